@@ -4,7 +4,12 @@
 
 #include "core/allocation_tracker.h"
 
+#include <execinfo.h>
+
+#include <fstream>
+
 #include "absl/random/random.h"
+#include "absl/strings/str_cat.h"
 #include "base/logging.h"
 #include "util/fibers/stacktrace.h"
 
@@ -48,32 +53,133 @@ absl::Span<const AllocationTracker::TrackingInfo> AllocationTracker::GetRanges()
   return absl::MakeConstSpan(tracking_);
 }
 
-void AllocationTracker::ProcessNew(void* ptr, size_t size) {
-  if (tracking_.empty()) {
-    return;
-  }
+void AllocationTracker::StartProfile(size_t sample_bytes) {
+  DCHECK_GT(sample_bytes, 0u);
+
+  // The first call of backtrace loads the unwinder, which allocates.
+  inside_tracker_ = true;
+  void* frame;
+  backtrace(&frame, 1);
+
+  live_.clear();
+  stacks_.clear();
+  sample_bytes_ = profile_period_ = sample_bytes;
+  bytes_until_sample_ = absl::Exponential<double>(g_bitgen, 1.0 / sample_bytes);
+  inside_tracker_ = false;
+}
 
-  thread_local bool inside_process_new = false;
-  if (inside_process_new) {
+void AllocationTracker::StopProfile() {
+  sample_bytes_ = 0;
+}
+
+AllocationTracker::HeapProfile AllocationTracker::GetProfile() {
+  // Copying allocates, and the stacks must not change while they are iterated.
+  inside_tracker_ = true;
+  HeapProfile profile;
+  profile.sample_bytes = profile_period_;
+  profile.stacks.insert(stacks_.begin(), stacks_.end());
+  inside_tracker_ = false;
+  return profile;
+}
+
+void AllocationTracker::ProcessNew(void* ptr, size_t size) {
+  if ((tracking_.empty() && sample_bytes_ == 0) || inside_tracker_) {
     return;
   }
 
   // Prevent endless recursion, in case logging allocates memory
-  inside_process_new = true;
-  double random = absl::Uniform(g_bitgen, 0.0, 1.0);
-  for (const auto& band : tracking_) {
-    if (random >= band.sample_odds || size > band.upper_bound || size < band.lower_bound) {
-      continue;
+  inside_tracker_ = true;
+  if (!tracking_.empty()) {
+    double random = absl::Uniform(g_bitgen, 0.0, 1.0);
+    for (const auto& band : tracking_) {
+      if (random >= band.sample_odds || size > band.upper_bound || size < band.lower_bound) {
+        continue;
+      }
+
+      LOG(INFO) << "Allocating " << size << " bytes (" << ptr
+                << "). Stack: " << util::fb2::GetStacktrace();
     }
+  }
 
-    LOG(INFO) << "Allocating " << size << " bytes (" << ptr
-              << "). Stack: " << util::fb2::GetStacktrace();
+  if (sample_bytes_ > 0 && ptr != nullptr) {
+    bytes_until_sample_ -= size;
+    if (bytes_until_sample_ < 0) {
+      SampleAllocation(ptr, size);
+      bytes_until_sample_ = absl::Exponential<double>(g_bitgen, 1.0 / sample_bytes_);
+    }
   }
-  inside_process_new = false;
+  inside_tracker_ = false;
 }
 
 void AllocationTracker::ProcessDelete(void* ptr) {
-  // We currently do not handle delete.
+  // Allocations that were sampled by other threads are missed, but those are rare as most of the
+  // data is owned by a single thread.
+  if (live_.empty() || inside_tracker_) {
+    return;
+  }
+
+  auto it = live_.find(ptr);
+  if (it == live_.end()) {
+    return;
+  }
+
+  it->second.stats->live_count--;
+  it->second.stats->live_bytes -= it->second.size;
+  live_.erase(it);
+}
+
+ABSL_ATTRIBUTE_NOINLINE void AllocationTracker::SampleAllocation(void* ptr, size_t size) {
+  // Skip the frames of the tracker and of operator new.
+  constexpr int kSkipFrames = 3;
+  void* frames[kMaxDepth + kSkipFrames];
+  int depth = std::max(backtrace(frames, std::size(frames)) - kSkipFrames, 0);
+
+  void** stack = frames + kSkipFrames;
+  StackStats& stats = stacks_[std::vector<void*>(stack, stack + depth)];
+  stats.alloc_count++;
+  stats.alloc_bytes += size;
+  stats.live_count++;
+  stats.live_bytes += size;
+  live_[ptr] = {size, &stats};
+}
+
+void AllocationTracker::HeapProfile::Merge(const HeapProfile& other) {
+  sample_bytes = std::max(sample_bytes, other.sample_bytes);
+  for (const auto& [stack, other_stats] : other.stacks) {
+    StackStats& stats = stacks[stack];
+    stats.alloc_count += other_stats.alloc_count;
+    stats.alloc_bytes += other_stats.alloc_bytes;
+    stats.live_count += other_stats.live_count;
+    stats.live_bytes += other_stats.live_bytes;
+  }
+}
+
+std::string AllocationTracker::HeapProfile::ToPprof() const {
+  StackStats total;
+  std::string body;
+  for (const auto& [stack, stats] : stacks) {
+    total.alloc_count += stats.alloc_count;
+    total.alloc_bytes += stats.alloc_bytes;
+    total.live_count += stats.live_count;
+    total.live_bytes += stats.live_bytes;
+
+    absl::StrAppend(&body, stats.live_count, ": ", stats.live_bytes, " [", stats.alloc_count,
+                    ": ", stats.alloc_bytes, "] @");
+    for (void* pc : stack)
+      absl::StrAppend(&body, " 0x", absl::Hex(reinterpret_cast<uintptr_t>(pc)));
+    body += '\n';
+  }
+
+  std::string out =
+      absl::StrCat("heap profile: ", total.live_count, ": ", total.live_bytes, " [",
+                   total.alloc_count, ": ", total.alloc_bytes, "] @ heap_v2/", sample_bytes, "\n");
+  out += body;
+
+  // The memory mappings that pprof needs to symbolize the addresses.
+  out += "\nMAPPED_LIBRARIES:\n";
+  std::ifstream maps("/proc/self/maps");
+  out.append(std::istreambuf_iterator<char>(maps), std::istreambuf_iterator<char>());
+  return out;
 }
 
 }  // namespace dfly
@@ -3,10 +3,14 @@
 //
 #pragma once
 
+#include <absl/container/flat_hash_map.h>
 #include <absl/container/inlined_vector.h>
+#include <absl/container/node_hash_map.h>
 #include <mimalloc.h>
 
 #include <cstddef>
+#include <string>
+#include <vector>
 
 namespace dfly {
 
@@ -14,6 +18,10 @@ namespace dfly {
 // the stack trace of the memory allocation, if matched by size & sampling criteria.
 // Supports up to 4 different bands in parallel.
 //
+// It also works as a sampling heap profiler: on average one allocation per sample_bytes allocated
+// bytes is sampled with its call stack and remembered until it is freed, so that the bytes that
+// are live and those that were allocated in total can be reported per call stack.
+//
 // Thread-local. Must be configured in all relevant threads separately.
 //
 // #define INJECT_ALLOCATION_TRACKER before #include exactly once to override new/delete
@@ -25,6 +33,32 @@ class AllocationTracker {
     double sample_odds = 0.0;
   };
 
+  static constexpr unsigned kMaxDepth = 32;
+
+  // Sampled allocations that share a call stack.
+  struct StackStats {
+    uint64_t alloc_count = 0;
+    uint64_t alloc_bytes = 0;
+    uint64_t live_count = 0;
+    uint64_t live_bytes = 0;
+  };
+
+  struct HeapProfile {
+    size_t sample_bytes = 0;
+    absl::flat_hash_map<std::vector<void*>, StackStats> stacks;
+
+    void Merge(const HeapProfile& other);
+
+    // Serializes the profile in the legacy gperftools heap profile format, which is understood
+    // by pprof. The counts are not scaled, pprof does it based on sample_bytes.
+    std::string ToPprof() const;
+  };
+
+  // Frees that happen while the members are destroyed, or later on thread exit, are not tracked.
+  ~AllocationTracker() {
+    inside_tracker_ = true;
+  }
+
   // Returns a thread-local reference.
   static AllocationTracker& Get();
 
@@ -40,11 +74,42 @@ class AllocationTracker {
 
   absl::Span<const TrackingInfo> GetRanges() const;
 
+  // Drops the previous samples and starts sampling allocations with the given average distance
+  // in bytes.
+  void StartProfile(size_t sample_bytes);
+
+  // Stops sampling new allocations. The samples are kept and their frees are still tracked.
+  void StopProfile();
+
+  size_t profile_sample_bytes() const {
+    return sample_bytes_;
+  }
+
+  HeapProfile GetProfile();
+
   void ProcessNew(void* ptr, size_t size);
   void ProcessDelete(void* ptr);
 
  private:
+  struct LiveAllocation {
+    size_t size;
+    StackStats* stats;
+  };
+
+  void SampleAllocation(void* ptr, size_t size);
+
   absl::InlinedVector<TrackingInfo, 4> tracking_;
+
+  // Set while the tracker itself allocates, which must not be tracked.
+  bool inside_tracker_ = false;
+
+  size_t sample_bytes_ = 0;
+  size_t profile_period_ = 0;
+  int64_t bytes_until_sample_ = 0;
+
+  // Node based, so that live allocations can point to the stats of their stack.
+  absl::node_hash_map<std::vector<void*>, StackStats> stacks_;
+  absl::flat_hash_map<void*, LiveAllocation> live_;
 };
 
 }  // namespace dfly
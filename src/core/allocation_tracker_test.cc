@@ -0,0 +1,84 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/allocation_tracker.h"
+
+#include <absl/strings/str_cat.h>
+#include <gmock/gmock.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+using testing::HasSubstr;
+using testing::StartsWith;
+
+class AllocationTrackerTest : public ::testing::Test {
+ protected:
+  void TearDown() override {
+    tracker_.StopProfile();
+  }
+
+  static void* FakePtr(size_t i) {
+    return reinterpret_cast<void*>(0x1000 + i * 16);
+  }
+
+  AllocationTracker::StackStats Total() {
+    AllocationTracker::StackStats total;
+    for (const auto& [stack, stats] : tracker_.GetProfile().stacks) {
+      total.alloc_count += stats.alloc_count;
+      total.alloc_bytes += stats.alloc_bytes;
+      total.live_count += stats.live_count;
+      total.live_bytes += stats.live_bytes;
+    }
+    return total;
+  }
+
+  AllocationTracker& tracker_ = AllocationTracker::Get();
+};
+
+TEST_F(AllocationTrackerTest, HeapProfile) {
+  constexpr size_t kNumAllocs = 10000;
+  tracker_.StartProfile(1024);
+
+  // On average every other allocation of half the sample distance is sampled.
+  for (size_t i = 0; i < kNumAllocs; ++i)
+    tracker_.ProcessNew(FakePtr(i), 512);
+
+  auto total = Total();
+  EXPECT_GT(total.alloc_count, kNumAllocs / 3);
+  EXPECT_LT(total.alloc_count, kNumAllocs * 2 / 3);
+  EXPECT_EQ(total.alloc_bytes, total.alloc_count * 512);
+  EXPECT_EQ(total.live_count, total.alloc_count);
+
+  for (size_t i = 0; i < kNumAllocs / 2; ++i)
+    tracker_.ProcessDelete(FakePtr(i));
+  uint64_t live_count = Total().live_count;
+  EXPECT_LT(live_count, total.alloc_count);
+  EXPECT_GT(live_count, 0u);
+
+  // Frees of sampled allocations are still tracked once sampling stopped.
+  tracker_.StopProfile();
+  for (size_t i = kNumAllocs; i < 2 * kNumAllocs; ++i)
+    tracker_.ProcessNew(FakePtr(i), 512);
+  for (size_t i = kNumAllocs / 2; i < kNumAllocs; ++i)
+    tracker_.ProcessDelete(FakePtr(i));
+
+  auto after = Total();
+  EXPECT_EQ(after.alloc_count, total.alloc_count);
+  EXPECT_EQ(after.live_count, 0u);
+
+  string pprof = tracker_.GetProfile().ToPprof();
+  EXPECT_THAT(pprof, StartsWith(absl::StrCat("heap profile: 0: 0 [", total.alloc_count, ": ",
+                                             total.alloc_bytes, "] @ heap_v2/1024\n")));
+  EXPECT_THAT(pprof, HasSubstr("\nMAPPED_LIBRARIES:\n"));
+
+  // Starting again drops the previous samples.
+  tracker_.StartProfile(1024);
+  EXPECT_EQ(Total().alloc_count, 0u);
+}
+
+}  // namespace dfly
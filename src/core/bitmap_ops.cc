@@ -0,0 +1,344 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/bitmap_ops.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <absl/numeric/bits.h>
+
+#include <algorithm>
+#include <cstring>
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+// Size of the destination blocks CombineBitmaps applies all sources to, small enough to stay in
+// L1 while the sources are streamed over it.
+constexpr size_t kCombineBlock = 4096;
+
+uint64_t LoadWord(const uint8_t* p) {
+  uint64_t word;
+  memcpy(&word, p, sizeof(word));
+  return word;
+}
+
+void StoreWord(uint8_t* p, uint64_t word) {
+  memcpy(p, &word, sizeof(word));
+}
+
+template <BitwiseOp op, typename T> T Apply(T a, T b) {
+  if constexpr (op == BitwiseOp::kAnd)
+    return a & b;
+  else if constexpr (op == BitwiseOp::kOr)
+    return a | b;
+  else
+    return a ^ b;
+}
+
+size_t CountScalar(const uint8_t* data, size_t len) {
+  size_t count = 0, i = 0;
+  for (; i + 8 <= len; i += 8)
+    count += absl::popcount(LoadWord(data + i));
+  for (; i < len; i++)
+    count += absl::popcount(data[i]);
+  return count;
+}
+
+template <BitwiseOp op> void ApplyScalar(uint8_t* dest, const uint8_t* src, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+    StoreWord(dest + i, Apply<op>(LoadWord(dest + i), LoadWord(src + i)));
+  for (; i < len; i++)
+    dest[i] = Apply<op>(dest[i], src[i]);
+}
+
+void NegateScalar(uint8_t* data, size_t len) {
+  size_t i = 0;
+  for (; i + 8 <= len; i += 8)
+    StoreWord(data + i, ~LoadWord(data + i));
+  for (; i < len; i++)
+    data[i] = ~data[i];
+}
+
+size_t FindNotScalar(const uint8_t* data, size_t len, uint8_t skip) {
+  const uint64_t skip_word = uint64_t(skip) * 0x0101010101010101ULL;
+  size_t i = 0;
+  while (i + 8 <= len && LoadWord(data + i) == skip_word)
+    i += 8;
+  while (i < len && data[i] == skip)
+    i++;
+  return i;
+}
+
+#if defined(__x86_64__)
+
+// Counts bits of every byte with two lookups of 4 bits, then sums the bytes of every 64 bit lane.
+__attribute__((target("avx2,popcnt"))) size_t CountAvx2(const uint8_t* data, size_t len) {
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4, 0, 1, 1,
+                                          2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_mask = _mm256_set1_epi8(0x0f);
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i cnt =
+        _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    acc = _mm256_add_epi64(acc, _mm256_sad_epu8(cnt, _mm256_setzero_si256()));
+  }
+  size_t count = _mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1) +
+                 _mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3);
+  return count + CountScalar(data + i, len - i);
+}
+
+template <BitwiseOp op>
+__attribute__((target("avx2"))) void ApplyAvx2(uint8_t* dest, const uint8_t* src, size_t len) {
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dest + i));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    __m256i res;
+    if constexpr (op == BitwiseOp::kAnd)
+      res = _mm256_and_si256(a, b);
+    else if constexpr (op == BitwiseOp::kOr)
+      res = _mm256_or_si256(a, b);
+    else
+      res = _mm256_xor_si256(a, b);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dest + i), res);
+  }
+  ApplyScalar<op>(dest + i, src + i, len - i);
+}
+
+__attribute__((target("avx2"))) void NegateAvx2(uint8_t* data, size_t len) {
+  const __m256i ones = _mm256_set1_epi8(-1);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i* p = reinterpret_cast<__m256i*>(data + i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), ones));
+  }
+  NegateScalar(data + i, len - i);
+}
+
+__attribute__((target("avx2"))) size_t FindNotAvx2(const uint8_t* data, size_t len,
+                                                   uint8_t skip) {
+  const __m256i skip_v = _mm256_set1_epi8(skip);
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+    uint32_t mask = ~uint32_t(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, skip_v)));
+    if (mask)
+      return i + __builtin_ctz(mask);
+  }
+  return i + FindNotScalar(data + i, len - i, skip);
+}
+
+__attribute__((target("avx512f,avx512vpopcntdq"))) size_t CountAvx512(const uint8_t* data,
+                                                                      size_t len) {
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i v = _mm512_loadu_si512(data + i);
+    acc = _mm512_add_epi64(acc, _mm512_popcnt_epi64(v));
+  }
+  uint64_t lanes[8];
+  _mm512_storeu_si512(lanes, acc);
+  size_t count = 0;
+  for (uint64_t lane : lanes)
+    count += lane;
+  return count + CountScalar(data + i, len - i);
+}
+
+template <BitwiseOp op>
+__attribute__((target("avx512f"))) void ApplyAvx512(uint8_t* dest, const uint8_t* src,
+                                                    size_t len) {
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    __m512i a = _mm512_loadu_si512(dest + i);
+    __m512i b = _mm512_loadu_si512(src + i);
+    __m512i res;
+    if constexpr (op == BitwiseOp::kAnd)
+      res = _mm512_and_si512(a, b);
+    else if constexpr (op == BitwiseOp::kOr)
+      res = _mm512_or_si512(a, b);
+    else
+      res = _mm512_xor_si512(a, b);
+    _mm512_storeu_si512(dest + i, res);
+  }
+  ApplyScalar<op>(dest + i, src + i, len - i);
+}
+
+__attribute__((target("avx512f"))) void NegateAvx512(uint8_t* data, size_t len) {
+  const __m512i ones = _mm512_set1_epi64(-1);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64)
+    _mm512_storeu_si512(data + i, _mm512_xor_si512(_mm512_loadu_si512(data + i), ones));
+  NegateScalar(data + i, len - i);
+}
+
+__attribute__((target("avx512f,avx512bw"))) size_t FindNotAvx512(const uint8_t* data,
+                                                                 size_t len, uint8_t skip) {
+  const __m512i skip_v = _mm512_set1_epi8(skip);
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    uint64_t mask = _mm512_cmpneq_epi8_mask(_mm512_loadu_si512(data + i), skip_v);
+    if (mask)
+      return i + __builtin_ctzll(mask);
+  }
+  return i + FindNotScalar(data + i, len - i, skip);
+}
+
+#elif defined(__aarch64__)
+
+size_t CountNeon(const uint8_t* data, size_t len) {
+  size_t count = 0, i = 0;
+  for (; i + 16 <= len; i += 16)
+    count += vaddvq_u8(vcntq_u8(vld1q_u8(data + i)));  // at most 128, fits into a byte
+  return count + CountScalar(data + i, len - i);
+}
+
+template <BitwiseOp op> void ApplyNeon(uint8_t* dest, const uint8_t* src, size_t len) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    uint8x16_t a = vld1q_u8(dest + i), b = vld1q_u8(src + i);
+    uint8x16_t res;
+    if constexpr (op == BitwiseOp::kAnd)
+      res = vandq_u8(a, b);
+    else if constexpr (op == BitwiseOp::kOr)
+      res = vorrq_u8(a, b);
+    else
+      res = veorq_u8(a, b);
+    vst1q_u8(dest + i, res);
+  }
+  ApplyScalar<op>(dest + i, src + i, len - i);
+}
+
+void NegateNeon(uint8_t* data, size_t len) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16)
+    vst1q_u8(data + i, vmvnq_u8(vld1q_u8(data + i)));
+  NegateScalar(data + i, len - i);
+}
+
+size_t FindNotNeon(const uint8_t* data, size_t len, uint8_t skip) {
+  const uint8x16_t skip_v = vdupq_n_u8(skip);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    if (vminvq_u8(vceqq_u8(vld1q_u8(data + i), skip_v)) != 0xff)
+      break;  // the scalar search below finds the byte within this block
+  }
+  return i + FindNotScalar(data + i, len - i, skip);
+}
+
+#endif
+
+using ApplyFn = void (*)(uint8_t* dest, const uint8_t* src, size_t len);
+
+struct Kernels {
+  const char* name;
+  size_t (*count)(const uint8_t* data, size_t len);
+  ApplyFn and_fn, or_fn, xor_fn;
+  void (*negate)(uint8_t* data, size_t len);
+  size_t (*find_not)(const uint8_t* data, size_t len, uint8_t skip);
+};
+
+Kernels SelectKernels() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+      __builtin_cpu_supports("avx512vpopcntdq")) {
+    return {"avx512",
+            CountAvx512,
+            ApplyAvx512<BitwiseOp::kAnd>,
+            ApplyAvx512<BitwiseOp::kOr>,
+            ApplyAvx512<BitwiseOp::kXor>,
+            NegateAvx512,
+            FindNotAvx512};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return {"avx2",
+            CountAvx2,
+            ApplyAvx2<BitwiseOp::kAnd>,
+            ApplyAvx2<BitwiseOp::kOr>,
+            ApplyAvx2<BitwiseOp::kXor>,
+            NegateAvx2,
+            FindNotAvx2};
+  }
+#elif defined(__aarch64__)
+  return {"neon",
+          CountNeon,
+          ApplyNeon<BitwiseOp::kAnd>,
+          ApplyNeon<BitwiseOp::kOr>,
+          ApplyNeon<BitwiseOp::kXor>,
+          NegateNeon,
+          FindNotNeon};
+#endif
+  return {"scalar",
+          CountScalar,
+          ApplyScalar<BitwiseOp::kAnd>,
+          ApplyScalar<BitwiseOp::kOr>,
+          ApplyScalar<BitwiseOp::kXor>,
+          NegateScalar,
+          FindNotScalar};
+}
+
+const Kernels kKernels = SelectKernels();
+
+}  // namespace
+
+size_t CountSetBits(const uint8_t* data, size_t len) {
+  return kKernels.count(data, len);
+}
+
+void CombineBitmaps(BitwiseOp op, absl::Span<const string_view> srcs, uint8_t* dest, size_t len) {
+  ApplyFn apply = op == BitwiseOp::kAnd  ? kKernels.and_fn
+                  : op == BitwiseOp::kOr ? kKernels.or_fn
+                                         : kKernels.xor_fn;
+
+  // Number of bytes src has in the block [offset, offset + n)
+  auto overlap = [](string_view src, size_t offset, size_t n) {
+    return src.size() > offset ? min(n, src.size() - offset) : 0;
+  };
+
+  for (size_t offset = 0; offset < len; offset += kCombineBlock) {
+    size_t n = min(kCombineBlock, len - offset);
+    uint8_t* block = dest + offset;
+
+    size_t first = overlap(srcs[0], offset, n);
+    if (first)
+      memcpy(block, srcs[0].data() + offset, first);
+    memset(block + first, 0, n - first);
+
+    for (size_t i = 1; i < srcs.size(); i++) {
+      size_t common = overlap(srcs[i], offset, n);
+      if (common)
+        apply(block, reinterpret_cast<const uint8_t*>(srcs[i].data()) + offset, common);
+
+      // The zero padding of shorter sources clears the rest of the block for AND
+      if (op == BitwiseOp::kAnd)
+        memset(block + common, 0, n - common);
+    }
+  }
+}
+
+void NegateBitmap(uint8_t* data, size_t len) {
+  kKernels.negate(data, len);
+}
+
+size_t FindFirstByteNot(const uint8_t* data, size_t len, uint8_t skip) {
+  return kKernels.find_not(data, len, skip);
+}
+
+const char* BitmapKernelsName() {
+  return kKernels.name;
+}
+
+}  // namespace dfly
@@ -0,0 +1,39 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+#include "absl/types/span.h"
+
+namespace dfly {
+
+// Kernels over byte strings used by the bitmap commands. The implementation (avx512, avx2, neon
+// or scalar) is selected once at startup according to the cpu features.
+
+enum class BitwiseOp { kAnd, kOr, kXor };
+
+// Returns the number of set bits in data[0, len).
+size_t CountSetBits(const uint8_t* data, size_t len);
+
+// Combines srcs with op into dest[0, len). Sources shorter than len are treated as padded with
+// zero bytes. The destination is filled block by block, so that it is written only once no matter
+// how many sources there are. srcs must not be empty.
+void CombineBitmaps(BitwiseOp op, absl::Span<const std::string_view> srcs, uint8_t* dest,
+                    size_t len);
+
+// Flips all bits of data[0, len).
+void NegateBitmap(uint8_t* data, size_t len);
+
+// Returns the index of the first byte in data[0, len) that is not equal to skip, or len if there
+// is none.
+size_t FindFirstByteNot(const uint8_t* data, size_t len, uint8_t skip);
+
+// Name of the selected implementation.
+const char* BitmapKernelsName();
+
+}  // namespace dfly
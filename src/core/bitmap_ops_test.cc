@@ -0,0 +1,140 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/bitmap_ops.h"
+
+#include <absl/numeric/bits.h>
+
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+class BitmapOpsTest : public ::testing::Test {
+ protected:
+  string RandomBytes(size_t len) {
+    string res(len, 0);
+    for (auto& c : res)
+      c = generator_() & 0xff;
+    return res;
+  }
+
+  mt19937 generator_{42};
+};
+
+TEST_F(BitmapOpsTest, CountSetBits) {
+  LOG(INFO) << "Kernels: " << BitmapKernelsName();
+
+  string data = RandomBytes(1000);
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+  for (size_t start : {0, 1, 7, 31, 64}) {
+    for (size_t len : {0, 1, 9, 33, 63, 64, 65, 200, 900}) {
+      size_t expected = 0;
+      for (size_t i = start; i < start + len; i++)
+        expected += absl::popcount(bytes[i]);
+      EXPECT_EQ(CountSetBits(bytes + start, len), expected) << start << " " << len;
+    }
+  }
+}
+
+TEST_F(BitmapOpsTest, CombineBitmaps) {
+  // Lengths around the vector widths and the combine block size
+  vector<string> srcs;
+  for (size_t len : {0, 5, 100, 4095, 4097, 9000})
+    srcs.push_back(RandomBytes(len));
+  vector<string_view> views(srcs.begin(), srcs.end());
+  size_t len = 9000;
+
+  for (BitwiseOp op : {BitwiseOp::kAnd, BitwiseOp::kOr, BitwiseOp::kXor}) {
+    for (size_t num = 1; num <= views.size(); num++) {
+      // Rotate so that sources of every length come first
+      for (size_t first = 0; first < views.size(); first++) {
+        vector<string_view> args;
+        for (size_t i = 0; i < num; i++)
+          args.push_back(views[(first + i) % views.size()]);
+
+        string expected(len, 0);
+        for (size_t i = 0; i < len; i++) {
+          auto byte_at = [&](string_view s) -> uint8_t { return i < s.size() ? s[i] : 0; };
+          uint8_t res = byte_at(args[0]);
+          for (size_t j = 1; j < args.size(); j++) {
+            uint8_t b = byte_at(args[j]);
+            res = op == BitwiseOp::kAnd ? res & b : op == BitwiseOp::kOr ? res | b : res ^ b;
+          }
+          expected[i] = res;
+        }
+
+        string dest(len, 'x');
+        CombineBitmaps(op, args, reinterpret_cast<uint8_t*>(dest.data()), len);
+        EXPECT_EQ(dest, expected) << int(op) << " " << num << " " << first;
+      }
+    }
+  }
+}
+
+TEST_F(BitmapOpsTest, NegateBitmap) {
+  string data = RandomBytes(333);
+  string expected = data;
+  for (auto& c : expected)
+    c = ~c;
+  NegateBitmap(reinterpret_cast<uint8_t*>(data.data()), data.size());
+  EXPECT_EQ(data, expected);
+}
+
+TEST_F(BitmapOpsTest, FindFirstByteNot) {
+  for (uint8_t skip : {0, 0xff}) {
+    string data(500, skip);
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(data.data());
+    EXPECT_EQ(FindFirstByteNot(bytes, data.size(), skip), data.size());
+    for (size_t pos : {0, 1, 31, 32, 63, 64, 100, 499}) {
+      data[pos] = skip ^ 0x10;
+      for (size_t start : {0, 1, 17}) {
+        if (start > pos)
+          continue;
+        EXPECT_EQ(FindFirstByteNot(bytes + start, data.size() - start, skip), pos - start);
+      }
+      data[pos] = skip;
+    }
+  }
+}
+
+static void BM_CountSetBits(benchmark::State& state) {
+  string data(state.range(0), 0x5a);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        CountSetBits(reinterpret_cast<const uint8_t*>(data.data()), data.size()));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_CountSetBits)->Arg(4096)->Arg(1 << 22);
+
+static void BM_CombineBitmaps(benchmark::State& state) {
+  size_t len = 1 << 22;
+  vector<string> srcs(state.range(0), string(len, 0x5a));
+  vector<string_view> views(srcs.begin(), srcs.end());
+  string dest(len, 0);
+  for (auto _ : state) {
+    CombineBitmaps(BitwiseOp::kOr, views, reinterpret_cast<uint8_t*>(dest.data()), len);
+    benchmark::DoNotOptimize(dest.data());
+  }
+  state.SetBytesProcessed(state.iterations() * len * srcs.size());
+}
+BENCHMARK(BM_CombineBitmaps)->Arg(2)->Arg(8);
+
+static void BM_FindFirstByteNot(benchmark::State& state) {
+  string data(1 << 22, 0);
+  data.back() = 1;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(
+        FindFirstByteNot(reinterpret_cast<const uint8_t*>(data.data()), data.size(), 0));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_FindFirstByteNot);
+
+}  // namespace dfly
@@ -34,21 +34,34 @@ inline uint64_t BitIndex(uint64_t low, uint64_t hi, unsigned i, uint64_t mask) {
 constexpr double kDenom = M_LN2 * M_LN2;
 constexpr double kSBFErrorFactor = 0.5;
 
+// Blocked filters need about that many more bits per entry to keep the false positive rate
+constexpr double kBlockedBPEFactor = 1.2;
+
+constexpr unsigned kBlockBits = 512;
+
+// Number of items SBF hashes and prefetches ahead in batched operations
+constexpr size_t kPrefetchBatch = 16;
+
 inline double BPE(double fp_prob) {
   return -log(fp_prob) / kDenom;
 }
 
+inline double FilterBPE(double fp_prob, bool blocked) {
+  return blocked ? BPE(fp_prob) * kBlockedBPEFactor : BPE(fp_prob);
+}
+
 }  // namespace
 
 Bloom::~Bloom() {
   CHECK(bf_ == nullptr);
 }
 
-Bloom::Bloom(Bloom&& o) : hash_cnt_(o.hash_cnt_), bit_log_(o.bit_log_), bf_(o.bf_) {
+Bloom::Bloom(Bloom&& o)
+    : hash_cnt_(o.hash_cnt_), bit_log_(o.bit_log_), blocked_(o.blocked_), bf_(o.bf_) {
   o.bf_ = nullptr;
 }
 
-void Bloom::Init(uint64_t entries, double fp_prob, PMR_NS::memory_resource* heap) {
+void Bloom::Init(uint64_t entries, double fp_prob, PMR_NS::memory_resource* heap, bool blocked) {
   CHECK(bf_ == nullptr);
   CHECK(fp_prob > 0 && fp_prob < 1);
 
@@ -58,28 +71,31 @@ void Bloom::Init(uint64_t entries, double fp_prob, PMR_NS::memory_resource* heap
 
   hash_cnt_ = ceil(M_LN2 * bpe);
 
-  uint64_t bits = uint64_t(ceil(entries * bpe));
-  if (bits < 512) {
-    bits = 512;
+  uint64_t bits = uint64_t(ceil(entries * FilterBPE(fp_prob, blocked)));
+  if (bits < kBlockBits) {
+    bits = kBlockBits;
   }
   bits = absl::bit_ceil(bits);  // make it power of 2.
 
   uint64_t length = bits / 8;
-  bf_ = (uint8_t*)heap->allocate(length);
+  bf_ = (uint8_t*)heap->allocate(length, kAlignment);
   memset(bf_, 0, length);
   bit_log_ = absl::countr_zero(bits);
+  blocked_ = blocked;
 }
 
-void Bloom::Init(uint8_t* blob, size_t len, unsigned hash_cnt) {
+void Bloom::Init(uint8_t* blob, size_t len, unsigned hash_cnt, bool blocked) {
   DCHECK_EQ(len * 8, absl::bit_ceil(len * 8));  // must be power of two.
+  DCHECK(!blocked || len * 8 >= kBlockBits);
   CHECK(bf_ == nullptr);
   hash_cnt_ = hash_cnt;
   bf_ = blob;
   bit_log_ = absl::countr_zero(len * 8);
+  blocked_ = blocked;
 }
 
 void Bloom::Destroy(PMR_NS::memory_resource* resource) {
-  resource->deallocate(CHECK_NOTNULL(bf_), bitlen() / 8);
+  resource->deallocate(CHECK_NOTNULL(bf_), bitlen() / 8, kAlignment);
   bf_ = nullptr;
 }
 
@@ -91,6 +107,17 @@ bool Bloom::Exists(std::string_view str) const {
 }
 
 bool Bloom::Exists(const uint64_t fp[2]) const {
+  if (blocked_) {
+    uint64_t mask[8];
+    const uint64_t* block = BlockMask(fp, mask);
+
+    // Written without early exits, so that the compiler vectorizes it.
+    uint64_t missing = 0;
+    for (unsigned i = 0; i < 8; ++i)
+      missing |= mask[i] & ~block[i];
+    return missing == 0;
+  }
+
   uint64_t mask = GetMask(bit_log_);
   for (unsigned i = 0; i < hash_cnt_; ++i) {
     uint64_t index = BitIndex(fp[0], fp[1], i, mask);
@@ -107,6 +134,18 @@ bool Bloom::Add(std::string_view str) {
 }
 
 bool Bloom::Add(const uint64_t fp[2]) {
+  if (blocked_) {
+    uint64_t mask[8];
+    uint64_t* block = BlockMask(fp, mask);
+
+    uint64_t missing = 0;
+    for (unsigned i = 0; i < 8; ++i) {
+      missing |= mask[i] & ~block[i];
+      block[i] |= mask[i];
+    }
+    return missing != 0;
+  }
+
   uint64_t mask = GetMask(bit_log_);
 
   unsigned changes = 0;
@@ -118,13 +157,43 @@ bool Bloom::Add(const uint64_t fp[2]) {
   return changes != 0;
 }
 
+void Bloom::Prefetch(const uint64_t fp[2]) const {
+  if (blocked_) {
+    uint64_t block_mask = GetMask(bit_log_ - absl::countr_zero(kBlockBits));
+    __builtin_prefetch(bf_ + (fp[1] & block_mask) * (kBlockBits / 8));
+    return;
+  }
+
+  uint64_t mask = GetMask(bit_log_);
+  for (unsigned i = 0; i < hash_cnt_; ++i) {
+    __builtin_prefetch(bf_ + BitIndex(fp[0], fp[1], i, mask) / 8);
+  }
+}
+
 size_t Bloom::Capacity(double fp_prob) const {
   if (fp_prob > 0.5)
     fp_prob = 0.5;
-  double bpe = BPE(fp_prob);
+  double bpe = FilterBPE(fp_prob, blocked_);
   return floor(bitlen() / bpe);
 }
 
+// The block is selected by the high part of the fingerprint. The bits within it are the top bits
+// of a sequence generated from the low part, since double hashing in such a small range yields
+// too few distinct patterns.
+uint64_t* Bloom::BlockMask(const uint64_t fp[2], uint64_t mask[8]) const {
+  uint64_t block_mask = GetMask(bit_log_ - absl::countr_zero(kBlockBits));
+  uint64_t* block = reinterpret_cast<uint64_t*>(bf_ + (fp[1] & block_mask) * (kBlockBits / 8));
+
+  uint64_t h = fp[0];
+  memset(mask, 0, 8 * sizeof(uint64_t));
+  for (unsigned i = 0; i < hash_cnt_; ++i) {
+    h = h * 0x9E3779B97F4A7C15ULL + 0x632BE59BD9B4E019ULL;
+    uint32_t bit = h >> 55;  // top 9 bits, as kBlockBits is 512
+    mask[bit / 64] |= 1ULL << (bit % 64);
+  }
+  return block;
+}
+
 inline bool Bloom::IsSet(size_t bit_idx) const {
   uint64_t byte_idx = bit_idx / 8;
   bit_idx %= 8;  // index within the byte
@@ -144,20 +213,25 @@ inline bool Bloom::Set(size_t bit_idx) {
 ///////////////////////////////////////////////////////////////////////////////
 // SBF implementation
 ///////////////////////////////////////////////////////////////////////////////
-SBF::SBF(uint64_t initial_capacity, double fp_prob, double grow_factor, PMR_NS::memory_resource* mr)
-    : filters_(1, mr), grow_factor_(grow_factor), fp_prob_(fp_prob * kSBFErrorFactor) {
-  filters_.front().Init(initial_capacity, fp_prob_, mr);
+SBF::SBF(uint64_t initial_capacity, double fp_prob, double grow_factor, PMR_NS::memory_resource* mr,
+         bool blocked)
+    : filters_(1, mr),
+      grow_factor_(grow_factor),
+      fp_prob_(fp_prob * kSBFErrorFactor),
+      blocked_(blocked) {
+  filters_.front().Init(initial_capacity, fp_prob_, mr, blocked_);
   max_capacity_ = filters_.front().Capacity(fp_prob_);
 }
 
 SBF::SBF(double grow_factor, double fp_prob, size_t max_capacity, size_t prev_size,
-         size_t current_size, PMR_NS::memory_resource* mr)
+         size_t current_size, PMR_NS::memory_resource* mr, bool blocked)
     : filters_(mr),
       grow_factor_(grow_factor),
       fp_prob_(fp_prob),
       prev_size_(prev_size),
       current_size_(current_size),
-      max_capacity_(max_capacity) {
+      max_capacity_(max_capacity),
+      blocked_(blocked) {
 }
 
 SBF::~SBF() {
@@ -173,22 +247,26 @@ SBF& SBF::operator=(SBF&& src) {
   fp_prob_ = src.fp_prob_;
   current_size_ = src.current_size_;
   max_capacity_ = src.max_capacity_;
+  blocked_ = src.blocked_;
 
   return *this;
 }
 
 void SBF::AddFilter(const std::string& blob, unsigned hash_cnt) {
   PMR_NS::memory_resource* mr = filters_.get_allocator().resource();
-  uint8_t* ptr = (uint8_t*)mr->allocate(blob.size(), 1);
+  uint8_t* ptr = (uint8_t*)mr->allocate(blob.size(), Bloom::kAlignment);
   memcpy(ptr, blob.data(), blob.size());
-  filters_.emplace_back().Init(ptr, blob.size(), hash_cnt);
+  filters_.emplace_back().Init(ptr, blob.size(), hash_cnt, blocked_);
 }
 
 bool SBF::Add(std::string_view str) {
-  DCHECK_LT(current_size_, max_capacity_);
-
   XXH128_hash_t hash = Hash(str);
   uint64_t fp[2] = {hash.low64, hash.high64};
+  return Add(fp);
+}
+
+bool SBF::Add(const uint64_t fp[2]) {
+  DCHECK_LT(current_size_, max_capacity_);
 
   auto exists = [fp](const Bloom& b) { return b.Exists(fp); };
 
@@ -207,7 +285,7 @@ bool SBF::Add(std::string_view str) {
   if (current_size_ >= max_capacity_) {
     fp_prob_ *= kSBFErrorFactor;
     filters_.emplace_back().Init(max_capacity_ * grow_factor_, fp_prob_,
-                                 filters_.get_allocator().resource());
+                                 filters_.get_allocator().resource(), blocked_);
     current_size_ = 0;
     max_capacity_ = filters_.back().Capacity(fp_prob_);
   }
@@ -218,12 +296,42 @@ bool SBF::Add(std::string_view str) {
 bool SBF::Exists(std::string_view str) const {
   XXH128_hash_t hash = Hash(str);
   uint64_t fp[2] = {hash.low64, hash.high64};
+  return Exists(fp);
+}
 
+bool SBF::Exists(const uint64_t fp[2]) const {
   auto exists = [fp](const Bloom& b) { return b.Exists(fp); };
 
   return any_of(filters_.crbegin(), filters_.crend(), exists);
 }
 
+// Hashes items in batches of kPrefetchBatch and prefetches their memory in all filters, so that
+// the cache misses of a batch overlap. Items are still applied in order.
+template <typename F>
+void SBF::ForEachPrefetched(absl::Span<const string_view> items, F&& f) const {
+  uint64_t fps[kPrefetchBatch][2];
+  for (size_t start = 0; start < items.size(); start += kPrefetchBatch) {
+    size_t num = min(kPrefetchBatch, items.size() - start);
+    for (size_t i = 0; i < num; ++i) {
+      XXH128_hash_t hash = Hash(items[start + i]);
+      fps[i][0] = hash.low64;
+      fps[i][1] = hash.high64;
+      for (const Bloom& b : filters_)
+        b.Prefetch(fps[i]);
+    }
+    for (size_t i = 0; i < num; ++i)
+      f(start + i, fps[i]);
+  }
+}
+
+void SBF::Add(absl::Span<const string_view> items, bool* results) {
+  ForEachPrefetched(items, [&](size_t i, const uint64_t fp[2]) { results[i] = Add(fp); });
+}
+
+void SBF::Exists(absl::Span<const string_view> items, bool* results) const {
+  ForEachPrefetched(items, [&](size_t i, const uint64_t fp[2]) { results[i] = Exists(fp); });
+}
+
 size_t SBF::MallocUsed() const {
   size_t res = filters_.capacity() * sizeof(Bloom);
   for (const auto& b : filters_) {
@@ -8,11 +8,15 @@
 #include <string_view>
 #include <vector>
 
+#include "absl/types/span.h"
 #include "base/pmr/memory_resource.h"
 
 namespace dfly {
 
 /// Bloom filter based on the design of https://github.com/jvirkki/libbloom
+/// In blocked mode all bits of an item are set inside a single 64-byte block, so that a lookup
+/// touches one cache line instead of hash_cnt of them. This costs a slightly higher false positive
+/// rate for the same number of bits, which is compensated by allocating more bits per entry.
 class Bloom {
   Bloom(const Bloom&) = delete;
   Bloom& operator=(const Bloom&) = delete;
@@ -27,10 +31,11 @@ class Bloom {
   // entries - entries are silently rounded up to the minimum capacity.
   // fp_prob - False-positive probability of collision. Must be in (0, 1) range.
   // heap
-  void Init(uint64_t entries, double fp_prob, PMR_NS::memory_resource* resource);
+  void Init(uint64_t entries, double fp_prob, PMR_NS::memory_resource* resource,
+            bool blocked = false);
 
-  // Direct initializer. len*8 must be power of 2.
-  void Init(uint8_t* blob, size_t len, unsigned hash_cnt);
+  // Direct initializer. len*8 must be power of 2. blob must be allocated with kAlignment.
+  void Init(uint8_t* blob, size_t len, unsigned hash_cnt, bool blocked = false);
 
   // Destroys the object, must be called before destructing the object.
   // resource - resource with which the object was initialized.
@@ -49,6 +54,9 @@ class Bloom {
   bool Add(std::string_view str);
   bool Add(const uint64_t fp[2]);
 
+  // Prefetches the memory accessed by Exists and Add for the fingerprints
+  void Prefetch(const uint64_t fp[2]) const;
+
   size_t bitlen() const {
     return 1ULL << bit_log_;
   }
@@ -66,12 +74,23 @@ class Bloom {
     return hash_cnt_;
   }
 
+  bool blocked() const {
+    return blocked_;
+  }
+
+  // Alignment of the filter blob, so that blocks never cross cache lines
+  static constexpr size_t kAlignment = 64;
+
  private:
   bool IsSet(size_t index) const;
   bool Set(size_t index);  // return true if bit was set (i.e was 0 before)
 
+  // Returns the block of the item and fills its bits in mask
+  uint64_t* BlockMask(const uint64_t fp[2], uint64_t mask[8]) const;
+
   uint8_t hash_cnt_ = 0;
   uint8_t bit_log_ = 0;    // log of bit length of the filter. bit length is always power of 2.
+  bool blocked_ = false;
   uint8_t* bf_ = nullptr;  // pointer to the blob.
 };
 
@@ -87,12 +106,14 @@ class SBF {
   SBF(const SBF&) = delete;
 
  public:
-  SBF(uint64_t initial_capacity, double fp_prob, double grow_factor, PMR_NS::memory_resource* mr);
+  // blocked - whether filters use the blocked mode of Bloom
+  SBF(uint64_t initial_capacity, double fp_prob, double grow_factor, PMR_NS::memory_resource* mr,
+      bool blocked = false);
 
   // C'tor used for loading persisted filters into SBF.
   // Should be followed by AddFilter.
   SBF(double grow_factor, double fp_prob, size_t max_capacity, size_t prev_size,
-      size_t current_size, PMR_NS::memory_resource* mr);
+      size_t current_size, PMR_NS::memory_resource* mr, bool blocked = false);
   ~SBF();
 
   SBF& operator=(SBF&& src);
@@ -102,6 +123,11 @@ class SBF {
   bool Add(std::string_view str);
   bool Exists(std::string_view str) const;
 
+  // Batched versions of Add and Exists. Hash all items and prefetch the memory they access
+  // before probing the filters. results must have the size of items.
+  void Add(absl::Span<const std::string_view> items, bool* results);
+  void Exists(absl::Span<const std::string_view> items, bool* results) const;
+
   size_t current_size() const {
     return current_size_;
   }
@@ -136,9 +162,19 @@ class SBF {
     return max_capacity_;
   }
 
+  bool blocked() const {
+    return blocked_;
+  }
+
   size_t MallocUsed() const;
 
  private:
+  bool Add(const uint64_t fp[2]);
+  bool Exists(const uint64_t fp[2]) const;
+
+  template <typename F>
+  void ForEachPrefetched(absl::Span<const std::string_view> items, F&& f) const;
+
   // multiple filters from the smallest to the largest.
   std::vector<Bloom, PMR_NS::polymorphic_allocator<Bloom>> filters_;
   double grow_factor_;
@@ -146,6 +182,7 @@ class SBF {
   size_t prev_size_ = 0;
   size_t current_size_ = 0;
   size_t max_capacity_;
+  bool blocked_;
 };
 
 }  // namespace dfly
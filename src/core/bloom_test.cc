@@ -72,6 +72,31 @@ TEST_F(BloomTest, Extreme) {
   b2.Destroy(PMR_NS::get_default_resource());
 }
 
+TEST_F(BloomTest, Blocked) {
+  Bloom bloom;
+  bloom.Init(1000, 0.001, PMR_NS::get_default_resource(), true);
+  EXPECT_TRUE(bloom.blocked());
+  EXPECT_EQ(0u, reinterpret_cast<uintptr_t>(bloom.data().data()) % Bloom::kAlignment);
+
+  size_t max_capacity = bloom.Capacity(0.001);
+  for (unsigned i = 0; i < max_capacity; ++i) {
+    ASSERT_FALSE(bloom.Exists(absl::StrCat("item", i)));
+  }
+
+  unsigned collisions = 0;
+  for (unsigned i = 0; i < max_capacity; ++i) {
+    string item = absl::StrCat("item", i);
+    if (!bloom.Add(item)) {
+      ++collisions;
+    }
+    ASSERT_TRUE(bloom.Exists(item));
+  }
+
+  // Blocks fill unevenly, so allow a small number of false positives.
+  EXPECT_LE(collisions, 3) << max_capacity;
+  bloom.Destroy(PMR_NS::get_default_resource());
+}
+
 TEST_F(BloomTest, SBF) {
   SBF sbf(10, 0.001, 2, PMR_NS::get_default_resource());
 
@@ -88,10 +113,35 @@ TEST_F(BloomTest, SBF) {
   EXPECT_LE(collisions, kNumElems * 0.008);
 }
 
+TEST_F(BloomTest, SBFBatch) {
+  for (bool blocked : {false, true}) {
+    SBF sbf(10, 0.001, 2, PMR_NS::get_default_resource(), blocked);
+    vector<string> items;
+    for (unsigned i = 0; i < 1000; ++i) {
+      items.push_back(absl::StrCat("item", i));
+    }
+    vector<string_view> views(items.begin(), items.end());
+
+    // Make sure the filters grow in the middle of the batch.
+    unique_ptr<bool[]> results(new bool[views.size()]);
+    sbf.Add(views, results.get());
+    EXPECT_GT(sbf.num_filters(), 1u);
+    unsigned collisions = count(results.get(), results.get() + views.size(), false);
+    EXPECT_LE(collisions, 10u) << blocked;
+
+    sbf.Exists(views, results.get());
+    EXPECT_EQ(views.size(), count(results.get(), results.get() + views.size(), true));
+    for (const auto& item : items) {
+      EXPECT_TRUE(sbf.Exists(item));
+      EXPECT_FALSE(sbf.Add(item));
+    }
+  }
+}
+
 static void BM_BloomExist(benchmark::State& state) {
   constexpr size_t kCapacity = 1U << 22;
   Bloom bloom;
-  bloom.Init(kCapacity, 0.001, PMR_NS::get_default_resource());
+  bloom.Init(kCapacity, 0.001, PMR_NS::get_default_resource(), state.range(0));
   for (size_t i = 0; i < kCapacity * 0.8; ++i) {
     bloom.Add(absl::StrCat("val", i));
   }
@@ -105,6 +155,26 @@ static void BM_BloomExist(benchmark::State& state) {
   }
   bloom.Destroy(PMR_NS::get_default_resource());
 }
-BENCHMARK(BM_BloomExist);
+BENCHMARK(BM_BloomExist)->Arg(0)->Arg(1);
+
+static void BM_SBFExistsBatch(benchmark::State& state) {
+  constexpr size_t kCapacity = 1U << 22;
+  SBF sbf(kCapacity, 0.001, 2, PMR_NS::get_default_resource(), state.range(0));
+  for (size_t i = 0; i < kCapacity / 2; ++i) {
+    sbf.Add(absl::StrCat("val", i));
+  }
+
+  vector<string> items;
+  for (unsigned i = 0; i < 64; ++i) {
+    items.push_back(absl::StrCat("val", i * 7919));
+  }
+  vector<string_view> views(items.begin(), items.end());
+  bool results[64];
+  while (state.KeepRunning()) {
+    sbf.Exists(views, results);
+  }
+  state.SetItemsProcessed(state.iterations() * views.size());
+}
+BENCHMARK(BM_SBFExistsBatch)->Arg(0)->Arg(1);
 
 }  // namespace dfly
@@ -4,8 +4,12 @@
 
 #pragma once
 
+#include <absl/functional/function_ref.h>
+
+#include <algorithm>
 #include <functional>
 #include <optional>
+#include <vector>
 
 #include "base/pmr/memory_resource.h"
 #include "core/detail/bptree_internal.h"
@@ -44,10 +48,22 @@ template <typename T, typename Policy = BPTreePolicy<T>> class BPTree {
   // true if inserted, false if skipped.
   bool Insert(KeyT item);
 
+  // Builds the tree bottom-up from num strictly increasing items. Nodes are packed to
+  // fill_factor of their capacity, leaving room for subsequent inserts. The tree must be empty.
+  void BulkBuild(const KeyT* items, size_t num, double fill_factor = 0.9);
+
   bool Contains(KeyT item) const;
 
   bool Delete(KeyT item);
 
+  // Overwrites the item that compares equal to item, for example to update the pointer to
+  // a member that was moved. Returns false if there is no such item.
+  bool Replace(KeyT item);
+
+  // Moves the nodes for which should_move returns true to new allocations, for example to
+  // release underutilized memory pages. Returns the number of moved nodes.
+  size_t ReallocNodes(absl::FunctionRef<bool(const void*)> should_move);
+
   std::optional<uint32_t> GetRank(KeyT item) const;
 
   size_t Height() const {
@@ -115,6 +131,11 @@ template <typename T, typename Policy = BPTreePolicy<T>> class BPTree {
 
   void IncreaseSubtreeCounts(const BPTreePath& path, unsigned depth, int32_t delta);
 
+  // Returns the number of nodes to split num items into, so that the nodes hold about
+  // target items each and at least min_items if there is more than one node.
+  // One item is taken out as a separator between every two adjacent nodes.
+  static size_t NumBulkNodes(size_t num, unsigned target, unsigned min_items);
+
   // Charts the path towards key. Returns true if key is found.
   // In that case path->Last().first->Key(path->Last().second) == key.
   // Fills the tree path not including the key itself. In case key was not found,
@@ -206,6 +227,87 @@ template <typename T, typename Policy> bool BPTree<T, Policy>::Insert(KeyT item)
   return true;
 }
 
+template <typename T, typename Policy>
+void BPTree<T, Policy>::BulkBuild(const KeyT* items, size_t num, double fill_factor) {
+  using Layout = detail::BPNodeLayout<T>;
+  using Comp [[maybe_unused]] = typename Policy::KeyCompareTo;
+
+  assert(root_ == nullptr);
+  if (num == 0)
+    return;
+
+  for (size_t i = 1; i < num; ++i) {
+    assert(Comp()(items[i - 1], items[i]) < 0);
+  }
+
+  auto target = [fill_factor](unsigned min_items, unsigned max_items) {
+    unsigned res = fill_factor * max_items;
+    return std::clamp(res, min_items, max_items);
+  };
+
+  // Leaf level. The items between adjacent leaves become separators at the level above.
+  std::vector<BPTreeNode*> nodes;
+  std::vector<KeyT> separators;
+  size_t num_nodes = NumBulkNodes(num, target(Layout::kMinLeafKeys, Layout::kMaxLeafKeys),
+                                  Layout::kMinLeafKeys);
+  nodes.reserve(num_nodes);
+  separators.reserve(num_nodes - 1);
+
+  size_t base = (num - num_nodes + 1) / num_nodes, extra = (num - num_nodes + 1) % num_nodes;
+  const KeyT* next = items;
+  for (size_t i = 0; i < num_nodes; ++i) {
+    BPTreeNode* leaf = CreateNode(true);
+    leaf->num_items_ = base + (i < extra);
+    for (unsigned j = 0; j < leaf->num_items_; ++j)
+      leaf->SetKey(j, *next++);
+    nodes.push_back(leaf);
+    if (i + 1 < num_nodes)
+      separators.push_back(*next++);
+  }
+  assert(next == items + num);
+  height_ = 1;
+
+  // Inner levels. Each level groups the nodes below with the separators between them.
+  const unsigned inner_target = target(Layout::kMinInnerKeys, Layout::kMaxInnerKeys);
+  while (nodes.size() > 1) {
+    size_t num_keys = separators.size();
+    num_nodes = NumBulkNodes(num_keys, inner_target, Layout::kMinInnerKeys);
+    base = (num_keys - num_nodes + 1) / num_nodes;
+    extra = (num_keys - num_nodes + 1) % num_nodes;
+
+    std::vector<BPTreeNode*> parents;
+    std::vector<KeyT> parent_separators;
+    parents.reserve(num_nodes);
+    parent_separators.reserve(num_nodes - 1);
+
+    size_t child = 0, key = 0;
+    for (size_t i = 0; i < num_nodes; ++i) {
+      BPTreeNode* inner = CreateNode(false);
+      inner->num_items_ = base + (i < extra);
+
+      uint32_t tree_count = inner->num_items_;
+      for (unsigned j = 0; j <= inner->num_items_; ++j) {
+        if (j < inner->num_items_)
+          inner->SetKey(j, separators[key++]);
+        inner->SetChild(j, nodes[child]);
+        tree_count += nodes[child++]->TreeCount();
+      }
+      inner->SetTreeCount(tree_count);
+      parents.push_back(inner);
+      if (i + 1 < num_nodes)
+        parent_separators.push_back(separators[key++]);
+    }
+    assert(child == nodes.size() && key == num_keys);
+
+    nodes.swap(parents);
+    separators.swap(parent_separators);
+    height_++;
+  }
+
+  root_ = nodes.front();
+  count_ = num;
+}
+
 template <typename T, typename Policy> bool BPTree<T, Policy>::Delete(KeyT item) {
   if (!root_)
     return false;
@@ -219,6 +321,55 @@ template <typename T, typename Policy> bool BPTree<T, Policy>::Delete(KeyT item)
   return true;
 }
 
+template <typename T, typename Policy> bool BPTree<T, Policy>::Replace(KeyT item) {
+  if (!root_)
+    return false;
+
+  BPTreePath path;
+  if (!Locate(item, &path))
+    return false;
+
+  auto [node, pos] = path.Last();
+  node->SetKey(pos, item);
+  return true;
+}
+
+template <typename T, typename Policy>
+size_t BPTree<T, Policy>::ReallocNodes(absl::FunctionRef<bool(const void*)> should_move) {
+  if (!root_)
+    return 0;
+
+  size_t moved = 0;
+  auto realloc = [&](BPTreeNode* node) {
+    if (!should_move(node))
+      return node;
+
+    // The nodes have no pointers to their parents, so a copy is valid as is.
+    BPTreeNode* copy = CreateNode(node->IsLeaf());
+    memcpy(static_cast<void*>(copy), node, detail::kBPNodeSize);
+    DestroyNode(node);
+    moved++;
+    return copy;
+  };
+
+  root_ = realloc(root_);
+  std::vector<BPTreeNode*> inner_nodes;
+  if (!root_->IsLeaf())
+    inner_nodes.push_back(root_);
+
+  while (!inner_nodes.empty()) {
+    BPTreeNode* node = inner_nodes.back();
+    inner_nodes.pop_back();
+    for (unsigned i = 0; i <= node->NumItems(); ++i) {
+      BPTreeNode* child = realloc(node->Child(i));
+      node->SetChild(i, child);
+      if (!child->IsLeaf())
+        inner_nodes.push_back(child);
+    }
+  }
+  return moved;
+}
+
 template <typename T, typename Policy>
 std::optional<uint32_t> BPTree<T, Policy>::GetRank(KeyT item) const {
   if (!root_)
@@ -385,6 +536,14 @@ bool BPTree<T, Policy>::RebalanceLeafAndInsert(const BPTreePath& path, unsigned
   return false;
 }
 
+template <typename T, typename Policy>
+size_t BPTree<T, Policy>::NumBulkNodes(size_t num, unsigned target, unsigned min_items) {
+  size_t res = (num + target + 1) / (target + 1);  // ceil((num + 1) / (target + 1))
+  while (res > 1 && num - (res - 1) < res * min_items)
+    --res;
+  return res;
+}
+
 template <typename T, typename Policy>
 void BPTree<T, Policy>::IncreaseSubtreeCounts(const BPTreePath& path, unsigned depth,
                                               int32_t delta) {
@@ -462,8 +621,13 @@ template <typename T, typename Policy>
 detail::BPTreePath<T> BPTree<T, Policy>::GEQ(KeyT item) const {
   BPTreePath path;
 
-  if (!Locate(item, &path) && path.Last().second >= path.Last().first->NumItems())
-    path.Clear();
+  if (!Locate(item, &path) && path.Last().second >= path.Last().first->NumItems()) {
+    // All the items of the leaf are less than item, so the next item is the separator of the
+    // nearest ancestor whose left subtree contains the leaf, if any.
+    do {
+      path.Pop();
+    } while (!path.Empty() && path.Last().second == path.Last().first->NumItems());
+  }
 
   return path;
 }
@@ -75,6 +75,39 @@ struct ZsetPolicy {
 
 using SDSTree = BPTree<ZsetPolicy::KeyT, ZsetPolicy>;
 
+// Same order as ZsetPolicy but with the scores kept in a separate array per node.
+struct ScoredZsetPolicy {
+  using KeyT = detail::ScoredItem;
+
+  struct KeyCompareTo {
+    int operator()(const KeyT& left, const KeyT& right) {
+      if (left.score < right.score)
+        return -1;
+      if (left.score > right.score)
+        return 1;
+
+      return sdscmp((sds)left.member, (sds)right.member);
+    }
+  };
+};
+
+using ScoredSDSTree = BPTree<ScoredZsetPolicy::KeyT, ScoredZsetPolicy>;
+
+// Orders by score and then by the member address.
+struct ScoredPolicy {
+  using KeyT = detail::ScoredItem;
+
+  struct KeyCompareTo {
+    int operator()(const KeyT& left, const KeyT& right) {
+      if (left.score < right.score)
+        return -1;
+      if (left.score > right.score)
+        return 1;
+      return left.member < right.member ? -1 : (left.member > right.member ? 1 : 0);
+    }
+  };
+};
+
 }  // namespace
 
 class BPTreeSetTest : public ::testing::Test {
@@ -222,6 +255,33 @@ TEST_F(BPTreeSetTest, Delete) {
   }
 }
 
+TEST_F(BPTreeSetTest, ReallocNodes) {
+  EXPECT_EQ(0u, bptree_.ReallocNodes([](const void*) { return true; }));
+
+  FillTree();
+  size_t used = mi_alloc_.used();
+  const void* root = bptree_.DEBUG_root();
+
+  EXPECT_EQ(0u, bptree_.ReallocNodes([](const void*) { return false; }));
+  EXPECT_EQ(root, bptree_.DEBUG_root());
+
+  EXPECT_EQ(bptree_.NodeCount(), bptree_.ReallocNodes([](const void*) { return true; }));
+  EXPECT_NE(root, bptree_.DEBUG_root());
+  EXPECT_EQ(used, mi_alloc_.used());
+
+  // Move every other node.
+  unsigned calls = 0;
+  size_t moved = bptree_.ReallocNodes([&](const void*) { return calls++ % 2 == 0; });
+  EXPECT_EQ(bptree_.NodeCount(), calls);
+  EXPECT_EQ((calls + 1) / 2, moved);
+
+  ASSERT_TRUE(Validate());
+  ASSERT_EQ(kNumElems, bptree_.Size());
+  for (unsigned i = 0; i < kNumElems; ++i) {
+    ASSERT_EQ(i, *bptree_.GetRank(i));
+  }
+}
+
 TEST_F(BPTreeSetTest, Iterate) {
   FillTree(2);
 
@@ -385,6 +445,106 @@ TEST_F(BPTreeSetTest, ReverseIterate) {
   }
 }
 
+TEST_F(BPTreeSetTest, BulkBuild) {
+  for (size_t num : {0, 1, 5, 15, 16, 100, 1000, 7000, 100000}) {
+    vector<uint64_t> items(num);
+    for (size_t i = 0; i < num; ++i)
+      items[i] = i * 2;
+
+    bptree_.Clear();
+    bptree_.BulkBuild(items.data(), num);
+    ASSERT_EQ(num, bptree_.Size());
+    ASSERT_TRUE(Validate()) << num;
+
+    // All the nodes but the root must hold at least the minimal number of items.
+    vector<const detail::BPTreeNode<uint64_t>*> stack;
+    if (bptree_.DEBUG_root())
+      stack.push_back(bptree_.DEBUG_root());
+    while (!stack.empty()) {
+      auto* node = stack.back();
+      stack.pop_back();
+      if (node != bptree_.DEBUG_root()) {
+        ASSERT_GE(node->NumItems(), node->MinItems()) << num;
+        ASSERT_LE(node->NumItems(), node->MaxItems()) << num;
+      }
+      if (!node->IsLeaf()) {
+        for (unsigned i = 0; i <= node->NumItems(); ++i)
+          stack.push_back(node->Child(i));
+      }
+    }
+
+    for (size_t i = 0; i < num; i += 7) {
+      ASSERT_EQ(i, *bptree_.GetRank(i * 2));
+    }
+    uint64_t expected = 0;
+    bptree_.Iterate(0, UINT32_MAX, [&](uint64_t val) {
+      EXPECT_EQ(expected, val);
+      expected += 2;
+      return true;
+    });
+    EXPECT_EQ(num * 2, expected);
+
+    // The tree stays functional after the bulk build.
+    for (size_t i = 0; i < num; i += 3)
+      ASSERT_TRUE(bptree_.Insert(i * 2 + 1));
+    for (size_t i = 0; i < num; i += 2)
+      ASSERT_TRUE(bptree_.Delete(i * 2));
+    ASSERT_TRUE(Validate()) << num;
+    ASSERT_EQ(num - (num + 1) / 2 + (num + 2) / 3, bptree_.Size());
+  }
+}
+
+TEST_F(BPTreeSetTest, ScoredLayout) {
+  using Item = detail::ScoredItem;
+  auto less = [](const Item& a, const Item& b) {
+    return ScoredPolicy::KeyCompareTo{}(a, b) < 0;
+  };
+
+  // Many duplicate scores so that the tie-breaks on members are exercised.
+  vector<Item> items;
+  for (uintptr_t i = 1; i <= kNumElems; ++i) {
+    items.push_back({double(generator_() % 100), (void*)i});
+  }
+
+  BPTree<Item, ScoredPolicy> tree(&mi_alloc_);
+  for (auto item : items) {
+    ASSERT_TRUE(tree.Insert(item));
+  }
+  EXPECT_FALSE(tree.Insert(items[0]));
+  ASSERT_EQ(kNumElems, tree.Size());
+  EXPECT_GT(tree.Height(), 1u);
+
+  vector<Item> sorted = items;
+  std::sort(sorted.begin(), sorted.end(), less);
+
+  for (unsigned i = 0; i < sorted.size(); i += 7) {
+    ASSERT_EQ(i, *tree.GetRank(sorted[i]));
+  }
+
+  // The first item with a score of 50 or more.
+  auto path = tree.GEQ(Item{49.5, nullptr});
+  ASSERT_FALSE(path.Empty());
+  auto it = std::lower_bound(sorted.begin(), sorted.end(), Item{49.5, nullptr}, less);
+  EXPECT_EQ(it->member, path.Terminal().member);
+
+  // Delete every other item and check the order of the rest.
+  for (unsigned i = 0; i < sorted.size(); i += 2) {
+    ASSERT_TRUE(tree.Delete(sorted[i]));
+  }
+  EXPECT_FALSE(tree.Contains(sorted[0]));
+
+  vector<Item> rest;
+  tree.Iterate(0, UINT32_MAX, [&](Item item) {
+    rest.push_back(item);
+    return true;
+  });
+  ASSERT_EQ(sorted.size() / 2, rest.size());
+  for (unsigned i = 0; i < rest.size(); ++i) {
+    ASSERT_EQ(sorted[2 * i + 1].member, rest[i].member) << i;
+    ASSERT_EQ(sorted[2 * i + 1].score, rest[i].score) << i;
+  }
+}
+
 static string RandomString(mt19937& rand, unsigned len) {
   const string_view alpanum = "1234567890abcdefghijklmnopqrstuvwxyz";
   string ret;
@@ -430,6 +590,59 @@ static void BM_FindRandomBPTree(benchmark::State& state) {
 }
 BENCHMARK(BM_FindRandomBPTree)->Arg(1024)->Arg(1 << 16)->Arg(1 << 20);
 
+static void BM_FindRandomScoredBPTree(benchmark::State& state) {
+  unsigned iters = state.range(0);
+  std::vector<ZsetPolicy::KeyT> vals = GenerateRandomPairs(iters);
+  ScoredSDSTree bptree;
+  for (unsigned i = 0; i < iters; ++i) {
+    bptree.Insert({vals[i].d, vals[i].s});
+  }
+
+  unsigned i = 0;
+  while (state.KeepRunningBatch(10)) {
+    for (unsigned j = 0; j < 10; ++j) {
+      benchmark::DoNotOptimize(bptree.GEQ({vals[i].d, vals[i].s}));
+      ++i;
+      if (vals.size() == i)
+        i = 0;
+    }
+  }
+  for (const auto v : vals) {
+    sdsfree(v.s);
+  }
+}
+BENCHMARK(BM_FindRandomScoredBPTree)->Arg(1024)->Arg(1 << 16)->Arg(1 << 20);
+
+static void BM_BulkBuildScoredBPTree(benchmark::State& state) {
+  unsigned iters = state.range(0);
+  std::vector<ZsetPolicy::KeyT> vals = GenerateRandomPairs(iters);
+  std::vector<detail::ScoredItem> items(iters);
+  for (unsigned i = 0; i < iters; ++i)
+    items[i] = {vals[i].d, vals[i].s};
+  std::sort(items.begin(), items.end(), [](const auto& a, const auto& b) {
+    return ScoredZsetPolicy::KeyCompareTo{}(a, b) < 0;
+  });
+
+  while (state.KeepRunning()) {
+    ScoredSDSTree bptree;
+    if (state.range(1)) {
+      bptree.BulkBuild(items.data(), items.size());
+    } else {
+      for (const auto& item : items)
+        bptree.Insert(item);
+    }
+    benchmark::DoNotOptimize(bptree.Size());
+  }
+  for (const auto v : vals) {
+    sdsfree(v.s);
+  }
+}
+BENCHMARK(BM_BulkBuildScoredBPTree)
+    ->Args({1024, 0})
+    ->Args({1024, 1})
+    ->Args({1 << 16, 0})
+    ->Args({1 << 16, 1});
+
 static void BM_FindRandomZSL(benchmark::State& state) {
   zskiplist* zsl = zslCreate();
   unsigned iters = state.range(0);
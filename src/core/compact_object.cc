@@ -27,9 +27,15 @@ extern "C" {
 #include "base/pod_array.h"
 #include "core/bloom.h"
 #include "core/detail/bitpacking.h"
+#include "core/key_prefix_dict.h"
+#include "core/listpack_scan.h"
+#include "core/qlist.h"
+#include "core/small_set.h"
 #include "core/sorted_map.h"
 #include "core/string_map.h"
 #include "core/string_set.h"
+#include "core/value_compressor.h"
+#include "core/value_dedup.h"
 
 ABSL_RETIRED_FLAG(bool, use_set2, true, "If true use DenseSet for an optimized set data structure");
 
@@ -60,6 +66,9 @@ inline void FreeObjSet(unsigned encoding, void* ptr, MemoryResource* mr) {
     case kEncodingIntSet:
       zfree((void*)ptr);
       break;
+    case kEncodingSmallSet:
+      SmallSet::Free((SmallSet*)ptr);
+      break;
     default:
       LOG(FATAL) << "Unknown set encoding type";
   }
@@ -73,6 +82,8 @@ size_t MallocUsedSet(unsigned encoding, void* ptr) {
     }
     case kEncodingIntSet:
       return intsetBlobLen((intset*)ptr);
+    case kEncodingSmallSet:
+      return zmalloc_usable_size(ptr);
   }
 
   LOG(DFATAL) << "Unknown set encoding type " << encoding;
@@ -136,24 +147,30 @@ inline void FreeObjZset(unsigned encoding, void* ptr) {
   }
 }
 
+// Re-allocates a single zmalloc-ed blob of the given size if its page is underutilized.
+// Returns the new pointer of the blob and whether it was moved.
+pair<void*, bool> DefragBlob(void* ptr, size_t bytes, float ratio) {
+  if (!zmalloc_page_is_underutilized(ptr, ratio))
+    return {ptr, false};
+
+  void* replacement = zmalloc(bytes);
+  memcpy(replacement, ptr, bytes);
+  zfree(ptr);
+  return {replacement, true};
+}
+
+// Listpack is stored as a single contiguous array
+pair<void*, bool> DefragListpack(void* ptr, float ratio) {
+  return DefragBlob(ptr, lpBytes((uint8_t*)ptr), ratio);
+}
+
 // Iterates over allocations of internal hash data structures and re-allocates
 // them if their pages are underutilized.
 // Returns pointer to new object ptr and whether any re-allocations happened.
 pair<void*, bool> DefragHash(MemoryResource* mr, unsigned encoding, void* ptr, float ratio) {
   switch (encoding) {
-    // Listpack is stored as a single contiguous array
-    case kEncodingListPack: {
-      uint8_t* lp = (uint8_t*)ptr;
-      if (!zmalloc_page_is_underutilized(lp, ratio))
-        return {lp, false};
-
-      size_t lp_bytes = lpBytes(lp);
-      uint8_t* replacement = lpNew(lpBytes(lp));
-      memcpy(replacement, lp, lp_bytes);
-      lpFree(lp);
-
-      return {replacement, true};
-    };
+    case kEncodingListPack:
+      return DefragListpack(ptr, ratio);
 
     // StringMap supports re-allocation of it's internal nodes
     case kEncodingStrMap2: {
@@ -171,6 +188,80 @@ pair<void*, bool> DefragHash(MemoryResource* mr, unsigned encoding, void* ptr, f
   };
 }
 
+pair<void*, bool> DefragSet(unsigned encoding, void* ptr, float ratio) {
+  switch (encoding) {
+    case kEncodingIntSet:
+      return DefragBlob(ptr, intsetBlobLen((intset*)ptr), ratio);
+
+    case kEncodingSmallSet:
+      return DefragBlob(ptr, ((SmallSet*)ptr)->BlobLen(), ratio);
+
+    case kEncodingStrMap2: {
+      bool realloced = false;
+
+      StringSet* ss = (StringSet*)ptr;
+      for (auto it = ss->begin(); it != ss->end(); ++it)
+        realloced |= it.ReallocIfNeeded(ratio);
+
+      return {ss, realloced};
+    }
+
+    default:
+      ABSL_UNREACHABLE();
+  };
+}
+
+pair<void*, bool> DefragZset(unsigned encoding, void* ptr, float ratio) {
+  switch (encoding) {
+    case OBJ_ENCODING_LISTPACK:
+      return DefragListpack(ptr, ratio);
+
+    // SortedMap moves its members and the nodes of its tree.
+    case OBJ_ENCODING_SKIPLIST: {
+      detail::SortedMap* sm = (detail::SortedMap*)ptr;
+      return {sm, sm->DefragIfNeeded(ratio)};
+    }
+
+    default:
+      ABSL_UNREACHABLE();
+  };
+}
+
+bool DefragQuicklist(quicklist* ql, float ratio) {
+  bool realloced = false;
+
+  // The nodes themselves stay in place because bookmarks may point to them,
+  // only the listpacks they own are moved.
+  for (quicklistNode* node = ql->head; node; node = node->next) {
+    size_t bytes = node->sz;
+    if (node->encoding == QUICKLIST_NODE_ENCODING_LZF)
+      bytes = sizeof(quicklistLZF) + ((quicklistLZF*)node->entry)->sz;
+
+    auto [new_entry, moved] = DefragBlob(node->entry, bytes, ratio);
+    node->entry = (unsigned char*)new_entry;
+    realloced |= moved;
+  }
+  return realloced;
+}
+
+// Moves the listpacks of the stream entries, the rax nodes themselves are not moved.
+bool DefragStream(stream* s, float ratio) {
+  bool realloced = false;
+
+  raxIterator ri;
+  raxStart(&ri, s->rax_tree);
+  raxSeek(&ri, "^", NULL, 0);
+  while (raxNext(&ri)) {
+    auto [new_lp, moved] = DefragListpack(ri.data, ratio);
+    if (moved) {
+      raxSetData(ri.node, new_lp);
+      realloced = true;
+    }
+  }
+  raxStop(&ri);
+  return realloced;
+}
+
 inline void FreeObjStream(void* ptr) {
   freeStream((stream*)ptr);
 }
@@ -204,6 +295,11 @@ struct TL {
   size_t small_str_bytes;
   base::PODArray<uint8_t> tmp_buf;
   string tmp_str;
+  unique_ptr<KeyPrefixDict> prefix_dict;
+  unique_ptr<ValueCompressor> compressor;
+  size_t compression_saved_bytes = 0;
+  unique_ptr<ValueDedupTable> dedup;
+  size_t dedup_min_size = 0;
 };
 
 thread_local TL tl;
@@ -214,6 +310,9 @@ constexpr bool kUseSmallStrings = true;
 /// file and implement with SIMD instructions.
 constexpr bool kUseAsciiEncoding = true;
 
+// Upper bound of the decoded size of prefix encoded strings.
+constexpr size_t kMaxPrefixedLen = KeyPrefixDict::kMaxPrefixLen + 256;
+
 }  // namespace
 
 static_assert(sizeof(CompactObj) == 18);
@@ -226,9 +325,15 @@ size_t RobjWrapper::MallocUsed() const {
 
   switch (type_) {
     case OBJ_STRING:
-      CHECK_EQ(OBJ_ENCODING_RAW, encoding_);
+      // Shared blobs are accounted by the dedup table, since the memory is freed only with
+      // the last value that references it.
+      if (encoding_ == kEncodingStrShared)
+        return 0;
+      DCHECK(encoding_ == OBJ_ENCODING_RAW || encoding_ == kEncodingStrZstd);
       return InnerObjMallocUsed();
     case OBJ_LIST:
+      if (encoding_ == kEncodingQL2)
+        return ((QList*)inner_obj_)->MallocUsed();
       DCHECK_EQ(encoding_, OBJ_ENCODING_QUICKLIST);
       return QlMAllocSize((quicklist*)inner_obj_);
     case OBJ_SET:
@@ -249,10 +354,11 @@ size_t RobjWrapper::MallocUsed() const {
 
 size_t RobjWrapper::Size() const {
   switch (type_) {
-    case OBJ_STRING:
-      DCHECK_EQ(OBJ_ENCODING_RAW, encoding_);
+    case OBJ_STRING:  // for compressed strings - the size of the compressed blob.
       return sz_;
     case OBJ_LIST:
+      if (encoding_ == kEncodingQL2)
+        return ((QList*)inner_obj_)->Size();
       return quicklistCount((quicklist*)inner_obj_);
     case OBJ_ZSET: {
       switch (encoding_) {
@@ -276,6 +382,8 @@ size_t RobjWrapper::Size() const {
           StringSet* ss = (StringSet*)inner_obj_;
           return ss->UpperBoundSize();
         }
+        case kEncodingSmallSet:
+          return ((SmallSet*)inner_obj_)->Size();
         default:
           LOG(FATAL) << "Unexpected encoding " << encoding_;
       };
@@ -304,10 +412,17 @@ void RobjWrapper::Free(MemoryResource* mr) {
   switch (type_) {
     case OBJ_STRING:
       DVLOG(2) << "Freeing string object";
-      DCHECK_EQ(OBJ_ENCODING_RAW, encoding_);
+      if (encoding_ == kEncodingStrShared) {
+        tl.dedup->Release(static_cast<const char*>(inner_obj_));
+        break;
+      }
       mr->deallocate(inner_obj_, 0, 8);  // we do not keep the allocated size.
       break;
     case OBJ_LIST:
+      if (encoding_ == kEncodingQL2) {
+        CompactObj::DeleteMR<QList>(inner_obj_);
+        break;
+      }
       CHECK_EQ(encoding_, OBJ_ENCODING_QUICKLIST);
       quicklistRelease((quicklist*)inner_obj_);
       break;
@@ -364,13 +479,13 @@ bool RobjWrapper::Equal(string_view sv) const {
   if (type() != OBJ_STRING)
     return false;
 
-  DCHECK_EQ(OBJ_ENCODING_RAW, encoding());
+  DCHECK(encoding() == OBJ_ENCODING_RAW || encoding() == kEncodingStrShared);
   return AsView() == sv;
 }
 
-void RobjWrapper::SetString(string_view s, MemoryResource* mr) {
+void RobjWrapper::SetString(string_view s, MemoryResource* mr, unsigned encoding) {
   type_ = OBJ_STRING;
-  encoding_ = OBJ_ENCODING_RAW;
+  encoding_ = encoding;
 
   if (s.size() > sz_) {
     size_t cur_cap = InnerObjMallocUsed();
@@ -382,8 +497,29 @@ void RobjWrapper::SetString(string_view s, MemoryResource* mr) {
   }
 }
 
+void RobjWrapper::SetRange(size_t offset, string_view s, MemoryResource* mr) {
+  DCHECK_EQ(type_, OBJ_STRING);
+  DCHECK_EQ(encoding_, OBJ_ENCODING_RAW);
+
+  size_t end = offset + s.size();
+  if (end > sz_) {
+    size_t cur_cap = InnerObjMallocUsed();
+    if (end > cur_cap) {
+      MakeInnerRoom(cur_cap, end, mr);
+    }
+    if (offset > sz_) {
+      memset(reinterpret_cast<char*>(inner_obj_) + sz_, 0, offset - sz_);
+    }
+    sz_ = end;
+  }
+  memcpy(reinterpret_cast<char*>(inner_obj_) + offset, s.data(), s.size());
+}
+
 bool RobjWrapper::DefragIfNeeded(float ratio) {
   if (type() == OBJ_STRING) {
+    // Shared blobs are referenced by other values as well.
+    if (encoding_ == kEncodingStrShared)
+      return false;
     if (zmalloc_page_is_underutilized(inner_obj(), ratio)) {
       ReallocateString(tl.local_mr);
       return true;
@@ -392,6 +528,21 @@ bool RobjWrapper::DefragIfNeeded(float ratio) {
     auto [new_ptr, realloced] = DefragHash(tl.local_mr, encoding_, inner_obj_, ratio);
     inner_obj_ = new_ptr;
     return realloced;
+  } else if (type() == OBJ_SET) {
+    auto [new_ptr, realloced] = DefragSet(encoding_, inner_obj_, ratio);
+    inner_obj_ = new_ptr;
+    return realloced;
+  } else if (type() == OBJ_ZSET) {
+    auto [new_ptr, realloced] = DefragZset(encoding_, inner_obj_, ratio);
+    inner_obj_ = new_ptr;
+    return realloced;
+  } else if (type() == OBJ_LIST) {
+    if (encoding_ == kEncodingQL2)
+      return ((QList*)inner_obj_)->DefragIfNeeded(ratio);
+    DCHECK_EQ(encoding_, OBJ_ENCODING_QUICKLIST);
+    return DefragQuicklist((quicklist*)inner_obj_, ratio);
+  } else if (type() == OBJ_STREAM) {
+    return DefragStream((stream*)inner_obj_, ratio);
   }
   return false;
 }
@@ -418,7 +569,7 @@ int RobjWrapper::ZsetAdd(double score, sds ele, int in_flags, int* out_flags, do
     unsigned char* eptr;
     uint8_t* lp = (uint8_t*)inner_obj_;
 
-    if ((eptr = zzlFind(lp, ele, &curscore)) != NULL) {
+    if ((eptr = detail::ZzlFind(lp, {ele, sdslen(ele)}, &curscore)) != NULL) {
       /* NX? Return, same element already exists. */
       if (nx) {
         *out_flags |= ZADD_OUT_NOP;
@@ -458,7 +609,7 @@ int RobjWrapper::ZsetAdd(double score, sds ele, int in_flags, int* out_flags, do
       /* check if the element is too large or the list
        * becomes too long *before* executing zzlInsert. */
       if (zl_len >= server.zset_max_listpack_entries ||
-          sdslen(ele) > server.zset_max_listpack_value) {
+          sdslen(ele) > server.zset_max_listpack_value || detail::LpLookupTooSlow(zl_len * 2)) {
         inner_obj_ = SortedMap::FromListPack(tl.local_mr, lp);
         lpFree(lp);
         encoding_ = OBJ_ENCODING_SKIPLIST;
@@ -495,6 +646,12 @@ void RobjWrapper::Init(unsigned type, unsigned encoding, void* inner) {
   Set(inner, 0);
 }
 
+void RobjWrapper::SetShared(const char* data, uint32_t len) {
+  type_ = OBJ_STRING;
+  encoding_ = kEncodingStrShared;
+  Set(const_cast<char*>(data), len);
+}
+
 inline size_t RobjWrapper::InnerObjMallocUsed() const {
   return zmalloc_size(inner_obj_);
 }
@@ -525,6 +682,15 @@ using namespace std;
 auto CompactObj::GetStats() -> Stats {
   Stats res;
   res.small_string_bytes = tl.small_str_bytes;
+  res.compression_saved_bytes = tl.compression_saved_bytes;
+  if (tl.dedup) {
+    res.shared_value_bytes = tl.dedup->blob_bytes();
+    res.dedup_saved_bytes = tl.dedup->saved_bytes();
+  }
+  if (tl.prefix_dict) {
+    res.key_prefix_bytes = tl.prefix_dict->MallocUsed();
+    res.key_prefixes = tl.prefix_dict->size();
+  }
 
   return res;
 }
@@ -534,6 +700,33 @@ void CompactObj::InitThreadLocal(MemoryResource* mr) {
   tl.tmp_buf = base::PODArray<uint8_t>{mr};
 }
 
+void CompactObj::InitKeyPrefixes(bool enable) {
+  if (enable) {
+    if (!tl.prefix_dict)
+      tl.prefix_dict = make_unique<KeyPrefixDict>();
+  } else {
+    tl.prefix_dict.reset();
+  }
+}
+
+void CompactObj::InitValueCompression(size_t min_size) {
+  if (min_size) {
+    tl.compressor = make_unique<ValueCompressor>(min_size);
+  } else {
+    tl.compressor.reset();
+  }
+}
+
+void CompactObj::InitValueDedup(size_t min_size) {
+  // The table is kept as long as existing shared values reference its blobs.
+  if (min_size && !tl.dedup) {
+    tl.dedup = make_unique<ValueDedupTable>(tl.local_mr);
+  } else if (!min_size && tl.dedup && tl.dedup->size() == 0) {
+    tl.dedup.reset();
+  }
+  tl.dedup_min_size = min_size;
+}
+
 CompactObj::~CompactObj() {
   if (HasAllocated()) {
     Free();
@@ -545,10 +738,12 @@ CompactObj& CompactObj::operator=(CompactObj&& o) noexcept {
 
   SetMeta(o.taglen_, o.mask_);  // Frees underlying resources if needed.
   memcpy(&u_, &o.u_, sizeof(u_));
+  freq_ = o.freq_;
 
   // SetMeta deallocates the object and we only want reset it.
   o.taglen_ = 0;
   o.mask_ = 0;
+  o.freq_ = 0;
 
   return *this;
 }
@@ -563,6 +758,15 @@ size_t CompactObj::Size() const {
       case SMALL_TAG:
         raw_size = u_.small_str.size();
         break;
+      case PREFIX_TAG:
+      case PREFIX_SMALL_TAG: {
+        string_view parts[3];
+        uint16_t id;
+        unsigned num = GetPrefixedV(parts, &id);
+        for (unsigned i = 0; i < num; ++i)
+          raw_size += parts[i].size();
+        break;
+      }
       case INT_TAG: {
         absl::AlphaNum an(u_.ival);
         raw_size = an.size();
@@ -572,7 +776,8 @@ size_t CompactObj::Size() const {
         raw_size = u_.ext_ptr.size;
         break;
       case ROBJ_TAG:
-        raw_size = u_.r_obj.Size();
+        raw_size = IsCompressed() ? ValueCompressor::DecompressedSize(u_.r_obj.AsView())
+                                  : u_.r_obj.Size();
         break;
       default:
         LOG(DFATAL) << "Should not reach " << int(taglen_);
@@ -596,7 +801,7 @@ uint64_t CompactObj::HashCode() const {
     return XXH3_64bits_withSeed(u_.inline_str, taglen_, kHashSeed);
   }
 
-  if (encoded) {
+  if (encoded || IsCompressed()) {
     GetString(&tl.tmp_str);
     return XXH3_64bits_withSeed(tl.tmp_str.data(), tl.tmp_str.size(), kHashSeed);
   }
@@ -606,6 +811,14 @@ uint64_t CompactObj::HashCode() const {
       return u_.small_str.HashCode();
     case ROBJ_TAG:
       return u_.r_obj.HashCode();
+    case PREFIX_TAG:
+    case PREFIX_SMALL_TAG: {
+      // Must be equal to the hash of the decoded string.
+      char buf[kMaxPrefixedLen];
+      size_t len = Size();
+      GetString(buf);
+      return XXH3_64bits_withSeed(buf, len, kHashSeed);
+    }
     case INT_TAG: {
       absl::AlphaNum an(u_.ival);
       return XXH3_64bits_withSeed(an.data(), an.size(), kHashSeed);
@@ -622,9 +835,12 @@ uint64_t CompactObj::HashCode(string_view str) {
 }
 
 unsigned CompactObj::ObjType() const {
-  if (IsInline() || taglen_ == INT_TAG || taglen_ == SMALL_TAG || taglen_ == EXTERNAL_TAG)
+  if (IsInline() || taglen_ == INT_TAG || taglen_ == SMALL_TAG || IsPrefixed())
     return OBJ_STRING;
 
+  if (taglen_ == EXTERNAL_TAG)
+    return u_.ext_ptr.type;
+
   if (taglen_ == ROBJ_TAG)
     return u_.r_obj.type();
 
@@ -666,9 +882,12 @@ string_view CompactObj::ObjTypeToString(unsigned type) {
 unsigned CompactObj::Encoding() const {
   switch (taglen_) {
     case ROBJ_TAG:
-      return u_.r_obj.encoding();
+      // Compression and sharing are transparent to the users of string values.
+      return IsCompressed() || IsShared() ? OBJ_ENCODING_RAW : u_.r_obj.encoding();
     case INT_TAG:
       return OBJ_ENCODING_INT;
+    case EXTERNAL_TAG:
+      return u_.ext_ptr.type == OBJ_STRING ? OBJ_ENCODING_RAW : u_.ext_ptr.encoding;
     default:
       return OBJ_ENCODING_RAW;
   }
@@ -696,13 +915,19 @@ std::optional<int64_t> CompactObj::TryGetInt() const {
 }
 
 auto CompactObj::GetJson() const -> JsonType* {
-  if (ObjType() == OBJ_JSON) {
-    DCHECK_EQ(u_.json_obj.encoding, kEncodingJsonCons);
+  if (ObjType() == OBJ_JSON && u_.json_obj.encoding == kEncodingJsonCons) {
     return u_.json_obj.json_ptr;
   }
   return nullptr;
 }
 
+absl::Span<uint8_t> CompactObj::GetFlatJson() const {
+  if (ObjType() == OBJ_JSON && u_.json_obj.encoding == kEncodingJsonFlat) {
+    return {u_.json_obj.flat_ptr, u_.json_obj.json_len};
+  }
+  return {};
+}
+
 void CompactObj::SetJson(JsonType&& j) {
   if (taglen_ == JSON_TAG && u_.json_obj.encoding == kEncodingJsonCons) {
     // already json
@@ -716,6 +941,13 @@ void CompactObj::SetJson(JsonType&& j) {
 }
 
 void CompactObj::SetJson(const uint8_t* buf, size_t len) {
+  if (taglen_ == JSON_TAG && u_.json_obj.encoding == kEncodingJsonFlat &&
+      u_.json_obj.json_len == len) {
+    // Re-encoded value of the same size
+    memcpy(u_.json_obj.flat_ptr, buf, len);
+    return;
+  }
+
   SetMeta(JSON_TAG);
   u_.json_obj.flat_ptr = (uint8_t*)tl.local_mr->allocate(len, kAlignSize);
   memcpy(u_.json_obj.flat_ptr, buf, len);
@@ -723,12 +955,13 @@ void CompactObj::SetJson(const uint8_t* buf, size_t len) {
   u_.json_obj.json_len = len;
 }
 
-void CompactObj::SetSBF(uint64_t initial_capacity, double fp_prob, double grow_factor) {
+void CompactObj::SetSBF(uint64_t initial_capacity, double fp_prob, double grow_factor,
+                        bool blocked) {
   if (taglen_ == SBF_TAG) {  // already json
-    *u_.sbf = SBF(initial_capacity, fp_prob, grow_factor, tl.local_mr);
+    *u_.sbf = SBF(initial_capacity, fp_prob, grow_factor, tl.local_mr, blocked);
   } else {
     SetMeta(SBF_TAG);
-    u_.sbf = AllocateMR<SBF>(initial_capacity, fp_prob, grow_factor, tl.local_mr);
+    u_.sbf = AllocateMR<SBF>(initial_capacity, fp_prob, grow_factor, tl.local_mr, blocked);
   }
 }
 
@@ -809,6 +1042,109 @@ void CompactObj::SetString(std::string_view str) {
   u_.r_obj.SetString(encoded, tl.local_mr);
 }
 
+void CompactObj::SetPrefixedString(string_view str) {
+  KeyPrefixDict* dict = tl.prefix_dict.get();
+
+  // Shorter strings are stored inline anyway.
+  if (!dict || str.size() <= kInlineLen || IsExternal())
+    return SetString(str);
+
+  // Match references the prefix before SetMeta, which may release its last reference.
+  optional<uint16_t> id = dict->Match(str);
+  if (!id)
+    return SetString(str);
+
+  string_view suffix = str.substr(dict->Get(*id).size());
+  uint8_t mask = mask_ & ~kEncMask;
+  size_t encoded_len = sizeof(uint16_t) + suffix.size();
+  bool is_inline = suffix.size() <= sizeof(u_.prefixed_str.suffix);
+  if (!is_inline && !(kUseSmallStrings && SmallString::CanAllocate(encoded_len))) {
+    dict->Unref(*id);  // Forgets the prefix if it was just learned for this string.
+    return SetString(str);
+  }
+
+  if (is_inline) {
+    SetMeta(PREFIX_TAG, mask);
+    u_.prefixed_str.prefix_id = *id;
+    u_.prefixed_str.suffix_len = suffix.size();
+    memcpy(u_.prefixed_str.suffix, suffix.data(), suffix.size());
+    return;
+  }
+
+  char buf[sizeof(uint16_t) + 256];
+  absl::little_endian::Store16(buf, *id);
+  memcpy(buf + sizeof(uint16_t), suffix.data(), suffix.size());
+
+  SetMeta(PREFIX_SMALL_TAG, mask);
+  tl.small_str_bytes += u_.small_str.Assign(string_view{buf, encoded_len});
+}
+
+void CompactObj::SetCompressedString(string_view str) {
+  if (tl.dedup_min_size && str.size() >= tl.dedup_min_size && str.size() > kInlineLen &&
+      !IsExternal()) {
+    // Reference the blob before SetMeta, which may release its last reference.
+    if (const char* data = tl.dedup->Acquire(str); data) {
+      SetMeta(ROBJ_TAG, mask_ & ~kEncMask);
+      u_.r_obj.SetShared(data, str.size());
+      return;
+    }
+  }
+
+  ValueCompressor* compressor = tl.compressor.get();
+  if (!compressor || str.size() <= kInlineLen || str.size() < compressor->min_size() ||
+      IsExternal())
+    return SetString(str);
+
+  optional<string_view> blob = compressor->Compress(str);
+  if (!blob)
+    return SetString(str);
+
+  SetMeta(ROBJ_TAG, mask_ & ~kEncMask);
+  u_.r_obj.SetString(*blob, tl.local_mr, kEncodingStrZstd);
+  tl.compression_saved_bytes += str.size() - blob->size();
+}
+
+void CompactObj::SetRawString(string_view str) {
+  CHECK(!IsExternal());
+  if (str.size() <= kInlineLen)
+    return SetString(str);
+
+  SetMeta(ROBJ_TAG, mask_ & ~kEncMask);
+  u_.r_obj.SetString(str, tl.local_mr);
+}
+
+bool CompactObj::SetRawRange(size_t offset, string_view str) {
+  if (taglen_ != ROBJ_TAG || u_.r_obj.type() != OBJ_STRING ||
+      u_.r_obj.encoding() != OBJ_ENCODING_RAW || (mask_ & kEncMask))
+    return false;
+
+  u_.r_obj.SetRange(offset, str, tl.local_mr);
+  return true;
+}
+
+unsigned CompactObj::GetPrefixedV(string_view dest[3], uint16_t* id) const {
+  DCHECK(IsPrefixed());
+  DCHECK(tl.prefix_dict);
+
+  unsigned num = 2;
+  if (taglen_ == PREFIX_TAG) {
+    *id = u_.prefixed_str.prefix_id;
+    dest[1] = string_view{u_.prefixed_str.suffix, u_.prefixed_str.suffix_len};
+  } else {
+    string_view slices[2];
+    num = u_.small_str.GetV(slices) + 1;
+    DCHECK_EQ(3u, num);
+    DCHECK_GT(slices[0].size(), sizeof(uint16_t));
+
+    *id = absl::little_endian::Load16(slices[0].data());
+    dest[1] = slices[0].substr(sizeof(uint16_t));
+    dest[2] = slices[1];
+  }
+  dest[0] = tl.prefix_dict->Get(*id);
+
+  return num;
+}
+
 string_view CompactObj::GetSlice(string* scratch) const {
   CHECK(!IsExternal());
   uint8_t is_encoded = mask_ & kEncMask;
@@ -836,6 +1172,12 @@ string_view CompactObj::GetSlice(string* scratch) const {
     return *scratch;
   }
 
+  if (IsPrefixed()) {
+    scratch->resize(Size());
+    GetString(scratch->data());
+    return *scratch;
+  }
+
   if (is_encoded) {
     if (taglen_ == ROBJ_TAG) {
       CHECK_EQ(OBJ_STRING, u_.r_obj.type());
@@ -866,7 +1208,12 @@ string_view CompactObj::GetSlice(string* scratch) const {
   // no encoding.
   if (taglen_ == ROBJ_TAG) {
     CHECK_EQ(OBJ_STRING, u_.r_obj.type());
-    DCHECK_EQ(OBJ_ENCODING_RAW, u_.r_obj.encoding());
+    if (IsCompressed()) {
+      scratch->resize(Size());
+      ValueCompressor::Decompress(u_.r_obj.AsView(), scratch->data());
+      return *scratch;
+    }
+    DCHECK(u_.r_obj.encoding() == OBJ_ENCODING_RAW || IsShared());
     return u_.r_obj.AsView();
   }
 
@@ -889,7 +1236,10 @@ bool CompactObj::DefragIfNeeded(float ratio) {
       }
       return false;
     case SMALL_TAG:
+    case PREFIX_SMALL_TAG:
       return u_.small_str.DefragIfNeeded(ratio);
+    case JSON_TAG:
+      return DefragJson(ratio);
     case INT_TAG:
       // this is not relevant in this case
       return false;
@@ -901,12 +1251,37 @@ bool CompactObj::DefragIfNeeded(float ratio) {
   }
 }
 
+bool CompactObj::DefragJson(float ratio) {
+  if (u_.json_obj.encoding == kEncodingJsonFlat) {
+    uint8_t* flat = u_.json_obj.flat_ptr;
+    uint32_t len = u_.json_obj.json_len;
+    if (!zmalloc_page_is_underutilized(flat, ratio))
+      return false;
+
+    u_.json_obj.flat_ptr = (uint8_t*)tl.local_mr->allocate(len, kAlignSize);
+    memcpy(u_.json_obj.flat_ptr, flat, len);
+    tl.local_mr->deallocate(flat, len, kAlignSize);
+    return true;
+  }
+
+  // The document is spread over many allocations, so it is copied as a whole once its root
+  // is found on an underutilized page, which keeps the check cheap for large documents.
+  JsonType* json = u_.json_obj.json_ptr;
+  if (!zmalloc_page_is_underutilized(json, ratio))
+    return false;
+
+  u_.json_obj.json_ptr = AllocateMR<JsonType>(*json, json->get_allocator());
+  DeleteMR<JsonType>(json);
+  return true;
+}
+
 bool CompactObj::HasAllocated() const {
   if (IsRef() || taglen_ == INT_TAG || IsInline() || taglen_ == EXTERNAL_TAG ||
       (taglen_ == ROBJ_TAG && u_.r_obj.inner_obj() == nullptr))
     return false;
 
-  DCHECK(taglen_ == ROBJ_TAG || taglen_ == SMALL_TAG || taglen_ == JSON_TAG || taglen_ == SBF_TAG);
+  DCHECK(taglen_ == ROBJ_TAG || taglen_ == SMALL_TAG || taglen_ == JSON_TAG || taglen_ == SBF_TAG ||
+         IsPrefixed());
   return true;
 }
 
@@ -941,6 +1316,17 @@ void CompactObj::GetString(char* dest) const {
     return;
   }
 
+  if (IsPrefixed()) {
+    string_view parts[3];
+    uint16_t id;
+    unsigned num = GetPrefixedV(parts, &id);
+    for (unsigned i = 0; i < num; ++i) {
+      memcpy(dest, parts[i].data(), parts[i].size());
+      dest += parts[i].size();
+    }
+    return;
+  }
+
   if (is_encoded) {
     if (taglen_ == ROBJ_TAG) {
       CHECK_EQ(OBJ_STRING, u_.r_obj.type());
@@ -968,7 +1354,11 @@ void CompactObj::GetString(char* dest) const {
   // no encoding.
   if (taglen_ == ROBJ_TAG) {
     CHECK_EQ(OBJ_STRING, u_.r_obj.type());
-    DCHECK_EQ(OBJ_ENCODING_RAW, u_.r_obj.encoding());
+    if (IsCompressed()) {
+      ValueCompressor::Decompress(u_.r_obj.AsView(), dest);
+      return;
+    }
+    DCHECK(u_.r_obj.encoding() == OBJ_ENCODING_RAW || IsShared());
     memcpy(dest, u_.r_obj.inner_obj(), u_.r_obj.Size());
     return;
   }
@@ -987,17 +1377,42 @@ void CompactObj::GetString(char* dest) const {
 }
 
 void CompactObj::SetExternal(size_t offset, size_t sz) {
+  SetExternal(offset, sz, OBJ_STRING, OBJ_ENCODING_RAW);
+}
+
+void CompactObj::SetExternal(size_t offset, size_t sz, unsigned type, unsigned encoding) {
   SetMeta(EXTERNAL_TAG, mask_ & ~kEncMask);
 
+  u_.ext_ptr.type = type;
+  u_.ext_ptr.encoding = encoding;
+  u_.ext_ptr.reads = 0;
   u_.ext_ptr.page_index = offset / 4096;
   u_.ext_ptr.page_offset = offset % 4096;
   u_.ext_ptr.size = sz;
 }
 
+void CompactObj::SetExternalCompressed(size_t offset, size_t sz, size_t raw_size) {
+  DCHECK_GT(sz, 0u);
+  DCHECK_LT(sz, 1u << 24);
+  SetExternal(offset, raw_size, OBJ_STRING, sz);
+}
+
+bool CompactObj::IsExternalCompressed() const {
+  return taglen_ == EXTERNAL_TAG && u_.ext_ptr.type == OBJ_STRING && u_.ext_ptr.encoding != 0;
+}
+
 std::pair<size_t, size_t> CompactObj::GetExternalSlice() const {
   DCHECK_EQ(EXTERNAL_TAG, taglen_);
   size_t offset = size_t(u_.ext_ptr.page_index) * 4096 + u_.ext_ptr.page_offset;
-  return pair<size_t, size_t>(offset, size_t(u_.ext_ptr.size));
+  size_t len = IsExternalCompressed() ? u_.ext_ptr.encoding : u_.ext_ptr.size;
+  return pair<size_t, size_t>(offset, len);
+}
+
+unsigned CompactObj::IncrementExternalReads() {
+  DCHECK_EQ(EXTERNAL_TAG, taglen_);
+  if (u_.ext_ptr.reads < UINT16_MAX)
+    u_.ext_ptr.reads++;
+  return u_.ext_ptr.reads;
 }
 
 void CompactObj::Reset() {
@@ -1013,6 +1428,9 @@ void CompactObj::Free() {
   DCHECK(HasAllocated());
 
   if (taglen_ == ROBJ_TAG) {
+    if (IsCompressed()) {
+      tl.compression_saved_bytes -= Size() - u_.r_obj.Size();
+    }
     u_.r_obj.Free(tl.local_mr);
   } else if (taglen_ == SMALL_TAG) {
     tl.small_str_bytes -= u_.small_str.MallocUsed();
@@ -1026,6 +1444,15 @@ void CompactObj::Free() {
     }
   } else if (taglen_ == SBF_TAG) {
     DeleteMR<SBF>(u_.sbf);
+  } else if (IsPrefixed()) {
+    string_view parts[3];
+    uint16_t id;
+    GetPrefixedV(parts, &id);
+    if (taglen_ == PREFIX_SMALL_TAG) {
+      tl.small_str_bytes -= u_.small_str.MallocUsed();
+      u_.small_str.Free();
+    }
+    tl.prefix_dict->Unref(id);
   } else {
     LOG(FATAL) << "Unsupported tag " << int(taglen_);
   }
@@ -1046,10 +1473,14 @@ size_t CompactObj::MallocUsed() const {
     return zmalloc_size(u_.json_obj.json_ptr);
   }
 
-  if (taglen_ == SMALL_TAG) {
+  if (taglen_ == SMALL_TAG || taglen_ == PREFIX_SMALL_TAG) {
     return u_.small_str.MallocUsed();
   }
 
+  if (taglen_ == PREFIX_TAG) {
+    return 0;
+  }
+
   if (taglen_ == SBF_TAG) {
     return u_.sbf->MallocUsed();
   }
@@ -1057,9 +1488,56 @@ size_t CompactObj::MallocUsed() const {
   return 0;
 }
 
+void CompactObj::Prefetch() const {
+  if (!HasAllocated())
+    return;
+
+  const void* ptr = nullptr;
+  if (taglen_ == ROBJ_TAG) {
+    ptr = u_.r_obj.inner_obj();
+  } else if (taglen_ == JSON_TAG) {
+    ptr = u_.json_obj.json_ptr;
+  } else if (taglen_ == SBF_TAG) {
+    ptr = u_.sbf;
+  } else if (taglen_ == SMALL_TAG || taglen_ == PREFIX_SMALL_TAG) {
+    string_view slices[2];
+    u_.small_str.GetV(slices);
+    ptr = slices[0].data();
+  }
+  __builtin_prefetch(ptr);
+}
+
 bool CompactObj::operator==(const CompactObj& o) const {
   DCHECK(taglen_ != JSON_TAG && o.taglen_ != JSON_TAG) << "cannot use JSON type to check equal";
 
+  // Whether a key is prefix encoded depends on the time it was created, so the same string may
+  // have different representations.
+  if (IsPrefixed() || o.IsPrefixed()) {
+    if (IsPrefixed() && o.IsPrefixed()) {
+      // The same string always has the same candidate prefix and the same suffix representation.
+      if (taglen_ != o.taglen_)
+        return false;
+      string_view p1[3], p2[3];
+      uint16_t id1, id2;
+      unsigned num = GetPrefixedV(p1, &id1);
+      o.GetPrefixedV(p2, &id2);
+      return id1 == id2 && equal(p1 + 1, p1 + num, p2 + 1);
+    }
+
+    string scratch;
+    return IsPrefixed() ? EqualPrefixed(o.GetSlice(&scratch)) : o.EqualPrefixed(GetSlice(&scratch));
+  }
+
+  // The compressed blob of a string depends on the dictionary that was used, and shared strings
+  // are never packed, so these are compared by their contents.
+  if (IsCompressed() || o.IsCompressed() || IsShared() || o.IsShared()) {
+    if (o.ObjType() != OBJ_STRING || ObjType() != OBJ_STRING)
+      return false;
+    string scratch;
+    return IsCompressed() || IsShared() ? EqualNonInline(o.GetSlice(&scratch))
+                                        : o == GetSlice(&scratch);
+  }
+
   uint8_t m1 = mask_ & kEncMask;
   uint8_t m2 = o.mask_ & kEncMask;
   if (m1 != m2)
@@ -1090,15 +1568,35 @@ bool CompactObj::EqualNonInline(std::string_view sv) const {
     }
 
     case ROBJ_TAG:
+      if (IsCompressed()) {
+        if (Size() != sv.size())
+          return false;
+        string scratch;
+        return GetSlice(&scratch) == sv;
+      }
       return u_.r_obj.Equal(sv);
     case SMALL_TAG:
       return u_.small_str.Equal(sv);
+    case PREFIX_TAG:
+    case PREFIX_SMALL_TAG:
+      return EqualPrefixed(sv);
     default:
       break;
   }
   return false;
 }
 
+bool CompactObj::EqualPrefixed(string_view sv) const {
+  string_view parts[3];
+  uint16_t id;
+  unsigned num = GetPrefixedV(parts, &id);
+  for (unsigned i = 0; i < num; ++i) {
+    if (!absl::ConsumePrefix(&sv, parts[i]))
+      return false;
+  }
+  return sv.empty();
+}
+
 bool CompactObj::CmpEncoded(string_view sv) const {
   size_t encode_len = binpacked_len(sv.size());
 
@@ -1174,6 +1672,54 @@ bool CompactObj::CmpEncoded(string_view sv) const {
   return false;
 }
 
+string_view CompactObj::GetRawString() const {
+  if (taglen_ != ROBJ_TAG || u_.r_obj.type() != OBJ_STRING || (mask_ & kEncMask) ||
+      IsCompressed())
+    return {};
+
+  DCHECK(u_.r_obj.encoding() == OBJ_ENCODING_RAW || IsShared());
+  return u_.r_obj.AsView();
+}
+
+bool CompactObj::IsCompressed() const {
+  return taglen_ == ROBJ_TAG && u_.r_obj.type() == OBJ_STRING &&
+         u_.r_obj.encoding() == kEncodingStrZstd;
+}
+
+void* CompactObj::SingleBlock() const {
+  if (taglen_ != ROBJ_TAG || IsRef() || u_.r_obj.inner_obj() == nullptr)
+    return nullptr;
+
+  unsigned encoding = u_.r_obj.encoding();
+  bool single = false;
+  switch (u_.r_obj.type()) {
+    case OBJ_STRING:
+      // Shared and compressed strings are accounted by the thread's dedup and compression stats.
+      single = encoding != kEncodingStrShared && encoding != kEncodingStrZstd;
+      break;
+    case OBJ_SET:
+      single = encoding == kEncodingIntSet || encoding == kEncodingSmallSet;
+      break;
+    case OBJ_HASH:
+      single = encoding == kEncodingListPack;
+      break;
+    case OBJ_ZSET:
+      single = encoding == OBJ_ENCODING_LISTPACK;
+      break;
+  }
+  return single ? u_.r_obj.inner_obj() : nullptr;
+}
+
+bool CompactObj::IsShared() const {
+  return taglen_ == ROBJ_TAG && u_.r_obj.type() == OBJ_STRING &&
+         u_.r_obj.encoding() == kEncodingStrShared;
+}
+
+uint32_t CompactObj::SharedRefCount() const {
+  return IsShared() ? ValueDedupTable::RefCount(static_cast<const char*>(u_.r_obj.inner_obj()))
+                    : 0;
+}
+
 size_t CompactObj::DecodedLen(size_t sz) const {
   return ascii_len(sz) - ((mask_ & ASCII1_ENC_BIT) ? 1 : 0);
 }
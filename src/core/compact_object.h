@@ -5,6 +5,7 @@
 #pragma once
 
 #include <absl/base/internal/endian.h>
+#include <absl/types/span.h>
 
 #include <optional>
 #include <type_traits>
@@ -19,8 +20,12 @@ constexpr unsigned kEncodingIntSet = 0;
 constexpr unsigned kEncodingStrMap = 1;   // for set/map encodings of strings
 constexpr unsigned kEncodingStrMap2 = 2;  // for set/map encodings of strings using DenseSet
 constexpr unsigned kEncodingListPack = 3;
+constexpr unsigned kEncodingSmallSet = 3;  // for sets of a few short strings using SmallSet
 constexpr unsigned kEncodingJsonCons = 0;
 constexpr unsigned kEncodingJsonFlat = 1;
+constexpr unsigned kEncodingQL2 = 1;  // for lists encoded as QList
+constexpr unsigned kEncodingStrZstd = 1;  // for strings compressed with ValueCompressor
+constexpr unsigned kEncodingStrShared = 2;  // for strings shared through ValueDedupTable
 
 class SBF;
 
@@ -41,9 +46,18 @@ class RobjWrapper {
   size_t Size() const;
   void Free(MemoryResource* mr);
 
-  void SetString(std::string_view s, MemoryResource* mr);
+  // encoding is OBJ_ENCODING_RAW (0) or kEncodingStrZstd.
+  void SetString(std::string_view s, MemoryResource* mr, unsigned encoding = 0);
   void Init(unsigned type, unsigned encoding, void* inner);
 
+  // Requires: OBJ_STRING with OBJ_ENCODING_RAW. Overwrites the string at offset with s, padding it
+  // with zeros up to offset. Grows the blob geometrically, so that a series of appends copies
+  // the string amortized O(1) times.
+  void SetRange(size_t offset, std::string_view s, MemoryResource* mr);
+
+  // Takes over a reference of the shared blob data of length len.
+  void SetShared(const char* data, uint32_t len);
+
   unsigned type() const {
     return type_;
   }
@@ -107,6 +121,8 @@ class CompactObj {
     EXTERNAL_TAG = 20,
     JSON_TAG = 21,
     SBF_TAG = 22,
+    PREFIX_TAG = 23,        // Prefix id and an inline suffix, see SetPrefixedString.
+    PREFIX_SMALL_TAG = 24,  // Prefix id and suffix stored in a small string.
   };
 
   enum MaskBit {
@@ -176,6 +192,12 @@ class CompactObj {
 
   std::string_view GetSlice(std::string* scratch) const;
 
+  // Returns the string value if it is stored as is in a heap allocated blob, i.e. it is not
+  // inlined, packed or compressed, otherwise returns an empty view. Unlike GetSlice, the view
+  // does not point into this object and stays valid when the object moves in the table,
+  // until the value is modified, freed or defragmented.
+  std::string_view GetRawString() const;
+
   std::string ToString() const {
     std::string res;
     GetString(&res);
@@ -251,6 +273,17 @@ class CompactObj {
     }
   }
 
+  static constexpr uint8_t kMaxFreq = 7;
+
+  // Logarithmic access counter used by the LFU eviction policy, see DbSlice.
+  uint8_t Freq() const {
+    return freq_;
+  }
+
+  void SetFreq(uint8_t freq) {
+    freq_ = freq;
+  }
+
   bool IsSticky() const {
     return mask_ & STICKY;
   }
@@ -272,6 +305,12 @@ class CompactObj {
     return u_.r_obj.inner_obj();
   }
 
+  // Returns the heap block that holds the whole value, or nullptr if the value is inline or
+  // spans several allocations. Such a value can be handed over to another thread as it is, only
+  // the accounting of the block moves: strings are allocated by memory_resource() and listpack
+  // and intset containers by zmalloc.
+  void* SingleBlock() const;
+
   void SetRObjPtr(void* ptr) {
     u_.r_obj.Init(u_.r_obj.type(), u_.r_obj.encoding(), ptr);
   }
@@ -297,6 +336,29 @@ class CompactObj {
   void SetString(std::string_view str);
   void GetString(std::string* res) const;
 
+  // Like SetString, but encodes str with a learned prefix from the thread-local key prefix
+  // dictionary, if it is enabled. Meant for keys, which share long prefixes in many workloads.
+  void SetPrefixedString(std::string_view str);
+
+  // Like SetString, but stores large values compressed with the thread-local value compressor,
+  // if it is enabled and the value compresses well. Compressed values are decompressed on every
+  // read, so it is meant for values that are mostly written and read whole.
+  // If value deduplication is enabled, large values are shared with the values of identical
+  // contents instead, and stored neither packed nor compressed.
+  void SetCompressedString(std::string_view str);
+
+  // Like SetString, but stores large values as is in a heap allocated blob, neither packed nor
+  // compressed, so that they can be modified in place by SetRawRange.
+  void SetRawString(std::string_view str);
+
+  // If the value is a string stored as is in its own heap allocated blob, overwrites it at offset
+  // with str in place, extending it with zeros up to offset if needed, and returns true.
+  // Otherwise returns false and doesn't modify the value. Use offset == Size() to append.
+  bool SetRawRange(size_t offset, std::string_view str);
+
+  // Number of values that share the blob of this value, 0 if it is not shared.
+  uint32_t SharedRefCount() const;
+
   // Will set this to hold OBJ_JSON, after that it is safe to call GetJson
   // NOTE: in order to avid copy which can be expensive in this case,
   // you need to move an object that created with the function JsonFromString
@@ -304,15 +366,20 @@ class CompactObj {
   void SetJson(JsonType&& j);
   void SetJson(const uint8_t* buf, size_t len);
 
-  // pre condition - the type here is OBJ_JSON and was set with SetJson
+  // pre condition - the type here is OBJ_JSON and was set with SetJson.
+  // Returns nullptr for values encoded with kEncodingJsonFlat.
   JsonType* GetJson() const;
 
+  // Buffer of a json value encoded with kEncodingJsonFlat, empty for other values. Its bytes can be
+  // patched in place as long as their number is unchanged.
+  absl::Span<uint8_t> GetFlatJson() const;
+
   void SetSBF(SBF* sbf) {
     SetMeta(SBF_TAG);
     u_.sbf = sbf;
   }
 
-  void SetSBF(uint64_t initial_capacity, double fp_prob, double grow_factor);
+  void SetSBF(uint64_t initial_capacity, double fp_prob, double grow_factor, bool blocked = false);
   SBF* GetSBF() const;
 
   // dest must have at least Size() bytes available
@@ -323,12 +390,31 @@ class CompactObj {
   }
 
   void SetExternal(size_t offset, size_t sz);
+
+  // Same for an offloaded value of another type, that keeps reporting its type and encoding.
+  void SetExternal(size_t offset, size_t sz, unsigned type, unsigned encoding);
+
+  // Same for a string that is stored compressed by ValueCompressor. sz is the length of the
+  // stored blob and must be below 16MB, raw_size is the length reported by Size().
+  void SetExternalCompressed(size_t offset, size_t sz, size_t raw_size);
+
+  // Whether this is an external string set by SetExternalCompressed.
+  bool IsExternalCompressed() const;
+
+  // Returns offset and length of the stored bytes.
   std::pair<size_t, size_t> GetExternalSlice() const;
 
+  // Counts a read of the external value, saturating. Returns the number of reads since it was
+  // offloaded.
+  unsigned IncrementExternalReads();
+
   // In case this object a single blob, returns number of bytes allocated on heap
   // for that blob. Otherwise returns 0.
   size_t MallocUsed() const;
 
+  // Prefetches the start of the heap allocation of the object, if it has one.
+  void Prefetch() const;
+
   // Resets the object to empty state (string).
   void Reset();
 
@@ -342,11 +428,28 @@ class CompactObj {
 
   struct Stats {
     size_t small_string_bytes = 0;
+    size_t key_prefix_bytes = 0;  // used by the key prefix dictionary.
+    size_t key_prefixes = 0;      // number of learned prefixes.
+    size_t compression_saved_bytes = 0;  // saved by compressed strings.
+    size_t shared_value_bytes = 0;       // allocated by blobs of shared strings.
+    size_t dedup_saved_bytes = 0;        // saved by sharing identical strings.
   };
 
   static Stats GetStats();
 
   static void InitThreadLocal(MemoryResource* mr);
+
+  // Creates or destroys the thread-local key prefix dictionary used by SetPrefixedString.
+  // It can be destroyed only when no prefix encoded objects exist anymore.
+  static void InitKeyPrefixes(bool enable);
+
+  // Enables compression of string values that are at least min_size bytes long by
+  // SetCompressedString, 0 disables it. Existing compressed values stay readable.
+  static void InitValueCompression(size_t min_size);
+
+  // Enables sharing of string values that are at least min_size bytes long by
+  // SetCompressedString, 0 disables it. Existing shared values stay shared.
+  static void InitValueDedup(size_t min_size);
   static MemoryResource* memory_resource();  // thread-local.
 
   template <typename T>
@@ -383,8 +486,27 @@ class CompactObj {
 
   bool HasAllocated() const;
 
+  // Requires: taglen_ == JSON_TAG.
+  bool DefragJson(float ratio);
+
   bool CmpEncoded(std::string_view sv) const;
 
+  bool IsPrefixed() const {
+    return taglen_ == PREFIX_TAG || taglen_ == PREFIX_SMALL_TAG;
+  }
+
+  // Requires: IsPrefixed(). Returns the prefix id and fills dest with the prefix followed by
+  // 1 or 2 slices of the suffix. Returns the number of the filled slices.
+  unsigned GetPrefixedV(std::string_view dest[3], uint16_t* id) const;
+
+  bool EqualPrefixed(std::string_view sv) const;
+
+  // Whether this is a string compressed by SetCompressedString.
+  bool IsCompressed() const;
+
+  // Whether this is a string shared by SetCompressedString.
+  bool IsShared() const;
+
   void SetMeta(uint8_t taglen, uint8_t mask = 0) {
     if (HasAllocated()) {
       Free();
@@ -397,13 +519,19 @@ class CompactObj {
 
   struct ExternalPtr {
     uint32_t type : 8;
-    uint32_t reserved : 24;
+    uint32_t encoding : 24;  // for strings the length of the compressed blob, or 0
     uint32_t page_index;
     uint16_t page_offset;  // 0 for multi-page blobs. != 0 for small blobs.
-    uint16_t reserved2;
+    uint16_t reads;
     uint32_t size;
   } __attribute__((packed));
 
+  struct PrefixedStr {
+    uint16_t prefix_id;
+    uint8_t suffix_len;
+    char suffix[kInlineLen - 3];
+  } __attribute__((packed));
+
   struct JsonWrapper {
     union {
       JsonType* json_ptr;
@@ -428,6 +556,7 @@ class CompactObj {
     SBF* sbf __attribute__((packed));
     int64_t ival __attribute__((packed));
     ExternalPtr ext_ptr;
+    PrefixedStr prefixed_str;
 
     U() : r_obj() {
     }
@@ -438,8 +567,9 @@ class CompactObj {
 
   mutable uint8_t mask_ = 0;
 
-  // We currently reserve 5 bits for tags and 3 bits for extending the mask. currently reserved.
-  uint8_t taglen_ = 0;
+  // We currently reserve 5 bits for tags and the remaining 3 bits for the access frequency.
+  uint8_t taglen_ : 5 = 0;
+  uint8_t freq_ : 3 = 0;
 };
 
 inline bool CompactObj::operator==(std::string_view sv) const {
@@ -9,12 +9,18 @@
 
 #include <jsoncons/json.hpp>
 #include <jsoncons_ext/jsonpath/jsonpath.hpp>
+#include <random>
+#include <thread>
 
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "core/detail/bitpacking.h"
 #include "core/flat_set.h"
+#include "core/key_prefix_dict.h"
+#include "core/lazy_free.h"
 #include "core/mi_memory_resource.h"
+#include "core/qlist.h"
+#include "core/string_set.h"
 
 extern "C" {
 #include "redis/intset.h"
@@ -281,6 +287,81 @@ TEST_F(CompactObjectTest, Int) {
   EXPECT_TRUE(cobj_.HasExpire());
 }
 
+TEST_F(CompactObjectTest, Freq) {
+  string tmp(100, 'a');
+  cobj_.SetString(tmp);
+  cobj_.SetFreq(CompactObj::kMaxFreq);
+  EXPECT_EQ(tmp.size(), cobj_.Size());
+  EXPECT_EQ(cobj_, tmp);
+
+  // Inline strings keep their length in the same byte.
+  CompactObj obj("0123456789abcdef");
+  obj.SetFreq(3);
+  EXPECT_EQ(obj, "0123456789abcdef");
+
+  CompactObj moved = std::move(obj);
+  EXPECT_EQ(3, moved.Freq());
+  EXPECT_EQ(moved, "0123456789abcdef");
+  EXPECT_EQ(CompactObj::kMaxFreq, cobj_.Freq());
+}
+
+TEST_F(CompactObjectTest, PrefixedString) {
+  CompactObj::InitKeyPrefixes(true);
+  const string prefix = "tenant:1234:session:";
+
+  // Keys that are created before the prefix is learned are not encoded.
+  vector<CompactObj> keys(KeyPrefixDict::kLearnThreshold * 2);
+  for (size_t i = 0; i < keys.size(); ++i) {
+    keys[i].SetPrefixedString(absl::StrCat(prefix, i));
+  }
+  EXPECT_GT(keys.front().MallocUsed(), 0);
+  EXPECT_EQ(0, keys.back().MallocUsed());
+  EXPECT_EQ(1, CompactObj::GetStats().key_prefixes);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    string s = absl::StrCat(prefix, i);
+    CompactObj raw{s};
+    EXPECT_EQ(s, keys[i]);
+    EXPECT_EQ(s.size(), keys[i].Size());
+    EXPECT_EQ(s, keys[i].GetSlice(&tmp_));
+    EXPECT_EQ(CompactObj::HashCode(s), keys[i].HashCode());
+    EXPECT_EQ(OBJ_STRING, keys[i].ObjType());
+    EXPECT_TRUE(raw == keys[i]);
+    EXPECT_TRUE(keys[i] == raw);
+    EXPECT_NE(absl::StrCat(s, "x"), keys[i]);
+  }
+  EXPECT_FALSE(keys[1] == keys[2]);
+
+  // Long suffixes are kept in small strings.
+  string s = absl::StrCat(prefix, string(40, 'x'));
+  cobj_.SetPrefixedString(s);
+  CompactObj obj;
+  obj.SetPrefixedString(s);
+  EXPECT_GT(cobj_.MallocUsed(), 0);
+  EXPECT_EQ(s, cobj_);
+  EXPECT_EQ(s, cobj_.ToString());
+  EXPECT_EQ(CompactObj::HashCode(s), cobj_.HashCode());
+  EXPECT_TRUE(cobj_ == obj);
+  EXPECT_FALSE(cobj_ == keys[0]);
+
+  // The prefix is forgotten once no key uses it.
+  keys.clear();
+  obj.Reset();
+  EXPECT_EQ(1, CompactObj::GetStats().key_prefixes);
+  cobj_.SetString(s);
+  EXPECT_EQ(0, CompactObj::GetStats().key_prefixes);
+  EXPECT_EQ(s, cobj_);
+
+  // A prefix learned for a key whose suffix can't be encoded is not kept.
+  s = absl::StrCat(prefix, string(SmallString::kMaxSize + 1, 'y'));
+  for (unsigned i = 0; i < KeyPrefixDict::kLearnThreshold; ++i)
+    cobj_.SetPrefixedString(s);
+  EXPECT_EQ(0, CompactObj::GetStats().key_prefixes);
+  EXPECT_EQ(s, cobj_);
+
+  CompactObj::InitKeyPrefixes(false);
+}
+
 TEST_F(CompactObjectTest, MediumString) {
   string tmp(511, 'b');
 
@@ -296,6 +377,195 @@ TEST_F(CompactObjectTest, MediumString) {
   EXPECT_EQ(27463, cobj_.Size());
 }
 
+TEST_F(CompactObjectTest, SmallStringOtherThread) {
+  // Non ascii strings that are stored as SmallString.
+  vector<string> vals;
+  vector<CompactObj> objs(100);
+  for (unsigned i = 0; i < objs.size(); ++i) {
+    vals.push_back(absl::StrCat(string(20 + i, '\xff'), i));
+    objs[i].SetString(vals.back());
+  }
+  uint64_t hash = objs[5].HashCode();
+
+  // The reader thread has no thread local SmallString state.
+  thread reader([&] {
+    string tmp;
+    for (unsigned i = 0; i < objs.size(); ++i) {
+      objs[i].GetString(&tmp);
+      EXPECT_EQ(vals[i], tmp);
+      EXPECT_TRUE(objs[i] == vals[i]);
+    }
+    EXPECT_EQ(hash, objs[5].HashCode());
+  });
+  reader.join();
+
+  for (auto& obj : objs)
+    obj.Reset();
+}
+
+TEST_F(CompactObjectTest, CompressedString) {
+  CompactObj::InitValueCompression(64);
+  auto make_val = [](unsigned i) {
+    return absl::StrCat(R"({"id":)", i, R"(,"name":"user)", i % 7, R"(","tags":["alpha","beta"],)",
+                        R"("address":{"city":"Springfield","street":"Evergreen Terrace"},)",
+                        R"("active":true,"score":)", i * 31 % 1000, "}");
+  };
+
+  // Enough values to train the dictionary.
+  vector<string> vals;
+  vector<CompactObj> objs(400);
+  for (unsigned i = 0; i < objs.size(); ++i) {
+    vals.push_back(make_val(i));
+    objs[i].SetCompressedString(vals.back());
+  }
+  EXPECT_GT(CompactObj::GetStats().compression_saved_bytes, 0u);
+
+  for (unsigned i = 0; i < objs.size(); ++i) {
+    const string& val = vals[i];
+    CompactObj raw{val};
+    EXPECT_EQ(val.size(), objs[i].Size());
+    EXPECT_EQ(val, objs[i].GetSlice(&tmp_));
+    EXPECT_EQ(val, objs[i].ToString());
+    EXPECT_EQ(val, objs[i]);
+    EXPECT_NE(absl::StrCat(val, "x"), objs[i]);
+    EXPECT_EQ(CompactObj::HashCode(val), objs[i].HashCode());
+    EXPECT_EQ(OBJ_STRING, objs[i].ObjType());
+    EXPECT_EQ(OBJ_ENCODING_RAW, objs[i].Encoding());
+    EXPECT_TRUE(raw == objs[i]);
+    EXPECT_TRUE(objs[i] == raw);
+  }
+  size_t last = objs.size() - 1;
+  EXPECT_LT(objs[last].MallocUsed(), vals[last].size() / 2);
+  EXPECT_FALSE(objs[1] == objs[2]);
+
+  thread reader([&] {
+    string tmp;
+    for (unsigned i = 0; i < objs.size(); ++i) {
+      objs[i].GetString(&tmp);
+      EXPECT_EQ(vals[i], tmp);
+    }
+  });
+  reader.join();
+
+  // Short and random values are stored as is.
+  string val(40, 'x');
+  cobj_.SetCompressedString(val);
+  EXPECT_EQ(val, cobj_);
+  EXPECT_EQ(val.size(), cobj_.Size());
+
+  mt19937 generator(1);
+  val.resize(1000);
+  for (char& c : val)
+    c = generator();
+  cobj_.SetCompressedString(val);
+  EXPECT_GE(cobj_.MallocUsed(), val.size());
+  EXPECT_EQ(val, cobj_.ToString());
+
+  objs.clear();
+  cobj_.Reset();
+  EXPECT_EQ(0u, CompactObj::GetStats().compression_saved_bytes);
+  CompactObj::InitValueCompression(0);
+}
+
+TEST_F(CompactObjectTest, SharedString) {
+  CompactObj::InitValueDedup(64);
+  string val(1000, 'v');
+  string other = val + "x";
+
+  vector<CompactObj> objs(10);
+  for (auto& obj : objs)
+    obj.SetCompressedString(val);
+  cobj_.SetCompressedString(other);
+
+  auto stats = CompactObj::GetStats();
+  EXPECT_EQ(9 * val.size(), stats.dedup_saved_bytes);
+  EXPECT_GE(stats.shared_value_bytes, val.size() + other.size());
+  EXPECT_LT(stats.shared_value_bytes, val.size() + other.size() + 128);
+
+  for (const auto& obj : objs) {
+    EXPECT_EQ(10u, obj.SharedRefCount());
+    EXPECT_EQ(val, obj.GetSlice(&tmp_));
+    EXPECT_EQ(val, obj.GetRawString());
+    EXPECT_EQ(val.size(), obj.Size());
+    EXPECT_EQ(val, obj);
+    EXPECT_EQ(OBJ_ENCODING_RAW, obj.Encoding());
+    EXPECT_EQ(0u, obj.MallocUsed());
+    EXPECT_TRUE(CompactObj{val} == obj);
+  }
+  EXPECT_EQ(1u, cobj_.SharedRefCount());
+  EXPECT_FALSE(objs[0] == cobj_);
+
+  // Setting a value releases the reference of the shared blob.
+  objs[0].SetCompressedString(other);
+  EXPECT_EQ(9u, objs[1].SharedRefCount());
+  EXPECT_EQ(2u, cobj_.SharedRefCount());
+  objs[1].SetString(val);
+  EXPECT_EQ(0u, objs[1].SharedRefCount());
+  EXPECT_EQ(8u, objs[2].SharedRefCount());
+  EXPECT_TRUE(objs[1] == objs[2]);
+
+  // Short values are not shared.
+  cobj_.SetCompressedString(string(40, 'v'));
+  EXPECT_EQ(0u, cobj_.SharedRefCount());
+
+  objs.clear();
+  cobj_.Reset();
+  stats = CompactObj::GetStats();
+  EXPECT_EQ(0u, stats.dedup_saved_bytes);
+  EXPECT_EQ(0u, stats.shared_value_bytes);
+  CompactObj::InitValueDedup(0);
+}
+
+TEST_F(CompactObjectTest, RawString) {
+  cobj_.SetString("short");
+  EXPECT_TRUE(cobj_.GetRawString().empty());
+
+  // Ascii strings are packed.
+  cobj_.SetString(string(1000, 'a'));
+  EXPECT_TRUE(cobj_.GetRawString().empty());
+
+  string val(1000, '\xff');
+  cobj_.SetString(val);
+  string_view raw = cobj_.GetRawString();
+  EXPECT_EQ(val, raw);
+
+  CompactObj moved = std::move(cobj_);
+  EXPECT_EQ(raw.data(), moved.GetRawString().data());
+}
+
+TEST_F(CompactObjectTest, RawRange) {
+  // Packed strings are not modified in place.
+  cobj_.SetString(string(1000, 'a'));
+  EXPECT_FALSE(cobj_.SetRawRange(0, "b"));
+  EXPECT_EQ(string(1000, 'a'), cobj_.ToString());
+
+  string val(1000, 'a');
+  cobj_.SetRawString(val);
+  EXPECT_EQ(val, cobj_.GetRawString());
+  ASSERT_TRUE(cobj_.SetRawRange(10, "bcd"));
+  val.replace(10, 3, "bcd");
+  EXPECT_EQ(val, cobj_.ToString());
+
+  // Appends grow the blob geometrically, so most of them don't move it.
+  const char* data = cobj_.GetRawString().data();
+  unsigned moves = 0;
+  for (unsigned i = 0; i < 1000; ++i) {
+    ASSERT_TRUE(cobj_.SetRawRange(cobj_.Size(), "xyz"));
+    val.append("xyz");
+    const char* next = cobj_.GetRawString().data();
+    moves += next != data;
+    data = next;
+  }
+  EXPECT_EQ(val, cobj_.ToString());
+  EXPECT_LT(moves, 10u);
+
+  // Writing past the end pads the string with zeros.
+  ASSERT_TRUE(cobj_.SetRawRange(val.size() + 2, "e"));
+  val.append(string_view{"\0\0e", 3});
+  EXPECT_EQ(val, cobj_.ToString());
+  EXPECT_EQ(val.size(), cobj_.Size());
+}
+
 TEST_F(CompactObjectTest, AsciiUtil) {
   std::string_view data{"aaaaaabb"};
   uint8_t buf[32];
@@ -337,6 +607,39 @@ TEST_F(CompactObjectTest, IntSet) {
   EXPECT_GT(cobj_.MallocUsed(), 0);
 }
 
+TEST_F(CompactObjectTest, LazyFree) {
+  constexpr size_t kNumElems = 1000;
+  StringSet* ss = CompactObj::AllocateMR<StringSet>();
+  for (size_t i = 0; i < kNumElems; ++i)
+    ss->Add(absl::StrCat("elem", i));
+  cobj_.InitRobj(OBJ_SET, kEncodingStrMap2, ss);
+
+  LazyFreeQueue queue;
+  size_t set_bytes = cobj_.MallocUsed();
+  queue.Push(&cobj_);
+  EXPECT_EQ(0, cobj_.Size());
+  EXPECT_EQ(set_bytes, queue.pending_bytes());
+
+  QList* ql = CompactObj::AllocateMR<QList>(-2, CompactObj::memory_resource());
+  for (size_t i = 0; i < kNumElems; ++i)
+    ql->Push(absl::StrCat("item", i), QList::TAIL);
+  CompactObj list;
+  list.InitRobj(OBJ_LIST, kEncodingQL2, ql);
+  queue.Push(&list);
+
+  cobj_.SetString("small");
+  queue.Push(&cobj_);
+  EXPECT_EQ(3u, queue.size());
+
+  unsigned steps = 0;
+  while (!queue.Empty()) {
+    EXPECT_LE(queue.Step(100), 120u);
+    ++steps;
+  }
+  EXPECT_GE(steps, 2 * kNumElems / 120);
+  EXPECT_EQ(0u, queue.pending_bytes());
+}
+
 TEST_F(CompactObjectTest, ZSet) {
   // unrelated, checking that sds static encoding works.
   // it is used in zset special strings.
@@ -574,6 +877,43 @@ TEST_F(CompactObjectTest, DefragHash) {
   }
 }
 
+// Intsets are single blobs like listpacks, DenseSet based sets move their members like StringMap.
+TEST_F(CompactObjectTest, DefragIntSet) {
+  vector<intset*> sets(1000);
+  for (size_t i = 0; i < sets.size(); i++) {
+    intset* is = intsetNew();
+    for (int64_t j = 0; j < 100; j++)
+      is = intsetAdd(is, j * 1000, nullptr);
+    sets[i] = is;
+  }
+
+  for (size_t i = 0; i < sets.size(); i++) {
+    if (i % 10 != 0)
+      zfree(sets[i]);
+  }
+
+  intset* target = nullptr;
+  for (size_t i = 0; i < sets.size(); i += 10) {
+    if (zmalloc_page_is_underutilized(sets[i], 0.8))
+      target = sets[i];
+  }
+  CHECK_NE(target, nullptr);
+
+  cobj_.InitRobj(OBJ_SET, kEncodingIntSet, target);
+  ASSERT_TRUE(cobj_.DefragIfNeeded(0.8));
+
+  intset* is = (intset*)cobj_.RObjPtr();
+  EXPECT_NE(is, target) << "must have changed due to realloc";
+  ASSERT_EQ(intsetLen(is), 100u);
+  for (int64_t j = 0; j < 100; j++)
+    EXPECT_TRUE(intsetFind(is, j * 1000));
+
+  for (size_t i = 0; i < sets.size(); i += 10) {
+    if (sets[i] != target)
+      zfree(sets[i]);
+  }
+}
+
 static void ascii_pack_naive(const char* ascii, size_t len, uint8_t* bin) {
   const char* end = ascii + len;
 
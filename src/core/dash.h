@@ -119,6 +119,7 @@ class DashTable : public detail::DashTableBase {
             PMR_NS::memory_resource* mr = PMR_NS::get_default_resource());
   ~DashTable();
 
+  // Grows and pre-splits the table so that inserting up to size entries rarely splits segments.
   void Reserve(size_t size);
 
   // false for duplicate, true if inserted.
@@ -153,6 +154,11 @@ class DashTable : public detail::DashTableBase {
   // Pred accepts either (const key&) or (const key&, const value&)
   template <typename Pred> iterator FindFirst(uint64_t key_hash, Pred&& pred);
 
+  // Looks up num keys and writes the results into dest[0..num).
+  // Unlike calling Find() in a loop, it hashes the keys and prefetches their segments
+  // and buckets before comparing the fingerprints, so the cache misses of different keys overlap.
+  template <typename U> void FindBatch(const U* keys, size_t num, iterator* dest);
+
   // it must be valid.
   void Erase(iterator it);
 
@@ -233,6 +239,21 @@ class DashTable : public detail::DashTableBase {
   // Returns: cursor that is guaranteed to be less than 2^40.
   template <typename Cb> Cursor Traverse(Cursor curs, Cb&& cb);
 
+  // Called before Traverse(curs) by traversals that are bound by memory latency. Prefetches the
+  // buckets of the logical bucket a few cursors ahead, and calls cb(key, value) for the entries
+  // of the next one, whose buckets the earlier calls prefetched, so that cb can prefetch the
+  // allocations they point to. Over-approximates the entries and does not hash the keys.
+  template <typename Cb> void PrefetchTraversal(Cursor curs, Cb&& cb) const;
+
+  // Returns the cursor of the logical bucket that key hashes to. Unlike the cursors of Traverse,
+  // it encodes the segment bits of the hash at the maximal depth, so it keeps pointing to the
+  // segment that holds the key when the table grows or shrinks.
+  template <typename U> Cursor KeyCursor(const U& key) const;
+
+  // Calls cb(iterator) for the entries of the logical bucket at a cursor returned by KeyCursor,
+  // i.e. the entries of the segment that holds it, whose home bucket it is.
+  template <typename Cb> void TraverseLogicalBucket(Cursor curs, Cb&& cb);
+
   // Takes an iterator pointing to an entry in a dash bucket and traverses all bucket's entries by
   // calling cb(iterator) for every non-empty slot. The iteration goes over a physical bucket.
   template <typename Cb> void TraverseBucket(const_iterator it, Cb&& cb);
@@ -282,6 +303,13 @@ class DashTable : public detail::DashTableBase {
   bool ShiftRight(bucket_iterator it);
 
   template <typename BumpPolicy> iterator BumpUp(iterator it, const BumpPolicy& bp) {
+    // Bumping swaps entries between stash and regular buckets, which could move an entry
+    // that has not been split yet. It's just a heuristic so we skip it during the split.
+    if (split_.target &&
+        (segment_[it.seg_id_] == split_.source || segment_[it.seg_id_] == split_.target)) {
+      return it;
+    }
+
     SegmentIterator seg_it =
         segment_[it.seg_id_]->BumpUp(it.bucket_id_, it.slot_id_, DoHash(it->first), bp);
 
@@ -296,6 +324,40 @@ class DashTable : public detail::DashTableBase {
     return stash_unloaded_;
   }
 
+  uint64_t segments_merged() const {
+    return segments_merged_;
+  }
+
+  // Merges the segment at directory index seg_id with its buddy, i.e. the segment it has been
+  // split from or split into, if both have the same local depth and together they hold
+  // at most max_load * segment capacity entries. Lowers the directory depth when all the segments
+  // have smaller local depth than the global one. Segments of the initial table are never merged.
+  // Returns the directory index of the resulting segment (or of the original segment
+  // if nothing was merged), which is valid even if the directory has been resized.
+  // Invalidates iterators and does not preserve bucket versions of the moved entries
+  // relative to ongoing traversals, hence should not run during snapshotting.
+  uint32_t Merge(uint32_t seg_id, double max_load);
+
+  // Enables incremental splits when num_buckets > 0. In that mode a full segment is not split
+  // in one go. Instead, the new segment is linked into the directory right away and every
+  // following insertion moves at most num_buckets buckets from the source segment to the new one.
+  // Lookups consult both segments until the split completes. 0 (default) means full splits.
+  void set_split_step(unsigned num_buckets) {
+    if (num_buckets == 0)
+      FinishSplit();
+    split_step_ = num_buckets;
+  }
+
+  bool split_in_progress() const {
+    return split_.target != nullptr;
+  }
+
+  // Completes the pending incremental split, if there is one.
+  void FinishSplit() {
+    if (split_.target)
+      SplitStep(SegmentType::kBucketNum);
+  }
+
  private:
   enum class InsertMode {
     kInsertIfNotFound,
@@ -306,12 +368,28 @@ class DashTable : public detail::DashTableBase {
                                            InsertMode mode);
 
   void IncreaseDepth(unsigned new_depth);
+  void DecreaseDepth();
   void Split(uint32_t seg_id);
 
+  // Moves up to num_buckets regular buckets of the pending incremental split.
+  void SplitStep(unsigned num_buckets);
+
+  // Splits the bucket bid of the pending split unless it has been split already.
+  void SplitBucket(uint8_t bid);
+
+  // Returns (segment id, segment iterator). Takes into account the pending incremental split,
+  // i.e. entries that belong to the target segment but still reside in the source one.
+  template <typename Pred>
+  std::pair<uint32_t, SegmentIterator> FindInternal(uint64_t key_hash, Pred&& pred) const;
+
   // Segment directory contains multiple segment pointers, some of them pointing to
   // the same object. IterateDistinct goes over all distinct segments in the table.
   template <typename Cb> void IterateDistinct(Cb&& cb);
 
+  // Number of distinct segments per local depth. Allows checking cheaply whether the directory
+  // can be shrunk after merging segments.
+  std::array<uint32_t, 33> depth_count_{};
+
   template <typename K> auto EqPred(const K& key) const {
     return [p = &policy_, &key](const auto& probe) -> bool { return p->Equal(probe, key); };
   }
@@ -319,8 +397,28 @@ class DashTable : public detail::DashTableBase {
   Policy policy_;
   std::vector<SegmentType*, PMR_NS::polymorphic_allocator<SegmentType*>> segment_;
 
+  // State of the incremental split. Since the directory is not resized while a split is pending,
+  // the segment ids stay valid until the split completes.
+  // Invariant: an entry that belongs to the target segment may only reside in a regular bucket
+  // of the source that has not been split yet. To preserve it, the stash buckets are split
+  // when the split starts, and the probing buckets of a key are split before the key is inserted
+  // into the source, because insertion may displace entries between neighbouring buckets.
+  struct SplitState {
+    SegmentType* source = nullptr;
+    SegmentType* target = nullptr;
+    uint32_t source_id = 0;
+    uint32_t target_id = 0;
+    uint8_t next_bid = 0;   // next regular bucket in source to split.
+    uint64_t done_mask = 0;  // regular buckets that have been split already.
+  };
+  static_assert(SegmentType::kBucketNum <= 64);
+
+  SplitState split_;
+  unsigned split_step_ = 0;
+
   uint64_t garbage_collected_ = 0;
   uint64_t stash_unloaded_ = 0;
+  uint64_t segments_merged_ = 0;
 };  // DashTable
 
 template <typename _Key, typename _Value, typename Policy>
@@ -519,6 +617,7 @@ DashTable<_Key, _Value, Policy>::DashTable(size_t capacity_log, const Policy& po
     ptr = pa.allocate(1);
     pa.construct(ptr, global_depth_);  //   new SegmentType(global_depth_);
   }
+  depth_count_[global_depth_] = segment_.size();
 }
 
 template <typename _Key, typename _Value, typename Policy>
@@ -538,6 +637,19 @@ DashTable<_Key, _Value, Policy>::~DashTable() {
 template <typename _Key, typename _Value, typename Policy>
 template <typename U, typename Cb>
 void DashTable<_Key, _Value, Policy>::CVCUponInsert(uint64_t ver_threshold, const U& key, Cb&& cb) {
+  if (split_.target) {
+    // Insertion advances the pending split which moves entries from the source segment
+    // to the target. We do not simulate it precisely, and instead report all the buckets of both.
+    for (uint32_t sid : {split_.source_id, split_.target_id}) {
+      const SegmentType* seg = segment_[sid];
+      for (uint8_t i = 0; i < SegmentType::kTotalBuckets; ++i) {
+        if (seg->GetVersion(i) < ver_threshold && !seg->GetBucket(i).IsEmpty()) {
+          cb(bucket_iterator{this, sid, i});
+        }
+      }
+    }
+  }
+
   uint64_t key_hash = DoHash(key);
   uint32_t seg_id = SegmentId(key_hash);
   assert(seg_id < segment_.size());
@@ -583,6 +695,8 @@ void DashTable<_Key, _Value, Policy>::CVCUponBump(uint64_t ver_upperbound, const
 
 template <typename _Key, typename _Value, typename Policy>
 void DashTable<_Key, _Value, Policy>::Clear() {
+  split_ = SplitState{};
+
   auto cb = [this](SegmentType* seg) {
     seg->TraverseAll([this, seg](const SegmentIterator& it) {
       policy_.DestroyKey(seg->Key(it.index, it.slot));
@@ -632,6 +746,8 @@ void DashTable<_Key, _Value, Policy>::Clear() {
     global_depth_ = initial_depth_;
     unique_segments_ = new_size;
     segment_.resize(new_size);
+    depth_count_.fill(0);
+    depth_count_[initial_depth_] = new_size;
   }
 }
 
@@ -671,14 +787,8 @@ void DashTable<_Key, _Value, Policy>::IterateDistinct(Cb&& cb) {
 template <typename _Key, typename _Value, typename Policy>
 template <typename U>
 auto DashTable<_Key, _Value, Policy>::Find(U&& key) const -> const_iterator {
-  uint64_t key_hash = DoHash(key);
-  uint32_t seg_id = SegmentId(key_hash);  // seg_id takes up global_depth_ high bits.
-
-  // Hash structure is like this: [SSUUUUBF], where S is segment id, U - unused,
-  // B - bucket id and F is a fingerprint. Segment id is needed to identify the correct segment.
-  // Once identified, the segment instance uses the lower part of hash to locate the key.
-  // It uses 8 least significant bits for a fingerprint and few more bits for bucket id.
-  if (auto seg_it = segment_[seg_id]->FindIt(key_hash, EqPred(key)); seg_it.found()) {
+  auto [seg_id, seg_it] = FindInternal(DoHash(key), EqPred(key));
+  if (seg_it.found()) {
     return {this, seg_id, seg_it.index, seg_it.slot};
   }
   return {};
@@ -693,22 +803,66 @@ auto DashTable<_Key, _Value, Policy>::Find(U&& key) -> iterator {
 template <typename _Key, typename _Value, typename Policy>
 template <typename Pred>
 auto DashTable<_Key, _Value, Policy>::FindFirst(uint64_t key_hash, Pred&& pred) -> iterator {
-  uint32_t seg_id = SegmentId(key_hash);
-  if (auto seg_it = segment_[seg_id]->FindIt(key_hash, pred); seg_it.found()) {
+  auto [seg_id, seg_it] = FindInternal(key_hash, pred);
+  if (seg_it.found()) {
     return {this, seg_id, seg_it.index, seg_it.slot};
   }
   return {};
 }
 
+template <typename _Key, typename _Value, typename Policy>
+template <typename U>
+void DashTable<_Key, _Value, Policy>::FindBatch(const U* keys, size_t num, iterator* dest) {
+  constexpr size_t kBatchSize = 16;
+  uint64_t hashes[kBatchSize];
+
+  for (size_t offs = 0; offs < num; offs += kBatchSize) {
+    const size_t batch = std::min(kBatchSize, num - offs);
+
+    for (size_t i = 0; i < batch; ++i) {
+      hashes[i] = DoHash(keys[offs + i]);
+      __builtin_prefetch(&segment_[SegmentId(hashes[i])]);
+    }
+
+    for (size_t i = 0; i < batch; ++i) {
+      segment_[SegmentId(hashes[i])]->Prefetch(hashes[i]);
+    }
+
+    for (size_t i = 0; i < batch; ++i) {
+      dest[offs + i] = FindFirst(hashes[i], EqPred(keys[offs + i]));
+    }
+  }
+}
+
+template <typename _Key, typename _Value, typename Policy>
+template <typename Pred>
+auto DashTable<_Key, _Value, Policy>::FindInternal(uint64_t key_hash, Pred&& pred) const
+    -> std::pair<uint32_t, SegmentIterator> {
+  uint32_t seg_id = SegmentId(key_hash);  // seg_id takes up global_depth_ high bits.
+
+  // Hash structure is like this: [SSUUUUBF], where S is segment id, U - unused,
+  // B - bucket id and F is a fingerprint. Segment id is needed to identify the correct segment.
+  // Once identified, the segment instance uses the lower part of hash to locate the key.
+  // It uses 8 least significant bits for a fingerprint and few more bits for bucket id.
+  const SegmentType* target = segment_[seg_id];
+  SegmentIterator seg_it = target->FindIt(key_hash, pred);
+  if (!seg_it.found() && target == split_.target) {
+    // The entry may still reside in the source segment of the pending split.
+    seg_id = split_.source_id;
+    seg_it = split_.source->FindIt(key_hash, pred);
+  }
+  return {seg_id, seg_it};
+}
+
 template <typename _Key, typename _Value, typename Policy>
 size_t DashTable<_Key, _Value, Policy>::Erase(const Key_t& key) {
   uint64_t key_hash = DoHash(key);
-  size_t x = SegmentId(key_hash);
-  auto* target = segment_[x];
-  auto it = target->FindIt(key_hash, EqPred(key));
+  auto [seg_id, it] = FindInternal(key_hash, EqPred(key));
   if (!it.found())
     return 0;
 
+  auto* target = segment_[seg_id];
+
   policy_.DestroyKey(target->Key(it.index, it.slot));
   policy_.DestroyValue(target->Value(it.index, it.slot));
   target->Delete(it, key_hash);
@@ -736,13 +890,21 @@ void DashTable<_Key, _Value, Policy>::Reserve(size_t size) {
     return;
 
   size_t sg_floor = (size - 1) / SegmentType::capacity();
-  if (sg_floor < segment_.size()) {
-    return;
-  }
-  assert(sg_floor > 1u);
+  assert(sg_floor > 0u);
   unsigned new_depth = 1 + (63 ^ __builtin_clzll(sg_floor));
 
-  IncreaseDepth(new_depth);
+  FinishSplit();
+  if (new_depth > global_depth_)
+    IncreaseDepth(new_depth);
+
+  // Pre-split the segments to new_depth so that the insertions do not have to. The segments are
+  // split at once since there is no insertion traffic to amortize the incremental split over.
+  unsigned split_step = std::exchange(split_step_, 0);
+  for (uint32_t seg_id = 0; seg_id < segment_.size(); ++seg_id) {
+    while (segment_[seg_id]->local_depth() < new_depth)
+      Split(seg_id);
+  }
+  split_step_ = split_step;
 }
 
 template <typename _Key, typename _Value, typename Policy>
@@ -752,6 +914,10 @@ auto DashTable<_Key, _Value, Policy>::InsertInternal(U&& key, V&& value, Evictio
   uint64_t key_hash = DoHash(key);
   uint32_t target_seg_id = SegmentId(key_hash);
 
+  // Every insertion pays a bounded share of the pending split.
+  if (split_.target)
+    SplitStep(split_step_);
+
   while (true) {
     // Keep last global_depth_ msb bits of the hash.
     assert(target_seg_id < segment_.size());
@@ -760,6 +926,20 @@ auto DashTable<_Key, _Value, Policy>::InsertInternal(U&& key, V&& value, Evictio
     // Load heap allocated segment data - to avoid TLB miss when accessing the bucket.
     __builtin_prefetch(target, 0, 1);
 
+    if (mode == InsertMode::kInsertIfNotFound && target == split_.target) {
+      // The key may still reside in the source segment of the pending split.
+      if (auto src_it = split_.source->FindIt(key_hash, EqPred(key)); src_it.found()) {
+        return std::make_pair(iterator{this, split_.source_id, src_it.index, src_it.slot}, false);
+      }
+    }
+
+    if (target == split_.source) {
+      uint8_t bids[HotspotBuckets::kRegularBuckets];
+      SegmentType::FillProbeArray(key_hash, bids);
+      for (uint8_t bid : bids)
+        SplitBucket(bid);
+    }
+
     typename SegmentType::Iterator it;
     bool res = true;
     if (mode == InsertMode::kForceInsert) {
@@ -837,6 +1017,16 @@ auto DashTable<_Key, _Value, Policy>::InsertInternal(U&& key, V&& value, Evictio
       }
     }
 
+    // The segment takes part in the pending split - move more entries out of the source
+    // before trying again.
+    if (split_.target && (target == split_.source || target == split_.target)) {
+      SplitStep(std::max(split_step_, 1u));
+      continue;
+    }
+
+    // We allow one pending split at a time.
+    FinishSplit();
+
     if (!ev.CanGrow(*this)) {
       throw std::bad_alloc{};
     }
@@ -884,12 +1074,132 @@ void DashTable<_Key, _Value, Policy>::Split(uint32_t seg_id) {
 
   auto hash_fn = [this](const auto& k) { return policy_.HashFn(k); };
 
-  source->Split(std::move(hash_fn), target);  // increases the depth.
+  if (split_step_ == 0) {
+    source->Split(std::move(hash_fn), target);  // increases the depth.
+  } else {
+    // Link the target segment now, the entries will be moved gradually by SplitStep.
+    assert(split_.target == nullptr);
+    source->StartSplit(target);
+    split_ = SplitState{.source = source,
+                        .target = target,
+                        .source_id = uint32_t(start_idx),
+                        .target_id = uint32_t(start_idx + chunk_size / 2)};
+  }
   ++unique_segments_;
+  --depth_count_[target->local_depth() - 1];
+  depth_count_[target->local_depth()] += 2;
 
   for (size_t i = start_idx + chunk_size / 2; i < start_idx + chunk_size; ++i) {
     segment_[i] = target;
   }
+
+  if (split_step_ > 0) {
+    auto hash_fn = [this](const auto& k) { return policy_.HashFn(k); };
+    for (uint8_t bid = SegmentType::kBucketNum; bid < SegmentType::kTotalBuckets; ++bid) {
+      source->SplitBucket(hash_fn, target, bid);
+    }
+    SplitStep(split_step_);
+  }
+}
+
+template <typename _Key, typename _Value, typename Policy>
+uint32_t DashTable<_Key, _Value, Policy>::Merge(uint32_t seg_id, double max_load) {
+  assert(seg_id < segment_.size());
+  SegmentType* seg = segment_[seg_id];
+  const unsigned local_depth = seg->local_depth();
+  const size_t chunk_size = 1u << (global_depth_ - local_depth);
+  const uint32_t start_idx = seg_id & ~(chunk_size - 1);
+
+  if (local_depth <= initial_depth_ || split_.target)
+    return start_idx;
+
+  // The buddy differs from the segment in the last bit of the local depth prefix.
+  const uint32_t buddy_idx = start_idx ^ chunk_size;
+  SegmentType* buddy = segment_[buddy_idx];
+  if (buddy->local_depth() != local_depth)
+    return start_idx;
+
+  if (seg->SlowSize() + buddy->SlowSize() > max_load * SegmentType::capacity())
+    return start_idx;
+
+  // We always keep the left segment, since we later Split it the same way if we need to revert.
+  const uint32_t left_idx = std::min(start_idx, buddy_idx);
+  const uint32_t right_idx = std::max(start_idx, buddy_idx);
+  SegmentType* left = segment_[left_idx];
+  SegmentType* right = segment_[right_idx];
+  auto hash_fn = [this](const auto& k) { return policy_.HashFn(k); };
+
+  if (!left->MoveFrom(hash_fn, right)) {
+    // Move back the entries that were moved into the left segment.
+    for (uint8_t bid = 0; bid < SegmentType::kTotalBuckets; ++bid) {
+      left->SplitBucket(hash_fn, right, bid);
+    }
+    return start_idx;
+  }
+
+  left->set_local_depth(local_depth - 1);
+  std::fill(segment_.begin() + right_idx, segment_.begin() + right_idx + chunk_size, left);
+
+  PMR_NS::polymorphic_allocator<SegmentType> pa(segment_.get_allocator());
+  std::allocator_traits<decltype(pa)>::destroy(pa, right);
+  std::allocator_traits<decltype(pa)>::deallocate(pa, right, 1);
+
+  --unique_segments_;
+  ++segments_merged_;
+  depth_count_[local_depth] -= 2;
+  ++depth_count_[local_depth - 1];
+
+  uint32_t res = left_idx;
+  while (global_depth_ > initial_depth_ && depth_count_[global_depth_] == 0) {
+    DecreaseDepth();
+    res >>= 1;
+  }
+  return res;
+}
+
+template <typename _Key, typename _Value, typename Policy>
+void DashTable<_Key, _Value, Policy>::DecreaseDepth() {
+  assert(global_depth_ > initial_depth_);
+
+  // Every segment is referenced by at least 2 consecutive entries, so we keep every second one.
+  size_t new_size = segment_.size() / 2;
+  for (size_t i = 0; i < new_size; ++i) {
+    assert(segment_[2 * i] == segment_[2 * i + 1]);
+    segment_[i] = segment_[2 * i];
+  }
+  segment_.resize(new_size);
+  segment_.shrink_to_fit();
+  --global_depth_;
+}
+
+template <typename _Key, typename _Value, typename Policy>
+void DashTable<_Key, _Value, Policy>::SplitBucket(uint8_t bid) {
+  assert(bid < SegmentType::kBucketNum);
+  uint64_t mask = 1ULL << bid;
+  if (split_.done_mask & mask)
+    return;
+
+  auto hash_fn = [this](const auto& k) { return policy_.HashFn(k); };
+  split_.source->SplitBucket(hash_fn, split_.target, bid);
+  split_.done_mask |= mask;
+}
+
+template <typename _Key, typename _Value, typename Policy>
+void DashTable<_Key, _Value, Policy>::SplitStep(unsigned num_buckets) {
+  assert(split_.target);
+
+  for (unsigned i = 0; i < num_buckets && split_.next_bid < SegmentType::kBucketNum;) {
+    uint64_t mask = 1ULL << split_.next_bid;
+    if ((split_.done_mask & mask) == 0) {
+      SplitBucket(split_.next_bid);
+      ++i;
+    }
+    ++split_.next_bid;
+  }
+
+  if (split_.next_bid == SegmentType::kBucketNum) {
+    split_ = SplitState{};
+  }
 }
 
 template <typename _Key, typename _Value, typename Policy>
@@ -958,6 +1268,56 @@ auto DashTable<_Key, _Value, Policy>::Traverse(Cursor curs, Cb&& cb) -> Cursor {
   return Cursor{global_depth_, sid, bid};
 }
 
+template <typename _Key, typename _Value, typename Policy>
+template <typename Cb>
+void DashTable<_Key, _Value, Policy>::PrefetchTraversal(Cursor curs, Cb&& cb) const {
+  constexpr unsigned kDistance = 4;  // Of the bucket prefetch, in logical buckets.
+  if (curs.bucket_id() >= Policy::kBucketNum)
+    return;
+
+  uint32_t sid = curs.segment_id(global_depth_);
+  uint8_t bid = curs.bucket_id();
+
+  // Follows the order of Traverse, which ignores that it skips empty logical buckets.
+  for (unsigned i = 1; i <= kDistance; ++i) {
+    sid = NextSeg(sid);
+    if (sid >= segment_.size()) {
+      sid = 0;
+      if (++bid >= Policy::kBucketNum)
+        return;
+    }
+
+    if (i == 1)
+      segment_[sid]->ForEachInBuckets(bid, cb);
+  }
+  segment_[sid]->PrefetchBuckets(bid);
+}
+
+template <typename _Key, typename _Value, typename Policy>
+template <typename U>
+auto DashTable<_Key, _Value, Policy>::KeyCursor(const U& key) const -> Cursor {
+  // Cursors hold 32 bits of segment id, see DashCursor.
+  constexpr unsigned kMaxDepth = 32;
+  assert(global_depth_ <= kMaxDepth);
+
+  uint64_t key_hash = DoHash(key);
+  uint8_t bids[4];
+  SegmentType::FillProbeArray(key_hash, bids);
+  return Cursor{kMaxDepth, uint32_t(key_hash >> (64 - kMaxDepth)), bids[1]};
+}
+
+template <typename _Key, typename _Value, typename Policy>
+template <typename Cb>
+void DashTable<_Key, _Value, Policy>::TraverseLogicalBucket(Cursor curs, Cb&& cb) {
+  uint32_t sid = curs.segment_id(global_depth_);
+  uint8_t bid = curs.bucket_id();
+  assert(sid < segment_.size() && bid < Policy::kBucketNum);
+
+  auto hash_fun = [this](const auto& k) { return policy_.HashFn(k); };
+  auto dt_cb = [&](const SegmentIterator& it) { cb(iterator{this, sid, it.index, it.slot}); };
+  segment_[sid]->TraverseLogicalBucket(bid, hash_fun, std::move(dt_cb));
+}
+
 template <typename _Key, typename _Value, typename Policy>
 template <typename Cb>
 void DashTable<_Key, _Value, Policy>::TraverseBucket(const_iterator it, Cb&& cb) {
@@ -2,56 +2,37 @@
 // See LICENSE for licensing terms.
 //
 
+// DashTable micro-benchmarks. Run with --benchmark_format=json (or --benchmark_out=<file>
+// --benchmark_out_format=json) to get machine readable results and --benchmark_filter=<regex>
+// to select a subset. Benchmarks are parameterized by key size (8 means uint64 keys, otherwise
+// sds keys of that length) and by the load factor (in percents) of the table they run on.
+
+#include <absl/random/random.h>
+#include <absl/strings/str_format.h>
+#include <benchmark/benchmark.h>
 #include <mimalloc.h>
 
-#include <absl/base/internal/cycleclock.h>
-#include <absl/container/flat_hash_map.h>
-
 #include "base/hash.h"
-#include "base/histogram.h"
 #include "base/init.h"
 #include "core/dash.h"
 
 extern "C" {
-#include "redis/dict.h"
 #include "redis/sds.h"
 #include "redis/zmalloc.h"
 }
 
 using namespace std;
 
-ABSL_FLAG(uint32_t, n, 100000, "num items");
-ABSL_FLAG(string, type, "dash", "");
-ABSL_FLAG(bool, sds, false, "If true, uses sds as primary key");
+ABSL_FLAG(uint32_t, n, 1 << 20, "Number of items the benchmarked tables are sized for");
+ABSL_FLAG(bool, avx2, true, "If false, dash table probes fingerprints with sse only");
 
 namespace dfly {
 
-static uint64_t dictSdsHash(const void* key) {
-  return dictGenHashFunction((unsigned char*)key, sdslen((char*)key));
-}
-
-static int dictSdsKeyCompare(dict*, const void* key1, const void* key2) {
-  int l1, l2;
-
-  l1 = sdslen((sds)key1);
-  l2 = sdslen((sds)key2);
-  if (l1 != l2)
-    return 0;
-  return memcmp(key1, key2, l1) == 0;
-}
-
-static dictType SdsDict = {
-    dictSdsHash,       /* hash function */
-    NULL,              /* key dup */
-    NULL,              /* val dup */
-    dictSdsKeyCompare, /* key compare */
-    NULL,
-    // dictSdsDestructor, /* key destructor */
-    NULL, /* val destructor */
-    NULL,
-};
-
+// Both policies follow the layout and versioning of PrimeTable.
 struct UInt64Policy : public BasicDashPolicy {
+  enum { kSlotNum = 14, kBucketNum = 56, kStashBucketNum = 4 };
+  static constexpr bool kUseVersion = true;
+
   static uint64_t HashFn(uint64_t v) {
     return XXH3_64bits(&v, sizeof(v));
   }
@@ -59,7 +40,7 @@ struct UInt64Policy : public BasicDashPolicy {
 
 struct SdsDashPolicy {
   enum { kSlotNum = 14, kBucketNum = 56, kStashBucketNum = 4 };
-  static constexpr bool kUseVersion = false;
+  static constexpr bool kUseVersion = true;
 
   static uint64_t HashFn(sds u) {
     return XXH3_64bits(reinterpret_cast<const uint8_t*>(u), sdslen(u));
@@ -77,7 +58,7 @@ struct SdsDashPolicy {
   }
 
   static bool Equal(sds u1, sds u2) {
-    return dictSdsKeyCompare(nullptr, u1, u2) == 0;
+    return Equal(u1, std::string_view{u2, sdslen(u2)});
   }
 
   static bool Equal(sds u1, std::string_view u2) {
@@ -88,144 +69,350 @@ struct SdsDashPolicy {
 using Dash64 = DashTable<uint64_t, uint64_t, UInt64Policy>;
 using DashSds = DashTable<sds, uint64_t, SdsDashPolicy>;
 
-using absl::GetFlag;
+template <typename Table> struct KeyTraits;
+
+template <> struct KeyTraits<Dash64> {
+  using Key = uint64_t;
+
+  static Key Make(absl::BitGen* gen, size_t) {
+    return absl::Uniform<uint64_t>(*gen);
+  }
+
+  static uint64_t Own(Key k) {
+    return k;
+  }
+
+  static uint64_t View(Key k) {
+    return k;
+  }
+
+  static void Free(uint64_t) {
+  }
+};
+
+template <> struct KeyTraits<DashSds> {
+  using Key = string;
+
+  static Key Make(absl::BitGen* gen, size_t key_size) {
+    string res = absl::StrFormat("%016x", absl::Uniform<uint64_t>(*gen));
+    res.resize(key_size, 'x');
+    return res;
+  }
+
+  static sds Own(const Key& k) {
+    return sdsnewlen(k.data(), k.size());
+  }
+
+  static string_view View(const Key& k) {
+    return k;
+  }
+
+  static void Free(sds s) {
+    sdsfree(s);
+  }
+};
+
+template <typename Table> using KeyVec = vector<typename KeyTraits<Table>::Key>;
 
-inline void Sample(int64_t start, int64_t end, base::Histogram* hist) {
-  hist->Add((end - start) / 100);
+template <typename Table> KeyVec<Table> MakeKeys(size_t num, size_t key_size) {
+  absl::BitGen gen;
+  KeyVec<Table> res(num);
+  for (auto& k : res)
+    k = KeyTraits<Table>::Make(&gen, key_size);
+  return res;
 }
 
-Dash64 udt;
-DashSds sds_dt;
-base::Histogram hist;
+// Returns true if the key was inserted. Duplicates and keys that did not fit are released.
+template <typename Table, typename EvictionPolicy>
+bool InsertKey(const typename KeyTraits<Table>::Key& k, EvictionPolicy& ev, Table* table) {
+  auto key = KeyTraits<Table>::Own(k);
+  try {
+    if (table->Insert(key, 0, ev).second)
+      return true;
+  } catch (const bad_alloc&) {
+  }
+  KeyTraits<Table>::Free(key);
+  return false;
+}
 
-#define USE_TIME 1
+template <typename Table> void InsertAll(const KeyVec<Table>& keys, Table* table) {
+  typename Table::DefaultEvictionPolicy ev;
+  for (const auto& k : keys)
+    InsertKey(k, ev, table);
+}
 
-int64_t GetNow() {
-  #if USE_TIME
-    return absl::GetCurrentTimeNanos();
-#else
-    return absl::base_internal::CycleClock::Now();
-#endif
+template <typename Table> void Erase(const typename KeyTraits<Table>::Key& k, Table* table) {
+  auto it = table->Find(KeyTraits<Table>::View(k));
+  table->Erase(it);
 }
 
-#if defined(__i386__) || defined(__amd64__)
-  #define LFENCE __asm__ __volatile__("lfence")
-#else
-  #define LFENCE __asm__ __volatile__("ISB")
-#endif
+template <typename Table> struct NoGrowPolicy : public Table::DefaultEvictionPolicy {
+  bool CanGrow(const Table&) {
+    return false;
+  }
+};
 
-absl::flat_hash_map<uint64_t, uint64_t> mymap;
+// Grows the table with --n keys and then, without growing it further, erases or adds keys
+// until it reaches load_pct percents of its capacity. Returns the keys stored in the table.
+template <typename Table> KeyVec<Table> Fill(size_t key_size, unsigned load_pct, Table* table) {
+  typename Table::DefaultEvictionPolicy ev;
+  KeyVec<Table> keys;
+  for (const auto& k : MakeKeys<Table>(absl::GetFlag(FLAGS_n), key_size)) {
+    if (InsertKey(k, ev, table))
+      keys.push_back(k);
+  }
 
-void BenchFlat(uint64_t num) {
-  for (uint64_t i = 0; i < num; ++i) {
-    time_t start = GetNow();
-    mymap.emplace(i, 0);
-    LFENCE;
+  const size_t target = table->capacity() * load_pct / 100;
+  while (table->size() > target) {
+    Erase(keys.back(), table);
+    keys.pop_back();
+  }
 
-    time_t end = GetNow();
-    Sample(start, end, &hist);
+  // High loads are reachable only up to the point where inserts start to fail.
+  absl::BitGen gen;
+  NoGrowPolicy<Table> no_grow;
+  for (size_t attempts = target; table->size() < target && attempts > 0; --attempts) {
+    auto k = KeyTraits<Table>::Make(&gen, key_size);
+    if (InsertKey(k, no_grow, table))
+      keys.push_back(k);
   }
+  return keys;
 }
 
-void BenchDash(uint64_t num) {
-  for (uint64_t i = 0; i < num; ++i) {
-    time_t start = GetNow();
-    udt.Insert(i, 0);
-    LFENCE;
+template <typename Table> void SetCounters(const Table& table, benchmark::State& state) {
+  state.counters["load"] = table.load_factor();
+  state.counters["segments"] = table.unique_segments();
+}
 
-    time_t end = GetNow();
-    Sample(start, end, &hist);
+// Args: key size, presized. Without presizing the table grows from a single segment via
+// splits, otherwise every iteration inserts into a fresh table reserved for all the keys.
+template <typename Table> void BM_Insert(benchmark::State& state) {
+  const size_t num = absl::GetFlag(FLAGS_n);
+  auto keys = MakeKeys<Table>(num, state.range(0));
+  const bool presized = state.range(1);
+
+  for (auto _ : state) {
+    state.PauseTiming();
+    auto table = make_unique<Table>();
+    if (presized)
+      table->Reserve(num);
+    state.ResumeTiming();
+
+    InsertAll(keys, table.get());
+
+    state.PauseTiming();
+    SetCounters(*table, state);
+    table.reset();
+    state.ResumeTiming();
   }
+  state.SetItemsProcessed(state.iterations() * num);
 }
 
-inline sds Prefix() {
-  return sdsnew("xxxxxxxxxxxxxxxxxxxxxxx");
+// Args: key size, load percents.
+template <typename Table> void BM_FindHit(benchmark::State& state) {
+  Table table;
+  auto keys = Fill(state.range(0), state.range(1), &table);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.Find(KeyTraits<Table>::View(keys[i])));
+    if (++i == keys.size())
+      i = 0;
+  }
+  SetCounters(table, state);
 }
 
-void BenchDashSds(uint64_t num) {
-  sds key = sdscatsds(Prefix(), sdsfromlonglong(0));
-  for (uint64_t i = 0; i < num; ++i) {
-    time_t start = GetNow();
-    sds_dt.Insert(key, 0);
-    time_t end = GetNow();
-    Sample(start, end, &hist);
+template <typename Table> void BM_FindMiss(benchmark::State& state) {
+  Table table;
+  auto keys = Fill(state.range(0), state.range(1), &table);
+  auto missing = MakeKeys<Table>(keys.size(), state.range(0));
 
-    key = sdscatsds(Prefix(), sdsfromlonglong(i + 1));
+  size_t i = 0;
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(table.Find(KeyTraits<Table>::View(missing[i])));
+    if (++i == missing.size())
+      i = 0;
   }
+  SetCounters(table, state);
 }
 
-static uint64_t callbackHash(const void* key) {
-  return XXH64(&key, sizeof(key), 0);
+// Measures lookup + erase by iterator, refilling the table once all keys were erased.
+template <typename Table> void BM_Erase(benchmark::State& state) {
+  Table table;
+  auto keys = Fill(state.range(0), state.range(1), &table);
+  SetCounters(table, state);
+
+  size_t i = 0;
+  for (auto _ : state) {
+    if (i == keys.size()) {
+      state.PauseTiming();
+      InsertAll(keys, &table);
+      i = 0;
+      state.ResumeTiming();
+    }
+    Erase(keys[i++], &table);
+  }
 }
 
-static dictType IntDict = {callbackHash, NULL, NULL, NULL, NULL, NULL, NULL};
+// Full cursor scan as done by SCAN and expiry.
+template <typename Table> void BM_Traverse(benchmark::State& state) {
+  Table table;
+  Fill(state.range(0), state.range(1), &table);
 
-dict* redis_dict = nullptr;
+  for (auto _ : state) {
+    typename Table::Cursor cursor;
+    do {
+      cursor = table.Traverse(cursor, [](auto it) { benchmark::DoNotOptimize(it->second); });
+    } while (cursor);
+  }
+  state.SetItemsProcessed(state.iterations() * table.size());
+  SetCounters(table, state);
+}
 
-void BenchDict(uint64_t num) {
-  redis_dict = dictCreate(&IntDict);
+// Full scan the way SliceSnapshot does it: traverses the table, skipping buckets with a
+// newer version and walking the physical bucket of every reported entry otherwise.
+template <typename Table> void BM_SnapshotTraverse(benchmark::State& state) {
+  Table table;
+  Fill(state.range(0), state.range(1), &table);
+
+  uint64_t version = 0;
+  for (auto _ : state) {
+    ++version;
+    auto cb = [version](typename Table::iterator it) {
+      if (it.GetVersion() >= version)
+        return;
+      it.SetVersion(version);
+      for (typename Table::bucket_iterator bit(it); !bit.is_done(); ++bit) {
+        benchmark::DoNotOptimize(bit->second);
+      }
+    };
+
+    typename Table::Cursor cursor;
+    do {
+      cursor = table.Traverse(cursor, cb);
+    } while (cursor);
+  }
+  state.SetItemsProcessed(state.iterations() * table.size());
+  SetCounters(table, state);
+}
 
-  for (uint64_t i = 0; i < num; ++i) {
-    time_t start = GetNow();
-    dictAdd(redis_dict, (void*)i, nullptr);
-    LFENCE;
-    time_t end = GetNow();
-    Sample(start, end, &hist);
+// Physical traversal used by tiered storage offloading.
+template <typename Table> void BM_TraverseBySegmentOrder(benchmark::State& state) {
+  Table table;
+  Fill(state.range(0), state.range(1), &table);
+
+  for (auto _ : state) {
+    typename Table::Cursor cursor;
+    do {
+      cursor = table.TraverseBySegmentOrder(
+          cursor, [](auto it) { benchmark::DoNotOptimize(it->second); });
+    } while (cursor);
   }
+  state.SetItemsProcessed(state.iterations() * table.size());
+  SetCounters(table, state);
 }
 
-void BenchDictSds() {
-  uint64_t num = GetFlag(FLAGS_n);
+// Evicts the last slot of a stash bucket like PrimeEvictionPolicy does.
+template <typename Table> struct EvictPolicy {
+  static constexpr bool can_gc = false;
+  static constexpr bool can_evict = true;
 
-  sds key = sdscat(Prefix(), sdsfromlonglong(0));
-  redis_dict = dictCreate(&SdsDict);
+  bool CanGrow(const Table&) {
+    return false;
+  }
+
+  void RecordSplit(typename Table::Segment_t*) {
+  }
+
+  unsigned Evict(const typename Table::HotspotBuckets& hotb, Table* me) {
+    constexpr size_t kNumStashBuckets = ABSL_ARRAYSIZE(hotb.probes.by_type.stash_buckets);
+
+    evicted += me->ShiftRight(hotb.probes.by_type.stash_buckets[hotb.key_hash % kNumStashBuckets]);
+    return 1;
+  }
+
+  size_t evicted = 0;
+};
+
+// Inserts new keys into a table that is not allowed to grow.
+template <typename Table> void BM_InsertEvict(benchmark::State& state) {
+  Table table;
+  auto keys = Fill(state.range(0), state.range(1), &table);
+  auto fresh = MakeKeys<Table>(keys.size() * 4, state.range(0));
+  EvictPolicy<Table> policy;
+
+  size_t i = 0;
+  for (auto _ : state) {
+    InsertKey(fresh[i], policy, &table);
+    if (++i == fresh.size())
+      i = 0;
+  }
+  state.counters["evicted"] = policy.evicted;
+  SetCounters(table, state);
+}
 
-  for (uint64_t i = 0; i < num; ++i) {
-    time_t start = GetNow();
-    dictAdd(redis_dict, key, nullptr);
-    time_t end = GetNow();
-    Sample(start, end, &hist);
+void InsertArgs(benchmark::internal::Benchmark* b, initializer_list<int64_t> key_sizes) {
+  b->ArgNames({"key_size", "presized"});
+  for (int64_t ks : key_sizes) {
+    b->Args({ks, 0});
+    b->Args({ks, 1});
+  }
+}
 
-    key = sdscatsds(Prefix(), sdsfromlonglong(i + 1));
+void LoadArgs(benchmark::internal::Benchmark* b, initializer_list<int64_t> key_sizes) {
+  b->ArgNames({"key_size", "load"});
+  for (int64_t ks : key_sizes) {
+    for (int64_t load : {50, 70, 90}) {
+      b->Args({ks, load});
+    }
   }
 }
 
+void U64InsertArgs(benchmark::internal::Benchmark* b) {
+  InsertArgs(b, {8});
+}
+
+void SdsInsertArgs(benchmark::internal::Benchmark* b) {
+  InsertArgs(b, {16, 64});
+}
+
+void U64LoadArgs(benchmark::internal::Benchmark* b) {
+  LoadArgs(b, {8});
+}
+
+void SdsLoadArgs(benchmark::internal::Benchmark* b) {
+  LoadArgs(b, {16, 64});
+}
+
+#define DASH_BENCHMARK(fn, args, unit)                               \
+  BENCHMARK_TEMPLATE(fn, Dash64)->Apply(U64##args)->Unit(unit);   \
+  BENCHMARK_TEMPLATE(fn, DashSds)->Apply(Sds##args)->Unit(unit)
+
+DASH_BENCHMARK(BM_Insert, InsertArgs, benchmark::kMillisecond);
+DASH_BENCHMARK(BM_FindHit, LoadArgs, benchmark::kNanosecond);
+DASH_BENCHMARK(BM_FindMiss, LoadArgs, benchmark::kNanosecond);
+DASH_BENCHMARK(BM_Erase, LoadArgs, benchmark::kNanosecond);
+DASH_BENCHMARK(BM_Traverse, LoadArgs, benchmark::kMillisecond);
+DASH_BENCHMARK(BM_SnapshotTraverse, LoadArgs, benchmark::kMillisecond);
+DASH_BENCHMARK(BM_TraverseBySegmentOrder, LoadArgs, benchmark::kMillisecond);
+DASH_BENCHMARK(BM_InsertEvict, LoadArgs, benchmark::kNanosecond);
+
 }  // namespace dfly
 
 using namespace dfly;
 
 int main(int argc, char* argv[]) {
+  benchmark::Initialize(&argc, argv);
   MainInitGuard guard(&argc, &argv);
 
   init_zmalloc_threadlocal(mi_heap_get_backing());
 
-  string table_type = GetFlag(FLAGS_type);
-
-  bool is_sds = GetFlag(FLAGS_sds);
-  uint64_t start = absl::GetCurrentTimeNanos();
-  uint64_t num = GetFlag(FLAGS_n);
-
-  if (table_type == "dash") {
-    if (is_sds) {
-      BenchDashSds(num);
-    } else {
-      BenchDash(num);
-    }
-  } else if (table_type == "dict") {
-    if (is_sds) {
-      BenchDictSds();
-    } else {
-      BenchDict(num);
-    }
-  } else if (table_type == "flat") {
-    BenchFlat(num);
-  } else {
-    LOG(FATAL) << "Unknown type " << table_type;
-  }
+#if !defined(__aarch64__) && !defined(__s390x__)
+  use_avx2_cmp = use_avx2_cmp && absl::GetFlag(FLAGS_avx2);
+#endif
 
-  CONSOLE_INFO << "latencies histogram (jiffies, 100ns):\n" << hist.ToString();
-  uint64_t delta = (absl::GetCurrentTimeNanos() - start) / 1000000;
-  CONSOLE_INFO << "Took " << delta << " ms";
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
 
   return 0;
 }
@@ -148,6 +148,11 @@ template <unsigned NUM_SLOTS, unsigned NUM_STASH_FPS> class BucketBase {
     return mask & GetProbe(probe);
   }
 
+  // Same as Find() but probes two buckets in a single vectorized comparison.
+  // Bits [0, 16) of the result correspond to a, bits [16, 32) to b.
+  static uint32_t Find2(const BucketBase& a, bool probe_a, const BucketBase& b, bool probe_b,
+                        uint8_t fp_hash);
+
   uint8_t Fp(unsigned i) const {
     assert(i < finger_arr_.size());
     return finger_arr_[i];
@@ -328,7 +333,12 @@ template <typename _Key, typename _Value, typename Policy = DefaultSegmentPolicy
       this->SetHash(slot, meta_hash, probe);
     }
 
-    template <typename Pred> SlotId FindByFp(uint8_t fp_hash, bool probe, Pred&& pred) const;
+    template <typename Pred> SlotId FindByFp(uint8_t fp_hash, bool probe, Pred&& pred) const {
+      return FindByMask(this->Find(fp_hash, probe), std::forward<Pred>(pred));
+    }
+
+    // Returns the first slot in mask that satisfies pred.
+    template <typename Pred> SlotId FindByMask(unsigned mask, Pred&& pred) const;
 
     bool ShiftRight();
 
@@ -406,13 +416,23 @@ template <typename _Key, typename _Value, typename Policy = DefaultSegmentPolicy
 
   template <typename HashFn> void Split(HashFn&& hfunc, Segment* dest);
 
+  // Incremental version of Split. StartSplit increases the local depth of this segment and
+  // assigns it to dest, then SplitBucket moves the entries of bucket bid that belong to dest.
+  // Split is equivalent to StartSplit followed by SplitBucket over all the buckets.
+  // SplitBucket is idempotent: calling it again for the same bucket does not move anything.
+  void StartSplit(Segment* dest) {
+    ++local_depth_;
+    dest->local_depth_ = local_depth_;
+  }
+
+  template <typename HashFn> void SplitBucket(HashFn&& hfunc, Segment* dest, uint8_t bid);
+
   // Moves all the entries from 'src' segment to this segment.
-  // The calling code must ensure first that we actually can move all the key and we do not
-  // have hot, overfilled buckets that will prevent us from moving all the keys.
-  // If MoveFrom fails, the dashtable will abort, assert and will be left in an inconsistent state.
-  // If MoveFrom succeeds, the src segment will be left empty but with inconsistent metadata, so
-  // should it should be deallocated or reinitialized.
-  template <typename HashFn> void MoveFrom(HashFn&& hfunc, Segment* src);
+  // Returns false if some entry could not be moved because of hot, overfilled buckets.
+  // In that case the entries that have not been moved stay in src, and both segments are left
+  // in a consistent state, so the move can be reverted with SplitBucket.
+  // If MoveFrom succeeds, the src segment will be left empty.
+  template <typename HashFn> bool MoveFrom(HashFn&& hfunc, Segment* src);
 
   void Delete(const Iterator& it, Hash_t key_hash);
 
@@ -503,6 +523,32 @@ template <typename _Key, typename _Value, typename Policy = DefaultSegmentPolicy
   // Find item with given key hash and truthy predicate
   template <typename Pred> Iterator FindIt(Hash_t key_hash, Pred&& pred) const;
 
+  // Prefetches the home bucket of key_hash and its neighbour, i.e. the buckets FindIt visits first.
+  void Prefetch(Hash_t key_hash) const {
+    uint8_t bid = BucketIndex(key_hash);
+    __builtin_prefetch(&bucket_[bid]);
+    __builtin_prefetch(&bucket_[NextBid(bid)]);
+  }
+
+  // Prefetches all the cache lines of bucket bid and its neighbour, which hold the entries that
+  // TraverseLogicalBucket(bid) visits unless they are stashed.
+  void PrefetchBuckets(uint8_t bid) const {
+    for (uint8_t id : {bid, NextBid(bid)}) {
+      const char* ptr = reinterpret_cast<const char*>(&bucket_[id]);
+      for (size_t offs = 0; offs < sizeof(Bucket); offs += 64)
+        __builtin_prefetch(ptr + offs);
+    }
+  }
+
+  // Calls cb(key, value) for the entries of the buckets that PrefetchBuckets(bid) prefetches.
+  template <typename Cb> void ForEachInBuckets(uint8_t bid, Cb&& cb) const {
+    for (uint8_t id : {bid, NextBid(bid)}) {
+      bucket_[id].ForEachSlot([&](auto* bucket, SlotId slot, bool probe) {
+        cb(bucket->key[slot], bucket->value[slot]);
+      });
+    }
+  }
+
   // Returns valid iterator if succeeded or invalid if not (it's full).
   // Requires: key should be not present in the segment.
   // if spread is true, tries to spread the load between neighbour and home buckets,
@@ -953,6 +999,20 @@ uint32_t BucketBase<NUM_SLOTS, NUM_OVR>::CompareFP(uint8_t fp) const {
 }
 #endif
 
+template <unsigned NUM_SLOTS, unsigned NUM_OVR>
+uint32_t BucketBase<NUM_SLOTS, NUM_OVR>::Find2(const BucketBase& a, bool probe_a,
+                                               const BucketBase& b, bool probe_b,
+                                               uint8_t fp_hash) {
+#ifdef __s390x__
+  uint32_t mask = a.CompareFP(fp_hash) | (b.CompareFP(fp_hash) << 16);
+#else
+  uint32_t mask = CmpEqMask2x16(a.finger_arr_.data(), b.finger_arr_.data(), fp_hash);
+#endif
+  uint32_t valid = (a.GetBusy() & a.GetProbe(probe_a)) |
+                   ((b.GetBusy() & b.GetProbe(probe_b)) << 16);
+  return mask & valid;
+}
+
 // Bucket slot array goes from left to right: [x, x, ...]
 // Shift right vacates the first slot on the left by shifting all the elements right and
 // possibly deleting the last one on the right.
@@ -1022,9 +1082,7 @@ ___] |___ |__] |  | |___ | \|  |
 
 template <typename Key, typename Value, typename Policy>
 template <typename Pred>
-auto Segment<Key, Value, Policy>::Bucket::FindByFp(uint8_t fp_hash, bool probe, Pred&& pred) const
-    -> SlotId {
-  unsigned mask = this->Find(fp_hash, probe);
+auto Segment<Key, Value, Policy>::Bucket::FindByMask(unsigned mask, Pred&& pred) const -> SlotId {
   if (!mask)
     return kNanSlot;
 
@@ -1126,15 +1184,17 @@ auto Segment<Key, Value, Policy>::FindIt(Hash_t key_hash, Pred&& pred) const ->
   __builtin_prefetch(&target);
 
   uint8_t fp_hash = key_hash & kFpMask;
-  SlotId sid = target.FindByFp(fp_hash, false, pred);
+  uint8_t nid = NextBid(bidx);
+  const Bucket& probe = bucket_[nid];
+
+  // Probe fingerprints of the home and the neighbour buckets in one go.
+  uint32_t mask = BucketType::Find2(target, false, probe, true, fp_hash);
+  SlotId sid = target.FindByMask(mask & 0xFFFF, pred);
   if (sid != BucketType::kNanSlot) {
     return Iterator{bidx, sid};
   }
 
-  uint8_t nid = NextBid(bidx);
-  const Bucket& probe = bucket_[nid];
-
-  sid = probe.FindByFp(fp_hash, true, pred);
+  sid = probe.FindByMask(mask >> 16, pred);
 
 #ifdef ENABLE_DASH_STATS
   stats.neighbour_probes++;
@@ -1161,7 +1221,25 @@ auto Segment<Key, Value, Policy>::FindIt(Hash_t key_hash, Pred&& pred) const ->
     stats.stash_overflow_probes++;
 #endif
 
-    for (unsigned i = 0; i < kStashBucketNum; ++i) {
+    unsigned i = 0;
+    for (; i + 1 < kStashBucketNum; i += 2) {
+      const Bucket& sb1 = bucket_[kBucketNum + i];
+      const Bucket& sb2 = bucket_[kBucketNum + i + 1];
+      uint32_t mask = BucketType::Find2(sb1, false, sb2, false, fp_hash);
+      if (!mask)
+        continue;
+
+      auto sid = sb1.FindByMask(mask & 0xFFFF, pred);
+      if (sid != BucketType::kNanSlot) {
+        return Iterator{uint8_t(kBucketNum + i), sid};
+      }
+      sid = sb2.FindByMask(mask >> 16, pred);
+      if (sid != BucketType::kNanSlot) {
+        return Iterator{uint8_t(kBucketNum + i + 1), sid};
+      }
+    }
+
+    if (i < kStashBucketNum) {
       auto sid = stash_cb(0, i);
       if (sid != BucketType::kNanSlot) {
         return Iterator{uint8_t(kBucketNum + i), sid};
@@ -1220,17 +1298,26 @@ void Segment<Key, Value, Policy>::Delete(const Iterator& it, Hash_t key_hash) {
 template <typename Key, typename Value, typename Policy>
 template <typename HFunc>
 void Segment<Key, Value, Policy>::Split(HFunc&& hfn, Segment* dest_right) {
-  ++local_depth_;
-  dest_right->local_depth_ = local_depth_;
+  StartSplit(dest_right);
 
   // versioning does not work when entries move across buckets.
   // we need to setup rules on how we do that
   // do_versioning();
-  auto is_mine = [this](Hash_t hash) { return (hash >> (64 - local_depth_) & 1) == 0; };
+  for (uint8_t i = 0; i < kTotalBuckets; ++i) {
+    SplitBucket(hfn, dest_right, i);
+  }
+}
 
-  for (unsigned i = 0; i < kBucketNum; ++i) {
-    uint32_t invalid_mask = 0;
+template <typename Key, typename Value, typename Policy>
+template <typename HFunc>
+void Segment<Key, Value, Policy>::SplitBucket(HFunc&& hfn, Segment* dest_right, uint8_t bid) {
+  assert(bid < kTotalBuckets);
+  assert(dest_right->local_depth_ == local_depth_);
+
+  auto is_mine = [this](Hash_t hash) { return (hash >> (64 - local_depth_) & 1) == 0; };
+  uint32_t invalid_mask = 0;
 
+  if (bid < kBucketNum) {
     auto cb = [&](auto* bucket, unsigned slot, bool probe) {
       auto& key = bucket->key[slot];
       Hash_t hash = hfn(key);
@@ -1273,64 +1360,65 @@ void Segment<Key, Value, Policy>::Split(HFunc&& hfn, Segment* dest_right) {
       }
     };
 
-    bucket_[i].ForEachSlot(std::move(cb));
-    bucket_[i].ClearSlots(invalid_mask);
+    bucket_[bid].ForEachSlot(std::move(cb));
+    bucket_[bid].ClearSlots(invalid_mask);
+    return;
   }
 
-  for (unsigned i = 0; i < kStashBucketNum; ++i) {
-    uint32_t invalid_mask = 0;
-    unsigned bid = kBucketNum + i;
-    Bucket& stash = bucket_[bid];
-
-    auto cb = [&](auto* bucket, unsigned slot, bool probe) {
-      auto& key = bucket->key[slot];
-      Hash_t hash = hfn(key);
+  unsigned stash_id = bid - kBucketNum;
+  Bucket& stash = bucket_[bid];
 
-      if (is_mine(hash)) {
-        // If the entry stays in the same segment we try to unload it back to the regular bucket.
-        Iterator it = TryMoveFromStash(i, slot, hash);
-        if (it.found()) {
-          invalid_mask |= (1u << slot);
-        }
+  auto cb = [&](auto* bucket, unsigned slot, bool probe) {
+    auto& key = bucket->key[slot];
+    Hash_t hash = hfn(key);
 
-        return;
+    if (is_mine(hash)) {
+      // If the entry stays in the same segment we try to unload it back to the regular bucket.
+      Iterator it = TryMoveFromStash(stash_id, slot, hash);
+      if (it.found()) {
+        invalid_mask |= (1u << slot);
       }
 
-      invalid_mask |= (1u << slot);
-      auto it = dest_right->InsertUniq(std::forward<Key_t>(bucket->key[slot]),
-                                       std::forward<Value_t>(bucket->value[slot]), hash, false);
-      (void)it;
-      assert(it.index != kNanBid);
+      return;
+    }
 
-      if constexpr (kUseVersion) {
-        // Update the version in the destination bucket.
-        uint64_t ver = bucket->GetVersion();
-        dest_right->bucket_[it.index].UpdateVersion(ver);
-      }
+    invalid_mask |= (1u << slot);
+    auto it = dest_right->InsertUniq(std::forward<Key_t>(bucket->key[slot]),
+                                     std::forward<Value_t>(bucket->value[slot]), hash, false);
+    (void)it;
+    assert(it.index != kNanBid);
 
-      // Remove stash reference pointing to stach bucket i.
-      RemoveStashReference(i, hash);
-    };
+    if constexpr (kUseVersion) {
+      // Update the version in the destination bucket.
+      uint64_t ver = bucket->GetVersion();
+      dest_right->bucket_[it.index].UpdateVersion(ver);
+    }
 
-    stash.ForEachSlot(std::move(cb));
-    stash.ClearSlots(invalid_mask);
-  }
+    // Remove stash reference pointing to stach bucket i.
+    RemoveStashReference(stash_id, hash);
+  };
+
+  stash.ForEachSlot(std::move(cb));
+  stash.ClearSlots(invalid_mask);
 }
 
 template <typename Key, typename Value, typename Policy>
 template <typename HFunc>
-void Segment<Key, Value, Policy>::MoveFrom(HFunc&& hfunc, Segment* src) {
+bool Segment<Key, Value, Policy>::MoveFrom(HFunc&& hfunc, Segment* src) {
   for (unsigned bid = 0; bid < kTotalBuckets; ++bid) {
     Bucket& src_bucket = src->bucket_[bid];
+    uint32_t moved_mask = 0;
     bool success = true;
-    auto cb = [&, hfunc = std::move(hfunc)](Bucket* bucket, unsigned slot, bool probe) {
+    auto cb = [&](Bucket* bucket, unsigned slot, bool probe) {
+      if (!success)
+        return;
+
       auto& key = bucket->key[slot];
       Hash_t hash = hfunc(key);
 
+      // InsertUniq does not touch key and value if it fails.
       auto it = this->InsertUniq(std::forward<Key_t>(key),
                                  std::forward<Value_t>(bucket->value[slot]), hash, false);
-      (void)it;
-      assert(it.index != kNanBid);
       if (it.index == kNanBid) {
         success = false;
         return;
@@ -1340,12 +1428,19 @@ void Segment<Key, Value, Policy>::MoveFrom(HFunc&& hfunc, Segment* src) {
         // Update the version in the destination bucket.
         this->bucket_[it.index].UpdateVersion(bucket->GetVersion());
       }
+
+      moved_mask |= (1u << slot);
+      if (bid >= kBucketNum) {
+        src->RemoveStashReference(bid - kBucketNum, hash);
+      }
     };
 
     src_bucket.ForEachSlot(std::move(cb));
+    src_bucket.ClearSlots(moved_mask);
     if (!success)
-      break;
+      return false;
   }
+  return true;
 }
 
 template <typename Key, typename Value, typename Policy>
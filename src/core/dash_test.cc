@@ -340,8 +340,50 @@ TEST_F(DashTest, Merge) {
 
   segment_.Split(&UInt64Policy::HashFn, &s2);
   ASSERT_EQ(segment_.SlowSize() + s2.SlowSize(), keys.size());
-  segment_.MoveFrom(&UInt64Policy::HashFn, &s2);
+  EXPECT_TRUE(segment_.MoveFrom(&UInt64Policy::HashFn, &s2));
   EXPECT_EQ(segment_.SlowSize(), keys.size());
+  EXPECT_EQ(0, s2.SlowSize());
+}
+
+TEST_F(DashTest, MergeSegments) {
+  constexpr size_t kNumItems = 50000;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    dt_.Insert(i, i);
+  }
+
+  const unsigned segments = dt_.unique_segments();
+  const unsigned depth = dt_.depth();
+  for (size_t i = 0; i < kNumItems; ++i) {
+    if (i % 16 != 0)
+      dt_.Erase(i);
+  }
+
+  // Merge until reaching the fixed point.
+  uint64_t merged = 0;
+  do {
+    merged = dt_.segments_merged();
+    for (uint32_t sid = 0; sid < dt_.GetSegmentCount(); sid = dt_.NextSeg(sid)) {
+      sid = dt_.Merge(sid, 0.5);
+    }
+  } while (merged != dt_.segments_merged());
+
+  EXPECT_GT(dt_.segments_merged(), 0u);
+  EXPECT_EQ(segments - dt_.segments_merged(), dt_.unique_segments());
+  EXPECT_LT(dt_.depth(), depth);
+  EXPECT_LE(dt_.load_factor(), 1);
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    ASSERT_EQ(i % 16 != 0, dt_.Find(i).is_done()) << i;
+  }
+
+  // The table can grow again after merging.
+  for (size_t i = 0; i < kNumItems; ++i) {
+    dt_.Insert(i, i);
+  }
+  EXPECT_EQ(kNumItems, dt_.size());
+  for (size_t i = 0; i < kNumItems; ++i) {
+    ASSERT_FALSE(dt_.Find(i).is_done()) << i;
+  }
 }
 
 TEST_F(DashTest, BumpUp) {
@@ -501,6 +543,18 @@ TEST_F(DashTest, Reserve) {
   for (unsigned i = 0; i <= bc * 2; ++i) {
     dt_.Reserve(i);
     ASSERT_GE((1 << dt_.depth()) * Dash64::kSegCapacity, i);
+    ASSERT_EQ(1u << dt_.depth(), dt_.unique_segments());
+  }
+
+  constexpr size_t kNumItems = 50000;
+  dt_.Reserve(kNumItems * 2);
+  size_t segments = dt_.unique_segments();
+  for (size_t i = 0; i < kNumItems; ++i) {
+    dt_.Insert(i, i);
+  }
+  EXPECT_EQ(segments, dt_.unique_segments());
+  for (size_t i = 0; i < kNumItems; ++i) {
+    ASSERT_FALSE(dt_.Find(i).is_done());
   }
 }
 
@@ -543,6 +597,94 @@ TEST_F(DashTest, Insert) {
   ASSERT_TRUE(dt_.Find(some_val).is_done());
 }
 
+TEST_F(DashTest, IncrementalSplit) {
+  constexpr size_t kNumItems = 100000;
+  dt_.set_split_step(2);
+
+  bool seen_split = false;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    ASSERT_TRUE(dt_.Insert(i, i).second);
+    seen_split |= dt_.split_in_progress();
+
+    // Duplicates must be found even if they still reside in the source segment.
+    if (i % 13 == 0) {
+      ASSERT_FALSE(dt_.Insert(i / 2, 0).second);
+    }
+  }
+  EXPECT_TRUE(seen_split);
+  EXPECT_EQ(kNumItems, dt_.size());
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    Dash64::const_iterator it = dt_.Find(i);
+    ASSERT_TRUE(it != dt_.end()) << i;
+    ASSERT_EQ(it->second, i);
+  }
+
+  set<uint64_t> keys;
+  Dash64::Cursor cursor;
+  do {
+    cursor = dt_.Traverse(cursor, [&](const Dash64::iterator& it) { keys.insert(it->first); });
+  } while (cursor);
+  EXPECT_EQ(kNumItems, keys.size());
+
+  for (size_t i = 0; i < kNumItems; i += 2) {
+    ASSERT_EQ(1, dt_.Erase(i));
+  }
+  EXPECT_EQ(kNumItems / 2, dt_.size());
+
+  dt_.FinishSplit();
+  EXPECT_FALSE(dt_.split_in_progress());
+  for (size_t i = 1; i < kNumItems; i += 2) {
+    ASSERT_FALSE(dt_.Find(i).is_done()) << i;
+  }
+}
+
+TEST_F(DashTest, FindBatch) {
+  constexpr size_t kNumItems = 5000;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    dt_.Insert(i * 2, i);
+  }
+
+  vector<uint64_t> keys(kNumItems);
+  for (size_t i = 0; i < kNumItems; ++i) {
+    keys[i] = i;
+  }
+
+  vector<Dash64::iterator> res(kNumItems);
+  dt_.FindBatch(keys.data(), keys.size(), res.data());
+  for (size_t i = 0; i < kNumItems; ++i) {
+    ASSERT_EQ(i % 2 == 1, res[i].is_done()) << i;
+    if (i % 2 == 0) {
+      ASSERT_EQ(i, res[i]->first);
+      ASSERT_EQ(i / 2, res[i]->second);
+    }
+  }
+}
+
+#if !defined(__aarch64__) && !defined(__s390x__)
+TEST_F(DashTest, FindSimdPaths) {
+  constexpr size_t kNumItems = 20000;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    dt_.Insert(i * 2, i);
+  }
+
+  bool has_avx2 = use_avx2_cmp;
+  for (bool avx2 : {false, true}) {
+    if (avx2 && !has_avx2)
+      continue;
+    use_avx2_cmp = avx2;
+    for (size_t i = 0; i < kNumItems * 2; ++i) {
+      auto it = dt_.Find(i);
+      ASSERT_EQ(i % 2 == 1, it.is_done()) << i << " " << avx2;
+      if (i % 2 == 0) {
+        ASSERT_EQ(i / 2, it->second);
+      }
+    }
+  }
+  use_avx2_cmp = has_avx2;
+}
+#endif
+
 TEST_F(DashTest, Traverse) {
   constexpr auto kNumItems = 50;
   for (size_t i = 0; i < kNumItems; ++i) {
@@ -566,6 +708,49 @@ TEST_F(DashTest, Traverse) {
   EXPECT_EQ(kNumItems - 1, nums.back());
 }
 
+TEST_F(DashTest, PrefetchTraversal) {
+  constexpr auto kNumItems = 2000;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    dt_.Insert(i, i * 2);
+  }
+
+  // The entries passed to the callback are the ones that the next cursors traverse.
+  Dash64::Cursor cursor;
+  set<uint64_t> prefetched, traversed;
+  do {
+    dt_.PrefetchTraversal(cursor, [&](uint64_t key, uint64_t value) {
+      EXPECT_EQ(key * 2, value);
+      prefetched.insert(key);
+    });
+    cursor = dt_.Traverse(cursor, [&](Dash64::iterator it) { traversed.insert(it->first); });
+  } while (cursor);
+
+  EXPECT_EQ(kNumItems, traversed.size());
+  EXPECT_GT(prefetched.size(), kNumItems / 2);
+  for (uint64_t key : prefetched)
+    EXPECT_TRUE(traversed.count(key)) << key;
+}
+
+TEST_F(DashTest, KeyCursor) {
+  constexpr auto kNumItems = 200;
+  vector<Dash64::Cursor> cursors;
+  for (size_t i = 0; i < kNumItems; ++i) {
+    dt_.Insert(i, i);
+    cursors.push_back(dt_.KeyCursor(i));
+  }
+
+  // The cursors outlive the splits of the segments that held the keys.
+  for (size_t i = kNumItems; i < 10000; ++i)
+    dt_.Insert(i, i);
+  ASSERT_GT(dt_.unique_segments(), 1u);
+
+  for (size_t i = 0; i < kNumItems; ++i) {
+    bool found = false;
+    dt_.TraverseLogicalBucket(cursors[i], [&](Dash64::iterator it) { found |= it->first == i; });
+    EXPECT_TRUE(found) << i;
+  }
+}
+
 TEST_F(DashTest, Bucket) {
   constexpr auto kNumItems = 250;
   for (size_t i = 0; i < kNumItems; ++i) {
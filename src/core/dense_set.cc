@@ -25,8 +25,16 @@ constexpr size_t kMinSizeShift = 2;
 constexpr size_t kMinSize = 1 << kMinSizeShift;
 constexpr bool kAllowDisplacements = true;
 
+// Number of old buckets moved into the grown table by each insertion while rehashing.
+// Must be large enough for the rehashing to finish before the table needs to grow again.
+constexpr size_t kRehashBucketsPerStep = 4;
+
 DenseSet::IteratorBase::IteratorBase(const DenseSet* owner, bool is_end)
     : owner_(const_cast<DenseSet*>(owner)), curr_entry_(nullptr) {
+  // Iterators traverse only entries_; a full traversal is O(n) anyway.
+  if (!is_end)
+    owner_->FinishRehash();
+
   curr_list_ = is_end ? owner_->entries_.end() : owner_->entries_.begin();
 
   // Even if `is_end` is `false`, the list can be empty.
@@ -73,7 +81,7 @@ void DenseSet::IteratorBase::Advance() {
   DCHECK(!curr_entry_->IsEmpty());
 }
 
-DenseSet::DenseSet(MemoryResource* mr) : entries_(mr) {
+DenseSet::DenseSet(MemoryResource* mr) : entries_(mr), old_entries_(mr) {
 }
 
 DenseSet::~DenseSet() {
@@ -167,26 +175,56 @@ void* DenseSet::PopDataFront(DenseSet::ChainVectorIterator it) {
 }
 
 void DenseSet::ClearInternal() {
-  for (auto it = entries_.begin(); it != entries_.end(); ++it) {
-    while (!it->IsEmpty()) {
-      bool has_ttl = it->HasTtl();
-      bool is_displ = it->IsDisplaced();
-      void* obj = PopDataFront(it);
-      int32_t delta = int32_t(BucketId(obj, 0)) - int32_t(it - entries_.begin());
-      if (is_displ) {
-        DCHECK(delta < 2 || delta > -2);
-      } else {
-        DCHECK_EQ(delta, 0);
+  for (Buckets* entries : {&old_entries_, &entries_}) {
+    // old_entries_ is indexed by the bucket ids of the previous capacity.
+    unsigned shift = entries == &old_entries_ ? 1 : 0;
+    for (auto it = entries->begin(); it != entries->end(); ++it) {
+      while (!it->IsEmpty()) {
+        bool has_ttl = it->HasTtl();
+        bool is_displ = it->IsDisplaced();
+        void* obj = PopDataFront(it);
+        int32_t delta = int32_t(BucketId(obj, 0) >> shift) - int32_t(it - entries->begin());
+        if (is_displ) {
+          DCHECK(delta < 2 || delta > -2);
+        } else {
+          DCHECK_EQ(delta, 0);
+        }
+        ObjDelete(obj, has_ttl);
       }
-      ObjDelete(obj, has_ttl);
     }
   }
 
   entries_.clear();
+  old_entries_.clear();
+  rehash_idx_ = 0;
   num_used_buckets_ = 0;
   num_links_ = 0;
   size_ = 0;
   expiration_used_ = false;
+  next_expiry_ = UINT32_MAX;
+}
+
+uint32_t DenseSet::ClearStep(uint32_t cursor, uint32_t count) {
+  // Bucket ids of old_entries_ go first.
+  size_t old_size = old_entries_.size();
+  size_t total = old_size + entries_.size();
+  uint32_t deleted = 0;
+
+  // Visiting a bucket is cheaper than deleting an object, but sparse sets still need a bound.
+  size_t max_visits = size_t(count) * 8;
+  for (size_t visits = 0; cursor < total && deleted < count && visits < max_visits;
+       ++cursor, ++visits) {
+    auto it = cursor < old_size ? old_entries_.begin() + cursor
+                                : entries_.begin() + (cursor - old_size);
+    while (!it->IsEmpty()) {
+      bool has_ttl = it->HasTtl();
+      ObjDelete(PopDataFront(it), has_ttl);
+      ++deleted;
+    }
+  }
+
+  size_ -= min<uint32_t>(size_, deleted);
+  return cursor;
 }
 
 bool DenseSet::Equal(DensePtr dptr, const void* ptr, uint32_t cookie) const {
@@ -252,6 +290,7 @@ auto DenseSet::FindEmptyAround(uint32_t bid) -> ChainVectorIterator {
 }
 
 void DenseSet::Reserve(size_t sz) {
+  FinishRehash();
   sz = std::max<size_t>(sz, kMinSize);
 
   sz = absl::bit_ceil(sz);
@@ -312,6 +351,7 @@ void DenseSet::Grow(size_t prev_size) {
             // we want to make *prev a DensePtr instead of DenseLink and we
             // want to deallocate the link.
             DensePtr tmp = DensePtr::From(plink);
+            tmp.SetTtl(prev->HasTtl());  // the ttl bit of the link's object is kept in prev.
             DCHECK(ObjectAllocSize(tmp.GetObject()));
 
             FreeLink(plink);
@@ -337,6 +377,87 @@ void DenseSet::Grow(size_t prev_size) {
   }
 }
 
+void DenseSet::StartRehash() {
+  FinishRehash();
+
+  size_t prev_size = entries_.size();
+  old_entries_.swap(entries_);
+  entries_.resize(prev_size * 2);
+  ++capacity_log_;
+  rehash_idx_ = 0;
+}
+
+void DenseSet::RehashStep(size_t num_buckets) {
+  if (!IsRehashing())
+    return;
+
+  size_t end = old_entries_.size() - rehash_idx_ > num_buckets ? rehash_idx_ + num_buckets
+                                                                : old_entries_.size();
+  for (; rehash_idx_ < end; ++rehash_idx_) {
+    RehashBucket(rehash_idx_);
+  }
+
+  if (rehash_idx_ == old_entries_.size()) {
+    old_entries_.clear();
+    old_entries_.shrink_to_fit();
+    rehash_idx_ = 0;
+  }
+}
+
+void DenseSet::FinishRehash() {
+  RehashStep(SIZE_MAX);
+}
+
+void DenseSet::RehashAround(uint32_t bid) {
+  // An item of bucket bid may be displaced to one of its neighbours.
+  uint32_t first = bid > 0 ? bid - 1 : 0;
+  uint32_t last = std::min<size_t>(bid + 1, old_entries_.size() - 1);
+  for (uint32_t i = std::max<size_t>(first, rehash_idx_); i <= last; ++i) {
+    RehashBucket(i);
+  }
+}
+
+void DenseSet::RehashBucket(uint32_t bid) {
+  auto it = old_entries_.begin() + bid;
+  if (it->IsEmpty())
+    return;
+
+  --num_used_buckets_;
+  while (!it->IsEmpty()) {
+    InsertMoved(PopPtrFront(it));
+  }
+}
+
+void DenseSet::InsertMoved(DensePtr dptr) {
+  dptr.ClearDisplaced();
+  DCHECK(dptr.GetObject() != nullptr);
+
+  uint32_t bucket_id = BucketId(dptr.GetObject(), 0);
+  ChainVectorIterator list = FindEmptyAround(bucket_id);
+  if (list != entries_.end()) {
+    PushFront(list, dptr);
+    if (std::distance(entries_.begin(), list) != bucket_id) {
+      list->SetDisplaced(std::distance(entries_.begin() + bucket_id, list));
+    }
+    ++num_used_buckets_;
+    return;
+  }
+
+  // Same as in AddUnique, move the displaced items back to their home buckets.
+  while (!entries_[bucket_id].IsEmpty() && entries_[bucket_id].IsDisplaced()) {
+    DensePtr unlinked = PopPtrFront(entries_.begin() + bucket_id);
+
+    PushFront(entries_.begin() + bucket_id, dptr);
+    bucket_id -= unlinked.GetDisplacedDirection();
+    dptr = unlinked;
+    dptr.ClearDisplaced();
+  }
+
+  DCHECK_EQ(BucketId(dptr.GetObject(), 0), bucket_id);
+  PushFront(entries_.begin() + bucket_id, dptr);
+  DCHECK(!entries_[bucket_id].IsDisplaced());
+}
+
 auto DenseSet::AddOrFindDense(void* ptr, bool has_ttl) -> DensePtr* {
   uint64_t hc = Hash(ptr, 0);
 
@@ -346,6 +467,8 @@ auto DenseSet::AddOrFindDense(void* ptr, bool has_ttl) -> DensePtr* {
     uint32_t bucket_id = BucketId(hc);
     auto e = entries_.begin() + bucket_id;
     obj_malloc_used_ += PushFront(e, ptr, has_ttl);
+    if (has_ttl)
+      UpdateNextExpiry(ptr);
     ++size_;
     ++num_used_buckets_;
 
@@ -370,6 +493,10 @@ void DenseSet::AddUnique(void* obj, bool has_ttl, uint64_t hashcode) {
     entries_.resize(kMinSize);
   }
 
+  RehashStep(kRehashBucketsPerStep);
+  if (has_ttl)
+    UpdateNextExpiry(obj);
+
   uint32_t bucket_id = BucketId(hashcode);
 
   DCHECK_LT(bucket_id, entries_.size());
@@ -392,11 +519,8 @@ void DenseSet::AddUnique(void* obj, bool has_ttl, uint64_t hashcode) {
       break;
     }
 
-    size_t prev_size = entries_.size();
-    entries_.resize(prev_size * 2);
-    ++capacity_log_;
-
-    Grow(prev_size);
+    // Items are moved lazily into the grown table by the following insertions.
+    StartRehash();
     bucket_id = BucketId(hashcode);
   }
 
@@ -437,9 +561,18 @@ void DenseSet::AddUnique(void* obj, bool has_ttl, uint64_t hashcode) {
 
 auto DenseSet::Find2(const void* ptr, uint32_t bid, uint32_t cookie)
     -> tuple<size_t, DensePtr*, DensePtr*> {
-  DCHECK_LT(bid, entries_.size());
+  auto res = FindInBuckets(&entries_, ptr, bid, cookie);
+  if (std::get<2>(res) == nullptr && IsRehashing()) {
+    res = FindInBuckets(&old_entries_, ptr, bid >> 1, cookie);
+  }
+  return res;
+}
+
+auto DenseSet::FindInBuckets(Buckets* entries, const void* ptr, uint32_t bid, uint32_t cookie)
+    -> tuple<size_t, DensePtr*, DensePtr*> {
+  DCHECK_LT(bid, entries->size());
 
-  DensePtr* curr = &entries_[bid];
+  DensePtr* curr = &(*entries)[bid];
   ExpireIfNeeded(nullptr, curr);
 
   if (Equal(*curr, ptr, cookie)) {
@@ -448,7 +581,7 @@ auto DenseSet::Find2(const void* ptr, uint32_t bid, uint32_t cookie)
 
   // first look for displaced nodes since this is quicker than iterating a potential long chain
   if (bid > 0) {
-    curr = &entries_[bid - 1];
+    curr = &(*entries)[bid - 1];
     ExpireIfNeeded(nullptr, curr);
 
     if (Equal(*curr, ptr, cookie)) {
@@ -456,8 +589,8 @@ auto DenseSet::Find2(const void* ptr, uint32_t bid, uint32_t cookie)
     }
   }
 
-  if (bid + 1 < entries_.size()) {
-    curr = &entries_[bid + 1];
+  if (bid + 1 < entries->size()) {
+    curr = &(*entries)[bid + 1];
     ExpireIfNeeded(nullptr, curr);
 
     if (Equal(*curr, ptr, cookie)) {
@@ -466,7 +599,7 @@ auto DenseSet::Find2(const void* ptr, uint32_t bid, uint32_t cookie)
   }
 
   // if the node is not displaced, search the correct chain
-  DensePtr* prev = &entries_[bid];
+  DensePtr* prev = &(*entries)[bid];
   curr = prev->Next();
   while (curr != nullptr) {
     ExpireIfNeeded(prev, curr);
@@ -495,6 +628,7 @@ void DenseSet::Delete(DensePtr* prev, DensePtr* ptr) {
 
       DenseLinkKey* plink = prev->AsLink();
       DensePtr tmp = DensePtr::From(plink);
+      tmp.SetTtl(prev->HasTtl());  // the ttl bit of the link's object is kept in prev.
       DCHECK(ObjectAllocSize(tmp.GetObject()));
 
       FreeLink(plink);
@@ -516,21 +650,30 @@ void DenseSet::Delete(DensePtr* prev, DensePtr* ptr) {
 }
 
 void* DenseSet::PopInternal() {
-  ChainVectorIterator bucket_iter = entries_.begin();
+  // Pop the items that were not moved yet first, buckets before rehash_idx_ are empty.
+  Buckets* entries = &old_entries_;
+  ChainVectorIterator bucket_iter = old_entries_.begin() + rehash_idx_;
 
   // find the first non-empty chain
-  do {
-    while (bucket_iter != entries_.end() && bucket_iter->IsEmpty()) {
+  while (true) {
+    while (bucket_iter != entries->end() && bucket_iter->IsEmpty()) {
       ++bucket_iter;
     }
 
-    // empty set
-    if (bucket_iter == entries_.end()) {
-      return nullptr;
+    if (bucket_iter == entries->end()) {
+      // empty set
+      if (entries == &entries_)
+        return nullptr;
+
+      entries = &entries_;
+      bucket_iter = entries_.begin();
+      continue;
     }
 
     ExpireIfNeeded(nullptr, &(*bucket_iter));
-  } while (bucket_iter->IsEmpty());
+    if (!bucket_iter->IsEmpty())
+      break;
+  }
 
   if (bucket_iter->IsObject()) {
     --num_used_buckets_;
@@ -559,6 +702,10 @@ void* DenseSet::AddOrReplaceObj(void* obj, bool has_ttl) {
 
   ptr->SetObject(obj);
   ptr->SetTtl(has_ttl);
+  if (has_ttl) {
+    expiration_used_ = true;
+    UpdateNextExpiry(obj);
+  }
 
   return res;
 }
@@ -590,8 +737,12 @@ uint32_t DenseSet::Scan(uint32_t cursor, const ItemCb& cb) const {
 
   // First find the bucket to scan, skip empty buckets.
   // A bucket is empty if the current index is empty and the data is not displaced
-  // to the right or to the left.
-  while (entries_idx < entries_.size() && NoItemBelongsBucket(entries_idx)) {
+  // to the right or to the left. While rehashing, the items of the bucket that were not moved
+  // yet are still in the old table, so it must be checked as well.
+  while (entries_idx < entries_.size()) {
+    bool found_old = IsRehashing() && ScanOldBucket(entries_idx, cb);
+    if (found_old || !NoItemBelongsBucket(entries_idx))
+      break;
     ++entries_idx;
   }
 
@@ -647,6 +798,106 @@ uint32_t DenseSet::Scan(uint32_t cursor, const ItemCb& cb) const {
   return entries_idx << (32 - capacity_log_);
 }
 
+bool DenseSet::ScanOldBucket(uint32_t bid, const ItemCb& cb) const {
+  auto& entries = const_cast<DenseSet*>(this)->old_entries_;
+  uint32_t old_bid = bid >> 1;
+  bool found = false;
+
+  // An old bucket is split into two buckets of the grown table, so we report only the
+  // items that hash into bid.
+  auto visit = [&](const DensePtr* ptr) {
+    if (BucketId(ptr->GetObject(), 0) == bid) {
+      cb(ptr->GetObject());
+      found = true;
+    }
+  };
+
+  DensePtr* curr = &entries[old_bid];
+  ExpireIfNeeded(nullptr, curr);
+  if (!curr->IsEmpty() && !curr->IsDisplaced()) {
+    while (true) {
+      visit(curr);
+      if (!curr->IsLink())
+        break;
+
+      if (ExpireIfNeeded(curr, &curr->AsLink()->next) && !curr->IsLink()) {
+        break;
+      }
+      curr = &curr->AsLink()->next;
+    }
+  }
+
+  if (old_bid > 0) {
+    DensePtr* left_bucket = &entries[old_bid - 1];
+    ExpireIfNeeded(nullptr, left_bucket);
+    if (left_bucket->IsDisplaced() && left_bucket->GetDisplacedDirection() == -1) {
+      visit(left_bucket);
+    }
+  }
+
+  if (old_bid + 1 < entries.size()) {
+    DensePtr* right_bucket = &entries[old_bid + 1];
+    ExpireIfNeeded(nullptr, right_bucket);
+    if (right_bucket->IsDisplaced() && right_bucket->GetDisplacedDirection() == 1) {
+      visit(right_bucket);
+    }
+  }
+
+  return found;
+}
+
+bool DenseSet::DeleteExpiredStep(uint32_t* cursor, unsigned* budget) {
+  if (capacity_log_ == 0 || entries_.empty()) {
+    next_expiry_ = UINT32_MAX;
+    *cursor = 0;
+    return true;
+  }
+
+  // Spend the budget on moving the buckets first, so that the pass needs to cover only entries_.
+  if (IsRehashing()) {
+    unsigned steps = std::min<size_t>(*budget, old_entries_.size() - rehash_idx_);
+    RehashStep(steps);
+    *budget -= steps;
+    if (IsRehashing())
+      return false;
+  }
+
+  // The pass recomputes next_expiry_ from the items it visits and the items added meanwhile.
+  if (*cursor == 0)
+    next_expiry_ = UINT32_MAX;
+
+  size_t idx = *cursor >> (32 - capacity_log_);
+  for (; idx < entries_.size() && *budget > 0; ++idx, --*budget) {
+    DensePtr* curr = &entries_[idx];
+    DensePtr* prev = nullptr;
+
+    while (true) {
+      // If curr was the last item of the chain, prev is not a link anymore and was visited.
+      if (ExpireIfNeeded(prev, curr) && prev && !prev->IsLink())
+        break;
+
+      if (curr->IsEmpty())
+        break;
+
+      if (curr->HasTtl())
+        UpdateNextExpiry(curr->GetObject());
+
+      prev = curr;
+      curr = curr->Next();
+      if (curr == nullptr)
+        break;
+    }
+  }
+
+  if (idx >= entries_.size()) {
+    *cursor = 0;
+    return true;
+  }
+
+  *cursor = idx << (32 - capacity_log_);
+  return false;
+}
+
 auto DenseSet::NewLink(void* data, DensePtr next) -> DenseLinkKey* {
   LinkAllocator la(mr());
   DenseLinkKey* lk = la.allocate(1);
@@ -673,6 +924,10 @@ bool DenseSet::ExpireIfNeededInternal(DensePtr* prev, DensePtr* node) const {
     // updates the *node to next item if relevant or resets it to empty.
     const_cast<DenseSet*>(this)->Delete(prev, node);
     deleted = true;
+
+    // node was the tail of the chain and was freed together with the link of prev.
+    if (prev && !prev->IsLink())
+      break;
   } while (node->HasTtl());
 
   return deleted;
@@ -3,6 +3,7 @@
 //
 #pragma once
 
+#include <algorithm>
 #include <cassert>
 #include <cstddef>
 #include <cstdint>
@@ -236,12 +237,24 @@ class DenseSet {
   }
 
   size_t SetMallocUsed() const {
-    return entries_.capacity() * sizeof(DensePtr) + num_links_ * sizeof(DenseLinkKey);
+    return (entries_.capacity() + old_entries_.capacity()) * sizeof(DensePtr) +
+           num_links_ * sizeof(DenseLinkKey);
+  }
+
+  // Whether the set is in the middle of growing, i.e. some of its items still reside in the
+  // previous bucket array.
+  bool IsRehashing() const {
+    return !old_entries_.empty();
   }
 
   using ItemCb = std::function<void(const void*)>;
 
   uint32_t Scan(uint32_t cursor, const ItemCb& cb) const;
+
+  // Deletes the objects of the buckets from cursor on, until at least count objects were deleted,
+  // and returns the cursor to continue from. Lets a set that is no longer used be destroyed in
+  // steps, it is empty once Empty() returns true.
+  uint32_t ClearStep(uint32_t cursor, uint32_t count);
   void Reserve(size_t sz);
 
   // set an abstract time that allows expiry.
@@ -257,6 +270,18 @@ class DenseSet {
     return expiration_used_;
   }
 
+  // Lower bound of the expiry times of the items with ttl, or UINT32_MAX if there are none.
+  // Exact after a full DeleteExpiredStep pass, lowered by every insertion with ttl since then.
+  uint32_t NextExpiry() const {
+    return next_expiry_;
+  }
+
+  // Deletes the expired items in the buckets starting at cursor, which has the same semantics as
+  // in Scan. Visits at most *budget buckets and decreases the budget accordingly.
+  // Returns true if the pass over the whole set is finished, NextExpiry is exact then.
+  // Otherwise it should be continued with the updated cursor.
+  bool DeleteExpiredStep(uint32_t* cursor, unsigned* budget);
+
  protected:
   // Virtual functions to be implemented for generic data
   virtual uint64_t Hash(const void* obj, uint32_t cookie) const = 0;
@@ -278,13 +303,25 @@ class DenseSet {
 
   void* FindInternal(const void* obj, uint64_t hashcode, uint32_t cookie) const;
 
+  // Batched version of FindInternal, calls cb(i, obj) for each of objs[i] with the found object
+  // or nullptr. The buckets of a batch are prefetched first and then the objects they point to,
+  // so that the cache misses of the independent probes overlap.
+  template <typename T, typename Cb>
+  void FindInternalBatch(const T* objs, size_t num, uint32_t cookie, Cb&& cb) const;
+
   IteratorBase FindIt(const void* ptr, uint32_t cookie) {
     if (Empty())
       return IteratorBase{};
 
-    auto [bid, _, curr] = Find2(ptr, BucketId(ptr, cookie), cookie);
+    uint32_t bid = BucketId(ptr, cookie);
+
+    // Iterators point into entries_, so move the candidates out of the old array first.
+    if (IsRehashing())
+      RehashAround(bid >> 1);
+
+    auto [idx, _, curr] = FindInBuckets(&entries_, ptr, bid, cookie);
     if (curr) {
-      return IteratorBase(this, entries_.begin() + bid, curr);
+      return IteratorBase(this, entries_.begin() + idx, curr);
     }
     return IteratorBase{};
   }
@@ -319,6 +356,8 @@ class DenseSet {
   void AddUnique(void* obj, bool has_ttl, uint64_t hashcode);
 
  private:
+  using Buckets = std::vector<DensePtr, DensePtrAllocator>;
+
   DenseSet(const DenseSet&) = delete;
   DenseSet& operator=(DenseSet&) = delete;
 
@@ -345,6 +384,25 @@ class DenseSet {
   bool NoItemBelongsBucket(uint32_t bid) const;
   void Grow(size_t prev_size);
 
+  // Incremental rehashing: when the set grows, a twice larger bucket array replaces entries_
+  // and the items are moved from old_entries_ a few buckets at a time by the following mutations.
+  // Lookups search both arrays until all the buckets are moved. Iterators are not affected as
+  // creating them finishes the rehashing, while growing invalidates them anyway.
+  void StartRehash();
+  void RehashStep(size_t num_buckets);
+  void FinishRehash();
+
+  // Moves the items of old bucket bid and of its neighbours to entries_.
+  void RehashAround(uint32_t bid);
+  void RehashBucket(uint32_t bid);
+
+  // Inserts a pointer that was unlinked from old_entries_ without affecting the set's size.
+  void InsertMoved(DensePtr dptr);
+
+  // Calls cb for the items of old_entries_ that belong to bucket bid of entries_.
+  // Returns true if any item was found.
+  bool ScanOldBucket(uint32_t bid, const ItemCb& cb) const;
+
   // ============ Pseudo Linked List Functions for interacting with Chains ==================
   size_t PushFront(ChainVectorIterator, void* obj, bool has_ttl);
   void PushFront(ChainVectorIterator, DensePtr);
@@ -365,8 +423,13 @@ class DenseSet {
   }
 
   // returns bid and (prev, item) pair. If item is root, then prev is null.
+  // During rehashing the returned bid may refer to old_entries_.
   std::tuple<size_t, DensePtr*, DensePtr*> Find2(const void* ptr, uint32_t bid, uint32_t cookie);
 
+  // Same as Find2 but searches only the given bucket array.
+  std::tuple<size_t, DensePtr*, DensePtr*> FindInBuckets(Buckets* entries, const void* ptr,
+                                                         uint32_t bid, uint32_t cookie);
+
   DenseLinkKey* NewLink(void* data, DensePtr next);
 
   inline void FreeLink(DenseLinkKey* plink) {
@@ -385,11 +448,17 @@ class DenseSet {
 
   bool ExpireIfNeededInternal(DensePtr* prev, DensePtr* node) const;
 
+  void UpdateNextExpiry(const void* obj) {
+    next_expiry_ = std::min(next_expiry_, ObjExpireTime(obj));
+  }
+
   // Deletes the object pointed by ptr and removes it from the set.
   // If ptr is a link then it will be deleted internally.
   void Delete(DensePtr* prev, DensePtr* ptr);
 
-  std::vector<DensePtr, DensePtrAllocator> entries_;
+  Buckets entries_;
+  Buckets old_entries_;  // Not empty while rehashing, half the size of entries_.
+  size_t rehash_idx_ = 0;  // Buckets of old_entries_ before it were moved into entries_.
 
   mutable size_t obj_malloc_used_ = 0;
   mutable uint32_t size_ = 0;              // number of elements in the set.
@@ -398,6 +467,7 @@ class DenseSet {
   unsigned capacity_log_ = 0;
 
   uint32_t time_now_ = 0;
+  uint32_t next_expiry_ = UINT32_MAX;
 
   mutable bool expiration_used_ = false;
 };
@@ -411,4 +481,38 @@ inline void* DenseSet::FindInternal(const void* obj, uint64_t hashcode, uint32_t
   return ptr ? ptr->GetObject() : nullptr;
 }
 
+template <typename T, typename Cb>
+void DenseSet::FindInternalBatch(const T* objs, size_t num, uint32_t cookie, Cb&& cb) const {
+  constexpr size_t kBatchSize = 16;
+  uint64_t hashes[kBatchSize];
+
+  if (entries_.empty()) {
+    for (size_t i = 0; i < num; ++i)
+      cb(i, nullptr);
+    return;
+  }
+
+  for (size_t offs = 0; offs < num; offs += kBatchSize) {
+    const size_t batch = std::min(kBatchSize, num - offs);
+
+    for (size_t i = 0; i < batch; ++i) {
+      hashes[i] = Hash(&objs[offs + i], cookie);
+      __builtin_prefetch(&entries_[BucketId(hashes[i])]);
+      if (IsRehashing())
+        __builtin_prefetch(&old_entries_[BucketId(hashes[i]) >> 1]);
+    }
+
+    // Either the object itself or the first link of the chain.
+    for (size_t i = 0; i < batch; ++i) {
+      const DensePtr& ptr = entries_[BucketId(hashes[i])];
+      if (!ptr.IsEmpty())
+        __builtin_prefetch(ptr.Raw());
+    }
+
+    for (size_t i = 0; i < batch; ++i) {
+      cb(offs + i, FindInternal(&objs[offs + i], hashes[i], cookie));
+    }
+  }
+}
+
 }  // namespace dfly
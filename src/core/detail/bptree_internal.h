@@ -6,7 +6,11 @@
 
 #include <array>
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <utility>
+
+#include "core/sse_port.h"
 
 namespace dfly {
 
@@ -61,6 +65,7 @@ template <typename T> class BPNodeLayout {
   static constexpr uint16_t kKeyOffset = 4;                  // 4 bytes for metadata
   static constexpr uint16_t kSubTreeLen = sizeof(uint32_t);  // 4 bytes for count.
  public:
+  static constexpr bool kHasScores = false;
   static constexpr uint16_t kKeySize = sizeof(T);
   static constexpr uint16_t kMaxLeafKeys = (kBPNodeSize - kKeyOffset) / kKeySize;
   static constexpr uint16_t kMinLeafKeys = kMaxLeafKeys / 2;
@@ -84,6 +89,22 @@ template <typename T> class BPNodeLayout {
     return reinterpret_cast<const uint8_t*>(node) + kKeyOffset + kKeySize * index;
   }
 
+  static KeyT LoadKey(const void* node, bool leaf, unsigned index) {
+    KeyT res;
+    memcpy(&res, KeyPtr(index, node), kKeySize);
+    return res;
+  }
+
+  static void StoreKey(void* node, bool leaf, unsigned index, KeyT key) {
+    memcpy(KeyPtr(index, node), &key, kKeySize);
+  }
+
+  // Moves count keys from src_node[src] to dest_node[dest]. The ranges may overlap.
+  static void MoveKeys(void* dest_node, unsigned dest, const void* src_node, unsigned src,
+                       unsigned count, bool leaf) {
+    memmove(KeyPtr(dest, dest_node), KeyPtr(src, src_node), count * kKeySize);
+  }
+
   static uint8_t* TreeCountPtr(void* node) {
     return reinterpret_cast<uint8_t*>(node) + kKeyOffset + kKeySize * kMaxInnerKeys;
   }
@@ -103,6 +124,120 @@ template <typename T> class BPNodeLayout {
   static_assert(kMaxLeafKeys < 128);
 };
 
+// Item of a tree that is ordered by score first, for example a sorted set entry.
+// A NaN score marks a query key that ignores the scores, it is never stored in the tree.
+struct ScoredItem {
+  double score;
+  void* member;
+};
+
+/**
+ * @brief Layout of nodes holding ScoredItem keys. The scores and the members are stored in
+ *        separate arrays so that the scores of a node are contiguous and can be searched with
+ *        vector compares before the comparator breaks ties on the members.
+ *        The inner node looks like this:
+ *        | 8 bytes metadata | scores ... | members ... | 4 bytes tree-count | children nodes |
+ *        The leaf node looks like this:
+ *        | 8 bytes metadata | scores ... | members ... |
+ */
+template <> class BPNodeLayout<ScoredItem> {
+  static constexpr uint16_t kKeyOffset = 8;  // 4 bytes for metadata, 4 bytes to align scores.
+  static constexpr uint16_t kSubTreeLen = sizeof(uint32_t);
+
+ public:
+  static constexpr bool kHasScores = true;
+  static constexpr uint16_t kKeySize = sizeof(ScoredItem);
+  static constexpr uint16_t kMaxLeafKeys = (kBPNodeSize - kKeyOffset) / kKeySize;
+  static constexpr uint16_t kMinLeafKeys = kMaxLeafKeys / 2;
+  static constexpr uint16_t kMaxInnerKeys =
+      (kBPNodeSize - sizeof(void*) - kKeyOffset - kSubTreeLen) / (kKeySize + sizeof(void*));
+  static constexpr uint16_t kMinInnerKeys = kMaxInnerKeys / 2;
+
+  using KeyT = ScoredItem;
+
+  static KeyT LoadKey(const void* node, bool leaf, unsigned index) {
+    KeyT res;
+    memcpy(&res.score, ScorePtr(index, node), sizeof(double));
+    memcpy(&res.member, MemberPtr(index, node, leaf), sizeof(void*));
+    return res;
+  }
+
+  static void StoreKey(void* node, bool leaf, unsigned index, KeyT key) {
+    memcpy(ScorePtr(index, node), &key.score, sizeof(double));
+    memcpy(MemberPtr(index, node, leaf), &key.member, sizeof(void*));
+  }
+
+  static void MoveKeys(void* dest_node, unsigned dest, const void* src_node, unsigned src,
+                       unsigned count, bool leaf) {
+    memmove(ScorePtr(dest, dest_node), ScorePtr(src, src_node), count * sizeof(double));
+    memmove(MemberPtr(dest, dest_node, leaf), MemberPtr(src, src_node, leaf),
+            count * sizeof(void*));
+  }
+
+  // Returns the range [first, last) of the scores equal to score among the first num
+  // (sorted) scores of the node.
+  static std::pair<unsigned, unsigned> EqualRange(const void* node, unsigned num, double score) {
+    const double* scores = reinterpret_cast<const double*>(ScorePtr(0, node));
+    unsigned lt = 0, le = 0, i = 0;
+#ifndef __s390x__
+    const __m128d key = _mm_set1_pd(score);
+    for (; i + 2 <= num; i += 2) {
+      __m128d data = _mm_loadu_pd(scores + i);
+      lt += __builtin_popcount(_mm_movemask_pd(_mm_cmplt_pd(data, key)));
+      le += __builtin_popcount(_mm_movemask_pd(_mm_cmple_pd(data, key)));
+    }
+#endif
+    for (; i < num; ++i) {
+      lt += scores[i] < score;
+      le += scores[i] <= score;
+    }
+    return {lt, le};
+  }
+
+  static uint8_t* TreeCountPtr(void* node) {
+    return reinterpret_cast<uint8_t*>(node) + kKeyOffset + kKeySize * kMaxInnerKeys;
+  }
+
+  static const uint8_t* TreeCountPtr(const void* node) {
+    return reinterpret_cast<const uint8_t*>(node) + kKeyOffset + kKeySize * kMaxInnerKeys;
+  }
+
+  static uint8_t* ChildrenStart(void* node) {
+    return TreeCountPtr(node) + kSubTreeLen;
+  }
+
+  static const uint8_t* ChildrenStart(const void* node) {
+    return TreeCountPtr(node) + kSubTreeLen;
+  }
+
+ private:
+  static uint8_t* ScorePtr(unsigned index, void* node) {
+    return reinterpret_cast<uint8_t*>(node) + kKeyOffset + sizeof(double) * index;
+  }
+
+  static const uint8_t* ScorePtr(unsigned index, const void* node) {
+    return reinterpret_cast<const uint8_t*>(node) + kKeyOffset + sizeof(double) * index;
+  }
+
+  // The members array follows the scores array, whose capacity depends on the node type.
+  static unsigned MembersOffset(bool leaf) {
+    return kKeyOffset + sizeof(double) * (leaf ? kMaxLeafKeys : kMaxInnerKeys);
+  }
+
+  static uint8_t* MemberPtr(unsigned index, void* node, bool leaf) {
+    return reinterpret_cast<uint8_t*>(node) + MembersOffset(leaf) + sizeof(void*) * index;
+  }
+
+  static const uint8_t* MemberPtr(unsigned index, const void* node, bool leaf) {
+    return reinterpret_cast<const uint8_t*>(node) + MembersOffset(leaf) + sizeof(void*) * index;
+  }
+
+  static_assert(kMaxLeafKeys < 128);
+  static_assert(kKeyOffset + kKeySize * kMaxInnerKeys + kSubTreeLen +
+                    sizeof(void*) * (kMaxInnerKeys + 1) <=
+                kBPNodeSize);
+};
+
 template <typename T> class BPTreeNode {
   template <typename K, typename Policy> friend class ::dfly::BPTree;
 
@@ -123,14 +258,11 @@ template <typename T> class BPTreeNode {
   }
 
   KeyT Key(unsigned index) const {
-    KeyT res;
-    memcpy(&res, Layout::KeyPtr(index, this), sizeof(KeyT));
-    return res;
+    return Layout::LoadKey(this, leaf_, index);
   }
 
   void SetKey(size_t index, KeyT item) {
-    uint8_t* slot = Layout::KeyPtr(index, this);
-    memcpy(slot, &item, sizeof(KeyT));
+    Layout::StoreKey(this, leaf_, index, item);
   }
 
   bool IsLeaf() const {
@@ -142,7 +274,8 @@ template <typename T> class BPTreeNode {
     bool found;
   };
 
-  // Searches for key in the node using binary search.
+  // Searches for key in the node using binary search. For scored layouts the search is
+  // narrowed down to the items with the score of key first.
   // Returns SearchResult with index of the key if found.
   template <typename Comp> SearchResult BSearch(KeyT key, Comp&& comp) const;
 
@@ -372,16 +505,28 @@ auto BPTreeNode<T>::BSearch(KeyT key, Comp&& cmp_op) const -> SearchResult {
   uint16_t hi = num_items_;
   assert(hi > 0);
 
-  // optimization: check the last item first.
-  int cmp_res = cmp_op(key, Key(hi - 1));
-  if (cmp_res >= 0) {
-    return cmp_res > 0 ? SearchResult{.index = hi, .found = false}
-                       : SearchResult{.index = uint16_t(hi - 1), .found = true};
-  }
+  if constexpr (Layout::kHasScores) {
+    if (!std::isnan(key.score)) {
+      auto [first, last] = Layout::EqualRange(this, hi, key.score);
+      if (first == last)
+        return {.index = uint16_t(first), .found = false};
 
-  // key < Key(hi - 1)
+      // Only the items with an equal score are left for the comparator.
+      lo = first;
+      hi = last;
+    }
+  } else {
+    // optimization: check the last item first.
+    int cmp_res = cmp_op(key, Key(hi - 1));
+    if (cmp_res >= 0) {
+      return cmp_res > 0 ? SearchResult{.index = hi, .found = false}
+                         : SearchResult{.index = uint16_t(hi - 1), .found = true};
+    }
+
+    // key < Key(hi - 1)
+    --hi;
+  }
 
-  --hi;
   while (lo < hi) {
     uint16_t mid = (lo + hi) >> 1;
     assert(mid < hi);
@@ -407,8 +552,7 @@ auto BPTreeNode<T>::BSearch(KeyT key, Comp&& cmp_op) const -> SearchResult {
 template <typename T> void BPTreeNode<T>::ShiftRight(unsigned index) {
   unsigned num_items_to_shift = num_items_ - index;
   if (num_items_to_shift > 0) {
-    uint8_t* ptr = Layout::KeyPtr(index, this);
-    memmove(ptr + Layout::kKeySize, ptr, num_items_to_shift * Layout::kKeySize);
+    Layout::MoveKeys(this, index + 1, this, index, num_items_to_shift, leaf_);
 
     if (!IsLeaf()) {
       uint8_t* src = Layout::ChildrenStart(this) + index * sizeof(BPTreeNode*);
@@ -424,8 +568,7 @@ template <typename T> void BPTreeNode<T>::ShiftLeft(unsigned index, bool child_s
 
   unsigned num_items_to_shift = num_items_ - index - 1;
   if (num_items_to_shift > 0) {
-    memmove(Layout::KeyPtr(index, this), Layout::KeyPtr(index + 1, this),
-            num_items_to_shift * Layout::kKeySize);
+    Layout::MoveKeys(this, index, this, index + 1, num_items_to_shift, leaf_);
     if (!leaf_) {
       index += unsigned(child_step_right);
       num_items_to_shift = num_items_ - index;
@@ -676,8 +819,7 @@ template <typename T> void BPTreeNode<T>::Split(BPTreeNode<T>* right, T* median)
   *median = Key(mid);
   right->leaf_ = leaf_;
   right->num_items_ = num_items_ - (mid + 1);
-  memmove(Layout::KeyPtr(0, right), Layout::KeyPtr(mid + 1, this),
-          right->num_items_ * Layout::kKeySize);
+  Layout::MoveKeys(right, 0, this, mid + 1, right->num_items_, leaf_);
   if (!IsLeaf()) {
     uint32_t right_subtree_count = right->num_items_;
     for (size_t i = 0; i <= right->num_items_; i++) {
@@ -0,0 +1,89 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/container/btree_map.h>
+#include <absl/container/flat_hash_set.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace dfly {
+
+// Index of the expire table by coarse deadlines, which lets active expiry visit only the parts
+// of the table that are due, so that its cost scales with the number of expiring keys rather
+// than with the size of the table. Every bucket covers kSpanMs of deadlines and holds the
+// cursors (see DashTable::KeyCursor) of the logical table buckets with keys due in it, so the
+// keys of the same table bucket that expire around the same time share an entry. Entries are not
+// removed when keys are deleted or their expiry changes - a stale one costs its owner a visit of
+// a single table bucket.
+class ExpireBuckets {
+ public:
+  static constexpr unsigned kSpanBits = 10;
+  static constexpr uint64_t kSpanMs = 1u << kSpanBits;  // ~1 second
+
+  void Add(uint64_t deadline_ms, uint64_t cursor) {
+    size_ += buckets_[deadline_ms >> kSpanBits].insert(cursor).second;
+  }
+
+  // Removes the entries of the buckets that ended by now_ms, i.e. whose keys are all due, at
+  // most limit of them, and calls cb(cursor) for each. Returns the number of removed entries.
+  // cb may add entries, which are due after now_ms.
+  template <typename Cb> size_t PopDue(uint64_t now_ms, size_t limit, Cb&& cb);
+
+  // Number of entries of the buckets that ended by now_ms.
+  size_t DueSize(uint64_t now_ms) const {
+    size_t res = 0;
+    for (auto it = buckets_.begin(); it != buckets_.end() && IsDue(it->first, now_ms); ++it)
+      res += it->second.size();
+    return res;
+  }
+
+  // For how long the oldest due bucket has been waiting for PopDue.
+  uint64_t lag(uint64_t now_ms) const {
+    if (buckets_.empty() || !IsDue(buckets_.begin()->first, now_ms))
+      return 0;
+    return now_ms - (buckets_.begin()->first + 1) * kSpanMs;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  void Clear() {
+    buckets_.clear();
+    size_ = 0;
+  }
+
+ private:
+  static bool IsDue(uint64_t bucket, uint64_t now_ms) {
+    return (bucket + 1) * kSpanMs <= now_ms;
+  }
+
+  absl::btree_map<uint64_t, absl::flat_hash_set<uint64_t>> buckets_;
+  size_t size_ = 0;
+};
+
+template <typename Cb> size_t ExpireBuckets::PopDue(uint64_t now_ms, size_t limit, Cb&& cb) {
+  size_t popped = 0;
+  while (popped < limit && !buckets_.empty() && IsDue(buckets_.begin()->first, now_ms)) {
+    // cb may add buckets, which invalidates the iterators of the map.
+    uint64_t bucket = buckets_.begin()->first;
+    absl::flat_hash_set<uint64_t> cursors = std::move(buckets_.begin()->second);
+    buckets_.erase(buckets_.begin());
+    size_ -= cursors.size();
+
+    auto it = cursors.begin();
+    for (; it != cursors.end() && popped < limit; ++it, ++popped)
+      cb(*it);
+
+    // Keep the rest for the next call.
+    for (; it != cursors.end(); ++it)
+      Add(bucket * kSpanMs, *it);
+  }
+  return popped;
+}
+
+}  // namespace dfly
@@ -0,0 +1,55 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/expire_buckets.h"
+
+#include <gmock/gmock.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+using testing::UnorderedElementsAre;
+
+class ExpireBucketsTest : public ::testing::Test {
+ protected:
+  static constexpr uint64_t kStart = 1000 * ExpireBuckets::kSpanMs;
+
+  ExpireBuckets buckets_;
+};
+
+TEST_F(ExpireBucketsTest, PopDue) {
+  buckets_.Add(kStart + 1, 1);
+  buckets_.Add(kStart + 2, 1);  // shares the entry
+  buckets_.Add(kStart + 3, 2);
+  buckets_.Add(kStart + ExpireBuckets::kSpanMs, 3);
+  EXPECT_EQ(3, buckets_.size());
+
+  vector<uint64_t> popped;
+  auto cb = [&](uint64_t cursor) { popped.push_back(cursor); };
+
+  // The first bucket is due only once all its deadlines passed.
+  EXPECT_EQ(0, buckets_.PopDue(kStart + 10, 10, cb));
+  EXPECT_EQ(0, buckets_.DueSize(kStart + 10));
+
+  uint64_t now = kStart + ExpireBuckets::kSpanMs + 5;
+  EXPECT_EQ(2, buckets_.DueSize(now));
+  EXPECT_EQ(5, buckets_.lag(now));
+
+  EXPECT_EQ(1, buckets_.PopDue(now, 1, cb));
+  EXPECT_EQ(1, buckets_.DueSize(now));
+  EXPECT_EQ(1, buckets_.PopDue(now, 10, cb));
+  EXPECT_THAT(popped, UnorderedElementsAre(1, 2));
+  EXPECT_EQ(0, buckets_.lag(now));
+
+  // Entries added by the callback are kept for later.
+  now += ExpireBuckets::kSpanMs;
+  EXPECT_EQ(1, buckets_.PopDue(now, 10, [&](uint64_t cursor) { buckets_.Add(now + 1, cursor); }));
+  EXPECT_EQ(1, buckets_.size());
+  EXPECT_EQ(0, buckets_.DueSize(now));
+}
+
+}  // namespace dfly
@@ -55,4 +55,21 @@ TEST_F(ExtentTreeTest, Basic) {
   EXPECT_THAT(*op, testing::Pair(60, 92));
 }
 
+TEST_F(ExtentTreeTest, Remove) {
+  tree_.Add(0, 256);
+  EXPECT_TRUE(tree_.Remove(64, 64));
+  EXPECT_FALSE(tree_.Remove(96, 64));   // overlaps the removed range
+  EXPECT_FALSE(tree_.Remove(200, 64));  // beyond the tree
+  EXPECT_TRUE(tree_.Remove(0, 16));
+
+  auto op = tree_.GetRange(48, 16);
+  EXPECT_TRUE(op);
+  EXPECT_THAT(*op, testing::Pair(16, 64));
+
+  op = tree_.GetRange(128, 1);
+  EXPECT_TRUE(op);
+  EXPECT_THAT(*op, testing::Pair(128, 256));
+  EXPECT_FALSE(tree_.GetRange(1, 1));
+}
+
 }  // namespace dfly
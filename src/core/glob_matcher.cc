@@ -0,0 +1,81 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/glob_matcher.h"
+
+extern "C" {
+#include "redis/util.h"
+}
+
+namespace dfly {
+
+using namespace std;
+
+GlobMatcher::GlobMatcher(string_view pattern) : pattern_(pattern) {
+  segments_.emplace_back();
+  for (size_t i = 0; i < pattern.size(); ++i) {
+    char c = pattern[i];
+    if (c == '*') {
+      // Consecutive stars are the same as one.
+      if (!ends_with_star_)
+        segments_.emplace_back();
+      has_star_ = ends_with_star_ = true;
+      continue;
+    }
+
+    if (c == '?' || c == '[') {
+      segments_.clear();
+      return;
+    }
+
+    // A trailing backslash matches itself.
+    if (c == '\\' && i + 1 < pattern.size())
+      c = pattern[++i];
+    segments_.back().push_back(c);
+    ends_with_star_ = false;
+  }
+
+  // The first segment is always the prefix, which may be empty.
+  if (ends_with_star_ && segments_.size() > 1)
+    segments_.pop_back();
+  literal_ = true;
+}
+
+bool GlobMatcher::Matches(string_view str) const {
+  if (!literal_) {
+    return stringmatchlen(pattern_.data(), pattern_.size(), str.data(), str.size(), 0) == 1;
+  }
+
+  // Like stringmatchlen, don't match an empty string with anything but an empty pattern.
+  if (str.empty())
+    return pattern_.empty();
+
+  const string& prefix = segments_.front();
+  if (!has_star_)
+    return str == prefix;
+
+  if (str.substr(0, prefix.size()) != prefix)
+    return false;
+  str.remove_prefix(prefix.size());
+
+  size_t end = segments_.size();
+  if (!ends_with_star_) {
+    const string& suffix = segments_.back();
+    if (str.size() < suffix.size() || str.substr(str.size() - suffix.size()) != suffix)
+      return false;
+    str.remove_suffix(suffix.size());
+    --end;
+  }
+
+  // Taking the leftmost occurrence of every segment leaves the most room for the next ones.
+  for (size_t i = 1; i < end; ++i) {
+    size_t pos = str.find(segments_[i]);
+    if (pos == string_view::npos)
+      return false;
+    str.remove_prefix(pos + segments_[i].size());
+  }
+  return true;
+}
+
+}  // namespace dfly
@@ -0,0 +1,34 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dfly {
+
+// Glob pattern with the semantics of redis stringmatchlen, compiled once to be matched against
+// many strings. Patterns that consist of literals and '*' only, like "user:*:cart", are split
+// into literal segments: the first one must be a prefix, the last one a suffix and the others
+// are searched in order in between. Patterns with '?' or character classes are matched with
+// stringmatchlen.
+class GlobMatcher {
+ public:
+  explicit GlobMatcher(std::string_view pattern);
+
+  bool Matches(std::string_view str) const;
+
+ private:
+  std::string pattern_;
+
+  // Literal segments separated by '*', valid if literal_ is set.
+  std::vector<std::string> segments_;
+  bool literal_ = false;
+  bool has_star_ = false;
+  bool ends_with_star_ = false;
+};
+
+}  // namespace dfly
@@ -0,0 +1,85 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/glob_matcher.h"
+
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+extern "C" {
+#include "redis/util.h"
+}
+
+namespace dfly {
+
+using namespace std;
+
+class GlobMatcherTest : public ::testing::Test {
+ protected:
+  string RandomString(string_view alphabet, size_t max_len) {
+    string res(generator_() % (max_len + 1), 0);
+    for (auto& c : res)
+      c = alphabet[generator_() % alphabet.size()];
+    return res;
+  }
+
+  mt19937 generator_{42};
+};
+
+TEST_F(GlobMatcherTest, Literal) {
+  EXPECT_TRUE(GlobMatcher("user:*:cart").Matches("user:42:cart"));
+  EXPECT_TRUE(GlobMatcher("user:*:cart").Matches("user::cart"));
+  EXPECT_FALSE(GlobMatcher("user:*:cart").Matches("user:cart"));
+  EXPECT_FALSE(GlobMatcher("user:*:cart").Matches("user:42:carts"));
+
+  EXPECT_TRUE(GlobMatcher("").Matches(""));
+  EXPECT_FALSE(GlobMatcher("*").Matches(""));  // same as stringmatchlen
+  EXPECT_TRUE(GlobMatcher("**").Matches("abc"));
+  EXPECT_TRUE(GlobMatcher("abc").Matches("abc"));
+  EXPECT_FALSE(GlobMatcher("abc").Matches("abcd"));
+  EXPECT_TRUE(GlobMatcher("a*b*c").Matches("abbbc"));
+  EXPECT_FALSE(GlobMatcher("ab*ba").Matches("aba"));
+  EXPECT_TRUE(GlobMatcher("*ab*ab*").Matches("xabxab"));
+  EXPECT_FALSE(GlobMatcher("*ab*ab*").Matches("xabx"));
+
+  // Escaped stars are literals.
+  EXPECT_TRUE(GlobMatcher("a\\*").Matches("a*"));
+  EXPECT_FALSE(GlobMatcher("a\\*").Matches("ab"));
+}
+
+TEST_F(GlobMatcherTest, Fallback) {
+  EXPECT_TRUE(GlobMatcher("h?llo").Matches("hello"));
+  EXPECT_TRUE(GlobMatcher("h[ae]llo*").Matches("hallo world"));
+  EXPECT_FALSE(GlobMatcher("h[^e]llo").Matches("hello"));
+}
+
+TEST_F(GlobMatcherTest, SameAsStringMatch) {
+  for (unsigned i = 0; i < 20000; ++i) {
+    string pattern = RandomString(i % 2 ? "ab*\\" : "ab*?[]^\\", 8);
+    GlobMatcher matcher(pattern);
+    for (unsigned j = 0; j < 10; ++j) {
+      string str = RandomString("ab*\\", 10);
+      bool expected = stringmatchlen(pattern.data(), pattern.size(), str.data(), str.size(), 0);
+      ASSERT_EQ(matcher.Matches(str), expected) << pattern << " " << str;
+    }
+  }
+}
+
+static void BM_MatchLiteral(benchmark::State& state) {
+  string_view pattern = "user:*:cart";
+  string key = "user:1234567890:session";
+  GlobMatcher matcher(pattern);
+  for (auto _ : state) {
+    if (state.range(0))
+      benchmark::DoNotOptimize(matcher.Matches(key));
+    else
+      benchmark::DoNotOptimize(
+          stringmatchlen(pattern.data(), pattern.size(), key.data(), key.size(), 0));
+  }
+}
+BENCHMARK(BM_MatchLiteral)->Arg(0)->Arg(1);
+
+}  // namespace dfly
@@ -6,6 +6,7 @@
 
 #include <absl/base/casts.h>
 #include <absl/container/fixed_array.h>
+#include <absl/container/inlined_vector.h>
 #include <absl/strings/str_cat.h>
 #include <absl/time/clock.h>
 #include <mimalloc.h>
@@ -39,6 +40,9 @@ using namespace std;
 
 namespace {
 
+// Argument buffers of redis.call() that grew bigger than that are freed after the call.
+constexpr size_t kMaxRetainedBuffer = 64 * 1024;
+
 // EVP_Q_digest is not present in the older versions of OpenSSL.
 int EVPDigest(const void* data, size_t datalen, unsigned char* md, size_t* mdlen) {
   unsigned int temp = 0;
@@ -131,7 +135,7 @@ class RedisTranslator : public ObjectExplorer {
 
   lua_State* lua_;
   bool has_error_{false};
-  vector<unsigned> array_index_{};
+  absl::InlinedVector<unsigned, 4> array_index_;  // nesting is rarely deep
 };
 
 void RedisTranslator::OnBool(bool b) {
@@ -244,13 +248,41 @@ optional<int> FetchKey(lua_State* lua, const char* key) {
   return type;
 }
 
+// Scripts are run back to back on the same interpreter, so the table of the previous run is
+// refilled in place unless the script replaced it with something else. Scripts can not create
+// globals, so the old table is not reachable from anywhere but the globals table.
 void SetGlobalArrayInternal(lua_State* lua, const char* name, MutSliceSpan args) {
-  lua_createtable(lua, args.size(), 0);
+  lua_pushglobaltable(lua);
+  lua_pushstring(lua, name);
+  bool reuse = lua_rawget(lua, -2) == LUA_TTABLE;
+  if (reuse && lua_getmetatable(lua, -1)) {
+    lua_pop(lua, 1);
+    reuse = false;
+  }
+
+  size_t old_len = 0;
+  if (reuse) {
+    old_len = lua_rawlen(lua, -1);
+  } else {
+    lua_pop(lua, 1);
+    lua_createtable(lua, args.size(), 0);
+  }
+
   for (size_t j = 0; j < args.size(); j++) {
     lua_pushlstring(lua, args[j].data(), args[j].size());
     lua_rawseti(lua, -2, j + 1);
   }
-  lua_setglobal(lua, name);
+  for (size_t j = args.size(); j < old_len; j++) {
+    lua_pushnil(lua);
+    lua_rawseti(lua, -2, j + 1);
+  }
+
+  if (reuse) {
+    lua_pop(lua, 2);  // the table and the globals table
+  } else {
+    lua_remove(lua, -2);  // the globals table
+    lua_setglobal(lua, name);
+  }
 }
 
 /* In case the error set into the Lua stack by PushError() was generated
@@ -489,6 +521,12 @@ void* mimalloc_glue(void* ud, void* ptr, size_t osize, size_t nsize) {
   }
 }
 
+// lua_Writer that appends the chunk to a string.
+int DumpToString(lua_State* lua, const void* p, size_t sz, void* ud) {
+  static_cast<string*>(ud)->append(static_cast<const char*>(p), sz);
+  return 0;
+}
+
 }  // namespace
 
 Interpreter::Interpreter() {
@@ -540,6 +578,14 @@ Interpreter::Interpreter() {
   lua_pushcfunction(lua_, RedisAPCallCommand);
   lua_settable(lua_, -3);
 
+  /* redis.dcall and redis.await */
+  lua_pushstring(lua_, "dcall");
+  lua_pushcfunction(lua_, RedisDCallCommand);
+  lua_settable(lua_, -3);
+  lua_pushstring(lua_, "await");
+  lua_pushcfunction(lua_, RedisAwaitCommand);
+  lua_settable(lua_, -3);
+
   lua_pushstring(lua_, "sha1hex");
   lua_pushcfunction(lua_, RedisSha1Command);
   lua_settable(lua_, -3);
@@ -582,7 +628,8 @@ void Interpreter::FuncSha1(string_view body, char* fp) {
   ToHex(digest, fp);
 }
 
-auto Interpreter::AddFunction(string_view sha, string_view body, string* result) -> AddResult {
+auto Interpreter::AddFunction(string_view sha, string_view body, string* result,
+                              string* bytecode) -> AddResult {
   char funcname[43];
   funcname[0] = 'f';
   funcname[1] = '_';
@@ -593,12 +640,32 @@ auto Interpreter::AddFunction(string_view sha, string_view body, string* result)
   int type = lua_getglobal(lua_, funcname);
   lua_pop(lua_, 1);
 
-  if (type == LUA_TNIL && !AddInternal(funcname, body, result))
+  if (type == LUA_TNIL && !AddInternal(funcname, body, result, bytecode))
     return COMPILE_ERR;
 
   return type == LUA_TNIL ? ADD_OK : ALREADY_EXISTS;
 }
 
+auto Interpreter::AddPrecompiled(string_view sha, string_view bytecode, string* error)
+    -> AddResult {
+  if (Exists(sha))
+    return ALREADY_EXISTS;
+
+  // Binary mode only, the chunk defines the global function like the source one in AddInternal.
+  int res = luaL_loadbufferx(lua_, bytecode.data(), bytecode.size(), "@user_script", "b");
+  if (res == 0) {
+    res = lua_pcall(lua_, 0, 0, 0);
+  }
+
+  if (res) {
+    error->assign(lua_tostring(lua_, -1));
+    lua_pop(lua_, 1);
+    return COMPILE_ERR;
+  }
+
+  return ADD_OK;
+}
+
 bool Interpreter::Exists(string_view sha) const {
   DCHECK(lua_);
 
@@ -737,12 +804,18 @@ bool Interpreter::IsResultSafe() const {
   return res;
 }
 
-bool Interpreter::AddInternal(const char* f_id, string_view body, string* error) {
+bool Interpreter::AddInternal(const char* f_id, string_view body, string* error,
+                              string* bytecode) {
   string script = absl::StrCat("function ", f_id, "() \n");
   absl::StrAppend(&script, body, "\nend");
 
   int res = luaL_loadbuffer(lua_, script.data(), script.size(), "@user_script");
   if (res == 0) {
+    if (bytecode) {
+      // Keep the debug info, so that errors of precompiled scripts report the same lines.
+      bytecode->clear();
+      lua_dump(lua_, DumpToString, bytecode, 0);
+    }
     res = lua_pcall(lua_, 0, 0, 0);  // run func definition code
   }
 
@@ -887,7 +960,8 @@ void Interpreter::ResetStack() {
 // Returns number of results, which is always 1 in this case.
 // Please note that lua resets the stack once the function returns so no need
 // to unwind the stack manually in the function (though lua allows doing this).
-int Interpreter::RedisGenericCommand(bool raise_error, bool async, ObjectExplorer* explorer) {
+int Interpreter::RedisGenericCommand(bool raise_error, bool async, ObjectExplorer* explorer,
+                                     bool deferred) {
   /* By using Lua debug hooks it is possible to trigger a recursive call
    * to luaRedisGenericCommand(), which normally should never happen.
    * To make this function reentrant is futile and makes it slower, but
@@ -945,7 +1019,7 @@ int Interpreter::RedisGenericCommand(bool raise_error, bool async, ObjectExplore
   }
 
   char name_buffer[32];  // backing storage for cmd name
-  absl::FixedArray<absl::Span<char>, 4> args(argc);
+  absl::FixedArray<absl::Span<char>, 16> args(argc);
 
   // Copy command name to name_buffer and set it as first arg.
   unsigned name_len = lua_rawlen(lua_, 1);
@@ -997,11 +1071,13 @@ int Interpreter::RedisGenericCommand(bool raise_error, bool async, ObjectExplore
     explorer = &*translator;
   }
 
-  redis_func_(CallArgs{MutSliceSpan{args}, &buffer_, explorer, async, raise_error, &raise_error});
+  redis_func_(CallArgs{MutSliceSpan{args}, &buffer_, explorer, async, raise_error, &raise_error,
+                       deferred});
   cmd_depth_--;
 
-  // Shrink reusable buffer if it's too big.
-  if (buffer_.capacity() > 128) {
+  // Keep the buffer for the next calls, so that scripts calling commands in a loop do not
+  // allocate and zero-fill it every time, unless a huge call made it too big.
+  if (buffer_.capacity() > kMaxRetainedBuffer) {
     buffer_.clear();
     buffer_.shrink_to_fit();
   }
@@ -1041,6 +1117,40 @@ int Interpreter::RedisAPCallCommand(lua_State* lua) {
   return reinterpret_cast<Interpreter*>(*ptr)->RedisGenericCommand(false, true);
 }
 
+int Interpreter::RedisDCallCommand(lua_State* lua) {
+  void** ptr = static_cast<void**>(lua_getextraspace(lua));
+  return reinterpret_cast<Interpreter*>(*ptr)->RedisGenericCommand(true, true, nullptr, true);
+}
+
+int Interpreter::RedisAwaitCommand(lua_State* lua) {
+  void** ptr = static_cast<void**>(lua_getextraspace(lua));
+  return reinterpret_cast<Interpreter*>(*ptr)->RedisAwait();
+}
+
+int Interpreter::RedisAwait() {
+  if (lua_gettop(lua_) != 1 || !lua_isinteger(lua_, 1)) {
+    PushError(lua_, "Please specify a handle returned by redis.dcall()");
+    return RaiseError(lua_);
+  }
+
+  if (!await_func_) {
+    PushError(lua_, "internal error - await function not defined");
+    return RaiseError(lua_);
+  }
+
+  int64_t handle = lua_tointeger(lua_, 1);
+  lua_pop(lua_, 1);
+
+  RedisTranslator translator(lua_);
+  await_func_(handle, &translator);
+
+  if (translator.HasError())
+    return RaiseError(lua_);
+
+  DCHECK_EQ(1, lua_gettop(lua_));
+  return 1;
+}
+
 InterpreterManager::Stats& InterpreterManager::Stats::operator+=(const Stats& other) {
   this->used_bytes += other.used_bytes;
   this->interpreter_cnt += other.interpreter_cnt;
@@ -57,10 +57,17 @@ class Interpreter {
     // The function can request an abort due to an error, even if error_abort is false.
     // It happens when async cmds are flushed and result in an uncatched error.
     bool* requested_abort;
+
+    // Deferred by dcall: executed like acall, but the reply is kept and the callee pushes an
+    // integer handle that can be resolved with redis.await().
+    bool deferred = false;
   };
 
   using RedisFunc = std::function<void(CallArgs)>;
 
+  // Resolves a handle returned by redis.dcall() and passes its reply to the translator.
+  using AwaitFunc = std::function<void(int64_t handle, ObjectExplorer* translator)>;
+
   Interpreter();
   ~Interpreter();
 
@@ -82,8 +89,14 @@ class Interpreter {
     COMPILE_ERR = 2,
   };
 
-  // Add function with sha and body to interpreter.
-  AddResult AddFunction(std::string_view sha, std::string_view body, std::string* error);
+  // Add function with sha and body to interpreter. If bytecode is set and the function was
+  // compiled, it receives the precompiled chunk of the function for AddPrecompiled().
+  AddResult AddFunction(std::string_view sha, std::string_view body, std::string* error,
+                        std::string* bytecode = nullptr);
+
+  // Add function with sha from a chunk precompiled by AddFunction() of any interpreter,
+  // which skips parsing and compiling the script.
+  AddResult AddPrecompiled(std::string_view sha, std::string_view bytecode, std::string* error);
 
   bool Exists(std::string_view sha) const;
 
@@ -120,23 +133,35 @@ class Interpreter {
     redis_func_ = std::forward<U>(u);
   }
 
+  template <typename U> void SetAwaitFunc(U&& u) {
+    await_func_ = std::forward<U>(u);
+  }
+
   // Invoke command with arguments from lua stack, given options and possibly custom explorer
-  int RedisGenericCommand(bool raise_error, bool async, ObjectExplorer* explorer = nullptr);
+  int RedisGenericCommand(bool raise_error, bool async, ObjectExplorer* explorer = nullptr,
+                          bool deferred = false);
 
  private:
   // Returns true if function was successfully added,
   // otherwise returns false and sets the error.
-  bool AddInternal(const char* f_id, std::string_view body, std::string* error);
+  bool AddInternal(const char* f_id, std::string_view body, std::string* error,
+                   std::string* bytecode);
   bool IsTableSafe() const;
 
   static int RedisCallCommand(lua_State* lua);
   static int RedisPCallCommand(lua_State* lua);
   static int RedisACallCommand(lua_State* lua);
   static int RedisAPCallCommand(lua_State* lua);
+  static int RedisDCallCommand(lua_State* lua);
+  static int RedisAwaitCommand(lua_State* lua);
+
+  // Resolve the handle on top of the lua stack.
+  int RedisAwait();
 
   lua_State* lua_;
   unsigned cmd_depth_ = 0;
   RedisFunc redis_func_;
+  AwaitFunc await_func_;
   std::string buffer_;
 };
 
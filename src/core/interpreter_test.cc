@@ -236,6 +236,31 @@ TEST_F(InterpreterTest, Add) {
   EXPECT_TRUE(intptr_.Exists(sha1));
 }
 
+TEST_F(InterpreterTest, AddPrecompiled) {
+  string_view script = "local a = 40\nreturn a + 2";
+  char sha_buf[64];
+  Interpreter::FuncSha1(script, sha_buf);
+  string_view sha{sha_buf, std::strlen(sha_buf)};
+
+  string err, bytecode;
+  Interpreter other;
+  ASSERT_EQ(Interpreter::ADD_OK, other.AddFunction(sha, script, &err, &bytecode));
+  EXPECT_FALSE(bytecode.empty());
+
+  ASSERT_EQ(Interpreter::ADD_OK, intptr_.AddPrecompiled(sha, bytecode, &err));
+  EXPECT_EQ(0, lua_gettop(lua()));
+  EXPECT_EQ(Interpreter::ALREADY_EXISTS, intptr_.AddPrecompiled(sha, bytecode, &err));
+
+  ASSERT_EQ(Interpreter::RUN_OK, intptr_.RunFunction(sha, &err));
+  intptr_.SerializeResult(&ser_);
+  EXPECT_EQ("i(42) ", ser_.res);
+
+  // Source code is never accepted as a precompiled chunk.
+  EXPECT_EQ(Interpreter::COMPILE_ERR,
+            intptr_.AddPrecompiled(string(40, 'a'), "return 1", &err));
+  EXPECT_EQ(0, lua_gettop(lua()));
+}
+
 // Test cases taken from scripting.tcl
 TEST_F(InterpreterTest, Execute) {
   ASSERT_TRUE(Execute("return 42"));
@@ -335,6 +360,12 @@ TEST_F(InterpreterTest, ArgKeys) {
   EXPECT_TRUE(Execute("return {ARGV[1], KEYS[1], KEYS[2]}"));
   EXPECT_EQ("[str(foo) str(key1) str(key2)]", ser_.res);
 
+  // The tables are refilled in place, the tail of the previous run must not leak.
+  SetGlobalArray("ARGV", {"baz"});
+  SetGlobalArray("KEYS", {});
+  EXPECT_TRUE(Execute("return {#ARGV, ARGV[1], ARGV[2] == nil, #KEYS}"));
+  EXPECT_EQ("[i(1) str(baz) bool(1) i(0)]", ser_.res);
+
   SetGlobalArray("INTKEYS", {"123456", "1"});
   EXPECT_TRUE(Execute("return INTKEYS[1] + 0")) << error_;
   EXPECT_EQ("i(123456)", ser_.res);
@@ -472,6 +503,32 @@ TEST_F(InterpreterTest, AsyncReplacement) {
   }
 }
 
+TEST_F(InterpreterTest, DeferredCall) {
+  vector<string> calls;
+  auto cb = [&calls](Interpreter::CallArgs ca) {
+    ASSERT_TRUE(ca.async && ca.deferred);
+    calls.emplace_back(ca.args[0].data(), ca.args[0].size());
+    ca.translator->OnInt(calls.size() - 1);  // handle
+  };
+  auto await_cb = [&calls](int64_t handle, ObjectExplorer* translator) {
+    if (handle < 0 || size_t(handle) >= calls.size())
+      return translator->OnError("bad handle");
+    translator->OnString(calls[handle]);
+  };
+  intptr_.SetRedisFunc(cb);
+  intptr_.SetAwaitFunc(await_cb);
+
+  EXPECT_TRUE(Execute("local a = redis.dcall('A'); local b = redis.dcall('B'); "
+                      "return {redis.await(b), redis.await(a)}"));
+  EXPECT_EQ("[str(B) str(A)]", ser_.res);
+
+  EXPECT_FALSE(Execute("return redis.await(7)"));
+  EXPECT_THAT(error_, testing::HasSubstr("bad handle"));
+
+  EXPECT_FALSE(Execute("return redis.await('x')"));
+  EXPECT_THAT(error_, testing::HasSubstr("handle returned by redis.dcall()"));
+}
+
 TEST_F(InterpreterTest, ReplicateCommands) {
   EXPECT_TRUE(Execute("return redis.replicate_commands()"));
   EXPECT_EQ("i(1)", ser_.res);
@@ -479,6 +479,33 @@ TYPED_TEST(JsonPathTest, Mutate) {
   }
 }
 
+using FlatPathTest = JsonPathTest<FlatJson>;
+
+TEST_F(FlatPathTest, Patch) {
+  ASSERT_EQ(0, Parse("$..v"));
+  Path path = driver_.TakePath();
+
+  FlatJson json = ValidJson<FlatJson>(R"({"a": {"v": 1}, "b": {"v": true}, "c": [{"v": 3}]})");
+  PatchCallback cb = [](const JsonType& val) -> optional<JsonType> {
+    if (val.is_bool())
+      return JsonType(!val.as_bool());
+    return JsonType(val.as<int64_t>() + 1);
+  };
+  ASSERT_EQ(3u, PatchPath(path, cb, json));
+  EXPECT_EQ(ValidJson<JsonType>(R"({"a": {"v": 2}, "b": {"v": false}, "c": [{"v": 4}]})"),
+            FromFlat(json));
+
+  // The second value does not fit into a byte, so the first one is restored as well
+  ASSERT_EQ(0, Parse("$.arr[*]"));
+  path = driver_.TakePath();
+  json = ValidJson<FlatJson>(R"({"arr": [1, 2, 3]})");
+  PatchCallback cb2 = [](const JsonType& val) -> optional<JsonType> {
+    return JsonType(val.as<int64_t>() * 100);
+  };
+  ASSERT_FALSE(PatchPath(path, cb2, json));
+  EXPECT_EQ(ValidJson<JsonType>(R"({"arr": [1, 2, 3]})"), FromFlat(json));
+}
+
 TYPED_TEST(JsonPathTest, SubRange) {
   TypeParam json = ValidJson<TypeParam>(R"({"arr": [1, 2, 3, 4, 5]})");
   ASSERT_EQ(0, this->Parse("$.arr[1:2]"));
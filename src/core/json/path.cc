@@ -32,6 +32,28 @@ class JsonPathDriver : public json::Driver {
   }
 };
 
+// Overwrites scalar dst with src if it has the same type and fits into the bytes of dst
+bool PatchValue(FlatJson dst, const JsonType& src) {
+  if (src.is_bool())
+    return dst.IsBool() && dst.MutateBool(src.as_bool());
+
+  if (src.is_int64())
+    return dst.IsInt() && dst.MutateInt(src.as<int64_t>());
+
+  if (src.is_uint64())
+    return dst.IsUInt() && dst.MutateUInt(src.as<uint64_t>());
+
+  if (src.is_double())
+    return dst.IsFloat() && dst.MutateFloat(src.as_double());
+
+  if (src.is_string()) {
+    string_view str = src.as_string_view();
+    return dst.IsString() && dst.MutateString(str.data(), str.size());
+  }
+
+  return false;
+}
+
 }  // namespace
 
 const char* SegmentName(SegmentType type) {
@@ -217,6 +239,10 @@ JsonType FromFlat(FlatJson src) {
     return JsonType(src.AsInt64());
   }
 
+  if (src.IsUInt()) {
+    return JsonType(src.AsUInt64());
+  }
+
   if (src.IsFloat()) {
     return JsonType(src.AsDouble());
   }
@@ -254,6 +280,10 @@ void FromJsonType(const JsonType& src, flexbuffers::Builder* fbb) {
     return fbb->Int(src.as<int64_t>());
   }
 
+  if (src.is_uint64()) {
+    return fbb->UInt(src.as<uint64_t>());
+  }
+
   if (src.is_double()) {
     return fbb->Double(src.as_double());
   }
@@ -284,6 +314,40 @@ void FromJsonType(const JsonType& src, flexbuffers::Builder* fbb) {
   fbb->EndVector(start, false, false);
 }
 
+optional<unsigned> PatchPath(const Path& path, PatchCallback callback, FlatJson json) {
+  // Results of functions are not part of the buffer
+  if (!path.empty() && path.front().type() == SegmentType::FUNCTION)
+    return nullopt;
+
+  unsigned matches = 0;
+  bool failed = false;
+  vector<pair<FlatJson, JsonType>> patched;  // Patched values with their previous values
+  EvaluatePath(path, json, [&](optional<string_view>, FlatJson val) {
+    matches++;
+    if (failed)
+      return;
+
+    JsonType prev = FromFlat(val);
+    optional<JsonType> next = callback(prev);
+    if (!next)
+      return;
+
+    if (!PatchValue(val, *next)) {
+      failed = true;
+      return;
+    }
+    patched.emplace_back(val, std::move(prev));
+  });
+
+  if (!failed)
+    return matches;
+
+  // Previous values always fit into their places
+  for (auto it = patched.rbegin(); it != patched.rend(); ++it)
+    CHECK(PatchValue(it->first, it->second));
+  return nullopt;
+}
+
 unsigned MutatePath(const Path& path, MutateCallback callback, FlatJson json,
                     flexbuffers::Builder* fbb) {
   JsonType mut_json = FromFlat(json);
@@ -128,6 +128,9 @@ using PathFlatCallback = absl::FunctionRef<void(std::optional<std::string_view>,
 // Returns true if the entry should be deleted, false otherwise.
 using MutateCallback = absl::FunctionRef<bool(std::optional<std::string_view>, JsonType*)>;
 
+// Returns the new value of a scalar match or nullopt to leave it unchanged.
+using PatchCallback = absl::FunctionRef<std::optional<JsonType>(const JsonType&)>;
+
 void EvaluatePath(const Path& path, const JsonType& json, PathCallback callback);
 
 // Same as above but for flatbuffers.
@@ -138,6 +141,12 @@ unsigned MutatePath(const Path& path, MutateCallback callback, JsonType* json);
 unsigned MutatePath(const Path& path, MutateCallback callback, FlatJson json,
                     flexbuffers::Builder* fbb);
 
+// Overwrites matches of path in the flat buffer of json in place. New values must have the type
+// of the values they replace and fit into their bytes, strings must keep their length. If any
+// doesn't, all patches are undone and nullopt is returned, so the buffer has to be rebuilt.
+// Returns number of matches found otherwise.
+std::optional<unsigned> PatchPath(const Path& path, PatchCallback callback, FlatJson json);
+
 // utility function to parse a jsonpath. Returns an error message if a parse error was
 // encountered.
 nonstd::expected<Path, std::string> ParsePath(std::string_view path);
@@ -0,0 +1,90 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/key_prefix_dict.h"
+
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+string_view KeyPrefixDict::CandidatePrefix(string_view key) const {
+  size_t pos = key.substr(0, kMaxPrefixLen).rfind(delimiter_);
+  if (pos == string_view::npos || pos + 1 < kMinPrefixLen)
+    return {};
+  return key.substr(0, pos + 1);
+}
+
+auto KeyPrefixDict::Match(string_view key) -> optional<PrefixId> {
+  string_view prefix = CandidatePrefix(key);
+  if (prefix.empty())
+    return nullopt;
+
+  if (auto it = ids_.find(prefix); it != ids_.end()) {
+    Ref(it->second);
+    return it->second;
+  }
+
+  if (ids_.size() == kMaxPrefixes)
+    return nullopt;
+
+  auto it = candidates_.find(prefix);
+  if (it == candidates_.end()) {
+    // Keys with unique prefixes should not grow the candidates indefinitely, so we start over
+    // and let the frequent prefixes win again.
+    if (candidates_.size() >= kMaxCandidates)
+      candidates_.clear();
+    candidates_.emplace(prefix, 1);
+    return nullopt;
+  }
+
+  if (++it->second < kLearnThreshold)
+    return nullopt;
+
+  candidates_.erase(it);
+  return Learn(prefix);
+}
+
+auto KeyPrefixDict::Learn(string_view prefix) -> optional<PrefixId> {
+  PrefixId id;
+  if (free_ids_.empty()) {
+    id = entries_.size();
+    entries_.emplace_back();
+  } else {
+    id = free_ids_.back();
+    free_ids_.pop_back();
+  }
+
+  entries_[id].prefix = prefix;
+  entries_[id].refs = 1;
+  ids_.emplace(prefix, id);
+  prefix_bytes_ += 2 * prefix.size();  // in entries_ and in ids_
+  DVLOG(1) << "Learned key prefix " << prefix << " with id " << id;
+
+  return id;
+}
+
+void KeyPrefixDict::Unref(PrefixId id) {
+  Entry& entry = entries_[id];
+  DCHECK_GT(entry.refs, 0u);
+  if (--entry.refs > 0)
+    return;
+
+  ids_.erase(entry.prefix);
+  prefix_bytes_ -= 2 * entry.prefix.size();
+  entry.prefix.clear();
+  entry.prefix.shrink_to_fit();
+  free_ids_.push_back(id);
+}
+
+size_t KeyPrefixDict::MallocUsed() const {
+  size_t res = prefix_bytes_ + entries_.capacity() * sizeof(Entry) +
+               free_ids_.capacity() * sizeof(PrefixId);
+  res += ids_.capacity() * sizeof(decltype(ids_)::value_type);
+  res += candidates_.capacity() * sizeof(decltype(candidates_)::value_type);
+  return res;
+}
+
+}  // namespace dfly
@@ -0,0 +1,75 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace dfly {
+
+// Dictionary of key prefixes that are shared by many keys, for example "tenant:1234:session:".
+// A candidate prefix of a key ends with its last delimiter within the first kMaxPrefixLen bytes.
+// Candidates are counted and learned once they have been seen kLearnThreshold times.
+// Learned prefixes are reference counted by the keys that use them and are forgotten once no
+// key references them anymore, so that their ids can be reused.
+// Not thread-safe, meant to be used per shard.
+class KeyPrefixDict {
+ public:
+  using PrefixId = uint16_t;
+
+  static constexpr size_t kMinPrefixLen = 4;
+  static constexpr size_t kMaxPrefixLen = 64;
+  static constexpr size_t kMaxPrefixes = 1u << 16;
+  static constexpr unsigned kLearnThreshold = 16;
+  static constexpr size_t kMaxCandidates = 4096;
+
+  explicit KeyPrefixDict(char delimiter = ':') : delimiter_(delimiter) {
+  }
+
+  // Returns the id of the learned prefix of key, if any, referenced on behalf of the caller who
+  // must Unref it once done with it. Counts the candidate prefix of key otherwise and may learn
+  // it, so that a prefix the caller ends up not using is forgotten on Unref.
+  std::optional<PrefixId> Match(std::string_view key);
+
+  std::string_view Get(PrefixId id) const {
+    return entries_[id].prefix;
+  }
+
+  void Ref(PrefixId id) {
+    ++entries_[id].refs;
+  }
+
+  void Unref(PrefixId id);
+
+  // Number of learned prefixes.
+  size_t size() const {
+    return ids_.size();
+  }
+
+  size_t MallocUsed() const;
+
+ private:
+  struct Entry {
+    std::string prefix;
+    size_t refs = 0;
+  };
+
+  std::string_view CandidatePrefix(std::string_view key) const;
+
+  std::optional<PrefixId> Learn(std::string_view prefix);
+
+  char delimiter_;
+  std::vector<Entry> entries_;
+  std::vector<PrefixId> free_ids_;
+  absl::flat_hash_map<std::string, PrefixId> ids_;
+  absl::flat_hash_map<std::string, unsigned> candidates_;
+  size_t prefix_bytes_ = 0;
+};
+
+}  // namespace dfly
@@ -0,0 +1,85 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/key_prefix_dict.h"
+
+#include <absl/strings/str_cat.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+class KeyPrefixDictTest : public ::testing::Test {
+ protected:
+  // Feeds the dictionary with keys until it learns the prefix of key.
+  optional<KeyPrefixDict::PrefixId> LearnPrefix(string_view key) {
+    for (unsigned i = 0; i < KeyPrefixDict::kLearnThreshold; ++i) {
+      if (auto id = dict_.Match(key); id)
+        return id;
+    }
+    return nullopt;
+  }
+
+  KeyPrefixDict dict_;
+};
+
+TEST_F(KeyPrefixDictTest, Learn) {
+  for (unsigned i = 1; i < KeyPrefixDict::kLearnThreshold; ++i) {
+    EXPECT_FALSE(dict_.Match(absl::StrCat("tenant:1234:session:", i)));
+  }
+
+  auto id = dict_.Match("tenant:1234:session:xyz");
+  ASSERT_TRUE(id);
+  EXPECT_EQ("tenant:1234:session:", dict_.Get(*id));
+  EXPECT_EQ(1u, dict_.size());
+  EXPECT_EQ(id, dict_.Match("tenant:1234:session:"));
+  EXPECT_FALSE(dict_.Match("tenant:1234:sessions"));
+
+  // No delimiter, too short or beyond the maximal prefix length.
+  EXPECT_FALSE(LearnPrefix("nodelimiter"));
+  EXPECT_FALSE(LearnPrefix("ab:cdefgh"));
+  EXPECT_FALSE(LearnPrefix(absl::StrCat(string(KeyPrefixDict::kMaxPrefixLen, 'x'), ":abc")));
+  EXPECT_EQ(1u, dict_.size());
+
+  // Every match references the prefix, which is forgotten once it's unreferenced.
+  dict_.Unref(*id);
+  EXPECT_EQ(1u, dict_.size());
+  dict_.Unref(*id);
+  EXPECT_EQ(0u, dict_.size());
+  EXPECT_FALSE(dict_.Match("tenant:1234:session:"));
+}
+
+TEST_F(KeyPrefixDictTest, RefCount) {
+  auto id = LearnPrefix("user:1:name");
+  ASSERT_TRUE(id);
+  dict_.Ref(*id);
+
+  dict_.Unref(*id);
+  EXPECT_EQ(1u, dict_.size());
+  dict_.Unref(*id);
+  EXPECT_EQ(0u, dict_.size());
+
+  // The id is reused for the next learned prefix.
+  auto id2 = LearnPrefix("item:200:price");
+  ASSERT_TRUE(id2);
+  EXPECT_EQ(*id, *id2);
+  EXPECT_EQ("item:200:", dict_.Get(*id2));
+}
+
+TEST_F(KeyPrefixDictTest, UniquePrefixes) {
+  // Keys with unique prefixes are never learned and the candidates stay bounded.
+  size_t mem_usage = 0;
+  for (unsigned i = 0; i < KeyPrefixDict::kMaxCandidates * 4; ++i) {
+    EXPECT_FALSE(dict_.Match(absl::StrCat("user:", i, ":name")));
+    if (i == KeyPrefixDict::kMaxCandidates - 1)
+      mem_usage = dict_.MallocUsed();
+  }
+  EXPECT_EQ(0u, dict_.size());
+  EXPECT_LE(dict_.MallocUsed(), mem_usage);
+}
+
+}  // namespace dfly
@@ -0,0 +1,85 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/lazy_free.h"
+
+extern "C" {
+#include "redis/quicklist.h"
+#include "redis/redis_aux.h"
+}
+
+#include "base/logging.h"
+#include "core/qlist.h"
+#include "core/sorted_map.h"
+#include "core/string_map.h"
+#include "core/string_set.h"
+
+namespace dfly {
+
+using namespace std;
+
+void LazyFreeQueue::Push(CompactObj* obj) {
+  size_t bytes = obj->MallocUsed();
+  items_.push_back(Item{std::move(*obj), bytes});
+  pending_bytes_ += bytes;
+}
+
+size_t LazyFreeQueue::Step(size_t max_elements) {
+  size_t budget = max_elements;
+  while (!items_.empty() && budget > 0) {
+    Item& item = items_.front();
+    if (!FreeSome(&item, &budget))
+      break;
+
+    pending_bytes_ -= item.bytes;
+    items_.pop_front();
+  }
+  return max_elements - budget;
+}
+
+bool LazyFreeQueue::FreeSome(Item* item, size_t* budget) {
+  CompactObj& obj = item->obj;
+  unsigned type = obj.ObjType();
+  unsigned encoding = obj.Encoding();
+
+  // Empties the container a few elements at a time, the rest is freed by Reset below.
+  if ((type == OBJ_SET || type == OBJ_HASH) && encoding == kEncodingStrMap2) {
+    DenseSet* ds = type == OBJ_SET ? static_cast<DenseSet*>((StringSet*)obj.RObjPtr())
+                                   : static_cast<DenseSet*>((StringMap*)obj.RObjPtr());
+    size_t prev_size = ds->UpperBoundSize();
+    item->cursor = ds->ClearStep(item->cursor, uint32_t(min<size_t>(*budget, UINT32_MAX)));
+    *budget -= min(*budget, prev_size - ds->UpperBoundSize());
+    if (!ds->Empty())
+      return false;
+  } else if (type == OBJ_LIST && encoding == kEncodingQL2) {
+    QList* ql = (QList*)obj.RObjPtr();
+    size_t count = min(*budget, ql->Size());
+    ql->Erase(0, count);
+    *budget -= count;
+    if (ql->Size() > 0)
+      return false;
+  } else if (type == OBJ_LIST) {
+    DCHECK_EQ(encoding, OBJ_ENCODING_QUICKLIST);
+    quicklist* ql = (quicklist*)obj.RObjPtr();
+    size_t count = min<size_t>(*budget, quicklistCount(ql));
+    quicklistDelRange(ql, 0, count);
+    *budget -= count;
+    if (quicklistCount(ql) > 0)
+      return false;
+  } else if (type == OBJ_ZSET && encoding == OBJ_ENCODING_SKIPLIST) {
+    detail::SortedMap* zs = (detail::SortedMap*)obj.RObjPtr();
+    size_t count = min(*budget, zs->Size());
+    if (count > 0)
+      zs->DeleteRangeByRank(0, count - 1);
+    *budget -= count;
+    if (zs->Size() > 0)
+      return false;
+  }
+
+  *budget -= min<size_t>(*budget, 1);
+  obj.Reset();
+  return true;
+}
+
+}  // namespace dfly
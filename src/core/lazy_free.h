@@ -0,0 +1,56 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+#include "core/compact_object.h"
+
+namespace dfly {
+
+// Values that were detached from their keys and wait to be freed. Freeing a large container
+// inline stalls its thread for as long as it takes to free every element, so the queue destroys
+// the values in steps instead: containers with many elements (string sets and maps, lists and
+// sorted sets) are emptied a few elements at a time, other values are freed whole.
+// Not thread-safe, the values must be freed by the thread that allocated them.
+class LazyFreeQueue {
+ public:
+  // Takes over the value of obj, which is left empty.
+  void Push(CompactObj* obj);
+
+  // Frees values or parts of them, until at least max_elements elements were destroyed or the
+  // queue became empty. Returns the number of elements destroyed.
+  size_t Step(size_t max_elements);
+
+  bool Empty() const {
+    return items_.empty();
+  }
+
+  size_t size() const {
+    return items_.size();
+  }
+
+  // Heap bytes of the values in the queue, as they were when pushed.
+  size_t pending_bytes() const {
+    return pending_bytes_;
+  }
+
+ private:
+  struct Item {
+    CompactObj obj;
+    size_t bytes;
+    uint32_t cursor = 0;  // continues the destruction of a DenseSet
+  };
+
+  // Destroys elements of item while *budget lasts, decreasing it by their number. Returns true
+  // once the whole value was freed.
+  static bool FreeSome(Item* item, size_t* budget);
+
+  std::deque<Item> items_;
+  size_t pending_bytes_ = 0;
+};
+
+}  // namespace dfly
@@ -0,0 +1,254 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/listpack_scan.h"
+
+extern "C" {
+#include "redis/listpack.h"
+#include "redis/redis_aux.h"
+#include "redis/zset.h"
+}
+
+#include <absl/time/clock.h>
+
+#include <cstring>
+
+#include "base/logging.h"
+#include "core/sse_port.h"
+
+namespace dfly {
+namespace detail {
+
+using namespace std;
+
+namespace {
+
+constexpr uint8_t kLpEof = 0xFF;
+
+// One in kSampleMask + 1 lookups is timed when a lookup budget is set.
+constexpr uint32_t kSampleMask = 63;
+
+struct LookupCost {
+  uint32_t counter = 0;
+  double ns_per_entry = 0;  // exponential moving average over the sampled lookups.
+};
+
+thread_local LookupCost tl_cost;
+
+// The searched element, with its first 16 bytes padded so that they can be compared with a
+// single vector load.
+class Needle {
+ public:
+  explicit Needle(string_view elem) : elem_(elem) {
+    memset(head_, 0, sizeof(head_));
+    memcpy(head_, elem.data(), min(elem.size(), sizeof(head_)));
+    head_mask_ = elem.size() >= 16 ? 0xFFFF : (1u << elem.size()) - 1;
+  }
+
+  size_t size() const {
+    return elem_.size();
+  }
+
+  // Compares the string of the same length at s with the needle. end bounds the readable bytes.
+  bool Equal(const uint8_t* s, const uint8_t* end) const {
+#ifndef __s390x__
+    if (s + 16 <= end) {
+      __m128i data = mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+      __m128i head = mm_loadu_si128(reinterpret_cast<const __m128i*>(head_));
+      uint32_t mask = _mm_movemask_epi8(_mm_cmpeq_epi8(data, head));
+      if ((mask & head_mask_) != head_mask_)
+        return false;
+      return elem_.size() <= 16 || memcmp(s + 16, elem_.data() + 16, elem_.size() - 16) == 0;
+    }
+#endif
+    return elem_.empty() || memcmp(s, elem_.data(), elem_.size()) == 0;
+  }
+
+  // Returns true and sets the value if the needle is stored as an integer by listpack.
+  bool AsInt(int64_t* val) {
+    if (int_state_ == 0) {
+      bool is_int = !elem_.empty() && elem_.size() < 32 &&
+                    lpStringToInt64(elem_.data(), elem_.size(), &int_val_);
+      int_state_ = is_int ? 1 : 2;
+    }
+    *val = int_val_;
+    return int_state_ == 1;
+  }
+
+ private:
+  string_view elem_;
+  uint8_t head_[16];
+  uint32_t head_mask_;
+  uint8_t int_state_ = 0;  // 0 - not computed yet, 1 - integer, 2 - not an integer.
+  int64_t int_val_ = 0;
+};
+
+inline uint32_t BacklenSize(uint64_t l) {
+  if (l <= 127)
+    return 1;
+  if (l < 16383)
+    return 2;
+  if (l < 2097151)
+    return 3;
+  if (l < 268435455)
+    return 4;
+  return 5;
+}
+
+inline uint64_t LoadLE(const uint8_t* p, unsigned bytes) {
+  uint64_t res = 0;
+  for (unsigned i = 0; i < bytes; ++i)
+    res |= uint64_t(p[i]) << (8 * i);
+  return res;
+}
+
+struct EntryHeader {
+  uint32_t hdr_len;  // encoding bytes, for integers the whole entry without the backlen.
+  uint32_t str_len;  // 0 for integers.
+  bool is_str;
+};
+
+inline EntryHeader DecodeHeader(const uint8_t* p) {
+  uint8_t b = p[0];
+  if ((b & 0x80) == 0)  // 7 bit uint
+    return {1, 0, false};
+  if ((b & 0xC0) == 0x80)  // 6 bit string
+    return {1, uint32_t(b & 0x3F), true};
+  if ((b & 0xE0) == 0xC0)  // 13 bit int
+    return {2, 0, false};
+  if ((b & 0xF0) == 0xE0)  // 12 bit string
+    return {2, (uint32_t(b & 0xF) << 8) | p[1], true};
+
+  switch (b) {
+    case 0xF0:
+      return {5, uint32_t(LoadLE(p + 1, 4)), true};
+    case 0xF1:
+      return {3, 0, false};
+    case 0xF2:
+      return {4, 0, false};
+    case 0xF3:
+      return {5, 0, false};
+    case 0xF4:
+      return {9, 0, false};
+  }
+  LOG(FATAL) << "Invalid listpack encoding " << unsigned(b);
+  return {};
+}
+
+// Decodes an integer entry the same way lpGet does.
+int64_t DecodeInt(const uint8_t* p) {
+  uint8_t b = p[0];
+  uint64_t uval, negstart, negmax;
+
+  if ((b & 0x80) == 0)
+    return b;
+
+  if ((b & 0xE0) == 0xC0) {
+    uval = (uint64_t(b & 0x1F) << 8) | p[1];
+    negstart = uint64_t(1) << 12;
+    negmax = 8191;
+  } else if (b == 0xF1) {
+    uval = LoadLE(p + 1, 2);
+    negstart = uint64_t(1) << 15;
+    negmax = UINT16_MAX;
+  } else if (b == 0xF2) {
+    uval = LoadLE(p + 1, 3);
+    negstart = uint64_t(1) << 23;
+    negmax = UINT32_MAX >> 8;
+  } else if (b == 0xF3) {
+    uval = LoadLE(p + 1, 4);
+    negstart = uint64_t(1) << 31;
+    negmax = UINT32_MAX;
+  } else {
+    DCHECK_EQ(b, 0xF4);
+    uval = LoadLE(p + 1, 8);
+    negstart = uint64_t(1) << 63;
+    negmax = UINT64_MAX;
+  }
+
+  if (uval >= negstart) {
+    int64_t v = negmax - uval;
+    return -v - 1;
+  }
+  return uval;
+}
+
+void RecordLookup(int64_t start_ns, size_t scanned) {
+  if (scanned == 0)
+    return;
+  double sample = double(absl::GetCurrentTimeNanos() - start_ns) / scanned;
+  double& avg = tl_cost.ns_per_entry;
+  avg = avg == 0 ? sample : avg * 0.875 + sample * 0.125;
+}
+
+}  // namespace
+
+uint8_t* LpScanFind(uint8_t* lp, uint8_t* p, string_view elem, unsigned skip, uint32_t* pos) {
+  const uint8_t* end = lp + lpBytes(lp);
+  Needle needle(elem);
+
+  bool sample = server.max_listpack_lookup_ns > 0 && (++tl_cost.counter & kSampleMask) == 0;
+  int64_t start_ns = sample ? absl::GetCurrentTimeNanos() : 0;
+
+  size_t scanned = 0;
+  unsigned skipcnt = 0;
+  uint8_t* res = nullptr;
+
+  while (*p != kLpEof) {
+    DCHECK(p >= lp + 6 && p < end);
+    EntryHeader hdr = DecodeHeader(p);
+    uint32_t enc_len = hdr.hdr_len + hdr.str_len;
+    ++scanned;
+
+    if (skipcnt == 0) {
+      if (hdr.is_str) {
+        if (hdr.str_len == needle.size() && needle.Equal(p + hdr.hdr_len, end)) {
+          res = p;
+          break;
+        }
+      } else {
+        int64_t val;
+        if (needle.AsInt(&val) && DecodeInt(p) == val) {
+          res = p;
+          break;
+        }
+      }
+      skipcnt = skip;
+    } else {
+      --skipcnt;
+    }
+
+    p += enc_len + BacklenSize(enc_len);
+    CHECK_LT(p, end);
+  }
+
+  if (sample)
+    RecordLookup(start_ns, scanned);
+  if (res && pos)
+    *pos = scanned - 1;
+
+  return res;
+}
+
+uint8_t* ZzlFind(uint8_t* lp, string_view member, double* score) {
+  uint8_t* eptr = LpFindField(lp, member);
+  if (eptr && score) {
+    uint8_t* sptr = lpNext(lp, eptr);
+    DCHECK(sptr);
+    *score = zzlGetScore(sptr);
+  }
+  return eptr;
+}
+
+bool LpLookupTooSlow(size_t num_entries) {
+  size_t budget = server.max_listpack_lookup_ns;
+  if (budget == 0)
+    return false;
+
+  // A successful lookup scans half of the entries on average.
+  return tl_cost.ns_per_entry * num_entries / 2 > budget;
+}
+
+}  // namespace detail
+}  // namespace dfly
@@ -0,0 +1,41 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+namespace dfly {
+
+namespace detail {
+
+// Returns the first entry equal to elem among every (skip + 1)-th entry of lp starting from p,
+// or nullptr if there is none. Same semantics as lpFind, but entry headers are decoded inline
+// so that entries are skipped by their encoded length, and only string entries of the same
+// encoded length as elem are compared, 16 bytes at a time. If pos is not null, it is set to the
+// number of entries between p and the result.
+uint8_t* LpScanFind(uint8_t* lp, uint8_t* p, std::string_view elem, unsigned skip,
+                    uint32_t* pos = nullptr);
+
+// Returns the field entry equal to field in a listpack of (field, value) pairs or nullptr.
+inline uint8_t* LpFindField(uint8_t* lp, std::string_view field) {
+  uint8_t* first = lp + 6;  // LP_HDR_SIZE
+  return *first == 0xFF ? nullptr : LpScanFind(lp, first, field, 1);
+}
+
+// zzlFind counterpart built on LpScanFind. Returns the member entry of a listpack encoded
+// sorted set and fills score if it is not null.
+uint8_t* ZzlFind(uint8_t* lp, std::string_view member, double* score);
+
+// Returns true if looking up a field in a listpack with num_entries entries is estimated to
+// take longer than server.max_listpack_lookup_ns, meaning the container should be converted
+// to a hash based encoding. The estimate is based on the cost per scanned entry measured by
+// sampling lookups on the calling thread. Always false if the budget is 0.
+bool LpLookupTooSlow(size_t num_entries);
+
+}  // namespace detail
+
+}  // namespace dfly
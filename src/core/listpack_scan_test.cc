@@ -0,0 +1,126 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/listpack_scan.h"
+
+#include <absl/strings/str_cat.h>
+#include <mimalloc.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+extern "C" {
+#include "redis/listpack.h"
+#include "redis/redis_aux.h"
+#include "redis/zmalloc.h"
+}
+
+namespace dfly {
+
+using namespace std;
+using detail::LpFindField;
+using detail::LpScanFind;
+
+class ListpackScanTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    init_zmalloc_threadlocal(mi_heap_get_backing());
+  }
+
+  void SetUp() override {
+    lp_ = lpNew(0);
+  }
+
+  void TearDown() override {
+    lpFree(lp_);
+    server.max_listpack_lookup_ns = 0;
+  }
+
+  void Append(string_view elem) {
+    lp_ = lpAppend(lp_, elem.empty() ? lp_ : (uint8_t*)elem.data(), elem.size());
+  }
+
+  uint8_t* RedisFind(string_view elem, unsigned skip) {
+    uint8_t* first = lpFirst(lp_);
+    if (!first)
+      return nullptr;
+    return lpFind(lp_, first, elem.empty() ? lp_ : (uint8_t*)elem.data(), elem.size(), skip);
+  }
+
+  uint8_t* lp_;
+};
+
+TEST_F(ListpackScanTest, Basic) {
+  EXPECT_EQ(nullptr, LpFindField(lp_, "a"));
+
+  // Entries of all encodings: short, medium and long strings and integers of all widths.
+  vector<string> elems = {"",
+                          "a",
+                          "field",
+                          string(15, 'x'),
+                          string(16, 'x'),
+                          string(17, 'x'),
+                          string(100, 'y'),
+                          string(5000, 'z'),
+                          "0",
+                          "127",
+                          "-1",
+                          "4000",
+                          "-4000",
+                          "30000",
+                          "-8000000",
+                          "2000000000",
+                          "-9223372036854775808",
+                          "9223372036854775807",
+                          "00123",
+                          "12a"};
+  for (const auto& e : elems)
+    Append(e);
+
+  for (unsigned skip : {0u, 1u}) {
+    for (const auto& e : elems) {
+      EXPECT_EQ(RedisFind(e, skip), LpScanFind(lp_, lpFirst(lp_), e, skip)) << e << " " << skip;
+    }
+    for (const char* e : {"b", "123", "-2", "xxxxxxxxxxxxxxxxy", ""}) {
+      EXPECT_EQ(RedisFind(e, skip), LpScanFind(lp_, lpFirst(lp_), e, skip)) << e << " " << skip;
+    }
+  }
+
+  // Fields at even positions only.
+  EXPECT_NE(nullptr, LpFindField(lp_, "field"));
+  EXPECT_EQ(nullptr, LpFindField(lp_, "a"));
+  EXPECT_NE(nullptr, LpFindField(lp_, "-8000000"));
+  EXPECT_EQ(nullptr, LpFindField(lp_, "30000"));
+}
+
+TEST_F(ListpackScanTest, ZzlFind) {
+  for (unsigned i = 0; i < 20; ++i) {
+    Append(absl::StrCat("member", i));
+    Append(absl::StrCat(i, ".5"));
+  }
+
+  double score = 0;
+  uint8_t* eptr = detail::ZzlFind(lp_, "member7", &score);
+  ASSERT_NE(nullptr, eptr);
+  EXPECT_EQ(7.5, score);
+  EXPECT_EQ(nullptr, detail::ZzlFind(lp_, "member20", &score));
+  EXPECT_EQ(nullptr, detail::ZzlFind(lp_, "7.5", &score));
+}
+
+TEST_F(ListpackScanTest, LookupCost) {
+  for (unsigned i = 0; i < 64; ++i)
+    Append(absl::StrCat("field", i));
+
+  EXPECT_FALSE(detail::LpLookupTooSlow(1u << 30));
+
+  // Lookups are measured once a budget is set.
+  server.max_listpack_lookup_ns = 1000;
+  for (unsigned i = 0; i < 1000; ++i)
+    LpFindField(lp_, "missing");
+
+  EXPECT_FALSE(detail::LpLookupTooSlow(2));
+  EXPECT_TRUE(detail::LpLookupTooSlow(1u << 30));
+}
+
+}  // namespace dfly
@@ -32,7 +32,8 @@ void* MiMemoryResource::do_allocate(size_t size, size_t align) {
 }
 
 void MiMemoryResource::do_deallocate(void* ptr, size_t size, size_t align) {
-  DCHECK(size > 33554400 || mi_heap_contains_block(heap_, ptr));
+  // Blocks adopted from the resources of other threads are freed here as well.
+  DCHECK(size > 33554400 || mi_heap_contains_block(heap_, ptr) || mi_is_in_heap_region(ptr));
 
   size_t usable = mi_usable_size(ptr);
 
@@ -24,6 +24,17 @@ class MiMemoryResource : public PMR_NS::memory_resource {
     return used_;
   }
 
+  // Move the accounting of a block between the resources of two threads when its value is
+  // handed over without copying. The block stays in the heap that allocated it, mimalloc returns
+  // it there when it is freed by another thread.
+  void Disown(const void* ptr) {
+    used_ -= mi_usable_size(ptr);
+  }
+
+  void Adopt(const void* ptr) {
+    used_ += mi_usable_size(ptr);
+  }
+
  private:
   void* do_allocate(std::size_t size, std::size_t align) final;
 
@@ -0,0 +1,94 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+
+namespace dfly {
+
+// Bounded lock-free ring with multiple producers and a single consumer, based on Vyukov's
+// bounded MPMC queue. A producer publishes a value with a single successful CAS on the tail,
+// the consumer owns the head and does not need atomic read-modify-write operations at all.
+// Head and tail are kept on separate cache lines, so that producers and the consumer do not
+// invalidate each other's lines.
+//
+// T should be cheap to copy, as values are copied into and out of the ring.
+template <typename T, size_t kCapacity> class MPSCRing {
+  static_assert(kCapacity >= 2 && (kCapacity & (kCapacity - 1)) == 0,
+                "Capacity must be a power of 2");
+  static_assert(std::is_trivially_copyable_v<T>);
+
+ public:
+  MPSCRing() : cells_(new Cell[kCapacity]) {
+    for (size_t i = 0; i < kCapacity; ++i)
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+  }
+
+  MPSCRing(const MPSCRing&) = delete;
+  void operator=(const MPSCRing&) = delete;
+
+  // Can be called from any thread. Returns false if the ring is full.
+  bool TryPush(const T& value) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    while (true) {
+      Cell& cell = cells_[pos & kMask];
+      size_t seq = cell.seq.load(std::memory_order_acquire);
+      intptr_t diff = intptr_t(seq) - intptr_t(pos);
+      if (diff == 0) {
+        // On failure pos is updated to the current tail.
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+          cell.value = value;
+          cell.seq.store(pos + 1, std::memory_order_release);
+          return true;
+        }
+      } else if (diff < 0) {
+        return false;  // the consumer did not free this cell yet
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+  }
+
+  // Must be called only from the consumer thread. Returns false if the ring is empty or the
+  // next value is not fully published yet.
+  bool TryPop(T* dest) {
+    Cell& cell = cells_[head_ & kMask];
+    if (cell.seq.load(std::memory_order_acquire) != head_ + 1)
+      return false;
+
+    *dest = cell.value;
+    cell.seq.store(head_ + kCapacity, std::memory_order_release);
+    ++head_;
+    return true;
+  }
+
+  // Approximate number of values in the ring, valid only from the consumer thread.
+  size_t size() const {
+    return tail_.load(std::memory_order_relaxed) - head_;
+  }
+
+  static constexpr size_t capacity() {
+    return kCapacity;
+  }
+
+ private:
+  static constexpr size_t kCacheLine = 64;
+  static constexpr size_t kMask = kCapacity - 1;
+
+  struct Cell {
+    std::atomic<size_t> seq;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  alignas(kCacheLine) std::atomic<size_t> tail_{0};
+  alignas(kCacheLine) size_t head_ = 0;
+};
+
+}  // namespace dfly
@@ -0,0 +1,84 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/mpsc_ring.h"
+
+#include <gmock/gmock.h>
+
+#include <thread>
+#include <vector>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+class MPSCRingTest : public ::testing::Test {
+ protected:
+  MPSCRing<uint64_t, 8> ring_;
+};
+
+TEST_F(MPSCRingTest, Basic) {
+  uint64_t val = 0;
+  EXPECT_FALSE(ring_.TryPop(&val));
+
+  for (uint64_t i = 0; i < ring_.capacity(); ++i)
+    EXPECT_TRUE(ring_.TryPush(i));
+  EXPECT_FALSE(ring_.TryPush(100));  // full
+  EXPECT_EQ(8, ring_.size());
+
+  for (uint64_t i = 0; i < 3; ++i) {
+    ASSERT_TRUE(ring_.TryPop(&val));
+    EXPECT_EQ(i, val);
+  }
+
+  // Freed cells are reused after wrapping around.
+  for (uint64_t i = 8; i < 11; ++i)
+    EXPECT_TRUE(ring_.TryPush(i));
+  EXPECT_FALSE(ring_.TryPush(100));
+
+  for (uint64_t i = 3; i < 11; ++i) {
+    ASSERT_TRUE(ring_.TryPop(&val));
+    EXPECT_EQ(i, val);
+  }
+  EXPECT_FALSE(ring_.TryPop(&val));
+  EXPECT_EQ(0, ring_.size());
+}
+
+TEST_F(MPSCRingTest, MultipleProducers) {
+  constexpr unsigned kProducers = 4;
+  constexpr uint64_t kPerProducer = 20000;
+
+  vector<thread> producers;
+  for (unsigned p = 0; p < kProducers; ++p) {
+    producers.emplace_back([this, p] {
+      for (uint64_t i = 0; i < kPerProducer; ++i) {
+        while (!ring_.TryPush(p * kPerProducer + i))
+          this_thread::yield();
+      }
+    });
+  }
+
+  // Values of every producer must be received in the order they were pushed.
+  vector<uint64_t> next(kProducers, 0);
+  uint64_t received = 0, val = 0;
+  while (received < kProducers * kPerProducer) {
+    if (!ring_.TryPop(&val)) {
+      this_thread::yield();
+      continue;
+    }
+    unsigned p = val / kPerProducer;
+    ASSERT_LT(p, kProducers);
+    ASSERT_EQ(next[p]++, val % kPerProducer);
+    ++received;
+  }
+
+  for (auto& t : producers)
+    t.join();
+  EXPECT_FALSE(ring_.TryPop(&val));
+}
+
+}  // namespace dfly
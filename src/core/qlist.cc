@@ -0,0 +1,491 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/qlist.h"
+
+extern "C" {
+#include "redis/listpack.h"
+#include "redis/zmalloc.h"
+}
+
+#include <absl/container/inlined_vector.h>
+#include <absl/strings/str_cat.h>
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "core/listpack_scan.h"
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+// Same as optimization_level in quicklist.c.
+constexpr size_t kOptLevel[] = {4096, 8192, 16384, 32768, 65536};
+
+// Chunk size limit for count based fill, see SIZE_SAFETY_LIMIT in quicklist.c.
+constexpr size_t kSafetyLimit = 8192;
+
+// Upper bound of the listpack entry overhead, the encoding header and the backlen.
+constexpr size_t kEntryOverhead = 11;
+
+// listpack treats a null string as a deletion, so empty values must point somewhere.
+uint8_t* ToPtr(string_view sv) {
+  static const char kEmpty[] = "";
+  return (uint8_t*)(sv.empty() ? kEmpty : sv.data());
+}
+
+QList::Entry GetEntry(uint8_t* p) {
+  unsigned slen = 0;
+  long long lval = 0;
+  uint8_t* s = lpGetValue(p, &slen, &lval);
+  if (s)
+    return QList::Entry{reinterpret_cast<const char*>(s), slen, 0};
+  return QList::Entry{nullptr, 0, lval};
+}
+
+// Converts a possibly negative index into the position within the list.
+optional<size_t> ToIndex(long index, size_t count) {
+  if (index < 0)
+    index += count;
+  if (index < 0 || size_t(index) >= count)
+    return nullopt;
+  return index;
+}
+
+}  // namespace
+
+bool QList::Entry::operator==(string_view sv) const {
+  if (value)
+    return sz == sv.size() && (sz == 0 || memcmp(value, sv.data(), sz) == 0);
+
+  absl::AlphaNum an(longval);
+  return sv == an.Piece();
+}
+
+string QList::Entry::to_string() const {
+  if (value)
+    return string(value, sz);
+  return absl::StrCat(longval);
+}
+
+QList::QList(int fill, MemoryResource* mr) : nodes_(mr), fill_(fill) {
+}
+
+QList::~QList() {
+  for (Node& node : nodes_)
+    lpFree(node.lp);
+}
+
+size_t QList::MallocUsed() const {
+  return lp_bytes_ + nodes_.size() * sizeof(Node) + sizeof(QList);
+}
+
+void QList::Push(string_view value, Where where) {
+  if (where == HEAD) {
+    if (nodes_.empty() || !AllowInsert(nodes_.front(), value.size())) {
+      nodes_.push_front(Node{NewListpack(value), 1, 0, origin_});
+    } else {
+      Node& node = nodes_.front();
+      node.lp = lpPrepend(node.lp, ToPtr(value), value.size());
+      ++node.count;
+    }
+    UpdateSize(&nodes_.front());
+    --origin_;
+  } else {
+    if (nodes_.empty() || !AllowInsert(nodes_.back(), value.size())) {
+      int64_t end = (nodes_.empty() ? origin_ : nodes_.back().end) + 1;
+      nodes_.push_back(Node{NewListpack(value), 1, 0, end});
+    } else {
+      Node& node = nodes_.back();
+      node.lp = lpAppend(node.lp, ToPtr(value), value.size());
+      ++node.count;
+      ++node.end;
+    }
+    UpdateSize(&nodes_.back());
+  }
+  ++count_;
+}
+
+string QList::Pop(Where where) {
+  DCHECK_GT(count_, 0u);
+
+  Node& node = where == HEAD ? nodes_.front() : nodes_.back();
+  uint8_t* p = where == HEAD ? lpFirst(node.lp) : lpLast(node.lp);
+  string res = GetEntry(p).to_string();
+
+  node.lp = lpDelete(node.lp, p, nullptr);
+  --node.count;
+  --count_;
+  if (where == HEAD)
+    ++origin_;
+  else
+    --node.end;
+
+  if (node.count > 0) {
+    UpdateSize(&node);
+    return res;
+  }
+
+  lp_bytes_ -= node.sz;
+  lpFree(node.lp);
+  if (where == HEAD)
+    nodes_.pop_front();
+  else
+    nodes_.pop_back();
+  return res;
+}
+
+void QList::AppendListpack(uint8_t* lp) {
+  uint32_t count = lpLength(lp);
+  DCHECK_GT(count, 0u);
+
+  int64_t end = (nodes_.empty() ? origin_ : nodes_.back().end) + count;
+  nodes_.push_back(Node{lp, count, 0, end});
+  UpdateSize(&nodes_.back());
+  count_ += count;
+}
+
+auto QList::Get(long index) const -> optional<Entry> {
+  auto idx = ToIndex(index, count_);
+  if (!idx)
+    return nullopt;
+
+  size_t i = FindNode(*idx);
+  uint8_t* p = lpSeek(nodes_[i].lp, origin_ + *idx - NodeStart(i));
+  DCHECK(p);
+  return GetEntry(p);
+}
+
+bool QList::Replace(long index, string_view elem) {
+  auto idx = ToIndex(index, count_);
+  if (!idx)
+    return false;
+
+  size_t i = FindNode(*idx);
+  Node& node = nodes_[i];
+  uint8_t* p = lpSeek(node.lp, origin_ + *idx - NodeStart(i));
+  node.lp = lpReplace(node.lp, &p, ToPtr(elem), elem.size());
+  UpdateSize(&node);
+  return true;
+}
+
+bool QList::Insert(string_view pivot, string_view elem, InsertOpt opt) {
+  for (size_t i = 0; i < nodes_.size(); ++i) {
+    uint8_t* lp = nodes_[i].lp;
+    uint8_t* first = lpFirst(lp);
+    uint32_t offset = 0;
+    if (first && detail::LpScanFind(lp, first, pivot, 0, &offset)) {
+      InsertAt(i, opt == AFTER ? offset + 1 : offset, elem);
+      return true;
+    }
+  }
+  return false;
+}
+
+unsigned QList::Remove(string_view elem, unsigned count, Where where) {
+  unsigned removed = 0;
+  size_t first_touched = nodes_.size();
+
+  for (size_t k = 0; k < nodes_.size() && (count == 0 || removed < count); ++k) {
+    size_t i = where == HEAD ? k : nodes_.size() - k - 1;
+    Node& node = nodes_[i];
+    unsigned node_removed = 0;
+    auto done = [&] { return count && removed + node_removed == count; };
+
+    if (where == HEAD) {
+      uint8_t* p = lpFirst(node.lp);
+      while (p && !done()) {
+        p = detail::LpScanFind(node.lp, p, elem, 0);
+        if (!p)
+          break;
+        node.lp = lpDelete(node.lp, p, &p);
+        ++node_removed;
+      }
+    } else {
+      // The matches are found scanning forward and deleted from the last one, so that the
+      // offsets of the preceding ones stay valid.
+      absl::InlinedVector<size_t, 8> offsets;
+      for (uint8_t* p = lpFirst(node.lp); p; p = lpNext(node.lp, p)) {
+        p = detail::LpScanFind(node.lp, p, elem, 0);
+        if (!p)
+          break;
+        offsets.push_back(p - node.lp);
+      }
+      for (size_t j = offsets.size(); j > 0 && !done(); --j) {
+        node.lp = lpDelete(node.lp, node.lp + offsets[j - 1], nullptr);
+        ++node_removed;
+      }
+    }
+
+    if (node_removed) {
+      node.count -= node_removed;
+      UpdateSize(&node);
+      removed += node_removed;
+      first_touched = min(first_touched, i);
+    }
+  }
+
+  if (removed) {
+    count_ -= removed;
+    RebuildIndex(first_touched);
+  }
+  return removed;
+}
+
+void QList::Find(string_view elem, Where where, size_t limit, FindFunc cb) const {
+  size_t scanned = limit == 0 ? count_ : min(limit, count_);
+
+  // Indices in [lo, hi) are scanned.
+  size_t lo = where == HEAD ? 0 : count_ - scanned;
+  size_t hi = where == HEAD ? scanned : count_;
+  absl::InlinedVector<size_t, 8> matches;
+
+  for (size_t k = 0; k < nodes_.size(); ++k) {
+    size_t i = where == HEAD ? k : nodes_.size() - k - 1;
+    size_t start = NodeStart(i) - origin_;
+    if (where == HEAD ? start >= hi : start + nodes_[i].count <= lo)
+      return;
+
+    // Nodes are scanned forward, matches of the tail scan are reported in reverse.
+    uint8_t* lp = nodes_[i].lp;
+    size_t index = start;
+    matches.clear();
+    for (uint8_t* p = lpFirst(lp); p; p = lpNext(lp, p), ++index) {
+      uint32_t pos = 0;
+      p = detail::LpScanFind(lp, p, elem, 0, &pos);
+      if (!p)
+        break;
+      index += pos;
+      if (index >= hi)
+        break;
+      if (index < lo)
+        continue;
+      if (where == HEAD && !cb(index))
+        return;
+      if (where == TAIL)
+        matches.push_back(index);
+    }
+
+    for (size_t j = matches.size(); j > 0; --j) {
+      if (!cb(matches[j - 1]))
+        return;
+    }
+  }
+}
+
+void QList::Erase(long start, long count) {
+  if (start < 0)
+    start = max<long>(start + count_, 0);
+  if (count <= 0 || size_t(start) >= count_)
+    return;
+  count = min<long>(count, count_ - start);
+
+  size_t first = FindNode(start);
+  uint32_t offset = origin_ + start - NodeStart(first);
+  long left = count;
+
+  for (size_t i = first; left > 0; ++i) {
+    Node& node = nodes_[i];
+    uint32_t del = min<long>(left, node.count - offset);
+    if (del < node.count) {
+      node.lp = lpDeleteRange(node.lp, offset, del);
+      UpdateSize(&node);
+    }
+    node.count -= del;
+    left -= del;
+    offset = 0;
+  }
+
+  count_ -= count;
+  RebuildIndex(first);
+}
+
+bool QList::Iterate(IterateFunc cb, long start, long end) const {
+  if (start < 0)
+    start = 0;
+  if (end < 0 || size_t(end) >= count_)
+    end = long(count_) - 1;
+  if (start > end)
+    return true;
+
+  size_t i = FindNode(start);
+  uint8_t* p = lpSeek(nodes_[i].lp, origin_ + start - NodeStart(i));
+  for (long left = end - start + 1; left > 0; --left) {
+    DCHECK(p);
+    if (!cb(GetEntry(p)))
+      return false;
+    p = lpNext(nodes_[i].lp, p);
+    if (!p && ++i < nodes_.size())
+      p = lpFirst(nodes_[i].lp);
+  }
+  return true;
+}
+
+bool QList::IterateNodes(NodeFunc cb, long start, long end) const {
+  if (start < 0)
+    start = 0;
+  if (end < 0 || size_t(end) >= count_)
+    end = long(count_) - 1;
+  if (start > end)
+    return true;
+
+  size_t i = FindNode(start);
+  uint32_t offset = origin_ + start - NodeStart(i);
+  for (long left = end - start + 1; left > 0; ++i) {
+    uint32_t count = min<long>(left, nodes_[i].count - offset);
+    if (!cb(nodes_[i].lp, offset, count))
+      return false;
+    left -= count;
+    offset = 0;
+  }
+  return true;
+}
+
+bool QList::IterateReverse(IterateFunc cb) const {
+  for (size_t i = nodes_.size(); i > 0; --i) {
+    uint8_t* lp = nodes_[i - 1].lp;
+    for (uint8_t* p = lpLast(lp); p; p = lpPrev(lp, p)) {
+      if (!cb(GetEntry(p)))
+        return false;
+    }
+  }
+  return true;
+}
+
+bool QList::DefragIfNeeded(float ratio) {
+  bool realloced = false;
+  for (Node& node : nodes_) {
+    if (!zmalloc_page_is_underutilized(node.lp, ratio))
+      continue;
+
+    size_t bytes = lpBytes(node.lp);
+    uint8_t* lp = static_cast<uint8_t*>(zmalloc(bytes));
+    memcpy(lp, node.lp, bytes);
+    zfree(node.lp);
+    node.lp = lp;
+    realloced = true;
+  }
+  return realloced;
+}
+
+size_t QList::FindNode(size_t index) const {
+  int64_t pos = origin_ + int64_t(index);
+  auto it = upper_bound(nodes_.begin(), nodes_.end(), pos,
+                        [](int64_t pos, const Node& node) { return pos < node.end; });
+  DCHECK(it != nodes_.end());
+  return it - nodes_.begin();
+}
+
+bool QList::AllowInsert(const Node& node, size_t sz) const {
+  size_t new_sz = node.sz + sz + kEntryOverhead;
+  if (fill_ >= 0)
+    return node.count < unsigned(fill_) && new_sz <= kSafetyLimit;
+
+  size_t level = min<size_t>(-(fill_ + 1), size(kOptLevel) - 1);
+  return new_sz <= kOptLevel[level];
+}
+
+void QList::UpdateSize(Node* node) {
+  lp_bytes_ -= node->sz;
+  node->sz = lpBytes(node->lp);
+  lp_bytes_ += node->sz;
+}
+
+uint8_t* QList::NewListpack(string_view value) {
+  uint8_t* lp = lpNew(0);
+  return lpAppend(lp, ToPtr(value), value.size());
+}
+
+void QList::InsertAt(size_t i, uint32_t offset, string_view elem) {
+  ++count_;
+
+  Node* node = &nodes_[i];
+  if (AllowInsert(*node, elem.size())) {
+    if (offset == node->count) {
+      node->lp = lpAppend(node->lp, ToPtr(elem), elem.size());
+    } else {
+      uint8_t* p = lpSeek(node->lp, offset);
+      node->lp = lpInsertString(node->lp, ToPtr(elem), elem.size(), p, LP_BEFORE, nullptr);
+    }
+    ++node->count;
+    UpdateSize(node);
+    ShiftEnds(i, 1);
+    return;
+  }
+
+  // The node is full, try the neighbour on the side of the insertion point.
+  if (offset == 0 && i > 0 && AllowInsert(nodes_[i - 1], elem.size())) {
+    Node& prev = nodes_[i - 1];
+    prev.lp = lpAppend(prev.lp, ToPtr(elem), elem.size());
+    ++prev.count;
+    UpdateSize(&prev);
+    ShiftEnds(i - 1, 1);
+    return;
+  }
+
+  if (offset == node->count && i + 1 < nodes_.size() && AllowInsert(nodes_[i + 1], elem.size())) {
+    Node& next = nodes_[i + 1];
+    next.lp = lpPrepend(next.lp, ToPtr(elem), elem.size());
+    ++next.count;
+    UpdateSize(&next);
+    ShiftEnds(i + 1, 1);
+    return;
+  }
+
+  if (offset > 0 && offset < node->count)
+    Split(i, offset);
+
+  size_t pos = offset == 0 ? i : i + 1;
+  int64_t start = NodeStart(pos);
+  nodes_.insert(nodes_.begin() + pos, Node{NewListpack(elem), 1, 0, start + 1});
+  UpdateSize(&nodes_[pos]);
+  ShiftEnds(pos + 1, 1);
+}
+
+void QList::ShiftEnds(size_t i, int64_t delta) {
+  for (; i < nodes_.size(); ++i)
+    nodes_[i].end += delta;
+}
+
+void QList::Split(size_t i, uint32_t offset) {
+  Node& node = nodes_[i];
+  DCHECK(offset > 0 && offset < node.count);
+
+  uint8_t* tail = (uint8_t*)zmalloc(node.sz);
+  memcpy(tail, node.lp, node.sz);
+  tail = lpDeleteRange(tail, 0, offset);
+
+  uint32_t tail_count = node.count - offset;
+  int64_t end = node.end;
+  node.lp = lpDeleteRange(node.lp, offset, tail_count);
+  node.count = offset;
+  node.end = end - tail_count;
+  UpdateSize(&node);
+
+  nodes_.insert(nodes_.begin() + i + 1, Node{tail, tail_count, 0, end});
+  UpdateSize(&nodes_[i + 1]);
+}
+
+void QList::RebuildIndex(size_t i) {
+  int64_t end = NodeStart(i);
+  size_t dest = i;
+  for (; i < nodes_.size(); ++i) {
+    Node& node = nodes_[i];
+    if (node.count == 0) {
+      lp_bytes_ -= node.sz;
+      lpFree(node.lp);
+      continue;
+    }
+    end += node.count;
+    node.end = end;
+    nodes_[dest++] = node;
+  }
+  nodes_.erase(nodes_.begin() + dest, nodes_.end());
+}
+
+}  // namespace dfly
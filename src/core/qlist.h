@@ -0,0 +1,154 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/functional/function_ref.h>
+
+#include <cstdint>
+#include <deque>
+#include <optional>
+#include <string>
+#include <string_view>
+
+#include "base/pmr/memory_resource.h"
+
+namespace dfly {
+
+// A list of strings stored as a sequence of listpack chunks, similar to redis quicklist.
+// Unlike quicklist, the chunk headers are kept in one array together with the cumulative
+// element counts, so positional lookups binary search the chunk instead of walking a linked
+// list, and pushes and pops at either end touch only the outermost chunk.
+// Listpacks are allocated with zmalloc, i.e. from the thread local mimalloc heap.
+// Chunks are never compressed.
+class QList {
+ public:
+  enum Where { TAIL, HEAD };
+  enum InsertOpt { BEFORE, AFTER };
+
+  // A view of an element. Valid until the list is modified.
+  struct Entry {
+    const char* value = nullptr;  // nullptr for integers.
+    size_t sz = 0;
+    int64_t longval = 0;
+
+    bool operator==(std::string_view sv) const;
+    std::string to_string() const;
+  };
+
+  using IterateFunc = absl::FunctionRef<bool(Entry)>;
+  using MemoryResource = PMR_NS::memory_resource;
+
+  // fill has the semantics of list_max_listpack_size: negative values limit the size of
+  // a chunk to 4KB << (-fill - 1), positive values limit the number of elements in a chunk.
+  explicit QList(int fill = -2, MemoryResource* mr = PMR_NS::get_default_resource());
+  QList(const QList&) = delete;
+  QList& operator=(const QList&) = delete;
+  ~QList();
+
+  size_t Size() const {
+    return count_;
+  }
+
+  size_t MallocUsed() const;
+
+  void Push(std::string_view value, Where where);
+
+  // Removes and returns the element at the given end. The list must not be empty.
+  std::string Pop(Where where);
+
+  // Appends a non-empty listpack as the last chunk and takes ownership of it. Used by the
+  // rdb loader.
+  void AppendListpack(uint8_t* lp);
+
+  // Returns the element at index, negative indices count from the tail.
+  std::optional<Entry> Get(long index) const;
+
+  // Replaces the element at index, negative indices count from the tail.
+  // Returns false if the index is out of range.
+  bool Replace(long index, std::string_view elem);
+
+  // Inserts elem before or after the first occurrence of pivot.
+  // Returns false if pivot was not found.
+  bool Insert(std::string_view pivot, std::string_view elem, InsertOpt opt);
+
+  // Removes up to count occurrences of elem, all of them if count is 0, scanning from the
+  // given end. Returns the number of removed elements.
+  unsigned Remove(std::string_view elem, unsigned count, Where where);
+
+  // Calls cb with the indices of the elements equal to elem, in the scanning order from the
+  // given end, until it returns false. Only the first limit elements from that end are scanned,
+  // all of them if limit is 0.
+  using FindFunc = absl::FunctionRef<bool(size_t index)>;
+  void Find(std::string_view elem, Where where, size_t limit, FindFunc cb) const;
+
+  // Erases count elements starting at start, negative start counts from the tail.
+  void Erase(long start, long count);
+
+  // Calls cb for the elements with indices in [start, end] until it returns false.
+  // Returns false if the iteration was stopped by cb.
+  bool Iterate(IterateFunc cb, long start, long end) const;
+
+  // Calls cb for the chunks holding the elements with indices in [start, end], with the offset
+  // of the first element of the range within the chunk and the number of elements of the range
+  // in it, until cb returns false. Returns false if the iteration was stopped by cb.
+  using NodeFunc = absl::FunctionRef<bool(const uint8_t* lp, uint32_t offset, uint32_t count)>;
+  bool IterateNodes(NodeFunc cb, long start, long end) const;
+
+  // Same as Iterate over the whole list but from the tail towards the head.
+  bool IterateReverse(IterateFunc cb) const;
+
+  // Moves the listpacks that reside on pages with utilization below ratio to new allocations.
+  // Returns true if any listpack was moved.
+  bool DefragIfNeeded(float ratio);
+
+  size_t node_count() const {
+    return nodes_.size();
+  }
+
+  const uint8_t* node_listpack(size_t i) const {
+    return nodes_[i].lp;
+  }
+
+ private:
+  struct Node {
+    uint8_t* lp;
+    uint32_t count;
+    uint32_t sz;  // listpack bytes.
+    int64_t end;  // exclusive end position of the node, see origin_.
+  };
+
+  // Node i holds the positions [start(i), nodes_[i].end), where start(0) is origin_ and
+  // start(i) is nodes_[i - 1].end. Element index k is at position origin_ + k.
+  int64_t NodeStart(size_t i) const {
+    return i == 0 ? origin_ : nodes_[i - 1].end;
+  }
+
+  // Returns the node holding the element at index, which must be valid.
+  size_t FindNode(size_t index) const;
+
+  bool AllowInsert(const Node& node, size_t sz) const;
+  void UpdateSize(Node* node);
+  uint8_t* NewListpack(std::string_view value);
+
+  // Inserts elem at offset within node i, possibly into a neighbour or a new node.
+  void InsertAt(size_t i, uint32_t offset, std::string_view elem);
+
+  // Adds delta to the ends of nodes [i, node_count()).
+  void ShiftEnds(size_t i, int64_t delta);
+
+  // Splits node i into [0, offset) and [offset, count).
+  void Split(size_t i, uint32_t offset);
+
+  // Recomputes the node ends starting from node i and drops empty nodes.
+  void RebuildIndex(size_t i);
+
+  std::deque<Node, PMR_NS::polymorphic_allocator<Node>> nodes_;
+  int64_t origin_ = 0;
+  size_t count_ = 0;
+  size_t lp_bytes_ = 0;
+  int fill_;
+};
+
+}  // namespace dfly
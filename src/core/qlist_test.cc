@@ -0,0 +1,373 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/qlist.h"
+
+#include <absl/strings/str_cat.h>
+#include <gmock/gmock.h>
+#include <mimalloc.h>
+
+#include <deque>
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+extern "C" {
+#include "redis/listpack.h"
+#include "redis/zmalloc.h"
+}
+
+namespace dfly {
+
+using namespace std;
+using testing::ElementsAre;
+
+class QListTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    init_zmalloc_threadlocal(mi_heap_get_backing());
+  }
+
+  static vector<string> ToVec(const QList& ql) {
+    vector<string> res;
+    ql.Iterate(
+        [&](QList::Entry e) {
+          res.push_back(e.to_string());
+          return true;
+        },
+        0, -1);
+    return res;
+  }
+
+  void Verify(const QList& ql, const deque<string>& model) {
+    ASSERT_EQ(model.size(), ql.Size());
+    vector<string> expected(model.begin(), model.end());
+    ASSERT_EQ(expected, ToVec(ql));
+    for (size_t i = 0; i < model.size(); i += 1 + model.size() / 16) {
+      auto entry = ql.Get(i);
+      ASSERT_TRUE(entry);
+      ASSERT_EQ(model[i], entry->to_string()) << i;
+    }
+  }
+
+  mt19937 generator_{1};
+};
+
+TEST_F(QListTest, Basic) {
+  QList ql;
+  EXPECT_EQ(0u, ql.Size());
+  EXPECT_FALSE(ql.Get(0));
+
+  ql.Push("b", QList::TAIL);
+  ql.Push("a", QList::HEAD);
+  ql.Push("123", QList::TAIL);
+  ql.Push("", QList::TAIL);
+  EXPECT_EQ(4u, ql.Size());
+  EXPECT_EQ(1u, ql.node_count());
+
+  EXPECT_TRUE(*ql.Get(0) == "a");
+  EXPECT_TRUE(*ql.Get(-2) == "123");
+  EXPECT_FALSE(*ql.Get(-2) == "0123");
+  EXPECT_TRUE(*ql.Get(3) == "");
+  EXPECT_FALSE(ql.Get(4));
+  EXPECT_FALSE(ql.Get(-5));
+
+  EXPECT_TRUE(ql.Replace(-1, "c"));
+  EXPECT_FALSE(ql.Replace(4, "c"));
+  EXPECT_TRUE(ql.Insert("b", "x", QList::AFTER));
+  EXPECT_TRUE(ql.Insert("a", "y", QList::BEFORE));
+  EXPECT_FALSE(ql.Insert("z", "y", QList::BEFORE));
+  EXPECT_EQ((vector<string>{"y", "a", "b", "x", "123", "c"}), ToVec(ql));
+
+  EXPECT_EQ("y", ql.Pop(QList::HEAD));
+  EXPECT_EQ("c", ql.Pop(QList::TAIL));
+  EXPECT_EQ(4u, ql.Size());
+  EXPECT_GT(ql.MallocUsed(), 0u);
+}
+
+TEST_F(QListTest, Chunks) {
+  // Count based fill.
+  QList ql(4);
+  for (unsigned i = 0; i < 10; ++i)
+    ql.Push(absl::StrCat(i), QList::TAIL);
+  EXPECT_EQ(3u, ql.node_count());
+  for (unsigned i = 0; i < 10; ++i)
+    ql.Push(absl::StrCat(-int(i) - 1), QList::HEAD);
+  EXPECT_EQ(6u, ql.node_count());
+
+  for (int i = -10; i < 10; ++i) {
+    EXPECT_EQ(absl::StrCat(i), ql.Get(i + 10)->to_string());
+    EXPECT_EQ(absl::StrCat(i), ql.Get(i - 10)->to_string());
+  }
+
+  // Size based fill, 4KB chunks.
+  QList ql2(-1);
+  string val(1000, 'x');
+  for (unsigned i = 0; i < 8; ++i)
+    ql2.Push(val, QList::TAIL);
+  EXPECT_EQ(2u, ql2.node_count());
+
+  // Large values get their own chunk.
+  ql2.Push(string(10000, 'y'), QList::TAIL);
+  ql2.Push(val, QList::TAIL);
+  EXPECT_EQ(4u, ql2.node_count());
+  EXPECT_EQ(10000u, ql2.Get(8)->sz);
+}
+
+TEST_F(QListTest, RemoveErase) {
+  QList ql(3);
+  deque<string> model;
+  for (unsigned i = 0; i < 30; ++i) {
+    string val = i % 3 == 0 ? "x" : absl::StrCat(i);
+    ql.Push(val, QList::TAIL);
+    model.push_back(val);
+  }
+
+  EXPECT_EQ(2u, ql.Remove("x", 2, QList::TAIL));
+  model.erase(model.begin() + 27);
+  model.erase(model.begin() + 24);
+  Verify(ql, model);
+
+  EXPECT_EQ(1u, ql.Remove("x", 1, QList::HEAD));
+  model.pop_front();
+  Verify(ql, model);
+
+  EXPECT_EQ(7u, ql.Remove("x", 0, QList::HEAD));
+  model.erase(remove(model.begin(), model.end(), "x"), model.end());
+  Verify(ql, model);
+  EXPECT_EQ(0u, ql.Remove("x", 0, QList::TAIL));
+
+  ql.Erase(0, 3);
+  model.erase(model.begin(), model.begin() + 3);
+  Verify(ql, model);
+
+  ql.Erase(-4, 10);
+  model.erase(model.end() - 4, model.end());
+  Verify(ql, model);
+
+  ql.Erase(2, 5);
+  model.erase(model.begin() + 2, model.begin() + 7);
+  Verify(ql, model);
+
+  ql.Erase(0, ql.Size());
+  EXPECT_EQ(0u, ql.Size());
+  EXPECT_EQ(0u, ql.node_count());
+
+  ql.Push("a", QList::HEAD);
+  EXPECT_EQ("a", ql.Get(0)->to_string());
+}
+
+TEST_F(QListTest, Find) {
+  QList ql(4);
+  for (unsigned i = 0; i < 20; ++i)
+    ql.Push(i % 3 == 0 ? "x" : absl::StrCat(i % 2), QList::TAIL);
+  ql.Pop(QList::HEAD);  // indices do not start at the first position of the first chunk.
+
+  auto find = [&](string_view elem, QList::Where where, size_t limit) {
+    vector<size_t> res;
+    ql.Find(elem, where, limit, [&](size_t index) {
+      res.push_back(index);
+      return true;
+    });
+    return res;
+  };
+
+  EXPECT_THAT(find("x", QList::HEAD, 0), ElementsAre(2, 5, 8, 11, 14, 17));
+  EXPECT_THAT(find("x", QList::TAIL, 0), ElementsAre(17, 14, 11, 8, 5, 2));
+  EXPECT_THAT(find("x", QList::HEAD, 9), ElementsAre(2, 5, 8));
+  EXPECT_THAT(find("x", QList::TAIL, 9), ElementsAre(17, 14, 11));
+  EXPECT_THAT(find("1", QList::HEAD, 5), ElementsAre(0, 4));
+  EXPECT_THAT(find("0", QList::TAIL, 4), ElementsAre(15));
+  EXPECT_THAT(find("y", QList::HEAD, 0), ElementsAre());
+
+  vector<size_t> first;
+  ql.Find("x", QList::TAIL, 0, [&](size_t index) {
+    first.push_back(index);
+    return first.size() < 2;
+  });
+  EXPECT_THAT(first, ElementsAre(17, 14));
+
+  EXPECT_TRUE(ql.Insert("1", "y", QList::AFTER));
+  EXPECT_THAT(find("y", QList::HEAD, 0), ElementsAre(1));
+}
+
+TEST_F(QListTest, Iterate) {
+  QList ql(5);
+  for (unsigned i = 0; i < 23; ++i)
+    ql.Push(absl::StrCat(i), QList::TAIL);
+
+  vector<string> res;
+  auto cb = [&](QList::Entry e) {
+    res.push_back(e.to_string());
+    return res.size() < 4;
+  };
+  EXPECT_TRUE(ql.Iterate(cb, 4, 6));
+  EXPECT_EQ((vector<string>{"4", "5", "6"}), res);
+
+  res.clear();
+  EXPECT_FALSE(ql.Iterate(cb, 8, 100));
+  EXPECT_EQ((vector<string>{"8", "9", "10", "11"}), res);
+
+  res.clear();
+  EXPECT_FALSE(ql.IterateReverse(cb));
+  EXPECT_EQ((vector<string>{"22", "21", "20", "19"}), res);
+
+  res.clear();
+  EXPECT_TRUE(ql.Iterate(cb, 30, 40));
+  EXPECT_TRUE(res.empty());
+}
+
+TEST_F(QListTest, IterateNodes) {
+  QList ql(5);
+  for (unsigned i = 0; i < 23; ++i)
+    ql.Push(absl::StrCat(i), QList::TAIL);
+  ql.Pop(QList::HEAD);  // the first chunk starts past its origin
+
+  vector<string> res;
+  vector<uint32_t> counts;
+  auto cb = [&](const uint8_t* lp, uint32_t offset, uint32_t count) {
+    uint8_t* p = lpSeek(const_cast<uint8_t*>(lp), offset);
+    for (uint32_t i = 0; i < count; ++i, p = lpNext(const_cast<uint8_t*>(lp), p)) {
+      int64_t len;
+      uint8_t buf[LP_INTBUF_SIZE];
+      uint8_t* elem = lpGet(p, &len, buf);
+      res.emplace_back(reinterpret_cast<char*>(elem), len);
+    }
+    counts.push_back(count);
+    return true;
+  };
+
+  EXPECT_TRUE(ql.IterateNodes(cb, 2, 12));
+  EXPECT_EQ(11u, res.size());
+  EXPECT_EQ("3", res.front());
+  EXPECT_EQ("13", res.back());
+  EXPECT_EQ((vector<uint32_t>{2, 5, 4}), counts);
+
+  res.clear();
+  counts.clear();
+  EXPECT_TRUE(ql.IterateNodes(cb, 0, -1));
+  EXPECT_EQ(22u, res.size());
+  EXPECT_EQ(ToVec(ql), res);
+}
+
+TEST_F(QListTest, AppendListpack) {
+  QList ql;
+  for (unsigned n : {3, 1, 5}) {
+    uint8_t* lp = lpNew(0);
+    for (unsigned i = 0; i < n; ++i)
+      lp = lpAppendInteger(lp, i);
+    ql.AppendListpack(lp);
+  }
+  EXPECT_EQ(9u, ql.Size());
+  EXPECT_EQ(3u, ql.node_count());
+  EXPECT_EQ(0, ql.Get(3)->longval);
+  EXPECT_EQ(4, ql.Get(-1)->longval);
+  EXPECT_EQ(lpLength((uint8_t*)ql.node_listpack(2)), 5u);
+}
+
+TEST_F(QListTest, Random) {
+  for (int fill : {1, 2, 7, -1}) {
+    QList ql(fill);
+    deque<string> model;
+
+    for (unsigned i = 0; i < 5000; ++i) {
+      string val = absl::StrCat(generator_() % 50);
+      if (generator_() % 4 == 0)
+        val.append(generator_() % 200, 'v');
+      unsigned op = generator_() % 10;
+
+      if (op < 3 || model.empty()) {
+        bool head = generator_() % 2;
+        ql.Push(val, head ? QList::HEAD : QList::TAIL);
+        head ? model.push_front(val) : model.push_back(val);
+      } else if (op < 5) {
+        bool head = generator_() % 2;
+        string expected = head ? model.front() : model.back();
+        head ? model.pop_front() : model.pop_back();
+        ASSERT_EQ(expected, ql.Pop(head ? QList::HEAD : QList::TAIL));
+      } else if (op == 5) {
+        size_t idx = generator_() % model.size();
+        ASSERT_TRUE(ql.Replace(idx, val));
+        model[idx] = val;
+      } else if (op == 6) {
+        size_t idx = generator_() % model.size();
+        string pivot = model[idx];
+        auto it = find(model.begin(), model.end(), pivot);
+        bool after = generator_() % 2;
+        ASSERT_TRUE(ql.Insert(pivot, val, after ? QList::AFTER : QList::BEFORE));
+        model.insert(after ? it + 1 : it, val);
+      } else if (op == 7) {
+        string elem = absl::StrCat(generator_() % 50);
+        unsigned count = generator_() % 3;
+        bool head = generator_() % 2;
+        unsigned removed = 0;
+        if (head) {
+          for (auto it = model.begin(); it != model.end() && (!count || removed < count);) {
+            if (*it == elem) {
+              it = model.erase(it);
+              ++removed;
+            } else {
+              ++it;
+            }
+          }
+        } else {
+          for (size_t j = model.size(); j > 0 && (!count || removed < count); --j) {
+            if (model[j - 1] == elem) {
+              model.erase(model.begin() + j - 1);
+              ++removed;
+            }
+          }
+        }
+        ASSERT_EQ(removed, ql.Remove(elem, count, head ? QList::HEAD : QList::TAIL));
+      } else if (op == 8 && generator_() % 8 == 0) {
+        size_t start = generator_() % model.size();
+        size_t count = min<size_t>(generator_() % 10, model.size() - start);
+        ql.Erase(start, count);
+        model.erase(model.begin() + start, model.begin() + start + count);
+      } else {
+        size_t idx = generator_() % model.size();
+        auto entry = ql.Get(idx);
+        ASSERT_TRUE(entry);
+        ASSERT_EQ(model[idx], entry->to_string());
+      }
+
+      if (i % 500 == 0)
+        Verify(ql, model);
+    }
+    Verify(ql, model);
+  }
+}
+
+static void BM_QListIndex(benchmark::State& state) {
+  init_zmalloc_threadlocal(mi_heap_get_backing());
+  QList ql;
+  unsigned num = state.range(0);
+  for (unsigned i = 0; i < num; ++i)
+    ql.Push(absl::StrCat("element", i), QList::TAIL);
+
+  mt19937 generator(1);
+  while (state.KeepRunning()) {
+    for (unsigned i = 0; i < 100; ++i)
+      benchmark::DoNotOptimize(ql.Get(generator() % num));
+  }
+}
+BENCHMARK(BM_QListIndex)->Arg(1000)->Arg(100000)->Arg(1000000);
+
+static void BM_QListPushPop(benchmark::State& state) {
+  init_zmalloc_threadlocal(mi_heap_get_backing());
+  QList ql;
+  for (unsigned i = 0; i < 1024; ++i)
+    ql.Push(absl::StrCat("element", i), QList::TAIL);
+
+  while (state.KeepRunning()) {
+    for (unsigned i = 0; i < 100; ++i) {
+      ql.Push("value", QList::HEAD);
+      benchmark::DoNotOptimize(ql.Pop(QList::TAIL));
+    }
+  }
+}
+BENCHMARK(BM_QListPushPop);
+
+}  // namespace dfly
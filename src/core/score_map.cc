@@ -86,6 +86,15 @@ std::optional<double> ScoreMap::Find(std::string_view field) {
   return GetValue(str);
 }
 
+void ScoreMap::FindBatch(const string_view* keys, size_t num, optional<double>* dest) const {
+  FindInternalBatch(keys, num, 1, [dest](size_t i, void* obj) {  // 1 - string_view
+    if (obj)
+      dest[i] = GetValue((sds)obj);
+    else
+      dest[i].reset();
+  });
+}
+
 uint64_t ScoreMap::Hash(const void* obj, uint32_t cookie) const {
   DCHECK_LT(cookie, 2u);
 
@@ -138,4 +147,21 @@ detail::SdsScorePair ScoreMap::iterator::BreakToPair(void* obj) {
   return detail::SdsScorePair(f, GetValue(f));
 }
 
+bool ScoreMap::iterator::ReallocIfNeeded(float ratio, absl::FunctionRef<void(sds)> on_move) {
+  // Unwrap all links to correctly call SetObject()
+  auto* ptr = curr_entry_;
+  while (ptr->IsLink())
+    ptr = ptr->AsLink();
+
+  sds key = (sds)ptr->GetObject();
+  if (!zmalloc_page_is_underutilized(key, ratio))
+    return false;
+
+  sds new_key = (sds)AllocateScored({key, sdslen(key)}, GetValue(key));
+  on_move(new_key);
+  ptr->SetObject(new_key);
+  sdsfree(key);
+  return true;
+}
+
 }  // namespace dfly
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <absl/functional/function_ref.h>
+
 #include <optional>
 #include <string_view>
 
@@ -75,6 +77,10 @@ class ScoreMap : public DenseSet {
     bool operator!=(const iterator& b) const {
       return !(*this == b);
     }
+
+    // Moves the current entry to a new allocation if it sits on an underutilized page.
+    // on_move is called with the new entry while the old one is still valid.
+    bool ReallocIfNeeded(float ratio, absl::FunctionRef<void(sds)> on_move);
   };
 
   // Returns pointer to the internal objest and the insertion result.
@@ -100,6 +106,10 @@ class ScoreMap : public DenseSet {
   /// @return sds
   std::optional<double> Find(std::string_view key);
 
+  // Looks up num keys at once, sets dest[i] to the score of keys[i] if found.
+  // Faster than calling Find for each key, see DenseSet::FindInternalBatch.
+  void FindBatch(const std::string_view* keys, size_t num, std::optional<double>* dest) const;
+
   // returns the internal object if found, otherwise nullptr.
   void* FindObj(sds ele) {
     return FindInternal(ele, Hash(ele, 0), 0);
@@ -4,19 +4,35 @@
 
 #include "core/search/ast_expr.h"
 
+#include <absl/strings/escaping.h>
 #include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_join.h>
 
 #include <algorithm>
+#include <charconv>
 #include <cmath>
 #include <regex>
 
 #include "base/logging.h"
+#include "core/overloaded.h"
 
 using namespace std;
 
 namespace dfly::search {
 
-AstTermNode::AstTermNode(string term) : term{term} {
+namespace {
+
+// Shortest representation that converts back to the same value
+void AppendDouble(double d, string* out) {
+  char buf[32];
+  auto res = to_chars(buf, buf + sizeof(buf), d);
+  out->append(buf, res.ptr);
+}
+
+}  // namespace
+
+AstTermNode::AstTermNode(string term, MatchType match) : term{term}, match{match} {
 }
 
 AstRangeNode::AstRangeNode(double lo, bool lo_excl, double hi, bool hi_excl)
@@ -72,6 +88,69 @@ AstKnnNode::AstKnnNode(AstNode&& filter, AstKnnNode&& self) {
   this->filter = make_unique<AstNode>(std::move(filter));
 }
 
+string NormalizeAst(const AstNode& node) {
+  string result;
+  string* out = &result;
+  Overloaded visitor{
+      [](monostate) {},
+      [out](const AstStarNode&) { out->append("*"); },
+      [out](const AstTermNode& term) {
+        absl::StrAppend(out, term.match == AstTermNode::SUFFIX ? "*" : "", term.term,
+                        term.match == AstTermNode::PREFIX ? "*" : "");
+      },
+      [out](const AstRangeNode& range) {
+        out->append("[");
+        AppendDouble(range.lo, out);
+        out->append(" ");
+        AppendDouble(range.hi, out);
+        out->append("]");
+      },
+      [out](const AstGeoNode& geo) {
+        out->append("[GEO");
+        for (double value : {geo.lon, geo.lat, geo.radius, geo.width, geo.height}) {
+          out->append(" ");
+          AppendDouble(value, out);
+        }
+        out->append("]");
+      },
+      [out](const AstNegateNode& negate) {
+        absl::StrAppend(out, "-(", NormalizeAst(*negate.node), ")");
+      },
+      [out](const AstLogicalNode& logical) {
+        // Operands of logical nodes are commutative
+        vector<string> operands;
+        for (const auto& sub : logical.nodes)
+          operands.push_back(NormalizeAst(sub));
+        sort(operands.begin(), operands.end());
+        auto sep = logical.op == AstLogicalNode::AND ? " " : " | ";
+        absl::StrAppend(out, "(", absl::StrJoin(operands, sep), ")");
+      },
+      [out](const AstFieldNode& field) {
+        absl::StrAppend(out, "@", field.field, ":(", NormalizeAst(*field.node), ")");
+      },
+      [out](const AstTagsNode& tags) {
+        vector<string> sorted = tags.tags;
+        sort(sorted.begin(), sorted.end());
+        absl::StrAppend(out, "{", absl::StrJoin(sorted, " | "), "}");
+      },
+      [out](const AstKnnNode& knn) {
+        string_view vec{reinterpret_cast<const char*>(knn.vec.first.get()),
+                        knn.vec.second * sizeof(float)};
+        absl::StrAppend(out, knn.filter ? NormalizeAst(*knn.filter) : "*", " =>[KNN ", knn.limit,
+                        " @", knn.field, " ", absl::CEscape(vec), " AS ", knn.score_alias);
+        if (knn.ef_runtime)
+          absl::StrAppend(out, " EF_RUNTIME ", *knn.ef_runtime);
+        out->append("]");
+      },
+      [out](const AstSortNode& sort_node) {
+        absl::StrAppend(out, NormalizeAst(*sort_node.filter), " SORTBY @", sort_node.field,
+                        sort_node.descending ? " DESC" : " ASC");
+      },
+  };
+  visit(visitor, node.Variant());
+  return result;
+}
+
 }  // namespace dfly::search
 
 namespace std {
@@ -8,6 +8,7 @@
 #include <iostream>
 #include <memory>
 #include <ostream>
+#include <string>
 #include <variant>
 #include <vector>
 
@@ -22,11 +23,14 @@ struct AstNode;
 // Matches all documents
 struct AstStarNode {};
 
-// Matches terms in text fields
+// Matches terms in text fields, or all terms with a given prefix or suffix
 struct AstTermNode {
-  AstTermNode(std::string term);
+  enum MatchType { EXACT, PREFIX, SUFFIX };
+
+  AstTermNode(std::string term, MatchType match = EXACT);
 
   std::string term;
+  MatchType match;
 };
 
 // Matches numeric range
@@ -36,6 +40,14 @@ struct AstRangeNode {
   double lo, hi;
 };
 
+// Matches geo points within a circle of radius around the center if radius is set, or within
+// a rectangle of width x height otherwise. The center is given in degrees, sizes in meters.
+struct AstGeoNode {
+  double lon, lat;
+  double radius = 0;
+  double width = 0, height = 0;
+};
+
 // Negates subtree
 struct AstNegateNode {
   AstNegateNode(AstNode&& node);
@@ -97,8 +109,8 @@ struct AstSortNode {
 };
 
 using NodeVariants =
-    std::variant<std::monostate, AstStarNode, AstTermNode, AstRangeNode, AstNegateNode,
-                 AstLogicalNode, AstFieldNode, AstTagsNode, AstKnnNode, AstSortNode>;
+    std::variant<std::monostate, AstStarNode, AstTermNode, AstRangeNode, AstGeoNode,
+                 AstNegateNode, AstLogicalNode, AstFieldNode, AstTagsNode, AstKnnNode, AstSortNode>;
 
 struct AstNode : public NodeVariants {
   using variant::variant;
@@ -114,6 +126,10 @@ struct AstNode : public NodeVariants {
 
 using AstExpr = AstNode;
 
+// Canonical text form of a query tree. Queries that differ only in whitespace, the order of
+// operands of AND, OR or tag lists, or that substitute the same parameters, have equal forms.
+std::string NormalizeAst(const AstNode& node);
+
 }  // namespace search
 }  // namespace dfly
 
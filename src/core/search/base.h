@@ -23,6 +23,9 @@ using DocId = uint32_t;
 
 enum class VectorSimilarity { L2, COSINE };
 
+// Encoding of indexed vectors, see VectorCodec
+enum class VectorQuantization { NONE, FP16, INT8 };
+
 using OwnedFtVector = std::pair<std::unique_ptr<float[]>, size_t /* dimension (size) */>;
 
 // Query params represent named parameters for queries supplied via PARAMS.
@@ -84,6 +87,15 @@ struct BaseIndex {
   virtual ~BaseIndex() = default;
   virtual void Add(DocId id, DocumentAccessor* doc, std::string_view field) = 0;
   virtual void Remove(DocId id, DocumentAccessor* doc, std::string_view field) = 0;
+
+  // Compact internal structures after bulk updates
+  virtual void Optimize() {
+  }
+
+  // Bytes allocated outside of the memory resource the index was created with
+  virtual size_t ExternalMemoryUsage() const {
+    return 0;
+  }
 };
 
 // Base class for type-specific sorting indices.
@@ -27,6 +27,27 @@ template <typename C> bool BlockList<C>::Remove(DocId t) {
   return false;
 }
 
+template <typename C> bool BlockList<C>::Contains(DocId t) const {
+  // Only the last block starting before t can contain it
+  auto it = std::upper_bound(blocks_.begin(), blocks_.end(), t,
+                             [](DocId t, const C& l) { return *l.begin() > t; });
+  if (it == blocks_.begin())
+    return false;
+  --it;
+
+  using BlockIterator = typename C::iterator;
+  if constexpr (is_base_of_v<random_access_iterator_tag,
+                             typename iterator_traits<BlockIterator>::iterator_category>) {
+    return binary_search(it->begin(), it->end(), t);
+  } else {
+    for (DocId id : *it) {
+      if (id >= t)
+        return id == t;
+    }
+    return false;
+  }
+}
+
 template <typename C> typename BlockList<C>::BlockIt BlockList<C>::FindBlock(DocId t) {
   DCHECK(blocks_.empty() || blocks_.back().Size() > 0u);
 
@@ -33,6 +33,10 @@ template <typename Container /* underlying container */> class BlockList {
   // Remove element, returns true if removed, false if not found.
   bool Remove(DocId t);
 
+  // Check if element is present. Finds the block in logarithmic time, compressed blocks are then
+  // decoded up to the element.
+  bool Contains(DocId t) const;
+
   size_t Size() const {
     return size_;
   }
@@ -103,6 +103,18 @@ TYPED_TEST(BlockListTest, RandomNumbers) {
   }
 }
 
+TYPED_TEST(BlockListTest, Contains) {
+  auto list = this->Make();
+  EXPECT_FALSE(list.Contains(0));
+
+  // Even numbers span many blocks
+  for (DocId i = 0; i < 1000; i += 2)
+    list.Insert(i);
+
+  for (DocId i = 0; i < 1002; i++)
+    EXPECT_EQ(list.Contains(i), i % 2 == 0 && i < 1000) << i;
+}
+
 static void BM_Erase90PctTail(benchmark::State& state) {
   BlockList<CompressedSortedSet> bl{PMR_NS::get_default_resource()};
 
@@ -6,6 +6,7 @@
 
 #include <absl/container/flat_hash_set.h>
 #include <absl/strings/ascii.h>
+#include <absl/strings/match.h>
 #include <absl/strings/numbers.h>
 #include <absl/strings/str_join.h>
 #include <absl/strings/str_split.h>
@@ -14,16 +15,23 @@
 
 #include <hnswlib/hnswalg.h>
 #include <hnswlib/hnswlib.h>
-#include <hnswlib/space_ip.h>
-#include <hnswlib/space_l2.h>
 #include <uni_algo/case.h>
 #include <uni_algo/ranges_word.h>
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
+#include <thread>
 
 #include "base/logging.h"
 
+extern "C" {
+#include "redis/geo.h"
+#include "redis/geohash.h"
+#include "redis/geohash_helper.h"
+#include "redis/util.h"
+}
+
 namespace dfly::search {
 
 using namespace std;
@@ -46,6 +54,20 @@ absl::flat_hash_set<std::string> TokenizeWords(std::string_view text) {
   return words;
 }
 
+// Count occurrences of every word of text, return total number of words
+uint32_t CountWords(std::string_view text, absl::flat_hash_map<std::string, uint32_t>* counts) {
+  uint32_t total = 0;
+  for (std::string_view word : una::views::word_only::utf8(text)) {
+    (*counts)[una::cases::to_lowercase_utf8(word)]++;
+    total++;
+  }
+  return total;
+}
+
+string Reversed(string_view str) {
+  return string{str.rbegin(), str.rend()};
+}
+
 // Split taglist, remove duplicates and convert all to lowercase
 // TODO: introduce unicode support if needed
 absl::flat_hash_set<string> NormalizeTags(string_view taglist, bool case_sensitive,
@@ -63,16 +85,48 @@ absl::flat_hash_set<string> NormalizeTags(string_view taglist, bool case_sensiti
   return tags;
 }
 
+// Parse "lon,lat" into the 52 bit geohash of the point
+optional<uint64_t> ParseGeoPoint(string_view str) {
+  pair<string_view, string_view> parts = absl::StrSplit(str, ',');
+  double lon, lat;
+  if (!absl::SimpleAtod(parts.first, &lon) || !absl::SimpleAtod(parts.second, &lat))
+    return nullopt;
+
+  GeoHashBits hash;
+  if (!geohashEncodeWGS84(lon, lat, GEO_STEP_MAX, &hash))
+    return nullopt;
+  return geohashAlign52Bits(hash);
+}
+
+GeoShape MakeGeoShape(const GeoIndex::Area& area) {
+  GeoShape shape{};
+  shape.xy[0] = area.lon;
+  shape.xy[1] = area.lat;
+  shape.conversion = 1;
+  if (area.radius > 0) {
+    shape.type = CIRCULAR_TYPE;
+    shape.t.radius = area.radius;
+  } else {
+    shape.type = RECTANGLE_TYPE;
+    shape.t.r.width = area.width;
+    shape.t.r.height = area.height;
+  }
+  return shape;
+}
+
 };  // namespace
 
-NumericIndex::NumericIndex(PMR_NS::memory_resource* mr) : entries_{mr} {
+NumericIndex::Block::Block(PMR_NS::memory_resource* mr) : entries{mr}, ids{mr} {
+}
+
+NumericIndex::NumericIndex(PMR_NS::memory_resource* mr) : blocks_{mr} {
 }
 
 void NumericIndex::Add(DocId id, DocumentAccessor* doc, string_view field) {
   for (auto str : doc->GetStrings(field)) {
     double num;
     if (absl::SimpleAtod(str, &num))
-      entries_.emplace(num, id);
+      Insert({num, id});
   }
 }
 
@@ -80,46 +134,264 @@ void NumericIndex::Remove(DocId id, DocumentAccessor* doc, string_view field) {
   for (auto str : doc->GetStrings(field)) {
     double num;
     if (absl::SimpleAtod(str, &num))
-      entries_.erase({num, id});
+      Erase({num, id});
   }
 }
 
-vector<DocId> NumericIndex::Range(double l, double r) const {
-  auto it_l = entries_.lower_bound({l, 0});
-  auto it_r = entries_.lower_bound({r, numeric_limits<DocId>::max()});
+void NumericIndex::Insert(Entry entry) {
+  auto* mr = blocks_.get_allocator().resource();
+  if (blocks_.empty()) {
+    Block& block = blocks_.emplace_back(mr);
+    block.entries.push_back(entry);
+    block.ids.Insert(entry.second);
+    return;
+  }
 
-  vector<DocId> out;
-  for (auto it = it_l; it != it_r; ++it)
-    out.push_back(it->second);
+  // Last block starting not after entry
+  auto it = upper_bound(blocks_.begin(), blocks_.end(), entry,
+                        [](const Entry& e, const Block& b) { return e < b.entries.front(); });
+  Block& block = *(it == blocks_.begin() ? it : prev(it));
+
+  auto pos = lower_bound(block.entries.begin(), block.entries.end(), entry);
+  if (pos != block.entries.end() && *pos == entry)
+    return;
+  block.entries.insert(pos, entry);
+  block.ids.Insert(entry.second);
+
+  if (block.entries.size() <= kMaxBlockSize)
+    return;
+
+  // Split block in halves and rebuild the sets of both
+  Block upper{mr};
+  auto middle = block.entries.begin() + block.entries.size() / 2;
+  upper.entries.assign(middle, block.entries.end());
+  block.entries.erase(middle, block.entries.end());
+
+  block.ids = RoaringSet{mr};
+  for (auto [_, id] : block.entries)
+    block.ids.Insert(id);
+  for (auto [_, id] : upper.entries)
+    upper.ids.Insert(id);
+
+  size_t index = &block - blocks_.data();
+  blocks_.insert(blocks_.begin() + index + 1, std::move(upper));
+}
+
+void NumericIndex::Erase(Entry entry) {
+  // First block ending not before entry
+  auto it = lower_bound(blocks_.begin(), blocks_.end(), entry,
+                        [](const Block& b, const Entry& e) { return b.entries.back() < e; });
+  if (it == blocks_.end())
+    return;
+
+  auto pos = lower_bound(it->entries.begin(), it->entries.end(), entry);
+  if (pos == it->entries.end() || *pos != entry)
+    return;
+  it->entries.erase(pos);
+
+  if (it->entries.empty()) {
+    blocks_.erase(it);
+    return;
+  }
+
+  // Documents can have multiple values in a block
+  auto same_id = [id = entry.second](const Entry& e) { return e.second == id; };
+  if (none_of(it->entries.begin(), it->entries.end(), same_id))
+    it->ids.Remove(entry.second);
+}
+
+PMR_NS::vector<NumericIndex::Block>::const_iterator NumericIndex::FirstBlock(double value) const {
+  return lower_bound(blocks_.begin(), blocks_.end(), value,
+                     [](const Block& b, double value) { return b.Max() < value; });
+}
+
+RoaringSet NumericIndex::Range(double l, double r) const {
+  RoaringSet out{blocks_.get_allocator().resource()};
+  for (auto it = FirstBlock(l); it != blocks_.end() && it->Min() <= r; ++it) {
+    if (l <= it->Min() && it->Max() <= r) {
+      out.Merge(it->ids);
+      continue;
+    }
+
+    for (auto e = lower_bound(it->entries.begin(), it->entries.end(), Entry{l, 0});
+         e != it->entries.end() && e->first <= r; ++e)
+      out.Insert(e->second);
+  }
+  return out;
+}
+
+size_t NumericIndex::Count(double l, double r, size_t limit) const {
+  size_t count = 0;
+  for (auto it = FirstBlock(l); it != blocks_.end() && it->Min() <= r && count < limit; ++it) {
+    if (l <= it->Min() && it->Max() <= r) {
+      count += it->entries.size();
+      continue;
+    }
+
+    for (auto e = lower_bound(it->entries.begin(), it->entries.end(), Entry{l, 0});
+         e != it->entries.end() && e->first <= r && count < limit; ++e)
+      count++;
+  }
+  return min(count, limit);
+}
+
+void NumericIndex::Filter(double l, double r, vector<DocId>* docs) const {
+  vector<bool> matched(docs->size());
+  auto mark = [docs, &matched](DocId id) {
+    auto pos = lower_bound(docs->begin(), docs->end(), id);
+    if (pos != docs->end() && *pos == id)
+      matched[pos - docs->begin()] = true;
+  };
+
+  for (auto it = FirstBlock(l); it != blocks_.end() && it->Min() <= r; ++it) {
+    // Probe the set of covered blocks if there are fewer docs than entries
+    if (l <= it->Min() && it->Max() <= r && docs->size() < it->entries.size()) {
+      for (size_t i = 0; i < docs->size(); i++)
+        matched[i] = matched[i] || it->ids.Contains((*docs)[i]);
+      continue;
+    }
+
+    for (auto e = lower_bound(it->entries.begin(), it->entries.end(), Entry{l, 0});
+         e != it->entries.end() && e->first <= r; ++e)
+      mark(e->second);
+  }
+
+  size_t kept = 0;
+  for (size_t i = 0; i < docs->size(); i++) {
+    if (matched[i])
+      (*docs)[kept++] = (*docs)[i];
+  }
+  docs->resize(kept);
+}
 
+GeoIndex::GeoIndex(PMR_NS::memory_resource* mr) : entries_{mr}, hashes_{mr} {
+}
+
+void GeoIndex::Add(DocId id, DocumentAccessor* doc, string_view field) {
+  for (auto str : doc->GetStrings(field)) {
+    if (auto hash = ParseGeoPoint(str); hash) {
+      if (hashes_.size() <= id)
+        hashes_.resize(id + 1, kNoHash);
+      hashes_[id] = *hash;
+      entries_.emplace(*hash, id);
+      return;
+    }
+  }
+}
+
+void GeoIndex::Remove(DocId id, DocumentAccessor* doc, string_view field) {
+  if (id >= hashes_.size() || hashes_[id] == kNoHash)
+    return;
+  entries_.erase({hashes_[id], id});
+  hashes_[id] = kNoHash;
+}
+
+vector<pair<uint64_t, uint64_t>> GeoIndex::CellRanges(const Area& area) {
+  GeoShape shape = MakeGeoShape(area);
+  GeoHashRadius cells = geohashCalculateAreasByShapeWGS84(&shape);
+
+  const GeoHashNeighbors& n = cells.neighbors;
+  GeoHashBits neighbors[9] = {cells.hash,   n.north,      n.south,      n.east,      n.west,
+                              n.north_east, n.north_west, n.south_east, n.south_west};
+
+  vector<pair<uint64_t, uint64_t>> ranges;
+  for (const GeoHashBits& cell : neighbors) {
+    // Cells outside of the valid range are zeroed
+    if (HASHISZERO(cell))
+      continue;
+
+    GeoHashFix52Bits min, max;
+    scoresOfGeoHashBox(cell, &min, &max);
+    ranges.emplace_back(min, max);
+  }
+
+  // Adjacent cells are the same for huge areas and neighbors can be contiguous
+  sort(ranges.begin(), ranges.end());
+  size_t merged = 0;
+  for (size_t i = 0; i < ranges.size(); i++) {
+    if (merged > 0 && ranges[i].first <= ranges[merged - 1].second)
+      ranges[merged - 1].second = max(ranges[merged - 1].second, ranges[i].second);
+    else
+      ranges[merged++] = ranges[i];
+  }
+  ranges.resize(merged);
+  return ranges;
+}
+
+bool GeoIndex::Contains(const Area& area, uint64_t hash) {
+  GeoShape shape = MakeGeoShape(area);
+  double xy[2], distance;
+  return geoWithinShape(&shape, double(hash), xy, &distance) == C_OK;
+}
+
+vector<DocId> GeoIndex::Within(const Area& area) const {
+  vector<DocId> out;
+  for (auto [min, max] : CellRanges(area)) {
+    for (auto it = entries_.lower_bound({min, 0}); it != entries_.end() && it->first < max; ++it) {
+      if (Contains(area, it->first))
+        out.push_back(it->second);
+    }
+  }
   sort(out.begin(), out.end());
-  out.erase(unique(out.begin(), out.end()), out.end());
   return out;
 }
 
+size_t GeoIndex::Count(const Area& area, size_t limit) const {
+  size_t count = 0;
+  for (auto [min, max] : CellRanges(area)) {
+    for (auto it = entries_.lower_bound({min, 0});
+         it != entries_.end() && it->first < max && count < limit; ++it)
+      count++;
+  }
+  return count;
+}
+
+void GeoIndex::Filter(const Area& area, vector<DocId>* docs) const {
+  auto outside = [this, &area](DocId id) {
+    return id >= hashes_.size() || hashes_[id] == kNoHash || !Contains(area, hashes_[id]);
+  };
+  docs->erase(remove_if(docs->begin(), docs->end(), outside), docs->end());
+}
+
 template <typename C>
 BaseStringIndex<C>::BaseStringIndex(PMR_NS::memory_resource* mr, bool case_sensitive)
     : case_sensitive_{case_sensitive}, entries_{mr} {
 }
 
 template <typename C>
-const typename BaseStringIndex<C>::Container* BaseStringIndex<C>::Matching(string_view str) const {
+string_view BaseStringIndex<C>::Normalize(string_view str, string* tmp) const {
   str = absl::StripAsciiWhitespace(str);
-
-  string tmp;
   if (!case_sensitive_) {
-    tmp = ToLower(str);
-    str = tmp;
+    *tmp = ToLower(str);
+    str = *tmp;
   }
+  return str;
+}
 
-  auto it = entries_.find(str);
+template <typename C>
+const typename BaseStringIndex<C>::Container* BaseStringIndex<C>::Matching(string_view str) const {
+  string tmp;
+  auto it = entries_.find(Normalize(str, &tmp));
   return (it != entries_.end()) ? &it->second : nullptr;
 }
 
+template <typename C>
+vector<const typename BaseStringIndex<C>::Container*> BaseStringIndex<C>::MatchingPrefix(
+    string_view prefix) const {
+  string tmp;
+  prefix = Normalize(prefix, &tmp);
+
+  vector<const Container*> out;
+  for (auto it = entries_.lower_bound(prefix);
+       it != entries_.end() && absl::StartsWith(it->first, prefix); ++it)
+    out.push_back(&it->second);
+  return out;
+}
+
 template <typename C>
 typename BaseStringIndex<C>::Container* BaseStringIndex<C>::GetOrCreate(string_view word) {
   auto* mr = entries_.get_allocator().resource();
-  return &entries_.try_emplace(PMR_NS::string{word, mr}, mr, 1000 /* block size */).first->second;
+  return &entries_.try_emplace(PMR_NS::string{word, mr}, mr).first->second;
 }
 
 template <typename C>
@@ -149,17 +421,104 @@ void BaseStringIndex<C>::Remove(DocId id, DocumentAccessor* doc, string_view fie
   }
 }
 
-template struct BaseStringIndex<CompressedSortedSet>;
-template struct BaseStringIndex<SortedVector>;
+template struct BaseStringIndex<TextPostings>;
+template struct BaseStringIndex<RoaringSet>;
+
+TextPostings::TextPostings(PMR_NS::memory_resource* mr) : BlockList{mr}, frequencies_{mr} {
+}
+
+bool TextPostings::Insert(DocId id, uint32_t frequency) {
+  if (!BlockList::Insert(id))
+    return false;
+  if (frequency > 1)
+    frequencies_[id] = frequency;
+  return true;
+}
+
+bool TextPostings::Remove(DocId id) {
+  frequencies_.erase(id);
+  return BlockList::Remove(id);
+}
+
+uint32_t TextPostings::Frequency(DocId id) const {
+  auto it = frequencies_.find(id);
+  return it != frequencies_.end() ? it->second : 1;
+}
+
+TextIndex::TextIndex(PMR_NS::memory_resource* mr)
+    : BaseStringIndex(mr, false), reversed_terms_{mr}, doc_lengths_{mr} {
+}
+
+void TextIndex::Add(DocId id, DocumentAccessor* doc, string_view field) {
+  absl::flat_hash_map<string, uint32_t> counts;
+  uint32_t length = 0;
+  for (string_view str : doc->GetStrings(field))
+    length += CountWords(str, &counts);
+
+  auto* mr = entries_.get_allocator().resource();
+  for (const auto& [word, count] : counts) {
+    auto* postings = GetOrCreate(word);
+    if (postings->Size() == 0)
+      reversed_terms_.emplace(Reversed(word), mr);
+    postings->Insert(id, count);
+  }
+
+  if (id >= doc_lengths_.size())
+    doc_lengths_.resize(id + 1);
+  doc_lengths_[id] = length;
+  total_length_ += length;
+  num_docs_++;
+}
+
+void TextIndex::Remove(DocId id, DocumentAccessor* doc, string_view field) {
+  absl::flat_hash_set<string> words;
+  for (string_view str : doc->GetStrings(field))
+    words.merge(TokenizeWords(str));
+
+  for (const auto& word : words) {
+    auto it = entries_.find(word);
+    if (it == entries_.end())
+      continue;
+
+    it->second.Remove(id);
+    if (it->second.Size() == 0) {
+      entries_.erase(it);
+      reversed_terms_.erase(Reversed(word));
+    }
+  }
+
+  DCHECK_LT(id, doc_lengths_.size());
+  total_length_ -= exchange(doc_lengths_[id], 0);
+  num_docs_--;
+}
 
 absl::flat_hash_set<std::string> TextIndex::Tokenize(std::string_view value) const {
   return TokenizeWords(value);
 }
 
+vector<const TextIndex::Container*> TextIndex::MatchingSuffix(string_view suffix) const {
+  string tmp;
+  string reversed = Reversed(Normalize(suffix, &tmp));
+
+  vector<const Container*> out;
+  for (auto it = reversed_terms_.lower_bound(reversed);
+       it != reversed_terms_.end() && absl::StartsWith(*it, reversed); ++it) {
+    auto entry = entries_.find(Reversed(*it));
+    DCHECK(entry != entries_.end());
+    out.push_back(&entry->second);
+  }
+  return out;
+}
+
 absl::flat_hash_set<std::string> TagIndex::Tokenize(std::string_view value) const {
   return NormalizeTags(value, case_sensitive_, separator_);
 }
 
+void TagIndex::Optimize() {
+  for (auto& [_, ids] : entries_)
+    ids.Optimize();
+}
+
 BaseVectorIndex::BaseVectorIndex(size_t dim, VectorSimilarity sim) : dim_{dim}, sim_{sim} {
 }
 
@@ -169,19 +528,35 @@ std::pair<size_t /*dim*/, VectorSimilarity> BaseVectorIndex::Info() const {
 
 FlatVectorIndex::FlatVectorIndex(const SchemaField::VectorParams& params,
                                  PMR_NS::memory_resource* mr)
-    : BaseVectorIndex{params.dim, params.sim}, entries_{mr} {
+    : BaseVectorIndex{params.dim, params.sim}, entries_{mr}, codes_{mr} {
   DCHECK(!params.use_hnsw);
-  entries_.reserve(params.capacity * params.dim);
+  if (params.quantization == VectorQuantization::NONE) {
+    entries_.reserve(params.capacity * params.dim);
+  } else {
+    codec_.emplace(params.dim, params.quantization);
+    codes_.reserve(params.capacity * codec_->CodeSize());
+  }
 }
 
 void FlatVectorIndex::Add(DocId id, DocumentAccessor* doc, string_view field) {
+  // TODO: Let get vector write to buf itself
+  auto [ptr, size] = doc->GetVector(field);
+
+  if (codec_) {
+    size_t code_size = codec_->CodeSize();
+    DCHECK_LE(id * code_size, codes_.size());
+    if (id * code_size == codes_.size())
+      codes_.resize((id + 1) * code_size);
+
+    if (size == dim_)
+      codec_->Encode(ptr.get(), &codes_[id * code_size]);
+    return;
+  }
+
   DCHECK_LE(id * dim_, entries_.size());
   if (id * dim_ == entries_.size())
     entries_.resize((id + 1) * dim_);
 
-  // TODO: Let get vector write to buf itself
-  auto [ptr, size] = doc->GetVector(field);
-
   if (size == dim_)
     memcpy(&entries_[id * dim_], ptr.get(), dim_ * sizeof(float));
 }
@@ -190,36 +565,150 @@ void FlatVectorIndex::Remove(DocId id, DocumentAccessor* doc, string_view field)
   // noop
 }
 
-const float* FlatVectorIndex::Get(DocId doc) const {
-  return &entries_[doc * dim_];
+void FlatVectorIndex::Distances(const float* target, const DocId* docs, size_t num,
+                                float* out) const {
+  if (!codec_) {
+    absl::InlinedVector<const float*, 64> vecs(num);
+    for (size_t i = 0; i < num; i++)
+      vecs[i] = &entries_[docs[i] * dim_];
+    VectorDistances(target, vecs.data(), num, dim_, sim_, out);
+    return;
+  }
+
+  size_t code_size = codec_->CodeSize();
+  absl::InlinedVector<char, 1024> encoded(code_size);
+  codec_->Encode(target, encoded.data());
+  for (size_t i = 0; i < num; i++)
+    out[i] = codec_->Distance(encoded.data(), &codes_[docs[i] * code_size], sim_);
 }
 
+// Hnswlib space that uses the distance kernels of vector_utils. Like hnswlib::L2Space and
+// hnswlib::InnerProductSpace, it computes squared euclidean distances for L2 and one minus the
+// inner product otherwise. With quantization, hnswlib stores the codes and the distance functions
+// receive points and queries encoded.
+class HnswSpace : public hnswlib::SpaceInterface<float> {
+ public:
+  explicit HnswSpace(const SchemaField::VectorParams& params) : dim_{params.dim} {
+    bool l2 = params.sim == VectorSimilarity::L2;
+    if (params.quantization == VectorQuantization::NONE) {
+      dist_func_ = l2 ? &L2Distance : &IpDistance;
+    } else {
+      codec_.emplace(params.dim, params.quantization);
+      dist_func_ = l2 ? &CodeL2Distance : &CodeIpDistance;
+    }
+  }
+
+  size_t get_data_size() override {
+    return codec_ ? codec_->CodeSize() : dim_ * sizeof(float);
+  }
+
+  hnswlib::DISTFUNC<float> get_dist_func() override {
+    return dist_func_;
+  }
+
+  void* get_dist_func_param() override {
+    return this;
+  }
+
+  // Returns data in the format stored by hnswlib, buf is used for encoding if needed
+  const void* Prepare(const float* data, std::string* buf) const {
+    if (!codec_)
+      return data;
+    buf->resize(codec_->CodeSize());
+    codec_->Encode(data, buf->data());
+    return buf->data();
+  }
+
+ private:
+  static const HnswSpace* Self(const void* param) {
+    return static_cast<const HnswSpace*>(param);
+  }
+
+  static float L2Distance(const void* u, const void* v, const void* param) {
+    return L2DistanceSquared(static_cast<const float*>(u), static_cast<const float*>(v),
+                             Self(param)->dim_);
+  }
+
+  static float IpDistance(const void* u, const void* v, const void* param) {
+    return 1.0f - InnerProduct(static_cast<const float*>(u), static_cast<const float*>(v),
+                               Self(param)->dim_);
+  }
+
+  static float CodeL2Distance(const void* u, const void* v, const void* param) {
+    return Self(param)->codec_->L2DistanceSquared(static_cast<const char*>(u),
+                                                  static_cast<const char*>(v));
+  }
+
+  static float CodeIpDistance(const void* u, const void* v, const void* param) {
+    return 1.0f - Self(param)->codec_->InnerProduct(static_cast<const char*>(u),
+                                                    static_cast<const char*>(v));
+  }
+
+  size_t dim_;
+  std::optional<VectorCodec> codec_;
+  hnswlib::DISTFUNC<float> dist_func_;
+};
+
 struct HnswlibAdapter {
   // Default setting of hnswlib/hnswalg
   constexpr static size_t kDefaultEfRuntime = 10;
 
   HnswlibAdapter(const SchemaField::VectorParams& params)
-      : space_{MakeSpace(params.dim, params.sim)}, world_{GetSpacePtr(),
-                                                          params.capacity,
-                                                          params.hnsw_m,
-                                                          params.hnsw_ef_construction,
-                                                          100 /* seed*/,
-                                                          true} {
+      : space_{params}, world_{&space_,
+                               params.capacity,
+                               params.hnsw_m,
+                               params.hnsw_ef_construction,
+                               100 /* seed*/,
+                               true} {
   }
 
   void Add(float* data, DocId id) {
     if (world_.cur_element_count + 1 >= world_.max_elements_)
       world_.resizeIndex(world_.cur_element_count * 2);
-    world_.addPoint(data, id);
+    world_.addPoint(space_.Prepare(data, &buf_), id);
+  }
+
+  void AddBatch(absl::Span<const pair<DocId, const float*>> vecs, size_t num_threads) {
+    // Growing the index is not thread safe, so capacity is reserved for the whole batch
+    size_t required = world_.cur_element_count + vecs.size() + 1;
+    if (required >= world_.max_elements_)
+      world_.resizeIndex(max(required, world_.cur_element_count * 2));
+
+    atomic_size_t next{0};
+    auto insert = [&] {
+      string buf;
+      for (size_t i = next++; i < vecs.size(); i = next++)
+        world_.addPoint(space_.Prepare(vecs[i].second, &buf), vecs[i].first);
+    };
+
+    vector<thread> helpers;
+    for (size_t i = 1; i < min(num_threads, vecs.size()); i++)
+      helpers.emplace_back(insert);
+    insert();
+    for (auto& helper : helpers)
+      helper.join();
   }
 
   void Remove(DocId id) {
     world_.markDelete(id);
   }
 
+  size_t MemoryUsage() const {
+    // Level 0 links and data are stored per reserved element, upper level links per used element
+    size_t bytes = world_.max_elements_ * (world_.size_data_per_element_ + sizeof(void*) +
+                                           sizeof(int) + sizeof(std::mutex));
+    for (size_t i = 0; i < world_.cur_element_count; i++)
+      bytes += world_.element_levels_[i] * world_.size_links_per_element_;
+
+    // Approximate node size of the unordered map from labels to internal ids
+    using LookupEntry = pair<hnswlib::labeltype, hnswlib::tableint>;
+    bytes += world_.label_lookup_.size() * (sizeof(LookupEntry) + 2 * sizeof(void*));
+    return bytes;
+  }
+
   vector<pair<float, DocId>> Knn(float* target, size_t k, std::optional<size_t> ef) {
     world_.setEf(ef.value_or(kDefaultEfRuntime));
-    return QueueToVec(world_.searchKnn(target, k));
+    return QueueToVec(world_.searchKnn(space_.Prepare(target, &buf_), k));
   }
 
   vector<pair<float, DocId>> Knn(float* target, size_t k, std::optional<size_t> ef,
@@ -236,23 +725,10 @@ struct HnswlibAdapter {
 
     world_.setEf(ef.value_or(kDefaultEfRuntime));
     BinsearchFilter filter{&allowed};
-    return QueueToVec(world_.searchKnn(target, k, &filter));
+    return QueueToVec(world_.searchKnn(space_.Prepare(target, &buf_), k, &filter));
   }
 
  private:
-  using SpaceUnion = std::variant<hnswlib::L2Space, hnswlib::InnerProductSpace>;
-
-  static SpaceUnion MakeSpace(size_t dim, VectorSimilarity sim) {
-    if (sim == VectorSimilarity::L2)
-      return hnswlib::L2Space{dim};
-    else
-      return hnswlib::InnerProductSpace{dim};
-  }
-
-  hnswlib::SpaceInterface<float>* GetSpacePtr() {
-    return visit([](auto& space) -> hnswlib::SpaceInterface<float>* { return &space; }, space_);
-  }
-
   template <typename Q> static vector<pair<float, DocId>> QueueToVec(Q queue) {
     vector<pair<float, DocId>> out(queue.size());
     size_t idx = out.size();
@@ -263,8 +739,9 @@ struct HnswlibAdapter {
     return out;
   }
 
-  SpaceUnion space_;
+  HnswSpace space_;
   hnswlib::HierarchicalNSW<float> world_;
+  std::string buf_;  // Buffer for encoding points and queries
 };
 
 HnswVectorIndex::HnswVectorIndex(const SchemaField::VectorParams& params, PMR_NS::memory_resource*)
@@ -292,6 +769,25 @@ std::vector<std::pair<float, DocId>> HnswVectorIndex::Knn(float* target, size_t
   return adapter_->Knn(target, k, ef, allowed);
 }
 
+size_t HnswVectorIndex::ExternalMemoryUsage() const {
+  return adapter_->MemoryUsage();
+}
+
+void HnswVectorIndex::AddBatch(absl::Span<const pair<DocId, DocumentAccessor*>> docs,
+                               string_view field, size_t num_threads) {
+  vector<OwnedFtVector> owned;
+  vector<pair<DocId, const float*>> vecs;
+  owned.reserve(docs.size());
+  vecs.reserve(docs.size());
+
+  for (auto [id, doc] : docs) {
+    owned.push_back(doc->GetVector(field));
+    if (owned.back().second == dim_)
+      vecs.emplace_back(id, owned.back().first.get());
+  }
+  adapter_->AddBatch(vecs, num_threads);
+}
+
 void HnswVectorIndex::Remove(DocId id, DocumentAccessor* doc, string_view field) {
   adapter_->Remove(id);
 }
@@ -2,10 +2,12 @@
 // See LICENSE for licensing terms.
 //
 
+#include <absl/container/btree_map.h>
 #include <absl/container/btree_set.h>
 #include <absl/container/flat_hash_map.h>
 #include <absl/container/flat_hash_set.h>
 
+#include <limits>
 #include <map>
 #include <memory>
 #include <optional>
@@ -15,30 +17,109 @@
 #include "core/search/base.h"
 #include "core/search/block_list.h"
 #include "core/search/compressed_sorted_set.h"
+#include "core/search/roaring_set.h"
 
 // TODO: move core field definitions out of big header
 #include "core/search/search.h"
+#include "core/search/vector_utils.h"
 
 namespace dfly::search {
 
 // Index for integer fields.
-// Range bounds are queried in logarithmic time, iteration is constant.
+// Entries are kept in sorted blocks of consecutive values. Every block keeps a set of its ids, so
+// ranges are computed by unifying the sets of covered blocks and only boundary blocks are scanned.
 struct NumericIndex : public BaseIndex {
   explicit NumericIndex(PMR_NS::memory_resource* mr);
 
   void Add(DocId id, DocumentAccessor* doc, std::string_view field) override;
   void Remove(DocId id, DocumentAccessor* doc, std::string_view field) override;
 
-  std::vector<DocId> Range(double l, double r) const;
+  // Ids of documents with a value in range, sorted and deduplicated
+  RoaringSet Range(double l, double r) const;
+
+  // Number of values in range, counting stops at limit. Documents with multiple values in range
+  // are counted multiple times.
+  size_t Count(double l, double r, size_t limit) const;
+
+  // Keep only sorted docs with a value in range. The range is scanned once without being
+  // materialized, which is cheaper than Range when there are few docs.
+  void Filter(double l, double r, std::vector<DocId>* docs) const;
 
  private:
   using Entry = std::pair<double, DocId>;
-  absl::btree_set<Entry, std::less<Entry>, PMR_NS::polymorphic_allocator<Entry>> entries_;
+
+  // Blocks are split when they grow larger
+  static constexpr size_t kMaxBlockSize = 1024;
+
+  struct Block {
+    explicit Block(PMR_NS::memory_resource* mr);
+
+    double Min() const {
+      return entries.front().first;
+    }
+
+    double Max() const {
+      return entries.back().first;
+    }
+
+    PMR_NS::vector<Entry> entries;  // Sorted, never empty
+    RoaringSet ids;                 // Ids of all entries
+  };
+
+  // First block that can contain values not less than value
+  PMR_NS::vector<Block>::const_iterator FirstBlock(double value) const;
+
+  void Insert(Entry entry);
+  void Erase(Entry entry);
+
+  PMR_NS::vector<Block> blocks_;
 };
 
-// Base index for string based indices.
+// Index for geo fields with "lon,lat" values.
+// Points are ordered by their 52 bit geohash, so areas are looked up by the ranges of the geohash
+// cells covering them and only candidates inside these cells are checked for the exact distance.
+// Documents are indexed by their first valid point.
+struct GeoIndex : public BaseIndex {
+  // Circle if radius is set, otherwise rectangle of width x height around the center. The center
+  // is given in degrees, all sizes in meters.
+  struct Area {
+    double lon, lat;
+    double radius = 0;
+    double width = 0, height = 0;
+  };
+
+  explicit GeoIndex(PMR_NS::memory_resource* mr);
+
+  void Add(DocId id, DocumentAccessor* doc, std::string_view field) override;
+  void Remove(DocId id, DocumentAccessor* doc, std::string_view field) override;
+
+  // Ids of documents inside area, sorted
+  std::vector<DocId> Within(const Area& area) const;
+
+  // Number of candidates in the cells covering area, counting stops at limit
+  size_t Count(const Area& area, size_t limit) const;
+
+  // Keep only sorted docs inside area. Points of docs are looked up by id, so no cells are scanned
+  void Filter(const Area& area, std::vector<DocId>* docs) const;
+
+ private:
+  static constexpr uint64_t kNoHash = std::numeric_limits<uint64_t>::max();
+
+  // Ranges [min, max) of geohashes of the cells covering area
+  static std::vector<std::pair<uint64_t, uint64_t>> CellRanges(const Area& area);
+
+  static bool Contains(const Area& area, uint64_t hash);
+
+  absl::btree_set<std::pair<uint64_t, DocId>, std::less<std::pair<uint64_t, DocId>>,
+                  PMR_NS::polymorphic_allocator<std::pair<uint64_t, DocId>>>
+      entries_;
+
+  PMR_NS::vector<uint64_t> hashes_;  // Geohash of every document by id, kNoHash if not indexed
+};
+
+// Base index for string based indices, C is the type of the set of ids of every entry.
 template <typename C> struct BaseStringIndex : public BaseIndex {
-  using Container = BlockList<C>;
+  using Container = C;
 
   BaseStringIndex(PMR_NS::memory_resource* mr, bool case_sensitive);
 
@@ -51,54 +132,94 @@ template <typename C> struct BaseStringIndex : public BaseIndex {
   // Pointer is valid as long as index is not mutated. Nullptr if not found
   const Container* Matching(std::string_view str) const;
 
+  // All entries starting with prefix. Entries are ordered, so only the matching range is scanned.
+  std::vector<const Container*> MatchingPrefix(std::string_view prefix) const;
+
  protected:
   Container* GetOrCreate(std::string_view word);
 
-  struct PmrEqual {
-    using is_transparent = void;
-    bool operator()(const PMR_NS::string& lhs, const PMR_NS::string& rhs) const {
-      return lhs == rhs;
-    }
-    bool operator()(const PMR_NS::string& lhs, const std::string_view& rhs) const {
-      return lhs == rhs;
-    }
-  };
+  // Strip and lowercase query string if needed
+  std::string_view Normalize(std::string_view str, std::string* tmp) const;
 
-  struct PmrHash {
+  struct PmrLess {
     using is_transparent = void;
-    size_t operator()(const std::string_view& sv) const {
-      return absl::Hash<std::string_view>()(sv);
-    }
-    size_t operator()(const PMR_NS::string& pmrs) const {
-      return operator()(std::string_view{pmrs.data(), pmrs.size()});
+    bool operator()(std::string_view lhs, std::string_view rhs) const {
+      return lhs < rhs;
     }
   };
 
   bool case_sensitive_ = false;
 
-  absl::flat_hash_map<PMR_NS::string, Container, PmrHash, PmrEqual,
-                      PMR_NS::polymorphic_allocator<std::pair<PMR_NS::string, Container>>>
+  absl::btree_map<PMR_NS::string, Container, PmrLess,
+                  PMR_NS::polymorphic_allocator<std::pair<const PMR_NS::string, Container>>>
       entries_;
 };
 
+// Ids of documents containing a term with the frequency of the term in every document. Most
+// terms occur once per document, so only larger frequencies are stored.
+struct TextPostings : public BlockList<CompressedSortedSet> {
+  explicit TextPostings(PMR_NS::memory_resource* mr);
+
+  bool Insert(DocId id, uint32_t frequency = 1);
+  bool Remove(DocId id);
+
+  // Frequency of term in a contained document
+  uint32_t Frequency(DocId id) const;
+
+ private:
+  absl::flat_hash_map<DocId, uint32_t, absl::Hash<DocId>, std::equal_to<DocId>,
+                      PMR_NS::polymorphic_allocator<std::pair<const DocId, uint32_t>>>
+      frequencies_;
+};
+
 // Index for text fields.
-// Hashmap based lookup per word.
-struct TextIndex : public BaseStringIndex<CompressedSortedSet> {
-  TextIndex(PMR_NS::memory_resource* mr) : BaseStringIndex(mr, false) {
-  }
+// Ordered lookup per word, with term frequencies and document lengths for BM25 scoring.
+struct TextIndex : public BaseStringIndex<TextPostings> {
+  explicit TextIndex(PMR_NS::memory_resource* mr);
+
+  void Add(DocId id, DocumentAccessor* doc, std::string_view field) override;
+  void Remove(DocId id, DocumentAccessor* doc, std::string_view field) override;
 
   absl::flat_hash_set<std::string> Tokenize(std::string_view value) const override;
+
+  // All entries ending with suffix, looked up in the dictionary of reversed terms
+  std::vector<const Container*> MatchingSuffix(std::string_view suffix) const;
+
+  size_t NumDocs() const {
+    return num_docs_;
+  }
+
+  // Number of words of document
+  uint32_t DocLength(DocId id) const {
+    return id < doc_lengths_.size() ? doc_lengths_[id] : 0;
+  }
+
+  double AverageDocLength() const {
+    return num_docs_ > 0 ? double(total_length_) / num_docs_ : 0;
+  }
+
+ private:
+  absl::btree_set<PMR_NS::string, PmrLess, PMR_NS::polymorphic_allocator<PMR_NS::string>>
+      reversed_terms_;
+
+  PMR_NS::vector<uint32_t> doc_lengths_;
+  uint64_t total_length_ = 0;
+  size_t num_docs_ = 0;
 };
 
-// Index for text fields.
-// Hashmap based lookup per word.
-struct TagIndex : public BaseStringIndex<SortedVector> {
+// Index for tag fields.
+// Hashmap based lookup per tag. Tags are often shared by large parts of the documents, so their
+// ids are stored in roaring sets that are intersected and unified a word at a time.
+struct TagIndex : public BaseStringIndex<RoaringSet> {
   TagIndex(PMR_NS::memory_resource* mr, SchemaField::TagParams params)
       : BaseStringIndex(mr, params.case_sensitive), separator_{params.separator} {
   }
 
   absl::flat_hash_set<std::string> Tokenize(std::string_view value) const override;
 
+  // Convert sets to runs where it saves memory
+  void Optimize() override;
+
  private:
   char separator_;
 };
@@ -121,10 +242,14 @@ struct FlatVectorIndex : public BaseVectorIndex {
   void Add(DocId id, DocumentAccessor* doc, std::string_view field) override;
   void Remove(DocId id, DocumentAccessor* doc, std::string_view field) override;
 
-  const float* Get(DocId doc) const;
+  // Compute distances from target to the vectors of docs[0, num) into out
+  void Distances(const float* target, const DocId* docs, size_t num, float* out) const;
 
  private:
-  PMR_NS::vector<float> entries_;
+  PMR_NS::vector<float> entries_;  // Vectors stored as is if not quantized
+
+  std::optional<VectorCodec> codec_;
+  PMR_NS::vector<char> codes_;  // Encoded vectors of codec_->CodeSize() bytes
 };
 
 struct HnswlibAdapter;
@@ -136,10 +261,18 @@ struct HnswVectorIndex : public BaseVectorIndex {
   void Add(DocId id, DocumentAccessor* doc, std::string_view field) override;
   void Remove(DocId id, DocumentAccessor* doc, std::string_view field) override;
 
+  // Insert vectors of docs with num_threads threads in parallel. Hnswlib locks graph nodes
+  // individually, so concurrent insertions only contend on the nodes they link.
+  void AddBatch(absl::Span<const std::pair<DocId, DocumentAccessor*>> docs,
+                std::string_view field, size_t num_threads);
+
   std::vector<std::pair<float, DocId>> Knn(float* target, size_t k, std::optional<size_t> ef) const;
   std::vector<std::pair<float, DocId>> Knn(float* target, size_t k, std::optional<size_t> ef,
                                            const std::vector<DocId>& allowed) const;
 
+  // Hnswlib allocates the graph with malloc
+  size_t ExternalMemoryUsage() const override;
+
  private:
   std::unique_ptr<HnswlibAdapter> adapter_;
 };
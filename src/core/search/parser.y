@@ -27,6 +27,8 @@
 #include "core/search/query_driver.h"
 #include "core/search/vector_utils.h"
 
+#include <absl/strings/match.h>
+
 // Have to disable because GCC doesn't understand `symbol_type`'s union
 // implementation
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
@@ -35,6 +37,17 @@
 
 using namespace std;
 
+// Multiplier converting geo distances in unit to meters, 0 if unit is unknown
+static double GeoUnitToMeters(string_view unit) {
+  static const pair<string_view, double> kUnits[] = {
+      {"m", 1.0}, {"km", 1000.0}, {"mi", 1609.34}, {"ft", 0.3048}};
+  for (auto [name, meters] : kUnits) {
+    if (absl::EqualsIgnoreCase(unit, name))
+      return meters;
+  }
+  return 0;
+}
+
 }
 
 %parse-param { QueryDriver *driver  }
@@ -66,7 +79,7 @@ using namespace std;
 
 // Needed 0 at the end to satisfy bison 3.5.1
 %token YYEOF 0
-%token <std::string> TERM "term" PARAM "param" FIELD "field"
+%token <std::string> TERM "term" PARAM "param" FIELD "field" PREFIX "prefix" SUFFIX "suffix"
 
 %precedence TERM
 %left OR_OP
@@ -128,11 +141,15 @@ search_unary_expr:
   LPAREN search_expr RPAREN           { $$ = std::move($2); }
   | NOT_OP search_unary_expr          { $$ = AstNegateNode(std::move($2)); }
   | TERM                              { $$ = AstTermNode(std::move($1)); }
+  | PREFIX                            { $$ = AstTermNode(std::move($1), AstTermNode::PREFIX); }
+  | SUFFIX                            { $$ = AstTermNode(std::move($1), AstTermNode::SUFFIX); }
   | UINT32                            { $$ = AstTermNode(to_string($1)); }
   | FIELD COLON field_cond            { $$ = AstFieldNode(std::move($1), std::move($3)); }
 
 field_cond:
   TERM                                                  { $$ = AstTermNode(std::move($1)); }
+  | PREFIX                                              { $$ = AstTermNode(std::move($1), AstTermNode::PREFIX); }
+  | SUFFIX                                              { $$ = AstTermNode(std::move($1), AstTermNode::SUFFIX); }
   | UINT32                                              { $$ = AstTermNode(to_string($1)); }
   | NOT_OP field_cond                                   { $$ = AstNegateNode(std::move($2)); }
   | LPAREN field_cond_expr RPAREN                       { $$ = std::move($2); }
@@ -141,6 +158,20 @@ field_cond:
 
 numeric_filter_expr:
 opt_lparen generic_number opt_lparen generic_number { $$ = AstRangeNode($2, $1, $4, $3); }
+  | opt_lparen generic_number opt_lparen generic_number generic_number TERM
+    {
+      double meters = GeoUnitToMeters($6);
+      if ($1 || $3 || meters == 0)
+        throw syntax_error(@$, "invalid geo radius filter");
+      $$ = AstGeoNode{$2, $4, $5 * meters};
+    }
+  | TERM generic_number generic_number generic_number generic_number TERM
+    {
+      double meters = GeoUnitToMeters($6);
+      if (!absl::EqualsIgnoreCase($1, "BOX") || meters == 0)
+        throw syntax_error(@$, "invalid geo box filter");
+      $$ = AstGeoNode{$2, $3, 0, $4 * meters, $5 * meters};
+    }
 
 generic_number:
   DOUBLE { $$ = $1; }
@@ -167,6 +198,8 @@ field_unary_expr:
   LPAREN field_cond_expr RPAREN                  { $$ = std::move($2); }
   | NOT_OP field_unary_expr                      { $$ = AstNegateNode(std::move($2)); };
   | TERM                                         { $$ = AstTermNode(std::move($1)); }
+  | PREFIX                                       { $$ = AstTermNode(std::move($1), AstTermNode::PREFIX); }
+  | SUFFIX                                       { $$ = AstTermNode(std::move($1), AstTermNode::SUFFIX); }
   | UINT32                                       { $$ = AstTermNode(to_string($1)); }
 
 tag_list:
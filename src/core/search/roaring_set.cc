@@ -0,0 +1,608 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/search/roaring_set.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace dfly::search {
+
+using namespace std;
+
+namespace {
+
+using Container = RoaringSet::Container;
+using Type = RoaringSet::Type;
+
+// Arrays larger than that take more space than bitmaps
+constexpr uint32_t kArrayMax = 4096;
+constexpr size_t kBitmapWords = 65536 / 64;
+constexpr uint32_t kNoBit = 65536;
+
+bool TestBit(const uint64_t* words, uint32_t bit) {
+  return (words[bit / 64] >> (bit % 64)) & 1;
+}
+
+void SetBit(uint64_t* words, uint32_t bit) {
+  words[bit / 64] |= uint64_t(1) << (bit % 64);
+}
+
+void ClearBit(uint64_t* words, uint32_t bit) {
+  words[bit / 64] &= ~(uint64_t(1) << (bit % 64));
+}
+
+// Position of the first set bit not less than from or kNoBit
+uint32_t NextBit(const uint64_t* words, uint32_t from) {
+  if (from >= kNoBit)
+    return kNoBit;
+
+  size_t i = from / 64;
+  uint64_t word = words[i] & (~uint64_t(0) << (from % 64));
+  while (word == 0) {
+    if (++i == kBitmapWords)
+      return kNoBit;
+    word = words[i];
+  }
+  return i * 64 + __builtin_ctzll(word);
+}
+
+// Computes out = a op b over whole bitmaps and returns the number of set bits of out
+enum class BitOp { kAnd, kOr, kAndNot };
+
+template <BitOp op> uint64_t Apply(uint64_t a, uint64_t b) {
+  if constexpr (op == BitOp::kAnd)
+    return a & b;
+  else if constexpr (op == BitOp::kOr)
+    return a | b;
+  else
+    return a & ~b;
+}
+
+template <BitOp op> uint32_t WordsScalar(const uint64_t* a, const uint64_t* b, uint64_t* out) {
+  uint32_t count = 0;
+  for (size_t i = 0; i < kBitmapWords; i++) {
+    out[i] = Apply<op>(a[i], b[i]);
+    count += __builtin_popcountll(out[i]);
+  }
+  return count;
+}
+
+#if defined(__x86_64__)
+
+template <BitOp op>
+__attribute__((target("avx2,popcnt"))) uint32_t WordsAvx2(const uint64_t* a, const uint64_t* b,
+                                                          uint64_t* out) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < kBitmapWords; i += 4) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+    __m256i res;
+    if constexpr (op == BitOp::kAnd)
+      res = _mm256_and_si256(va, vb);
+    else if constexpr (op == BitOp::kOr)
+      res = _mm256_or_si256(va, vb);
+    else
+      res = _mm256_andnot_si256(vb, va);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), res);
+
+    count += _mm_popcnt_u64(out[i]) + _mm_popcnt_u64(out[i + 1]) + _mm_popcnt_u64(out[i + 2]) +
+             _mm_popcnt_u64(out[i + 3]);
+  }
+  return count;
+}
+
+#endif
+
+using WordsFn = uint32_t (*)(const uint64_t* a, const uint64_t* b, uint64_t* out);
+
+struct Kernels {
+  const char* name;
+  WordsFn and_words, or_words, andnot_words;
+};
+
+Kernels SelectKernels() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) {
+    return {"avx2", WordsAvx2<BitOp::kAnd>, WordsAvx2<BitOp::kOr>, WordsAvx2<BitOp::kAndNot>};
+  }
+#endif
+  return {"scalar", WordsScalar<BitOp::kAnd>, WordsScalar<BitOp::kOr>,
+          WordsScalar<BitOp::kAndNot>};
+}
+
+const Kernels kKernels = SelectKernels();
+
+void ToBitmap(Container* c) {
+  c->words.assign(kBitmapWords, 0);
+  if (c->type == Type::ARRAY) {
+    for (uint16_t v : c->values)
+      SetBit(c->words.data(), v);
+  } else if (c->type == Type::RUN) {
+    for (size_t i = 0; i < c->values.size(); i += 2) {
+      for (uint32_t v = c->values[i]; v <= c->values[i + 1]; v++)
+        SetBit(c->words.data(), v);
+    }
+  }
+  c->values.clear();
+  c->values.shrink_to_fit();
+  c->type = Type::BITMAP;
+}
+
+void ToArray(Container* c) {
+  PMR_NS::vector<uint16_t> values{c->values.get_allocator()};
+  values.reserve(c->cardinality);
+  if (c->type == Type::BITMAP) {
+    for (uint32_t v = NextBit(c->words.data(), 0); v != kNoBit; v = NextBit(c->words.data(), v + 1))
+      values.push_back(v);
+  } else if (c->type == Type::RUN) {
+    for (size_t i = 0; i < c->values.size(); i += 2) {
+      for (uint32_t v = c->values[i]; v <= c->values[i + 1]; v++)
+        values.push_back(v);
+    }
+  } else {
+    return;
+  }
+  c->values = std::move(values);
+  c->words.clear();
+  c->words.shrink_to_fit();
+  c->type = Type::ARRAY;
+}
+
+// Runs are converted back to arrays or bitmaps before they are modified
+void ToPlain(Container* c) {
+  if (c->type != Type::RUN)
+    return;
+  if (c->cardinality > kArrayMax)
+    ToBitmap(c);
+  else
+    ToArray(c);
+}
+
+size_t CountRuns(const Container& c) {
+  size_t runs = 0;
+  if (c.type == Type::ARRAY) {
+    for (size_t i = 0; i < c.values.size(); i++)
+      runs += i == 0 || c.values[i] != c.values[i - 1] + 1;
+  } else if (c.type == Type::BITMAP) {
+    // A run starts at every set bit whose predecessor is not set
+    uint64_t carry = 0;
+    for (uint64_t word : c.words) {
+      runs += __builtin_popcountll(word & ~((word << 1) | carry));
+      carry = word >> 63;
+    }
+  } else {
+    runs = c.values.size() / 2;
+  }
+  return runs;
+}
+
+void ToRuns(Container* c) {
+  PMR_NS::vector<uint16_t> runs{c->values.get_allocator()};
+  auto push = [&runs](uint32_t v) {
+    if (!runs.empty() && runs.back() + 1u == v)
+      runs.back() = v;
+    else
+      runs.insert(runs.end(), {uint16_t(v), uint16_t(v)});
+  };
+
+  if (c->type == Type::ARRAY) {
+    for (uint16_t v : c->values)
+      push(v);
+  } else if (c->type == Type::BITMAP) {
+    for (uint32_t v = NextBit(c->words.data(), 0); v != kNoBit; v = NextBit(c->words.data(), v + 1))
+      push(v);
+  } else {
+    return;
+  }
+
+  c->values = std::move(runs);
+  c->words.clear();
+  c->words.shrink_to_fit();
+  c->type = Type::RUN;
+}
+
+// Returns c if it's not a run, otherwise a converted copy stored in tmp
+const Container& Plain(const Container& c, Container* tmp) {
+  if (c.type != Type::RUN)
+    return c;
+  tmp->key = c.key;
+  tmp->type = c.type;
+  tmp->cardinality = c.cardinality;
+  tmp->values.assign(c.values.begin(), c.values.end());
+  ToPlain(tmp);
+  return *tmp;
+}
+
+Container Copy(const Container& c, PMR_NS::memory_resource* mr) {
+  Container out{c.key, mr};
+  out.type = c.type;
+  out.cardinality = c.cardinality;
+  out.values.assign(c.values.begin(), c.values.end());
+  out.words.assign(c.words.begin(), c.words.end());
+  return out;
+}
+
+// Shrinks bitmaps with few values to arrays
+void Normalize(Container* c) {
+  if (c->type == Type::BITMAP && c->cardinality <= kArrayMax)
+    ToArray(c);
+  else if (c->type == Type::ARRAY && c->cardinality > kArrayMax)
+    ToBitmap(c);
+}
+
+// Containers of set operations, arguments are never runs
+Container AndContainers(const Container& a, const Container& b, PMR_NS::memory_resource* mr) {
+  Container out{a.key, mr};
+  if (a.type == Type::BITMAP && b.type == Type::BITMAP) {
+    out.type = Type::BITMAP;
+    out.words.resize(kBitmapWords);
+    out.cardinality = kKernels.and_words(a.words.data(), b.words.data(), out.words.data());
+  } else if (a.type == Type::ARRAY && b.type == Type::ARRAY) {
+    set_intersection(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+                     back_inserter(out.values));
+  } else {
+    const Container& array = a.type == Type::ARRAY ? a : b;
+    const Container& bitmap = a.type == Type::ARRAY ? b : a;
+    for (uint16_t v : array.values) {
+      if (TestBit(bitmap.words.data(), v))
+        out.values.push_back(v);
+    }
+  }
+
+  if (out.type == Type::ARRAY)
+    out.cardinality = out.values.size();
+  Normalize(&out);
+  return out;
+}
+
+Container OrContainers(const Container& a, const Container& b, PMR_NS::memory_resource* mr) {
+  Container out{a.key, mr};
+  if (a.type == Type::BITMAP && b.type == Type::BITMAP) {
+    out.type = Type::BITMAP;
+    out.words.resize(kBitmapWords);
+    out.cardinality = kKernels.or_words(a.words.data(), b.words.data(), out.words.data());
+  } else if (a.type == Type::ARRAY && b.type == Type::ARRAY) {
+    set_union(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+              back_inserter(out.values));
+    out.cardinality = out.values.size();
+  } else {
+    const Container& array = a.type == Type::ARRAY ? a : b;
+    const Container& bitmap = a.type == Type::ARRAY ? b : a;
+    out = Copy(bitmap, mr);
+    out.key = a.key;
+    for (uint16_t v : array.values) {
+      if (!TestBit(out.words.data(), v)) {
+        SetBit(out.words.data(), v);
+        out.cardinality++;
+      }
+    }
+  }
+
+  Normalize(&out);
+  return out;
+}
+
+Container AndNotContainers(const Container& a, const Container& b, PMR_NS::memory_resource* mr) {
+  Container out{a.key, mr};
+  if (a.type == Type::BITMAP && b.type == Type::BITMAP) {
+    out.type = Type::BITMAP;
+    out.words.resize(kBitmapWords);
+    out.cardinality = kKernels.andnot_words(a.words.data(), b.words.data(), out.words.data());
+  } else if (a.type == Type::ARRAY && b.type == Type::ARRAY) {
+    set_difference(a.values.begin(), a.values.end(), b.values.begin(), b.values.end(),
+                   back_inserter(out.values));
+    out.cardinality = out.values.size();
+  } else if (a.type == Type::ARRAY) {
+    for (uint16_t v : a.values) {
+      if (!TestBit(b.words.data(), v))
+        out.values.push_back(v);
+    }
+    out.cardinality = out.values.size();
+  } else {
+    out = Copy(a, mr);
+    for (uint16_t v : b.values) {
+      if (TestBit(out.words.data(), v)) {
+        ClearBit(out.words.data(), v);
+        out.cardinality--;
+      }
+    }
+  }
+
+  Normalize(&out);
+  return out;
+}
+
+}  // namespace
+
+RoaringSet::Container::Container(uint16_t key, PMR_NS::memory_resource* mr)
+    : key{key}, values{mr}, words{mr} {
+}
+
+RoaringSet::ConstIterator::ConstIterator(const Container* container, const Container* end)
+    : container_{container}, end_{end} {
+  SeekContainer();
+}
+
+void RoaringSet::ConstIterator::SeekContainer() {
+  pos_ = 0;
+  if (container_ == end_) {
+    key_ = low_ = 0;
+    return;
+  }
+
+  key_ = container_->key;
+  if (container_->type == Type::BITMAP)
+    low_ = NextBit(container_->words.data(), 0);
+  else
+    low_ = container_->values[0];  // first value of array or run
+}
+
+RoaringSet::ConstIterator& RoaringSet::ConstIterator::operator++() {
+  const Container& c = *container_;
+  switch (c.type) {
+    case Type::ARRAY:
+      if (++pos_ < c.values.size()) {
+        low_ = c.values[pos_];
+        return *this;
+      }
+      break;
+    case Type::BITMAP:
+      if (uint32_t next = NextBit(c.words.data(), low_ + 1u); next != kNoBit) {
+        low_ = next;
+        return *this;
+      }
+      break;
+    case Type::RUN:
+      if (low_ < c.values[pos_ * 2 + 1]) {
+        low_++;
+        return *this;
+      }
+      if (++pos_ * 2 < c.values.size()) {
+        low_ = c.values[pos_ * 2];
+        return *this;
+      }
+      break;
+  }
+
+  ++container_;
+  SeekContainer();
+  return *this;
+}
+
+RoaringSet::RoaringSet(PMR_NS::memory_resource* mr) : containers_{mr} {
+}
+
+PMR_NS::vector<RoaringSet::Container>::iterator RoaringSet::LowerBound(uint16_t key) {
+  return lower_bound(containers_.begin(), containers_.end(), key,
+                     [](const Container& c, uint16_t key) { return c.key < key; });
+}
+
+PMR_NS::vector<RoaringSet::Container>::const_iterator RoaringSet::LowerBound(uint16_t key) const {
+  return lower_bound(containers_.begin(), containers_.end(), key,
+                     [](const Container& c, uint16_t key) { return c.key < key; });
+}
+
+bool RoaringSet::Insert(IntType value) {
+  uint16_t key = value >> 16, low = value & 0xFFFF;
+  auto it = LowerBound(key);
+  if (it == containers_.end() || it->key != key)
+    it = containers_.insert(it, Container{key, containers_.get_allocator().resource()});
+
+  Container& c = *it;
+  ToPlain(&c);
+
+  if (c.type == Type::BITMAP) {
+    if (TestBit(c.words.data(), low))
+      return false;
+    SetBit(c.words.data(), low);
+  } else {
+    auto pos = lower_bound(c.values.begin(), c.values.end(), low);
+    if (pos != c.values.end() && *pos == low)
+      return false;
+
+    if (c.values.size() < kArrayMax) {
+      c.values.insert(pos, low);
+    } else {
+      ToBitmap(&c);
+      SetBit(c.words.data(), low);
+    }
+  }
+
+  c.cardinality++;
+  size_++;
+  return true;
+}
+
+bool RoaringSet::Remove(IntType value) {
+  uint16_t key = value >> 16, low = value & 0xFFFF;
+  auto it = LowerBound(key);
+  if (it == containers_.end() || it->key != key || !Contains(value))
+    return false;
+
+  Container& c = *it;
+  ToPlain(&c);
+
+  if (c.type == Type::BITMAP) {
+    ClearBit(c.words.data(), low);
+  } else {
+    c.values.erase(lower_bound(c.values.begin(), c.values.end(), low));
+  }
+
+  c.cardinality--;
+  size_--;
+
+  // Shrink bitmaps only with a margin, so that values around the limit don't convert every time
+  if (c.cardinality == 0)
+    containers_.erase(it);
+  else if (c.type == Type::BITMAP && c.cardinality < kArrayMax / 2)
+    ToArray(&c);
+  return true;
+}
+
+bool RoaringSet::Contains(IntType value) const {
+  uint16_t key = value >> 16, low = value & 0xFFFF;
+  auto it = LowerBound(key);
+  if (it == containers_.end() || it->key != key)
+    return false;
+
+  switch (it->type) {
+    case Type::ARRAY:
+      return binary_search(it->values.begin(), it->values.end(), low);
+    case Type::BITMAP:
+      return TestBit(it->words.data(), low);
+    case Type::RUN: {
+      // Find last run that starts not after low
+      size_t lo = 0, hi = it->values.size() / 2;
+      while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (it->values[mid * 2] <= low)
+          lo = mid + 1;
+        else
+          hi = mid;
+      }
+      return lo > 0 && low <= it->values[(lo - 1) * 2 + 1];
+    }
+  }
+  return false;
+}
+
+size_t RoaringSet::ByteSize() const {
+  size_t bytes = containers_.capacity() * sizeof(Container);
+  for (const auto& c : containers_)
+    bytes += c.values.capacity() * sizeof(uint16_t) + c.words.capacity() * sizeof(uint64_t);
+  return bytes;
+}
+
+RoaringSet::ConstIterator RoaringSet::begin() const {
+  return ConstIterator{containers_.data(), containers_.data() + containers_.size()};
+}
+
+RoaringSet::ConstIterator RoaringSet::end() const {
+  const Container* end = containers_.data() + containers_.size();
+  return ConstIterator{end, end};
+}
+
+void RoaringSet::Optimize() {
+  for (auto& c : containers_) {
+    if (c.type == Type::RUN)
+      continue;
+
+    size_t bytes = c.type == Type::ARRAY ? c.cardinality * sizeof(uint16_t) : kBitmapWords * 8;
+    if (CountRuns(c) * 2 * sizeof(uint16_t) < bytes)
+      ToRuns(&c);
+  }
+}
+
+RoaringSet RoaringSet::And(const RoaringSet& l, const RoaringSet& r) {
+  auto* mr = l.containers_.get_allocator().resource();
+  RoaringSet out{mr};
+  Container tmp_l{0, mr}, tmp_r{0, mr};
+
+  auto it_l = l.containers_.begin(), it_r = r.containers_.begin();
+  while (it_l != l.containers_.end() && it_r != r.containers_.end()) {
+    if (it_l->key < it_r->key) {
+      ++it_l;
+    } else if (it_r->key < it_l->key) {
+      ++it_r;
+    } else {
+      Container c = AndContainers(Plain(*it_l, &tmp_l), Plain(*it_r, &tmp_r), mr);
+      if (c.cardinality > 0) {
+        out.size_ += c.cardinality;
+        out.containers_.push_back(std::move(c));
+      }
+      ++it_l;
+      ++it_r;
+    }
+  }
+  return out;
+}
+
+RoaringSet RoaringSet::Or(const RoaringSet& l, const RoaringSet& r) {
+  auto* mr = l.containers_.get_allocator().resource();
+  RoaringSet out{mr};
+  Container tmp_l{0, mr}, tmp_r{0, mr};
+
+  auto it_l = l.containers_.begin(), it_r = r.containers_.begin();
+  while (it_l != l.containers_.end() || it_r != r.containers_.end()) {
+    if (it_r == r.containers_.end() || (it_l != l.containers_.end() && it_l->key < it_r->key)) {
+      out.containers_.push_back(Copy(*it_l++, mr));
+    } else if (it_l == l.containers_.end() || it_r->key < it_l->key) {
+      out.containers_.push_back(Copy(*it_r++, mr));
+    } else {
+      out.containers_.push_back(OrContainers(Plain(*it_l, &tmp_l), Plain(*it_r, &tmp_r), mr));
+      ++it_l;
+      ++it_r;
+    }
+    out.size_ += out.containers_.back().cardinality;
+  }
+  return out;
+}
+
+void RoaringSet::Merge(const RoaringSet& other) {
+  auto* mr = containers_.get_allocator().resource();
+  Container tmp{0, mr};
+
+  auto it = containers_.begin();
+  for (const auto& c_other : other.containers_) {
+    it = lower_bound(it, containers_.end(), c_other.key,
+                     [](const Container& c, uint16_t key) { return c.key < key; });
+    if (it == containers_.end() || it->key != c_other.key) {
+      size_ += c_other.cardinality;
+      it = containers_.insert(it, Copy(c_other, mr)) + 1;
+      continue;
+    }
+
+    Container& c = *it++;
+    size_ -= c.cardinality;
+    ToPlain(&c);
+    const Container& plain_other = Plain(c_other, &tmp);
+
+    if (c.type == Type::BITMAP && plain_other.type == Type::BITMAP) {
+      c.cardinality = kKernels.or_words(c.words.data(), plain_other.words.data(), c.words.data());
+    } else if (c.type == Type::BITMAP) {
+      for (uint16_t v : plain_other.values) {
+        if (!TestBit(c.words.data(), v)) {
+          SetBit(c.words.data(), v);
+          c.cardinality++;
+        }
+      }
+    } else {
+      c = OrContainers(c, plain_other, mr);
+    }
+    size_ += c.cardinality;
+  }
+}
+
+RoaringSet RoaringSet::AndNot(const RoaringSet& l, const RoaringSet& r) {
+  auto* mr = l.containers_.get_allocator().resource();
+  RoaringSet out{mr};
+  Container tmp_l{0, mr}, tmp_r{0, mr};
+
+  auto it_r = r.containers_.begin();
+  for (const auto& c_l : l.containers_) {
+    while (it_r != r.containers_.end() && it_r->key < c_l.key)
+      ++it_r;
+
+    Container c = it_r != r.containers_.end() && it_r->key == c_l.key
+                      ? AndNotContainers(Plain(c_l, &tmp_l), Plain(*it_r, &tmp_r), mr)
+                      : Copy(c_l, mr);
+    if (c.cardinality > 0) {
+      out.size_ += c.cardinality;
+      out.containers_.push_back(std::move(c));
+    }
+  }
+  return out;
+}
+
+const char* RoaringSet::KernelsName() {
+  return kKernels.name;
+}
+
+}  // namespace dfly::search
@@ -0,0 +1,124 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "base/pmr/memory_resource.h"
+#include "core/search/base.h"
+
+namespace dfly::search {
+
+// Sorted set of ids in the style of roaring bitmaps. Ids are split into chunks of 64K by their
+// upper 16 bits. Every chunk has a container for the lower 16 bits in one of three forms:
+// - array of sorted values, used for sparse chunks
+// - bitmap of 65536 bits, used for dense chunks
+// - runs of consecutive values, only created by Optimize()
+// Dense sets take one bit per id and are intersected or unified a word at a time, with AVX2 if
+// available, instead of element by element.
+class RoaringSet {
+ public:
+  using IntType = DocId;
+
+  enum class Type : uint8_t { ARRAY, BITMAP, RUN };
+
+  // Storage of the values of one chunk
+  struct Container {
+    Container(uint16_t key, PMR_NS::memory_resource* mr);
+
+    uint16_t key;
+    Type type = Type::ARRAY;
+    uint32_t cardinality = 0;
+    PMR_NS::vector<uint16_t> values;  // Array values or [first, last] pairs of runs
+    PMR_NS::vector<uint64_t> words;   // Bitmap
+  };
+
+  struct ConstIterator {
+    friend class RoaringSet;
+
+    // To make it work with std container contructors
+    using iterator_category = std::forward_iterator_tag;
+    using difference_type = std::ptrdiff_t;
+    using value_type = IntType;
+    using pointer = IntType*;
+    using reference = IntType&;
+
+    IntType operator*() const {
+      return (IntType(key_) << 16) | low_;
+    }
+
+    ConstIterator& operator++();
+
+    friend bool operator==(const ConstIterator& l, const ConstIterator& r) {
+      return l.container_ == r.container_ && l.low_ == r.low_;
+    }
+
+    friend bool operator!=(const ConstIterator& l, const ConstIterator& r) {
+      return !(l == r);
+    }
+
+   private:
+    ConstIterator(const Container* container, const Container* end);
+
+    // Position at the first value of container_ or at end
+    void SeekContainer();
+
+    const Container *container_, *end_;
+    uint32_t pos_ = 0;  // Index of array value or run
+    uint16_t key_ = 0, low_ = 0;
+  };
+
+  using iterator = ConstIterator;
+
+  explicit RoaringSet(PMR_NS::memory_resource* mr);
+
+  // Insert element, returns true if inserted, false if already present.
+  bool Insert(IntType value);
+
+  // Remove element, returns true if removed, false if not found.
+  bool Remove(IntType value);
+
+  bool Contains(IntType value) const;
+
+  size_t Size() const {
+    return size_;
+  }
+
+  size_t size() const {
+    return size_;
+  }
+
+  size_t ByteSize() const;
+
+  ConstIterator begin() const;
+  ConstIterator end() const;
+
+  // Convert containers to runs where it saves memory. Should be called after bulk insertions,
+  // because inserting into or removing from runs converts them back.
+  void Optimize();
+
+  // Add all values of other, updating containers in place
+  void Merge(const RoaringSet& other);
+
+  // Set operations, results are allocated from the memory resource of l
+  static RoaringSet And(const RoaringSet& l, const RoaringSet& r);
+  static RoaringSet Or(const RoaringSet& l, const RoaringSet& r);
+  static RoaringSet AndNot(const RoaringSet& l, const RoaringSet& r);
+
+  // Name of the selected bitmap kernels: avx2 or scalar
+  static const char* KernelsName();
+
+ private:
+  // Find container with given key or the position where it should be inserted
+  PMR_NS::vector<Container>::iterator LowerBound(uint16_t key);
+  PMR_NS::vector<Container>::const_iterator LowerBound(uint16_t key) const;
+
+  PMR_NS::vector<Container> containers_;
+  size_t size_ = 0;
+};
+
+}  // namespace dfly::search
@@ -0,0 +1,134 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/search/roaring_set.h"
+
+#include <gmock/gmock.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <set>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly::search {
+
+using namespace std;
+
+class RoaringSetTest : public testing::Test {
+ protected:
+  static RoaringSet Make(const set<DocId>& values) {
+    RoaringSet out{PMR_NS::get_default_resource()};
+    for (DocId v : values)
+      out.Insert(v);
+    return out;
+  }
+
+  // Sparse values, dense values that turn into bitmaps and long runs over several chunks
+  static set<DocId> RandomValues(unsigned seed) {
+    srand(seed);
+    set<DocId> out;
+    for (size_t i = 0; i < 3'000; i++)
+      out.insert(rand() % 1'000'000);
+    for (size_t i = 0; i < 20'000; i++)
+      out.insert(rand() % 30'000);
+    for (DocId v = 100'000 + seed * 1'000; v < 250'000; v++)
+      out.insert(v);
+    return out;
+  }
+
+  static vector<DocId> ToVector(const RoaringSet& set) {
+    return {set.begin(), set.end()};
+  }
+};
+
+TEST_F(RoaringSetTest, InsertRemove) {
+  RoaringSet set{PMR_NS::get_default_resource()};
+  std::set<DocId> set_copy;
+  EXPECT_FALSE(set.Contains(0));
+
+  for (size_t i = 0; i < 50'000; i++) {
+    DocId v = rand() % 200'000;
+    if (rand() % 3 == 0)
+      EXPECT_EQ(set.Remove(v), set_copy.erase(v) > 0);
+    else
+      EXPECT_EQ(set.Insert(v), set_copy.insert(v).second);
+  }
+
+  EXPECT_EQ(set.Size(), set_copy.size());
+  EXPECT_THAT(ToVector(set), testing::ElementsAreArray(set_copy));
+
+  for (DocId v = 0; v < 200'000; v++)
+    ASSERT_EQ(set.Contains(v), set_copy.count(v) > 0) << v;
+
+  for (DocId v : set_copy)
+    EXPECT_TRUE(set.Remove(v));
+  EXPECT_EQ(set.Size(), 0u);
+  EXPECT_EQ(set.begin(), set.end());
+}
+
+TEST_F(RoaringSetTest, SetOperations) {
+  set<DocId> l = RandomValues(1), r = RandomValues(2);
+  RoaringSet rl = Make(l), rr = Make(r);
+
+  for (bool optimized : {false, true}) {
+    vector<DocId> expected;
+    set_intersection(l.begin(), l.end(), r.begin(), r.end(), back_inserter(expected));
+    EXPECT_EQ(ToVector(RoaringSet::And(rl, rr)), expected) << optimized;
+    EXPECT_EQ(RoaringSet::And(rl, rr).Size(), expected.size());
+
+    expected.clear();
+    set_union(l.begin(), l.end(), r.begin(), r.end(), back_inserter(expected));
+    EXPECT_EQ(ToVector(RoaringSet::Or(rl, rr)), expected) << optimized;
+    EXPECT_EQ(RoaringSet::Or(rl, rr).Size(), expected.size());
+
+    expected.clear();
+    set_difference(l.begin(), l.end(), r.begin(), r.end(), back_inserter(expected));
+    EXPECT_EQ(ToVector(RoaringSet::AndNot(rl, rr)), expected) << optimized;
+    EXPECT_EQ(RoaringSet::AndNot(rl, rr).Size(), expected.size());
+
+    rl.Optimize();
+    rr.Optimize();
+  }
+}
+
+TEST_F(RoaringSetTest, Optimize) {
+  set<DocId> values = RandomValues(3);
+  RoaringSet set = Make(values);
+
+  size_t bytes = set.ByteSize();
+  set.Optimize();
+  EXPECT_LT(set.ByteSize(), bytes);
+  EXPECT_THAT(ToVector(set), testing::ElementsAreArray(values));
+
+  for (DocId v = 0; v < 300'000; v += 7)
+    ASSERT_EQ(set.Contains(v), values.count(v) > 0) << v;
+
+  // Runs are converted back on modification
+  for (DocId v = 150'000; v < 160'000; v += 2) {
+    EXPECT_TRUE(set.Remove(v));
+    values.erase(v);
+  }
+  EXPECT_TRUE(set.Insert(1'500'000));
+  values.insert(1'500'000);
+  EXPECT_THAT(ToVector(set), testing::ElementsAreArray(values));
+}
+
+static void BM_AndDense(benchmark::State& state) {
+  RoaringSet l{PMR_NS::get_default_resource()}, r{PMR_NS::get_default_resource()};
+  for (DocId v = 0; v < 1'000'000; v++) {
+    if (v % 2 == 0)
+      l.Insert(v);
+    if (v % 3 == 0)
+      r.Insert(v);
+  }
+
+  while (state.KeepRunning())
+    benchmark::DoNotOptimize(RoaringSet::And(l, r).Size());
+}
+
+BENCHMARK(BM_AndDense);
+
+}  // namespace dfly::search
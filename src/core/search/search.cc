@@ -10,6 +10,7 @@
 #include <absl/strings/str_join.h>
 
 #include <chrono>
+#include <cmath>
 #include <type_traits>
 #include <variant>
 
@@ -19,6 +20,7 @@
 #include "core/search/compressed_sorted_set.h"
 #include "core/search/indices.h"
 #include "core/search/query_driver.h"
+#include "core/search/roaring_set.h"
 #include "core/search/sort_indices.h"
 #include "core/search/vector_utils.h"
 
@@ -37,6 +39,10 @@ AstExpr ParseQuery(std::string_view query, const QueryParams* params) {
   return driver.Take();
 }
 
+GeoIndex::Area ToGeoArea(const AstGeoNode& node) {
+  return {node.lon, node.lat, node.radius, node.width, node.height};
+}
+
 // GCC 12 yields a wrong warning in a deeply inlined call in UnifyResults, only ignoring the whole
 // scope solves it
 #ifndef __clang__
@@ -48,7 +54,7 @@ AstExpr ParseQuery(std::string_view query, const QueryParams* params) {
 struct IndexResult {
   using DocVec = vector<DocId>;
   using BorrowedView =
-      variant<const DocVec*, const BlockList<CompressedSortedSet>*, const BlockList<SortedVector>*>;
+      variant<const DocVec*, const BlockList<CompressedSortedSet>*, const RoaringSet*>;
 
   IndexResult() : value_{DocVec{}} {
   }
@@ -56,6 +62,9 @@ struct IndexResult {
   IndexResult(DocVec&& dv) : value_{std::move(dv)} {
   }
 
+  IndexResult(RoaringSet&& set) : value_{std::move(set)} {
+  }
+
   template <typename C> IndexResult(const C* container = nullptr) : value_{container} {
     if (container == nullptr)
       value_ = DocVec{};
@@ -108,8 +117,8 @@ struct IndexResult {
   }
 
  private:
-  variant<DocVec /*owned*/, const DocVec*, const BlockList<CompressedSortedSet>*,
-          const BlockList<SortedVector>*>
+  variant<DocVec /*owned*/, RoaringSet /*owned*/, const DocVec*,
+          const BlockList<CompressedSortedSet>*, const RoaringSet*>
       value_;
 };
 
@@ -117,8 +126,17 @@ struct ProfileBuilder {
   string GetNodeInfo(const AstNode& node) {
     Overloaded node_info{
         [](monostate) -> string { return ""s; },
-        [](const AstTermNode& n) { return absl::StrCat("Term{", n.term, "}"); },
+        [](const AstTermNode& n) {
+          auto prefix = n.match == AstTermNode::SUFFIX ? "*" : "";
+          auto suffix = n.match == AstTermNode::PREFIX ? "*" : "";
+          return absl::StrCat("Term{", prefix, n.term, suffix, "}");
+        },
         [](const AstRangeNode& n) { return absl::StrCat("Range{", n.lo, "<>", n.hi, "}"); },
+        [](const AstGeoNode& n) {
+          if (n.radius > 0)
+            return absl::StrCat("Geo{", n.lon, ",", n.lat, ",r=", n.radius, "}");
+          return absl::StrCat("Geo{", n.lon, ",", n.lat, ",", n.width, "x", n.height, "}");
+        },
         [](const AstLogicalNode& n) {
           auto op = n.op == AstLogicalNode::AND ? "and" : "or";
           return absl::StrCat("Logical{n=", n.nodes.size(), ",o=", op, "}");
@@ -140,12 +158,15 @@ struct ProfileBuilder {
     return chrono::steady_clock::now();
   }
 
-  void Finish(Tp start, const AstNode& node, const IndexResult& result) {
+  // Note is appended to the node description, used for query plans
+  void Finish(Tp start, const AstNode& node, size_t num_processed, string_view note = {}) {
     DCHECK_GE(depth_, 1u);
     auto took = chrono::steady_clock::now() - start;
     size_t micros = chrono::duration_cast<chrono::microseconds>(took).count();
     auto descr = GetNodeInfo(node);
-    profile_.events.push_back({std::move(descr), micros, depth_ - 1, result.Size()});
+    if (!note.empty())
+      absl::StrAppend(&descr, " ", note);
+    profile_.events.push_back({std::move(descr), micros, depth_ - 1, num_processed});
     depth_--;
   }
 
@@ -162,6 +183,11 @@ struct ProfileBuilder {
 struct BasicSearch {
   using LogicOp = AstLogicalNode::LogicOp;
 
+  // Children of intersections are probed instead of searched if they are estimated to be at least
+  // that many times larger than the current result. Probing costs an index lookup per candidate,
+  // while searching passes over all matches of the child.
+  constexpr static size_t kProbeRatio = 16;
+
   BasicSearch(const FieldIndices* indices, size_t limit)
       : indices_{indices}, limit_{limit}, tmp_vec_{} {
   }
@@ -170,6 +196,10 @@ struct BasicSearch {
     profile_builder_ = ProfileBuilder{};
   }
 
+  void EnableScoring() {
+    scoring_enabled_ = true;
+  }
+
   // Get casted sub index by field
   template <typename T> T* GetIndex(string_view field) {
     static_assert(is_base_of_v<BaseIndex, T>);
@@ -212,6 +242,16 @@ struct BasicSearch {
     IndexResult& current = *current_ptr;
     tmp_vec_.clear();
 
+    // Roaring sets are merged container by container instead of element by element
+    auto matched_view = matched.Borrowed(), current_view = current.Borrowed();
+    auto *matched_set = get_if<const RoaringSet*>(&matched_view),
+         *current_set = get_if<const RoaringSet*>(&current_view);
+    if (matched_set && current_set) {
+      current = op == LogicOp::AND ? RoaringSet::And(**matched_set, **current_set)
+                                   : RoaringSet::Or(**matched_set, **current_set);
+      return;
+    }
+
     if (op == LogicOp::AND) {
       tmp_vec_.reserve(min(matched.Size(), current.Size()));
       auto cb = [this](auto* s1, auto* s2) {
@@ -255,18 +295,36 @@ struct BasicSearch {
     return {&indices_->GetAllDocs()};
   }
 
-  // "term": access field's text index or unify results from all text indices if no field is set
-  IndexResult Search(const AstTermNode& node, string_view active_field) {
-    if (!active_field.empty()) {
-      if (auto* index = GetIndex<TextIndex>(active_field); index)
-        return index->Matching(node.term);
-      return IndexResult{};
-    }
+  // Postings of all terms matched by node with their indices: the field's text index or all text
+  // indices if no field is set. Prefixes and suffixes can match multiple terms per index
+  vector<pair<const TextIndex*, const TextIndex::Container*>> MatchingTerms(
+      const AstTermNode& node, string_view active_field) {
+    vector<TextIndex*> selected_indices;
+    if (active_field.empty())
+      selected_indices = indices_->GetAllTextIndices();
+    else if (auto* index = GetIndex<TextIndex>(active_field); index)
+      selected_indices.push_back(index);
+
+    vector<pair<const TextIndex*, const TextIndex::Container*>> out;
+    for (const TextIndex* index : selected_indices) {
+      if (node.match == AstTermNode::EXACT) {
+        if (auto* postings = index->Matching(node.term); postings)
+          out.emplace_back(index, postings);
+        continue;
+      }
 
-    vector<TextIndex*> selected_indices = indices_->GetAllTextIndices();
-    auto mapping = [&node](TextIndex* index) { return index->Matching(node.term); };
+      auto matched = node.match == AstTermNode::PREFIX ? index->MatchingPrefix(node.term)
+                                                       : index->MatchingSuffix(node.term);
+      for (auto* postings : matched)
+        out.emplace_back(index, postings);
+    }
+    return out;
+  }
 
-    return UnifyResults(GetSubResults(selected_indices, mapping), LogicOp::OR);
+  // "term", "prefix*" or "*suffix": unify results of all matched terms
+  IndexResult Search(const AstTermNode& node, string_view active_field) {
+    auto mapping = [](const auto& entry) { return IndexResult{entry.second}; };
+    return UnifyResults(GetSubResults(MatchingTerms(node, active_field), mapping), LogicOp::OR);
   }
 
   // [range]: access field's numeric index
@@ -277,6 +335,14 @@ struct BasicSearch {
     return IndexResult{};
   }
 
+  // [lon lat radius unit] or [BOX lon lat width height unit]: access field's geo index
+  IndexResult Search(const AstGeoNode& node, string_view active_field) {
+    DCHECK(!active_field.empty());
+    if (auto* index = GetIndex<GeoIndex>(active_field); index)
+      return index->Within(ToGeoArea(node));
+    return IndexResult{};
+  }
+
   // negate -(*subquery*): explicitly compute result complement. Needs further optimizations
   IndexResult Search(const AstNegateNode& node, string_view active_field) {
     vector<DocId> matched = SearchGeneric(*node.node, active_field).Take();
@@ -291,10 +357,229 @@ struct BasicSearch {
     return all;
   }
 
-  // logical query: unify all sub results
+  // logical query: unify all sub results. Intersections are planned from the estimated sizes of
+  // their children: the smallest one is searched and the others only narrow down its results
   IndexResult Search(const AstLogicalNode& node, string_view active_field) {
-    auto mapping = [&](auto& node) { return SearchGeneric(node, active_field); };
-    return UnifyResults(GetSubResults(node.nodes, mapping), node.op);
+    if (node.op == LogicOp::OR) {
+      auto mapping = [&](auto& node) { return SearchGeneric(node, active_field); };
+      return UnifyResults(GetSubResults(node.nodes, mapping), node.op);
+    }
+
+    if (node.nodes.empty())
+      return vector<DocId>{};
+
+    size_t num_docs = indices_->GetAllDocs().size();
+    vector<pair<size_t, const AstNode*>> plan;
+    for (const auto& child : node.nodes)
+      plan.emplace_back(Estimate(child, active_field, num_docs), &child);
+    stable_sort(plan.begin(), plan.end(),
+                [](const auto& l, const auto& r) { return l.first < r.first; });
+
+    string plan_info;
+    if (profile_builder_)
+      plan_info = absl::StrCat("plan=search:", plan[0].first);
+
+    IndexResult out = SearchGeneric(*plan[0].second, active_field);
+    for (auto [estimate, child] : absl::MakeSpan(plan).subspan(1)) {
+      bool probe = out.Size() * kProbeRatio <= estimate;
+      if (profile_builder_)
+        absl::StrAppend(&plan_info, probe ? ",probe:" : ",merge:", estimate);
+
+      if (!probe) {
+        Merge(SearchGeneric(*child, active_field), &out, LogicOp::AND);
+        continue;
+      }
+
+      auto start = profile_builder_ ? profile_builder_->Start() : ProfileBuilder::Tp{};
+      vector<DocId> docs = out.Take();
+      Filter(*child, active_field, &docs);
+      if (profile_builder_)
+        profile_builder_->Finish(start, *child, docs.size(), "probed");
+      out = std::move(docs);
+    }
+
+    plan_info_ = std::move(plan_info);
+    return out;
+  }
+
+  // Upper bound of documents matched by node, exact for terms of a single field and single tags.
+  // Counting stops at limit, which is enough to order the children of an intersection.
+  size_t Estimate(const AstNode& node, string_view active_field, size_t limit) {
+    auto cb = [&](const auto& inner) { return Estimate(inner, active_field, limit); };
+    return min(visit(cb, node.Variant()), limit);
+  }
+
+  size_t Estimate(monostate, string_view, size_t) {
+    return 0;
+  }
+
+  size_t Estimate(const AstTermNode& node, string_view active_field, size_t) {
+    size_t sum = 0;
+    for (auto [_, postings] : MatchingTerms(node, active_field))
+      sum += postings->Size();
+    return sum;
+  }
+
+  size_t Estimate(const AstRangeNode& node, string_view active_field, size_t limit) {
+    auto* index = GetIndex<NumericIndex>(active_field);
+    return index ? index->Count(node.lo, node.hi, limit) : 0;
+  }
+
+  size_t Estimate(const AstGeoNode& node, string_view active_field, size_t limit) {
+    auto* index = GetIndex<GeoIndex>(active_field);
+    return index ? index->Count(ToGeoArea(node), limit) : 0;
+  }
+
+  size_t Estimate(const AstTagsNode& node, string_view active_field, size_t) {
+    auto* index = GetIndex<TagIndex>(active_field);
+    if (!index)
+      return 0;
+
+    size_t sum = 0;
+    for (const auto& tag : node.tags) {
+      if (auto* container = index->Matching(tag); container)
+        sum += container->Size();
+    }
+    return sum;
+  }
+
+  size_t Estimate(const AstLogicalNode& node, string_view active_field, size_t limit) {
+    if (node.op == LogicOp::AND) {
+      for (const auto& child : node.nodes)
+        limit = Estimate(child, active_field, limit);
+      return limit;
+    }
+
+    size_t sum = 0;
+    for (const auto& child : node.nodes)
+      sum += Estimate(child, active_field, limit);
+    return sum;
+  }
+
+  size_t Estimate(const AstFieldNode& node, string_view, size_t limit) {
+    return Estimate(*node.node, node.field, limit);
+  }
+
+  // Stars, negations and other nodes can match all documents
+  template <typename T> size_t Estimate(const T&, string_view, size_t) {
+    return indices_->GetAllDocs().size();
+  }
+
+  // Keep only the sorted docs matched by node. Indices are probed for every doc, so the results
+  // of node are never materialized.
+  void Filter(const AstNode& node, string_view active_field, vector<DocId>* docs) {
+    if (docs->empty() || !error_.empty())
+      return;
+
+    // Knn and sort nodes are only top level, but fall back to searching them to be safe
+    if (holds_alternative<AstKnnNode>(node.Variant()) ||
+        holds_alternative<AstSortNode>(node.Variant())) {
+      IndexResult current{std::move(*docs)};
+      Merge(SearchGeneric(node, active_field), &current, LogicOp::AND);
+      *docs = current.Take();
+      return;
+    }
+
+    auto cb = [&](const auto& inner) { Filter(inner, active_field, docs); };
+    visit(cb, node.Variant());
+  }
+
+  template <typename C>
+  static void KeepContained(const vector<const C*>& sets, vector<DocId>* docs) {
+    auto missing = [&sets](DocId doc) {
+      return none_of(sets.begin(), sets.end(), [doc](const C* set) {
+        return set != nullptr && set->Contains(doc);
+      });
+    };
+    docs->erase(remove_if(docs->begin(), docs->end(), missing), docs->end());
+  }
+
+  void Filter(monostate, string_view, vector<DocId>* docs) {
+    docs->clear();
+  }
+
+  void Filter(const AstStarNode&, string_view, vector<DocId>*) {
+  }
+
+  void Filter(const AstTermNode& node, string_view active_field, vector<DocId>* docs) {
+    vector<const TextIndex::Container*> sets;
+    for (auto [_, postings] : MatchingTerms(node, active_field))
+      sets.push_back(postings);
+    KeepContained(sets, docs);
+  }
+
+  void Filter(const AstRangeNode& node, string_view active_field, vector<DocId>* docs) {
+    if (auto* index = GetIndex<NumericIndex>(active_field); index)
+      index->Filter(node.lo, node.hi, docs);
+    else
+      docs->clear();
+  }
+
+  void Filter(const AstGeoNode& node, string_view active_field, vector<DocId>* docs) {
+    if (auto* index = GetIndex<GeoIndex>(active_field); index)
+      index->Filter(ToGeoArea(node), docs);
+    else
+      docs->clear();
+  }
+
+  void Filter(const AstTagsNode& node, string_view active_field, vector<DocId>* docs) {
+    vector<const TagIndex::Container*> sets;
+    if (auto* index = GetIndex<TagIndex>(active_field); index) {
+      for (const auto& tag : node.tags)
+        sets.push_back(index->Matching(tag));
+    }
+    KeepContained(sets, docs);
+  }
+
+  void Filter(const AstNegateNode& node, string_view active_field, vector<DocId>* docs) {
+    vector<DocId> matched = *docs;
+    Filter(*node.node, active_field, &matched);
+
+    vector<DocId> out;
+    set_difference(docs->begin(), docs->end(), matched.begin(), matched.end(),
+                   back_inserter(out));
+    *docs = std::move(out);
+  }
+
+  void Filter(const AstLogicalNode& node, string_view active_field, vector<DocId>* docs) {
+    if (node.op == LogicOp::AND) {
+      // Most selective children first, so that the others probe fewer docs
+      size_t num_docs = indices_->GetAllDocs().size();
+      vector<pair<size_t, const AstNode*>> plan;
+      for (const auto& child : node.nodes)
+        plan.emplace_back(Estimate(child, active_field, num_docs), &child);
+      stable_sort(plan.begin(), plan.end(),
+                  [](const auto& l, const auto& r) { return l.first < r.first; });
+
+      for (auto [_, child] : plan)
+        Filter(*child, active_field, docs);
+      return;
+    }
+
+    // Every child probes only the docs not matched by previous ones
+    vector<DocId> matched, rest = std::move(*docs);
+    for (const auto& child : node.nodes) {
+      vector<DocId> child_matched = rest, merged;
+      Filter(child, active_field, &child_matched);
+
+      set_union(matched.begin(), matched.end(), child_matched.begin(), child_matched.end(),
+                back_inserter(merged));
+      matched = std::move(merged);
+
+      vector<DocId> unmatched;
+      set_difference(rest.begin(), rest.end(), child_matched.begin(), child_matched.end(),
+                     back_inserter(unmatched));
+      rest = std::move(unmatched);
+    }
+    *docs = std::move(matched);
+  }
+
+  void Filter(const AstFieldNode& node, string_view, vector<DocId>* docs) {
+    Filter(*node.node, node.field, docs);
+  }
+
+  template <typename T> void Filter(const T&, string_view, vector<DocId>*) {
+    LOG(DFATAL) << "Unexpected node type in filter";
   }
 
   // @field: set active field for sub tree
@@ -306,11 +591,23 @@ struct BasicSearch {
 
   // {tags | ...}: Unify results for all tags
   IndexResult Search(const AstTagsNode& node, string_view active_field) {
-    if (auto* tag_index = GetIndex<TagIndex>(active_field); tag_index) {
-      auto mapping = [tag_index](string_view tag) { return tag_index->Matching(tag); };
-      return UnifyResults(GetSubResults(node.tags, mapping), LogicOp::OR);
+    auto* tag_index = GetIndex<TagIndex>(active_field);
+    if (!tag_index)
+      return IndexResult{};
+
+    vector<const RoaringSet*> sets;
+    for (const auto& tag : node.tags) {
+      if (auto* set = tag_index->Matching(tag); set)
+        sets.push_back(set);
     }
-    return IndexResult{};
+
+    if (sets.size() <= 1)
+      return sets.empty() ? IndexResult{} : IndexResult{sets[0]};
+
+    RoaringSet merged = RoaringSet::Or(*sets[0], *sets[1]);
+    for (const RoaringSet* set : absl::MakeSpan(sets).subspan(2))
+      merged.Merge(*set);
+    return IndexResult{std::move(merged)};
   }
 
   // SORTBY field [DESC]: Sort by field. Part of params and not "core query".
@@ -337,11 +634,24 @@ struct BasicSearch {
   void SearchKnnFlat(FlatVectorIndex* vec_index, const AstKnnNode& knn, IndexResult&& sub_results) {
     knn_distances_.reserve(sub_results.Size());
     auto cb = [&](auto* set) {
-      auto [dim, sim] = vec_index->Info();
+      // Distances are computed in batches, so that the kernels can handle several vectors at once
+      constexpr size_t kBatch = 64;
+      DocId docs[kBatch];
+      float dists[kBatch];
+      size_t batch = 0;
+      auto flush = [&] {
+        vec_index->Distances(knn.vec.first.get(), docs, batch, dists);
+        for (size_t i = 0; i < batch; i++)
+          knn_distances_.emplace_back(dists[i], docs[i]);
+        batch = 0;
+      };
+
       for (DocId matched_doc : *set) {
-        float dist = VectorDistance(knn.vec.first.get(), vec_index->Get(matched_doc), dim, sim);
-        knn_distances_.emplace_back(dist, matched_doc);
+        docs[batch] = matched_doc;
+        if (++batch == kBatch)
+          flush();
       }
+      flush();
     };
     visit(cb, sub_results.Borrowed());
 
@@ -408,19 +718,96 @@ struct BasicSearch {
            visit([](auto* set) { return is_sorted(set->begin(), set->end()); }, result.Borrowed()));
 
     if (profile_builder_)
-      profile_builder_->Finish(start, node, result);
+      profile_builder_->Finish(start, node, result.Size(), exchange(plan_info_, {}));
 
     return result;
   }
 
+  // Collect postings of all terms that are not negated, they contribute to the score of a doc
+  void CollectTerms(const AstNode& node, string_view active_field,
+                    vector<pair<const TextIndex*, const TextIndex::Container*>>* out) {
+    Overloaded cb{
+        [&](const AstTermNode& n) {
+          auto matched = MatchingTerms(n, active_field);
+          out->insert(out->end(), matched.begin(), matched.end());
+        },
+        [&](const AstLogicalNode& n) {
+          for (const auto& child : n.nodes)
+            CollectTerms(child, active_field, out);
+        },
+        [&](const AstFieldNode& n) { CollectTerms(*n.node, n.field, out); },
+        [](const auto&) {},
+    };
+    visit(cb, node.Variant());
+  }
+
+  // Order results by their BM25 score and keep the best limit_ of them in a heap
+  IndexResult ScoreBm25(const AstNode& query, IndexResult&& result) {
+    constexpr float kK1 = 1.2, kB = 0.75;
+
+    vector<pair<const TextIndex*, const TextIndex::Container*>> terms;
+    CollectTerms(query, "", &terms);
+
+    auto bm25 = [&terms](DocId doc) {
+      float score = 0;
+      for (auto [index, postings] : terms) {
+        if (!postings->Contains(doc))
+          continue;
+
+        float num_docs = index->NumDocs(), matched = postings->Size();
+        float idf = log(1 + (num_docs - matched + 0.5f) / (matched + 0.5f));
+        float tf = postings->Frequency(doc);
+        float norm = 1 - kB + kB * index->DocLength(doc) / max(index->AverageDocLength(), 1.0);
+        score += idf * tf * (kK1 + 1) / (tf + kK1 * norm);
+      }
+      return score;
+    };
+
+    // Higher scores first, lower ids first for equal scores. The heap keeps the worst on top
+    auto better = [](const pair<float, DocId>& l, const pair<float, DocId>& r) {
+      return l.first > r.first || (l.first == r.first && l.second < r.second);
+    };
+
+    vector<pair<float, DocId>> top;
+    auto cb = [&](auto* set) {
+      for (DocId doc : *set) {
+        pair<float, DocId> scored{bm25(doc), doc};
+        if (top.size() < limit_) {
+          top.push_back(scored);
+          push_heap(top.begin(), top.end(), better);
+        } else if (!top.empty() && better(scored, top.front())) {
+          pop_heap(top.begin(), top.end(), better);
+          top.back() = scored;
+          push_heap(top.begin(), top.end(), better);
+        }
+      }
+    };
+    visit(cb, result.Borrowed());
+    sort_heap(top.begin(), top.end(), better);
+
+    vector<DocId> out(top.size());
+    scores_.clear();
+    scores_.reserve(top.size());
+    for (size_t i = 0; i < top.size(); i++) {
+      out[i] = top[i].second;
+      scores_.emplace_back(top[i].first);
+    }
+    return out;
+  }
+
   SearchResult Search(const AstNode& query) {
     IndexResult result = SearchGeneric(query, "", true);
 
+    // Knn and sort nodes define their own order
+    size_t total = result.Size();
+    if (scoring_enabled_ && !holds_alternative<AstKnnNode>(query.Variant()) &&
+        !holds_alternative<AstSortNode>(query.Variant()))
+      result = ScoreBm25(query, std::move(result));
+
     // Extract profile if enabled
     optional<AlgorithmProfile> profile =
         profile_builder_ ? make_optional(profile_builder_->Take()) : nullopt;
 
-    size_t total = result.Size();
     return SearchResult{total,
                         max(total, preagg_total_),
                         result.Take(limit_),
@@ -433,6 +820,7 @@ struct BasicSearch {
   size_t limit_;
 
   size_t preagg_total_ = 0;
+  bool scoring_enabled_ = false;
   string error_;
   optional<ProfileBuilder> profile_builder_ = ProfileBuilder{};
 
@@ -440,6 +828,7 @@ struct BasicSearch {
 
   vector<DocId> tmp_vec_;
   vector<pair<float, DocId>> knn_distances_;
+  string plan_info_;  // Plan of last searched intersection, added to its profile event
 };
 
 #ifndef __clang__
@@ -454,13 +843,40 @@ string_view Schema::LookupAlias(string_view alias) const {
   return alias;
 }
 
+void* CountingMemoryResource::do_allocate(size_t bytes, size_t alignment) {
+  void* p = upstream_->allocate(bytes, alignment);
+  used_ += bytes;
+  return p;
+}
+
+void CountingMemoryResource::do_deallocate(void* p, size_t bytes, size_t alignment) {
+  DCHECK_GE(used_, bytes);
+  used_ -= bytes;
+  upstream_->deallocate(p, bytes, alignment);
+}
+
+bool CountingMemoryResource::do_is_equal(const PMR_NS::memory_resource& other) const noexcept {
+  return this == &other;
+}
+
 FieldIndices::FieldIndices(Schema schema, PMR_NS::memory_resource* mr)
-    : schema_{std::move(schema)}, all_ids_{}, indices_{} {
-  CreateIndices(mr);
-  CreateSortIndices(mr);
+    : schema_{std::move(schema)},
+      all_ids_{},
+      indices_{},
+      postings_mr_{make_unique<CountingMemoryResource>(mr)},
+      vectors_mr_{make_unique<CountingMemoryResource>(mr)},
+      sort_mr_{make_unique<CountingMemoryResource>(mr)} {
+  CreateIndices();
+  CreateSortIndices();
+}
+
+FieldIndices::~FieldIndices() {
+  indices_.clear();
+  sort_indices_.clear();
 }
 
-void FieldIndices::CreateIndices(PMR_NS::memory_resource* mr) {
+void FieldIndices::CreateIndices() {
+  PMR_NS::memory_resource* mr = postings_mr_.get();
   for (const auto& [field_ident, field_info] : schema_.fields) {
     if ((field_info.flags & SchemaField::NOINDEX) > 0)
       continue;
@@ -472,6 +888,9 @@ void FieldIndices::CreateIndices(PMR_NS::memory_resource* mr) {
       case SchemaField::NUMERIC:
         indices_[field_ident] = make_unique<NumericIndex>(mr);
         break;
+      case SchemaField::GEO:
+        indices_[field_ident] = make_unique<GeoIndex>(mr);
+        break;
       case SchemaField::TAG: {
         const auto& tparams = std::get<SchemaField::TagParams>(field_info.special_params);
         indices_[field_ident] = make_unique<TagIndex>(mr, tparams);
@@ -484,9 +903,9 @@ void FieldIndices::CreateIndices(PMR_NS::memory_resource* mr) {
         const auto& vparams = std::get<SchemaField::VectorParams>(field_info.special_params);
 
         if (vparams.use_hnsw)
-          vector_index = make_unique<HnswVectorIndex>(vparams, mr);
+          vector_index = make_unique<HnswVectorIndex>(vparams, vectors_mr_.get());
         else
-          vector_index = make_unique<FlatVectorIndex>(vparams, mr);
+          vector_index = make_unique<FlatVectorIndex>(vparams, vectors_mr_.get());
 
         indices_[field_ident] = std::move(vector_index);
         break;
@@ -495,7 +914,8 @@ void FieldIndices::CreateIndices(PMR_NS::memory_resource* mr) {
   }
 }
 
-void FieldIndices::CreateSortIndices(PMR_NS::memory_resource* mr) {
+void FieldIndices::CreateSortIndices() {
+  PMR_NS::memory_resource* mr = sort_mr_.get();
   for (const auto& [field_ident, field_info] : schema_.fields) {
     if ((field_info.flags & SchemaField::SORTABLE) == 0)
       continue;
@@ -508,6 +928,7 @@ void FieldIndices::CreateSortIndices(PMR_NS::memory_resource* mr) {
       case SchemaField::NUMERIC:
         sort_indices_[field_ident] = make_unique<NumericSortIndex>(mr);
         break;
+      case SchemaField::GEO:
       case SchemaField::VECTOR:
         break;
     }
@@ -523,6 +944,31 @@ void FieldIndices::Add(DocId doc, DocumentAccessor* access) {
   all_ids_.insert(upper_bound(all_ids_.begin(), all_ids_.end(), doc), doc);
 }
 
+void FieldIndices::AddBatch(absl::Span<const std::pair<DocId, DocumentAccessor*>> docs,
+                            size_t num_threads) {
+  for (auto& [field, index] : indices_) {
+    if (auto* hnsw = dynamic_cast<HnswVectorIndex*>(index.get()); hnsw && num_threads > 1) {
+      hnsw->AddBatch(docs, field, num_threads);
+      continue;
+    }
+    for (auto [doc, access] : docs)
+      index->Add(doc, access, field);
+  }
+
+  for (auto& [field, sort_index] : sort_indices_) {
+    for (auto [doc, access] : docs)
+      sort_index->Add(doc, access, field);
+  }
+
+  for (auto [doc, _] : docs)
+    all_ids_.insert(upper_bound(all_ids_.begin(), all_ids_.end(), doc), doc);
+}
+
+void FieldIndices::Optimize() {
+  for (auto& [_, index] : indices_)
+    index->Optimize();
+}
+
 void FieldIndices::Remove(DocId doc, DocumentAccessor* access) {
   for (auto& [field, index] : indices_)
     index->Remove(doc, access, field);
@@ -572,6 +1018,17 @@ vector<pair<string, SortableValue>> FieldIndices::ExtractStoredValues(DocId doc)
   return out;
 }
 
+FieldIndices::MemoryUsage FieldIndices::GetMemoryUsage() const {
+  MemoryUsage usage{.postings = postings_mr_->used() + all_ids_.capacity() * sizeof(DocId),
+                    .vectors = vectors_mr_->used(),
+                    .sort_indices = sort_mr_->used()};
+
+  // Only vector indices allocate outside of their memory resources
+  for (const auto& [_, index] : indices_)
+    usage.vectors += index->ExternalMemoryUsage();
+  return usage;
+}
+
 SearchAlgorithm::SearchAlgorithm() = default;
 SearchAlgorithm::~SearchAlgorithm() = default;
 
@@ -599,6 +1056,8 @@ SearchResult SearchAlgorithm::Search(const FieldIndices* index, size_t limit) co
   auto bs = BasicSearch{index, limit};
   if (profiling_enabled_)
     bs.EnableProfiling();
+  if (scoring_enabled_)
+    bs.EnableScoring();
   return bs.Search(*query_);
 }
 
@@ -616,6 +1075,9 @@ optional<AggregationInfo> SearchAlgorithm::HasAggregation() const {
     return AggregationInfo{nullopt, alias, sort->descending};
   }
 
+  if (scoring_enabled_)
+    return AggregationInfo{nullopt, "", true};
+
   return nullopt;
 }
 
@@ -623,4 +1085,16 @@ void SearchAlgorithm::EnableProfiling() {
   profiling_enabled_ = true;
 }
 
+bool SearchAlgorithm::IsProfilingEnabled() const {
+  return profiling_enabled_;
+}
+
+string SearchAlgorithm::NormalizedQuery() const {
+  return absl::StrCat(NormalizeAst(*query_), scoring_enabled_ ? " SCORER BM25" : "");
+}
+
+void SearchAlgorithm::EnableScoring() {
+  scoring_enabled_ = true;
+}
+
 }  // namespace dfly::search
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/types/span.h>
 
 #include <functional>
 #include <memory>
@@ -23,7 +24,7 @@ struct TextIndex;
 
 // Describes a specific index field
 struct SchemaField {
-  enum FieldType { TAG, TEXT, NUMERIC, VECTOR };
+  enum FieldType { TAG, TEXT, NUMERIC, VECTOR, GEO };
   enum FieldFlags : uint8_t { NOINDEX = 1 << 0, SORTABLE = 1 << 1 };
 
   struct VectorParams {
@@ -34,6 +35,7 @@ struct SchemaField {
     size_t capacity = 1000;                       // initial capacity
     size_t hnsw_ef_construction = 200;
     size_t hnsw_m = 16;
+    VectorQuantization quantization = VectorQuantization::NONE;
   };
 
   struct TagParams {
@@ -61,15 +63,54 @@ struct Schema {
   std::string_view LookupAlias(std::string_view alias) const;
 };
 
+// Forwards allocations to an upstream resource and counts the bytes in use
+class CountingMemoryResource : public PMR_NS::memory_resource {
+ public:
+  explicit CountingMemoryResource(PMR_NS::memory_resource* upstream) : upstream_{upstream} {
+  }
+
+  size_t used() const {
+    return used_;
+  }
+
+ private:
+  void* do_allocate(size_t bytes, size_t alignment) override;
+  void do_deallocate(void* p, size_t bytes, size_t alignment) override;
+  bool do_is_equal(const PMR_NS::memory_resource& other) const noexcept override;
+
+  PMR_NS::memory_resource* upstream_;
+  size_t used_ = 0;
+};
+
 // Collection of indices for all fields in schema
 class FieldIndices {
  public:
+  // Bytes used by the indices of every kind
+  struct MemoryUsage {
+    size_t postings = 0;  // text, tag and numeric indices and the list of all ids
+    size_t vectors = 0;
+    size_t sort_indices = 0;
+  };
+
   // Create indices based on schema
   FieldIndices(Schema schema, PMR_NS::memory_resource* mr);
 
+  FieldIndices(FieldIndices&&) = default;
+  FieldIndices& operator=(FieldIndices&&) = default;
+
+  // Destroys indices before the memory resources they are allocated from
+  ~FieldIndices();
+
   void Add(DocId doc, DocumentAccessor* access);
   void Remove(DocId doc, DocumentAccessor* access);
 
+  // Add documents in bulk, used for building indices. Hnsw indices insert the whole batch with
+  // num_threads threads, including the calling one.
+  void AddBatch(absl::Span<const std::pair<DocId, DocumentAccessor*>> docs, size_t num_threads);
+
+  // Compact indices after bulk insertions
+  void Optimize();
+
   BaseIndex* GetIndex(std::string_view field) const;
   BaseSortIndex* GetSortIndex(std::string_view field) const;
   std::vector<TextIndex*> GetAllTextIndices() const;
@@ -80,15 +121,21 @@ class FieldIndices {
   // Extract values stored in sort indices
   std::vector<std::pair<std::string, SortableValue>> ExtractStoredValues(DocId doc) const;
 
+  MemoryUsage GetMemoryUsage() const;
+
  private:
-  void CreateIndices(PMR_NS::memory_resource* mr);
-  void CreateSortIndices(PMR_NS::memory_resource* mr);
+  void CreateIndices();
+  void CreateSortIndices();
 
  private:
   Schema schema_;
   std::vector<DocId> all_ids_;
   absl::flat_hash_map<std::string, std::unique_ptr<BaseIndex>> indices_;
   absl::flat_hash_map<std::string, std::unique_ptr<BaseSortIndex>> sort_indices_;
+
+  // Count allocations of every kind of index. Declared after the indices, so that move assignment
+  // destroys previous indices before their resources.
+  std::unique_ptr<CountingMemoryResource> postings_mr_, vectors_mr_, sort_mr_;
 };
 
 struct AlgorithmProfile {
@@ -112,7 +159,7 @@ struct SearchResult {
   // The ids of the matched documents
   std::vector<DocId> ids;
 
-  // Contains final scores if an aggregation was present
+  // Contains final scores if an aggregation or scoring was present
   std::vector<ResultScore> scores;
 
   // If profiling was enabled
@@ -144,9 +191,17 @@ class SearchAlgorithm {
   std::optional<AggregationInfo> HasAggregation() const;
 
   void EnableProfiling();
+  bool IsProfilingEnabled() const;
+
+  // Canonical form of the query and the options that affect its results, used as a cache key
+  std::string NormalizedQuery() const;
+
+  // Order results by BM25 score of their text terms, unless sorted by field or knn
+  void EnableScoring();
 
  private:
   bool profiling_enabled_ = false;
+  bool scoring_enabled_ = false;
   std::unique_ptr<AstNode> query_;
 };
 
@@ -105,6 +105,15 @@ TEST_F(SearchParserTest, Scanner) {
   NEXT_EQ(TOK_DOUBLE, double, d);
 }
 
+TEST_F(SearchParserTest, Affixes) {
+  SetInput("hel* *llo *");
+  NEXT_EQ(TOK_PREFIX, string, "hel");
+  NEXT_EQ(TOK_SUFFIX, string, "llo");
+  NEXT_TOK(TOK_STAR);
+
+  EXPECT_EQ(0, Parse("hel* -*llo @field:(wor* | *ld)"));
+}
+
 TEST_F(SearchParserTest, Parse) {
   EXPECT_EQ(0, Parse(" foo bar (baz) "));
   EXPECT_EQ(0, Parse(" -(foo) @foo:bar @ss:[1 2]"));
@@ -142,6 +151,17 @@ TEST_F(SearchParserTest, Numeric) {
   NEXT_EQ(TOK_TERM, string, "22");
 }
 
+TEST_F(SearchParserTest, Geo) {
+  EXPECT_EQ(0, Parse("@loc:[-122.41 37.77 10 km]"));
+  EXPECT_EQ(0, Parse("@loc:[13 52 500 M] @name:foo"));
+  EXPECT_EQ(0, Parse("@loc:[BOX 13.4 52.5 2 1 mi]"));
+
+  EXPECT_EQ(1, Parse("@loc:[13 52 10 parsecs]"));
+  EXPECT_EQ(1, Parse("@loc:[(13 52 10 km]"));
+  EXPECT_EQ(1, Parse("@loc:[CIRCLE 13 52 2 1 km]"));
+  EXPECT_EQ(1, Parse("@loc:[BOX 13 52 2 km]"));
+}
+
 TEST_F(SearchParserTest, KNN) {
   SetInput("*=>[KNN 1 @vector field_vec]");
   NEXT_TOK(TOK_STAR);
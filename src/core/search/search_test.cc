@@ -7,19 +7,25 @@
 #include <absl/cleanup/cleanup.h>
 #include <absl/container/flat_hash_map.h>
 #include <absl/strings/escaping.h>
+#include <absl/strings/match.h>
 #include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_split.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
 
 #include <algorithm>
+#include <functional>
 #include <memory_resource>
+#include <numeric>
 #include <random>
 
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "core/search/base.h"
+#include "core/search/indices.h"
 #include "core/search/query_driver.h"
+#include "core/search/sort_indices.h"
 #include "core/search/vector_utils.h"
 
 namespace dfly {
@@ -163,6 +169,23 @@ TEST_F(SearchTest, MatchTerm) {
   EXPECT_TRUE(Check()) << GetError();
 }
 
+TEST_F(SearchTest, MatchPrefixSuffix) {
+  PrepareQuery("hel*");
+  ExpectAll("hello", "Help me", "hel", "word helium");
+  ExpectNone("shell", "he", "wrong");
+  EXPECT_TRUE(Check()) << GetError();
+
+  PrepareQuery("*llo");
+  ExpectAll("hello", "Cello player", "llo");
+  ExpectNone("hellos", "llama", "lo");
+  EXPECT_TRUE(Check()) << GetError();
+
+  PrepareQuery("@field:hel* -*lp");
+  ExpectAll("hello", "helium");
+  ExpectNone("help", "hello help", "yelp");
+  EXPECT_TRUE(Check()) << GetError();
+}
+
 TEST_F(SearchTest, MatchNotTerm) {
   PrepareQuery("-foo");
 
@@ -308,6 +331,136 @@ TEST_F(SearchTest, MatchDoubleRange) {
   }
 }
 
+TEST_F(SearchTest, MatchGeo) {
+  PrepareSchema({{"loc", SchemaField::GEO}, {"n", SchemaField::NUMERIC}});
+
+  // One degree of longitude is about 111 km at the equator
+  {
+    PrepareQuery("@loc:[0 0 100 km]");
+    ExpectAll(Map{{"loc", "0,0"}}, Map{{"loc", "0.5,0.5"}}, Map{{"loc", "-0.8,0"}});
+    ExpectNone(Map{{"loc", "1,0"}}, Map{{"loc", "0.7,-0.7"}}, Map{{"loc", "50,50"}},
+               Map{{"loc", "invalid"}}, Map{{"n", "0"}});
+    EXPECT_TRUE(Check()) << GetError();
+  }
+
+  {
+    PrepareQuery("@loc:[BOX 0 0 200 100 km]");
+    ExpectAll(Map{{"loc", "0.8,0.4"}}, Map{{"loc", "-0.8,-0.4"}});
+    ExpectNone(Map{{"loc", "0.8,0.5"}}, Map{{"loc", "1,0"}});
+    EXPECT_TRUE(Check()) << GetError();
+  }
+
+  {
+    PrepareQuery("@loc:[0 0 100 km] @n:[1 2]");
+    ExpectAll(Map{{"loc", "0,0"}, {"n", "1"}});
+    ExpectNone(Map{{"loc", "0,0"}, {"n", "3"}}, Map{{"loc", "5,5"}, {"n", "1"}});
+    EXPECT_TRUE(Check()) << GetError();
+  }
+}
+
+TEST(GeoIndexTest, Cells) {
+  GeoIndex index{PMR_NS::get_default_resource()};
+
+  // Grid of points around Berlin, 0.01 degrees apart
+  const size_t kSide = 100;
+  for (size_t i = 0; i < kSide * kSide; i++) {
+    MockedDocument doc{absl::StrCat(13 + 0.01 * (i % kSide), ",", 52 + 0.01 * (i / kSide))};
+    index.Add(i, &doc, "field");
+  }
+
+  for (GeoIndex::Area area : {GeoIndex::Area{13.5, 52.5, 5'000}, {13.5, 52.5, 40'000},
+                              {13.1, 52.1, 1'000'000}, {13.5, 52.5, 0, 10'000, 20'000}}) {
+    vector<DocId> within = index.Within(area);
+    EXPECT_FALSE(within.empty());
+    EXPECT_TRUE(is_sorted(within.begin(), within.end()));
+
+    // Cells cover the area, so they contain at least all matches
+    EXPECT_GE(index.Count(area, kSide * kSide), within.size());
+
+    vector<DocId> all(kSide * kSide);
+    iota(all.begin(), all.end(), 0);
+    index.Filter(area, &all);
+    EXPECT_EQ(all, within);
+  }
+
+  // Removed documents are not matched anymore
+  MockedDocument doc{"13.5,52.5"};
+  index.Remove(50 * kSide + 50, &doc, "field");
+  vector<DocId> within = index.Within({13.5, 52.5, 100});
+  EXPECT_TRUE(within.empty());
+}
+
+TEST(NumericIndexTest, Blocks) {
+  NumericIndex index{PMR_NS::get_default_resource()};
+
+  // Many values split the index into blocks, some docs have multiple values
+  const size_t kNum = 10'000;
+  default_random_engine gen{};
+  uniform_int_distribution<int> dist(0, 1000);
+  vector<vector<int>> values(kNum);
+  for (size_t i = 0; i < kNum; i++) {
+    values[i] = {dist(gen)};
+    if (i % 3 == 0)
+      values[i].push_back(values[i][0] + 1 + dist(gen) % 500);
+  }
+
+  // Mocked documents return a single string, so they are indexed value by value
+  auto add = [&index](DocId id, int value) {
+    MockedDocument doc{to_string(value)};
+    index.Add(id, &doc, "field");
+  };
+  for (size_t i = 0; i < kNum; i++) {
+    for (int value : values[i])
+      add(i, value);
+  }
+
+  auto check = [&](double l, double r) {
+    vector<DocId> expected;
+    size_t count = 0;
+    for (size_t i = 0; i < kNum; i++) {
+      size_t in_range = count_if(values[i].begin(), values[i].end(),
+                                 [l, r](int v) { return l <= v && v <= r; });
+      count += in_range;
+      if (in_range > 0)
+        expected.push_back(i);
+    }
+
+    RoaringSet range = index.Range(l, r);
+    EXPECT_EQ(vector<DocId>(range.begin(), range.end()), expected) << l << " " << r;
+    EXPECT_EQ(index.Count(l, r, kNum * 2), count) << l << " " << r;
+
+    vector<DocId> filtered;
+    for (DocId i = 0; i < kNum; i += 7)
+      filtered.push_back(i);
+    index.Filter(l, r, &filtered);
+
+    vector<DocId> expected_filtered;
+    copy_if(expected.begin(), expected.end(), back_inserter(expected_filtered),
+            [](DocId i) { return i % 7 == 0; });
+    EXPECT_EQ(filtered, expected_filtered) << l << " " << r;
+  };
+
+  for (auto [l, r] : {pair{0, 1000}, {100, 900}, {500, 500}, {-5, 3}, {999, 2000}, {200, 100}})
+    check(l, r);
+
+  // Remove one value of every doc with multiple values, and all values of every fifth doc
+  for (size_t i = 0; i < kNum; i++) {
+    if (values[i].size() > 1) {
+      MockedDocument doc{to_string(values[i].back())};
+      index.Remove(i, &doc, "field");
+      values[i].pop_back();
+    }
+    if (i % 5 == 0) {
+      MockedDocument doc{to_string(values[i][0])};
+      index.Remove(i, &doc, "field");
+      values[i].clear();
+    }
+  }
+
+  for (auto [l, r] : {pair{0, 1000}, {100, 900}, {500, 500}, {-5, 3}, {999, 2000}})
+    check(l, r);
+}
+
 TEST_F(SearchTest, MatchStar) {
   PrepareQuery("*");
   ExpectAll("one", "two", "three", "and", "all", "documents");
@@ -372,6 +525,100 @@ TEST_F(SearchTest, IntegerTerms) {
   EXPECT_TRUE(Check()) << GetError();
 }
 
+TEST_F(SearchTest, PlannedIntersections) {
+  auto schema = MakeSimpleSchema(
+      {{"text", SchemaField::TEXT}, {"tag", SchemaField::TAG}, {"num", SchemaField::NUMERIC}});
+  FieldIndices indices{schema, PMR_NS::get_default_resource()};
+
+  // Rare terms and tags make intersections probe the common ones
+  const size_t kNum = 2000;
+  vector<MockedDocument> docs;
+  for (size_t i = 0; i < kNum; i++) {
+    string text = i % 100 == 0 ? "common rare" : "common";
+    string tag = i % 50 == 0 ? "rare" : "common";
+    docs.emplace_back(MockedDocument::Map{{"text", text}, {"tag", tag}, {"num", to_string(i)}});
+  }
+  for (size_t i = 0; i < kNum; i++)
+    indices.Add(i, &docs[i]);
+
+  pair<string_view, function<bool(size_t)>> cases[] = {
+      {"@tag:{rare} @text:common", [](size_t i) { return i % 50 == 0; }},
+      {"@tag:{rare} @num:[100 1000]",
+       [](size_t i) { return i % 50 == 0 && i >= 100 && i <= 1000; }},
+      {"@text:rare @tag:{rare | common} -@num:[0 500]",
+       [](size_t i) { return i % 100 == 0 && i > 500; }},
+      {"@text:rare (@tag:{common} | @num:[1500 2000])",
+       [](size_t i) { return i % 100 == 0 && i >= 1500; }},
+      {"@tag:{rare} (@text:rare @num:[0 1000])",
+       [](size_t i) { return i % 100 == 0 && i <= 1000; }},
+      {"@text:rare -(@text:common @tag:{rare})", [](size_t) { return false; }},
+  };
+
+  for (const auto& [query, pred] : cases) {
+    SearchAlgorithm algo{};
+    algo.EnableProfiling();
+    QueryParams params;
+    ASSERT_TRUE(algo.Init(query, &params)) << query;
+    auto result = algo.Search(&indices);
+
+    vector<DocId> expected;
+    for (size_t i = 0; i < kNum; i++) {
+      if (pred(i))
+        expected.push_back(i);
+    }
+    EXPECT_EQ(result.ids, expected) << query;
+
+    // The plan shows up in the profile
+    ASSERT_TRUE(result.profile);
+    auto& events = result.profile->events;
+    auto is_probe = [](const auto& event) { return absl::StrContains(event.descr, "probed"); };
+    EXPECT_TRUE(any_of(events.begin(), events.end(), is_probe)) << query;
+  }
+}
+
+TEST_F(SearchTest, Bm25) {
+  auto schema = MakeSimpleSchema({{"text", SchemaField::TEXT}});
+  FieldIndices indices{schema, PMR_NS::get_default_resource()};
+
+  vector<MockedDocument> docs;
+  for (string_view text : {"fox jumps over the dog", "fox fox", "dog", "fox dog", "foxtrot"})
+    docs.emplace_back(MockedDocument::Map{{"text", string{text}}});
+  for (size_t i = 0; i < docs.size(); i++)
+    indices.Add(i, &docs[i]);
+
+  auto search = [&indices](string_view query, size_t limit) {
+    SearchAlgorithm algo{};
+    algo.EnableScoring();
+    QueryParams params;
+    EXPECT_TRUE(algo.Init(query, &params));
+    return algo.Search(&indices, limit);
+  };
+
+  // Higher frequencies and shorter documents score higher
+  auto result = search("fox", 10);
+  EXPECT_EQ(result.ids, vector<DocId>({1, 3, 0}));
+  ASSERT_EQ(result.scores.size(), 3u);
+  EXPECT_GT(get<float>(result.scores[0]), get<float>(result.scores[1]));
+  EXPECT_GT(get<float>(result.scores[1]), get<float>(result.scores[2]));
+
+  // Only the best ones are kept, all matches are counted
+  result = search("fox | dog", 2);
+  EXPECT_EQ(result.ids, vector<DocId>({3, 1}));
+  EXPECT_EQ(result.total, 4u);
+
+  // Negated terms don't contribute
+  result = search("fox -dog", 10);
+  EXPECT_EQ(result.ids, vector<DocId>({1}));
+
+  // Terms of removed documents disappear from the dictionary
+  EXPECT_EQ(search("*trot", 10).ids, vector<DocId>({4}));
+  indices.Remove(1, &docs[1]);
+  indices.Remove(4, &docs[4]);
+  EXPECT_EQ(search("fox*", 10).ids, vector<DocId>({3, 0}));
+  EXPECT_EQ(search("*ox", 10).ids, vector<DocId>({3, 0}));
+  EXPECT_TRUE(search("*trot", 10).ids.empty());
+}
+
 std::string ToBytes(absl::Span<const float> vec) {
   return string{reinterpret_cast<const char*>(vec.data()), sizeof(float) * vec.size()};
 }
@@ -399,6 +646,87 @@ TEST_F(SearchTest, Errors) {
   EXPECT_THAT(algo.Search(&indices).error, HasSubstr("Wrong vector index dimensions"));
 }
 
+TEST(FieldIndicesTest, MemoryUsage) {
+  auto schema = MakeSimpleSchema(
+      {{"title", SchemaField::TEXT}, {"n", SchemaField::NUMERIC}, {"v", SchemaField::VECTOR}});
+  schema.fields["title"].flags |= SchemaField::SORTABLE;
+  schema.fields["v"].special_params = SchemaField::VectorParams{false, 2};
+
+  FieldIndices indices{schema, PMR_NS::get_default_resource()};
+  auto empty = indices.GetMemoryUsage();
+
+  vector<MockedDocument> docs;
+  for (size_t i = 0; i < 100; i++) {
+    float vec[2] = {float(i), 1.0f};
+    string vec_bytes{reinterpret_cast<char*>(vec), sizeof(vec)};
+    docs.emplace_back(MockedDocument::Map{
+        {"title", absl::StrCat("title number ", i)}, {"n", absl::StrCat(i)}, {"v", vec_bytes}});
+  }
+  for (DocId i = 0; i < docs.size(); i++)
+    indices.Add(i, &docs[i]);
+
+  auto full = indices.GetMemoryUsage();
+  EXPECT_GT(full.postings, empty.postings);
+  EXPECT_GE(full.vectors, 100 * 2 * sizeof(float));
+  EXPECT_GT(full.sort_indices, empty.sort_indices);
+
+  for (DocId i = 0; i < docs.size(); i++)
+    indices.Remove(i, &docs[i]);
+  EXPECT_LT(indices.GetMemoryUsage().postings, full.postings);
+}
+
+TEST(StringSortIndexTest, Sort) {
+  // Values around the inline prefix length, including ones that only differ past it.
+  vector<string> values = {"b", "abcdefgh", "abcdefghij", "abcdefghi", "", "abcdefg", "abc",
+                           "abcdefgz", "abcdefghia", string(100, 'a'), string("abc\0", 4)};
+
+  StringSortIndex index{PMR_NS::get_default_resource()};
+  vector<MockedDocument> docs(values.begin(), values.end());
+  for (DocId i = 0; i < docs.size(); i++)
+    index.Add(i, &docs[i], "field");
+
+  vector<string> sorted = values;
+  sort(sorted.begin(), sorted.end());
+
+  for (bool desc : {false, true}) {
+    vector<DocId> ids(values.size());
+    iota(ids.begin(), ids.end(), 0);
+    auto scores = index.Sort(&ids, values.size(), desc);
+    ASSERT_EQ(scores.size(), values.size());
+
+    for (size_t i = 0; i < ids.size(); i++) {
+      size_t pos = desc ? sorted.size() - i - 1 : i;
+      EXPECT_EQ(values[ids[i]], sorted[pos]) << i << " " << desc;
+    }
+  }
+
+  for (DocId i = 0; i < docs.size(); i++)
+    EXPECT_EQ(get<string>(index.Lookup(i)), values[i]);
+
+  index.Remove(1, &docs[1]);
+  EXPECT_EQ(get<string>(index.Lookup(1)), "");
+}
+
+TEST(SearchAlgorithmTest, NormalizedQuery) {
+  auto normalized = [](string_view query) {
+    QueryParams params;
+    params["p"] = "word";
+
+    SearchAlgorithm algo{};
+    EXPECT_TRUE(algo.Init(query, &params)) << query;
+    return algo.NormalizedQuery();
+  };
+
+  EXPECT_EQ(normalized("a  b"), normalized("b a"));
+  EXPECT_EQ(normalized("@tag:{x | y} | c*"), normalized("c* | @tag:{y|x}"));
+  EXPECT_EQ(normalized("a $p"), normalized("word a"));
+
+  EXPECT_NE(normalized("a b"), normalized("a | b"));
+  EXPECT_NE(normalized("a*"), normalized("*a"));
+  EXPECT_NE(normalized("@n:[(5 10]"), normalized("@n:[5 10]"));
+  EXPECT_NE(normalized("-(a b)"), normalized("-a b"));
+}
+
 class KnnTest : public SearchTest, public testing::WithParamInterface<bool /* hnsw */> {};
 
 TEST_P(KnnTest, Simple1D) {
@@ -580,15 +908,225 @@ TEST_P(KnnTest, AutoResize) {
   EXPECT_EQ(indices.GetAllDocs().size(), 100);
 }
 
+TEST_P(KnnTest, Quantized) {
+  const size_t kDims = 32, kNum = 1000, kLimit = 10;
+
+  default_random_engine rnd{42};
+  uniform_real_distribution<float> coord(-1, 1);
+  auto random_vec = [&] {
+    vector<float> vec(kDims);
+    generate(vec.begin(), vec.end(), [&] { return coord(rnd); });
+    return ToBytes(absl::MakeConstSpan(vec));
+  };
+
+  vector<string> vecs(kNum);
+  generate(vecs.begin(), vecs.end(), random_vec);
+
+  for (auto sim : {VectorSimilarity::L2, VectorSimilarity::COSINE}) {
+    // Exact results of a flat index without quantization are the reference
+    auto MakeIndices = [&](bool hnsw, VectorQuantization quantization) {
+      auto schema = MakeSimpleSchema({{"pos", SchemaField::VECTOR}});
+      SchemaField::VectorParams params{hnsw, kDims, sim};
+      params.quantization = quantization;
+      params.hnsw_ef_construction = 400;
+      schema.fields["pos"].special_params = params;
+
+      auto indices = make_unique<FieldIndices>(schema, PMR_NS::get_default_resource());
+      for (size_t i = 0; i < kNum; i++) {
+        MockedDocument doc{Map{{"pos", vecs[i]}}};
+        indices->Add(i, &doc);
+      }
+      return indices;
+    };
+
+    auto exact = MakeIndices(false, VectorQuantization::NONE);
+    for (auto quantization : {VectorQuantization::FP16, VectorQuantization::INT8}) {
+      auto quantized = MakeIndices(GetParam(), quantization);
+
+      size_t found = 0;
+      const size_t kQueries = 20;
+      for (size_t i = 0; i < kQueries; i++) {
+        QueryParams params;
+        params["vec"] = random_vec();
+
+        SearchAlgorithm algo{};
+        algo.Init(absl::StrCat("* =>[KNN ", kLimit, " @pos $vec EF_RUNTIME 100]"), &params);
+        auto expected = algo.Search(exact.get()).ids;
+        for (DocId id : algo.Search(quantized.get()).ids)
+          found += count(expected.begin(), expected.end(), id);
+      }
+
+      double recall = double(found) / (kQueries * kLimit);
+      EXPECT_GT(recall, 0.9) << int(sim) << " " << int(quantization);
+    }
+  }
+}
+
+TEST_F(SearchTest, HnswAddBatch) {
+  const size_t kDims = 16, kNum = 2000, kLimit = 10;
+
+  default_random_engine rnd{42};
+  uniform_real_distribution<float> coord(-1, 1);
+  auto random_vec = [&] {
+    vector<float> vec(kDims);
+    generate(vec.begin(), vec.end(), [&] { return coord(rnd); });
+    return ToBytes(absl::MakeConstSpan(vec));
+  };
+
+  vector<MockedDocument> docs;
+  for (size_t i = 0; i < kNum; i++)
+    docs.emplace_back(Map{{"pos", random_vec()}});
+
+  auto MakeIndices = [&](bool hnsw) {
+    auto schema = MakeSimpleSchema({{"pos", SchemaField::VECTOR}});
+    // Small initial capacity checks that the index grows before parallel insertions
+    schema.fields["pos"].special_params =
+        SchemaField::VectorParams{hnsw, kDims, VectorSimilarity::L2, 10};
+    return make_unique<FieldIndices>(schema, PMR_NS::get_default_resource());
+  };
+
+  auto exact = MakeIndices(false);
+  for (size_t i = 0; i < kNum; i++)
+    exact->Add(i, &docs[i]);
+
+  // Insert in a few batches with four threads
+  auto batched = MakeIndices(true);
+  vector<pair<DocId, DocumentAccessor*>> batch;
+  for (size_t i = 0; i < kNum; i++) {
+    batch.emplace_back(i, &docs[i]);
+    if (batch.size() == 512 || i + 1 == kNum) {
+      batched->AddBatch(batch, 4);
+      batch.clear();
+    }
+  }
+  EXPECT_EQ(batched->GetAllDocs().size(), kNum);
+
+  size_t found = 0;
+  const size_t kQueries = 20;
+  for (size_t i = 0; i < kQueries; i++) {
+    QueryParams params;
+    params["vec"] = random_vec();
+
+    SearchAlgorithm algo{};
+    algo.Init(absl::StrCat("* =>[KNN ", kLimit, " @pos $vec EF_RUNTIME 100]"), &params);
+    auto expected = algo.Search(exact.get()).ids;
+    for (DocId id : algo.Search(batched.get()).ids)
+      found += count(expected.begin(), expected.end(), id);
+  }
+  EXPECT_GT(double(found) / (kQueries * kLimit), 0.9);
+}
+
 INSTANTIATE_TEST_SUITE_P(KnnFlat, KnnTest, testing::Values(false));
 INSTANTIATE_TEST_SUITE_P(KnnHnsw, KnnTest, testing::Values(true));
 
+TEST(VectorUtilsTest, Distances) {
+  LOG(INFO) << "Using " << VectorKernelsName() << " vector kernels";
+
+  default_random_engine rnd{42};
+  uniform_real_distribution<float> coord(-1, 1);
+
+  // Dimensions cover the tails of all kernels
+  for (size_t dims : {1, 3, 4, 7, 8, 15, 16, 17, 31, 100, 768}) {
+    vector<vector<float>> vecs(11, vector<float>(dims));
+    for (auto& vec : vecs)
+      generate(vec.begin(), vec.end(), [&] { return coord(rnd); });
+
+    const float* u = vecs[0].data();
+    vector<const float*> vs;
+    for (size_t i = 1; i < vecs.size(); i++)
+      vs.push_back(vecs[i].data());
+
+    float l2[10], cosine[10];
+    VectorDistances(u, vs.data(), vs.size(), dims, VectorSimilarity::L2, l2);
+    VectorDistances(u, vs.data(), vs.size(), dims, VectorSimilarity::COSINE, cosine);
+
+    for (size_t i = 0; i < vs.size(); i++) {
+      double sum_sq = 0, sum_uv = 0, sum_uu = 0, sum_vv = 0;
+      for (size_t j = 0; j < dims; j++) {
+        sum_sq += (u[j] - vs[i][j]) * (u[j] - vs[i][j]);
+        sum_uv += u[j] * vs[i][j];
+        sum_uu += u[j] * u[j];
+        sum_vv += vs[i][j] * vs[i][j];
+      }
+      double expected_cosine = 1 - sum_uv / sqrt(sum_uu * sum_vv);
+
+      EXPECT_NEAR(l2[i], sqrt(sum_sq), 1e-3) << dims;
+      EXPECT_NEAR(cosine[i], expected_cosine, 1e-3) << dims;
+      EXPECT_NEAR(VectorDistance(u, vs[i], dims, VectorSimilarity::L2), sqrt(sum_sq), 1e-3);
+      EXPECT_NEAR(L2DistanceSquared(u, vs[i], dims), sum_sq, 1e-2);
+      EXPECT_NEAR(InnerProduct(u, vs[i], dims), sum_uv, 1e-3);
+    }
+  }
+}
+
+TEST(VectorUtilsTest, Codec) {
+  default_random_engine rnd{42};
+  uniform_real_distribution<float> coord(-1, 1);
+
+  for (auto quantization : {VectorQuantization::FP16, VectorQuantization::INT8}) {
+    // Int8 codes keep about two decimal digits of every component
+    const double kError = quantization == VectorQuantization::FP16 ? 2e-3 : 3e-2;
+
+    for (size_t dims : {1, 3, 8, 15, 16, 17, 31, 32, 33, 100, 768}) {
+      VectorCodec codec{dims, quantization};
+      vector<float> u(dims), v(dims);
+      generate(u.begin(), u.end(), [&] { return coord(rnd); });
+      generate(v.begin(), v.end(), [&] { return coord(rnd); });
+
+      // Codes don't need to be aligned
+      string cu(codec.CodeSize() + 1, '\0'), cv(codec.CodeSize() + 1, '\0');
+      codec.Encode(u.data(), cu.data() + 1);
+      codec.Encode(v.data(), cv.data() + 1);
+
+      for (auto sim : {VectorSimilarity::L2, VectorSimilarity::COSINE}) {
+        EXPECT_NEAR(codec.Distance(cu.data() + 1, cv.data() + 1, sim),
+                    VectorDistance(u.data(), v.data(), dims, sim), kError)
+            << dims << " " << int(quantization);
+      }
+      EXPECT_NEAR(codec.Distance(cu.data() + 1, cu.data() + 1, VectorSimilarity::L2), 0, 1e-2);
+    }
+
+    // Zero vectors have no scale
+    VectorCodec codec{4, quantization};
+    vector<float> zero(4, 0.0f);
+    string code(codec.CodeSize(), '\0');
+    codec.Encode(zero.data(), code.data());
+    EXPECT_EQ(codec.Distance(code.data(), code.data(), VectorSimilarity::L2), 0);
+    EXPECT_EQ(codec.Distance(code.data(), code.data(), VectorSimilarity::COSINE), 0);
+  }
+}
+
+static void BM_VectorDistances(benchmark::State& state) {
+  unsigned ndims = state.range(0);
+  const size_t kNum = 1024;
+
+  vector<float> data((kNum + 1) * ndims);
+  for (float& coord : data)
+    coord = static_cast<float>(rand()) / static_cast<float>(RAND_MAX);
+
+  vector<const float*> vs;
+  for (size_t i = 1; i <= kNum; i++)
+    vs.push_back(data.data() + i * ndims);
+  vector<float> out(kNum);
+
+  auto sim = state.range(1) ? VectorSimilarity::COSINE : VectorSimilarity::L2;
+  while (state.KeepRunning()) {
+    VectorDistances(data.data(), vs.data(), kNum, ndims, sim, out.data());
+    benchmark::DoNotOptimize(out.data());
+  }
+  state.SetItemsProcessed(state.iterations() * kNum);
+  state.SetLabel(VectorKernelsName());
+}
+
+BENCHMARK(BM_VectorDistances)->ArgsProduct({{32, 128, 768}, {0, 1}});
+
 static void BM_VectorSearch(benchmark::State& state) {
   unsigned ndims = state.range(0);
   unsigned nvecs = state.range(1);
+  bool hnsw = state.range(2);
 
   auto schema = MakeSimpleSchema({{"pos", SchemaField::VECTOR}});
-  schema.fields["pos"].special_params = SchemaField::VectorParams{false, ndims};
+  schema.fields["pos"].special_params = SchemaField::VectorParams{hnsw, ndims};
   FieldIndices indices{schema, PMR_NS::get_default_resource()};
 
   auto random_vec = [ndims]() {
@@ -617,7 +1155,7 @@ static void BM_VectorSearch(benchmark::State& state) {
   }
 }
 
-BENCHMARK(BM_VectorSearch)->Args({120, 10'000});
+BENCHMARK(BM_VectorSearch)->ArgsProduct({{120, 768}, {10'000}, {0, 1}});
 
 }  // namespace search
 
@@ -9,8 +9,10 @@
 #include <absl/strings/numbers.h>
 #include <absl/strings/str_split.h>
 
+#include <absl/base/internal/endian.h>
+
 #include <algorithm>
-#include <type_traits>
+#include <cstring>
 
 namespace dfly::search {
 
@@ -24,11 +26,7 @@ SimpleValueSortIndex<T>::SimpleValueSortIndex(PMR_NS::memory_resource* mr) : val
 
 template <typename T> SortableValue SimpleValueSortIndex<T>::Lookup(DocId doc) const {
   DCHECK_LT(doc, values_.size());
-  if constexpr (is_same_v<T, PMR_NS::string>) {
-    return std::string(values_[doc]);
-  } else {
-    return values_[doc];
-  }
+  return values_[doc];
 }
 
 template <typename T>
@@ -64,7 +62,6 @@ template <typename T> PMR_NS::memory_resource* SimpleValueSortIndex<T>::GetMemRe
 }
 
 template struct SimpleValueSortIndex<double>;
-template struct SimpleValueSortIndex<PMR_NS::string>;
 
 double NumericSortIndex::Get(DocId id, DocumentAccessor* doc, std::string_view field) {
   auto str = doc->GetStrings(field);
@@ -77,12 +74,92 @@ double NumericSortIndex::Get(DocId id, DocumentAccessor* doc, std::string_view f
   return v;
 }
 
-PMR_NS::string StringSortIndex::Get(DocId id, DocumentAccessor* doc, std::string_view field) {
+StringSortIndex::StringSortIndex(PMR_NS::memory_resource* mr) : keys_{mr} {
+}
+
+StringSortIndex::~StringSortIndex() {
+  for (Key& key : keys_)
+    Reset(&key);
+}
+
+SortableValue StringSortIndex::Lookup(DocId doc) const {
+  DCHECK_LT(doc, keys_.size());
+  return Value(keys_[doc]);
+}
+
+std::vector<ResultScore> StringSortIndex::Sort(std::vector<DocId>* ids, size_t limit,
+                                               bool desc) const {
+  auto cb = [this, desc](DocId lhs, DocId rhs) {
+    int res = Compare(keys_[lhs], keys_[rhs]);
+    return desc ? res > 0 : res < 0;
+  };
+  std::partial_sort(ids->begin(), ids->begin() + std::min(ids->size(), limit), ids->end(), cb);
+
+  vector<ResultScore> out(min(ids->size(), limit));
+  for (size_t i = 0; i < out.size(); i++)
+    out[i] = Value(keys_[(*ids)[i]]);
+  return out;
+}
+
+void StringSortIndex::Add(DocId id, DocumentAccessor* doc, std::string_view field) {
+  DCHECK_LE(id, keys_.size());  // Doc ids grow at most by one
+  if (id >= keys_.size())
+    keys_.resize(id + 1);
+
+  Key& key = keys_[id];
+  Reset(&key);
+
   auto str = doc->GetStrings(field);
   if (str.empty())
-    return "";
+    return;
+
+  string_view value = str.front();
+  char prefix[kPrefixLen] = {0};
+  memcpy(prefix, value.data(), min(value.size(), kPrefixLen));
+  key.prefix = absl::big_endian::Load64(prefix);
+  key.len = value.size();
+
+  if (value.size() > kPrefixLen) {
+    size_t rest = value.size() - kPrefixLen;
+    key.suffix = static_cast<char*>(keys_.get_allocator().resource()->allocate(rest, 1));
+    memcpy(key.suffix, value.data() + kPrefixLen, rest);
+  }
+}
+
+void StringSortIndex::Remove(DocId id, DocumentAccessor* doc, std::string_view field) {
+  DCHECK_LT(id, keys_.size());
+  Reset(&keys_[id]);
+}
+
+int StringSortIndex::Compare(const Key& lhs, const Key& rhs) {
+  if (lhs.prefix != rhs.prefix)
+    return lhs.prefix < rhs.prefix ? -1 : 1;
+
+  // Equal prefixes mean that the shorter value is a prefix of the longer one, unless both
+  // continue past the prefix.
+  size_t common = min(lhs.len, rhs.len);
+  if (common > kPrefixLen) {
+    int res = memcmp(lhs.suffix, rhs.suffix, common - kPrefixLen);
+    if (res != 0)
+      return res;
+  }
+  return lhs.len == rhs.len ? 0 : (lhs.len < rhs.len ? -1 : 1);
+}
+
+string StringSortIndex::Value(const Key& key) const {
+  char prefix[kPrefixLen];
+  absl::big_endian::Store64(prefix, key.prefix);
+
+  string res(prefix, min<size_t>(key.len, kPrefixLen));
+  if (key.len > kPrefixLen)
+    res.append(key.suffix, key.len - kPrefixLen);
+  return res;
+}
 
-  return PMR_NS::string{str.front(), GetMemRes()};
+void StringSortIndex::Reset(Key* key) {
+  if (key->suffix)
+    keys_.get_allocator().resource()->deallocate(key->suffix, key->len - kPrefixLen, 1);
+  *key = Key{};
 }
 
 }  // namespace dfly::search
@@ -42,11 +42,35 @@ struct NumericSortIndex : public SimpleValueSortIndex<double> {
   double Get(DocId id, DocumentAccessor* doc, std::string_view field) override;
 };
 
-// TODO: Map tags to integers for fast sort
-struct StringSortIndex : public SimpleValueSortIndex<PMR_NS::string> {
-  StringSortIndex(PMR_NS::memory_resource* mr) : SimpleValueSortIndex{mr} {};
+// Keeps the values as sort keys: the first kPrefixLen bytes are stored inline as a big endian
+// integer, so that most comparisons are a single integer compare, and only the rest of longer
+// values is allocated from the memory resource.
+struct StringSortIndex : BaseSortIndex {
+  static constexpr size_t kPrefixLen = 8;
 
-  PMR_NS::string Get(DocId id, DocumentAccessor* doc, std::string_view field) override;
+  StringSortIndex(PMR_NS::memory_resource* mr);
+  ~StringSortIndex() override;
+
+  SortableValue Lookup(DocId doc) const override;
+  std::vector<ResultScore> Sort(std::vector<DocId>* ids, size_t limit, bool desc) const override;
+
+  void Add(DocId id, DocumentAccessor* doc, std::string_view field) override;
+  void Remove(DocId id, DocumentAccessor* doc, std::string_view field) override;
+
+ private:
+  struct Key {
+    uint64_t prefix = 0;  // zero padded if the value is shorter than kPrefixLen
+    uint32_t len = 0;
+    char* suffix = nullptr;  // the len - kPrefixLen bytes past the prefix, if there are any
+  };
+
+  // Three way comparison of the values of the keys.
+  static int Compare(const Key& lhs, const Key& rhs);
+
+  std::string Value(const Key& key) const;
+  void Reset(Key* key);
+
+  PMR_NS::vector<Key> keys_;
 };
 
 }  // namespace dfly::search
@@ -4,7 +4,15 @@
 
 #include "core/search/vector_utils.h"
 
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#include <algorithm>
 #include <cmath>
+#include <cstring>
 #include <memory>
 
 #include "base/logging.h"
@@ -15,27 +23,377 @@ using namespace std;
 
 namespace {
 
-// Euclidean vector distance: sqrt( sum: (u[i] - v[i])^2  )
-__attribute__((optimize("fast-math"))) float L2Distance(const float* u, const float* v,
-                                                        size_t dims) {
+// The kernels compute sums over the dimensions of u with N vectors at once, so that every load of
+// u is shared. For kL2 sums are the squared differences, for kDot the products and for kCosine
+// norms are summed as well.
+enum class SumOp { kL2, kDot, kCosine };
+
+// Number of vectors per block of VectorDistances
+constexpr size_t kBlock = 4;
+
+template <SumOp op, size_t N>
+__attribute__((optimize("fast-math"))) void SumsScalarFrom(size_t start, const float* u,
+                                                           const float* const* vs, size_t dims,
+                                                           float* sums, float* norms) {
+  for (size_t j = 0; j < N; j++) {
+    const float* v = vs[j];
+    float sum = 0, norm = 0;
+    for (size_t i = start; i < dims; i++) {
+      if constexpr (op == SumOp::kL2) {
+        sum += (u[i] - v[i]) * (u[i] - v[i]);
+      } else {
+        sum += u[i] * v[i];
+        if constexpr (op == SumOp::kCosine)
+          norm += v[i] * v[i];
+      }
+    }
+    sums[j] += sum;
+    if constexpr (op == SumOp::kCosine)
+      norms[j] += norm;
+  }
+}
+
+template <SumOp op, size_t N>
+void SumsScalar(const float* u, const float* const* vs, size_t dims, float* sums, float* norms) {
+  for (size_t j = 0; j < N; j++) {
+    sums[j] = 0;
+    if constexpr (op == SumOp::kCosine)
+      norms[j] = 0;
+  }
+  SumsScalarFrom<op, N>(0, u, vs, dims, sums, norms);
+}
+
+// Rounds to nearest even like the hardware conversions, overflows to infinity
+uint16_t FloatToHalf(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000, mant = x & 0x7FFFFF;
+  int32_t exp = int32_t((x >> 23) & 0xFF) - 127 + 15;
+
+  if (((x >> 23) & 0xFF) == 0xFF)  // infinity or nan
+    return sign | 0x7C00 | (mant ? 0x200 : 0);
+  if (exp >= 31)
+    return sign | 0x7C00;
+
+  uint32_t shift = 13;
+  if (exp <= 0) {  // subnormal half
+    if (exp < -10)
+      return sign;
+    mant |= 0x800000;
+    shift = 14 - exp;
+    exp = 0;
+  }
+
+  uint32_t half = sign | (uint32_t(exp) << 10) | (mant >> shift);
+  uint32_t rem = mant & ((1u << shift) - 1), mid = 1u << (shift - 1);
+  if (rem > mid || (rem == mid && (half & 1)))
+    half++;  // may carry into the exponent, which is still correct
+  return half;
+}
+
+float HalfToFloat(uint16_t h) {
+  uint32_t sign = uint32_t(h & 0x8000) << 16, exp = (h >> 10) & 0x1F, mant = h & 0x3FF;
+  uint32_t x;
+  if (exp == 0x1F) {
+    x = sign | 0x7F800000 | (mant << 13);
+  } else if (exp != 0) {
+    x = sign | ((exp + 127 - 15) << 23) | (mant << 13);
+  } else if (mant == 0) {
+    x = sign;
+  } else {  // subnormal half, normalized for float
+    uint32_t shifts = 0;
+    while (!(mant & 0x400)) {
+      mant <<= 1;
+      shifts++;
+    }
+    x = sign | ((127 - 15 + 1 - shifts) << 23) | ((mant & 0x3FF) << 13);
+  }
+  float f;
+  memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+float DotHalfScalarFrom(size_t start, const uint16_t* u, const uint16_t* v, size_t dims) {
   float sum = 0;
-  for (size_t i = 0; i < dims; i++)
-    sum += (u[i] - v[i]) * (u[i] - v[i]);
-  return sqrt(sum);
+  for (size_t i = start; i < dims; i++)
+    sum += HalfToFloat(u[i]) * HalfToFloat(v[i]);
+  return sum;
+}
+
+float DotHalfScalar(const uint16_t* u, const uint16_t* v, size_t dims) {
+  return DotHalfScalarFrom(0, u, v, dims);
+}
+
+int32_t DotInt8ScalarFrom(size_t start, const int8_t* u, const int8_t* v, size_t dims) {
+  int32_t sum = 0;
+  for (size_t i = start; i < dims; i++)
+    sum += int32_t(u[i]) * v[i];
+  return sum;
+}
+
+int32_t DotInt8Scalar(const int8_t* u, const int8_t* v, size_t dims) {
+  return DotInt8ScalarFrom(0, u, v, dims);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2,fma"))) inline float HorizontalSumAvx2(__m256 v) {
+  __m128 sum = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+  sum = _mm_hadd_ps(sum, sum);
+  sum = _mm_hadd_ps(sum, sum);
+  return _mm_cvtss_f32(sum);
 }
 
-// TODO: Normalize vectors ahead if cosine distance is used
-__attribute__((optimize("fast-math"))) float CosineDistance(const float* u, const float* v,
-                                                            size_t dims) {
-  float sum_uv = 0, sum_uu = 0, sum_vv = 0;
-  for (size_t i = 0; i < dims; i++) {
-    sum_uv += u[i] * v[i];
-    sum_uu += u[i] * u[i];
-    sum_vv += v[i] * v[i];
+template <SumOp op, size_t N>
+__attribute__((target("avx2,fma"))) void SumsAvx2(const float* u, const float* const* vs,
+                                                  size_t dims, float* sums, float* norms) {
+  __m256 acc[N], norm_acc[N];
+  for (size_t j = 0; j < N; j++)
+    acc[j] = norm_acc[j] = _mm256_setzero_ps();
+
+  size_t i = 0;
+  for (; i + 8 <= dims; i += 8) {
+    __m256 vu = _mm256_loadu_ps(u + i);
+    for (size_t j = 0; j < N; j++) {
+      __m256 vv = _mm256_loadu_ps(vs[j] + i);
+      if constexpr (op == SumOp::kL2) {
+        __m256 diff = _mm256_sub_ps(vu, vv);
+        acc[j] = _mm256_fmadd_ps(diff, diff, acc[j]);
+      } else {
+        acc[j] = _mm256_fmadd_ps(vu, vv, acc[j]);
+        if constexpr (op == SumOp::kCosine)
+          norm_acc[j] = _mm256_fmadd_ps(vv, vv, norm_acc[j]);
+      }
+    }
+  }
+
+  for (size_t j = 0; j < N; j++) {
+    sums[j] = HorizontalSumAvx2(acc[j]);
+    if constexpr (op == SumOp::kCosine)
+      norms[j] = HorizontalSumAvx2(norm_acc[j]);
+  }
+  SumsScalarFrom<op, N>(i, u, vs, dims, sums, norms);
+}
+
+__attribute__((target("avx2,fma,f16c"))) float DotHalfAvx2(const uint16_t* u, const uint16_t* v,
+                                                           size_t dims) {
+  __m256 acc = _mm256_setzero_ps();
+  size_t i = 0;
+  for (; i + 8 <= dims; i += 8) {
+    __m256 vu = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i)));
+    __m256 vv = _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i)));
+    acc = _mm256_fmadd_ps(vu, vv, acc);
+  }
+  return HorizontalSumAvx2(acc) + DotHalfScalarFrom(i, u, v, dims);
+}
+
+// Codes are widened to 16 bits and multiplied pairwise into 32 bit sums
+__attribute__((target("avx2"))) int32_t DotInt8Avx2(const int8_t* u, const int8_t* v,
+                                                    size_t dims) {
+  __m256i acc = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 16 <= dims; i += 16) {
+    __m256i vu = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(u + i)));
+    __m256i vv = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(v + i)));
+    acc = _mm256_add_epi32(acc, _mm256_madd_epi16(vu, vv));
+  }
+
+  alignas(32) int32_t lanes[8];
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), acc);
+  int32_t sum = 0;
+  for (int32_t lane : lanes)
+    sum += lane;
+  return sum + DotInt8ScalarFrom(i, u, v, dims);
+}
+
+// Reduces through memory, as the intrinsics that extract parts of the register, including
+// _mm512_reduce_add_ps, trip -Wuninitialized on gcc 12
+__attribute__((target("avx512f"))) inline float HorizontalSumAvx512(__m512 v) {
+  alignas(64) float lanes[16];
+  _mm512_store_ps(lanes, v);
+  float sum = 0;
+  for (float lane : lanes)
+    sum += lane;
+  return sum;
+}
+
+// The tail is handled with masked loads, which read zeros past the end of the vectors
+template <SumOp op, size_t N>
+__attribute__((target("avx512f"))) void SumsAvx512(const float* u, const float* const* vs,
+                                                   size_t dims, float* sums, float* norms) {
+  __m512 acc[N], norm_acc[N];
+  for (size_t j = 0; j < N; j++)
+    acc[j] = norm_acc[j] = _mm512_setzero_ps();
+
+  for (size_t i = 0; i < dims; i += 16) {
+    __mmask16 mask = dims - i >= 16 ? __mmask16(0xFFFF) : __mmask16((1u << (dims - i)) - 1);
+    __m512 vu = _mm512_maskz_loadu_ps(mask, u + i);
+    for (size_t j = 0; j < N; j++) {
+      __m512 vv = _mm512_maskz_loadu_ps(mask, vs[j] + i);
+      if constexpr (op == SumOp::kL2) {
+        __m512 diff = _mm512_sub_ps(vu, vv);
+        acc[j] = _mm512_fmadd_ps(diff, diff, acc[j]);
+      } else {
+        acc[j] = _mm512_fmadd_ps(vu, vv, acc[j]);
+        if constexpr (op == SumOp::kCosine)
+          norm_acc[j] = _mm512_fmadd_ps(vv, vv, norm_acc[j]);
+      }
+    }
   }
 
-  if (float denom = sum_uu * sum_vv; denom != 0.0f)
-    return 1 - sum_uv / sqrt(denom);
+  for (size_t j = 0; j < N; j++) {
+    sums[j] = HorizontalSumAvx512(acc[j]);
+    if constexpr (op == SumOp::kCosine)
+      norms[j] = HorizontalSumAvx512(norm_acc[j]);
+  }
+}
+
+__attribute__((target("avx512f"))) float DotHalfAvx512(const uint16_t* u, const uint16_t* v,
+                                                       size_t dims) {
+  __m512 acc = _mm512_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= dims; i += 16) {
+    // The masked conversion avoids the same gcc 12 warning about undefined intrinsic values
+    __m256i hu = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + i));
+    __m256i hv = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i));
+    __m512 vu = _mm512_maskz_cvtph_ps(0xFFFF, hu), vv = _mm512_maskz_cvtph_ps(0xFFFF, hv);
+    acc = _mm512_fmadd_ps(vu, vv, acc);
+  }
+  return HorizontalSumAvx512(acc) + DotHalfScalarFrom(i, u, v, dims);
+}
+
+__attribute__((target("avx512f,avx512bw"))) int32_t DotInt8Avx512(const int8_t* u,
+                                                                  const int8_t* v, size_t dims) {
+  __m512i acc = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 32 <= dims; i += 32) {
+    __m512i vu = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(u + i)));
+    __m512i vv = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(v + i)));
+    acc = _mm512_add_epi32(acc, _mm512_madd_epi16(vu, vv));
+  }
+
+  alignas(64) int32_t lanes[16];
+  _mm512_store_si512(lanes, acc);
+  int32_t sum = 0;
+  for (int32_t lane : lanes)
+    sum += lane;
+  return sum + DotInt8ScalarFrom(i, u, v, dims);
+}
+
+#elif defined(__aarch64__)
+
+template <SumOp op, size_t N>
+void SumsNeon(const float* u, const float* const* vs, size_t dims, float* sums, float* norms) {
+  float32x4_t acc[N], norm_acc[N];
+  for (size_t j = 0; j < N; j++)
+    acc[j] = norm_acc[j] = vdupq_n_f32(0);
+
+  size_t i = 0;
+  for (; i + 4 <= dims; i += 4) {
+    float32x4_t vu = vld1q_f32(u + i);
+    for (size_t j = 0; j < N; j++) {
+      float32x4_t vv = vld1q_f32(vs[j] + i);
+      if constexpr (op == SumOp::kL2) {
+        float32x4_t diff = vsubq_f32(vu, vv);
+        acc[j] = vfmaq_f32(acc[j], diff, diff);
+      } else {
+        acc[j] = vfmaq_f32(acc[j], vu, vv);
+        if constexpr (op == SumOp::kCosine)
+          norm_acc[j] = vfmaq_f32(norm_acc[j], vv, vv);
+      }
+    }
+  }
+
+  for (size_t j = 0; j < N; j++) {
+    sums[j] = vaddvq_f32(acc[j]);
+    if constexpr (op == SumOp::kCosine)
+      norms[j] = vaddvq_f32(norm_acc[j]);
+  }
+  SumsScalarFrom<op, N>(i, u, vs, dims, sums, norms);
+}
+
+float DotHalfNeon(const uint16_t* u, const uint16_t* v, size_t dims) {
+  float32x4_t acc = vdupq_n_f32(0);
+  size_t i = 0;
+  for (; i + 4 <= dims; i += 4) {
+    float32x4_t vu = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(u + i)));
+    float32x4_t vv = vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(v + i)));
+    acc = vfmaq_f32(acc, vu, vv);
+  }
+  return vaddvq_f32(acc) + DotHalfScalarFrom(i, u, v, dims);
+}
+
+int32_t DotInt8Neon(const int8_t* u, const int8_t* v, size_t dims) {
+  int32x4_t acc = vdupq_n_s32(0);
+  size_t i = 0;
+  for (; i + 16 <= dims; i += 16) {
+    int8x16_t vu = vld1q_s8(u + i), vv = vld1q_s8(v + i);
+    acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(vu), vget_low_s8(vv)));
+    acc = vpadalq_s16(acc, vmull_high_s8(vu, vv));
+  }
+  return vaddvq_s32(acc) + DotInt8ScalarFrom(i, u, v, dims);
+}
+
+#endif
+
+using SumsFn = void (*)(const float* u, const float* const* vs, size_t dims, float* sums,
+                        float* norms);
+
+struct Kernels {
+  const char* name;
+  SumsFn l2, l2_block, dot, cosine, cosine_block;
+  float (*dot_half)(const uint16_t* u, const uint16_t* v, size_t dims);
+  int32_t (*dot_int8)(const int8_t* u, const int8_t* v, size_t dims);
+};
+
+Kernels SelectKernels() {
+#if defined(__x86_64__)
+  if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+    return {"avx512",
+            SumsAvx512<SumOp::kL2, 1>,
+            SumsAvx512<SumOp::kL2, kBlock>,
+            SumsAvx512<SumOp::kDot, 1>,
+            SumsAvx512<SumOp::kCosine, 1>,
+            SumsAvx512<SumOp::kCosine, kBlock>,
+            DotHalfAvx512,
+            DotInt8Avx512};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+      __builtin_cpu_supports("f16c")) {
+    return {"avx2",
+            SumsAvx2<SumOp::kL2, 1>,
+            SumsAvx2<SumOp::kL2, kBlock>,
+            SumsAvx2<SumOp::kDot, 1>,
+            SumsAvx2<SumOp::kCosine, 1>,
+            SumsAvx2<SumOp::kCosine, kBlock>,
+            DotHalfAvx2,
+            DotInt8Avx2};
+  }
+#elif defined(__aarch64__)
+  return {"neon",
+          SumsNeon<SumOp::kL2, 1>,
+          SumsNeon<SumOp::kL2, kBlock>,
+          SumsNeon<SumOp::kDot, 1>,
+          SumsNeon<SumOp::kCosine, 1>,
+          SumsNeon<SumOp::kCosine, kBlock>,
+          DotHalfNeon,
+          DotInt8Neon};
+#endif
+  return {"scalar",
+          SumsScalar<SumOp::kL2, 1>,
+          SumsScalar<SumOp::kL2, kBlock>,
+          SumsScalar<SumOp::kDot, 1>,
+          SumsScalar<SumOp::kCosine, 1>,
+          SumsScalar<SumOp::kCosine, kBlock>,
+          DotHalfScalar,
+          DotInt8Scalar};
+}
+
+const Kernels kKernels = SelectKernels();
+
+float CosineDistance(float uu, float uv, float vv) {
+  if (float denom = uu * vv; denom != 0.0f)
+    return 1 - uv / sqrt(denom);
   return 0.0f;
 }
 
@@ -54,12 +412,125 @@ OwnedFtVector BytesToFtVector(string_view value) {
 }
 
 float VectorDistance(const float* u, const float* v, size_t dims, VectorSimilarity sim) {
+  float out;
+  VectorDistances(u, &v, 1, dims, sim, &out);
+  return out;
+}
+
+void VectorDistances(const float* u, const float* const* vs, size_t num, size_t dims,
+                     VectorSimilarity sim, float* out) {
+  size_t i = 0;
+  switch (sim) {
+    case VectorSimilarity::L2: {
+      for (; i + kBlock <= num; i += kBlock)
+        kKernels.l2_block(u, vs + i, dims, out + i, nullptr);
+      for (; i < num; i++)
+        kKernels.l2(u, vs + i, dims, out + i, nullptr);
+      for (i = 0; i < num; i++)
+        out[i] = sqrt(out[i]);
+      break;
+    }
+    case VectorSimilarity::COSINE: {
+      // TODO: Normalize vectors ahead if cosine distance is used
+      float uu = InnerProduct(u, u, dims);
+      float norms[kBlock];
+      for (; i + kBlock <= num; i += kBlock) {
+        kKernels.cosine_block(u, vs + i, dims, out + i, norms);
+        for (size_t j = 0; j < kBlock; j++)
+          out[i + j] = CosineDistance(uu, out[i + j], norms[j]);
+      }
+      for (; i < num; i++) {
+        kKernels.cosine(u, vs + i, dims, out + i, norms);
+        out[i] = CosineDistance(uu, out[i], norms[0]);
+      }
+      break;
+    }
+  };
+}
+
+float L2DistanceSquared(const float* u, const float* v, size_t dims) {
+  float sum;
+  kKernels.l2(u, &v, dims, &sum, nullptr);
+  return sum;
+}
+
+float InnerProduct(const float* u, const float* v, size_t dims) {
+  float sum;
+  kKernels.dot(u, &v, dims, &sum, nullptr);
+  return sum;
+}
+
+const char* VectorKernelsName() {
+  return kKernels.name;
+}
+
+VectorCodec::VectorCodec(size_t dims, VectorQuantization quantization)
+    : dims_{dims}, quantization_{quantization} {
+  DCHECK(quantization != VectorQuantization::NONE);
+}
+
+size_t VectorCodec::CodeSize() const {
+  size_t width = quantization_ == VectorQuantization::FP16 ? sizeof(uint16_t) : sizeof(int8_t);
+  return sizeof(Header) + dims_ * width;
+}
+
+void VectorCodec::Encode(const float* vec, char* code) const {
+  Header header{1.0f, 0.0f};
+  if (quantization_ == VectorQuantization::FP16) {
+    for (size_t i = 0; i < dims_; i++) {
+      uint16_t half = FloatToHalf(vec[i]);
+      float decoded = HalfToFloat(half);
+      header.sq_norm += decoded * decoded;
+      memcpy(code + sizeof(Header) + i * sizeof(half), &half, sizeof(half));
+    }
+  } else {
+    float max_abs = 0;
+    for (size_t i = 0; i < dims_; i++)
+      max_abs = max(max_abs, fabs(vec[i]));
+    header.scale = max_abs / 127;
+
+    int32_t sq_sum = 0;
+    auto* codes = reinterpret_cast<int8_t*>(code + sizeof(Header));
+    for (size_t i = 0; i < dims_; i++) {
+      float scaled = header.scale > 0 ? round(vec[i] / header.scale) : 0.0f;
+      codes[i] = int8_t(clamp(scaled, -127.0f, 127.0f));
+      sq_sum += int32_t(codes[i]) * codes[i];
+    }
+    header.sq_norm = header.scale * header.scale * sq_sum;
+  }
+  memcpy(code, &header, sizeof(Header));
+}
+
+VectorCodec::Header VectorCodec::ReadHeader(const char* code) {
+  Header header;
+  memcpy(&header, code, sizeof(Header));
+  return header;
+}
+
+float VectorCodec::InnerProduct(const char* u, const char* v) const {
+  const char *cu = u + sizeof(Header), *cv = v + sizeof(Header);
+  if (quantization_ == VectorQuantization::FP16) {
+    return kKernels.dot_half(reinterpret_cast<const uint16_t*>(cu),
+                             reinterpret_cast<const uint16_t*>(cv), dims_);
+  }
+
+  int32_t dot = kKernels.dot_int8(reinterpret_cast<const int8_t*>(cu),
+                                  reinterpret_cast<const int8_t*>(cv), dims_);
+  return ReadHeader(u).scale * ReadHeader(v).scale * dot;
+}
+
+float VectorCodec::L2DistanceSquared(const char* u, const char* v) const {
+  float sq_dist = ReadHeader(u).sq_norm + ReadHeader(v).sq_norm - 2 * InnerProduct(u, v);
+  return max(sq_dist, 0.0f);  // rounding can make it slightly negative for close vectors
+}
+
+float VectorCodec::Distance(const char* u, const char* v, VectorSimilarity sim) const {
   switch (sim) {
     case VectorSimilarity::L2:
-      return L2Distance(u, v, dims);
+      return sqrt(L2DistanceSquared(u, v));
     case VectorSimilarity::COSINE:
-      return CosineDistance(u, v, dims);
-  };
+      return CosineDistance(ReadHeader(u).sq_norm, InnerProduct(u, v), ReadHeader(v).sq_norm);
+  }
   return 0.0f;
 }
 
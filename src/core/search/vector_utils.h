@@ -10,6 +10,53 @@ namespace dfly::search {
 
 OwnedFtVector BytesToFtVector(std::string_view value);
 
+// Distances are computed by kernels selected at startup based on cpu capabilities: AVX-512,
+// AVX2 with FMA or NEON, with a scalar fallback.
 float VectorDistance(const float* u, const float* v, size_t dims, VectorSimilarity sim);
 
+// Computes the distances of u to vs[0, num) into out. Vectors are processed in blocks that share
+// the loads of u, which is faster than computing the distances one by one.
+void VectorDistances(const float* u, const float* const* vs, size_t num, size_t dims,
+                     VectorSimilarity sim, float* out);
+
+// Squared euclidean distance and inner product, as used for hnsw search
+float L2DistanceSquared(const float* u, const float* v, size_t dims);
+float InnerProduct(const float* u, const float* v, size_t dims);
+
+// Name of the selected kernels: avx512, avx2, neon or scalar
+const char* VectorKernelsName();
+
+// Encodes vectors in a compact format and computes distances between encoded vectors. Codes
+// start with a header holding the scale and the squared norm of the decoded vector, so that all
+// distances are derived from a single dot product of the codes.
+// FP16 stores halves. INT8 stores values linearly scaled by max |x| / 127 per vector, so that
+// precision adapts to every vector but is lost for components much smaller than the largest one.
+class VectorCodec {
+ public:
+  VectorCodec(size_t dims, VectorQuantization quantization);
+
+  // Size of encoded vector in bytes
+  size_t CodeSize() const;
+
+  // Write encoded vector of CodeSize() bytes into code. The code buffer doesn't need to be aligned
+  void Encode(const float* vec, char* code) const;
+
+  float InnerProduct(const char* u, const char* v) const;
+  float L2DistanceSquared(const char* u, const char* v) const;
+
+  // Same semantics as VectorDistance
+  float Distance(const char* u, const char* v, VectorSimilarity sim) const;
+
+ private:
+  struct Header {
+    float scale;
+    float sq_norm;
+  };
+
+  static Header ReadHeader(const char* code);
+
+  size_t dims_;
+  VectorQuantization quantization_;
+};
+
 }  // namespace dfly::search
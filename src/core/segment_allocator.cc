@@ -3,6 +3,7 @@
 //
 #include "core/segment_allocator.h"
 
+#include <absl/base/internal/spinlock.h>
 #include <mimalloc/types.h>
 
 #include "base/logging.h"
@@ -11,6 +12,26 @@ constexpr size_t kSegmentShift = MI_SEGMENT_SHIFT;
 
 namespace dfly {
 
+namespace {
+
+// CanAllocate is checked before the allocation, so every thread may register one segment after
+// the check passed. We keep enough ids in reserve for that.
+constexpr uint32_t kReservedSegments = 256;
+
+absl::base_internal::SpinLock table_mu(absl::kConstInit,
+                                       absl::base_internal::SCHEDULE_KERNEL_ONLY);
+
+// Maps segment pointers to their ids in the global table, guarded by table_mu.
+absl::flat_hash_map<uint64_t, uint16_t>& GlobalRevIndex() {
+  static auto* index = new absl::flat_hash_map<uint64_t, uint16_t>;
+  return *index;
+}
+
+}  // namespace
+
+std::atomic<uint8_t*> SegmentAllocator::address_table_[1u << kSegmentIdBits];
+std::atomic_uint32_t SegmentAllocator::num_segments_{0};
+
 SegmentAllocator::SegmentAllocator(mi_heap_t* heap) : heap_(heap) {
   // mimalloc uses 4MiB segments and we might need change this code if it changes.
   constexpr size_t kSegLogSpan = 32 - kSegmentIdBits + 3;
@@ -18,16 +39,33 @@ SegmentAllocator::SegmentAllocator(mi_heap_t* heap) : heap_(heap) {
   static_assert((~kSegmentAlignMask) == (MI_SEGMENT_SIZE - 1));
 }
 
-void SegmentAllocator::ValidateMapSize() {
-  if (address_table_.size() > (1u << kSegmentIdBits)) {
-    // This can happen if we restrict dragonfly to small number of threads on high-memory machine,
-    // for example.
-    LOG(WARNING) << "address_table_ map is growing too large: " << address_table_.size();
+uint16_t SegmentAllocator::RegisterSegment(uint64_t seg_ptr) {
+  uint16_t seg_id;
+  {
+    absl::base_internal::SpinLockHolder lk(&table_mu);
+    uint32_t num = num_segments_.load(std::memory_order_relaxed);
+    auto [it, inserted] = GlobalRevIndex().emplace(seg_ptr, num);
+    if (inserted) {
+      // Can only happen if CanAllocate was not checked before allocating.
+      CHECK_LT(num, 1u << kSegmentIdBits) << "segment table is full";
+      address_table_[num].store((uint8_t*)seg_ptr, std::memory_order_release);
+      num_segments_.store(num + 1, std::memory_order_relaxed);
+      if (num + 1 == (1u << kSegmentIdBits) - kReservedSegments) {
+        // This can happen on high-memory machines, small strings use regular allocations from
+        // now on.
+        LOG(WARNING) << "Segment table is full: " << num + 1;
+      }
+    }
+    seg_id = it->second;
   }
+
+  rev_indx_.emplace(seg_ptr, seg_id);
+  return seg_id;
 }
 
 bool SegmentAllocator::CanAllocate() {
-  return address_table_.size() < (1u << kSegmentIdBits);
+  return num_segments_.load(std::memory_order_relaxed) <
+         (1u << kSegmentIdBits) - kReservedSegments;
 }
 
 }  // namespace dfly
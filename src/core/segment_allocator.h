@@ -6,6 +6,8 @@
 #include <absl/container/flat_hash_map.h>
 #include <mimalloc.h>
 
+#include <atomic>
+
 /***
  * This class is tightly coupled with mimalloc segment allocation logic and is designed to provide
  * a compact pointer representation (4bytes ptr) over 64bit address space that gives you
@@ -19,6 +21,8 @@ namespace dfly {
  * @brief Tightly coupled with mi_malloc 2.x implementation.
  *        Fetches 4MiB segment pointers from the allocated pointers.
  *        Provides own indexing of small pointers to real address space using the segment ptrs/
+ *        The segment table is global, so pointers allocated on one thread can be translated
+ *        on any other thread.
  */
 
 class SegmentAllocator {
@@ -34,8 +38,9 @@ class SegmentAllocator {
   SegmentAllocator(mi_heap_t* heap);
   bool CanAllocate();
 
-  uint8_t* Translate(Ptr p) const {
-    return address_table_[p & kSegmentIdMask] + Offset(p);
+  // Thread-safe. The table entries never change once published, so readers do not lock.
+  static uint8_t* Translate(Ptr p) {
+    return address_table_[p & kSegmentIdMask].load(std::memory_order_acquire) + Offset(p);
   }
 
   std::pair<Ptr, uint8_t*> Allocate(uint32_t size);
@@ -59,9 +64,13 @@ class SegmentAllocator {
     return (p >> kSegmentIdBits) * 8;
   }
 
-  void ValidateMapSize();
+  // Returns the id of the segment in the global table, adding it if needed.
+  uint16_t RegisterSegment(uint64_t seg_ptr);
+
+  static std::atomic<uint8_t*> address_table_[1u << kSegmentIdBits];
+  static std::atomic_uint32_t num_segments_;
 
-  std::vector<uint8_t*> address_table_;
+  // Thread local cache of the global reverse index, so that allocations do not lock.
   absl::flat_hash_map<uint64_t, uint16_t> rev_indx_;
   mi_heap_t* heap_;
   size_t used_ = 0;
@@ -76,14 +85,11 @@ inline auto SegmentAllocator::Allocate(uint32_t size) -> std::pair<Ptr, uint8_t*
   uint64_t seg_ptr = iptr & kSegmentAlignMask;
 
   // could be speed up using last used seg_ptr.
-  auto [it, inserted] = rev_indx_.emplace(seg_ptr, address_table_.size());
-  if (inserted) {
-    ValidateMapSize();
-    address_table_.push_back((uint8_t*)seg_ptr);
-  }
+  auto it = rev_indx_.find(seg_ptr);
+  uint16_t seg_id = it != rev_indx_.end() ? it->second : RegisterSegment(seg_ptr);
 
   uint32_t seg_offset = (iptr - seg_ptr) / 8;
-  Ptr res = (seg_offset << kSegmentIdBits) | it->second;
+  Ptr res = (seg_offset << kSegmentIdBits) | seg_id;
   used_ += mi_good_size(size);
 
   return std::make_pair(res, (uint8_t*)ptr);
@@ -0,0 +1,242 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/segment_arena.h"
+
+#include <absl/strings/ascii.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+#include <fstream>
+
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+constexpr size_t kCacheLine = 64;
+
+}  // namespace
+
+// Occupies the first cache line of each region, blocks follow it.
+struct SegmentArena::Region {
+  Region* prev = nullptr;
+  Region* next = nullptr;
+  void* free_list = nullptr;  // Blocks that were returned to the region.
+  unsigned used = 0;
+  unsigned untouched = 0;  // Blocks [untouched, blocks_per_region_) were never handed out.
+  bool is_explicit = false;
+
+  uint8_t* Block(unsigned index, size_t stride) {
+    return reinterpret_cast<uint8_t*>(this) + kCacheLine + index * stride;
+  }
+};
+
+SegmentArena::SegmentArena(size_t block_size, Mode mode, PMR_NS::memory_resource* upstream)
+    : block_size_(block_size), mode_(mode), upstream_(upstream) {
+  static_assert(sizeof(Region) <= kCacheLine);
+
+  stride_ = (block_size + kCacheLine - 1) & ~(kCacheLine - 1);
+  blocks_per_region_ = (kRegionSize - kCacheLine) / stride_;
+  CHECK_GT(blocks_per_region_, 0u) << block_size;
+}
+
+SegmentArena::~SegmentArena() {
+  DCHECK_EQ(used_blocks_, 0u);
+
+  for (uintptr_t region : regions_) {
+    munmap(reinterpret_cast<void*>(region), kRegionSize);
+  }
+}
+
+auto SegmentArena::ReadHugePageMappings() -> vector<HugePageMapping> {
+  vector<HugePageMapping> res;
+  ifstream smaps("/proc/self/smaps");
+  if (!smaps) {
+    LOG_FIRST_N(ERROR, 1) << "Could not open /proc/self/smaps";
+    return res;
+  }
+
+  uint64_t start = 0, end = 0;
+  string line;
+  while (getline(smaps, line)) {
+    string_view sv = line;
+    if (absl::ConsumePrefix(&sv, "AnonHugePages:")) {
+      size_t kb = 0;
+      sv = absl::StripAsciiWhitespace(absl::StripSuffix(absl::StripAsciiWhitespace(sv), "kB"));
+      if (end > start && absl::SimpleAtoi(sv, &kb) && kb > 0)
+        res.push_back({start, end, kb * 1024});
+      continue;
+    }
+
+    // Mapping header, for example "7f2a4d000000-7f2a4d200000 rw-p 00000000 00:00 0".
+    vector<string_view> range = absl::StrSplit(sv.substr(0, sv.find(' ')), '-');
+    uint64_t s, e;
+    if (range.size() == 2 && absl::SimpleHexAtoi(range[0], &s) &&
+        absl::SimpleHexAtoi(range[1], &e)) {
+      start = s;
+      end = e;
+    }
+  }
+
+  // The kernel lists the mappings in address order, sort anyway as HugePageBytes relies on it.
+  sort(res.begin(), res.end(), [](const auto& a, const auto& b) { return a.start < b.start; });
+  return res;
+}
+
+size_t SegmentArena::HugePageBytes(const vector<HugePageMapping>& mappings) const {
+  size_t res = explicit_regions_ * kRegionSize;
+  if (!has_transparent_regions() || mappings.empty())
+    return res;
+
+  // Transparent regions may be merged into larger mappings by the kernel, so attribute to us
+  // the huge pages of every mapping that contains our regions, capped by their size.
+  vector<size_t> overlap(mappings.size());
+  for (uintptr_t region : regions_) {
+    if (reinterpret_cast<Region*>(region)->is_explicit)
+      continue;
+
+    auto it = upper_bound(mappings.begin(), mappings.end(), region,
+                          [](uintptr_t addr, const auto& m) { return addr < m.start; });
+    if (it != mappings.begin() && region < prev(it)->end)
+      overlap[prev(it) - mappings.begin()] += kRegionSize;
+  }
+
+  for (size_t i = 0; i < mappings.size(); ++i)
+    res += min(mappings[i].huge_bytes, overlap[i]);
+  return res;
+}
+
+void* SegmentArena::do_allocate(size_t size, size_t align) {
+  if (size != block_size_ || align > kCacheLine)
+    return upstream_->allocate(size, align);
+
+  Region* region = partial_;
+  if (!region) {
+    if (spare_) {
+      region = exchange(spare_, nullptr);
+    } else {
+      region = MapRegion();
+      if (!region)
+        return upstream_->allocate(size, align);
+    }
+    LinkPartial(region);
+  }
+
+  void* res = region->free_list;
+  if (res) {
+    region->free_list = *reinterpret_cast<void**>(res);
+  } else {
+    DCHECK_LT(region->untouched, blocks_per_region_);
+    res = region->Block(region->untouched++, stride_);
+  }
+
+  if (++region->used == blocks_per_region_)
+    UnlinkPartial(region);
+  ++used_blocks_;
+
+  return res;
+}
+
+void SegmentArena::do_deallocate(void* ptr, size_t size, size_t align) {
+  uintptr_t base = reinterpret_cast<uintptr_t>(ptr) & ~(kRegionSize - 1);
+  if (size != block_size_ || align > kCacheLine || !regions_.contains(base)) {
+    upstream_->deallocate(ptr, size, align);
+    return;
+  }
+
+  Region* region = reinterpret_cast<Region*>(base);
+  DCHECK_GT(region->used, 0u);
+  if (region->used == blocks_per_region_)
+    LinkPartial(region);
+
+  *reinterpret_cast<void**>(ptr) = region->free_list;
+  region->free_list = ptr;
+  --used_blocks_;
+
+  if (--region->used > 0)
+    return;
+
+  UnlinkPartial(region);
+  if (spare_) {
+    UnmapRegion(region);
+  } else {
+    region->free_list = nullptr;
+    region->untouched = 0;
+    spare_ = region;
+  }
+}
+
+auto SegmentArena::MapRegion() -> Region* {
+  void* ptr = MAP_FAILED;
+  bool is_explicit = false;
+
+  if (mode_ == Mode::kExplicit) {
+    ptr = mmap(nullptr, kRegionSize, PROT_READ | PROT_WRITE,
+               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+    is_explicit = ptr != MAP_FAILED;
+    LOG_IF_EVERY_N(WARNING, !is_explicit, 1000)
+        << "Could not map explicit huge pages, falling back to transparent ones";
+  }
+
+  if (ptr == MAP_FAILED) {
+    // Over-map to align the region on a huge page boundary.
+    void* raw = mmap(nullptr, kRegionSize * 2, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+                     -1, 0);
+    if (raw == MAP_FAILED) {
+      LOG_EVERY_N(ERROR, 1000) << "Could not map arena region: " << strerror(errno);
+      return nullptr;
+    }
+
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = (start + kRegionSize - 1) & ~(kRegionSize - 1);
+    if (aligned != start)
+      munmap(raw, aligned - start);
+    if (size_t tail = start + kRegionSize - aligned; tail > 0)
+      munmap(reinterpret_cast<void*>(aligned + kRegionSize), tail);
+
+    ptr = reinterpret_cast<void*>(aligned);
+    madvise(ptr, kRegionSize, MADV_HUGEPAGE);
+  }
+
+  regions_.insert(reinterpret_cast<uintptr_t>(ptr));
+  explicit_regions_ += is_explicit;
+
+  Region* region = new (ptr) Region{};
+  region->is_explicit = is_explicit;
+  return region;
+}
+
+void SegmentArena::UnmapRegion(Region* region) {
+  explicit_regions_ -= region->is_explicit;
+  regions_.erase(reinterpret_cast<uintptr_t>(region));
+  munmap(region, kRegionSize);
+}
+
+void SegmentArena::LinkPartial(Region* region) {
+  region->prev = nullptr;
+  region->next = partial_;
+  if (partial_)
+    partial_->prev = region;
+  partial_ = region;
+}
+
+void SegmentArena::UnlinkPartial(Region* region) {
+  if (region->prev)
+    region->prev->next = region->next;
+  else
+    partial_ = region->next;
+
+  if (region->next)
+    region->next->prev = region->prev;
+  region->prev = region->next = nullptr;
+}
+
+}  // namespace dfly
@@ -0,0 +1,96 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/container/flat_hash_set.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "base/pmr/memory_resource.h"
+
+namespace dfly {
+
+// Memory resource that serves allocations of a single size - dash table segments - from
+// 2MB regions backed by huge pages in order to reduce TLB misses when accessing segments.
+// All other allocations are forwarded to the upstream resource.
+// Not thread-safe, meant to be used per shard.
+class SegmentArena : public PMR_NS::memory_resource {
+ public:
+  static constexpr size_t kRegionSize = 1 << 21;
+
+  enum class Mode : uint8_t {
+    kTransparent,  // madvise(MADV_HUGEPAGE), relies on transparent huge pages being enabled.
+    kExplicit,     // MAP_HUGETLB, falls back to kTransparent when no huge pages are reserved.
+  };
+
+  SegmentArena(size_t block_size, Mode mode, PMR_NS::memory_resource* upstream);
+  ~SegmentArena();
+
+  size_t block_size() const {
+    return block_size_;
+  }
+
+  // Bytes mapped for regions, including free blocks.
+  size_t mapped_bytes() const {
+    return regions_.size() * kRegionSize;
+  }
+
+  // Bytes of the blocks handed out by the arena.
+  size_t used_bytes() const {
+    return used_blocks_ * block_size_;
+  }
+
+  // Whether some regions rely on transparent huge pages, i.e. HugePageBytes needs the mappings.
+  bool has_transparent_regions() const {
+    return regions_.size() > explicit_regions_;
+  }
+
+  // A mapping of the process that has transparent huge pages.
+  struct HugePageMapping {
+    uintptr_t start, end;
+    size_t huge_bytes;
+  };
+
+  // Parses /proc/self/smaps into its mappings with transparent huge pages, sorted by address.
+  // Does blocking file I/O, so it should be called once for all arenas and not on hot paths.
+  static std::vector<HugePageMapping> ReadHugePageMappings();
+
+  // Returns how many of the mapped bytes are backed by huge pages, according to mappings
+  // returned by ReadHugePageMappings.
+  size_t HugePageBytes(const std::vector<HugePageMapping>& mappings) const;
+
+ private:
+  struct Region;
+
+  void* do_allocate(std::size_t size, std::size_t align) final;
+  void do_deallocate(void* ptr, std::size_t size, std::size_t align) final;
+
+  bool do_is_equal(const PMR_NS::memory_resource& o) const noexcept final {
+    return this == &o;
+  }
+
+  Region* MapRegion();
+  void UnmapRegion(Region* region);
+
+  void LinkPartial(Region* region);
+  void UnlinkPartial(Region* region);
+
+  size_t block_size_;
+  size_t stride_;  // block_size_ rounded up to a cache line.
+  unsigned blocks_per_region_;
+  Mode mode_;
+  PMR_NS::memory_resource* upstream_;
+
+  Region* partial_ = nullptr;  // Regions with free blocks.
+  Region* spare_ = nullptr;    // An empty region kept mapped to avoid remapping churn.
+
+  absl::flat_hash_set<uintptr_t> regions_;
+  size_t explicit_regions_ = 0;
+  size_t used_blocks_ = 0;
+};
+
+}  // namespace dfly
@@ -0,0 +1,99 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/segment_arena.h"
+
+#include "base/gtest.h"
+#include "base/hash.h"
+#include "base/logging.h"
+#include "core/dash.h"
+
+namespace dfly {
+
+using namespace std;
+
+class SegmentArenaTest : public ::testing::Test {
+ protected:
+  static constexpr size_t kBlockSize = 9000;
+
+  SegmentArenaTest()
+      : arena_(kBlockSize, SegmentArena::Mode::kTransparent, PMR_NS::new_delete_resource()) {
+  }
+
+  SegmentArena arena_;
+};
+
+TEST_F(SegmentArenaTest, Forward) {
+  void* ptr = arena_.allocate(100, 8);
+  EXPECT_EQ(0, arena_.mapped_bytes());
+  EXPECT_EQ(0, arena_.used_bytes());
+  arena_.deallocate(ptr, 100, 8);
+}
+
+TEST_F(SegmentArenaTest, Regions) {
+  constexpr size_t kNumBlocks = 1000;
+  vector<void*> blocks(kNumBlocks);
+  for (auto& ptr : blocks) {
+    ptr = arena_.allocate(kBlockSize, 8);
+    memset(ptr, 0xFF, kBlockSize);
+    EXPECT_EQ(0, reinterpret_cast<uintptr_t>(ptr) % 64);
+  }
+
+  EXPECT_EQ(kNumBlocks * kBlockSize, arena_.used_bytes());
+  EXPECT_GE(arena_.mapped_bytes(), arena_.used_bytes());
+  EXPECT_EQ(0, arena_.mapped_bytes() % SegmentArena::kRegionSize);
+  EXPECT_LE(arena_.HugePageBytes(SegmentArena::ReadHugePageMappings()), arena_.mapped_bytes());
+
+  sort(blocks.begin(), blocks.end());
+  for (size_t i = 1; i < blocks.size(); ++i) {
+    ASSERT_GE(reinterpret_cast<uint8_t*>(blocks[i]) - reinterpret_cast<uint8_t*>(blocks[i - 1]),
+              kBlockSize);
+  }
+
+  // Freed blocks are reused before mapping new regions.
+  size_t mapped = arena_.mapped_bytes();
+  for (size_t i = 0; i < kNumBlocks; i += 2) {
+    arena_.deallocate(blocks[i], kBlockSize, 8);
+  }
+  for (size_t i = 0; i < kNumBlocks; i += 2) {
+    blocks[i] = arena_.allocate(kBlockSize, 8);
+  }
+  EXPECT_EQ(mapped, arena_.mapped_bytes());
+
+  // A single empty region is kept mapped.
+  for (void* ptr : blocks) {
+    arena_.deallocate(ptr, kBlockSize, 8);
+  }
+  EXPECT_EQ(0, arena_.used_bytes());
+  EXPECT_EQ(SegmentArena::kRegionSize, arena_.mapped_bytes());
+}
+
+struct UInt64Policy : public BasicDashPolicy {
+  static uint64_t HashFn(uint64_t v) {
+    return XXH3_64bits(&v, sizeof(v));
+  }
+};
+
+TEST_F(SegmentArenaTest, DashTable) {
+  using Dash64 = DashTable<uint64_t, uint64_t, UInt64Policy>;
+  SegmentArena arena(sizeof(Dash64::Segment_t), SegmentArena::Mode::kTransparent,
+                     PMR_NS::new_delete_resource());
+
+  {
+    Dash64 dt(1, UInt64Policy{}, &arena);
+    for (uint64_t i = 0; i < 100000; ++i) {
+      dt.Insert(i, i);
+    }
+    EXPECT_EQ(dt.unique_segments() * sizeof(Dash64::Segment_t), arena.used_bytes());
+
+    for (uint64_t i = 0; i < 100000; ++i) {
+      auto it = dt.Find(i);
+      ASSERT_FALSE(it.is_done());
+      ASSERT_EQ(i, it->second);
+    }
+  }
+  EXPECT_EQ(0, arena.used_bytes());
+}
+
+}  // namespace dfly
@@ -0,0 +1,216 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/small_set.h"
+
+#include <xxhash.h>
+
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+extern "C" {
+#include "redis/zmalloc.h"
+}
+
+#include "base/logging.h"
+#include "core/sse_port.h"
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+constexpr XXH64_hash_t kHashSeed = 0x9e3779b97f4a7c15ULL;
+constexpr size_t kMaxDataCap = UINT16_MAX;
+
+uint64_t Hash(string_view member) {
+  return XXH3_64bits_withSeed(member.data(), member.size(), kHashSeed);
+}
+
+uint8_t Fingerprint(uint64_t hash) {
+  return 0x80 | (hash & 0x7F);
+}
+
+// Bitmask of the slots of the group whose control byte equals val.
+uint32_t MatchGroup(const uint8_t* group, uint8_t val) {
+#ifdef __s390x__
+  uint32_t mask = 0;
+  for (unsigned i = 0; i < SmallSet::kGroupSize; ++i)
+    mask |= uint32_t(group[i] == val) << i;
+  return mask;
+#else
+  __m128i ctrl = mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+  return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(val)));
+#endif
+}
+
+// Bitmask of the slots of the group that hold members, their control bytes have the high bit.
+uint32_t MatchFull(const uint8_t* group) {
+#ifdef __s390x__
+  uint32_t mask = 0;
+  for (unsigned i = 0; i < SmallSet::kGroupSize; ++i)
+    mask |= uint32_t(group[i] >> 7) << i;
+  return mask;
+#else
+  return _mm_movemask_epi8(mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+#endif
+}
+
+// Slots for size members, so that at most 7/8 of them are used.
+unsigned CapacityFor(unsigned size) {
+  unsigned capacity = SmallSet::kGroupSize;
+  while (capacity * 7 / 8 < size)
+    capacity *= 2;
+  return capacity;
+}
+
+}  // namespace
+
+SmallSet* SmallSet::Allocate(unsigned capacity, size_t data_cap) {
+  size_t header = sizeof(SmallSet) + capacity * (1 + sizeof(uint16_t));
+  size_t usable = 0;
+  void* ptr = zmalloc_usable(header + data_cap, &usable);
+
+  SmallSet* ss = new (ptr) SmallSet;
+  ss->capacity_ = capacity;
+  ss->data_cap_ = min(usable - header, kMaxDataCap);  // use the slack of the allocation
+  memset(ss->Ctrl(), kEmpty, capacity);
+  return ss;
+}
+
+SmallSet* SmallSet::Create(unsigned reserve, size_t member_bytes) {
+  DCHECK_LE(reserve, kMaxSize);
+  return Allocate(CapacityFor(reserve), min(member_bytes + reserve, kMaxDataCap));
+}
+
+void SmallSet::Free(SmallSet* ss) {
+  zfree(ss);
+}
+
+SmallSet* SmallSet::Rehash(SmallSet* ss, unsigned capacity) {
+  SmallSet* res = Allocate(capacity, ss->data_cap_);
+
+  // Members keep their offsets, only their slots change.
+  memcpy(res->Data(), ss->Data(), ss->data_len_);
+  res->data_len_ = ss->data_len_;
+  ss->Iterate([&](string_view member) {
+    uint64_t hash = Hash(member);
+    unsigned slot = res->FindFree(hash);
+    res->Ctrl()[slot] = Fingerprint(hash);
+    res->Offsets()[slot] = reinterpret_cast<const uint8_t*>(member.data()) - 1 - ss->Data();
+    return true;
+  });
+  res->size_ = res->used_ = ss->size_;
+
+  Free(ss);
+  return res;
+}
+
+int SmallSet::Find(string_view member, uint64_t hash) const {
+  uint8_t fp = Fingerprint(hash);
+  unsigned group_mask = capacity_ / kGroupSize - 1;
+  const uint8_t* ctrl = Ctrl();
+
+  // Since some slots are always empty, the probe stops at the first group with an empty slot.
+  for (unsigned g = (hash >> 7) & group_mask;; g = (g + 1) & group_mask) {
+    const uint8_t* group = ctrl + g * kGroupSize;
+    for (uint32_t match = MatchGroup(group, fp); match; match &= match - 1) {
+      unsigned slot = g * kGroupSize + __builtin_ctz(match);
+      if (MemberAt(Offsets()[slot]) == member)
+        return slot;
+    }
+    if (MatchGroup(group, kEmpty))
+      return -1;
+  }
+}
+
+unsigned SmallSet::FindFree(uint64_t hash) const {
+  unsigned group_mask = capacity_ / kGroupSize - 1;
+  for (unsigned g = (hash >> 7) & group_mask;; g = (g + 1) & group_mask) {
+    uint32_t free_slots = ~MatchFull(Ctrl() + g * kGroupSize) & ((1u << kGroupSize) - 1);
+    if (free_slots)
+      return g * kGroupSize + __builtin_ctz(free_slots);
+  }
+}
+
+SmallSet* SmallSet::Add(SmallSet* ss, string_view member, bool* added) {
+  DCHECK_LE(member.size(), kMaxMemberLen);
+
+  uint64_t hash = Hash(member);
+  *added = ss->Find(member, hash) < 0;
+  if (!*added)
+    return ss;
+
+  DCHECK_LT(ss->size_, kMaxSize);
+
+  // Rebuild the slots once they fill up, they grow unless most of them were erased.
+  if ((ss->used_ + 1u) * 8 > ss->capacity_ * 7u)
+    ss = Rehash(ss, CapacityFor(ss->size_ + 1));
+
+  // The member area is at the end of the blob, so that it grows without moving members.
+  size_t need = member.size() + 1;
+  if (ss->data_len_ + need > ss->data_cap_) {
+    size_t header = sizeof(SmallSet) + ss->capacity_ * (1 + sizeof(uint16_t));
+    size_t data_cap = min(max(ss->data_len_ + need, size_t(ss->data_cap_) * 3 / 2), kMaxDataCap);
+    DCHECK_LE(ss->data_len_ + need, data_cap);
+
+    size_t usable = 0;
+    ss = reinterpret_cast<SmallSet*>(zrealloc_usable(ss, header + data_cap, &usable));
+    ss->data_cap_ = min(usable - header, kMaxDataCap);
+  }
+
+  unsigned slot = ss->FindFree(hash);
+  uint8_t* ctrl = ss->Ctrl();
+  ss->used_ += ctrl[slot] == kEmpty;
+  ctrl[slot] = Fingerprint(hash);
+  ss->Offsets()[slot] = ss->data_len_;
+
+  uint8_t* dest = ss->Data() + ss->data_len_;
+  dest[0] = member.size();
+  memcpy(dest + 1, member.data(), member.size());
+  ss->data_len_ += need;
+  ++ss->size_;
+  return ss;
+}
+
+bool SmallSet::Erase(string_view member) {
+  int slot = Find(member, Hash(member));
+  if (slot < 0)
+    return false;
+
+  // No probe went past a group with an empty slot, so the slot can become empty as well.
+  uint8_t* ctrl = Ctrl();
+  if (MatchGroup(ctrl + slot / kGroupSize * kGroupSize, kEmpty)) {
+    ctrl[slot] = kEmpty;
+    --used_;
+  } else {
+    ctrl[slot] = kErased;
+  }
+  --size_;
+
+  // Keep the members packed, shifting the ones that followed the erased member.
+  uint16_t offset = Offsets()[slot];
+  size_t len = member.size() + 1;
+  memmove(Data() + offset, Data() + offset + len, data_len_ - offset - len);
+  data_len_ -= len;
+
+  uint16_t* offsets = Offsets();
+  for (unsigned i = 0; i < capacity_; ++i) {
+    if ((ctrl[i] & kFull) && offsets[i] > offset)
+      offsets[i] -= len;
+  }
+  return true;
+}
+
+bool SmallSet::Contains(string_view member) const {
+  return Find(member, Hash(member)) >= 0;
+}
+
+size_t SmallSet::BlobLen() const {
+  return sizeof(SmallSet) + capacity_ * (1 + sizeof(uint16_t)) + data_cap_;
+}
+
+}  // namespace dfly
@@ -0,0 +1,124 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <string_view>
+
+namespace dfly {
+
+// Open addressing set of a few short strings packed into a single zmalloc-ed blob, for the sets
+// that are too small to pay the buckets and the per member allocations of StringSet.
+// Probing follows SwissTable: slots are split into groups of 16 and each slot has a control
+// byte holding 7 bits of the member hash, so that a lookup matches a whole group with a single
+// SIMD compare and reads only the members whose fingerprint matched.
+//
+// The blob is laid out as: header, control byte per slot, offset of the member per slot, and the
+// members, each one a length byte followed by its bytes. Members are not rehashed when the
+// member area grows, only the slots are rebuilt once they fill up.
+class SmallSet {
+ public:
+  static constexpr unsigned kGroupSize = 16;
+  static constexpr size_t kMaxMemberLen = 128;
+  static constexpr unsigned kMaxSize = 448;  // 512 slots at the maximal load
+
+  SmallSet(const SmallSet&) = delete;
+  SmallSet& operator=(const SmallSet&) = delete;
+
+  // Returns an empty set with room for reserve members of member_bytes bytes in total.
+  static SmallSet* Create(unsigned reserve = 0, size_t member_bytes = 0);
+  static void Free(SmallSet* ss);
+
+  // Adds member unless it is present, sets added accordingly. Returns the set, which moves when
+  // its blob grows. member must be at most kMaxMemberLen bytes long, and the set must have
+  // less than kMaxSize members.
+  static SmallSet* Add(SmallSet* ss, std::string_view member, bool* added);
+
+  // Returns true if member was erased. The blob is not reallocated.
+  bool Erase(std::string_view member);
+
+  bool Contains(std::string_view member) const;
+
+  uint32_t Size() const {
+    return size_;
+  }
+
+  bool Empty() const {
+    return size_ == 0;
+  }
+
+  // Bytes of the blob.
+  size_t BlobLen() const;
+
+  // Calls cb with each member, in no particular order, until it returns false. Returns false
+  // if the iteration was stopped. The set must not change during the iteration.
+  template <typename F> bool Iterate(F&& cb) const {
+    const uint8_t* ctrl = Ctrl();
+    for (unsigned i = 0; i < capacity_; ++i) {
+      if ((ctrl[i] & kFull) && !cb(MemberAt(Offsets()[i])))
+        return false;
+    }
+    return true;
+  }
+
+ private:
+  static constexpr uint8_t kEmpty = 0;
+  static constexpr uint8_t kErased = 1;
+  static constexpr uint8_t kFull = 0x80;
+
+  SmallSet() = default;
+
+  // Allocates an empty blob with the given number of slots and bytes for members.
+  static SmallSet* Allocate(unsigned capacity, size_t data_cap);
+
+  // Moves the members into a blob with the given number of slots, dropping erased ones.
+  static SmallSet* Rehash(SmallSet* ss, unsigned capacity);
+
+  uint8_t* Ctrl() {
+    return reinterpret_cast<uint8_t*>(this + 1);
+  }
+
+  const uint8_t* Ctrl() const {
+    return reinterpret_cast<const uint8_t*>(this + 1);
+  }
+
+  uint16_t* Offsets() {
+    return reinterpret_cast<uint16_t*>(Ctrl() + capacity_);
+  }
+
+  const uint16_t* Offsets() const {
+    return reinterpret_cast<const uint16_t*>(Ctrl() + capacity_);
+  }
+
+  uint8_t* Data() {
+    return reinterpret_cast<uint8_t*>(Offsets() + capacity_);
+  }
+
+  const uint8_t* Data() const {
+    return reinterpret_cast<const uint8_t*>(Offsets() + capacity_);
+  }
+
+  std::string_view MemberAt(uint16_t offset) const {
+    const uint8_t* ptr = Data() + offset;
+    return {reinterpret_cast<const char*>(ptr + 1), ptr[0]};
+  }
+
+  // Returns the slot of member or -1 if it is missing.
+  int Find(std::string_view member, uint64_t hash) const;
+
+  // Returns a slot for a new member with the given hash, either empty or erased.
+  unsigned FindFree(uint64_t hash) const;
+
+  uint16_t size_ = 0;      // members
+  uint16_t used_ = 0;      // slots that are not empty, including erased ones
+  uint16_t capacity_ = 0;  // slots, a power of 2 multiple of kGroupSize
+  uint16_t data_len_ = 0;  // bytes of the members
+  uint16_t data_cap_ = 0;  // bytes allocated for the members
+  uint16_t reserved_ = 0;
+};
+
+static_assert(sizeof(SmallSet) == 12);
+
+}  // namespace dfly
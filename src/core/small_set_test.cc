@@ -0,0 +1,114 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/small_set.h"
+
+#include <absl/container/flat_hash_set.h>
+#include <absl/strings/str_cat.h>
+#include <gmock/gmock.h>
+#include <mimalloc.h>
+
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+extern "C" {
+#include "redis/zmalloc.h"
+}
+
+namespace dfly {
+
+using namespace std;
+using absl::StrCat;
+using testing::UnorderedElementsAre;
+
+class SmallSetTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    auto* tlh = mi_heap_get_backing();
+    init_zmalloc_threadlocal(tlh);
+  }
+
+  void SetUp() override {
+    ss_ = SmallSet::Create();
+  }
+
+  void TearDown() override {
+    SmallSet::Free(ss_);
+  }
+
+  bool Add(string_view member) {
+    bool added = false;
+    ss_ = SmallSet::Add(ss_, member, &added);
+    return added;
+  }
+
+  vector<string> Members() const {
+    vector<string> res;
+    ss_->Iterate([&](string_view member) {
+      res.emplace_back(member);
+      return true;
+    });
+    return res;
+  }
+
+  SmallSet* ss_ = nullptr;
+};
+
+TEST_F(SmallSetTest, Basic) {
+  EXPECT_TRUE(ss_->Empty());
+  EXPECT_TRUE(Add("foo"));
+  EXPECT_TRUE(Add("bar"));
+  EXPECT_TRUE(Add(""));
+  EXPECT_FALSE(Add("foo"));
+  EXPECT_EQ(3, ss_->Size());
+
+  EXPECT_TRUE(ss_->Contains("bar"));
+  EXPECT_TRUE(ss_->Contains(""));
+  EXPECT_FALSE(ss_->Contains("baz"));
+  EXPECT_THAT(Members(), UnorderedElementsAre("foo", "bar", ""));
+
+  EXPECT_TRUE(ss_->Erase("foo"));
+  EXPECT_FALSE(ss_->Erase("foo"));
+  EXPECT_FALSE(ss_->Contains("foo"));
+  EXPECT_THAT(Members(), UnorderedElementsAre("bar", ""));
+
+  string long_member(SmallSet::kMaxMemberLen, 'x');
+  EXPECT_TRUE(Add(long_member));
+  EXPECT_TRUE(ss_->Contains(long_member));
+  EXPECT_LE(ss_->BlobLen(), zmalloc_usable_size(ss_));
+}
+
+TEST_F(SmallSetTest, Grow) {
+  for (unsigned i = 0; i < SmallSet::kMaxSize; ++i)
+    ASSERT_TRUE(Add(StrCat("member:", i)));
+  EXPECT_EQ(SmallSet::kMaxSize, ss_->Size());
+
+  for (unsigned i = 0; i < SmallSet::kMaxSize; ++i)
+    ASSERT_TRUE(ss_->Contains(StrCat("member:", i))) << i;
+  EXPECT_FALSE(ss_->Contains("member:-1"));
+  EXPECT_EQ(SmallSet::kMaxSize, Members().size());
+}
+
+TEST_F(SmallSetTest, Random) {
+  // Erased slots are reused and reclaimed as members come and go.
+  absl::flat_hash_set<string> expected;
+  mt19937 rand(0);
+  for (unsigned i = 0; i < 20000; ++i) {
+    string member = StrCat(rand() % 300, string(rand() % 20, 'a'));
+    if (expected.size() < 200 && rand() % 2) {
+      ASSERT_EQ(expected.insert(member).second, Add(member));
+    } else {
+      ASSERT_EQ(expected.erase(member) > 0, ss_->Erase(member));
+    }
+    ASSERT_EQ(expected.size(), ss_->Size());
+  }
+
+  for (const string& member : expected)
+    EXPECT_TRUE(ss_->Contains(member));
+  EXPECT_EQ(expected.size(), Members().size());
+}
+
+}  // namespace dfly
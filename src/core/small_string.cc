@@ -68,7 +68,7 @@ size_t SmallString::Assign(std::string_view s) {
     realptr = rp;
     size_ = s.size();
   } else if (s.size() <= size_) {
-    realptr = tl.seg_alloc->Translate(small_ptr_);
+    realptr = SegmentAllocator::Translate(small_ptr_);
 
     if (s.size() < size_) {
       size_t capacity = mi_usable_size(realptr);
@@ -101,7 +101,7 @@ void SmallString::Free() {
 uint16_t SmallString::MallocUsed() const {
   if (size_ <= kPrefLen)
     return 0;
-  auto* realptr = tl.seg_alloc->Translate(small_ptr_);
+  auto* realptr = SegmentAllocator::Translate(small_ptr_);
 
   return mi_malloc_usable_size(realptr);
 }
@@ -118,7 +118,7 @@ bool SmallString::Equal(std::string_view o) const {
   if (memcmp(prefix_, o.data(), kPrefLen) != 0)
     return false;
 
-  uint8_t* realp = tl.seg_alloc->Translate(small_ptr_);
+  uint8_t* realp = SegmentAllocator::Translate(small_ptr_);
 
   return memcmp(realp, o.data() + kPrefLen, size_ - kPrefLen) == 0;
 }
@@ -143,6 +143,10 @@ uint64_t SmallString::HashCode() const {
   string_view slice[2];
 
   GetV(slice);
+
+  // Strings may be read from threads that did not call InitThreadLocal.
+  if (!tl.xxh_state)
+    tl.xxh_state.reset(XXH3_createState());
   XXH3_state_t* state = tl.xxh_state.get();
   XXH3_64bits_reset_withSeed(state, kHashSeed);
   XXH3_64bits_update(state, slice[0].data(), slice[0].size());
@@ -156,7 +160,7 @@ void SmallString::Get(std::string* dest) const {
   if (size_) {
     DCHECK_GT(size_, kPrefLen);
     memcpy(dest->data(), prefix_, kPrefLen);
-    uint8_t* ptr = tl.seg_alloc->Translate(small_ptr_);
+    uint8_t* ptr = SegmentAllocator::Translate(small_ptr_);
     memcpy(dest->data() + kPrefLen, ptr, size_ - kPrefLen);
   }
 }
@@ -169,7 +173,7 @@ unsigned SmallString::GetV(string_view dest[2]) const {
   }
 
   dest[0] = string_view{prefix_, kPrefLen};
-  uint8_t* ptr = tl.seg_alloc->Translate(small_ptr_);
+  uint8_t* ptr = SegmentAllocator::Translate(small_ptr_);
   dest[1] = string_view{reinterpret_cast<char*>(ptr), size_ - kPrefLen};
   return 2;
 }
@@ -180,7 +184,7 @@ bool SmallString::DefragIfNeeded(float ratio) {
     return false;
   }
 
-  uint8_t* cur_real_ptr = tl.seg_alloc->Translate(small_ptr_);
+  uint8_t* cur_real_ptr = SegmentAllocator::Translate(small_ptr_);
   if (!mi_heap_page_is_underutilized(tl.seg_alloc->heap(), cur_real_ptr, ratio))
     return false;
 
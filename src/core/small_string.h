@@ -14,6 +14,8 @@ namespace dfly {
 // for in-memory workloads, especially for keys.
 // Please note that this class does not have automatic constructors and destructors, therefore
 // it requires explicit management.
+// Strings are mutated on the thread that allocated them but const methods may be called from
+// any thread.
 class SmallString {
   static constexpr unsigned kPrefLen = 10;
   static constexpr unsigned kMaxSize = (1 << 8) - 1;
@@ -0,0 +1,203 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/sorted_intersect.h"
+
+extern "C" {
+#include "redis/endianconv.h"
+#include "redis/intset.h"
+}
+
+#include <algorithm>
+#include <cstring>
+
+#include "base/logging.h"
+#include "core/sse_port.h"
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+// Galloping is used when one of the inputs is at least that many times longer than the other.
+constexpr size_t kGallopRatio = 32;
+
+// Returns the first position in [from, n) whose item is not less than val or n if there is
+// none. Steps exponentially before bisecting, so that short distances are cheap to cover.
+template <typename Get> size_t GallopTo(const Get& get, size_t from, size_t n, int64_t val) {
+  size_t lo = from, hi = from, step = 1;
+  while (hi < n && get(hi) < val) {
+    lo = hi + 1;
+    hi += step;
+    step <<= 1;
+  }
+
+  hi = min(hi, n);
+  while (lo < hi) {
+    size_t mid = lo + (hi - lo) / 2;
+    if (get(mid) < val)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+// Searches every item of a in the nb items of the long input accessed by get.
+template <typename Get>
+size_t GallopIntersect(const int64_t* a, size_t na, const Get& get, size_t nb, int64_t* dest,
+                       size_t limit) {
+  size_t k = 0, pos = 0;
+  for (size_t i = 0; i < na && pos < nb; ++i) {
+    pos = GallopTo(get, pos, nb, a[i]);
+    if (pos < nb && get(pos) == a[i]) {
+      dest[k++] = a[i];
+      ++pos;
+      if (k == limit)
+        break;
+    }
+  }
+  return k;
+}
+
+size_t MergeScalar(const int64_t* a, size_t na, const int64_t* b, size_t nb, int64_t* dest,
+                   size_t limit, size_t i, size_t j, size_t k) {
+  while (i < na && j < nb) {
+    if (a[i] < b[j]) {
+      ++i;
+    } else if (b[j] < a[i]) {
+      ++j;
+    } else {
+      dest[k++] = a[i];
+      ++i;
+      ++j;
+      if (k == limit)
+        break;
+    }
+  }
+  return k;
+}
+
+#if defined(__x86_64__)
+
+// Compares blocks of 4 items of a with blocks of 4 items of b, all 16 pairs at once, and
+// advances the block with the smaller maximum.
+__attribute__((target("avx2"))) size_t MergeAvx2(const int64_t* a, size_t na, const int64_t* b,
+                                                 size_t nb, int64_t* dest, size_t limit) {
+  size_t i = 0, j = 0, k = 0;
+  while (i + 4 <= na && j + 4 <= nb && (limit == 0 || k + 4 <= limit)) {
+    __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+    __m256i eq = _mm256_cmpeq_epi64(va, vb);
+    for (unsigned r = 0; r < 3; ++r) {
+      vb = _mm256_permute4x64_epi64(vb, 0x39);  // rotate by one item.
+      eq = _mm256_or_si256(eq, _mm256_cmpeq_epi64(va, vb));
+    }
+    unsigned mask = _mm256_movemask_pd(_mm256_castsi256_pd(eq));
+
+    // Read the block maxima before writing to dest since it may alias a.
+    int64_t a_max = a[i + 3], b_max = b[j + 3];
+    while (mask) {
+      dest[k++] = a[i + __builtin_ctz(mask)];
+      mask &= mask - 1;
+    }
+
+    if (a_max <= b_max)
+      i += 4;
+    if (b_max <= a_max)
+      j += 4;
+  }
+
+  return MergeScalar(a, na, b, nb, dest, limit, i, j, k);
+}
+
+const bool kHasAvx2 = __builtin_cpu_supports("avx2");
+
+#endif
+
+template <typename T> int64_t IntsetAt(const intset* is, size_t index) {
+  T val;
+  memcpy(&val, is->contents + index * sizeof(T), sizeof(T));
+  if constexpr (sizeof(T) == sizeof(int16_t))
+    val = intrev16ifbe(val);
+  else if constexpr (sizeof(T) == sizeof(int32_t))
+    val = intrev32ifbe(val);
+  else
+    val = intrev64ifbe(val);
+  return val;
+}
+
+template <typename T> void DecodeTyped(const intset* is, size_t len, vector<int64_t>* dest) {
+  for (size_t i = 0; i < len; ++i)
+    dest->push_back(IntsetAt<T>(is, i));
+}
+
+template <typename T>
+size_t GallopIntset(int64_t* items, size_t num, const intset* is, size_t len, size_t limit) {
+  auto get = [is](size_t index) { return IntsetAt<T>(is, index); };
+  return GallopIntersect(items, num, get, len, items, limit);
+}
+
+}  // namespace
+
+size_t IntersectSorted(const int64_t* a, size_t na, const int64_t* b, size_t nb, int64_t* dest,
+                       size_t limit) {
+  if (na == 0 || nb == 0)
+    return 0;
+
+  if (na / kGallopRatio >= nb) {
+    auto get = [a](size_t index) { return a[index]; };
+    return GallopIntersect(b, nb, get, na, dest, limit);
+  }
+
+  if (nb / kGallopRatio >= na) {
+    auto get = [b](size_t index) { return b[index]; };
+    return GallopIntersect(a, na, get, nb, dest, limit);
+  }
+
+#if defined(__x86_64__)
+  if (kHasAvx2)
+    return MergeAvx2(a, na, b, nb, dest, limit);
+#endif
+  return MergeScalar(a, na, b, nb, dest, limit, 0, 0, 0);
+}
+
+void IntsetDecode(const intset* is, vector<int64_t>* dest) {
+  size_t len = intsetLen(is);
+  dest->reserve(dest->size() + len);
+
+  switch (intrev32ifbe(is->encoding)) {
+    case sizeof(int16_t):
+      return DecodeTyped<int16_t>(is, len, dest);
+    case sizeof(int32_t):
+      return DecodeTyped<int32_t>(is, len, dest);
+    default:
+      DCHECK_EQ(intrev32ifbe(is->encoding), sizeof(int64_t));
+      return DecodeTyped<int64_t>(is, len, dest);
+  }
+}
+
+size_t IntersectIntset(int64_t* items, size_t num, const intset* is, size_t limit) {
+  size_t len = intsetLen(is);
+  if (num == 0 || len == 0)
+    return 0;
+
+  if (len / kGallopRatio < num) {
+    vector<int64_t> members;
+    IntsetDecode(is, &members);
+    return IntersectSorted(items, num, members.data(), members.size(), items, limit);
+  }
+
+  switch (intrev32ifbe(is->encoding)) {
+    case sizeof(int16_t):
+      return GallopIntset<int16_t>(items, num, is, len, limit);
+    case sizeof(int32_t):
+      return GallopIntset<int32_t>(items, num, is, len, limit);
+    default:
+      return GallopIntset<int64_t>(items, num, is, len, limit);
+  }
+}
+
+}  // namespace dfly
@@ -0,0 +1,29 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+typedef struct intset intset;
+
+namespace dfly {
+
+// Intersects two increasing arrays of distinct integers and writes the common items to dest in
+// increasing order. dest may alias a. Gallops over the longer array when the lengths differ
+// a lot and merges both arrays block by block otherwise. Stops after limit items unless limit
+// is 0. Returns the number of items written.
+size_t IntersectSorted(const int64_t* a, size_t na, const int64_t* b, size_t nb, int64_t* dest,
+                       size_t limit = 0);
+
+// Appends the members of is to dest in increasing order.
+void IntsetDecode(const intset* is, std::vector<int64_t>* dest);
+
+// Intersects items[0, num) in place with the members of is, with the same semantics as
+// IntersectSorted. Searches is directly when it is much larger than items.
+size_t IntersectIntset(int64_t* items, size_t num, const intset* is, size_t limit = 0);
+
+}  // namespace dfly
@@ -0,0 +1,109 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/sorted_intersect.h"
+
+#include <mimalloc.h>
+
+#include <algorithm>
+#include <random>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+extern "C" {
+#include "redis/intset.h"
+#include "redis/zmalloc.h"
+}
+
+namespace dfly {
+
+using namespace std;
+
+class SortedIntersectTest : public ::testing::Test {
+ protected:
+  static void SetUpTestSuite() {
+    init_zmalloc_threadlocal(mi_heap_get_backing());
+  }
+
+  // Returns n distinct sorted values in [0, range) shifted by base.
+  vector<int64_t> RandomSorted(size_t n, int64_t range, int64_t base = 0) {
+    vector<int64_t> res;
+    while (res.size() < n) {
+      for (size_t i = res.size(); i < n; ++i)
+        res.push_back(base + int64_t(generator_() % range));
+      sort(res.begin(), res.end());
+      res.erase(unique(res.begin(), res.end()), res.end());
+    }
+    return res;
+  }
+
+  static vector<int64_t> Expected(const vector<int64_t>& a, const vector<int64_t>& b) {
+    vector<int64_t> res;
+    set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(res));
+    return res;
+  }
+
+  mt19937_64 generator_{1};
+};
+
+TEST_F(SortedIntersectTest, Sorted) {
+  // Covers the merge on inputs of similar lengths and galloping on skewed ones.
+  for (auto [na, nb] : {pair{0, 10}, {1, 1}, {7, 9}, {100, 120}, {1000, 1000}, {10, 5000},
+                        {5000, 10}, {3, 100000}}) {
+    int64_t range = 2 * (na + nb) + 1;
+    vector<int64_t> a = RandomSorted(na, range), b = RandomSorted(nb, range);
+    vector<int64_t> expected = Expected(a, b);
+
+    vector<int64_t> dest(min(a.size(), b.size()));
+    size_t res = IntersectSorted(a.data(), a.size(), b.data(), b.size(), dest.data());
+    dest.resize(res);
+    EXPECT_EQ(expected, dest) << na << " " << nb;
+
+    // In place.
+    res = IntersectSorted(a.data(), a.size(), b.data(), b.size(), a.data());
+    a.resize(res);
+    EXPECT_EQ(expected, a) << na << " " << nb;
+  }
+}
+
+TEST_F(SortedIntersectTest, Limit) {
+  vector<int64_t> a = RandomSorted(1000, 2000), b = RandomSorted(1000, 2000);
+  vector<int64_t> expected = Expected(a, b);
+  ASSERT_GT(expected.size(), 10u);
+
+  vector<int64_t> dest(a.size());
+  for (size_t limit : {1, 3, 4, 5, 10}) {
+    ASSERT_EQ(limit, IntersectSorted(a.data(), a.size(), b.data(), b.size(), dest.data(), limit));
+    EXPECT_TRUE(equal(dest.begin(), dest.begin() + limit, expected.begin()));
+  }
+}
+
+TEST_F(SortedIntersectTest, Intset) {
+  // int16, int32 and int64 encodings, small and large relative to the other input.
+  for (int64_t base : {-10000LL, 1LL << 20, -(1LL << 40)}) {
+    for (size_t len : {50, 5000}) {
+      vector<int64_t> members = RandomSorted(len, 40000, base);
+      intset* is = intsetNew();
+      for (int64_t val : members) {
+        uint8_t success;
+        is = intsetAdd(is, val, &success);
+      }
+
+      vector<int64_t> decoded;
+      IntsetDecode(is, &decoded);
+      EXPECT_EQ(members, decoded);
+
+      vector<int64_t> items = RandomSorted(100, 40000, base);
+      vector<int64_t> expected = Expected(items, members);
+      size_t res = IntersectIntset(items.data(), items.size(), is);
+      items.resize(res);
+      EXPECT_EQ(expected, items) << base << " " << len;
+
+      zfree(is);
+    }
+  }
+}
+
+}  // namespace dfly
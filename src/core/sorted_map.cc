@@ -4,7 +4,9 @@
 
 #include "core/sorted_map.h"
 
+#include <algorithm>
 #include <cmath>
+#include <limits>
 
 extern "C" {
 #include "redis/listpack.h"
@@ -28,11 +30,10 @@ namespace detail {
 
 namespace {
 
-// We tag sds pointers to allow customizable comparison function that supports both
-// Lex and Numeric comparison. It's safe to do on linux systems because its memory address range
-// is within 56 bit space.
+// We tag sds pointers to mark the +inf member when querying open/closed score bounds.
+// It's safe to do on linux systems because its memory address range is within 56 bit space.
+// Lex queries ignore the score by setting it to NaN.
 constexpr uint64_t kInfTag = 1ULL << 63;
-constexpr uint64_t kIgnoreDoubleTag = 1ULL << 62;
 constexpr uint64_t kSdsMask = (1ULL << 60) - 1;
 
 double GetObjScore(const void* obj) {
@@ -47,12 +48,20 @@ void SetObjScore(void* obj, double score) {
   absl::little_endian::Store64(ptr, absl::bit_cast<uint64_t>(score));
 }
 
-// buf must be at least 10 chars long.
+ScoredItem TreeKey(void* obj) {
+  return {GetObjScore(obj), obj};
+}
+
+// Builds a key that can be used for querying members by lex order regardless of their scores.
+ScoredItem LexKey(sds ele) {
+  return {std::numeric_limits<double>::quiet_NaN(), ele};
+}
+
+// buf must be at least 2 chars long.
 // Builds a tagged key that can be used for querying open/closed bounds.
-void* BuildScoredKey(double score, bool is_str_inf, char buf[]) {
+ScoredItem BuildScoredKey(double score, bool is_str_inf, char buf[]) {
   buf[0] = SDS_TYPE_5;  // length 0.
   buf[1] = 0;
-  absl::little_endian::Store64(buf + 2, absl::bit_cast<uint64_t>(score));
   void* key = buf + 1;
 
   // to include/exclude the score we set the secondary string to +inf.
@@ -60,7 +69,7 @@ void* BuildScoredKey(double score, bool is_str_inf, char buf[]) {
   if (is_str_inf) {
     key = (void*)(uint64_t(key) | kInfTag);
   }
-  return key;
+  return {score, key};
 }
 
 // Copied from t_zset.c
@@ -207,29 +216,24 @@ SortedMap::~SortedMap() {
   delete score_map;
 }
 
-int SortedMap::ScoreSdsPolicy::KeyCompareTo::operator()(ScoreSds a, ScoreSds b) const {
-  sds sdsa = (sds)(uint64_t(a) & kSdsMask);
-  sds sdsb = (sds)(uint64_t(b) & kSdsMask);
-
-  // if omit score comparison if at least one of the elements is tagged to ignore the score.
-  // These tags exist only when passing keys for query methods, tree elements are never tagged.
-  if ((uint64_t(a) & kIgnoreDoubleTag) == 0 && (uint64_t(b) & kIgnoreDoubleTag) == 0) {
-    double sa = GetObjScore(sdsa);
-    double sb = GetObjScore(sdsb);
-
-    if (sa < sb)
-      return -1;
-    if (sa > sb)
-      return 1;
-  }
+int SortedMap::ScoreSdsPolicy::KeyCompareTo::operator()(ScoredItem a, ScoredItem b) const {
+  // NaN scores of lex query keys fail both comparisons, hence only the members are compared.
+  // Query keys are never stored in the tree.
+  if (a.score < b.score)
+    return -1;
+  if (a.score > b.score)
+    return 1;
 
   // Marks +inf.
-  if (uint64_t(a) & kInfTag)
+  if (uint64_t(a.member) & kInfTag)
     return 1;
 
-  if (uint64_t(b) & kInfTag)
+  if (uint64_t(b.member) & kInfTag)
     return -1;
 
+  sds sdsa = (sds)(uint64_t(a.member) & kSdsMask);
+  sds sdsb = (sds)(uint64_t(b.member) & kSdsMask);
+
   return sdscmp(sdsa, sdsb);
 }
 
@@ -251,7 +255,7 @@ int SortedMap::Add(double score, sds ele, int in_flags, int* out_flags, double*
 
     *out_flags = ZADD_OUT_ADDED;
     *newscore = score;
-    bool added = score_tree->Insert(obj);
+    bool added = score_tree->Insert({score, obj});
     DCHECK(added);
 
     return 1;
@@ -273,9 +277,9 @@ int SortedMap::Add(double score, sds ele, int in_flags, int* out_flags, double*
   }
 
   // Update the score.
-  CHECK(score_tree->Delete(obj));
+  CHECK(score_tree->Delete(TreeKey(obj)));
   SetObjScore(obj, score);
-  CHECK(score_tree->Insert(obj));
+  CHECK(score_tree->Insert({score, obj}));
   *out_flags = ZADD_OUT_UPDATED;
   *newscore = score;
   return 1;
@@ -297,19 +301,52 @@ bool SortedMap::Insert(double score, sds ele) {
   auto [newk, added] = score_map->AddOrUpdate(string_view{ele, sdslen(ele)}, score);
   DCHECK(added);
 
-  added = score_tree->Insert(newk);
+  added = score_tree->Insert({score, newk});
   DCHECK(added);
   sdsfree(ele);
 
   return true;
 }
 
+bool SortedMap::BulkInsert(absl::Span<const pair<double, sds>> members) {
+  DCHECK_EQ(0u, score_tree->Size());
+
+  vector<ScoredItem> items;
+  items.reserve(members.size());
+  score_map->Reserve(members.size());
+
+  bool valid = true;
+  for (auto [score, ele] : members) {
+    if (valid && !isnan(score)) {
+      auto [newk, added] = score_map->AddOrUpdate(string_view{ele, sdslen(ele)}, score);
+      valid = added;
+      items.push_back({score, newk});
+    } else {
+      valid = false;
+    }
+    sdsfree(ele);
+  }
+
+  if (!valid) {
+    score_map->Clear();
+    return false;
+  }
+
+  ScoreSdsPolicy::KeyCompareTo cmp;
+  auto less = [&cmp](ScoredItem a, ScoredItem b) { return cmp(a, b) < 0; };
+  if (!std::is_sorted(items.begin(), items.end(), less))
+    std::sort(items.begin(), items.end(), less);
+
+  score_tree->BulkBuild(items.data(), items.size());
+  return true;
+}
+
 optional<unsigned> SortedMap::GetRank(sds ele, bool reverse) const {
   ScoreSds obj = score_map->FindObj(ele);
   if (obj == nullptr)
     return std::nullopt;
 
-  optional rank = score_tree->GetRank(obj);
+  optional rank = score_tree->GetRank(TreeKey(obj));
   DCHECK(rank);
   return reverse ? score_map->UpperBoundSize() - *rank - 1 : *rank;
 }
@@ -322,15 +359,15 @@ SortedMap::ScoredArray SortedMap::GetRange(const zrangespec& range, unsigned off
 
   char buf[16];
   if (reverse) {
-    ScoreSds key = BuildScoredKey(range.max, !range.maxex, buf);
+    ScoredItem key = BuildScoredKey(range.max, !range.maxex, buf);
     auto path = score_tree->LEQ(key);
     if (path.Empty())
       return arr;
 
-    if (range.maxex && range.max == GetObjScore(path.Terminal())) {
+    if (range.maxex && range.max == path.Terminal().score) {
       ++offset;
     }
-    DCHECK_LE(GetObjScore(path.Terminal()), range.max);
+    DCHECK_LE(path.Terminal().score, range.max);
 
     while (offset--) {
       if (!path.Prev())
@@ -338,9 +375,8 @@ SortedMap::ScoredArray SortedMap::GetRange(const zrangespec& range, unsigned off
     }
 
     while (limit--) {
-      ScoreSds ele = path.Terminal();
+      auto [score, ele] = path.Terminal();
 
-      double score = GetObjScore(ele);
       if (range.min > score || (range.min == score && range.minex))
         break;
       arr.emplace_back(string{(sds)ele, sdslen((sds)ele)}, score);
@@ -348,7 +384,7 @@ SortedMap::ScoredArray SortedMap::GetRange(const zrangespec& range, unsigned off
         break;
     }
   } else {
-    ScoreSds key = BuildScoredKey(range.min, range.minex, buf);
+    ScoredItem key = BuildScoredKey(range.min, range.minex, buf);
     auto path = score_tree->GEQ(key);
     if (path.Empty())
       return arr;
@@ -363,9 +399,7 @@ SortedMap::ScoredArray SortedMap::GetRange(const zrangespec& range, unsigned off
 
     // Count the number of elements in the range.
     while (limit--) {
-      ScoreSds ele = path.Terminal();
-
-      double score = GetObjScore(ele);
+      double score = path.Terminal().score;
       if (range.max < score || (range.max == score && range.maxex))
         break;
       ++num_elems;
@@ -376,8 +410,8 @@ SortedMap::ScoredArray SortedMap::GetRange(const zrangespec& range, unsigned off
     // reserve enough space.
     arr.resize(num_elems);
     for (size_t i = 0; i < num_elems; ++i) {
-      ScoreSds ele = path2.Terminal();
-      arr[i] = {string{(sds)ele, sdslen((sds)ele)}, GetObjScore(ele)};
+      auto [score, ele] = path2.Terminal();
+      arr[i] = {string{(sds)ele, sdslen((sds)ele)}, score};
       path2.Next();
     }
   }
@@ -390,17 +424,16 @@ SortedMap::ScoredArray SortedMap::GetLexRange(const zlexrangespec& range, unsign
   if (score_tree->Size() <= offset || limit == 0)
     return {};
 
-  detail::BPTreePath<ScoreSds> path;
+  detail::BPTreePath<ScoredItem> path;
   ScoredArray arr;
 
   if (reverse) {
     if (range.max != cmaxstring) {
-      ScoreSds range_key = (ScoreSds)(uint64_t(range.max) | kIgnoreDoubleTag);
-      path = score_tree->LEQ(range_key);
+      path = score_tree->LEQ(LexKey(range.max));
       if (path.Empty())
         return {};
 
-      if (range.maxex && sdscmp((sds)path.Terminal(), range.max) == 0) {
+      if (range.maxex && sdscmp((sds)path.Terminal().member, range.max) == 0) {
         ++offset;
       }
       while (offset--) {
@@ -412,25 +445,24 @@ SortedMap::ScoredArray SortedMap::GetLexRange(const zlexrangespec& range, unsign
     }
 
     while (limit--) {
-      ScoreSds ele = path.Terminal();
+      auto [score, ele] = path.Terminal();
 
       if (range.min != cminstring) {
         int cmp = sdscmp((sds)ele, range.min);
         if (cmp < 0 || (cmp == 0 && range.minex))
           break;
       }
-      arr.emplace_back(string{(sds)ele, sdslen((sds)ele)}, GetObjScore(ele));
+      arr.emplace_back(string{(sds)ele, sdslen((sds)ele)}, score);
       if (!path.Prev())
         break;
     }
   } else {
     if (range.min != cminstring) {
-      ScoreSds range_key = (ScoreSds)(uint64_t(range.min) | kIgnoreDoubleTag);
-      path = score_tree->GEQ(range_key);
+      path = score_tree->GEQ(LexKey(range.min));
       if (path.Empty())
         return {};
 
-      if (range.minex && sdscmp((sds)path.Terminal(), range.min) == 0) {
+      if (range.minex && sdscmp((sds)path.Terminal().member, range.min) == 0) {
         ++offset;
       }
       while (offset--) {
@@ -442,14 +474,14 @@ SortedMap::ScoredArray SortedMap::GetLexRange(const zlexrangespec& range, unsign
     }
 
     while (limit--) {
-      ScoreSds ele = path.Terminal();
+      auto [score, ele] = path.Terminal();
 
       if (range.max != cmaxstring) {
         int cmp = sdscmp((sds)ele, range.max);
         if (cmp > 0 || (cmp == 0 && range.maxex))
           break;
       }
-      arr.emplace_back(string{(sds)ele, sdslen((sds)ele)}, GetObjScore(ele));
+      arr.emplace_back(string{(sds)ele, sdslen((sds)ele)}, score);
       if (!path.Next())
         break;
     }
@@ -460,8 +492,8 @@ SortedMap::ScoredArray SortedMap::GetLexRange(const zlexrangespec& range, unsign
 uint8_t* SortedMap::ToListPack() const {
   uint8_t* lp = lpNew(0);
 
-  score_tree->Iterate(0, UINT32_MAX, [&](ScoreSds ele) {
-    lp = zzlInsertAt(lp, NULL, (sds)ele, GetObjScore(ele));
+  score_tree->Iterate(0, UINT32_MAX, [&](ScoredItem item) {
+    lp = zzlInsertAt(lp, NULL, (sds)item.member, item.score);
     return true;
   });
 
@@ -473,7 +505,7 @@ bool SortedMap::Delete(sds ele) {
   if (obj == nullptr)
     return false;
 
-  CHECK(score_tree->Delete(obj));
+  CHECK(score_tree->Delete(TreeKey(obj)));
   CHECK(score_map->Erase(ele));
   return true;
 }
@@ -483,6 +515,23 @@ size_t SortedMap::MallocSize() const {
   return score_map->SetMallocUsed() + score_map->ObjMallocUsed() + score_tree->NodeCount() * 256;
 }
 
+bool SortedMap::DefragIfNeeded(float ratio) {
+  bool realloced = false;
+  for (auto it = score_map->begin(); it != score_map->end(); ++it) {
+    // The tree points to the members of the map, so it must follow them.
+    realloced |= it.ReallocIfNeeded(ratio, [this](sds new_member) {
+      [[maybe_unused]] bool replaced = score_tree->Replace(TreeKey(new_member));
+      DCHECK(replaced);
+    });
+  }
+
+  auto underutilized = [ratio](const void* node) {
+    return zmalloc_page_is_underutilized(const_cast<void*>(node), ratio);
+  };
+  realloced |= score_tree->ReallocNodes(underutilized) > 0;
+  return realloced;
+}
+
 bool SortedMap::Reserve(size_t sz) {
   score_map->Reserve(sz);
   return true;
@@ -500,7 +549,7 @@ size_t SortedMap::DeleteRangeByRank(unsigned start, unsigned end) {
      */
 
     auto path = score_tree->FromRank(start);
-    sds ele = (sds)path.Terminal();
+    sds ele = (sds)path.Terminal().member;
     score_tree->Delete(path);
     score_map->Erase(ele);
   }
@@ -513,13 +562,13 @@ size_t SortedMap::DeleteRangeByScore(const zrangespec& range) {
   size_t deleted = 0;
 
   while (score_tree->Size() > 0) {
-    ScoreSds min_key = BuildScoredKey(range.min, range.minex, buf);
+    ScoredItem min_key = BuildScoredKey(range.min, range.minex, buf);
     auto path = score_tree->GEQ(min_key);
     if (path.Empty())
       break;
 
-    ScoreSds item = path.Terminal();
-    double score = GetObjScore(item);
+    ScoredItem item = path.Terminal();
+    double score = item.score;
 
     if (range.minex) {
       DCHECK_GT(score, range.min);
@@ -529,9 +578,9 @@ size_t SortedMap::DeleteRangeByScore(const zrangespec& range) {
     if (score > range.max || (range.maxex && score == range.max))
       break;
 
-    score_tree->Delete(item);
+    score_tree->Delete(path);
     ++deleted;
-    score_map->Erase((sds)item);
+    score_map->Erase((sds)item.member);
   }
 
   return deleted;
@@ -545,28 +594,27 @@ size_t SortedMap::DeleteRangeByLex(const zlexrangespec& range) {
 
   uint32_t rank = 0;
   if (range.min != cminstring) {
-    ScoreSds range_key = (ScoreSds)(uint64_t(range.min) | kIgnoreDoubleTag);
-    auto path = score_tree->GEQ(range_key);
+    auto path = score_tree->GEQ(LexKey(range.min));
     if (path.Empty())
       return {};
 
     rank = path.Rank();
-    if (range.minex && sdscmp((sds)path.Terminal(), range.min) == 0) {
+    if (range.minex && sdscmp((sds)path.Terminal().member, range.min) == 0) {
       ++rank;
     }
   }
 
   while (rank < score_tree->Size()) {
     auto path = score_tree->FromRank(rank);
-    ScoreSds item = path.Terminal();
+    sds item = (sds)path.Terminal().member;
     if (range.max != cmaxstring) {
-      int cmp = sdscmp((sds)item, range.max);
+      int cmp = sdscmp(item, range.max);
       if (cmp > 0 || (cmp == 0 && range.maxex))
         break;
     }
     ++deleted;
     score_tree->Delete(path);
-    score_map->Erase((sds)item);
+    score_map->Erase(item);
   }
 
   return deleted;
@@ -595,8 +643,8 @@ SortedMap::ScoredArray SortedMap::PopTopScores(unsigned count, bool reverse) {
 
   for (unsigned i = 0; i < count; ++i) {
     auto path = score_tree->FromRank(rank);
-    ScoreSds obj = path.Terminal();
-    res.emplace_back(string{(sds)obj, sdslen((sds)obj)}, GetObjScore(obj));
+    auto [score, obj] = path.Terminal();
+    res.emplace_back(string{(sds)obj, sdslen((sds)obj)}, score);
 
     score_tree->Delete(path);
     score_map->Erase((sds)obj);
@@ -615,17 +663,17 @@ size_t SortedMap::Count(const zrangespec& range) const {
   // build min key.
   char buf[16];
 
-  ScoreSds range_key = BuildScoredKey(range.min, range.minex, buf);
+  ScoredItem range_key = BuildScoredKey(range.min, range.minex, buf);
   auto path = score_tree->GEQ(range_key);
   if (path.Empty())
     return 0;
 
-  ScoreSds bound = path.Terminal();
+  ScoredItem bound = path.Terminal();
 
   if (range.minex) {
-    DCHECK_GT(GetObjScore(bound), range.min);
+    DCHECK_GT(bound.score, range.min);
   } else {
-    DCHECK_GE(GetObjScore(bound), range.min);
+    DCHECK_GE(bound.score, range.min);
   }
 
   uint32_t min_rank = path.Rank();
@@ -642,7 +690,7 @@ size_t SortedMap::Count(const zrangespec& range) const {
 
   bound = path.Terminal();
   uint32_t max_rank = path.Rank();
-  if (range.maxex || GetObjScore(bound) > range.max) {
+  if (range.maxex || bound.score > range.max) {
     if (max_rank <= min_rank)
       return 0;
     --max_rank;
@@ -657,16 +705,15 @@ size_t SortedMap::LexCount(const zlexrangespec& range) const {
     return 0;
 
   uint32_t min_rank = 0;
-  detail::BPTreePath<ScoreSds> path;
+  detail::BPTreePath<ScoredItem> path;
 
   if (range.min != cminstring) {
-    ScoreSds range_key = (ScoreSds)(uint64_t(range.min) | kIgnoreDoubleTag);
-    path = score_tree->GEQ(range_key);
+    path = score_tree->GEQ(LexKey(range.min));
     if (path.Empty())
       return 0;
 
     min_rank = path.Rank();
-    if (range.minex && sdscmp((sds)path.Terminal(), range.min) == 0) {
+    if (range.minex && sdscmp((sds)path.Terminal().member, range.min) == 0) {
       ++min_rank;
       if (min_rank >= score_tree->Size())
         return 0;
@@ -675,13 +722,12 @@ size_t SortedMap::LexCount(const zlexrangespec& range) const {
 
   uint32_t max_rank = score_tree->Size() - 1;
   if (range.max != cmaxstring) {
-    ScoreSds range_key = (ScoreSds)(uint64_t(range.max) | kIgnoreDoubleTag);
-    path = score_tree->GEQ(range_key);
+    path = score_tree->GEQ(LexKey(range.max));
     if (!path.Empty()) {
       max_rank = path.Rank();
 
       // fix the max rank, if needed.
-      int cmp = sdscmp((sds)path.Terminal(), range.max);
+      int cmp = sdscmp((sds)path.Terminal().member, range.max);
       DCHECK_GE(cmp, 0);
       if (cmp > 0 || range.maxex) {
         if (max_rank <= min_rank)
@@ -701,15 +747,38 @@ bool SortedMap::Iterate(unsigned start_rank, unsigned len, bool reverse,
   bool success;
   if (reverse) {
     success = score_tree->IterateReverse(
-        start_rank, end_rank, [&](ScoreSds obj) { return cb((sds)obj, GetObjScore(obj)); });
+        start_rank, end_rank, [&](ScoredItem item) { return cb((sds)item.member, item.score); });
   } else {
-    success = score_tree->Iterate(start_rank, end_rank,
-                                  [&](ScoreSds obj) { return cb((sds)obj, GetObjScore(obj)); });
+    success = score_tree->Iterate(start_rank, end_rank, [&](ScoredItem item) {
+      return cb((sds)item.member, item.score);
+    });
   }
 
   return success;
 }
 
+bool SortedMap::IterateByScore(const zrangespec& range,
+                               absl::FunctionRef<bool(sds, double)> cb) const {
+  if (score_tree->Size() == 0)
+    return true;
+
+  char buf[16];
+  ScoredItem key = BuildScoredKey(range.min, range.minex, buf);
+  auto path = score_tree->GEQ(key);
+  if (path.Empty())
+    return true;
+
+  do {
+    auto [score, ele] = path.Terminal();
+    if (range.max < score || (range.max == score && range.maxex))
+      break;
+    if (!cb((sds)ele, score))
+      return false;
+  } while (path.Next());
+
+  return true;
+}
+
 uint64_t SortedMap::Scan(uint64_t cursor,
                          absl::FunctionRef<void(std::string_view, double)> cb) const {
   auto scan_cb = [&cb](const void* obj) {
@@ -732,6 +801,9 @@ SortedMap* SortedMap::FromListPack(PMR_NS::memory_resource* res, const uint8_t*
   void* ptr = res->allocate(sizeof(SortedMap), alignof(SortedMap));
   SortedMap* zs = new (ptr) SortedMap{res};
 
+  vector<pair<double, sds>> members;
+  members.reserve(lpLength(zl) / 2);
+
   eptr = lpSeek(zl, 0);
   if (eptr != NULL) {
     sptr = lpNext(zl, eptr);
@@ -746,10 +818,13 @@ SortedMap* SortedMap::FromListPack(PMR_NS::memory_resource* res, const uint8_t*
     else
       ele = sdsnewlen((char*)vstr, vlen);
 
-    CHECK(zs->Insert(score, ele));
+    members.emplace_back(score, ele);
     zzlNext(zl, &eptr, &sptr);
   }
 
+  // The listpack is sorted, so the tree is built without sorting.
+  CHECK(zs->BulkInsert(members));
+
   return zs;
 }
 
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <absl/functional/function_ref.h>
+#include <absl/types/span.h>
 
 #include <memory>
 #include <optional>
@@ -41,8 +42,9 @@ class SortedMap {
   SortedMap(const SortedMap&) = delete;
   SortedMap& operator=(const SortedMap&) = delete;
 
+  // The tree keeps the score of every member next to it, see BPNodeLayout<ScoredItem>.
   struct ScoreSdsPolicy {
-    using KeyT = ScoreSds;
+    using KeyT = ScoredItem;
 
     struct KeyCompareTo {
       int operator()(KeyT a, KeyT b) const;
@@ -52,6 +54,12 @@ class SortedMap {
   bool Reserve(size_t sz);
   int Add(double score, sds ele, int in_flags, int* out_flags, double* newscore);
   bool Insert(double score, sds member);
+
+  // Fills an empty map with members in one pass, building the score tree bottom-up instead of
+  // inserting the members one by one. Takes ownership of the members. Members that are already
+  // sorted by (score, member), e.g. those of a listpack, skip the sorting step.
+  // Returns false if a member is duplicated or a score is NaN, leaving the map empty.
+  bool BulkInsert(absl::Span<const std::pair<double, sds>> members);
   bool Delete(sds ele);
 
   size_t Size() const {
@@ -60,6 +68,10 @@ class SortedMap {
 
   size_t MallocSize() const;
 
+  // Moves the members and the tree nodes that sit on underutilized pages to new allocations.
+  // Returns true if anything was moved.
+  bool DefragIfNeeded(float ratio);
+
   size_t DeleteRangeByRank(unsigned start, unsigned end);
   size_t DeleteRangeByScore(const zrangespec& range);
   size_t DeleteRangeByLex(const zlexrangespec& range);
@@ -67,6 +79,12 @@ class SortedMap {
   ScoredArray PopTopScores(unsigned count, bool reverse);
 
   std::optional<double> GetScore(sds ele) const;
+
+  // Batched GetScore, sets dest[i] to the score of members[i] if it exists.
+  void GetScoreBatch(const std::string_view* members, size_t num,
+                     std::optional<double>* dest) const {
+    score_map->FindBatch(members, num, dest);
+  }
   std::optional<unsigned> GetRank(sds ele, bool reverse) const;
   ScoredArray GetRange(const zrangespec& r, unsigned offs, unsigned len, bool rev) const;
   ScoredArray GetLexRange(const zlexrangespec& r, unsigned o, unsigned l, bool rev) const;
@@ -79,13 +97,17 @@ class SortedMap {
   bool Iterate(unsigned start_rank, unsigned len, bool reverse,
                absl::FunctionRef<bool(sds, double)> cb) const;
 
+  // Runs cb for each element with a score in range, in ascending order.
+  // Stops iteration if cb returns false. Returns false in this case.
+  bool IterateByScore(const zrangespec& range, absl::FunctionRef<bool(sds, double)> cb) const;
+
   uint64_t Scan(uint64_t cursor, absl::FunctionRef<void(std::string_view, double)> cb) const;
 
   uint8_t* ToListPack() const;
   static SortedMap* FromListPack(PMR_NS::memory_resource* res, const uint8_t* lp);
 
  private:
-  using ScoreTree = BPTree<ScoreSds, ScoreSdsPolicy>;
+  using ScoreTree = BPTree<ScoredItem, ScoreSdsPolicy>;
 
   ScoreMap* score_map = nullptr;
   ScoreTree* score_tree = nullptr;  // just a stub for now.
@@ -105,6 +105,36 @@ TEST_F(SortedMapTest, InsertPop) {
                                       Pair(StrEq("a97"), 1000)));
 }
 
+TEST_F(SortedMapTest, BulkInsert) {
+  vector<pair<double, sds>> members;
+  for (unsigned i = 0; i < 1000; ++i) {
+    members.emplace_back(i % 10, sdscatfmt(sdsempty(), "a%u", i));
+  }
+  ASSERT_TRUE(sm_.BulkInsert(members));
+  EXPECT_EQ(1000, sm_.Size());
+
+  sds s = sdsnew("a10");
+  EXPECT_EQ(0, sm_.GetScore(s));
+  EXPECT_EQ(1, sm_.GetRank(s, false));
+  sdsfree(s);
+
+  vector<sds> vec;
+  sm_.Iterate(0, 4, false, [&](sds ele, double score) {
+    vec.push_back(ele);
+    return true;
+  });
+  EXPECT_THAT(vec, ElementsAre(StrEq("a0"), StrEq("a10"), StrEq("a100"), StrEq("a110")));
+
+  // The map behaves as usual after the bulk insertion.
+  ASSERT_TRUE(sm_.Insert(-1, sdsnew("b")));
+  EXPECT_THAT(sm_.PopTopScores(2, false), ElementsAre(Pair(StrEq("b"), -1), Pair(StrEq("a0"), 0)));
+
+  SortedMap dup(&mr_);
+  members = {{1, sdsnew("x")}, {2, sdsnew("y")}, {3, sdsnew("x")}};
+  EXPECT_FALSE(dup.BulkInsert(members));
+  EXPECT_EQ(0, dup.Size());
+}
+
 TEST_F(SortedMapTest, LexRanges) {
   for (unsigned i = 0; i < 100; ++i) {
     sds s = sdsempty();
@@ -205,6 +235,42 @@ TEST_F(SortedMapTest, ScoreRanges) {
   ASSERT_EQ(0, array.size());
 }
 
+TEST_F(SortedMapTest, IterateByScore) {
+  zrangespec range;
+  range.min = 1;
+  range.max = 3;
+  range.minex = 0;
+  range.maxex = 1;
+
+  vector<pair<string, double>> items;
+  auto cb = [&](sds ele, double score) {
+    items.emplace_back(string{ele, sdslen(ele)}, score);
+    return items.size() < 3;
+  };
+  EXPECT_TRUE(sm_.IterateByScore(range, cb));
+  EXPECT_TRUE(items.empty());
+
+  for (unsigned i = 0; i < 5; ++i) {
+    ASSERT_TRUE(sm_.Insert(i, sdscatfmt(sdsempty(), "a%u", i)));
+    ASSERT_TRUE(sm_.Insert(i, sdscatfmt(sdsempty(), "b%u", i)));
+  }
+
+  EXPECT_FALSE(sm_.IterateByScore(range, cb));
+  EXPECT_THAT(items, ElementsAre(Pair("a1", 1), Pair("b1", 1), Pair("a2", 2)));
+
+  items.clear();
+  range.minex = 1;
+  range.maxex = 0;
+  EXPECT_FALSE(sm_.IterateByScore(range, cb));
+  EXPECT_THAT(items, ElementsAre(Pair("a2", 2), Pair("b2", 2), Pair("a3", 3)));
+
+  items.clear();
+  range.min = 4;
+  range.max = 10;
+  EXPECT_TRUE(sm_.IterateByScore(range, cb));
+  EXPECT_THAT(items, ElementsAre(Pair("a4", 4), Pair("b4", 4)));
+}
+
 TEST_F(SortedMapTest, DeleteRange) {
   for (unsigned i = 0; i <= 100; ++i) {
     sds s = sdsempty();
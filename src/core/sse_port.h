@@ -9,9 +9,13 @@
 #include <vecintrin.h>
 #else
 #include <emmintrin.h>
+#include <immintrin.h>
 #include <tmmintrin.h>
 #endif
 
+#include <cstdint>
+#include <cstring>
+
 namespace dfly {
 
 #ifndef __s390x__
@@ -25,6 +29,55 @@ inline __m128i mm_loadu_si128(const __m128i* ptr) {
   return _mm_loadu_si128(ptr);
 #endif
 }
+
+#if defined(__aarch64__)
+// Compares fp with 16 bytes at a and 16 bytes at b. Returns a bitmask where bits [0, 16)
+// correspond to the matches in a and bits [16, 32) to the matches in b.
+inline uint32_t CmpEqMask2x16(const uint8_t* a, const uint8_t* b, uint8_t fp) {
+  static const uint8_t kBits[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+
+  const uint8x16_t key = vdupq_n_u8(fp);
+  const uint8x16_t bits = vld1q_u8(kBits);
+  uint8x16_t ma = vandq_u8(vceqq_u8(vld1q_u8(a), key), bits);
+  uint8x16_t mb = vandq_u8(vceqq_u8(vld1q_u8(b), key), bits);
+
+  // Three pairwise additions fold every 8 bytes into a single byte of the mask.
+  uint8x16_t sum = vpaddq_u8(ma, mb);
+  sum = vpaddq_u8(sum, sum);
+  sum = vpaddq_u8(sum, sum);
+  return vgetq_lane_u32(vreinterpretq_u32_u8(sum), 0);
+}
+#else
+
+__attribute__((target("avx2"))) inline uint32_t CmpEqMask2x16Avx2(const uint8_t* a,
+                                                                  const uint8_t* b, uint8_t fp) {
+  __m256i data = _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)));
+  data = _mm256_inserti128_si256(data, _mm_loadu_si128(reinterpret_cast<const __m128i*>(b)), 1);
+  return _mm256_movemask_epi8(_mm256_cmpeq_epi8(data, _mm256_set1_epi8(fp)));
+}
+
+inline uint32_t CmpEqMask2x16Sse(const uint8_t* a, const uint8_t* b, uint8_t fp) {
+  const __m128i key = _mm_set1_epi8(fp);
+  uint32_t ma = _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)), key));
+  uint32_t mb = _mm_movemask_epi8(
+      _mm_cmpeq_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b)), key));
+  return ma | (mb << 16);
+}
+
+// Selected at startup based on cpu capabilities, can be reset to compare both paths.
+inline bool use_avx2_cmp = __builtin_cpu_supports("avx2");
+
+// Compares fp with 16 bytes at a and 16 bytes at b. Returns a bitmask where bits [0, 16)
+// correspond to the matches in a and bits [16, 32) to the matches in b.
+inline uint32_t CmpEqMask2x16(const uint8_t* a, const uint8_t* b, uint8_t fp) {
+#ifdef __AVX2__
+  return CmpEqMask2x16Avx2(a, b, fp);
+#else
+  return use_avx2_cmp ? CmpEqMask2x16Avx2(a, b, fp) : CmpEqMask2x16Sse(a, b, fp);
+#endif
+}
+#endif
 #endif
 
 }  // namespace dfly
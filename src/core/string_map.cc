@@ -101,6 +101,11 @@ bool StringMap::Contains(string_view field) const {
   return FindInternal(&field, hashcode, 1) != nullptr;
 }
 
+void StringMap::FindBatch(const string_view* fields, size_t num, sds* dest) const {
+  FindInternalBatch(fields, num, 1,  // 1 - string_view
+                    [dest](size_t i, void* obj) { dest[i] = obj ? GetValue((sds)obj) : nullptr; });
+}
+
 void StringMap::Clear() {
   ClearInternal();
 }
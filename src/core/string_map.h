@@ -114,6 +114,10 @@ class StringMap : public DenseSet {
 
   bool Contains(std::string_view s1) const;
 
+  // Looks up num fields at once, sets dest[i] to the value of fields[i] or nullptr if not found.
+  // Faster than calling Find for each field, see DenseSet::FindInternalBatch.
+  void FindBatch(const std::string_view* fields, size_t num, sds* dest) const;
+
   /// @brief  Returns value of the key or nullptr if key not found.
   /// @param key
   /// @return sds
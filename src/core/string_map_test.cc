@@ -127,6 +127,29 @@ TEST_F(StringMapTest, IterateExpired) {
   EXPECT_EQ(it, sm_->end());
 }
 
+TEST_F(StringMapTest, FindBatch) {
+  vector<string> fields;
+  for (unsigned i = 0; i < 100; ++i) {
+    fields.push_back(absl::StrCat("field", i));
+    EXPECT_TRUE(sm_->AddOrUpdate(fields.back(), absl::StrCat("val", i), i % 2 ? 1 : UINT32_MAX));
+  }
+  fields.push_back("missing");
+  sm_->set_time(1);
+
+  vector<string_view> keys(fields.begin(), fields.end());
+  vector<sds> vals(keys.size());
+  sm_->FindBatch(keys.data(), keys.size(), vals.data());
+  for (unsigned i = 0; i < 100; ++i) {
+    if (i % 2) {
+      EXPECT_EQ(nullptr, vals[i]) << i;  // expired
+    } else {
+      ASSERT_NE(nullptr, vals[i]) << i;
+      EXPECT_EQ(absl::StrCat("val", i), string_view(vals[i], sdslen(vals[i])));
+    }
+  }
+  EXPECT_EQ(nullptr, vals.back());
+}
+
 unsigned total_wasted_memory = 0;
 
 TEST_F(StringMapTest, ReallocIfNeeded) {
@@ -133,4 +133,23 @@ void StringSet::ObjDelete(void* obj, bool has_ttl) const {
   sdsfree((sds)obj);
 }
 
+bool StringSet::iterator::ReallocIfNeeded(float ratio) {
+  // Unwrap all links to correctly call SetObject()
+  auto* ptr = curr_entry_;
+  while (ptr->IsLink())
+    ptr = ptr->AsLink();
+
+  sds str = (sds)ptr->GetObject();
+  if (!zmalloc_page_is_underutilized(str, ratio))
+    return false;
+
+  size_t len = sdslen(str);
+  size_t space_size = ptr->HasTtl() ? sizeof(uint32_t) : 0;
+  sds new_str = AllocSdsWithSpace(len, space_size);
+  memcpy(new_str, str, len + 1 + space_size);
+  ptr->SetObject(new_str);
+  sdsfree(str);
+  return true;
+}
+
 }  // namespace dfly
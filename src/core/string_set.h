@@ -39,6 +39,12 @@ class StringSet : public DenseSet {
     return FindInternal(&s1, Hash(&s1, 1), 1) != nullptr;
   }
 
+  // Looks up num members at once, sets dest[i] to the found member or nullptr.
+  // Faster than calling Contains for each member, see DenseSet::FindInternalBatch.
+  void FindBatch(const std::string_view* members, size_t num, sds* dest) const {
+    FindInternalBatch(members, num, 1, [dest](size_t i, void* obj) { dest[i] = (sds)obj; });
+  }
+
   void Clear() {
     ClearInternal();
   }
@@ -85,6 +91,9 @@ class StringSet : public DenseSet {
       return (value_type)curr_entry_->GetObject();
     }
 
+    // Moves the current member to a new allocation if it sits on an underutilized page.
+    bool ReallocIfNeeded(float ratio);
+
     using IteratorBase::ExpiryTime;
     using IteratorBase::HasExpiry;
   };
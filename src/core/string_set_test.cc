@@ -183,6 +183,23 @@ TEST_F(StringSetTest, SimpleScan) {
   EXPECT_TRUE(seen.size() == info.size() && equal(seen.begin(), seen.end(), info.begin()));
 }
 
+TEST_F(StringSetTest, ClearStep) {
+  constexpr size_t kNumElems = 1000;
+  for (size_t i = 0; i < kNumElems; ++i)
+    EXPECT_TRUE(ss_->Add(StrCat("elem", i)));
+
+  uint32_t cursor = 0;
+  unsigned steps = 0;
+  while (!ss_->Empty()) {
+    size_t prev_size = ss_->UpperBoundSize();
+    cursor = ss_->ClearStep(cursor, 10);
+    EXPECT_LE(prev_size - ss_->UpperBoundSize(), 20u);
+    ++steps;
+  }
+  EXPECT_GE(steps, kNumElems / 20);
+  EXPECT_EQ(0u, ss_->UpperBoundSize());
+}
+
 // Ensure REDIS scan guarantees are met
 TEST_F(StringSetTest, ScanGuarantees) {
   unordered_set<string_view> to_be_seen = {"foo", "bar"};
@@ -326,6 +343,54 @@ TEST_F(StringSetTest, XtremeScanGrow) {
   EXPECT_EQ(seen.size(), to_see.size());
 }
 
+TEST_F(StringSetTest, IncrementalRehash) {
+  mt19937 generator(0);
+  vector<string> strs;
+
+  // Grow a large enough table so that the rehashing takes many steps.
+  while (strs.size() < 1024 || !ss_->IsRehashing()) {
+    string str = random_string(generator, 12);
+    if (ss_->Add(str))
+      strs.push_back(str);
+  }
+  for (size_t i = 0; i < strs.size(); i += 10) {
+    EXPECT_TRUE(ss_->Erase(strs[i]));
+    EXPECT_FALSE(ss_->Contains(strs[i]));
+  }
+  EXPECT_TRUE(ss_->IsRehashing());
+
+  for (size_t i = 0; i < strs.size(); ++i) {
+    EXPECT_EQ(i % 10 != 0, ss_->Contains(strs[i])) << i;
+  }
+
+  // Keep inserting while scanning, so that buckets are moved between the scan calls.
+  unordered_set<string> seen;
+  auto scan_callback = [&](const sds ptr) { seen.emplace(ptr, sdslen(ptr)); };
+
+  uint32_t cursor = 0;
+  do {
+    cursor = ss_->Scan(cursor, scan_callback);
+    ss_->Add(random_string(generator, 12));
+  } while (cursor != 0);
+
+  for (size_t i = 0; i < strs.size(); ++i) {
+    if (i % 10 != 0) {
+      EXPECT_TRUE(seen.count(strs[i])) << i;
+    }
+  }
+
+  // Iterating finishes the rehashing at once.
+  while (!ss_->IsRehashing()) {
+    ss_->Add(random_string(generator, 12));
+  }
+  size_t count = 0;
+  for (auto it = ss_->begin(); it != ss_->end(); ++it) {
+    ++count;
+  }
+  EXPECT_FALSE(ss_->IsRehashing());
+  EXPECT_EQ(ss_->UpperBoundSize(), count);
+}
+
 TEST_F(StringSetTest, Pop) {
   constexpr size_t num_items = 8;
   unordered_set<string> to_insert;
@@ -418,6 +483,40 @@ TEST_F(StringSetTest, Ttl) {
   }
 }
 
+TEST_F(StringSetTest, DeleteExpiredStep) {
+  EXPECT_EQ(UINT32_MAX, ss_->NextExpiry());
+  for (unsigned i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(ss_->Add(StrCat("short", i), 10));
+    EXPECT_TRUE(ss_->Add(StrCat("long", i), 100));
+    EXPECT_TRUE(ss_->Add(StrCat("persistent", i)));
+  }
+  EXPECT_EQ(10u, ss_->NextExpiry());
+
+  // Nothing is due yet, the pass only finds the next expiry.
+  uint32_t cursor = 0;
+  unsigned budget = UINT32_MAX;
+  EXPECT_TRUE(ss_->DeleteExpiredStep(&cursor, &budget));
+  EXPECT_EQ(3000u, ss_->UpperBoundSize());
+  EXPECT_EQ(10u, ss_->NextExpiry());
+
+  // Bounded steps.
+  ss_->set_time(10);
+  unsigned steps = 0;
+  do {
+    budget = 16;
+    ++steps;
+  } while (!ss_->DeleteExpiredStep(&cursor, &budget));
+  EXPECT_GT(steps, 1u);
+  EXPECT_EQ(2000u, ss_->UpperBoundSize());
+  EXPECT_EQ(100u, ss_->NextExpiry());
+
+  ss_->set_time(100);
+  budget = UINT32_MAX;
+  EXPECT_TRUE(ss_->DeleteExpiredStep(&cursor, &budget));
+  EXPECT_EQ(1000u, ss_->UpperBoundSize());
+  EXPECT_EQ(UINT32_MAX, ss_->NextExpiry());
+}
+
 TEST_F(StringSetTest, Grow) {
   mt19937 generator(0);
 
@@ -448,6 +547,26 @@ TEST_F(StringSetTest, Reserve) {
   }
 }
 
+TEST_F(StringSetTest, FindBatch) {
+  vector<string> strs;
+  mt19937 generator(0);
+  for (size_t i = 0; i < 1000; ++i) {
+    strs.push_back(random_string(generator, 10));
+    if (i % 3)
+      ss_->Add(strs.back());
+  }
+
+  vector<string_view> members(strs.begin(), strs.end());
+  vector<sds> found(members.size());
+  ss_->FindBatch(members.data(), members.size(), found.data());
+  for (size_t i = 0; i < strs.size(); ++i) {
+    EXPECT_EQ(ss_->Contains(strs[i]), found[i] != nullptr) << i;
+    if (found[i]) {
+      EXPECT_EQ(strs[i], string_view(found[i], sdslen(found[i])));
+    }
+  }
+}
+
 TEST_F(StringSetTest, IterateEmpty) {
   for (const auto& s : *ss_) {
     // We're iterating to make sure there is no crash. However, if we got here, it's a bug
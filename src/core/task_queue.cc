@@ -45,6 +45,7 @@ void TaskQueue::TaskLoop() {
 
   auto cb = [&] {
     if (queue_.try_dequeue(func)) {
+      backlog_.fetch_sub(1, std::memory_order_relaxed);
       push_ec_.notify();
       return true;
     }
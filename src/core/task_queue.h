@@ -4,6 +4,10 @@
 
 #pragma once
 
+#include <memory>
+#include <type_traits>
+
+#include "base/function2.hpp"
 #include "base/mpmc_bounded_queue.h"
 #include "util/fibers/detail/result_mover.h"
 #include "util/fibers/fibers.h"
@@ -21,10 +25,26 @@ namespace dfly {
  */
 class TaskQueue {
  public:
+  // Callbacks are stored inside the queue cells, so submitting one does not allocate. The captures
+  // of a callback must fit into kCbCapacity bytes, which is checked at compile time.
+  static constexpr size_t kCbCapacity = 64;
+
+  using CbFunc = fu2::function_base<true /*owns*/, false /*copyable*/,
+                                    fu2::capacity_fixed<kCbCapacity>, false /* non-throwing*/,
+                                    false /* strong exceptions guarantees*/, void()>;
+
   explicit TaskQueue(unsigned consumer_fb_cnt, unsigned queue_size = 128);
 
+  // Moves a callback with bigger captures to the heap, for the paths where an allocation
+  // per callback does not matter.
+  template <typename F> static auto Boxed(F&& f) {
+    return [f = std::make_unique<std::decay_t<F>>(std::forward<F>(f))]() { (*f)(); };
+  }
+
   template <typename F> bool TryAdd(F&& f) {
+    CheckCapacity<F>();
     if (queue_.try_enqueue(std::forward<F>(f))) {
+      backlog_.fetch_add(1, std::memory_order_relaxed);
       pull_ec_.notify();
       return true;
     }
@@ -39,7 +59,10 @@ class TaskQueue {
    * @return true if Add() had to preempt, false is fast path without preemptions was followed.
    */
   template <typename F> bool Add(F&& f) {
-    if (TryAdd(std::forward<F>(f))) {
+    // Converted once, so that the captures are not moved from by a failed attempt.
+    CheckCapacity<F>();
+    CbFunc cb{std::forward<F>(f)};
+    if (TryAdd(std::move(cb))) {
       return false;
     }
 
@@ -47,7 +70,7 @@ class TaskQueue {
     while (true) {
       auto key = push_ec_.prepareWait();
 
-      if (TryAdd(std::forward<F>(f))) {
+      if (TryAdd(std::move(cb))) {
         break;
       }
       result = true;
@@ -56,6 +79,7 @@ class TaskQueue {
     return result;
   }
 
+  // f is stored together with 16 bytes of the bookkeeping, within kCbCapacity.
   template <typename F> auto Await(F&& f) -> decltype(f()) {
     util::fb2::Done done;
     using ResultType = decltype(f());
@@ -88,16 +112,30 @@ class TaskQueue {
     return concurrency_level_;
   }
 
+  // Returns number of callbacks waiting in the queue. Approximate, as producers count their
+  // callbacks only after pushing them, so the counter can even drop below zero for a moment.
+  unsigned backlog() const {
+    int backlog = backlog_.load(std::memory_order_relaxed);
+    return backlog > 0 ? backlog : 0;
+  }
+
  private:
-  void TaskLoop();
+  template <typename F> static constexpr void CheckCapacity() {
+    using T = std::decay_t<F>;
+    static_assert(std::is_same_v<T, CbFunc> ||
+                      (sizeof(T) <= kCbCapacity && alignof(T) <= alignof(std::max_align_t)),
+                  "The callback does not fit into TaskQueue::kCbCapacity, capture less or wrap it "
+                  "with TaskQueue::Boxed");
+  }
 
-  typedef std::function<void()> CbFunc;
+  void TaskLoop();
 
   using FuncQ = base::mpmc_bounded_queue<CbFunc>;
   FuncQ queue_;
 
   util::fb2::EventCount push_ec_, pull_ec_;
   std::atomic_bool is_closed_{false};
+  std::atomic_int backlog_{0};
   unsigned num_consumers_;
   std::unique_ptr<util::fb2::Fiber[]> consumer_fiber_;
   unsigned concurrency_level_ = 0;
@@ -0,0 +1,190 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dfly {
+
+// Hierarchical timer wheel with millisecond ticks. Level L has kSlots slots, each covering
+// kSlots^L ticks, so kLevels levels cover kSlots^kLevels ticks (~4.6 hours) ahead of the
+// current tick; entries that are further away are kept in an overflow list that is re-examined
+// once per full rotation. Entries are never removed individually - owners are expected to
+// validate an entry when it fires.
+template <typename T> class TimerWheel {
+ public:
+  static constexpr unsigned kSlotBits = 6;
+  static constexpr unsigned kSlots = 1u << kSlotBits;
+  static constexpr unsigned kLevels = 4;
+
+  explicit TimerWheel(uint64_t now_ms = 0) : current_(now_ms) {
+  }
+
+  // Schedules value to fire at deadline_ms. Deadlines in the past fire on the next Advance.
+  void Add(uint64_t deadline_ms, T value) {
+    uint64_t tick = std::max(deadline_ms, current_ + 1);
+    Place(Entry{tick, std::move(value)});
+    ++size_;
+  }
+
+  // Fires all entries with deadlines up to now_ms, at most limit of them, by calling
+  // cb(deadline_ms, T&&). Returns number of fired entries. If the limit is reached, the wheel
+  // stays behind now_ms and the next call continues from where this one stopped.
+  // cb may add new entries, but they should be scheduled after now_ms.
+  template <typename Cb> size_t Advance(uint64_t now_ms, size_t limit, Cb&& cb);
+
+  // Drops all entries, keeping the current tick.
+  void Clear();
+
+  size_t size() const {
+    return size_;
+  }
+
+  // Bytes allocated for the slots, not including memory owned by the values.
+  size_t MemUsage() const;
+
+  // How far the wheel is behind now_ms, i.e. for how long the due entries wait to be fired.
+  uint64_t lag(uint64_t now_ms) const {
+    return now_ms > current_ ? now_ms - current_ : 0;
+  }
+
+ private:
+  struct Entry {
+    uint64_t tick;
+    T value;
+  };
+
+  using Slot = std::vector<Entry>;
+
+  static constexpr uint64_t LevelSpan(unsigned level) {
+    return uint64_t(1) << (kSlotBits * level);
+  }
+
+  void Place(Entry&& e);
+
+  // Redistributes the entries of the higher level slots that start at tick.
+  void Cascade(uint64_t tick);
+
+  std::array<std::array<Slot, kSlots>, kLevels> levels_;
+  std::array<size_t, kLevels> level_size_{};  // Used to skip the ticks of empty levels.
+  Slot overflow_;
+  uint64_t current_;  // Last tick that was fully processed.
+  size_t size_ = 0;
+  bool cascaded_ = false;  // Whether Cascade was called for current_ + 1.
+};
+
+template <typename T> void TimerWheel<T>::Place(Entry&& e) {
+  // Relative to the next tick to process, so that a level 0 rotation covers it as well.
+  uint64_t delta = e.tick - (current_ + 1);
+  for (unsigned level = 0; level < kLevels; ++level) {
+    if (delta < LevelSpan(level + 1)) {
+      unsigned slot = (e.tick >> (kSlotBits * level)) & (kSlots - 1);
+      levels_[level][slot].push_back(std::move(e));
+      ++level_size_[level];
+      return;
+    }
+  }
+  overflow_.push_back(std::move(e));
+}
+
+template <typename T> void TimerWheel<T>::Cascade(uint64_t tick) {
+  if (tick % LevelSpan(kLevels) == 0) {
+    Slot overflow = std::move(overflow_);
+    overflow_.clear();
+    for (auto& e : overflow)
+      Place(std::move(e));
+  }
+
+  // Higher levels first, so that their entries can cascade further down at the same tick.
+  for (unsigned level = kLevels - 1; level > 0; --level) {
+    if (tick % LevelSpan(level) != 0)
+      continue;
+
+    Slot& slot = levels_[level][(tick >> (kSlotBits * level)) & (kSlots - 1)];
+    Slot entries = std::move(slot);
+    slot.clear();
+    level_size_[level] -= entries.size();
+    for (auto& e : entries)
+      Place(std::move(e));
+  }
+}
+
+template <typename T> size_t TimerWheel<T>::MemUsage() const {
+  size_t res = overflow_.capacity();
+  for (const auto& level : levels_) {
+    for (const auto& slot : level)
+      res += slot.capacity();
+  }
+  return res * sizeof(Entry);
+}
+
+template <typename T> void TimerWheel<T>::Clear() {
+  for (auto& level : levels_) {
+    for (auto& slot : level)
+      slot.clear();
+  }
+  level_size_.fill(0);
+  overflow_.clear();
+  size_ = 0;
+  cascaded_ = false;
+}
+
+template <typename T>
+template <typename Cb>
+size_t TimerWheel<T>::Advance(uint64_t now_ms, size_t limit, Cb&& cb) {
+  size_t fired = 0;
+  while (current_ < now_ms) {
+    if (size_ == 0) {
+      current_ = now_ms;
+      cascaded_ = false;
+      break;
+    }
+
+    uint64_t tick = current_ + 1;
+    if (!cascaded_) {
+      // Nothing fires before the first non-empty level cascades, so jump to that tick.
+      unsigned level = 0;
+      while (level < kLevels && level_size_[level] == 0)
+        ++level;
+      if (level > 0) {
+        uint64_t span = LevelSpan(level);
+        uint64_t next = (tick + span - 1) / span * span;
+        if (next > now_ms) {
+          current_ = now_ms;
+          break;
+        }
+        tick = next;
+        current_ = tick - 1;
+      }
+
+      Cascade(tick);
+      cascaded_ = true;
+    }
+
+    Slot& slot = levels_[0][tick & (kSlots - 1)];
+    while (!slot.empty()) {
+      if (fired == limit)
+        return fired;
+
+      Entry e = std::move(slot.back());
+      slot.pop_back();
+      --level_size_[0];
+      --size_;
+      ++fired;
+      cb(e.tick, std::move(e.value));
+    }
+
+    current_ = tick;
+    cascaded_ = false;
+  }
+
+  return fired;
+}
+
+}  // namespace dfly
@@ -0,0 +1,111 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/timer_wheel.h"
+
+#include <absl/random/random.h>
+#include <gmock/gmock.h>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+class TimerWheelTest : public ::testing::Test {
+ protected:
+  static constexpr uint64_t kStart = 1000000;
+
+  TimerWheel<uint32_t> wheel_{kStart};
+};
+
+TEST_F(TimerWheelTest, Basic) {
+  wheel_.Add(kStart + 10, 1);
+  wheel_.Add(kStart + 5, 2);
+  wheel_.Add(kStart - 5, 3);  // already due
+  EXPECT_EQ(3, wheel_.size());
+
+  vector<uint32_t> fired;
+  auto cb = [&](uint64_t, uint32_t val) { fired.push_back(val); };
+
+  EXPECT_EQ(1, wheel_.Advance(kStart + 4, 10, cb));
+  EXPECT_THAT(fired, testing::ElementsAre(3));
+
+  EXPECT_EQ(2, wheel_.Advance(kStart + 10, 10, cb));
+  EXPECT_THAT(fired, testing::ElementsAre(3, 2, 1));
+  EXPECT_EQ(0, wheel_.size());
+  EXPECT_EQ(0, wheel_.lag(kStart + 10));
+}
+
+TEST_F(TimerWheelTest, Limit) {
+  for (uint32_t i = 0; i < 10; ++i) {
+    wheel_.Add(kStart + 1, i);
+  }
+
+  size_t fired = 0;
+  auto cb = [&](uint64_t, uint32_t) { ++fired; };
+  EXPECT_EQ(4, wheel_.Advance(kStart + 100, 4, cb));
+  EXPECT_EQ(100, wheel_.lag(kStart + 100));
+  EXPECT_EQ(4, wheel_.Advance(kStart + 100, 4, cb));
+  EXPECT_EQ(2, wheel_.Advance(kStart + 100, 4, cb));
+  EXPECT_EQ(10, fired);
+  EXPECT_EQ(0, wheel_.lag(kStart + 100));
+}
+
+TEST_F(TimerWheelTest, FarAway) {
+  constexpr uint64_t kFar = uint64_t(1) << 40;
+  wheel_.Add(kStart + kFar, 1);
+  wheel_.Add(kStart + 100000, 2);
+
+  vector<uint32_t> fired;
+  auto cb = [&](uint64_t, uint32_t val) { fired.push_back(val); };
+
+  // Empty levels are skipped, so it does not take 2^40 iterations.
+  EXPECT_EQ(1, wheel_.Advance(kStart + kFar - 1, 10, cb));
+  EXPECT_EQ(1, wheel_.Advance(kStart + kFar, 10, cb));
+  EXPECT_THAT(fired, testing::ElementsAre(2, 1));
+
+  wheel_.Add(kStart + kFar + 10, 3);
+  wheel_.Clear();
+  EXPECT_EQ(0, wheel_.size());
+  EXPECT_EQ(0, wheel_.Advance(kStart + kFar + 10, 10, cb));
+}
+
+TEST_F(TimerWheelTest, Random) {
+  constexpr uint32_t kNumItems = 20000;
+  constexpr uint64_t kHorizon = uint64_t(1) << 26;  // beyond the reach of all levels.
+
+  absl::BitGen gen;
+  vector<uint64_t> deadlines(kNumItems);
+  for (uint32_t i = 0; i < kNumItems; ++i) {
+    // Mix near and far deadlines.
+    uint64_t range = absl::Bernoulli(gen, 0.5) ? 5000 : kHorizon;
+    deadlines[i] = kStart + absl::Uniform<uint64_t>(gen, 0, range);
+    wheel_.Add(deadlines[i], i);
+  }
+
+  vector<bool> seen(kNumItems);
+  uint64_t now = kStart;
+  auto cb = [&](uint64_t deadline, uint32_t val) {
+    ASSERT_FALSE(seen[val]);
+    ASSERT_LE(deadlines[val], now);
+    ASSERT_EQ(max(deadlines[val], kStart + 1), deadline);
+    seen[val] = true;
+  };
+
+  while (wheel_.size() > 0) {
+    now += absl::Uniform<uint64_t>(gen, 1, 20000);
+    wheel_.Advance(now, SIZE_MAX, cb);
+
+    // Everything that is due has fired.
+    for (uint32_t i = 0; i < kNumItems; i += 97) {
+      ASSERT_EQ(deadlines[i] <= now, seen[i]) << i << " " << deadlines[i] << " " << now;
+    }
+  }
+
+  EXPECT_EQ(kNumItems, count(seen.begin(), seen.end(), true));
+}
+
+}  // namespace dfly
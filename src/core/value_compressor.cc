@@ -0,0 +1,176 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/value_compressor.h"
+
+#include <absl/base/internal/endian.h>
+#include <zdict.h>
+#include <zstd.h>
+
+#include <atomic>
+#include <cmath>
+
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+constexpr int kCompressionLevel = 1;
+
+// Values are stored compressed only if that saves at least 1/8 of their size.
+constexpr unsigned kMinSavingsShift = 3;
+
+// Values with a higher byte entropy are most likely compressed or encrypted already.
+constexpr double kMaxEntropy = 7.0;
+constexpr size_t kEntropyPrefix = 1024;
+
+constexpr size_t kMaxSampleLen = 4096;
+constexpr size_t kNumSamples = 256;
+constexpr size_t kDictCapacity = 16384;
+
+// Decompression dictionaries by id, id 0 is reserved for "no dictionary".
+atomic<ZSTD_DDict*> ddicts[ValueCompressor::kMaxDictionaries];
+atomic_uint32_t next_dict_id{1};
+
+struct DecompressionContext {
+  ZSTD_DCtx* dctx = ZSTD_createDCtx();
+  ~DecompressionContext() {
+    ZSTD_freeDCtx(dctx);
+  }
+};
+
+}  // namespace
+
+ValueCompressor::ValueCompressor(size_t min_size) : min_size_(min_size) {
+  cctx_ = ZSTD_createCCtx();
+}
+
+ValueCompressor::~ValueCompressor() {
+  ZSTD_freeCDict(cdict_);
+  ZSTD_freeCCtx(cctx_);
+}
+
+optional<string_view> ValueCompressor::Compress(string_view value) {
+  if (value.size() < min_size_ || value.size() > UINT32_MAX || Entropy(value) > kMaxEntropy)
+    return nullopt;
+
+  if (!training_done_)
+    AddSample(value);
+
+  buf_.resize(kHeaderSize + ZSTD_compressBound(value.size()));
+  char* dest = buf_.data() + kHeaderSize;
+  size_t dest_cap = buf_.size() - kHeaderSize;
+  size_t res;
+  if (cdict_) {
+    res = ZSTD_compress_usingCDict(cctx_, dest, dest_cap, value.data(), value.size(), cdict_);
+  } else {
+    res = ZSTD_compressCCtx(cctx_, dest, dest_cap, value.data(), value.size(), kCompressionLevel);
+  }
+
+  if (ZSTD_isError(res)) {
+    LOG(DFATAL) << "Compression failed " << ZSTD_getErrorName(res);
+    return nullopt;
+  }
+
+  size_t blob_len = kHeaderSize + res;
+  if (blob_len > value.size() - (value.size() >> kMinSavingsShift))
+    return nullopt;
+
+  absl::little_endian::Store32(buf_.data(), value.size());
+  absl::little_endian::Store16(buf_.data() + 4, dict_id_);
+  return string_view{buf_.data(), blob_len};
+}
+
+uint32_t ValueCompressor::DecompressedSize(string_view blob) {
+  DCHECK_GT(blob.size(), kHeaderSize);
+  return absl::little_endian::Load32(blob.data());
+}
+
+void ValueCompressor::Decompress(string_view blob, char* dest) {
+  thread_local DecompressionContext ctx;
+
+  uint32_t len = DecompressedSize(blob);
+  uint16_t dict_id = absl::little_endian::Load16(blob.data() + 4);
+  const char* src = blob.data() + kHeaderSize;
+  size_t src_len = blob.size() - kHeaderSize;
+
+  size_t res;
+  if (dict_id) {
+    ZSTD_DDict* ddict = ddicts[dict_id].load(memory_order_acquire);
+    DCHECK(ddict);
+    res = ZSTD_decompress_usingDDict(ctx.dctx, dest, len, src, src_len, ddict);
+  } else {
+    res = ZSTD_decompressDCtx(ctx.dctx, dest, len, src, src_len);
+  }
+  CHECK(!ZSTD_isError(res) && res == len) << "Corrupted compressed value";
+}
+
+double ValueCompressor::Entropy(string_view value) {
+  value = value.substr(0, kEntropyPrefix);
+
+  unsigned counts[256] = {0};
+  for (char c : value)
+    ++counts[uint8_t(c)];
+
+  double res = 0;
+  double total = value.size();
+  for (unsigned cnt : counts) {
+    if (cnt) {
+      double p = cnt / total;
+      res -= p * log2(p);
+    }
+  }
+  return res;
+}
+
+void ValueCompressor::AddSample(string_view value) {
+  value = value.substr(0, kMaxSampleLen);
+  samples_.append(value);
+  sample_sizes_.push_back(value.size());
+
+  if (sample_sizes_.size() >= kNumSamples)
+    TrainDictionary();
+}
+
+void ValueCompressor::TrainDictionary() {
+  training_done_ = true;
+
+  string dict(kDictCapacity, '\0');
+  size_t res = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples_.data(),
+                                     sample_sizes_.data(), sample_sizes_.size());
+
+  samples_ = string{};
+  sample_sizes_ = vector<size_t>{};
+
+  // Training fails if the samples do not have enough in common.
+  if (ZDICT_isError(res)) {
+    VLOG(1) << "Could not train compression dictionary " << ZDICT_getErrorName(res);
+    return;
+  }
+
+  uint32_t id = next_dict_id.fetch_add(1, memory_order_relaxed);
+  if (id >= kMaxDictionaries) {
+    LOG(WARNING) << "Too many compression dictionaries";
+    return;
+  }
+
+  ZSTD_DDict* ddict = ZSTD_createDDict(dict.data(), res);
+  ZSTD_CDict* cdict = ZSTD_createCDict(dict.data(), res, kCompressionLevel);
+  if (!ddict || !cdict) {
+    ZSTD_freeDDict(ddict);
+    ZSTD_freeCDict(cdict);
+    return;
+  }
+
+  // The decompression dictionary is leaked on purpose, blobs that reference it may outlive
+  // this instance.
+  ddicts[id].store(ddict, memory_order_release);
+  cdict_ = cdict;
+  dict_id_ = id;
+}
+
+}  // namespace dfly
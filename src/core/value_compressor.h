@@ -0,0 +1,72 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+typedef struct ZSTD_CCtx_s ZSTD_CCtx;
+typedef struct ZSTD_CDict_s ZSTD_CDict;
+
+namespace dfly {
+
+// Compresses large string values with zstd. The first compressible values seen by the instance
+// are sampled to train a zstd dictionary, so that values with a similar structure, like json
+// documents of the same schema, compress well even when each one of them is only a few hundred
+// bytes long. Values which are too short or look random are not compressed.
+//
+// A compressed blob consists of a header with the decompressed length and the id of the
+// dictionary, followed by the zstd frame. Dictionaries are registered globally and never
+// freed, so blobs can be decompressed on any thread.
+// Compress is not thread-safe, the instance is meant to be used per shard.
+class ValueCompressor {
+ public:
+  static constexpr size_t kHeaderSize = 6;
+  static constexpr size_t kMaxDictionaries = 1024;
+
+  // Values shorter than min_size are never compressed.
+  explicit ValueCompressor(size_t min_size);
+  ValueCompressor(const ValueCompressor&) = delete;
+  ~ValueCompressor();
+
+  // Returns the compressed blob of value if it is worth storing it compressed.
+  // The blob is valid until the next call.
+  std::optional<std::string_view> Compress(std::string_view value);
+
+  static uint32_t DecompressedSize(std::string_view blob);
+
+  // dest must have at least DecompressedSize(blob) bytes available. Thread-safe.
+  static void Decompress(std::string_view blob, char* dest);
+
+  bool has_dictionary() const {
+    return dict_id_ != 0;
+  }
+
+  size_t min_size() const {
+    return min_size_;
+  }
+
+ private:
+  // Estimated Shannon entropy in bits per byte of a prefix of value.
+  static double Entropy(std::string_view value);
+
+  void AddSample(std::string_view value);
+  void TrainDictionary();
+
+  size_t min_size_;
+  ZSTD_CCtx* cctx_;
+  ZSTD_CDict* cdict_ = nullptr;
+  uint16_t dict_id_ = 0;  // 0 - no dictionary.
+  bool training_done_ = false;
+
+  std::string samples_;
+  std::vector<size_t> sample_sizes_;
+  std::string buf_;
+};
+
+}  // namespace dfly
@@ -0,0 +1,64 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/value_dedup.h"
+
+#include <xxhash.h>
+
+#include <cstring>
+
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+ValueDedupTable::~ValueDedupTable() {
+  for (const auto& [hash, blob] : index_)
+    Free(blob);
+}
+
+const char* ValueDedupTable::Acquire(string_view value) {
+  XXH128_hash_t hash = XXH3_128bits(value.data(), value.size());
+  auto [it, inserted] = index_.try_emplace({hash.low64, hash.high64}, nullptr);
+  if (!inserted) {
+    Blob* blob = it->second;
+    if (string_view{blob->data(), blob->len} != value)
+      return nullptr;
+
+    ++blob->refs;
+    saved_bytes_ += blob->len;
+    return blob->data();
+  }
+
+  DCHECK_LT(value.size(), 1ull << 32);
+  void* ptr = mr_->allocate(sizeof(Blob) + value.size(), alignof(Blob));
+  Blob* blob = new (ptr) Blob{{hash.low64, hash.high64}, 1, uint32_t(value.size())};
+  memcpy(blob->data(), value.data(), value.size());
+
+  blob_bytes_ += sizeof(Blob) + value.size();
+  it->second = blob;
+  return blob->data();
+}
+
+void ValueDedupTable::Release(const char* data) {
+  Blob* blob = FromData(data);
+  DCHECK_GT(blob->refs, 0u);
+
+  if (--blob->refs > 0) {
+    saved_bytes_ -= blob->len;
+    return;
+  }
+
+  index_.erase(pair{blob->hash[0], blob->hash[1]});
+  Free(blob);
+}
+
+void ValueDedupTable::Free(Blob* blob) {
+  size_t bytes = sizeof(Blob) + blob->len;
+  blob_bytes_ -= bytes;
+  mr_->deallocate(blob, bytes, alignof(Blob));
+}
+
+}  // namespace dfly
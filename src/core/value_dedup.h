@@ -0,0 +1,82 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+
+#include <cstdint>
+#include <string_view>
+#include <utility>
+
+#include "base/pmr/memory_resource.h"
+
+namespace dfly {
+
+// Content addressed store of immutable string values, which lets identical large values share
+// a single copy. A blob is indexed by the 128-bit hash of its bytes and is reference counted by
+// the values that use it. Blobs are never modified: a value that changes is stored anew and
+// releases its reference, so sharing is copy-on-write.
+// A blob is referenced by the pointer to its bytes, which follow a header with its hash,
+// reference count and length.
+// Not thread-safe, meant to be used per shard.
+class ValueDedupTable {
+ public:
+  using MemoryResource = PMR_NS::memory_resource;
+
+  explicit ValueDedupTable(MemoryResource* mr) : mr_(mr) {
+  }
+  ValueDedupTable(const ValueDedupTable&) = delete;
+  ~ValueDedupTable();
+
+  // References the blob holding value, which is created if needed, and returns its bytes.
+  // Returns nullptr if the hash of value collides with a blob of different contents.
+  const char* Acquire(std::string_view value);
+
+  // Drops a reference of the blob and frees it with the last one.
+  void Release(const char* data);
+
+  static uint32_t RefCount(const char* data) {
+    return FromData(data)->refs;
+  }
+
+  // Number of blobs.
+  size_t size() const {
+    return index_.size();
+  }
+
+  // Bytes allocated for the blobs.
+  size_t blob_bytes() const {
+    return blob_bytes_;
+  }
+
+  // Bytes that the values sharing blobs would have needed for their own copies.
+  size_t saved_bytes() const {
+    return saved_bytes_;
+  }
+
+ private:
+  struct Blob {
+    uint64_t hash[2];
+    uint32_t refs;
+    uint32_t len;
+
+    char* data() {
+      return reinterpret_cast<char*>(this + 1);
+    }
+  };
+
+  static Blob* FromData(const char* data) {
+    return reinterpret_cast<Blob*>(const_cast<char*>(data)) - 1;
+  }
+
+  void Free(Blob* blob);
+
+  MemoryResource* mr_;
+  absl::flat_hash_map<std::pair<uint64_t, uint64_t>, Blob*> index_;
+  size_t blob_bytes_ = 0;
+  size_t saved_bytes_ = 0;
+};
+
+}  // namespace dfly
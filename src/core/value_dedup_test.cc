@@ -0,0 +1,53 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "core/value_dedup.h"
+
+#include "base/gtest.h"
+#include "base/logging.h"
+
+namespace dfly {
+
+using namespace std;
+
+class ValueDedupTableTest : public ::testing::Test {
+ protected:
+  ValueDedupTable table_{PMR_NS::get_default_resource()};
+};
+
+TEST_F(ValueDedupTableTest, Share) {
+  string val(1000, 'a');
+  const char* data = table_.Acquire(val);
+  ASSERT_NE(data, nullptr);
+  EXPECT_EQ(val, string_view(data, val.size()));
+  EXPECT_EQ(1u, ValueDedupTable::RefCount(data));
+  EXPECT_EQ(0u, table_.saved_bytes());
+  EXPECT_GT(table_.blob_bytes(), val.size());
+
+  EXPECT_EQ(data, table_.Acquire(string(1000, 'a')));
+  EXPECT_EQ(data, table_.Acquire(val));
+  EXPECT_EQ(3u, ValueDedupTable::RefCount(data));
+  EXPECT_EQ(2 * val.size(), table_.saved_bytes());
+
+  const char* other = table_.Acquire(val + "b");
+  EXPECT_NE(other, data);
+  EXPECT_EQ(2u, table_.size());
+
+  table_.Release(data);
+  table_.Release(data);
+  EXPECT_EQ(1u, ValueDedupTable::RefCount(data));
+  EXPECT_EQ(0u, table_.saved_bytes());
+  table_.Release(data);
+  EXPECT_EQ(1u, table_.size());
+
+  // The bytes of a freed blob can be shared again.
+  data = table_.Acquire(val);
+  EXPECT_EQ(1u, ValueDedupTable::RefCount(data));
+  table_.Release(data);
+  table_.Release(other);
+  EXPECT_EQ(0u, table_.size());
+  EXPECT_EQ(0u, table_.blob_bytes());
+}
+
+}  // namespace dfly
@@ -0,0 +1,59 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "facade/arg_arena.h"
+
+#include <mimalloc.h>
+
+namespace facade {
+
+using namespace std;
+
+ArgArena::~ArgArena() {
+  Reset(false);
+}
+
+char* ArgArena::Allocate(size_t sz) {
+  used_ += sz;
+
+  if (sz > kBlockSize / 2)
+    return NewBlock(sz);
+
+  if (size_t(end_ - next_) < sz) {
+    next_ = NewBlock(kBlockSize);
+    end_ = next_ + kBlockSize;
+  }
+
+  char* res = next_;
+  next_ += sz;
+  return res;
+}
+
+void ArgArena::Reset(bool keep_block) {
+  Block kept{nullptr, 0};
+  for (const Block& block : blocks_) {
+    if (keep_block && !kept.ptr && block.size == kBlockSize)
+      kept = block;
+    else
+      mi_free(block.ptr);
+  }
+
+  blocks_.clear();
+  used_ = 0;
+  capacity_ = kept.size;
+  next_ = end_ = kept.ptr;
+  if (kept.ptr) {
+    blocks_.push_back(kept);
+    end_ += kBlockSize;
+  }
+}
+
+char* ArgArena::NewBlock(size_t size) {
+  char* ptr = static_cast<char*>(mi_malloc(size));
+  blocks_.push_back({ptr, size});
+  capacity_ += size;
+  return ptr;
+}
+
+}  // namespace facade
@@ -0,0 +1,56 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <cstddef>
+#include <vector>
+
+namespace facade {
+
+// Bump pointer arena for the arguments of pipelined commands of a single connection.
+// Allocations are never freed individually, the whole arena is reset once none of them
+// is referenced anymore. Allocations larger than half a block get a block of their own, so
+// that a single big value does not waste the rest of the current block.
+// Not thread-safe.
+class ArgArena {
+ public:
+  static constexpr size_t kBlockSize = 16384;
+
+  ArgArena() = default;
+  ArgArena(const ArgArena&) = delete;
+  ~ArgArena();
+
+  char* Allocate(size_t sz);
+
+  // Invalidates all allocations. If keep_block is true, one block of kBlockSize is retained
+  // for the next allocations.
+  void Reset(bool keep_block);
+
+  // Total size of the blocks held by the arena.
+  size_t Capacity() const {
+    return capacity_;
+  }
+
+  // Bytes allocated since the last reset.
+  size_t Used() const {
+    return used_;
+  }
+
+ private:
+  struct Block {
+    char* ptr;
+    size_t size;
+  };
+
+  char* NewBlock(size_t size);
+
+  std::vector<Block> blocks_;
+  char* next_ = nullptr;  // bump pointer into the current block
+  char* end_ = nullptr;   // end of the current block
+  size_t capacity_ = 0;
+  size_t used_ = 0;
+};
+
+}  // namespace facade
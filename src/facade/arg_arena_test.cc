@@ -0,0 +1,62 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "facade/arg_arena.h"
+
+#include <gmock/gmock.h>
+
+#include <cstring>
+
+using namespace testing;
+using namespace std;
+
+namespace facade {
+
+class ArgArenaTest : public testing::Test {
+ protected:
+  ArgArena arena_;
+};
+
+TEST_F(ArgArenaTest, Bump) {
+  char* a = arena_.Allocate(10);
+  char* b = arena_.Allocate(20);
+  EXPECT_EQ(a + 10, b);
+  EXPECT_EQ(30u, arena_.Used());
+  EXPECT_EQ(ArgArena::kBlockSize, arena_.Capacity());
+
+  char* c = arena_.Allocate(ArgArena::kBlockSize / 2);
+  EXPECT_EQ(b + 20, c);
+
+  // Does not fit into the current block.
+  c = arena_.Allocate(ArgArena::kBlockSize / 2);
+  EXPECT_EQ(2 * ArgArena::kBlockSize, arena_.Capacity());
+  memset(c, 'x', ArgArena::kBlockSize / 2);
+}
+
+TEST_F(ArgArenaTest, LargeAllocation) {
+  char* a = arena_.Allocate(8);
+  char* big = arena_.Allocate(ArgArena::kBlockSize * 4);
+  memset(big, 'x', ArgArena::kBlockSize * 4);
+
+  // The current block keeps serving small allocations.
+  EXPECT_EQ(a + 8, arena_.Allocate(8));
+  EXPECT_EQ(ArgArena::kBlockSize * 5, arena_.Capacity());
+}
+
+TEST_F(ArgArenaTest, Reset) {
+  arena_.Allocate(ArgArena::kBlockSize * 2);
+  char* a = arena_.Allocate(100);
+  arena_.Allocate(ArgArena::kBlockSize);
+
+  arena_.Reset(true);
+  EXPECT_EQ(0u, arena_.Used());
+  EXPECT_EQ(ArgArena::kBlockSize, arena_.Capacity());
+  EXPECT_EQ(a, arena_.Allocate(10));
+
+  arena_.Reset(false);
+  EXPECT_EQ(0u, arena_.Capacity());
+  EXPECT_NE(nullptr, arena_.Allocate(10));
+}
+
+}  // namespace facade
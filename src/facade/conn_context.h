@@ -110,6 +110,7 @@ class ConnectionContext {
 
   // TODO fix inherit actual values from default
   std::string authed_username{"default"};
+  std::string client_class;  // set by CLIENT SETINFO CLASS, authed_username is used if empty
   std::vector<uint64_t> acl_commands;
   // keys
   dfly::acl::AclKeys keys{{}, true};
@@ -6,7 +6,9 @@
 
 #include <absl/container/flat_hash_map.h>
 #include <absl/strings/match.h>
+#include <absl/strings/numbers.h>
 #include <absl/strings/str_cat.h>
+#include <absl/strings/str_split.h>
 #include <mimalloc.h>
 
 #include <numeric>
@@ -57,7 +59,22 @@ ABSL_FLAG(uint64_t, publish_buffer_limit, 128_MB,
 ABSL_FLAG(bool, no_tls_on_admin_port, false, "Allow non-tls connections on admin port");
 
 ABSL_FLAG(uint64_t, pipeline_squash, 10,
-          "Number of queued pipelined commands above which squashing is enabled, 0 means disabled");
+          "Number of queued pipelined commands above which squashing is enabled, 0 means disabled. "
+          "Connections lower the threshold when squashing turns out to be faster.");
+
+ABSL_FLAG(uint32_t, pipeline_squash_batch_usec, 1000,
+          "Target latency of a single squashed batch, longer pipelines are squashed in several "
+          "batches so that the first replies are sent earlier. 0 means unlimited.");
+
+ABSL_FLAG(uint32_t, dispatch_budget_usec, 0,
+          "If positive, a connection that dispatches a pipeline yields to the other connections of "
+          "its thread each time it ran commands for this long. The budget is multiplied by the "
+          "weight of the client class, see dispatch_class_weights. 0 means no budget.");
+
+ABSL_FLAG(string, dispatch_class_weights, "",
+          "Comma separated list of class:weight pairs that scale dispatch_budget_usec. The class "
+          "of a client is its ACL user, unless it set one of the listed classes with "
+          "CLIENT SETINFO CLASS. Unlisted classes have weight 1.");
 
 // When changing this constant, also update `test_large_cmd` test in connection_test.py.
 ABSL_FLAG(uint32_t, max_multi_bulk_len, 1u << 16,
@@ -92,6 +109,20 @@ void SendProtocolError(RedisParser::Result pres, SinkReplyBuilder* builder) {
 // TODO: to implement correct matcher according to HTTP spec
 // https://www.w3.org/Protocols/rfc2616/rfc2616-sec5.html
 // One place to find a good implementation would be https://github.com/h2o/picohttpparser
+absl::flat_hash_map<string, double> ParseClassWeights(string_view weights) {
+  absl::flat_hash_map<string, double> res;
+  for (string_view entry : absl::StrSplit(weights, ',', absl::SkipEmpty())) {
+    pair<string_view, string_view> kv = absl::StrSplit(entry, absl::MaxSplits(':', 1));
+    double weight = 0;
+    if (!absl::SimpleAtod(kv.second, &weight) || weight <= 0) {
+      LOG(ERROR) << "Invalid dispatch class weight " << entry;
+      exit(-1);
+    }
+    res[kv.first] = weight;
+  }
+  return res;
+}
+
 bool MatchHttp11Line(string_view line) {
   return (absl::StartsWith(line, "GET ") || absl::StartsWith(line, "POST ")) &&
          absl::EndsWith(line, "HTTP/1.1");
@@ -108,38 +139,39 @@ void UpdateIoBufCapacity(const io::IoBuf& io_buf, ConnectionStats* stats,
   }
 }
 
+// Records are collected in memory and written in large chunks, so that recording costs a copy
+// per command rather than a file write.
+constexpr size_t kTrafficFlushSize = 64_KB;
+
 struct TrafficLogger {
   // protects agains closing the file while writing or data races when opening the file.
   // Also, makes sure that LogTraffic are executed atomically.
   fb2::Mutex mutex;
   unique_ptr<io::WriteFile> log_file;
+  string buffer;  // records not written yet
 
+  // Writes the remaining records and closes the file.
   void ResetLocked();
-  // Returns true if Write succeeded, false if it failed and the recording should be aborted.
-  bool Write(string_view blob);
-  bool Write(iovec* blobs, size_t len);
+
+  // Returns true if the write succeeded, false if it failed and the recording was aborted.
+  bool Flush();
 };
 
 void TrafficLogger::ResetLocked() {
   if (log_file) {
+    if (!buffer.empty()) {
+      auto ec = log_file->Write(io::Buffer(buffer));
+      LOG_IF(ERROR, ec) << "Error writing to traffic log: " << ec;
+    }
     log_file->Close();
     log_file.reset();
   }
+  buffer.clear();
 }
 
-// Returns true if Write succeeded, false if it failed and the recording should be aborted.
-bool TrafficLogger::Write(string_view blob) {
-  auto ec = log_file->Write(io::Buffer(blob));
-  if (ec) {
-    LOG(ERROR) << "Error writing to traffic log: " << ec;
-    ResetLocked();
-    return false;
-  }
-  return true;
-}
-
-bool TrafficLogger::Write(iovec* blobs, size_t len) {
-  auto ec = log_file->Write(blobs, len);
+bool TrafficLogger::Flush() {
+  auto ec = log_file->Write(io::Buffer(buffer));
+  buffer.clear();
   if (ec) {
     LOG(ERROR) << "Error writing to traffic log: " << ec;
     ResetLocked();
@@ -182,22 +214,27 @@ void LogTraffic(uint32_t id, bool has_more, absl::Span<RespExpr> resp,
 
   DVLOG(2) << "Recording " << cmd;
 
-  char stack_buf[1024];
-  char* next = stack_buf;
+  // Grab the lock and check if the file is still open.
+  lock_guard lk{tl_traffic_logger.mutex};
+  if (!tl_traffic_logger.log_file)
+    return;
 
   // We write id, timestamp, db_index, has_more, num_parts, part_len, part_len, part_len, ...
   // And then all the part blobs concatenated together.
-  auto write_u32 = [&next](uint32_t i) {
-    absl::little_endian::Store32(next, i);
-    next += 4;
+  string& buffer = tl_traffic_logger.buffer;
+  auto write_u32 = [&buffer](uint32_t i) {
+    char tmp[4];
+    absl::little_endian::Store32(tmp, i);
+    buffer.append(tmp, sizeof(tmp));
   };
 
   // id
   write_u32(id);
 
   // timestamp
-  absl::little_endian::Store64(next, absl::GetCurrentTimeNanos());
-  next += 8;
+  char timestamp[8];
+  absl::little_endian::Store64(timestamp, absl::GetCurrentTimeNanos());
+  buffer.append(timestamp, sizeof(timestamp));
 
   // db_index
   write_u32(ci.db_index);
@@ -206,47 +243,29 @@ void LogTraffic(uint32_t id, bool has_more, absl::Span<RespExpr> resp,
   write_u32(has_more ? 1 : 0);
   write_u32(uint32_t(resp.size()));
 
-  // Grab the lock and check if the file is still open.
-  lock_guard lk{tl_traffic_logger.mutex};
-  if (!tl_traffic_logger.log_file)
-    return;
-
   // part_len, ...
   for (auto part : resp) {
-    if (size_t(next - stack_buf + 4) > sizeof(stack_buf)) {
-      if (!tl_traffic_logger.Write(string_view{stack_buf, size_t(next - stack_buf)})) {
-        return;
-      }
-      next = stack_buf;
-    }
     write_u32(part.GetView().size());
   }
 
   // Write the data itself.
-  std::array<iovec, 16> blobs;
-  unsigned index = 0;
-  if (next != stack_buf) {
-    blobs[index++] = iovec{.iov_base = stack_buf, .iov_len = size_t(next - stack_buf)};
-  }
-
   for (auto part : resp) {
-    blobs[index++] = iovec{.iov_base = const_cast<char*>(part.GetView().data()),
-                           .iov_len = part.GetView().size()};
-    if (index >= blobs.size()) {
-      if (!tl_traffic_logger.Write(blobs.data(), blobs.size())) {
-        return;
-      }
-      index = 0;
-    }
+    buffer.append(part.GetView());
   }
 
-  if (index) {
-    tl_traffic_logger.Write(blobs.data(), index);
+  if (buffer.size() >= kTrafficFlushSize) {
+    tl_traffic_logger.Flush();
   }
 }
 
 constexpr size_t kMinReadSize = 256;
 
+// Number of consecutive small reads after which a grown read buffer is released.
+constexpr unsigned kSmallReadsBeforeShrink = 32;
+
+// Arena size of a connection beyond which pipelined arguments are allocated per message.
+constexpr size_t kArgArenaLimit = 64 * ArgArena::kBlockSize;
+
 thread_local uint32_t free_req_release_weight = 0;
 
 const char* kPhaseName[Connection::NUM_PHASES] = {"SETUP", "READ", "PROCESS", "SHUTTING_DOWN",
@@ -255,6 +274,8 @@ const char* kPhaseName[Connection::NUM_PHASES] = {"SETUP", "READ", "PROCESS", "S
 }  // namespace
 
 thread_local vector<Connection::PipelineMessagePtr> Connection::pipeline_req_pool_;
+thread_local bool Connection::pipeline_req_pool_used_ = false;
+thread_local time_t Connection::pipeline_req_pool_last_use_ = 0;
 thread_local Connection::QueueBackpressure Connection::tl_queue_backpressure_;
 
 void Connection::QueueBackpressure::EnsureBelowLimit() {
@@ -275,8 +296,10 @@ struct Connection::Shutdown {
   }
 };
 
-void Connection::PipelineMessage::SetArgs(const RespVec& args) {
-  auto* next = storage.data();
+void Connection::PipelineMessage::SetArgs(const RespVec& args, char* storage,
+                                          size_t storage_size) {
+  this->storage_size = storage_size;
+  auto* next = storage;
   for (size_t i = 0; i < args.size(); ++i) {
     RespExpr::Buffer buf = args[i].GetBuf();
     size_t s = buf.size();
@@ -295,7 +318,8 @@ Connection::MCPipelineMessage::MCPipelineMessage(MemcacheParser::Command cmd_in,
   // but there are no other uses like this so far.
 
   // Compute total size and create backing
-  backing_size = cmd.key.size() + value.size();
+  string_view& opaque = cmd.meta_flags.opaque;
+  backing_size = cmd.key.size() + value.size() + opaque.size();
   for (const auto& ext_key : cmd.keys_ext)
     backing_size += ext_key.size();
 
@@ -321,6 +345,11 @@ Connection::MCPipelineMessage::MCPipelineMessage(MemcacheParser::Command cmd_in,
     key = {backing.get() + offset, key.size()};
     offset += key.size();
   }
+
+  if (!opaque.empty()) {
+    memcpy(backing.get() + offset, opaque.data(), opaque.size());
+    opaque = {backing.get() + offset, opaque.size()};
+  }
 }
 
 void Connection::MessageDeleter::operator()(PipelineMessage* msg) const {
@@ -333,23 +362,24 @@ void Connection::MessageDeleter::operator()(PubMessage* msg) const {
   mi_free(msg);
 }
 
-void Connection::PipelineMessage::Reset(size_t nargs, size_t capacity) {
-  storage.resize(capacity);
+void Connection::PipelineMessage::Reset(size_t nargs) {
   args.resize(nargs);
 }
 
 size_t Connection::PipelineMessage::StorageCapacity() const {
-  return storage.capacity() + args.capacity();
+  return args.capacity() * sizeof(MutableSlice);
 }
 
 size_t Connection::MessageHandle::UsedMemory() const {
   struct MessageSize {
     size_t operator()(const PubMessagePtr& msg) {
+      if (msg->shared_bytes_ref)
+        return sizeof(PubMessage);
       return sizeof(PubMessage) + (msg->channel.size() + msg->message.size());
     }
     size_t operator()(const PipelineMessagePtr& msg) {
       return sizeof(PipelineMessage) + msg->args.capacity() * sizeof(MutableSlice) +
-             msg->storage.capacity();
+             msg->storage_size;
     }
     size_t operator()(const MonitorMessage& msg) {
       return msg.capacity();
@@ -369,7 +399,8 @@ size_t Connection::MessageHandle::UsedMemory() const {
       return 0;  // no access to internal type, memory usage negligible
     }
     size_t operator()(const InvalidationMessage& msg) {
-      return 0;
+      return std::accumulate(msg.keys.begin(), msg.keys.end(), msg.key.capacity(),
+                             [](size_t acc, const auto& key) { return acc + key.capacity(); });
     }
     size_t operator()(const MCPipelineMessagePtr& msg) {
       return sizeof(MCPipelineMessage) + msg->backing_size +
@@ -425,6 +456,9 @@ void Connection::DispatchOperations::operator()(const AclUpdateMessage& msg) {
 
 void Connection::DispatchOperations::operator()(const PubMessage& pub_msg) {
   RedisReplyBuilder* rbuilder = (RedisReplyBuilder*)builder;
+  if (!pub_msg.frame.empty())
+    return rbuilder->SendEncodedPush(pub_msg.frame);
+
   unsigned i = 0;
   array<string_view, 4> arr;
   if (pub_msg.pattern.empty()) {
@@ -470,6 +504,8 @@ void Connection::DispatchOperations::operator()(const InvalidationMessage& msg)
   rbuilder->SendBulkString("invalidate");
   if (msg.invalidate_due_to_flush) {
     rbuilder->SendNull();
+  } else if (!msg.keys.empty()) {
+    rbuilder->SendStringArr(OwnedArgSlice{msg.keys});
   } else {
     std::string_view keys[] = {msg.key};
     rbuilder->SendStringArr(keys);
@@ -587,6 +623,10 @@ void Connection::OnConnectionStart() {
     tl_queue_backpressure_.publish_buffer_limit = absl::GetFlag(FLAGS_publish_buffer_limit);
     tl_queue_backpressure_.pipeline_cache_limit = absl::GetFlag(FLAGS_request_cache_limit);
     tl_queue_backpressure_.pipeline_buffer_limit = absl::GetFlag(FLAGS_pipeline_buffer_limit);
+    tl_queue_backpressure_.dispatch_budget_ns =
+        uint64_t(absl::GetFlag(FLAGS_dispatch_budget_usec)) * 1000;
+    tl_queue_backpressure_.class_weights =
+        ParseClassWeights(absl::GetFlag(FLAGS_dispatch_class_weights));
     if (tl_queue_backpressure_.publish_buffer_limit == 0 ||
         tl_queue_backpressure_.pipeline_cache_limit == 0 ||
         tl_queue_backpressure_.pipeline_buffer_limit == 0) {
@@ -1225,6 +1265,16 @@ auto Connection::IoLoop(util::FiberSocketBase* peer, SinkReplyBuilder* orig_buil
       }
     } else if (parse_status != OK) {
       break;
+    } else if (*recv_sz >= kMinReadSize) {
+      small_read_streak_ = 0;
+    } else if (io_buf_.Capacity() > kMinReadSize && io_buf_.InputLen() == 0 &&
+               ++small_read_streak_ >= kSmallReadsBeforeShrink) {
+      // The buffer was grown for large requests or a deep pipeline, but the connection is back
+      // to small reads. Most connections sit idle most of the time, so we give the memory back
+      // instead of pinning it until the connection closes. We wait for a streak of small reads
+      // so that clients alternating large and small requests do not regrow it every cycle.
+      small_read_streak_ = 0;
+      UpdateIoBufCapacity(io_buf_, stats_, [&]() { io_buf_ = io::IoBuf{kMinReadSize}; });
     }
     ec = orig_builder->GetError();
   } while (peer->IsOpen() && !ec);
@@ -1260,11 +1310,48 @@ bool Connection::ShouldEndDispatchFiber(const MessageHandle& msg) {
   return false;
 }
 
-void Connection::SquashPipeline(facade::SinkReplyBuilder* builder) {
+size_t Connection::PendingMCGets() const {
+  size_t count = 0;
+  for (const auto& msg : dispatch_q_) {
+    auto* mc_msg = get_if<MCPipelineMessagePtr>(&msg.handle);
+    if (!mc_msg || (*mc_msg)->cmd.type != MemcacheParser::GET || (*mc_msg)->cmd.meta)
+      break;
+    ++count;
+  }
+  return count;
+}
+
+void Connection::SquashMCPipeline(facade::SinkReplyBuilder* builder, size_t count) {
+  vector<const MemcacheParser::Command*> cmds(count);
+  for (size_t i = 0; i < count; ++i)
+    cmds[i] = &get<MCPipelineMessagePtr>(dispatch_q_[i].handle)->cmd;
+
+  stats_->squashed_commands += count;
+  stats_->squash_batches[ConnectionStats::SquashBatchBucket(count)]++;
+
+  cc_->async_dispatch = true;
+  service_->DispatchManyMC(absl::MakeSpan(cmds), cc_.get());
+  cc_->async_dispatch = false;
+
+  auto it = dispatch_q_.begin();
+  while (it->IsControl())  // Skip all newly received intrusive messages
+    ++it;
+
+  for (auto rit = it; rit != it + count; ++rit)
+    RecycleMessage(std::move(*rit));
+  dispatch_q_.erase(it, it + count);
+
+  if (dispatch_q_.empty()) {  // Flush as no command is left to do it
+    builder->FlushBatch();
+    builder->SetBatchMode(false);
+  }
+}
+
+void Connection::SquashPipeline(facade::SinkReplyBuilder* builder, size_t max_batch) {
   DCHECK_EQ(dispatch_q_.size(), pending_pipeline_cmd_cnt_);
 
   vector<CmdArgList> squash_cmds;
-  squash_cmds.reserve(dispatch_q_.size());
+  squash_cmds.reserve(min(dispatch_q_.size(), max_batch));
 
   for (auto& msg : dispatch_q_) {
     CHECK(holds_alternative<PipelineMessagePtr>(msg.handle))
@@ -1272,15 +1359,25 @@ void Connection::SquashPipeline(facade::SinkReplyBuilder* builder) {
 
     auto& pmsg = get<PipelineMessagePtr>(msg.handle);
     squash_cmds.push_back(absl::MakeSpan(pmsg->args));
+    if (squash_cmds.size() == max_batch)
+      break;
   }
   stats_->squashed_commands += squash_cmds.size();
+  stats_->squash_batches[ConnectionStats::SquashBatchBucket(squash_cmds.size())]++;
   cc_->async_dispatch = true;
 
+  uint64_t start_ns = ProactorBase::GetMonotonicTimeNs();
   size_t dispatched = service_->DispatchManyCommands(absl::MakeSpan(squash_cmds), cc_.get());
+  if (dispatched > 0) {
+    uint64_t cmd_ns = (ProactorBase::GetMonotonicTimeNs() - start_ns) / dispatched;
+    squash_cmd_ns_ = squash_cmd_ns_ ? (squash_cmd_ns_ * 7 + cmd_ns) / 8 : cmd_ns;
+  }
 
   if (pending_pipeline_cmd_cnt_ == squash_cmds.size()) {  // Flush if no new commands appeared
     builder->FlushBatch();
     builder->SetBatchMode(false);  // in case the next dispatch is sync
+  } else if (squash_cmds.size() == max_batch) {
+    builder->FlushBatch();  // Don't hold the replies of this batch until the next one is done.
   }
 
   cc_->async_dispatch = false;
@@ -1298,6 +1395,18 @@ void Connection::SquashPipeline(facade::SinkReplyBuilder* builder) {
   skip_next_squashing_ = dispatched != squash_cmds.size();
 }
 
+void Connection::UpdateSquashThreshold(uint64_t max_threshold) {
+  // Both latencies include the hops to the shards, so pipelines with a high shard fanout
+  // benefit from squashing sooner than ones that hit a single shard.
+  if (squash_cmd_ns_ == 0 || dispatch_cmd_ns_ == 0)
+    return;
+
+  if (squash_cmd_ns_ < dispatch_cmd_ns_ && squash_threshold_ > 1)
+    squash_threshold_--;
+  else if (squash_cmd_ns_ >= dispatch_cmd_ns_ && squash_threshold_ < max_threshold)
+    squash_threshold_++;
+}
+
 void Connection::ClearPipelinedMessages() {
   DispatchOperations dispatch_op{cc_->reply_builder(), this};
 
@@ -1350,10 +1459,17 @@ void Connection::ExecutionFiber(util::FiberSocketBase* peer) {
   DispatchOperations dispatch_op{builder, this};
 
   size_t squashing_threshold = absl::GetFlag(FLAGS_pipeline_squash);
+  uint64_t squash_batch_ns = uint64_t(absl::GetFlag(FLAGS_pipeline_squash_batch_usec)) * 1000;
+  squash_threshold_ = squashing_threshold;
 
   uint64_t prev_epoch = fb2::FiberSwitchEpoch();
   fb2::NoOpLock noop_lk;
 
+  // The fiber yields after running commands for slice_budget_ns, see dispatch_budget_usec.
+  uint64_t dispatch_budget_ns = queue_backpressure_->dispatch_budget_ns;
+  uint64_t slice_start_ns = 0, slice_budget_ns = 0;
+  ConnectionStats::QueueLatency slice_latency;
+
   while (!builder->GetError()) {
     DCHECK_EQ(socket()->proactor(), ProactorBase::me());
     cnd_.wait(noop_lk, [this] {
@@ -1362,6 +1478,11 @@ void Connection::ExecutionFiber(util::FiberSocketBase* peer) {
     if (cc_->conn_closing)
       break;
 
+    if (dispatch_budget_ns > 0 && slice_start_ns == 0) {
+      slice_start_ns = ProactorBase::GetMonotonicTimeNs();
+      slice_budget_ns = dispatch_budget_ns * DispatchWeight();
+    }
+
     // We really want to have batching in the builder if possible. This is especially
     // critical in situations where Nagle's algorithm can introduce unwanted high
     // latencies. However we can only batch if we're sure that there are more commands
@@ -1388,10 +1509,22 @@ void Connection::ExecutionFiber(util::FiberSocketBase* peer) {
     // It is only enabled if the threshold is reached and the whole dispatch queue
     // consists only of commands (no pubsub or monitor messages)
     bool squashing_enabled = squashing_threshold > 0;
-    bool threshold_reached = pending_pipeline_cmd_cnt_ > squashing_threshold;
+    bool threshold_reached = pending_pipeline_cmd_cnt_ > squash_threshold_;
     bool are_all_plain_cmds = pending_pipeline_cmd_cnt_ == dispatch_q_.size();
     if (squashing_enabled && threshold_reached && are_all_plain_cmds && !skip_next_squashing_) {
-      SquashPipeline(builder);
+      size_t max_batch = SIZE_MAX;
+      if (squash_batch_ns > 0 && squash_cmd_ns_ > 0)
+        max_batch = max<size_t>(squash_batch_ns / squash_cmd_ns_, squashing_threshold + 1);
+      if (dispatch_budget_ns > 0) {
+        uint64_t now = ProactorBase::GetMonotonicTimeNs();
+        for (size_t i = 0; i < min(max_batch, dispatch_q_.size()); ++i)
+          AddQueueLatency(dispatch_q_[i], now, &slice_latency);
+      }
+      SquashPipeline(builder, max_batch);
+      UpdateSquashThreshold(squashing_threshold);
+    } else if (size_t mc_gets = squashing_enabled ? PendingMCGets() : 0; mc_gets > 1) {
+      // Pipelined memcache gets are answered by a single multi-key lookup.
+      SquashMCPipeline(builder, mc_gets);
     } else {
       MessageHandle msg = std::move(dispatch_q_.front());
       dispatch_q_.pop_front();
@@ -1410,12 +1543,40 @@ void Connection::ExecutionFiber(util::FiberSocketBase* peer) {
         return;  // don't set conn closing flag
       }
 
+      bool measure = squashing_enabled && holds_alternative<PipelineMessagePtr>(msg.handle);
+      uint64_t start_ns = measure ? ProactorBase::GetMonotonicTimeNs() : 0;
+      if (dispatch_budget_ns > 0) {
+        uint64_t now = start_ns ? start_ns : ProactorBase::GetMonotonicTimeNs();
+        AddQueueLatency(msg, now, &slice_latency);
+      }
+
       cc_->async_dispatch = true;
       std::visit(dispatch_op, msg.handle);
       cc_->async_dispatch = false;
+
+      if (measure) {
+        uint64_t cmd_ns = ProactorBase::GetMonotonicTimeNs() - start_ns;
+        dispatch_cmd_ns_ = dispatch_cmd_ns_ ? (dispatch_cmd_ns_ * 7 + cmd_ns) / 8 : cmd_ns;
+        UpdateSquashThreshold(squashing_threshold);
+      }
       RecycleMessage(std::move(msg));
     }
 
+    if (dispatch_budget_ns > 0) {
+      bool exhausted = ProactorBase::GetMonotonicTimeNs() - slice_start_ns >= slice_budget_ns;
+      if (exhausted || dispatch_q_.empty()) {
+        EndDispatchSlice(&slice_latency);
+        slice_start_ns = 0;
+      }
+
+      // Let the other connections of this thread run, the replies so far are sent first.
+      if (exhausted && !dispatch_q_.empty()) {
+        stats_->dispatch_budget_yields++;
+        builder->FlushBatch();
+        ThisFiber::Yield();
+      }
+    }
+
     DCHECK(queue_backpressure_ == &tl_queue_backpressure_);
     if (!queue_backpressure_->IsPipelineBufferOverLimit(stats_->dispatch_queue_bytes) ||
         dispatch_q_.empty()) {
@@ -1432,6 +1593,39 @@ void Connection::ExecutionFiber(util::FiberSocketBase* peer) {
   queue_backpressure_->pipeline_cnd.notify_all();
 }
 
+std::string_view Connection::ClientClass() const {
+  const auto& cls = cc_->client_class;
+  if (!cls.empty() && queue_backpressure_->class_weights.contains(cls))
+    return cls;
+  return cc_->authed_username;
+}
+
+double Connection::DispatchWeight() const {
+  const auto& weights = queue_backpressure_->class_weights;
+  if (weights.empty())
+    return 1;
+  auto it = weights.find(ClientClass());
+  return it == weights.end() ? 1 : it->second;
+}
+
+void Connection::AddQueueLatency(const MessageHandle& msg, uint64_t now_ns,
+                                 ConnectionStats::QueueLatency* latency) {
+  if (msg.IsPipelineMsg()) {
+    latency->count++;
+    latency->total_usec += (now_ns - msg.dispatch_ts) / 1000;
+  }
+}
+
+void Connection::EndDispatchSlice(ConnectionStats::QueueLatency* latency) {
+  if (latency->count == 0)
+    return;
+
+  auto& dest = stats_->class_queue_latency[ClientClass()];
+  dest.count += latency->count;
+  dest.total_usec += latency->total_usec;
+  *latency = {};
+}
+
 Connection::PipelineMessagePtr Connection::FromArgs(RespVec args, mi_heap_t* heap) {
   DCHECK(!args.empty());
   size_t backed_sz = 0;
@@ -1447,14 +1641,27 @@ Connection::PipelineMessagePtr Connection::FromArgs(RespVec args, mi_heap_t* hea
 
   PipelineMessagePtr ptr;
   if (ptr = GetFromPipelinePool(); ptr) {
-    ptr->Reset(args.size(), backed_sz);
+    ptr->Reset(args.size());
   } else {
     void* heap_ptr = mi_heap_malloc_small(heap, sizeof(PipelineMessage));
     // We must construct in place here, since there is a slice that uses memory locations
-    ptr.reset(new (heap_ptr) PipelineMessage(args.size(), backed_sz));
+    ptr.reset(new (heap_ptr) PipelineMessage(args.size()));
+  }
+
+  // The arena is reset only once the pipeline drains, so a pipeline that never drains would
+  // grow it without bound. Beyond the limit the arguments are owned by the message instead.
+  char* storage;
+  if (arg_arena_.Capacity() < kArgArenaLimit) {
+    // An idle arena is accounted as cached pipeline memory, see ResetArgArena().
+    if (arg_arena_.Used() == 0)
+      stats_->pipeline_cmd_cache_bytes -= arg_arena_.Capacity();
+    storage = arg_arena_.Allocate(backed_sz);
+  } else {
+    ptr->heap_storage.reset(new char[backed_sz]);
+    storage = ptr->heap_storage.get();
   }
 
-  ptr->SetArgs(args);
+  ptr->SetArgs(args, storage, backed_sz);
   return ptr;
 }
 
@@ -1480,6 +1687,7 @@ Connection::PipelineMessagePtr Connection::GetFromPipelinePool() {
     return nullptr;
 
   free_req_release_weight = 0;  // Reset the release weight.
+  pipeline_req_pool_used_ = true;
   auto ptr = std::move(pipeline_req_pool_.back());
   stats_->pipeline_cmd_cache_bytes -= ptr->StorageCapacity();
   pipeline_req_pool_.pop_back();
@@ -1503,7 +1711,9 @@ bool Connection::Migrate(util::fb2::ProactorBase* dest) {
     return false;
   }
 
+  unsigned from = socket_->proactor()->GetPoolIndex();
   listener()->Migrate(this, dest);
+  static_cast<Listener*>(listener())->OnConnectionMigrated(from, dest->GetPoolIndex());
   // After we migrate, it could be the case the connection was shut down. We should
   // act accordingly.
   if (!socket()->IsOpen()) {
@@ -1532,6 +1742,19 @@ bool Connection::IsCurrentlyDispatching() const {
   return cc_->async_dispatch || cc_->sync_dispatch;
 }
 
+shared_ptr<void> Connection::TrackSharedPubBytes(size_t bytes) {
+  QueueBackpressure* qbp = &tl_queue_backpressure_;
+  ConnectionStats* stats = &tl_facade_stats->conn_stats;
+  qbp->subscriber_bytes.fetch_add(bytes, memory_order_relaxed);
+  stats->dispatch_queue_subscriber_bytes += bytes;
+
+  // Released by the dispatch fibers of this thread after the last message is recycled.
+  return shared_ptr<void>(nullptr, [qbp, stats, bytes](void*) {
+    qbp->subscriber_bytes.fetch_sub(bytes, memory_order_relaxed);
+    stats->dispatch_queue_subscriber_bytes -= bytes;
+  });
+}
+
 void Connection::SendPubMessageAsync(PubMessage msg) {
   void* ptr = mi_malloc(sizeof(PubMessage));
   SendAsync({PubMessagePtr{new (ptr) PubMessage{std::move(msg)}, MessageDeleter{}}});
@@ -1636,13 +1859,28 @@ void Connection::RecycleMessage(MessageHandle msg) {
     stats_->pipelined_cmd_latency += (ProactorBase::GetMonotonicTimeNs() - msg.dispatch_ts) / 1000;
 
     pending_pipeline_cmd_cnt_--;
+    (*pipe)->heap_storage.reset();
     if (stats_->pipeline_cmd_cache_bytes < queue_backpressure_->pipeline_cache_limit) {
       stats_->pipeline_cmd_cache_bytes += (*pipe)->StorageCapacity();
       pipeline_req_pool_.push_back(std::move(*pipe));
     }
+
+    // The replies are already written or copied into the reply batch, so once the last
+    // queued pipeline message is recycled none of the arena allocations is referenced.
+    if (pending_pipeline_cmd_cnt_ == 0)
+      ResetArgArena();
   }
 }
 
+void Connection::ResetArgArena() {
+  if (arg_arena_.Used() == 0)
+    return;
+
+  size_t cache_limit = queue_backpressure_->pipeline_cache_limit;
+  arg_arena_.Reset(stats_->pipeline_cmd_cache_bytes + ArgArena::kBlockSize <= cache_limit);
+  stats_->pipeline_cmd_cache_bytes += arg_arena_.Capacity();
+}
+
 std::string Connection::LocalBindStr() const {
   if (socket_->IsUDS())
     return "unix-domain-socket";
@@ -1689,6 +1927,22 @@ void Connection::RequestAsyncMigration(util::fb2::ProactorBase* dest) {
   migration_request_ = dest;
 }
 
+bool Connection::RequestRebalance(util::fb2::ProactorBase* dest) {
+  // Subscriptions and tracking are bound to thread local state, replication flows and http
+  // connections are placed explicitly.
+  if (cc_ == nullptr || migration_request_ || cc_->subscriptions > 0 || cc_->replica_conn ||
+      tracking_enabled_ || is_http_) {
+    return false;
+  }
+
+  unsigned from = socket_->proactor()->GetPoolIndex();
+  if (!static_cast<Listener*>(listener())->IsMoveBalanced(from, dest->GetPoolIndex()))
+    return false;
+
+  migration_request_ = dest;
+  return true;
+}
+
 void Connection::StartTrafficLogging(string_view path) {
   OpenTrafficLogger(path);
 }
@@ -1703,24 +1957,70 @@ bool Connection::IsHttp() const {
 }
 
 Connection::MemoryUsage Connection::GetMemoryUsage() const {
-  size_t mem = sizeof(*this) + dfly::HeapSize(dispatch_q_) + dfly::HeapSize(name_) +
-               dfly::HeapSize(tmp_parse_args_) + dfly::HeapSize(tmp_cmd_vec_) +
-               dfly::HeapSize(memcache_parser_) + dfly::HeapSize(redis_parser_) +
-               dfly::HeapSize(cc_);
+  MemoryUsage usage;
+  usage.parser_bytes = dfly::HeapSize(tmp_parse_args_) + dfly::HeapSize(tmp_cmd_vec_) +
+                       dfly::HeapSize(memcache_parser_) + dfly::HeapSize(redis_parser_);
+  if (cc_ && cc_->reply_builder())
+    usage.reply_bytes = cc_->reply_builder()->UsedMemory();
+  usage.arg_arena_bytes = arg_arena_.Capacity();
+  usage.dispatch_queue_bytes = dfly::HeapSize(dispatch_q_);
+
+  // The reply builder is accounted as part of the context.
+  usage.mem = sizeof(*this) + dfly::HeapSize(name_) + dfly::HeapSize(cc_) + usage.parser_bytes +
+              usage.arg_arena_bytes + usage.dispatch_queue_bytes;
 
   // We add a hardcoded 9k value to accomodate for the part of the Fiber stack that is in use.
   // The allocated stack is actually larger (~130k), but only a small fraction of that (9k
   // according to our checks) is actually part of the RSS.
-  mem += 9'000;
+  usage.mem += 9'000;
 
-  return {
-      .mem = mem,
-      .buf_mem = io_buf_.GetMemoryUsage(),
-  };
+  usage.buf_mem = io_buf_.GetMemoryUsage();
+  return usage;
+}
+
+void Connection::TrimIfIdle(time_t now, uint32_t idle_sec) {
+  if (phase_ != READ_SOCKET || now - last_interaction_ < time_t(idle_sec))
+    return;
+
+  // Async dispatches may still reference the arena and the parsed arguments.
+  if (IsCurrentlyDispatching() || !dispatch_q_.empty() || pending_pipeline_cmd_cnt_ > 0)
+    return;
+
+  if (arg_arena_.Used() == 0 && arg_arena_.Capacity() > 0) {
+    stats_->pipeline_cmd_cache_bytes -= arg_arena_.Capacity();
+    arg_arena_.Reset(false);
+  }
+
+  // The parser copies the arguments of a partial request into its stash.
+  RespVec{}.swap(tmp_parse_args_);
+  CmdArgVec{}.swap(tmp_cmd_vec_);
+
+  if (cc_ && cc_->reply_builder())
+    cc_->reply_builder()->ReleaseBuffers();
+}
+
+void Connection::TrimThreadLocal(time_t now, uint32_t idle_sec) {
+  if (pipeline_req_pool_used_) {
+    pipeline_req_pool_used_ = false;
+    pipeline_req_pool_last_use_ = now;
+    return;
+  }
+
+  if (pipeline_req_pool_.empty() || now - pipeline_req_pool_last_use_ < time_t(idle_sec))
+    return;
+
+  for (const auto& req : pipeline_req_pool_)
+    tl_facade_stats->conn_stats.pipeline_cmd_cache_bytes -= req->StorageCapacity();
+  pipeline_req_pool_.clear();
+  pipeline_req_pool_.shrink_to_fit();
 }
 
 void Connection::DecreaseStatsOnClose() {
   stats_->read_buf_capacity -= io_buf_.Capacity();
+  if (arg_arena_.Used() == 0) {
+    stats_->pipeline_cmd_cache_bytes -= arg_arena_.Capacity();
+    arg_arena_.Reset(false);
+  }
 
   // Update num_replicas if this was a replica connection.
   if (cc_->replica_conn) {
@@ -5,6 +5,7 @@
 #pragma once
 
 #include <absl/container/fixed_array.h>
+#include <absl/container/flat_hash_map.h>
 #include <mimalloc.h>
 #include <sys/socket.h>
 
@@ -15,6 +16,7 @@
 #include <variant>
 
 #include "facade/acl_commands_def.h"
+#include "facade/arg_arena.h"
 #include "facade/facade_types.h"
 #include "facade/memcache_parser.h"
 #include "facade/resp_expr.h"
@@ -35,12 +37,6 @@ typedef struct mi_heap_s mi_heap_t;
 #define SO_INCOMING_NAPI_ID 56
 #endif
 
-#ifdef ABSL_HAVE_ADDRESS_SANITIZER
-constexpr size_t kReqStorageSize = 88;
-#else
-constexpr size_t kReqStorageSize = 120;
-#endif
-
 namespace facade {
 
 class ConnectionContext;
@@ -74,25 +70,33 @@ class Connection : public util::Connection {
     std::string pattern{};              // non-empty for pattern subscriber
     std::shared_ptr<char[]> buf;        // stores channel name and message
     std::string_view channel, message;  // channel and message parts from buf
+
+    // Push frame encoded by the publisher with RedisReplyBuilder::EncodePush. If set, it is
+    // part of buf and shared with the other subscribers of the publish.
+    std::string_view frame;
+
+    // If set, buf is accounted in the subscriber bytes once per thread by this reference, see
+    // TrackSharedPubBytes, instead of once per message.
+    std::shared_ptr<void> shared_bytes_ref;
   };
 
   // Pipeline message, accumulated Redis command to be executed.
+  // The arguments are stored in the arena of the connection that parsed them, or in
+  // heap_storage once the arena reached its size limit.
   struct PipelineMessage {
-    PipelineMessage(size_t nargs, size_t capacity) : args(nargs), storage(capacity) {
+    explicit PipelineMessage(size_t nargs) : args(nargs) {
     }
 
-    void Reset(size_t nargs, size_t capacity);
+    void Reset(size_t nargs);
 
-    void SetArgs(const RespVec& args);
+    // Copies args into storage, which must fit all of them including a terminating zero each.
+    void SetArgs(const RespVec& args, char* storage, size_t storage_size);
 
     size_t StorageCapacity() const;
 
-    // mi_stl_allocator uses mi heap internally.
-    // The capacity is chosen so that we allocate a fully utilized (256 bytes) block.
-    using StorageType = absl::InlinedVector<char, kReqStorageSize, mi_stl_allocator<char>>;
-
     absl::InlinedVector<MutableSlice, 6> args;
-    StorageType storage;
+    size_t storage_size = 0;
+    std::unique_ptr<char[]> heap_storage;
   };
 
   // Pipeline message, accumulated Memcached command to be executed.
@@ -125,6 +129,7 @@ class Connection : public util::Connection {
 
   struct InvalidationMessage {
     std::string key;
+    std::vector<std::string> keys;  // Keys coalesced by broadcast tracking, replace key if set.
     bool invalidate_due_to_flush = false;
   };
 
@@ -216,6 +221,10 @@ class Connection : public util::Connection {
   // Virtual because behavior is overridden in test_utils.
   virtual void SendPubMessageAsync(PubMessage);
 
+  // Accounts bytes shared by the pub messages of a single publish in the subscriber bytes of
+  // this thread, until the last copy of the returned reference is released.
+  static std::shared_ptr<void> TrackSharedPubBytes(size_t bytes);
+
   // Add monitor message to dispatch queue.
   void SendMonitorMessageAsync(std::string);
 
@@ -278,17 +287,36 @@ class Connection : public util::Connection {
   }
 
   struct MemoryUsage {
-    size_t mem = 0;
+    size_t mem = 0;  // everything but the io buffer, including the components below
+
+    size_t parser_bytes = 0;          // parsers and their argument vectors
+    size_t reply_bytes = 0;           // reply builder and its batch
+    size_t arg_arena_bytes = 0;       // arguments of pipelined commands
+    size_t dispatch_queue_bytes = 0;  // messages waiting for the dispatch fiber
+
     io::IoBuf::MemoryUsage buf_mem;
   };
   MemoryUsage GetMemoryUsage() const;
 
+  // Releases the buffers the connection keeps at their high-water sizes if it has not been
+  // active for at least idle_sec seconds. Called by the listener on the connection thread.
+  // The io buffer is referenced by the pending read and is shrunk by the read loop instead.
+  void TrimIfIdle(time_t now, uint32_t idle_sec);
+
+  // Releases the pipeline request pool of the thread if it was not used for idle_sec seconds.
+  static void TrimThreadLocal(time_t now, uint32_t idle_sec);
+
   ConnectionContext* cntx();
 
   // Requests that at some point, this connection will be migrated to `dest` thread.
   // Connections will migrate at most once, and only when the flag --migrate_connections is true.
   void RequestAsyncMigration(util::fb2::ProactorBase* dest);
 
+  // Like RequestAsyncMigration, but may be requested any number of times, used to move
+  // connections to the threads of the shards they use. Returns false if the connection can't
+  // migrate or if the move would overload dest, see Listener::IsMoveBalanced.
+  bool RequestRebalance(util::fb2::ProactorBase* dest);
+
   // Starts traffic logging in the calling thread. Must be a proactor thread.
   // Each thread creates its own log file combining requests from all the connections in
   // that thread. A noop if the thread is already logging.
@@ -336,6 +364,9 @@ class Connection : public util::Connection {
     size_t publish_buffer_limit = 0;   // cached flag publish_buffer_limit
     size_t pipeline_cache_limit = 0;   // cached flag pipeline_cache_limit
     size_t pipeline_buffer_limit = 0;  // cached flag for buffer size in bytes
+    uint64_t dispatch_budget_ns = 0;   // cached flag dispatch_budget_usec
+
+    absl::flat_hash_map<std::string, double> class_weights;  // parsed dispatch_class_weights
   };
 
  private:
@@ -367,6 +398,20 @@ class Connection : public util::Connection {
   // Updates memory stats and pooling, must be called for all used messages
   void RecycleMessage(MessageHandle msg);
 
+  // The class used for the dispatch budget and the queueing latency stats of this client.
+  std::string_view ClientClass() const;
+  double DispatchWeight() const;
+
+  static void AddQueueLatency(const MessageHandle& msg, uint64_t now_ns,
+                              ConnectionStats::QueueLatency* latency);
+
+  // Accounts the queueing latency of a dispatch slice in the stats of the client class.
+  void EndDispatchSlice(ConnectionStats::QueueLatency* latency);
+
+  // Releases the arguments of the recycled pipeline messages, keeping a block for the next
+  // pipeline if the request_cache_limit budget allows.
+  void ResetArgArena();
+
   // Create new pipeline request, re-use from pool when possible.
   PipelineMessagePtr FromArgs(RespVec args, mi_heap_t* heap);
 
@@ -385,8 +430,21 @@ class Connection : public util::Connection {
   bool ShouldEndDispatchFiber(const MessageHandle& msg);
 
   void LaunchDispatchFiberIfNeeded();  // Dispatch fiber is started lazily
-  // Squashes pipelined commands from the dispatch queue to spread load over all threads
-  void SquashPipeline(facade::SinkReplyBuilder*);
+  // Squashes pipelined commands from the dispatch queue to spread load over all threads.
+  // At most max_batch commands are squashed, so that the first replies are not delayed by
+  // a very long pipeline.
+  void SquashPipeline(facade::SinkReplyBuilder*, size_t max_batch);
+
+  // Number of memcache get commands at the front of the dispatch queue.
+  size_t PendingMCGets() const;
+
+  // Dispatches the count memcache get commands at the front of the dispatch queue together,
+  // so that their keys are looked up in a single hop.
+  void SquashMCPipeline(facade::SinkReplyBuilder*, size_t count);
+
+  // Adapts squash_threshold_ to the measured latencies, squashing shorter pipelines when
+  // squashed commands are cheaper than commands dispatched one by one.
+  void UpdateSquashThreshold(uint64_t max_threshold);
 
   // Clear pipelined messages, disaptching only intrusive ones.
   void ClearPipelinedMessages();
@@ -425,6 +483,9 @@ class Connection : public util::Connection {
 
   unsigned parser_error_ = 0;
 
+  // Number of consecutive small reads since the read buffer was last used for a large one.
+  unsigned small_read_streak_ = 0;
+
   // amount of times we enqued requests asynchronously during the same async_fiber_epoch_.
   unsigned async_streak_len_ = 0;
   uint64_t async_fiber_epoch_ = 0;
@@ -444,9 +505,21 @@ class Connection : public util::Connection {
 
   util::fb2::ProactorBase* migration_request_ = nullptr;
 
+  // Adaptive pipeline squashing state, see UpdateSquashThreshold().
+  uint64_t squash_threshold_ = 0;  // queue depth above which the pipeline is squashed.
+  uint64_t squash_cmd_ns_ = 0;     // moving average of the latency per squashed command.
+  uint64_t dispatch_cmd_ns_ = 0;   // moving average of the latency of a pipelined command.
+
+  // Holds the arguments of the queued pipeline messages, reset once all of them are recycled.
+  ArgArena arg_arena_;
+
   // Pooled pipeline messages per-thread
   // Aggregated while handling pipelines, gradually released while handling regular commands.
   static thread_local std::vector<PipelineMessagePtr> pipeline_req_pool_;
+  // Whether the pool was used since the last TrimThreadLocal call, and the time of the last
+  // call that saw it used.
+  static thread_local bool pipeline_req_pool_used_;
+  static thread_local time_t pipeline_req_pool_last_use_;
 
   // Per-thread queue backpressure structs.
   static thread_local QueueBackpressure tl_queue_backpressure_;
@@ -17,6 +17,7 @@
 #include "base/flags.h"
 #include "base/logging.h"
 #include "facade/dragonfly_connection.h"
+#include "facade/numa.h"
 #include "facade/service_interface.h"
 #include "util/proactor_pool.h"
 
@@ -27,7 +28,8 @@ ABSL_FLAG(uint32_t, conn_io_thread_start, 0, "Starting thread id for handling se
 ABSL_FLAG(bool, tls, false, "");
 ABSL_FLAG(bool, conn_use_incoming_cpu, false,
           "If true uses incoming cpu of a socket in order to distribute"
-          " incoming connections");
+          " incoming connections. When the threads of the cpu are busy, a thread on the same "
+          "NUMA node is preferred");
 
 ABSL_FLAG(string, tls_cert_file, "", "cert file for tls connections");
 ABSL_FLAG(string, tls_key_file, "", "key file for tls connections");
@@ -41,6 +43,9 @@ ABSL_FLAG(uint32_t, tcp_keepalive, 300,
 ABSL_FLAG(uint32_t, tcp_user_timeout, 0,
           "the maximum period in milliseconds that transimitted data may stay unacknowledged "
           "before TCP aborts the connection. 0 means OS default timeout");
+ABSL_FLAG(uint32_t, conn_idle_trim_sec, 30,
+          "Connections that are idle for this many seconds release the buffers kept at their "
+          "peak sizes. 0 disables trimming");
 
 ABSL_DECLARE_FLAG(bool, primary_port_http_enabled);
 
@@ -288,6 +293,34 @@ uint64_t Listener::RefusedConnectionMaxClientsCount() {
 
 void Listener::PreAcceptLoop(util::ProactorBase* pb) {
   per_thread_.resize(pool()->size());
+
+  // A single timer per thread rather than per connection, as most of them are idle.
+  idle_trimmers_.resize(pool()->size());
+  pool()->AwaitBrief([this](unsigned index, ProactorBase*) {
+    IdleTrimmer& trimmer = idle_trimmers_[index];
+    trimmer.fiber = fb2::Fiber("conn_idle_trim", &Listener::RunIdleTrimming, this, trimmer.done);
+  });
+}
+
+void Listener::RunIdleTrimming(fb2::Done done) {
+  while (true) {
+    uint32_t idle_sec = absl::GetFlag(FLAGS_conn_idle_trim_sec);
+
+    // Check twice per period, so that connections are trimmed at most 1.5 periods after they
+    // became idle.
+    auto period = chrono::seconds(max(idle_sec / 2, 1u));
+    if (done.WaitFor(period))
+      return;
+
+    if (idle_sec == 0)
+      continue;
+
+    time_t now = time(nullptr);
+    TraverseConnectionsOnThread([now, idle_sec](unsigned, util::Connection* conn) {
+      static_cast<facade::Connection*>(conn)->TrimIfIdle(now, idle_sec);
+    });
+    Connection::TrimThreadLocal(now, idle_sec);
+  }
 }
 
 bool Listener::IsPrivilegedInterface() const {
@@ -306,6 +339,13 @@ void Listener::PreShutdown() {
   // This shouldn't take a long time: All clients should reject incoming commands
   // at this stage since we're in SHUTDOWN mode.
   // If a command is running for too long we give up and proceed.
+  if (!idle_trimmers_.empty()) {
+    pool()->AwaitFiberOnAll([this](unsigned index, ProactorBase*) {
+      idle_trimmers_[index].done.Notify();
+      idle_trimmers_[index].fiber.JoinIfNeeded();
+    });
+  }
+
   DispatchTracker tracker{{this}};
   tracker.TrackAll();
 
@@ -346,7 +386,7 @@ void Listener::OnConnectionStart(util::Connection* conn) {
 }
 
 void Listener::OnConnectionClose(util::Connection* conn) {
-  // TODO: We do not account for connections migrated to other threads. This is a rare case.
+  // Connections that migrated are accounted on their new thread, see OnConnectionMigrated.
   unsigned id = conn->socket()->proactor()->GetPoolIndex();
   DCHECK_LT(id, per_thread_.size());
   auto& pth = per_thread_[id];
@@ -366,6 +406,41 @@ void Listener::OnConnectionClose(util::Connection* conn) {
   }
 }
 
+bool Listener::IsMoveBalanced(unsigned from, unsigned to) {
+  DCHECK_LT(from, per_thread_.size());
+  DCHECK_LT(to, per_thread_.size());
+
+  absl::base_internal::SpinLockHolder lock{&mutex_};
+  int32_t from_cnt = per_thread_[from].num_connections;
+  int32_t to_cnt = per_thread_[to].num_connections;
+  if (to_cnt + 1 < from_cnt)  // the move evens out the two threads
+    return true;
+
+  int32_t limit = conn_cnt_ * 5 / (4 * per_thread_.size()) + 1;
+  return to_cnt + 1 <= limit;
+}
+
+void Listener::OnConnectionMigrated(unsigned from, unsigned to) {
+  DCHECK_LT(from, per_thread_.size());
+  DCHECK_LT(to, per_thread_.size());
+
+  absl::base_internal::SpinLockHolder lock{&mutex_};
+  --per_thread_[from].num_connections;
+  ++per_thread_[to].num_connections;
+  UpdateMinCntLocked();
+}
+
+void Listener::UpdateMinCntLocked() {
+  min_cnt_thread_id_ = 0;
+  min_cnt_ = per_thread_[0].num_connections;
+  for (unsigned i = 1; i < per_thread_.size(); ++i) {
+    if (per_thread_[i].num_connections < min_cnt_) {
+      min_cnt_ = per_thread_[i].num_connections;
+      min_cnt_thread_id_ = i;
+    }
+  }
+}
+
 void Listener::OnMaxConnectionsReached(util::FiberSocketBase* sock) {
   listener_tl_stats.refused_conn_maxclients_reached_cnt++;
   sock->Write(io::Buffer("-ERR max number of clients reached\r\n"));
@@ -408,6 +483,21 @@ ProactorBase* Listener::PickConnectionProactor(util::FiberSocketBase* sock) {
           }
         }
 
+        // Otherwise the least loaded thread on the node of the cpu, so that the connection
+        // doesn't cross sockets on every read.
+        if (res_id == kuint32max && numa::NumNodes() > 1) {
+          int node = numa::NodeOfCpu(cpu);
+          for (unsigned id = 0; id < per_thread_.size(); ++id) {
+            if (numa::NodeOfThread(id) == node && per_thread_[id].num_connections < min_cnt_ + 5 &&
+                (res_id == kuint32max ||
+                 per_thread_[id].num_connections < per_thread_[res_id].num_connections)) {
+              res_id = id;
+            }
+          }
+          if (res_id != kuint32max)
+            VLOG(1) << "using thread " << res_id << " on node " << node << " for cpu " << cpu;
+        }
+
         if (res_id == kuint32max) {
           VLOG(1) << "choosing a thread with minimum conns " << min_cnt_thread_id_ << " instead of "
                   << cpu;
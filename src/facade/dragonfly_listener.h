@@ -15,6 +15,7 @@
 #include "facade/facade_types.h"
 #include "util/fiber_socket_base.h"
 #include "util/fibers/proactor_base.h"
+#include "util/fibers/synchronization.h"
 #include "util/http/http_handler.h"
 #include "util/listener_interface.h"
 
@@ -50,6 +51,13 @@ class Listener : public util::ListenerInterface {
   bool IsPrivilegedInterface() const;
   bool IsMainInterface() const;
 
+  // Returns true if moving a connection from thread `from` to thread `to` keeps the connections
+  // balanced: `to` ends up with at most a quarter more than the average number of connections.
+  bool IsMoveBalanced(unsigned from, unsigned to);
+
+  // Updates the per thread connection counts after a connection moved between threads.
+  void OnConnectionMigrated(unsigned from, unsigned to);
+
  private:
   util::Connection* NewConnection(ProactorBase* proactor) final;
   ProactorBase* PickConnectionProactor(util::FiberSocketBase* sock) final;
@@ -62,6 +70,12 @@ class Listener : public util::ListenerInterface {
   void PreShutdown() final;
   void PostShutdown() final;
 
+  // Periodically trims the idle connections of the calling thread, see --conn_idle_trim_sec.
+  void RunIdleTrimming(util::fb2::Done done);
+
+  // Recomputes min_cnt_ and min_cnt_thread_id_, must be called under mutex_.
+  void UpdateMinCntLocked();
+
   std::unique_ptr<util::HttpListenerBase> http_base_;
 
   ServiceInterface* service_;
@@ -72,6 +86,12 @@ class Listener : public util::ListenerInterface {
   };
   std::vector<PerThread> per_thread_;
 
+  struct IdleTrimmer {
+    util::fb2::Fiber fiber;
+    util::fb2::Done done;
+  };
+  std::vector<IdleTrimmer> idle_trimmers_;  // indexed by thread
+
   std::atomic_uint32_t next_id_{0};
 
   Role role_;
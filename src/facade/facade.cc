@@ -2,6 +2,7 @@
 // See LICENSE for licensing terms.
 //
 
+#include <absl/numeric/bits.h>
 #include <absl/strings/escaping.h>
 #include <absl/strings/str_cat.h>
 
@@ -20,7 +21,7 @@ constexpr size_t kSizeConnStats = sizeof(ConnectionStats);
 
 ConnectionStats& ConnectionStats::operator+=(const ConnectionStats& o) {
   // To break this code deliberately if we add/remove a field to this struct.
-  static_assert(kSizeConnStats == 120u);
+  static_assert(kSizeConnStats == 240u + kSanitizerOverhead);
 
   ADD(read_buf_capacity);
   ADD(dispatch_queue_entries);
@@ -39,9 +40,25 @@ ConnectionStats& ConnectionStats::operator+=(const ConnectionStats& o) {
   ADD(num_migrations);
   ADD(squashed_commands);
 
+  for (unsigned i = 0; i < kSquashBatchBuckets; ++i)
+    ADD(squash_batches[i]);
+
+  ADD(dispatch_budget_yields);
+  for (const auto& [cls, latency] : o.class_queue_latency) {
+    auto& dest = class_queue_latency[cls];
+    dest.count += latency.count;
+    dest.total_usec += latency.total_usec;
+  }
+
   return *this;
 }
 
+unsigned ConnectionStats::SquashBatchBucket(size_t batch_size) {
+  if (batch_size <= 2)
+    return 0;
+  return min<unsigned>(absl::bit_width(batch_size - 1) - 1, kSquashBatchBuckets - 1);
+}
+
 ReplyStats& ReplyStats::operator+=(const ReplyStats& o) {
   static_assert(sizeof(ReplyStats) == 72u + kSanitizerOverhead);
   ADD(io_write_cnt);
@@ -114,6 +114,25 @@ struct ConnectionStats {
   uint32_t num_blocked_clients = 0;
   uint64_t num_migrations = 0;
   uint64_t squashed_commands = 0;
+
+  // Squashed pipeline batches by size. Bucket i counts batches of up to 2^(i + 1) commands,
+  // the last bucket counts all larger batches.
+  static constexpr unsigned kSquashBatchBuckets = 10;
+  uint64_t squash_batches[kSquashBatchBuckets] = {};
+
+  static unsigned SquashBatchBucket(size_t batch_size);
+
+  // How often dispatch fibers yielded because they exhausted their budget.
+  uint64_t dispatch_budget_yields = 0;
+
+  struct QueueLatency {
+    uint64_t count = 0;
+    uint64_t total_usec = 0;
+  };
+
+  // Time pipelined commands spent in the dispatch queue, by client class.
+  absl::flat_hash_map<std::string, QueueLatency> class_queue_latency;
+
   ConnectionStats& operator+=(const ConnectionStats& o);
 };
 
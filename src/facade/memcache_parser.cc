@@ -116,10 +116,145 @@ MP::Result ParseValueless(TokensView tokens, MP::Command* res) {
   return MP::OK;
 }
 
+// Returns the command type of the mode flag of ms and ma, INVALID if the mode is not valid.
+MP::CmdType MetaMode(MP::CmdType type, char mode) {
+  switch (absl::ascii_toupper(mode)) {
+    case 'E':
+      return type == MP::SET ? MP::ADD : MP::INVALID;
+    case 'A':
+      return type == MP::SET ? MP::APPEND : MP::INVALID;
+    case 'P':
+      return type == MP::SET ? MP::PREPEND : MP::INVALID;
+    case 'R':
+      return type == MP::SET ? MP::REPLACE : MP::INVALID;
+    case 'S':
+      return type == MP::SET ? MP::SET : MP::INVALID;
+    case 'I':
+    case '+':
+      return type == MP::INCR ? MP::INCR : MP::INVALID;
+    case 'D':
+    case '-':
+      return type == MP::INCR ? MP::DECR : MP::INVALID;
+  }
+  return MP::INVALID;
+}
+
+// Parses meta commands: mn, mg <key> <flags>*, ms <key> <datalen> <flags>*,
+// md <key> <flags>* and ma <key> <flags>*.
+MP::Result ParseMeta(TokensView tokens, MP::Command* res) {
+  DCHECK_EQ(tokens[0].size(), 2u);
+
+  res->meta = true;
+  res->meta_flags = {};
+  res->flags = 0;
+  res->expire_ts = 0;
+  res->bytes_len = 0;
+
+  char cmd = tokens[0][1];
+  if (cmd == 'n') {
+    res->type = MP::META_NOOP;
+    return tokens.size() == 1 ? MP::OK : MP::PARSE_ERROR;
+  }
+
+  if (tokens.size() < 2 || tokens[1].size() > 250)
+    return MP::PARSE_ERROR;
+  res->key = tokens[1];
+
+  size_t flag_pos = 2;
+  switch (cmd) {
+    case 'g':
+      res->type = MP::GET;
+      break;
+    case 's':
+      res->type = MP::SET;
+      if (tokens.size() < 3 || !absl::SimpleAtoi(tokens[2], &res->bytes_len))
+        return MP::BAD_INT;
+      flag_pos = 3;
+      break;
+    case 'd':
+      res->type = MP::DELETE;
+      break;
+    case 'a':
+      res->type = MP::INCR;
+      res->delta = 1;
+      break;
+    default:
+      return MP::UNKNOWN_CMD;
+  }
+
+  MP::Command::MetaFlags& mf = res->meta_flags;
+  bool is_store = res->type == MP::SET;
+  bool is_arithm = res->type == MP::INCR;
+  for (string_view token : tokens.subspan(flag_pos)) {
+    string_view arg = token.substr(1);
+    switch (token[0]) {
+      case 'v':
+        mf.return_value = true;
+        break;
+      case 'f':
+        mf.return_flags = true;
+        break;
+      case 'c':
+        mf.return_cas = true;
+        break;
+      case 't':
+        mf.return_ttl = true;
+        break;
+      case 'k':
+        mf.return_key = true;
+        break;
+      case 's':
+        mf.return_size = true;
+        break;
+      case 'q':
+        mf.quiet = true;
+        break;
+      case 'O':
+        if (arg.size() > 32)
+          return MP::PARSE_ERROR;
+        mf.opaque = arg;
+        continue;
+      case 'F':
+        if (!is_store)
+          return MP::PARSE_ERROR;
+        if (!absl::SimpleAtoi(arg, &res->flags))
+          return MP::BAD_INT;
+        continue;
+      case 'T':
+        if (!is_store)
+          return MP::PARSE_ERROR;
+        if (!absl::SimpleAtoi(arg, &res->expire_ts))
+          return MP::BAD_INT;
+        continue;
+      case 'D':
+        if (!is_arithm)
+          return MP::PARSE_ERROR;
+        if (!absl::SimpleAtoi(arg, &res->delta))
+          return MP::BAD_DELTA;
+        continue;
+      case 'M':
+        res->type = arg.size() == 1 ? MetaMode(res->type, arg[0]) : MP::INVALID;
+        if (res->type == MP::INVALID)
+          return MP::PARSE_ERROR;
+        continue;
+      default:
+        return MP::PARSE_ERROR;
+    }
+
+    // Return flags have no argument.
+    if (!arg.empty())
+      return MP::PARSE_ERROR;
+  }
+
+  return MP::OK;
+}
+
 }  // namespace
 
 auto MP::Parse(string_view str, uint32_t* consumed, Command* cmd) -> Result {
   cmd->no_reply = false;  // re-initialize
+  cmd->meta = false;
+  cmd->keys_ext.clear();
   auto pos = str.find("\r\n");
   *consumed = 0;
   if (pos == string_view::npos) {
@@ -143,6 +278,9 @@ auto MP::Parse(string_view str, uint32_t* consumed, Command* cmd) -> Result {
   if (num_tokens == 0)
     return PARSE_ERROR;
 
+  if (tokens[0].size() == 2 && tokens[0][0] == 'm')
+    return ParseMeta(absl::MakeSpan(tokens), cmd);
+
   cmd->type = From(tokens[0]);
   if (cmd->type == INVALID) {
     return UNKNOWN_CMD;
@@ -33,6 +33,7 @@ class MemcacheParser {
 
     QUIT = 20,
     VERSION = 21,
+    META_NOOP = 22,
 
     // The rest of write commands.
     DELETE = 31,
@@ -56,6 +57,23 @@ class MemcacheParser {
     uint32_t bytes_len = 0;
     uint32_t flags = 0;
     bool no_reply = false;
+
+    // Meta commands (mg, ms, md, ma) are translated to the classic command types above,
+    // their flags select the fields of the reply.
+    // See https://github.com/memcached/memcached/wiki/MetaCommands
+    struct MetaFlags {
+      bool return_value = false;  // v
+      bool return_flags = false;  // f
+      bool return_cas = false;    // c
+      bool return_ttl = false;    // t
+      bool return_key = false;    // k
+      bool return_size = false;   // s
+      bool quiet = false;         // q, omits replies for successes and misses.
+      std::string_view opaque;    // O, echoed back in the reply.
+    };
+
+    bool meta = false;
+    MetaFlags meta_flags;
   };
 
   enum Result {
@@ -101,6 +101,51 @@ TEST_F(MCParserTest, NoreplyBasic) {
   EXPECT_FALSE(cmd_.no_reply);
 }
 
+TEST_F(MCParserTest, Meta) {
+  MemcacheParser::Result st = parser_.Parse("mg key v f c t k s q Oxyz\r\n", &consumed_, &cmd_);
+  EXPECT_EQ(MemcacheParser::OK, st);
+  EXPECT_EQ(MemcacheParser::GET, cmd_.type);
+  EXPECT_EQ("key", cmd_.key);
+  EXPECT_TRUE(cmd_.meta);
+  const auto& mf = cmd_.meta_flags;
+  EXPECT_TRUE(mf.return_value && mf.return_flags && mf.return_cas && mf.return_ttl &&
+              mf.return_key && mf.return_size && mf.quiet);
+  EXPECT_EQ("xyz", mf.opaque);
+
+  st = parser_.Parse("ms key 5 F3 T10 MA\r\nhello\r\n", &consumed_, &cmd_);
+  EXPECT_EQ(MemcacheParser::OK, st);
+  EXPECT_EQ(20, consumed_);
+  EXPECT_EQ(MemcacheParser::APPEND, cmd_.type);
+  EXPECT_EQ(5, cmd_.bytes_len);
+  EXPECT_EQ(3, cmd_.flags);
+  EXPECT_EQ(10, cmd_.expire_ts);
+  EXPECT_FALSE(cmd_.meta_flags.quiet);
+
+  st = parser_.Parse("ma key D7 M-\r\n", &consumed_, &cmd_);
+  EXPECT_EQ(MemcacheParser::OK, st);
+  EXPECT_EQ(MemcacheParser::DECR, cmd_.type);
+  EXPECT_EQ(7, cmd_.delta);
+
+  st = parser_.Parse("md key q\r\n", &consumed_, &cmd_);
+  EXPECT_EQ(MemcacheParser::OK, st);
+  EXPECT_EQ(MemcacheParser::DELETE, cmd_.type);
+  EXPECT_TRUE(cmd_.meta_flags.quiet);
+
+  st = parser_.Parse("mn\r\n", &consumed_, &cmd_);
+  EXPECT_EQ(MemcacheParser::OK, st);
+  EXPECT_EQ(MemcacheParser::META_NOOP, cmd_.type);
+
+  st = parser_.Parse("get key\r\n", &consumed_, &cmd_);
+  EXPECT_EQ(MemcacheParser::OK, st);
+  EXPECT_FALSE(cmd_.meta);
+
+  EXPECT_EQ(MemcacheParser::PARSE_ERROR, parser_.Parse("mg key vx\r\n", &consumed_, &cmd_));
+  EXPECT_EQ(MemcacheParser::PARSE_ERROR, parser_.Parse("mg key F1\r\n", &consumed_, &cmd_));
+  EXPECT_EQ(MemcacheParser::PARSE_ERROR, parser_.Parse("ms key 1 MI\r\n", &consumed_, &cmd_));
+  EXPECT_EQ(MemcacheParser::BAD_INT, parser_.Parse("ms key x\r\n", &consumed_, &cmd_));
+  EXPECT_EQ(MemcacheParser::UNKNOWN_CMD, parser_.Parse("mx key\r\n", &consumed_, &cmd_));
+}
+
 class MCParserNoreplyTest : public MCParserTest {
  protected:
   void RunTest(string_view str, bool noreply) {
@@ -128,6 +173,28 @@ TEST_F(MCParserNoreplyTest, Other) {
   RunTest("flush_all\r\n", false);
 }
 
+static void BM_ParseMC(benchmark::State& state) {
+  vector<string> cmds;
+  for (unsigned i = 0; i < 100; ++i) {
+    if (i % 2)
+      cmds.push_back(absl::StrCat("set key:", i, " 0 0 5\r\n"));
+    else
+      cmds.push_back(absl::StrCat("get key:", i, " key:", i + 1, " key:", i + 2, "\r\n"));
+  }
+  cmds.push_back("mg key:1 v f t\r\n");
+
+  MemcacheParser parser;
+  MemcacheParser::Command cmd;
+  uint32_t consumed = 0;
+  while (state.KeepRunning()) {
+    for (const auto& c : cmds) {
+      parser.Parse(c, &consumed, &cmd);
+      benchmark::DoNotOptimize(cmd);
+    }
+  }
+}
+BENCHMARK(BM_ParseMC);
+
 TEST_F(MCParserNoreplyTest, LargeGetRequest) {
   std::string large_request = "get";
   for (size_t i = 0; i < 100; ++i) {
@@ -0,0 +1,104 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "facade/numa.h"
+
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+#include "base/logging.h"
+
+namespace facade::numa {
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned kMaxThreads = 1024;
+constexpr int kMpolPreferred = 1;  // MPOL_PREFERRED of linux/mempolicy.h
+
+int16_t thread_nodes[kMaxThreads] = {};
+
+// Node of every cpu, read from sysfs once.
+struct Topology {
+  vector<int> cpu_nodes;
+  unsigned num_nodes = 1;
+
+  Topology();
+};
+
+Topology::Topology() {
+  for (unsigned node = 0;; ++node) {
+    ifstream in("/sys/devices/system/node/node" + to_string(node) + "/cpulist");
+    string cpulist;
+    if (!in || !getline(in, cpulist))
+      break;
+
+    num_nodes = node + 1;
+
+    // The list looks like "0-15,32-47".
+    for (string_view range : absl::StrSplit(absl::StripAsciiWhitespace(cpulist), ',')) {
+      pair<string_view, string_view> bounds = absl::StrSplit(range, '-');
+      unsigned first = 0, last = 0;
+      if (!absl::SimpleAtoi(bounds.first, &first))
+        continue;
+      if (bounds.second.empty() || !absl::SimpleAtoi(bounds.second, &last))
+        last = first;
+
+      if (cpu_nodes.size() <= last)
+        cpu_nodes.resize(last + 1, 0);
+      for (unsigned cpu = first; cpu <= last; ++cpu)
+        cpu_nodes[cpu] = node;
+    }
+  }
+}
+
+const Topology& GetTopology() {
+  static Topology topology;
+  return topology;
+}
+
+}  // namespace
+
+unsigned NumNodes() {
+  return GetTopology().num_nodes;
+}
+
+int NodeOfCpu(int cpu) {
+  const auto& cpu_nodes = GetTopology().cpu_nodes;
+  return cpu >= 0 && size_t(cpu) < cpu_nodes.size() ? cpu_nodes[cpu] : 0;
+}
+
+int InitThread(unsigned thread_index, bool bind) {
+  CHECK_LT(thread_index, kMaxThreads);
+  int node = NodeOfCpu(sched_getcpu());
+  thread_nodes[thread_index] = node;
+
+  if (bind && NumNodes() > 1 && node < 64) {
+    unsigned long mask = 1ul << node;
+    if (syscall(SYS_set_mempolicy, kMpolPreferred, &mask, 64) != 0) {
+      LOG(WARNING) << "Could not bind the memory of thread " << thread_index << " to node "
+                   << node << ": " << strerror(errno);
+    }
+  }
+
+  VLOG(1) << "Thread " << thread_index << " runs on node " << node;
+  return node;
+}
+
+int NodeOfThread(unsigned thread_index) {
+  return thread_index < kMaxThreads ? thread_nodes[thread_index] : 0;
+}
+
+}  // namespace facade::numa
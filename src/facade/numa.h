@@ -0,0 +1,23 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+namespace facade::numa {
+
+// Number of NUMA nodes of the host, 1 when it has no NUMA topology.
+unsigned NumNodes();
+
+// Node of cpu, 0 when unknown.
+int NodeOfCpu(int cpu);
+
+// Records the node of the calling pool thread, which must be pinned to its cpu. If bind is set,
+// the kernel is asked to allocate the memory of the thread on that node, so that the heaps of
+// the thread stay local to it. Returns the node.
+int InitThread(unsigned thread_index, bool bind);
+
+// Node of a pool thread as recorded by InitThread, 0 when unknown.
+int NodeOfThread(unsigned thread_index);
+
+}  // namespace facade::numa
@@ -3,6 +3,8 @@
 //
 #include "facade/redis_parser.h"
 
+#include <absl/base/internal/endian.h>
+#include <absl/strings/ascii.h>
 #include <absl/strings/numbers.h>
 
 #include "base/logging.h"
@@ -12,6 +14,61 @@ namespace facade {
 
 using namespace std;
 
+namespace {
+
+// Returns the number of leading decimal digits of the 8 bytes in val, loaded in little endian
+// order, without branching on the individual bytes.
+inline unsigned CountDigits(uint64_t val) {
+  constexpr uint64_t kHighNibbles = 0xF0F0F0F0F0F0F0F0ULL;
+  constexpr uint64_t kThrees = 0x3030303030303030ULL;
+
+  // The high nibble of a byte is non zero iff the byte is not in ['0', '9']. Carries of the
+  // addition corrupt only the bytes that follow a non digit.
+  uint64_t non_digits = ((val & kHighNibbles) ^ kThrees) |
+                        (((val + 0x0606060606060606ULL) & kHighNibbles) ^ kThrees);
+  uint64_t mask = (non_digits | (non_digits << 1) | (non_digits << 2) | (non_digits << 3)) &
+                  0x8080808080808080ULL;
+  return mask ? __builtin_ctzll(mask) / 8 : 8;
+}
+
+// Returns the value of the first num_digits (1-8) digits of val.
+inline uint32_t DigitsValue(uint64_t val, unsigned num_digits) {
+  // Borrows of the subtraction do not affect the digits, and the shift turns the rest into
+  // leading zeros.
+  val = (val - 0x3030303030303030ULL) << (8 * (8 - num_digits));
+  val = (val * 10) + (val >> 8);
+  val = (((val & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((val >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >>
+        32;
+  return val;
+}
+
+// Parses a non-negative length of up to 7 digits followed by CRLF.
+// Returns the position after CRLF or nullptr if the input does not hold such a length.
+uint8_t* ParseLen(uint8_t* ptr, uint8_t* end, uint32_t* len) {
+  unsigned num_digits = 0;
+  if (end - ptr >= 8) {
+    uint64_t val = absl::little_endian::Load64(ptr);
+    num_digits = CountDigits(val);
+    if (num_digits == 0 || num_digits == 8)
+      return nullptr;
+    *len = DigitsValue(val, num_digits);
+  } else {
+    *len = 0;
+    for (; ptr + num_digits < end && absl::ascii_isdigit(ptr[num_digits]); ++num_digits)
+      *len = *len * 10 + (ptr[num_digits] - '0');
+    if (num_digits == 0)
+      return nullptr;
+  }
+
+  ptr += num_digits;
+  if (end - ptr < 2 || ptr[0] != '\r' || ptr[1] != '\n')
+    return nullptr;
+  return ptr + 2;
+}
+
+}  // namespace
+
 auto RedisParser::Parse(Buffer str, uint32_t* consumed, RespExpr::Vec* res) -> Result {
   *consumed = 0;
   res->clear();
@@ -26,6 +83,13 @@ auto RedisParser::Parse(Buffer str, uint32_t* consumed, RespExpr::Vec* res) -> R
 
   if (state_ == INIT_S) {
     InitStart(str[0], res);
+
+    // Pipelined commands usually arrive whole, so we try to parse them in one pass.
+    if (str[0] == '*' && ParseMultiBulk(str, consumed, res)) {
+      state_ = CMD_COMPLETE_S;
+      last_result_ = OK;
+      return OK;
+    }
   }
 
   if (!cached_expr_)
@@ -106,6 +170,12 @@ void RedisParser::InitStart(uint8_t prefix_b, RespExpr::Vec* res) {
     case '%':  // Resp3 MAP
       state_ = MAP_LEN_S;
       break;
+    case '>':  // Resp3 PUSH, only sent by servers
+      if (!server_mode_) {
+        state_ = ARRAY_LEN_S;
+        break;
+      }
+      [[fallthrough]];
     default:
       state_ = INLINE_S;
       break;
@@ -205,11 +275,40 @@ auto RedisParser::ParseInline(Buffer str) -> Result {
   return OK;
 }
 
+bool RedisParser::ParseMultiBulk(Buffer str, uint32_t* consumed, RespVec* res) {
+  uint8_t* end = str.data() + str.size();
+  uint32_t arr_len;
+  uint8_t* ptr = ParseLen(str.data() + 1, end, &arr_len);
+  if (!ptr || arr_len == 0 || arr_len > max_arr_len_)
+    return false;
+
+  // A bulk string takes at least 6 bytes, do not trust arr_len for reserving otherwise.
+  if (size_t(end - ptr) >= size_t(arr_len) * 6)
+    res->reserve(arr_len);
+
+  for (uint32_t i = 0; i < arr_len; ++i) {
+    uint32_t len;
+    uint8_t* next = ptr < end && *ptr == '$' ? ParseLen(ptr + 1, end, &len) : nullptr;
+    if (!next || size_t(end - next) < size_t(len) + 2 || next[len] != '\r' ||
+        next[len + 1] != '\n') {
+      res->clear();
+      return false;
+    }
+
+    res->emplace_back(RespExpr::STRING);
+    res->back().u = Buffer{next, len};
+    ptr = next + len + 2;
+  }
+
+  *consumed = ptr - str.data();
+  return true;
+}
+
 auto RedisParser::ParseNum(Buffer str, int64_t* res) -> Result {
   if (str.size() < 4) {
     return INPUT_PENDING;
   }
-  DCHECK(str[0] == '$' || str[0] == '*' || str[0] == '%' || str[0] == '~');
+  DCHECK(str[0] == '$' || str[0] == '*' || str[0] == '%' || str[0] == '~' || str[0] == '>');
 
   char* s = reinterpret_cast<char*>(str.data() + 1);
   char* pos = reinterpret_cast<char*>(memchr(s, '\n', str.size() - 1));
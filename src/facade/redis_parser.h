@@ -73,6 +73,11 @@ class RedisParser {
   Result ConsumeBulk(Buffer str);
   Result ParseInline(Buffer str);
 
+  // Parses a multi-bulk array of bulk strings in one pass if str holds all of it.
+  // Returns false and leaves res empty otherwise, e.g. for partial or non-canonical input,
+  // which is then handled by the state machine.
+  bool ParseMultiBulk(Buffer str, uint32_t* consumed, RespVec* res);
+
   // Updates last_consumed_
   Result ParseNum(Buffer str, int64_t* res);
   void HandleFinishArg();
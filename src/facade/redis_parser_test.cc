@@ -209,4 +209,132 @@ TEST_F(RedisParserTest, NestedArray) {
   ASSERT_THAT(args_[1].GetVec(), ElementsAre("car"));
 }
 
+TEST_F(RedisParserTest, Pipeline) {
+  string cmds;
+  vector<vector<string>> expected;
+  for (unsigned i = 0; i < 20; ++i) {
+    string key = absl::StrCat("key:", i);
+    string val(i * 7, 'v');
+    absl::StrAppend(&cmds, "*3\r\n$3\r\nSET\r\n$", key.size(), "\r\n", key, "\r\n$", val.size(),
+                    "\r\n", val, "\r\n");
+    expected.push_back({"SET", key, val});
+  }
+
+  // Feed the pipeline split at every position to exercise both the complete and the partial
+  // command paths.
+  for (size_t split = 0; split <= cmds.size(); split += 7) {
+    RedisParser parser;
+    vector<vector<string>> parsed;
+    string pending;
+    for (string_view chunk : {string_view(cmds).substr(0, split), string_view(cmds).substr(split)}) {
+      pending.append(chunk);
+      string buf = pending;
+      RedisParser::Buffer input{reinterpret_cast<uint8_t*>(buf.data()), buf.size()};
+      while (!input.empty()) {
+        uint32_t consumed = 0;
+        auto res = parser.Parse(input, &consumed, &args_);
+        input.remove_prefix(consumed);
+        if (res != RedisParser::OK) {
+          ASSERT_EQ(RedisParser::INPUT_PENDING, res);
+          break;
+        }
+        vector<string> cmd;
+        for (const auto& arg : args_)
+          cmd.emplace_back(ToSV(arg.GetBuf()));
+        parsed.push_back(std::move(cmd));
+      }
+      pending.assign(reinterpret_cast<char*>(input.data()), input.size());
+    }
+    EXPECT_EQ(expected, parsed) << split;
+  }
+}
+
+TEST_F(RedisParserTest, NonCanonicalLengths) {
+  // Handled by the state machine.
+  ASSERT_EQ(RedisParser::OK, Parse("*2\r\n$00000003\r\nGET\r\n$+1\r\nk\r\n"));
+  EXPECT_THAT(args_, ElementsAre("GET", "k"));
+  ASSERT_EQ(RedisParser::OK, Parse("*1\r\n$-1\r\n"));
+  EXPECT_EQ(RespExpr::NIL, args_[0].type);
+  ASSERT_EQ(RedisParser::BAD_STRING, Parse("*1\r\n$3\r\nGETX\r\n"));
+}
+
+static void BM_ParsePipeline(benchmark::State& state) {
+  string cmds;
+  for (unsigned i = 0; i < 100; ++i) {
+    string key = absl::StrCat("key:", i);
+    absl::StrAppend(&cmds, "*3\r\n$3\r\nSET\r\n$", key.size(), "\r\n", key,
+                    "\r\n$5\r\nvalue\r\n");
+  }
+
+  RedisParser parser;
+  RespVec args;
+  while (state.KeepRunning()) {
+    RedisParser::Buffer input{reinterpret_cast<uint8_t*>(cmds.data()), cmds.size()};
+    while (!input.empty()) {
+      uint32_t consumed = 0;
+      parser.Parse(input, &consumed, &args);
+      input.remove_prefix(consumed);
+    }
+    benchmark::DoNotOptimize(args);
+  }
+}
+BENCHMARK(BM_ParsePipeline);
+
+// Pipeline of commands whose values have sizes from a few bytes to state.range(0).
+static void BM_ParseMixedPipeline(benchmark::State& state) {
+  string cmds;
+  for (unsigned i = 0; i < 100; ++i) {
+    string key = absl::StrCat("key:", i);
+    string value(1 + (i * 7919) % state.range(0), 'v');
+    if (i % 3 == 0) {
+      absl::StrAppend(&cmds, "*2\r\n$3\r\nGET\r\n$", key.size(), "\r\n", key, "\r\n");
+    } else {
+      absl::StrAppend(&cmds, "*3\r\n$3\r\nSET\r\n$", key.size(), "\r\n", key, "\r\n$",
+                      value.size(), "\r\n", value, "\r\n");
+    }
+  }
+
+  RedisParser parser;
+  RespVec args;
+  while (state.KeepRunning()) {
+    RedisParser::Buffer input{reinterpret_cast<uint8_t*>(cmds.data()), cmds.size()};
+    while (!input.empty()) {
+      uint32_t consumed = 0;
+      parser.Parse(input, &consumed, &args);
+      input.remove_prefix(consumed);
+    }
+    benchmark::DoNotOptimize(args);
+  }
+  state.SetBytesProcessed(state.iterations() * cmds.size());
+}
+BENCHMARK(BM_ParseMixedPipeline)->Arg(16)->Arg(1024)->Arg(16384);
+
+// Parses replies in client mode, state.range(0) selects RESP2 or RESP3.
+static void BM_ParseReplies(benchmark::State& state) {
+  bool resp3 = state.range(0);
+  string replies;
+  for (unsigned i = 0; i < 100; ++i) {
+    if (resp3) {
+      absl::StrAppend(&replies, "%2\r\n$5\r\nfield\r\n,", i, ".5\r\n$3\r\nkey\r\n_\r\n");
+    } else {
+      absl::StrAppend(&replies, "*4\r\n$5\r\nfield\r\n$5\r\n", i % 10, ".500\r\n",
+                      "$3\r\nkey\r\n:1\r\n");
+    }
+  }
+
+  RedisParser parser(UINT32_MAX, false);
+  RespVec args;
+  while (state.KeepRunning()) {
+    RedisParser::Buffer input{reinterpret_cast<uint8_t*>(replies.data()), replies.size()};
+    while (!input.empty()) {
+      uint32_t consumed = 0;
+      CHECK_EQ(RedisParser::OK, parser.Parse(input, &consumed, &args));
+      input.remove_prefix(consumed);
+    }
+    benchmark::DoNotOptimize(args);
+  }
+  state.SetBytesProcessed(state.iterations() * replies.size());
+}
+BENCHMARK(BM_ParseReplies)->Arg(0)->Arg(1);
+
 }  // namespace facade
@@ -43,6 +43,34 @@ const char* NullString(bool resp3) {
 
 }  // namespace
 
+void ReplyChunks::Append(string_view str) {
+  while (!str.empty()) {
+    if (chunks_.empty() || chunks_.back().size() == kChunkSize)
+      AddChunk();
+
+    string& chunk = chunks_.back();
+    size_t len = min(str.size(), kChunkSize - chunk.size());
+    chunk.append(str.data(), len);
+    str.remove_prefix(len);
+    size_ += len;
+  }
+}
+
+string ReplyChunks::ToString() const {
+  string res;
+  res.reserve(size_);
+  for (const string& chunk : chunks_)
+    res.append(chunk);
+  return res;
+}
+
+void ReplyChunks::AddChunk() {
+  // The first chunk grows with its contents, so that small replies stay small
+  chunks_.emplace_back();
+  if (chunks_.size() > 1)
+    chunks_.back().reserve(kChunkSize);
+}
+
 SinkReplyBuilder::MGetResponse::~MGetResponse() {
   while (storage_list) {
     auto* next = storage_list->next;
@@ -197,6 +225,11 @@ size_t SinkReplyBuilder::UsedMemory() const {
   return dfly::HeapSize(batch_);
 }
 
+void SinkReplyBuilder::ReleaseBuffers() {
+  if (batch_.empty())
+    string{}.swap(batch_);
+}
+
 MCReplyBuilder::MCReplyBuilder(::io::Sink* sink) : SinkReplyBuilder(sink), noreply_(false) {
 }
 
@@ -210,17 +243,80 @@ void MCReplyBuilder::SendSimpleString(std::string_view str) {
 }
 
 void MCReplyBuilder::SendStored() {
+  if (meta_cmd_)
+    return SendMetaStatus("HD", true);
   SendSimpleString("STORED");
 }
 
 void MCReplyBuilder::SendLong(long val) {
   char buf[32];
   char* next = absl::numbers_internal::FastIntToBuffer(val, buf);
-  SendSimpleString(string_view(buf, next - buf));
+  string_view str(buf, next - buf);
+
+  if (meta_cmd_) {
+    if (!meta_cmd_->meta_flags.return_value)
+      return SendMetaStatus("HD", true);
+
+    GetResp item{str};
+    string header = MetaHeader("VA", &item);
+    header.append(kCRLF);
+    iovec v[] = {IoVec(header), IoVec(str), IoVec(kCRLF)};
+    return Send(v, ABSL_ARRAYSIZE(v));
+  }
+  SendSimpleString(str);
+}
+
+string MCReplyBuilder::MetaHeader(string_view code, const GetResp* item) const {
+  const MemcacheParser::Command::MetaFlags& mf = meta_cmd_->meta_flags;
+  string res{code};
+  if (item) {
+    if (mf.return_value)
+      absl::StrAppend(&res, " ", item->value.size());
+    if (mf.return_flags)
+      absl::StrAppend(&res, " f", item->mc_flag);
+    if (mf.return_cas)
+      absl::StrAppend(&res, " c", item->mc_ver);
+    if (mf.return_ttl)
+      absl::StrAppend(&res, " t", item->mc_ttl);
+    if (mf.return_size)
+      absl::StrAppend(&res, " s", item->value.size());
+  }
+  if (mf.return_key)
+    absl::StrAppend(&res, " k", meta_cmd_->key);
+  if (!mf.opaque.empty())
+    absl::StrAppend(&res, " O", mf.opaque);
+  return res;
+}
+
+void MCReplyBuilder::SendMetaStatus(string_view code, bool omit_quiet) {
+  if (omit_quiet && meta_cmd_->meta_flags.quiet)
+    return;
+
+  string header = MetaHeader(code, nullptr);
+  iovec v[] = {IoVec(header), IoVec(kCRLF)};
+  Send(v, ABSL_ARRAYSIZE(v));
 }
 
 void MCReplyBuilder::SendMGetResponse(MGetResponse resp) {
+  if (meta_cmd_) {
+    DCHECK_EQ(resp.resp_arr.size(), 1u);
+    if (!resp.resp_arr[0])
+      return SendMetaStatus("EN", true);
+
+    // The value is sent straight from the response storage.
+    const GetResp& item = *resp.resp_arr[0];
+    bool with_value = meta_cmd_->meta_flags.return_value;
+    string header = MetaHeader(with_value ? "VA" : "HD", &item);
+    header.append(kCRLF);
+    if (!with_value)
+      return SendRaw(header);
+
+    iovec v[] = {IoVec(header), IoVec(item.value), IoVec(kCRLF)};
+    return Send(v, ABSL_ARRAYSIZE(v));
+  }
+
   string header;
+  auto next_end = get_batch_.begin();
   for (unsigned i = 0; i < resp.resp_arr.size(); ++i) {
     if (resp.resp_arr[i]) {
       const auto& src = *resp.resp_arr[i];
@@ -234,12 +330,20 @@ void MCReplyBuilder::SendMGetResponse(MGetResponse resp) {
       Send(v, ABSL_ARRAYSIZE(v));
       header.clear();
     }
+
+    // The first argument of the batch is the command name, so keys start at 1.
+    if (next_end != get_batch_.end() && *next_end == i + 1) {
+      ++next_end;
+      if (next_end != get_batch_.end())
+        SendSimpleString("END");
+    }
   }
   SendSimpleString("END");
 }
 
 void MCReplyBuilder::SendError(string_view str, std::string_view type) {
-  SendSimpleString(absl::StrCat("SERVER_ERROR ", str));
+  for (size_t i = 0; i < max<size_t>(get_batch_.size(), 1); ++i)
+    SendSimpleString(absl::StrCat("SERVER_ERROR ", str));
 }
 
 void MCReplyBuilder::SendProtocolError(std::string_view str) {
@@ -256,13 +360,23 @@ void MCReplyBuilder::SendClientError(string_view str) {
 }
 
 void MCReplyBuilder::SendSetSkipped() {
+  if (meta_cmd_)
+    return SendMetaStatus("NS", false);
   SendSimpleString("NOT_STORED");
 }
 
 void MCReplyBuilder::SendNotFound() {
+  if (meta_cmd_)
+    return SendMetaStatus("NF", true);
   SendSimpleString("NOT_FOUND");
 }
 
+void MCReplyBuilder::SendDeleted() {
+  if (meta_cmd_)
+    return SendMetaStatus("HD", true);
+  SendSimpleString("DELETED");
+}
+
 char* RedisReplyBuilder::FormatDouble(double val, char* dest, unsigned dest_len) {
   StringBuilder sb(dest, dest_len);
   CHECK(dfly_conv.ToShortest(val, &sb));
@@ -336,6 +450,30 @@ void RedisReplyBuilder::SendBulkString(std::string_view str) {
   return Send(v, ABSL_ARRAYSIZE(v));
 }
 
+void RedisReplyBuilder::SendBulkChunks(const ReplyChunks& chunks) {
+  char tmp[absl::numbers_internal::kFastToBufferSize + 3];
+  tmp[0] = '$';  // Format length
+  char* next = absl::numbers_internal::FastIntToBuffer(uint64_t(chunks.Size()), tmp + 1);
+  *next++ = '\r';
+  *next++ = '\n';
+
+  // Send chunks in batches to bound the number of iovecs per write.
+  constexpr unsigned kBatchLen = 32;
+  iovec v[kBatchLen + 1];
+  unsigned len = 0;
+  v[len++] = IoVec(string_view{tmp, size_t(next - tmp)});
+  for (const string& chunk : chunks.Chunks()) {
+    if (len == kBatchLen) {
+      Send(v, len);
+      len = 0;
+    }
+    v[len++] = IoVec(chunk);
+  }
+  v[len++] = IoVec(kCRLF);
+
+  Send(v, len);
+}
+
 void RedisReplyBuilder::SendVerbatimString(std::string_view str, VerbatimFormat format) {
   if (!is_resp3_)
     return SendBulkString(str);
@@ -530,6 +668,18 @@ constexpr static string_view START_SYMBOLS[] = {"*", "~", "%", ">"};
 static_assert(START_SYMBOLS[RedisReplyBuilder::MAP] == "%" &&
               START_SYMBOLS[RedisReplyBuilder::SET] == "~");
 
+void RedisReplyBuilder::SendEncodedPush(std::string_view body) {
+  std::string_view parts[] = {is_resp3_ ? START_SYMBOLS[PUSH] : START_SYMBOLS[ARRAY], body};
+  SendRawVec(parts);
+}
+
+string RedisReplyBuilder::EncodePush(absl::Span<const std::string_view> elems) {
+  string res = absl::StrCat(elems.size(), kCRLF);
+  for (string_view elem : elems)
+    absl::StrAppend(&res, "$", elem.size(), kCRLF, elem, kCRLF);
+  return res;
+}
+
 void RedisReplyBuilder::StartCollection(unsigned len, CollectionType type) {
   if (!is_resp3_) {  // Flatten for Resp2
     if (type == MAP)
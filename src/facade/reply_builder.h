@@ -7,8 +7,10 @@
 
 #include <optional>
 #include <string_view>
+#include <vector>
 
 #include "facade/facade_types.h"
+#include "facade/memcache_parser.h"
 #include "facade/op_status.h"
 #include "io/io.h"
 
@@ -21,6 +23,39 @@ enum class ReplyMode {
   FULL       // All replies are recorded
 };
 
+// Reply data serialized in advance into chunks of bounded size. Large replies grow without
+// reallocating and are sent without being copied into one contiguous buffer.
+class ReplyChunks {
+ public:
+  static constexpr size_t kChunkSize = 16384;
+
+  void Append(std::string_view str);
+
+  void Append(char c) {
+    if (chunks_.empty() || chunks_.back().size() == kChunkSize)
+      AddChunk();
+    chunks_.back().push_back(c);
+    size_++;
+  }
+
+  size_t Size() const {
+    return size_;
+  }
+
+  const std::vector<std::string>& Chunks() const {
+    return chunks_;
+  }
+
+  // Concatenation of all chunks
+  std::string ToString() const;
+
+ private:
+  void AddChunk();
+
+  std::vector<std::string> chunks_;
+  size_t size_ = 0;
+};
+
 class SinkReplyBuilder {
  public:
   struct MGetStorage {
@@ -34,6 +69,7 @@ class SinkReplyBuilder {
 
     uint64_t mc_ver = 0;  // 0 means we do not output it (i.e has not been requested).
     uint32_t mc_flag = 0;
+    int64_t mc_ttl = -1;  // remaining seconds, -1 if the key does not expire.
 
     GetResp() = default;
     GetResp(std::string_view val) : value(val) {
@@ -141,6 +177,9 @@ class SinkReplyBuilder {
 
   virtual size_t UsedMemory() const;
 
+  // Frees the capacity of the reply batch if it is empty.
+  void ReleaseBuffers();
+
   static const ReplyStats& GetThreadLocalStats() {
     return tl_facade_stats->reply_stats;
   }
@@ -187,6 +226,7 @@ class MCReplyBuilder : public SinkReplyBuilder {
 
   void SendClientError(std::string_view str);
   void SendNotFound();
+  void SendDeleted();
   void SendSimpleString(std::string_view str) final;
   void SendProtocolError(std::string_view str) final;
 
@@ -194,7 +234,28 @@ class MCReplyBuilder : public SinkReplyBuilder {
     noreply_ = noreply;
   }
 
+  // While set, replies are formatted as the responses of the meta command cmd.
+  void SetMetaCommand(const MemcacheParser::Command* cmd) {
+    meta_cmd_ = cmd;
+  }
+
+  // While set, a MGET response answers a batch of get commands, ends holding the index of the
+  // last key of each. The response is ended and errors are repeated once per command.
+  void SetGetBatch(absl::Span<const unsigned> ends) {
+    get_batch_ = ends;
+  }
+
   bool NoReply() const;
+
+ private:
+  // Returns "<code> <return flags>*", item provides the fields of a retrieved value.
+  std::string MetaHeader(std::string_view code, const GetResp* item) const;
+
+  // Sends a value-less meta status line, omitted in quiet mode if omit_quiet is set.
+  void SendMetaStatus(std::string_view code, bool omit_quiet);
+
+  const MemcacheParser::Command* meta_cmd_ = nullptr;
+  absl::Span<const unsigned> get_batch_;
 };
 
 class RedisReplyBuilder : public SinkReplyBuilder {
@@ -232,7 +293,20 @@ class RedisReplyBuilder : public SinkReplyBuilder {
   void SendSimpleString(std::string_view str) override;
 
   virtual void SendBulkString(std::string_view str);
+
+  // Sends the concatenation of chunks as one bulk string
+  virtual void SendBulkChunks(const ReplyChunks& chunks);
+
   virtual void SendVerbatimString(std::string_view str, VerbatimFormat format = TXT);
+
+  // Sends a push message of bulk strings encoded with EncodePush. The body is written straight
+  // from the caller's buffer, so that many connections can share it. Bypasses reply capturing,
+  // only for messages sent outside of commands.
+  void SendEncodedPush(std::string_view body);
+
+  // Encodes a push message without its type byte, which depends on the protocol of the
+  // connection: '>' for RESP3 and '*' for RESP2.
+  static std::string EncodePush(absl::Span<const std::string_view> elems);
   virtual void SendScoredArray(const std::vector<std::pair<std::string, double>>& arr,
                                bool with_scores);
 
@@ -587,6 +587,29 @@ TEST_F(RedisReplyBuilderTest, BulkStringWithErrorString) {
   ASSERT_THAT(parsing_output.args, ElementsAre(message));
 }
 
+TEST_F(RedisReplyBuilderTest, BulkChunks) {
+  // Spans more chunks than are sent in one batch, appends cross chunk boundaries
+  ReplyChunks chunks;
+  std::string message;
+  for (unsigned i = 0; message.size() < 40 * ReplyChunks::kChunkSize; i++) {
+    std::string part = absl::StrCat("part", i, ",");
+    chunks.Append(part);
+    chunks.Append('|');
+    absl::StrAppend(&message, part, "|");
+  }
+  ASSERT_EQ(chunks.Size(), message.size());
+  ASSERT_EQ(chunks.ToString(), message);
+  ASSERT_GT(chunks.Chunks().size(), 32u);
+
+  builder_->SendBulkChunks(chunks);
+  ASSERT_TRUE(NoErrors());
+  ASSERT_EQ(str(), absl::StrCat(kBulkStringStart, message.size(), kCRLF, message, kCRLF));
+  sink_.Clear();
+
+  builder_->SendBulkChunks(ReplyChunks{});
+  ASSERT_EQ(str(), absl::StrCat(kBulkStringStart, 0, kCRLF, kCRLF));
+}
+
 TEST_F(RedisReplyBuilderTest, Int) {
   // message in the form of ":0\r\n" and ":1000\r\n"
   // this message just starts with ':' and ends with \r\n
@@ -951,6 +974,35 @@ TEST_F(RedisReplyBuilderTest, VerbatimString) {
   ASSERT_EQ(TakePayload(), "$16\r\nA simple string!\r\n") << "Resp3 VerbatimString TXT failed.";
 }
 
+TEST_F(RedisReplyBuilderTest, EncodedPush) {
+  std::string_view elems[] = {"pmessage", "ch*", "channel", "hello"};
+  std::string body = RedisReplyBuilder::EncodePush(elems);
+
+  // Same bytes as a push message of bulk strings, for both protocols.
+  for (bool resp3 : {false, true}) {
+    builder_->SetResp3(resp3);
+    builder_->SendStringArr(elems, RedisReplyBuilder::PUSH);
+    std::string expected = TakePayload();
+    builder_->SendEncodedPush(body);
+    ASSERT_TRUE(NoErrors());
+    ASSERT_EQ(TakePayload(), expected) << resp3;
+  }
+}
+
+TEST_F(RedisReplyBuilderTest, ReleaseBuffers) {
+  builder_->SetBatchMode(true);
+  for (unsigned i = 0; i < 100; ++i)
+    builder_->SendBulkString("value");
+  EXPECT_GT(builder_->UsedMemory(), 0u);
+
+  // The batch keeps its capacity after a flush until the buffers are released.
+  builder_->FlushBatch();
+  EXPECT_GT(builder_->UsedMemory(), 0u);
+  builder_->ReleaseBuffers();
+  EXPECT_EQ(builder_->UsedMemory(), 0u);
+  EXPECT_EQ(100u, RawTokenizedMessage().size() / 2);
+}
+
 static void BM_FormatDouble(benchmark::State& state) {
   vector<double> values;
   char buf[64];
@@ -969,4 +1021,74 @@ static void BM_FormatDouble(benchmark::State& state) {
 }
 BENCHMARK(BM_FormatDouble);
 
+// SinkReplyBuilder accounts its writes in the thread local stats.
+static void InitBenchStats() {
+  if (!tl_facade_stats)
+    tl_facade_stats = new FacadeStats;
+}
+
+static void BM_SendStringArr(benchmark::State& state) {
+  InitBenchStats();
+  vector<string> values;
+  for (int64_t i = 0; i < state.range(0); ++i)
+    values.push_back(absl::StrCat("element:", i));
+
+  io::StringSink sink;
+  RedisReplyBuilder builder(&sink);
+  while (state.KeepRunning()) {
+    builder.SendStringArr(OwnedArgSlice{values});
+    sink.Clear();
+  }
+}
+BENCHMARK(BM_SendStringArr)->Arg(10)->Arg(1000)->Arg(100000);
+
+// Map reply with double values, state.range(0) selects RESP2 or RESP3.
+static void BM_SendMap(benchmark::State& state) {
+  InitBenchStats();
+  io::StringSink sink;
+  RedisReplyBuilder builder(&sink);
+  builder.SetResp3(state.range(0));
+  while (state.KeepRunning()) {
+    builder.StartCollection(100, RedisReplyBuilder::MAP);
+    for (unsigned i = 0; i < 100; ++i) {
+      builder.SendBulkString("field");
+      builder.SendDouble(i * 1.5);
+    }
+    sink.Clear();
+  }
+}
+BENCHMARK(BM_SendMap)->Arg(0)->Arg(1);
+
+static void BM_SendBulkString(benchmark::State& state) {
+  InitBenchStats();
+  string value(state.range(0), 'v');
+  io::StringSink sink;
+  RedisReplyBuilder builder(&sink);
+  while (state.KeepRunning()) {
+    builder.SendBulkString(value);
+    sink.Clear();
+  }
+  state.SetBytesProcessed(state.iterations() * value.size());
+}
+BENCHMARK(BM_SendBulkString)->Arg(16)->Arg(1024)->Arg(65536);
+
+// Pipelined replies batched in the builder, as done for squashed pipelines.
+static void BM_SendBatchedArrays(benchmark::State& state) {
+  InitBenchStats();
+  io::StringSink sink;
+  RedisReplyBuilder builder(&sink);
+  builder.SetBatchMode(true);
+  while (state.KeepRunning()) {
+    for (unsigned i = 0; i < 100; ++i) {
+      builder.StartArray(3);
+      builder.SendLong(i);
+      builder.SendBulkString("value");
+      builder.SendNull();
+    }
+    builder.FlushBatch();
+    sink.Clear();
+  }
+}
+BENCHMARK(BM_SendBatchedArrays);
+
 }  // namespace facade
@@ -81,6 +81,11 @@ void CapturingReplyBuilder::SendBulkString(std::string_view str) {
   Capture(BulkString{string{str}});
 }
 
+void CapturingReplyBuilder::SendBulkChunks(const ReplyChunks& chunks) {
+  SKIP_LESS(ReplyMode::FULL);
+  Capture(BulkString{chunks.ToString()});
+}
+
 void CapturingReplyBuilder::SendScoredArray(const std::vector<std::pair<std::string, double>>& arr,
                                             bool with_scores) {
   SKIP_LESS(ReplyMode::FULL);
@@ -42,6 +42,7 @@ class CapturingReplyBuilder : public RedisReplyBuilder {
   void SendSimpleString(std::string_view str) override;
 
   void SendBulkString(std::string_view str) override;
+  void SendBulkChunks(const ReplyChunks& chunks) override;
   void SendScoredArray(const std::vector<std::pair<std::string, double>>& arr,
                        bool with_scores) override;
 
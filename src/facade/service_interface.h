@@ -34,6 +34,13 @@ class ServiceInterface {
   virtual void DispatchMC(const MemcacheParser::Command& cmd, std::string_view value,
                           ConnectionContext* cntx) = 0;
 
+  // Executes consecutive pipelined memcache get commands, replying to each of them in order.
+  virtual void DispatchManyMC(absl::Span<const MemcacheParser::Command* const> cmds,
+                              ConnectionContext* cntx) {
+    for (const auto* cmd : cmds)
+      DispatchMC(*cmd, std::string_view{}, cntx);
+  }
+
   virtual ConnectionContext* CreateContext(util::FiberSocketBase* peer, Connection* owner) = 0;
 
   virtual void ConfigureHttpHandlers(util::HttpListenerBase* base, bool is_privileged) {
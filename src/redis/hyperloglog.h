@@ -63,4 +63,24 @@ int64_t pfcountMulti(struct HllBufferPtr* hlls, size_t hlls_count);
  * `out_hll` *can* be one of the elements in `in_hlls`. */
 int pfmerge(struct HllBufferPtr* in_hlls, size_t in_hlls_count, struct HllBufferPtr out_hll);
 
+/* Returns the number of registers of an HLL. Arrays of 8-bit registers used by the functions
+ * below must have this size. */
+size_t getHllRegistersCount();
+
+/* Merges the dense-encoded HLL `hll_ptr` into the array of 8-bit `registers`, by keeping the
+ * maximum of every register.
+ * Returns 0 upon success, or a negative number if `hll_ptr` is not a dense-encoded HLL. */
+int mergeDenseHllRegisters(struct HllBufferPtr hll_ptr, uint8_t* registers);
+
+/* Merges the array of 8-bit registers `other` into `registers`. */
+void mergeHllRegisters(uint8_t* registers, const uint8_t* other);
+
+/* Returns the estimated count for an array of 8-bit registers. */
+int64_t pfcountRegisters(const uint8_t* registers);
+
+/* Overwrites the registers of the dense-encoded HLL `out_hll` with the array of 8-bit
+ * `registers`.
+ * Returns 0 upon success, or a negative number if `out_hll` is not a dense-encoded HLL. */
+int storeHllRegisters(const uint8_t* registers, struct HllBufferPtr out_hll);
+
 #endif
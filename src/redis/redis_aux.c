@@ -21,8 +21,12 @@ void InitRedisTables() {
   server.zset_max_listpack_entries = 128;
   server.zset_max_listpack_value = 32;
 
+  server.set_max_small_entries = 128;
+  server.set_max_small_value = 64;
+
   server.max_map_field_len = 64;
   server.max_listpack_map_bytes = 1024;
+  server.max_listpack_lookup_ns = 0;
 
   server.stream_node_max_bytes = 4096;
   server.stream_node_max_entries = 100;
@@ -47,6 +47,14 @@ typedef struct ServerStub {
   size_t zset_max_listpack_entries;
   size_t zset_max_listpack_value;
 
+  /* Sets of strings are encoded as SmallSet up to these limits */
+  size_t set_max_small_entries;
+  size_t set_max_small_value;
+
+  /* Budget for a single listpack lookup, containers whose measured lookup cost exceeds it
+   * are converted to hash based encodings. 0 disables the check. */
+  size_t max_listpack_lookup_ns;
+
   size_t stream_node_max_bytes;
   long long stream_node_max_entries;
 } Server;
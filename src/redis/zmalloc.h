@@ -132,6 +132,9 @@ int zmalloc_page_is_underutilized(void *ptr, float ratio);
 // roman: void zlibc_free(void *ptr);
 
 void init_zmalloc_threadlocal(void* heap);
+
+/* Switches the allocations of this thread to heap if they currently use old_heap. */
+void replace_zmalloc_threadlocal(void* old_heap, void* heap);
 extern __thread ssize_t zmalloc_used_memory_tl;
 
 #undef __zm_str
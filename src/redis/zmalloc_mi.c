@@ -175,6 +175,11 @@ void init_zmalloc_threadlocal(void* heap) {
   zmalloc_heap = heap;
 }
 
+void replace_zmalloc_threadlocal(void* old_heap, void* heap) {
+  if (zmalloc_heap == old_heap)
+    zmalloc_heap = heap;
+}
+
 int zmalloc_page_is_underutilized(void* ptr, float ratio) {
   return mi_heap_page_is_underutilized(zmalloc_heap, ptr, ratio);
 }
@@ -12,6 +12,7 @@
 #include "base/logging.h"
 #include "facade/facade_test.h"
 #include "server/acl/acl_commands_def.h"
+#include "server/acl/key_matcher.h"
 #include "server/command_registry.h"
 #include "server/test_utils.h"
 
@@ -469,4 +470,27 @@ TEST_F(AclFamilyTest, TestKeys) {
   EXPECT_THAT(resp, ErrArg("ERR Unrecognized parameter %RFOO"));
 }
 
+TEST_F(AclFamilyTest, KeyMatcher) {
+  using acl::KeyOp;
+  std::vector<acl::GlobType> globs = {{"foo", KeyOp::READ},
+                                      {"bar*", KeyOp::WRITE},
+                                      {"b*z", KeyOp::READ_WRITE},
+                                      {"baz:?", KeyOp::READ}};
+  acl::KeyMatcher matcher{globs};
+
+  EXPECT_TRUE(matcher.Matches("foo", KeyOp::READ));
+  EXPECT_FALSE(matcher.Matches("foo", KeyOp::WRITE));
+  EXPECT_FALSE(matcher.Matches("foo1", KeyOp::READ));
+
+  EXPECT_TRUE(matcher.Matches("bar", KeyOp::WRITE));
+  EXPECT_TRUE(matcher.Matches("bar:1", KeyOp::WRITE));
+  EXPECT_FALSE(matcher.Matches("bar:1", KeyOp::READ));
+
+  EXPECT_TRUE(matcher.Matches("barz", KeyOp::READ));
+  EXPECT_TRUE(matcher.Matches("bz", KeyOp::WRITE));
+  EXPECT_TRUE(matcher.Matches("baz:1", KeyOp::READ));
+  EXPECT_FALSE(matcher.Matches("baz:1", KeyOp::WRITE));
+  EXPECT_FALSE(matcher.Matches("", KeyOp::READ));
+}
+
 }  // namespace dfly
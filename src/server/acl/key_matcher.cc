@@ -0,0 +1,65 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/acl/key_matcher.h"
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace dfly::acl {
+
+KeyMatcher::KeyMatcher(const std::vector<GlobType>& globs) {
+  for (const auto& [pattern, op] : globs) {
+    if (op == KeyOp::READ || op == KeyOp::READ_WRITE)
+      read_.Add(pattern);
+    if (op == KeyOp::WRITE || op == KeyOp::READ_WRITE)
+      write_.Add(pattern);
+  }
+}
+
+bool KeyMatcher::Matches(std::string_view key, KeyOp op) const {
+  DCHECK(op != KeyOp::READ_WRITE);
+  return (op == KeyOp::READ ? read_ : write_).Matches(key);
+}
+
+void KeyMatcher::Patterns::Add(std::string_view pattern) {
+  size_t pos = pattern.find_first_of("*?[\\");
+  if (pos == std::string_view::npos) {
+    literals.emplace(pattern);
+    return;
+  }
+
+  // Only trailing stars after the prefix, i.e. "prefix*".
+  if (pattern.find_first_not_of('*', pos) == std::string_view::npos) {
+    prefixes.emplace(pattern.substr(0, pos));
+    auto it = std::lower_bound(prefix_lengths.begin(), prefix_lengths.end(), pos);
+    if (it == prefix_lengths.end() || *it != pos)
+      prefix_lengths.insert(it, pos);
+    return;
+  }
+
+  globs.emplace_back(pattern);
+}
+
+bool KeyMatcher::Patterns::Matches(std::string_view key) const {
+  if (literals.contains(key))
+    return true;
+
+  // Like stringmatchlen, only an empty pattern matches an empty key.
+  if (key.empty())
+    return false;
+
+  for (size_t len : prefix_lengths) {
+    if (len > key.size())
+      break;
+    if (prefixes.contains(key.substr(0, len)))
+      return true;
+  }
+
+  return std::any_of(globs.begin(), globs.end(),
+                     [key](const GlobMatcher& glob) { return glob.Matches(key); });
+}
+
+}  // namespace dfly::acl
@@ -0,0 +1,43 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "absl/container/flat_hash_set.h"
+#include "core/glob_matcher.h"
+#include "facade/acl_commands_def.h"
+
+namespace dfly::acl {
+
+// The key patterns of a user compiled into a single matcher per access type. It is built once
+// when the patterns change and shared by all connections of the user via AclKeys.
+// Literal patterns are looked up in a hash set and patterns like "prefix*" by their prefix, so
+// that only the remaining patterns are evaluated one by one.
+class KeyMatcher {
+ public:
+  explicit KeyMatcher(const std::vector<GlobType>& globs);
+
+  // Whether key matches any of the patterns that allow op, either READ or WRITE.
+  bool Matches(std::string_view key, KeyOp op) const;
+
+ private:
+  struct Patterns {
+    void Add(std::string_view pattern);
+    bool Matches(std::string_view key) const;
+
+    absl::flat_hash_set<std::string> literals;
+    absl::flat_hash_set<std::string> prefixes;
+    std::vector<size_t> prefix_lengths;  // distinct, in increasing order
+    std::vector<GlobMatcher> globs;
+  };
+
+  Patterns read_;
+  Patterns write_;
+};
+
+}  // namespace dfly::acl
@@ -12,6 +12,7 @@
 #include "absl/strings/escaping.h"
 #include "core/overloaded.h"
 #include "server/acl/helpers.h"
+#include "server/acl/key_matcher.h"
 
 namespace dfly::acl {
 
@@ -219,6 +220,7 @@ void User::SetKeyGlobs(std::vector<UpdateKey> keys) {
       keys_.key_globs.push_back({std::move(key.key), key.op});
     }
   }
+  keys_.matcher = std::make_shared<const KeyMatcher>(keys_.key_globs);
 }
 
 void User::SetNopass() {
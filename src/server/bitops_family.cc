@@ -9,6 +9,7 @@
 #include "absl/strings/match.h"
 #include "base/expected.hpp"
 #include "base/logging.h"
+#include "core/bitmap_ops.h"
 #include "facade/cmd_arg_parser.h"
 #include "facade/op_status.h"
 #include "server/acl/acl_commands_def.h"
@@ -79,66 +80,21 @@ bool ToUpperAndGetAsBit(CmdArgList args, size_t i, bool* as_bit) {
   }
 }
 
-// This function can be used for any case where we allowing out of bound
-// access where the default in this case would be 0 -such as bitop
-uint8_t GetByteAt(std::string_view s, std::size_t at) {
-  return at >= s.size() ? 0 : s[at];
-}
-
-// For XOR, OR, AND operations on a collection of bytes
-template <typename BitOp, typename SkipOp>
-std::string BitOpString(BitOp operation_f, SkipOp skip_f, const BitsStrVec& values,
-                        std::string new_value) {
+// For XOR, OR, AND operations on a collection of values. The result is as long as the longest
+// value, shorter values are treated as padded with zero bytes.
+std::string BitOpString(BitwiseOp op, const BitsStrVec& values, std::size_t max_len) {
   // at this point, values are not empty
-  std::size_t max_size = new_value.size();
-
-  if (values.size() > 1) {
-    for (std::size_t i = 0; i < max_size; i++) {
-      std::uint8_t new_entry = operation_f(GetByteAt(values[0], i), GetByteAt(values[1], i));
-      for (std::size_t j = 2; j < values.size(); ++j) {
-        new_entry = operation_f(new_entry, GetByteAt(values[j], i));
-        if (skip_f(new_entry)) {
-          break;
-        }
-      }
-      new_value[i] = new_entry;
-    }
-    return new_value;
-  } else {
+  if (values.size() == 1) {
     return values[0];
   }
-}
-
-// Helper functions to support operations
-// so we would not need to check which
-// operations to run in the look (unlike
-// https://github.com/redis/redis/blob/c2b0c13d5c0fab49131f6f5e844f80bfa43f6219/src/bitops.c#L607)
-constexpr bool SkipAnd(uint8_t byte) {
-  return byte == 0x0;
-}
-
-constexpr bool SkipOr(uint8_t byte) {
-  return byte == 0xff;
-}
-
-constexpr bool SkipXor(uint8_t) {
-  return false;
-}
-
-constexpr uint8_t AndOp(uint8_t left, uint8_t right) {
-  return left & right;
-}
-
-constexpr uint8_t OrOp(uint8_t left, uint8_t right) {
-  return left | right;
-}
-
-constexpr uint8_t XorOp(uint8_t left, uint8_t right) {
-  return left ^ right;
+  std::vector<std::string_view> srcs(values.begin(), values.end());
+  std::string new_value(max_len, 0);
+  CombineBitmaps(op, srcs, reinterpret_cast<uint8_t*>(new_value.data()), max_len);
+  return new_value;
 }
 
 std::string BitOpNotString(std::string from) {
-  std::transform(from.begin(), from.end(), from.begin(), [](auto c) { return ~c; });
+  NegateBitmap(reinterpret_cast<uint8_t*>(from.data()), from.size());
   return from;
 }
 
@@ -178,10 +134,10 @@ std::size_t CountBitSetByByteIndices(std::string_view at, std::size_t start, std
     return 0;
   }
   end = std::min(end, at.size());  // don't overflow
-  std::uint32_t count =
-      std::accumulate(std::next(at.begin(), start), std::next(at.begin(), end), 0,
-                      [](auto counter, uint8_t ch) { return counter + absl::popcount(ch); });
-  return count;
+  if (start >= end) {
+    return 0;
+  }
+  return CountSetBits(reinterpret_cast<const uint8_t*>(at.data()) + start, end - start);
 }
 
 // Count the number of bits that are on, on bits boundaries: i.e. Start and end are the indices for
@@ -392,16 +348,14 @@ std::string RunBitOperationOnValues(std::string_view op, const BitsStrVec& value
   // is shorter than the other it would return a 0 and the operation would continue
   // until we ran the longest value. The function will return the resulting new value
   std::size_t max_len = 0;
-  std::size_t max_len_index = 0;
 
   const auto BitOperation = [&]() {
     if (op == OR_OP_NAME) {
-      std::string default_str{values[max_len_index]};
-      return BitOpString(OrOp, SkipOr, std::move(values), std::move(default_str));
+      return BitOpString(BitwiseOp::kOr, values, max_len);
     } else if (op == XOR_OP_NAME) {
-      return BitOpString(XorOp, SkipXor, std::move(values), std::string(max_len, 0));
+      return BitOpString(BitwiseOp::kXor, values, max_len);
     } else if (op == AND_OP_NAME) {
-      return BitOpString(AndOp, SkipAnd, std::move(values), std::string(max_len, 0));
+      return BitOpString(BitwiseOp::kAnd, values, max_len);
     } else if (op == NOT_OP_NAME) {
       return BitOpNotString(values[0]);
     } else {
@@ -416,10 +370,7 @@ std::string RunBitOperationOnValues(std::string_view op, const BitsStrVec& value
   // The new result is the max length input
   max_len = values[0].size();
   for (std::size_t i = 1; i < values.size(); ++i) {
-    if (values[i].size() > max_len) {
-      max_len = values[i].size();
-      max_len_index = i;
-    }
+    max_len = std::max(max_len, values[i].size());
   }
   return BitOperation();
 }
@@ -1283,17 +1234,38 @@ std::size_t GetFirstBitWithValueInByte(uint8_t byte, bool value) {
 
 int64_t FindFirstBitWithValueAsBit(std::string_view value_str, bool bit_value, int64_t start,
                                    int64_t end) {
-  for (int64_t i = start; i <= end; ++i) {
-    if (static_cast<size_t>(GetByteIndex(i)) >= value_str.size()) {
-      break;
-    }
-    const uint8_t current_byte = GetByteValue(value_str, i);
-    bool current_bit = CheckBitStatus(current_byte, GetNormalizedBitIndex(i));
-    if (current_bit != bit_value) {
-      continue;
-    }
+  end = std::min<int64_t>(end, static_cast<int64_t>(value_str.size()) * OFFSET_FACTOR - 1);
+  if (start > end) {
+    return -1;
+  }
+
+  // Search for set bits of value ^ flip, masking out the bits before start and after end
+  const uint8_t flip = bit_value ? 0 : std::numeric_limits<uint8_t>::max();
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(value_str.data());
+  const int64_t first_byte = GetByteIndex(start), last_byte = GetByteIndex(end);
+  auto masked_byte = [&](int64_t index) -> uint8_t {
+    uint8_t byte = data[index] ^ flip;
+    if (index == first_byte)
+      byte &= 0xff >> GetBitIndex(start);
+    if (index == last_byte)
+      byte &= 0xff << GetNormalizedBitIndex(end);
+    return byte;
+  };
 
-    return i;
+  int64_t index = first_byte;
+  if (uint8_t byte = masked_byte(index); byte) {
+    return index * OFFSET_FACTOR + absl::countl_zero(byte);
+  }
+
+  // Skip the whole bytes in between, then check the last byte
+  index++;
+  if (index < last_byte) {
+    index += FindFirstByteNot(data + index, last_byte - index, flip);
+  }
+  if (index <= last_byte) {
+    if (uint8_t byte = masked_byte(index); byte) {
+      return index * OFFSET_FACTOR + absl::countl_zero(byte);
+    }
   }
 
   return -1;
@@ -1301,20 +1273,19 @@ int64_t FindFirstBitWithValueAsBit(std::string_view value_str, bool bit_value, i
 
 int64_t FindFirstBitWithValueAsByte(std::string_view value_str, bool bit_value, int64_t start,
                                     int64_t end) {
-  for (int64_t i = start; i <= end; ++i) {
-    if (static_cast<size_t>(i) >= value_str.size()) {
-      break;
-    }
-    const uint8_t current_byte = value_str[i];
-    const uint8_t kNotFoundByte = bit_value ? 0 : std::numeric_limits<uint8_t>::max();
-    if (current_byte == kNotFoundByte) {
-      continue;
-    }
+  end = std::min<int64_t>(end, static_cast<int64_t>(value_str.size()) - 1);
+  if (start > end) {
+    return -1;
+  }
 
-    return i * OFFSET_FACTOR + GetFirstBitWithValueInByte(current_byte, bit_value);
+  const uint8_t kNotFoundByte = bit_value ? 0 : std::numeric_limits<uint8_t>::max();
+  const uint8_t* data = reinterpret_cast<const uint8_t*>(value_str.data());
+  int64_t i = start + FindFirstByteNot(data + start, end - start + 1, kNotFoundByte);
+  if (i > end) {
+    return -1;
   }
 
-  return -1;
+  return i * OFFSET_FACTOR + GetFirstBitWithValueInByte(data[i], bit_value);
 }
 
 OpResult<int64_t> FindFirstBitWithValue(const OpArgs& op_args, std::string_view key, bool bit_value,
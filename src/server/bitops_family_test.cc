@@ -532,6 +532,38 @@ TEST_F(BitOpsFamilyTest, BitPos) {
   EXPECT_EQ(-1, CheckedInt({"bitpos", "d", "0"}));
 }
 
+TEST_F(BitOpsFamilyTest, LargeValues) {
+  // Values longer than the vector kernels and the blocks of BITOP
+  Run({"setbit", "a", "80003", "1"});
+  Run({"setbit", "a", "80100", "1"});
+  Run({"setbit", "b", "80003", "1"});
+  Run({"setbit", "b", "9", "1"});
+  Run({"setbit", "c", "200000", "1"});
+
+  EXPECT_EQ(80003, CheckedInt({"bitpos", "a", "1"}));
+  EXPECT_EQ(80003, CheckedInt({"bitpos", "a", "1", "80003", "-1", "BIT"}));
+  EXPECT_EQ(80100, CheckedInt({"bitpos", "a", "1", "80004", "-1", "BIT"}));
+  EXPECT_EQ(-1, CheckedInt({"bitpos", "a", "1", "80004", "80099", "BIT"}));
+  EXPECT_EQ(80100, CheckedInt({"bitpos", "a", "1", "10001"}));
+  EXPECT_EQ(2, CheckedInt({"bitcount", "a"}));
+  EXPECT_EQ(1, CheckedInt({"bitcount", "a", "80004", "-1", "BIT"}));
+
+  EXPECT_EQ(25001, CheckedInt({"bitop", "and", "dest", "a", "b", "c"}));
+  EXPECT_EQ(0, CheckedInt({"bitcount", "dest"}));
+  EXPECT_EQ(10013, CheckedInt({"bitop", "and", "dest", "a", "b"}));
+  EXPECT_EQ(80003, CheckedInt({"bitpos", "dest", "1"}));
+  EXPECT_EQ(25001, CheckedInt({"bitop", "or", "dest", "a", "b", "c"}));
+  EXPECT_EQ(4, CheckedInt({"bitcount", "dest"}));
+  EXPECT_EQ(25001, CheckedInt({"bitop", "xor", "dest", "a", "b", "c"}));
+  EXPECT_EQ(3, CheckedInt({"bitcount", "dest"}));
+  EXPECT_EQ(9, CheckedInt({"bitpos", "dest", "1"}));
+
+  EXPECT_EQ(25001, CheckedInt({"bitop", "not", "dest", "c"}));
+  EXPECT_EQ(25001 * 8 - 1, CheckedInt({"bitcount", "dest"}));
+  EXPECT_EQ(200000, CheckedInt({"bitpos", "dest", "0"}));
+  EXPECT_EQ(200001, CheckedInt({"bitpos", "dest", "1", "200000", "-1", "BIT"}));
+}
+
 TEST_F(BitOpsFamilyTest, BitFieldParsing) {
   const auto syntax_error = ErrArg("ERR syntax error");
   // Parsing Errors
@@ -8,10 +8,19 @@
 
 #include <boost/smart_ptr/intrusive_ptr.hpp>
 
+extern "C" {
+#include "redis/stream.h"
+}
+
+#include "base/flags.h"
 #include "base/logging.h"
 #include "server/engine_shard_set.h"
 #include "server/transaction.h"
 
+ABSL_FLAG(uint32_t, blocking_wake_batch, 32,
+          "Maximal number of transactions blocked on the same list, sorted set or stream that are "
+          "woken up together, when the key has enough elements for all of them");
+
 namespace dfly {
 
 using namespace std;
@@ -32,12 +41,12 @@ struct BlockingController::WatchQueue {
   deque<WatchItem> items;
   TxId notify_txid = UINT64_MAX;
 
-  // Updated  by both coordinator and shard threads but at different times.
-  enum State { SUSPENDED, ACTIVE } state = SUSPENDED;
+  // Number of notified transactions at the front of the queue. We keep them in the queue
+  // until they finish, to know which queues must be handled.
+  unsigned num_awakened = 0;
 
-  void Suspend() {
-    state = SUSPENDED;
-    notify_txid = UINT64_MAX;
+  bool HasSuspended() const {
+    return items.size() > num_awakened;
   }
 
   auto Find(Transaction* tx) const {
@@ -72,28 +81,21 @@ bool BlockingController::DbWatchTable::UnwatchTx(string_view key, Transaction* t
   WatchQueue* wq = wq_it->second.get();
   DCHECK(!wq->items.empty());
 
+  // tx can be is_awakened == true because of some other key and this queue would be
+  // in suspended and we still need to clean it up.
+  // The suspended item does not have to be the first one in the queue.
   bool res = false;
-  if (wq->state == WatchQueue::ACTIVE && wq->items.front().get() == tx) {
-    wq->items.pop_front();
-
-    // We suspend the queue and add keys to re-verification.
-    // If they are still present, this queue will be reactivated below.
-    wq->state = WatchQueue::SUSPENDED;
-
-    if (!wq->items.empty())
-      awakened_keys.insert(wq_it->first);  // send for further validation.
-    res = true;
-  } else {
-    // tx can be is_awakened == true because of some other key and this queue would be
-    // in suspended and we still need to clean it up.
-    // the suspended item does not have to be the first one in the queue.
-    // This shard has not been awakened and in case this transaction in the queue
-    // we must clean it up.
-    if (auto it = wq->Find(tx); it != wq->items.end()) {
-      wq->items.erase(it);
-    }
+  if (auto it = wq->Find(tx); it != wq->items.end()) {
+    res = size_t(it - wq->items.begin()) < wq->num_awakened;
+    wq->num_awakened -= res;
+    wq->items.erase(it);
   }
 
+  // The notified transaction finished, so we add the key to re-verification.
+  // If it's still present, the next transactions in the queue will be notified.
+  if (res && wq->HasSuspended())
+    awakened_keys.insert(wq_it->first);
+
   if (wq->items.empty()) {
     DVLOG(1) << "queue_map.erase";
     awakened_keys.erase(wq_it->first);
@@ -111,8 +113,8 @@ BlockingController::~BlockingController() {
 bool BlockingController::DbWatchTable::AddAwakeEvent(string_view key) {
   auto it = queue_map.find(key);
 
-  if (it == queue_map.end() || it->second->state != WatchQueue::SUSPENDED)
-    return false;  /// nobody watches this key or state does not match.
+  if (it == queue_map.end() || !it->second->HasSuspended())
+    return false;  /// nobody watches this key or all watchers are notified already.
 
   return awakened_keys.insert(it->first).second;
 }
@@ -240,39 +242,68 @@ void BlockingController::AwakeWatched(DbIndex db_index, string_view db_key) {
   }
 }
 
-// Marks the queue as active and notifies the first transaction in the queue.
+// Notifies the suspended transactions in the queue, as many as the key can serve.
 void BlockingController::NotifyWatchQueue(std::string_view key, WatchQueue* wq,
                                           const DbContext& context) {
-  DCHECK_EQ(wq->state, WatchQueue::SUSPENDED);
+  size_t capacity = WakeCapacity(key, context);
+  if (wq->num_awakened >= capacity)
+    return;
 
   auto& queue = wq->items;
   ShardId sid = owner_->shard_id();
 
   // In the most cases we shouldn't have skipped elements at all
   absl::InlinedVector<dfly::WatchItem, 4> skipped;
-  while (!queue.empty()) {
-    auto& wi = queue.front();
-    Transaction* head = wi.get();
+  while (wq->HasSuspended() && wq->num_awakened < capacity) {
+    auto it = queue.begin() + wq->num_awakened;
+    Transaction* tx = it->get();
     // We check may the transaction be notified otherwise move it to the end of the queue
-    if (wi.key_ready_checker(owner_, context, head, key)) {
-      DVLOG(2) << "WQ-Pop " << head->DebugId() << " from key " << key;
-      if (head->NotifySuspended(owner_->committed_txid(), sid, key)) {
-        wq->state = WatchQueue::ACTIVE;
+    if (it->key_ready_checker(owner_, context, tx, key)) {
+      DVLOG(2) << "WQ-Pop " << tx->DebugId() << " from key " << key;
+      if (tx->NotifySuspended(owner_->committed_txid(), sid, key)) {
         // We deliberately keep the notified transaction in the queue to know which queue
         // must handled when this transaction finished.
+        wq->num_awakened++;
         wq->notify_txid = owner_->committed_txid();
-        awakened_transactions_.insert(head);
-        break;
+        awakened_transactions_.insert(tx);
+        continue;
       }
     } else {
-      skipped.push_back(std::move(wi));
+      skipped.push_back(std::move(*it));
     }
 
-    queue.pop_front();
+    queue.erase(it);
   }
   std::move(skipped.begin(), skipped.end(), std::back_inserter(queue));
 }
 
+size_t BlockingController::WakeCapacity(std::string_view key, const DbContext& context) const {
+  size_t limit = absl::GetFlag(FLAGS_blocking_wake_batch);
+  if (limit <= 1)
+    return 1;
+
+  // Transactions blocked on lists and sorted sets consume a single element each, so as many of
+  // them can run as the key has elements. They are executed immediately after waking up, and
+  // the locks they hold keep other transactions from modifying the key in the meantime.
+  auto res = owner_->db_slice().FindReadOnly(context, key);
+  if (!IsValid(res.it))
+    return 1;
+
+  unsigned type = res.it->second.ObjType();
+
+  // Plain XREAD transactions don't consume entries, so all of them can read the new ones. Readers
+  // of consumer groups do, and can only block on streams that have groups.
+  if (type == OBJ_STREAM) {
+    const stream* s = reinterpret_cast<const stream*>(res.it->second.RObjPtr());
+    return (s->cgroups && raxSize(s->cgroups) > 0) ? 1 : limit;
+  }
+
+  if (type != OBJ_LIST && type != OBJ_ZSET)
+    return 1;
+
+  return std::clamp<size_t>(res.it->second.Size(), 1, limit);
+}
+
 size_t BlockingController::NumWatched(DbIndex db_indx) const {
   auto it = watched_dbs_.find(db_indx);
   if (it == watched_dbs_.end())
@@ -57,6 +57,9 @@ class BlockingController {
 
   void NotifyWatchQueue(std::string_view key, WatchQueue* wqm, const DbContext& context);
 
+  // Returns how many transactions blocked on the key can be notified together.
+  size_t WakeCapacity(std::string_view key, const DbContext& context) const;
+
   // void NotifyConvergence(Transaction* tx);
 
   EngineShard* owner_;
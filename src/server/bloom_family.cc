@@ -25,6 +25,7 @@ struct SbfParams {
   uint32_t init_capacity;
   double error;
   double grow_factor = kDefaultGrowFactor;
+  bool blocked = false;
 
   bool ok() const {
     return error > 0 and error < 0.5;
@@ -43,7 +44,7 @@ OpStatus OpReserve(const SbfParams& params, const OpArgs& op_args, string_view k
     return OpStatus::KEY_EXISTS;
 
   PrimeValue& pv = op_res->it->second;
-  pv.SetSBF(params.init_capacity, params.error, params.grow_factor);
+  pv.SetSBF(params.init_capacity, params.error, params.grow_factor, params.blocked);
 
   return OpStatus::OK;
 }
@@ -65,9 +66,18 @@ OpResult<AddResult> OpAdd(const OpArgs& op_args, string_view key, CmdArgList ite
   }
 
   SBF* sbf = pv.GetSBF();
+  absl::InlinedVector<string_view, 4> views(items.size());
+  for (size_t i = 0; i < items.size(); ++i) {
+    views[i] = ToSV(items[i]);
+  }
+
+  // Batched to let SBF prefetch the memory of the following items.
+  unique_ptr<bool[]> added(new bool[items.size()]);
+  sbf->Add(views, added.get());
+
   AddResult result(items.size());
   for (size_t i = 0; i < items.size(); ++i) {
-    result[i] = sbf->Add(ToSV(items[i]));
+    result[i] = added[i];
   }
   return result;
 }
@@ -80,12 +90,14 @@ OpResult<ExistsResult> OpExists(const OpArgs& op_args, string_view key, CmdArgLi
   auto it = (*op_res);
 
   const SBF* sbf = it->second.GetSBF();
-  ExistsResult result(items.size());
-
+  absl::InlinedVector<string_view, 4> views(items.size());
   for (size_t i = 0; i < items.size(); ++i) {
-    result[i] = sbf->Exists(ToSV(items[i]));
+    views[i] = ToSV(items[i]);
   }
 
+  ExistsResult result(items.size());
+  sbf->Exists(views, result.data());
+
   return result;
 }
 
@@ -98,6 +110,14 @@ void BloomFamily::Reserve(CmdArgList args, ConnectionContext* cntx) {
 
   tie(params.error, params.init_capacity) = parser.Next<double, uint32_t>();
 
+  while (parser.HasNext()) {
+    if (parser.Check("BLOCKED").IgnoreCase()) {
+      params.blocked = true;
+    } else {
+      return cntx->SendError(kSyntaxErr);
+    }
+  }
+
   if (parser.Error())
     return cntx->SendError(kSyntaxErr);
 
@@ -51,4 +51,24 @@ TEST_F(BloomFamilyTest, Multiple) {
   EXPECT_THAT(resp, RespArray(ElementsAre(IntArg(1), IntArg(1), IntArg(1))));
 }
 
+TEST_F(BloomFamilyTest, Blocked) {
+  EXPECT_EQ(Run({"bf.reserve", "b1", "0.01", "1000", "blocked"}), "OK");
+  EXPECT_THAT(Run({"bf.reserve", "b2", "0.01", "1000", "foo"}), ErrArg("syntax"));
+
+  vector<string> args = {"bf.madd", "b1"};
+  for (unsigned i = 0; i < 100; ++i) {
+    args.push_back(absl::StrCat("item", i));
+  }
+  auto resp = Run(absl::MakeSpan(args));
+  ASSERT_THAT(resp, ArrLen(100));
+  args[0] = "bf.mexists";
+  resp = Run(absl::MakeSpan(args));
+  ASSERT_THAT(resp, ArrLen(100));
+  for (const auto& val : resp.GetVec()) {
+    EXPECT_THAT(val, IntArg(1));
+  }
+  EXPECT_THAT(Run({"bf.exists", "b1", "item7"}), IntArg(1));
+  EXPECT_THAT(Run({"bf.add", "b1", "item7"}), IntArg(0));
+}
+
 }  // namespace dfly
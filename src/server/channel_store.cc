@@ -6,13 +6,10 @@
 
 #include <shared_mutex>
 
-extern "C" {
-#include "redis/util.h"
-}
-
 #include <absl/container/fixed_array.h>
 
 #include "base/logging.h"
+#include "facade/reply_builder.h"
 #include "server/engine_shard_set.h"
 #include "server/server_state.h"
 
@@ -21,34 +18,82 @@ using namespace std;
 
 namespace {
 
-bool Matches(string_view pattern, string_view channel) {
-  return stringmatchlen(pattern.data(), pattern.size(), channel.data(), channel.size(), 0) == 1;
-}
-
-// Build functor for sending messages to connection
-auto BuildSender(string_view channel, facade::ArgRange messages) {
-  absl::FixedArray<string_view, 1> views(messages.Size());
-  size_t messages_size = accumulate(messages.begin(), messages.end(), 0,
-                                    [](int sum, string_view str) { return sum + str.size(); });
-  auto buf = shared_ptr<char[]>{new char[channel.size() + messages_size]};
-  {
-    memcpy(buf.get(), channel.data(), channel.size());
-    char* ptr = buf.get() + channel.size();
+// Sends the messages of a publish to subscriber connections. The channel, the messages and
+// their push frames for every distinct pattern of the subscribers are encoded once into a
+// buffer shared by all connections.
+class PubSender {
+ public:
+  PubSender(string_view channel, facade::ArgRange messages,
+            const vector<ChannelStore::Subscriber>& subscribers, bool sharded);
+
+  // Size of the shared buffer
+  size_t Bytes() const {
+    return bytes_;
+  }
 
-    size_t i = 0;
+  void Send(facade::Connection* conn, const string& pattern,
+            const shared_ptr<void>& bytes_ref) const;
+
+ private:
+  shared_ptr<char[]> buf_;
+  size_t bytes_ = 0;
+  string_view channel_;
+  absl::FixedArray<string_view, 1> messages_;
+  absl::flat_hash_map<string, size_t> pattern_index_;  // "" for channel subscribers
+  vector<string_view> frames_;                         // pattern index * messages + message
+};
+
+PubSender::PubSender(string_view channel, facade::ArgRange messages,
+                     const vector<ChannelStore::Subscriber>& subscribers, bool sharded)
+    : messages_(messages.Size()) {
+  for (const auto& sub : subscribers)
+    pattern_index_.emplace(sub.pattern, pattern_index_.size());
+
+  // Same elements as sent by Connection::DispatchOperations for unencoded messages.
+  vector<string> frames(pattern_index_.size() * messages_.size());
+  for (const auto& [pattern, index] : pattern_index_) {
+    size_t i = index * messages_.size();
     for (string_view message : messages) {
-      memcpy(ptr, message.data(), message.size());
-      views[i++] = {ptr, message.size()};
-      ptr += message.size();
+      if (pattern.empty()) {
+        string_view elems[] = {sharded ? "smessage" : "message", channel, message};
+        frames[i++] = facade::RedisReplyBuilder::EncodePush(elems);
+      } else {
+        string_view elems[] = {"pmessage", pattern, channel, message};
+        frames[i++] = facade::RedisReplyBuilder::EncodePush(elems);
+      }
     }
   }
 
-  return [channel, buf = std::move(buf), views = std::move(views)](facade::Connection* conn,
-                                                                   string pattern) {
-    string_view channel_view{buf.get(), channel.size()};
-    for (std::string_view message_view : views)
-      conn->SendPubMessageAsync({std::move(pattern), buf, channel_view, message_view});
+  bytes_ = channel.size();
+  for (string_view message : messages)
+    bytes_ += message.size();
+  for (const string& frame : frames)
+    bytes_ += frame.size();
+
+  buf_ = shared_ptr<char[]>{new char[bytes_]};
+  char* ptr = buf_.get();
+  auto copy = [&ptr](string_view src) {
+    memcpy(ptr, src.data(), src.size());
+    ptr += src.size();
+    return string_view{ptr - src.size(), src.size()};
   };
+
+  channel_ = copy(channel);
+  size_t i = 0;
+  for (string_view message : messages)
+    messages_[i++] = copy(message);
+  frames_.reserve(frames.size());
+  for (const string& frame : frames)
+    frames_.push_back(copy(frame));
+}
+
+void PubSender::Send(facade::Connection* conn, const string& pattern,
+                     const shared_ptr<void>& bytes_ref) const {
+  auto it = pattern_index_.find(pattern);
+  DCHECK(it != pattern_index_.end());
+  const string_view* frames = frames_.data() + it->second * messages_.size();
+  for (size_t i = 0; i < messages_.size(); ++i)
+    conn->SendPubMessageAsync({pattern, buf_, channel_, messages_[i], frames[i], bytes_ref});
 }
 
 }  // namespace
@@ -101,6 +146,37 @@ void ChannelStore::ChannelMap::DeleteAll() {
     delete ptr.Get();
 }
 
+void ChannelStore::ChannelMap::BuildPatternIndex() {
+  by_prefix_.clear();
+  prefix_lengths_.clear();
+  for (const auto& slot : *this) {
+    string_view pattern = slot.first;
+    string_view prefix = pattern.substr(0, pattern.find_first_of("*?[\\"));
+    by_prefix_[prefix].push_back({GlobMatcher{pattern}, &slot});
+  }
+
+  for (const auto& [prefix, _] : by_prefix_)
+    prefix_lengths_.push_back(prefix.size());
+  sort(prefix_lengths_.begin(), prefix_lengths_.end());
+  prefix_lengths_.erase(unique(prefix_lengths_.begin(), prefix_lengths_.end()),
+                        prefix_lengths_.end());
+}
+
+void ChannelStore::ChannelMap::ForEachMatchingPattern(
+    string_view channel, absl::FunctionRef<void(const value_type&)> func) const {
+  for (size_t len : prefix_lengths_) {
+    if (len > channel.size())
+      break;
+    auto it = by_prefix_.find(channel.substr(0, len));
+    if (it == by_prefix_.end())
+      continue;
+    for (const auto& [matcher, slot] : it->second) {
+      if (matcher.Matches(channel))
+        func(*slot);
+    }
+  }
+}
+
 ChannelStore::ChannelStore() : channels_{new ChannelMap{}}, patterns_{new ChannelMap{}} {
   control_block.most_recent = this;
 }
@@ -124,7 +200,11 @@ void ChannelStore::Destroy() {
 ChannelStore::ControlBlock ChannelStore::control_block;
 
 unsigned ChannelStore::SendMessages(std::string_view channel, facade::ArgRange messages) const {
-  vector<Subscriber> subscribers = FetchSubscribers(channel);
+  return SendToSubscribers(FetchSubscribers(channel), channel, messages, false);
+}
+
+unsigned ChannelStore::SendToSubscribers(vector<Subscriber> subscribers, string_view channel,
+                                         facade::ArgRange messages, bool sharded) {
   if (subscribers.empty())
     return 0;
 
@@ -141,13 +221,19 @@ unsigned ChannelStore::SendMessages(std::string_view channel, facade::ArgRange m
       last_thread = sub.Thread();
   }
 
+  auto sender = make_shared<const PubSender>(channel, messages, subscribers, sharded);
   auto subscribers_ptr = make_shared<decltype(subscribers)>(std::move(subscribers));
-  auto cb = [subscribers_ptr, send = BuildSender(channel, messages)](unsigned idx, auto*) {
+  auto cb = [subscribers_ptr, sender](unsigned idx, auto*) {
+    // The shared buffer is accounted once per thread, as long as any of its messages is queued.
+    shared_ptr<void> bytes_ref;
     auto it = lower_bound(subscribers_ptr->begin(), subscribers_ptr->end(), idx,
                           ChannelStore::Subscriber::ByThreadId);
     while (it != subscribers_ptr->end() && it->Thread() == idx) {
-      if (auto* ptr = it->Get(); ptr)
-        send(ptr, it->pattern);
+      if (auto* ptr = it->Get(); ptr) {
+        if (!bytes_ref)
+          bytes_ref = facade::Connection::TrackSharedPubBytes(sender->Bytes());
+        sender->Send(ptr, it->pattern, bytes_ref);
+      }
       it++;
     }
   };
@@ -162,10 +248,8 @@ vector<ChannelStore::Subscriber> ChannelStore::FetchSubscribers(string_view chan
   if (auto it = channels_->find(channel); it != channels_->end())
     Fill(*it->second, string{}, &res);
 
-  for (const auto& [pat, subs] : *patterns_) {
-    if (Matches(pat, channel))
-      Fill(*subs, pat, &res);
-  }
+  patterns_->ForEachMatchingPattern(
+      channel, [&res](const auto& slot) { Fill(*slot.second, slot.first, &res); });
 
   sort(res.begin(), res.end(), Subscriber::ByThread);
   return res;
@@ -184,8 +268,9 @@ void ChannelStore::Fill(const SubscribeMap& src, const string& pattern, vector<S
 
 std::vector<string> ChannelStore::ListChannels(const string_view pattern) const {
   vector<string> res;
+  GlobMatcher matcher{pattern};
   for (const auto& [channel, _] : *channels_) {
-    if (pattern.empty() || Matches(pattern, channel))
+    if (pattern.empty() || matcher.Matches(channel))
       res.push_back(channel);
   }
   return res;
@@ -195,6 +280,42 @@ size_t ChannelStore::PatternCount() const {
   return patterns_->size();
 }
 
+void ShardChannels::Add(string_view channel, ConnectionContext* cntx, uint32_t thread_id) {
+  channels_[channel].emplace(cntx, thread_id);
+}
+
+void ShardChannels::Remove(string_view channel, ConnectionContext* cntx) {
+  if (auto it = channels_.find(channel); it != channels_.end()) {
+    it->second.erase(cntx);
+    if (it->second.empty())
+      channels_.erase(it);
+  }
+}
+
+vector<ChannelStore::Subscriber> ShardChannels::FetchSubscribers(string_view channel) const {
+  vector<ChannelStore::Subscriber> res;
+  if (auto it = channels_.find(channel); it != channels_.end())
+    ChannelStore::Fill(it->second, string{}, &res);
+
+  sort(res.begin(), res.end(), ChannelStore::Subscriber::ByThread);
+  return res;
+}
+
+size_t ShardChannels::NumSubscribers(string_view channel) const {
+  auto it = channels_.find(channel);
+  return it != channels_.end() ? it->second.size() : 0;
+}
+
+vector<string> ShardChannels::ListChannels(string_view pattern) const {
+  vector<string> res;
+  GlobMatcher matcher{pattern};
+  for (const auto& [channel, _] : channels_) {
+    if (pattern.empty() || matcher.Matches(channel))
+      res.push_back(channel);
+  }
+  return res;
+}
+
 ChannelStoreUpdater::ChannelStoreUpdater(bool pattern, bool to_add, ConnectionContext* cntx,
                                          uint32_t thread_id)
     : pattern_{pattern}, to_add_{to_add}, cntx_{cntx}, thread_id_{thread_id} {
@@ -261,6 +382,8 @@ void ChannelStoreUpdater::Apply() {
   auto [target, copied] = GetTargetMap(store);
   for (auto key : ops_)
     Modify(target, key);
+  if (copied && pattern_)
+    target->BuildPatternIndex();
 
   // Prepare replacement.
   auto* replacement = store;
@@ -5,14 +5,18 @@
 
 #include <absl/container/flat_hash_map.h>
 
+#include <absl/functional/function_ref.h>
+
 #include <string_view>
 
+#include "core/glob_matcher.h"
 #include "facade/dragonfly_connection.h"
 #include "server/conn_context.h"
 
 namespace dfly {
 
 class ChannelStoreUpdater;
+class ShardChannels;
 
 // ChannelStore manages PUB/SUB subscriptions.
 //
@@ -35,9 +39,11 @@ class ChannelStoreUpdater;
 // A centralized ChannelStore, contrary to sharded storage, avoids contention on a single shard
 // thread for heavy throughput on a single channel and thus seamlessly scales on multiple threads
 // even with a small number of channels. In general, it has a slightly lower latency, due to the
-// fact that no hop is required to fetch the subscribers.
+// fact that no hop is required to fetch the subscribers. Sharded channels (SSUBSCRIBE) are the
+// exception and are stored by the shards owning them, see ShardChannels.
 class ChannelStore {
   friend class ChannelStoreUpdater;
+  friend class ShardChannels;
 
  public:
   struct Subscriber : public facade::Connection::WeakRef {
@@ -57,6 +63,11 @@ class ChannelStore {
   // Send messages to channel, block on connection backpressure
   unsigned SendMessages(std::string_view channel, facade::ArgRange messages) const;
 
+  // Send messages to subscribers sorted by thread, block on connection backpressure.
+  // Subscribers without a pattern receive "smessage" pushes if sharded is set.
+  static unsigned SendToSubscribers(std::vector<Subscriber> subscribers, std::string_view channel,
+                                    facade::ArgRange messages, bool sharded);
+
   // Fetch all subscribers for channel, including matching patterns.
   std::vector<Subscriber> FetchSubscribers(std::string_view channel) const;
 
@@ -93,11 +104,38 @@ class ChannelStore {
 
   // SubscriberMaps for channels/patterns.
   struct ChannelMap : absl::flat_hash_map<std::string, UpdatablePointer> {
+    using Base = absl::flat_hash_map<std::string, UpdatablePointer>;
+
+    ChannelMap() = default;
+
+    // Copies only the slots, the pattern index must be rebuilt for the copy.
+    ChannelMap(const ChannelMap& other) : Base(other) {
+    }
+
     void Add(std::string_view key, ConnectionContext* me, uint32_t thread_id);
     void Remove(std::string_view key, ConnectionContext* me);
 
     // Delete all stored SubscribeMap pointers.
     void DeleteAll();
+
+    // Indexes the keys as patterns by their literal prefix, i.e. the part before the first
+    // wildcard. Must be called after slots are added or removed and before publishing the map.
+    void BuildPatternIndex();
+
+    // Calls func for all patterns matching channel. Only patterns whose literal prefix is a
+    // prefix of channel are evaluated.
+    void ForEachMatchingPattern(std::string_view channel,
+                                absl::FunctionRef<void(const value_type&)> func) const;
+
+   private:
+    struct IndexedPattern {
+      GlobMatcher matcher;
+      const value_type* slot;  // stable, as slots are not added or removed after indexing
+    };
+
+    // Literal prefix -> patterns, with the distinct prefix lengths in increasing order.
+    absl::flat_hash_map<std::string_view, std::vector<IndexedPattern>> by_prefix_;
+    std::vector<size_t> prefix_lengths_;
   };
 
   // Centralized controller to prevent overlaping updates.
@@ -118,6 +156,25 @@ class ChannelStore {
   ChannelMap* patterns_;
 };
 
+// Subscribers of the sharded channels (SSUBSCRIBE) owned by a single shard. A channel lives in
+// the shard of its key, which is the shard of its slot in cluster mode, and is accessed only from
+// the shard thread. SPUBLISH fetches its subscribers with a single hop and subscriptions don't
+// require RCU updates of the global ChannelStore.
+class ShardChannels {
+ public:
+  void Add(std::string_view channel, ConnectionContext* cntx, uint32_t thread_id);
+  void Remove(std::string_view channel, ConnectionContext* cntx);
+
+  // Fetch all subscribers for channel, sorted by thread.
+  std::vector<ChannelStore::Subscriber> FetchSubscribers(std::string_view channel) const;
+
+  size_t NumSubscribers(std::string_view channel) const;
+  std::vector<std::string> ListChannels(std::string_view pattern) const;
+
+ private:
+  absl::flat_hash_map<std::string, ChannelStore::SubscribeMap> channels_;
+};
+
 // Performs RCU (read-copy-update) updates to the channel store.
 // See ChannelStore header top for design details.
 // Queues operations and performs them with Apply().
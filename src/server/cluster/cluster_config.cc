@@ -91,8 +91,15 @@ shared_ptr<ClusterConfig> ClusterConfig::CreateFromConfig(string_view my_id,
   shared_ptr<ClusterConfig> result(new ClusterConfig());
 
   result->config_ = config;
+  result->slot_shards_.resize(SlotSet::kSlotsNumber);
+
+  for (size_t i = 0; i < result->config_.size(); ++i) {
+    const auto& shard = result->config_[i];
+    for (const auto& range : shard.slot_ranges) {
+      fill(result->slot_shards_.begin() + range.start, result->slot_shards_.begin() + range.end + 1,
+           i);
+    }
 
-  for (const auto& shard : result->config_) {
     bool owned_by_me = shard.master.id == my_id ||
                        any_of(shard.replicas.begin(), shard.replicas.end(),
                               [&](const ClusterNodeInfo& node) { return node.id == my_id; });
@@ -206,7 +213,11 @@ optional<std::vector<MigrationInfo>> ParseMigrations(const JsonType& json) {
     auto port = ReadNumeric<uint16_t>(element.at_or_null("port"));
     auto slots = GetClusterSlotRanges(element.at_or_null("slot_ranges"));
 
-    if (!node_id.is_string() || !ip.is_string() || !port || !slots) {
+    optional<uint32_t> priority = 0;
+    if (auto priority_json = element.at_or_null("priority"); !priority_json.is_null())
+      priority = ReadNumeric<uint32_t>(priority_json);
+
+    if (!node_id.is_string() || !ip.is_string() || !port || !slots || !priority) {
       LOG(WARNING) << kInvalidConfigPrefix << "invalid migration json " << json;
       return nullopt;
     }
@@ -214,7 +225,8 @@ optional<std::vector<MigrationInfo>> ParseMigrations(const JsonType& json) {
     res.emplace_back(MigrationInfo{.slot_ranges = std::move(*slots),
                                    .node_id = node_id.as_string(),
                                    .ip = ip.as_string(),
-                                   .port = *port});
+                                   .port = *port,
+                                   .priority = *priority});
   }
   return res;
 }
@@ -315,16 +327,8 @@ bool ClusterConfig::IsMySlot(std::string_view key) const {
 ClusterNodeInfo ClusterConfig::GetMasterNodeForSlot(SlotId id) const {
   CHECK_LE(id, cluster::kMaxSlotNum) << "Requesting a non-existing slot id " << id;
 
-  for (const auto& shard : config_) {
-    for (const auto& range : shard.slot_ranges) {
-      if (id >= range.start && id <= range.end) {
-        return shard.master;
-      }
-    }
-  }
-
-  DCHECK(false) << "Can't find master node for slot " << id;
-  return {};
+  // Valid configs have all slots covered, see IsConfigValid().
+  return config_[slot_shards_[id]].master;
 }
 
 ClusterShardInfos ClusterConfig::GetConfig() const {
@@ -52,15 +52,14 @@ class ClusterConfig {
   }
 
  private:
-  struct SlotEntry {
-    const ClusterShardInfo* shard = nullptr;
-    bool owned_by_me = false;
-  };
-
   ClusterConfig() = default;
 
   ClusterShardInfos config_;
 
+  // Index of the shard in config_ that serves every slot, so that MOVED replies don't scan all
+  // the slot ranges of the config.
+  std::vector<uint16_t> slot_shards_;
+
   SlotSet my_slots_;
   std::vector<MigrationInfo> my_outgoing_migrations_;
   std::vector<MigrationInfo> my_incoming_migrations_;
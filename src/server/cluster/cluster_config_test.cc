@@ -8,6 +8,7 @@
 
 #include <jsoncons/json.hpp>
 
+#include "absl/strings/str_replace.h"
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "server/test_utils.h"
@@ -538,6 +539,34 @@ TEST_F(ClusterConfigTest, ConfigSetMigrations) {
   EXPECT_TRUE(config5->GetNewOutgoingMigrations(config2).empty());
 }
 
+TEST_F(ClusterConfigTest, ConfigSetMigrationPriority) {
+  const auto* config_str = R"json(
+  [
+    {
+      "slot_ranges": [ { "start": 0, "end": 8000 } ],
+      "master": { "id": "id0", "ip": "localhost", "port": 3000 },
+      "replicas": [],
+      "migrations": [{ "slot_ranges": [ { "start": 7000, "end": 8000 } ]
+                     , "ip": "127.0.0.1", "port" : 9001, "node_id": "id1", "priority": 5 }]
+    },
+    {
+      "slot_ranges": [ { "start": 8001, "end": 16383 } ],
+      "master": { "id": "id1", "ip": "localhost", "port": 3001 },
+      "replicas": []
+    }
+  ])json";
+
+  auto config = ClusterConfig::CreateFromConfig("id0", config_str);
+  ASSERT_NE(config, nullptr);
+  auto migrations = config->GetNewOutgoingMigrations(nullptr);
+  ASSERT_EQ(migrations.size(), 1u);
+  EXPECT_EQ(migrations[0].priority, 5u);
+
+  string invalid =
+      absl::StrReplaceAll(config_str, {{"\"priority\": 5", "\"priority\": \"high\""}});
+  EXPECT_EQ(ClusterConfig::CreateFromConfig("id0", invalid), nullptr);
+}
+
 TEST_F(ClusterConfigTest, InvalidConfigMigrationsWithoutIP) {
   auto config = ClusterConfig::CreateFromConfig("id0", R"json(
   [
@@ -606,6 +635,8 @@ TEST_F(ClusterConfigTest, SlotSetAPI) {
     EXPECT_EQ(ss.GetRemovedSlots(ss1).ToSlotRanges(),
               SlotRanges({{0, 1000}, {5000, 5049}, {5051, 5089}}));
     EXPECT_EQ(ss1.GetRemovedSlots(ss).ToSlotRanges(), SlotRanges());
+    EXPECT_FALSE(ss1 == ss);
+    EXPECT_TRUE(ss1 == SlotSet(SlotRanges({{1001, 2000}})));
   }
 }
 
@@ -56,6 +56,11 @@ struct MigrationInfo {
   std::string ip;
   uint16_t port = 0;
 
+  // Migrations of lower priorities pause while ones of higher priorities stream their snapshots.
+  // Not part of the identity of the migration, so a change in the config takes effect only when
+  // the migration is started again.
+  uint32_t priority = 0;
+
   bool operator==(const MigrationInfo& r) const {
     return ip == r.ip && port == r.port && slot_ranges == r.slot_ranges && node_id == r.node_id;
   }
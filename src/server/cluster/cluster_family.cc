@@ -28,6 +28,9 @@ ABSL_FLAG(std::string, cluster_announce_ip, "", "ip that cluster commands announ
 ABSL_FLAG(std::string, cluster_node_id, "",
           "ID within a cluster, used for slot assignment. MUST be unique. If empty, uses master "
           "replication ID (random string)");
+ABSL_FLAG(uint32_t, cluster_replica_read_max_lag_ms, 0,
+          "Replicas redirect reads to the master of the slot while their replication lag is "
+          "above this bound, or while they do not stably sync. 0 disables the bound.");
 
 ABSL_DECLARE_FLAG(int32_t, port);
 
@@ -78,6 +81,18 @@ ClusterConfig* ClusterFamily::cluster_config() {
   return tl_cluster_config.get();
 }
 
+bool ClusterFamily::CanReadFromReplica(const ConnectionContext& cntx) {
+  if (cntx.cluster_readwrite)
+    return false;
+
+  uint32_t max_lag_ms = absl::GetFlag(FLAGS_cluster_replica_read_max_lag_ms);
+  if (max_lag_ms == 0)
+    return true;
+
+  // The replication fiber publishes the lag, so reads neither lock nor hop.
+  return Replica::PublishedApplyLagMs() <= max_lag_ms;
+}
+
 ClusterShardInfo ClusterFamily::GetEmulatedShardInfo(ConnectionContext* cntx) const {
   ClusterShardInfo info{.slot_ranges = {{.start = 0, .end = kMaxSlotNum}},
                         .master = {},
@@ -123,6 +138,12 @@ void ClusterFamily::ClusterHelp(ConnectionContext* cntx) {
       "   <id> <ip:port> <flags> <master> <pings> <pongs> <epoch> <link> <slot> ...",
       "INFO",
       "  Return information about the cluster",
+      "COUNTKEYSINSLOT <slot>",
+      "  Return the number of keys in <slot>.",
+      "GETKEYSINSLOT <slot> <count>",
+      "  Return key names stored by current node in a slot.",
+      "SLOT-STATS [ORDERBY KEY-COUNT|OPS-PER-SEC|BYTES-PER-SEC] [LIMIT <count>]",
+      "  Return the busiest slots of the node with their decayed load.",
       "HELP",
       "    Prints this help.",
   };
@@ -358,6 +379,165 @@ void ClusterFamily::KeySlot(CmdArgList args, ConnectionContext* cntx) {
   return cntx->SendLong(id);
 }
 
+void ClusterFamily::CountKeysInSlot(CmdArgList args, ConnectionContext* cntx) {
+  if (args.size() != 2) {
+    return cntx->SendError(WrongNumArgsError("CLUSTER COUNTKEYSINSLOT"));
+  }
+
+  CmdArgParser parser(args.subspan(1));
+  auto sid = parser.Next<uint32_t>();
+  if (auto err = parser.Error(); err)
+    return cntx->SendError(err->MakeReply());
+  if (sid > kMaxSlotNum)
+    return cntx->SendError("Invalid slot");
+  if (!IsClusterEnabled())
+    return cntx->SendError("COUNTKEYSINSLOT is not supported in emulated cluster mode");
+
+  atomic_uint64_t count = 0;
+  shard_set->RunBriefInParallel([&](EngineShard* shard) {
+    count.fetch_add(shard->db_slice().GetSlotStats(sid).key_count, memory_order_relaxed);
+  });
+  return cntx->SendLong(count.load());
+}
+
+void ClusterFamily::GetKeysInSlot(CmdArgList args, ConnectionContext* cntx) {
+  if (args.size() != 3) {
+    return cntx->SendError(WrongNumArgsError("CLUSTER GETKEYSINSLOT"));
+  }
+
+  CmdArgParser parser(args.subspan(1));
+  auto [sid, count] = parser.Next<uint32_t, uint32_t>();
+  if (auto err = parser.Error(); err)
+    return cntx->SendError(err->MakeReply());
+  if (sid > kMaxSlotNum)
+    return cntx->SendError("Invalid slot");
+  if (!IsClusterEnabled())
+    return cntx->SendError("GETKEYSINSLOT is not supported in emulated cluster mode");
+
+  fb2::Mutex mu;
+  vector<string> keys;
+
+  auto cb = [&](auto*) {
+    EngineShard* shard = EngineShard::tlocal();
+    if (shard == nullptr || shard->db_slice().GetSlotStats(sid).key_count == 0)
+      return;
+
+    // With the slot key index only the keys of the slot are visited, otherwise the whole table is
+    // traversed.
+    vector<string> shard_keys;
+    if (DbTable* table = shard->db_slice().GetDBTable(0); table->slot_keys) {
+      shard_keys = table->slot_keys->GetKeys(sid, count);
+    } else {
+      PrimeTable::Cursor cursor;
+      uint64_t i = 0;
+      string tmp;
+      do {
+        cursor = shard->db_slice().GetDBTable(0)->prime.Traverse(cursor, [&](PrimeIterator it) {
+          string_view key = it->first.GetSlice(&tmp);
+          if (shard_keys.size() < count && cluster::KeySlot(key) == sid)
+            shard_keys.emplace_back(key);
+        });
+        if (++i % 100 == 0)
+          ThisFiber::Yield();
+      } while (cursor && shard_keys.size() < count);
+    }
+
+    lock_guard lk(mu);
+    for (string& key : shard_keys) {
+      if (keys.size() < count)
+        keys.push_back(std::move(key));
+    }
+  };
+
+  shard_set->pool()->AwaitFiberOnAll(std::move(cb));
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->SendStringArr(keys);
+}
+
+void ClusterFamily::ClusterSlotStats(CmdArgList args, ConnectionContext* cntx) {
+  enum class OrderBy { KEY_COUNT, OPS, BYTES };
+
+  CmdArgParser parser(args.subspan(1));
+  OrderBy order_by = OrderBy::OPS;
+  uint32_t limit = 10;
+  while (parser.HasNext()) {
+    if (parser.Check("ORDERBY").IgnoreCase().ExpectTail(1)) {
+      order_by = parser.ToUpper().Switch("KEY-COUNT", OrderBy::KEY_COUNT, "OPS-PER-SEC",
+                                         OrderBy::OPS, "BYTES-PER-SEC", OrderBy::BYTES);
+    } else if (parser.Check("LIMIT").IgnoreCase().ExpectTail(1)) {
+      limit = parser.Next<uint32_t>();
+    } else {
+      return cntx->SendError(kSyntaxErr);
+    }
+  }
+  if (auto err = parser.Error(); err)
+    return cntx->SendError(err->MakeReply());
+  if (!IsClusterEnabled())
+    return cntx->SendError("SLOT-STATS is not supported in emulated cluster mode");
+
+  struct Entry {
+    SlotId sid;
+    uint64_t key_count = 0;
+    double ops_per_sec = 0;
+    double bytes_per_sec = 0;
+  };
+
+  vector<Entry> slots(kMaxSlotNum + 1);
+  for (SlotId sid = 0; sid <= kMaxSlotNum; ++sid)
+    slots[sid].sid = sid;
+
+  fb2::Mutex mu;
+  shard_set->RunBlockingInParallel([&](EngineShard* shard) {
+    lock_guard lk(mu);
+    for (SlotId sid = 0; sid <= kMaxSlotNum; ++sid) {
+      const SlotLoad& load = shard->db_slice().GetSlotLoad(sid);
+      slots[sid].key_count += shard->db_slice().GetSlotStats(sid).key_count;
+      slots[sid].ops_per_sec += load.ops_per_sec;
+      slots[sid].bytes_per_sec += load.bytes_per_sec;
+    }
+  });
+
+  // Commands on the keys of a slot are what costs its CPU, so the share of the operations of
+  // the node approximates the share of its CPU.
+  double total_ops = 0;
+  for (const Entry& e : slots)
+    total_ops += e.ops_per_sec;
+
+  auto metric = [order_by](const Entry& e) {
+    switch (order_by) {
+      case OrderBy::KEY_COUNT:
+        return double(e.key_count);
+      case OrderBy::OPS:
+        return e.ops_per_sec;
+      case OrderBy::BYTES:
+        return e.bytes_per_sec;
+    }
+    return 0.0;
+  };
+
+  limit = min<size_t>(limit, slots.size());
+  partial_sort(slots.begin(), slots.begin() + limit, slots.end(),
+               [&](const Entry& a, const Entry& b) { return metric(a) > metric(b); });
+  slots.resize(limit);
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartArray(slots.size());
+  for (const Entry& e : slots) {
+    rb->StartArray(2);
+    rb->SendLong(e.sid);
+    rb->StartArray(8);
+    rb->SendBulkString("key-count");
+    rb->SendLong(e.key_count);
+    rb->SendBulkString("ops-per-sec");
+    rb->SendDouble(e.ops_per_sec);
+    rb->SendBulkString("bytes-per-sec");
+    rb->SendDouble(e.bytes_per_sec);
+    rb->SendBulkString("cpu-share");
+    rb->SendDouble(total_ops > 0 ? e.ops_per_sec / total_ops : 0);
+  }
+}
+
 void ClusterFamily::Cluster(CmdArgList args, ConnectionContext* cntx) {
   // In emulated cluster mode, all slots are mapped to the same host, and number of cluster
   // instances is thus 1.
@@ -381,22 +561,30 @@ void ClusterFamily::Cluster(CmdArgList args, ConnectionContext* cntx) {
     return ClusterInfo(cntx);
   } else if (sub_cmd == "KEYSLOT") {
     return KeySlot(args, cntx);
+  } else if (sub_cmd == "COUNTKEYSINSLOT") {
+    return CountKeysInSlot(args, cntx);
+  } else if (sub_cmd == "GETKEYSINSLOT") {
+    return GetKeysInSlot(args, cntx);
+  } else if (sub_cmd == "SLOT-STATS") {
+    return ClusterSlotStats(args, cntx);
   } else {
     return cntx->SendError(facade::UnknownSubCmd(sub_cmd, "CLUSTER"), facade::kSyntaxErrType);
   }
 }
 
 void ClusterFamily::ReadOnly(CmdArgList args, ConnectionContext* cntx) {
-  if (!IsClusterEmulated()) {
+  if (!IsClusterEnabledOrEmulated()) {
     return cntx->SendError(kClusterDisabled);
   }
+  cntx->cluster_readwrite = false;
   cntx->SendOk();
 }
 
 void ClusterFamily::ReadWrite(CmdArgList args, ConnectionContext* cntx) {
-  if (!IsClusterEmulated()) {
+  if (!IsClusterEnabledOrEmulated()) {
     return cntx->SendError(kClusterDisabled);
   }
+  cntx->cluster_readwrite = true;
   cntx->SendOk();
 }
 
@@ -420,6 +608,8 @@ void ClusterFamily::DflyCluster(CmdArgList args, ConnectionContext* cntx) {
     return DflyClusterFlushSlots(args, cntx);
   } else if (sub_cmd == "SLOT-MIGRATION-STATUS") {
     return DflySlotMigrationStatus(args, cntx);
+  } else if (sub_cmd == "FORWARDED") {
+    return DflyClusterForwarded(args, cntx);
   }
 
   return cntx->SendError(UnknownSubCmd(sub_cmd, "DFLYCLUSTER"), kSyntaxErrType);
@@ -433,6 +623,14 @@ void ClusterFamily::DflyClusterMyId(CmdArgList args, ConnectionContext* cntx) {
   rb->SendBulkString(id_);
 }
 
+void ClusterFamily::DflyClusterForwarded(CmdArgList args, ConnectionContext* cntx) {
+  if (!args.empty()) {
+    return cntx->SendError(WrongNumArgsError("DFLYCLUSTER FORWARDED"));
+  }
+  cntx->cluster_forwarded = true;
+  cntx->SendOk();
+}
+
 namespace {
 // Guards set configuration, so that we won't handle 2 in parallel.
 util::fb2::Mutex set_config_mu;
@@ -499,14 +697,22 @@ void ClusterFamily::DflyClusterConfig(CmdArgList args, ConnectionContext* cntx)
   }
 
   string_view json_str = ArgS(args, 0);
-  shared_ptr<ClusterConfig> new_config = ClusterConfig::CreateFromConfig(id_, json_str);
-  if (new_config == nullptr) {
-    LOG(WARNING) << "Can't set cluster config";
-    return cntx->SendError("Invalid cluster configuration.");
-  }
 
   lock_guard gu(set_config_mu);
 
+  shared_ptr<ClusterConfig> new_config;
+  if (last_parsed_config_ && json_str == last_config_json_) {
+    new_config = last_parsed_config_;
+  } else {
+    new_config = ClusterConfig::CreateFromConfig(id_, json_str);
+    if (new_config == nullptr) {
+      LOG(WARNING) << "Can't set cluster config";
+      return cntx->SendError("Invalid cluster configuration.");
+    }
+    last_config_json_ = json_str;
+    last_parsed_config_ = new_config;
+  }
+
   VLOG(1) << "Setting new cluster config: " << json_str;
   auto out_migrations_slots = RemoveOutgoingMigrations(new_config, tl_cluster_config);
   RemoveIncomingMigrations(new_config->GetFinishedIncomingMigrations(tl_cluster_config));
@@ -539,32 +745,40 @@ void ClusterFamily::DflyClusterConfig(CmdArgList args, ConnectionContext* cntx)
   StartSlotMigrations(new_config->GetNewOutgoingMigrations(tl_cluster_config));
 
   SlotSet before = tl_cluster_config ? tl_cluster_config->GetOwnedSlots() : SlotSet(true);
+  SlotSet removed = before.GetRemovedSlots(new_config->GetOwnedSlots());
 
-  // Ignore blocked commands because we filter them with CancelBlockingOnThread
-  DispatchTracker tracker{server_family_->GetNonPriviligedListeners(), cntx->conn(),
-                          false /* ignore paused */, true /* ignore blocked */};
-
-  auto blocking_filter = [&new_config](ArgSlice keys) {
-    bool moved = any_of(keys.begin(), keys.end(), [&](auto k) { return !new_config->IsMySlot(k); });
-    return moved ? OpStatus::KEY_MOVED : OpStatus::OK;
-  };
-
-  auto cb = [this, &tracker, &new_config, blocking_filter](util::ProactorBase* pb) {
-    server_family_->CancelBlockingOnThread(blocking_filter);
-    tl_cluster_config = new_config;
-    tracker.TrackOnThread();
-  };
-
-  server_family_->service().proactor_pool().AwaitFiberOnAll(std::move(cb));
-  DCHECK(tl_cluster_config != nullptr);
-
-  if (!tracker.Wait(absl::Seconds(1))) {
-    LOG(WARNING) << "Cluster config change timed out";
+  if (removed.Empty()) {
+    // No slot moves away, so neither blocked nor running commands can touch keys we no longer
+    // own, and there is nothing to cancel or to wait for.
+    auto cb = [&new_config](unsigned, util::ProactorBase*) { tl_cluster_config = new_config; };
+    server_family_->service().proactor_pool().AwaitBrief(std::move(cb));
+  } else {
+    // Ignore blocked commands because we filter them with CancelBlockingOnThread
+    DispatchTracker tracker{server_family_->GetNonPriviligedListeners(), cntx->conn(),
+                            false /* ignore paused */, true /* ignore blocked */};
+
+    auto blocking_filter = [&new_config](ArgSlice keys) {
+      bool moved =
+          any_of(keys.begin(), keys.end(), [&](auto k) { return !new_config->IsMySlot(k); });
+      return moved ? OpStatus::KEY_MOVED : OpStatus::OK;
+    };
+
+    auto cb = [this, &tracker, &new_config, blocking_filter](util::ProactorBase* pb) {
+      server_family_->CancelBlockingOnThread(blocking_filter);
+      tl_cluster_config = new_config;
+      tracker.TrackOnThread();
+    };
+
+    server_family_->service().proactor_pool().AwaitFiberOnAll(std::move(cb));
+
+    if (!tracker.Wait(absl::Seconds(1))) {
+      LOG(WARNING) << "Cluster config change timed out";
+    }
   }
+  DCHECK(tl_cluster_config != nullptr);
 
-  SlotSet after = tl_cluster_config->GetOwnedSlots();
   if (ServerState::tlocal()->is_master) {
-    auto deleted_slots = (before.GetRemovedSlots(after)).ToSlotRanges();
+    auto deleted_slots = removed.ToSlotRanges();
     deleted_slots.insert(deleted_slots.end(), out_migrations_slots.begin(),
                          out_migrations_slots.end());
     LOG_IF(INFO, !deleted_slots.empty())
@@ -683,11 +897,12 @@ void ClusterFamily::DflySlotMigrationStatus(CmdArgList args, ConnectionContext*
   reply.reserve(incoming_migrations_jobs_.size() + outgoing_migration_jobs_.size());
 
   auto append_answer = [rb, &reply](string_view direction, string_view node_id, string_view filter,
-                                    MigrationState state, size_t keys_number, string_view error) {
+                                    MigrationState state, size_t keys_number, string_view error,
+                                    string_view progress = {}) {
     if (filter.empty() || filter == node_id) {
       error = error.empty() ? "0" : error;
       reply.push_back(absl::StrCat(direction, " ", node_id, " ", StateToStr(state),
-                                   " keys:", keys_number, " errors:", error));
+                                   " keys:", keys_number, " errors:", error, progress));
     }
   };
 
@@ -697,8 +912,17 @@ void ClusterFamily::DflySlotMigrationStatus(CmdArgList args, ConnectionContext*
                   m->GetErrorStr());
   }
   for (const auto& m : outgoing_migration_jobs_) {
+    if (!node_id.empty() && node_id != m->GetMigrationInfo().node_id)
+      continue;
+
+    // What the snapshots sent so far, as " sent:<start>-<end>=<keys>/<bytes>" for every range.
+    string progress;
+    for (const auto& range : m->GetProgress()) {
+      absl::StrAppend(&progress, " sent:", range.range.start, "-", range.range.end, "=",
+                      range.keys, "/", range.bytes);
+    }
     append_answer("out", m->GetMigrationInfo().node_id, node_id, m->GetState(), m->GetKeyCount(),
-                  m->GetErrorStr());
+                  m->GetErrorStr(), progress);
   }
 
   if (reply.empty()) {
@@ -769,8 +993,9 @@ SlotRanges ClusterFamily::RemoveOutgoingMigrations(shared_ptr<ClusterConfig> new
 
 namespace {
 // returns removed incoming migration
+// keep are the slots that are not flushed, for a migration that continues the removed one.
 bool RemoveIncomingMigrationImpl(std::vector<std::shared_ptr<IncomingSlotMigration>>& jobs,
-                                 string source_id) {
+                                 string source_id, const SlotSet& keep = SlotSet{}) {
   auto it = std::find_if(jobs.begin(), jobs.end(), [&source_id](const auto& im) {
     // we can have only one migration per target-source pair
     return source_id == im->GetSourceID();
@@ -783,7 +1008,8 @@ bool RemoveIncomingMigrationImpl(std::vector<std::shared_ptr<IncomingSlotMigrati
 
   // Flush non-owned migrations
   SlotSet migration_slots(migration->GetSlots());
-  SlotSet removed = migration_slots.GetRemovedSlots(tl_cluster_config->GetOwnedSlots());
+  SlotSet removed = migration_slots.GetRemovedSlots(tl_cluster_config->GetOwnedSlots())
+                        .GetRemovedSlots(keep);
 
   migration->Stop();
   // all fibers has migration shared_ptr so we don't need to join it and can erase
@@ -800,6 +1026,28 @@ bool RemoveIncomingMigrationImpl(std::vector<std::shared_ptr<IncomingSlotMigrati
 
   return true;
 }
+
+// Stops the migration from source_id and returns the checkpoints of its flows, or nothing if a
+// migration of slots with flows_num flows can not continue from them.
+std::vector<IncomingSlotMigration::FlowCheckpoint> StopForResume(
+    const std::vector<std::shared_ptr<IncomingSlotMigration>>& jobs, string_view source_id,
+    const SlotRanges& slots, uint32_t flows_num) {
+  auto it = std::find_if(jobs.begin(), jobs.end(),
+                         [&source_id](const auto& im) { return source_id == im->GetSourceID(); });
+  if (it == jobs.end() || (*it)->GetState() == MigrationState::C_FINISHED ||
+      !(SlotSet((*it)->GetSlots()) == SlotSet(slots))) {
+    return {};
+  }
+
+  (*it)->Stop();
+  auto checkpoints = (*it)->GetCheckpoints();
+  bool complete = checkpoints.size() == flows_num &&
+                  all_of(checkpoints.begin(), checkpoints.end(),
+                         [](const auto& checkpoint) { return checkpoint.lsn != 0; });
+  if (!complete)
+    return {};
+  return checkpoints;
+}
 }  // namespace
 
 void ClusterFamily::RemoveIncomingMigrations(const std::vector<MigrationInfo>& migrations) {
@@ -815,6 +1063,8 @@ void ClusterFamily::InitMigration(CmdArgList args, ConnectionContext* cntx) {
   CmdArgParser parser{args};
 
   auto [source_id, flows_num] = parser.Next<std::string, uint32_t>();
+  // Sent on a retry, for the target to reply with the point that the flows can continue from.
+  bool resume = parser.Check("RESUME");
 
   SlotRanges slots;
   do {
@@ -839,13 +1089,43 @@ void ClusterFamily::InitMigration(CmdArgList args, ConnectionContext* cntx) {
   VLOG(1) << "Init migration " << source_id;
 
   lock_guard lk(migration_mu_);
-  auto was_removed = RemoveIncomingMigrationImpl(incoming_migrations_jobs_, source_id);
+  std::vector<IncomingSlotMigration::FlowCheckpoint> checkpoints;
+  if (resume)
+    checkpoints = StopForResume(incoming_migrations_jobs_, source_id, slots, flows_num);
+
+  // The slots whose keys all the flows have sent are kept, the other ones are sent again.
+  SlotSet kept{slots};
+  for (const auto& checkpoint : checkpoints)
+    kept = kept.GetCommonSlots(checkpoint.done_slots);
+  if (checkpoints.empty())
+    kept = SlotSet{};
+
+  auto was_removed = RemoveIncomingMigrationImpl(incoming_migrations_jobs_, source_id, kept);
   LOG_IF(WARNING, was_removed) << "Reinit issued for migration from:" << source_id;
 
-  incoming_migrations_jobs_.emplace_back(make_shared<IncomingSlotMigration>(
-      std::move(source_id), &server_family_->service(), std::move(slots), flows_num));
+  auto migration = make_shared<IncomingSlotMigration>(
+      std::move(source_id), &server_family_->service(), std::move(slots), flows_num);
+  incoming_migrations_jobs_.emplace_back(migration);
 
-  return cntx->SendOk();
+  if (checkpoints.empty())
+    return cntx->SendOk();
+
+  SlotRanges kept_ranges = kept.ToSlotRanges();
+  LOG(INFO) << "Resuming migration from " << migration->GetSourceID() << ", kept slots "
+            << SlotRange::ToString(kept_ranges);
+
+  // Replies with the LSN of each flow, followed by the ranges of the kept slots.
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartArray(checkpoints.size() + kept_ranges.size() * 2);
+  for (auto& checkpoint : checkpoints) {
+    rb->SendLong(checkpoint.lsn);
+    checkpoint.done_slots = kept;
+  }
+  for (const SlotRange& range : kept_ranges) {
+    rb->SendLong(range.start);
+    rb->SendLong(range.end);
+  }
+  migration->SetCheckpoints(std::move(checkpoints));
 }
 
 std::shared_ptr<OutgoingMigration> ClusterFamily::CreateOutgoingMigration(MigrationInfo info) {
@@ -37,6 +37,10 @@ class ClusterFamily {
     return id_;
   }
 
+  // Whether a replica may serve a read of its replicated slots on this connection: it was not
+  // switched to READWRITE and the replication lag is within cluster_replica_read_max_lag_ms.
+  bool CanReadFromReplica(const ConnectionContext& cntx);
+
  private:
   // Cluster commands compatible with Redis
   void Cluster(CmdArgList args, ConnectionContext* cntx);
@@ -47,6 +51,9 @@ class ClusterFamily {
   void ClusterInfo(ConnectionContext* cntx);
 
   void KeySlot(CmdArgList args, ConnectionContext* cntx);
+  void CountKeysInSlot(CmdArgList args, ConnectionContext* cntx);
+  void GetKeysInSlot(CmdArgList args, ConnectionContext* cntx);
+  void ClusterSlotStats(CmdArgList args, ConnectionContext* cntx);
 
   void ReadOnly(CmdArgList args, ConnectionContext* cntx);
   void ReadWrite(CmdArgList args, ConnectionContext* cntx);
@@ -57,6 +64,7 @@ class ClusterFamily {
   void DflyClusterGetSlotInfo(CmdArgList args, ConnectionContext* cntx);
   void DflyClusterMyId(CmdArgList args, ConnectionContext* cntx);
   void DflyClusterFlushSlots(CmdArgList args, ConnectionContext* cntx);
+  void DflyClusterForwarded(CmdArgList args, ConnectionContext* cntx);
 
  private:  // Slots migration section
   void DflySlotMigrationStatus(CmdArgList args, ConnectionContext* cntx);
@@ -101,6 +109,12 @@ class ClusterFamily {
 
   std::string id_;
 
+  // The last pushed config as it was parsed, before the changes of finished migrations were
+  // applied to it. Repeated pushes of the same config skip the parsing. Accessed only under
+  // set_config_mu.
+  std::string last_config_json_;
+  std::shared_ptr<ClusterConfig> last_parsed_config_;
+
   ServerFamily* server_family_ = nullptr;
 };
 
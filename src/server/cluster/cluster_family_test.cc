@@ -525,6 +525,20 @@ TEST_F(ClusterFamilyTest, ClusterConfigDeleteSlotsNoCrashOnShutdown) {
   ConfigSingleNodeCluster("abc");
 }
 
+TEST_F(ClusterFamilyTest, ClusterConfigRepeatedPush) {
+  ConfigSingleNodeCluster(GetMyId());
+  Run({"debug", "populate", "1000"});
+
+  // Pushing the same config again keeps all keys and ownership.
+  ConfigSingleNodeCluster(GetMyId());
+  EXPECT_EQ(CheckedInt({"dbsize"}), 1000);
+  EXPECT_EQ(Run({"get", "key:0"}), "value:0");
+
+  ConfigSingleNodeCluster("abc");
+  ExpectConditionWithinTimeout([&]() { return CheckedInt({"dbsize"}) == 0; });
+  EXPECT_THAT(Run({"get", "key:0"}), ErrArg("MOVED"));
+}
+
 TEST_F(ClusterFamilyTest, ClusterConfigDeleteSomeSlots) {
   string config_template = R"json(
       [
@@ -648,6 +662,61 @@ TEST_F(ClusterFamilyTest, FlushSlots) {
                                                   _, "total_writes", _, "memory_bytes", _)))));
 }
 
+TEST_F(ClusterFamilyTest, KeysInSlot) {
+  EXPECT_EQ(Run({"debug", "populate", "100", "key", "4", "slots", "0", "1"}), "OK");
+  EXPECT_EQ(Run({"debug", "populate", "10", "other", "4", "slots", "2", "2"}), "OK");
+
+  EXPECT_THAT(Run({"cluster", "countkeysinslot", "2"}), IntArg(10));
+  EXPECT_THAT(Run({"cluster", "countkeysinslot", "3"}), IntArg(0));
+  EXPECT_THAT(Run({"cluster", "countkeysinslot", "16384"}), ErrArg("Invalid slot"));
+
+  auto resp = Run({"cluster", "getkeysinslot", "2", "100"});
+  ASSERT_THAT(resp, ArrLen(10));
+  for (const auto& key : resp.GetVec())
+    EXPECT_EQ(KeySlot(key.GetString()), 2);
+  EXPECT_THAT(Run({"cluster", "getkeysinslot", "2", "3"}), ArrLen(3));
+  EXPECT_THAT(Run({"cluster", "getkeysinslot", "3", "10"}), ArrLen(0));
+}
+
+TEST_F(ClusterFamilyTest, SlotStats) {
+  EXPECT_EQ(Run({"debug", "populate", "20", "key", "4", "slots", "5", "5"}), "OK");
+  EXPECT_EQ(Run({"debug", "populate", "10", "other", "4", "slots", "7", "7"}), "OK");
+
+  EXPECT_THAT(
+      Run({"cluster", "slot-stats", "orderby", "key-count", "limit", "2"}),
+      RespArray(ElementsAre(RespArray(ElementsAre(IntArg(5), RespArray(ElementsAre(
+                                                                 "key-count", IntArg(20), _, _, _,
+                                                                 _, "cpu-share", _)))),
+                            RespArray(ElementsAre(IntArg(7), RespArray(ElementsAre(
+                                                                 "key-count", IntArg(10), _, _, _,
+                                                                 _, "cpu-share", _)))))));
+
+  EXPECT_THAT(Run({"cluster", "slot-stats", "orderby", "cpu"}), ErrArg("syntax error"));
+  EXPECT_THAT(Run({"cluster", "slot-stats", "limit"}), ErrArg("syntax error"));
+}
+
+TEST_F(ClusterFamilyTest, SlotKeyIndex) {
+  absl::FlagSaver fs;
+  SetTestFlag("cluster_slot_key_index", "true");
+  ResetService();
+
+  EXPECT_EQ(Run({"debug", "populate", "100", "key", "4", "slots", "0", "1"}), "OK");
+  long slot0 = CheckedInt({"cluster", "countkeysinslot", "0"});
+  EXPECT_GT(slot0, 0);
+  EXPECT_THAT(Run({"cluster", "getkeysinslot", "0", "1000"}), ArrLen(slot0));
+
+  EXPECT_EQ(RunPrivileged({"dflycluster", "flushslots", "0", "0"}), "OK");
+  ExpectConditionWithinTimeout([&]() { return CheckedInt({"dbsize"}) == 100 - slot0; });
+  EXPECT_THAT(Run({"cluster", "getkeysinslot", "0", "1000"}), ArrLen(0));
+  EXPECT_THAT(Run({"cluster", "getkeysinslot", "1", "1000"}), ArrLen(100 - slot0));
+
+  // Deleted keys leave the index.
+  auto keys = Run({"cluster", "getkeysinslot", "1", "1"});
+  ASSERT_THAT(keys, ArrLen(1));
+  EXPECT_THAT(Run({"del", keys.GetVec()[0].GetString()}), IntArg(1));
+  EXPECT_THAT(Run({"cluster", "getkeysinslot", "1", "1000"}), ArrLen(100 - slot0 - 1));
+}
+
 TEST_F(ClusterFamilyTest, FlushSlotsAndImmediatelySetValue) {
   for (int count : {1, 10, 100, 1000, 10000, 100000}) {
     ConfigSingleNodeCluster(GetMyId());
@@ -691,6 +760,55 @@ TEST_F(ClusterFamilyTest, ClusterCrossSlot) {
   EXPECT_THAT(Run({"MGET", "key{tag}", "key2{tag}"}), RespArray(ElementsAre("value", "value2")));
 }
 
+TEST_F(ClusterFamilyTest, CrossSlotForwarding) {
+  string config = absl::Substitute(R"json(
+      [
+        {
+          "slot_ranges": [ { "start": 0, "end": 8000 } ],
+          "master": { "id": "$0", "ip": "10.0.0.1", "port": 7000 },
+          "replicas": []
+        },
+        {
+          "slot_ranges": [ { "start": 8001, "end": 16383 } ],
+          "master": { "id": "other", "ip": "127.0.0.1", "port": 1 },
+          "replicas": []
+        }
+      ])json",
+                                   GetMyId());
+  EXPECT_EQ(RunPrivileged({"dflycluster", "config", config}), "OK");
+
+  // "b" and "c" are local, "a" belongs to the other node.
+  EXPECT_THAT(Run({"mset", "b", "1", "c", "2"}), ErrArg("CROSSSLOT"));
+
+  absl::FlagSaver fs;
+  SetTestFlag("cluster_cross_slot_forwarding", "true");
+
+  EXPECT_EQ(Run({"mset", "b", "1", "c", "2"}), "OK");
+  EXPECT_THAT(Run({"mget", "c", "b", "f"}),
+              RespArray(ElementsAre("2", "1", ArgType(RespExpr::NIL))));
+  EXPECT_THAT(Run({"get", "a"}), ErrArg("MOVED"));
+
+  // Keys of local slots only are fine for other commands and in transactions too.
+  EXPECT_THAT(Run({"exists", "b", "c"}), IntArg(2));
+  Run({"multi"});
+  Run({"mget", "b", "c"});
+  EXPECT_THAT(Run({"exec"}), RespArray(ElementsAre("1", "2")));
+
+  // The other node is not reachable.
+  EXPECT_THAT(Run({"mget", "a", "b"}), ErrArg("Forwarding to 127.0.0.1:1"));
+  EXPECT_THAT(Run({"exists", "a", "b"}), ErrArg("CROSSSLOT"));
+  Run({"multi"});
+  EXPECT_THAT(Run({"mget", "a", "b"}), ErrArg("CROSSSLOT"));
+  Run({"discard"});
+
+  EXPECT_THAT(Run({"del", "b", "c"}), IntArg(2));
+
+  // Commands that another node forwarded are redirected rather than forwarded again.
+  EXPECT_EQ(RunPrivileged({"dflycluster", "forwarded"}), "OK");
+  EXPECT_THAT(Run({"mget", "b", "a"}), ErrArg("MOVED 15495 127.0.0.1:1"));
+  EXPECT_EQ(Run({"mset", "b", "1", "c", "2"}), "OK");
+}
+
 class ClusterFamilyEmulatedTest : public ClusterFamilyTest {
  public:
   ClusterFamilyEmulatedTest() {
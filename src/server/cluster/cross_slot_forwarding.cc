@@ -0,0 +1,267 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/cluster/cross_slot_forwarding.h"
+
+#include <absl/container/flat_hash_map.h>
+#include <absl/flags/flag.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "base/logging.h"
+#include "facade/error.h"
+#include "facade/reply_capture.h"
+#include "server/cluster/cluster_config.h"
+#include "server/command_registry.h"
+#include "server/conn_context.h"
+#include "server/main_service.h"
+#include "server/protocol_client.h"
+#include "server/transaction.h"
+
+ABSL_FLAG(bool, cluster_cross_slot_forwarding, false,
+          "If set, MGET, MSET and DEL accept keys of several slots in cluster mode. Keys of local "
+          "slots are served directly and the other ones are forwarded to the masters of their "
+          "slots, which must have this flag set too. The parts are not atomic with each other.");
+ABSL_FLAG(uint32_t, cluster_forwarding_timeout_ms, 2000,
+          "Timeout for connecting to and waiting for the nodes cross-slot commands are forwarded "
+          "to.");
+
+namespace dfly::cluster {
+
+using namespace std;
+using namespace facade;
+using namespace util;
+
+namespace {
+
+// Connection to another node of the cluster that forwarded commands are sent over.
+class ForwardingClient : private ProtocolClient {
+ public:
+  ForwardingClient(string host, uint16_t port) : ProtocolClient(std::move(host), port) {
+  }
+
+  error_code Connect() {
+    if (auto ec = ResolveHostDns(); ec)
+      return ec;
+    auto timeout = absl::GetFlag(FLAGS_cluster_forwarding_timeout_ms) * 1ms;
+    if (auto ec = ConnectAndAuth(timeout, &cntx_); ec)
+      return ec;
+
+    // The node replies MOVED to the commands of this connection instead of forwarding them again.
+    auto res = Execute({"DFLYCLUSTER", "FORWARDED"});
+    if (!res)
+      return res.error();
+    if (!CheckRespIsSimpleReply("OK"))
+      return make_error_code(errc::bad_message);
+    return {};
+  }
+
+  // Sends the command as a RESP array and reads its reply. The reply stays valid until the next
+  // call.
+  io::Result<const RespVec*> Execute(const vector<string_view>& cmd) {
+    string buf = absl::StrCat("*", cmd.size());
+    for (string_view arg : cmd)
+      absl::StrAppend(&buf, kCRLF, "$", arg.size(), kCRLF, arg);
+
+    // SendCommand terminates the last argument.
+    if (auto ec = SendCommand(buf); ec)
+      return nonstd::make_unexpected(ec);
+    auto res = ReadRespReply(absl::GetFlag(FLAGS_cluster_forwarding_timeout_ms));
+    if (!res)
+      return nonstd::make_unexpected(res.error());
+    return &LastResponseArgs();
+  }
+};
+
+// Idle connections of this thread, by the endpoint of the node.
+thread_local absl::flat_hash_map<string, vector<unique_ptr<ForwardingClient>>> tl_forwarding_pool;
+
+// The part of the command that one node serves.
+struct Part {
+  ClusterNodeInfo node;
+  vector<string_view> args;  // Starts with the command name.
+  vector<size_t> key_pos;    // Of the keys of the part in the command, in order.
+
+  // Parsed reply, either one value per key for MGET, a count for DEL or nothing for MSET.
+  vector<optional<string>> values;
+  long count = 0;
+  optional<string> error;
+};
+
+void ReplyError(Part* part, string_view error) {
+  part->error = absl::StrCat("Forwarding to ", part->node.ip, ":", part->node.port, ": ", error);
+}
+
+void ParseReply(string_view cmd, const RespVec& reply, Part* part) {
+  if (reply.size() == 1 && reply[0].type == RespExpr::ERROR)
+    return ReplyError(part, reply[0].GetView());
+
+  if (cmd == "MGET") {
+    if (reply.size() != part->key_pos.size())
+      return ReplyError(part, "unexpected reply");
+    for (const auto& value : reply) {
+      if (value.type == RespExpr::STRING)
+        part->values.emplace_back(value.GetString());
+      else
+        part->values.emplace_back();
+    }
+  } else if (cmd == "MSET") {
+    if (reply.size() != 1 || reply[0].type != RespExpr::STRING || reply[0].GetView() != "OK")
+      return ReplyError(part, "unexpected reply");
+  } else {
+    if (reply.size() != 1 || !reply[0].GetInt())
+      return ReplyError(part, "unexpected reply");
+    part->count = *reply[0].GetInt();
+  }
+}
+
+void ExecuteRemote(string_view cmd, Part* part) {
+  string endpoint = absl::StrCat(part->node.ip, ":", part->node.port);
+  auto& idle = tl_forwarding_pool[endpoint];
+
+  unique_ptr<ForwardingClient> client;
+  if (!idle.empty()) {
+    client = std::move(idle.back());
+    idle.pop_back();
+  } else {
+    client = make_unique<ForwardingClient>(part->node.ip, part->node.port);
+    if (auto ec = client->Connect(); ec)
+      return ReplyError(part, ec.message());
+  }
+
+  auto res = client->Execute(part->args);
+  if (!res) {
+    // The connection is dropped, as its state is unknown.
+    return ReplyError(part, res.error().message());
+  }
+
+  ParseReply(cmd, **res, part);
+  tl_forwarding_pool[endpoint].push_back(std::move(client));
+}
+
+void ExecuteLocal(string_view cmd, Service* service, ConnectionContext* cntx, Part* part) {
+  vector<string> storage(part->args.begin(), part->args.end());
+  vector<MutableSlice> args(storage.size());
+  for (size_t i = 0; i < storage.size(); ++i)
+    args[i] = absl::MakeSpan(storage[i]);
+
+  CapturingReplyBuilder crb;
+  SinkReplyBuilder* orig = cntx->Inject(&crb);
+  service->DispatchCommand(absl::MakeSpan(args), cntx);
+  cntx->Inject(orig);
+
+  auto reply = crb.Take();
+  if (auto err = CapturingReplyBuilder::GetError(reply); err) {
+    part->error = string(err->first);
+  } else if (auto* mget = get_if<SinkReplyBuilder::MGetResponse>(&reply); mget) {
+    for (const auto& value : mget->resp_arr) {
+      if (value)
+        part->values.emplace_back(string(value->value));
+      else
+        part->values.emplace_back();
+    }
+  } else if (auto* count = get_if<long>(&reply); count) {
+    part->count = *count;
+  }
+}
+
+}  // namespace
+
+void ShutdownCrossSlotForwarding() {
+  tl_forwarding_pool.clear();
+}
+
+bool IsCrossSlotForwardable(const CommandId* cid) {
+  return cid->name() == "MGET" || cid->name() == "MSET" || cid->name() == "DEL";
+}
+
+bool MaybeForwardCrossSlot(const CommandId* cid, CmdArgList args, const ClusterConfig* config,
+                           Service* service, ConnectionContext* cntx) {
+  if (!IsCrossSlotForwardable(cid) || !absl::GetFlag(FLAGS_cluster_cross_slot_forwarding) ||
+      config == nullptr || cntx->cluster_forwarded) {
+    return false;
+  }
+
+  OpResult<KeyIndex> key_index = DetermineKeys(cid, args);
+  if (!key_index)
+    return false;
+
+  // The local part comes first, then one part per remote node.
+  vector<Part> parts(1);
+  parts[0].args.push_back(cid->name());
+  absl::flat_hash_map<string, size_t> node_parts;
+  size_t num_keys = 0;
+
+  for (unsigned i = key_index->start; i < key_index->end; i += key_index->step, ++num_keys) {
+    string_view key = ArgS(args, i);
+    SlotId slot = KeySlot(key);
+
+    Part* part = &parts[0];
+    if (!config->IsMySlot(slot)) {
+      ClusterNodeInfo master = config->GetMasterNodeForSlot(slot);
+      auto [it, inserted] = node_parts.emplace(master.id, parts.size());
+      if (inserted) {
+        auto& remote = parts.emplace_back();
+        remote.node = std::move(master);
+        remote.args.push_back(cid->name());
+      }
+      part = &parts[it->second];
+    }
+
+    part->key_pos.push_back(num_keys);
+    for (unsigned j = i; j < i + key_index->step; ++j)
+      part->args.push_back(ArgS(args, j));
+  }
+
+  if (parts.size() == 1)
+    return false;
+
+  string_view cmd = cid->name();
+  vector<fb2::Fiber> fibers;
+  for (size_t i = 1; i < parts.size(); ++i) {
+    fibers.emplace_back("cross_slot_forward",
+                        [cmd, part = &parts[i]] { ExecuteRemote(cmd, part); });
+  }
+  if (!parts[0].key_pos.empty())
+    ExecuteLocal(cmd, service, cntx, &parts[0]);
+  for (auto& fb : fibers)
+    fb.Join();
+
+  for (const auto& part : parts) {
+    if (part.error) {
+      cntx->SendError(*part.error);
+      return true;
+    }
+  }
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  if (cmd == "MGET") {
+    vector<const optional<string>*> values(num_keys);
+    for (const auto& part : parts) {
+      DCHECK_EQ(part.values.size(), part.key_pos.size());
+      for (size_t i = 0; i < part.key_pos.size() && i < part.values.size(); ++i)
+        values[part.key_pos[i]] = &part.values[i];
+    }
+
+    rb->StartArray(num_keys);
+    for (const auto* value : values) {
+      if (value && *value)
+        rb->SendBulkString(**value);
+      else
+        rb->SendNull();
+    }
+  } else if (cmd == "MSET") {
+    rb->SendOk();
+  } else {
+    long count = 0;
+    for (const auto& part : parts)
+      count += part.count;
+    rb->SendLong(count);
+  }
+  return true;
+}
+
+}  // namespace dfly::cluster
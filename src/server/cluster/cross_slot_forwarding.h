@@ -0,0 +1,34 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include "server/common.h"
+
+namespace dfly {
+
+class CommandId;
+class ConnectionContext;
+class Service;
+
+namespace cluster {
+
+class ClusterConfig;
+
+// Whether cid may span the slots of several nodes when --cluster_cross_slot_forwarding is set.
+bool IsCrossSlotForwardable(const CommandId* cid);
+
+// Runs a MGET, MSET or DEL whose keys belong to other nodes, if forwarding is enabled, and returns
+// whether it did. The keys of the local slots are served directly, the other ones are sent to the
+// masters of their slots over pooled connections of the calling thread, and the replies are merged
+// in the order of the keys. The parts are not atomic with each other. Commands of connections
+// that other nodes forward over are not forwarded again.
+bool MaybeForwardCrossSlot(const CommandId* cid, CmdArgList args, const ClusterConfig* config,
+                           Service* service, ConnectionContext* cntx);
+
+// Closes the pooled connections of the calling thread.
+void ShutdownCrossSlotForwarding();
+
+}  // namespace cluster
+}  // namespace dfly
@@ -33,6 +33,7 @@ class ClusterShardMigration {
   }
 
   void Start(Context* cntx, util::FiberSocketBase* source, util::fb2::BlockingCounter bc) {
+    std::lock_guard run_lk(run_mu_);
     {
       std::lock_guard lk(mu_);
       socket_ = source;
@@ -63,7 +64,11 @@ class ClusterShardMigration {
         }
         bc->Add();  // the flow isn't finished so we lock it again
       }
-      if (tx_data->opcode == journal::Op::PING) {
+      if (tx_data->opcode == journal::Op::LSN) {
+        checkpoint_.lsn = tx_data->lsn;
+      } else if (tx_data->opcode == journal::Op::SLOT_DONE) {
+        checkpoint_.done_slots.Set(tx_data->slot, true);
+      } else if (tx_data->opcode == journal::Op::PING) {
         // TODO check about ping logic
       } else {
         ExecuteTxWithNoShardSync(std::move(*tx_data), cntx);
@@ -86,6 +91,16 @@ class ClusterShardMigration {
     return {};
   }
 
+  IncomingSlotMigration::FlowCheckpoint GetCheckpoint() {
+    std::lock_guard lk(run_mu_);
+    return checkpoint_;
+  }
+
+  void SetCheckpoint(IncomingSlotMigration::FlowCheckpoint checkpoint) {
+    std::lock_guard lk(run_mu_);
+    checkpoint_ = std::move(checkpoint);
+  }
+
  private:
   void ExecuteTxWithNoShardSync(TransactionData&& tx_data, Context* cntx) {
     if (cntx->IsCancelled()) {
@@ -110,6 +125,8 @@ class ClusterShardMigration {
   uint32_t source_shard_id_;
   util::fb2::Mutex mu_;
   util::FiberSocketBase* socket_ ABSL_GUARDED_BY(mu_);
+  util::fb2::Mutex run_mu_;  // Held by Start
+  IncomingSlotMigration::FlowCheckpoint checkpoint_ ABSL_GUARDED_BY(run_mu_);
   JournalExecutor executor_;
   IncomingSlotMigration* in_migration_;
 };
@@ -163,6 +180,20 @@ void IncomingSlotMigration::StartFlow(uint32_t shard, util::FiberSocketBase* sou
   VLOG(1) << "Incoming slot migration flow for shard: " << shard << " finished";
 }
 
+vector<IncomingSlotMigration::FlowCheckpoint> IncomingSlotMigration::GetCheckpoints() const {
+  DCHECK(cntx_.IsCancelled());
+  vector<FlowCheckpoint> res;
+  for (const auto& flow : shard_flows_)
+    res.push_back(flow->GetCheckpoint());
+  return res;
+}
+
+void IncomingSlotMigration::SetCheckpoints(vector<FlowCheckpoint> checkpoints) {
+  DCHECK_EQ(checkpoints.size(), shard_flows_.size());
+  for (size_t i = 0; i < checkpoints.size(); ++i)
+    shard_flows_[i]->SetCheckpoint(std::move(checkpoints[i]));
+}
+
 size_t IncomingSlotMigration::GetKeyCount() const {
   if (state_.load() == MigrationState::C_FINISHED) {
     return keys_number_;
@@ -6,6 +6,7 @@
 #include "helio/io/io.h"
 #include "helio/util/fiber_socket_base.h"
 #include "server/cluster/cluster_defs.h"
+#include "server/cluster/slot_set.h"
 #include "server/common.h"
 
 namespace dfly {
@@ -59,6 +60,20 @@ class IncomingSlotMigration {
 
   size_t GetKeyCount() const;
 
+  // Where a flow can continue from: the source journal records before lsn were applied, and all
+  // the keys of done_slots were received. lsn is 0 if the flow did not get that far.
+  struct FlowCheckpoint {
+    LSN lsn = 0;
+    SlotSet done_slots;
+  };
+
+  // Must be called after Stop, waits for the flows to exit.
+  std::vector<FlowCheckpoint> GetCheckpoints() const;
+
+  // Carries over the checkpoints of the migration that this one continues, for the case it is
+  // interrupted before the flows get new ones. Must be called before the flows start.
+  void SetCheckpoints(std::vector<FlowCheckpoint> checkpoints);
+
  private:
   std::string source_id_;
   Service& service_;
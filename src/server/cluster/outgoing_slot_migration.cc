@@ -29,8 +29,13 @@ namespace dfly::cluster {
 class OutgoingMigration::SliceSlotMigration : private ProtocolClient {
  public:
   SliceSlotMigration(DbSlice* slice, ServerContext server_context, SlotSet slots,
-                     journal::Journal* journal)
-      : ProtocolClient(server_context), streamer_(slice, std::move(slots), journal, &cntx_) {
+                     journal::Journal* journal, uint32_t priority)
+      : ProtocolClient(server_context),
+        streamer_(slice, std::move(slots), journal, &cntx_, priority) {
+  }
+
+  void SetResumePoint(LSN lsn, SlotSet done_slots) {
+    streamer_.SetResumePoint(lsn, std::move(done_slots));
   }
 
   void Sync(const std::string& node_id, uint32_t shard_id) {
@@ -73,6 +78,10 @@ class OutgoingMigration::SliceSlotMigration : private ProtocolClient {
     return cntx_.GetError();
   }
 
+  const auto& GetSlotProgress() const {
+    return streamer_.GetSlotProgress();
+  }
+
  private:
   RestoreStreamer streamer_;
 };
@@ -173,31 +182,32 @@ void OutgoingMigration::SyncFb() {
 
     VLOG(2) << "Migration initiating";
     ResetParser(false);
-    auto cmd = absl::StrCat("DFLYMIGRATE INIT ", cf_->MyID(), " ", slot_migrations_.size());
-    for (const auto& s : migration_info_.slot_ranges) {
-      absl::StrAppend(&cmd, " ", s.start, " ", s.end);
-    }
 
-    if (auto ec = SendCommandAndReadResponse(cmd); ec) {
-      VLOG(1) << "Unable to initialize migration";
-      cntx_.ReportError(GenericError(ec, "Could not send INIT command."));
-      continue;
-    }
-
-    if (!CheckRespIsSimpleReply("OK")) {
-      VLOG(2) << "Received non-OK response, retrying";
-      if (!CheckRespIsSimpleReply(kUnknownMigration)) {
-        VLOG(2) << "Target node does not recognize migration";
-        cntx_.ReportError(GenericError(std::string(ToSV(LastResponseArgs().front().GetBuf()))));
-      }
+    // A retry continues from where the flows of the previous attempt stopped, unless the target
+    // dropped their data or the journal records since then are gone.
+    optional<ResumePoint> resume_point;
+    if (slot_migrations_.front() != nullptr)
+      resume_point.emplace();
+    if (!SendInit(&resume_point))
       continue;
+    if (resume_point && !CanResume(*resume_point)) {
+      VLOG(1) << "Can not resume migration " << migration_info_.ToString();
+      resume_point.reset();
+      if (!SendInit(&resume_point))
+        continue;
     }
 
-    shard_set->pool()->AwaitFiberOnAll([this](util::ProactorBase* pb) {
+    shard_set->pool()->AwaitFiberOnAll([this, &resume_point](util::ProactorBase* pb) {
       if (auto* shard = EngineShard::tlocal(); shard) {
         server_family_->journal()->StartInThread();
-        slot_migrations_[shard->shard_id()] = std::make_unique<SliceSlotMigration>(
-            &shard->db_slice(), server(), migration_info_.slot_ranges, server_family_->journal());
+        auto& migration = slot_migrations_[shard->shard_id()];
+        migration = std::make_unique<SliceSlotMigration>(
+            &shard->db_slice(), server(), migration_info_.slot_ranges, server_family_->journal(),
+            migration_info_.priority);
+        if (resume_point) {
+          migration->SetResumePoint(resume_point->lsns[shard->shard_id()],
+                                    resume_point->done_slots);
+        }
       }
     });
 
@@ -239,6 +249,66 @@ void OutgoingMigration::SyncFb() {
   VLOG(1) << "Exiting outgoing migration fiber for migration " << migration_info_.ToString();
 }
 
+bool OutgoingMigration::SendInit(optional<ResumePoint>* resume_point) {
+  auto cmd = absl::StrCat("DFLYMIGRATE INIT ", cf_->MyID(), " ", slot_migrations_.size());
+  if (*resume_point)
+    absl::StrAppend(&cmd, " RESUME");
+  for (const auto& s : migration_info_.slot_ranges) {
+    absl::StrAppend(&cmd, " ", s.start, " ", s.end);
+  }
+
+  if (auto ec = SendCommandAndReadResponse(cmd); ec) {
+    VLOG(1) << "Unable to initialize migration";
+    cntx_.ReportError(GenericError(ec, "Could not send INIT command."));
+    return false;
+  }
+
+  if (CheckRespIsSimpleReply("OK")) {
+    resume_point->reset();
+    return true;
+  }
+
+  // The LSN of each flow, followed by the ranges of the slots that the target kept.
+  const auto& args = LastResponseArgs();
+  size_t flows = slot_migrations_.size();
+  bool is_resume_point = *resume_point && args.size() >= flows && (args.size() - flows) % 2 == 0 &&
+                         all_of(args.begin(), args.end(), [](const RespExpr& arg) {
+                           return arg.type == RespExpr::INT64;
+                         });
+  if (is_resume_point) {
+    (*resume_point)->lsns.clear();
+    for (size_t i = 0; i < flows; ++i)
+      (*resume_point)->lsns.push_back(get<int64_t>(args[i].u));
+
+    SlotRanges done_ranges;
+    for (size_t i = flows; i < args.size(); i += 2) {
+      done_ranges.push_back(SlotRange{SlotId(get<int64_t>(args[i].u)),
+                                      SlotId(get<int64_t>(args[i + 1].u))});
+    }
+    (*resume_point)->done_slots = SlotSet{done_ranges};
+    return true;
+  }
+
+  VLOG(2) << "Received non-OK response, retrying";
+  if (!CheckRespIsSimpleReply(kUnknownMigration)) {
+    VLOG(2) << "Target node does not recognize migration";
+    cntx_.ReportError(GenericError(std::string(ToSV(args.front().GetBuf()))));
+  }
+  return false;
+}
+
+bool OutgoingMigration::CanResume(const ResumePoint& resume_point) const {
+  atomic_bool res = true;
+  shard_set->pool()->AwaitFiberOnAll([&](util::ProactorBase* pb) {
+    if (auto* shard = EngineShard::tlocal(); shard) {
+      LSN lsn = resume_point.lsns[shard->shard_id()];
+      if (!RestoreStreamer::CanResumeFrom(server_family_->journal(), lsn))
+        res.store(false, memory_order_relaxed);
+    }
+  });
+  return res.load(memory_order_relaxed);
+}
+
 bool OutgoingMigration::FinalizeMigration(long attempt) {
   // if it's not the 1st attempt and flows are work correctly we try to reconnect and ACK one more
   // time
@@ -341,4 +411,30 @@ size_t OutgoingMigration::GetKeyCount() const {
   }
   return cluster::GetKeyCount(migration_info_.slot_ranges);
 }
+
+vector<OutgoingMigration::RangeProgress> OutgoingMigration::GetProgress() const {
+  vector<RangeProgress> res;
+  for (const SlotRange& range : migration_info_.slot_ranges)
+    res.push_back({.range = range});
+
+  fb2::Mutex mu;
+  shard_set->pool()->AwaitFiberOnAll([&](util::ProactorBase* pb) {
+    const auto* shard = EngineShard::tlocal();
+    if (!shard || !slot_migrations_[shard->shard_id()])
+      return;
+
+    lock_guard lk(mu);
+    for (const auto& [sid, progress] : slot_migrations_[shard->shard_id()]->GetSlotProgress()) {
+      auto it = find_if(res.begin(), res.end(), [sid = sid](const RangeProgress& p) {
+        return p.range.start <= sid && sid <= p.range.end;
+      });
+      if (it != res.end()) {
+        it->keys += progress.keys;
+        it->bytes += progress.bytes;
+      }
+    }
+  });
+  return res;
+}
+
 }  // namespace dfly::cluster
@@ -5,6 +5,7 @@
 
 #include "io/io.h"
 #include "server/cluster/cluster_defs.h"
+#include "server/cluster/slot_set.h"
 #include "server/protocol_client.h"
 
 namespace dfly {
@@ -55,6 +56,15 @@ class OutgoingMigration : private ProtocolClient {
 
   size_t GetKeyCount() const;
 
+  // Keys and bytes that the snapshots of the flows have sent, per slot range of the migration.
+  struct RangeProgress {
+    SlotRange range;
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
+  };
+
+  std::vector<RangeProgress> GetProgress() const;
+
   static constexpr long kInvalidAttempt = -1;
   static constexpr std::string_view kUnknownMigration = "UNKNOWN_MIGRATION";
 
@@ -69,6 +79,20 @@ class OutgoingMigration : private ProtocolClient {
   // SliceSlotMigration manages state and data transfering for the corresponding shard
   class SliceSlotMigration;
 
+  // Where the flows of an interrupted attempt can continue from, see
+  // RestoreStreamer::SetResumePoint.
+  struct ResumePoint {
+    std::vector<LSN> lsns;  // Per flow.
+    SlotSet done_slots;
+  };
+
+  // Sends DFLYMIGRATE INIT, returns false on failure. If resume_point is set, asks the target for
+  // the point to continue from and resets it if the target has none.
+  bool SendInit(std::optional<ResumePoint>* resume_point);
+
+  // Whether all the flows still have the journal records since the resume point.
+  bool CanResume(const ResumePoint& resume_point) const;
+
   void SyncFb();
   // return true if migration is finalized even with C_ERROR state
   bool FinalizeMigration(long attempt);
@@ -34,6 +34,11 @@ class SlotSet {
     *slots_ = *s.slots_;
   }
 
+  SlotSet& operator=(const SlotSet& s) {
+    *slots_ = *s.slots_;
+    return *this;
+  }
+
   bool Contains(SlotId slot) const {
     return slots_->test(slot);
   }
@@ -62,11 +67,20 @@ class SlotSet {
     return slots_->all();
   }
 
+  bool operator==(const SlotSet& s) const {
+    return *slots_ == *s.slots_;
+  }
+
   // Get SlotSet that are absent in the slots
   SlotSet GetRemovedSlots(const SlotSet& slots) const {
     return *slots_ & ~*slots.slots_;
   }
 
+  // Get SlotSet that are present in the slots as well
+  SlotSet GetCommonSlots(const SlotSet& slots) const {
+    return *slots_ & *slots.slots_;
+  }
+
   SlotRanges ToSlotRanges() const {
     SlotRanges res;
 
@@ -0,0 +1,196 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/cmd_profiler.h"
+
+#include <execinfo.h>
+#include <signal.h>
+#include <time.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <fstream>
+
+#include "base/logging.h"
+#include "util/fibers/synchronization.h"
+#include "util/proactor_pool.h"
+
+// Older glibc versions don't define the accessor of the thread id for SIGEV_THREAD_ID.
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+// 16K samples at 100Hz keep more than 2.5 minutes of a fully busy thread.
+constexpr uint32_t kMaxSamples = 1 << 14;
+
+struct ThreadSamples {
+  explicit ThreadSamples(bool with_stacks)
+      : cids(kMaxSamples), depth(with_stacks ? kMaxSamples : 0),
+        stacks(with_stacks ? kMaxSamples * CmdProfiler::kMaxDepth : 0) {
+  }
+
+  timer_t timer;
+  uint32_t size = 0;
+  uint64_t dropped = 0;
+
+  vector<const CommandId*> cids;
+  vector<uint8_t> depth;
+  vector<void*> stacks;
+};
+
+// Accessed from the signal handler, which runs on the same thread.
+thread_local ThreadSamples* tl_samples = nullptr;
+
+util::fb2::Mutex profile_mu;
+bool profile_running = false;
+CmdProfiler::Options profile_opts;
+
+void OnProfSignal(int, siginfo_t*, void*) {
+  ThreadSamples* samples = tl_samples;
+  if (samples == nullptr)
+    return;
+
+  if (samples->size == kMaxSamples) {
+    ++samples->dropped;
+    return;
+  }
+
+  int saved_errno = errno;
+  uint32_t index = samples->size++;
+  samples->cids[index] = CmdProfiler::current();
+  if (!samples->stacks.empty()) {
+    void** stack = samples->stacks.data() + size_t(index) * CmdProfiler::kMaxDepth;
+    // Skip the frames of the handler and of the signal trampoline.
+    void* frames[CmdProfiler::kMaxDepth + 2];
+    int depth = max(backtrace(frames, size(frames)) - 2, 0);
+    memcpy(stack, frames + 2, depth * sizeof(void*));
+    samples->depth[index] = depth;
+  }
+  errno = saved_errno;
+}
+
+void StartThread(const CmdProfiler::Options& opts) {
+  auto samples = make_unique<ThreadSamples>(opts.stacks);
+
+  sigevent sev{};
+  sev.sigev_notify = SIGEV_THREAD_ID;
+  sev.sigev_signo = SIGPROF;
+  sev.sigev_notify_thread_id = gettid();
+  if (timer_create(CLOCK_THREAD_CPUTIME_ID, &sev, &samples->timer) != 0) {
+    LOG(ERROR) << "Could not create the profiling timer: " << strerror(errno);
+    return;
+  }
+
+  tl_samples = samples.release();
+  atomic_signal_fence(memory_order_seq_cst);
+
+  long period_nsec = 1'000'000'000L / opts.hz;
+  itimerspec spec{};
+  spec.it_interval.tv_sec = spec.it_value.tv_sec = period_nsec / 1'000'000'000L;
+  spec.it_interval.tv_nsec = spec.it_value.tv_nsec = period_nsec % 1'000'000'000L;
+  timer_settime(tl_samples->timer, 0, &spec, nullptr);
+}
+
+unique_ptr<ThreadSamples> StopThread() {
+  unique_ptr<ThreadSamples> samples{tl_samples};
+  if (!samples)
+    return samples;
+
+  // A signal that is pending when the timer is deleted is delivered before timer_delete returns
+  // to user space, so the buffer is not written to anymore once it is detached.
+  timer_delete(samples->timer);
+  tl_samples = nullptr;
+  atomic_signal_fence(memory_order_seq_cst);
+  return samples;
+}
+
+void AppendWord(uintptr_t word, string* out) {
+  out->append(reinterpret_cast<const char*>(&word), sizeof(word));
+}
+
+}  // namespace
+
+thread_local const CommandId* CmdProfiler::current_ = nullptr;
+
+bool CmdProfiler::Start(const Options& opts, util::ProactorPool* pool) {
+  DCHECK_GT(opts.hz, 0u);
+
+  lock_guard lk(profile_mu);
+  if (profile_running)
+    return false;
+
+  // The first call of backtrace loads the unwinder, which is not safe inside of a signal handler.
+  void* frame;
+  backtrace(&frame, 1);
+
+  struct sigaction sa {};
+  sa.sa_sigaction = OnProfSignal;
+  sa.sa_flags = SA_SIGINFO | SA_RESTART;
+  sigemptyset(&sa.sa_mask);
+  CHECK_EQ(0, sigaction(SIGPROF, &sa, nullptr));
+
+  profile_running = true;
+  profile_opts = opts;
+  pool->AwaitBrief([&opts](unsigned, util::ProactorBase*) { StartThread(opts); });
+  return true;
+}
+
+optional<CmdProfiler::Result> CmdProfiler::Stop(util::ProactorPool* pool) {
+  lock_guard lk(profile_mu);
+  if (!profile_running)
+    return nullopt;
+
+  vector<unique_ptr<ThreadSamples>> threads(pool->size());
+  pool->AwaitBrief(
+      [&threads](unsigned index, util::ProactorBase*) { threads[index] = StopThread(); });
+  profile_running = false;
+
+  Result result;
+  result.period_usec = 1'000'000 / profile_opts.hz;
+  for (const auto& samples : threads) {
+    if (!samples)
+      continue;
+
+    result.dropped += samples->dropped;
+    for (uint32_t i = 0; i < samples->size; ++i) {
+      ++result.commands[samples->cids[i]];
+      if (!samples->stacks.empty()) {
+        void** stack = samples->stacks.data() + size_t(i) * kMaxDepth;
+        ++result.stacks[vector<void*>(stack, stack + samples->depth[i])];
+      }
+    }
+  }
+  return result;
+}
+
+string CmdProfiler::ToPprof(const Result& result) {
+  // Header: header count, header words, format version, sampling period and padding.
+  string out;
+  for (uintptr_t word : {0ul, 3ul, 0ul, uintptr_t(result.period_usec), 0ul})
+    AppendWord(word, &out);
+
+  for (const auto& [stack, count] : result.stacks) {
+    AppendWord(count, &out);
+    AppendWord(stack.size(), &out);
+    for (void* pc : stack)
+      AppendWord(reinterpret_cast<uintptr_t>(pc), &out);
+  }
+
+  // Trailer followed by the memory mappings that pprof needs to symbolize the addresses.
+  for (uintptr_t word : {0ul, 1ul, 0ul})
+    AppendWord(word, &out);
+
+  ifstream maps("/proc/self/maps");
+  out.append(istreambuf_iterator<char>(maps), istreambuf_iterator<char>());
+  return out;
+}
+
+}  // namespace dfly
@@ -0,0 +1,71 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace util {
+class ProactorPool;
+}  // namespace util
+
+namespace dfly {
+
+class CommandId;
+
+// Sampling profiler that attributes the CPU time of the proactor threads to commands.
+// Every thread arms a timer on its own CPU clock that delivers SIGPROF to it, and the handler
+// records the command marked as running on the thread, and optionally the call stack, into a
+// preallocated thread local buffer. Marking a command costs a single thread local store, so the
+// marks are always on and only the timers are armed on demand.
+class CmdProfiler {
+ public:
+  static constexpr unsigned kMaxDepth = 24;
+
+  struct Options {
+    unsigned hz = 100;
+    bool stacks = false;
+  };
+
+  struct Result {
+    unsigned period_usec = 0;
+    uint64_t dropped = 0;
+
+    // Samples per command, nullptr for samples taken outside of any command.
+    absl::flat_hash_map<const CommandId*, uint64_t> commands;
+
+    // Sample count per distinct call stack, only if Options::stacks was set.
+    absl::flat_hash_map<std::vector<void*>, uint64_t> stacks;
+  };
+
+  // Marks the command running on the calling thread. Commands may block and let other fibers run
+  // on the thread, so the invocation of a command overrides the mark and clears it when it
+  // finishes, while callbacks that run to completion restore the previous mark.
+  static void SetCurrent(const CommandId* cid) {
+    current_ = cid;
+  }
+
+  static const CommandId* current() {
+    return current_;
+  }
+
+  // Starts profiling all threads of the pool, false if a profile is already running.
+  static bool Start(const Options& opts, util::ProactorPool* pool);
+
+  // Stops profiling and collects the samples of all threads, nullopt if no profile is running.
+  static std::optional<Result> Stop(util::ProactorPool* pool);
+
+  // Serializes the stacks of the result in the legacy gperftools CPU profile format, which is
+  // understood by pprof.
+  static std::string ToPprof(const Result& result);
+
+ private:
+  static thread_local const CommandId* current_;
+};
+
+}  // namespace dfly
@@ -16,6 +16,7 @@
 #include "facade/dragonfly_connection.h"
 #include "facade/error.h"
 #include "server/acl/acl_commands_def.h"
+#include "server/cmd_profiler.h"
 #include "server/server_state.h"
 
 using namespace std;
@@ -42,6 +43,50 @@ CommandId::CommandId(const char* name, uint32_t mask, int8_t arity, int8_t first
     opt_mask_ |= CO::NOSCRIPT;
 }
 
+void CmdLatencyHistogram::Add(uint64_t usec) {
+  unsigned bucket = usec ? 64 - __builtin_clzll(usec) : 0;
+  ++buckets[min(bucket, kNumBuckets - 1)];
+}
+
+CmdLatencyHistogram& CmdLatencyHistogram::operator+=(const CmdLatencyHistogram& o) {
+  for (unsigned i = 0; i < kNumBuckets; ++i)
+    buckets[i] += o.buckets[i];
+  return *this;
+}
+
+const char* TxPhaseStats::PhaseName(unsigned phase) {
+  switch (phase) {
+    case SCHEDULE:
+      return "schedule";
+    case QUEUE:
+      return "queue";
+    case EXEC:
+      return "exec";
+    case REPLY:
+      return "reply";
+  }
+  return "unknown";
+}
+
+void TxPhaseStats::Add(const uint64_t (&usec)[kNumPhases]) {
+  ++count;
+  for (unsigned i = 0; i < kNumPhases; ++i) {
+    sum_usec[i] += usec[i];
+    unsigned bucket = usec[i] ? 64 - __builtin_clzll(usec[i]) : 0;
+    ++buckets[i][min(bucket, kNumBuckets - 1)];
+  }
+}
+
+TxPhaseStats& TxPhaseStats::operator+=(const TxPhaseStats& o) {
+  count += o.count;
+  for (unsigned i = 0; i < kNumPhases; ++i) {
+    sum_usec[i] += o.sum_usec[i];
+    for (unsigned j = 0; j < kNumBuckets; ++j)
+      buckets[i][j] += o.buckets[i][j];
+  }
+  return *this;
+}
+
 bool CommandId::IsTransactional() const {
   if (first_key_ > 0 || (opt_mask_ & CO::GLOBAL_TRANS) || (opt_mask_ & CO::NO_KEY_TRANSACTIONAL))
     return true;
@@ -58,7 +103,9 @@ bool CommandId::IsMultiTransactional() const {
 
 uint64_t CommandId::Invoke(CmdArgList args, ConnectionContext* cntx) const {
   int64_t before = absl::GetCurrentTimeNanos();
+  CmdProfiler::SetCurrent(this);
   handler_(args, cntx);
+  CmdProfiler::SetCurrent(nullptr);
   int64_t after = absl::GetCurrentTimeNanos();
 
   ServerState* ss = ServerState::tlocal();  // Might have migrated thread, read after invocation
@@ -69,9 +116,22 @@ uint64_t CommandId::Invoke(CmdArgList args, ConnectionContext* cntx) const {
   ++ent.first;
   ent.second += execution_time_usec;
 
+  auto& latency = latency_stats_[ss->thread_index()];
+  if (!latency)
+    latency = make_unique<CmdLatencyHistogram>();
+  latency->Add(execution_time_usec);
+
   return execution_time_usec;
 }
 
+void CommandId::RecordPhases(unsigned thread_index,
+                             const uint64_t (&usec)[TxPhaseStats::kNumPhases]) const {
+  auto& stats = phase_stats_[thread_index];
+  if (!stats)
+    stats = make_unique<TxPhaseStats>();
+  stats->Add(usec);
+}
+
 optional<facade::ErrorReply> CommandId::Validate(CmdArgList tail_args) const {
   if ((arity() > 0 && tail_args.size() + 1 != size_t(arity())) ||
       (arity() < 0 && tail_args.size() + 1 < size_t(-arity()))) {
@@ -80,7 +140,7 @@ optional<facade::ErrorReply> CommandId::Validate(CmdArgList tail_args) const {
 
   if ((opt_mask() & CO::INTERLEAVED_KEYS)) {
     if ((name() == "JSON.MSET" && tail_args.size() % 3 != 0) ||
-        (name() == "MSET" && tail_args.size() % 2 != 0))
+        ((name() == "MSET" || name() == "MINCRBY") && tail_args.size() % 2 != 0))
       return facade::ErrorReply{facade::WrongNumArgsError(name()), kSyntaxErrType};
   }
 
@@ -68,6 +68,42 @@ static_assert(!IsEvalKind(""));
 // Per thread vector of command stats. Each entry is {cmd_calls, cmd_latency_agg in usec}.
 using CmdCallStats = std::pair<uint64_t, uint64_t>;
 
+// Latency histogram of the invocations of a command.
+struct CmdLatencyHistogram {
+  // Bucket i counts latencies below 2^i usec, the last bucket counts all the rest.
+  static constexpr unsigned kNumBuckets = 24;
+
+  void Add(uint64_t usec);
+
+  CmdLatencyHistogram& operator+=(const CmdLatencyHistogram& o);
+
+  uint64_t buckets[kNumBuckets] = {};
+};
+
+// Latency histograms of the transaction phases of a command.
+struct TxPhaseStats {
+  enum Phase : uint8_t {
+    SCHEDULE,  // scheduling on the shards
+    QUEUE,     // waiting in the shard queues, including waits for contended locks
+    EXEC,      // running the callbacks on the shards
+    REPLY,     // the rest of the invocation, mostly parsing and reply serialization
+    kNumPhases
+  };
+
+  // Bucket i counts latencies below 2^i usec, the last bucket counts all the rest.
+  static constexpr unsigned kNumBuckets = 16;
+
+  static const char* PhaseName(unsigned phase);
+
+  void Add(const uint64_t (&usec)[kNumPhases]);
+
+  TxPhaseStats& operator+=(const TxPhaseStats& o);
+
+  uint64_t count = 0;
+  uint64_t sum_usec[kNumPhases] = {};
+  uint64_t buckets[kNumPhases][kNumBuckets] = {};
+};
+
 class CommandId : public facade::CommandId {
  public:
   // NOTICE: name must be a literal string, otherwise metrics break! (see cmd_stats_map in
@@ -79,6 +115,8 @@ class CommandId : public facade::CommandId {
 
   void Init(unsigned thread_count) {
     command_stats_ = std::make_unique<CmdCallStats[]>(thread_count);
+    phase_stats_ = std::make_unique<std::unique_ptr<TxPhaseStats>[]>(thread_count);
+    latency_stats_ = std::make_unique<std::unique_ptr<CmdLatencyHistogram>[]>(thread_count);
   }
 
   using Handler =
@@ -129,14 +167,33 @@ class CommandId : public facade::CommandId {
 
   void ResetStats(unsigned thread_index) {
     command_stats_[thread_index] = {0, 0};
+    phase_stats_[thread_index].reset();
+    latency_stats_[thread_index].reset();
   }
 
   CmdCallStats GetStats(unsigned thread_index) const {
     return command_stats_[thread_index];
   }
 
+  // Records the transaction phase latencies of an invocation.
+  void RecordPhases(unsigned thread_index,
+                    const uint64_t (&usec)[TxPhaseStats::kNumPhases]) const;
+
+  // Returns null if the command did not record any phases on this thread.
+  const TxPhaseStats* GetPhaseStats(unsigned thread_index) const {
+    return phase_stats_[thread_index].get();
+  }
+
+  // Returns null if the command was not invoked on this thread.
+  const CmdLatencyHistogram* GetLatencyStats(unsigned thread_index) const {
+    return latency_stats_[thread_index].get();
+  }
+
  private:
   std::unique_ptr<CmdCallStats[]> command_stats_;
+  // Allocated on first use, most commands are never called on most threads.
+  std::unique_ptr<std::unique_ptr<TxPhaseStats>[]> phase_stats_;
+  std::unique_ptr<std::unique_ptr<CmdLatencyHistogram>[]> latency_stats_;
   Handler handler_;
   ArgValidator validator_;
 };
@@ -183,6 +240,23 @@ class CommandRegistry {
     }
   }
 
+  void MergePhaseStats(unsigned thread_index,
+                       std::function<void(std::string_view, const TxPhaseStats&)> cb) const {
+    for (const auto& k_v : cmd_map_) {
+      if (const TxPhaseStats* src = k_v.second.GetPhaseStats(thread_index); src)
+        cb(k_v.second.name(), *src);
+    }
+  }
+
+  void MergeLatencyStats(
+      unsigned thread_index,
+      std::function<void(std::string_view, const CmdLatencyHistogram&)> cb) const {
+    for (const auto& k_v : cmd_map_) {
+      if (const CmdLatencyHistogram* src = k_v.second.GetLatencyStats(thread_index); src)
+        cb(k_v.second.name(), *src);
+    }
+  }
+
   void StartFamily();
 
   std::string_view RenamedOrOriginal(std::string_view orig) const;
@@ -46,6 +46,10 @@ ABSL_FLAG(unsigned, locktag_skip_n_end_delimiters, 0,
 ABSL_FLAG(std::string, locktag_prefix, "",
           "Only keys with this prefix participate in tag extraction.");
 
+ABSL_FLAG(dfly::MemoryBytesFlag, sync_bandwidth_limit, dfly::MemoryBytesFlag{},
+          "If positive, limits the bytes per second that the full syncs of all replicas and the "
+          "slot migrations send together. Can be changed at runtime with CONFIG SET.");
+
 namespace dfly {
 
 using namespace std;
@@ -258,19 +262,36 @@ bool ParseDouble(string_view src, double* value) {
 #define ADD(x) (x) += o.x
 
 TieredStats& TieredStats::operator+=(const TieredStats& o) {
-  static_assert(sizeof(TieredStats) == 96);
+  static_assert(sizeof(TieredStats) == 760);
 
   ADD(total_stashes);
   ADD(total_fetches);
   ADD(total_cancels);
   ADD(total_deletes);
   ADD(total_defrags);
+  ADD(total_hot_skips);
+  ADD(total_uncached_reads);
+  ADD(total_range_reads);
+  ADD(total_compactions);
+  ADD(total_compressed_stashes);
+  ADD(compression_saved_bytes);
 
   ADD(allocated_bytes);
   ADD(capacity_bytes);
 
   ADD(pending_read_cnt);
   ADD(pending_stash_cnt);
+  ADD(pending_io_cnt);
+
+  ADD(small_page_bytes);
+  ADD(small_page_allocated_bytes);
+  ADD(medium_page_bytes);
+  ADD(medium_page_allocated_bytes);
+
+  ADD(read_usec);
+  ADD(stash_usec);
+  ADD(queue_wait_usec);
+  ADD(pending_io_depth);
 
   ADD(small_bins_cnt);
   ADD(small_bins_entries_cnt);
@@ -280,9 +301,11 @@ TieredStats& TieredStats::operator+=(const TieredStats& o) {
 }
 
 SearchStats& SearchStats::operator+=(const SearchStats& o) {
-  static_assert(sizeof(SearchStats) == 24);
+  static_assert(sizeof(SearchStats) == 40);
   ADD(used_memory);
   ADD(num_entries);
+  ADD(cache_hits);
+  ADD(cache_misses);
 
   DCHECK(num_indices == 0 || num_indices == o.num_indices);
   num_indices = std::max(num_indices, o.num_indices);
@@ -310,9 +333,9 @@ OpResult<ScanOpts> ScanOpts::TryFrom(CmdArgList args) {
       else if (scan_opts.limit > 4096)
         scan_opts.limit = 4096;
     } else if (opt == "MATCH") {
-      scan_opts.pattern = ArgS(args, i + 1);
-      if (scan_opts.pattern == "*")
-        scan_opts.pattern = string_view{};
+      string_view pattern = ArgS(args, i + 1);
+      if (pattern != "*")
+        scan_opts.matcher.emplace(pattern);
     } else if (opt == "TYPE") {
       ToLower(&args[i + 1]);
       scan_opts.type_filter = ArgS(args, i + 1);
@@ -328,9 +351,7 @@ OpResult<ScanOpts> ScanOpts::TryFrom(CmdArgList args) {
 }
 
 bool ScanOpts::Matches(std::string_view val_name) const {
-  if (pattern.empty())
-    return true;
-  return stringmatchlen(pattern.data(), pattern.size(), val_name.data(), val_name.size(), 0) == 1;
+  return !matcher || matcher->Matches(val_name);
 }
 
 GenericError::operator std::error_code() const {
@@ -435,6 +456,50 @@ std::string AbslUnparseFlag(const dfly::MemoryBytesFlag& flag) {
   return strings::HumanReadableNumBytes(flag.value);
 }
 
+namespace {
+
+// The time at which all the bytes consumed so far are sent at the limited rate.
+atomic_uint64_t sync_bandwidth_tat_ns{0};
+
+// After an idle period, up to this much time worth of bytes pass without a pause.
+constexpr uint64_t kSyncBandwidthBurstNs = 100'000'000;
+
+}  // namespace
+
+chrono::nanoseconds SyncBandwidthLimiter::Consume(size_t bytes) {
+  uint64_t limit = absl::GetFlag(FLAGS_sync_bandwidth_limit).value;
+  if (limit == 0 || bytes == 0)
+    return chrono::nanoseconds{0};
+
+  uint64_t now = chrono::duration_cast<chrono::nanoseconds>(
+                     chrono::steady_clock::now().time_since_epoch())
+                     .count();
+  uint64_t cost = static_cast<uint64_t>(double(bytes) * 1e9 / limit);
+  uint64_t tat = sync_bandwidth_tat_ns.load(memory_order_relaxed), next;
+  do {
+    next = max(tat, now) + cost;
+  } while (!sync_bandwidth_tat_ns.compare_exchange_weak(tat, next, memory_order_relaxed));
+
+  if (next <= now + kSyncBandwidthBurstNs)
+    return chrono::nanoseconds{0};
+  return chrono::nanoseconds{next - now - kSyncBandwidthBurstNs};
+}
+
+uint64_t SyncBandwidthLimiter::Throttle(size_t bytes, const Cancellation* cll) {
+  chrono::nanoseconds pause = Consume(bytes);
+  if (pause.count() == 0)
+    return 0;
+
+  // Sleeps in steps to notice cancellations.
+  constexpr chrono::nanoseconds kStep = 10ms;
+  auto start = chrono::steady_clock::now();
+  auto deadline = start + pause;
+  for (auto now = start; now < deadline && !cll->IsCancelled(); now = chrono::steady_clock::now())
+    ThisFiber::SleepFor(min<chrono::nanoseconds>(deadline - now, kStep));
+
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+}
+
 std::ostream& operator<<(std::ostream& os, const GlobalState& state) {
   return os << GlobalStateName(state);
 }
@@ -10,13 +10,17 @@
 #include <absl/types/span.h>
 
 #include <atomic>
+#include <chrono>
 #include <cstddef>
 #include <cstdint>
+#include <optional>
 #include <string_view>
 #include <vector>
 
+#include "core/glob_matcher.h"
 #include "facade/facade_types.h"
 #include "facade/op_status.h"
+#include "server/tiering/common.h"
 #include "util/fibers/fibers.h"
 #include "util/fibers/synchronization.h"
 
@@ -66,12 +70,30 @@ struct TieredStats {
   size_t total_cancels = 0;
   size_t total_deletes = 0;
   size_t total_defrags = 0;
+  size_t total_hot_skips = 0;       // offload candidates skipped as accessed since the last pass
+  size_t total_uncached_reads = 0;  // reads served from disk without loading the value to memory
+  size_t total_range_reads = 0;     // reads of only the pages covering a range of a value
+  size_t total_compactions = 0;     // values moved out of sparsely used pages
+  size_t total_compressed_stashes = 0;
+  size_t compression_saved_bytes = 0;  // by offloaded values that are stored compressed
 
   size_t allocated_bytes = 0;
   size_t capacity_bytes = 0;
 
   size_t pending_read_cnt = 0;
   size_t pending_stash_cnt = 0;
+  size_t pending_io_cnt = 0;  // disk reads and writes in flight
+
+  // Bytes of pages in use and of allocated blocks by page class of the allocator
+  size_t small_page_bytes = 0;
+  size_t small_page_allocated_bytes = 0;
+  size_t medium_page_bytes = 0;
+  size_t medium_page_allocated_bytes = 0;
+
+  tiering::Log2Histogram read_usec;
+  tiering::Log2Histogram stash_usec;
+  tiering::Log2Histogram queue_wait_usec;   // of reads before they are submitted
+  tiering::Log2Histogram pending_io_depth;  // sampled when a disk operation is issued
 
   size_t small_bins_cnt = 0;
   size_t small_bins_entries_cnt = 0;
@@ -84,6 +106,8 @@ struct SearchStats {
   size_t used_memory = 0;
   size_t num_indices = 0;
   size_t num_entries = 0;
+  size_t cache_hits = 0;
+  size_t cache_misses = 0;
 
   SearchStats& operator+=(const SearchStats&);
 };
@@ -288,7 +312,7 @@ class Context : protected Cancellation {
 };
 
 struct ScanOpts {
-  std::string_view pattern;
+  std::optional<GlobMatcher> matcher;  // MATCH pattern, compiled once per command
   size_t limit = 10;
   std::string_view type_filter;
   unsigned bucket_id = UINT_MAX;
@@ -304,6 +328,11 @@ inline uint32_t MemberTimeSeconds(uint64_t now_ms) {
   return (now_ms / 1000) - kMemberExpiryBase;
 }
 
+// Inverse of MemberTimeSeconds.
+inline uint64_t MemberTimeMs(uint32_t member_time) {
+  return (member_time + kMemberExpiryBase) * 1000;
+}
+
 struct MemoryBytesFlag {
   uint64_t value = 0;
 };
@@ -311,6 +340,20 @@ struct MemoryBytesFlag {
 bool AbslParseFlag(std::string_view in, dfly::MemoryBytesFlag* flag, std::string* err);
 std::string AbslUnparseFlag(const dfly::MemoryBytesFlag& flag);
 
+// Token bucket shared by all threads that limits the bandwidth of full syncs and slot migrations
+// to sync_bandwidth_limit bytes per second. The producers account for the bytes they serialized
+// and pause, so that the stream is throttled at its source instead of buffering in memory.
+class SyncBandwidthLimiter {
+ public:
+  // Accounts for the bytes and returns how long the caller should pause before producing more.
+  // Always zero if the bandwidth is unlimited.
+  static std::chrono::nanoseconds Consume(size_t bytes);
+
+  // Consumes and sleeps for the returned pause, which is interrupted if cll is cancelled.
+  // Returns the time slept in nanoseconds.
+  static uint64_t Throttle(size_t bytes, const Cancellation* cll);
+};
+
 using RandomPick = std::uint32_t;
 
 class PicksGenerator {
@@ -8,6 +8,7 @@
 #include "core/heap_size.h"
 #include "facade/acl_commands_def.h"
 #include "server/acl/acl_commands_def.h"
+#include "server/channel_store.h"
 #include "server/command_registry.h"
 #include "server/engine_shard_set.h"
 #include "server/server_family.h"
@@ -20,6 +21,48 @@ namespace dfly {
 using namespace std;
 using namespace facade;
 
+optional<ShardId> ShardAffinity::Record(ShardId sid, ShardId current, double min_share) {
+  if (sid != kInvalidSid) {
+    if (counts_.size() <= sid)
+      counts_.resize(sid + 1, 0);
+    counts_[sid]++;
+  }
+
+  if (++commands_ < kWindow)
+    return nullopt;
+
+  ShardId top = kInvalidSid;
+  uint32_t top_count = 0;
+  for (ShardId i = 0; i < counts_.size(); ++i) {
+    if (counts_[i] > top_count) {
+      top = i;
+      top_count = counts_[i];
+    }
+  }
+  bool dominant = top_count >= min_share * commands_;
+  fill(counts_.begin(), counts_.end(), 0);
+  commands_ = 0;
+
+  if (cooldown_windows_ > 0) {
+    --cooldown_windows_;
+    return nullopt;
+  }
+
+  if (!dominant || top == current) {
+    stable_windows_ = 0;
+    return nullopt;
+  }
+
+  stable_windows_ = top == candidate_ ? stable_windows_ + 1 : 1;
+  candidate_ = top;
+  if (stable_windows_ < kStableWindows)
+    return nullopt;
+
+  stable_windows_ = 0;
+  cooldown_windows_ = kCooldownWindows;
+  return top;
+}
+
 StoredCmd::StoredCmd(const CommandId* cid, CmdArgList args, facade::ReplyMode mode)
     : cid_{cid}, buffer_{}, sizes_(args.size()), reply_mode_{mode} {
   size_t total_size = 0;
@@ -133,6 +176,17 @@ void ConnectionContext::ChangeMonitor(bool start) {
   EnableMonitoring(start);
 }
 
+void ConnectionContext::ChangeBcastTracking(bool start) {
+  auto& my_repo = ServerState::tlocal()->BcastTracking();
+  if (start)
+    my_repo.Add(conn(), conn_state.tracking_info_.prefixes());
+  else
+    my_repo.Remove(conn(), conn_state.tracking_info_.prefixes());
+
+  shard_set->pool()->AwaitBrief(
+      [start](unsigned, auto*) { ServerState::tlocal()->BcastTracking().NotifyChangeCount(start); });
+}
+
 vector<unsigned> ChangeSubscriptions(bool pattern, CmdArgList args, bool to_add, bool to_reply,
                                      ConnectionContext* conn) {
   vector<unsigned> result(to_reply ? args.size() : 0, 0);
@@ -181,6 +235,60 @@ vector<unsigned> ChangeSubscriptions(bool pattern, CmdArgList args, bool to_add,
   return result;
 }
 
+// Sharded channels are registered in the shards owning them, with one hop per shard.
+vector<unsigned> ChangeShardSubscriptions(CmdArgList args, bool to_add, bool to_reply,
+                                          ConnectionContext* conn) {
+  vector<unsigned> result(to_reply ? args.size() : 0, 0);
+
+  auto& conn_state = conn->conn_state;
+  if (!to_add && !conn_state.subscribe_info)
+    return result;
+
+  if (!conn_state.subscribe_info) {
+    conn_state.subscribe_info.reset(new ConnectionState::SubscribeInfo);
+    conn->subscriptions++;
+  }
+
+  auto& sinfo = *conn_state.subscribe_info.get();
+
+  int32_t tid = util::ProactorBase::me()->GetPoolIndex();
+  DCHECK_GE(tid, 0);
+
+  vector<vector<string_view>> ops(shard_set->size());
+  size_t i = 0;
+  for (string_view channel : ArgS(args)) {
+    if (to_add ? sinfo.shard_channels.emplace(channel).second
+               : sinfo.shard_channels.erase(channel) > 0)
+      ops[Shard(channel, ops.size())].push_back(channel);
+
+    if (to_reply)
+      result[i++] = sinfo.shard_channels.size();
+  }
+
+  for (ShardId sid = 0; sid < ops.size(); ++sid) {
+    if (ops[sid].empty())
+      continue;
+
+    shard_set->Await(sid, [&, sid] {
+      auto* channels = EngineShard::tlocal()->shard_channels();
+      for (string_view channel : ops[sid]) {
+        if (to_add)
+          channels->Add(channel, conn, uint32_t(tid));
+        else
+          channels->Remove(channel, conn);
+      }
+    });
+  }
+
+  if (!to_add && conn_state.subscribe_info->IsEmpty()) {
+    conn_state.subscribe_info.reset();
+    DCHECK_GE(conn->subscriptions, 1u);
+    conn->subscriptions--;
+  }
+
+  return result;
+}
+
 void ConnectionContext::ChangeSubscription(bool to_add, bool to_reply, CmdArgList args) {
   vector<unsigned> result = ChangeSubscriptions(false, args, to_add, to_reply, this);
 
@@ -211,6 +319,21 @@ void ConnectionContext::ChangePSubscription(bool to_add, bool to_reply, CmdArgLi
   }
 }
 
+void ConnectionContext::ChangeSSubscription(bool to_add, bool to_reply, CmdArgList args) {
+  vector<unsigned> result = ChangeShardSubscriptions(args, to_add, to_reply, this);
+
+  if (to_reply) {
+    const char* action[2] = {"sunsubscribe", "ssubscribe"};
+    if (result.size() == 0) {
+      return SendSubscriptionChangedResponse(action[to_add], std::nullopt, 0);
+    }
+
+    for (size_t i = 0; i < result.size(); ++i) {
+      SendSubscriptionChangedResponse(action[to_add], ArgS(args, i), result[i]);
+    }
+  }
+}
+
 void ConnectionContext::UnsubscribeAll(bool to_reply) {
   if (to_reply && (!conn_state.subscribe_info || conn_state.subscribe_info->channels.empty())) {
     return SendSubscriptionChangedResponse("unsubscribe", std::nullopt, 0);
@@ -232,6 +355,18 @@ void ConnectionContext::PUnsubscribeAll(bool to_reply) {
   ChangePSubscription(false, to_reply, CmdArgList{arg_vec});
 }
 
+void ConnectionContext::SUnsubscribeAll(bool to_reply) {
+  if (to_reply &&
+      (!conn_state.subscribe_info || conn_state.subscribe_info->shard_channels.empty())) {
+    return SendSubscriptionChangedResponse("sunsubscribe", std::nullopt, 0);
+  }
+
+  StringVec channels(conn_state.subscribe_info->shard_channels.begin(),
+                     conn_state.subscribe_info->shard_channels.end());
+  CmdArgVec arg_vec(channels.begin(), channels.end());
+  ChangeSSubscription(false, to_reply, CmdArgList{arg_vec});
+}
+
 void ConnectionContext::SendSubscriptionChangedResponse(string_view action,
                                                         std::optional<string_view> topic,
                                                         unsigned count) {
@@ -254,7 +389,7 @@ size_t ConnectionState::ScriptInfo::UsedMemory() const {
 }
 
 size_t ConnectionState::SubscribeInfo::UsedMemory() const {
-  return dfly::HeapSize(channels) + dfly::HeapSize(patterns);
+  return dfly::HeapSize(channels) + dfly::HeapSize(patterns) + dfly::HeapSize(shard_channels);
 }
 
 size_t ConnectionState::UsedMemory() const {
@@ -280,7 +415,7 @@ void ConnectionState::ExecInfo::ClearWatched() {
 }
 
 bool ConnectionState::ClientTracking::ShouldTrackKeys() const {
-  if (!IsTrackingOn()) {
+  if (!IsTrackingOn() || bcast_) {
     return false;
   }
 
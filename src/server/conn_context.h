@@ -7,6 +7,9 @@
 #include <absl/container/fixed_array.h>
 #include <absl/container/flat_hash_set.h>
 
+#include <optional>
+#include <vector>
+
 #include "acl/acl_commands_def.h"
 #include "facade/acl_commands_def.h"
 #include "facade/conn_context.h"
@@ -23,6 +26,33 @@ class ChannelStore;
 class Interpreter;
 struct FlowInfo;
 
+namespace journal {
+struct ForwardedEntry;
+}  // namespace journal
+
+// Counts the shards used by the commands of a connection over windows of commands, in order to
+// move the connection to the thread of the shard it uses most, see --conn_rebalance_share.
+// A move is proposed only once the same shard dominated kStableWindows windows in a row, and not
+// again for kCooldownWindows windows after that, so connections with mixed traffic don't bounce.
+class ShardAffinity {
+ public:
+  static constexpr unsigned kWindow = 512;
+  static constexpr unsigned kStableWindows = 2;
+  static constexpr unsigned kCooldownWindows = 8;
+
+  // Records a command that ran on shard sid, or on several shards if sid is kInvalidSid, for a
+  // connection on the thread of shard current. Returns the shard to move to when the window
+  // closes and one shard, other than current, ran at least min_share of its commands.
+  std::optional<ShardId> Record(ShardId sid, ShardId current, double min_share);
+
+ private:
+  std::vector<uint32_t> counts_;
+  uint32_t commands_ = 0;
+  ShardId candidate_ = kInvalidSid;
+  uint8_t stable_windows_ = 0;
+  uint8_t cooldown_windows_ = 0;
+};
+
 // Stores command id and arguments for delayed invocation.
 // Used for storing MULTI/EXEC commands.
 class StoredCmd {
@@ -107,12 +137,17 @@ struct ConnectionState {
     size_t async_cmds_heap_mem = 0;     // bytes used by async_cmds
     size_t async_cmds_heap_limit = 0;   // max bytes allowed for async_cmds
     std::vector<StoredCmd> async_cmds;  // aggregated by acall
+
+    // Replies of deferred calls (dcall) indexed by their handle. Replies of calls still
+    // buffered in async_cmds are empty until the buffer is flushed, resolved ones are taken.
+    std::vector<facade::CapturingReplyBuilder::Payload> deferred_replies;
+    std::vector<std::pair<uint32_t, uint32_t>> deferred_pending;  // (index in async_cmds, handle)
   };
 
   // PUB-SUB messaging related data.
   struct SubscribeInfo {
     bool IsEmpty() const {
-      return channels.empty() && patterns.empty();
+      return channels.empty() && patterns.empty() && shard_channels.empty();
     }
 
     unsigned SubscriptionCount() const {
@@ -124,6 +159,7 @@ struct ConnectionState {
     // TODO: to provide unique_strings across service. This will allow us to use string_view here.
     absl::flat_hash_set<std::string> channels;
     absl::flat_hash_set<std::string> patterns;
+    absl::flat_hash_set<std::string> shard_channels;  // registered in the owning shards
   };
 
   struct ReplicationInfo {
@@ -144,6 +180,7 @@ struct ConnectionState {
 
   enum MCGetMask {
     FETCH_CAS_VER = 1,
+    FETCH_TTL = 2,
   };
 
   size_t UsedMemory() const;
@@ -175,6 +212,9 @@ struct ConnectionState {
   //    >> EXEC
   //    From this point onwards `foo` and `get` keys are tracked. Same aplies if CACHING YES
   //    is used within the MULTI/EXEC block.
+  // 3. CLIENT TRACKING ON BCAST [PREFIX p]... does not track any keys. Instead, the
+  //    connection is notified about all the modified keys that start with one of the
+  //    prefixes, or about all keys if no prefix was given. See BcastTrackingRepo.
   //
   // The state machine implements the above rules. We need to track:
   // 1. If TRACKING is ON and OPTIN
@@ -215,6 +255,19 @@ struct ConnectionState {
       noloop_ = noloop;
     }
 
+    void SetBcast(bool bcast, std::vector<std::string> prefixes) {
+      bcast_ = bcast;
+      prefixes_ = std::move(prefixes);
+    }
+
+    bool IsBcast() const {
+      return bcast_;
+    }
+
+    const std::vector<std::string>& prefixes() const {
+      return prefixes_;
+    }
+
     // Check if the keys should be tracked. Result adheres to the state machine described above.
     bool ShouldTrackKeys() const;
 
@@ -241,7 +294,9 @@ struct ConnectionState {
     // a flag indicating whether the client has turned on client tracking.
     bool tracking_enabled_ = false;
     bool noloop_ = false;
+    bool bcast_ = false;
     Options option_ = NONE;
+    std::vector<std::string> prefixes_;  // BCAST mode prefixes, all keys if empty
     // sequence number
     size_t seq_num_ = 0;
     size_t caching_seq_num_ = 0;
@@ -280,6 +335,7 @@ class ConnectionContext : public facade::ConnectionContext {
   };
 
   DebugInfo last_command_debug;
+  ShardAffinity shard_affinity;
 
   // TODO: to introduce proper accessors.
   Transaction* transaction = nullptr;
@@ -293,10 +349,16 @@ class ConnectionContext : public facade::ConnectionContext {
 
   void ChangeSubscription(bool to_add, bool to_reply, CmdArgList args);
   void ChangePSubscription(bool to_add, bool to_reply, CmdArgList args);
+  void ChangeSSubscription(bool to_add, bool to_reply, CmdArgList args);
   void UnsubscribeAll(bool to_reply);
   void PUnsubscribeAll(bool to_reply);
+  void SUnsubscribeAll(bool to_reply);
   void ChangeMonitor(bool start);  // either start or stop monitor on a given connection
 
+  // Registers or unregisters the connection for broadcast tracking of the prefixes in
+  // tracking_info_.
+  void ChangeBcastTracking(bool start);
+
   size_t UsedMemory() const override;
 
   // Whether this connection is a connection from a replica to its master.
@@ -304,6 +366,18 @@ class ConnectionContext : public facade::ConnectionContext {
   // instance that helps applying commands coming from master.
   bool is_replicating = false;
 
+  // Serialization of the command being applied by a replica, which is journaled as is instead of
+  // serializing the command again.
+  const journal::ForwardedEntry* forwarded_entry = nullptr;
+
+  // Set by READWRITE and cleared by READONLY. Replicas in cluster mode serve reads of their
+  // replicated slots unless it is set, and redirect them to the masters otherwise.
+  bool cluster_readwrite = false;
+
+  // Set by DFLYCLUSTER FORWARDED on the connections other nodes forward cross-slot commands over.
+  // Their commands are not forwarded again, so that nodes with different configs don't bounce them.
+  bool cluster_forwarded = false;
+
   bool monitor = false;  // when a monitor command is sent over a given connection, we need to aware
                          // of it as a state for the connection
 
@@ -3,8 +3,15 @@
 //
 #include "server/container_utils.h"
 
+#include <xxhash.h>
+
+#include <charconv>
+
 #include "base/flags.h"
 #include "base/logging.h"
+#include "core/listpack_scan.h"
+#include "core/qlist.h"
+#include "core/small_set.h"
 #include "core/sorted_map.h"
 #include "core/string_map.h"
 #include "core/string_set.h"
@@ -150,6 +157,17 @@ quicklistEntry QLEntry() {
 }
 
 bool IterateList(const PrimeValue& pv, const IterateFunc& func, long start, long end) {
+  if (pv.Encoding() == kEncodingQL2) {
+    QList* ql = static_cast<QList*>(pv.RObjPtr());
+    return ql->Iterate(
+        [&](QList::Entry entry) {
+          if (entry.value)
+            return func(ContainerEntry{entry.value, entry.sz});
+          return func(ContainerEntry{entry.longval});
+        },
+        start, end);
+  }
+
   quicklist* ql = static_cast<quicklist*>(pv.RObjPtr());
   long llen = quicklistCount(ql);
   if (end < 0 || end >= llen)
@@ -181,6 +199,10 @@ bool IterateSet(const PrimeValue& pv, const IterateFunc& func) {
     while (success && intsetGet(is, ii++, &ival)) {
       success = func(ContainerEntry{ival});
     }
+  } else if (pv.Encoding() == kEncodingSmallSet) {
+    success = static_cast<const SmallSet*>(pv.RObjPtr())->Iterate([&](string_view member) {
+      return func(ContainerEntry{member.data(), member.size()});
+    });
   } else {
     for (sds ptr : *static_cast<StringSet*>(pv.RObjPtr())) {
       if (!func(ContainerEntry{ptr, sdslen(ptr)})) {
@@ -259,16 +281,26 @@ StringMap* GetStringMap(const PrimeValue& pv, const DbContext& db_context) {
 }
 
 optional<string_view> LpFind(uint8_t* lp, string_view key, uint8_t int_buf[]) {
-  uint8_t* fptr = lpFirst(lp);
-  DCHECK(fptr);
-
-  fptr = lpFind(lp, fptr, (unsigned char*)key.data(), key.size(), 1);
+  uint8_t* fptr = detail::LpFindField(lp, key);
   if (!fptr)
     return std::nullopt;
   uint8_t* vptr = lpNext(lp, fptr);
   return LpGetView(vptr, int_buf);
 }
 
+unsigned MergePartition(string_view member, unsigned num_parts) {
+  return XXH3_64bits(member.data(), member.size()) % num_parts;
+}
+
+string_view EntryViews::Get(const ContainerEntry& ce) {
+  if (ce.value)
+    return {ce.value, ce.length};
+
+  auto& buf = ints_.emplace_back();
+  char* end = to_chars(buf.data(), buf.data() + buf.size(), ce.longval).ptr;
+  return {buf.data(), size_t(end - buf.data())};
+}
+
 string_view LpGetView(uint8_t* lp_it, uint8_t int_buf[]) {
   int64_t ele_len = 0;
   uint8_t* elem = lpGet(lp_it, &ele_len, int_buf);
@@ -276,6 +308,67 @@ string_view LpGetView(uint8_t* lp_it, uint8_t int_buf[]) {
   return std::string_view{reinterpret_cast<char*>(elem), size_t(ele_len)};
 }
 
+void ReadView::AppendListpack(const uint8_t* lp, uint32_t offset, uint32_t count) {
+  if (count == 0)
+    return;
+
+  size_t bytes = lpBytes(const_cast<uint8_t*>(lp));
+  segments_.push_back({buf_.size(), offset, count, true});
+  buf_.append(reinterpret_cast<const char*>(lp), bytes);
+  size_ += count;
+}
+
+void ReadView::Append(string_view str) {
+  if (segments_.empty() || segments_.back().is_listpack)
+    segments_.push_back({buf_.size(), 0, 0, false});
+
+  uint32_t len = str.size();
+  buf_.append(reinterpret_cast<const char*>(&len), sizeof(len));
+  buf_.append(str);
+  segments_.back().count++;
+  size_++;
+}
+
+vector<string_view> ReadView::Entries() {
+  vector<string_view> res;
+  res.reserve(size_);
+
+  // Integers are formatted into ints_, which may reallocate, so their views are set at the end.
+  vector<pair<size_t, size_t>> int_entries;  // (index in res, offset in ints_)
+  ints_.clear();
+
+  uint8_t intbuf[LP_INTBUF_SIZE];
+  for (const Segment& seg : segments_) {
+    char* start = buf_.data() + seg.pos;
+    if (!seg.is_listpack) {
+      for (uint32_t i = 0; i < seg.count; ++i) {
+        uint32_t len;
+        memcpy(&len, start, sizeof(len));
+        res.emplace_back(start + sizeof(len), len);
+        start += sizeof(len) + len;
+      }
+      continue;
+    }
+
+    uint8_t* lp = reinterpret_cast<uint8_t*>(start);
+    uint8_t* p = lpSeek(lp, seg.skip);
+    for (uint32_t i = 0; i < seg.count; ++i, p = lpNext(lp, p)) {
+      DCHECK(p);
+      int64_t len = 0;
+      uint8_t* elem = lpGet(p, &len, intbuf);
+      if (elem == intbuf) {
+        int_entries.emplace_back(res.size(), ints_.size());
+        ints_.append(reinterpret_cast<char*>(intbuf), len);
+      }
+      res.emplace_back(reinterpret_cast<char*>(elem), len);
+    }
+  }
+
+  for (auto [index, offset] : int_entries)
+    res[index] = string_view{ints_.data() + offset, res[index].size()};
+  return res;
+}
+
 OpResult<string> RunCbOnFirstNonEmptyBlocking(Transaction* trans, int req_obj_type,
                                               BlockingResultCb func, unsigned limit_ms,
                                               bool* block_flag, bool* pause_flag,
@@ -12,7 +12,12 @@ extern "C" {
 #include "redis/quicklist.h"
 }
 
+#include <array>
+#include <deque>
 #include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace dfly {
 
@@ -81,6 +86,62 @@ std::string_view LpGetView(uint8_t* lp_it, uint8_t int_buf[]);
 // Find value by key and return stringview to it, otherwise nullopt.
 std::optional<std::string_view> LpFind(uint8_t* lp, std::string_view key, uint8_t int_buf[]);
 
+// Partition of member among num_parts, for splitting the partial results of multi-key commands
+// so that the shards merge them in parallel, each its own partition. Independent of the hashes
+// of the containers, so that the members of a partition don't collide in them.
+unsigned MergePartition(std::string_view member, unsigned num_parts);
+
+// Total size of the partial results from which merging them on several shards in parallel pays
+// off the extra hop.
+constexpr size_t kMinParallelMergeSize = 4096;
+
+// Views of container entries for the partial results of multi-key commands, which refer to the
+// members of the source containers instead of copying them. The containers must stay locked
+// while the views are used. Integer entries have no string form in their containers, so it is
+// kept here, in chunks rather than in a string per entry.
+class EntryViews {
+ public:
+  std::string_view Get(const ContainerEntry& ce);
+
+ private:
+  std::deque<std::array<char, 24>> ints_;  // Never moves its elements on push_back.
+};
+
+// A copy of elements of a container, which the shard thread takes with as few copies and
+// allocations as possible, so that the coordinator decodes and serializes the reply instead.
+// Listpacks are copied whole rather than element by element, other elements are packed into
+// a single buffer.
+class ReadView {
+ public:
+  // Copies the count entries of listpack lp starting at entry offset.
+  void AppendListpack(const uint8_t* lp, uint32_t offset, uint32_t count);
+
+  void Append(std::string_view str);
+
+  size_t size() const {
+    return size_;
+  }
+
+  // Returns the entries in order. The views are valid until the ReadView is changed or
+  // destroyed. Integer entries of listpacks are formatted into a buffer of the view.
+  std::vector<std::string_view> Entries();
+
+ private:
+  // Entries [skip, skip + count) of the listpack at pos, or count strings at pos, each prefixed
+  // with its 32 bit length.
+  struct Segment {
+    size_t pos;
+    uint32_t skip;
+    uint32_t count;
+    bool is_listpack;
+  };
+
+  std::string buf_;
+  std::string ints_;
+  std::vector<Segment> segments_;
+  size_t size_ = 0;
+};
+
 using BlockingResultCb =
     std::function<void(Transaction*, EngineShard*, std::string_view /* key */)>;
 
@@ -5,9 +5,15 @@
 #include "server/db_slice.h"
 
 #include <absl/cleanup/cleanup.h>
+#include <absl/container/inlined_vector.h>
+#include <absl/random/random.h>
+
+#include <cmath>
 
 #include "base/flags.h"
 #include "base/logging.h"
+#include "core/string_map.h"
+#include "core/string_set.h"
 #include "generic_family.h"
 #include "server/channel_store.h"
 #include "server/cluster/cluster_defs.h"
@@ -34,9 +40,42 @@ ABSL_FLAG(double, table_growth_margin, 0.4,
           "Prevents table from growing if number of free slots x average object size x this ratio "
           "is larger than memory budget.");
 
+ABSL_FLAG(bool, expire_timer_wheel, false,
+          "If true, indexes the keys with expiry by their deadlines so that the heartbeat deletes "
+          "exactly the keys that are due instead of sampling the expire table. Costs a copy of "
+          "each key with expiry.");
+
+ABSL_FLAG(bool, expire_time_buckets, false,
+          "If true, groups the expire table buckets by the coarse deadlines of their keys so that "
+          "the heartbeat visits only the buckets with keys that are due, instead of sampling the "
+          "whole expire table. Costs an entry per bucket and second of deadlines.");
+
+ABSL_FLAG(std::string, cache_eviction_policy, "bump",
+          "Eviction policy in cache mode. 'bump' moves accessed items towards the front of their "
+          "buckets and evicts from the end of the stash buckets. 'lfu' evicts the items with the "
+          "lowest approximate access frequency.");
+
+ABSL_FLAG(bool, field_expiry_index, false,
+          "If true, indexes the hashes and sets with expiring fields by the expiry of their "
+          "earliest field, so that the heartbeat reclaims the expired fields instead of waiting "
+          "for them to be accessed.");
+
+ABSL_FLAG(bool, cluster_slot_key_index, false,
+          "If true, indexes the keys by their slots in cluster mode, so that flushing and "
+          "migrating slots visit only the keys of those slots instead of the whole table. Costs a "
+          "copy of each key.");
+
+ABSL_FLAG(uint32_t, lazyfree_slice_usec, 200,
+          "Time slice for freeing deleted and flushed values in the background, before yielding "
+          "to other work");
+
 ABSL_FLAG(std::string, notify_keyspace_events, "",
           "notify-keyspace-events. Only Ex is supported for now");
 
+ABSL_FLAG(bool, keyspace_events_compact, false,
+          "If true, the keyspace events of a heartbeat are published as a single message per db, "
+          "holding the keys as a RESP array, instead of a message per key.");
+
 namespace dfly {
 
 using namespace std;
@@ -57,6 +96,31 @@ static_assert(kPrimeSegmentSize == 32288);
 // 24576
 static_assert(kExpireSegmentSize == 23528);
 
+// New keys start above the minimum so that they are not evicted before they are accessed again.
+constexpr uint8_t kLfuInitFreq = 1;
+
+// Morris counter: increments freq with probability 2^-freq, so kMaxFreq corresponds to
+// ~2^kMaxFreq accesses.
+void IncrementFreq(CompactObj* key) {
+  thread_local absl::InsecureBitGen gen;
+  uint8_t freq = key->Freq();
+  if (freq < CompactObj::kMaxFreq && (absl::Uniform<uint32_t>(gen) & ((1u << freq) - 1)) == 0)
+    key->SetFreq(freq + 1);
+}
+
+// Decays freq on every eviction that considered the key without evicting it, so eviction
+// pressure determines how quickly keys that are no longer accessed become victims.
+void DecayFreq(CompactObj* key) {
+  if (uint8_t freq = key->Freq(); freq > 0)
+    key->SetFreq(freq - 1);
+}
+
+// Whether pv is a container large enough to be freed by the lazy free queue.
+bool FreesLazily(const PrimeValue& pv, size_t min_elements) {
+  return min_elements > 0 && pv.ObjType() != OBJ_STRING && !pv.IsExternal() &&
+         pv.Size() >= min_elements;
+}
+
 void AccountObjectMemory(string_view key, unsigned type, int64_t size, DbTable* db) {
   DCHECK_NE(db, nullptr);
   DbTableStats& stats = db->stats;
@@ -66,7 +130,9 @@ void AccountObjectMemory(string_view key, unsigned type, int64_t size, DbTable*
   stats.AddTypeMemoryUsage(type, size);
 
   if (cluster::IsClusterEnabled()) {
-    db->slots_stats[cluster::KeySlot(key)].memory_bytes += size;
+    cluster::SlotId sid = cluster::KeySlot(key);
+    db->slots_stats[sid].memory_bytes += size;
+    db->slots_load[sid].written_bytes += std::abs(size);
   }
 }
 
@@ -76,13 +142,14 @@ class PrimeEvictionPolicy {
   static constexpr bool can_gc = true;
 
   PrimeEvictionPolicy(const DbContext& cntx, bool can_evict, ssize_t mem_budget, ssize_t soft_limit,
-                      DbSlice* db_slice, bool apply_memory_limit)
+                      DbSlice* db_slice, bool apply_memory_limit, bool lfu)
       : db_slice_(db_slice),
         mem_budget_(mem_budget),
         soft_limit_(soft_limit),
         cntx_(cntx),
         can_evict_(can_evict),
-        apply_memory_limit_(apply_memory_limit) {
+        apply_memory_limit_(apply_memory_limit),
+        lfu_(lfu) {
   }
 
   // A hook function that is called every time a segment is full and requires splitting.
@@ -121,6 +188,10 @@ class PrimeEvictionPolicy {
   // items in runtime.
   const bool can_evict_;
   const bool apply_memory_limit_;
+  const bool lfu_;
+
+  unsigned EvictLfu(const PrimeTable::HotspotBuckets& eb);
+  void EvictEntry(PrimeTable::bucket_iterator it, std::string_view key, DbTable* table);
 };
 
 class PrimeBumpPolicy {
@@ -186,6 +257,9 @@ unsigned PrimeEvictionPolicy::Evict(const PrimeTable::HotspotBuckets& eb, PrimeT
   if (!can_evict_)
     return 0;
 
+  if (lfu_)
+    return EvictLfu(eb);
+
   constexpr size_t kNumStashBuckets = ABSL_ARRAYSIZE(eb.probes.by_type.stash_buckets);
 
   // choose "randomly" a stash bucket to evict an item.
@@ -206,27 +280,70 @@ unsigned PrimeEvictionPolicy::Evict(const PrimeTable::HotspotBuckets& eb, PrimeT
     if (lt.Find(LockTag(key)).has_value())
       return 0;
 
-    // log the evicted keys to journal.
-    if (auto journal = db_slice_->shard_owner()->journal(); journal) {
-      RecordExpiry(cntx_.db_index, key);
+    EvictEntry(last_slot_it, key, table);
+  }
+  me->ShiftRight(bucket_it);
+
+  return 1;
+}
+
+unsigned PrimeEvictionPolicy::EvictLfu(const PrimeTable::HotspotBuckets& eb) {
+  DbTable* table = db_slice_->GetDBTable(cntx_.db_index);
+  string scratch, victim_key;
+  PrimeTable::bucket_iterator victim;
+  unsigned victim_freq = CompactObj::kMaxFreq + 1;
+
+  // Consider the buckets the new key can be inserted into: its home bucket, the neighbour and
+  // the stash buckets.
+  auto consider = [&](PrimeTable::bucket_iterator bucket_it) {
+    for (; !bucket_it.is_done(); ++bucket_it) {
+      PrimeKey& key = bucket_it->first;
+      if (key.IsSticky())
+        continue;
+
+      if (key.Freq() < victim_freq) {
+        string_view key_slice = key.GetSlice(&scratch);
+        if (!table->trans_locks.Find(LockTag(key_slice)).has_value()) {
+          victim = bucket_it;
+          victim_freq = key.Freq();
+          victim_key = key_slice;
+        }
+      }
+      DecayFreq(&key);
     }
+  };
 
-    db_slice_->PerformDeletion(DbSlice::Iterator(last_slot_it, StringOrView::FromView(key)), table);
+  consider(eb.probes.by_type.regular_buckets[1]);
+  consider(eb.probes.by_type.regular_buckets[2]);
+  for (const auto& stash_it : eb.probes.by_type.stash_buckets)
+    consider(stash_it);
 
-    ++evicted_;
-  }
-  me->ShiftRight(bucket_it);
+  if (victim_freq > CompactObj::kMaxFreq)
+    return 0;
 
+  EvictEntry(victim, victim_key, table);
   return 1;
 }
 
+void PrimeEvictionPolicy::EvictEntry(PrimeTable::bucket_iterator it, string_view key,
+                                     DbTable* table) {
+  // log the evicted keys to journal.
+  if (auto journal = db_slice_->shard_owner()->journal(); journal) {
+    RecordExpiry(cntx_.db_index, key);
+  }
+
+  db_slice_->PerformDeletion(DbSlice::Iterator(it, StringOrView::FromView(key)), table);
+
+  ++evicted_;
+}
+
 }  // namespace
 
 #define ADD(x) (x) += o.x
 
 DbStats& DbStats::operator+=(const DbStats& o) {
   constexpr size_t kDbSz = sizeof(DbStats) - sizeof(DbTableStats);
-  static_assert(kDbSz == 32);
+  static_assert(kDbSz == 40);
 
   DbTableStats::operator+=(o);
 
@@ -234,12 +351,13 @@ DbStats& DbStats::operator+=(const DbStats& o) {
   ADD(expire_count);
   ADD(bucket_count);
   ADD(table_mem_usage);
+  ADD(expire_wheel_mem_usage);
 
   return *this;
 }
 
 SliceEvents& SliceEvents::operator+=(const SliceEvents& o) {
-  static_assert(sizeof(SliceEvents) == 112, "You should update this function with new fields");
+  static_assert(sizeof(SliceEvents) == 144, "You should update this function with new fields");
 
   ADD(evicted_keys);
   ADD(hard_evictions);
@@ -255,6 +373,10 @@ SliceEvents& SliceEvents::operator+=(const SliceEvents& o) {
   ADD(update);
   ADD(ram_hits);
   ADD(ram_misses);
+  ADD(segments_merged);
+  ADD(expired_hash_fields);
+  ADD(expired_set_fields);
+  ADD(prefetch_hits);
 
   return *this;
 }
@@ -264,6 +386,7 @@ SliceEvents& SliceEvents::operator+=(const SliceEvents& o) {
 DbSlice::DbSlice(uint32_t index, bool caching_mode, EngineShard* owner)
     : shard_id_(index),
       caching_mode_(caching_mode),
+      lfu_eviction_(0),
       owner_(owner),
       client_tracking_map_(owner->memory_resource()) {
   db_arr_.emplace_back();
@@ -277,6 +400,13 @@ DbSlice::DbSlice(uint32_t index, bool caching_mode, EngineShard* owner)
     exit(0);
   }
   expired_keys_events_recording_ = !keyspace_events.empty();
+
+  std::string eviction_policy = GetFlag(FLAGS_cache_eviction_policy);
+  if (eviction_policy != "bump" && eviction_policy != "lfu") {
+    LOG(ERROR) << "Unknown cache_eviction_policy " << eviction_policy;
+    exit(0);
+  }
+  lfu_eviction_ = eviction_policy == "lfu";
 }
 
 DbSlice::~DbSlice() {
@@ -305,8 +435,17 @@ auto DbSlice::GetStats() const -> Stats {
     stats.bucket_count = db_wrap.prime.bucket_count();
     stats.expire_count = db_wrap.expire.size();
     stats.table_mem_usage = (db_wrap.prime.mem_usage() + db_wrap.expire.mem_usage());
-  }
-  s.small_string_bytes = CompactObj::GetStats().small_string_bytes;
+    if (db_wrap.expire_wheel)
+      stats.expire_wheel_mem_usage = db_wrap.expire_wheel->MemUsage();
+  }
+  auto obj_stats = CompactObj::GetStats();
+  s.small_string_bytes = obj_stats.small_string_bytes;
+  s.key_prefix_bytes = obj_stats.key_prefix_bytes;
+  s.compression_saved_bytes = obj_stats.compression_saved_bytes;
+  s.shared_value_bytes = obj_stats.shared_value_bytes;
+  s.dedup_saved_bytes = obj_stats.dedup_saved_bytes;
+  s.lazyfree_pending_bytes = lazy_free_.pending_bytes();
+  s.lazyfree_pending_objects = lazy_free_.size();
 
   return s;
 }
@@ -316,13 +455,49 @@ SlotStats DbSlice::GetSlotStats(cluster::SlotId sid) const {
   return db_arr_[0]->slots_stats[sid];
 }
 
-void DbSlice::Reserve(DbIndex db_ind, size_t key_size) {
+const SlotLoad& DbSlice::GetSlotLoad(cluster::SlotId sid) const {
+  CHECK(db_arr_[0]);
+  return db_arr_[0]->slots_load[sid];
+}
+
+void DbSlice::UpdateSlotLoad(uint64_t now_ms) {
+  // The rates follow the load of the last kDecayMs or so.
+  constexpr uint64_t kIntervalMs = 1000;
+  constexpr double kDecayMs = 10000;
+
+  if (!cluster::IsClusterEnabled() || !db_arr_[0])
+    return;
+
+  DbTable& db = *db_arr_[0];
+  uint64_t elapsed_ms = now_ms - db.slots_load_time_ms;
+  if (now_ms < db.slots_load_time_ms + kIntervalMs)
+    return;
+  db.slots_load_time_ms = now_ms;
+
+  double alpha = 1 - std::exp(-double(elapsed_ms) / kDecayMs);
+  for (cluster::SlotId sid = 0; sid <= cluster::kMaxSlotNum; ++sid) {
+    const SlotStats& stats = db.slots_stats[sid];
+    SlotLoad& load = db.slots_load[sid];
+
+    uint64_t ops = stats.total_reads + stats.total_writes;
+    double ops_per_sec = double(ops - load.last_ops) * 1000 / elapsed_ms;
+    double bytes_per_sec = double(load.written_bytes - load.last_written_bytes) * 1000 / elapsed_ms;
+    load.last_ops = ops;
+    load.last_written_bytes = load.written_bytes;
+
+    load.ops_per_sec += alpha * (ops_per_sec - load.ops_per_sec);
+    load.bytes_per_sec += alpha * (bytes_per_sec - load.bytes_per_sec);
+  }
+}
+
+void DbSlice::Reserve(DbIndex db_ind, size_t key_size, size_t expire_size) {
   ActivateDb(db_ind);
 
   auto& db = db_arr_[db_ind];
   DCHECK(db);
 
   db->prime.Reserve(key_size);
+  db->expire.Reserve(expire_size);
 }
 
 DbSlice::AutoUpdater::AutoUpdater() {
@@ -425,16 +600,97 @@ OpResult<DbSlice::ConstIterator> DbSlice::FindReadOnly(const Context& cntx, stri
   return res.status();
 }
 
+OpResult<DbSlice::ConstIterator> DbSlice::FindReadOnlyOffloaded(const Context& cntx,
+                                                                string_view key,
+                                                                unsigned req_obj_type) const {
+  auto res = FindInternal(cntx, key, req_obj_type, UpdateStatsMode::kReadStats, true);
+  if (res.ok()) {
+    return ConstIterator(res->it, StringOrView::FromView(key));
+  }
+  return res.status();
+}
+
+std::unique_ptr<KeyPrefetch> DbSlice::PrefetchKeys(DbIndex db_ind, const ShardArgs& keys) {
+  if (!IsDbValid(db_ind) || keys.Size() > KeyPrefetch::kMaxKeys)
+    return nullptr;
+
+  auto res = std::make_unique<KeyPrefetch>();
+  res->table = db_arr_[db_ind];
+  for (string_view key : keys)
+    res->entries.emplace_back(key, PrimeIterator{});
+
+  absl::InlinedVector<string_view, KeyPrefetch::kMaxKeys> views;
+  for (const auto& entry : res->entries)
+    views.push_back(entry.first);
+  absl::InlinedVector<PrimeIterator, KeyPrefetch::kMaxKeys> its(views.size());
+  res->table->prime.FindBatch(views.data(), views.size(), its.data());
+  for (size_t i = 0; i < its.size(); ++i)
+    res->entries[i].second = its[i];
+  return res;
+}
+
+void DbSlice::FindReadOnly(const Context& cntx, absl::Span<const std::string_view> keys,
+                           unsigned req_obj_type, absl::Span<OpResult<ConstIterator>> res) const {
+  DCHECK_EQ(keys.size(), res.size());
+  if (!IsDbValid(cntx.db_index)) {
+    std::fill(res.begin(), res.end(), OpStatus::KEY_NOTFOUND);
+    return;
+  }
+
+  auto& db = *db_arr_[cntx.db_index];
+  absl::InlinedVector<PrimeIterator, 32> its(keys.size());
+  db.prime.FindBatch(keys.data(), keys.size(), its.data());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    PrimeIterator it = its[i];
+
+    // Bumping up or expiring the previous keys could have moved this entry.
+    if (IsValid(it))
+      it = db.Launder(it, keys[i]);
+
+    auto find_res = FindInternal(cntx, keys[i], it, req_obj_type, UpdateStatsMode::kReadStats);
+    if (find_res.ok()) {
+      res[i] = ConstIterator(find_res->it, StringOrView::FromView(keys[i]));
+    } else {
+      res[i] = find_res.status();
+    }
+  }
+}
+
 OpResult<DbSlice::PrimeItAndExp> DbSlice::FindInternal(const Context& cntx, std::string_view key,
                                                        std::optional<unsigned> req_obj_type,
-                                                       UpdateStatsMode stats_mode) const {
+                                                       UpdateStatsMode stats_mode,
+                                                       bool keep_offloaded) const {
   if (!IsDbValid(cntx.db_index)) {
     return OpStatus::KEY_NOTFOUND;
   }
 
+  auto& db = *db_arr_[cntx.db_index];
+  PrimeIterator* prefetched = cntx.prefetch ? cntx.prefetch->Get(&db, key) : nullptr;
+  if (!prefetched)
+    return FindInternal(cntx, key, db.prime.Find(key), req_obj_type, stats_mode, keep_offloaded);
+
+  // The entry could have moved or been deleted since it was prefetched.
+  PrimeIterator it = *prefetched;
+  if (IsValid(it) && it.IsOccupied() && it->first == key) {
+    ++events_.prefetch_hits;
+  } else {
+    it = db.prime.Find(key);
+  }
+
+  auto res = FindInternal(cntx, key, it, req_obj_type, stats_mode, keep_offloaded);
+  *prefetched = res.ok() ? res->it : PrimeIterator{};
+  return res;
+}
+
+OpResult<DbSlice::PrimeItAndExp> DbSlice::FindInternal(const Context& cntx, std::string_view key,
+                                                       PrimeIterator it,
+                                                       std::optional<unsigned> req_obj_type,
+                                                       UpdateStatsMode stats_mode,
+                                                       bool keep_offloaded) const {
   DbSlice::PrimeItAndExp res;
   auto& db = *db_arr_[cntx.db_index];
-  res.it = db.prime.Find(key);
+  res.it = it;
 
   absl::Cleanup update_stats_on_miss = [&]() {
     switch (stats_mode) {
@@ -463,7 +719,16 @@ OpResult<DbSlice::PrimeItAndExp> DbSlice::FindInternal(const Context& cntx, std:
     }
   }
 
-  if (caching_mode_ && IsValid(res.it)) {
+  // Offloaded strings are read asynchronously by their commands, containers are loaded here
+  if (PrimeValue& pv = res.it->second; pv.IsExternal() && pv.ObjType() != OBJ_STRING) {
+    TieredStorage* ts = owner_->tiered_storage();
+    if (!keep_offloaded || ts->ShouldLoad(&pv))
+      ts->Load(cntx.db_index, &pv);
+  }
+
+  if (caching_mode_ && lfu_eviction_ && IsValid(res.it)) {
+    IncrementFreq(&res.it->first);
+  } else if (caching_mode_ && IsValid(res.it)) {
     if (!change_cb_.empty()) {
       auto bump_cb = [&](PrimeTable::bucket_iterator bit) {
         DVLOG(2) << "Running callbacks for key " << key << " in dbid " << cntx.db_index;
@@ -481,6 +746,10 @@ OpResult<DbSlice::PrimeItAndExp> DbSlice::FindInternal(const Context& cntx, std:
 
   db.top_keys.Touch(key);
 
+  // Lets the offloading pass skip keys that were accessed since it last reached them
+  if (owner_ && owner_->tiered_storage())
+    res.it->first.SetTouched(true);
+
   std::move(update_stats_on_miss).Cancel();
   switch (stats_mode) {
     case UpdateStatsMode::kMutableStats:
@@ -549,7 +818,8 @@ OpResult<DbSlice::AddOrFindResult> DbSlice::AddOrFindInternal(const Context& cnt
                           int64_t(memory_budget_ - key.size()),
                           ssize_t(soft_budget_limit_),
                           this,
-                          apply_memory_limit};
+                          apply_memory_limit,
+                          bool(lfu_eviction_)};
 
   // If we are over limit in non-cache scenario, just be conservative and throw.
   if (apply_memory_limit && !caching_mode_ && evp.mem_budget() < 0) {
@@ -560,7 +830,10 @@ OpResult<DbSlice::AddOrFindResult> DbSlice::AddOrFindInternal(const Context& cnt
 
   // Fast-path if change_cb_ is empty so we Find or Add using
   // the insert operation: twice more efficient.
-  CompactObj co_key{key};
+  CompactObj co_key;
+  co_key.SetPrefixedString(key);
+  if (lfu_eviction_)
+    co_key.SetFreq(kLfuInitFreq);
   PrimeIterator it;
 
   // I try/catch just for sake of having a convenient place to set a breakpoint.
@@ -599,6 +872,8 @@ OpResult<DbSlice::AddOrFindResult> DbSlice::AddOrFindInternal(const Context& cnt
   if (cluster::IsClusterEnabled()) {
     cluster::SlotId sid = cluster::KeySlot(key);
     db.slots_stats[sid].key_count += 1;
+    if (db.slot_keys)
+      db.slot_keys->Add(sid, key);
   }
 
   return DbSlice::AddOrFindResult{
@@ -618,7 +893,8 @@ void DbSlice::ActivateDb(DbIndex db_ind) {
   CreateDb(db_ind);
 }
 
-bool DbSlice::Del(DbIndex db_ind, Iterator it) {
+bool DbSlice::Del(DbIndex db_ind, Iterator it, size_t lazy_free_min_elements,
+                  PrimeValue* detach_to) {
   if (!IsValid(it)) {
     return false;
   }
@@ -632,11 +908,51 @@ bool DbSlice::Del(DbIndex db_ind, Iterator it) {
     doc_del_cb_(key, DbContext{db_ind, GetCurrentTimeMs()}, it->second);
   }
   fetched_items_.erase(it->first.AsRef());
-  PerformDeletion(it, db.get());
+  PerformDeletion(it, db.get(), lazy_free_min_elements, detach_to);
 
+  if (detach_to) {
+    // The expiry and memcache flags of the key stay behind.
+    detach_to->SetExpire(false);
+    detach_to->SetFlag(false);
+  }
   return true;
 }
 
+bool DbSlice::LazyFreeStep() {
+  // Elements freed between clock checks.
+  constexpr size_t kStepElements = 256;
+
+  uint64_t deadline = absl::GetCurrentTimeNanos() + GetFlag(FLAGS_lazyfree_slice_usec) * 1000;
+  while (!lazy_free_.Empty()) {
+    lazy_free_.Step(kStepElements);
+    if (absl::GetCurrentTimeNanos() >= deadline)
+      break;
+  }
+  return !lazy_free_.Empty();
+}
+
+void DbSlice::ClearFlushedTable(DbTable* table) {
+  // The expire and mcflag tables reference the keys of prime.
+  table->expire.Clear();
+  table->mcflag.Clear();
+
+  const uint64_t slice_nanos = GetFlag(FLAGS_lazyfree_slice_usec) * 1000;
+  uint64_t deadline = absl::GetCurrentTimeNanos() + slice_nanos;
+  PrimeTable::Cursor cursor;
+  do {
+    cursor = table->prime.Traverse(cursor, [&](PrimeIterator it) {
+      if (FreesLazily(it->second, kLazyFreeMinElements))
+        lazy_free_.Push(&it->second);
+      table->prime.Erase(it);
+    });
+
+    if (absl::GetCurrentTimeNanos() >= deadline) {
+      ThisFiber::Yield();
+      deadline = absl::GetCurrentTimeNanos() + slice_nanos;
+    }
+  } while (cursor);
+}
+
 void DbSlice::FlushSlotsFb(const cluster::SlotSet& slot_ids) {
   // Slot deletion can take time as it traverses all the database, hence it runs in fiber.
   // We want to flush all the data of a slot that was added till the time the call to FlushSlotsFb
@@ -681,18 +997,44 @@ void DbSlice::FlushSlotsFb(const cluster::SlotSet& slot_ids) {
   next_version = RegisterOnChange(std::move(on_change));
 
   ServerState& etl = *ServerState::tlocal();
-  PrimeTable* pt = &db_arr_[0]->prime;
-  PrimeTable::Cursor cursor;
   uint64_t i = 0;
-  do {
-    PrimeTable::Cursor next = pt->Traverse(cursor, del_entry_cb);
-    ++i;
-    cursor = next;
-    if (i % 100 == 0) {
-      ThisFiber::Yield();
+  if (db_arr_[0]->slot_keys) {
+    // Keys added since the flush started have newer versions and are skipped by del_entry_cb.
+    for (cluster::SlotId sid = 0; sid <= cluster::kMaxSlotNum; ++sid) {
+      if (!slot_ids.Contains(sid))
+        continue;
+
+      for (const string& key : db_arr_[0]->slot_keys->GetKeys(sid)) {
+        while (IsLockedForSerialization())
+          ThisFiber::SleepFor(1ms);
+
+        if (etl.gstate() == GlobalState::SHUTTING_DOWN)
+          break;
+
+        // Looked up again every time, because the table can be flushed while we yield.
+        if (PrimeIterator it = db_arr_[0]->prime.Find(key); IsValid(it))
+          del_entry_cb(it);
+        if (++i % 100 == 0) {
+          ThisFiber::Yield();
+        }
+      }
     }
+  } else {
+    PrimeTable* pt = &db_arr_[0]->prime;
+    PrimeTable::Cursor cursor;
+    do {
+      while (IsLockedForSerialization())
+        ThisFiber::SleepFor(1ms);
+
+      PrimeTable::Cursor next = pt->Traverse(cursor, del_entry_cb);
+      ++i;
+      cursor = next;
+      if (i % 100 == 0) {
+        ThisFiber::Yield();
+      }
 
-  } while (cursor && etl.gstate() != GlobalState::SHUTTING_DOWN);
+    } while (cursor && etl.gstate() != GlobalState::SHUTTING_DOWN);
+  }
 
   UnregisterOnChange(next_version);
 
@@ -732,6 +1074,12 @@ void DbSlice::FlushDbIndexes(const std::vector<DbIndex>& indexes) {
   auto cb = [this, async_cleanup, indexes, flush_db_arr = std::move(flush_db_arr)]() mutable {
     if (async_cleanup)
       ClearEntriesOnFlush(indexes, flush_db_arr, true);
+
+    // Tables still referenced elsewhere, i.e. by a snapshot, must stay intact.
+    for (auto& db : flush_db_arr) {
+      if (db && db->use_count() == 1 && db->stats.tiered_entries == 0)
+        ClearFlushedTable(db.get());
+    }
     flush_db_arr.clear();
     ServerState::tlocal()->DecommitMemory(ServerState::kDataHeap | ServerState::kBackingHeap |
                                           ServerState::kGlibcmalloc);
@@ -743,6 +1091,10 @@ void DbSlice::FlushDbIndexes(const std::vector<DbIndex>& indexes) {
 void DbSlice::FlushDb(DbIndex db_ind) {
   // clear client tracking map.
   client_tracking_map_.clear();
+  InvalidateAllHotKeys();
+
+  // Deletion markers are not recorded for the flushed keys.
+  ResetDeltaSnapshots();
 
   if (db_ind != kDbAll) {
     // Flush a single database if a specific index is provided
@@ -765,6 +1117,25 @@ void DbSlice::AddExpire(DbIndex db_ind, Iterator main_it, uint64_t at) {
   uint64_t delta = at - expire_base_[0];  // TODO: employ multigen expire updates.
   CHECK(db_arr_[db_ind]->expire.Insert(main_it->first.AsRef(), ExpirePeriod(delta)).second);
   main_it->second.SetExpire(true);
+  if (db_arr_[db_ind]->expire_wheel || db_arr_[db_ind]->expire_buckets) {
+    string scratch;
+    ScheduleExpiry(*db_arr_[db_ind], main_it->first.GetSlice(&scratch), at);
+  }
+}
+
+void DbSlice::SetExpireTime(DbIndex db_ind, const ExpIterator& exp_it, uint64_t at) {
+  exp_it->second = FromAbsoluteTime(at);
+  ScheduleExpiry(*db_arr_[db_ind], exp_it.key(), at);
+}
+
+void DbSlice::ScheduleExpiry(DbTable& db, string_view key, uint64_t at) {
+  // Replicas never expire keys themselves, so they do not need the indices.
+  if (owner_->IsReplica())
+    return;
+  if (db.expire_wheel)
+    db.expire_wheel->Schedule(key, at);
+  if (db.expire_buckets)
+    db.expire_buckets->Add(at, db.expire.KeyCursor(key).value());
 }
 
 bool DbSlice::RemoveExpire(DbIndex db_ind, Iterator main_it) {
@@ -822,6 +1193,72 @@ OpResult<DbSlice::ItAndUpdater> DbSlice::AddNew(const Context& cntx, string_view
       .it = res.it, .exp_it = res.exp_it, .post_updater = std::move(res.post_updater)};
 }
 
+OpResult<bool> DbSlice::AddOrUpdateForLoad(const Context& cntx, string_view key, PrimeValue obj,
+                                            uint64_t expire_at_ms, bool sticky) {
+  auto slow_path = [&]() -> OpResult<bool> {
+    auto op_result = AddOrUpdate(cntx, key, std::move(obj), expire_at_ms);
+    RETURN_ON_BAD_STATUS(op_result);
+    op_result->it->first.SetSticky(sticky);
+    return op_result->is_new;
+  };
+
+  if (!change_cb_.empty() || ServerState::tlocal()->gstate() != GlobalState::LOADING)
+    return slow_path();
+
+  auto& db = *db_arr_[cntx.db_index];
+
+  // Memory limits are not applied while loading, see AddOrFindInternal.
+  PrimeEvictionPolicy evp{cntx,
+                          (bool(caching_mode_) && !owner_->IsReplica()),
+                          int64_t(memory_budget_ - key.size()),
+                          ssize_t(soft_budget_limit_),
+                          this,
+                          false,
+                          bool(lfu_eviction_)};
+
+  CompactObj co_key;
+  co_key.SetPrefixedString(key);
+  if (lfu_eviction_)
+    co_key.SetFreq(kLfuInitFreq);
+  co_key.SetSticky(sticky);
+
+  PrimeIterator it;
+  bool inserted;
+  try {
+    tie(it, inserted) = db.prime.Insert(std::move(co_key), PrimeValue{}, evp);
+  } catch (bad_alloc& e) {
+    events_.insertion_rejections++;
+    return OpStatus::OUT_OF_MEMORY;
+  }
+
+  events_.evicted_keys += evp.evicted();
+  memory_budget_ = evp.mem_budget();
+
+  if (!inserted)  // Duplicate keys are rare, let the regular path overwrite them.
+    return slow_path();
+
+  db.stats.inline_keys += it->first.IsInline();
+  AccountObjectMemory(key, it->first.ObjType(), it->first.MallocUsed(), &db);
+
+  it->second = std::move(obj);
+  AccountObjectMemory(key, it->second.ObjType(), it->second.MallocUsed(), &db);
+
+  if (expire_at_ms) {
+    it->second.SetExpire(true);
+    db.expire.InsertNew(it->first.AsRef(), FromAbsoluteTime(expire_at_ms));
+    ScheduleExpiry(db, key, expire_at_ms);
+  }
+
+  if (cluster::IsClusterEnabled()) {
+    cluster::SlotId sid = cluster::KeySlot(key);
+    db.slots_stats[sid].key_count += 1;
+    if (db.slot_keys)
+      db.slot_keys->Add(sid, key);
+  }
+
+  return true;
+}
+
 pair<int64_t, int64_t> DbSlice::ExpireParams::Calculate(int64_t now_ms) const {
   if (persist)
     return {0, 0};
@@ -861,7 +1298,7 @@ OpResult<int64_t> DbSlice::UpdateExpire(const Context& cntx, Iterator prime_it,
       return OpStatus::SKIPPED;
     }
 
-    expire_it->second = FromAbsoluteTime(abs_msec);
+    SetExpireTime(cntx.db_index, expire_it, abs_msec);
     return abs_msec;
   } else {
     if (params.expire_options & ExpireFlags::EXPIRE_XX) {
@@ -900,6 +1337,7 @@ OpResult<DbSlice::AddOrFindResult> DbSlice::AddOrUpdateInternal(const Context& c
       auto exp_it = db.expire.InsertNew(it->first.AsRef(), ExpirePeriod(delta));
       res.exp_it = ExpIterator(exp_it, StringOrView::FromView(key));
     }
+    ScheduleExpiry(db, key, expire_at_ms);
   }
 
   return op_result;
@@ -1110,6 +1548,26 @@ uint64_t DbSlice::RegisterOnChange(ChangeCallback cb) {
   return ver;
 }
 
+pair<uint64_t, DbSlice::DeletedKeys> DbSlice::StartDeltaSnapshot(uint64_t snapshot_version) {
+  DCHECK_EQ(delta_pending_version_, 0u);
+  delta_pending_version_ = snapshot_version;
+  return {delta_base_version_, std::exchange(deleted_keys_, {})};
+}
+
+void DbSlice::FinishDeltaSnapshot(bool success) {
+  if (success) {
+    delta_base_version_ = delta_pending_version_;
+    delta_pending_version_ = 0;
+  } else {
+    ResetDeltaSnapshots();
+  }
+}
+
+void DbSlice::ResetDeltaSnapshots() {
+  delta_base_version_ = delta_pending_version_ = 0;
+  deleted_keys_.clear();
+}
+
 void DbSlice::FlushChangeToEarlierCallbacks(DbIndex db_ind, Iterator it, uint64_t upper_bound) {
   FiberAtomicGuard fg;
   uint64_t bucket_version = it.GetVersion();
@@ -1176,16 +1634,187 @@ auto DbSlice::DeleteExpiredStep(const Context& cntx, unsigned count) -> DeleteEx
     }
   }
 
-  // Send and clear accumulated expired key events
-  if (auto& events = db_arr_[cntx.db_index]->expired_keys_events_; !events.empty()) {
-    ChannelStore* store = ServerState::tlocal()->channel_store();
-    store->SendMessages(absl::StrCat("__keyevent@", cntx.db_index, "__:expired"), events);
-    events.clear();
-  }
+  return result;
+}
+
+auto DbSlice::DeleteExpiredFromWheel(const Context& cntx, unsigned limit) -> DeleteExpiredStats {
+  auto& db = *db_arr_[cntx.db_index];
+  DeleteExpiredStats result;
+  if (!db.expire_wheel || !expire_allowed_)
+    return result;
+
+  auto cb = [&](string_view key) -> uint64_t {
+    auto exp_it = db.expire.Find(key);
+    if (!IsValid(exp_it))  // The key was deleted or persisted since.
+      return 0;
+
+    result.traversed++;
+    if (uint64_t at = ExpireTime(exp_it); at > cntx.time_now_ms) {
+      // The expiry was extended in the meantime.
+      return at;
+    }
+
+    if (!CheckLock(IntentLock::EXCLUSIVE, cntx.db_index, key))
+      return cntx.time_now_ms + 1;
+
+    auto prime_it = db.prime.Find(key);
+    CHECK(!prime_it.is_done());
+    ExpireIfNeeded(cntx, prime_it);
+    ++result.deleted;
+    return 0;
+  };
+
+  db.expire_wheel->Advance(cntx.time_now_ms, limit, cb);
+  return result;
+}
+
+auto DbSlice::DeleteExpiredFromBuckets(const Context& cntx, unsigned limit)
+    -> DeleteExpiredStats {
+  auto& db = *db_arr_[cntx.db_index];
+  DeleteExpiredStats result;
+  if (!db.expire_buckets || !expire_allowed_)
+    return result;
+
+  string stash;
+  auto cb = [&](uint64_t cursor) {
+    bool locked = false;
+    db.expire.TraverseLogicalBucket(cursor, [&](ExpireIterator it) {
+      result.traversed++;
+      if (ExpireTime(it) > time_t(cntx.time_now_ms))
+        return;
+
+      auto key = it->first.GetSlice(&stash);
+      if (!CheckLock(IntentLock::EXCLUSIVE, cntx.db_index, key)) {
+        locked = true;
+        return;
+      }
+
+      auto prime_it = db.prime.Find(it->first);
+      CHECK(!prime_it.is_done());
+      ExpireIfNeeded(cntx, prime_it);
+      ++result.deleted;
+    });
+
+    // Revisit the bucket for the keys that are due but could not be deleted.
+    if (locked)
+      db.expire_buckets->Add(cntx.time_now_ms + ExpireBuckets::kSpanMs, cursor);
+  };
 
+  db.expire_buckets->PopDue(cntx.time_now_ms, limit, cb);
   return result;
 }
 
+uint64_t DbSlice::ExpireLagMs(uint64_t now_ms) const {
+  uint64_t res = 0;
+  for (const auto& db : db_arr_) {
+    if (db && db->expire_wheel)
+      res = std::max(res, db->expire_wheel->lag(now_ms));
+    if (db && db->expire_buckets)
+      res = std::max(res, db->expire_buckets->lag(now_ms));
+  }
+  return res;
+}
+
+size_t DbSlice::ExpireBacklog(DbIndex db_ind, uint64_t now_ms) const {
+  const auto& db = db_arr_[db_ind];
+  return db && db->expire_buckets ? db->expire_buckets->DueSize(now_ms) : 0;
+}
+
+void DbSlice::ScheduleFieldExpiry(DbIndex db_ind, string_view key, uint32_t next_expiry) {
+  auto& db = *db_arr_[db_ind];
+  if (db.field_expire_wheel && !owner_->IsReplica() && next_expiry != UINT32_MAX)
+    db.field_expire_wheel->Add(MemberTimeMs(next_expiry), {string{key}});
+}
+
+void DbSlice::DeleteExpiredFields(const Context& cntx, unsigned budget) {
+  auto& db = *db_arr_[cntx.db_index];
+  if (!db.field_expire_wheel || !expire_allowed_)
+    return;
+
+  const uint32_t now_sec = MemberTimeSeconds(cntx.time_now_ms);
+
+  auto cb = [&](uint64_t, DbTable::FieldExpiryTask&& task) {
+    auto it = db.prime.Find(task.key);
+    if (!IsValid(it) || it->second.Encoding() != kEncodingStrMap2)
+      return;
+
+    unsigned type = it->second.ObjType();
+    DenseSet* ds = nullptr;
+    if (type == OBJ_HASH)
+      ds = static_cast<StringMap*>(it->second.RObjPtr());
+    else if (type == OBJ_SET)
+      ds = static_cast<StringSet*>(it->second.RObjPtr());
+    else
+      return;
+
+    // A new pass starts only if it is due. Otherwise either the expiry changed since, which
+    // scheduled the key again, or another pass is in progress.
+    if (task.cursor == 0 && ds->NextExpiry() > now_sec)
+      return;
+
+    if (budget == 0 || !CheckLock(IntentLock::EXCLUSIVE, cntx.db_index, task.key)) {
+      db.field_expire_wheel->Add(cntx.time_now_ms + 1, std::move(task));
+      return;
+    }
+
+    Iterator db_it(it, StringOrView::FromView(task.key));
+    PreUpdate(cntx.db_index, db_it, task.key);
+    size_t orig_size = it->second.MallocUsed();
+    size_t orig_len = ds->UpperBoundSize();
+
+    ds->set_time(now_sec);
+    bool done = ds->DeleteExpiredStep(&task.cursor, &budget);
+
+    size_t reclaimed = orig_len - ds->UpperBoundSize();
+    if (type == OBJ_HASH)
+      events_.expired_hash_fields += reclaimed;
+    else
+      events_.expired_set_fields += reclaimed;
+
+    PostUpdate(cntx.db_index, db_it, task.key, orig_size);
+    if (ds->Empty()) {
+      // Same as with lazily expired fields, empty containers are deleted.
+      Del(cntx.db_index, db_it);
+      return;
+    }
+
+    if (!done) {
+      db.field_expire_wheel->Add(cntx.time_now_ms + 1, std::move(task));
+    } else if (ds->NextExpiry() != UINT32_MAX) {
+      db.field_expire_wheel->Add(MemberTimeMs(ds->NextExpiry()), {std::move(task.key)});
+    }
+  };
+
+  db.field_expire_wheel->Advance(cntx.time_now_ms, SIZE_MAX, cb);
+}
+
+void DbSlice::SendKeyspaceEvents() {
+  if (!expired_keys_events_recording_)
+    return;
+
+  ChannelStore* store = ServerState::tlocal()->channel_store();
+  for (DbIndex db_ind = 0; db_ind < db_arr_.size(); ++db_ind) {
+    if (!db_arr_[db_ind])
+      continue;
+
+    auto& events = db_arr_[db_ind]->expired_keys_events_;
+    if (events.empty())
+      continue;
+
+    string channel = absl::StrCat("__keyevent@", db_ind, "__:expired");
+    if (GetFlag(FLAGS_keyspace_events_compact)) {
+      string batch = absl::StrCat("*", events.size(), "\r\n");
+      for (const string& key : events)
+        absl::StrAppend(&batch, "$", key.size(), "\r\n", key, "\r\n");
+      string_view message = batch;
+      store->SendMessages(channel, ArgSlice{&message, 1});
+    } else {
+      store->SendMessages(channel, events);
+    }
+    events.clear();
+  }
+}
+
 int32_t DbSlice::GetNextSegmentForEviction(int32_t segment_id, DbIndex db_ind) const {
   // wraps around if we reached the end
   return db_arr_[db_ind]->prime.NextSeg((size_t)segment_id) %
@@ -1235,6 +1864,12 @@ void DbSlice::FreeMemWithEvictionStep(DbIndex db_ind, size_t increase_goal_bytes
           if (evict_it->first.IsSticky())
             continue;
 
+          // Spare the keys that were accessed since the last pass, but age them.
+          if (lfu_eviction_ && evict_it->first.Freq() > 0) {
+            DecayFreq(&evict_it->first);
+            continue;
+          }
+
           // check if the key is locked by looking up transaction table.
           const auto& lt = db_table->trans_locks;
           string_view key = evict_it->first.GetSlice(&tmp);
@@ -1277,10 +1912,52 @@ finish:
   DVLOG(2) << "Eviction time (us): " << (time_finish - time_start) / 1000;
 }
 
+void DbSlice::OnScanCursor() {
+  last_scan_cursor_ms_ = GetCurrentTimeMs();
+}
+
+void DbSlice::MergeSegmentsStep(DbIndex db_ind, double max_load, uint64_t budget_usec) {
+  if (!change_cb_.empty())
+    return;
+
+  // A client may still continue its scan, merging would move entries behind its cursor.
+  if (last_scan_cursor_ms_ && GetCurrentTimeMs() < last_scan_cursor_ms_ + kScanQuietMs)
+    return;
+
+  DbTable* db = db_arr_[db_ind].get();
+  uint64_t deadline = absl::GetCurrentTimeNanos() + budget_usec * 1000;
+
+  auto merge_table = [&](auto* table, uint32_t* cursor) {
+    uint64_t merged_before = table->segments_merged();
+
+    // At most one pass over the table per step.
+    for (unsigned visited = table->unique_segments(); visited > 0; --visited) {
+      if (*cursor >= table->GetSegmentCount())
+        *cursor = 0;
+      *cursor = table->NextSeg(table->Merge(*cursor, max_load));
+      if (absl::GetCurrentTimeNanos() > deadline)
+        break;
+    }
+    events_.segments_merged += table->segments_merged() - merged_before;
+  };
+
+  merge_table(&db->prime, &db->prime_merge_cursor);
+  merge_table(&db->expire, &db->expire_merge_cursor);
+}
+
 void DbSlice::CreateDb(DbIndex db_ind) {
   auto& db = db_arr_[db_ind];
   if (!db) {
-    db.reset(new DbTable{owner_->memory_resource(), db_ind});
+    db.reset(new DbTable{owner_->memory_resource(), db_ind, owner_->segment_memory_resource()});
+    if (GetFlag(FLAGS_expire_timer_wheel))
+      db->expire_wheel = make_unique<ExpireWheel>(GetCurrentTimeMs());
+    if (GetFlag(FLAGS_expire_time_buckets))
+      db->expire_buckets = make_unique<ExpireBuckets>();
+    if (GetFlag(FLAGS_field_expiry_index))
+      db->field_expire_wheel =
+          make_unique<TimerWheel<DbTable::FieldExpiryTask>>(GetCurrentTimeMs());
+    if (cluster::IsClusterEnabled() && GetFlag(FLAGS_cluster_slot_key_index))
+      db->slot_keys = make_unique<SlotKeyIndex>(owner_->memory_resource());
   }
 }
 
@@ -1445,6 +2122,12 @@ void DbSlice::ResetEvents() {
 }
 
 void DbSlice::SendInvalidationTrackingMessage(std::string_view key) {
+  if (!ServerState::tlocal()->BcastTracking().Empty())
+    QueueBcastInvalidation(key);
+
+  if (!hot_keys_.empty())
+    QueueHotKeyInvalidation(key);
+
   if (client_tracking_map_.empty())
     return;
 
@@ -1474,11 +2157,86 @@ void DbSlice::SendInvalidationTrackingMessage(std::string_view key) {
   client_tracking_map_.erase(key);
 }
 
+void DbSlice::QueueBcastInvalidation(std::string_view key) {
+  bcast_keys_.emplace_back(key);
+  if (bcast_keys_.size() > 1)
+    return;
+
+  // Keys modified until the end of this loop iteration are sent to the threads in one batch.
+  auto cb = [this] {
+    auto keys = make_shared<vector<string>>(std::move(bcast_keys_));
+    bcast_keys_.clear();
+    shard_set->pool()->DispatchBrief([keys](unsigned, util::ProactorBase*) {
+      ServerState::tlocal()->BcastTracking().Invalidate(*keys);
+    });
+  };
+  fb2::Fiber(fb2::Launch::post, "bcast_keys", std::move(cb)).Detach();
+}
+
+uint64_t DbSlice::ShareHotKey(string_view key) {
+  // Keys that stay hot without being written are never removed, so the set is renewed once full.
+  constexpr size_t kMaxHotKeys = 4096;
+  if (hot_keys_.size() >= kMaxHotKeys && !hot_keys_.contains(key))
+    InvalidateAllHotKeys();
+
+  hot_keys_.emplace(key);
+  return hot_keys_epoch_.load(memory_order_relaxed);
+}
+
+void DbSlice::QueueHotKeyInvalidation(string_view key) {
+  auto it = hot_keys_.find(key);
+  if (it == hot_keys_.end())
+    return;
+
+  // Values read from now on are read at the new epoch. Until the broadcast reaches them, the
+  // threads see an epoch they did not handle and stop serving the cached values of this shard.
+  hot_keys_.erase(it);
+  hot_keys_epoch_.fetch_add(1, memory_order_release);
+  hot_key_invalidations_.emplace_back(key);
+  if (hot_key_invalidations_.size() > 1)
+    return;
+
+  auto cb = [this] {
+    auto keys = make_shared<vector<string>>(std::move(hot_key_invalidations_));
+    hot_key_invalidations_.clear();
+    shard_set->pool()->DispatchBrief(
+        [keys, sid = shard_id(), epoch = hot_keys_epoch()](unsigned, util::ProactorBase*) {
+          ServerState::tlocal()->hot_key_cache().Invalidate(sid, epoch, *keys);
+        });
+  };
+  fb2::Fiber(fb2::Launch::post, "hot_keys_invalidate", std::move(cb)).Detach();
+}
+
+void DbSlice::InvalidateAllHotKeys() {
+  if (hot_keys_.empty())
+    return;
+
+  hot_keys_.clear();
+  hot_keys_epoch_.fetch_add(1, memory_order_release);
+  shard_set->pool()->DispatchBrief(
+      [sid = shard_id(), epoch = hot_keys_epoch()](unsigned, util::ProactorBase*) {
+        ServerState::tlocal()->hot_key_cache().InvalidateShard(sid, epoch);
+      });
+}
+
+void DbSlice::PinValue(string_view raw) {
+  DCHECK(!raw.empty());
+  ++pinned_values_[raw.data()].refs;
+}
+
+void DbSlice::UnpinValue(string_view raw) {
+  auto it = pinned_values_.find(raw.data());
+  DCHECK(it != pinned_values_.end());
+  if (--it->second.refs == 0)
+    pinned_values_.erase(it);  // frees the value if its key was deleted meanwhile
+}
+
 void DbSlice::PerformDeletion(PrimeIterator del_it, DbTable* table) {
   return PerformDeletion(Iterator::FromPrime(del_it), table);
 }
 
-void DbSlice::PerformDeletion(Iterator del_it, ExpIterator exp_it, DbTable* table) {
+void DbSlice::PerformDeletion(Iterator del_it, ExpIterator exp_it, DbTable* table,
+                              size_t lazy_free_min_elements, PrimeValue* detach_to) {
   if (!exp_it.is_done()) {
     table->expire.Erase(exp_it.GetInnerIt());
   }
@@ -1493,6 +2251,13 @@ void DbSlice::PerformDeletion(Iterator del_it, ExpIterator exp_it, DbTable* tabl
   DbTableStats& stats = table->stats;
   const PrimeValue& pv = del_it->second;
 
+  // Offloaded containers keep reporting their encoding until they are deleted from disk
+  if (pv.ObjType() == OBJ_HASH && pv.Encoding() == kEncodingListPack) {
+    --stats.listpack_blob_cnt;
+  } else if (pv.ObjType() == OBJ_ZSET && pv.Encoding() == OBJ_ENCODING_LISTPACK) {
+    --stats.listpack_blob_cnt;
+  }
+
   if (pv.IsExternal() && shard_owner()->tiered_storage()) {
     shard_owner()->tiered_storage()->Delete(table->index, &del_it->second);
   }
@@ -1502,29 +2267,44 @@ void DbSlice::PerformDeletion(Iterator del_it, ExpIterator exp_it, DbTable* tabl
   AccountObjectMemory(del_it.key(), del_it->first.ObjType(), -del_it->first.MallocUsed(),
                       table);                                                // Key
   AccountObjectMemory(del_it.key(), pv.ObjType(), -value_heap_size, table);  // Value
-  if (pv.ObjType() == OBJ_HASH && pv.Encoding() == kEncodingListPack) {
-    --stats.listpack_blob_cnt;
-  } else if (pv.ObjType() == OBJ_ZSET && pv.Encoding() == OBJ_ENCODING_LISTPACK) {
-    --stats.listpack_blob_cnt;
-  }
 
   if (cluster::IsClusterEnabled()) {
     cluster::SlotId sid = cluster::KeySlot(del_it.key());
     table->slots_stats[sid].key_count -= 1;
+    if (table->slot_keys)
+      table->slot_keys->Remove(sid, del_it.key());
   }
 
+  if (delta_base_version_ || delta_pending_version_) {
+    if (deleted_keys_.size() <= table->index)
+      deleted_keys_.resize(table->index + 1);
+    deleted_keys_[table->index].emplace(del_it.key());
+  }
+
+  auto pinned = pinned_values_.end();
+  if (!pinned_values_.empty() && !detach_to && !pv.GetRawString().empty())
+    pinned = pinned_values_.find(pv.GetRawString().data());
+
+  if (pinned != pinned_values_.end())
+    pinned->second.deleted = std::move(del_it->second);
+  else if (detach_to)
+    *detach_to = std::move(del_it->second);
+  else if (FreesLazily(del_it->second, lazy_free_min_elements))
+    lazy_free_.Push(&del_it->second);
+
   table->prime.Erase(del_it.GetInnerIt());
   SendInvalidationTrackingMessage(del_it.key());
 }
 
-void DbSlice::PerformDeletion(Iterator del_it, DbTable* table) {
+void DbSlice::PerformDeletion(Iterator del_it, DbTable* table, size_t lazy_free_min_elements,
+                              PrimeValue* detach_to) {
   ExpIterator exp_it;
   if (del_it->second.HasExpire()) {
     exp_it = ExpIterator::FromPrime(table->expire.Find(del_it->first));
     DCHECK(!exp_it.is_done());
   }
 
-  PerformDeletion(del_it, exp_it, table);
+  PerformDeletion(del_it, exp_it, table, lazy_free_min_elements, detach_to);
 }
 
 void DbSlice::OnCbFinish() {
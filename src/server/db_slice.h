@@ -4,6 +4,10 @@
 
 #pragma once
 
+#include <absl/container/flat_hash_map.h>
+#include <absl/container/inlined_vector.h>
+
+#include "core/lazy_free.h"
 #include "core/mi_memory_resource.h"
 #include "core/string_or_view.h"
 #include "facade/dragonfly_connection.h"
@@ -31,6 +35,9 @@ struct DbStats : public DbTableStats {
   // Memory used by dictionaries.
   size_t table_mem_usage = 0;
 
+  // Memory used by DbTable::expire_wheel.
+  size_t expire_wheel_mem_usage = 0;
+
   using DbTableStats::operator+=;
   using DbTableStats::operator=;
 
@@ -64,9 +71,42 @@ struct SliceEvents {
   // how many updates and insertions of keys between snapshot intervals
   size_t update = 0;
 
+  // how many dash table segments were merged with their buddies after deletions.
+  size_t segments_merged = 0;
+
+  // fields with ttl reclaimed by DeleteExpiredFields.
+  size_t expired_hash_fields = 0;
+  size_t expired_set_fields = 0;
+
+  // lookups that reused an iterator of KeyPrefetch.
+  size_t prefetch_hits = 0;
+
   SliceEvents& operator+=(const SliceEvents& o);
 };
 
+// Iterators of the declared keys of an armed script, looked up once per shard when the script is
+// scheduled and reused by the commands it calls, see DbSlice::PrefetchKeys. The iterators are
+// just hints: they are used only with the table they were taken from and only while they still
+// point at their key, otherwise the key is looked up again.
+struct KeyPrefetch {
+  // Larger scripts are not prefetched, since the linear search would cost more than a lookup.
+  static constexpr size_t kMaxKeys = 16;
+
+  boost::intrusive_ptr<DbTable> table;  // keeps the table of the iterators alive
+  absl::InlinedVector<std::pair<std::string_view, PrimeIterator>, 4> entries;
+
+  // Returns the stored iterator of key if it was prefetched from db, nullptr otherwise.
+  PrimeIterator* Get(const DbTable* db, std::string_view key) {
+    if (db != table.get())
+      return nullptr;
+    for (auto& [k, it] : entries) {
+      if (k == key)
+        return &it;
+    }
+    return nullptr;
+  }
+};
+
 class DbSlice {
   DbSlice(const DbSlice&) = delete;
   void operator=(const DbSlice&) = delete;
@@ -179,6 +219,12 @@ class DbSlice {
     std::vector<DbStats> db_stats;
     SliceEvents events;
     size_t small_string_bytes = 0;
+    size_t key_prefix_bytes = 0;
+    size_t compression_saved_bytes = 0;
+    size_t shared_value_bytes = 0;
+    size_t dedup_saved_bytes = 0;
+    size_t lazyfree_pending_bytes = 0;
+    size_t lazyfree_pending_objects = 0;
   };
 
   using Context = DbContext;
@@ -222,8 +268,9 @@ class DbSlice {
   DbSlice(uint32_t index, bool caching_mode, EngineShard* owner);
   ~DbSlice();
 
-  // Activates `db_ind` database if it does not exist (see ActivateDb below).
-  void Reserve(DbIndex db_ind, size_t key_size);
+  // Activates `db_ind` database if it does not exist (see ActivateDb below) and pre-sizes its
+  // prime and expire tables.
+  void Reserve(DbIndex db_ind, size_t key_size, size_t expire_size = 0);
 
   // Returns statistics for the whole db slice. A bit heavy operation.
   Stats GetStats() const;
@@ -231,6 +278,13 @@ class DbSlice {
   // Returns slot statistics for db 0.
   SlotStats GetSlotStats(cluster::SlotId sid) const;
 
+  // Returns the decayed load of a slot of db 0, see UpdateSlotLoad.
+  const SlotLoad& GetSlotLoad(cluster::SlotId sid) const;
+
+  // Updates the decayed rates of the operations and of the written bytes of every slot from
+  // slots_stats, at most once a second. Called by the heartbeat in cluster mode.
+  void UpdateSlotLoad(uint64_t now_ms);
+
   void UpdateExpireBase(uint64_t now, unsigned generation) {
     expire_base_[generation & 1] = now;
   }
@@ -246,6 +300,10 @@ class DbSlice {
     return memory_budget_;
   }
 
+  const SliceEvents& events() const {
+    return events_;
+  }
+
   size_t bytes_per_object() const {
     return bytes_per_object_;
   }
@@ -286,6 +344,22 @@ class DbSlice {
   OpResult<ConstIterator> FindReadOnly(const Context& cntx, std::string_view key,
                                        unsigned req_obj_type) const;
 
+  // Like FindReadOnly, but an offloaded container is loaded back to memory only if
+  // TieredStorage::ShouldLoad allows it. Otherwise it stays offloaded for the caller to look up
+  // the few elements it needs in a copy read by TieredStorage::ReadContainer.
+  OpResult<ConstIterator> FindReadOnlyOffloaded(const Context& cntx, std::string_view key,
+                                                unsigned req_obj_type) const;
+
+  // Looks up the keys of db_ind in a single pass and returns their iterators for reuse by the
+  // following lookups that pass it in Context::prefetch. Returns nullptr if there are too many
+  // keys. The result must be destroyed on the shard thread.
+  std::unique_ptr<KeyPrefetch> PrefetchKeys(DbIndex db_ind, const ShardArgs& keys);
+
+  // Batched version of FindReadOnly. Looks up all the keys in a single pass over the table
+  // in order to overlap the cache misses of the lookups. res must have keys.size() entries.
+  void FindReadOnly(const Context& cntx, absl::Span<const std::string_view> keys,
+                    unsigned req_obj_type, absl::Span<OpResult<ConstIterator>> res) const;
+
   struct AddOrFindResult {
     Iterator it;
     ExpIterator exp_it;
@@ -307,6 +381,13 @@ class DbSlice {
   OpResult<ItAndUpdater> AddNew(const Context& cntx, std::string_view key, PrimeValue obj,
                                 uint64_t expire_at_ms);
 
+  // Bulk insertion path for loading snapshots, behaves like AddOrUpdate otherwise.
+  // Inserts with a single table probe and skips bump-ups, versioning and the update hooks,
+  // which is correct only while loading when no snapshot, watch or client tracking is active.
+  // Returns whether the key was new.
+  OpResult<bool> AddOrUpdateForLoad(const Context& cntx, std::string_view key, PrimeValue obj,
+                                    uint64_t expire_at_ms, bool sticky);
+
   // Update entry expiration. Return epxiration timepoint in abs milliseconds, or -1 if the entry
   // already expired and was deleted;
   facade::OpResult<int64_t> UpdateExpire(const Context& cntx, Iterator prime_it, ExpIterator exp_it,
@@ -315,6 +396,9 @@ class DbSlice {
   // Adds expiry information.
   void AddExpire(DbIndex db_ind, Iterator main_it, uint64_t at);
 
+  // Changes existing expiry information to the absolute time at.
+  void SetExpireTime(DbIndex db_ind, const ExpIterator& exp_it, uint64_t at);
+
   // Removes the corresponing expiry information if exists.
   // Returns true if expiry existed (and removed).
   bool RemoveExpire(DbIndex db_ind, Iterator main_it);
@@ -329,7 +413,29 @@ class DbSlice {
   // Creates a database with index `db_ind`. If such database exists does nothing.
   void ActivateDb(DbIndex db_ind);
 
-  bool Del(DbIndex db_ind, Iterator it);
+  // Values with at least lazy_free_min_elements elements are detached and freed in the
+  // background by LazyFreeStep, 0 frees them inline. If detach_to is set, the value is moved
+  // there instead of being freed.
+  bool Del(DbIndex db_ind, Iterator it, size_t lazy_free_min_elements = 0,
+           PrimeValue* detach_to = nullptr);
+
+  // Keeps the heap blob raw of a string value, see CompactObj::GetRawString, alive until the
+  // matching UnpinValue. Deleting a key whose value is pinned, e.g. by lazy expiry of another
+  // reader or by eviction, which do not respect key locks, moves the value aside instead of
+  // freeing it. Pins nest.
+  void PinValue(std::string_view raw);
+  void UnpinValue(std::string_view raw);
+
+  // Containers smaller than this are cheap enough to free inline.
+  static constexpr size_t kLazyFreeMinElements = 64;
+
+  // Frees the values detached by Del and FlushDb for a time slice, see lazyfree_slice_usec.
+  // Returns true if some are left.
+  bool LazyFreeStep();
+
+  const LazyFreeQueue& lazy_free_queue() const {
+    return lazy_free_;
+  }
 
   constexpr static DbIndex kDbAll = 0xFFFF;
 
@@ -416,6 +522,26 @@ class DbSlice {
   //! Unregisters the callback.
   void UnregisterOnChange(uint64_t id);
 
+  // Keys deleted since the last snapshot, per database index.
+  using DeletedKeys = std::vector<absl::flat_hash_set<std::string>>;
+
+  // Delta snapshots save only the buckets that changed since their base snapshot and the keys
+  // deleted since then. Called when a snapshot that can serve as a base starts with
+  // snapshot_version. Returns the version of the current base (0 if there is none) and the keys
+  // deleted since it, and starts tracking deletions relative to the new snapshot.
+  std::pair<uint64_t, DeletedKeys> StartDeltaSnapshot(uint64_t snapshot_version);
+
+  // Makes the snapshot started by StartDeltaSnapshot the base of the next delta if it succeeded.
+  // Otherwise the deleted keys are lost and the next snapshot can not be a delta.
+  void FinishDeltaSnapshot(bool success);
+
+  // Drops the delta base, for example when the data is replaced.
+  void ResetDeltaSnapshots();
+
+  uint64_t delta_base_version() const {
+    return delta_base_version_;
+  }
+
   struct DeleteExpiredStats {
     uint32_t deleted = 0;         // number of deleted items due to expiry (less than traversed).
     uint32_t traversed = 0;       // number of traversed items that have ttl bit
@@ -424,7 +550,45 @@ class DbSlice {
 
   // Deletes some amount of possible expired items.
   DeleteExpiredStats DeleteExpiredStep(const Context& cntx, unsigned count);
+
+  // Deletes up to limit keys that are due according to DbTable::expire_wheel, if it is enabled.
+  DeleteExpiredStats DeleteExpiredFromWheel(const Context& cntx, unsigned limit);
+
+  // Visits up to limit expire table buckets with keys that are due according to
+  // DbTable::expire_buckets, if it is enabled, and deletes their expired keys.
+  DeleteExpiredStats DeleteExpiredFromBuckets(const Context& cntx, unsigned limit);
+
+  // For how long the due keys have been waiting for DeleteExpiredFromWheel or
+  // DeleteExpiredFromBuckets, max over all dbs.
+  uint64_t ExpireLagMs(uint64_t now_ms) const;
+
+  // Number of expire table buckets with due keys that DeleteExpiredFromBuckets did not visit yet.
+  size_t ExpireBacklog(DbIndex db_ind, uint64_t now_ms) const;
+
+  // Should be called after adding fields with ttl to the hash or set at key, if that decreased
+  // its DenseSet::NextExpiry, i.e. the member time at which its earliest field expires.
+  void ScheduleFieldExpiry(DbIndex db_ind, std::string_view key, uint32_t next_expiry);
+
+  // Reclaims the expired fields of the hashes and sets that are due according to
+  // DbTable::field_expire_wheel, if it is enabled. Visits at most budget buckets of them.
+  void DeleteExpiredFields(const Context& cntx, unsigned budget);
   void FreeMemWithEvictionStep(DbIndex db_indx, size_t increase_goal_bytes);
+
+  // Publishes the keyspace events recorded since the last call, a batch per db. Called once per
+  // heartbeat, so that each batch reaches the subscriber threads in a single dispatch.
+  void SendKeyspaceEvents();
+
+  // Merges underutilized buddy segments of the prime and expire tables, running for at most
+  // budget_usec. Merging moves entries between segments and shrinks the directory, so cursors
+  // taken before a merge may skip entries. It does nothing while snapshots, journal streamers
+  // or slot migrations, which all register change callbacks, traverse the tables, and for
+  // kScanQuietMs after SCAN handed out a cursor to continue from.
+  void MergeSegmentsStep(DbIndex db_ind, double max_load, uint64_t budget_usec);
+
+  static constexpr uint64_t kScanQuietMs = 60000;
+
+  // Called by SCAN when it returns a cursor to continue from.
+  void OnScanCursor();
   void ScheduleForOffloadStep(DbIndex db_indx, size_t increase_goal_bytes);
 
   int32_t GetNextSegmentForEviction(int32_t segment_id, DbIndex db_ind) const;
@@ -465,8 +629,19 @@ class DbSlice {
     client_tracking_map_[key].insert(conn_ref);
   }
 
+  // Marks key as cached by coordinator threads, which are sent its invalidation once it
+  // changes, and returns the invalidation epoch its value is read at, see HotKeyCache.
+  uint64_t ShareHotKey(std::string_view key);
+
+  // The latest invalidation epoch, bumped before the write that changed a cached key replies.
+  // Read by coordinator threads to reject cached values of invalidations they did not handle.
+  uint64_t hot_keys_epoch() const {
+    return hot_keys_epoch_.load(std::memory_order_acquire);
+  }
+
   // Delete a key referred by its iterator.
-  void PerformDeletion(Iterator del_it, DbTable* table);
+  void PerformDeletion(Iterator del_it, DbTable* table, size_t lazy_free_min_elements = 0,
+                       PrimeValue* detach_to = nullptr);
   void PerformDeletion(PrimeIterator del_it, DbTable* table);
 
   void LockChangeCb() const {
@@ -477,6 +652,23 @@ class DbSlice {
     return cb_mu_.unlock_shared();
   }
 
+  // Taken by a snapshot while it saves a big value in parts and preempts in between. Blocks the
+  // transactions of the shard, the background tasks that modify the tables check
+  // IsLockedForSerialization and skip their step or wait.
+  void LockForSerialization() {
+    cb_mu_.lock();
+    ++serialization_locks_;
+  }
+
+  void UnlockForSerialization() {
+    --serialization_locks_;
+    cb_mu_.unlock();
+  }
+
+  bool IsLockedForSerialization() const {
+    return serialization_locks_ > 0;
+  }
+
  private:
   void PreUpdate(DbIndex db_ind, Iterator it, std::string_view key);
   void PostUpdate(DbIndex db_ind, Iterator it, std::string_view key, size_t orig_size);
@@ -499,12 +691,25 @@ class DbSlice {
   void ClearEntriesOnFlush(absl::Span<const DbIndex> indices, const DbTableArray& db_arr,
                            bool async);
 
-  void PerformDeletion(Iterator del_it, ExpIterator exp_it, DbTable* table);
+  void PerformDeletion(Iterator del_it, ExpIterator exp_it, DbTable* table,
+                       size_t lazy_free_min_elements = 0, PrimeValue* detach_to = nullptr);
+
+  // Empties a flushed table in time slices, handing its large values to lazy_free_.
+  void ClearFlushedTable(DbTable* table);
 
   // Send invalidation message to the clients that are tracking the change to a key.
   void SendInvalidationTrackingMessage(std::string_view key);
 
+  // Collects the key for the BCAST tracking clients of all threads.
+  void QueueBcastInvalidation(std::string_view key);
+  void QueueHotKeyInvalidation(std::string_view key);
+  void InvalidateAllHotKeys();
+
   void CreateDb(DbIndex index);
+
+  // Adds key to the expire_wheel of db, if it has one.
+  void ScheduleExpiry(DbTable& db, std::string_view key, uint64_t at);
+
   size_t EvictObjects(size_t memory_to_free, Iterator it, DbTable* table);
 
   enum class UpdateStatsMode {
@@ -521,9 +726,17 @@ class DbSlice {
 
   OpResult<AddOrFindResult> AddOrFindInternal(const Context& cntx, std::string_view key);
 
+  // If keep_offloaded is set, offloaded containers are loaded only if TieredStorage::ShouldLoad.
   OpResult<PrimeItAndExp> FindInternal(const Context& cntx, std::string_view key,
                                        std::optional<unsigned> req_obj_type,
-                                       UpdateStatsMode stats_mode) const;
+                                       UpdateStatsMode stats_mode,
+                                       bool keep_offloaded = false) const;
+
+  // Continues FindInternal for the key that has been looked up already and located at it.
+  OpResult<PrimeItAndExp> FindInternal(const Context& cntx, std::string_view key, PrimeIterator it,
+                                       std::optional<unsigned> req_obj_type,
+                                       UpdateStatsMode stats_mode,
+                                       bool keep_offloaded = false) const;
   OpResult<ItAndUpdater> FindMutableInternal(const Context& cntx, std::string_view key,
                                              std::optional<unsigned> req_obj_type);
 
@@ -536,6 +749,7 @@ class DbSlice {
  private:
   ShardId shard_id_;
   uint8_t caching_mode_ : 1;
+  uint8_t lfu_eviction_ : 1;  // see FLAGS_cache_eviction_policy
 
   EngineShard* owner_;
 
@@ -543,6 +757,11 @@ class DbSlice {
   bool expire_allowed_ = true;
 
   uint64_t version_ = 1;  // Used to version entries in the PrimeTable.
+
+  // Delta snapshots state, see StartDeltaSnapshot.
+  uint64_t delta_base_version_ = 0;
+  uint64_t delta_pending_version_ = 0;
+  DeletedKeys deleted_keys_;  // tracked while there is a base or a pending base
   ssize_t memory_budget_ = SSIZE_MAX;
   size_t bytes_per_object_ = 0;
   size_t soft_budget_limit_ = 0;
@@ -560,6 +779,7 @@ class DbSlice {
   // journaling. LockChangeCb is called before the callback, and UnlockChangeCb is called after
   // journaling is completed. Register to bucket and journal changes is also does without preemption
   mutable util::fb2::SharedMutex cb_mu_;
+  unsigned serialization_locks_ = 0;  // cb_mu_ is held exclusively by LockForSerialization
   // ordered from the smallest to largest version.
   std::vector<std::pair<uint64_t, ChangeCallback>> change_cb_;
 
@@ -597,6 +817,22 @@ class DbSlice {
                       absl::container_internal::hash_default_hash<std::string>,
                       absl::container_internal::hash_default_eq<std::string>, AllocatorType>
       client_tracking_map_;
+
+  std::vector<std::string> bcast_keys_;  // modified keys waiting for QueueBcastInvalidation
+
+  // Keys cached by coordinator threads, their changes are broadcast as invalidations.
+  absl::flat_hash_set<std::string> hot_keys_;
+  std::vector<std::string> hot_key_invalidations_;  // waiting for QueueHotKeyInvalidation
+  std::atomic<uint64_t> hot_keys_epoch_{0};
+
+  LazyFreeQueue lazy_free_;
+  uint64_t last_scan_cursor_ms_ = 0;
+
+  struct PinnedValue {
+    unsigned refs = 0;
+    PrimeValue deleted;  // the value of the key if it was deleted while pinned
+  };
+  absl::flat_hash_map<const char*, PinnedValue> pinned_values_;
 };
 
 inline bool IsValid(const DbSlice::Iterator& it) {
@@ -18,6 +18,7 @@ extern "C" {
 #include "base/logging.h"
 #include "core/string_map.h"
 #include "server/blocking_controller.h"
+#include "server/cmd_profiler.h"
 #include "server/container_utils.h"
 #include "server/engine_shard_set.h"
 #include "server/error.h"
@@ -403,6 +404,10 @@ void DebugCmd::Run(CmdArgList args) {
         "TRAFFIC <path> | [STOP]"
         "    Starts traffic logging to the specified path. If path is not specified,"
         "    traffic logging is stopped.",
+        "PROFILE START [HZ <hz>] [STACKS] | STOP",
+        "    Starts sampling the CPU time of all threads <hz> times per second, 100 by default.",
+        "    STOP ends the profile and prints the share of the samples taken per command.",
+        "    With STACKS, the call stacks are sampled as well, see also the /profilez page.",
         "HELP",
         "    Prints this help.",
     };
@@ -462,6 +467,10 @@ void DebugCmd::Run(CmdArgList args) {
     return LogTraffic(args.subspan(1));
   }
 
+  if (subcmd == "PROFILE" && args.size() >= 2) {
+    return Profile(args.subspan(1));
+  }
+
   string reply = UnknownSubCmd(subcmd, "DEBUG");
   return cntx_->SendError(reply, kSyntaxErrType);
 }
@@ -469,6 +478,7 @@ void DebugCmd::Run(CmdArgList args) {
 void DebugCmd::Shutdown() {
   // disable traffic logging
   shard_set->pool()->AwaitFiberOnAll([](auto*) { facade::Connection::StopTrafficLogging(); });
+  CmdProfiler::Stop(shard_set->pool());
 }
 
 void DebugCmd::Reload(CmdArgList args) {
@@ -730,13 +740,14 @@ void DebugCmd::PopulateRangeFiber(uint64_t from, uint64_t num_of_keys,
     ++index;
 
     if (shard_batch.sz == 32) {
-      ess.Add(sid, [this, index, options, shard_batch] {
+      // The batch is too big to be stored by the shard queue.
+      ess.Add(sid, TaskQueue::Boxed([this, index, options, shard_batch] {
         DoPopulateBatch(options.type, options.prefix, options.val_size,
                         options.populate_random_values, options.elements, shard_batch, &sf_, cntx_);
         if (index % 50 == 0) {
           ThisFiber::Yield();
         }
-      });
+      }));
 
       // we capture shard_batch by value so we can override it here.
       shard_batch.sz = 0;
@@ -758,18 +769,30 @@ void DebugCmd::Exec() {
   EngineShardSet& ess = *shard_set;
   fb2::Mutex mu;
   std::map<string, unsigned> freq_cnt;
+  std::map<string, ServerState::ExecProfile> profiles;
 
   ess.pool()->AwaitFiberOnAll([&](auto*) {
+    unique_lock lk(mu);
     for (const auto& k_v : ServerState::tlocal()->exec_freq_count) {
-      unique_lock lk(mu);
       freq_cnt[k_v.first] += k_v.second;
     }
+    for (const auto& [shape, src] : ServerState::tlocal()->exec_profiles) {
+      auto& dest = profiles[shape];
+      dest.execs += src.execs;
+      dest.single_shard += src.single_shard;
+      dest.squashed += src.squashed;
+      dest.squashed_cmds += src.squashed_cmds;
+    }
   });
 
   string res;
   for (const auto& k_v : freq_cnt) {
     StrAppend(&res, k_v.second, ":", k_v.first, "\n");
   }
+  for (const auto& [shape, p] : profiles) {
+    StrAppend(&res, "PROFILE execs=", p.execs, " single_shard=", p.single_shard,
+              " squashed=", p.squashed, " squashed_cmds=", p.squashed_cmds, "\n", shape, "\n");
+  }
   auto* rb = static_cast<RedisReplyBuilder*>(cntx_->reply_builder());
   rb->SendVerbatimString(res);
 }
@@ -792,6 +815,55 @@ void DebugCmd::LogTraffic(CmdArgList args) {
   cntx_->SendOk();
 }
 
+void DebugCmd::Profile(CmdArgList args) {
+  string_view action = ArgS(args, 0);
+  if (action == "START") {
+    CmdProfiler::Options opts;
+    for (size_t i = 1; i < args.size(); ++i) {
+      string_view opt = ArgS(args, i);
+      if (opt == "HZ" && i + 1 < args.size()) {
+        if (!absl::SimpleAtoi(ArgS(args, ++i), &opts.hz) || opts.hz == 0 || opts.hz > 10000)
+          return cntx_->SendError(kInvalidIntErr);
+      } else if (opt == "STACKS") {
+        opts.stacks = true;
+      } else {
+        return cntx_->SendError(kSyntaxErr);
+      }
+    }
+
+    if (!CmdProfiler::Start(opts, shard_set->pool()))
+      return cntx_->SendError("Profile is already running");
+    return cntx_->SendOk();
+  }
+
+  if (action != "STOP")
+    return cntx_->SendError(UnknownSubCmd(action, "DEBUG PROFILE"));
+
+  optional<CmdProfiler::Result> result = CmdProfiler::Stop(shard_set->pool());
+  if (!result)
+    return cntx_->SendError("Profile is not running");
+
+  vector<pair<uint64_t, string_view>> commands;
+  uint64_t total = 0;
+  for (const auto& [cid, samples] : result->commands) {
+    commands.emplace_back(samples, cid ? cid->name() : "(other)"sv);
+    total += samples;
+  }
+  sort(commands.rbegin(), commands.rend());
+
+  string out;
+  absl::StrAppend(&out, "samples: ", total, "\n");
+  absl::StrAppend(&out, "period_usec: ", result->period_usec, "\n");
+  absl::StrAppend(&out, "dropped: ", result->dropped, "\n");
+  for (const auto& [samples, name] : commands) {
+    absl::StrAppend(&out, name, ": ", samples, " ");
+    absl::StrAppend(&out, absl::SixDigits(100.0 * samples / total), "%\n");
+  }
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx_->reply_builder());
+  rb->SendVerbatimString(out);
+}
+
 void DebugCmd::Inspect(string_view key, CmdArgList args) {
   EngineShardSet& ess = *shard_set;
   ShardId sid = Shard(key, ess.size());
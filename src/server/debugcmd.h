@@ -51,6 +51,7 @@ class DebugCmd {
   void Stacktrace();
   void Shards();
   void LogTraffic(CmdArgList);
+  void Profile(CmdArgList args);
 
   ServerFamily& sf_;
   ConnectionContext* cntx_;
@@ -7,8 +7,6 @@
 
 #include <absl/strings/match.h>
 
-#include <numeric>
-
 #include "base/flags.h"
 #include "base/logging.h"
 #include "server/detail/snapshot_storage.h"
@@ -103,7 +101,7 @@ GenericError ValidateFilename(const fs::path& filename, bool new_version) {
 }
 
 GenericError RdbSnapshot::Start(SaveMode save_mode, const std::string& path,
-                                const RdbSaver::GlobalData& glob_data) {
+                                const RdbSaver::GlobalData& glob_data, DeltaMode delta_mode) {
   VLOG(1) << "Saving RDB " << path;
 
   CHECK_NOTNULL(snapshot_storage_);
@@ -117,7 +115,7 @@ GenericError RdbSnapshot::Start(SaveMode save_mode, const std::string& path,
 
   is_linux_file_ = file_type & FileType::IO_URING;
   bool align_writes = (file_type & FileType::DIRECT) != 0;
-  saver_.reset(new RdbSaver(io_sink_.get(), save_mode, align_writes));
+  saver_.reset(new RdbSaver(io_sink_.get(), save_mode, align_writes, delta_mode));
 
   return saver_->SaveHeader(std::move(glob_data));
 }
@@ -185,6 +183,14 @@ SaveInfo SaveStagesController::Finalize() {
     shared_err_ = err;
   }
 
+  if (delta_mode_ != DeltaMode::NONE) {
+    bool success = !shared_err_;
+    shard_set->RunBriefInParallel(
+        [success](EngineShard* es) { es->db_slice().FinishDeltaSnapshot(success); });
+    if (success && delta_mode_ == DeltaMode::BASE)
+      RemoveStaleDeltas();
+  }
+
   return GetSaveInfo();
 }
 
@@ -225,11 +231,10 @@ RdbSaver::SnapshotStats SaveStagesController::GetCurrentSnapshotProgress() const
 
   if (use_dfs_format_) {
     shard_set->RunBriefInParallel([&](EngineShard* es) { fetch(es->shard_id()); });
-    RdbSaver::SnapshotStats init{0, 0};
-    return std::accumulate(
-        results.begin(), results.end(), init, [](auto init, auto pr) -> RdbSaver::SnapshotStats {
-          return {init.current_keys + pr.current_keys, init.total_keys + pr.total_keys};
-        });
+    RdbSaver::SnapshotStats total;
+    for (const auto& pr : results)
+      total += pr;
+    return total;
   }
   fetch(0);
   return results[0];
@@ -269,16 +274,26 @@ void SaveStagesController::SaveDfsSingle(EngineShard* shard) {
   auto& [snapshot, filename] = snapshots_[shard ? shard->shard_id() : shard_set->size()];
 
   SaveMode mode = shard == nullptr ? SaveMode::SUMMARY : SaveMode::SINGLE_SHARD;
-  auto glob_data = shard == nullptr ? RdbSaver::GetGlobalData(service_) : RdbSaver::GlobalData{};
+  auto glob_data = shard == nullptr ? GetGlobalData() : RdbSaver::GlobalData{};
+
+  // The base is dropped when the data is replaced, for example by FLUSHALL.
+  if (delta_mode_ == DeltaMode::DELTA && shard && shard->db_slice().delta_base_version() == 0) {
+    shared_err_ = GenericError{"base snapshot was invalidated, a full save is required"};
+    snapshot.reset();
+    return;
+  }
 
-  if (auto err = snapshot->Start(mode, filename, glob_data); err) {
+  if (auto err = snapshot->Start(mode, filename, glob_data, delta_mode_); err) {
     shared_err_ = err;
     snapshot.reset();
     return;
   }
 
-  if (mode == SaveMode::SINGLE_SHARD)
+  if (mode == SaveMode::SINGLE_SHARD) {
+    if (on_shard_cut_)
+      on_shard_cut_(shard);
     snapshot->StartInShard(shard);
+  }
 }
 
 // Save a single rdb file
@@ -291,14 +306,16 @@ void SaveStagesController::SaveRdb() {
   if (!is_cloud_)
     filename += ".tmp";
 
-  if (auto err = snapshot->Start(SaveMode::RDB, filename, RdbSaver::GetGlobalData(service_)); err) {
+  if (auto err = snapshot->Start(SaveMode::RDB, filename, GetGlobalData()); err) {
     snapshot.reset();
     return;
   }
 
-  auto cb = [snapshot = snapshot.get()](Transaction* t, EngineShard* shard) {
+  auto cb = [this, snapshot = snapshot.get()](Transaction* t, EngineShard* shard) {
     // a hack to avoid deadlock in Transaction::RunCallback(...)
     shard->db_slice().UnlockChangeCb();
+    if (on_shard_cut_)
+      on_shard_cut_(shard);
     snapshot->StartInShard(shard);
     shard->db_slice().LockChangeCb();
     return OpStatus::OK;
@@ -310,6 +327,13 @@ uint32_t SaveStagesController::GetCurrentSaveDuration() {
   return (absl::Now() - start_time_) / absl::Seconds(1);
 }
 
+RdbSaver::GlobalData SaveStagesController::GetGlobalData() const {
+  RdbSaver::GlobalData res = RdbSaver::GetGlobalData(service_);
+  res.master_id = master_id_;
+  res.master_lsns = master_lsns_;
+  return res;
+}
+
 SaveInfo SaveStagesController::GetSaveInfo() {
   SaveInfo info;
   info.save_time = absl::ToUnixSeconds(start_time_);
@@ -366,8 +390,29 @@ GenericError SaveStagesController::FinalizeFileMovement() {
   return GenericError(ec);
 }
 
+void SaveStagesController::RemoveStaleDeltas() {
+  fs::path dir = full_path_.parent_path().empty() ? fs::path{"."} : full_path_.parent_path();
+  string prefix = StrCat(full_path_.filename().string(), "-delta-");
+
+  error_code ec;
+  for (const auto& entry : fs::directory_iterator(dir, ec)) {
+    if (absl::StartsWith(entry.path().filename().string(), prefix)) {
+      fs::remove(entry.path(), ec);
+    }
+  }
+}
+
 // Build full path: get dir, try creating dirs, get filename with placeholder
 GenericError SaveStagesController::BuildFullPath() {
+  if (delta_mode_ == DeltaMode::DELTA) {
+    // Deltas are chained to their base: <base>-delta-0001-summary.dfs, <base>-delta-0001-0000.dfs
+    full_path_ = StrCat(delta_of_, "-delta-", absl::Dec(delta_seq_, absl::kZeroPad4));
+    is_cloud_ = IsCloudPath(full_path_.string());
+    if (is_cloud_ || !use_dfs_format_)
+      return {"delta snapshots are supported only for local dfs files"};
+    return {};
+  }
+
   fs::path dir_path = GetFlag(FLAGS_dir);
   if (!dir_path.empty()) {
     if (auto ec = CreateDirs(dir_path); ec)
@@ -386,6 +431,8 @@ GenericError SaveStagesController::BuildFullPath() {
   filename = absl::FormatTime(filename.string(), start_time_, absl::LocalTimeZone());
   full_path_ = dir_path / filename;
   is_cloud_ = IsCloudPath(full_path_.string());
+  if (is_cloud_)
+    delta_mode_ = DeltaMode::NONE;
   return {};
 }
 
@@ -6,6 +6,7 @@
 #pragma once
 
 #include <filesystem>
+#include <functional>
 
 #include "server/rdb_save.h"
 #include "util/fibers/fiberqueue_threadpool.h"
@@ -34,6 +35,15 @@ struct SaveStagesInputs {
   Service* service_;
   util::fb2::FiberQueueThreadPool* fq_threadpool_;
   std::shared_ptr<SnapshotStorage> snapshot_storage_;
+  DeltaMode delta_mode_ = DeltaMode::NONE;
+  std::string delta_of_;  // path of the base snapshot without the "-summary.dfs" suffix.
+  unsigned delta_seq_ = 0;
+
+  // Called in every shard thread right before its snapshot starts.
+  std::function<void(EngineShard*)> on_shard_cut_;
+  // Set when saving on a replica, see RdbSaver::GlobalData.
+  std::string master_id_;
+  std::vector<LSN> master_lsns_;
 };
 
 class RdbSnapshot {
@@ -42,7 +52,8 @@ class RdbSnapshot {
       : snapshot_storage_{snapshot_storage} {
   }
 
-  GenericError Start(SaveMode save_mode, const string& path, const RdbSaver::GlobalData& glob_data);
+  GenericError Start(SaveMode save_mode, const string& path, const RdbSaver::GlobalData& glob_data,
+                     DeltaMode delta_mode = DeltaMode::NONE);
   void StartInShard(EngineShard* shard);
 
   error_code SaveBody();
@@ -107,11 +118,16 @@ struct SaveStagesController : public SaveStagesInputs {
 
   SaveInfo GetSaveInfo();
 
+  RdbSaver::GlobalData GetGlobalData() const;
+
   void InitResources();
 
   // Remove .tmp extension or delete files in case of error
   GenericError FinalizeFileMovement();
 
+  // Delete the deltas chained to an older base with the same name once a new base is saved.
+  void RemoveStaleDeltas();
+
   // Build full path: get dir, try creating dirs, get filename with placeholder
   GenericError BuildFullPath();
 
@@ -3,28 +3,50 @@
 
 #include "server/detail/snapshot_storage.h"
 
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
 #include <absl/strings/str_replace.h>
 #include <absl/strings/strip.h>
 
 #ifdef WITH_AWS
 #include <aws/core/auth/AWSCredentialsProvider.h>
 #include <aws/s3/S3Client.h>
+#include <aws/s3/model/AbortMultipartUploadRequest.h>
+#include <aws/s3/model/CompleteMultipartUploadRequest.h>
+#include <aws/s3/model/CreateMultipartUploadRequest.h>
+#include <aws/s3/model/GetObjectRequest.h>
+#include <aws/s3/model/HeadObjectRequest.h>
 #include <aws/s3/model/ListObjectsV2Request.h>
 #include <aws/s3/model/PutObjectRequest.h>
+#include <aws/s3/model/UploadPartRequest.h>
+
+#include <sstream>
 
 #include "util/aws/aws.h"
 #include "util/aws/credentials_provider_chain.h"
 #include "util/aws/s3_endpoint_provider.h"
-#include "util/aws/s3_read_file.h"
-#include "util/aws/s3_write_file.h"
 #endif
 
 #include <regex>
 
+#include "base/flags.h"
 #include "base/logging.h"
 #include "io/file_util.h"
 #include "server/engine_shard_set.h"
 #include "util/fibers/fiber_file.h"
+#include "util/fibers/uring_proactor.h"
+
+ABSL_FLAG(uint32_t, snapshot_write_inflight, 4,
+          "Maximum number of asynchronous io_uring writes in flight per snapshot file. "
+          "0 writes synchronously.");
+
+ABSL_FLAG(uint32_t, s3_part_size_mb, 8,
+          "Size of the parts of multipart uploads and of the ranges of downloads of S3 snapshot "
+          "files, in MB. S3 requires at least 5MB.");
+ABSL_FLAG(uint32_t, s3_upload_inflight, 4,
+          "Maximum number of parts uploaded concurrently per S3 snapshot file.");
+ABSL_FLAG(uint32_t, s3_download_inflight, 4,
+          "Maximum number of ranges downloaded ahead concurrently per S3 snapshot file.");
 
 namespace dfly {
 namespace detail {
@@ -74,7 +96,8 @@ io::Result<std::pair<io::Sink*, uint8_t>, GenericError> FileSnapshotStorage::Ope
     if (kRdbWriteFlags & O_DIRECT) {
       file_type |= FileType::DIRECT;
     }
-    return std::pair(new LinuxWriteWrapper(res->release()), file_type);
+    unsigned max_inflight = absl::GetFlag(FLAGS_snapshot_write_inflight);
+    return std::pair(new LinuxWriteWrapper(res->release(), max_inflight), file_type);
 #else
     LOG(FATAL) << "Linux I/O is not supported on this platform";
 #endif
@@ -177,6 +200,39 @@ io::Result<std::vector<std::string>, GenericError> FileSnapshotStorage::LoadPath
   return paths;
 }
 
+io::Result<std::vector<std::string>, GenericError> FileSnapshotStorage::LoadChain(
+    const std::string& load_path) {
+  constexpr std::string_view kSummary = "-summary.dfs";
+  constexpr std::string_view kDelta = "-delta-";
+
+  std::string_view stem = load_path;
+  if (!absl::ConsumeSuffix(&stem, kSummary))
+    return std::vector<std::string>{load_path};
+
+  // Delta snapshots are named <base>-delta-NNNN-summary.dfs and numbered from 1.
+  size_t pos = stem.rfind(kDelta);
+  unsigned last = 0;
+  if (pos == std::string_view::npos || stem.size() - pos - kDelta.size() != 4 ||
+      !absl::SimpleAtoi(stem.substr(pos + kDelta.size()), &last) || last == 0) {
+    return std::vector<std::string>{load_path};
+  }
+
+  std::string_view base = stem.substr(0, pos);
+  std::vector<std::string> chain{absl::StrCat(base, kSummary)};
+  for (unsigned i = 1; i <= last; ++i)
+    chain.push_back(absl::StrCat(base, kDelta, absl::Dec(i, absl::kZeroPad4), kSummary));
+
+  for (const auto& path : chain) {
+    if (!fs::exists(path)) {
+      return nonstd::make_unexpected(
+          GenericError(std::make_error_code(std::errc::no_such_file_or_directory),
+                       absl::StrCat("Delta snapshot chain is broken, missing ", path)));
+    }
+  }
+
+  return chain;
+}
+
 #ifdef WITH_AWS
 AwsS3SnapshotStorage::AwsS3SnapshotStorage(const std::string& endpoint, bool https,
                                            bool ec2_metadata, bool sign_payload) {
@@ -210,12 +266,21 @@ io::Result<std::pair<io::Sink*, uint8_t>, GenericError> AwsS3SnapshotStorage::Op
       return nonstd::make_unexpected(GenericError("Invalid S3 path"));
     }
     auto [bucket, key] = *bucket_path;
-    io::Result<aws::S3WriteFile> file = aws::S3WriteFile::Open(bucket, key, s3_);
-    if (!file) {
-      return nonstd::make_unexpected(GenericError(file.error(), "Failed to open write file"));
+
+    Aws::S3::Model::CreateMultipartUploadRequest request;
+    request.SetBucket(bucket);
+    request.SetKey(key);
+    Aws::S3::Model::CreateMultipartUploadOutcome outcome = s3_->CreateMultipartUpload(request);
+    if (!outcome.IsSuccess()) {
+      return nonstd::make_unexpected(
+          GenericError(std::make_error_code(std::errc::io_error),
+                       "Failed to open write file: " + outcome.GetError().GetMessage()));
     }
 
-    aws::S3WriteFile* f = new aws::S3WriteFile(std::move(*file));
+    size_t part_size = size_t(std::max(absl::GetFlag(FLAGS_s3_part_size_mb), 5u)) << 20;
+    auto* f = new S3MultipartWriteFile(std::move(bucket), std::move(key),
+                                       outcome.GetResult().GetUploadId(), s3_, part_size,
+                                       std::max(absl::GetFlag(FLAGS_s3_upload_inflight), 1u));
     return std::pair<io::Sink*, uint8_t>(f, FileType::CLOUD);
   });
 }
@@ -226,7 +291,20 @@ io::ReadonlyFileOrError AwsS3SnapshotStorage::OpenReadFile(const std::string& pa
     return nonstd::make_unexpected(GenericError("Invalid S3 path"));
   }
   auto [bucket, key] = *bucket_path;
-  return new aws::S3ReadFile(bucket, key, s3_);
+
+  Aws::S3::Model::HeadObjectRequest request;
+  request.SetBucket(bucket);
+  request.SetKey(key);
+  Aws::S3::Model::HeadObjectOutcome outcome = s3_->HeadObject(request);
+  if (!outcome.IsSuccess()) {
+    LOG(ERROR) << "Failed to open " << path << ": " << outcome.GetError().GetMessage();
+    return nonstd::make_unexpected(std::make_error_code(std::errc::no_such_file_or_directory));
+  }
+
+  size_t part_size = size_t(std::max(absl::GetFlag(FLAGS_s3_part_size_mb), 1u)) << 20;
+  return new S3RangedReadFile(std::move(bucket), std::move(key),
+                              outcome.GetResult().GetContentLength(), s3_, part_size,
+                              std::max(absl::GetFlag(FLAGS_s3_download_inflight), 1u));
 }
 
 io::Result<std::string, GenericError> AwsS3SnapshotStorage::LoadPath(std::string_view dir,
@@ -380,10 +458,211 @@ AwsS3SnapshotStorage::ListObjects(std::string_view bucket_name, std::string_view
   } while (!continuation_token.empty());
   return keys;
 }
+
+S3MultipartWriteFile::S3MultipartWriteFile(std::string bucket, std::string key,
+                                           std::string upload_id,
+                                           std::shared_ptr<Aws::S3::S3Client> s3, size_t part_size,
+                                           unsigned max_inflight)
+    : io::WriteFile(key),
+      bucket_(std::move(bucket)),
+      key_(std::move(key)),
+      upload_id_(std::move(upload_id)),
+      s3_(std::move(s3)),
+      part_size_(part_size),
+      max_inflight_(max_inflight) {
+  buf_.reserve(part_size_);
+}
+
+S3MultipartWriteFile::~S3MultipartWriteFile() {
+  // The fibers of pending uploads reference this object.
+  inflight_ec_.await([this] { return inflight_ == 0; });
+}
+
+io::Result<size_t> S3MultipartWriteFile::WriteSome(const iovec* v, uint32_t len) {
+  if (async_ec_)
+    return nonstd::make_unexpected(async_ec_);
+
+  size_t total = 0;
+  for (uint32_t i = 0; i < len; ++i) {
+    buf_.append(static_cast<const char*>(v[i].iov_base), v[i].iov_len);
+    total += v[i].iov_len;
+  }
+
+  if (buf_.size() >= part_size_)
+    UploadPart();
+  return total;
+}
+
+std::error_code S3MultipartWriteFile::Close() {
+  // S3 requires at least one part, the last one can be smaller than the minimum part size.
+  if (!buf_.empty() || parts_.empty())
+    UploadPart();
+  inflight_ec_.await([this] { return inflight_ == 0; });
+
+  if (async_ec_) {
+    Aws::S3::Model::AbortMultipartUploadRequest request;
+    request.SetBucket(bucket_);
+    request.SetKey(key_);
+    request.SetUploadId(upload_id_);
+    s3_->AbortMultipartUpload(request);
+    return async_ec_;
+  }
+
+  Aws::S3::Model::CompletedMultipartUpload completed;
+  completed.SetParts(parts_);
+  Aws::S3::Model::CompleteMultipartUploadRequest request;
+  request.SetBucket(bucket_);
+  request.SetKey(key_);
+  request.SetUploadId(upload_id_);
+  request.SetMultipartUpload(std::move(completed));
+  Aws::S3::Model::CompleteMultipartUploadOutcome outcome = s3_->CompleteMultipartUpload(request);
+  if (!outcome.IsSuccess()) {
+    LOG(ERROR) << "Failed to complete upload of " << key_ << ": "
+               << outcome.GetError().GetMessage();
+    return std::make_error_code(std::errc::io_error);
+  }
+  return {};
+}
+
+void S3MultipartWriteFile::UploadPart() {
+  inflight_ec_.await([this] { return inflight_ < max_inflight_; });
+
+  // Part numbers start from 1, the parts are completed in this order.
+  int part_number = parts_.size() + 1;
+  parts_.emplace_back();
+  parts_.back().SetPartNumber(part_number);
+
+  size_t part_len = buf_.size();
+  auto body = std::make_shared<std::stringstream>(std::move(buf_));
+  buf_.clear();
+  buf_.reserve(part_size_);
+
+  inflight_++;
+  fb2::Fiber("s3_upload_part", [this, part_number, part_len, body = std::move(body)]() mutable {
+    Aws::S3::Model::UploadPartRequest request;
+    request.SetBucket(bucket_);
+    request.SetKey(key_);
+    request.SetUploadId(upload_id_);
+    request.SetPartNumber(part_number);
+    request.SetContentLength(part_len);
+    request.SetBody(std::move(body));
+
+    Aws::S3::Model::UploadPartOutcome outcome = s3_->UploadPart(request);
+    if (outcome.IsSuccess()) {
+      parts_[part_number - 1].SetETag(outcome.GetResult().GetETag());
+    } else if (!async_ec_) {
+      LOG(ERROR) << "Failed to upload part " << part_number << " of " << key_ << ": "
+                 << outcome.GetError().GetMessage();
+      async_ec_ = std::make_error_code(std::errc::io_error);
+    }
+    inflight_--;
+    inflight_ec_.notifyAll();
+  }).Detach();
+}
+
+S3RangedReadFile::S3RangedReadFile(std::string bucket, std::string key, size_t size,
+                                   std::shared_ptr<Aws::S3::S3Client> s3, size_t part_size,
+                                   unsigned max_inflight)
+    : bucket_(std::move(bucket)),
+      key_(std::move(key)),
+      size_(size),
+      s3_(std::move(s3)),
+      part_size_(part_size),
+      max_inflight_(max_inflight) {
+}
+
+S3RangedReadFile::~S3RangedReadFile() {
+  // The fibers of pending downloads reference this object.
+  inflight_ec_.await([this] { return inflight_ == 0; });
+}
+
+io::Result<size_t> S3RangedReadFile::Read(size_t offset, const iovec* v, uint32_t len) {
+  if (offset >= size_)
+    return 0;
+
+  // Drop the ranges before the offset. A read outside of the downloaded window restarts it.
+  while (!ranges_.empty() && ranges_.front()->offset + part_size_ <= offset)
+    ranges_.pop_front();
+  if (ranges_.empty() || ranges_.front()->offset > offset) {
+    ranges_.clear();
+    next_offset_ = offset - offset % part_size_;
+  }
+
+  FetchAhead();
+  std::shared_ptr<Range> range = ranges_.front();
+  inflight_ec_.await([&] { return range->ready; });
+  if (range->ec)
+    return nonstd::make_unexpected(range->ec);
+
+  size_t read = 0;
+  size_t pos = offset - range->offset;
+  for (uint32_t i = 0; i < len && pos < range->data.size(); ++i) {
+    size_t n = std::min(v[i].iov_len, range->data.size() - pos);
+    memcpy(v[i].iov_base, range->data.data() + pos, n);
+    pos += n;
+    read += n;
+  }
+  return read;
+}
+
+std::error_code S3RangedReadFile::Close() {
+  inflight_ec_.await([this] { return inflight_ == 0; });
+  ranges_.clear();
+  return {};
+}
+
+void S3RangedReadFile::FetchAhead() {
+  while (ranges_.size() < max_inflight_ && next_offset_ < size_) {
+    auto range = std::make_shared<Range>();
+    range->offset = next_offset_;
+    size_t range_len = std::min(part_size_, size_ - next_offset_);
+    next_offset_ += range_len;
+    ranges_.push_back(range);
+
+    inflight_++;
+    fb2::Fiber("s3_read_ahead", [this, range = std::move(range), range_len] {
+      Aws::S3::Model::GetObjectRequest request;
+      request.SetBucket(bucket_);
+      request.SetKey(key_);
+      request.SetRange(
+          absl::StrCat("bytes=", range->offset, "-", range->offset + range_len - 1));
+
+      Aws::S3::Model::GetObjectOutcome outcome = s3_->GetObject(request);
+      if (outcome.IsSuccess()) {
+        range->data.resize(range_len);
+        auto& body = outcome.GetResult().GetBody();
+        body.read(range->data.data(), range_len);
+        if (size_t(body.gcount()) != range_len)
+          range->ec = std::make_error_code(std::errc::io_error);  // short read
+      } else {
+        LOG(ERROR) << "Failed to download " << key_ << " at " << range->offset << ": "
+                   << outcome.GetError().GetMessage();
+        range->ec = std::make_error_code(std::errc::io_error);
+      }
+      range->ready = true;
+      inflight_--;
+      inflight_ec_.notifyAll();
+    }).Detach();
+  }
+}
 #endif
 
 #ifdef __linux__
+LinuxWriteWrapper::LinuxWriteWrapper(fb2::LinuxFile* lf, unsigned max_inflight)
+    : lf_(lf), max_inflight_(max_inflight) {
+}
+
+LinuxWriteWrapper::~LinuxWriteWrapper() {
+  // The callbacks of pending writes reference this object.
+  inflight_ec_.await([this] { return inflight_ == 0; });
+  for (io::MutableBytes buf : free_bufs_)
+    ::operator delete[](buf.data(), std::align_val_t(4096));
+}
+
 io::Result<size_t> LinuxWriteWrapper::WriteSome(const iovec* v, uint32_t len) {
+  if (max_inflight_ > 0 && ProactorBase::me()->GetKind() == ProactorBase::IOURING)
+    return WriteAsync(v, len);
+
   io::Result<size_t> res = lf_->WriteSome(v, len, offset_, 0);
   if (res) {
     offset_ += *res;
@@ -391,6 +670,79 @@ io::Result<size_t> LinuxWriteWrapper::WriteSome(const iovec* v, uint32_t len) {
 
   return res;
 }
+
+std::error_code LinuxWriteWrapper::Close() {
+  inflight_ec_.await([this] { return inflight_ == 0; });
+  std::error_code ec = lf_->Close();
+  return async_ec_ ? async_ec_ : ec;
+}
+
+io::Result<size_t> LinuxWriteWrapper::WriteAsync(const iovec* v, uint32_t len) {
+  inflight_ec_.await([this] { return inflight_ < max_inflight_; });
+  if (async_ec_)
+    return nonstd::make_unexpected(async_ec_);
+
+  size_t total = 0;
+  for (uint32_t i = 0; i < len; ++i)
+    total += v[i].iov_len;
+  if (total == 0)
+    return 0;
+
+  // Copying allows the caller to reuse its buffer while the write is in flight.
+  fb2::UringBuf buf = PrepareBuf(total);
+  uint8_t* next = buf.bytes.data();
+  for (uint32_t i = 0; i < len; ++i) {
+    memcpy(next, v[i].iov_base, v[i].iov_len);
+    next += v[i].iov_len;
+  }
+
+  auto io_cb = [this, buf, total](int io_res) {
+    if (io_res < 0) {
+      async_ec_ = std::error_code{-io_res, std::system_category()};
+    } else if (size_t(io_res) < total && !async_ec_) {
+      async_ec_ = std::make_error_code(std::errc::io_error);  // short write
+    }
+    ReturnBuf(buf);
+    inflight_--;
+    inflight_ec_.notifyAll();
+  };
+
+  io::Bytes data{buf.bytes.data(), total};
+  inflight_++;
+  if (buf.buf_idx)
+    lf_->WriteFixedAsync(data, offset_, *buf.buf_idx, std::move(io_cb));
+  else
+    lf_->WriteAsync(data, offset_, std::move(io_cb));
+  offset_ += total;
+
+  return total;
+}
+
+fb2::UringBuf LinuxWriteWrapper::PrepareBuf(size_t size) {
+  auto* up = static_cast<fb2::UringProactor*>(ProactorBase::me());
+  if (auto borrowed = up->RequestBuffer(size); borrowed)
+    return *borrowed;
+
+  // Writes are usually of the same size, so buffers of previous writes can be reused.
+  while (!free_bufs_.empty()) {
+    io::MutableBytes buf = free_bufs_.back();
+    free_bufs_.pop_back();
+    if (buf.size() >= size)
+      return fb2::UringBuf{buf, std::nullopt};
+    ::operator delete[](buf.data(), std::align_val_t(4096));
+  }
+
+  size_t capacity = (size + 4095) / 4096 * 4096;
+  uint8_t* ptr = new (std::align_val_t(4096)) uint8_t[capacity];
+  return fb2::UringBuf{{ptr, capacity}, std::nullopt};
+}
+
+void LinuxWriteWrapper::ReturnBuf(fb2::UringBuf buf) {
+  if (buf.buf_idx)
+    static_cast<fb2::UringProactor*>(ProactorBase::me())->ReturnBuffer(buf);
+  else
+    free_bufs_.push_back(buf.bytes);
+}
 #endif
 
 void SubstituteFilenamePlaceholders(fs::path* filename, const FilenameSubstitutions& fns) {
@@ -5,16 +5,20 @@
 
 #ifdef WITH_AWS
 #include <aws/s3/S3Client.h>
+#include <aws/s3/model/CompletedPart.h>
 #endif
 
+#include <deque>
 #include <filesystem>
 #include <string>
 #include <string_view>
 #include <utility>
 
+#include "io/file.h"
 #include "io/io.h"
 #include "server/common.h"
 #include "util/fibers/fiberqueue_threadpool.h"
+#include "util/fibers/synchronization.h"
 #include "util/fibers/uring_file.h"
 
 namespace dfly {
@@ -51,6 +55,13 @@ class SnapshotStorage {
   // Returns the snapshot paths given the RDB file or DFS summary file path.
   virtual io::Result<std::vector<std::string>, GenericError> LoadPaths(
       const std::string& load_path) = 0;
+
+  // Returns the summary files to load one after another, starting with the base snapshot,
+  // when load_path is a delta snapshot. Otherwise returns load_path only.
+  virtual io::Result<std::vector<std::string>, GenericError> LoadChain(
+      const std::string& load_path) {
+    return std::vector<std::string>{load_path};
+  }
 };
 
 class FileSnapshotStorage : public SnapshotStorage {
@@ -68,6 +79,9 @@ class FileSnapshotStorage : public SnapshotStorage {
   io::Result<std::vector<std::string>, GenericError> LoadPaths(
       const std::string& load_path) override;
 
+  io::Result<std::vector<std::string>, GenericError> LoadChain(
+      const std::string& load_path) override;
+
  private:
   util::fb2::FiberQueueThreadPool* fq_threadpool_;
 };
@@ -107,24 +121,113 @@ class AwsS3SnapshotStorage : public SnapshotStorage {
 
 // Returns bucket_name, obj_path for an s3 path.
 std::optional<std::pair<std::string, std::string>> GetBucketPath(std::string_view path);
+
+// Writes an S3 object with a multipart upload. Parts of part_size bytes are uploaded by
+// fibers of the calling thread, with at most max_inflight of them in flight. Errors of pending
+// uploads are reported by the following writes or by Close. All calls must be made from the same
+// proactor thread.
+class S3MultipartWriteFile : public io::WriteFile {
+ public:
+  S3MultipartWriteFile(std::string bucket, std::string key, std::string upload_id,
+                       std::shared_ptr<Aws::S3::S3Client> s3, size_t part_size,
+                       unsigned max_inflight);
+  ~S3MultipartWriteFile();
+
+  io::Result<size_t> WriteSome(const iovec* v, uint32_t len) final;
+
+  // Uploads the remaining data and completes the upload, or aborts it on error.
+  std::error_code Close() final;
+
+ private:
+  void UploadPart();
+
+  std::string bucket_, key_, upload_id_;
+  std::shared_ptr<Aws::S3::S3Client> s3_;
+  const size_t part_size_;
+  const unsigned max_inflight_;
+
+  std::string buf_;  // data of the next part
+  std::vector<Aws::S3::Model::CompletedPart> parts_;
+  unsigned inflight_ = 0;
+  std::error_code async_ec_;  // first error of a part upload
+  util::fb2::EventCount inflight_ec_;
+};
+
+// Reads an S3 object with ranged GETs. Sequential reads are served from up to max_inflight
+// ranges of part_size bytes that are downloaded ahead by fibers of the calling thread. All calls
+// must be made from the same proactor thread.
+class S3RangedReadFile : public io::ReadonlyFile {
+ public:
+  S3RangedReadFile(std::string bucket, std::string key, size_t size,
+                   std::shared_ptr<Aws::S3::S3Client> s3, size_t part_size, unsigned max_inflight);
+  ~S3RangedReadFile();
+
+  io::Result<size_t> Read(size_t offset, const iovec* v, uint32_t len) final;
+
+  std::error_code Close() final;
+
+  size_t Size() const final {
+    return size_;
+  }
+
+  int Handle() const final {
+    return -1;
+  }
+
+ private:
+  struct Range {
+    size_t offset;
+    std::string data;
+    bool ready = false;
+    std::error_code ec;
+  };
+
+  // Starts downloading the ranges that follow the last one, up to max_inflight_ ranges ahead.
+  void FetchAhead();
+
+  std::string bucket_, key_;
+  size_t size_;
+  std::shared_ptr<Aws::S3::S3Client> s3_;
+  const size_t part_size_;
+  const unsigned max_inflight_;
+
+  std::deque<std::shared_ptr<Range>> ranges_;  // ordered by offset, contiguous
+  size_t next_offset_ = 0;                     // offset of the next range to fetch
+  unsigned inflight_ = 0;
+  util::fb2::EventCount inflight_ec_;
+};
 #endif
 
 #ifdef __linux__
 // takes ownership over the file.
+// If max_inflight is positive, the data is copied into page aligned buffers and submitted as
+// asynchronous io_uring writes, with at most max_inflight writes pending. Registered buffers are
+// used when the proactor has them. Errors of pending writes are reported by the following
+// writes or by Close. All calls must be made from the same proactor thread.
 class LinuxWriteWrapper : public io::Sink {
  public:
-  LinuxWriteWrapper(util::fb2::LinuxFile* lf) : lf_(lf) {
-  }
+  LinuxWriteWrapper(util::fb2::LinuxFile* lf, unsigned max_inflight = 0);
+  ~LinuxWriteWrapper();
 
   io::Result<size_t> WriteSome(const iovec* v, uint32_t len) final;
 
-  std::error_code Close() {
-    return lf_->Close();
-  }
+  // Waits for the pending writes and closes the file.
+  std::error_code Close();
 
  private:
+  io::Result<size_t> WriteAsync(const iovec* v, uint32_t len);
+
+  util::fb2::UringBuf PrepareBuf(size_t size);
+  void ReturnBuf(util::fb2::UringBuf buf);
+
   std::unique_ptr<util::fb2::LinuxFile> lf_;
   off_t offset_ = 0;
+
+  const unsigned max_inflight_;
+  unsigned inflight_ = 0;
+  std::error_code async_ec_;                 // first error of an asynchronous write
+  std::vector<io::MutableBytes> free_bufs_;  // page aligned buffers for reuse
+  util::fb2::EventCount inflight_ec_;
 };
 #endif
 
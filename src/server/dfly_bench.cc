@@ -2,24 +2,35 @@
 // See LICENSE for licensing terms.
 //
 
+#include <absl/base/internal/endian.h>
+#include <absl/container/flat_hash_map.h>
 #include <absl/random/random.h>
+#include <absl/strings/match.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_format.h>
 #include <absl/strings/str_split.h>
 
+#include <algorithm>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
 #include <queue>
 
 #include "absl/time/clock.h"
 #include "absl/time/time.h"
-#include "base/histogram.h"
 #include "base/init.h"
 #include "base/zipf_gen.h"
 #include "facade/redis_parser.h"
 #include "io/io_buf.h"
 #include "util/fibers/dns_resolve.h"
 #include "util/fibers/pool.h"
+#include "util/fibers/synchronization.h"
 #include "util/fibers/uring_socket.h"
 
+extern "C" {
+#include "redis/crc16.h"
+}
+
 // A load-test for DragonflyDB that fixes coordinated omission problem.
 
 using std::string;
@@ -38,7 +49,38 @@ ABSL_FLAG(uint64_t, key_stddev, 0,
           "Standard deviation for non-uniform distribution, 0 chooses"
           " a default value of (max-min)/6");
 ABSL_FLAG(string, ratio, "1:10", "Set:Get ratio");
-ABSL_FLAG(string, command, "", "custom command with __key__ placeholder for keys");
+ABSL_FLAG(string, command, "",
+          "custom command with __key__ placeholder for keys and __data__ placeholder for values");
+ABSL_FLAG(string, command_mix, "",
+          "Weighted mix of custom commands, as weight:command entries separated by ';', for "
+          "example \"6:get __key__;2:hset __key__ f __data__;1:zadd __key__ 1 __data__\". "
+          "Overrides command and ratio");
+ABSL_FLAG(string, data_size, "3",
+          "Size of values in bytes, either fixed or a min-max range to draw the sizes from");
+ABSL_FLAG(string, data_size_dist, "U",
+          "Distribution of value sizes in the data_size range: U for uniform, L for log-uniform, "
+          "which favors small values");
+ABSL_FLAG(string, replay, "",
+          "If set, replays the traffic recorded by DEBUG TRAFFIC <path> from the <path>-*.bin "
+          "files instead of generating commands. The recorded clients are spread over all the "
+          "connections, keeping the order of their commands and their pipelines");
+ABSL_FLAG(double, replay_speed, 1.0,
+          "Rate of the replay relative to the recording, 0 sends the commands as fast as "
+          "possible");
+ABSL_FLAG(bool, cluster, false,
+          "If true, discovers the nodes of a cluster with CLUSTER SHARDS from the h:p seed and "
+          "sends every command to the master that owns the slot of its first key. Commands with "
+          "several keys should confine them to one slot with hash tags");
+ABSL_FLAG(uint32_t, pipeline, 1,
+          "Number of requests sent together in a single write. The qps schedule stays the rate "
+          "of requests, so batches are sent every pipeline/qps seconds");
+ABSL_FLAG(bool, open_loop, false,
+          "If true, the latency of a request is measured from the time it was scheduled to be "
+          "sent, rather than from when it was actually sent. This accounts for the delays of "
+          "requests that the client could not send on schedule (coordinated omission).");
+ABSL_FLAG(string, json_out, "",
+          "If set, a second by second time series of throughput and latency is written to this "
+          "file in JSON");
 
 using namespace std;
 using namespace util;
@@ -48,9 +90,61 @@ using facade::RespVec;
 using tcp = ::boost::asio::ip::tcp;
 
 constexpr string_view kKeyPlaceholder = "__key__"sv;
+constexpr string_view kDataPlaceholder = "__data__"sv;
+constexpr unsigned kNumSlots = 16384;
 
 thread_local absl::InsecureBitGen bit_gen;
 
+// Log-linear histogram in the spirit of HdrHistogram. Values are grouped by their highest bit
+// and every group is split into the same number of linear buckets, so each value is recorded
+// with a relative error below 0.1% at any magnitude.
+class HdrHistogram {
+ public:
+  void Add(uint64_t val);
+  void Merge(const HdrHistogram& other);
+  void Clear();
+
+  // Returns the value that p percent of the recorded values do not exceed.
+  uint64_t Percentile(double p) const;
+
+  uint64_t count() const {
+    return count_;
+  }
+
+  uint64_t max() const {
+    return max_;
+  }
+
+  double Mean() const {
+    return count_ ? double(sum_) / count_ : 0;
+  }
+
+  string ToString() const;
+
+ private:
+  static constexpr unsigned kSubBucketBits = 11;
+  static constexpr uint64_t kSubBucketHalf = 1ULL << (kSubBucketBits - 1);
+
+  static unsigned BucketIndex(uint64_t val);
+
+  // The highest value that falls into the bucket.
+  static uint64_t BucketHighest(unsigned index);
+
+  vector<uint64_t> counts_;
+  uint64_t count_ = 0, sum_ = 0, min_ = UINT64_MAX, max_ = 0;
+};
+
+// Latencies of the connections of a thread, in usec.
+struct LatencyStats {
+  void Add(uint64_t usec) {
+    total.Add(usec);
+    interval.Add(usec);
+  }
+
+  HdrHistogram total;
+  HdrHistogram interval;  // since the last time series sample
+};
+
 class KeyGenerator {
  public:
   KeyGenerator(uint32_t min, uint32_t max);
@@ -65,82 +159,223 @@ class KeyGenerator {
   enum DistType { UNIFORM, NORMAL, ZIPFIAN } dist_type_;
 };
 
+class ValueGenerator {
+ public:
+  ValueGenerator();
+
+  string_view operator()();
+
+ private:
+  uint32_t min_, max_;
+  bool log_uniform_;
+  string data_;  // values are prefixes of it
+};
+
 class CommandGenerator {
  public:
-  CommandGenerator(KeyGenerator* keygen);
+  CommandGenerator(KeyGenerator* keygen, ValueGenerator* valgen);
 
   string operator()();
 
+  // The first key of the last generated command, which decides its slot.
+  string_view first_key() const {
+    return first_key_;
+  }
+
  private:
+  // A command with its literal parts split by placeholders.
+  struct Template {
+    vector<string> parts;
+    vector<string_view> placeholders;  // between consecutive parts
+    uint32_t weight;
+  };
+
+  void AddTemplate(string_view command, uint32_t weight);
+
   KeyGenerator* keygen_;
-  uint32_t ratio_set_ = 0, ratio_get_ = 0;
-  string command_;
+  ValueGenerator* valgen_;
+  vector<Template> templates_;
+  uint32_t total_weight_ = 0;
   string cmd_;
-  std::vector<size_t> key_indices_;
+  string first_key_;
 };
 
-CommandGenerator::CommandGenerator(KeyGenerator* keygen) : keygen_(keygen) {
-  command_ = GetFlag(FLAGS_command);
-  if (command_.empty()) {
-    pair<string, string> ratio_str = absl::StrSplit(GetFlag(FLAGS_ratio), ':');
-    CHECK(absl::SimpleAtoi(ratio_str.first, &ratio_set_));
-    CHECK(absl::SimpleAtoi(ratio_str.second, &ratio_get_));
-  } else {
-    for (size_t pos = 0; (pos = command_.find(kKeyPlaceholder, pos)) != string::npos;
-         pos += kKeyPlaceholder.size()) {
-      key_indices_.push_back(pos);
+ValueGenerator::ValueGenerator() {
+  string size = GetFlag(FLAGS_data_size);
+  pair<string, string> range = absl::StrSplit(size, absl::MaxSplits('-', 1));
+  CHECK(absl::SimpleAtoi(range.first, &min_)) << "Invalid data_size " << size;
+  max_ = min_;
+  if (!range.second.empty())
+    CHECK(absl::SimpleAtoi(range.second, &max_)) << "Invalid data_size " << size;
+  CHECK_LE(min_, max_);
+
+  string dist = GetFlag(FLAGS_data_size_dist);
+  CHECK(dist == "U" || dist == "L") << "Unknown value size distribution: " << dist;
+  log_uniform_ = dist == "L";
+  data_.assign(max_, 'x');
+}
+
+string_view ValueGenerator::operator()() {
+  uint32_t size = min_;
+  if (min_ < max_) {
+    if (log_uniform_) {
+      double lo = log(std::max(min_, 1u)), hi = log(max_ + 1.0);
+      size = std::clamp(uint32_t(exp(absl::Uniform(bit_gen, lo, hi))), min_, max_);
+    } else {
+      size = absl::Uniform(absl::IntervalClosed, bit_gen, min_, max_);
+    }
+  }
+  return string_view{data_}.substr(0, size);
+}
+
+CommandGenerator::CommandGenerator(KeyGenerator* keygen, ValueGenerator* valgen)
+    : keygen_(keygen), valgen_(valgen) {
+  string mix = GetFlag(FLAGS_command_mix);
+  string command = GetFlag(FLAGS_command);
+  if (!mix.empty()) {
+    for (string_view entry : absl::StrSplit(mix, ';', absl::SkipWhitespace())) {
+      pair<string_view, string_view> parts = absl::StrSplit(entry, absl::MaxSplits(':', 1));
+      uint32_t weight = 0;
+      CHECK(absl::SimpleAtoi(parts.first, &weight) && !parts.second.empty())
+          << "Invalid command_mix entry: " << entry;
+      AddTemplate(parts.second, weight);
     }
+  } else if (!command.empty()) {
+    AddTemplate(command, 1);
+  } else {
+    pair<string, string> ratio_str = absl::StrSplit(GetFlag(FLAGS_ratio), ':');
+    uint32_t ratio_set = 0, ratio_get = 0;
+    CHECK(absl::SimpleAtoi(ratio_str.first, &ratio_set));
+    CHECK(absl::SimpleAtoi(ratio_str.second, &ratio_get));
+    AddTemplate("set __key__ __data__", ratio_set);
+    AddTemplate("get __key__", ratio_get);
+  }
+  CHECK_GT(total_weight_, 0u) << "No commands to send";
+}
+
+void CommandGenerator::AddTemplate(string_view command, uint32_t weight) {
+  Template tmpl;
+  tmpl.weight = weight;
+  size_t last_pos = 0;
+  while (true) {
+    size_t key_pos = command.find(kKeyPlaceholder, last_pos);
+    size_t data_pos = command.find(kDataPlaceholder, last_pos);
+    size_t pos = std::min(key_pos, data_pos);
+    tmpl.parts.emplace_back(command.substr(last_pos, pos - last_pos));
+    if (pos == string_view::npos)
+      break;
+
+    string_view placeholder = pos == key_pos ? kKeyPlaceholder : kDataPlaceholder;
+    tmpl.placeholders.push_back(placeholder);
+    last_pos = pos + placeholder.size();
   }
+  templates_.push_back(std::move(tmpl));
+  total_weight_ += weight;
 }
 
 string CommandGenerator::operator()() {
-  cmd_.clear();
-  string key;
-  if (command_.empty()) {
-    key = (*keygen_)();
+  uint32_t pick = absl::Uniform(bit_gen, 0U, total_weight_);
+  const Template* tmpl = &templates_.front();
+  for (const Template& t : templates_) {
+    tmpl = &t;
+    if (pick < t.weight)
+      break;
+    pick -= t.weight;
+  }
 
-    if (absl::Uniform(bit_gen, 0U, ratio_get_ + ratio_set_) < ratio_set_) {
-      // TODO: value size
-      absl::StrAppend(&cmd_, "set ", key, " val\r\n");
+  cmd_.clear();
+  first_key_.clear();
+  for (size_t i = 0; i < tmpl->placeholders.size(); ++i) {
+    cmd_.append(tmpl->parts[i]);
+    if (tmpl->placeholders[i] == kKeyPlaceholder) {
+      string key = (*keygen_)();
+      if (first_key_.empty())
+        first_key_ = key;
+      cmd_.append(key);
     } else {
-      absl::StrAppend(&cmd_, "get ", key, "\r\n");
-    }
-  } else {
-    size_t last_pos = 0;
-    for (size_t pos : key_indices_) {
-      key = (*keygen_)();
-      absl::StrAppend(&cmd_, command_.substr(last_pos, pos - last_pos), key);
-      last_pos = pos + kKeyPlaceholder.size();
+      cmd_.append((*valgen_)());
     }
-    absl::StrAppend(&cmd_, command_.substr(last_pos), "\r\n");
   }
+  absl::StrAppend(&cmd_, tmpl->parts.back(), "\r\n");
   return cmd_;
 }
 
-// Per connection driver.
+// Returns the cluster slot of key, only its hash tag is hashed if it has one.
+uint16_t KeySlot(string_view key) {
+  size_t start = key.find('{');
+  if (start != string_view::npos) {
+    size_t end = key.find('}', start + 1);
+    if (end != string_view::npos && end != start + 1)
+      key = key.substr(start + 1, end - start - 1);
+  }
+  return crc16(key.data(), key.size()) & (kNumSlots - 1);
+}
+
+// The nodes the connections send commands to. Without cluster mode it holds just the server.
+struct Topology {
+  vector<tcp::endpoint> nodes;
+  vector<uint16_t> slot_owner;  // node index of every slot, empty without cluster mode
+
+  unsigned NodeOf(string_view key) const {
+    return slot_owner.empty() ? 0 : slot_owner[KeySlot(key)];
+  }
+};
+
+// Commands a recorded client sent in one go, which are replayed with a single write.
+struct ReplayBatch {
+  uint64_t time_ns;  // recording time of the first command
+  uint32_t db;
+  uint32_t num_cmds = 0;
+  string payload;  // RESP encoded commands
+};
+
+// Recorded traffic split by replay connection.
+struct ReplayLoad {
+  vector<vector<ReplayBatch>> conns;
+  uint64_t base_time_ns = UINT64_MAX;  // of the earliest command
+  uint64_t num_cmds = 0;
+};
+
+// Per connection driver. In cluster mode it holds a socket to every node.
 class Driver {
  public:
-  explicit Driver(ProactorBase* p = nullptr) {
-    if (p)
-      socket_.reset(p->CreateSocket());
+  explicit Driver(ProactorBase* p = nullptr) : p_(p) {
   }
 
   Driver(const Driver&) = delete;
   Driver(Driver&&) = default;
   Driver& operator=(Driver&&) = default;
 
-  void Connect(unsigned index, const tcp::endpoint& ep);
-  void Run(uint32_t num_reqs, uint64_t cycle_ns, base::Histogram* dest);
+  void Connect(unsigned index, const Topology* topology);
+  void Run(uint32_t num_reqs, uint64_t cycle_ns, LatencyStats* dest);
 
- private:
-  void ReceiveFb(base::Histogram* dest);
+  // Sends the batches at their recording times, relative to base_time_ns and scaled by speed,
+  // starting at start_ns.
+  void Replay(const vector<ReplayBatch>& batches, uint64_t base_time_ns, int64_t start_ns,
+              double speed, LatencyStats* dest);
 
+ private:
   struct Req {
     uint64_t start;
   };
 
-  unique_ptr<FiberSocketBase> socket_;
-  queue<Req> reqs_;
+  struct NodeConn {
+    unique_ptr<FiberSocketBase> socket;
+    queue<Req> reqs;
+    string batch;  // commands to send on the current tick
+  };
+
+  void ReceiveFb(NodeConn* conn, LatencyStats* dest);
+
+  void StartReceiving(LatencyStats* dest);
+
+  // Waits for the replies to all the requests, unless the connection was closed.
+  void StopReceiving(bool closed);
+
+  ProactorBase* p_;
+  const Topology* topology_ = nullptr;
+  vector<NodeConn> conns_;  // by node index
+  vector<fb2::Fiber> receive_fbs_;
 };
 
 // Per thread client.
@@ -155,16 +390,86 @@ class TLocalClient {
 
   TLocalClient(const TLocalClient&) = delete;
 
-  void Connect(tcp::endpoint ep);
+  void Connect(const Topology* topology);
   void Run(uint64_t cycle_ns);
+  void Replay(const ReplayLoad& load, int64_t start_ns);
 
-  base::Histogram hist;
+  LatencyStats stats;
 
  private:
   ProactorBase* p_;
   vector<Driver> drivers_;
 };
 
+unsigned HdrHistogram::BucketIndex(uint64_t val) {
+  if (val < 2 * kSubBucketHalf)
+    return val;
+
+  // Keep the kSubBucketBits highest bits of the value.
+  unsigned shift = 63 - __builtin_clzll(val) - (kSubBucketBits - 1);
+  return shift * kSubBucketHalf + (val >> shift);
+}
+
+uint64_t HdrHistogram::BucketHighest(unsigned index) {
+  if (index < 2 * kSubBucketHalf)
+    return index;
+
+  unsigned shift = index / kSubBucketHalf - 1;
+  uint64_t mantissa = index - shift * kSubBucketHalf;
+  return ((mantissa + 1) << shift) - 1;
+}
+
+void HdrHistogram::Add(uint64_t val) {
+  unsigned index = BucketIndex(val);
+  if (index >= counts_.size())
+    counts_.resize(index + 1, 0);
+  ++counts_[index];
+
+  ++count_;
+  sum_ += val;
+  min_ = std::min(min_, val);
+  max_ = std::max(max_, val);
+}
+
+void HdrHistogram::Merge(const HdrHistogram& other) {
+  if (other.counts_.size() > counts_.size())
+    counts_.resize(other.counts_.size(), 0);
+  for (size_t i = 0; i < other.counts_.size(); ++i)
+    counts_[i] += other.counts_[i];
+
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+void HdrHistogram::Clear() {
+  *this = HdrHistogram{};
+}
+
+uint64_t HdrHistogram::Percentile(double p) const {
+  if (count_ == 0)
+    return 0;
+
+  uint64_t rank = std::max<uint64_t>(1, ceil(p / 100 * count_));
+  uint64_t seen = 0;
+  for (unsigned i = 0; i < counts_.size(); ++i) {
+    seen += counts_[i];
+    if (seen >= rank)
+      return std::min(BucketHighest(i), max_);
+  }
+  return max_;
+}
+
+string HdrHistogram::ToString() const {
+  if (count_ == 0)
+    return "no samples";
+
+  return absl::StrFormat(
+      "count: %u mean: %.2f min: %u max: %u\np50: %u p99: %u p99.9: %u p99.99: %u", count_,
+      Mean(), min_, max_, Percentile(50), Percentile(99), Percentile(99.9), Percentile(99.99));
+}
+
 KeyGenerator::KeyGenerator(uint32_t min, uint32_t max)
     : min_(min), max_(max), range_(max - min + 1) {
   prefix_ = GetFlag(FLAGS_key_prefix);
@@ -206,14 +511,41 @@ string KeyGenerator::operator()() {
   return absl::StrCat(prefix_, key_suffix);
 }
 
-void Driver::Connect(unsigned index, const tcp::endpoint& ep) {
+void Driver::Connect(unsigned index, const Topology* topology) {
   VLOG(2) << "Connecting " << index;
-  error_code ec = socket_->Connect(ep);
-  CHECK(!ec) << "Could not connect to " << ep << " " << ec;
+  topology_ = topology;
+  conns_.resize(topology->nodes.size());
+  for (size_t i = 0; i < conns_.size(); ++i) {
+    conns_[i].socket.reset(p_->CreateSocket());
+    error_code ec = conns_[i].socket->Connect(topology->nodes[i]);
+    CHECK(!ec) << "Could not connect to " << topology->nodes[i] << " " << ec;
+  }
+}
+
+void Driver::StartReceiving(LatencyStats* dest) {
+  for (NodeConn& conn : conns_)
+    receive_fbs_.push_back(MakeFiber([this, &conn, dest] { ReceiveFb(&conn, dest); }));
 }
 
-void Driver::Run(uint32_t num_reqs, uint64_t cycle_ns, base::Histogram* dest) {
-  auto receive_fb = MakeFiber([this, dest] { ReceiveFb(dest); });
+void Driver::StopReceiving(bool closed) {
+  // TODO: to change to a condvar or something.
+  for (NodeConn& conn : conns_) {
+    while (!closed && !conn.reqs.empty()) {
+      ThisFiber::SleepFor(1ms);
+    }
+  }
+
+  for (NodeConn& conn : conns_)
+    conn.socket->Shutdown(SHUT_RDWR);  // breaks the receive fiber.
+  for (auto& fb : receive_fbs_)
+    fb.Join();
+  receive_fbs_.clear();
+  for (NodeConn& conn : conns_)
+    std::ignore = conn.socket->Close();
+}
+
+void Driver::Run(uint32_t num_reqs, uint64_t cycle_ns, LatencyStats* dest) {
+  StartReceiving(dest);
 
   int64_t next_invocation = absl::GetCurrentTimeNanos();
 
@@ -222,9 +554,14 @@ void Driver::Run(uint32_t num_reqs, uint64_t cycle_ns, base::Histogram* dest) {
   const uint32_t key_minimum = GetFlag(FLAGS_key_minimum);
   const uint32_t key_maximum = GetFlag(FLAGS_key_maximum);
 
+  const uint32_t pipeline = std::max(1u, GetFlag(FLAGS_pipeline));
+  const bool open_loop = GetFlag(FLAGS_open_loop);
+
   KeyGenerator key_gen(key_minimum, key_maximum);
-  CommandGenerator cmd_gen(&key_gen);
-  for (unsigned i = 0; i < num_reqs; ++i) {
+  ValueGenerator val_gen;
+  CommandGenerator cmd_gen(&key_gen, &val_gen);
+  bool closed = false;
+  for (unsigned i = 0; i < num_reqs; i += pipeline) {
     int64_t now = absl::GetCurrentTimeNanos();
 
     int64_t sleep_ns = next_invocation - now;
@@ -234,47 +571,98 @@ void Driver::Run(uint32_t num_reqs, uint64_t cycle_ns, base::Histogram* dest) {
     } else {
       VLOG(5) << "Behind QPS schedule";
     }
-    next_invocation += cycle_ns;
-
-    string cmd = cmd_gen();
+    const int64_t scheduled = next_invocation;
+    const uint32_t batch_size = std::min(pipeline, num_reqs - i);
+    next_invocation += cycle_ns * batch_size;
 
     Req req;
-    req.start = absl::GetCurrentTimeNanos();
-    reqs_.push(req);
-    // TODO: add type (get/set)
+    req.start = open_loop ? uint64_t(scheduled) : absl::GetCurrentTimeNanos();
+    for (uint32_t j = 0; j < batch_size; ++j) {
+      string cmd = cmd_gen();
+      NodeConn& conn = conns_[topology_->NodeOf(cmd_gen.first_key())];
+      conn.batch.append(cmd);
+      conn.reqs.push(req);
+      // TODO: add type (get/set)
+    }
 
-    error_code ec = socket_->Write(io::Buffer(cmd));
-    if (ec && FiberSocketBase::IsConnClosed(ec)) {
-      // TODO: report failure
-      VLOG(1) << "Connection closed";
-      break;
+    for (NodeConn& conn : conns_) {
+      if (conn.batch.empty())
+        continue;
+
+      error_code ec = conn.socket->Write(io::Buffer(conn.batch));
+      conn.batch.clear();
+      if (ec && FiberSocketBase::IsConnClosed(ec)) {
+        // TODO: report failure
+        VLOG(1) << "Connection closed";
+        closed = true;
+        break;
+      }
+      CHECK(!ec) << ec.message();
     }
-    CHECK(!ec) << ec.message();
+    if (closed)
+      break;
   }
 
   const absl::Time finish = absl::Now();
   VLOG(1) << "Done queuing " << num_reqs << " requests, which took " << finish - start
           << ". Waiting for server processing";
 
-  // TODO: to change to a condvar or something.
-  while (!reqs_.empty()) {
-    ThisFiber::SleepFor(1ms);
+  StopReceiving(closed);
+}
+
+void Driver::Replay(const vector<ReplayBatch>& batches, uint64_t base_time_ns, int64_t start_ns,
+                    double speed, LatencyStats* dest) {
+  DCHECK_EQ(conns_.size(), 1u);
+  NodeConn& conn = conns_.front();
+  StartReceiving(dest);
+
+  const bool open_loop = GetFlag(FLAGS_open_loop) && speed > 0;
+  uint32_t db = 0;
+  bool closed = false;
+  for (const ReplayBatch& batch : batches) {
+    int64_t scheduled = start_ns;
+    if (speed > 0)
+      scheduled += int64_t((batch.time_ns - base_time_ns) / speed);
+
+    int64_t sleep_ns = scheduled - absl::GetCurrentTimeNanos();
+    if (sleep_ns > 0)
+      ThisFiber::SleepFor(chrono::nanoseconds(sleep_ns));
+
+    Req req;
+    req.start = open_loop ? uint64_t(scheduled) : absl::GetCurrentTimeNanos();
+
+    // Recorded clients of different databases may share the connection.
+    if (batch.db != db) {
+      absl::StrAppend(&conn.batch, "select ", batch.db, "\r\n");
+      conn.reqs.push(req);
+      db = batch.db;
+    }
+    conn.batch.append(batch.payload);
+    for (uint32_t i = 0; i < batch.num_cmds; ++i)
+      conn.reqs.push(req);
+
+    error_code ec = conn.socket->Write(io::Buffer(conn.batch));
+    conn.batch.clear();
+    if (ec && FiberSocketBase::IsConnClosed(ec)) {
+      VLOG(1) << "Connection closed";
+      closed = true;
+      break;
+    }
+    CHECK(!ec) << ec.message();
   }
 
-  socket_->Shutdown(SHUT_RDWR);  // breaks the receive fiber.
-  receive_fb.Join();
-  std::ignore = socket_->Close();
+  StopReceiving(closed);
 }
 
-void Driver::ReceiveFb(base::Histogram* dest) {
+void Driver::ReceiveFb(NodeConn* conn, LatencyStats* dest) {
   facade::RedisParser parser{1 << 16, false};
   io::IoBuf io_buf{512};
   unsigned num_resp = 0;
   while (true) {
     auto buf = io_buf.AppendBuffer();
-    VLOG(2) << "Socket read: " << reqs_.size() << " " << num_resp;
+    VLOG(2) << "Socket read: " << conn->reqs.size() << " " << num_resp;
 
-    ::io::Result<size_t> recv_sz = socket_->Recv(buf);
+    ::io::Result<size_t> recv_sz = conn->socket->Recv(buf);
     if (!recv_sz && FiberSocketBase::IsConnClosed(recv_sz.error())) {
       break;
     }
@@ -289,9 +677,9 @@ void Driver::ReceiveFb(base::Histogram* dest) {
       result = parser.Parse(io_buf.InputBuffer(), &consumed, &parse_args);
       if (result == RedisParser::OK && !parse_args.empty()) {
         uint64_t now = absl::GetCurrentTimeNanos();
-        uint64_t usec = (now - reqs_.front().start) / 1000;
+        uint64_t usec = (now - conn->reqs.front().start) / 1000;
         dest->Add(usec);
-        reqs_.pop();
+        conn->reqs.pop();
         parse_args.clear();
         ++num_resp;
       }
@@ -301,14 +689,14 @@ void Driver::ReceiveFb(base::Histogram* dest) {
   VLOG(1) << "ReceiveFb done";
 }
 
-void TLocalClient::Connect(tcp::endpoint ep) {
+void TLocalClient::Connect(const Topology* topology) {
   VLOG(2) << "Connecting client...";
   vector<fb2::Fiber> fbs(drivers_.size());
 
   for (size_t i = 0; i < fbs.size(); ++i) {
     fbs[i] = MakeFiber([&, i] {
       ThisFiber::SetName(absl::StrCat("connect/", i));
-      drivers_[i].Connect(i, ep);
+      drivers_[i].Connect(i, topology);
     });
   }
 
@@ -321,14 +709,223 @@ void TLocalClient::Run(uint64_t cycle_ns) {
   uint32_t num_reqs = GetFlag(FLAGS_n);
 
   for (size_t i = 0; i < fbs.size(); ++i) {
-    fbs[i] =
-        fb2::Fiber(absl::StrCat("run/", i), [&, i] { drivers_[i].Run(num_reqs, cycle_ns, &hist); });
+    fbs[i] = fb2::Fiber(absl::StrCat("run/", i),
+                        [&, i] { drivers_[i].Run(num_reqs, cycle_ns, &stats); });
+  }
+
+  for (auto& fb : fbs)
+    fb.Join();
+}
+
+void TLocalClient::Replay(const ReplayLoad& load, int64_t start_ns) {
+  vector<fb2::Fiber> fbs(drivers_.size());
+  const double speed = GetFlag(FLAGS_replay_speed);
+  const size_t first_conn = p_->GetPoolIndex() * drivers_.size();
+
+  for (size_t i = 0; i < fbs.size(); ++i) {
+    fbs[i] = fb2::Fiber(absl::StrCat("replay/", i), [&, i] {
+      drivers_[i].Replay(load.conns[first_conn + i], load.base_time_ns, start_ns, speed, &stats);
+    });
   }
 
   for (auto& fb : fbs)
     fb.Join();
 }
 
+// Returns the files DEBUG TRAFFIC recorded with the given path prefix, one per server thread.
+vector<string> TrafficFiles(const string& prefix) {
+  namespace fs = std::filesystem;
+  fs::path base{prefix};
+  fs::path dir = base.has_parent_path() ? base.parent_path() : fs::path{"."};
+  string stem = base.filename().string() + "-";
+
+  vector<string> files;
+  for (const auto& entry : fs::directory_iterator(dir)) {
+    string name = entry.path().filename().string();
+    if (absl::StartsWith(name, stem) && absl::EndsWith(name, ".bin"))
+      files.push_back(entry.path().string());
+  }
+  sort(files.begin(), files.end());
+  return files;
+}
+
+// Parses a recording, see LogTraffic in dragonfly_connection.cc for the format. The clients are
+// assigned to connections by their id, which is unique across the server threads, so a client
+// keeps its connection even if the server migrated it between threads.
+void LoadTrafficFile(const string& path, ReplayLoad* load) {
+  ifstream in(path, ios::binary);
+  string data{istreambuf_iterator<char>(in), istreambuf_iterator<char>()};
+  CHECK(!data.empty() && data[0] == 2) << path << " is not a version 2 traffic recording";
+
+  // Batches of the clients whose last command had more commands pipelined after it.
+  absl::flat_hash_map<uint32_t, size_t> open_batches;
+
+  constexpr size_t kHeaderSize = 24;
+  const char* next = data.data() + 1;
+  const char* end = data.data() + data.size();
+  vector<string_view> parts;
+  while (next + kHeaderSize <= end) {
+    uint32_t client = absl::little_endian::Load32(next);
+    uint64_t time_ns = absl::little_endian::Load64(next + 4);
+    uint32_t db = absl::little_endian::Load32(next + 12);
+    bool has_more = absl::little_endian::Load32(next + 16) != 0;
+    uint32_t num_parts = absl::little_endian::Load32(next + 20);
+    next += kHeaderSize;
+
+    CHECK_LE(next + 4ULL * num_parts, end) << "Truncated record in " << path;
+    const char* blob = next + 4ULL * num_parts;
+    parts.clear();
+    for (uint32_t i = 0; i < num_parts; ++i) {
+      uint32_t len = absl::little_endian::Load32(next + 4 * i);
+      CHECK_LE(blob + len, end) << "Truncated record in " << path;
+      parts.emplace_back(blob, len);
+      blob += len;
+    }
+    next = blob;
+
+    // The replay selects the database of every batch by itself.
+    if (parts.empty() || absl::EqualsIgnoreCase(parts.front(), "select")) {
+      if (!has_more)
+        open_batches.erase(client);
+      continue;
+    }
+
+    vector<ReplayBatch>& batches = load->conns[client % load->conns.size()];
+    auto it = open_batches.find(client);
+    if (it == open_batches.end() || batches[it->second].db != db) {
+      batches.push_back(ReplayBatch{time_ns, db});
+      it = open_batches.insert_or_assign(client, batches.size() - 1).first;
+    }
+
+    ReplayBatch& batch = batches[it->second];
+    absl::StrAppend(&batch.payload, "*", parts.size(), "\r\n");
+    for (string_view part : parts)
+      absl::StrAppend(&batch.payload, "$", part.size(), "\r\n", part, "\r\n");
+    ++batch.num_cmds;
+
+    if (!has_more)
+      open_batches.erase(it);
+    load->base_time_ns = std::min(load->base_time_ns, time_ns);
+    ++load->num_cmds;
+  }
+}
+
+ReplayLoad LoadTraffic(const string& prefix, size_t num_conns) {
+  vector<string> files = TrafficFiles(prefix);
+  CHECK(!files.empty()) << "No traffic recordings " << prefix << "-*.bin";
+
+  ReplayLoad load;
+  load.conns.resize(num_conns);
+  for (const string& file : files)
+    LoadTrafficFile(file, &load);
+
+  // The files are read one after another, so put the batches of every connection back into
+  // recording order. The sort is stable to keep the order of the commands of a client.
+  for (auto& batches : load.conns) {
+    stable_sort(batches.begin(), batches.end(),
+                [](const auto& a, const auto& b) { return a.time_ns < b.time_ns; });
+  }
+  return load;
+}
+
+// Throughput and latency of all the connections during one interval of the run.
+struct IntervalSample {
+  double end_sec;  // since the start of the run
+  uint64_t requests;
+  double qps;
+  uint64_t p50, p99, p999, p9999, max;  // usec
+};
+
+void WriteTimeSeries(const string& path, const vector<IntervalSample>& samples) {
+  string json = "{\"series\": [";
+  for (size_t i = 0; i < samples.size(); ++i) {
+    const IntervalSample& s = samples[i];
+    absl::StrAppendFormat(&json,
+                          "%s\n  {\"time_sec\": %.3f, \"requests\": %u, \"qps\": %.1f, "
+                          "\"p50_usec\": %u, \"p99_usec\": %u, \"p99.9_usec\": %u, "
+                          "\"p99.99_usec\": %u, \"max_usec\": %u}",
+                          i ? "," : "", s.end_sec, s.requests, s.qps, s.p50, s.p99, s.p999,
+                          s.p9999, s.max);
+  }
+  json.append("\n]}\n");
+
+  ofstream out(path);
+  out << json;
+  CHECK(out.good()) << "Could not write " << path;
+}
+
+// Returns the value of field in a CLUSTER SHARDS reply, which lists the fields of an entry as
+// name value pairs, nullptr if it is missing.
+const facade::RespExpr* FindField(const RespVec& entry, string_view field) {
+  for (size_t i = 0; i + 1 < entry.size(); i += 2) {
+    if (entry[i].type == facade::RespExpr::STRING && entry[i].GetView() == field)
+      return &entry[i + 1];
+  }
+  return nullptr;
+}
+
+Topology FetchClusterTopology(ProactorBase* p, const tcp::endpoint& seed) {
+  unique_ptr<FiberSocketBase> socket(p->CreateSocket());
+  error_code ec = socket->Connect(seed);
+  CHECK(!ec) << "Could not connect to " << seed << " " << ec;
+  ec = socket->Write(io::Buffer("cluster shards\r\n"));
+  CHECK(!ec) << ec.message();
+
+  // The reply is parsed whole, so that it can refer to the buffer.
+  io::IoBuf io_buf{4096};
+  RespVec shards;
+  RedisParser::Result result = RedisParser::INPUT_PENDING;
+  while (result == RedisParser::INPUT_PENDING) {
+    ::io::Result<size_t> recv_sz = socket->Recv(io_buf.AppendBuffer());
+    CHECK(recv_sz) << recv_sz.error().message();
+    io_buf.CommitWrite(*recv_sz);
+
+    RedisParser parser{UINT32_MAX, false};
+    uint32_t consumed = 0;
+    shards.clear();
+    result = parser.Parse(io_buf.InputBuffer(), &consumed, &shards);
+  }
+  CHECK_EQ(result, RedisParser::OK);
+  CHECK(shards.empty() || shards.front().type != facade::RespExpr::ERROR)
+      << "CLUSTER SHARDS failed: " << shards.front().GetString();
+
+  Topology topology;
+  topology.slot_owner.assign(kNumSlots, 0);
+  size_t covered = 0;
+  for (const auto& shard : shards) {
+    const auto* slots = FindField(shard.GetVec(), "slots");
+    const auto* nodes = FindField(shard.GetVec(), "nodes");
+    CHECK(slots && nodes) << "Unexpected CLUSTER SHARDS reply";
+
+    optional<tcp::endpoint> master;
+    for (const auto& node : nodes->GetVec()) {
+      const auto* role = FindField(node.GetVec(), "role");
+      const auto* ip = FindField(node.GetVec(), "ip");
+      const auto* port = FindField(node.GetVec(), "port");
+      if (role && ip && port && role->GetView() == "master") {
+        master.emplace(::boost::asio::ip::make_address(ip->GetString()),
+                       uint16_t(port->GetInt().value_or(0)));
+      }
+    }
+    CHECK(master) << "A shard has no master";
+    topology.nodes.push_back(*master);
+
+    const RespVec& ranges = slots->GetVec();
+    for (size_t i = 0; i + 1 < ranges.size(); i += 2) {
+      int64_t start = ranges[i].GetInt().value_or(0), end = ranges[i + 1].GetInt().value_or(-1);
+      for (int64_t slot = start; slot <= end && slot < int64_t(kNumSlots); ++slot) {
+        topology.slot_owner[slot] = topology.nodes.size() - 1;
+        ++covered;
+      }
+    }
+  }
+
+  CHECK(!topology.nodes.empty()) << "The cluster has no shards";
+  LOG_IF(WARNING, covered < kNumSlots)
+      << "Only " << covered << " slots are assigned, the rest are sent to the first node";
+  return topology;
+}
+
 int main(int argc, char* argv[]) {
   MainInitGuard guard(&argc, &argv);
 
@@ -346,32 +943,96 @@ int main(int argc, char* argv[]) {
   auto address = ::boost::asio::ip::make_address(ip_addr);
   tcp::endpoint ep{address, GetFlag(FLAGS_p)};
 
+  const string replay = GetFlag(FLAGS_replay);
+  ReplayLoad load;
+  if (!replay.empty()) {
+    CHECK(!GetFlag(FLAGS_cluster)) << "Replay is not supported in cluster mode";
+    load = LoadTraffic(replay, pp->size() * GetFlag(FLAGS_c));
+    CONSOLE_INFO << "Replaying " << load.num_cmds << " commands at " << GetFlag(FLAGS_replay_speed)
+                 << "x speed";
+  }
+
+  Topology topology;
+  if (GetFlag(FLAGS_cluster)) {
+    topology = proactor->Await([&] { return FetchClusterTopology(proactor, ep); });
+    CONSOLE_INFO << "Discovered " << topology.nodes.size() << " cluster masters";
+  } else {
+    topology.nodes.push_back(ep);
+  }
+
   thread_local unique_ptr<TLocalClient> client;
 
   LOG(INFO) << "Connecting threads";
   pp->AwaitFiberOnAll([&](auto* p) {
     client = make_unique<TLocalClient>(p);
-    client->Connect(ep);
+    client->Connect(&topology);
   });
 
   const uint32_t qps = GetFlag(FLAGS_qps);
   const int64_t interval = 1000000000LL / qps;
   uint32_t num_reqs = GetFlag(FLAGS_n);
 
-  CONSOLE_INFO << "Running all threads, sending " << num_reqs << " requests at a rate of "
-               << GetFlag(FLAGS_qps) << "qps, i.e. request every " << interval / 1000 << "us";
+  if (replay.empty()) {
+    CONSOLE_INFO << "Running all threads, sending " << num_reqs << " requests at a rate of "
+                 << GetFlag(FLAGS_qps) << "qps, i.e. request every " << interval / 1000 << "us";
+  }
+
+  const string json_out = GetFlag(FLAGS_json_out);
+  vector<IntervalSample> samples;
+  absl::Time sample_time = absl::Now();
+  const absl::Time start_time = sample_time;
+
+  // Merges and resets the interval histograms of all threads.
+  auto take_sample = [&] {
+    fb2::Mutex mutex;
+    HdrHistogram hist;
+    pp->AwaitFiberOnAll([&](auto* p) {
+      lock_guard gu(mutex);
+      hist.Merge(client->stats.interval);
+      client->stats.interval.Clear();
+    });
+
+    absl::Time now = absl::Now();
+    double interval_sec = absl::ToDoubleSeconds(now - sample_time);
+    sample_time = now;
+    samples.push_back({absl::ToDoubleSeconds(now - start_time), hist.count(),
+                       interval_sec > 0 ? hist.count() / interval_sec : 0, hist.Percentile(50),
+                       hist.Percentile(99), hist.Percentile(99.9), hist.Percentile(99.99),
+                       hist.max()});
+  };
+
+  fb2::Done sampler_done;
+  fb2::Fiber sampler;
+  if (!json_out.empty()) {
+    sampler = proactor->LaunchFiber([&] {
+      while (!sampler_done.WaitFor(1s))
+        take_sample();
+    });
+  }
 
-  const absl::Time start_time = absl::Now();
-  pp->AwaitFiberOnAll([&](auto* p) { client->Run(interval); });
+  if (replay.empty()) {
+    pp->AwaitFiberOnAll([&](auto* p) { client->Run(interval); });
+  } else {
+    // All the threads start from the same point, so that the connections keep their offsets.
+    int64_t replay_start = absl::GetCurrentTimeNanos() + 100'000'000;
+    pp->AwaitFiberOnAll([&](auto* p) { client->Replay(load, replay_start); });
+  }
   absl::Duration duration = absl::Now() - start_time;
   LOG(INFO) << "Finished. Total time: " << duration;
 
+  if (sampler.IsJoinable()) {
+    sampler_done.Notify();
+    sampler.Join();
+    take_sample();  // the last partial interval
+    WriteTimeSeries(json_out, samples);
+  }
+
   fb2::Mutex mutex;
-  base::Histogram hist;
+  HdrHistogram hist;
   LOG(INFO) << "Resetting all threads";
   pp->AwaitFiberOnAll([&](auto* p) {
     lock_guard gu(mutex);
-    hist.Merge(client->hist);
+    hist.Merge(client->stats.total);
     client.reset();
   });
 
@@ -251,6 +251,7 @@ void DflyCmd::Flow(CmdArgList args, ConnectionContext* cntx) {
   flow.conn = cntx->conn();
   flow.eof_token = eof_token;
   flow.version = replica_ptr->version;
+  flow.journal_compression = replica_ptr->journal_compression;
   if (!cntx->conn()->Migrate(shard_set->pool()->at(flow_id))) {
     // Listener::PreShutdown() triggered
     if (cntx->conn()->socket()->IsOpen()) {
@@ -262,7 +263,9 @@ void DflyCmd::Flow(CmdArgList args, ConnectionContext* cntx) {
 
   std::string_view sync_type = "FULL";
   if (seqid.has_value()) {
-    if (sf_->journal()->IsLSNInBuffer(*seqid) || sf_->journal()->GetLsn() == *seqid) {
+    auto* journal = sf_->journal();
+    if (journal->IsLSNInBuffer(*seqid) || journal->IsLSNOnDisk(*seqid) ||
+        journal->GetLsn() == *seqid) {
       // This does not guarantee the lsn will still be present when DFLY SYNC runs,
       // replication will be retried if it gets evicted by then.
       flow.start_partial_sync_at = *seqid;
@@ -274,7 +277,8 @@ void DflyCmd::Flow(CmdArgList args, ConnectionContext* cntx) {
                 << " that the replication buffer doesn't contain this anymore (current_lsn="
                 << sf_->journal()->GetLsn() << "). Will perform a full sync of the data.";
       LOG(INFO) << "If this happens often you can control the replication buffer's size with the "
-                   "--shard_repl_backlog_len option";
+                   "--shard_repl_backlog_len option, or keep a larger backlog on disk with "
+                   "--journal_disk_dir";
     }
   }
 
@@ -537,6 +541,9 @@ OpStatus DflyCmd::StartStableSyncInThread(FlowInfo* flow, Context* cntx, EngineS
 
   if (shard != nullptr) {
     flow->streamer.reset(new JournalStreamer(sf_->journal(), cntx));
+    flow->streamer->EnableCompression(flow->journal_compression);
+    if (flow->version >= DflyVersion::VER5)
+      flow->streamer->EnableTimestamps();
     bool send_lsn = flow->version >= DflyVersion::VER4;
     flow->streamer->Start(flow->conn->socket(), send_lsn);
   }
@@ -683,6 +690,8 @@ std::vector<ReplicaRoleInfo> DflyCmd::GetReplicasRoleInfo() const {
   for (const auto& [id, info] : replica_infos_) {
     LSN lag = replication_lags[id];
     SyncState state = SyncState::PREPARATION;
+    JournalStreamer::CompressionStats compression;
+    vector<ReplicaRoleInfo::FlowStats> flow_stats;
 
     // If the replica state being updated, its lag is undefined,
     // the same applies of course if its state is not STABLE_SYNC.
@@ -692,12 +701,26 @@ std::vector<ReplicaRoleInfo> DflyCmd::GetReplicasRoleInfo() const {
       if (state != SyncState::STABLE_SYNC) {
         lag = 0;
       }
+      for (const FlowInfo& flow : info->flows) {
+        if (!flow.streamer)
+          continue;
+        auto flow_compression = flow.streamer->GetCompressionStats();
+        compression.raw_bytes += flow_compression.raw_bytes;
+        compression.sent_bytes += flow_compression.sent_bytes;
+        compression.cpu_usec += flow_compression.cpu_usec;
+
+        auto stats = flow.streamer->GetStats();
+        flow_stats.push_back({uint32_t(&flow - info->flows.data()), stats.written_bytes,
+                              stats.bytes_per_sec, stats.in_flight_bytes, stats.throttle_usec});
+      }
       info->mu.unlock();
     } else {
       lag = 0;
     }
-    vec.push_back(
-        ReplicaRoleInfo{info->id, info->address, info->listening_port, SyncStateName(state), lag});
+    vec.push_back(ReplicaRoleInfo{info->id, info->address, info->listening_port,
+                                  SyncStateName(state), lag, info->journal_compression,
+                                  compression.raw_bytes, compression.sent_bytes,
+                                  compression.cpu_usec, std::move(flow_stats)});
   }
   return vec;
 }
@@ -783,6 +806,15 @@ void DflyCmd::SetDflyClientVersion(ConnectionContext* cntx, DflyVersion version)
   replica_ptr->version = version;
 }
 
+void DflyCmd::SetJournalCompression(ConnectionContext* cntx, JournalCompression compression) {
+  auto replica_ptr = GetReplicaInfo(cntx->conn_state.replication_info.repl_session_id);
+  VLOG(1) << "Journal compression for session_id="
+          << cntx->conn_state.replication_info.repl_session_id << " is "
+          << JournalCompressionName(compression);
+
+  replica_ptr->journal_compression = compression;
+}
+
 // Must run under locked replica_info.mu.
 bool DflyCmd::CheckReplicaStateOrReply(const ReplicaInfo& repl_info, SyncState expected,
                                        RedisReplyBuilder* rb) {
@@ -807,6 +839,12 @@ void DflyCmd::BreakOnShutdown() {
 }
 
 void DflyCmd::Shutdown() {
+  shutting_down_ = true;
+  ack_ec_.notifyAll();
+  CancelAllReplications();
+}
+
+void DflyCmd::CancelAllReplications() {
   ReplicaInfoMap pending;
   {
     std::lock_guard lk(mu_);
@@ -818,6 +856,55 @@ void DflyCmd::Shutdown() {
   }
 }
 
+void DflyCmd::OnAck(FlowInfo* flow, LSN ack) {
+  flow->last_acked_lsn = ack;
+  if (ack_waiters_ > 0) {
+    ++ack_epoch_;
+    ack_ec_.notifyAll();
+  }
+}
+
+unsigned DflyCmd::WaitForAcks(const std::vector<LSN>& lsns, unsigned numreplicas,
+                              std::chrono::steady_clock::time_point deadline) {
+  ++ack_waiters_;
+  absl::Cleanup cleanup = [this] { --ack_waiters_; };
+
+  while (true) {
+    // Read before counting, so that an ack that arrives meanwhile changes it.
+    uint64_t epoch = ack_epoch_;
+    unsigned acked = CountAckedReplicas(lsns);
+    if (acked >= numreplicas || shutting_down_)
+      return acked;
+
+    // Long waits are split, so that the deadline does not overflow the wait.
+    auto now = chrono::steady_clock::now();
+    if (now >= deadline)
+      return acked;
+    auto wait_until = deadline - now > 1h ? now + 1h : deadline;
+    ack_ec_.await_until([&] { return ack_epoch_ != epoch || shutting_down_; }, wait_until);
+  }
+}
+
+unsigned DflyCmd::CountAckedReplicas(const std::vector<LSN>& lsns) const {
+  lock_guard lk(mu_);
+  unsigned acked = 0;
+  for (const auto& [id, info] : replica_infos_) {
+    // Replicas that change their state are in no position to ack.
+    if (!info->mu.try_lock())
+      continue;
+    bool stable = info->replica_state == SyncState::STABLE_SYNC;
+    info->mu.unlock();
+    if (!stable || info->flows.size() != lsns.size())
+      continue;
+
+    bool covered = true;
+    for (size_t i = 0; i < lsns.size() && covered; ++i)
+      covered = info->flows[i].last_acked_lsn >= lsns[i];
+    acked += covered;
+  }
+  return acked;
+}
+
 void FlowInfo::TryShutdownSocket() {
   // Close socket for clean disconnect.
   if (conn->socket()->IsOpen()) {
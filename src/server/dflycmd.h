@@ -7,9 +7,11 @@
 #include <absl/container/btree_map.h>
 
 #include <atomic>
+#include <chrono>
 #include <memory>
 
 #include "server/conn_context.h"
+#include "server/journal/serializer.h"
 
 namespace facade {
 class RedisReplyBuilder;
@@ -44,9 +46,12 @@ struct FlowInfo {
   std::string eof_token;
 
   DflyVersion version = DflyVersion::VER0;
+  JournalCompression journal_compression = JournalCompression::NONE;
 
   std::optional<LSN> start_partial_sync_at;
-  uint64_t last_acked_lsn = 0;
+
+  // Written by the flow connection on the thread of the shard, read by WAIT from any thread.
+  std::atomic_uint64_t last_acked_lsn{0};
 
   std::function<void()> cleanup;  // Optional cleanup for cancellation.
 };
@@ -118,6 +123,7 @@ class DflyCmd {
     std::string address;
     uint32_t listening_port;
     DflyVersion version = DflyVersion::VER0;
+    JournalCompression journal_compression = JournalCompression::NONE;
 
     // Flows describe the state of shard-local flow.
     // They are always indexed by the shard index on the master.
@@ -134,6 +140,9 @@ class DflyCmd {
 
   void BreakOnShutdown();
 
+  // Disconnects all replicas, for example when a replica of a replica resyncs from scratch.
+  void CancelAllReplications();
+
   // Stop all background processes so we can exit in orderly manner.
   void Shutdown();
 
@@ -149,9 +158,20 @@ class DflyCmd {
   // Sets metadata.
   void SetDflyClientVersion(ConnectionContext* cntx, DflyVersion version);
 
+  // Compression of the stable sync journal that the replica requested.
+  void SetJournalCompression(ConnectionContext* cntx, JournalCompression compression);
+
   // Transition into cancelled state, run cleanup.
   void CancelReplication(uint32_t sync_id, std::shared_ptr<ReplicaInfo> replica_info_ptr);
 
+  // Records the ack of a flow and wakes the WAIT commands.
+  void OnAck(FlowInfo* flow, LSN ack);
+
+  // Waits until numreplicas replicas in stable sync acked the journal of every shard up to the
+  // given LSNs, or until the deadline. Returns the number of these replicas.
+  unsigned WaitForAcks(const std::vector<LSN>& lsns, unsigned numreplicas,
+                       std::chrono::steady_clock::time_point deadline);
+
  private:
   // JOURNAL [START/STOP]
   // Start or stop journaling.
@@ -218,6 +238,8 @@ class DflyCmd {
   // between the master's LSN and the last acknowledged LSN in over all shards.
   std::map<uint32_t, LSN> ReplicationLags() const;
 
+  unsigned CountAckedReplicas(const std::vector<LSN>& lsns) const;
+
  private:
   ServerFamily* sf_;  // Not owned
 
@@ -227,6 +249,12 @@ class DflyCmd {
   ReplicaInfoMap replica_infos_;
 
   mutable util::fb2::Mutex mu_;  // Guard global operations. See header top for locking levels.
+
+  // Acks wake the WAIT commands only while there are any.
+  std::atomic_uint32_t ack_waiters_{0};
+  std::atomic_uint64_t ack_epoch_{0};
+  std::atomic_bool shutting_down_{false};
+  util::fb2::EventCount ack_ec_;
 };
 
 }  // namespace dfly
@@ -13,6 +13,7 @@ extern "C" {
 #include <absl/strings/strip.h>
 #include <fast_float/fast_float.h>
 #include <gmock/gmock.h>
+#include <mimalloc.h>
 
 #include "base/flags.h"
 #include "base/gtest.h"
@@ -20,6 +21,7 @@ extern "C" {
 #include "facade/facade_test.h"
 #include "server/conn_context.h"
 #include "server/main_service.h"
+#include "server/server_state.h"
 #include "server/test_utils.h"
 
 ABSL_DECLARE_FLAG(float, mem_defrag_threshold);
@@ -28,6 +30,15 @@ ABSL_DECLARE_FLAG(uint32_t, mem_defrag_check_sec_interval);
 ABSL_DECLARE_FLAG(std::vector<std::string>, rename_command);
 ABSL_DECLARE_FLAG(double, oom_deny_ratio);
 ABSL_DECLARE_FLAG(bool, lua_resp2_legacy_float);
+ABSL_DECLARE_FLAG(bool, expire_timer_wheel);
+ABSL_DECLARE_FLAG(bool, expire_time_buckets);
+ABSL_DECLARE_FLAG(bool, key_prefix_compression);
+ABSL_DECLARE_FLAG(uint32_t, value_compression_min_size);
+ABSL_DECLARE_FLAG(uint32_t, value_dedup_min_size);
+ABSL_DECLARE_FLAG(bool, field_expiry_index);
+ABSL_DECLARE_FLAG(bool, tx_batch_schedule);
+ABSL_DECLARE_FLAG(bool, tx_schedule_ring);
+ABSL_DECLARE_FLAG(dfly::MemoryBytesFlag, prefault_memory);
 
 namespace dfly {
 
@@ -37,9 +48,11 @@ using absl::SetFlag;
 using absl::StrCat;
 using fb2::Fiber;
 using ::io::Result;
+using testing::_;
 using testing::AnyOf;
 using testing::ElementsAre;
 using testing::HasSubstr;
+using testing::UnorderedElementsAre;
 
 namespace {
 
@@ -135,6 +148,316 @@ TEST_F(DflyRenameCommandTest, RenameCommand) {
   ASSERT_THAT(Run({"abcdefghijklmnop"}), "PONG");
 }
 
+class DflyExpireWheelTest : public DflyEngineTest {
+ protected:
+  DflyExpireWheelTest() : DflyEngineTest() {
+    absl::SetFlag(&FLAGS_expire_timer_wheel, true);
+  }
+
+  void TearDown() {
+    absl::SetFlag(&FLAGS_expire_timer_wheel, false);
+    DflyEngineTest::TearDown();
+  }
+
+  void DeleteExpired() {
+    shard_set->RunBriefInParallel([](EngineShard* shard) {
+      shard->db_slice().DeleteExpiredFromWheel(DbContext{0, GetCurrentTimeMs()}, UINT32_MAX);
+    });
+  }
+};
+
+TEST_F(DflyExpireWheelTest, DeletesDueKeys) {
+  for (unsigned i = 0; i < 100; ++i) {
+    Run({"set", StrCat("short", i), "v", "px", "100"});
+    Run({"set", StrCat("long", i), "v", "px", "1000"});
+  }
+  Run({"set", "extended", "v", "px", "100"});
+  Run({"pexpire", "extended", "1000"});
+
+  AdvanceTime(200);
+  DeleteExpired();
+  EXPECT_EQ(101, CheckedInt({"dbsize"}));
+  EXPECT_EQ(100, GetMetrics().events.expired_keys);
+  EXPECT_EQ(0, GetMetrics().expire_lag_ms);
+
+  AdvanceTime(1000);
+  DeleteExpired();
+  EXPECT_EQ(0, CheckedInt({"dbsize"}));
+}
+
+TEST_F(DflyExpireWheelTest, RefreshKeepsOneEntry) {
+  auto wheel_entries = [] {
+    atomic<size_t> res = 0;
+    shard_set->RunBriefInParallel([&](EngineShard* shard) {
+      res += shard->db_slice().GetDBTable(0)->expire_wheel->entries();
+    });
+    return res.load();
+  };
+
+  Run({"set", "key", "v", "px", "100"});
+  for (unsigned i = 1; i <= 1000; ++i) {
+    Run({"pexpire", "key", StrCat(100 + i)});
+  }
+  EXPECT_EQ(1, wheel_entries());
+  EXPECT_GT(GetMetrics().db_stats[0].expire_wheel_mem_usage, 0u);
+
+  // Its entry fires at the first deadline and reschedules the key to the current one.
+  AdvanceTime(200);
+  DeleteExpired();
+  EXPECT_EQ(1, CheckedInt({"dbsize"}));
+  EXPECT_EQ(1, wheel_entries());
+
+  // Bringing the deadline forward adds an entry, the stale one is dropped when it fires.
+  Run({"pexpire", "key", "10"});
+  EXPECT_EQ(2, wheel_entries());
+  AdvanceTime(20);
+  DeleteExpired();
+  EXPECT_EQ(0, CheckedInt({"dbsize"}));
+  AdvanceTime(1000);
+  DeleteExpired();
+  EXPECT_EQ(0, wheel_entries());
+}
+
+class DflyPrefaultTest : public DflyEngineTest {
+ protected:
+  DflyPrefaultTest() : DflyEngineTest(), prev_max_memory_(max_memory_limit) {
+    max_memory_limit = 512ULL << 20;
+    absl::SetFlag(&FLAGS_prefault_memory, MemoryBytesFlag{128ULL << 20});
+  }
+
+  void TearDown() {
+    DflyEngineTest::TearDown();
+    absl::SetFlag(&FLAGS_prefault_memory, MemoryBytesFlag{});
+    max_memory_limit = prev_max_memory_;
+  }
+
+  size_t prev_max_memory_;
+};
+
+TEST_F(DflyPrefaultTest, Smoke) {
+  shard_set->RunBriefInParallel([](EngineShard*) {
+    EXPECT_NE(ServerState::tlocal()->data_heap(), mi_heap_get_backing());
+  });
+
+  // The shard heaps keep allocating from their arenas past the prefaulted part.
+  const string value(2 << 20, 'x');
+  for (unsigned i = 0; i < 100; ++i) {
+    ASSERT_EQ(Run({"set", StrCat("key", i), value}), "OK");
+  }
+  for (unsigned i = 0; i < 100; i += 10) {
+    EXPECT_THAT(Run({"strlen", StrCat("key", i)}), IntArg(value.size()));
+  }
+}
+
+class DflyExpireBucketsTest : public DflyEngineTest {
+ protected:
+  DflyExpireBucketsTest() : DflyEngineTest() {
+    absl::SetFlag(&FLAGS_expire_time_buckets, true);
+  }
+
+  void TearDown() {
+    absl::SetFlag(&FLAGS_expire_time_buckets, false);
+    DflyEngineTest::TearDown();
+  }
+
+  void DeleteExpired() {
+    shard_set->RunBriefInParallel([](EngineShard* shard) {
+      shard->db_slice().DeleteExpiredFromBuckets(DbContext{0, GetCurrentTimeMs()}, UINT32_MAX);
+    });
+  }
+};
+
+TEST_F(DflyExpireBucketsTest, DeletesDueKeys) {
+  for (unsigned i = 0; i < 100; ++i) {
+    Run({"set", StrCat("short", i), "v", "px", "100"});
+    Run({"set", StrCat("long", i), "v", "px", "5000"});
+  }
+  Run({"set", "extended", "v", "px", "100"});
+  Run({"pexpire", "extended", "5000"});
+  EXPECT_EQ(0, GetMetrics().expire_backlog);
+
+  // The buckets are due once all their deadlines passed.
+  AdvanceTime(2500);
+  EXPECT_GT(GetMetrics().expire_backlog, 0u);
+  DeleteExpired();
+  EXPECT_EQ(101, CheckedInt({"dbsize"}));
+  EXPECT_EQ(100, GetMetrics().events.expired_keys);
+  EXPECT_EQ(0, GetMetrics().expire_backlog);
+
+  AdvanceTime(5000);
+  DeleteExpired();
+  EXPECT_EQ(0, CheckedInt({"dbsize"}));
+}
+
+class DflyFieldExpiryTest : public DflyEngineTest {
+ protected:
+  DflyFieldExpiryTest() : DflyEngineTest() {
+    absl::SetFlag(&FLAGS_field_expiry_index, true);
+  }
+
+  void TearDown() {
+    absl::SetFlag(&FLAGS_field_expiry_index, false);
+    DflyEngineTest::TearDown();
+  }
+
+  void DeleteExpired() {
+    shard_set->RunBriefInParallel([](EngineShard* shard) {
+      shard->db_slice().DeleteExpiredFields(DbContext{0, GetCurrentTimeMs()}, UINT32_MAX);
+    });
+  }
+};
+
+TEST_F(DflyFieldExpiryTest, ReclaimsExpiredFields) {
+  for (unsigned i = 0; i < 100; ++i) {
+    Run({"hsetex", "hash", "1", StrCat("short", i), "v"});
+    Run({"hsetex", "hash", "100", StrCat("long", i), "v"});
+    Run({"saddex", "set", "1", StrCat("short", i)});
+    Run({"saddex", "set", "100", StrCat("long", i)});
+  }
+  Run({"saddex", "gone", "1", "a", "b"});
+
+  AdvanceTime(2000);
+  DeleteExpired();
+  auto metrics = GetMetrics();
+  EXPECT_EQ(100, metrics.events.expired_hash_fields);
+  EXPECT_EQ(102, metrics.events.expired_set_fields);
+  EXPECT_EQ(2, CheckedInt({"dbsize"}));  // empty containers are deleted
+  EXPECT_EQ(100, CheckedInt({"hlen", "hash"}));
+
+  // The fields that are not due yet are kept until their time comes.
+  AdvanceTime(50000);
+  DeleteExpired();
+  EXPECT_EQ(100, GetMetrics().events.expired_hash_fields);
+
+  AdvanceTime(60000);
+  DeleteExpired();
+  EXPECT_EQ(200, GetMetrics().events.expired_hash_fields);
+  EXPECT_EQ(0, CheckedInt({"dbsize"}));
+}
+
+class DflyKeyPrefixTest : public DflyEngineTest {
+ protected:
+  DflyKeyPrefixTest() : DflyEngineTest() {
+    absl::SetFlag(&FLAGS_key_prefix_compression, true);
+  }
+
+  void TearDown() {
+    absl::SetFlag(&FLAGS_key_prefix_compression, false);
+    DflyEngineTest::TearDown();
+  }
+};
+
+TEST_F(DflyKeyPrefixTest, PrefixedKeys) {
+  constexpr unsigned kNumKeys = 1000;
+  for (unsigned i = 0; i < kNumKeys; ++i) {
+    Run({"set", StrCat("tenant:1234:session:", i), StrCat(i)});
+  }
+  EXPECT_EQ(kNumKeys, CheckedInt({"dbsize"}));
+  EXPECT_GT(GetMetrics().key_prefix_bytes, 0u);
+
+  for (unsigned i = 0; i < kNumKeys; ++i) {
+    ASSERT_EQ(StrCat(i), Run({"get", StrCat("tenant:1234:session:", i)}));
+  }
+
+  auto resp = Run({"keys", "tenant:1234:session:99*"});
+  EXPECT_THAT(resp, ArrLen(11));  // 99 and 990-999
+
+  Run({"rename", "tenant:1234:session:1", "tenant:1234:session:renamed"});
+  EXPECT_EQ("1", Run({"get", "tenant:1234:session:renamed"}));
+  EXPECT_EQ(1, CheckedInt({"del", "tenant:1234:session:renamed", "tenant:1234:session:1"}));
+
+  Run({"flushall"});
+  EXPECT_EQ(0, CheckedInt({"dbsize"}));
+}
+
+class DflyValueCompressionTest : public DflyEngineTest {
+ protected:
+  DflyValueCompressionTest() : DflyEngineTest() {
+    absl::SetFlag(&FLAGS_value_compression_min_size, 64);
+  }
+
+  void TearDown() {
+    absl::SetFlag(&FLAGS_value_compression_min_size, 0);
+    DflyEngineTest::TearDown();
+  }
+};
+
+TEST_F(DflyValueCompressionTest, CompressedValues) {
+  constexpr unsigned kNumKeys = 1000;
+  auto make_val = [](unsigned i) {
+    return StrCat(R"({"id":)", i, R"(,"name":"user)", i % 7, R"(","tags":["alpha","beta"],)",
+                  R"("address":{"city":"Springfield","street":"Evergreen Terrace"},)",
+                  R"("note":")", string(100, '-'), R"("})");
+  };
+  for (unsigned i = 0; i < kNumKeys; ++i) {
+    Run({"set", StrCat("key", i), make_val(i)});
+  }
+  EXPECT_GT(GetMetrics().compression_saved_bytes, 0u);
+
+  string last = make_val(kNumKeys - 1);
+  EXPECT_EQ(last, Run({"get", StrCat("key", kNumKeys - 1)}));
+  EXPECT_EQ(last.size(), CheckedInt({"strlen", StrCat("key", kNumKeys - 1)}));
+  EXPECT_EQ(last.substr(2, 4), Run({"getrange", StrCat("key", kNumKeys - 1), "2", "5"}));
+  EXPECT_LT(CheckedInt({"memory", "usage", StrCat("key", kNumKeys - 1)}), last.size());
+
+  EXPECT_EQ(last.size() + 1, CheckedInt({"append", StrCat("key", kNumKeys - 1), "x"}));
+  EXPECT_EQ(StrCat(last, "x"), Run({"get", StrCat("key", kNumKeys - 1)}));
+  Run({"setrange", "key1", "0", "[["});
+  EXPECT_EQ(StrCat("[[", make_val(1).substr(2)), Run({"get", "key1"}));
+
+  for (unsigned i = 2; i < kNumKeys - 1; ++i) {
+    ASSERT_EQ(make_val(i), Run({"get", StrCat("key", i)}));
+  }
+
+  Run({"flushall"});
+  EXPECT_EQ(0u, GetMetrics().compression_saved_bytes);
+}
+
+class DflyValueDedupTest : public DflyEngineTest {
+ protected:
+  DflyValueDedupTest() : DflyEngineTest() {
+    absl::SetFlag(&FLAGS_value_dedup_min_size, 256);
+  }
+
+  void TearDown() {
+    absl::SetFlag(&FLAGS_value_dedup_min_size, 0);
+    DflyEngineTest::TearDown();
+  }
+};
+
+TEST_F(DflyValueDedupTest, SharedValues) {
+  constexpr unsigned kNumKeys = 100;
+  string tmpl(4096, 't');
+  for (unsigned i = 0; i < kNumKeys; ++i) {
+    Run({"set", StrCat("key", i), tmpl});
+  }
+
+  // Every shard keeps a single copy, so the saved bytes depend on the number of used shards.
+  auto metrics = GetMetrics();
+  EXPECT_GE(metrics.dedup_saved_bytes, (kNumKeys - shard_set->size()) * tmpl.size());
+  EXPECT_LE(metrics.shared_value_bytes, shard_set->size() * (tmpl.size() + 64));
+  EXPECT_EQ(tmpl, Run({"get", "key1"}));
+  EXPECT_EQ(tmpl.size(), CheckedInt({"strlen", "key1"}));
+
+  // Modifications are copied on write.
+  EXPECT_EQ(tmpl.size() + 1, CheckedInt({"append", "key1", "x"}));
+  EXPECT_EQ(StrCat(tmpl, "x"), Run({"get", "key1"}));
+  Run({"setrange", "key2", "0", "ab"});
+  EXPECT_EQ(StrCat("ab", tmpl.substr(2)), Run({"get", "key2"}));
+  for (unsigned i = 3; i < kNumKeys; ++i) {
+    ASSERT_EQ(tmpl, Run({"get", StrCat("key", i)}));
+  }
+
+  // Short values are not shared.
+  Run({"set", "short", string(100, 't')});
+  EXPECT_EQ(string(100, 't'), Run({"get", "short"}));
+
+  Run({"flushall"});
+  metrics = GetMetrics();
+  EXPECT_EQ(0u, metrics.dedup_saved_bytes);
+  EXPECT_EQ(0u, metrics.shared_value_bytes);
+}
+
 TEST_F(SingleThreadDflyEngineTest, GlobalSingleThread) {
   Run({"set", "a", "1"});
   Run({"move", "a", "1"});
@@ -355,6 +678,35 @@ TEST_F(DflyEngineTest, Memcache) {
   EXPECT_THAT(resp, ElementsAre("END"));
 }
 
+TEST_F(DflyEngineTest, MemcachePipelinedGets) {
+  using MP = MemcacheParser;
+
+  RunMC(MP::SET, "a", "1", 1);
+  RunMC(MP::SET, "b", "22", 0);
+
+  vector<MP::Command> cmds(3);
+  for (auto& cmd : cmds)
+    cmd.type = MP::GET;
+  cmds[0].key = "a";
+  cmds[1].key = "c";
+  cmds[2].key = "b";
+  cmds[2].keys_ext = {"a", "c"};
+
+  MCResponse resp = pp_->at(0)->Await([&] {
+    vector<const MP::Command*> ptrs;
+    for (const auto& cmd : cmds)
+      ptrs.push_back(&cmd);
+
+    TestConnWrapper* conn = AddFindConn(Protocol::MEMCACHE, GetId());
+    service_->DispatchManyMC(absl::MakeSpan(ptrs), conn->cmd_cntx());
+    return conn->SplitLines();
+  });
+
+  // Each command gets its own reply, in order.
+  EXPECT_THAT(resp, ElementsAre("VALUE a 1 1", "1", "END", "END", "VALUE b 0 2", "22",
+                                "VALUE a 1 1", "1", "END"));
+}
+
 TEST_F(DflyEngineTest, MemcacheFlags) {
   using MP = MemcacheParser;
 
@@ -364,6 +716,40 @@ TEST_F(DflyEngineTest, MemcacheFlags) {
   EXPECT_THAT(resp2, ElementsAre("VALUE key 42 3", "bar", "END"));
 }
 
+TEST_F(DflyEngineTest, MemcacheMeta) {
+  using MP = MemcacheParser;
+
+  auto run = [this](string_view line, string_view value = {}) {
+    MP parser;
+    MP::Command cmd;
+    uint32_t consumed = 0;
+    CHECK_EQ(MP::OK, parser.Parse(line, &consumed, &cmd)) << line;
+    return RunMC(cmd, value);
+  };
+
+  EXPECT_THAT(run("ms key 3 F42 T100\r\n", "bar"), ElementsAre("HD"));
+  EXPECT_THAT(run("ms key 3 ME q\r\n", "baz"), ElementsAre("NS"));
+  EXPECT_THAT(run("ms key 3 q\r\n", "baz"), ElementsAre());
+  EXPECT_THAT(run("ms key 1 MA\r\n", "z"), ElementsAre("HD"));
+
+  EXPECT_THAT(run("mg key v f t s k Oabc\r\n"),
+              ElementsAre("VA 4 f42 t100 s4 kkey Oabc", "bazz"));
+  EXPECT_THAT(run("mg key\r\n"), ElementsAre("HD"));
+  EXPECT_THAT(run("mg missing v\r\n"), ElementsAre("EN"));
+  EXPECT_THAT(run("mg missing v q\r\n"), ElementsAre());
+
+  EXPECT_THAT(run("ms num 2\r\n", "10"), ElementsAre("HD"));
+  EXPECT_THAT(run("ma num v\r\n"), ElementsAre("VA 2", "11"));
+  EXPECT_THAT(run("ma num MD D5 v\r\n"), ElementsAre("VA 1", "6"));
+  EXPECT_THAT(run("ma num q\r\n"), ElementsAre());
+  EXPECT_THAT(run("ma missing\r\n"), ElementsAre("NF"));
+
+  EXPECT_THAT(run("md key Oxyz\r\n"), ElementsAre("HD Oxyz"));
+  EXPECT_THAT(run("md key\r\n"), ElementsAre("NF"));
+  EXPECT_THAT(run("md key q\r\n"), ElementsAre());
+  EXPECT_THAT(run("mn\r\n"), ElementsAre("MN"));
+}
+
 TEST_F(DflyEngineTest, LimitMemory) {
   mi_option_enable(mi_option_limit_os_alloc);
   string blob(128, 'a');
@@ -502,6 +888,39 @@ TEST_F(DflyEngineTest, StickyEviction) {
   }
 }
 
+TEST_F(DflyEngineTest, LfuEvictionKeepsHotKeys) {
+  absl::FlagSaver fs;
+  SetTestFlag("cache_mode", "true");
+  SetTestFlag("cache_eviction_policy", "lfu");
+  absl::SetFlag(&FLAGS_oom_deny_ratio, 4);
+  max_memory_limit = 300000;
+  ResetService();
+  shard_set->TEST_EnableHeartBeat();
+
+  constexpr unsigned kHotKeys = 20;
+  string val(100, '.');
+  for (unsigned i = 0; i < kHotKeys; ++i) {
+    Run({"set", StrCat("hot", i), val});
+  }
+
+  // A scan-like workload that does not fit into memory, while the hot set keeps being accessed.
+  for (unsigned i = 0; i < 10000; ++i) {
+    ASSERT_EQ("OK", Run({"set", StrCat("scan", i), val}));
+    if (i % 50 == 0) {
+      for (unsigned j = 0; j < kHotKeys; ++j)
+        Run({"get", StrCat("hot", j)});
+    }
+  }
+
+  EXPECT_GT(GetMetrics().events.evicted_keys, 0u);
+
+  unsigned hot_alive = 0;
+  for (unsigned i = 0; i < kHotKeys; ++i) {
+    hot_alive += CheckedInt({"exists", StrCat("hot", i)});
+  }
+  EXPECT_GE(hot_alive, kHotKeys * 9 / 10);
+}
+
 TEST_F(DflyEngineTest, PSubscribe) {
   single_response_ = false;
   auto resp = pp_->at(1)->Await([&] { return Run({"psubscribe", "a*", "b*"}); });
@@ -519,6 +938,29 @@ TEST_F(DflyEngineTest, PSubscribe) {
   EXPECT_EQ("a*", msg.pattern);
 }
 
+TEST_F(DflyEngineTest, PSubscribeMany) {
+  single_response_ = false;
+  vector<string> args = {"psubscribe", "news.*",        "news.sport*", "n*",
+                         "*",          "news.?port",    "other*",      "new[sz].sport",
+                         "news.sport", "news.sport.\\*"};
+  pp_->at(1)->Await([&] { return Run(absl::MakeSpan(args)); });
+
+  // Only the patterns with a matching literal prefix are evaluated, but all matches count.
+  auto resp = pp_->at(0)->Await([&] { return Run({"publish", "news.sport", "foo"}); });
+  EXPECT_THAT(resp, IntArg(7));
+  resp = pp_->at(0)->Await([&] { return Run({"publish", "news.sport.*", "foo"}); });
+  EXPECT_THAT(resp, IntArg(6));
+  resp = pp_->at(0)->Await([&] { return Run({"publish", "other", "foo"}); });
+  EXPECT_THAT(resp, IntArg(2));
+
+  // The index is rebuilt when patterns are removed.
+  pp_->at(1)->Await([&] { return Run({"punsubscribe", "*", "n*"}); });
+  resp = pp_->at(0)->Await([&] { return Run({"publish", "other", "foo"}); });
+  EXPECT_THAT(resp, IntArg(1));
+  resp = pp_->at(0)->Await([&] { return Run({"publish", "news.sport", "foo"}); });
+  EXPECT_THAT(resp, IntArg(5));
+}
+
 TEST_F(DflyEngineTest, Unsubscribe) {
   auto resp = Run({"unsubscribe", "a"});
   EXPECT_THAT(resp.GetVec(), ElementsAre("unsubscribe", "a", IntArg(0)));
@@ -554,6 +996,45 @@ TEST_F(DflyEngineTest, PUnsubscribe) {
   EXPECT_THAT(resp.GetVec(), ElementsAre("punsubscribe", "b*", IntArg(0)));
 }
 
+TEST_F(DflyEngineTest, SSubscribe) {
+  auto resp = Run({"sunsubscribe"});
+  EXPECT_THAT(resp.GetVec(), ElementsAre("sunsubscribe", ArgType(RespExpr::NIL), IntArg(0)));
+
+  single_response_ = false;
+  pp_->at(1)->Await([&] { return Run({"ssubscribe", "a", "b"}); });
+  resp = pp_->at(0)->Await([&] { return Run({"spublish", "a", "foo"}); });
+  EXPECT_THAT(resp, IntArg(1));
+
+  // Sharded channels are separate from the global ones.
+  resp = pp_->at(0)->Await([&] { return Run({"publish", "a", "foo"}); });
+  EXPECT_THAT(resp, IntArg(0));
+
+  pp_->AwaitFiberOnAll([](ProactorBase* pb) {});
+
+  ASSERT_EQ(1, SubscriberMessagesLen("IO1"));
+  const auto& msg = GetPublishedMessage("IO1", 0);
+  EXPECT_EQ("foo", msg.message);
+  EXPECT_EQ("a", msg.channel);
+  EXPECT_THAT(string(msg.frame), HasSubstr("smessage"));
+
+  resp = Run({"pubsub", "shardchannels"});
+  EXPECT_THAT(resp.GetVec(), UnorderedElementsAre("a", "b"));
+  resp = Run({"pubsub", "shardnumsub", "a", "c"});
+  EXPECT_THAT(resp.GetVec(), ElementsAre("a", IntArg(1), "c", IntArg(0)));
+  resp = Run({"pubsub", "numsub", "a"});
+  EXPECT_THAT(resp.GetVec(), ElementsAre("a", IntArg(0)));
+
+  resp = pp_->at(1)->Await([&] { return Run({"sunsubscribe", "a"}); });
+  EXPECT_THAT(resp.GetVec(), ElementsAre("sunsubscribe", "a", IntArg(1)));
+  resp = pp_->at(0)->Await([&] { return Run({"spublish", "a", "foo"}); });
+  EXPECT_THAT(resp, IntArg(0));
+
+  resp = pp_->at(1)->Await([&] { return Run({"sunsubscribe"}); });
+  EXPECT_THAT(resp.GetVec(), ElementsAre("sunsubscribe", "b", IntArg(0)));
+  resp = Run({"pubsub", "shardchannels"});
+  EXPECT_THAT(resp, ArrLen(0));
+}
+
 TEST_F(DflyEngineTest, Bug468) {
   RespExpr resp = Run({"multi"});
   ASSERT_EQ(resp, "OK");
@@ -729,6 +1210,86 @@ TEST_F(DflyEngineTest, Latency) {
   Run({"latency", "latest"});
 }
 
+TEST_F(DflyEngineTest, ImmediateReads) {
+  Run({"set", "foo", "bar"});
+  for (unsigned i = 0; i < 5; ++i)
+    EXPECT_EQ(Run({"get", "foo"}), "bar");
+
+  // Uncontended single shard commands never go through the transaction queue.
+  auto metrics = GetMetrics();
+  EXPECT_EQ(metrics.shard_stats.tx_immediate_total, 6u);
+  EXPECT_EQ(metrics.shard_stats.tx_immediate_conflict_total, 0u);
+}
+
+TEST_F(DflyEngineTest, BatchSchedule) {
+  absl::SetFlag(&FLAGS_tx_batch_schedule, true);
+
+  const unsigned kFibers = 16;
+  vector<Fiber> fbs(kFibers);
+  for (unsigned i = 0; i < kFibers; ++i) {
+    fbs[i] = pp_->at(0)->LaunchFiber([this, i] {
+      string id = StrCat("w", i);
+      for (unsigned j = 0; j < 10; ++j)
+        Run(id, {"set", StrCat("key", i, ":", j), "v"});
+    });
+  }
+  for (auto& fb : fbs)
+    fb.Join();
+  absl::SetFlag(&FLAGS_tx_batch_schedule, false);
+
+  EXPECT_EQ(kFibers * 10, CheckedInt({"dbsize"}));
+  auto stats = GetMetrics().coordinator_stats;
+  EXPECT_GT(stats.tx_schedule_batch_cnt, 0u);
+  EXPECT_GE(stats.tx_schedule_batched_cnt, stats.tx_schedule_batch_cnt);
+}
+
+TEST_F(DflyEngineTest, ScheduleRing) {
+  absl::SetFlag(&FLAGS_tx_schedule_ring, true);
+
+  const unsigned kFibers = 16;
+  vector<Fiber> fbs(kFibers);
+  for (unsigned i = 0; i < kFibers; ++i) {
+    fbs[i] = pp_->at(0)->LaunchFiber([this, i] {
+      string id = StrCat("w", i);
+      for (unsigned j = 0; j < 10; ++j)
+        Run(id, {"incr", StrCat("key", j)});
+    });
+  }
+  for (auto& fb : fbs)
+    fb.Join();
+  absl::SetFlag(&FLAGS_tx_schedule_ring, false);
+
+  for (unsigned j = 0; j < 10; ++j)
+    EXPECT_EQ(Run({"get", StrCat("key", j)}), StrCat(kFibers));
+  EXPECT_GT(GetMetrics().shard_stats.tx_ring_scheduled_total, 0u);
+}
+
+TEST_F(DflyEngineTest, LockTableStripes) {
+  LockTable lt;
+  const LockFp kFp = 5, kCollidingFp = kFp + LockTable::kNumStripes;
+
+  EXPECT_TRUE(lt.Acquire(kFp, IntentLock::EXCLUSIVE));
+  EXPECT_FALSE(lt.Acquire(kFp, IntentLock::SHARED));
+  EXPECT_TRUE(lt.Acquire(kCollidingFp, IntentLock::SHARED));  // different key, same stripe
+  EXPECT_EQ(lt.Size(), 2u);
+  EXPECT_EQ(lt.OverflowSize(), 1u);
+
+  // Once the stripe is free, the colliding lock stays in the overflow map until released.
+  lt.Release(kFp, IntentLock::SHARED);
+  lt.Release(kFp, IntentLock::EXCLUSIVE);
+  EXPECT_FALSE(lt.Find(kFp));
+  EXPECT_FALSE(lt.Acquire(kCollidingFp, IntentLock::EXCLUSIVE));
+  EXPECT_EQ(lt.OverflowSize(), 1u);
+
+  lt.Release(kCollidingFp, IntentLock::SHARED);
+  lt.Release(kCollidingFp, IntentLock::EXCLUSIVE);
+  EXPECT_EQ(lt.Size(), 0u);
+
+  EXPECT_TRUE(lt.Acquire(kCollidingFp, IntentLock::SHARED));
+  EXPECT_EQ(lt.OverflowSize(), 0u);
+  EXPECT_TRUE(lt.Find(kCollidingFp)->Check(IntentLock::SHARED));
+}
+
 TEST_F(DflyEngineTest, EvalBug2664) {
   absl::FlagSaver fs;
   absl::SetFlag(&FLAGS_lua_resp2_legacy_float, true);
@@ -743,6 +1304,76 @@ TEST_F(DflyEngineTest, EvalBug2664) {
   EXPECT_THAT(resp, DoubleArg(42.9));
 }
 
+TEST_F(DflyEngineTest, DebugProfile) {
+  EXPECT_THAT(Run({"debug", "profile", "stop"}), ErrArg("Profile is not running"));
+  EXPECT_THAT(Run({"debug", "profile", "start", "hz", "0"}), ErrArg("value is not an integer"));
+
+  EXPECT_EQ(Run({"debug", "profile", "start", "hz", "1000", "stacks"}), "OK");
+  EXPECT_THAT(Run({"debug", "profile", "start"}), ErrArg("Profile is already running"));
+
+  for (unsigned i = 0; i < 1000; ++i)
+    Run({"set", absl::StrCat("key", i), string(100, 'x')});
+
+  auto resp = Run({"debug", "profile", "stop"});
+  EXPECT_THAT(resp.GetString(), HasSubstr("period_usec: 1000\n"));
+  EXPECT_THAT(resp.GetString(), HasSubstr("dropped: 0\n"));
+  EXPECT_THAT(Run({"debug", "profile", "stop"}), ErrArg("Profile is not running"));
+}
+
+TEST_F(DflyEngineTest, MemoryPrefixUsage) {
+  for (unsigned i = 0; i < 500; ++i)
+    Run({"set", absl::StrCat("user:", i), string(100, 'x')});
+  for (unsigned i = 0; i < 100; ++i)
+    Run({"set", absl::StrCat("sess:", i), string(1000, 'x')});
+  Run({"set", "plain", "x"});
+
+  // Small tables are scanned fully, so the counts are exact.
+  auto resp = Run({"memory", "prefix-usage"});
+  ASSERT_THAT(resp, ArrLen(3));
+  const auto& usage = resp.GetVec();
+  EXPECT_THAT(usage[0], RespArray(ElementsAre("sess", IntArg(100), _)));
+  EXPECT_THAT(usage[1], RespArray(ElementsAre("user", IntArg(500), _)));
+  EXPECT_THAT(usage[2], RespArray(ElementsAre("", IntArg(1), _)));
+  EXPECT_GT(get<int64_t>(usage[0].GetVec()[2].u), 100 * 1000);
+
+  resp = Run({"memory", "prefix-usage", "delimiter", "e", "top", "1"});
+  EXPECT_THAT(resp, RespArray(ElementsAre(RespArray(ElementsAre("s", IntArg(100), _)))));
+
+  EXPECT_THAT(Run({"memory", "prefix-usage", "samples", "0"}), ErrArg("syntax error"));
+  EXPECT_THAT(Run({"memory", "prefix-usage", "foo"}), ErrArg("syntax error"));
+}
+
+TEST(ShardAffinityTest, Record) {
+  ShardAffinity affinity;
+  auto record_window = [&](ShardId sid, ShardId current) {
+    optional<ShardId> res;
+    for (unsigned i = 0; i < ShardAffinity::kWindow; ++i) {
+      res = affinity.Record(i % 10 == 0 ? kInvalidSid : sid, current, 0.8);
+      if (i + 1 < ShardAffinity::kWindow)
+        EXPECT_FALSE(res);
+    }
+    return res;
+  };
+
+  // A single window is not enough, and a connection on its shard stays.
+  EXPECT_FALSE(record_window(2, 0));
+  EXPECT_FALSE(record_window(2, 2));
+
+  EXPECT_FALSE(record_window(2, 0));
+  EXPECT_EQ(record_window(2, 0), 2u);
+
+  // No moves during the cooldown.
+  for (unsigned i = 0; i < ShardAffinity::kCooldownWindows; ++i)
+    EXPECT_FALSE(record_window(3, 0));
+
+  // Mixed traffic has no dominant shard.
+  for (unsigned i = 0; i < 4; ++i)
+    EXPECT_FALSE(record_window(i % 2 == 0 ? 1 : kInvalidSid, 0));
+
+  EXPECT_FALSE(record_window(1, 0));
+  EXPECT_EQ(record_window(1, 0), 1u);
+}
+
 // TODO: to test transactions with a single shard since then all transactions become local.
 // To consider having a parameter in dragonfly engine controlling number of shards
 // unconditionally from number of cpus. TO TEST BLPOP under multi for single/multi argument case.
@@ -4,21 +4,30 @@
 
 #include "server/engine_shard_set.h"
 
+#include <absl/base/internal/cycleclock.h>
+#include <absl/cleanup/cleanup.h>
 #include <absl/strings/match.h>
+#include <absl/strings/str_split.h>
 
 #include <cerrno>
+#include <cstring>
 
 extern "C" {
 #include "redis/zmalloc.h"
 }
+#include <mimalloc.h>
+#include <sys/mman.h>
 #include <sys/statvfs.h>
+#include <unistd.h>
 
 #include <filesystem>
 
 #include "base/flags.h"
 #include "base/logging.h"
+#include "facade/numa.h"
 #include "io/proc_reader.h"
 #include "server/blocking_controller.h"
+#include "server/channel_store.h"
 #include "server/cluster/cluster_defs.h"
 #include "server/search/doc_index.h"
 #include "server/server_state.h"
@@ -34,7 +43,8 @@ ABSL_FLAG(string, tiered_prefix, "",
           "Experimental flag. Enables tiered storage if set. "
           "The string denotes the path and prefix of the files "
           " associated with tiered storage. Stronly advised to use "
-          "high performance NVME ssd disks for this.");
+          "high performance NVME ssd disks for this. A comma separated list of prefixes on "
+          "different devices spreads the files of every shard across them.");
 
 ABSL_FLAG(dfly::MemoryBytesFlag, tiered_max_file_size, dfly::MemoryBytesFlag{},
           "Limit on maximum file size that is used by the database for tiered storage. "
@@ -63,6 +73,34 @@ ABSL_FLAG(float, mem_defrag_page_utilization_threshold, 0.8,
           "memory page under utilization threshold. Ratio between used and committed size, below "
           "this, memory in this page will defragmented");
 
+ABSL_FLAG(uint32_t, mem_defrag_tick_budget_usec, 1000,
+          "Maximum CPU time in microseconds that a single run of the defragmentation task may "
+          "spend before it yields and continues from the same cursor later. 0 means no limit.");
+
+ABSL_FLAG(float, table_merge_load_factor, 0,
+          "If positive, buddy segments of the key tables that together are loaded by less than "
+          "this factor are merged during heartbeat to give memory back after mass deletions.");
+
+ABSL_FLAG(string, table_segment_arena, "",
+          "If set to 'thp' or 'hugetlb', segments of the key tables are allocated from a per shard "
+          "arena backed by transparent or explicitly reserved 2MB huge pages. Reduces TLB misses "
+          "on large tables.");
+
+ABSL_FLAG(bool, key_prefix_compression, false,
+          "If true, prefixes that are shared by many keys, i.e. the part up to the last ':', are "
+          "learned per shard and keys store a short prefix id instead. Saves key memory for "
+          "workloads with long common key prefixes.");
+
+ABSL_FLAG(uint32_t, value_compression_min_size, 0,
+          "If positive, string values of at least this size are stored compressed with zstd, "
+          "using a dictionary that every shard trains on its first values. Values that do not "
+          "compress well are stored as is. 0 disables the compression.");
+
+ABSL_FLAG(uint32_t, value_dedup_min_size, 0,
+          "If positive, string values of at least this size share a single copy per shard with "
+          "the values of identical contents, which is copied on write. Takes precedence over "
+          "value_compression_min_size. 0 disables the deduplication.");
+
 ABSL_FLAG(string, shard_round_robin_prefix, "",
           "When non-empty, keys which start with this prefix are not distributed across shards "
           "based on their value but instead via round-robin. Use cautiously! This can efficiently "
@@ -72,12 +110,35 @@ ABSL_FLAG(string, shard_round_robin_prefix, "",
 ABSL_FLAG(uint32_t, mem_defrag_check_sec_interval, 10,
           "Number of seconds between every defragmentation necessity check");
 
+ABSL_FLAG(bool, shard_memory_balancing, false,
+          "If true, the free memory and the evictions are divided among shards based on how much "
+          "data they hold and add and on their hit rates, instead of equally");
+
+ABSL_FLAG(uint32_t, heartbeat_budget_usec, 0,
+          "If positive, the background tasks of the heartbeat run in time slices of about this "
+          "many microseconds each, scaled up when the shard is idle and when a task falls "
+          "behind, and the heartbeat yields to requests between slices. The heartbeat also "
+          "runs less often when the shard is idle and more often when tasks fall behind. "
+          "0 - fixed amounts of work per heartbeat");
+
+ABSL_FLAG(dfly::MemoryBytesFlag, prefault_memory, dfly::MemoryBytesFlag{},
+          "If positive, every shard places its heap in a dedicated allocator arena on its NUMA "
+          "node and faults in its share of this many bytes, capped by maxmemory, on startup, "
+          "backed by transparent huge pages when possible. The first writes don't pay for page "
+          "faults then. The arenas reserve, but do not fault in, address space for maxmemory "
+          "each, so the shard heaps can not grow beyond the maxmemory set on startup.");
+
+ABSL_FLAG(bool, numa_bind, false,
+          "If true, the memory of every thread, including its shard heap, is allocated on the "
+          "NUMA node of the cpu the thread runs on");
+
 namespace dfly {
 
 using namespace tiering::literals;
 
 using namespace util;
 using absl::GetFlag;
+using absl::base_internal::CycleClock;
 using strings::HumanReadableNumBytes;
 
 namespace {
@@ -86,6 +147,62 @@ constexpr uint64_t kCursorDoneState = 0u;
 
 vector<EngineShardSet::CachedStats> cached_stats;  // initialized in EngineShardSet::Init
 
+// Maps size bytes, faults in the first prefault_size of them and hands them to mimalloc as an
+// arena, which only heaps created in it allocate from. Called by every shard thread, so that the
+// pages are faulted in parallel and local to numa_node, the node of the thread.
+optional<mi_arena_id_t> PrefaultMemory(size_t size, size_t prefault_size, int numa_node) {
+  // Arenas are carved into segments, so the region is aligned to them.
+  constexpr size_t kAlign = 64_MB;
+  size = (size + kAlign - 1) & ~(kAlign - 1);
+  prefault_size = min((prefault_size + kAlign - 1) & ~(kAlign - 1), size);
+
+  size_t map_size = size + kAlign;
+  void* ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  if (ptr == MAP_FAILED) {
+    LOG(WARNING) << "Could not map " << HumanReadableNumBytes(size)
+                 << " to prefault: " << strerror(errno);
+    return nullopt;
+  }
+
+  uintptr_t map_start = reinterpret_cast<uintptr_t>(ptr);
+  uintptr_t start = (map_start + kAlign - 1) & ~(kAlign - 1);
+  if (start > map_start)
+    munmap(ptr, start - map_start);
+  if (map_start + map_size > start + size)
+    munmap(reinterpret_cast<void*>(start + size), map_start + map_size - start - size);
+
+  char* region = reinterpret_cast<char*>(start);
+  uint64_t start_ns = absl::GetCurrentTimeNanos();
+
+  // Best effort, takes effect when transparent huge pages are in madvise mode.
+  madvise(region, size, MADV_HUGEPAGE);
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+  // Faults in the prefix with a single call, supported by Linux 5.14 and later.
+  if (madvise(region, prefault_size, MADV_POPULATE_WRITE) != 0) {
+    const size_t page_size = getpagesize();
+    for (size_t offs = 0; offs < prefault_size; offs += page_size)
+      reinterpret_cast<volatile char*>(region)[offs] = 0;
+  }
+
+  // The pages are committed, as far as mimalloc is concerned, and still zeroed.
+  mi_arena_id_t arena_id;
+  if (!mi_manage_os_memory_ex(region, size, true, false, true, numa_node, true, &arena_id)) {
+    LOG(WARNING) << "Could not hand over the prefaulted memory to the allocator";
+    munmap(region, size);
+    return nullopt;
+  }
+
+  VLOG(1) << "Prefaulted " << HumanReadableNumBytes(prefault_size) << " of "
+          << HumanReadableNumBytes(size) << " in "
+          << (absl::GetCurrentTimeNanos() - start_ns) / 1000000 << "ms";
+  return arena_id;
+}
+
 struct ShardMemUsage {
   std::size_t commited = 0;
   std::size_t used = 0;
@@ -104,6 +221,18 @@ ShardMemUsage ReadShardMemUsage(float wasted_ratio) {
   return usage;
 }
 
+unique_ptr<SegmentArena> CreateSegmentArena(PMR_NS::memory_resource* upstream) {
+  string mode = GetFlag(FLAGS_table_segment_arena);
+  if (mode.empty())
+    return nullptr;
+
+  LOG_IF(FATAL, mode != "thp" && mode != "hugetlb")
+      << "Unsupported table_segment_arena " << mode << ", expected thp or hugetlb";
+  auto arena_mode =
+      mode == "thp" ? SegmentArena::Mode::kTransparent : SegmentArena::Mode::kExplicit;
+  return make_unique<SegmentArena>(sizeof(PrimeTable::Segment_t), arena_mode, upstream);
+}
+
 // RoundRobinSharder implements a way to distribute keys that begin with some prefix.
 // Round-robin is disabled by default. It is not a general use-case optimization, but instead only
 // reasonable when there are a few highly contended keys, which we'd like to spread between the
@@ -202,6 +331,40 @@ vector<ShardId> RoundRobinSharder::round_robin_shards_;
 ShardId RoundRobinSharder::next_shard_;
 fb2::Mutex RoundRobinSharder::mutex_;
 
+// Publishes new memory shares of the shards, based on their demand since the last call.
+void BalanceShardMemory(vector<EngineShardSet::MemoryDemand>* last) {
+  const size_t num_shards = cached_stats.size();
+  last->resize(num_shards);
+  vector<EngineShardSet::MemoryDemand> demand(num_shards);
+  vector<EngineShardSet::MemoryShares> shares(num_shards);
+  for (size_t sid = 0; sid < num_shards; ++sid) {
+    const EngineShardSet::CachedStats& stats = cached_stats[sid];
+    EngineShardSet::MemoryDemand cur;
+    cur.used = stats.used_memory.load(memory_order_relaxed);
+    cur.hits = stats.hits.load(memory_order_relaxed);
+    cur.misses = stats.misses.load(memory_order_relaxed);
+
+    // Counters restart with CONFIG RESETSTAT, the round of the reset counts no lookups.
+    const EngineShardSet::MemoryDemand& prev = (*last)[sid];
+    demand[sid].used = cur.used;
+    demand[sid].growth = cur.used > prev.used ? cur.used - prev.used : 0;
+    demand[sid].hits = cur.hits >= prev.hits ? cur.hits - prev.hits : 0;
+    demand[sid].misses = cur.misses >= prev.misses ? cur.misses - prev.misses : 0;
+    (*last)[sid] = cur;
+
+    shares[sid].budget = stats.budget_share.load(memory_order_relaxed);
+    shares[sid].eviction = stats.eviction_share.load(memory_order_relaxed);
+  }
+
+  EngineShardSet::BalanceMemoryShares(demand, &shares);
+
+  // The shares are only read by the shards, so updating them one by one is fine.
+  for (size_t sid = 0; sid < num_shards; ++sid) {
+    cached_stats[sid].budget_share.store(shares[sid].budget, memory_order_relaxed);
+    cached_stats[sid].eviction_share.store(shares[sid].eviction, memory_order_relaxed);
+  }
+}
+
 }  // namespace
 
 constexpr size_t kQueueLen = 64;
@@ -211,7 +374,7 @@ EngineShardSet* shard_set = nullptr;
 uint64_t TEST_current_time_ms = 0;
 
 EngineShard::Stats& EngineShard::Stats::operator+=(const EngineShard::Stats& o) {
-  static_assert(sizeof(Stats) == 48);
+  static_assert(sizeof(Stats) == 64);
 
   defrag_attempt_total += o.defrag_attempt_total;
   defrag_realloc_total += o.defrag_realloc_total;
@@ -219,6 +382,8 @@ EngineShard::Stats& EngineShard::Stats::operator+=(const EngineShard::Stats& o)
   poll_execution_total += o.poll_execution_total;
   tx_ooo_total += o.tx_ooo_total;
   tx_immediate_total += o.tx_immediate_total;
+  tx_immediate_conflict_total += o.tx_immediate_conflict_total;
+  tx_ring_scheduled_total += o.tx_ring_scheduled_total;
 
   return *this;
 }
@@ -292,8 +457,12 @@ bool EngineShard::DoDefrag() {
 
   constexpr size_t kMaxTraverses = 40;
   const float threshold = GetFlag(FLAGS_mem_defrag_page_utilization_threshold);
+  const uint64_t budget_cycles =
+      GetFlag(FLAGS_mem_defrag_tick_budget_usec) * CycleClock::Frequency() / 1000000;
 
   auto& slice = db_slice();
+  if (slice.IsLockedForSerialization())
+    return false;  // the scan continues from the same cursor on the next run
 
   // If we moved to an invalid db, skip as long as it's not the last one
   while (!slice.IsDbValid(defrag_state_.dbid) && defrag_state_.dbid + 1 < slice.db_array_size())
@@ -311,9 +480,22 @@ bool EngineShard::DoDefrag() {
   uint64_t reallocations = 0;
   unsigned traverses_count = 0;
   uint64_t attempts = 0;
+  string tmp;
+  const uint64_t start = CycleClock::Now();
+
+  // Moving the members of large containers may take long, so the run is bounded by the budget
+  // as well as by the number of traversed buckets.
+  auto within_budget = [&] {
+    return budget_cycles == 0 || CycleClock::Now() - start < budget_cycles;
+  };
 
   do {
+    prime_table->PrefetchTraversal(cur, PrefetchEntry);
     cur = prime_table->Traverse(cur, [&](PrimeIterator it) {
+      // Locked values may be referenced by replies that are still being sent.
+      if (!slice.CheckLock(IntentLock::EXCLUSIVE, defrag_state_.dbid, it->first.GetSlice(&tmp)))
+        return;
+
       // for each value check whether we should move it because it
       // seats on underutilized page of memory, and if so, do it.
       bool did = it->second.DefragIfNeeded(threshold);
@@ -323,7 +505,7 @@ bool EngineShard::DoDefrag() {
       }
     });
     traverses_count++;
-  } while (traverses_count < kMaxTraverses && cur);
+  } while (traverses_count < kMaxTraverses && cur && within_budget());
 
   defrag_state_.UpdateScanState(cur.value());
 
@@ -359,7 +541,7 @@ uint32_t EngineShard::DefragTask() {
 
   if (defrag_state_.CheckRequired()) {
     VLOG(2) << shard_id << ": need to run defrag memory cursor state: " << defrag_state_.cursor;
-    if (DoDefrag()) {
+    if (RunBackground(BG_DEFRAG, [this] { return DoDefrag(); })) {
       // we didn't finish the scan
       return util::ProactorBase::kOnIdleMaxLevel;
     }
@@ -367,16 +549,25 @@ uint32_t EngineShard::DefragTask() {
   return kRunAtLowPriority;
 }
 
+uint32_t EngineShard::LazyFreeTask() {
+  constexpr uint32_t kRunAtLowPriority = 0u;
+  if (!RunBackground(BG_LAZY_FREE, [this] { return db_slice_.LazyFreeStep(); }))
+    return kRunAtLowPriority;
+  return util::ProactorBase::kOnIdleMaxLevel;
+}
+
 EngineShard::EngineShard(util::ProactorBase* pb, mi_heap_t* heap)
     : queue_(1, kQueueLen),
       txq_([](const Transaction* t) { return t->txid(); }),
       mi_resource_(heap),
+      segment_arena_(CreateSegmentArena(&mi_resource_)),
       db_slice_(pb->GetPoolIndex(), GetFlag(FLAGS_cache_mode), this) {
   tmp_str1 = sdsempty();
 
   db_slice_.UpdateExpireBase(absl::GetCurrentTimeNanos() / 1000000, 0);
   // start the defragmented task here
   defrag_task_ = pb->AddOnIdleTask([this]() { return this->DefragTask(); });
+  lazy_free_task_ = pb->AddOnIdleTask([this]() { return this->LazyFreeTask(); });
   queue_.Start(absl::StrCat("shard_queue_", db_slice_.shard_id()));
 }
 
@@ -398,6 +589,7 @@ void EngineShard::Shutdown() {
   }
 
   ProactorBase::me()->RemoveOnIdleTask(defrag_task_);
+  ProactorBase::me()->RemoveOnIdleTask(lazy_free_task_);
 }
 
 void EngineShard::StartPeriodicFiber(util::ProactorBase* pb) {
@@ -420,6 +612,9 @@ void EngineShard::InitThreadLocal(ProactorBase* pb, bool update_db_time, size_t
 
   CompactObj::InitThreadLocal(shard_->memory_resource());
   SmallString::InitThreadLocal(data_heap);
+  CompactObj::InitKeyPrefixes(GetFlag(FLAGS_key_prefix_compression));
+  CompactObj::InitValueCompression(GetFlag(FLAGS_value_compression_min_size));
+  CompactObj::InitValueDedup(GetFlag(FLAGS_value_dedup_min_size));
 
   if (string backing_prefix = GetFlag(FLAGS_tiered_prefix); !backing_prefix.empty()) {
     LOG_IF(FATAL, pb->GetKind() != ProactorBase::IOURING)
@@ -433,6 +628,7 @@ void EngineShard::InitThreadLocal(ProactorBase* pb, bool update_db_time, size_t
   RoundRobinSharder::Init();
 
   shard_->shard_search_indices_.reset(new ShardDocIndices());
+  shard_->shard_channels_.reset(new ShardChannels());
 
   if (update_db_time) {
     // Must be last, as it accesses objects initialized above.
@@ -452,6 +648,9 @@ void EngineShard::DestroyThreadLocal() {
   shard_->~EngineShard();
   mi_free(shard_);
   shard_ = nullptr;
+  CompactObj::InitKeyPrefixes(false);
+  CompactObj::InitValueCompression(0);
+  CompactObj::InitValueDedup(0);
   CompactObj::InitThreadLocal(nullptr);
   mi_heap_delete(tlh);
   RoundRobinSharder::Destroy();
@@ -467,6 +666,14 @@ void EngineShard::PollExecution(const char* context, Transaction* trans) {
   ShardId sid = shard_id();
   stats_.poll_execution_total++;
 
+  absl::Cleanup account_busy = [this, start = CycleClock::Now()] {
+    uint64_t usec = (CycleClock::Now() - start) * 1000000 / CycleClock::Frequency();
+    load_stats_.busy_usec_total += usec;
+    counter_[BUSY_USEC].IncBy(usec);
+  };
+
+  DrainScheduleRing();
+
   // If any of the following flags are present, we are guaranteed to run in this function:
   // 1. AWAKED_Q -> Blocking transactions are executed immediately after waking up, they don't
   // occupy a place in txq and have highest priority
@@ -571,18 +778,91 @@ void EngineShard::PollExecution(const char* context, Transaction* trans) {
   }
 }
 
+bool EngineShard::PushSchedule(ScheduleRequest req) {
+  if (!schedule_ring_.TryPush(req))
+    return false;
+
+  if (!schedule_ring_notified_.exchange(true, memory_order_acq_rel))
+    queue_.Add([] { EngineShard::tlocal()->PollExecution("schedule_ring", nullptr); });
+  return true;
+}
+
+void EngineShard::DrainScheduleRing() {
+  // The flag is cleared before draining, so requests published concurrently either are drained
+  // now or notify the shard again.
+  if (!schedule_ring_notified_.load(memory_order_relaxed) ||
+      !schedule_ring_notified_.exchange(false, memory_order_acq_rel))
+    return;
+
+  ScheduleRequest req;
+  while (schedule_ring_.TryPop(&req)) {
+    stats_.tx_ring_scheduled_total++;
+    req.tx->ScheduleFromRing(this, req.can_run_immediately);
+  }
+}
+
 void EngineShard::RemoveContTx(Transaction* tx) {
   if (continuation_trans_ == tx) {
     continuation_trans_ = nullptr;
   }
 }
 
+const char* EngineShard::BackgroundTaskName(BackgroundTask task) {
+  static constexpr const char* kNames[BG_TASK_TOTAL] = {
+      "expiry", "field_expiry", "eviction", "defrag", "tiering", "merge", "lazy_free"};
+  return kNames[task];
+}
+
+template <typename F> bool EngineShard::RunBackground(BackgroundTask task, F&& step) {
+  constexpr uint8_t kMaxBacklog = 3;
+
+  uint64_t start = CycleClock::Now();
+  bool more = step();
+  if (background_slice_cycles_ > 0) {
+    uint8_t& backlog = background_backlog_[task];
+    uint64_t slice = background_slice_cycles_ << backlog;
+    while (more && CycleClock::Now() - start < slice)
+      more = step();
+
+    if (more)
+      backlog = min<uint8_t>(backlog + 1, kMaxBacklog);
+    else if (backlog > 0)
+      --backlog;
+  }
+
+  uint64_t usec = (CycleClock::Now() - start) * 1000000 / CycleClock::Frequency();
+  load_stats_.background_usec[task] += usec;
+  background_counter_[task].IncBy(usec);
+  return more;
+}
+
 void EngineShard::Heartbeat() {
   CacheStats();
+  counter_[TX_QUEUE_LEN].IncBy(txq_.size());
+  counter_[HEARTBEATS].IncBy(1);
+  db_slice_.UpdateSlotLoad(GetCurrentTimeMs());
+
+  // The slices shrink to a quarter of the budget when the shard was busy during the last 6
+  // seconds and double when it was idle.
+  if (uint32_t budget_usec = GetFlag(FLAGS_heartbeat_budget_usec); budget_usec > 0) {
+    double idle = 1.0 - min(1.0, GetMovingSum6(BUSY_USEC) / 6e6);
+    background_slice_cycles_ =
+        budget_usec * (0.25 + 1.75 * idle) * CycleClock::Frequency() / 1000000;
+  } else {
+    background_slice_cycles_ = 0;
+  }
+  const bool sliced = background_slice_cycles_ > 0;
+
+  // Idle time is scarce under load, so lazy freeing also progresses with every heartbeat.
+  RunBackground(BG_LAZY_FREE, [this] { return db_slice_.LazyFreeStep(); });
 
   if (IsReplica())  // Never run expiration on replica.
     return;
 
+  // A snapshot is saving a big value in parts, the tables must not change meanwhile.
+  if (db_slice_.IsLockedForSerialization())
+    return;
+
   constexpr double kTtlDeleteLimit = 200;
   constexpr double kRedLimitFactor = 0.1;
 
@@ -597,36 +877,112 @@ void EngineShard::Heartbeat() {
     ttl_delete_target = kTtlDeleteLimit * double(deleted) / (double(traversed) + 10);
   }
 
-  ssize_t eviction_redline = (max_memory_limit * kRedLimitFactor) / shard_set->size();
+  // Max number of due keys to delete per db per heartbeat when the expire wheel is enabled,
+  // or per step when the tasks are sliced. Likewise for the due table buckets to visit when the
+  // expire time buckets are enabled.
+  const unsigned expire_wheel_batch = sliced ? 100 : 1000;
+
+  // Max number of hash and set buckets to check for expired fields per db per heartbeat.
+  constexpr unsigned kFieldExpiryBudget = 1000;
+
+  // Time budget for merging table segments per heartbeat, unless the tasks are sliced.
+  const uint64_t merge_budget_usec =
+      sliced ? background_slice_cycles_ * 1000000 / CycleClock::Frequency() : 100;
+  const float merge_load_factor = GetFlag(FLAGS_table_merge_load_factor);
+
+  // The budget is a share of the free memory, so the redline is the same share of the global
+  // one, while the bytes to evict are the eviction share of the global deficit.
+  const auto& shard_stats = cached_stats[shard_id()];
+  double budget_share = shard_stats.budget_share.load(memory_order_relaxed);
+  double eviction_share = shard_stats.eviction_share.load(memory_order_relaxed);
+  ssize_t eviction_redline = ssize_t(max_memory_limit * kRedLimitFactor * budget_share);
   size_t tiering_redline =
       (max_memory_limit * GetFlag(FLAGS_tiered_offload_threshold)) / shard_set->size();
 
   DbContext db_cntx;
   db_cntx.time_now_ms = GetCurrentTimeMs();
 
+  // Between the slices the heartbeat gives way to requests, which may flush the db, start a
+  // snapshot or turn the shard into a replica.
+  auto yield = [&](DbIndex i) {
+    if (!sliced)
+      return true;
+    ThisFiber::Yield();
+    return db_slice_.IsDbValid(i) && !db_slice_.IsLockedForSerialization() && !IsReplica();
+  };
+
   for (unsigned i = 0; i < db_slice_.db_array_size(); ++i) {
     if (!db_slice_.IsDbValid(i))
       continue;
 
     db_cntx.db_index = i;
-    auto [pt, expt] = db_slice_.GetTables(i);
-    if (expt->size() > pt->size() / 4) {
-      DbSlice::DeleteExpiredStats stats = db_slice_.DeleteExpiredStep(db_cntx, ttl_delete_target);
+    RunBackground(BG_EXPIRY, [&] {
+      auto [pt, expt] = db_slice_.GetTables(i);
+      if (expt->size() > pt->size() / 4) {
+        DbSlice::DeleteExpiredStats stats =
+            db_slice_.DeleteExpiredStep(db_cntx, ttl_delete_target);
+
+        counter_[TTL_TRAVERSE].IncBy(stats.traversed);
+        counter_[TTL_DELETE].IncBy(stats.deleted);
+      }
 
-      counter_[TTL_TRAVERSE].IncBy(stats.traversed);
-      counter_[TTL_DELETE].IncBy(stats.deleted);
-    }
+      // Sampling above is still needed for the keys that were scheduled before the wheel or
+      // the time buckets existed. The sampling runs once, the indices while they have due keys.
+      return false;
+    });
+    RunBackground(BG_EXPIRY, [&] {
+      return db_slice_.DeleteExpiredFromWheel(db_cntx, expire_wheel_batch).deleted ==
+             expire_wheel_batch;
+    });
+    RunBackground(BG_EXPIRY, [&] {
+      db_slice_.DeleteExpiredFromBuckets(db_cntx, expire_wheel_batch);
+      return db_slice_.ExpireBacklog(i, db_cntx.time_now_ms) > 0;
+    });
+    if (!yield(i))
+      break;
 
-    // if our budget is below the limit
-    if (db_slice_.memory_budget() < eviction_redline) {
-      db_slice_.FreeMemWithEvictionStep(i, eviction_redline - db_slice_.memory_budget());
+    RunBackground(BG_FIELD_EXPIRY, [&] {
+      db_slice_.DeleteExpiredFields(db_cntx, kFieldExpiryBudget);
+      return false;
+    });
+
+    if (merge_load_factor > 0) {
+      RunBackground(BG_MERGE, [&] {
+        db_slice_.MergeSegmentsStep(i, merge_load_factor, merge_budget_usec);
+        return false;
+      });
     }
+    if (!yield(i))
+      break;
 
-    if (tiered_storage_ && UsedMemory() > tiering_redline) {
-      tiered_storage_->RunOffloading(i);
+    // if our budget is below the limit. Values waiting to be freed lazily will return to it.
+    RunBackground(BG_EVICTION, [&] {
+      ssize_t memory_budget =
+          db_slice_.memory_budget() + ssize_t(db_slice_.lazy_free_queue().pending_bytes());
+      if (memory_budget >= eviction_redline)
+        return false;
+
+      double deficit = eviction_redline - memory_budget;
+      db_slice_.FreeMemWithEvictionStep(i, size_t(deficit / budget_share * eviction_share));
+      return db_slice_.memory_budget() < eviction_redline;
+    });
+
+    if (tiered_storage_) {
+      RunBackground(BG_TIERING, [&] {
+        if (UsedMemory() > tiering_redline)
+          tiered_storage_->RunOffloading(i);
+        tiered_storage_->RunCompaction(i);
+        return false;
+      });
     }
+    if (!yield(i))
+      break;
   }
 
+  // Keys expired or evicted during the heartbeat, or lazily since the last one, are published
+  // together instead of per step.
+  db_slice_.SendKeyspaceEvents();
+
   // Journal entries for expired entries are not writen to socket in the loop above.
   // Trigger write to socket when loop finishes.
   if (auto journal = EngineShard::tlocal()->journal(); journal) {
@@ -638,10 +994,27 @@ void EngineShard::RunPeriodic(std::chrono::milliseconds period_ms) {
   bool runs_global_periodic = (shard_id() == 0);  // Only shard 0 runs global periodic.
   unsigned global_count = 0;
   int64_t last_stats_time = time(nullptr);
+  vector<EngineShardSet::MemoryDemand> last_demand;
 
   while (true) {
+    uint64_t start = CycleClock::Now();
     Heartbeat();
-    if (fiber_periodic_done_.WaitFor(period_ms)) {
+    if ((CycleClock::Now() - start) * 1000 / CycleClock::Frequency() >= uint64_t(period_ms.count()))
+      ++load_stats_.heartbeat_overrun_total;
+
+    // With sliced background tasks, the heartbeat runs twice as often while a task falls
+    // behind, and four times less often while the shard is idle.
+    auto wait_ms = period_ms;
+    if (background_slice_cycles_ > 0) {
+      bool backlog = any_of(begin(background_backlog_), end(background_backlog_),
+                            [](uint8_t backlog) { return backlog > 0; });
+      if (backlog)
+        wait_ms = max(period_ms / 2, std::chrono::milliseconds{1});
+      else if (GetMovingSum6(BUSY_USEC) < 60'000)  // less than 1% busy
+        wait_ms = period_ms * 4;
+    }
+
+    if (fiber_periodic_done_.WaitFor(wait_ms)) {
       VLOG(2) << "finished running engine shard periodic task";
       return;
     }
@@ -658,6 +1031,9 @@ void EngineShard::RunPeriodic(std::chrono::milliseconds period_ms) {
 
         used_mem_current.store(sum, memory_order_relaxed);
 
+        if (GetFlag(FLAGS_shard_memory_balancing))
+          BalanceShardMemory(&last_demand);
+
         // Single writer, so no races.
         if (sum > used_mem_peak.load(memory_order_relaxed))
           used_mem_peak.store(sum, memory_order_relaxed);
@@ -699,12 +1075,36 @@ void EngineShard::CacheStats() {
   size_t obj_memory = table_memory <= used_mem ? used_mem - table_memory : 0;
 
   size_t bytes_per_obj = entries > 0 ? obj_memory / entries : 0;
-  db_slice_.SetCachedParams(free_mem / shard_set->size(), bytes_per_obj);
+  double budget_share = cached_stats[db_slice_.shard_id()].budget_share.load(memory_order_relaxed);
+  db_slice_.SetCachedParams(int64_t(free_mem * budget_share), bytes_per_obj);
+
+  const SliceEvents& events = db_slice_.events();
+  cached_stats[db_slice_.shard_id()].hits.store(events.hits, memory_order_relaxed);
+  cached_stats[db_slice_.shard_id()].misses.store(events.misses, memory_order_relaxed);
+}
+
+void EngineShard::DisownValue(const PrimeValue& pv) {
+  void* block = pv.SingleBlock();
+  DCHECK(block);
+  if (pv.ObjType() == OBJ_STRING)
+    mi_resource_.Disown(block);
+  else
+    zmalloc_used_memory_tl -= zmalloc_usable_size(block);
+}
+
+void EngineShard::AdoptValue(const PrimeValue& pv) {
+  void* block = pv.SingleBlock();
+  DCHECK(block);
+  if (pv.ObjType() == OBJ_STRING)
+    mi_resource_.Adopt(block);
+  else
+    zmalloc_used_memory_tl += zmalloc_usable_size(block);
 }
 
 size_t EngineShard::UsedMemory() const {
-  return mi_resource_.used() + zmalloc_used_memory_tl + SmallString::UsedThreadLocal() +
-         search_indices()->GetUsedMemory();
+  size_t arena_bytes = segment_arena_ ? segment_arena_->mapped_bytes() : 0;
+  return mi_resource_.used() + arena_bytes + zmalloc_used_memory_tl +
+         SmallString::UsedThreadLocal() + search_indices()->GetUsedMemory();
 }
 
 BlockingController* EngineShard::EnsureBlockingController() {
@@ -767,15 +1167,15 @@ auto EngineShard::AnalyzeTxQueue() const -> TxQueueInfo {
       continue;
 
     info.total_locks += table->trans_locks.Size();
-    for (const auto& [key, lock] : table->trans_locks) {
+    table->trans_locks.ForEach([&info](LockFp fp, const IntentLock& lock) {
       if (lock.IsContended()) {
         info.contended_locks++;
         if (lock.ContentionScore() > info.max_contention_score) {
           info.max_contention_score = lock.ContentionScore();
-          info.max_contention_lock = key;
+          info.max_contention_lock = fp;
         }
       }
-    }
+    });
   }
 
   return info;
@@ -793,20 +1193,26 @@ auto EngineShard::AnalyzeTxQueue() const -> TxQueueInfo {
 
  */
 
+// Sum of the sizes of the filesystems hosting the tiered prefixes
 uint64_t GetFsLimit() {
-  std::filesystem::path file_path(GetFlag(FLAGS_tiered_prefix));
-  std::string dir_name_str = file_path.parent_path().string();
-
-  if (dir_name_str.empty())
-    dir_name_str = ".";
-
-  struct statvfs stat;
-  if (statvfs(dir_name_str.c_str(), &stat) == 0) {
-    uint64_t limit = stat.f_frsize * stat.f_blocks;
-    return limit;
+  uint64_t limit = 0;
+  string prefixes = GetFlag(FLAGS_tiered_prefix);
+  for (string_view prefix : absl::StrSplit(prefixes, ',', absl::SkipWhitespace())) {
+    std::filesystem::path file_path(prefix);
+    std::string dir_name_str = file_path.parent_path().string();
+
+    if (dir_name_str.empty())
+      dir_name_str = ".";
+
+    struct statvfs stat;
+    if (statvfs(dir_name_str.c_str(), &stat) == 0) {
+      limit += stat.f_frsize * stat.f_blocks;
+    } else {
+      LOG(WARNING) << "Error getting filesystem information " << errno;
+      return 0;
+    }
   }
-  LOG(WARNING) << "Error getting filesystem information " << errno;
-  return 0;
+  return limit;
 }
 
 size_t GetTieredFileLimit(size_t threads) {
@@ -844,11 +1250,29 @@ size_t GetTieredFileLimit(size_t threads) {
 void EngineShardSet::Init(uint32_t sz, bool update_db_time) {
   CHECK_EQ(0u, size());
   cached_stats.resize(sz);
+  for (auto& stats : cached_stats) {
+    stats.budget_share = 1.0 / sz;
+    stats.eviction_share = 1.0 / sz;
+  }
   shard_queue_.resize(sz);
+  shards_.resize(sz);
 
   size_t max_shard_file_size = GetTieredFileLimit(sz);
+  size_t prefault_size = min<size_t>(GetFlag(FLAGS_prefault_memory).value, max_memory_limit) / sz;
+
+  bool numa_bind = GetFlag(FLAGS_numa_bind);
+
+  // The shards are initialized in parallel, each on its own thread.
   pp_->AwaitFiberOnAll([&](uint32_t index, ProactorBase* pb) {
+    int numa_node = facade::numa::InitThread(index, numa_bind);
     if (index < shard_queue_.size()) {
+      if (prefault_size) {
+        // Any shard may need up to maxmemory, for example with --shard_memory_balancing.
+        auto arena_id = PrefaultMemory(max_memory_limit, prefault_size,
+                                       facade::numa::NumNodes() > 1 ? numa_node : -1);
+        if (arena_id)
+          ServerState::tlocal()->SetDataHeap(mi_heap_new_in_arena(*arena_id));
+      }
       InitThreadLocal(pb, update_db_time, max_shard_file_size);
     }
   });
@@ -862,12 +1286,49 @@ void EngineShardSet::InitThreadLocal(ProactorBase* pb, bool update_db_time, size
   EngineShard::InitThreadLocal(pb, update_db_time, max_file_size);
   EngineShard* es = EngineShard::tlocal();
   shard_queue_[es->shard_id()] = es->GetFiberQueue();
+  shards_[es->shard_id()] = es;
 }
 
 const vector<EngineShardSet::CachedStats>& EngineShardSet::GetCachedStats() {
   return cached_stats;
 }
 
+void EngineShardSet::BalanceMemoryShares(const vector<MemoryDemand>& demand,
+                                         vector<MemoryShares>* shares) {
+  constexpr double kMinShareFactor = 0.1;
+  const size_t num_shards = demand.size();
+  DCHECK_EQ(num_shards, shares->size());
+
+  // A shard without lookups is neither hot nor cold.
+  vector<double> hit_ratio(num_shards);
+  for (size_t sid = 0; sid < num_shards; ++sid) {
+    uint64_t lookups = demand[sid].hits + demand[sid].misses;
+    hit_ratio[sid] = lookups ? double(demand[sid].hits) / lookups : 0.5;
+  }
+
+  vector<double> budget_score(num_shards), eviction_score(num_shards);
+  double budget_sum = 0, eviction_sum = 0;
+  for (size_t sid = 0; sid < num_shards; ++sid) {
+    budget_score[sid] = (demand[sid].used + demand[sid].growth) * (0.5 + hit_ratio[sid]);
+    eviction_score[sid] = demand[sid].used * (1.5 - hit_ratio[sid]);
+    budget_sum += budget_score[sid];
+    eviction_sum += eviction_score[sid];
+  }
+
+  auto target = [&](double score, double sum) {
+    double fair = 1.0 / num_shards;
+    if (sum == 0)
+      return fair;
+    return kMinShareFactor * fair + (1 - kMinShareFactor) * score / sum;
+  };
+
+  for (size_t sid = 0; sid < num_shards; ++sid) {
+    MemoryShares& cur = (*shares)[sid];
+    cur.budget = (cur.budget + target(budget_score[sid], budget_sum)) / 2;
+    cur.eviction = (cur.eviction + target(eviction_score[sid], eviction_sum)) / 2;
+  }
+}
+
 void EngineShardSet::TEST_EnableHeartBeat() {
   RunBriefInParallel([](EngineShard* shard) { shard->TEST_EnableHeartbeat(); });
 }
@@ -13,6 +13,8 @@ extern "C" {
 #include <xxhash.h>
 
 #include "core/mi_memory_resource.h"
+#include "core/mpsc_ring.h"
+#include "core/segment_arena.h"
 #include "core/task_queue.h"
 #include "core/tx_queue.h"
 #include "server/db_slice.h"
@@ -27,6 +29,7 @@ class Journal;
 
 class TieredStorage;
 class ShardDocIndices;
+class ShardChannels;
 class BlockingController;
 
 class EngineShard {
@@ -38,11 +41,41 @@ class EngineShard {
     uint64_t poll_execution_total = 0;
 
     uint64_t tx_immediate_total = 0;
+    uint64_t tx_immediate_conflict_total = 0;  // immediate runs rejected by a conflicting lock
     uint64_t tx_ooo_total = 0;
+    uint64_t tx_ring_scheduled_total = 0;  // schedule hops drained from the schedule ring
 
     Stats& operator+=(const Stats&);
   };
 
+  // Background work of the heartbeat and of the idle tasks, whose time is accounted per task.
+  enum BackgroundTask : uint8_t {
+    BG_EXPIRY,
+    BG_FIELD_EXPIRY,
+    BG_EVICTION,
+    BG_DEFRAG,
+    BG_TIERING,
+    BG_MERGE,
+    BG_LAZY_FREE,
+    BG_TASK_TOTAL
+  };
+
+  static const char* BackgroundTaskName(BackgroundTask task);
+
+  // Load of the shard thread. Reported per shard, so that imbalances between shards show up.
+  struct LoadStats {
+    uint64_t busy_usec_total = 0;          // time spent in PollExecution
+    uint64_t heartbeat_overrun_total = 0;  // heartbeats that ran longer than their period
+    uint64_t background_usec[BG_TASK_TOTAL] = {};  // time spent in every background task
+  };
+
+  // Schedule hop of a single shard transaction, published by its coordinator to the schedule
+  // ring of the shard instead of a shard queue task.
+  struct ScheduleRequest {
+    Transaction* tx;
+    bool can_run_immediately;
+  };
+
   // EngineShard() is private down below.
   ~EngineShard();
 
@@ -72,6 +105,22 @@ class EngineShard {
     return &mi_resource_;
   }
 
+  // Move the accounting of the heap block of a value that is handed over between shards without
+  // copying, see CompactObj::SingleBlock.
+  void DisownValue(const PrimeValue& pv);
+  void AdoptValue(const PrimeValue& pv);
+
+  // Memory resource for the segments of prime tables.
+  PMR_NS::memory_resource* segment_memory_resource() {
+    return segment_arena_ ? static_cast<PMR_NS::memory_resource*>(segment_arena_.get())
+                          : &mi_resource_;
+  }
+
+  // nullptr unless --table_segment_arena is set.
+  const SegmentArena* segment_arena() const {
+    return segment_arena_.get();
+  }
+
   TaskQueue* GetFiberQueue() {
     return &queue_;
   }
@@ -80,6 +129,10 @@ class EngineShard {
   // shard. Tries executing the passed transaction if possible (does not guarantee though).
   void PollExecution(const char* context, Transaction* trans);
 
+  // Publishes a schedule request to the schedule ring. Can be called from any thread.
+  // Returns false if the ring is full.
+  bool PushSchedule(ScheduleRequest req);
+
   // Returns transaction queue.
   TxQueue* txq() {
     return &txq_;
@@ -110,6 +163,10 @@ class EngineShard {
     return stats_;
   }
 
+  const LoadStats& load_stats() const {
+    return load_stats_;
+  }
+
   // Returns used memory for this shard.
   size_t UsedMemory() const;
 
@@ -121,6 +178,11 @@ class EngineShard {
     return shard_search_indices_.get();
   }
 
+  // Sharded pub/sub channels owned by this shard.
+  ShardChannels* shard_channels() const {
+    return shard_channels_.get();
+  }
+
   BlockingController* EnsureBlockingController();
 
   BlockingController* blocking_controller() {
@@ -131,13 +193,25 @@ class EngineShard {
   sds tmp_str1;
 
   // Moving average counters.
-  enum MovingCnt { TTL_TRAVERSE, TTL_DELETE, COUNTER_TOTAL };
+  enum MovingCnt {
+    TTL_TRAVERSE,
+    TTL_DELETE,
+    BUSY_USEC,     // usec spent in PollExecution
+    TX_QUEUE_LEN,  // tx queue length sampled by every heartbeat
+    HEARTBEATS,
+    COUNTER_TOTAL
+  };
 
   // Returns moving sum over the last 6 seconds.
   uint32_t GetMovingSum6(MovingCnt type) const {
     return counter_[unsigned(type)].SumTail();
   }
 
+  // Returns the usec spent in task over the last 6 seconds.
+  uint32_t GetBackgroundUsec6(BackgroundTask task) const {
+    return background_counter_[task].SumTail();
+  }
+
   journal::Journal* journal() {
     return journal_;
   }
@@ -224,19 +298,42 @@ class EngineShard {
   // --------------------------------------------------------------------------
   uint32_t DefragTask();
 
+  // Frees the values that DbSlice detached on deletion, when there is available CPU time.
+  uint32_t LazyFreeTask();
+
   // scan the shard with the cursor and apply
   // de-fragmentation option for entries. This function will return the new cursor at the end of the
   // scan This function is called from context of StartDefragTask
   // return true if we did not complete the shard scan
   bool DoDefrag();
 
+  // Schedules the transactions published to the schedule ring.
+  void DrainScheduleRing();
+
+  // Runs step, which does a bounded amount of work and returns true if work is left. With
+  // --heartbeat_budget_usec, step is repeated until the time slice of task runs out, and the
+  // slice of a task that leaves work behind grows in the following heartbeats. Accounts the time
+  // spent to task and returns true if work was left.
+  template <typename F> bool RunBackground(BackgroundTask task, F&& step);
+
+  // Time slice of the background tasks in the current heartbeat, 0 if they are not sliced.
+  uint64_t background_slice_cycles_ = 0;
+  uint8_t background_backlog_[BG_TASK_TOTAL] = {};  // slices grow by 2^backlog
+
   TaskQueue queue_;
 
+  // Coordinators publish schedule hops here with a single CAS, the shard drains them in
+  // PollExecution. Only the first request after a drain posts a shard queue task to notify it.
+  MPSCRing<ScheduleRequest, 1024> schedule_ring_;
+  std::atomic_bool schedule_ring_notified_{false};
+
   TxQueue txq_;
   MiMemoryResource mi_resource_;
+  std::unique_ptr<SegmentArena> segment_arena_;
   DbSlice db_slice_;
 
   Stats stats_;
+  LoadStats load_stats_;
 
   // Become passive if replica: don't automatially evict expired items.
   bool is_replica_ = false;
@@ -248,17 +345,20 @@ class EngineShard {
   IntentLock shard_lock_;
 
   uint32_t defrag_task_ = 0;
+  uint32_t lazy_free_task_ = 0;
   util::fb2::Fiber fiber_periodic_;
   util::fb2::Done fiber_periodic_done_;
 
   DefragTaskState defrag_state_;
   std::unique_ptr<TieredStorage> tiered_storage_;
   std::unique_ptr<ShardDocIndices> shard_search_indices_;
+  std::unique_ptr<ShardChannels> shard_channels_;
   std::unique_ptr<BlockingController> blocking_controller_;
 
   using Counter = util::SlidingCounter<7>;
 
   Counter counter_[COUNTER_TOTAL];
+  Counter background_counter_[BG_TASK_TOTAL];
 
   static __thread EngineShard* shard_;
 };
@@ -268,13 +368,44 @@ class EngineShardSet {
   struct CachedStats {
     std::atomic_uint64_t used_memory;
 
-    CachedStats() : used_memory(0) {
+    // Lookups of the shard, published for the memory balancer.
+    std::atomic_uint64_t hits;
+    std::atomic_uint64_t misses;
+
+    // Fractions of the free memory the shard may grow into, and of the memory to be evicted
+    // when free memory runs low. Set by the memory balancer, 1/N each when it is disabled.
+    std::atomic<double> budget_share;
+    std::atomic<double> eviction_share;
+
+    CachedStats() : used_memory(0), hits(0), misses(0), budget_share(0), eviction_share(0) {
     }
 
-    CachedStats(const CachedStats& o) : used_memory(o.used_memory.load()) {
+    CachedStats(const CachedStats& o)
+        : used_memory(o.used_memory.load()), hits(o.hits.load()), misses(o.misses.load()),
+          budget_share(o.budget_share.load()), eviction_share(o.eviction_share.load()) {
     }
   };
 
+  // Memory demand of a shard since the previous balancing round.
+  struct MemoryDemand {
+    size_t used = 0;    // bytes used by the shard
+    size_t growth = 0;  // bytes the shard grew by
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+  };
+
+  struct MemoryShares {
+    double budget = 0;
+    double eviction = 0;
+  };
+
+  // Moves the shares halfway towards targets derived from the demand of the shards. Free memory
+  // follows the shards that hold and add more data and serve more hits, while evictions are
+  // taken from the shards that hold more data that is rarely hit. Each shard keeps a tenth of
+  // an equal split of both, so that an idle shard can still grow and a busy one still evicts.
+  static void BalanceMemoryShares(const std::vector<MemoryDemand>& demand,
+                                  std::vector<MemoryShares>* shares);
+
   explicit EngineShardSet(util::ProactorPool* pp) : pp_(pp) {
   }
 
@@ -292,6 +423,7 @@ class EngineShardSet {
   static const std::vector<CachedStats>& GetCachedStats();
 
   // Uses a shard queue to dispatch. Callback runs in a dedicated fiber.
+  // Callbacks are not allocated, see TaskQueue::kCbCapacity.
   template <typename F> auto Await(ShardId sid, F&& f) {
     return shard_queue_[sid]->Await(std::forward<F>(f));
   }
@@ -302,6 +434,12 @@ class EngineShardSet {
     return shard_queue_[sid]->Add(std::forward<F>(f));
   }
 
+  // Publishes a schedule request to the schedule ring of the shard, returns false if it's full.
+  bool PushSchedule(ShardId sid, EngineShard::ScheduleRequest req) {
+    assert(sid < shards_.size());
+    return shards_[sid]->PushSchedule(req);
+  }
+
   // Runs a brief function on all shards. Waits for it to complete.
   // `func` must not preempt.
   template <typename U> void RunBriefInParallel(U&& func) const {
@@ -344,6 +482,7 @@ class EngineShardSet {
 
   util::ProactorPool* pp_;
   std::vector<TaskQueue*> shard_queue_;
+  std::vector<EngineShard*> shards_;
 };
 
 template <typename U, typename P>
@@ -87,5 +87,34 @@ TEST_F(RoundRobinSharderTest, RoundRobinShard) {
   }
 }
 
+TEST(MemoryBalancerTest, Shares) {
+  vector<EngineShardSet::MemoryDemand> demand(2);
+  vector<EngineShardSet::MemoryShares> shares(2, {0.5, 0.5});
+
+  // Idle shards keep an equal split.
+  EngineShardSet::BalanceMemoryShares(demand, &shares);
+  EXPECT_DOUBLE_EQ(0.5, shares[0].budget);
+  EXPECT_DOUBLE_EQ(0.5, shares[1].eviction);
+
+  // Shard 0 holds the same data as shard 1, but all of its lookups hit while those of shard 1
+  // miss: shard 0 gets more of the free memory and shard 1 evicts more.
+  demand[0] = {.used = 1000, .growth = 0, .hits = 100, .misses = 0};
+  demand[1] = {.used = 1000, .growth = 0, .hits = 0, .misses = 100};
+  for (unsigned i = 0; i < 20; ++i)
+    EngineShardSet::BalanceMemoryShares(demand, &shares);
+
+  EXPECT_NEAR(0.05 + 0.9 * 0.75, shares[0].budget, 1e-4);
+  EXPECT_NEAR(0.05 + 0.9 * 0.25, shares[0].eviction, 1e-4);
+  EXPECT_NEAR(1.0, shares[0].budget + shares[1].budget, 1e-9);
+  EXPECT_NEAR(1.0, shares[0].eviction + shares[1].eviction, 1e-9);
+
+  // An empty shard keeps its minimal share.
+  demand[1] = {};
+  for (unsigned i = 0; i < 20; ++i)
+    EngineShardSet::BalanceMemoryShares(demand, &shares);
+  EXPECT_NEAR(0.05, shares[1].budget, 1e-4);
+  EXPECT_NEAR(0.05, shares[1].eviction, 1e-4);
+}
+
 }  // namespace
 }  // namespace dfly
@@ -4,7 +4,10 @@
 
 #include "server/generic_family.h"
 
+#include <absl/strings/escaping.h>
+
 #include <boost/operators.hpp>
+#include <filesystem>
 #include <optional>
 
 #include "facade/reply_builder.h"
@@ -16,6 +19,7 @@ extern "C" {
 
 #include "base/flags.h"
 #include "base/logging.h"
+#include "io/file.h"
 #include "redis/rdb.h"
 #include "server/acl/acl_commands_def.h"
 #include "server/blocking_controller.h"
@@ -34,12 +38,25 @@ extern "C" {
 #include "server/transaction.h"
 #include "util/varz.h"
 
+ABSL_DECLARE_FLAG(std::string, dir);
+
 ABSL_FLAG(uint32_t, dbnum, 16, "Number of databases");
+ABSL_FLAG(uint32_t, lazyfree_del_min_elements, 8192,
+          "DEL frees containers with at least this many elements in the background, like UNLINK "
+          "does for all but small ones. 0 frees them inline.");
 ABSL_FLAG(uint32_t, keys_output_limit, 8192, "Maximum number of keys output by keys command");
+ABSL_FLAG(bool, dump_native_encoding, false,
+          "If true, DUMP copies listpacks, intsets and strings verbatim instead of converting "
+          "them to the encodings of RDB 9, which RESTORE then adopts without conversions. Such "
+          "payloads are accepted only by Dragonfly and Redis 7 or newer");
+ABSL_FLAG(uint32_t, scan_shard_fanout, 8,
+          "Maximum number of shards SCAN and KEYS query concurrently when the shards before "
+          "them are exhausted without filling the reply");
 
 namespace dfly {
 using namespace std;
 using namespace facade;
+namespace fs = std::filesystem;
 
 namespace {
 
@@ -269,6 +286,10 @@ OpResult<RestoreArgs> RestoreArgs::TryFrom(const CmdArgList& args) {
 
 OpStatus OpPersist(const OpArgs& op_args, string_view key);
 
+// Values held by a single heap block of at least this size are handed over between shards by
+// RENAME instead of being dumped and restored, see CompactObj::SingleBlock.
+constexpr size_t kMinHandoverBytes = 16_KB;
+
 class Renamer {
  public:
   Renamer(Transaction* t, std::string_view src_key, std::string_view dest_key, unsigned shard_count)
@@ -284,12 +305,15 @@ class Renamer {
  private:
   void FetchData();
   void FinalizeRename();
+  void HandOverRename();
 
   bool KeyExists(Transaction* t, EngineShard* shard, std::string_view key) const;
   void SerializeSrc(Transaction* t, EngineShard* shard);
 
   OpStatus DelSrc(Transaction* t, EngineShard* shard);
   OpStatus DeserializeDest(Transaction* t, EngineShard* shard);
+  void DetachSrc(Transaction* t, EngineShard* shard);
+  OpStatus AdoptDest(Transaction* t, EngineShard* shard);
 
   struct SerializedValue {
     std::string value;
@@ -310,6 +334,10 @@ class Renamer {
   bool dest_found_ = false;
 
   SerializedValue serialized_value_;
+
+  // Whether the value is moved to the destination shard as it is, in handover_value_.
+  bool handover_ = false;
+  PrimeValue handover_value_;
 };
 
 ErrorReply Renamer::Rename(bool destination_should_not_exist) {
@@ -320,7 +348,7 @@ ErrorReply Renamer::Rename(bool destination_should_not_exist) {
     return OpStatus::KEY_NOTFOUND;
   }
 
-  if (!serialized_value_.version) {
+  if (!handover_ && !serialized_value_.version) {
     transaction_->Conclude();
     return ErrorReply{kInvalidDumpValueErr};
   }
@@ -330,7 +358,10 @@ ErrorReply Renamer::Rename(bool destination_should_not_exist) {
     return OpStatus::KEY_EXISTS;
   }
 
-  FinalizeRename();
+  if (handover_)
+    HandOverRename();
+  else
+    FinalizeRename();
   return OpStatus::OK;
 }
 
@@ -373,6 +404,24 @@ void Renamer::FinalizeRename() {
   transaction_->Execute(std::move(cb), true);
 }
 
+void Renamer::HandOverRename() {
+  // The source detaches the value in its own hop, so that the destination never touches the
+  // value while the source may still use it.
+  auto detach_cb = [this](Transaction* t, EngineShard* shard) {
+    if (shard->shard_id() == src_sid_)
+      DetachSrc(t, shard);
+    return OpStatus::OK;
+  };
+  transaction_->Execute(std::move(detach_cb), false);
+
+  auto adopt_cb = [this](Transaction* t, EngineShard* shard) {
+    if (shard->shard_id() == dest_sid_)
+      return AdoptDest(t, shard);
+    return OpStatus::OK;
+  };
+  transaction_->Execute(std::move(adopt_cb), true);
+}
+
 bool Renamer::KeyExists(Transaction* t, EngineShard* shard, std::string_view key) const {
   auto& db_slice = shard->db_slice();
   auto it = db_slice.FindReadOnly(t->GetDbContext(), key).it;
@@ -388,14 +437,23 @@ void Renamer::SerializeSrc(Transaction* t, EngineShard* shard) {
     return;
   }
 
+  serialized_value_.expire_ts = db_slice.ExpireTime(exp_it);
+  serialized_value_.sticky = it->first.IsSticky();
+
+  const PrimeValue& pv = it->second;
+  if (src_sid_ != dest_sid_ && pv.SingleBlock() && pv.MallocUsed() >= kMinHandoverBytes) {
+    DVLOG(1) << "Rename: key '" << src_key_ << "' successfully found, going to hand it over";
+    handover_ = true;
+    return;
+  }
+
   DVLOG(1) << "Rename: key '" << src_key_ << "' successfully found, going to dump it";
 
   io::StringSink sink;
-  SerializerBase::DumpObject(it->second, &sink);
+  SerializerBase::DumpObject(pv, &sink, true);
 
-  auto rdb_version = GetRdbVersion(sink.str());
-  serialized_value_ = {std::move(sink).str(), rdb_version, db_slice.ExpireTime(exp_it),
-                       it->first.IsSticky()};
+  serialized_value_.version = GetRdbVersion(sink.str());
+  serialized_value_.value = std::move(sink).str();
 }
 
 OpStatus Renamer::DelSrc(Transaction* t, EngineShard* shard) {
@@ -471,6 +529,81 @@ OpStatus Renamer::DeserializeDest(Transaction* t, EngineShard* shard) {
   return OpStatus::OK;
 }
 
+void Renamer::DetachSrc(Transaction* t, EngineShard* shard) {
+  auto res = shard->db_slice().FindMutable(t->GetDbContext(), src_key_);
+  CHECK(IsValid(res.it));
+
+  DVLOG(1) << "Rename: detaching the key '" << src_key_;
+
+  res.post_updater.Run();
+  CHECK(shard->db_slice().Del(t->GetDbIndex(), res.it, 0, &handover_value_));
+  shard->DisownValue(handover_value_);
+
+  if (shard->journal()) {
+    RecordJournal(t->GetOpArgs(shard), "DEL"sv, ArgSlice{src_key_}, 2);
+  }
+}
+
+OpStatus Renamer::AdoptDest(Transaction* t, EngineShard* shard) {
+  OpArgs op_args = t->GetOpArgs(shard);
+  shard->AdoptValue(handover_value_);
+
+  RestoreArgs restore_args{serialized_value_.expire_ts, true, true};
+  if (!restore_args.UpdateExpiration(op_args.db_cntx.time_now_ms)) {
+    handover_value_.Reset();
+    return OpStatus::OUT_OF_RANGE;
+  }
+
+  auto& db_slice = shard->db_slice();
+  if (dest_found_) {
+    DVLOG(1) << "Rename: deleting the destiny key '" << dest_key_;
+    auto dest_res = db_slice.FindMutable(op_args.db_cntx, dest_key_);
+    dest_res.post_updater.Run();
+    CHECK(db_slice.Del(op_args.db_cntx.db_index, dest_res.it));
+  }
+
+  if (restore_args.Expired()) {
+    VLOG(1) << "Rename: the new key '" << dest_key_ << "' already expired, will not save the value";
+    handover_value_.Reset();
+
+    if (dest_found_ && shard->journal()) {
+      RecordJournal(op_args, "DEL"sv, ArgSlice{dest_key_}, 2);
+    }
+    return OpStatus::OK;
+  }
+
+  // The journal replays the rename as a RESTORE, which needs the dump of the value.
+  string dump;
+  if (shard->journal()) {
+    io::StringSink sink;
+    SerializerBase::DumpObject(handover_value_, &sink, true);
+    dump = std::move(sink).str();
+  }
+
+  auto add_res = db_slice.AddNew(op_args.db_cntx, dest_key_, std::move(handover_value_),
+                                 restore_args.ExpirationTime());
+  RETURN_ON_BAD_STATUS(add_res);
+  add_res->it->first.SetSticky(serialized_value_.sticky);
+
+  if (auto bc = shard->blocking_controller(); bc) {
+    bc->AwakeWatched(t->GetDbIndex(), dest_key_);
+  }
+
+  if (shard->journal()) {
+    auto expire_str = absl::StrCat(serialized_value_.expire_ts);
+
+    absl::InlinedVector<std::string_view, 6> args(
+        {dest_key_, expire_str, dump, "REPLACE"sv, "ABSTTL"sv});
+    if (serialized_value_.sticky) {
+      args.push_back("STICK"sv);
+    }
+
+    RecordJournal(op_args, "RESTORE"sv, args, 2);
+  }
+
+  return OpStatus::OK;
+}
+
 OpStatus OpPersist(const OpArgs& op_args, string_view key) {
   auto& db_slice = op_args.shard->db_slice();
   auto res = db_slice.FindMutable(op_args.db_cntx, key);
@@ -494,7 +627,7 @@ OpResult<std::string> OpDump(const OpArgs& op_args, string_view key) {
   if (IsValid(it)) {
     DVLOG(1) << "Dump: key '" << key << "' successfully found, going to dump it";
     io::StringSink sink;
-    SerializerBase::DumpObject(it->second, &sink);
+    SerializerBase::DumpObject(it->second, &sink, absl::GetFlag(FLAGS_dump_native_encoding));
     return sink.str();  // TODO: Add rvalue overload to str()
   }
   // fallback
@@ -559,11 +692,12 @@ bool ScanCb(const OpArgs& op_args, PrimeIterator prime_it, const ScanOpts& opts,
     return false;
   }
 
-  it->first.GetString(scratch);
-  if (!opts.Matches(*scratch)) {
+  // Only packed keys need decoding before matching, the others are matched in place.
+  string_view key = it->first.GetSlice(scratch);
+  if (!opts.Matches(key)) {
     return false;
   }
-  res->push_back(*scratch);
+  res->emplace_back(key);
 
   return true;
 }
@@ -587,6 +721,8 @@ void OpScan(const OpArgs& op_args, const ScanOpts& scan_opts, uint64_t* cursor,
 
   VLOG(1) << "OpScan " << db_slice.shard_id() << " cursor: " << cur.value();
   *cursor = cur.value();
+  if (*cursor)
+    db_slice.OnScanCursor();
 }
 
 uint64_t ScanGeneric(uint64_t cursor, const ScanOpts& scan_opts, StringVec* keys,
@@ -608,16 +744,52 @@ uint64_t ScanGeneric(uint64_t cursor, const ScanOpts& scan_opts, StringVec* keys
   cursor >>= 10;
   DbContext db_cntx{cntx->conn_state.db_index, GetCurrentTimeMs()};
 
+  // Number of shards scanned concurrently. Every shard after the current one is scanned from its
+  // start, and its keys are used only if all shards before it were exhausted, so the cursor
+  // still points into a single shard. The fanout grows while shards are exhausted without
+  // filling the reply, i.e. when the filters are selective.
+  unsigned fanout = 1;
+  unsigned max_fanout = std::max(absl::GetFlag(FLAGS_scan_shard_fanout), 1u);
+  vector<pair<uint64_t, StringVec>> shard_results;
+
   do {
-    ess->Await(sid, [&] {
-      OpArgs op_args{EngineShard::tlocal(), 0, db_cntx};
-      OpScan(op_args, scan_opts, &cursor, keys);
-    });
+    unsigned width = std::min(fanout, shard_count - sid);
+    if (width == 1) {
+      ess->Await(sid, [&] {
+        OpArgs op_args{EngineShard::tlocal(), 0, db_cntx};
+        OpScan(op_args, scan_opts, &cursor, keys);
+      });
+    } else {
+      shard_results.assign(width, {0, {}});
+      shard_results[0].first = cursor;
+
+      util::fb2::BlockingCounter bc(width);
+      for (unsigned i = 0; i < width; ++i) {
+        ess->Add(sid + i, [&, i, bc]() mutable {
+          OpArgs op_args{EngineShard::tlocal(), 0, db_cntx};
+          OpScan(op_args, scan_opts, &shard_results[i].first, &shard_results[i].second);
+          bc->Dec();
+        });
+      }
+      bc->Wait();
+
+      // Merge in shard order up to the first shard that still has keys left.
+      for (unsigned i = 0; i < width; ++i) {
+        auto& [shard_cursor, shard_keys] = shard_results[i];
+        keys->insert(keys->end(), make_move_iterator(shard_keys.begin()),
+                     make_move_iterator(shard_keys.end()));
+        cursor = shard_cursor;
+        if (cursor != 0 || i + 1 == width)
+          break;
+        ++sid;
+      }
+    }
 
     if (cursor == 0) {
       ++sid;
       if (unsigned(sid) == shard_count)
         break;
+      fanout = std::min(fanout * 2, max_fanout);
     }
 
     // Break after kMaxScanTimeMs.
@@ -683,7 +855,8 @@ OpResult<long> OpFieldTtl(Transaction* t, EngineShard* shard, string_view key, s
   return res <= 0 ? res : int32_t(res - MemberTimeSeconds(db_cntx.time_now_ms));
 }
 
-OpResult<uint32_t> OpDel(const OpArgs& op_args, const ShardArgs& keys) {
+OpResult<uint32_t> OpDel(const OpArgs& op_args, const ShardArgs& keys,
+                         size_t lazy_free_min_elements) {
   DVLOG(1) << "Del: " << keys.Front();
   auto& db_slice = op_args.shard->db_slice();
 
@@ -694,7 +867,7 @@ OpResult<uint32_t> OpDel(const OpArgs& op_args, const ShardArgs& keys) {
     if (!IsValid(fres.it))
       continue;
     fres.post_updater.Run();
-    res += int(db_slice.Del(op_args.db_cntx.db_index, fres.it));
+    res += int(db_slice.Del(op_args.db_cntx.db_index, fres.it, lazy_free_min_elements));
   }
 
   return res;
@@ -717,6 +890,102 @@ OpResult<uint32_t> OpStick(const OpArgs& op_args, const ShardArgs& keys) {
   return res;
 }
 
+struct ExportOpts {
+  ScanOpts scan;  // MATCH, TYPE and COUNT, the number of keys per shard and chunk
+  bool with_type = false;
+  bool with_ttl = false;
+  bool with_memory = false;
+  string file;
+};
+
+struct ExportedKey {
+  string key;
+  const char* type;
+  int64_t ttl_ms = -1;
+  size_t memory;
+};
+
+// Appends the next keys of the shard from cursor to chunk. Stops after opts.scan.limit keys or
+// once the time budget is spent, so that a shard is never stalled for long.
+void OpExportKeys(const OpArgs& op_args, const ExportOpts& opts, uint64_t* cursor,
+                  vector<ExportedKey>* chunk) {
+  constexpr uint64_t kTimeBudgetNs = 1'000'000;
+
+  auto& db_slice = op_args.shard->db_slice();
+  if (!db_slice.IsDbValid(op_args.db_cntx.db_index)) {
+    *cursor = 0;
+    return;
+  }
+
+  uint64_t start = absl::GetCurrentTimeNanos();
+  PrimeTable::Cursor cur = *cursor;
+  auto [prime_table, expire_table] = db_slice.GetTables(op_args.db_cntx.db_index);
+  string scratch;
+  do {
+    cur = prime_table->Traverse(cur, [&](PrimeIterator prime_it) {
+      DbSlice::Iterator it = DbSlice::Iterator::FromPrime(prime_it);
+      int64_t ttl_ms = -1;
+      if (prime_it->second.HasExpire()) {
+        auto res = db_slice.ExpireIfNeeded(op_args.db_cntx, it);
+        it = res.it;
+        if (IsValid(it) && IsValid(res.exp_it))
+          ttl_ms = db_slice.ExpireTime(res.exp_it) - op_args.db_cntx.time_now_ms;
+      }
+
+      if (!IsValid(it))
+        return;
+
+      const char* type = ObjTypeName(it->second.ObjType());
+      if (!opts.scan.type_filter.empty() && opts.scan.type_filter != type)
+        return;
+
+      string_view key = it->first.GetSlice(&scratch);
+      if (!opts.scan.Matches(key))
+        return;
+
+      size_t memory = it->first.MallocUsed() + it->second.MallocUsed();
+      chunk->push_back({string{key}, type, ttl_ms, memory});
+    });
+  } while (cur && chunk->size() < opts.scan.limit &&
+           absl::GetCurrentTimeNanos() - start < kTimeBudgetNs);
+
+  *cursor = cur.value();
+}
+
+// One line per key with tab separated fields. Keys are C-escaped, so that binary keys
+// don't break the format.
+void AppendExportLine(const ExportOpts& opts, const ExportedKey& entry, string* dest) {
+  absl::StrAppend(dest, absl::CEscape(entry.key));
+  if (opts.with_type)
+    absl::StrAppend(dest, "\t", entry.type);
+  if (opts.with_ttl)
+    absl::StrAppend(dest, "\t", entry.ttl_ms);
+  if (opts.with_memory)
+    absl::StrAppend(dest, "\t", entry.memory);
+  dest->push_back('\n');
+}
+
+// Sends a chunk as a RESP3 push message: ["exportkeys", [entry1, entry2, ...]], where an entry
+// is the key alone or an array of the key and the requested fields.
+void SendExportChunk(const ExportOpts& opts, const vector<ExportedKey>& chunk,
+                     RedisReplyBuilder* rb) {
+  unsigned num_fields = 1 + opts.with_type + opts.with_ttl + opts.with_memory;
+  rb->StartCollection(2, RedisReplyBuilder::PUSH);
+  rb->SendBulkString("exportkeys");
+  rb->StartArray(chunk.size());
+  for (const auto& entry : chunk) {
+    if (num_fields > 1)
+      rb->StartArray(num_fields);
+    rb->SendBulkString(entry.key);
+    if (opts.with_type)
+      rb->SendBulkString(entry.type);
+    if (opts.with_ttl)
+      rb->SendLong(entry.ttl_ms);
+    if (opts.with_memory)
+      rb->SendLong(entry.memory);
+  }
+}
+
 }  // namespace
 
 void GenericFamily::Init(util::ProactorPool* pp) {
@@ -726,15 +995,25 @@ void GenericFamily::Shutdown() {
 }
 
 void GenericFamily::Del(CmdArgList args, ConnectionContext* cntx) {
+  DelGeneric(args, absl::GetFlag(FLAGS_lazyfree_del_min_elements), cntx);
+}
+
+// Runs in O(1) on the command path, large values are freed in the background.
+void GenericFamily::Unlink(CmdArgList args, ConnectionContext* cntx) {
+  DelGeneric(args, DbSlice::kLazyFreeMinElements, cntx);
+}
+
+void GenericFamily::DelGeneric(CmdArgList args, size_t lazy_free_min_elements,
+                               ConnectionContext* cntx) {
   Transaction* transaction = cntx->transaction;
   VLOG(1) << "Del " << ArgS(args, 0);
 
   atomic_uint32_t result{0};
   bool is_mc = cntx->protocol() == Protocol::MEMCACHE;
 
-  auto cb = [&result](const Transaction* t, EngineShard* shard) {
+  auto cb = [&result, lazy_free_min_elements](const Transaction* t, EngineShard* shard) {
     ShardArgs args = t->GetShardArgs(shard->shard_id());
-    auto res = OpDel(t->GetOpArgs(shard), args);
+    auto res = OpDel(t->GetOpArgs(shard), args, lazy_free_min_elements);
     result.fetch_add(res.value_or(0), memory_order_relaxed);
 
     return OpStatus::OK;
@@ -753,7 +1032,7 @@ void GenericFamily::Del(CmdArgList args, ConnectionContext* cntx) {
     if (del_cnt == 0) {
       mc_builder->SendNotFound();
     } else {
-      mc_builder->SendSimpleString("DELETED");
+      mc_builder->SendDeleted();
     }
   } else {
     cntx->SendLong(del_cnt);
@@ -905,7 +1184,7 @@ void GenericFamily::Keys(CmdArgList args, ConnectionContext* cntx) {
   StringVec keys;
 
   ScanOpts scan_opts;
-  scan_opts.pattern = pattern;
+  scan_opts.matcher.emplace(pattern);
   scan_opts.limit = 512;
   auto output_limit = absl::GetFlag(FLAGS_keys_output_limit);
 
@@ -920,6 +1199,123 @@ void GenericFamily::Keys(CmdArgList args, ConnectionContext* cntx) {
   }
 }
 
+// EXPORTKEYS [MATCH pattern] [TYPE type] [COUNT count] [WITHTYPE] [WITHTTL] [WITHMEMORY]
+//            [FILE name]
+// Enumerates the whole keyspace of the selected db without building a reply with all the keys.
+// All shards are traversed in parallel, each one in steps of at most COUNT keys and a short time
+// budget, and the steps are interleaved with the regular transactions. The keys are streamed to
+// the client as RESP3 push messages, one per shard step, or written to the file under --dir.
+// The final reply is the number of exported keys.
+void GenericFamily::ExportKeys(CmdArgList args, ConnectionContext* cntx) {
+  ExportOpts opts;
+  opts.scan.limit = 1000;
+
+  for (size_t i = 0; i < args.size(); ++i) {
+    ToUpper(&args[i]);
+    string_view opt = ArgS(args, i);
+    if (opt == "WITHTYPE") {
+      opts.with_type = true;
+    } else if (opt == "WITHTTL") {
+      opts.with_ttl = true;
+    } else if (opt == "WITHMEMORY") {
+      opts.with_memory = true;
+    } else if (i + 1 == args.size()) {
+      return cntx->SendError(kSyntaxErr);
+    } else if (opt == "MATCH") {
+      string_view pattern = ArgS(args, ++i);
+      if (pattern != "*")
+        opts.scan.matcher.emplace(pattern);
+    } else if (opt == "TYPE") {
+      ToLower(&args[++i]);
+      opts.scan.type_filter = ArgS(args, i);
+    } else if (opt == "COUNT") {
+      if (!absl::SimpleAtoi(ArgS(args, ++i), &opts.scan.limit) || opts.scan.limit == 0)
+        return cntx->SendError(kInvalidIntErr);
+      opts.scan.limit = std::min<size_t>(opts.scan.limit, 100'000);
+    } else if (opt == "FILE") {
+      opts.file = ArgS(args, ++i);
+      if (opts.file.empty() || opts.file == "." || opts.file == ".." ||
+          opts.file.find('/') != string::npos) {
+        return cntx->SendError("invalid file name");
+      }
+    } else {
+      return cntx->SendError(kSyntaxErr);
+    }
+  }
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  if (opts.file.empty() && !rb->IsResp3())
+    return cntx->SendError("EXPORTKEYS requires RESP3 unless FILE is specified");
+
+  unique_ptr<io::WriteFile> file;
+  if (!opts.file.empty()) {
+    string path = (fs::path(absl::GetFlag(FLAGS_dir)) / opts.file).generic_string();
+    auto res = io::OpenWrite(path, io::WriteFile::Options{});
+    if (!res)
+      return cntx->SendError(absl::StrCat("Could not open ", path, ": ", res.error().message()));
+    file.reset(*res);
+  }
+
+  unsigned shard_count = shard_set->size();
+  vector<uint64_t> cursors(shard_count, 0);
+  vector<bool> done(shard_count, false);
+  vector<vector<ExportedKey>> chunks(shard_count);
+  unsigned active = shard_count;
+  size_t total = 0;
+  error_code ec;
+  string buf;
+
+  DbContext db_cntx{cntx->conn_state.db_index, 0};
+  while (active > 0 && !ec) {
+    db_cntx.time_now_ms = GetCurrentTimeMs();
+    util::fb2::BlockingCounter bc(active);
+    for (ShardId sid = 0; sid < shard_count; ++sid) {
+      if (done[sid])
+        continue;
+      shard_set->Add(sid, [&, sid, bc]() mutable {
+        OpArgs op_args{EngineShard::tlocal(), 0, db_cntx};
+        OpExportKeys(op_args, opts, &cursors[sid], &chunks[sid]);
+        bc->Dec();
+      });
+    }
+    bc->Wait();
+
+    for (ShardId sid = 0; sid < shard_count && !ec; ++sid) {
+      if (done[sid])
+        continue;
+
+      auto& chunk = chunks[sid];
+      if (!chunk.empty()) {
+        total += chunk.size();
+        if (file) {
+          buf.clear();
+          for (const auto& entry : chunk)
+            AppendExportLine(opts, entry, &buf);
+          ec = file->Write(buf);
+        } else {
+          SendExportChunk(opts, chunk, rb);
+        }
+        chunk.clear();
+      }
+
+      if (cursors[sid] == 0) {
+        done[sid] = true;
+        --active;
+      }
+    }
+  }
+
+  if (file) {
+    error_code close_ec = file->Close();
+    if (!ec)
+      ec = close_ec;
+  }
+  if (ec)
+    return cntx->SendError(absl::StrCat("Could not write ", opts.file, ": ", ec.message()));
+
+  rb->SendLong(total);
+}
+
 void GenericFamily::PexpireAt(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view msec = ArgS(args, 1);
@@ -1060,32 +1456,123 @@ SortEntryList MakeSortEntryList(bool alpha) {
     return SortEntryList{std::vector<SortEntry<false>>{}};
 }
 
-// Iterate over container with generic function that accepts strings and ints
-template <typename F> bool Iterate(const PrimeValue& pv, F&& func) {
-  auto cb = [&func](container_utils::ContainerEntry ce) {
-    if (ce.value)
-      return func(ce.ToString());
-    else
-      return func(ce.longval);
-  };
+// Strict ordering of SORT, DESC reverses it.
+template <typename T> bool SortLess(const T& lhs, const T& rhs, bool reversed) {
+  return reversed ? rhs < lhs : lhs < rhs;
+}
 
+// Iterate over container with generic function that accepts container entries
+template <typename F> bool IterateEntries(const PrimeValue& pv, F&& func) {
   switch (pv.ObjType()) {
     case OBJ_LIST:
-      return container_utils::IterateList(pv, cb);
+      return container_utils::IterateList(pv, func);
     case OBJ_SET:
-      return container_utils::IterateSet(pv, cb);
+      return container_utils::IterateSet(pv, func);
     case OBJ_ZSET:
       return container_utils::IterateSortedSet(
           pv.GetRobjWrapper(),
-          [&cb](container_utils::ContainerEntry ce, double) { return cb(ce); });
+          [&func](container_utils::ContainerEntry ce, double) { return func(ce); });
     default:
       return false;
   }
 }
 
-// Create a SortEntryList from given key
+// Iterate over container with generic function that accepts strings and ints
+template <typename F> bool Iterate(const PrimeValue& pv, F&& func) {
+  return IterateEntries(pv, [&func](container_utils::ContainerEntry ce) {
+    if (ce.value)
+      return func(ce.ToString());
+    else
+      return func(ce.longval);
+  });
+}
+
+bool ParseSortScore(container_utils::ContainerEntry ce, double* score) {
+  if (ce.value == nullptr) {
+    *score = ce.longval;
+    return true;
+  }
+  return absl::SimpleAtod(std::string_view{ce.value, ce.length}, score);
+}
+
+// Fetches the entries at the first `window` positions of the sorted order, unsorted.
+// The scores are parsed into a compact array first, to find the score at the window boundary,
+// so that the second pass over the container copies only the members inside the window.
+bool SelectNumericEntries(const PrimeValue& pv, bool reversed, size_t window,
+                          std::vector<SortEntry<false>>* entries) {
+  std::vector<double> scores;
+  scores.reserve(pv.Size());
+  bool success = IterateEntries(pv, [&scores](container_utils::ContainerEntry ce) {
+    double score;
+    if (!ParseSortScore(ce, &score))
+      return false;
+    scores.push_back(score);
+    return true;
+  });
+  if (!success)
+    return false;
+
+  auto less = [reversed](double lhs, double rhs) { return SortLess(lhs, rhs, reversed); };
+  std::vector<double> order = scores;
+  auto nth = order.begin() + window - 1;
+  std::nth_element(order.begin(), nth, order.end(), less);
+  double bound = *nth;
+
+  // Members with the bound score are taken in container order until the window is full.
+  size_t num_less =
+      std::count_if(order.begin(), nth, [&](double score) { return less(score, bound); });
+  size_t bound_left = window - num_less;
+
+  entries->reserve(window);
+  size_t index = 0;
+  IterateEntries(pv, [&](container_utils::ContainerEntry ce) {
+    double score = scores[index++];
+    if (less(score, bound) || (score == bound && bound_left > 0 && bound_left--)) {
+      auto& entry = entries->emplace_back();
+      entry.score = score;
+      entry.key = ce.ToString();
+    }
+    return entries->size() < window;
+  });
+  return true;
+}
+
+// Fetches the entries at the first `window` positions of the sorted order, unsorted.
+// They are kept in a heap with the last one on top, so that the members that don't make it
+// into the window are skipped without copying them.
+bool SelectAlphaEntries(const PrimeValue& pv, bool reversed, size_t window,
+                        std::vector<SortEntry<true>>* entries) {
+  auto less = [reversed](const SortEntry<true>& lhs, const SortEntry<true>& rhs) {
+    return SortLess(lhs.key, rhs.key, reversed);
+  };
+
+  entries->reserve(window);
+  return IterateEntries(pv, [&](container_utils::ContainerEntry ce) {
+    char buf[absl::numbers_internal::kFastToBufferSize];
+    std::string_view member;
+    if (ce.value) {
+      member = {ce.value, ce.length};
+    } else {
+      char* end = absl::numbers_internal::FastIntToBuffer(int64_t(ce.longval), buf);
+      member = {buf, size_t(end - buf)};
+    }
+
+    if (entries->size() < window) {
+      entries->emplace_back().key = member;
+      std::push_heap(entries->begin(), entries->end(), less);
+    } else if (SortLess(member, std::string_view{entries->front().key}, reversed)) {
+      std::pop_heap(entries->begin(), entries->end(), less);
+      entries->back().key = member;
+      std::push_heap(entries->begin(), entries->end(), less);
+    }
+    return true;
+  });
+}
+
+// Create a SortEntryList from given key. If window is not zero, only the entries at the first
+// window positions of the sorted order are fetched.
 OpResultTyped<SortEntryList> OpFetchSortEntries(const OpArgs& op_args, std::string_view key,
-                                                bool alpha) {
+                                                bool alpha, bool reversed, size_t window) {
   using namespace container_utils;
 
   auto it = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key).it;
@@ -1093,9 +1580,21 @@ OpResultTyped<SortEntryList> OpFetchSortEntries(const OpArgs& op_args, std::stri
     return OpStatus::KEY_NOTFOUND;
   }
 
+  const PrimeValue& pv = it->second;
+  bool select = window > 0 && window < pv.Size();
+
   auto result = MakeSortEntryList(alpha);
   bool success = std::visit(
-      [&pv = it->second](auto& entries) {
+      [&](auto& entries) {
+        if (select) {
+          if constexpr (std::is_same_v<std::decay_t<decltype(entries)>,
+                                       std::vector<SortEntry<true>>>) {
+            return SelectAlphaEntries(pv, reversed, window, &entries);
+          } else {
+            return SelectNumericEntries(pv, reversed, window, &entries);
+          }
+        }
+
         entries.reserve(pv.Size());
         return Iterate(pv, [&entries](auto&& val) {
           return entries.emplace_back().Parse(std::forward<decltype(val)>(val));
@@ -1103,7 +1602,7 @@ OpResultTyped<SortEntryList> OpFetchSortEntries(const OpArgs& op_args, std::stri
       },
       result);
   auto res = OpResultTyped{std::move(result)};
-  res.setType(it->second.ObjType());
+  res.setType(pv.ObjType());
   return success ? res : OpStatus::WRONG_TYPE;
 }
 
@@ -1111,7 +1610,7 @@ void GenericFamily::Sort(CmdArgList args, ConnectionContext* cntx) {
   std::string_view key = ArgS(args, 0);
   bool alpha = false;
   bool reversed = false;
-  std::optional<std::pair<size_t, size_t>> bounds;
+  std::optional<std::pair<size_t, size_t>> bounds;  // offset and count
 
   for (size_t i = 1; i < args.size(); i++) {
     ToUpper(&args[i]);
@@ -1130,14 +1629,19 @@ void GenericFamily::Sort(CmdArgList args, ConnectionContext* cntx) {
           !absl::SimpleAtoi(ArgS(args, i + 2), &limit)) {
         return cntx->SendError(kInvalidIntErr);
       }
-      bounds = {offset, limit};
+      // As in Redis, a negative offset starts from the beginning and a negative count returns
+      // all the remaining elements.
+      bounds = {size_t(std::max(offset, 0)), limit < 0 ? SIZE_MAX / 2 : size_t(limit)};
       i += 2;
     }
   }
 
+  // With LIMIT only the first offset + count elements of the sorted order are fetched, the
+  // rest of the container is never copied nor sorted.
+  size_t window = bounds ? bounds->first + bounds->second : 0;
   OpResultTyped<SortEntryList> fetch_result =
       cntx->transaction->ScheduleSingleHopT([&](Transaction* t, EngineShard* shard) {
-        return OpFetchSortEntries(t->GetOpArgs(shard), key, alpha);
+        return OpFetchSortEntries(t->GetOpArgs(shard), key, alpha, reversed, window);
       });
 
   if (fetch_result.status() == OpStatus::WRONG_TYPE)
@@ -1149,17 +1653,9 @@ void GenericFamily::Sort(CmdArgList args, ConnectionContext* cntx) {
 
   auto result_type = fetch_result.type();
   auto sort_call = [cntx, bounds, reversed, result_type](auto& entries) {
-    if (bounds) {
-      auto sort_it = entries.begin() + std::min(bounds->first + bounds->second, entries.size());
-      std::partial_sort(entries.begin(), sort_it, entries.end(),
-                        [reversed](const auto& lhs, const auto& rhs) {
-                          return bool(lhs.Cmp() < rhs.Cmp()) ^ reversed;
-                        });
-    } else {
-      std::sort(entries.begin(), entries.end(), [reversed](const auto& lhs, const auto& rhs) {
-        return bool(lhs.Cmp() < rhs.Cmp()) ^ reversed;
-      });
-    }
+    std::sort(entries.begin(), entries.end(), [reversed](const auto& lhs, const auto& rhs) {
+      return SortLess(lhs.Cmp(), rhs.Cmp(), reversed);
+    });
 
     auto start_it = entries.begin();
     auto end_it = entries.end();
@@ -1658,6 +2154,7 @@ constexpr uint32_t kRename = KEYSPACE | WRITE | SLOW;
 constexpr uint32_t kRenamNX = KEYSPACE | WRITE | FAST;
 constexpr uint32_t kSelect = FAST | CONNECTION;
 constexpr uint32_t kScan = KEYSPACE | READ | SLOW;
+constexpr uint32_t kExportKeys = KEYSPACE | READ | SLOW | DANGEROUS;
 constexpr uint32_t kTTL = KEYSPACE | READ | FAST;
 constexpr uint32_t kPTTL = KEYSPACE | READ | FAST;
 constexpr uint32_t kFieldTtl = KEYSPACE | READ | FAST;
@@ -1667,6 +2164,7 @@ constexpr uint32_t kDump = KEYSPACE | READ | SLOW;
 constexpr uint32_t kUnlink = KEYSPACE | WRITE | FAST;
 constexpr uint32_t kStick = KEYSPACE | WRITE | FAST;
 constexpr uint32_t kSort = WRITE | SET | SORTEDSET | LIST | SLOW | DANGEROUS;
+constexpr uint32_t kSortRo = READ | SET | SORTEDSET | LIST | SLOW;
 constexpr uint32_t kMove = KEYSPACE | WRITE | FAST;
 constexpr uint32_t kRestore = KEYSPACE | WRITE | SLOW | DANGEROUS;
 }  // namespace acl
@@ -1698,15 +2196,18 @@ void GenericFamily::Register(CommandRegistry* registry) {
       << CI{"RENAMENX", CO::WRITE | CO::NO_AUTOJOURNAL, 3, 1, 2, acl::kRenamNX}.HFUNC(RenameNx)
       << CI{"SELECT", kSelectOpts, 2, 0, 0, acl::kSelect}.HFUNC(Select)
       << CI{"SCAN", CO::READONLY | CO::FAST | CO::LOADING, -2, 0, 0, acl::kScan}.HFUNC(Scan)
+      << CI{"EXPORTKEYS", CO::READONLY | CO::NOSCRIPT, -1, 0, 0, acl::kExportKeys}.HFUNC(
+             ExportKeys)
       << CI{"TTL", CO::READONLY | CO::FAST, 2, 1, 1, acl::kTTL}.HFUNC(Ttl)
       << CI{"PTTL", CO::READONLY | CO::FAST, 2, 1, 1, acl::kPTTL}.HFUNC(Pttl)
       << CI{"FIELDTTL", CO::READONLY | CO::FAST, 3, 1, 1, acl::kFieldTtl}.HFUNC(FieldTtl)
       << CI{"TIME", CO::LOADING | CO::FAST, 1, 0, 0, acl::kTime}.HFUNC(Time)
       << CI{"TYPE", CO::READONLY | CO::FAST | CO::LOADING, 2, 1, 1, acl::kType}.HFUNC(Type)
       << CI{"DUMP", CO::READONLY, 2, 1, 1, acl::kDump}.HFUNC(Dump)
-      << CI{"UNLINK", CO::WRITE, -2, 1, -1, acl::kUnlink}.HFUNC(Del)
+      << CI{"UNLINK", CO::WRITE, -2, 1, -1, acl::kUnlink}.HFUNC(Unlink)
       << CI{"STICK", CO::WRITE, -2, 1, -1, acl::kStick}.HFUNC(Stick)
       << CI{"SORT", CO::READONLY, -2, 1, 1, acl::kSort}.HFUNC(Sort)
+      << CI{"SORT_RO", CO::READONLY, -2, 1, 1, acl::kSortRo}.HFUNC(Sort)
       << CI{"MOVE", CO::WRITE | CO::GLOBAL_TRANS | CO::NO_AUTOJOURNAL, 3, 1, 1, acl::kMove}.HFUNC(
              Move)
       << CI{"RESTORE", CO::WRITE, -4, 1, 1, acl::kRestore}.HFUNC(Restore)
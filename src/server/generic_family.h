@@ -45,6 +45,8 @@ class GenericFamily {
 
  private:
   static void Del(CmdArgList args, ConnectionContext* cntx);
+  static void Unlink(CmdArgList args, ConnectionContext* cntx);
+  static void DelGeneric(CmdArgList args, size_t lazy_free_min_elements, ConnectionContext* cntx);
   static void Ping(CmdArgList args, ConnectionContext* cntx);
   static void Exists(CmdArgList args, ConnectionContext* cntx);
   static void Expire(CmdArgList args, ConnectionContext* cntx);
@@ -65,6 +67,7 @@ class GenericFamily {
   static void Echo(CmdArgList args, ConnectionContext* cntx);
   static void Select(CmdArgList args, ConnectionContext* cntx);
   static void Scan(CmdArgList args, ConnectionContext* cntx);
+  static void ExportKeys(CmdArgList args, ConnectionContext* cntx);
   static void Time(CmdArgList args, ConnectionContext* cntx);
   static void Type(CmdArgList args, ConnectionContext* cntx);
   static void Dump(CmdArgList args, ConnectionContext* cntx);
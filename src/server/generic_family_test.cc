@@ -4,10 +4,13 @@
 
 #include "server/generic_family.h"
 
+#include <fstream>
+
 extern "C" {
 #include "redis/rdb.h"
 }
 
+#include "base/flags.h"
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "facade/facade_test.h"
@@ -24,6 +27,10 @@ using namespace util;
 using namespace boost;
 using absl::StrCat;
 
+ABSL_DECLARE_FLAG(uint32_t, scan_shard_fanout);
+ABSL_DECLARE_FLAG(string, dir);
+ABSL_DECLARE_FLAG(bool, dump_native_encoding);
+
 namespace dfly {
 
 class GenericFamilyTest : public BaseFamilyTest {};
@@ -174,6 +181,26 @@ TEST_F(GenericFamilyTest, Del) {
   Run({"del", "k1"});
 }
 
+TEST_F(GenericFamilyTest, UnlinkLazyFree) {
+  for (string_view type : {"set", "hash", "list", "zset"}) {
+    Run({"debug", "populate", "2", type, "10", "type", type, "elements", "2000"});
+  }
+  Run({"set", "small", "val"});
+  ASSERT_EQ(9, CheckedInt({"dbsize"}));
+
+  EXPECT_EQ(5, CheckedInt({"unlink", "set:0", "hash:0", "list:0", "zset:0", "small"}));
+  EXPECT_EQ(0, CheckedInt({"exists", "set:0", "hash:0", "list:0", "zset:0", "small"}));
+  EXPECT_EQ(4, CheckedInt({"dbsize"}));
+  ExpectConditionWithinTimeout([this] { return GetMetrics().lazyfree_pending_objects == 0; });
+  EXPECT_EQ(0u, GetMetrics().lazyfree_pending_bytes);
+
+  // Flushed tables hand their large values to the lazy free queue as well.
+  Run({"flushdb"});
+  EXPECT_EQ(0, CheckedInt({"dbsize"}));
+  ExpectConditionWithinTimeout([this] { return GetMetrics().lazyfree_pending_objects == 0; });
+  EXPECT_EQ(0u, GetMetrics().lazyfree_pending_bytes);
+}
+
 TEST_F(GenericFamilyTest, TTL) {
   EXPECT_EQ(-2, CheckedInt({"ttl", "foo"}));
   EXPECT_EQ(-2, CheckedInt({"pttl", "foo"}));
@@ -251,6 +278,23 @@ TEST_F(GenericFamilyTest, RenameNonString) {
   EXPECT_EQ(1, CheckedInt({"del", "b"}));
 }
 
+TEST_F(GenericFamilyTest, RenameHandover) {
+  string val(100000, 'x');
+  Run({"set", "x", val, "ex", "100"});
+  Run({"set", "b", "old"});
+
+  ASSERT_EQ(Run({"rename", "x", "b"}), "OK");
+  ASSERT_EQ(2, last_cmd_dbg_info_.shards_count);
+  EXPECT_THAT(Run({"get", "x"}), ArgType(RespExpr::NIL));
+  EXPECT_EQ(Run({"get", "b"}), val);
+  EXPECT_THAT(CheckedInt({"ttl", "b"}), AllOf(Gt(0), Le(100)));
+
+  ASSERT_EQ(Run({"rename", "b", "x"}), "OK");
+  EXPECT_EQ(Run({"get", "x"}), val);
+
+  EXPECT_EQ(1, CheckedInt({"del", "x"}));
+}
+
 TEST_F(GenericFamilyTest, RenameBinary) {
   const char kKey1[] = "\x01\x02\x03\x04";
   const char kKey2[] = "\x05\x06\x07\x08";
@@ -402,6 +446,132 @@ TEST_F(GenericFamilyTest, Scan) {
   EXPECT_THAT(vec, Each(StartsWith("zset")));
 }
 
+TEST_F(GenericFamilyTest, ScanFanout) {
+  absl::FlagSaver fs;
+  vector<string> expected;
+  for (unsigned i = 0; i < 500; ++i) {
+    Run({"set", StrCat("user:", i, ":session"), "bar"});
+    Run({"sadd", StrCat("user:", i, ":tags"), "bar"});
+    if (i % 10 == 0) {
+      Run({"set", StrCat("user:", i, ":cart"), "bar"});
+      expected.push_back(StrCat("user:", i, ":cart"));
+    }
+  }
+  Run({"sadd", "user:1:cart:set", "bar"});
+  sort(expected.begin(), expected.end());
+
+  for (uint32_t fanout : {1, 8}) {
+    absl::SetFlag(&FLAGS_scan_shard_fanout, fanout);
+    for (string_view count : {"1", "10", "1000"}) {
+      vector<string> keys;
+      string cursor = "0";
+      do {
+        auto resp =
+            Run({"scan", cursor, "match", "user:*:cart", "type", "string", "count", count});
+        ASSERT_THAT(resp, ArrLen(2));
+        cursor = resp.GetVec()[0].GetString();
+        for (auto& key : StrArray(resp.GetVec()[1]))
+          keys.push_back(key);
+      } while (cursor != "0");
+
+      // Every matching key is returned once.
+      sort(keys.begin(), keys.end());
+      EXPECT_EQ(keys, expected) << fanout << " " << count;
+    }
+  }
+}
+
+TEST_F(GenericFamilyTest, ScanAcrossMerge) {
+  // Grow the tables and delete most of the keys, so that their segments can be merged.
+  Run({"debug", "populate", "20000", "key", "1"});
+  vector<string> del = {"del"}, expected;
+  for (unsigned i = 0; i < 20000; ++i) {
+    string key = StrCat("key:", i);
+    if (i % 100 == 0)
+      expected.push_back(key);
+    else
+      del.push_back(key);
+  }
+  Run(absl::MakeSpan(del));
+  sort(expected.begin(), expected.end());
+
+  auto merge = [] {
+    shard_set->RunBriefInParallel([](EngineShard* shard) {
+      shard->db_slice().MergeSegmentsStep(0, 0.5, UINT32_MAX);
+    });
+  };
+
+  // Merge steps run between the pages, only shards the scan did not reach yet are merged.
+  vector<string> keys;
+  string cursor = "0";
+  do {
+    auto resp = Run({"scan", cursor, "count", "10"});
+    ASSERT_THAT(resp, ArrLen(2));
+    cursor = resp.GetVec()[0].GetString();
+    for (auto& key : StrArray(resp.GetVec()[1]))
+      keys.push_back(key);
+    merge();
+  } while (cursor != "0");
+
+  sort(keys.begin(), keys.end());
+  EXPECT_EQ(keys, expected);
+
+  // Once no cursor was handed out for a while, the scanned shards are merged as well.
+  size_t merged = GetMetrics().events.segments_merged;
+  AdvanceTime(DbSlice::kScanQuietMs + 1);
+  merge();
+  EXPECT_GT(GetMetrics().events.segments_merged, merged);
+  EXPECT_THAT(Run({"dbsize"}), IntArg(expected.size()));
+}
+
+TEST_F(GenericFamilyTest, ExportKeys) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_dir, ::testing::TempDir());
+  for (unsigned i = 0; i < 100; ++i) {
+    Run({"set", StrCat("key:", i), "bar"});
+    Run({"sadd", StrCat("set:", i), "bar"});
+  }
+  Run({"pexpire", "key:0", "100000"});
+
+  EXPECT_THAT(Run({"exportkeys"}), ErrArg("requires RESP3"));
+  EXPECT_THAT(Run({"exportkeys", "file", "../keys.txt"}), ErrArg("invalid file name"));
+  EXPECT_THAT(Run({"exportkeys", "count", "0", "file", "keys.txt"}),
+              ErrArg("value is not an integer"));
+
+  auto resp = Run({"exportkeys", "match", "key:*", "withtype", "withttl", "count", "7", "file",
+                   "keys.txt"});
+  EXPECT_THAT(resp, IntArg(100));
+
+  ifstream file(::testing::TempDir() + "/keys.txt");
+  vector<string> lines;
+  for (string line; getline(file, line);)
+    lines.push_back(line);
+  ASSERT_EQ(lines.size(), 100);
+  EXPECT_THAT(lines, Contains("key:1\tstring\t-1"));
+  EXPECT_THAT(lines, Contains(StartsWith("key:0\tstring\t")));
+  EXPECT_THAT(lines, Not(Contains("key:0\tstring\t-1")));
+
+  // Streamed as push messages, followed by the number of keys.
+  Run({"hello", "3"});
+  single_response_ = false;
+  resp = Run({"exportkeys", "type", "set", "count", "10"});
+  auto frames = resp.GetVec();
+  ASSERT_GE(frames.size(), 2);
+  EXPECT_THAT(frames.back(), IntArg(100));
+
+  vector<string> keys;
+  for (size_t i = 0; i + 1 < frames.size(); ++i) {
+    ASSERT_THAT(frames[i], ArrLen(2));
+    EXPECT_THAT(frames[i].GetVec()[0], "exportkeys");
+    for (auto& key : StrArray(frames[i].GetVec()[1]))
+      keys.push_back(key);
+  }
+  EXPECT_EQ(keys.size(), 100);
+  EXPECT_THAT(keys, Each(StartsWith("set:")));
+  sort(keys.begin(), keys.end());
+  EXPECT_EQ(unique(keys.begin(), keys.end()), keys.end());
+}
+
 TEST_F(GenericFamilyTest, Sort) {
   // Test list sort with params
   Run({"del", "list-1"});
@@ -467,6 +637,62 @@ TEST_F(GenericFamilyTest, Sort) {
   ASSERT_THAT(Run({"sort", "list-2"}), ErrArg("One or more scores can't be converted into double"));
 }
 
+TEST_F(GenericFamilyTest, SortLimit) {
+  // Enough elements, so that only a window of them is selected on the shard.
+  vector<string> list_args = {"rpush", "list-1"}, set_args = {"sadd", "set-1"};
+  for (unsigned i = 0; i < 300; i++) {
+    list_args.push_back(StrCat((i * 37) % 101, ".", i % 3));
+    set_args.push_back(StrCat((i * 53) % 1000));
+  }
+  Run(absl::MakeSpan(list_args));
+  Run(absl::MakeSpan(set_args));
+
+  // Single element replies are not wrapped in an array.
+  auto sort = [this](vector<string> args) -> vector<string> {
+    auto resp = Run(absl::MakeSpan(args));
+    if (resp.type == RespExpr::ARRAY)
+      return StrArray(resp);
+    return {resp.GetString()};
+  };
+
+  for (string_view key : {"list-1", "set-1"}) {
+    for (vector<string> opts : {vector<string>{}, {"DESC"}, {"ALPHA"}, {"DESC", "ALPHA"}}) {
+      vector<string> full_args = {"sort", string(key)};
+      full_args.insert(full_args.end(), opts.begin(), opts.end());
+      vector<string> full = sort(full_args);
+      ASSERT_EQ(full.size(), 300);
+      bool numeric = find(opts.begin(), opts.end(), "ALPHA") == opts.end();
+
+      vector<pair<size_t, size_t>> limits = {{0, 1}, {0, 10}, {7, 20}, {150, 149}, {299, 5}};
+      for (auto [offset, count] : limits) {
+        vector<string> args = full_args;
+        args.insert(args.end(), {"LIMIT", StrCat(offset), StrCat(count)});
+        vector<string> vec = sort(args);
+        ASSERT_EQ(vec.size(), min(count, full.size() - offset)) << key << " " << offset;
+        for (size_t i = 0; i < vec.size(); i++) {
+          // Equal numeric values may come in any order.
+          if (numeric)
+            EXPECT_EQ(stod(vec[i]), stod(full[offset + i])) << key << " " << offset;
+          else
+            EXPECT_EQ(vec[i], full[offset + i]) << key << " " << offset;
+        }
+      }
+    }
+  }
+
+  // Negative offset starts from the beginning, negative count returns all the rest.
+  EXPECT_THAT(Run({"sort", "set-1", "LIMIT", "-5", "1"}), "0");
+  EXPECT_THAT(Run({"sort", "set-1", "LIMIT", "297", "-1"}), ArrLen(3));
+}
+
+TEST_F(GenericFamilyTest, SortRo) {
+  Run({"rpush", "list-1", "3", "1", "2"});
+  EXPECT_THAT(Run({"sort_ro", "list-1"}).GetVec(), ElementsAre("1", "2", "3"));
+  EXPECT_THAT(Run({"sort_ro", "list-1", "DESC", "LIMIT", "0", "2"}).GetVec(),
+              ElementsAre("3", "2"));
+  EXPECT_THAT(Run({"sort_ro", "list-2"}), ArrLen(0));
+}
+
 TEST_F(GenericFamilyTest, TimeNoKeys) {
   auto resp = Run({"time"});
   EXPECT_THAT(resp, ArrLen(2));
@@ -565,6 +791,36 @@ TEST_F(GenericFamilyTest, Dump) {
   EXPECT_EQ(resp.type, RespExpr::NIL);
 }
 
+TEST_F(GenericFamilyTest, DumpNative) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_dump_native_encoding, true);
+
+  Run({"set", "str", string(100, 'x')});
+  Run({"rpush", "list", "a", "b", "3"});
+  Run({"hset", "hash", "f1", "v1", "f2", "2"});
+  Run({"zadd", "zset", "1", "a", "2.5", "b"});
+  Run({"sadd", "set", "1", "2", "3"});
+
+  for (string_view key : {"str", "list", "hash", "zset", "set"}) {
+    string dump{ToSV(Run({"dump", key}).GetBuf())};
+
+    // The footer holds the version of the native encodings.
+    ASSERT_GT(dump.size(), 10u);
+    EXPECT_EQ(RDB_VERSION, uint8_t(dump[dump.size() - 10])) << key;
+
+    string copy = absl::StrCat(key, ":copy");
+    ASSERT_EQ(Run({"restore", copy, "0", dump}), "OK") << key;
+    EXPECT_EQ(Run({"object", "encoding", key}), Run({"object", "encoding", copy})) << key;
+  }
+
+  EXPECT_EQ(Run({"get", "str:copy"}), string(100, 'x'));
+  EXPECT_THAT(Run({"lrange", "list:copy", "0", "-1"}).GetVec(), ElementsAre("a", "b", "3"));
+  EXPECT_THAT(Run({"hgetall", "hash:copy"}).GetVec(), ElementsAre("f1", "v1", "f2", "2"));
+  EXPECT_THAT(Run({"zrange", "zset:copy", "0", "-1", "withscores"}).GetVec(),
+              ElementsAre("a", "1", "b", "2.5"));
+  EXPECT_THAT(Run({"smembers", "set:copy"}).GetVec(), UnorderedElementsAre("1", "2", "3"));
+}
+
 TEST_F(GenericFamilyTest, Restore) {
   using std::chrono::duration_cast;
   using std::chrono::milliseconds;
@@ -169,51 +169,55 @@ OpResult<int64_t> CountHllsSingle(const OpArgs& op_args, string_view key) {
   }
 }
 
-OpResult<vector<string>> ReadValues(const OpArgs& op_args, const ShardArgs& keys) {
+// Merges all HLLs found at `keys` into an array of 8-bit registers, so that a single array is
+// passed from every shard to the coordinator.
+OpResult<vector<uint8_t>> MergeValues(const OpArgs& op_args, const ShardArgs& keys) {
   try {
-    vector<string> values;
+    vector<uint8_t> registers(getHllRegistersCount(), 0);
+    string tmp;
     for (string_view key : keys) {
       auto it = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key, OBJ_STRING);
       if (it.ok()) {
-        string hll;
-        it.value()->second.GetString(&hll);
-        ConvertToDenseIfNeeded(&hll);
-        if (isValidHLL(StringToHllPtr(hll)) != HLL_VALID_DENSE) {
+        string_view hll = it.value()->second.GetSlice(&tmp);
+        if (isValidHLL(StringToHllPtr(hll)) == HLL_VALID_SPARSE) {
+          string dense{hll};
+          ConvertToDenseIfNeeded(&dense);
+          tmp = std::move(dense);
+          hll = tmp;
+        }
+        if (mergeDenseHllRegisters(StringToHllPtr(hll), registers.data()) != 0) {
           return OpStatus::INVALID_VALUE;
-        } else {
-          values.push_back(std::move(hll));
         }
       } else if (it.status() == OpStatus::WRONG_TYPE) {
         return OpStatus::WRONG_TYPE;
       }
     }
-    return values;
+    return registers;
   } catch (const std::bad_alloc&) {
     return OpStatus::OUT_OF_MEMORY;
   }
 }
 
-vector<HllBufferPtr> ConvertShardVector(const vector<vector<string>>& hlls) {
-  vector<HllBufferPtr> ptrs;
-  ptrs.reserve(hlls.size());
-  for (auto& shard_hlls : hlls) {
-    for (auto& hll : shard_hlls) {
-      ptrs.push_back(StringToHllPtr(hll));
+vector<uint8_t> MergeShardRegisters(const vector<vector<uint8_t>>& shard_registers) {
+  vector<uint8_t> registers(getHllRegistersCount(), 0);
+  for (const auto& shard_regs : shard_registers) {
+    if (!shard_regs.empty()) {
+      mergeHllRegisters(registers.data(), shard_regs.data());
     }
   }
-  return ptrs;
+  return registers;
 }
 
 OpResult<int64_t> PFCountMulti(CmdArgList args, ConnectionContext* cntx) {
-  vector<vector<string>> hlls;
-  hlls.resize(shard_set->size());
+  vector<vector<uint8_t>> shard_registers;
+  shard_registers.resize(shard_set->size());
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
     ShardId sid = shard->shard_id();
     ShardArgs shard_args = t->GetShardArgs(shard->shard_id());
-    auto result = ReadValues(t->GetOpArgs(shard), shard_args);
+    auto result = MergeValues(t->GetOpArgs(shard), shard_args);
     if (result.ok()) {
-      hlls[sid] = std::move(result.value());
+      shard_registers[sid] = std::move(result.value());
     }
     return result.status();
   };
@@ -221,13 +225,8 @@ OpResult<int64_t> PFCountMulti(CmdArgList args, ConnectionContext* cntx) {
   Transaction* trans = cntx->transaction;
   trans->ScheduleSingleHop(std::move(cb));
 
-  vector<HllBufferPtr> ptrs = ConvertShardVector(hlls);
-  int64_t pf_count = pfcountMulti(ptrs.data(), ptrs.size());
-  if (pf_count < 0) {
-    return OpStatus::INVALID_VALUE;
-  } else {
-    return pf_count;
-  }
+  vector<uint8_t> registers = MergeShardRegisters(shard_registers);
+  return pfcountRegisters(registers.data());
 }
 
 void PFCount(CmdArgList args, ConnectionContext* cntx) {
@@ -246,16 +245,16 @@ void PFCount(CmdArgList args, ConnectionContext* cntx) {
 }
 
 OpResult<int> PFMergeInternal(CmdArgList args, ConnectionContext* cntx) {
-  vector<vector<string>> hlls;
-  hlls.resize(shard_set->size());
+  vector<vector<uint8_t>> shard_registers;
+  shard_registers.resize(shard_set->size());
 
   atomic_bool success = true;
   auto cb = [&](Transaction* t, EngineShard* shard) {
     ShardId sid = shard->shard_id();
     ShardArgs shard_args = t->GetShardArgs(shard->shard_id());
-    auto result = ReadValues(t->GetOpArgs(shard), shard_args);
+    auto result = MergeValues(t->GetOpArgs(shard), shard_args);
     if (result.ok()) {
-      hlls[sid] = std::move(result.value());
+      shard_registers[sid] = std::move(result.value());
     } else {
       success = false;
     }
@@ -270,12 +269,12 @@ OpResult<int> PFMergeInternal(CmdArgList args, ConnectionContext* cntx) {
     return OpStatus::INVALID_VALUE;
   }
 
-  vector<HllBufferPtr> ptrs = ConvertShardVector(hlls);
+  vector<uint8_t> registers = MergeShardRegisters(shard_registers);
 
   string hll;
   hll.resize(getDenseHllSize());
   createDenseHll(StringToHllPtr(hll));
-  int result = pfmerge(ptrs.data(), ptrs.size(), StringToHllPtr(hll));
+  int result = storeHllRegisters(registers.data(), StringToHllPtr(hll));
 
   auto set_cb = [&](Transaction* t, EngineShard* shard) {
     string_view key = ArgS(args, 0);
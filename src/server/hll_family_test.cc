@@ -193,4 +193,31 @@ TEST_F(HllFamilyTest, MergeInvalid) {
   EXPECT_EQ(CheckedInt({"pfcount", "key1"}), 3);
 }
 
+TEST_F(HllFamilyTest, MergeMany) {
+  // Mix of sparse and dense HLLs spread over all shards, with overlapping values.
+  vector<string> keys;
+  for (int i = 0; i < 50; i++) {
+    keys.push_back("key" + to_string(i));
+    vector<string> cmd = {"pfadd", keys.back()};
+    int num_values = i % 5 == 0 ? 2000 : 100;
+    for (int j = 0; j < num_values; j++) {
+      cmd.push_back(GenerateUniqueValue(i * 50 + j));
+    }
+    Run(absl::MakeSpan(cmd));
+  }
+
+  // Value ranges [50 * i, 50 * i + num_values) cover the range [0, 45 * 50 + 2000)
+  const int unique_values = 4250;
+  vector<string_view> args = {"pfcount"};
+  args.insert(args.end(), keys.begin(), keys.end());
+  int64_t count = CheckedInt(args);
+  EXPECT_LT(std::abs(count - unique_values * 1.0) / unique_values, 0.05);
+
+  args = {"pfmerge", "merged"};
+  args.insert(args.end(), keys.begin(), keys.end());
+  EXPECT_EQ(Run(args), "OK");
+  EXPECT_EQ(CheckedInt({"pfcount", "merged"}), count);
+  EXPECT_EQ(CheckedInt({"pfcount", "merged", "key0", "key49"}), count);
+}
+
 }  // namespace dfly
@@ -0,0 +1,109 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/hot_key_cache.h"
+
+#include "base/logging.h"
+#include "server/engine_shard_set.h"
+
+namespace dfly {
+
+using namespace std;
+
+namespace {
+
+// Hash table and LRU node overhead of an entry, besides its key and value.
+constexpr size_t kEntryOverhead = 64;
+
+size_t EntryBytes(string_view key, string_view value) {
+  // The key is held both by the entry map and by the lru.
+  return 2 * key.size() + value.size() + kEntryOverhead;
+}
+
+}  // namespace
+
+HotKeyCache::HotKeyCache() : lru_(1024, PMR_NS::get_default_resource()) {
+}
+
+void HotKeyCache::SetLimit(size_t max_bytes) {
+  max_bytes_ = max_bytes;
+  while (bytes_ > max_bytes_)
+    Erase(entries_.find(*lru_.GetTail()));
+}
+
+const string* HotKeyCache::Get(DbIndex db, string_view key, uint64_t now_ms) {
+  auto it = entries_.find(key);
+  if (it == entries_.end() || it->second.db != db)
+    return nullptr;
+
+  ShardId sid = it->second.sid;
+  if (shard_set->Get(sid)->db_slice().hot_keys_epoch() > shard_epochs_[sid])
+    return nullptr;  // some key of the shard changed, its broadcast is still on the way
+
+  if (it->second.expire_at_ms && it->second.expire_at_ms <= now_ms) {
+    Erase(it);
+    return nullptr;
+  }
+
+  lru_.Put(it->first, Position::kHead);
+  return &it->second.value;
+}
+
+void HotKeyCache::Put(ShardId sid, uint64_t epoch, DbIndex db, string_view key, string value,
+                      uint64_t expire_at_ms) {
+  if (sid >= shard_epochs_.size())
+    shard_epochs_.resize(sid + 1, 0);
+
+  // The shard may have changed the key after it was read.
+  if (epoch < shard_epochs_[sid])
+    return;
+
+  size_t entry_bytes = EntryBytes(key, value);
+  if (entry_bytes > max_bytes_)
+    return;
+
+  if (auto it = entries_.find(key); it != entries_.end())
+    Erase(it);
+
+  while (bytes_ + entry_bytes > max_bytes_)
+    Erase(entries_.find(*lru_.GetTail()));
+
+  auto [it, inserted] = entries_.try_emplace(key, Entry{std::move(value), expire_at_ms, db, sid});
+  DCHECK(inserted);
+  lru_.Put(it->first, Position::kHead);
+  bytes_ += entry_bytes;
+}
+
+void HotKeyCache::Invalidate(ShardId sid, uint64_t epoch, const vector<string>& keys) {
+  AdvanceEpoch(sid, epoch);
+  for (const auto& key : keys) {
+    if (auto it = entries_.find(key); it != entries_.end())
+      Erase(it);
+  }
+}
+
+void HotKeyCache::InvalidateShard(ShardId sid, uint64_t epoch) {
+  AdvanceEpoch(sid, epoch);
+  for (auto it = entries_.begin(); it != entries_.end();) {
+    auto next = std::next(it);
+    if (it->second.sid == sid)
+      Erase(it);
+    it = next;
+  }
+}
+
+void HotKeyCache::Erase(EntryMap::iterator it) {
+  DCHECK(it != entries_.end());
+  bytes_ -= EntryBytes(it->first, it->second.value);
+  lru_.Remove(it->first);
+  entries_.erase(it);
+}
+
+void HotKeyCache::AdvanceEpoch(ShardId sid, uint64_t epoch) {
+  if (sid >= shard_epochs_.size())
+    shard_epochs_.resize(sid + 1, 0);
+  shard_epochs_[sid] = max(shard_epochs_[sid], epoch);
+}
+
+}  // namespace dfly
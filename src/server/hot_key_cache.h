@@ -0,0 +1,81 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/container/flat_hash_map.h>
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "core/lru.h"
+#include "server/tx_base.h"
+
+namespace dfly {
+
+// Thread local read-through cache of small string values of hot keys, which lets coordinator
+// threads serve reads of keys that are hot on a shard without a hop to it. The shards track the
+// keys they handed out and broadcast the keys that change, see DbSlice::ShareHotKey.
+// Every shard numbers its broadcasts with an increasing epoch, and a value is added only if it
+// was read at the latest epoch of its shard seen by the thread. Otherwise a broadcast sent after
+// the read could have been handled before the value was added, leaving a stale copy behind.
+// The broadcasts are asynchronous, so a shard also bumps its epoch before a write of a cached
+// key replies, and no value of a shard is served while the thread has not handled the
+// broadcasts up to that epoch. This keeps reads that follow a write consistent with it.
+class HotKeyCache {
+ public:
+  HotKeyCache();
+
+  // Values are evicted in LRU order beyond max_bytes, 0 disables the cache.
+  void SetLimit(size_t max_bytes);
+
+  bool IsEnabled() const {
+    return max_bytes_ > 0;
+  }
+
+  // Returns the value of key in db, nullptr if it is not cached or expired. The value must be
+  // used before the fiber yields.
+  const std::string* Get(DbIndex db, std::string_view key, uint64_t now_ms);
+
+  // Adds the value of key read by shard sid at the given epoch, expire_at_ms is 0 if the key
+  // has no expiry.
+  void Put(ShardId sid, uint64_t epoch, DbIndex db, std::string_view key, std::string value,
+           uint64_t expire_at_ms);
+
+  // Drops the keys that changed on shard sid, when it advanced to epoch.
+  void Invalidate(ShardId sid, uint64_t epoch, const std::vector<std::string>& keys);
+
+  // Drops all the keys of shard sid, when it advanced to epoch.
+  void InvalidateShard(ShardId sid, uint64_t epoch);
+
+  size_t size() const {
+    return entries_.size();
+  }
+
+  size_t bytes() const {
+    return bytes_;
+  }
+
+ private:
+  struct Entry {
+    std::string value;
+    uint64_t expire_at_ms;
+    DbIndex db;
+    ShardId sid;
+  };
+
+  using EntryMap = absl::flat_hash_map<std::string, Entry>;
+
+  void Erase(EntryMap::iterator it);
+  void AdvanceEpoch(ShardId sid, uint64_t epoch);
+
+  EntryMap entries_;
+  Lru<std::string> lru_;  // recency order of the keys in entries_
+  std::vector<uint64_t> shard_epochs_;
+  size_t bytes_ = 0;
+  size_t max_bytes_ = 0;
+};
+
+}  // namespace dfly
@@ -12,6 +12,7 @@ extern "C" {
 }
 
 #include "base/logging.h"
+#include "core/listpack_scan.h"
 #include "core/string_map.h"
 #include "server/acl/acl_commands_def.h"
 #include "server/command_registry.h"
@@ -20,6 +21,7 @@ extern "C" {
 #include "server/engine_shard_set.h"
 #include "server/error.h"
 #include "server/search/doc_index.h"
+#include "server/tiered_storage.h"
 #include "server/transaction.h"
 
 using namespace std;
@@ -43,7 +45,9 @@ bool IsGoodForListpack(CmdArgList args, const uint8_t* lp) {
     sum += s.size();
   }
 
-  return lpBytes(const_cast<uint8_t*>(lp)) + sum < server.max_listpack_map_bytes;
+  uint8_t* ptr = const_cast<uint8_t*>(lp);
+  return lpBytes(ptr) + sum < server.max_listpack_map_bytes &&
+         !detail::LpLookupTooSlow(lpLength(ptr) + args.size());
 }
 
 using container_utils::GetStringMap;
@@ -51,9 +55,7 @@ using container_utils::LpFind;
 using container_utils::LpGetView;
 
 pair<uint8_t*, bool> LpDelete(uint8_t* lp, string_view field) {
-  uint8_t* fptr = lpFirst(lp);
-  DCHECK(fptr);
-  fptr = lpFind(lp, fptr, (unsigned char*)field.data(), field.size(), 1);
+  uint8_t* fptr = detail::LpFindField(lp, field);
   if (fptr == NULL) {
     return make_pair(lp, false);
   }
@@ -70,7 +72,6 @@ pair<uint8_t*, bool> LpDelete(uint8_t* lp, string_view field) {
 pair<uint8_t*, bool> LpInsert(uint8_t* lp, string_view field, string_view val, bool skip_exists) {
   uint8_t* vptr;
 
-  uint8_t* fptr = lpFirst(lp);
   uint8_t* fsrc = field.empty() ? lp : (uint8_t*)field.data();
 
   // if we vsrc is NULL then lpReplace will delete the element, which is not what we want.
@@ -80,20 +81,17 @@ pair<uint8_t*, bool> LpInsert(uint8_t* lp, string_view field, string_view val, b
 
   bool updated = false;
 
-  if (fptr) {
-    fptr = lpFind(lp, fptr, fsrc, field.size(), 1);
-    if (fptr) {
-      if (skip_exists) {
-        return make_pair(lp, false);
-      }
-      /* Grab pointer to the value (fptr points to the field) */
-      vptr = lpNext(lp, fptr);
-      updated = true;
-
-      /* Replace value */
-      lp = lpReplace(lp, &vptr, vsrc, val.size());
-      DCHECK_EQ(0u, lpLength(lp) % 2);
+  if (uint8_t* fptr = detail::LpFindField(lp, field); fptr) {
+    if (skip_exists) {
+      return make_pair(lp, false);
     }
+    /* Grab pointer to the value (fptr points to the field) */
+    vptr = lpNext(lp, fptr);
+    updated = true;
+
+    /* Replace value */
+    lp = lpReplace(lp, &vptr, vsrc, val.size());
+    DCHECK_EQ(0u, lpLength(lp) % 2);
   }
 
   if (!updated) {
@@ -193,7 +191,7 @@ OpStatus OpIncrBy(const OpArgs& op_args, string_view key, string_view field, Inc
       lpb = lpBytes(lp);
       stats->listpack_bytes -= lpb;
 
-      if (lpb >= server.max_listpack_map_bytes) {
+      if (lpb >= server.max_listpack_map_bytes || detail::LpLookupTooSlow(lpLength(lp))) {
         stats->listpack_blob_cnt--;
         StringMap* sm = HSetFamily::ConvertToStrMap(lp);
         pv.InitRobj(OBJ_HASH, kEncodingStrMap2, sm);
@@ -405,21 +403,43 @@ OpResult<uint32_t> OpDel(const OpArgs& op_args, string_view key, CmdArgList valu
   return deleted;
 }
 
-OpResult<vector<OptStr>> OpHMGet(const OpArgs& op_args, std::string_view key, CmdArgList fields) {
-  DCHECK(!fields.empty());
-
-  auto& db_slice = op_args.shard->db_slice();
-  auto it_res = db_slice.FindReadOnly(op_args.db_cntx, key, OBJ_HASH);
+struct FieldsLookup {
+  const PrimeValue* pv = nullptr;
+  uint8_t* lp = nullptr;  // listpack of the hash or nullptr if it's a StringMap
+};
 
+// Finds the hash for looking up a few of its fields. An offloaded hash isn't loaded back to
+// memory until it's read often enough, instead its fields are looked up in a copy read into buf.
+OpResult<FieldsLookup> FindForFields(const OpArgs& op_args, string_view key, string* buf) {
+  auto it_res = op_args.shard->db_slice().FindReadOnlyOffloaded(op_args.db_cntx, key, OBJ_HASH);
   if (!it_res)
     return it_res.status();
 
   const PrimeValue& pv = (*it_res)->second;
+  if (pv.IsExternal()) {
+    DCHECK_EQ(pv.Encoding(), kEncodingListPack);
+    if (auto ec = op_args.shard->tiered_storage()->ReadContainer(pv, buf); ec) {
+      LOG(ERROR) << "Failed to read offloaded hash " << ec.message();
+      return OpStatus::KEY_NOTFOUND;
+    }
+    return FieldsLookup{&pv, reinterpret_cast<uint8_t*>(buf->data())};
+  }
+
+  bool is_lp = pv.Encoding() == kEncodingListPack;
+  return FieldsLookup{&pv, is_lp ? static_cast<uint8_t*>(pv.RObjPtr()) : nullptr};
+}
+
+OpResult<vector<OptStr>> OpHMGet(const OpArgs& op_args, std::string_view key, CmdArgList fields) {
+  DCHECK(!fields.empty());
+
+  string buf;
+  auto lookup = FindForFields(op_args, key, &buf);
+  if (!lookup)
+    return lookup.status();
 
   std::vector<OptStr> result(fields.size());
 
-  if (pv.Encoding() == kEncodingListPack) {
-    uint8_t* lp = (uint8_t*)pv.RObjPtr();
+  if (uint8_t* lp = lookup->lp; lp) {
 
     absl::flat_hash_map<string_view, unsigned> reverse;
     reverse.reserve(fields.size() + 1);
@@ -451,13 +471,20 @@ OpResult<vector<OptStr>> OpHMGet(const OpArgs& op_args, std::string_view key, Cm
       lp_elem = lpNext(lp, lp_elem);  // switch to the next key
     } while (lp_elem);
   } else {
-    DCHECK_EQ(kEncodingStrMap2, pv.Encoding());
-    StringMap* sm = GetStringMap(pv, op_args.db_cntx);
+    DCHECK_EQ(kEncodingStrMap2, lookup->pv->Encoding());
+    StringMap* sm = GetStringMap(*lookup->pv, op_args.db_cntx);
 
+    vector<string_view> keys(fields.size());
     for (size_t i = 0; i < fields.size(); ++i) {
-      auto it = sm->Find(ToSV(fields[i]));
-      if (it != sm->end()) {
-        result[i].emplace(it->second, sdslen(it->second));
+      keys[i] = ToSV(fields[i]);
+    }
+
+    // Probe all fields at once to overlap the cache misses.
+    vector<sds> vals(fields.size());
+    sm->FindBatch(keys.data(), keys.size(), vals.data());
+    for (size_t i = 0; i < vals.size(); ++i) {
+      if (vals[i]) {
+        result[i].emplace(vals[i], sdslen(vals[i]));
       }
     }
   }
@@ -479,49 +506,43 @@ OpResult<uint32_t> OpLen(const OpArgs& op_args, string_view key) {
 }
 
 OpResult<int> OpExist(const OpArgs& op_args, string_view key, string_view field) {
-  auto& db_slice = op_args.shard->db_slice();
-  auto it_res = db_slice.FindReadOnly(op_args.db_cntx, key, OBJ_HASH);
-
-  if (!it_res) {
-    if (it_res.status() == OpStatus::KEY_NOTFOUND)
+  string buf;
+  auto lookup = FindForFields(op_args, key, &buf);
+  if (!lookup) {
+    if (lookup.status() == OpStatus::KEY_NOTFOUND)
       return 0;
-    return it_res.status();
+    return lookup.status();
   }
 
-  const PrimeValue& pv = (*it_res)->second;
-  void* ptr = pv.RObjPtr();
-  if (pv.Encoding() == kEncodingListPack) {
+  if (lookup->lp) {
     uint8_t intbuf[LP_INTBUF_SIZE];
-    optional<string_view> res = LpFind((uint8_t*)ptr, field, intbuf);
+    optional<string_view> res = LpFind(lookup->lp, field, intbuf);
     return res.has_value();
   }
 
-  DCHECK_EQ(kEncodingStrMap2, pv.Encoding());
-  StringMap* sm = GetStringMap(pv, op_args.db_cntx);
+  DCHECK_EQ(kEncodingStrMap2, lookup->pv->Encoding());
+  StringMap* sm = GetStringMap(*lookup->pv, op_args.db_cntx);
 
   return sm->Contains(field) ? 1 : 0;
 };
 
 OpResult<string> OpGet(const OpArgs& op_args, string_view key, string_view field) {
-  auto& db_slice = op_args.shard->db_slice();
-  auto it_res = db_slice.FindReadOnly(op_args.db_cntx, key, OBJ_HASH);
-  if (!it_res)
-    return it_res.status();
-
-  const PrimeValue& pv = (*it_res)->second;
-  void* ptr = pv.RObjPtr();
+  string buf;
+  auto lookup = FindForFields(op_args, key, &buf);
+  if (!lookup)
+    return lookup.status();
 
-  if (pv.Encoding() == kEncodingListPack) {
+  if (lookup->lp) {
     uint8_t intbuf[LP_INTBUF_SIZE];
-    optional<string_view> res = LpFind((uint8_t*)ptr, field, intbuf);
+    optional<string_view> res = LpFind(lookup->lp, field, intbuf);
     if (!res) {
       return OpStatus::KEY_NOTFOUND;
     }
     return string(*res);
   }
 
-  DCHECK_EQ(pv.Encoding(), kEncodingStrMap2);
-  StringMap* sm = GetStringMap(pv, op_args.db_cntx);
+  DCHECK_EQ(lookup->pv->Encoding(), kEncodingStrMap2);
+  StringMap* sm = GetStringMap(*lookup->pv, op_args.db_cntx);
   auto it = sm->Find(field);
 
   if (it == sm->end())
@@ -530,35 +551,39 @@ OpResult<string> OpGet(const OpArgs& op_args, string_view key, string_view field
   return string(it->second, sdslen(it->second));
 }
 
-OpResult<vector<string>> OpGetAll(const OpArgs& op_args, string_view key, uint8_t mask) {
+// The reply is decoded by the coordinator from a copy of the hash, see ReadView.
+OpResult<container_utils::ReadView> OpGetAll(const OpArgs& op_args, string_view key,
+                                             uint8_t mask) {
   auto& db_slice = op_args.shard->db_slice();
   auto it_res = db_slice.FindReadOnly(op_args.db_cntx, key, OBJ_HASH);
   if (!it_res) {
     if (it_res.status() == OpStatus::KEY_NOTFOUND)
-      return vector<string>{};
+      return container_utils::ReadView{};
     return it_res.status();
   }
 
   const PrimeValue& pv = (*it_res)->second;
 
-  vector<string> res;
+  container_utils::ReadView res;
   bool keyval = (mask == (FIELDS | VALUES));
 
   if (pv.Encoding() == kEncodingListPack) {
     uint8_t* lp = (uint8_t*)pv.RObjPtr();
-    res.resize(lpLength(lp) / (keyval ? 1 : 2));
+    if (keyval) {
+      res.AppendListpack(lp, 0, lpLength(lp));
+      return res;
+    }
 
     uint8_t* fptr = lpFirst(lp);
     uint8_t intbuf[LP_INTBUF_SIZE];
 
-    unsigned index = 0;
     while (fptr) {
       if (mask & FIELDS) {
-        res[index++] = LpGetView(fptr, intbuf);
+        res.Append(LpGetView(fptr, intbuf));
       }
       fptr = lpNext(lp, fptr);
       if (mask & VALUES) {
-        res[index++] = LpGetView(fptr, intbuf);
+        res.Append(LpGetView(fptr, intbuf));
       }
       fptr = lpNext(lp, fptr);
     }
@@ -566,14 +591,13 @@ OpResult<vector<string>> OpGetAll(const OpArgs& op_args, string_view key, uint8_
     DCHECK_EQ(pv.Encoding(), kEncodingStrMap2);
     StringMap* sm = GetStringMap(pv, op_args.db_cntx);
 
-    res.reserve(sm->UpperBoundSize() * (keyval ? 2 : 1));
     for (const auto& k_v : *sm) {
       if (mask & FIELDS) {
-        res.emplace_back(k_v.first, sdslen(k_v.first));
+        res.Append({k_v.first, sdslen(k_v.first)});
       }
 
       if (mask & VALUES) {
-        res.emplace_back(k_v.second, sdslen(k_v.second));
+        res.Append({k_v.second, sdslen(k_v.second)});
       }
     }
   }
@@ -582,26 +606,23 @@ OpResult<vector<string>> OpGetAll(const OpArgs& op_args, string_view key, uint8_
 }
 
 OpResult<size_t> OpStrLen(const OpArgs& op_args, string_view key, string_view field) {
-  auto& db_slice = op_args.shard->db_slice();
-  auto it_res = db_slice.FindReadOnly(op_args.db_cntx, key, OBJ_HASH);
-
-  if (!it_res) {
-    if (it_res.status() == OpStatus::KEY_NOTFOUND)
+  string buf;
+  auto lookup = FindForFields(op_args, key, &buf);
+  if (!lookup) {
+    if (lookup.status() == OpStatus::KEY_NOTFOUND)
       return 0;
-    return it_res.status();
+    return lookup.status();
   }
 
-  const PrimeValue& pv = (*it_res)->second;
-  void* ptr = pv.RObjPtr();
-  if (pv.Encoding() == kEncodingListPack) {
+  if (lookup->lp) {
     uint8_t intbuf[LP_INTBUF_SIZE];
-    optional<string_view> res = LpFind((uint8_t*)ptr, field, intbuf);
+    optional<string_view> res = LpFind(lookup->lp, field, intbuf);
 
     return res ? res->size() : 0;
   }
 
-  DCHECK_EQ(pv.Encoding(), kEncodingStrMap2);
-  StringMap* sm = GetStringMap(pv, op_args.db_cntx);
+  DCHECK_EQ(lookup->pv->Encoding(), kEncodingStrMap2);
+  StringMap* sm = GetStringMap(*lookup->pv, op_args.db_cntx);
 
   auto it = sm->Find(field);
   return it != sm->end() ? sdslen(it->second) : 0;
@@ -677,6 +698,7 @@ OpResult<uint32_t> OpSet(const OpArgs& op_args, string_view key, CmdArgList valu
     StringMap* sm = GetStringMap(pv, op_args.db_cntx);
     sm->Reserve(values.size() / 2);
     bool added;
+    uint32_t next_expiry = sm->NextExpiry();
 
     for (size_t i = 0; i < values.size(); i += 2) {
       string_view field = ToSV(values[i]);
@@ -688,6 +710,9 @@ OpResult<uint32_t> OpSet(const OpArgs& op_args, string_view key, CmdArgList valu
 
       created += unsigned(added);
     }
+
+    if (sm->NextExpiry() < next_expiry)
+      db_slice.ScheduleFieldExpiry(op_args.db_cntx.db_index, key, sm->NextExpiry());
   }
 
   op_args.shard->search_indices()->AddDoc(key, op_args.db_cntx, pv);
@@ -702,12 +727,14 @@ void HGetGeneric(CmdArgList args, ConnectionContext* cntx, uint8_t getall_mask)
     return OpGetAll(t->GetOpArgs(shard), key, getall_mask);
   };
 
-  OpResult<vector<string>> result = cntx->transaction->ScheduleSingleHopT(std::move(cb));
+  OpResult<container_utils::ReadView> result =
+      cntx->transaction->ScheduleSingleHopT(std::move(cb));
 
   auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
   if (result) {
     bool is_map = (getall_mask == (VALUES | FIELDS));
-    rb->SendStringArr(absl::Span<const string>{*result},
+    vector<string_view> entries = result->Entries();
+    rb->SendStringArr(absl::MakeConstSpan(entries),
                       is_map ? RedisReplyBuilder::MAP : RedisReplyBuilder::ARRAY);
   } else {
     rb->SendError(result.status());
@@ -6,6 +6,7 @@
 
 extern "C" {
 #include "redis/listpack.h"
+#include "redis/redis_aux.h"
 #include "redis/sds.h"
 }
 
@@ -325,6 +326,26 @@ TEST_F(HSetFamilyTest, TriggerConvertToStrMap) {
   EXPECT_THAT(Run({"HLEN", "hk"}), IntArg(kElements));
 }
 
+TEST_F(HSetFamilyTest, ConvertOnLookupCost) {
+  for (unsigned i = 0; i < 20; i++) {
+    Run({"HSET", "hk", absl::StrCat("field", i), "val"});
+  }
+  EXPECT_EQ(1, GetMetrics().db_stats[0].listpack_blob_cnt);
+
+  // No listpack lookup fits within a budget of 1ns, so the next write converts the hash once
+  // enough lookups have been sampled.
+  server.max_listpack_lookup_ns = 1;
+  for (unsigned i = 0; i < 1000; i++) {
+    Run({"HGET", "hk", "missing"});
+  }
+  Run({"HSET", "hk", "field", "val"});
+  server.max_listpack_lookup_ns = 0;
+
+  EXPECT_EQ(0, GetMetrics().db_stats[0].listpack_blob_cnt);
+  EXPECT_THAT(Run({"HLEN", "hk"}), IntArg(21));
+  EXPECT_EQ(Run({"HGET", "hk", "field7"}), "val");
+}
+
 TEST_F(HSetFamilyTest, Issue1140) {
   Run({"HSET", "CaseKey", "Foo", "Bar"});
 
@@ -4,6 +4,9 @@
 
 #include "server/http_api.h"
 
+#include <boost/asio/buffer.hpp>
+#include <boost/optional.hpp>
+
 #include "base/logging.h"
 #include "core/flatbuffers.h"
 #include "facade/conn_context.h"
@@ -123,7 +126,7 @@ struct CaptureVisitor {
     absl::StrAppend(&str, "null");
   }
 
-  void operator()(CapturingReplyBuilder::Error err) {
+  void operator()(const CapturingReplyBuilder::Error& err) {
     str = absl::StrCat(R"({"error": ")", err.first, "\"");
   }
 
@@ -141,7 +144,7 @@ struct CaptureVisitor {
     absl::StrAppend(&str, "]");
   }
 
-  void operator()(unique_ptr<CapturingReplyBuilder::CollectionPayload> cp) {
+  void operator()(const unique_ptr<CapturingReplyBuilder::CollectionPayload>& cp) {
     if (!cp) {
       absl::StrAppend(&str, "null");
       return;
@@ -152,12 +155,16 @@ struct CaptureVisitor {
     }
 
     absl::StrAppend(&str, "[");
-    for (auto& pl : cp->arr) {
-      visit(*this, std::move(pl));
+    for (const auto& pl : cp->arr) {
+      visit(*this, pl);
+      str.push_back(',');
     }
+    if (cp->arr.size())
+      str.pop_back();
+    absl::StrAppend(&str, "]");
   }
 
-  void operator()(facade::SinkReplyBuilder::MGetResponse resp) {
+  void operator()(const facade::SinkReplyBuilder::MGetResponse& resp) {
     absl::StrAppend(&str, "[");
     for (const auto& val : resp.resp_arr) {
       if (val) {
@@ -186,61 +193,148 @@ struct CaptureVisitor {
   string str;
 };
 
-}  // namespace
+// Body of the responses, which serializes the replies to JSON one at a time, so that the text of
+// a large batch never has to be held in memory as a whole. It has no known size, hence HTTP/1.1
+// responses are sent with chunked encoding, a chunk per reply.
+struct JsonRepliesBody {
+  struct value_type {
+    vector<CapturingReplyBuilder::Payload> replies;
+    bool batch = false;  // replies are sent as a JSON array
+  };
 
-void HttpAPI(const http::QueryArgs& args, HttpRequest&& req, Service* service,
-             HttpContext* http_cntx) {
-  auto& body = req.body();
+  class writer {
+   public:
+    using const_buffers_type = boost::asio::const_buffer;
+
+    template <bool isRequest, class Fields>
+    writer(const h2::header<isRequest, Fields>&, const value_type& body) : body_(body) {
+    }
+
+    void init(boost::beast::error_code& ec) {
+      ec = {};
+    }
 
+    boost::optional<pair<const_buffers_type, bool>> get(boost::beast::error_code& ec) {
+      ec = {};
+      if (next_ >= body_.replies.size())
+        return boost::none;
+
+      CaptureVisitor visitor;
+      visit(visitor, body_.replies[next_]);
+      chunk_ = std::move(visitor.str);
+      chunk_.push_back('}');
+      if (body_.batch) {
+        if (next_ == 0)
+          chunk_.insert(0, "[");
+        chunk_.push_back(next_ + 1 < body_.replies.size() ? ',' : ']');
+      }
+
+      ++next_;
+      bool more = next_ < body_.replies.size();
+      if (!more)
+        chunk_.append("\r\n");
+      return make_pair(boost::asio::buffer(chunk_), more);
+    }
+
+   private:
+    const value_type& body_;
+    size_t next_ = 0;
+    string chunk_;
+  };
+};
+
+// Parses the body of a request, which is either a single command, aka `["set", "foo", "bar"]`,
+// or a JSON array of commands. Returns false if the body is neither.
+bool ParseCommands(const string& body, vector<vector<string>>* commands, bool* batch) {
   flexbuffers::Builder fbb;
   flatbuffers::Parser parser;
-  flexbuffers::Reference doc;
-  bool success = parser.ParseFlexBuffer(body.c_str(), nullptr, &fbb);
-  if (success) {
-    fbb.Finish();
-    doc = flexbuffers::GetRoot(fbb.GetBuffer());
-    if (!IsVectorOfStrings(doc)) {
-      success = false;
-    }
+  if (!parser.ParseFlexBuffer(body.c_str(), nullptr, &fbb))
+    return false;
+
+  fbb.Finish();
+  flexbuffers::Reference doc = flexbuffers::GetRoot(fbb.GetBuffer());
+  if (!doc.IsVector() || doc.AsVector().size() == 0)
+    return false;
+
+  auto to_command = [](flexbuffers::Reference ref) {
+    vector<string> args;
+    flexbuffers::Vector vec = ref.AsVector();
+    for (size_t i = 0; i < vec.size(); ++i)
+      args.push_back(vec[i].AsString().c_str());
+    return args;
+  };
+
+  *batch = !IsVectorOfStrings(doc);
+  if (!*batch) {
+    commands->push_back(to_command(doc));
+    return true;
   }
 
+  flexbuffers::Vector vec = doc.AsVector();
+  for (size_t i = 0; i < vec.size(); ++i) {
+    if (!IsVectorOfStrings(vec[i]))
+      return false;
+    commands->push_back(to_command(vec[i]));
+  }
+  return true;
+}
+
+}  // namespace
+
+void HttpAPI(const http::QueryArgs& args, HttpRequest&& req, Service* service,
+             HttpContext* http_cntx) {
+  auto& body = req.body();
+
   // TODO: to add a content-type/json check.
-  if (!success) {
+  vector<vector<string>> commands;
+  bool batch = false;
+  if (!ParseCommands(body, &commands, &batch)) {
     VLOG(1) << "Invalid body " << body;
     auto response = http::MakeStringResponse(h2::status::bad_request);
     http::SetMime(http::kTextMime, &response);
+    response.keep_alive(req.keep_alive());
     response.body() = "Failed to parse json\r\n";
     http_cntx->Invoke(std::move(response));
     return;
   }
 
-  vector<string> cmd_args;
-  flexbuffers::Vector vec = doc.AsVector();
-  for (size_t i = 0; i < vec.size(); ++i) {
-    cmd_args.push_back(vec[i].AsString().c_str());
-  }
-  vector<facade::MutableSlice> cmd_slices(cmd_args.size());
-  for (size_t i = 0; i < cmd_args.size(); ++i) {
-    cmd_slices[i] = absl::MakeSpan(cmd_args[i]);
+  vector<vector<facade::MutableSlice>> cmd_slices(commands.size());
+  vector<facade::CmdArgList> cmd_list(commands.size());
+  for (size_t i = 0; i < commands.size(); ++i) {
+    for (string& arg : commands[i])
+      cmd_slices[i].push_back(absl::MakeSpan(arg));
+    cmd_list[i] = absl::MakeSpan(cmd_slices[i]);
   }
 
   facade::ConnectionContext* context = (facade::ConnectionContext*)http_cntx->user_data();
   DCHECK(context);
 
+  h2::response<JsonRepliesBody> response{h2::status::ok, req.version()};
+  response.set(h2::field::content_type, http::kJsonMime);
+  response.keep_alive(req.keep_alive());
+  response.body().batch = batch;
+
   facade::CapturingReplyBuilder reply_builder;
   auto* prev = context->Inject(&reply_builder);
-  // TODO: to finish this.
-  service->DispatchCommand(absl::MakeSpan(cmd_slices), context);
-  facade::CapturingReplyBuilder::Payload payload = reply_builder.Take();
-
+  if (batch) {
+    // The replies of the batch are captured as a single array, in the order of the commands,
+    // and the commands run as a pipeline. Squashing stops early when the server is paused,
+    // the rest of the commands are dispatched one by one like on regular connections.
+    reply_builder.StartCollection(cmd_list.size(), facade::RedisReplyBuilder::ARRAY);
+    size_t dispatched = service->DispatchManyCommands(absl::MakeSpan(cmd_list), context);
+    for (size_t i = dispatched; i < cmd_list.size(); ++i)
+      service->DispatchCommand(cmd_list[i], context);
+
+    auto payload = reply_builder.Take();
+    auto& replies = get<unique_ptr<CapturingReplyBuilder::CollectionPayload>>(payload)->arr;
+    response.body().replies = std::move(replies);
+  } else {
+    service->DispatchCommand(cmd_list.front(), context);
+    response.body().replies.push_back(reply_builder.Take());
+  }
   context->Inject(prev);
-  auto response = http::MakeStringResponse();
-  http::SetMime(http::kJsonMime, &response);
 
-  CaptureVisitor visitor;
-  std::visit(visitor, std::move(payload));
-  visitor.str.append("}\r\n");
-  response.body() = visitor.str;
+  response.prepare_payload();
   http_cntx->Invoke(std::move(response));
 }
 
@@ -15,7 +15,9 @@ using HttpRequest = util::HttpListenerBase::RequestType;
  *
  * @param args - query arguments. currently not used.
  * @param req  - full http request including the body that should consist of a json array
- *               representing a Dragonfly command. aka `["set", "foo", "bar"]`
+ *               representing a Dragonfly command. aka `["set", "foo", "bar"]`, or of a json
+ *               array of commands, which run as a pipeline and are replied with an array of
+ *               their results in the same order.
  * @param service - a pointer to dfly::Service* object.
  * @param http_cntxt - a pointer to the http context object which provide dragonfly context
  *                     information via user_data() and allows to reply with HTTP responses.
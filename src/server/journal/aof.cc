@@ -0,0 +1,503 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/journal/aof.h"
+
+#include <absl/flags/flag.h>
+#include <absl/strings/numbers.h>
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_split.h>
+#include <absl/strings/strip.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <map>
+
+#include "base/logging.h"
+#include "server/engine_shard_set.h"
+#include "server/error.h"
+#include "server/journal/executor.h"
+#include "server/journal/journal.h"
+#include "server/journal/serializer.h"
+#include "server/journal/tx_executor.h"
+#include "util/fibers/uring_file.h"
+#include "util/fibers/uring_proactor.h"
+
+ABSL_FLAG(uint32_t, aof_fsync_interval_ms, 1000,
+          "The longest time appended journal entries wait before they are written and synced to "
+          "disk. It bounds the writes that a crash can lose.");
+
+ABSL_FLAG(uint64_t, aof_fsync_bytes, 4ULL << 20,
+          "Appended journal entries are written and synced before the interval elapses once a "
+          "shard buffered this many bytes.");
+
+namespace dfly {
+namespace journal {
+
+using namespace std;
+using namespace util;
+using namespace util::fb2;
+namespace fs = std::filesystem;
+
+namespace {
+
+constexpr string_view kManifestName = "aof.manifest";
+constexpr string_view kFilePrefix = "aof-";
+
+string FileName(uint64_t generation, ShardId sid) {
+  return absl::StrCat(kFilePrefix, absl::Dec(generation, absl::kZeroPad8), "-",
+                      absl::Dec(sid, absl::kZeroPad4), ".log");
+}
+
+// Parses the generation out of a file name, returns nullopt for other files.
+optional<uint64_t> ParseGeneration(string_view name) {
+  if (!absl::ConsumePrefix(&name, kFilePrefix) || !absl::ConsumeSuffix(&name, ".log"))
+    return nullopt;
+  uint64_t generation;
+  vector<string_view> parts = absl::StrSplit(name, '-');
+  if (parts.size() != 2 || !absl::SimpleAtoi(parts[0], &generation))
+    return nullopt;
+  return generation;
+}
+
+error_code FiberSync(int fd) {
+  auto* proactor = static_cast<UringProactor*>(ProactorBase::me());
+  FiberCall fc(proactor);
+  fc->PrepFSync(fd, IORING_FSYNC_DATASYNC);
+  FiberCall::IoResult io_res = fc.Get();
+  return io_res < 0 ? error_code{-io_res, system_category()} : error_code{};
+}
+
+// Makes the creation of files in the directory durable.
+error_code SyncDir(const string& dir) {
+  int fd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    return error_code{errno, system_category()};
+  error_code ec = FiberSync(fd);
+  close(fd);
+  return ec;
+}
+
+}  // namespace
+
+// Buffers the journal entries of a shard and writes them in groups. All methods are called in
+// the shard thread.
+class AppendOnlyFile::ShardFile {
+ public:
+  ShardFile(string dir, ShardId sid, uint64_t generation)
+      : dir_(std::move(dir)), sid_(sid), segments_{Segment{generation, {}}} {
+  }
+
+  void Start(Journal* journal) {
+    appended_lsn_ = journal->GetLsn();
+    synced_lsn_.store(appended_lsn_, memory_order_relaxed);
+    cb_id_ = journal->RegisterOnChange([this](const JournalItem& item, bool) { Append(item); });
+    flush_fb_ = Fiber("aof_flush", &ShardFile::FlushFb, this);
+  }
+
+  void Stop(Journal* journal) {
+    journal->UnregisterOnChange(cb_id_);
+    closing_ = true;
+    flush_ec_.notify();
+    flush_fb_.JoinIfNeeded();
+    CloseFile();
+  }
+
+  void Rotate(uint64_t generation) {
+    segments_.push_back(Segment{generation, {}});
+    flush_ec_.notify();
+  }
+
+  LSN GetSyncedLsn() const {
+    return synced_lsn_.load(memory_order_acquire);
+  }
+
+  AofStats GetStats() const {
+    return AofStats{written_bytes_.load(memory_order_relaxed), syncs_.load(memory_order_relaxed),
+                 errors_.load(memory_order_relaxed)};
+  }
+
+ private:
+  // Entries appended between two rotations go to the files of the same generation.
+  struct Segment {
+    uint64_t generation;
+    string data;
+  };
+
+  // Never preempts, as it runs in the journal callbacks.
+  void Append(const JournalItem& item) {
+    if (!item.data)
+      return;
+    appended_lsn_ = item.lsn + 1;
+
+    // Pings only serve the replicas and carry nothing to replay.
+    if (item.opcode == Op::PING)
+      return;
+
+    segments_.back().data.append(*item.data);
+    pending_bytes_ += item.data->size();
+    if (pending_bytes_ >= max_pending_bytes_)
+      flush_ec_.notify();
+  }
+
+  void FlushFb() {
+    auto interval = chrono::milliseconds(max(absl::GetFlag(FLAGS_aof_fsync_interval_ms), 1u));
+    while (true) {
+      flush_ec_.await_until(
+          [this] {
+            return closing_ || pending_bytes_ >= max_pending_bytes_ || segments_.size() > 1;
+          },
+          chrono::steady_clock::now() + interval);
+
+      // Entries are no longer appended once closing, so this is the last group.
+      bool closing = closing_;
+      if (error_code ec = Flush(); ec) {
+        errors_.fetch_add(1, memory_order_relaxed);
+        LOG_FIRST_N(ERROR, 10) << "Error writing the append only file: " << ec.message();
+      }
+      if (closing)
+        break;
+    }
+  }
+
+  // Writes all buffered entries and syncs them.
+  error_code Flush() {
+    LSN lsn = appended_lsn_;
+    while (true) {
+      bool last = segments_.size() == 1;
+      uint64_t generation = segments_.front().generation;
+      string data = std::move(segments_.front().data);
+      segments_.front().data.clear();
+      pending_bytes_ -= data.size();
+      if (!last)
+        segments_.pop_front();
+
+      // Entries appended while writing wait for the next group.
+      if (!data.empty())
+        RETURN_ON_ERR(Write(generation, data));
+      if (last)
+        break;
+    }
+    RETURN_ON_ERR(Sync());
+    synced_lsn_.store(lsn, memory_order_release);
+    return {};
+  }
+
+  error_code Write(uint64_t generation, string_view data) {
+    if (!file_ || file_generation_ != generation) {
+      if (file_) {
+        RETURN_ON_ERR(Sync());
+        CloseFile();
+      }
+
+      fs::path path = fs::path(dir_) / FileName(generation, sid_);
+      auto res = OpenLinux(path.string(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666);
+      if (!res)
+        return res.error();
+      RETURN_ON_ERR(SyncDir(dir_));
+
+      VLOG(1) << "Opened append only file " << path;
+      file_ = std::move(res.value());
+      file_generation_ = generation;
+      offset_ = synced_offset_ = 0;
+    }
+
+    RETURN_ON_ERR(file_->Write(io::Buffer(data), offset_, 0));
+    offset_ += data.size();
+    written_bytes_.fetch_add(data.size(), memory_order_relaxed);
+    return {};
+  }
+
+  error_code Sync() {
+    if (!file_ || synced_offset_ == offset_)
+      return {};
+
+    size_t offset = offset_;
+    RETURN_ON_ERR(FiberSync(file_->fd()));
+    synced_offset_ = offset;
+    syncs_.fetch_add(1, memory_order_relaxed);
+    return {};
+  }
+
+  void CloseFile() {
+    if (!file_)
+      return;
+    error_code ec = file_->Close();
+    LOG_IF(ERROR, ec) << "Error closing the append only file " << ec.message();
+    file_.reset();
+  }
+
+  string dir_;
+  ShardId sid_;
+
+  deque<Segment> segments_;  // The last one is appended to.
+  size_t pending_bytes_ = 0;
+  LSN appended_lsn_ = 0;       // following the last appended entry
+  atomic<LSN> synced_lsn_{0};  // following the last synced entry, read by any thread
+  size_t max_pending_bytes_ = absl::GetFlag(FLAGS_aof_fsync_bytes);
+
+  unique_ptr<LinuxFile> file_;
+  uint64_t file_generation_ = 0;
+  size_t offset_ = 0, synced_offset_ = 0;
+
+  atomic_size_t written_bytes_{0}, syncs_{0}, errors_{0};
+
+  bool closing_ = false;
+  uint32_t cb_id_ = 0;
+  EventCount flush_ec_;
+  Fiber flush_fb_;
+};
+
+AppendOnlyFile::AppendOnlyFile(string dir, Journal* journal)
+    : dir_(std::move(dir)), journal_(journal) {
+}
+
+AppendOnlyFile::~AppendOnlyFile() {
+  DCHECK(shards_.empty()) << "AppendOnlyFile must be closed";
+}
+
+io::Result<optional<AofManifest>> AppendOnlyFile::ReadManifest(const string& dir) {
+  fs::path path = fs::path(dir) / kManifestName;
+  error_code ec;
+  if (!fs::exists(path, ec))
+    return optional<AofManifest>{};
+
+  ifstream in(path);
+  if (!in)
+    return nonstd::make_unexpected(make_error_code(errc::io_error));
+
+  AofManifest manifest;
+  bool has_generation = false;
+  string line;
+  while (getline(in, line)) {
+    string_view value = line;
+    if (absl::ConsumePrefix(&value, "snapshot ")) {
+      manifest.snapshot = string(value);
+    } else if (absl::ConsumePrefix(&value, "generation ")) {
+      has_generation = absl::SimpleAtoi(value, &manifest.generation);
+    }
+  }
+
+  if (!has_generation)
+    return nonstd::make_unexpected(make_error_code(errc::bad_message));
+  return manifest;
+}
+
+error_code AppendOnlyFile::WriteManifest(const AofManifest& manifest) {
+  fs::path path = fs::path(dir_) / kManifestName;
+  string tmp_path = absl::StrCat(path.string(), ".tmp");
+  string content = absl::StrCat("snapshot ", manifest.snapshot, "\ngeneration ",
+                                manifest.generation, "\n");
+
+  // The manifest is replaced atomically, and synced before so that it never points at a
+  // generation whose predecessors are already deleted.
+  int fd = open(tmp_path.c_str(), O_CREAT | O_WRONLY | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd < 0)
+    return error_code{errno, system_category()};
+  bool ok = write(fd, content.data(), content.size()) == ssize_t(content.size()) &&
+            fdatasync(fd) == 0;
+  int err = errno;
+  close(fd);
+  if (!ok)
+    return error_code{err, system_category()};
+
+  error_code ec;
+  fs::rename(tmp_path, path, ec);
+  return ec;
+}
+
+vector<uint64_t> AppendOnlyFile::ListGenerations() const {
+  vector<uint64_t> res;
+  error_code ec;
+  for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+    if (auto generation = ParseGeneration(entry.path().filename().string()); generation)
+      res.push_back(*generation);
+  }
+  sort(res.begin(), res.end());
+  res.erase(unique(res.begin(), res.end()), res.end());
+  return res;
+}
+
+error_code AppendOnlyFile::Replay(Service* service, const string& dir, uint64_t generation) {
+  // Files by generation, in the order of their shards.
+  map<uint64_t, vector<string>> files;
+  error_code ec;
+  for (const auto& entry : fs::directory_iterator(dir, ec)) {
+    auto file_generation = ParseGeneration(entry.path().filename().string());
+    if (file_generation && *file_generation >= generation)
+      files[*file_generation].push_back(entry.path().string());
+  }
+  if (ec)
+    return ec;
+
+  auto* pool = shard_set->pool();
+  for (auto& [file_generation, paths] : files) {
+    sort(paths.begin(), paths.end());
+    LOG(INFO) << "Replaying " << paths.size() << " append only files of generation "
+              << file_generation;
+
+    MultiShardExecution multi_shard_exe;
+    atomic_size_t entries{0};
+    vector<Fiber> fibers;
+    for (size_t i = 0; i < paths.size(); ++i) {
+      auto replay_file = [&, path = paths[i]] {
+        auto res = OpenRead(path);
+        if (!res) {
+          LOG(ERROR) << "Could not open " << path << ": " << res.error().message();
+          multi_shard_exe.CancelAllBlockingEntities();
+          return;
+        }
+
+        io::FileSource source{*res};
+        JournalReader reader{&source, 0};
+        JournalExecutor executor{service};
+        while (true) {
+          // The tail of a file can be torn by a crash, what precedes it is replayed.
+          auto entry = reader.ReadEntry();
+          if (!entry) {
+            LOG_IF(WARNING, entry.error() != errc::io_error)
+                << "Stopped replaying " << path << ": " << entry.error().message();
+            break;
+          }
+
+          TransactionData tx_data = TransactionData::FromEntry(std::move(*entry));
+          if (tx_data.command.cmd_args.empty())
+            continue;
+          entries.fetch_add(1, memory_order_relaxed);
+
+          if (!tx_data.IsGlobalCmd()) {
+            executor.Execute(tx_data.dbid, tx_data.command);
+            continue;
+          }
+
+          // Global commands were journaled by all shards, they run once every file reached them.
+          bool inserted_by_me =
+              multi_shard_exe.InsertTxToSharedMap(tx_data.txid, tx_data.shard_cnt);
+          auto& sync = multi_shard_exe.Find(tx_data.txid);
+          sync.block->Wait();
+          sync.barrier.Wait();
+          if (inserted_by_me)
+            executor.Execute(tx_data.dbid, tx_data.command);
+          sync.barrier.Wait();
+          if (sync.counter.fetch_sub(1, memory_order_relaxed) == 1)
+            multi_shard_exe.Erase(tx_data.txid);
+        }
+
+        // A file that ended does not reach any further global command, so whoever waits for
+        // one, waits for a command cut off by a crash.
+        multi_shard_exe.CancelAllBlockingEntities();
+      };
+      fibers.push_back(pool->at(i % pool->size())->LaunchFiber(std::move(replay_file)));
+    }
+
+    for (auto& fiber : fibers)
+      fiber.Join();
+    LOG(INFO) << "Replayed " << entries.load() << " journal entries";
+  }
+  return {};
+}
+
+error_code AppendOnlyFile::Open(string_view snapshot) {
+  CHECK(shards_.empty());
+  if (shard_set->pool()->at(0)->GetKind() != ProactorBase::IOURING)
+    return make_error_code(errc::operation_not_supported);
+
+  error_code ec;
+  fs::create_directories(dir_, ec);
+  if (ec)
+    return ec;
+
+  auto manifest = ReadManifest(dir_);
+  if (!manifest)
+    return manifest.error();
+
+  // The previous files are still needed for recovery until the next snapshot is committed, so
+  // a new generation is started.
+  vector<uint64_t> generations = ListGenerations();
+  generation_ = generations.empty() ? 0 : generations.back() + 1;
+  if (*manifest) {
+    generation_ = max(generation_, (*manifest)->generation);
+  } else {
+    RETURN_ON_ERR(WriteManifest(AofManifest{string(snapshot), generation_}));
+  }
+
+  shards_.resize(shard_set->size());
+  shard_set->pool()->AwaitFiberOnAll([this](auto*) {
+    journal_->StartInThread();
+    if (EngineShard* shard = EngineShard::tlocal(); shard) {
+      auto& file = shards_[shard->shard_id()];
+      file = make_unique<ShardFile>(dir_, shard->shard_id(), generation_);
+      file->Start(journal_);
+    }
+  });
+
+  LOG(INFO) << "Appending the journal to " << dir_ << ", generation " << generation_;
+  return {};
+}
+
+void AppendOnlyFile::Close(bool remove) {
+  if (shards_.empty())
+    return;
+
+  shard_set->RunBlockingInParallel(
+      [this](EngineShard* shard) { shards_[shard->shard_id()]->Stop(journal_); });
+  shards_.clear();
+
+  if (remove) {
+    error_code ec;
+    fs::remove(fs::path(dir_) / kManifestName, ec);
+    for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+      if (ParseGeneration(entry.path().filename().string()))
+        fs::remove(entry.path(), ec);
+    }
+    LOG(INFO) << "Removed the append only files in " << dir_;
+  }
+}
+
+void AppendOnlyFile::RotateInShard(ShardId sid, uint64_t generation) {
+  DCHECK_LT(sid, shards_.size());
+  shards_[sid]->Rotate(generation);
+}
+
+error_code AppendOnlyFile::CommitSnapshot(string_view snapshot, uint64_t generation) {
+  RETURN_ON_ERR(WriteManifest(AofManifest{string(snapshot), generation}));
+
+  // Files left by runs with more shards are matched by their names.
+  error_code ec;
+  for (const auto& entry : fs::directory_iterator(dir_, ec)) {
+    auto old = ParseGeneration(entry.path().filename().string());
+    if (old && *old < generation)
+      fs::remove(entry.path(), ec);
+  }
+  VLOG(1) << "Committed " << snapshot << " to the append only files, generation " << generation;
+  return {};
+}
+
+bool AppendOnlyFile::IsSynced(const vector<LSN>& lsns) const {
+  if (shards_.size() != lsns.size())
+    return false;
+  for (size_t i = 0; i < lsns.size(); ++i) {
+    if (shards_[i]->GetSyncedLsn() < lsns[i])
+      return false;
+  }
+  return true;
+}
+
+AofStats AppendOnlyFile::GetStats() const {
+  AofStats res;
+  for (const auto& shard : shards_) {
+    AofStats stats = shard->GetStats();
+    res.written_bytes += stats.written_bytes;
+    res.syncs += stats.syncs;
+    res.errors += stats.errors;
+  }
+  return res;
+}
+
+}  // namespace journal
+}  // namespace dfly
@@ -0,0 +1,150 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <memory>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "io/io.h"
+#include "server/common.h"
+
+namespace dfly {
+
+class Service;
+
+namespace journal {
+
+class Journal;
+
+// Describes how to recover the data from a directory of append only files.
+struct AofManifest {
+  std::string snapshot;     // Loaded first, empty if there is none.
+  uint64_t generation = 0;  // The files of this generation and of the following ones are replayed.
+};
+
+struct AofStats {
+  size_t written_bytes = 0;
+  size_t syncs = 0;
+  size_t errors = 0;
+};
+
+#ifdef __linux__
+
+// Append only persistence on top of the journal. Every shard appends the serialized entries of
+// its journal to a file of its own, and a background fiber writes and syncs them in groups, once
+// enough bytes were appended or once the sync interval elapsed. So a crash loses at most the
+// entries of the last interval, while writes never wait for the disk.
+// Every snapshot starts a new generation of files at its cut, and once the snapshot is saved
+// the older generations are deleted. Recovery loads the snapshot of the manifest and replays
+// the following generations.
+// Requires io_uring.
+class AppendOnlyFile {
+ public:
+  AppendOnlyFile(std::string dir, Journal* journal);
+  ~AppendOnlyFile();
+
+  static io::Result<std::optional<AofManifest>> ReadManifest(const std::string& dir);
+
+  // Replays the files of the given generation and of the following ones on top of the current
+  // data. Entries of all shards are applied in parallel, global commands synchronize them.
+  static std::error_code Replay(Service* service, const std::string& dir, uint64_t generation);
+
+  // Starts the journal and appends it to a new generation of files. If the directory has no
+  // manifest, one is written with the given snapshot. Must not be called from shard threads.
+  std::error_code Open(std::string_view snapshot);
+
+  // Writes and syncs all appended entries and closes the files. If remove is set, the files and
+  // the manifest are deleted, for example when the data is replaced by a full sync.
+  void Close(bool remove = false);
+
+  bool IsOpen() const {
+    return !shards_.empty();
+  }
+
+  // Returns the generation the next snapshot rotates the files to.
+  uint64_t NextGeneration() {
+    return ++generation_;
+  }
+
+  // Switches the shard to the files of a new generation. Called at the cut of a snapshot,
+  // without preempting between the two. Never preempts.
+  void RotateInShard(ShardId sid, uint64_t generation);
+
+  // Records the snapshot whose cut started the given generation and deletes the files of all
+  // generations before it.
+  std::error_code CommitSnapshot(std::string_view snapshot, uint64_t generation);
+
+  // Whether the journal of every shard is synced up to the given LSN, excluded. Safe to call
+  // from any thread while the files are open.
+  bool IsSynced(const std::vector<LSN>& lsns) const;
+
+  // Summed up over all shards. Safe to call from any thread while the files are open.
+  AofStats GetStats() const;
+
+ private:
+  class ShardFile;
+
+  std::error_code WriteManifest(const AofManifest& manifest);
+  std::vector<uint64_t> ListGenerations() const;
+
+  std::string dir_;
+  Journal* journal_;
+  uint64_t generation_ = 0;
+  std::vector<std::unique_ptr<ShardFile>> shards_;  // Each one is used by its shard thread.
+};
+
+#else
+
+class AppendOnlyFile {
+ public:
+  AppendOnlyFile(std::string dir, Journal* journal) {
+  }
+
+  static io::Result<std::optional<AofManifest>> ReadManifest(const std::string& dir) {
+    return std::optional<AofManifest>{};
+  }
+
+  static std::error_code Replay(Service* service, const std::string& dir, uint64_t generation) {
+    return {};
+  }
+
+  std::error_code Open(std::string_view snapshot) {
+    return std::make_error_code(std::errc::operation_not_supported);
+  }
+
+  void Close(bool remove = false) {
+  }
+
+  bool IsOpen() const {
+    return false;
+  }
+
+  uint64_t NextGeneration() {
+    return 0;
+  }
+
+  void RotateInShard(ShardId sid, uint64_t generation) {
+  }
+
+  std::error_code CommitSnapshot(std::string_view snapshot, uint64_t generation) {
+    return {};
+  }
+
+  bool IsSynced(const std::vector<LSN>& lsns) const {
+    return false;
+  }
+
+  AofStats GetStats() const {
+    return {};
+  }
+};
+
+#endif  // __linux__
+
+}  // namespace journal
+}  // namespace dfly
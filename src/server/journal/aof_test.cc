@@ -0,0 +1,106 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/journal/aof.h"
+
+#include <absl/flags/reflection.h>
+#include <absl/strings/str_cat.h>
+
+#include <filesystem>
+
+#include "base/flags.h"
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "facade/facade_test.h"
+#include "server/test_utils.h"
+
+using namespace testing;
+using namespace std;
+using namespace util;
+using namespace facade;
+namespace fs = std::filesystem;
+
+ABSL_DECLARE_FLAG(string, aof_dir);
+ABSL_DECLARE_FLAG(bool, force_epoll);
+
+namespace dfly {
+
+class AofTest : public BaseFamilyTest {
+ protected:
+  static constexpr string_view kDir = "aof_test_dir";
+
+  void SetUp() override {
+    if (absl::GetFlag(FLAGS_force_epoll))
+      GTEST_SKIP() << "Append only files require io_uring";
+
+    fs::remove_all(kDir);
+    absl::SetFlag(&FLAGS_aof_dir, string(kDir));
+    BaseFamilyTest::SetUp();
+  }
+
+  void TearDown() override {
+    BaseFamilyTest::TearDown();
+    fs::remove_all(kDir);
+    for (const auto& entry : fs::directory_iterator("."))
+      if (entry.path().filename().string().rfind("aof_test_snap", 0) == 0)
+        fs::remove(entry.path());
+  }
+
+  absl::FlagSaver saver_;
+};
+
+TEST_F(AofTest, ReplayOnRestart) {
+  Run({"set", "a", "1"});
+  Run({"incr", "a"});
+  Run({"flushall"});
+  Run({"set", "b", "2"});
+  Run({"incr", "b"});
+  Run({"rpush", "l", "x", "y"});
+  Run({"mset", "c", "1", "d", "2"});
+
+  ResetService();
+
+  EXPECT_THAT(Run({"exists", "a"}), IntArg(0));
+  EXPECT_EQ(Run({"get", "b"}), "3");
+  EXPECT_THAT(Run({"llen", "l"}), IntArg(2));
+  EXPECT_EQ(Run({"get", "d"}), "2");
+
+  // The replayed data is appended to the new generation, so a second restart keeps it.
+  Run({"incr", "b"});
+  ResetService();
+  EXPECT_EQ(Run({"get", "b"}), "4");
+}
+
+TEST_F(AofTest, SnapshotStartsGeneration) {
+  Run({"set", "a", "1"});
+  Run({"set", "b", "1"});
+  EXPECT_EQ(Run({"save", "df", "aof_test_snap"}), "OK");
+  Run({"incr", "a"});
+
+  auto manifest = journal::AppendOnlyFile::ReadManifest(string(kDir));
+  ASSERT_TRUE(manifest && *manifest);
+  EXPECT_THAT((*manifest)->snapshot, HasSubstr("aof_test_snap"));
+
+  // Only the files of the generation started by the snapshot are left.
+  string generation = absl::StrCat(absl::Dec((*manifest)->generation, absl::kZeroPad8));
+  for (const auto& entry : fs::directory_iterator(kDir)) {
+    string name = entry.path().filename().string();
+    if (name.rfind("aof-", 0) == 0)
+      EXPECT_EQ(name.substr(4, 8), generation);
+  }
+
+  ResetService();
+  EXPECT_EQ(Run({"get", "a"}), "2");
+  EXPECT_EQ(Run({"get", "b"}), "1");
+}
+
+TEST_F(AofTest, WaitAof) {
+  Run({"set", "a", "1"});
+  EXPECT_THAT(Run({"waitaof", "1", "0", "5000"}), RespArray(ElementsAre(IntArg(1), IntArg(0))));
+
+  ResetService();
+  EXPECT_EQ(Run({"get", "a"}), "1");
+}
+
+}  // namespace dfly
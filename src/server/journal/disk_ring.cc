@@ -0,0 +1,197 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/journal/disk_ring.h"
+
+#include <absl/base/internal/endian.h>
+#include <fcntl.h>
+
+#include <algorithm>
+
+#include "base/logging.h"
+
+namespace dfly {
+namespace journal {
+
+using namespace std;
+using namespace util;
+
+namespace {
+
+// Every entry in a block is prefixed by its length.
+constexpr size_t kLenSize = 4;
+
+}  // namespace
+
+DiskRing::DiskRing(size_t capacity) : capacity_(capacity) {
+}
+
+DiskRing::~DiskRing() {
+  DCHECK(!file_) << "DiskRing must be closed";
+}
+
+error_code DiskRing::Open(string_view path) {
+  CHECK(!file_);
+
+  auto res = fb2::OpenLinux(path, O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC, 0666);
+  if (!res)
+    return res.error();
+  file_ = std::move(res.value());
+
+  closing_ = false;
+  flush_fb_ = fb2::Fiber("journal_disk_ring", &DiskRing::FlushFb, this);
+  return {};
+}
+
+void DiskRing::Close() {
+  if (!file_)
+    return;
+
+  closing_ = true;
+  flush_ec_.notify();
+  flush_fb_.JoinIfNeeded();
+
+  error_code ec = file_->Close();
+  LOG_IF(ERROR, ec) << "Error closing journal ring " << ec.message();
+  file_.reset();
+}
+
+void DiskRing::Append(LSN lsn, string_view entry) {
+  if (open_data_.empty()) {
+    open_first_lsn_ = lsn;
+  } else {
+    DCHECK_EQ(lsn, open_end_lsn_);
+  }
+  open_end_lsn_ = lsn + 1;
+
+  char len[kLenSize];
+  absl::little_endian::Store32(len, entry.size());
+  open_data_.append(len, kLenSize).append(entry);
+
+  if (open_data_.size() >= kBlockSize)
+    Seal();
+}
+
+bool DiskRing::Contains(LSN lsn) const {
+  LSN first = blocks_.empty() ? open_first_lsn_ : blocks_.front().first_lsn;
+  LSN end = open_data_.empty() ? (blocks_.empty() ? first : blocks_.back().end_lsn)
+                               : open_end_lsn_;
+  return first <= lsn && lsn < end;
+}
+
+io::Result<LSN> DiskRing::Read(LSN lsn, absl::FunctionRef<void(string_view)> cb) {
+  if (!Contains(lsn))
+    return nonstd::make_unexpected(make_error_code(errc::result_out_of_range));
+
+  shared_ptr<const string> data;
+  LSN first_lsn;
+  if (!open_data_.empty() && lsn >= open_first_lsn_) {
+    // Copied, because appends during preemptions in cb can reallocate the open block.
+    data = make_shared<const string>(open_data_);
+    first_lsn = open_first_lsn_;
+  } else {
+    auto it = partition_point(blocks_.begin(), blocks_.end(),
+                              [lsn](const Block& block) { return block.end_lsn <= lsn; });
+    DCHECK(it != blocks_.end() && it->first_lsn <= lsn);
+    first_lsn = it->first_lsn;
+    data = it->data;
+
+    if (!data) {
+      uint64_t seq = it->seq;
+      string buf(it->size, '\0');
+      io::MutableBytes dest{reinterpret_cast<uint8_t*>(buf.data()), buf.size()};
+      error_code ec = file_->Read(dest, it->offset, 0);
+      if (ec)
+        return nonstd::make_unexpected(ec);
+
+      // The block is dropped before any write that overwrites it is issued, so if it is still
+      // present, what we read is intact.
+      if (!FindBlock(seq))
+        return nonstd::make_unexpected(make_error_code(errc::result_out_of_range));
+      data = make_shared<const string>(std::move(buf));
+    }
+  }
+
+  string_view block{*data};
+  LSN cur = first_lsn;
+  for (size_t pos = 0; pos + kLenSize <= block.size(); ++cur) {
+    uint32_t len = absl::little_endian::Load32(block.data() + pos);
+    pos += kLenSize;
+    if (cur >= lsn)
+      cb(block.substr(pos, len));
+    pos += len;
+  }
+
+  return cur;
+}
+
+void DiskRing::Seal() {
+  size_t size = open_data_.size();
+  if (size > capacity_) {
+    LOG_FIRST_N(WARNING, 10) << "Journal block of " << size << " bytes does not fit into the ring";
+    blocks_.clear();
+    open_data_.clear();
+    return;
+  }
+
+  // Wrapping around skips the tail of the file. The blocks left there by the previous round are
+  // the oldest ones.
+  if (next_offset_ + size > capacity_) {
+    while (!blocks_.empty() && blocks_.front().offset >= next_offset_)
+      blocks_.pop_front();
+    next_offset_ = 0;
+  }
+
+  // Drop the oldest blocks that the new one overwrites.
+  size_t start = next_offset_, end = next_offset_ + size;
+  while (!blocks_.empty() && blocks_.front().offset < end &&
+         start < blocks_.front().offset + blocks_.front().size) {
+    blocks_.pop_front();
+  }
+
+  blocks_.push_back(Block{next_seq_++, open_first_lsn_, open_end_lsn_, start, size,
+                          make_shared<const string>(std::move(open_data_))});
+  open_data_.clear();
+  next_offset_ = end;
+
+  flush_ec_.notify();
+}
+
+DiskRing::Block* DiskRing::FindBlock(uint64_t seq) {
+  if (blocks_.empty() || seq < blocks_.front().seq || seq > blocks_.back().seq)
+    return nullptr;
+  return &blocks_[seq - blocks_.front().seq];
+}
+
+void DiskRing::FlushFb() {
+  while (true) {
+    flush_ec_.await([this] { return closing_ || flush_seq_ < next_seq_; });
+    if (closing_)
+      break;
+
+    // Blocks dropped before they were written are skipped.
+    if (!blocks_.empty())
+      flush_seq_ = max(flush_seq_, blocks_.front().seq);
+
+    Block* block = FindBlock(flush_seq_);
+    if (!block) {
+      flush_seq_ = next_seq_;
+      continue;
+    }
+
+    uint64_t seq = flush_seq_++;
+    shared_ptr<const string> data = block->data;
+    error_code ec = file_->Write(io::Buffer(*data), block->offset, 0);
+
+    if (ec) {
+      // The block stays in memory until it is overwritten.
+      LOG_FIRST_N(ERROR, 10) << "Error writing journal ring: " << ec.message();
+    } else if (block = FindBlock(seq); block) {
+      block->data.reset();
+    }
+  }
+}
+
+}  // namespace journal
+}  // namespace dfly
@@ -0,0 +1,86 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <absl/functional/function_ref.h>
+
+#include <deque>
+#include <memory>
+#include <string>
+#include <system_error>
+
+#include "io/io.h"
+#include "server/common.h"
+#include "util/fibers/fibers.h"
+#include "util/fibers/synchronization.h"
+#include "util/fibers/uring_file.h"
+
+namespace dfly {
+namespace journal {
+
+// Ring of serialized journal entries in a file, which extends the in-memory backlog of a journal
+// slice, so that partial sync can resume from LSNs long dropped from memory.
+// Entries are grouped into blocks of consecutive LSNs. Sealed blocks are written asynchronously
+// by a background fiber through io_uring, and once the file is full the oldest blocks are
+// overwritten. Blocks that were not written yet are served from memory.
+// Must be used from a single io_uring proactor thread.
+class DiskRing {
+ public:
+  // Blocks are sealed once they reach this size.
+  static constexpr size_t kBlockSize = 64 * 1024;
+
+  explicit DiskRing(size_t capacity);
+  ~DiskRing();
+
+  std::error_code Open(std::string_view path);
+
+  // Waits for the pending write and closes the file.
+  void Close();
+
+  // Appends a serialized entry. LSNs must be consecutive. Never preempts.
+  void Append(LSN lsn, std::string_view entry);
+
+  // Whether the ring still holds the entry.
+  bool Contains(LSN lsn) const;
+
+  // Calls cb for lsn and the following entries of its block, and returns the LSN following the
+  // last entry passed to cb. Can preempt, including within cb.
+  io::Result<LSN> Read(LSN lsn, absl::FunctionRef<void(std::string_view)> cb);
+
+ private:
+  struct Block {
+    uint64_t seq;
+    LSN first_lsn, end_lsn;  // [first_lsn, end_lsn)
+    size_t offset;
+    size_t size;
+
+    // Held until the block is written to the file.
+    std::shared_ptr<const std::string> data;
+  };
+
+  void Seal();
+  Block* FindBlock(uint64_t seq);
+  void FlushFb();
+
+  size_t capacity_;
+  size_t next_offset_ = 0;
+  uint64_t next_seq_ = 0;
+  uint64_t flush_seq_ = 0;  // Seq of the next block to write.
+
+  std::deque<Block> blocks_;  // Sealed blocks, the oldest first.
+
+  // The block being filled.
+  std::string open_data_;
+  LSN open_first_lsn_ = 0, open_end_lsn_ = 0;
+
+  bool closing_ = false;
+
+  std::unique_ptr<util::fb2::LinuxFile> file_;
+  util::fb2::EventCount flush_ec_;
+  util::fb2::Fiber flush_fb_;
+};
+
+}  // namespace journal
+}  // namespace dfly
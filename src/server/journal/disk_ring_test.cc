@@ -0,0 +1,104 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/journal/disk_ring.h"
+
+#include <absl/strings/str_cat.h>
+
+#include <memory>
+
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "util/fibers/fibers.h"
+#include "util/fibers/pool.h"
+
+namespace dfly {
+namespace journal {
+
+using namespace std;
+using namespace util;
+
+class DiskRingTest : public testing::Test {
+ protected:
+  void SetUp() override {
+    pp_.reset(fb2::Pool::IOUring(16, 1));
+    pp_->Run();
+  }
+
+  void TearDown() override {
+    pp_->Stop();
+    pp_.reset();
+  }
+
+  static string Entry(LSN lsn) {
+    return absl::StrCat("entry", lsn, string(lsn % 100, 'x'));
+  }
+
+  // Reads all entries starting at lsn, so that their values can be checked.
+  static LSN ReadAll(DiskRing* ring, LSN lsn, LSN end) {
+    while (lsn < end) {
+      auto res = ring->Read(lsn, [&lsn](string_view entry) { EXPECT_EQ(Entry(lsn++), entry); });
+      if (!res)
+        break;
+      EXPECT_EQ(*res, lsn);
+    }
+    return lsn;
+  }
+
+  unique_ptr<ProactorPool> pp_;
+};
+
+TEST_F(DiskRingTest, ReadBack) {
+  pp_->at(0)->Await([this] {
+    DiskRing ring{1 << 20};
+    ASSERT_FALSE(ring.Open("disk_ring_test_file"));
+
+    EXPECT_FALSE(ring.Contains(1));
+    for (LSN lsn = 1; lsn < 5000; ++lsn)
+      ring.Append(lsn, Entry(lsn));
+
+    // Let the sealed blocks reach the file.
+    ThisFiber::SleepFor(10ms);
+
+    EXPECT_TRUE(ring.Contains(1));
+    EXPECT_TRUE(ring.Contains(4999));
+    EXPECT_FALSE(ring.Contains(5000));
+    EXPECT_EQ(5000u, ReadAll(&ring, 1, 5000));
+    EXPECT_EQ(5000u, ReadAll(&ring, 2500, 5000));
+
+    ring.Close();
+    unlink("disk_ring_test_file");
+  });
+}
+
+TEST_F(DiskRingTest, Wraparound) {
+  pp_->at(0)->Await([this] {
+    DiskRing ring{4 * DiskRing::kBlockSize};
+    ASSERT_FALSE(ring.Open("disk_ring_test_file"));
+
+    const LSN kEnd = 100000;
+    for (LSN lsn = 1; lsn < kEnd; ++lsn) {
+      ring.Append(lsn, Entry(lsn));
+      if (lsn % 1000 == 0)
+        ThisFiber::Yield();
+    }
+    ThisFiber::SleepFor(10ms);
+
+    // The oldest entries were overwritten, but the ring still covers a contiguous tail.
+    EXPECT_FALSE(ring.Contains(1));
+    EXPECT_TRUE(ring.Contains(kEnd - 1));
+
+    LSN first = kEnd - 1;
+    while (ring.Contains(first - 1))
+      --first;
+    EXPECT_GT(first, 1u);
+    EXPECT_EQ(kEnd, ReadAll(&ring, first, kEnd));
+
+    ring.Close();
+    unlink("disk_ring_test_file");
+  });
+}
+
+}  // namespace journal
+}  // namespace dfly
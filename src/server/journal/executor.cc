@@ -62,6 +62,36 @@ void JournalExecutor::Execute(DbIndex dbid, journal::ParsedEntry::CmdData& cmd)
   Execute(cmd);
 }
 
+void JournalExecutor::ExecuteForwarded(DbIndex dbid, journal::ParsedEntry::CmdData& cmd,
+                                       const journal::ForwardedEntry& fwd) {
+  SelectDb(dbid);
+  conn_context_.forwarded_entry = &fwd;
+  Execute(cmd);
+  conn_context_.forwarded_entry = nullptr;
+}
+
+void JournalExecutor::ExecuteBatch(DbIndex dbid,
+                                   absl::Span<journal::ParsedEntry::CmdData*> cmds) {
+  SelectDb(dbid);
+  if (cmds.size() == 1) {
+    Execute(*cmds[0]);
+    return;
+  }
+
+  vector<CmdArgList> args_list;
+  args_list.reserve(cmds.size());
+  for (auto* cmd : cmds) {
+    args_list.emplace_back(cmd->cmd_args.data(), cmd->cmd_args.size());
+  }
+
+  size_t dispatched = service_->DispatchManyCommands(absl::MakeSpan(args_list), &conn_context_);
+
+  // Squashing stops when the server is paused, the rest is dispatched one by one.
+  for (size_t i = dispatched; i < args_list.size(); ++i) {
+    service_->DispatchCommand(args_list[i], &conn_context_);
+  }
+}
+
 void JournalExecutor::FlushAll() {
   auto cmd = BuildFromParts("FLUSHALL");
   Execute(cmd);
@@ -25,6 +25,14 @@ class JournalExecutor {
   void Execute(DbIndex dbid, absl::Span<journal::ParsedEntry::CmdData> cmds);
   void Execute(DbIndex dbid, journal::ParsedEntry::CmdData& cmd);
 
+  // Executes a command and journals the given serialization of it, see ForwardedEntry.
+  void ExecuteForwarded(DbIndex dbid, journal::ParsedEntry::CmdData& cmd,
+                        const journal::ForwardedEntry& fwd);
+
+  // Executes independent commands in a batch, which squashes them into a single hop per shard
+  // instead of scheduling a transaction for every command.
+  void ExecuteBatch(DbIndex dbid, absl::Span<journal::ParsedEntry::CmdData*> cmds);
+
   void FlushAll();  // Execute FLUSHALL.
   void FlushSlots(const cluster::SlotRange& slot_range);
 
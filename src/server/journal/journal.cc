@@ -35,6 +35,10 @@ void Journal::StartInThread() {
   EngineShard* shard = EngineShard::tlocal();
   if (shard) {
     shard->set_journal(this);
+
+    // Only shards record entries, so only they need the on-disk ring.
+    error_code ec = journal_slice.OpenDiskRing();
+    LOG_IF(ERROR, ec) << "Could not open the on-disk journal ring: " << ec.message();
   }
 }
 
@@ -52,6 +56,7 @@ error_code Journal::Close() {
     if (shard) {
       shard->set_journal(nullptr);
     }
+    journal_slice.CloseDiskRing();
   };
 
   shard_set->pool()->AwaitFiberOnAll(close_cb);
@@ -79,6 +84,18 @@ std::string_view Journal::GetEntry(LSN lsn) const {
   return journal_slice.GetEntry(lsn);
 }
 
+const JournalItem& Journal::GetItem(LSN lsn) const {
+  return journal_slice.GetItem(lsn);
+}
+
+bool Journal::IsLSNOnDisk(LSN lsn) const {
+  return journal_slice.IsLSNOnDisk(lsn);
+}
+
+io::Result<LSN> Journal::ReadFromDisk(LSN lsn, absl::FunctionRef<void(std::string_view)> cb) {
+  return journal_slice.ReadFromDisk(lsn, cb);
+}
+
 LSN Journal::GetLsn() const {
   return journal_slice.cur_lsn();
 }
@@ -88,5 +105,13 @@ void Journal::RecordEntry(TxId txid, Op opcode, DbIndex dbid, unsigned shard_cnt
   journal_slice.AddLogRecord(Entry{txid, opcode, dbid, shard_cnt, slot, std::move(payload)}, await);
 }
 
+void Journal::RecordForwardedEntry(const ForwardedEntry& fwd, DbIndex dbid,
+                                   std::optional<cluster::SlotId> slot, std::string_view cmd,
+                                   bool await) {
+  DCHECK(!fwd.data.empty());
+  Entry entry{0, fwd.opcode, dbid, 1, slot, Entry::Payload(cmd, CmdArgList{})};
+  journal_slice.AddLogRecord(entry, await, fwd.data);
+}
+
 }  // namespace journal
 }  // namespace dfly
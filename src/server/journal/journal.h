@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <absl/functional/function_ref.h>
+
+#include "io/io.h"
 #include "server/journal/types.h"
 #include "util/proactor_pool.h"
 
@@ -31,12 +34,21 @@ class Journal {
 
   bool IsLSNInBuffer(LSN lsn) const;
   std::string_view GetEntry(LSN lsn) const;
+  const JournalItem& GetItem(LSN lsn) const;
+
+  // Entries dropped from the buffer can still be kept in the on-disk ring of the shard.
+  bool IsLSNOnDisk(LSN lsn) const;
+  io::Result<LSN> ReadFromDisk(LSN lsn, absl::FunctionRef<void(std::string_view)> cb);
 
   LSN GetLsn() const;
 
   void RecordEntry(TxId txid, Op opcode, DbIndex dbid, unsigned shard_cnt,
                    std::optional<cluster::SlotId> slot, Entry::Payload payload, bool await);
 
+  // Records a single shard entry of the master of this replica with its original serialization.
+  void RecordForwardedEntry(const ForwardedEntry& fwd, DbIndex dbid,
+                            std::optional<cluster::SlotId> slot, std::string_view cmd, bool await);
+
  private:
   mutable util::fb2::Mutex state_mu_;
 };
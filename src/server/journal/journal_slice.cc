@@ -14,11 +14,25 @@
 
 #include "base/function2.hpp"
 #include "base/logging.h"
+#include "server/error.h"
 #include "server/journal/serializer.h"
 
+#ifdef __linux__
+#include "server/journal/disk_ring.h"
+#include "util/fibers/proactor_base.h"
+#endif
+
 ABSL_FLAG(uint32_t, shard_repl_backlog_len, 1 << 10,
           "The length of the circular replication log per shard");
 
+ABSL_FLAG(std::string, journal_disk_dir, "",
+          "If set, every shard also keeps its recent journal entries in a ring file in this "
+          "directory, so that replicas can partially sync after disconnects longer than the "
+          "in-memory backlog covers. Requires io_uring.");
+
+ABSL_FLAG(uint64_t, journal_disk_ring_bytes, 1ULL << 30,
+          "The size of the on-disk journal ring per shard");
+
 namespace dfly {
 namespace journal {
 using namespace std;
@@ -27,11 +41,11 @@ namespace fs = std::filesystem;
 
 namespace {
 
-/*
 string ShardName(std::string_view base, unsigned index) {
   return absl::StrCat(base, "-", absl::Dec(index, absl::kZeroPad4), ".log");
 }
 
+/*
 uint32_t NextPowerOf2(uint32_t x) {
   if (x < 2) {
     return 1;
@@ -54,7 +68,9 @@ JournalSlice::JournalSlice() {
 }
 
 JournalSlice::~JournalSlice() {
-  // CHECK(!shard_file_);
+#ifdef __linux__
+  DCHECK(!disk_ring_);
+#endif
 }
 
 void JournalSlice::Init(unsigned index) {
@@ -62,7 +78,47 @@ void JournalSlice::Init(unsigned index) {
     return;
 
   slice_index_ = index;
-  ring_buffer_.emplace(2);
+  ring_buffer_.emplace(absl::GetFlag(FLAGS_shard_repl_backlog_len));
+}
+
+error_code JournalSlice::OpenDiskRing() {
+  string dir = absl::GetFlag(FLAGS_journal_disk_dir);
+  if (dir.empty() || disk_ring_)
+    return {};
+
+#ifdef __linux__
+  if (ProactorBase::me()->GetKind() != ProactorBase::IOURING) {
+    LOG_FIRST_N(WARNING, 1) << "--journal_disk_dir requires io_uring, ignoring it";
+    return {};
+  }
+
+  error_code ec;
+  fs::create_directories(dir, ec);
+  if (ec)
+    return ec;
+
+  // A ring has to hold at least a couple of blocks to serve anything.
+  size_t capacity = max<size_t>(absl::GetFlag(FLAGS_journal_disk_ring_bytes),
+                                4 * DiskRing::kBlockSize);
+  auto disk_ring = make_unique<DiskRing>(capacity);
+  fs::path path = fs::path(dir) / ShardName("journal", slice_index_);
+  RETURN_ON_ERR(disk_ring->Open(path.string()));
+
+  VLOG(1) << "Opened journal ring " << path;
+  disk_ring_ = std::move(disk_ring);
+#else
+  LOG_FIRST_N(WARNING, 1) << "--journal_disk_dir is supported only on linux, ignoring it";
+#endif
+  return {};
+}
+
+void JournalSlice::CloseDiskRing() {
+#ifdef __linux__
+  if (disk_ring_) {
+    disk_ring_->Close();
+    disk_ring_.reset();
+  }
+#endif
 }
 
 #if 0
@@ -136,13 +192,33 @@ bool JournalSlice::IsLSNInBuffer(LSN lsn) const {
 }
 
 std::string_view JournalSlice::GetEntry(LSN lsn) const {
+  return *GetItem(lsn).data;
+}
+
+const JournalItem& JournalSlice::GetItem(LSN lsn) const {
   DCHECK(ring_buffer_ && IsLSNInBuffer(lsn));
   auto start = (*ring_buffer_)[0].lsn;
   DCHECK((*ring_buffer_)[lsn - start].lsn == lsn);
-  return (*ring_buffer_)[lsn - start].data;
+  return (*ring_buffer_)[lsn - start];
+}
+
+bool JournalSlice::IsLSNOnDisk(LSN lsn) const {
+#ifdef __linux__
+  return disk_ring_ && disk_ring_->Contains(lsn);
+#else
+  return false;
+#endif
 }
 
-void JournalSlice::AddLogRecord(const Entry& entry, bool await) {
+io::Result<LSN> JournalSlice::ReadFromDisk(LSN lsn, absl::FunctionRef<void(string_view)> cb) {
+#ifdef __linux__
+  if (disk_ring_)
+    return disk_ring_->Read(lsn, cb);
+#endif
+  return nonstd::make_unexpected(make_error_code(errc::result_out_of_range));
+}
+
+void JournalSlice::AddLogRecord(const Entry& entry, bool await, string_view forwarded) {
   optional<FiberAtomicGuard> guard;
   if (!await) {
     guard.emplace();  // Guard is non-movable/copyable, so we must use emplace()
@@ -156,13 +232,13 @@ void JournalSlice::AddLogRecord(const Entry& entry, bool await) {
     item = &dummy;
     item->lsn = -1;
     item->opcode = entry.opcode;
-    item->data = "";
+    item->data = nullptr;
     item->slot = entry.slot;
   } else {
     FiberAtomicGuard fg;
     // GetTail gives a pointer to a new tail entry in the buffer, possibly overriding the last entry
     // if the buffer is full.
-    item = &dummy;
+    item = ring_buffer_->GetTail(true);
     item->opcode = entry.opcode;
     item->lsn = lsn_++;
     item->cmd = entry.payload.cmd;
@@ -170,11 +246,21 @@ void JournalSlice::AddLogRecord(const Entry& entry, bool await) {
 
     io::BufSink buf_sink{&ring_serialize_buf_};
     JournalWriter writer{&buf_sink};
-    writer.Write(entry);
+    if (forwarded.empty()) {
+      writer.Write(entry);
+    } else {
+      writer.Write(Entry{Op::SELECT, entry.dbid, entry.slot});
+      buf_sink.Write(io::Buffer(forwarded));
+    }
 
-    item->data = io::View(ring_serialize_buf_.InputBuffer());
+    item->data = std::make_shared<const std::string>(io::View(ring_serialize_buf_.InputBuffer()));
     ring_serialize_buf_.Clear();
     VLOG(2) << "Writing item [" << item->lsn << "]: " << entry.ToString();
+
+#ifdef __linux__
+    if (disk_ring_)
+      disk_ring_->Append(item->lsn, *item->data);
+#endif
   }
 
 #if 0
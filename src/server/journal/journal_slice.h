@@ -4,17 +4,23 @@
 
 #pragma once
 
+#include <absl/functional/function_ref.h>
+
+#include <memory>
 #include <optional>
 #include <shared_mutex>
 #include <string_view>
 
 #include "base/ring_buffer.h"
+#include "io/io.h"
 #include "server/common.h"
 #include "server/journal/types.h"
 
 namespace dfly {
 namespace journal {
 
+class DiskRing;
+
 // Journal slice is present for both shards and io threads.
 class JournalSlice {
  public:
@@ -23,6 +29,10 @@ class JournalSlice {
 
   void Init(unsigned index);
 
+  // Opens the on-disk ring of the slice, if it is configured. Called only in shard threads.
+  std::error_code OpenDiskRing();
+  void CloseDiskRing();
+
   // This is always the LSN of the *next* journal entry.
   LSN cur_lsn() const {
     return lsn_;
@@ -37,7 +47,9 @@ class JournalSlice {
     return slice_index_ != UINT32_MAX;
   }
 
-  void AddLogRecord(const Entry& entry, bool await);
+  // If forwarded is set, it holds the serialized entry, which is recorded instead of the
+  // serialization of entry.payload.
+  void AddLogRecord(const Entry& entry, bool await, std::string_view forwarded = {});
 
   // Register a callback that will be called every time a new entry is
   // added to the journal.
@@ -54,11 +66,19 @@ class JournalSlice {
   /// from the buffer.
   bool IsLSNInBuffer(LSN lsn) const;
   std::string_view GetEntry(LSN lsn) const;
+  const JournalItem& GetItem(LSN lsn) const;
+
+  /// Returns whether the journal entry with this LSN is available from the on-disk ring.
+  bool IsLSNOnDisk(LSN lsn) const;
+
+  // Passes the entry with this LSN and possibly some of the following entries to cb,
+  // reading them from the on-disk ring. Returns the LSN following the last passed entry.
+  // Can preempt.
+  io::Result<LSN> ReadFromDisk(LSN lsn, absl::FunctionRef<void(std::string_view)> cb);
 
  private:
-  // std::string shard_path_;
-  // std::unique_ptr<LinuxFile> shard_file_;
   std::optional<base::RingBuffer<JournalItem>> ring_buffer_;
+  std::unique_ptr<DiskRing> disk_ring_;
   base::IoBuf ring_serialize_buf_;
 
   mutable util::fb2::SharedMutex cb_mu_;  // to prevent removing callback during call
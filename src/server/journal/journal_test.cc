@@ -3,6 +3,7 @@
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "server/journal/serializer.h"
+#include "server/journal/tx_executor.h"
 #include "server/journal/types.h"
 #include "server/serializer_commons.h"
 
@@ -127,5 +128,137 @@ TEST(Journal, WriteRead) {
   }
 }
 
+TEST(Journal, Timestamp) {
+  base::IoBuf buf;
+  io::BufSink sink{&buf};
+  JournalWriter writer{&sink};
+
+  Entry entry{Op::TIMESTAMP, LSN(0)};
+  entry.timestamp_ms = 1234567;
+  writer.Write(entry);
+  writer.Write(Entry{Op::LSN, LSN(16)});
+
+  // Timestamps are not part of the LSN sequence, so the LSN entry still matches.
+  io::BufSource source{&buf};
+  JournalReader reader{&source, 0};
+  TransactionReader tx_reader{16};
+  Context cntx;
+
+  auto tx_data = tx_reader.NextTxData(&reader, &cntx);
+  ASSERT_TRUE(tx_data);
+  EXPECT_EQ(Op::TIMESTAMP, tx_data->opcode);
+  EXPECT_EQ(1234567u, tx_data->timestamp_ms);
+
+  tx_data = tx_reader.NextTxData(&reader, &cntx);
+  ASSERT_TRUE(tx_data);
+  EXPECT_EQ(Op::LSN, tx_data->opcode);
+  EXPECT_EQ(16u, tx_data->lsn);
+}
+
+TEST(Journal, SlotDone) {
+  base::IoBuf buf;
+  io::BufSink sink{&buf};
+  JournalWriter writer{&sink};
+  writer.Write(Entry{Op::SLOT_DONE, 0, cluster::SlotId(1234)});
+  writer.Write(Entry{Op::LSN, LSN(7)});
+
+  io::BufSource source{&buf};
+  JournalReader reader{&source, 0};
+  TransactionReader tx_reader;
+  Context cntx;
+
+  auto tx_data = tx_reader.NextTxData(&reader, &cntx);
+  ASSERT_TRUE(tx_data);
+  EXPECT_EQ(Op::SLOT_DONE, tx_data->opcode);
+  EXPECT_EQ(1234u, tx_data->slot);
+
+  tx_data = tx_reader.NextTxData(&reader, &cntx);
+  ASSERT_TRUE(tx_data);
+  EXPECT_EQ(Op::LSN, tx_data->opcode);
+  EXPECT_EQ(7u, tx_data->lsn);
+}
+
+TEST(Journal, CaptureRaw) {
+  StoredLists lists{};
+  auto list = [v = &lists](auto... ss) { return StoreList(v, ss...); };
+  using Payload = Entry::Payload;
+
+  std::vector<Entry> test_entries = {
+      {1, Op::COMMAND, 0, 1, nullopt, Payload("SET", list("A", "1"))},
+      {2, Op::EXPIRED, 3, 1, nullopt, Payload("DEL", list("B"))},
+      {3, Op::COMMAND, 3, 1, nullopt, Payload("LPUSH", list("l", "v1", "v2"))}};
+
+  // Serialize every entry on its own, as journal slices do.
+  base::IoBuf buf;
+  io::BufSink sink{&buf};
+  std::vector<string> serialized;
+  for (const auto& entry : test_entries) {
+    base::IoBuf entry_buf;
+    io::BufSink entry_sink{&entry_buf};
+    JournalWriter{&entry_sink}.Write(entry);
+    serialized.emplace_back(io::View(entry_buf.InputBuffer()));
+    sink.Write(io::Buffer(serialized.back()));
+  }
+
+  io::BufSource source{&buf};
+  JournalReader reader{&source, 0};
+  reader.SetCaptureRaw(true);
+
+  // Prefixing the raw bytes with SELECT reproduces the original serialization.
+  for (unsigned i = 0; i < test_entries.size(); i++) {
+    auto res = reader.ReadEntry();
+    ASSERT_TRUE(res.has_value());
+    EXPECT_EQ(test_entries[i].opcode, res->opcode);
+
+    base::IoBuf entry_buf;
+    io::BufSink entry_sink{&entry_buf};
+    JournalWriter{&entry_sink}.Write(Entry{Op::SELECT, res->dbid, nullopt});
+    entry_sink.Write(io::Buffer(res->raw));
+    EXPECT_EQ(serialized[i], io::View(entry_buf.InputBuffer()));
+  }
+}
+
+TEST(Journal, CompressedFrames) {
+  StoredLists lists{};
+  auto list = [v = &lists](auto... ss) { return StoreList(v, ss...); };
+  using Payload = Entry::Payload;
+
+  std::vector<Entry> test_entries;
+  for (unsigned i = 0; i < 100; i++) {
+    test_entries.push_back(
+        {i, Op::COMMAND, 0, 1, nullopt, Payload("SET", list("key", string(100, 'x')))});
+  }
+
+  for (JournalCompression compression : {JournalCompression::LZ4, JournalCompression::ZSTD}) {
+    base::IoBuf raw;
+    io::BufSink raw_sink{&raw};
+    JournalWriter writer{&raw_sink};
+    for (const auto& entry : test_entries) {
+      writer.Write(entry);
+    }
+
+    // Split the stream into two frames, each of them ends in the middle of an entry.
+    io::Bytes data = raw.InputBuffer();
+    JournalFrameCompressor compressor{compression};
+    base::IoBuf framed;
+    size_t split = data.size() / 2 + 1;
+    for (io::Bytes part : {data.subspan(0, split), data.subspan(split)}) {
+      auto frame = compressor.Compress(part);
+      framed.WriteAndCommit(frame.data(), frame.size());
+    }
+    EXPECT_LT(framed.InputLen(), data.size() / 4);
+
+    io::BufSource source{&framed};
+    JournalFrameSource frames{&source, compression};
+    JournalReader reader{&frames, 0};
+    for (const auto& expected : test_entries) {
+      auto res = reader.ReadEntry();
+      ASSERT_TRUE(res.has_value());
+      ASSERT_EQ(expected.txid, res->txid);
+      ASSERT_EQ(ExtractPayload(expected), ExtractPayload(*res));
+    }
+  }
+}
+
 }  // namespace journal
 }  // namespace dfly
@@ -4,6 +4,12 @@
 
 #include "server/journal/serializer.h"
 
+#include <absl/base/internal/endian.h>
+#include <absl/strings/match.h>
+#include <lz4.h>
+#include <zstd.h>
+
+#include <cstring>
 #include <system_error>
 
 #include "base/logging.h"
@@ -58,7 +64,8 @@ void JournalWriter::Write(const journal::Entry::Payload& payload) {
 void JournalWriter::Write(const journal::Entry& entry) {
   // Check if entry has a new db index and we need to emit a SELECT entry.
   if (entry.opcode != journal::Op::SELECT && entry.opcode != journal::Op::LSN &&
-      entry.opcode != journal::Op::PING && (!cur_dbid_ || entry.dbid != *cur_dbid_)) {
+      entry.opcode != journal::Op::PING && entry.opcode != journal::Op::TIMESTAMP &&
+      entry.opcode != journal::Op::SLOT_DONE && (!cur_dbid_ || entry.dbid != *cur_dbid_)) {
     Write(journal::Entry{journal::Op::SELECT, entry.dbid, entry.slot});
     cur_dbid_ = entry.dbid;
   }
@@ -72,6 +79,10 @@ void JournalWriter::Write(const journal::Entry& entry) {
       return Write(entry.dbid);
     case journal::Op::LSN:
       return Write(entry.lsn);
+    case journal::Op::TIMESTAMP:
+      return Write(entry.timestamp_ms);
+    case journal::Op::SLOT_DONE:
+      return Write(uint64_t(*entry.slot));
     case journal::Op::PING:
       return;
     case journal::Op::COMMAND:
@@ -117,12 +128,18 @@ std::error_code JournalReader::EnsureRead(size_t num) {
   return {};
 }
 
+void JournalReader::ConsumeInput(size_t num) {
+  if (capture_raw_)
+    raw_.append(reinterpret_cast<const char*>(buf_.InputBuffer().data()), num);
+  buf_.ConsumeInput(num);
+}
+
 template <typename UT> io::Result<UT> JournalReader::ReadUInt() {
   // Determine type and number of following bytes.
   if (auto ec = EnsureRead(1); ec)
     return make_unexpected(ec);
   PackedUIntMeta meta{buf_.InputBuffer()[0]};
-  buf_.ConsumeInput(1);
+  ConsumeInput(1);
 
   if (auto ec = EnsureRead(meta.ByteSize()); ec)
     return make_unexpected(ec);
@@ -130,7 +147,7 @@ template <typename UT> io::Result<UT> JournalReader::ReadUInt() {
   // Read and check intenger.
   uint64_t res;
   SET_OR_UNEXPECT(ReadPackedUInt(meta, buf_.InputBuffer()), res);
-  buf_.ConsumeInput(meta.ByteSize());
+  ConsumeInput(meta.ByteSize());
 
   if (res > std::numeric_limits<UT>::max())
     return make_unexpected(make_error_code(errc::result_out_of_range));
@@ -153,6 +170,8 @@ io::Result<size_t> JournalReader::ReadString(MutableSlice buffer) {
     return make_unexpected(make_error_code(errc::bad_message));
 
   buf_.ReadAndConsume(size, buffer.data());
+  if (capture_raw_)
+    raw_.append(reinterpret_cast<const char*>(buffer.data()), size);
 
   return size;
 }
@@ -180,6 +199,9 @@ std::error_code JournalReader::ReadCommand(journal::ParsedEntry::CmdData* data)
 }
 
 io::Result<journal::ParsedEntry> JournalReader::ReadEntry() {
+  // SELECT is read as a separate entry, so it is never part of the raw bytes.
+  raw_.clear();
+
   uint8_t int_op;
   SET_OR_UNEXPECT(ReadUInt<uint8_t>(), int_op);
   journal::Op opcode = static_cast<journal::Op>(int_op);
@@ -202,6 +224,18 @@ io::Result<journal::ParsedEntry> JournalReader::ReadEntry() {
     return entry;
   }
 
+  if (opcode == journal::Op::TIMESTAMP) {
+    SET_OR_UNEXPECT(ReadUInt<uint64_t>(), entry.timestamp_ms);
+    return entry;
+  }
+
+  if (opcode == journal::Op::SLOT_DONE) {
+    cluster::SlotId slot;
+    SET_OR_UNEXPECT(ReadUInt<uint16_t>(), slot);
+    entry.slot = slot;
+    return entry;
+  }
+
   SET_OR_UNEXPECT(ReadUInt<uint64_t>(), entry.txid);
   SET_OR_UNEXPECT(ReadUInt<uint32_t>(), entry.shard_cnt);
 
@@ -215,7 +249,159 @@ io::Result<journal::ParsedEntry> JournalReader::ReadEntry() {
   if (ec)
     return make_unexpected(ec);
 
+  if (capture_raw_)
+    entry.raw = std::move(raw_);
+
   return entry;
 }
 
+namespace {
+
+constexpr size_t kFrameHeaderSize = 8;
+constexpr uint32_t kMaxFrameRawSize = 1U << 30;
+
+// Fast levels, as the frames are compressed in the shard threads.
+constexpr int kZstdLevel = 1;
+
+}  // namespace
+
+bool ParseJournalCompression(std::string_view name, JournalCompression* dest) {
+  if (absl::EqualsIgnoreCase(name, "none"))
+    *dest = JournalCompression::NONE;
+  else if (absl::EqualsIgnoreCase(name, "lz4"))
+    *dest = JournalCompression::LZ4;
+  else if (absl::EqualsIgnoreCase(name, "zstd"))
+    *dest = JournalCompression::ZSTD;
+  else
+    return false;
+  return true;
+}
+
+std::string_view JournalCompressionName(JournalCompression compression) {
+  switch (compression) {
+    case JournalCompression::NONE:
+      return "none";
+    case JournalCompression::LZ4:
+      return "lz4";
+    case JournalCompression::ZSTD:
+      return "zstd";
+  }
+  return "unknown";
+}
+
+JournalFrameCompressor::JournalFrameCompressor(JournalCompression compression)
+    : compression_(compression) {
+  DCHECK(compression_ != JournalCompression::NONE);
+  if (compression_ == JournalCompression::ZSTD)
+    zstd_cctx_ = ZSTD_createCCtx();
+}
+
+JournalFrameCompressor::~JournalFrameCompressor() {
+  ZSTD_freeCCtx(zstd_cctx_);
+}
+
+std::vector<uint8_t> JournalFrameCompressor::Compress(io::Bytes data) {
+  DCHECK_LE(data.size(), kMaxFrameRawSize);
+
+  size_t bound = compression_ == JournalCompression::LZ4 ? LZ4_compressBound(data.size())
+                                                          : ZSTD_compressBound(data.size());
+  std::vector<uint8_t> frame(kFrameHeaderSize + std::max(bound, data.size()));
+  uint8_t* payload = frame.data() + kFrameHeaderSize;
+
+  size_t payload_size = 0;
+  if (compression_ == JournalCompression::LZ4) {
+    int res = LZ4_compress_default(reinterpret_cast<const char*>(data.data()),
+                                   reinterpret_cast<char*>(payload), data.size(), bound);
+    payload_size = res > 0 ? res : 0;
+  } else {
+    size_t res =
+        ZSTD_compressCCtx(zstd_cctx_, payload, bound, data.data(), data.size(), kZstdLevel);
+    payload_size = ZSTD_isError(res) ? 0 : res;
+  }
+
+  // Store incompressible data as is.
+  if (payload_size == 0 || payload_size >= data.size()) {
+    memcpy(payload, data.data(), data.size());
+    payload_size = data.size();
+  }
+
+  absl::little_endian::Store32(frame.data(), data.size());
+  absl::little_endian::Store32(frame.data() + 4, payload_size);
+  frame.resize(kFrameHeaderSize + payload_size);
+  return frame;
+}
+
+JournalFrameSource::JournalFrameSource(io::Source* upstream, JournalCompression compression)
+    : upstream_(upstream), compression_(compression) {
+  DCHECK(compression_ != JournalCompression::NONE);
+  if (compression_ == JournalCompression::ZSTD)
+    zstd_dctx_ = ZSTD_createDCtx();
+}
+
+JournalFrameSource::~JournalFrameSource() {
+  ZSTD_freeDCtx(zstd_dctx_);
+}
+
+io::Result<bool> JournalFrameSource::ReadFrame() {
+  uint8_t header[kFrameHeaderSize];
+  size_t read;
+  SET_OR_UNEXPECT(upstream_->ReadAtLeast(io::MutableBytes{header}, sizeof(header)), read);
+  if (read == 0)
+    return false;
+  if (read < sizeof(header))
+    return make_unexpected(make_error_code(errc::io_error));
+
+  uint32_t raw_size = absl::little_endian::Load32(header);
+  uint32_t payload_size = absl::little_endian::Load32(header + 4);
+  if (raw_size > kMaxFrameRawSize || payload_size > raw_size)
+    return make_unexpected(make_error_code(errc::bad_message));
+
+  payload_.resize(payload_size);
+  SET_OR_UNEXPECT(upstream_->ReadAtLeast(io::MutableBytes{payload_}, payload_size), read);
+  if (read < payload_size)
+    return make_unexpected(make_error_code(errc::io_error));
+
+  raw_offset_ = 0;
+  if (payload_size == raw_size) {
+    raw_.swap(payload_);
+    return true;
+  }
+
+  raw_.resize(raw_size);
+  bool ok;
+  if (compression_ == JournalCompression::LZ4) {
+    int res = LZ4_decompress_safe(reinterpret_cast<const char*>(payload_.data()),
+                                  reinterpret_cast<char*>(raw_.data()), payload_size, raw_size);
+    ok = res == int(raw_size);
+  } else {
+    size_t res = ZSTD_decompressDCtx(zstd_dctx_, raw_.data(), raw_size, payload_.data(),
+                                     payload_size);
+    ok = !ZSTD_isError(res) && res == raw_size;
+  }
+
+  if (!ok) {
+    LOG(ERROR) << "Could not decompress a journal frame of " << payload_size << " bytes";
+    return make_unexpected(make_error_code(errc::bad_message));
+  }
+  return true;
+}
+
+io::Result<size_t> JournalFrameSource::ReadSome(const iovec* v, uint32_t len) {
+  while (raw_offset_ == raw_.size()) {
+    bool has_frame;
+    SET_OR_UNEXPECT(ReadFrame(), has_frame);
+    if (!has_frame)
+      return 0;
+  }
+
+  size_t copied = 0;
+  for (uint32_t i = 0; i < len && raw_offset_ < raw_.size(); ++i) {
+    size_t n = std::min(v[i].iov_len, raw_.size() - raw_offset_);
+    memcpy(v[i].iov_base, raw_.data() + raw_offset_, n);
+    raw_offset_ += n;
+    copied += n;
+  }
+  return copied;
+}
+
 }  // namespace dfly
@@ -6,12 +6,16 @@
 
 #include <optional>
 #include <string>
+#include <vector>
 
 #include "io/io.h"
 #include "io/io_buf.h"
 #include "server/common.h"
 #include "server/journal/types.h"
 
+struct ZSTD_CCtx_s;
+struct ZSTD_DCtx_s;
+
 namespace dfly {
 
 // JournalWriter serializes journal entries to a sink.
@@ -50,10 +54,23 @@ struct JournalReader {
   // Try reading entry from source.
   io::Result<journal::ParsedEntry> ReadEntry();
 
+  // Whether data of the next entry was already read from the source.
+  bool HasBufferedData() const {
+    return buf_.InputLen() > 0;
+  }
+
+  // Keep the serialized bytes of every entry in ParsedEntry::raw, so that they can be forwarded.
+  void SetCaptureRaw(bool capture) {
+    capture_raw_ = capture;
+  }
+
  private:
   // Read from source until buffer contains at least num bytes.
   std::error_code EnsureRead(size_t num);
 
+  // Consume num bytes of the buffer, appending them to the raw entry when capturing.
+  void ConsumeInput(size_t num);
+
   // Read unsigned integer in packed encoding.
   template <typename UT> io::Result<UT> ReadUInt();
 
@@ -67,6 +84,50 @@ struct JournalReader {
   io::Source* source_;
   base::IoBuf buf_;
   DbIndex dbid_;
+
+  bool capture_raw_ = false;
+  std::string raw_;  // The entry being read, when capturing.
+};
+
+// Journal streams of the stable sync can be compressed in frames, which the replica requests with
+// REPLCONF JOURNAL-COMPRESSION. A frame starts with the length of its raw data and the length of
+// its payload, as 32 bit little endian integers. The payload is stored uncompressed if both are
+// equal.
+enum class JournalCompression : uint8_t { NONE, LZ4, ZSTD };
+
+bool ParseJournalCompression(std::string_view name, JournalCompression* dest);
+std::string_view JournalCompressionName(JournalCompression compression);
+
+class JournalFrameCompressor {
+ public:
+  explicit JournalFrameCompressor(JournalCompression compression);
+  ~JournalFrameCompressor();
+
+  // Returns the frame of data.
+  std::vector<uint8_t> Compress(io::Bytes data);
+
+ private:
+  JournalCompression compression_;
+  ZSTD_CCtx_s* zstd_cctx_ = nullptr;
+};
+
+// Reads journal frames from upstream and returns their raw data.
+class JournalFrameSource : public io::Source {
+ public:
+  JournalFrameSource(io::Source* upstream, JournalCompression compression);
+  ~JournalFrameSource();
+
+  io::Result<size_t> ReadSome(const iovec* v, uint32_t len) final;
+
+ private:
+  // Reads the next frame into raw_. Returns false on the end of the upstream.
+  io::Result<bool> ReadFrame();
+
+  io::Source* upstream_;
+  JournalCompression compression_;
+  ZSTD_DCtx_s* zstd_dctx_ = nullptr;
+  std::vector<uint8_t> payload_, raw_;
+  size_t raw_offset_ = 0;
 };
 
 }  // namespace dfly
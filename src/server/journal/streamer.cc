@@ -5,10 +5,18 @@
 #include "server/journal/streamer.h"
 
 #include <absl/functional/bind_front.h>
+#include <absl/time/clock.h>
 
+#include <set>
+
+#include "absl/cleanup/cleanup.h"
+#include "absl/strings/str_format.h"
 #include "base/flags.h"
 #include "base/logging.h"
+#include "core/string_map.h"
+#include "core/string_set.h"
 #include "server/cluster/cluster_defs.h"
+#include "server/container_utils.h"
 
 using namespace facade;
 
@@ -18,6 +26,8 @@ ABSL_FLAG(uint32_t, replication_stream_timeout, 500,
 ABSL_FLAG(uint32_t, replication_stream_output_limit, 64_KB,
           "Time to wait for the replication output buffer go below the throttle limit");
 
+ABSL_DECLARE_FLAG(uint64_t, serialization_max_chunk_size);
+
 namespace dfly {
 using namespace util;
 using namespace journal;
@@ -29,8 +39,38 @@ iovec IoVec(io::Bytes src) {
 }
 
 constexpr size_t kFlushThreshold = 2_KB;
+constexpr uint64_t kTimestampIntervalMs = 100;
+// Compressed frames aggregate more data, for a better ratio.
+constexpr size_t kCompressedFlushThreshold = 16_KB;
 uint32_t replication_stream_output_limit_cached = 64_KB;
 
+// Priorities of the restore streamers that are traversing their tables, shared by all threads.
+class PriorityGate {
+ public:
+  void Enter(uint32_t priority) {
+    std::lock_guard lk(mu_);
+    active_.insert(priority);
+    max_.store(*active_.rbegin(), std::memory_order_relaxed);
+  }
+
+  void Leave(uint32_t priority) {
+    std::lock_guard lk(mu_);
+    active_.erase(active_.find(priority));
+    max_.store(active_.empty() ? 0 : *active_.rbegin(), std::memory_order_relaxed);
+  }
+
+  uint32_t Max() const {
+    return max_.load(std::memory_order_relaxed);
+  }
+
+ private:
+  fb2::Mutex mu_;
+  std::multiset<uint32_t> active_;
+  std::atomic_uint32_t max_{0};
+};
+
+PriorityGate priority_gate;
+
 }  // namespace
 
 JournalStreamer::JournalStreamer(journal::Journal* journal, Context* cntx)
@@ -64,16 +104,33 @@ void JournalStreamer::Start(util::FiberSocketBase* dest, bool send_lsn) {
         time_t now = time(nullptr);
 
         // TODO: to chain it to the previous Write call.
-        if (send_lsn && now - last_lsn_time_ > 3) {
+        if (checkpoint_lsns_) {
+          WriteLsn(item.lsn + 1);
+        } else if (send_lsn && now - last_lsn_time_ > 3) {
           last_lsn_time_ = now;
+          WriteLsn(item.lsn);
+        }
+
+        uint64_t now_ms = absl::GetCurrentTimeNanos() / 1000000;
+        if (send_timestamps_ && now_ms - last_timestamp_ms_ >= kTimestampIntervalMs) {
+          last_timestamp_ms_ = now_ms;
           io::StringSink sink;
           JournalWriter writer(&sink);
-          writer.Write(Entry{journal::Op::LSN, item.lsn});
+          Entry entry{journal::Op::TIMESTAMP, LSN(0)};
+          entry.timestamp_ms = now_ms;
+          writer.Write(entry);
           Write(sink.str());
         }
       });
 }
 
+void JournalStreamer::WriteLsn(LSN lsn) {
+  io::StringSink sink;
+  JournalWriter writer(&sink);
+  writer.Write(Entry{journal::Op::LSN, lsn});
+  Write(sink.str());
+}
+
 void JournalStreamer::Cancel() {
   VLOG(1) << "JournalStreamer::Cancel";
   waker_.notifyAll();
@@ -86,20 +143,37 @@ size_t JournalStreamer::GetTotalBufferCapacities() const {
 }
 
 void JournalStreamer::Write(std::string_view str) {
+  DoWrite(str, nullptr);
+}
+
+void JournalStreamer::Write(std::shared_ptr<const std::string> data) {
+  std::string_view str{*data};
+  DoWrite(str, std::move(data));
+}
+
+void JournalStreamer::DoWrite(std::string_view str, std::shared_ptr<const std::string> owner) {
   DCHECK(!str.empty());
   DVLOG(2) << "Writing " << str.size() << " bytes";
 
   // If we do not have any in flight requests we send the string right a way.
   // We can not aggregate it since we do not know when the next update will follow.
   size_t total_pending = pending_buf_.size() + str.size();
-  if (in_flight_bytes_ == 0 || total_pending > kFlushThreshold) {
-    // because of potential SOO with strings we allocate explicitly on heap
-    uint8_t* buf(new uint8_t[str.size()]);
+  size_t flush_threshold = compressor_ ? kCompressedFlushThreshold : kFlushThreshold;
+  if (in_flight_bytes_ == 0 || total_pending > flush_threshold) {
+    if (compressor_) {
+      // The frame is a copy anyway, so the entry is compressed together with the pending ones.
+      AppendPending(str);
+      SendPending();
+      return;
+    }
 
-    // TODO: it is possible to remove these redundant copies if we adjust high level
-    // interfaces to pass reference-counted buffers.
-    memcpy(buf, str.data(), str.size());
+    // The string object is on the heap as well, so its data does not move even with SOO.
+    if (!owner) {
+      owner = std::make_shared<const std::string>(str);
+      str = *owner;
+    }
     in_flight_bytes_ += total_pending;
+    CountWritten(total_pending);
 
     iovec v[2];
     unsigned next_buf_id = 0;
@@ -108,41 +182,99 @@ void JournalStreamer::Write(std::string_view str) {
       v[0] = IoVec(pending_buf_);
       ++next_buf_id;
     }
-    v[next_buf_id++] = IoVec(io::Bytes(buf, str.size()));
+    v[next_buf_id++] = IoVec(io::Buffer(str));
 
-    dest_->AsyncWrite(
-        v, next_buf_id,
-        [buf0 = std::move(pending_buf_), buf, this, len = total_pending](std::error_code ec) {
-          delete[] buf;
-          OnCompletion(ec, len);
-        });
+    dest_->AsyncWrite(v, next_buf_id,
+                      [buf0 = std::move(pending_buf_), owner = std::move(owner), this,
+                       len = total_pending](std::error_code ec) { OnCompletion(ec, len); });
 
     return;
   }
 
   DCHECK_GT(in_flight_bytes_, 0u);
-  DCHECK_LE(pending_buf_.size() + str.size(), kFlushThreshold);
+  DCHECK_LE(pending_buf_.size() + str.size(), flush_threshold);
+  AppendPending(str);
+}
 
-  // Aggregate
+void JournalStreamer::AppendPending(std::string_view str) {
   size_t tail = pending_buf_.size();
   pending_buf_.resize(pending_buf_.size() + str.size());
   memcpy(pending_buf_.data() + tail, str.data(), str.size());
 }
 
+void JournalStreamer::SendPending() {
+  std::vector<uint8_t> buf = std::move(pending_buf_);
+  pending_buf_.clear();
+
+  if (compressor_) {
+    uint64_t start = absl::GetCurrentTimeNanos();
+    raw_bytes_.fetch_add(buf.size(), std::memory_order_relaxed);
+    buf = compressor_->Compress(buf);
+    sent_bytes_.fetch_add(buf.size(), std::memory_order_relaxed);
+    compress_ns_.fetch_add(absl::GetCurrentTimeNanos() - start, std::memory_order_relaxed);
+  }
+
+  io::Bytes src(buf);
+  in_flight_bytes_ += src.size();
+  CountWritten(src.size());
+  dest_->AsyncWrite(src, [buf = std::move(buf), this](std::error_code ec) {
+    OnCompletion(ec, buf.size());
+  });
+}
+
+void JournalStreamer::EnableCompression(JournalCompression compression) {
+  DCHECK(dest_ == nullptr);
+  if (compression != JournalCompression::NONE)
+    compressor_ = std::make_unique<JournalFrameCompressor>(compression);
+}
+
+JournalStreamer::CompressionStats JournalStreamer::GetCompressionStats() const {
+  return {raw_bytes_.load(std::memory_order_relaxed), sent_bytes_.load(std::memory_order_relaxed),
+          compress_ns_.load(std::memory_order_relaxed) / 1000};
+}
+
+JournalStreamer::Stats JournalStreamer::GetStats() const {
+  Stats res;
+  res.written_bytes = written_bytes_.load(std::memory_order_relaxed);
+  res.in_flight_bytes = in_flight_stat_.load(std::memory_order_relaxed);
+  res.throttle_usec = throttle_ns_.load(std::memory_order_relaxed) / 1000;
+
+  // The rate is updated on writes, so it is stale once the stream is idle.
+  uint64_t window_start = rate_window_start_ns_.load(std::memory_order_relaxed);
+  if (absl::GetCurrentTimeNanos() - window_start < 2'000'000'000)
+    res.bytes_per_sec = bytes_per_sec_.load(std::memory_order_relaxed);
+  return res;
+}
+
+void JournalStreamer::CountWritten(size_t len) {
+  written_bytes_.fetch_add(len, std::memory_order_relaxed);
+  in_flight_stat_.store(in_flight_bytes_, std::memory_order_relaxed);
+
+  uint64_t now = absl::GetCurrentTimeNanos();
+  uint64_t window_start = rate_window_start_ns_.load(std::memory_order_relaxed);
+  uint64_t window_bytes = rate_window_bytes_.load(std::memory_order_relaxed) + len;
+  if (now - window_start >= 1'000'000'000) {
+    // A window that started long ago covers an idle period, which the rate should not include.
+    if (window_start != 0 && now - window_start < 2'000'000'000)
+      bytes_per_sec_.store(window_bytes * 1'000'000'000 / (now - window_start),
+                           std::memory_order_relaxed);
+    rate_window_start_ns_.store(now, std::memory_order_relaxed);
+    window_bytes = 0;
+  }
+  rate_window_bytes_.store(window_bytes, std::memory_order_relaxed);
+}
+
 void JournalStreamer::OnCompletion(std::error_code ec, size_t len) {
   DCHECK_GE(in_flight_bytes_, len);
 
   DVLOG(2) << "Completing from " << in_flight_bytes_ << " to " << in_flight_bytes_ - len;
   in_flight_bytes_ -= len;
+  in_flight_stat_.store(in_flight_bytes_, std::memory_order_relaxed);
   if (ec && !IsStopped()) {
     cntx_->ReportError(ec);
   } else if (in_flight_bytes_ == 0 && !pending_buf_.empty() && !IsStopped()) {
     // If everything was sent but we have a pending buf, flush it.
-    io::Bytes src(pending_buf_);
-    in_flight_bytes_ += src.size();
-    dest_->AsyncWrite(src, [buf = std::move(pending_buf_), this](std::error_code ec) {
-      OnCompletion(ec, buf.size());
-    });
+    SendPending();
   }
 
   // notify ThrottleIfNeeded or WaitForInflightToComplete that waits
@@ -161,8 +293,10 @@ void JournalStreamer::ThrottleIfNeeded() {
               chrono::milliseconds(absl::GetFlag(FLAGS_replication_stream_timeout));
   auto inflight_start = in_flight_bytes_;
 
+  uint64_t wait_start = absl::GetCurrentTimeNanos();
   std::cv_status status =
       waker_.await_until([this]() { return !IsStalled() || IsStopped(); }, next);
+  throttle_ns_.fetch_add(absl::GetCurrentTimeNanos() - wait_start, std::memory_order_relaxed);
   if (status == std::cv_status::timeout) {
     LOG(WARNING) << "Stream timed out, inflight bytes start: " << inflight_start
                  << ", end: " << in_flight_bytes_;
@@ -170,6 +304,14 @@ void JournalStreamer::ThrottleIfNeeded() {
   }
 }
 
+void JournalStreamer::ThrottleBandwidth() {
+  uint64_t written = written_bytes_.load(std::memory_order_relaxed);
+  uint64_t slept_ns =
+      SyncBandwidthLimiter::Throttle(written - bandwidth_accounted_, cntx_->GetCancellation());
+  bandwidth_accounted_ = written;
+  throttle_ns_.fetch_add(slept_ns, std::memory_order_relaxed);
+}
+
 void JournalStreamer::WaitForInflightToComplete() {
   while (in_flight_bytes_) {
     auto next = chrono::steady_clock::now() + 1s;
@@ -185,8 +327,12 @@ bool JournalStreamer::IsStalled() const {
 }
 
 RestoreStreamer::RestoreStreamer(DbSlice* slice, cluster::SlotSet slots, journal::Journal* journal,
-                                 Context* cntx)
-    : JournalStreamer(journal, cntx), db_slice_(slice), my_slots_(std::move(slots)) {
+                                 Context* cntx, uint32_t priority)
+    : JournalStreamer(journal, cntx),
+      db_slice_(slice),
+      my_slots_(std::move(slots)),
+      priority_(priority),
+      max_chunk_size_(absl::GetFlag(FLAGS_serialization_max_chunk_size)) {
   DCHECK(slice != nullptr);
   db_array_ = slice->databases();  // Inc ref to make sure DB isn't deleted while we use it
 }
@@ -199,8 +345,33 @@ void RestoreStreamer::Start(util::FiberSocketBase* dest, bool send_lsn) {
   auto db_cb = absl::bind_front(&RestoreStreamer::OnDbChange, this);
   snapshot_version_ = db_slice_->RegisterOnChange(std::move(db_cb));
 
+  // The target keeps the last LSN it applied, so that an interrupted migration can continue from
+  // there, see SetResumePoint.
+  checkpoint_lsns_ = true;
   JournalStreamer::Start(dest, send_lsn);
 
+  bool resumed = true;
+  {
+    // No records are added in between, so the target gets each of them exactly once.
+    FiberAtomicGuard fg;
+    if (resume_lsn_)
+      resumed = SendJournalFrom(*resume_lsn_);
+    WriteLsn(journal_->GetLsn());
+  }
+  if (!resumed) {
+    cntx_->ReportError("Journal records to resume the migration from are gone");
+    return;
+  }
+
+  priority_gate.Enter(priority_);
+  absl::Cleanup leave = [this] { priority_gate.Leave(priority_); };
+  WaitForPriority();
+
+  if (db_array_[0]->slot_keys) {
+    WriteIndexedSlots();
+    return;
+  }
+
   PrimeTable::Cursor cursor;
   uint64_t last_yield = 0;
   PrimeTable* pt = &db_array_[0]->prime;
@@ -209,23 +380,152 @@ void RestoreStreamer::Start(util::FiberSocketBase* dest, bool send_lsn) {
     if (fiber_cancelled_)
       return;
 
-    bool written = false;
-    cursor = pt->Traverse(cursor, [&](PrimeTable::bucket_iterator it) {
+    bool written = false, big_value_skipped = false, table_locked = false;
+    auto cb = [&](PrimeTable::bucket_iterator it) {
+      if (!table_locked && it.GetVersion() < snapshot_version_ && HasBigValue(it)) {
+        big_value_skipped = true;
+        return;
+      }
       db_slice_->FlushChangeToEarlierCallbacks(0 /*db_id always 0 for cluster*/,
                                                DbSlice::Iterator::FromPrime(it), snapshot_version_);
-      if (WriteBucket(it)) {
+      if (WriteBucket(it, table_locked)) {
         written = true;
       }
-    });
+    };
+
+    pt->PrefetchTraversal(cursor, PrefetchEntry);
+    PrimeTable::Cursor next = pt->Traverse(cursor, cb);
+    if (big_value_skipped) {
+      // Traverse the logical bucket again and write the skipped buckets in chunks, like
+      // SliceSnapshot does with big values.
+      db_slice_->LockForSerialization();
+      table_locked = true;
+      pt->Traverse(cursor, cb);
+      db_slice_->UnlockForSerialization();
+    }
+    cursor = next;
+
     if (written) {
       ThrottleIfNeeded();
+      ThrottleBandwidth();
     }
 
     if (++last_yield >= 100) {
       ThisFiber::Yield();
+      WaitForPriority();
       last_yield = 0;
     }
   } while (cursor);
+
+  if (fiber_cancelled_)
+    return;
+
+  // The keys of a slot are spread over the whole table, so they all are done only at the end.
+  for (cluster::SlotId sid = 0; sid <= cluster::kMaxSlotNum; ++sid) {
+    if (my_slots_.Contains(sid) && !done_slots_.Contains(sid))
+      WriteSlotDone(sid);
+  }
+}
+
+void RestoreStreamer::SetResumePoint(LSN lsn, cluster::SlotSet done_slots) {
+  DCHECK(dest_ == nullptr);
+  resume_lsn_ = lsn;
+  done_slots_ = std::move(done_slots);
+}
+
+bool RestoreStreamer::CanResumeFrom(const journal::Journal* journal, LSN lsn) {
+  LSN end = journal->GetLsn();
+  if (lsn == end)
+    return true;
+  if (lsn > end || !journal->IsLSNInBuffer(lsn))
+    return false;
+
+  for (; lsn < end; ++lsn) {
+    const JournalItem& item = journal->GetItem(lsn);
+    if (item.cmd == "FLUSHALL" || item.cmd == "FLUSHDB")
+      return false;
+  }
+  return true;
+}
+
+bool RestoreStreamer::SendJournalFrom(LSN lsn) {
+  if (!CanResumeFrom(journal_, lsn))
+    return false;
+
+  // The other slots are flushed by the target and traversed again.
+  for (LSN end = journal_->GetLsn(); lsn < end; ++lsn) {
+    const JournalItem& item = journal_->GetItem(lsn);
+    if (item.slot && done_slots_.Contains(*item.slot)) {
+      Write(item.data);
+      WriteLsn(item.lsn + 1);
+    }
+  }
+  return true;
+}
+
+void RestoreStreamer::WriteSlotDone(cluster::SlotId slot_id) {
+  io::StringSink sink;
+  JournalWriter writer{&sink};
+  writer.Write(journal::Entry(journal::Op::SLOT_DONE, 0 /*db_id*/, slot_id));
+  Write(sink.str());
+}
+
+void RestoreStreamer::WriteIndexedSlots() {
+  PrimeTable* pt = &db_array_[0]->prime;
+  uint64_t last_yield = 0;
+
+  // Keys added after the start are sent by OnDbChange or by the journal.
+  for (cluster::SlotId sid = 0; sid <= cluster::kMaxSlotNum; ++sid) {
+    if (!my_slots_.Contains(sid) || done_slots_.Contains(sid))
+      continue;
+
+    for (const std::string& key : db_array_[0]->slot_keys->GetKeys(sid)) {
+      if (fiber_cancelled_)
+        return;
+
+      PrimeTable::iterator it = pt->Find(key);
+      if (!IsValid(it))
+        continue;
+
+      PrimeTable::bucket_iterator bit{it};
+      bool table_locked = false;
+      if (bit.GetVersion() < snapshot_version_ && HasBigValue(bit)) {
+        // Locking can preempt, so the key is looked up again.
+        db_slice_->LockForSerialization();
+        table_locked = true;
+        if (it = pt->Find(key); !IsValid(it)) {
+          db_slice_->UnlockForSerialization();
+          continue;
+        }
+        bit = PrimeTable::bucket_iterator{it};
+      }
+
+      db_slice_->FlushChangeToEarlierCallbacks(0 /*db_id always 0 for cluster*/,
+                                               DbSlice::Iterator::FromPrime(bit), snapshot_version_);
+      bool written = WriteBucket(bit, table_locked);
+      if (table_locked)
+        db_slice_->UnlockForSerialization();
+
+      if (written) {
+        ThrottleIfNeeded();
+        ThrottleBandwidth();
+      }
+
+      if (++last_yield >= 100) {
+        ThisFiber::Yield();
+        WaitForPriority();
+        last_yield = 0;
+      }
+    }
+
+    if (!fiber_cancelled_)
+      WriteSlotDone(sid);
+  }
+}
+
+void RestoreStreamer::WaitForPriority() {
+  while (!fiber_cancelled_ && priority_gate.Max() > priority_)
+    ThisFiber::SleepFor(10ms);
 }
 
 void RestoreStreamer::SendFinalize() {
@@ -272,17 +572,37 @@ bool RestoreStreamer::ShouldWrite(const journal::JournalItem& item) const {
 }
 
 bool RestoreStreamer::ShouldWrite(std::string_view key) const {
-  return ShouldWrite(cluster::KeySlot(key));
+  // The target already has the keys of done_slots_, only their journal records are sent.
+  cluster::SlotId slot_id = cluster::KeySlot(key);
+  return ShouldWrite(slot_id) && !done_slots_.Contains(slot_id);
 }
 
 bool RestoreStreamer::ShouldWrite(cluster::SlotId slot_id) const {
   return my_slots_.Contains(slot_id);
 }
 
-bool RestoreStreamer::WriteBucket(PrimeTable::bucket_iterator it) {
+bool RestoreStreamer::HasBigValue(PrimeTable::bucket_iterator it) const {
+  if (max_chunk_size_ == 0)
+    return false;
+
+  for (; !it.is_done(); ++it) {
+    const PrimeValue& pv = it->second;
+    unsigned obj_type = pv.ObjType();
+    bool is_container =
+        obj_type == OBJ_SET || obj_type == OBJ_HASH || obj_type == OBJ_ZSET || obj_type == OBJ_LIST;
+    if (is_container && !pv.IsExternal() && pv.MallocUsed() > max_chunk_size_)
+      return true;
+  }
+  return false;
+}
+
+bool RestoreStreamer::WriteBucket(PrimeTable::bucket_iterator it, bool chunked) {
   // Can't switch fibers because that could invalidate iterator or cause bucket splits which may
-  // move keys between buckets.
-  FiberAtomicGuard fg;
+  // move keys between buckets. Unless the table is locked for serialization, then big values are
+  // written in chunks and we preempt in between.
+  std::optional<FiberAtomicGuard> fg;
+  if (!chunked)
+    fg.emplace();
 
   bool written = false;
 
@@ -301,7 +621,10 @@ bool RestoreStreamer::WriteBucket(PrimeTable::bucket_iterator it) {
           expire = db_slice_->ExpireTime(eit);
         }
 
-        WriteEntry(key, it->first, pv, expire);
+        if (!chunked || pv.MallocUsed() <= max_chunk_size_ ||
+            !WriteChunkedEntry(key, it->first, pv, expire)) {
+          WriteEntry(key, it->first, pv, expire);
+        }
       }
     }
   }
@@ -335,7 +658,8 @@ void RestoreStreamer::WriteEntry(string_view key, const PrimeValue& pk, const Pr
   args.push_back(expire_str);
 
   io::StringSink value_dump_sink;
-  SerializerBase::DumpObject(pv, &value_dump_sink);
+  // The target is a Dragonfly node, which adopts the native encodings as they are.
+  SerializerBase::DumpObject(pv, &value_dump_sink, true);
   args.push_back(value_dump_sink.str());
 
   args.push_back("ABSTTL");  // Means expire string is since epoch
@@ -344,10 +668,110 @@ void RestoreStreamer::WriteEntry(string_view key, const PrimeValue& pk, const Pr
     args.push_back("STICK");
   }
 
-  WriteCommand(journal::Entry::Payload("RESTORE", ArgSlice(args)));
+  size_t bytes = WriteCommand(journal::Entry::Payload("RESTORE", ArgSlice(args)));
+
+  SlotProgress& progress = slot_progress_[cluster::KeySlot(key)];
+  progress.keys++;
+  progress.bytes += bytes;
+}
+
+bool RestoreStreamer::WriteChunkedEntry(std::string_view key, const PrimeValue& pk,
+                                        const PrimeValue& pv, uint64_t expire_ms) {
+  std::string_view cmd;
+  switch (pv.ObjType()) {
+    case OBJ_HASH:
+      // Fields with expiry can only be restored as a whole.
+      if (pv.Encoding() != kEncodingStrMap2 ||
+          static_cast<const StringMap*>(pv.RObjPtr())->ExpirationUsed())
+        return false;
+      cmd = "HSET";
+      break;
+    case OBJ_SET:
+      if (pv.Encoding() == kEncodingStrMap2 &&
+          static_cast<const StringSet*>(pv.RObjPtr())->ExpirationUsed())
+        return false;
+      cmd = "SADD";
+      break;
+    case OBJ_ZSET:
+      cmd = "ZADD";
+      break;
+    case OBJ_LIST:
+      cmd = "RPUSH";
+      break;
+    default:
+      return false;
+  }
+
+  // The target does not own the slot yet, so nobody sees the key before the last chunk.
+  size_t bytes = WriteCommand(journal::Entry::Payload("DEL", ArgSlice{key}));
+
+  std::vector<std::string> args{std::string{key}};
+  size_t chunk_bytes = 0;
+  auto add = [&](std::string arg) {
+    chunk_bytes += arg.size();
+    args.push_back(std::move(arg));
+  };
+  auto flush = [&] {
+    if (args.size() > 1) {
+      std::vector<std::string_view> view(args.begin(), args.end());
+      bytes += WriteCommand(journal::Entry::Payload(cmd, ArgSlice{view}));
+      args.resize(1);
+      chunk_bytes = 0;
+    }
+
+    ThrottleIfNeeded();
+    ThrottleBandwidth();
+    ThisFiber::Yield();
+    return !fiber_cancelled_;
+  };
+  auto add_entry = [&](container_utils::ContainerEntry entry) {
+    add(entry.ToString());
+    return chunk_bytes < max_chunk_size_ || flush();
+  };
+
+  switch (pv.ObjType()) {
+    case OBJ_HASH:
+      for (const auto& k_v : *static_cast<StringMap*>(pv.RObjPtr())) {
+        add(std::string{k_v->first, sdslen(k_v->first)});
+        add(std::string{k_v->second, sdslen(k_v->second)});
+        if (chunk_bytes >= max_chunk_size_ && !flush())
+          return true;
+      }
+      break;
+    case OBJ_SET:
+      if (!container_utils::IterateSet(pv, add_entry))
+        return true;
+      break;
+    case OBJ_ZSET:
+      if (!container_utils::IterateSortedSet(
+              pv.GetRobjWrapper(), [&](container_utils::ContainerEntry entry, double score) {
+                add(absl::StrFormat("%.17g", score));
+                return add_entry(entry);
+              }))
+        return true;
+      break;
+    case OBJ_LIST:
+      if (!container_utils::IterateList(pv, add_entry))
+        return true;
+      break;
+  }
+  flush();
+
+  if (expire_ms) {
+    std::string expire_str = absl::StrCat(expire_ms);
+    bytes += WriteCommand(journal::Entry::Payload("PEXPIREAT", ArgSlice{key, expire_str}));
+  }
+  if (pk.IsSticky()) {
+    bytes += WriteCommand(journal::Entry::Payload("STICK", ArgSlice{key}));
+  }
+
+  SlotProgress& progress = slot_progress_[cluster::KeySlot(key)];
+  progress.keys++;
+  progress.bytes += bytes;
+  return true;
 }
 
-void RestoreStreamer::WriteCommand(journal::Entry::Payload cmd_payload) {
+size_t RestoreStreamer::WriteCommand(journal::Entry::Payload cmd_payload) {
   journal::Entry entry(0,                     // txid
                        journal::Op::COMMAND,  // single command
                        0,                     // db index
@@ -361,6 +785,7 @@ void RestoreStreamer::WriteCommand(journal::Entry::Payload cmd_payload) {
   JournalWriter writer{&sink};
   writer.Write(entry);
   Write(sink.str());
+  return sink.str().size();
 }
 
 }  // namespace dfly
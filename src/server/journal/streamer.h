@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <absl/container/flat_hash_map.h>
+
 #include "server/db_slice.h"
 #include "server/journal/journal.h"
 #include "server/journal/serializer.h"
@@ -31,48 +33,114 @@ class JournalStreamer {
 
   size_t GetTotalBufferCapacities() const;
 
+  // Sends the journal in compressed frames, see JournalCompression. Must be called before Start.
+  void EnableCompression(JournalCompression compression);
+
+  struct CompressionStats {
+    uint64_t raw_bytes = 0;   // before compression
+    uint64_t sent_bytes = 0;  // compressed frames
+    uint64_t cpu_usec = 0;    // spent compressing
+  };
+
+  // Safe to call from any thread.
+  CompressionStats GetCompressionStats() const;
+
+  // Interleaves the stream with the wall clock time of the master, so that the replica can
+  // measure its apply lag. Must be called before Start.
+  void EnableTimestamps() {
+    send_timestamps_ = true;
+  }
+
+  struct Stats {
+    uint64_t written_bytes = 0;  // issued to the socket, after compression
+    uint64_t bytes_per_sec = 0;  // over the last second
+    uint64_t in_flight_bytes = 0;
+    uint64_t throttle_usec = 0;  // waiting in ThrottleIfNeeded and ThrottleBandwidth
+  };
+
+  // Safe to call from any thread.
+  Stats GetStats() const;
+
  protected:
-  // TODO: we copy the string on each write because JournalItem may be passed to multiple
-  // streamers so we can not move it. However, if we would either wrap JournalItem in shared_ptr
-  // or wrap JournalItem::data in shared_ptr, we can avoid the cost of copying strings.
-  // Also, for small strings it's more peformant to copy to the intermediate buffer than
-  // to issue an io operation.
+  // Small writes are copied into an intermediate buffer, as it is more performant than issuing an
+  // io operation for each of them. Larger ones are copied into a heap buffer that is alive until
+  // the write completes.
   void Write(std::string_view str);
 
+  // Journal entries are shared by all the streamers of the shard, so instead of copying a large
+  // entry, the write holds a reference to it until it completes.
+  void Write(std::shared_ptr<const std::string> data);
+
   // Blocks the if the consumer if not keeping up.
   void ThrottleIfNeeded();
 
+  // Pauses for the sync bandwidth limit, accounting for the bytes written since the last call.
+  void ThrottleBandwidth();
+
   virtual bool ShouldWrite(const journal::JournalItem& item) const {
     return !IsStopped();
   }
 
   void WaitForInflightToComplete();
 
+  // Writes an LSN entry, telling the consumer that it has the records before lsn.
+  void WriteLsn(LSN lsn);
+
   util::FiberSocketBase* dest_ = nullptr;
   Context* cntx_;
+  journal::Journal* journal_;
+  bool checkpoint_lsns_ = false;  // Follow each record with the LSN of the next one.
 
  private:
+  // str is owned by owner if it is not null.
+  void DoWrite(std::string_view str, std::shared_ptr<const std::string> owner);
+
+  void AppendPending(std::string_view str);
+
+  // Sends the pending buffer, as a compressed frame if compression is enabled.
+  void SendPending();
+
   void OnCompletion(std::error_code ec, size_t len);
 
+  // Accounts len bytes issued to the socket.
+  void CountWritten(size_t len);
+
   bool IsStopped() const {
     return cntx_->IsCancelled();
   }
 
   bool IsStalled() const;
 
-  journal::Journal* journal_;
   std::vector<uint8_t> pending_buf_;
   size_t in_flight_bytes_ = 0;
   time_t last_lsn_time_ = 0;
+  bool send_timestamps_ = false;
+  uint64_t last_timestamp_ms_ = 0;
+  uint64_t bandwidth_accounted_ = 0;  // written bytes passed to SyncBandwidthLimiter
   util::fb2::EventCount waker_;
   uint32_t journal_cb_id_{0};
+
+  std::unique_ptr<JournalFrameCompressor> compressor_;
+  std::atomic_uint64_t raw_bytes_{0}, sent_bytes_{0}, compress_ns_{0};
+
+  // Stats are written by the shard thread and read by any thread.
+  std::atomic_uint64_t written_bytes_{0}, in_flight_stat_{0}, throttle_ns_{0};
+  std::atomic_uint64_t rate_window_start_ns_{0}, rate_window_bytes_{0}, bytes_per_sec_{0};
 };
 
 // Serializes existing DB as RESTORE commands, and sends updates as regular commands.
 // Only handles relevant slots, while ignoring all others.
+// While streamers of a higher priority traverse their tables, the ones of lower priorities pause.
 class RestoreStreamer : public JournalStreamer {
  public:
-  RestoreStreamer(DbSlice* slice, cluster::SlotSet slots, journal::Journal* journal, Context* cntx);
+  // What the traversal has sent for a slot.
+  struct SlotProgress {
+    uint64_t keys = 0;
+    uint64_t bytes = 0;
+  };
+
+  RestoreStreamer(DbSlice* slice, cluster::SlotSet slots, journal::Journal* journal, Context* cntx,
+                  uint32_t priority = 0);
   ~RestoreStreamer() override;
 
   void Start(util::FiberSocketBase* dest, bool send_lsn = false) override;
@@ -81,25 +149,67 @@ class RestoreStreamer : public JournalStreamer {
 
   void SendFinalize();
 
+  // Continues an interrupted migration whose target has the records before lsn and all the keys
+  // of done_slots: the records of done_slots since lsn are sent from the journal buffer and only
+  // the other slots are traversed. Must be called before Start.
+  void SetResumePoint(LSN lsn, cluster::SlotSet done_slots);
+
+  // Whether the journal buffer still has the records since lsn and none of them flushed a db.
+  static bool CanResumeFrom(const journal::Journal* journal, LSN lsn);
+
   bool IsSnapshotFinished() const {
     return snapshot_finished_;
   }
 
+  // Must be called from the shard thread.
+  const absl::flat_hash_map<cluster::SlotId, SlotProgress>& GetSlotProgress() const {
+    return slot_progress_;
+  }
+
  private:
   void OnDbChange(DbIndex db_index, const DbSlice::ChangeReq& req);
   bool ShouldWrite(const journal::JournalItem& item) const override;
   bool ShouldWrite(std::string_view key) const;
   bool ShouldWrite(cluster::SlotId slot_id) const;
 
-  // Returns whether anything was written
-  bool WriteBucket(PrimeTable::bucket_iterator it);
+  // Sends the buffered records of done_slots_ since lsn. Returns false if they are gone.
+  bool SendJournalFrom(LSN lsn);
+
+  // Tells the target that it has all the keys of the slot.
+  void WriteSlotDone(cluster::SlotId slot_id);
+
+  // Writes the buckets of the keys of my_slots_, found through the slot key index of the table.
+  void WriteIndexedSlots();
+
+  // Pauses while streamers of a higher priority are traversing their tables.
+  void WaitForPriority();
+
+  // Whether the bucket has a container bigger than max_chunk_size_.
+  bool HasBigValue(PrimeTable::bucket_iterator it) const;
+
+  // Returns whether anything was written. If chunked is set, the table must be locked for
+  // serialization and big containers are written by WriteChunkedEntry.
+  bool WriteBucket(PrimeTable::bucket_iterator it, bool chunked = false);
   void WriteEntry(string_view key, const PrimeValue& pk, const PrimeValue& pv, uint64_t expire_ms);
-  void WriteCommand(journal::Entry::Payload cmd_payload);
+
+  // Writes a container as a DEL followed by HSET, SADD, ZADD or RPUSH commands of about
+  // max_chunk_size_ bytes each, and preempts between them, so that neither the buffers nor the
+  // target have to hold the whole value at once. Returns false if the value can only be written
+  // by WriteEntry, e.g. a hash with expiring fields.
+  bool WriteChunkedEntry(string_view key, const PrimeValue& pk, const PrimeValue& pv,
+                         uint64_t expire_ms);
+  // Returns the number of serialized bytes.
+  size_t WriteCommand(journal::Entry::Payload cmd_payload);
 
   DbSlice* db_slice_;
   DbTableArray db_array_;
   uint64_t snapshot_version_ = 0;
   cluster::SlotSet my_slots_;
+  cluster::SlotSet done_slots_;  // Sent by an earlier attempt, see SetResumePoint.
+  std::optional<LSN> resume_lsn_;
+  uint32_t priority_;
+  size_t max_chunk_size_;  // Of the commands that big containers are written in, 0 if disabled.
+  absl::flat_hash_map<cluster::SlotId, SlotProgress> slot_progress_;
   bool fiber_cancelled_ = false;
   bool snapshot_finished_ = false;
 };
@@ -54,6 +54,12 @@ void TransactionData::AddEntry(journal::ParsedEntry&& entry) {
     case journal::Op::LSN:
       lsn = entry.lsn;
       return;
+    case journal::Op::TIMESTAMP:
+      timestamp_ms = entry.timestamp_ms;
+      return;
+    case journal::Op::SLOT_DONE:
+      slot = *entry.slot;
+      return;
     case journal::Op::PING:
     case journal::Op::FIN:
       return;
@@ -61,6 +67,7 @@ void TransactionData::AddEntry(journal::ParsedEntry&& entry) {
     case journal::Op::COMMAND:
     case journal::Op::MULTI_COMMAND:
       command = std::move(entry.cmd);
+      raw_entry = std::move(entry.raw);
       [[fallthrough]];
     case journal::Op::EXEC:
       shard_cnt = entry.shard_cnt;
@@ -102,8 +109,9 @@ std::optional<TransactionData> TransactionReader::NextTxData(JournalReader* read
       return std::nullopt;
     }
 
-    // When LSN opcode is sent master does not increase journal lsn.
-    if (lsn_.has_value() && res->opcode != journal::Op::LSN) {
+    // When LSN or TIMESTAMP opcodes are sent master does not increase journal lsn.
+    if (lsn_.has_value() && res->opcode != journal::Op::LSN &&
+        res->opcode != journal::Op::TIMESTAMP) {
       ++*lsn_;
       VLOG(2) << "read lsn: " << *lsn_;
     }
@@ -49,9 +49,12 @@ struct TransactionData {
   DbIndex dbid{0};
   uint32_t shard_cnt{0};
   journal::ParsedEntry::CmdData command;
+  std::string raw_entry;  // Set when the reader captures raw entries.
 
   journal::Op opcode = journal::Op::NOOP;
   uint64_t lsn = 0;
+  uint64_t timestamp_ms = 0;
+  cluster::SlotId slot = 0;  // Of SLOT_DONE.
 };
 
 // Utility for reading TransactionData from a journal reader.
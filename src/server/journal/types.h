@@ -3,6 +3,7 @@
 //
 #pragma once
 
+#include <memory>
 #include <optional>
 #include <string>
 #include <variant>
@@ -23,7 +24,9 @@ enum class Op : uint8_t {
   EXEC = 12,
   PING = 13,
   FIN = 14,
-  LSN = 15
+  LSN = 15,
+  TIMESTAMP = 16,  // Wall clock time of the master in ms, not part of the LSN sequence.
+  SLOT_DONE = 17,  // All the keys of the slot were sent by a slot migration flow.
 };
 
 struct EntryBase {
@@ -33,6 +36,7 @@ struct EntryBase {
   uint32_t shard_cnt;
   std::optional<cluster::SlotId> slot;
   LSN lsn{0};
+  uint64_t timestamp_ms{0};
 };
 
 // This struct represents a single journal entry.
@@ -88,13 +92,25 @@ struct ParsedEntry : public EntryBase {
   };
   CmdData cmd;
 
+  // The serialized entry without its SELECT prefix, captured only by readers that keep raw
+  // entries.
+  std::string raw;
+
   std::string ToString() const;
 };
 
+// Entry serialized by the master of a replica, without its SELECT prefix. Replicas that have
+// replicas of their own journal it as is instead of serializing the applied command anew.
+struct ForwardedEntry {
+  Op opcode;
+  std::string_view data;
+};
+
 struct JournalItem {
   LSN lsn;
   Op opcode;
-  std::string data;
+  // The entry is serialized once and shared by all the streamers that send it, null for NOOP.
+  std::shared_ptr<const std::string> data;
   std::string_view cmd;
   std::optional<cluster::SlotId> slot;
 };
@@ -4,6 +4,7 @@
 
 #include "server/json_family.h"
 
+#include <absl/container/node_hash_map.h>
 #include <absl/strings/match.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_join.h>
@@ -17,6 +18,7 @@
 #include "base/flags.h"
 #include "base/logging.h"
 #include "core/flatbuffers.h"
+#include "core/lru.h"
 #include "core/json/json_object.h"
 #include "core/json/path.h"
 #include "facade/cmd_arg_parser.h"
@@ -35,6 +37,8 @@ ABSL_FLAG(bool, jsonpathv2, true,
           "If true uses Dragonfly jsonpath implementation, "
           "otherwise uses legacy jsoncons implementation.");
 ABSL_FLAG(bool, experimental_flat_json, false, "If true uses flat json implementation.");
+ABSL_FLAG(uint32_t, json_path_cache_size, 1024,
+          "Number of parsed JSON paths cached by every thread, 0 disables the cache.");
 
 namespace dfly {
 
@@ -56,6 +60,7 @@ static const char DefaultJsonPath[] = "$";
 namespace {
 
 using JsonPathV2 = variant<json::Path, JsonExpression>;
+using JsonPathPtr = shared_ptr<const JsonPathV2>;
 using ExprCallback = absl::FunctionRef<void(string_view, const JsonType&)>;
 
 inline void Evaluate(const JsonExpression& expr, const JsonType& obj, ExprCallback cb) {
@@ -79,6 +84,78 @@ inline JsonType Evaluate(const json::Path& expr, const JsonType& obj) {
   return res;
 }
 
+// Read-only json value of an entry in either encoding
+using JsonRef = variant<const JsonType*, FlatJson>;
+
+FlatJson GetFlatRoot(const PrimeValue& pv) {
+  absl::Span<uint8_t> buf = pv.GetFlatJson();
+  return flexbuffers::GetRoot(buf.data(), buf.size());
+}
+
+JsonRef GetJsonRef(const PrimeValue& pv) {
+  if (const JsonType* json = pv.GetJson(); json)
+    return json;
+  return GetFlatRoot(pv);
+}
+
+// Whole jsoncons value, flat values are decoded into tmp
+const JsonType& Decode(const JsonRef& json, JsonType* tmp) {
+  if (const auto* ptr = get_if<const JsonType*>(&json); ptr)
+    return **ptr;
+  *tmp = json::FromFlat(get<FlatJson>(json));
+  return *tmp;
+}
+
+// Paths are evaluated over flat values directly and only their matches are decoded. Legacy
+// expressions need the whole jsoncons value.
+void Evaluate(const JsonPathV2& expr, const JsonRef& json, ExprCallback cb) {
+  if (holds_alternative<FlatJson>(json) && holds_alternative<json::Path>(expr)) {
+    json::EvaluatePath(get<json::Path>(expr), get<FlatJson>(json),
+                       [&cb](optional<string_view> key, FlatJson val) {
+                         cb(key ? *key : string_view{}, json::FromFlat(val));
+                       });
+    return;
+  }
+
+  JsonType tmp;
+  const JsonType& obj = Decode(json, &tmp);
+  visit([&](const auto& arg) { Evaluate(arg, obj, cb); }, expr);
+}
+
+JsonType Evaluate(const JsonPathV2& expr, const JsonRef& json) {
+  if (holds_alternative<FlatJson>(json) && holds_alternative<json::Path>(expr)) {
+    JsonType res(json_array_arg);
+    Evaluate(expr, json, [&res](string_view, const JsonType& val) { res.push_back(val); });
+    return res;
+  }
+
+  JsonType tmp;
+  const JsonType& obj = Decode(json, &tmp);
+  return visit([&](const auto& arg) { return Evaluate(arg, obj); }, expr);
+}
+
+void SetFlatJson(const JsonType& value, PrimeValue* pv) {
+  flexbuffers::Builder fbb;
+  json::FromJsonType(value, &fbb);
+  fbb.Finish();
+  const auto& buf = fbb.GetBuffer();
+  pv->SetJson(buf.data(), buf.size());
+}
+
+// Jsoncons value of pv to be mutated. Flat values are decoded into tmp and have to be encoded back
+// with FinishMutation. Structural changes rebuild the whole buffer, which keeps it compact.
+JsonType* StartMutation(const PrimeValue& pv, JsonType* tmp) {
+  if (JsonType* json = pv.GetJson(); json)
+    return json;
+  *tmp = json::FromFlat(GetFlatRoot(pv));
+  return tmp;
+}
+
+void FinishMutation(const JsonType& json, PrimeValue* pv) {
+  if (pv->GetJson() != &json)
+    SetFlatJson(json, pv);
+}
+
 facade::OpStatus SetJson(const OpArgs& op_args, string_view key, JsonType&& value) {
   auto& db_slice = op_args.shard->db_slice();
 
@@ -90,11 +167,7 @@ facade::OpStatus SetJson(const OpArgs& op_args, string_view key, JsonType&& valu
   op_args.shard->search_indices()->RemoveDoc(key, op_args.db_cntx, res.it->second);
 
   if (absl::GetFlag(FLAGS_experimental_flat_json)) {
-    flexbuffers::Builder fbb;
-    json::FromJsonType(value, &fbb);
-    fbb.Finish();
-    const auto& buf = fbb.GetBuffer();
-    res.it->second.SetJson(buf.data(), buf.size());
+    SetFlatJson(value, &res.it->second);
   } else {
     res.it->second.SetJson(std::move(value));
   }
@@ -199,10 +272,8 @@ OpStatus UpdateEntry(const OpArgs& op_args, std::string_view key, std::string_vi
   }
 
   auto entry_it = it_res->it;
-  JsonType* json_val = entry_it->second.GetJson();
-  DCHECK(json_val) << "should have a valid JSON object for key '" << key << "' the type for it is '"
-                   << entry_it->second.ObjType() << "'";
-  JsonType& json_entry = *json_val;
+  JsonType tmp;
+  JsonType& json_entry = *StartMutation(entry_it->second, &tmp);
 
   op_args.shard->search_indices()->RemoveDoc(key, op_args.db_cntx, entry_it->second);
 
@@ -218,6 +289,7 @@ OpStatus UpdateEntry(const OpArgs& op_args, std::string_view key, std::string_vi
     verify_op(json_entry);
   }
 
+  FinishMutation(json_entry, &entry_it->second);
   it_res->post_updater.Run();
   op_args.shard->search_indices()->AddDoc(key, op_args.db_cntx, entry_it->second);
 
@@ -235,22 +307,47 @@ OpStatus UpdateEntry(const OpArgs& op_args, string_view key, const json::Path& p
   PrimeValue& pv = it_res->it->second;
 
   op_args.shard->search_indices()->RemoveDoc(key, op_args.db_cntx, pv);
-  json::MutatePath(path, std::move(cb), pv.GetJson());
+
+  JsonType tmp;
+  JsonType* json = StartMutation(pv, &tmp);
+  json::MutatePath(path, std::move(cb), json);
+  FinishMutation(*json, &pv);
+
   it_res->post_updater.Run();
   op_args.shard->search_indices()->AddDoc(key, op_args.db_cntx, pv);
 
   return OpStatus::OK;
 }
 
-OpResult<JsonType*> GetJson(const OpArgs& op_args, string_view key) {
+// Overwrites matches of path in a flat value in place, if all new values fit into the places of
+// the previous ones. Returns nullopt if the value is not flat or can't be patched, so the entry has
+// to be updated with UpdateEntry.
+optional<OpStatus> PatchEntry(const OpArgs& op_args, string_view key, const json::Path& path,
+                              json::PatchCallback cb) {
+  auto it_res = op_args.shard->db_slice().FindMutable(op_args.db_cntx, key, OBJ_JSON);
+  if (!it_res.ok()) {
+    return it_res.status();
+  }
+
+  PrimeValue& pv = it_res->it->second;
+  if (pv.GetFlatJson().empty()) {
+    return nullopt;
+  }
+
+  op_args.shard->search_indices()->RemoveDoc(key, op_args.db_cntx, pv);
+  bool patched = json::PatchPath(path, cb, GetFlatRoot(pv)).has_value();
+  it_res->post_updater.Run();
+  op_args.shard->search_indices()->AddDoc(key, op_args.db_cntx, pv);
+
+  return patched ? make_optional(OpStatus::OK) : nullopt;
+}
+
+OpResult<JsonRef> GetJson(const OpArgs& op_args, string_view key) {
   auto it_res = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key, OBJ_JSON);
   if (!it_res.ok())
     return it_res.status();
 
-  JsonType* json_val = it_res.value()->second.GetJson();
-  DCHECK(json_val) << "should have a valid JSON object for key " << key;
-
-  return json_val;
+  return GetJsonRef(it_res.value()->second);
 }
 
 // Returns the index of the next right bracket
@@ -454,20 +551,81 @@ void SendJsonValue(RedisReplyBuilder* rb, const JsonType& j) {
   }
 }
 
-OpResult<string> OpJsonGet(const OpArgs& op_args, string_view key,
-                           const vector<pair<string_view, optional<JsonPathV2>>>& expressions,
-                           bool should_format, const OptString& indent, const OptString& new_line,
-                           const OptString& space) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+// Sink of jsoncons encoders that writes into reply chunks
+class ReplyChunksSink {
+ public:
+  using value_type = char;
+
+  explicit ReplyChunksSink(facade::ReplyChunks* chunks) : chunks_{chunks} {
+  }
+
+  void append(const char* s, size_t length) {
+    chunks_->Append(string_view{s, length});
+  }
+
+  void push_back(char ch) {
+    chunks_->Append(ch);
+  }
+
+  void flush() {
+  }
+
+ private:
+  facade::ReplyChunks* chunks_;
+};
+
+// Same output as JsonType::to_string()
+void DumpCompact(const JsonType& json, facade::ReplyChunks* out) {
+  basic_compact_json_encoder<char, ReplyChunksSink> encoder{ReplyChunksSink{out}};
+  json.dump(encoder);
+}
+
+// Same output as JsonType::as<string>(), which returns strings unquoted
+void DumpAsString(const JsonType& json, facade::ReplyChunks* out) {
+  if (json.is_string())
+    out->Append(json.as_string_view());
+  else
+    DumpCompact(json, out);
+}
+
+OpResult<facade::ReplyChunks> OpJsonGet(const OpArgs& op_args, string_view key,
+                                        const vector<pair<string_view, JsonPathPtr>>& expressions,
+                                        bool should_format, const OptString& indent,
+                                        const OptString& new_line, const OptString& space) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
 
-  const JsonType& json_entry = *(result.value());
+  facade::ReplyChunks reply;
+  JsonType tmp;
   if (expressions.empty()) {
     // this implicitly means that we're using $ which
     // means we just brings all values
-    return json_entry.to_string();
+    DumpCompact(Decode(*result, &tmp), &reply);
+    return reply;
+  }
+
+  if (expressions.size() == 1 && !should_format) {
+    const JsonPathPtr& expr = expressions[0].second;
+    if (!expr) {
+      DumpAsString(Decode(*result, &tmp), &reply);
+      return reply;
+    }
+
+    // Matches are written as an array directly, without collecting copies of them
+    if (holds_alternative<json::Path>(*expr)) {
+      reply.Append('[');
+      bool first = true;
+      Evaluate(*expr, *result, [&](string_view, const JsonType& val) {
+        if (!first)
+          reply.Append(',');
+        first = false;
+        DumpCompact(val, &reply);
+      });
+      reply.Append(']');
+      return reply;
+    }
   }
 
   json_options options;
@@ -493,8 +651,8 @@ OpResult<string> OpJsonGet(const OpArgs& op_args, string_view key,
     }
   }
 
-  auto eval_wrapped = [&json_entry](const optional<JsonPathV2>& expr) -> JsonType {
-    return expr ? visit([&](auto& arg) { return Evaluate(arg, json_entry); }, *expr) : json_entry;
+  auto eval_wrapped = [&](const JsonPathPtr& expr) -> JsonType {
+    return expr ? Evaluate(*expr, *result) : Decode(*result, &tmp);
   };
 
   JsonType out{json_object_arg};  // see https://github.com/danielaparker/jsoncons/issues/482
@@ -507,37 +665,36 @@ OpResult<string> OpJsonGet(const OpArgs& op_args, string_view key,
   }
 
   if (should_format) {
-    json_printable jp(out, options, indenting::indent);
-    std::stringstream ss;
-    jp.dump(ss);
-    return ss.str();
+    basic_json_encoder<char, ReplyChunksSink> encoder{ReplyChunksSink{&reply}, options};
+    out.dump(encoder);
+  } else {
+    DumpAsString(out, &reply);
   }
-
-  return out.as<string>();
+  return reply;
 }
 
-OpResult<vector<string>> OpType(const OpArgs& op_args, string_view key, JsonPathV2 expression) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+OpResult<vector<string>> OpType(const OpArgs& op_args, string_view key,
+                                const JsonPathV2& expression) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
 
-  const JsonType& json_entry = *(result.value());
   vector<string> vec;
   auto cb = [&vec](const string_view& path, const JsonType& val) {
     vec.emplace_back(JsonTypeToName(val));
   };
 
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
   return vec;
 }
 
-OpResult<vector<OptSizeT>> OpStrLen(const OpArgs& op_args, string_view key, JsonPathV2 expression) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+OpResult<vector<OptSizeT>> OpStrLen(const OpArgs& op_args, string_view key,
+                                    const JsonPathV2& expression) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
-  const JsonType& json_entry = *(result.value());
   vector<OptSizeT> vec;
   auto cb = [&vec](const string_view& path, const JsonType& val) {
     if (val.is_string()) {
@@ -547,17 +704,17 @@ OpResult<vector<OptSizeT>> OpStrLen(const OpArgs& op_args, string_view key, Json
     }
   };
 
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
   return vec;
 }
 
-OpResult<vector<OptSizeT>> OpObjLen(const OpArgs& op_args, string_view key, JsonPathV2 expression) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+OpResult<vector<OptSizeT>> OpObjLen(const OpArgs& op_args, string_view key,
+                                    const JsonPathV2& expression) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
 
-  const JsonType& json_entry = *(result.value());
   vector<OptSizeT> vec;
   auto cb = [&vec](const string_view& path, const JsonType& val) {
     if (val.is_object()) {
@@ -567,17 +724,17 @@ OpResult<vector<OptSizeT>> OpObjLen(const OpArgs& op_args, string_view key, Json
     }
   };
 
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
   return vec;
 }
 
-OpResult<vector<OptSizeT>> OpArrLen(const OpArgs& op_args, string_view key, JsonPathV2 expression) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+OpResult<vector<OptSizeT>> OpArrLen(const OpArgs& op_args, string_view key,
+                                    const JsonPathV2& expression) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
 
-  const JsonType& json_entry = *(result.value());
   vector<OptSizeT> vec;
   auto cb = [&vec](const string_view& path, const JsonType& val) {
     if (val.is_array()) {
@@ -587,12 +744,12 @@ OpResult<vector<OptSizeT>> OpArrLen(const OpArgs& op_args, string_view key, Json
     }
   };
 
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
   return vec;
 }
 
 OpResult<vector<OptBool>> OpToggle(const OpArgs& op_args, string_view key, string_view path,
-                                   JsonPathV2 expression) {
+                                   const JsonPathV2& expression) {
   vector<OptBool> vec;
   OpStatus status;
   auto cb = [&vec](optional<string_view>, JsonType* val) {
@@ -606,9 +763,24 @@ OpResult<vector<OptBool>> OpToggle(const OpArgs& op_args, string_view key, strin
     return false;
   };
 
+  // Booleans have a fixed size in flat values, so toggling them never needs to rebuild the buffer
+  auto patch = [&vec](const JsonType& val) -> optional<JsonType> {
+    if (!val.is_bool()) {
+      vec.emplace_back(nullopt);
+      return nullopt;
+    }
+    vec.emplace_back(!val.as_bool());
+    return JsonType(!val.as_bool());
+  };
+
   if (holds_alternative<json::Path>(expression)) {
     const json::Path& expr = std::get<json::Path>(expression);
-    status = UpdateEntry(op_args, key, expr, cb);
+    if (auto patched = PatchEntry(op_args, key, expr, patch); patched) {
+      status = *patched;
+    } else {
+      vec.clear();
+      status = UpdateEntry(op_args, key, expr, cb);
+    }
   } else {
     status = UpdateEntry(op_args, key, path, cb);
   }
@@ -646,7 +818,8 @@ void BinOpApply(double num, bool num_is_double, ArithmeticOpType op, JsonType* v
 }
 
 OpResult<string> OpDoubleArithmetic(const OpArgs& op_args, string_view key, string_view path,
-                                    double num, ArithmeticOpType op_type, JsonPathV2 expression) {
+                                    double num, ArithmeticOpType op_type,
+                                    const JsonPathV2& expression) {
   bool is_result_overflow = false;
   double int_part;
   bool has_fractional_part = (modf(num, &int_part) != 0);
@@ -668,9 +841,33 @@ OpResult<string> OpDoubleArithmetic(const OpArgs& op_args, string_view key, stri
     return false;
   };
 
+  // Results that keep the type of their numbers and fit into their bytes are patched in place
+  auto patch = [&](const JsonType& val) -> optional<JsonType> {
+    if (!val.is_number()) {
+      output.push_back(JsonType::null());
+      return nullopt;
+    }
+
+    JsonType next = val;
+    bool overflow = false;
+    BinOpApply(num, has_fractional_part, op_type, &next, &overflow);
+    if (overflow) {
+      is_result_overflow = true;
+      return nullopt;
+    }
+    output.push_back(next);
+    return next;
+  };
+
   if (holds_alternative<json::Path>(expression)) {
     const json::Path& path = std::get<json::Path>(expression);
-    status = UpdateEntry(op_args, key, path, std::move(cb));
+    if (auto patched = PatchEntry(op_args, key, path, patch); patched) {
+      status = *patched;
+    } else {
+      is_result_overflow = false;
+      output = JsonType(json_array_arg);
+      status = UpdateEntry(op_args, key, path, std::move(cb));
+    }
   } else {
     status = UpdateEntry(op_args, key, path, std::move(cb));
   }
@@ -687,22 +884,28 @@ OpResult<string> OpDoubleArithmetic(const OpArgs& op_args, string_view key, stri
 // If expression is nullopt, then the whole key should be deleted, otherwise deletes
 // items specified by the expression/path.
 OpResult<long> OpDel(const OpArgs& op_args, string_view key, string_view path,
-                     optional<JsonPathV2> expression) {
+                     const JsonPathV2* expression) {
   if (!expression || path.empty()) {
     auto& db_slice = op_args.shard->db_slice();
     auto it = db_slice.FindMutable(op_args.db_cntx, key).it;  // post_updater will run immediately
     return long(db_slice.Del(op_args.db_cntx.db_index, it));
   }
 
-  OpResult<JsonType*> result = GetJson(op_args, key);
-  if (!result) {
+  auto it_res = op_args.shard->db_slice().FindMutable(op_args.db_cntx, key, OBJ_JSON);
+  if (!it_res.ok()) {
     return 0;
   }
 
+  PrimeValue& pv = it_res->it->second;
+  JsonType tmp;
+  JsonType& json_entry = *StartMutation(pv, &tmp);
+
   if (holds_alternative<json::Path>(*expression)) {
     const json::Path& path = get<json::Path>(*expression);
     long deletions = json::MutatePath(
-        path, [](optional<string_view>, JsonType* val) { return true; }, *result);
+        path, [](optional<string_view>, JsonType* val) { return true; }, &json_entry);
+    if (deletions > 0)
+      FinishMutation(json_entry, &pv);
     return deletions;
   }
 
@@ -712,7 +915,6 @@ OpResult<long> OpDel(const OpArgs& op_args, string_view key, string_view path,
     return false;
   };
 
-  JsonType& json_entry = *(result.value());
   error_code ec = JsonReplace(json_entry, path, std::move(cb));
   if (ec) {
     VLOG(1) << "Failed to evaluate expression on json with error: " << ec.message();
@@ -738,6 +940,7 @@ OpResult<long> OpDel(const OpArgs& op_args, string_view key, string_view path,
     VLOG(1) << "Failed to apply patch on json with error: " << ec.message();
     return 0;
   }
+  FinishMutation(json_entry, &pv);
 
   // SetString(op_args, key, j.as_string());
   return total_deletions;
@@ -746,8 +949,8 @@ OpResult<long> OpDel(const OpArgs& op_args, string_view key, string_view path,
 // Returns a vector of string vectors,
 // keys within the same object are stored in the same string vector.
 OpResult<vector<StringVec>> OpObjKeys(const OpArgs& op_args, string_view key,
-                                      JsonPathV2 expression) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+                                      const JsonPathV2& expression) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
@@ -767,15 +970,14 @@ OpResult<vector<StringVec>> OpObjKeys(const OpArgs& op_args, string_view key,
       current_object.emplace_back(member.key());
     }
   };
-  JsonType& json_entry = *(result.value());
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
 
   return vec;
 }
 
 // Retruns array of string lengths after a successful operation.
 OpResult<vector<OptSizeT>> OpStrAppend(const OpArgs& op_args, string_view key, string_view path,
-                                       JsonPathV2 expression, facade::ArgRange strs) {
+                                       const JsonPathV2& expression, facade::ArgRange strs) {
   vector<OptSizeT> vec;
   OpStatus status;
   auto cb = [&](const auto&, JsonType* val) {
@@ -809,7 +1011,7 @@ OpResult<vector<OptSizeT>> OpStrAppend(const OpArgs& op_args, string_view key, s
 // Returns the numbers of values cleared.
 // Clears containers(arrays or objects) and zeroing numbers.
 OpResult<long> OpClear(const OpArgs& op_args, string_view key, string_view path,
-                       JsonPathV2 expression) {
+                       const JsonPathV2& expression) {
   long clear_items = 0;
   OpStatus status;
   auto cb = [&clear_items](const auto& path, JsonType* val) {
@@ -876,7 +1078,7 @@ void ArrayPop(std::optional<std::string_view>, int index, JsonType* val,
 
 // Returns string vector that represents the pop out values.
 OpResult<vector<OptString>> OpArrPop(const OpArgs& op_args, string_view key, string_view path,
-                                     int index, JsonPathV2 expression) {
+                                     int index, const JsonPathV2& expression) {
   vector<OptString> vec;
   OpStatus status;
   auto cb = [&vec, index](optional<string_view>, JsonType* val) {
@@ -898,7 +1100,8 @@ OpResult<vector<OptString>> OpArrPop(const OpArgs& op_args, string_view key, str
 
 // Returns numeric vector that represents the new length of the array at each path.
 OpResult<vector<OptSizeT>> OpArrTrim(const OpArgs& op_args, string_view key, string_view path,
-                                     JsonPathV2 expression, int start_index, int stop_index) {
+                                     const JsonPathV2& expression, int start_index,
+                                     int stop_index) {
   vector<OptSizeT> vec;
   OpStatus status;
   auto cb = [&](const auto&, JsonType* val) {
@@ -957,7 +1160,7 @@ OpResult<vector<OptSizeT>> OpArrTrim(const OpArgs& op_args, string_view key, str
 
 // Returns numeric vector that represents the new length of the array at each path.
 OpResult<vector<OptSizeT>> OpArrInsert(const OpArgs& op_args, string_view key, string_view path,
-                                       JsonPathV2 expression, int index,
+                                       const JsonPathV2& expression, int index,
                                        const vector<JsonType>& new_values) {
   bool out_of_boundaries_encountered = false;
   vector<OptSizeT> vec;
@@ -1030,12 +1233,12 @@ OpResult<vector<OptSizeT>> OpArrInsert(const OpArgs& op_args, string_view key, s
 // Returns numeric vector that represents the new length of the array at each path, or Null reply
 // if the matching JSON value is not an array.
 OpResult<vector<OptSizeT>> OpArrAppend(const OpArgs& op_args, string_view key, string_view path,
-                                       JsonPathV2 expression,
+                                       const JsonPathV2& expression,
                                        const vector<JsonType>& append_values) {
   vector<OptSizeT> vec;
   OpStatus status;
 
-  OpResult<JsonType*> result = GetJson(op_args, key);
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
@@ -1068,9 +1271,10 @@ OpResult<vector<OptSizeT>> OpArrAppend(const OpArgs& op_args, string_view key, s
 // Returns a numeric vector representing each JSON value first index of the JSON scalar.
 // An index value of -1 represents unfound in the array.
 // JSON scalar has types of string, boolean, null, and number.
-OpResult<vector<OptLong>> OpArrIndex(const OpArgs& op_args, string_view key, JsonPathV2 expression,
-                                     const JsonType& search_val, int start_index, int end_index) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+OpResult<vector<OptLong>> OpArrIndex(const OpArgs& op_args, string_view key,
+                                     const JsonPathV2& expression, const JsonType& search_val,
+                                     int start_index, int end_index) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
@@ -1124,8 +1328,7 @@ OpResult<vector<OptLong>> OpArrIndex(const OpArgs& op_args, string_view key, Jso
 
     vec.emplace_back(pos);
   };
-  JsonType& json_entry = *(result.value());
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
   return vec;
 }
 
@@ -1145,16 +1348,13 @@ vector<OptString> OpJsonMGet(const JsonPathV2& expression, const Transaction* t,
       continue;
 
     dest.emplace();
-    JsonType* json_val = it_res.value()->second.GetJson();
-    DCHECK(json_val) << "should have a valid JSON object for key " << key;
 
     vector<JsonType> query_result;
     auto cb = [&query_result](const string_view& path, const JsonType& val) {
       query_result.push_back(val);
     };
 
-    const JsonType& json_entry = *(json_val);
-    visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+    Evaluate(expression, GetJsonRef(it_res.value()->second), cb);
 
     if (query_result.empty()) {
       continue;
@@ -1180,8 +1380,9 @@ vector<OptString> OpJsonMGet(const JsonPathV2& expression, const Transaction* t,
 }
 
 // Returns numeric vector that represents the number of fields of JSON value at each path.
-OpResult<vector<OptSizeT>> OpFields(const OpArgs& op_args, string_view key, JsonPathV2 expression) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+OpResult<vector<OptSizeT>> OpFields(const OpArgs& op_args, string_view key,
+                                    const JsonPathV2& expression) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
@@ -1190,22 +1391,21 @@ OpResult<vector<OptSizeT>> OpFields(const OpArgs& op_args, string_view key, Json
   auto cb = [&vec](const string_view& path, const JsonType& val) {
     vec.emplace_back(CountJsonFields(val));
   };
-  const JsonType& json_entry = *(result.value());
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
   return vec;
 }
 
 // Returns json vector that represents the result of the json query.
-OpResult<vector<JsonType>> OpResp(const OpArgs& op_args, string_view key, JsonPathV2 expression) {
-  OpResult<JsonType*> result = GetJson(op_args, key);
+OpResult<vector<JsonType>> OpResp(const OpArgs& op_args, string_view key,
+                                  const JsonPathV2& expression) {
+  OpResult<JsonRef> result = GetJson(op_args, key);
   if (!result) {
     return result.status();
   }
 
   vector<JsonType> vec;
   auto cb = [&vec](const string_view& path, const JsonType& val) { vec.emplace_back(val); };
-  const JsonType& json_entry = *(result.value());
-  visit([&](auto&& arg) { Evaluate(arg, json_entry, cb); }, expression);
+  Evaluate(expression, *result, cb);
   return vec;
 }
 
@@ -1283,6 +1483,23 @@ OpResult<bool> OpSet(const OpArgs& op_args, string_view key, string_view path,
     return OpStatus::OK;
   };
 
+  // Existing scalars of flat values are overwritten in place if the new value fits
+  if (!is_nx_condition && absl::GetFlag(FLAGS_experimental_flat_json)) {
+    if (auto json_path = json::ParsePath(path); json_path) {
+      auto patch = [&](const JsonType&) -> optional<JsonType> {
+        path_exists = true;
+        return new_json;
+      };
+
+      optional<OpStatus> patched = PatchEntry(op_args, key, *json_path, patch);
+      if (patched && *patched != OpStatus::OK)
+        return *patched;
+      if (patched && path_exists)
+        return true;
+      path_exists = false;
+    }
+  }
+
   OpStatus status = UpdateEntry(op_args, key, path, cb, inserter);
   if (status != OpStatus::OK) {
     return status;
@@ -1358,8 +1575,10 @@ OpStatus OpMerge(const OpArgs& op_args, string_view key, std::string_view json_s
   if (it_res.ok()) {
     op_args.shard->search_indices()->RemoveDoc(key, op_args.db_cntx, it_res->it->second);
 
-    JsonType* obj = it_res->it->second.GetJson();
+    JsonType tmp;
+    JsonType* obj = StartMutation(it_res->it->second, &tmp);
     RecursiveMerge(*parsed_json, obj);
+    FinishMutation(*obj, &it_res->it->second);
     it_res->post_updater.Run();
     op_args.shard->search_indices()->AddDoc(key, op_args.db_cntx, it_res->it->second);
     return OpStatus::OK;
@@ -1374,7 +1593,63 @@ OpStatus OpMerge(const OpArgs& op_args, string_view key, std::string_view json_s
   return OpSet(op_args, key, "$", json_str, false, false).status();
 }
 
-io::Result<JsonPathV2, string> ParsePathV2(string_view path) {
+// Parsed paths of the current thread by path string, evicting the least recently used ones.
+// Paths are shared with the commands that use them, so eviction never pulls a path from under
+// a running command.
+class PathCache {
+ public:
+  explicit PathCache(uint32_t capacity)
+      : lru_(capacity, PMR_NS::get_default_resource()), capacity_(capacity) {
+  }
+
+  // Returns nullptr if path is not cached or was parsed by the other implementation
+  JsonPathPtr Find(string_view path, bool v2) {
+    auto it = entries_.find(path);
+    if (it == entries_.end() || holds_alternative<json::Path>(*it->second) != v2)
+      return nullptr;
+
+    lru_.Put(it->first, Position::kHead);
+    return it->second;
+  }
+
+  void Insert(string_view path, JsonPathPtr expr) {
+    auto [it, inserted] = entries_.try_emplace(string{path}, std::move(expr));
+    if (!inserted) {
+      it->second = std::move(expr);
+      return;
+    }
+
+    lru_.Put(it->first, Position::kHead);
+    if (entries_.size() > capacity_) {
+      string_view tail = *lru_.GetTail();
+      lru_.Remove(tail);
+      entries_.erase(entries_.find(tail));
+    }
+  }
+
+ private:
+  absl::node_hash_map<string, JsonPathPtr> entries_;  // nodes keep the keys referenced by lru_
+  Lru<string_view> lru_;
+  uint32_t capacity_;
+};
+
+io::Result<JsonPathPtr, string> ParsePathUncached(string_view path, bool v2) {
+  if (v2) {
+    auto path_result = json::ParsePath(path);
+    if (!path_result) {
+      return nonstd::make_unexpected(std::move(path_result.error()));
+    }
+    return make_shared<const JsonPathV2>(std::move(path_result.value()));
+  }
+
+  io::Result<JsonExpression> expr_result = ParseJsonPath(path);
+  if (!expr_result) {
+    return nonstd::make_unexpected(kSyntaxErr);
+  }
+  return make_shared<const JsonPathV2>(std::move(expr_result.value()));
+}
+
+io::Result<JsonPathPtr, string> ParsePathV2(string_view path) {
   // We expect all valid paths to start with the root selector, otherwise prepend it
   string tmp_buf;
   if (!path.empty() && path.front() != '$') {
@@ -1382,14 +1657,26 @@ io::Result<JsonPathV2, string> ParsePathV2(string_view path) {
     path = tmp_buf;
   }
 
-  if (absl::GetFlag(FLAGS_jsonpathv2)) {
-    return json::ParsePath(path);
+  bool v2 = absl::GetFlag(FLAGS_jsonpathv2);
+  uint32_t capacity = absl::GetFlag(FLAGS_json_path_cache_size);
+  if (capacity < 2) {  // Lru needs at least two entries
+    return ParsePathUncached(path, v2);
   }
-  io::Result<JsonExpression> expr_result = ParseJsonPath(path);
-  if (!expr_result) {
-    return nonstd::make_unexpected(kSyntaxErr);
+
+  thread_local std::unique_ptr<PathCache> cache;
+  if (!cache) {
+    cache = std::make_unique<PathCache>(capacity);
   }
-  return JsonPathV2(std::move(expr_result.value()));
+
+  if (JsonPathPtr cached = cache->Find(path, v2); cached) {
+    return cached;
+  }
+
+  auto result = ParsePathUncached(path, v2);
+  if (result) {
+    cache->Insert(path, *result);  // Errors are not cached
+  }
+  return result;
 }
 
 }  // namespace
@@ -1494,10 +1781,10 @@ void JsonFamily::Resp(CmdArgList args, ConnectionContext* cntx) {
     path = ArgS(args, 1);
   }
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpResp(t->GetOpArgs(shard), key, std::move(expression));
+    return OpResp(t->GetOpArgs(shard), key, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1541,10 +1828,10 @@ void JsonFamily::Debug(CmdArgList args, ConnectionContext* cntx) {
 
   string_view key = ArgS(args, 1);
   string_view path = ArgS(args, 2);
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return func(t->GetOpArgs(shard), key, std::move(expression));
+    return func(t->GetOpArgs(shard), key, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1561,7 +1848,7 @@ void JsonFamily::MGet(CmdArgList args, ConnectionContext* cntx) {
   DCHECK_GE(args.size(), 1U);
 
   string_view path = ArgS(args, args.size() - 1);
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   Transaction* transaction = cntx->transaction;
   unsigned shard_count = shard_set->size();
@@ -1569,7 +1856,7 @@ void JsonFamily::MGet(CmdArgList args, ConnectionContext* cntx) {
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
     ShardId sid = shard->shard_id();
-    mget_resp[sid] = OpJsonMGet(expression, t, shard);
+    mget_resp[sid] = OpJsonMGet(*expression, t, shard);
     return OpStatus::OK;
   };
 
@@ -1608,7 +1895,7 @@ void JsonFamily::ArrIndex(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   optional<JsonType> search_value = JsonFromString(ArgS(args, 2));
   if (!search_value) {
@@ -1640,7 +1927,7 @@ void JsonFamily::ArrIndex(CmdArgList args, ConnectionContext* cntx) {
   }
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpArrIndex(t->GetOpArgs(shard), key, std::move(expression), *search_value, start_index,
+    return OpArrIndex(t->GetOpArgs(shard), key, *expression, *search_value, start_index,
                       end_index);
   };
 
@@ -1665,7 +1952,7 @@ void JsonFamily::ArrInsert(CmdArgList args, ConnectionContext* cntx) {
     return;
   }
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   vector<JsonType> new_values;
   for (size_t i = 3; i < args.size(); i++) {
@@ -1679,7 +1966,7 @@ void JsonFamily::ArrInsert(CmdArgList args, ConnectionContext* cntx) {
   }
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpArrInsert(t->GetOpArgs(shard), key, path, std::move(expression), index, new_values);
+    return OpArrInsert(t->GetOpArgs(shard), key, path, *expression, index, new_values);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1695,7 +1982,7 @@ void JsonFamily::ArrAppend(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   vector<JsonType> append_values;
 
@@ -1711,7 +1998,7 @@ void JsonFamily::ArrAppend(CmdArgList args, ConnectionContext* cntx) {
   }
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpArrAppend(t->GetOpArgs(shard), key, path, std::move(expression), append_values);
+    return OpArrAppend(t->GetOpArgs(shard), key, path, *expression, append_values);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1746,10 +2033,10 @@ void JsonFamily::ArrTrim(CmdArgList args, ConnectionContext* cntx) {
     return;
   }
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpArrTrim(t->GetOpArgs(shard), key, path, std::move(expression), start_index,
+    return OpArrTrim(t->GetOpArgs(shard), key, path, *expression, start_index,
                      stop_index);
   };
 
@@ -1774,10 +2061,10 @@ void JsonFamily::ArrPop(CmdArgList args, ConnectionContext* cntx) {
     }
   }
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpArrPop(t->GetOpArgs(shard), key, path, index, std::move(expression));
+    return OpArrPop(t->GetOpArgs(shard), key, path, index, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1801,10 +2088,10 @@ void JsonFamily::Clear(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpClear(t->GetOpArgs(shard), key, path, std::move(expression));
+    return OpClear(t->GetOpArgs(shard), key, path, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1821,11 +2108,11 @@ void JsonFamily::StrAppend(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
   auto strs = args.subspan(2);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpStrAppend(t->GetOpArgs(shard), key, path, std::move(expression),
+    return OpStrAppend(t->GetOpArgs(shard), key, path, *expression,
                        facade::ArgRange{strs});
   };
 
@@ -1846,10 +2133,10 @@ void JsonFamily::ObjKeys(CmdArgList args, ConnectionContext* cntx) {
     path = ArgS(args, 1);
   }
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpObjKeys(t->GetOpArgs(shard), key, std::move(expression));
+    return OpObjKeys(t->GetOpArgs(shard), key, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1873,11 +2160,11 @@ void JsonFamily::Del(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path;
 
-  optional<JsonPathV2> expression;
+  JsonPathPtr expression;
 
   if (args.size() > 1) {
     path = ArgS(args, 1);
-    expression.emplace(PARSE_PATHV2(path));
+    expression = PARSE_PATHV2(path);
   }
 
   if (path == "$" || path == ".") {
@@ -1885,7 +2172,7 @@ void JsonFamily::Del(CmdArgList args, ConnectionContext* cntx) {
   }
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpDel(t->GetOpArgs(shard), key, path, std::move(expression));
+    return OpDel(t->GetOpArgs(shard), key, path, expression.get());
   };
 
   Transaction* trans = cntx->transaction;
@@ -1904,10 +2191,10 @@ void JsonFamily::NumIncrBy(CmdArgList args, ConnectionContext* cntx) {
     return;
   }
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpDoubleArithmetic(t->GetOpArgs(shard), key, path, dnum, OP_ADD, std::move(expression));
+    return OpDoubleArithmetic(t->GetOpArgs(shard), key, path, dnum, OP_ADD, *expression);
   };
 
   OpResult<string> result = cntx->transaction->ScheduleSingleHopT(std::move(cb));
@@ -1931,11 +2218,11 @@ void JsonFamily::NumMultBy(CmdArgList args, ConnectionContext* cntx) {
     return;
   }
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
     return OpDoubleArithmetic(t->GetOpArgs(shard), key, path, dnum, OP_MULTIPLY,
-                              std::move(expression));
+                              *expression);
   };
 
   auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
@@ -1952,10 +2239,10 @@ void JsonFamily::Toggle(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpToggle(t->GetOpArgs(shard), key, path, std::move(expression));
+    return OpToggle(t->GetOpArgs(shard), key, path, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -1972,10 +2259,10 @@ void JsonFamily::Type(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpType(t->GetOpArgs(shard), key, std::move(expression));
+    return OpType(t->GetOpArgs(shard), key, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -2001,10 +2288,10 @@ void JsonFamily::ArrLen(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpArrLen(t->GetOpArgs(shard), key, std::move(expression));
+    return OpArrLen(t->GetOpArgs(shard), key, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -2021,10 +2308,10 @@ void JsonFamily::ObjLen(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpObjLen(t->GetOpArgs(shard), key, std::move(expression));
+    return OpObjLen(t->GetOpArgs(shard), key, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -2041,10 +2328,10 @@ void JsonFamily::StrLen(CmdArgList args, ConnectionContext* cntx) {
   string_view key = ArgS(args, 0);
   string_view path = ArgS(args, 1);
 
-  JsonPathV2 expression = PARSE_PATHV2(path);
+  JsonPathPtr expression = PARSE_PATHV2(path);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    return OpStrLen(t->GetOpArgs(shard), key, std::move(expression));
+    return OpStrLen(t->GetOpArgs(shard), key, *expression);
   };
 
   Transaction* trans = cntx->transaction;
@@ -2067,8 +2354,8 @@ void JsonFamily::Get(CmdArgList args, ConnectionContext* cntx) {
   OptString new_line;
   OptString space;
 
-  // '.' corresponds to the legacy, non-array format and is passed as nullopt.
-  vector<pair<string_view, optional<JsonPathV2>>> expressions;
+  // '.' corresponds to the legacy, non-array format and is passed as nullptr.
+  vector<pair<string_view, JsonPathPtr>> expressions;
 
   while (parser.HasNext()) {
     if (parser.Check("SPACE").IgnoreCase().ExpectTail(1)) {
@@ -2084,12 +2371,11 @@ void JsonFamily::Get(CmdArgList args, ConnectionContext* cntx) {
       continue;
     }
 
-    optional<JsonPathV2> expr;
+    JsonPathPtr expr;
     string_view expr_str = parser.Next();
 
     if (expr_str != ".") {
-      JsonPathV2 expression = PARSE_PATHV2(expr_str);
-      expr.emplace(std::move(expression));
+      expr = PARSE_PATHV2(expr_str);
     }
 
     expressions.emplace_back(expr_str, std::move(expr));
@@ -2104,10 +2390,10 @@ void JsonFamily::Get(CmdArgList args, ConnectionContext* cntx) {
   };
 
   Transaction* trans = cntx->transaction;
-  OpResult<string> result = trans->ScheduleSingleHopT(std::move(cb));
+  OpResult<facade::ReplyChunks> result = trans->ScheduleSingleHopT(std::move(cb));
   auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
   if (result) {
-    rb->SendBulkString(*result);
+    rb->SendBulkChunks(*result);
   } else {
     if (result == facade::OpStatus::KEY_NOTFOUND) {
       rb->SendNull();  // Match Redis
@@ -4,6 +4,7 @@
 
 #include "server/json_family.h"
 
+#include <absl/strings/str_join.h>
 #include <absl/strings/str_replace.h>
 
 #include <jsoncons/json.hpp>
@@ -14,6 +15,10 @@
 #include "server/command_registry.h"
 #include "server/test_utils.h"
 
+ABSL_DECLARE_FLAG(bool, experimental_flat_json);
+ABSL_DECLARE_FLAG(bool, jsonpathv2);
+ABSL_DECLARE_FLAG(uint32_t, json_path_cache_size);
+
 using namespace testing;
 using namespace std;
 using namespace util;
@@ -1133,4 +1138,102 @@ TEST_F(JsonFamilyTest, Merge) {
   EXPECT_EQ(resp, R"([{"a":"z","c":{"d":"e"}}])");
 }
 
+TEST_F(JsonFamilyTest, FlatEncoding) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_experimental_flat_json, true);
+
+  string json = R"({"a":1,"b":2.5,"c":"foo","d":[true,false],"e":[1,2],"f":{"g":null}})";
+  auto resp = Run({"JSON.SET", "json", ".", json});
+  ASSERT_THAT(resp, "OK");
+
+  resp = Run({"JSON.GET", "json"});
+  EXPECT_EQ(resp, json);
+
+  resp = Run({"JSON.GET", "json", "$.e[*]"});
+  EXPECT_EQ(resp, "[1,2]");
+
+  // Scalars are patched in place
+  resp = Run({"JSON.TOGGLE", "json", "$.d[*]"});
+  ASSERT_EQ(RespExpr::ARRAY, resp.type);
+  EXPECT_THAT(resp.GetVec(), ElementsAre(IntArg(0), IntArg(1)));
+
+  resp = Run({"JSON.NUMINCRBY", "json", "$.e[*]", "2"});
+  EXPECT_EQ(resp, "[3,4]");
+
+  resp = Run({"JSON.SET", "json", "$.c", R"("bar")"});
+  ASSERT_THAT(resp, "OK");
+
+  // Wider numbers and longer strings rebuild the buffer
+  resp = Run({"JSON.NUMINCRBY", "json", "$.e[*]", "100000"});
+  EXPECT_EQ(resp, "[100003,100004]");
+
+  resp = Run({"JSON.SET", "json", "$.c", R"("longer")"});
+  ASSERT_THAT(resp, "OK");
+
+  // Structural changes
+  resp = Run({"JSON.ARRAPPEND", "json", "$.d", "true"});
+  EXPECT_THAT(resp, IntArg(3));
+
+  resp = Run({"JSON.DEL", "json", "$.f"});
+  EXPECT_THAT(resp, IntArg(1));
+
+  resp = Run({"JSON.SET", "json", "$.h", "[]"});
+  ASSERT_THAT(resp, "OK");
+
+  resp = Run({"JSON.GET", "json"});
+  EXPECT_EQ(resp,
+            R"({"a":1,"b":2.5,"c":"longer","d":[false,true,true],"e":[100003,100004],"h":[]})");
+
+  resp = Run({"JSON.TYPE", "json", "$.*"});
+  ASSERT_EQ(RespExpr::ARRAY, resp.type);
+  EXPECT_THAT(resp.GetVec(), ElementsAre("integer", "number", "string", "array", "array", "array"));
+}
+
+TEST_F(JsonFamilyTest, GetLarge) {
+  // Output spans many reply chunks
+  vector<string> items;
+  for (unsigned i = 0; i < 20000; i++)
+    items.push_back(absl::StrCat(R"({"id":)", i, R"(,"name":"item)", i, R"("})"));
+  string json = absl::StrCat(R"({"items":[)", absl::StrJoin(items, ","), "]}");
+
+  auto resp = Run({"JSON.SET", "json", ".", json});
+  ASSERT_THAT(resp, "OK");
+
+  EXPECT_EQ(Run({"JSON.GET", "json"}), json);
+  EXPECT_EQ(Run({"JSON.GET", "json", "."}), json);
+  EXPECT_EQ(Run({"JSON.GET", "json", "$.items[*]"}),
+            absl::StrCat("[", absl::StrJoin(items, ","), "]"));
+  EXPECT_EQ(Run({"JSON.GET", "json", "$.items[1].name"}), R"(["item1"])");
+}
+
+TEST_F(JsonFamilyTest, PathCache) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_json_path_cache_size, 2);
+
+  auto resp = Run({"JSON.SET", "json", ".", R"({"a":1,"b":[2],"c":"foo"})"});
+  ASSERT_THAT(resp, "OK");
+
+  // Paths are evicted and parsed again while they are used
+  for (unsigned i = 0; i < 3; i++) {
+    EXPECT_EQ(Run({"JSON.GET", "json", "$.a"}), "[1]");
+    EXPECT_EQ(Run({"JSON.GET", "json", "$.b[0]"}), "[2]");
+    EXPECT_EQ(Run({"JSON.GET", "json", "c"}), R"(["foo"])");
+  }
+
+  // Errors are not cached
+  EXPECT_THAT(Run({"JSON.GET", "json", "$["}), ArgType(RespExpr::ERROR));
+  EXPECT_THAT(Run({"JSON.GET", "json", "$["}), ArgType(RespExpr::ERROR));
+
+  // Cached paths are replaced when the implementation changes
+  absl::SetFlag(&FLAGS_jsonpathv2, false);
+  EXPECT_EQ(Run({"JSON.GET", "json", "$.a"}), "[1]");
+  absl::SetFlag(&FLAGS_jsonpathv2, true);
+  EXPECT_EQ(Run({"JSON.GET", "json", "$.a"}), "[1]");
+
+  // Mutations keep working with shared paths
+  resp = Run({"JSON.NUMINCRBY", "json", "$.a", "1"});
+  EXPECT_EQ(resp, "[2]");
+  EXPECT_EQ(Run({"JSON.GET", "json", "$.a"}), "[2]");
+}
+
 }  // namespace dfly
@@ -13,6 +13,7 @@ extern "C" {
 
 #include "base/flags.h"
 #include "base/logging.h"
+#include "core/qlist.h"
 #include "server/blocking_controller.h"
 #include "server/command_registry.h"
 #include "server/conn_context.h"
@@ -59,6 +60,10 @@ ABSL_FLAG(int32_t, list_max_listpack_size, -2, "Maximum listpack size, default i
 
 ABSL_FLAG(int32_t, list_compress_depth, 0, "Compress depth of the list. Default is no compression");
 
+ABSL_FLAG(bool, list_experimental_v2, false,
+          "If true, new lists are encoded as chunked lists with a positional index instead of "
+          "quicklist. list_compress_depth does not apply to them");
+
 namespace dfly {
 
 using namespace std;
@@ -72,6 +77,36 @@ quicklist* GetQL(const PrimeValue& mv) {
   return (quicklist*)mv.RObjPtr();
 }
 
+QList* GetQLV2(const PrimeValue& mv) {
+  return (QList*)mv.RObjPtr();
+}
+
+bool IsQLV2(const PrimeValue& mv) {
+  return mv.Encoding() == kEncodingQL2;
+}
+
+QList::Where ToWhere(ListDir dir) {
+  return dir == ListDir::LEFT ? QList::HEAD : QList::TAIL;
+}
+
+void InitList(PrimeValue* pv) {
+  if (GetFlag(FLAGS_list_experimental_v2)) {
+    QList* ql = CompactObj::AllocateMR<QList>(GetFlag(FLAGS_list_max_listpack_size),
+                                              CompactObj::memory_resource());
+    pv->InitRobj(OBJ_LIST, kEncodingQL2, ql);
+    return;
+  }
+
+  quicklist* ql = quicklistCreate();
+  quicklistSetOptions(ql, GetFlag(FLAGS_list_max_listpack_size),
+                      GetFlag(FLAGS_list_compress_depth));
+  pv->InitRobj(OBJ_LIST, OBJ_ENCODING_QUICKLIST, ql);
+}
+
+size_t ListLen(const PrimeValue& pv) {
+  return IsQLV2(pv) ? GetQLV2(pv)->Size() : quicklistCount(GetQL(pv));
+}
+
 void* listPopSaver(unsigned char* data, size_t sz) {
   return new string((char*)data, sz);
 }
@@ -98,6 +133,22 @@ string ListPop(ListDir dir, quicklist* ql) {
   return res;
 }
 
+string ListPop(ListDir dir, const PrimeValue& pv) {
+  if (IsQLV2(pv))
+    return GetQLV2(pv)->Pop(ToWhere(dir));
+  return ListPop(dir, GetQL(pv));
+}
+
+void ListPush(ListDir dir, string_view val, const PrimeValue& pv) {
+  if (IsQLV2(pv)) {
+    GetQLV2(pv)->Push(val, ToWhere(dir));
+    return;
+  }
+
+  int pos = (dir == ListDir::LEFT) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+  quicklistPush(GetQL(pv), (void*)val.data(), val.size(), pos);
+}
+
 optional<ListDir> ParseDir(string_view arg) {
   if (arg == "LEFT") {
     return ListDir::LEFT;
@@ -199,14 +250,13 @@ std::string OpBPop(Transaction* t, EngineShard* shard, std::string_view key, Lis
   CHECK(it_res) << t->DebugId() << " " << key;  // must exist and must be ok.
 
   auto it = it_res->it;
-  quicklist* ql = GetQL(it->second);
 
   absl::StrAppend(debugMessages.Next(), "OpBPop: ", key, " by ", t->DebugId());
 
-  std::string value = ListPop(dir, ql);
+  std::string value = ListPop(dir, it->second);
   it_res->post_updater.Run();
 
-  if (quicklistCount(ql) == 0) {
+  if (ListLen(it->second) == 0) {
     DVLOG(1) << "deleting key " << key << " " << t->DebugId();
     absl::StrAppend(debugMessages.Next(), "OpBPop Del: ", key, " by ", t->DebugId());
 
@@ -229,18 +279,14 @@ OpResult<string> OpMoveSingleShard(const OpArgs& op_args, string_view src, strin
     return src_res.status();
 
   auto src_it = src_res->it;
-  quicklist* src_ql = GetQL(src_it->second);
 
   if (src == dest) {  // simple case.
-    string val = ListPop(src_dir, src_ql);
-
-    int pos = (dest_dir == ListDir::LEFT) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
-    quicklistPush(src_ql, val.data(), val.size(), pos);
+    string val = ListPop(src_dir, src_it->second);
+    ListPush(dest_dir, val, src_it->second);
 
     return val;
   }
 
-  quicklist* dest_ql = nullptr;
   src_res->post_updater.Run();
   auto op_res = db_slice.AddOrFind(op_args.db_cntx, dest);
   RETURN_ON_BAD_STATUS(op_res);
@@ -251,26 +297,20 @@ OpResult<string> OpMoveSingleShard(const OpArgs& op_args, string_view src, strin
   src_it = src_res->it;
 
   if (dest_res.is_new) {
-    dest_ql = quicklistCreate();
-    quicklistSetOptions(dest_ql, GetFlag(FLAGS_list_max_listpack_size),
-                        GetFlag(FLAGS_list_compress_depth));
-    dest_res.it->second.InitRobj(OBJ_LIST, OBJ_ENCODING_QUICKLIST, dest_ql);
+    InitList(&dest_res.it->second);
     DCHECK(IsValid(src_it));
   } else {
     if (dest_res.it->second.ObjType() != OBJ_LIST)
       return OpStatus::WRONG_TYPE;
-
-    dest_ql = GetQL(dest_res.it->second);
   }
 
-  string val = ListPop(src_dir, src_ql);
-  int pos = (dest_dir == ListDir::LEFT) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
-  quicklistPush(dest_ql, val.data(), val.size(), pos);
+  string val = ListPop(src_dir, src_it->second);
+  ListPush(dest_dir, val, dest_res.it->second);
 
   src_res->post_updater.Run();
   dest_res.post_updater.Run();
 
-  if (quicklistCount(src_ql) == 0) {
+  if (ListLen(src_it->second) == 0) {
     CHECK(db_slice.Del(op_args.db_cntx.db_index, src_it));
   }
 
@@ -288,7 +328,14 @@ OpResult<string> Peek(const OpArgs& op_args, string_view key, ListDir dir, bool
   if (!fetch)
     return OpStatus::OK;
 
-  quicklist* ql = GetQL(it_res.value()->second);
+  const PrimeValue& pv = it_res.value()->second;
+  if (IsQLV2(pv)) {
+    auto entry = GetQLV2(pv)->Get(dir == ListDir::LEFT ? 0 : -1);
+    CHECK(entry);
+    return entry->to_string();
+  }
+
+  quicklist* ql = GetQL(pv);
   quicklistEntry entry = container_utils::QLEntry();
   quicklistIter* iter = (dir == ListDir::LEFT) ? quicklistGetIterator(ql, AL_START_HEAD)
                                                : quicklistGetIterator(ql, AL_START_TAIL);
@@ -317,26 +364,30 @@ OpResult<uint32_t> OpPush(const OpArgs& op_args, std::string_view key, ListDir d
     res = std::move(*op_res);
   }
 
-  quicklist* ql = nullptr;
   DVLOG(1) << "OpPush " << key << " new_key " << res.is_new;
 
   if (res.is_new) {
-    ql = quicklistCreate();
-    quicklistSetOptions(ql, GetFlag(FLAGS_list_max_listpack_size),
-                        GetFlag(FLAGS_list_compress_depth));
-    res.it->second.InitRobj(OBJ_LIST, OBJ_ENCODING_QUICKLIST, ql);
+    InitList(&res.it->second);
   } else {
     if (res.it->second.ObjType() != OBJ_LIST)
       return OpStatus::WRONG_TYPE;
-    ql = GetQL(res.it->second);
   }
 
-  // Left push is LIST_HEAD.
-  int pos = (dir == ListDir::LEFT) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
+  const PrimeValue& pv = res.it->second;
+  if (IsQLV2(pv)) {
+    QList* ql = GetQLV2(pv);
+    for (string_view v : vals)
+      ql->Push(v, ToWhere(dir));
+  } else {
+    quicklist* ql = GetQL(pv);
+
+    // Left push is LIST_HEAD.
+    int pos = (dir == ListDir::LEFT) ? QUICKLIST_HEAD : QUICKLIST_TAIL;
 
-  for (string_view v : vals) {
-    es->tmp_str1 = sdscpylen(es->tmp_str1, v.data(), v.size());
-    quicklistPush(ql, es->tmp_str1, sdslen(es->tmp_str1), pos);
+    for (string_view v : vals) {
+      es->tmp_str1 = sdscpylen(es->tmp_str1, v.data(), v.size());
+      quicklistPush(ql, es->tmp_str1, sdslen(es->tmp_str1), pos);
+    }
   }
 
   if (res.is_new) {
@@ -358,7 +409,7 @@ OpResult<uint32_t> OpPush(const OpArgs& op_args, std::string_view key, ListDir d
     RecordJournal(op_args, command, mapped, 2);
   }
 
-  return quicklistCount(ql);
+  return ListLen(pv);
 }
 
 OpResult<StringVec> OpPop(const OpArgs& op_args, string_view key, ListDir dir, uint32_t count,
@@ -369,27 +420,26 @@ OpResult<StringVec> OpPop(const OpArgs& op_args, string_view key, ListDir dir, u
     return it_res.status();
 
   auto it = it_res->it;
-  quicklist* ql = GetQL(it->second);
 
   StringVec res;
-  if (quicklistCount(ql) < count) {
-    count = quicklistCount(ql);
+  if (ListLen(it->second) < count) {
+    count = ListLen(it->second);
   }
   res.reserve(count);
 
   if (return_results) {
     for (unsigned i = 0; i < count; ++i) {
-      res.push_back(ListPop(dir, ql));
+      res.push_back(ListPop(dir, it->second));
     }
   } else {
     for (unsigned i = 0; i < count; ++i) {
-      ListPop(dir, ql);
+      ListPop(dir, it->second);
     }
   }
 
   it_res->post_updater.Run();
 
-  if (quicklistCount(ql) == 0) {
+  if (ListLen(it->second) == 0) {
     absl::StrAppend(debugMessages.Next(), "OpPop Del: ", key, " by ", op_args.tx->DebugId());
     CHECK(db_slice.Del(op_args.db_cntx.db_index, it));
   }
@@ -468,16 +518,23 @@ OpResult<uint32_t> OpLen(const OpArgs& op_args, std::string_view key) {
   if (!res)
     return res.status();
 
-  quicklist* ql = GetQL(res.value()->second);
-
-  return quicklistCount(ql);
+  return ListLen(res.value()->second);
 }
 
 OpResult<string> OpIndex(const OpArgs& op_args, std::string_view key, long index) {
   auto res = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key, OBJ_LIST);
   if (!res)
     return res.status();
-  quicklist* ql = GetQL(res.value()->second);
+
+  const PrimeValue& pv = res.value()->second;
+  if (IsQLV2(pv)) {
+    auto entry = GetQLV2(pv)->Get(index);
+    if (!entry)
+      return OpStatus::KEY_NOTFOUND;
+    return entry->to_string();
+  }
+
+  quicklist* ql = GetQL(pv);
   quicklistEntry entry = container_utils::QLEntry();
   quicklistIter* iter = quicklistGetIteratorAtIdx(ql, AL_START_TAIL, index);
   if (!iter)
@@ -508,13 +565,30 @@ OpResult<vector<uint32_t>> OpPos(const OpArgs& op_args, std::string_view key,
     direction = AL_START_TAIL;
   }
 
-  quicklist* ql = GetQL(it_res.value()->second);
-  quicklistIter* ql_iter = quicklistGetIterator(ql, direction);
-  quicklistEntry entry;
-
   int index = 0;
   int matched = 0;
   vector<uint32_t> matches;
+
+  const PrimeValue& pv = it_res.value()->second;
+  if (IsQLV2(pv)) {
+    QList* ql = GetQLV2(pv);
+    auto cb = [&](size_t pos) {
+      matched++;
+      if (matched >= rank) {
+        matches.push_back(pos);
+        if (count && matched - rank + 1 >= count)
+          return false;
+      }
+      return true;
+    };
+
+    ql->Find(element, direction == AL_START_HEAD ? QList::HEAD : QList::TAIL, max_len, cb);
+    return matches;
+  }
+
+  quicklist* ql = GetQL(pv);
+  quicklistIter* ql_iter = quicklistGetIterator(ql, direction);
+  quicklistEntry entry;
   string str;
 
   while (quicklistNext(ql_iter, &entry) && (max_len == 0 || index < max_len)) {
@@ -546,7 +620,16 @@ OpResult<int> OpInsert(const OpArgs& op_args, string_view key, string_view pivot
   if (!it_res)
     return it_res.status();
 
-  quicklist* ql = GetQL(it_res->it->second);
+  const PrimeValue& pv = it_res->it->second;
+  if (IsQLV2(pv)) {
+    QList* ql = GetQLV2(pv);
+    QList::InsertOpt opt = insert_param == INSERT_AFTER ? QList::AFTER : QList::BEFORE;
+    if (!ql->Insert(pivot, elem, opt))
+      return -1;
+    return int(ql->Size());
+  }
+
+  quicklist* ql = GetQL(pv);
   quicklistEntry entry = container_utils::QLEntry();
   quicklistIter* qiter = quicklistGetIterator(ql, AL_START_HEAD);
   bool found = false;
@@ -579,7 +662,6 @@ OpResult<uint32_t> OpRem(const OpArgs& op_args, string_view key, string_view ele
     return it_res.status();
 
   auto it = it_res->it;
-  quicklist* ql = GetQL(it->second);
 
   int iter_direction = AL_START_HEAD;
   long long index = 0;
@@ -589,6 +671,19 @@ OpResult<uint32_t> OpRem(const OpArgs& op_args, string_view key, string_view ele
     index = -1;
   }
 
+  if (IsQLV2(it->second)) {
+    QList* ql = GetQLV2(it->second);
+    unsigned removed =
+        ql->Remove(elem, count, iter_direction == AL_START_HEAD ? QList::HEAD : QList::TAIL);
+    it_res->post_updater.Run();
+
+    if (ql->Size() == 0) {
+      CHECK(db_slice.Del(op_args.db_cntx.db_index, it));
+    }
+    return removed;
+  }
+
+  quicklist* ql = GetQL(it->second);
   quicklistIter* qiter = quicklistGetIteratorAtIdx(ql, iter_direction, index);
   quicklistEntry entry;
   unsigned removed = 0;
@@ -621,9 +716,12 @@ OpStatus OpSet(const OpArgs& op_args, string_view key, string_view elem, long in
     return it_res.status();
 
   auto it = it_res->it;
-  quicklist* ql = GetQL(it->second);
-
-  int replaced = quicklistReplaceAtIndex(ql, index, elem.data(), elem.size());
+  bool replaced = false;
+  if (IsQLV2(it->second)) {
+    replaced = GetQLV2(it->second)->Replace(index, elem);
+  } else {
+    replaced = quicklistReplaceAtIndex(GetQL(it->second), index, elem.data(), elem.size());
+  }
 
   if (!replaced) {
     return OpStatus::OUT_OF_RANGE;
@@ -638,8 +736,7 @@ OpStatus OpTrim(const OpArgs& op_args, string_view key, long start, long end) {
     return it_res.status();
 
   auto it = it_res->it;
-  quicklist* ql = GetQL(it->second);
-  long llen = quicklistCount(ql);
+  long llen = ListLen(it->second);
 
   /* convert negative indexes */
   if (start < 0)
@@ -664,24 +761,31 @@ OpStatus OpTrim(const OpArgs& op_args, string_view key, long start, long end) {
     rtrim = llen - end - 1;
   }
 
-  quicklistDelRange(ql, 0, ltrim);
-  quicklistDelRange(ql, -rtrim, rtrim);
+  if (IsQLV2(it->second)) {
+    QList* ql = GetQLV2(it->second);
+    ql->Erase(0, ltrim);
+    ql->Erase(-rtrim, rtrim);
+  } else {
+    quicklist* ql = GetQL(it->second);
+    quicklistDelRange(ql, 0, ltrim);
+    quicklistDelRange(ql, -rtrim, rtrim);
+  }
 
   it_res->post_updater.Run();
 
-  if (quicklistCount(ql) == 0) {
+  if (ListLen(it->second) == 0) {
     CHECK(db_slice.Del(op_args.db_cntx.db_index, it));
   }
   return OpStatus::OK;
 }
 
-OpResult<StringVec> OpRange(const OpArgs& op_args, std::string_view key, long start, long end) {
+OpResult<container_utils::ReadView> OpRange(const OpArgs& op_args, std::string_view key,
+                                            long start, long end) {
   auto res = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key, OBJ_LIST);
   if (!res)
     return res.status();
 
-  quicklist* ql = GetQL(res.value()->second);
-  long llen = quicklistCount(ql);
+  long llen = ListLen(res.value()->second);
 
   /* convert negative indexes */
   if (start < 0)
@@ -695,19 +799,45 @@ OpResult<StringVec> OpRange(const OpArgs& op_args, std::string_view key, long st
    * The range is empty when start > end or start >= length. */
   if (start > end || start >= llen) {
     /* Out of range start or start > end result in empty list */
-    return StringVec{};
+    return container_utils::ReadView{};
+  }
+
+  // The coordinator decodes the reply from the copy. Chunks that are mostly part of the range
+  // are copied whole, which is much cheaper than copying their elements one by one.
+  container_utils::ReadView view;
+  const PrimeValue& pv = res.value()->second;
+  if (pv.Encoding() == kEncodingQL2) {
+    const QList* ql = static_cast<const QList*>(pv.RObjPtr());
+    ql->IterateNodes(
+        [&view](const uint8_t* lp, uint32_t offset, uint32_t count) {
+          uint8_t* mlp = const_cast<uint8_t*>(lp);
+          if (count * 2 >= lpLength(mlp)) {
+            view.AppendListpack(lp, offset, count);
+            return true;
+          }
+
+          uint8_t intbuf[LP_INTBUF_SIZE];
+          uint8_t* p = lpSeek(mlp, offset);
+          for (uint32_t i = 0; i < count; ++i, p = lpNext(mlp, p))
+            view.Append(container_utils::LpGetView(p, intbuf));
+          return true;
+        },
+        start, end);
+    return view;
   }
 
-  StringVec str_vec;
   container_utils::IterateList(
-      res.value()->second,
-      [&str_vec](container_utils::ContainerEntry ce) {
-        str_vec.emplace_back(ce.ToString());
+      pv,
+      [&view](container_utils::ContainerEntry ce) {
+        if (ce.value)
+          view.Append(string_view{ce.value, ce.length});
+        else
+          view.Append(absl::StrCat(ce.longval));
         return true;
       },
       start, end);
 
-  return str_vec;
+  return view;
 }
 
 void MoveGeneric(ConnectionContext* cntx, string_view src, string_view dest, ListDir src_dir,
@@ -1108,7 +1238,11 @@ void ListFamily::LRange(CmdArgList args, ConnectionContext* cntx) {
   }
 
   auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
-  rb->SendStringArr(*res);
+  if (!res)
+    return rb->SendEmptyArray();
+
+  vector<string_view> entries = res->Entries();
+  rb->SendStringArr(absl::MakeConstSpan(entries));
 }
 
 // lrem key 5 foo, will remove foo elements from the list if exists at most 5 times.
@@ -4,8 +4,10 @@
 
 #include "server/list_family.h"
 
+#include <absl/flags/reflection.h>
 #include <absl/strings/match.h>
 
+#include "base/flags.h"
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "facade/facade_test.h"
@@ -22,6 +24,9 @@ using namespace std;
 using namespace util;
 using absl::StrCat;
 
+ABSL_DECLARE_FLAG(bool, list_experimental_v2);
+ABSL_DECLARE_FLAG(int32_t, list_max_listpack_size);
+
 namespace dfly {
 
 class ListFamilyTest : public BaseFamilyTest {
@@ -267,6 +272,39 @@ TEST_F(ListFamilyTest, WrongTypeDoesNotWake) {
   EXPECT_THAT(blpop_resp.GetVec(), ElementsAre(kKey1, "B"));
 }
 
+TEST_F(ListFamilyTest, BLPopWakeBatch) {
+  const unsigned kWaiters = 8;
+  vector<RespExpr> resps(kWaiters);
+  vector<fb2::Fiber> fbs(kWaiters);
+  for (unsigned i = 0; i < kWaiters; ++i) {
+    fbs[i] = pp_->at(i % 2)->LaunchFiber([&, i] {
+      resps[i] = Run(StrCat("w", i), {"blpop", kKey1, "0"});
+    });
+  }
+  ASSERT_TRUE(WaitUntilCondition(
+      [&] { return GetMetrics().facade_stats.conn_stats.num_blocked_clients == kWaiters; },
+      1000ms));
+
+  // A single push serves some of the waiters, the rest stays blocked.
+  Run({"rpush", kKey1, "1", "2", "3", "4", "5"});
+  ASSERT_TRUE(WaitUntilCondition(
+      [&] { return GetMetrics().facade_stats.conn_stats.num_blocked_clients == 3; }, 1000ms));
+  EXPECT_EQ(0, CheckedInt({"llen", kKey1}));
+
+  Run({"rpush", kKey1, "6", "7", "8", "9"});
+  for (auto& fb : fbs)
+    fb.Join();
+  EXPECT_EQ(1, CheckedInt({"llen", kKey1}));
+
+  set<string> popped;
+  for (const auto& resp : resps) {
+    ASSERT_THAT(resp, ArrLen(2));
+    popped.insert(resp.GetVec()[1].GetString());
+  }
+  EXPECT_EQ(kWaiters, popped.size());
+  ASSERT_EQ(0, NumWatched());
+}
+
 TEST_F(ListFamilyTest, BPopSameKeyTwice) {
   RespExpr blpop_resp;
 
@@ -384,6 +422,24 @@ TEST_F(ListFamilyTest, LRange) {
   ASSERT_THAT(resp.GetVec(), ElementsAre("1", "2"));
 }
 
+TEST_F(ListFamilyTest, LRangeManyChunks) {
+  // Integers and strings over many chunks, which are copied whole or element by element
+  // depending on how much of them is in the range.
+  vector<string> expected;
+  for (unsigned i = 0; i < 2000; ++i) {
+    expected.push_back(i % 3 ? absl::StrCat(i) : absl::StrCat("elem:", string(i % 50, 'x'), i));
+    Run({"rpush", kKey1, expected.back()});
+  }
+
+  for (auto [start, end] : {pair{0, 1999}, pair{5, 7}, pair{100, 1500}, pair{1990, 1999}}) {
+    auto resp = Run({"lrange", kKey1, absl::StrCat(start), absl::StrCat(end)});
+    ASSERT_THAT(resp, ArrLen(end - start + 1));
+    auto vec = resp.GetVec();
+    for (int i = start; i <= end; ++i)
+      ASSERT_EQ(vec[i - start].GetString(), expected[i]) << i;
+  }
+}
+
 TEST_F(ListFamilyTest, Lset) {
   Run({"rpush", kKey1, "0", "1", "2"});
   ASSERT_EQ(Run({"lset", kKey1, "0", "bar"}), "OK");
@@ -879,6 +935,36 @@ TEST_F(ListFamilyTest, OtherMultiWakesBLpop) {
   f2.Join();
 }
 
+TEST_F(ListFamilyTest, ExperimentalV2) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_list_experimental_v2, true);
+  absl::SetFlag(&FLAGS_list_max_listpack_size, 4);
+
+  for (unsigned i = 0; i < 20; ++i)
+    Run({"rpush", kKey1, StrCat(i)});
+  ASSERT_THAT(Run({"lpush", kKey1, "a", "b"}), IntArg(22));
+
+  EXPECT_EQ(Run({"lindex", kKey1, "0"}), "b");
+  EXPECT_EQ(Run({"lindex", kKey1, "12"}), "10");
+  EXPECT_EQ(Run({"lindex", kKey1, "-1"}), "19");
+  EXPECT_THAT(Run({"lindex", kKey1, "22"}), ArgType(RespExpr::NIL));
+
+  EXPECT_EQ(Run({"lset", kKey1, "5", "foo"}), "OK");
+  EXPECT_THAT(Run({"linsert", kKey1, "before", "foo", "bar"}), IntArg(23));
+  EXPECT_THAT(Run({"lrange", kKey1, "4", "7"}).GetVec(), ElementsAre("2", "bar", "foo", "4"));
+  EXPECT_THAT(Run({"lpos", kKey1, "foo"}), IntArg(6));
+
+  Run({"rpush", kKey1, "x", "foo"});
+  EXPECT_THAT(Run({"lrem", kKey1, "-1", "foo"}), IntArg(1));
+  EXPECT_EQ(Run({"ltrim", kKey1, "2", "-2"}), "OK");
+  EXPECT_THAT(Run({"llen", kKey1}), IntArg(21));
+
+  EXPECT_EQ(Run({"lmove", kKey1, kKey2, "LEFT", "RIGHT"}), "0");
+  EXPECT_EQ(Run({"rpop", kKey1}), "19");
+  EXPECT_EQ(Run({"lpop", kKey2}), "0");
+  EXPECT_THAT(Run({"exists", kKey2}), IntArg(0));
+}
+
 TEST_F(ListFamilyTest, ContendExpire) {
   vector<fb2::Fiber> blpop_fibers;
   for (unsigned i = 0; i < num_threads_; ++i) {
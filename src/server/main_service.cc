@@ -14,6 +14,7 @@ extern "C" {
 #include "redis/redis_aux.h"
 }
 
+#include <absl/base/internal/cycleclock.h>
 #include <absl/cleanup/cleanup.h>
 #include <absl/functional/bind_front.h>
 #include <absl/strings/ascii.h>
@@ -26,6 +27,7 @@ extern "C" {
 
 #include "base/flags.h"
 #include "base/logging.h"
+#include "core/allocation_tracker.h"
 #include "facade/dragonfly_connection.h"
 #include "facade/error.h"
 #include "facade/reply_builder.h"
@@ -36,8 +38,10 @@ extern "C" {
 #include "server/acl/validator.h"
 #include "server/bitops_family.h"
 #include "server/bloom_family.h"
+#include "server/cmd_profiler.h"
 #include "server/cluster/cluster_family.h"
 #include "server/cluster/cluster_utility.h"
+#include "server/cluster/cross_slot_forwarding.h"
 #include "server/conn_context.h"
 #include "server/error.h"
 #include "server/generic_family.h"
@@ -58,6 +62,7 @@ extern "C" {
 #include "server/zset_family.h"
 #include "strings/human_readable.h"
 #include "util/html/sorted_table.h"
+#include "util/http/http_common.h"
 #include "util/varz.h"
 
 using namespace std;
@@ -77,11 +82,19 @@ ABSL_FLAG(bool, multi_exec_squash, true,
           "Whether multi exec will squash single shard commands to optimize performance");
 
 ABSL_FLAG(bool, track_exec_frequencies, true, "Whether to track exec frequencies for multi exec");
+ABSL_FLAG(uint32_t, multi_exec_adaptive_runs, 16,
+          "If positive, EXEC bodies whose commands were never squashed in that many runs skip "
+          "squashing, retrying it once in a while. The runs are tracked per thread and body shape "
+          "along with track_exec_frequencies. 0 disables it");
 ABSL_FLAG(bool, lua_resp2_legacy_float, false,
           "Return rounded down integers instead of floats for lua scripts with RESP2");
 ABSL_FLAG(uint32_t, multi_eval_squash_buffer, 4096, "Max buffer for squashed commands per script");
+ABSL_FLAG(bool, lua_prefetch_keys, true,
+          "If true, the declared keys of atomic scripts are looked up once per shard when the "
+          "script is scheduled and the commands of the script reuse the lookups");
 
 ABSL_DECLARE_FLAG(bool, primary_port_http_enabled);
+ABSL_DECLARE_FLAG(bool, cluster_cross_slot_forwarding);
 ABSL_FLAG(bool, admin_nopass, false,
           "If set, would enable open admin access to console on the assigned port, without "
           "authorization needed.");
@@ -97,6 +110,20 @@ ABSL_FLAG(double, oom_deny_ratio, 1.1,
           "commands with flag denyoom will return OOM when the ratio between maxmemory and used "
           "memory is above this value");
 
+ABSL_FLAG(uint32_t, max_listpack_lookup_ns, 0,
+          "If positive, listpack encoded hashes and sorted sets are converted to hash based "
+          "encodings once their estimated lookup time exceeds this many nanoseconds. "
+          "The estimate is based on sampled lookup timings. 0 - disabled");
+
+ABSL_FLAG(double, conn_rebalance_share, 0,
+          "If positive, connections move to the thread of the shard that ran at least this share "
+          "of their recent commands, as long as the thread doesn't get overloaded with "
+          "connections. 0 - disabled");
+
+ABSL_FLAG(bool, slowlog_tx_phases, false,
+          "If true, slowlog entries of transactional commands end with an extra argument that "
+          "breaks their execution time down into transaction phases");
+
 namespace dfly {
 
 #if defined(__linux__)
@@ -281,6 +308,7 @@ class InterpreterReplier : public RedisReplyBuilder {
   void SendDouble(double val) final;
 
   void SendBulkString(std::string_view str) final;
+  void SendBulkChunks(const facade::ReplyChunks& chunks) final;
 
   void StartCollection(unsigned len, CollectionType type) final;
   void SendScoredArray(const std::vector<std::pair<std::string, double>>& arr,
@@ -446,6 +474,10 @@ void InterpreterReplier::SendBulkString(string_view str) {
   PostItem();
 }
 
+void InterpreterReplier::SendBulkChunks(const facade::ReplyChunks& chunks) {
+  SendBulkString(chunks.ToString());
+}
+
 void InterpreterReplier::StartCollection(unsigned len, CollectionType) {
   explr_->OnArrayStart(len);
 
@@ -574,6 +606,61 @@ void TxTable(const http::QueryArgs& args, HttpContext* send) {
   send->Invoke(std::move(resp));
 }
 
+// Samples the call stacks of all threads for ?seconds=N, 10 by default, and replies with a CPU
+// profile that can be read by pprof.
+void Profilez(const http::QueryArgs& args, HttpContext* send) {
+  unsigned seconds = 10;
+  for (const auto& [name, value] : args) {
+    if (name == "seconds" && (!absl::SimpleAtoi(value, &seconds) || seconds == 0)) {
+      http::StringResponse resp = http::MakeStringResponse(h2::status::bad_request);
+      resp.body() = "Invalid seconds\r\n";
+      return send->Invoke(std::move(resp));
+    }
+  }
+
+  optional<CmdProfiler::Result> result;
+  if (CmdProfiler::Start({.hz = 100, .stacks = true}, shard_set->pool())) {
+    ThisFiber::SleepFor(chrono::seconds(seconds));
+    result = CmdProfiler::Stop(shard_set->pool());
+  }
+
+  // Either a profile was running already or it was stopped with DEBUG PROFILE STOP meanwhile.
+  if (!result) {
+    http::StringResponse resp = http::MakeStringResponse(h2::status::conflict);
+    resp.body() = "Another profile is running\r\n";
+    return send->Invoke(std::move(resp));
+  }
+
+  http::StringResponse resp = http::MakeStringResponse(h2::status::ok);
+  resp.set(h2::field::content_type, "application/octet-stream");
+  resp.body() = CmdProfiler::ToPprof(*result);
+  send->Invoke(std::move(resp));
+}
+
+// Replies with the allocations sampled by MEMORY TRACK PROFILE as a heap profile that can be read
+// by pprof.
+void Heapz(const http::QueryArgs& args, HttpContext* send) {
+  vector<AllocationTracker::HeapProfile> profiles(shard_set->pool()->size());
+  shard_set->pool()->AwaitBrief([&profiles](unsigned index, auto*) {
+    profiles[index] = AllocationTracker::Get().GetProfile();
+  });
+
+  AllocationTracker::HeapProfile profile;
+  for (const auto& thread_profile : profiles)
+    profile.Merge(thread_profile);
+
+  if (profile.sample_bytes == 0) {
+    http::StringResponse resp = http::MakeStringResponse(h2::status::not_found);
+    resp.body() = "Heap profiling was not started with MEMORY TRACK PROFILE\r\n";
+    return send->Invoke(std::move(resp));
+  }
+
+  http::StringResponse resp = http::MakeStringResponse(h2::status::ok);
+  http::SetMime(http::kTextMime, &resp);
+  resp.body() = profile.ToPprof();
+  send->Invoke(std::move(resp));
+}
+
 void ClusterHtmlPage(const http::QueryArgs& args, HttpContext* send,
                      cluster::ClusterFamily* cluster_family) {
   http::StringResponse resp = http::MakeStringResponse(h2::status::ok);
@@ -728,16 +815,24 @@ Transaction::MultiMode DeduceExecMode(ExecEvalState state,
   return multi_mode;
 }
 
-string CreateExecDescriptor(const std::vector<StoredCmd>& stored_cmds, unsigned num_uniq_shards) {
+// Commands of the body and their number of arguments.
+string CreateExecShape(const std::vector<StoredCmd>& stored_cmds) {
   string result;
   result.reserve(stored_cmds.size() * 10);
-  absl::StrAppend(&result, "EXEC/", num_uniq_shards, "\n");
   for (const auto& scmd : stored_cmds) {
     absl::StrAppend(&result, "  ", scmd.Cid()->name(), " ", scmd.NumArgs(), "\n");
   }
   return result;
 }
 
+// Whether the profile of the body shape shows that squashing is not worth it. Every 64th run
+// squashes anyway, in case the arguments changed.
+bool SkipExecSquashing(const ServerState::ExecProfile& profile) {
+  uint32_t min_runs = GetFlag(FLAGS_multi_exec_adaptive_runs);
+  return min_runs > 0 && profile.squashed >= min_runs && profile.squashed_cmds == 0 &&
+         profile.execs % 64 != 0;
+}
+
 // Ensures availability of an interpreter for EVAL-like commands and it's automatic release.
 // If it's part of MULTI, the preborrowed interpreter is returned, otherwise a new is acquired.
 struct BorrowedInterpreter {
@@ -782,6 +877,25 @@ struct BorrowedInterpreter {
   bool owned_ = false;
 };
 
+// Breaks the invocation time of a transactional command down into its phases, based on the
+// phase cycles of its transaction before and after the invocation. Callbacks of multi shard
+// hops run in parallel, so their exec time is the sum over the shards.
+void ComputeTxPhases(const Transaction::PhaseCycles& before, const Transaction::PhaseCycles& after,
+                     uint64_t invoke_usec, uint64_t (&usec)[TxPhaseStats::kNumPhases]) {
+  const double usec_per_cycle = 1e6 / absl::base_internal::CycleClock::Frequency();
+  auto to_usec = [usec_per_cycle](uint64_t cycles) { return uint64_t(cycles * usec_per_cycle); };
+
+  uint64_t schedule = after.schedule - before.schedule;
+  uint64_t hops = after.hops - before.hops;
+  uint64_t exec = after.exec - before.exec;
+  uint64_t immediate_exec = after.immediate_exec - before.immediate_exec;
+
+  usec[TxPhaseStats::SCHEDULE] = to_usec(schedule - min(schedule, immediate_exec));
+  usec[TxPhaseStats::QUEUE] = to_usec(hops - min(hops, exec));
+  usec[TxPhaseStats::EXEC] = to_usec(exec + immediate_exec);
+  usec[TxPhaseStats::REPLY] = invoke_usec - min(invoke_usec, to_usec(schedule + hops));
+}
+
 }  // namespace
 
 Service::Service(ProactorPool* pp)
@@ -824,6 +938,8 @@ Service::~Service() {
 void Service::Init(util::AcceptServer* acceptor, std::vector<facade::Listener*> listeners,
                    const InitOpts& opts) {
   InitRedisTables();
+  server.max_listpack_lookup_ns = GetFlag(FLAGS_max_listpack_lookup_ns);
+  conn_rebalance_share_ = GetFlag(FLAGS_conn_rebalance_share);
 
   config_registry.RegisterMutable("maxmemory", [](const absl::CommandLineFlag& flag) {
     auto res = flag.TryGet<MemoryBytesFlag>();
@@ -845,6 +961,8 @@ void Service::Init(util::AcceptServer* acceptor, std::vector<facade::Listener*>
   config_registry.RegisterMutable("enable_heartbeat_eviction");
   config_registry.RegisterMutable("dbfilename");
   config_registry.RegisterMutable("table_growth_margin");
+  config_registry.RegisterMutable("sync_bandwidth_limit");
+  config_registry.RegisterMutable("cluster_replica_read_max_lag_ms");
 
   uint32_t shard_num = GetFlag(FLAGS_num_shards);
   if (shard_num == 0 || shard_num > pp_.size()) {
@@ -885,6 +1003,7 @@ void Service::Shutdown() {
   pp_.AwaitFiberOnAll([](ProactorBase* pb) {
     ServerState::tlocal()->EnterLameDuck();
     facade::Connection::ShutdownThreadLocal();
+    cluster::ShutdownCrossSlotForwarding();
   });
 
   config_registry.Reset();
@@ -905,6 +1024,30 @@ void Service::Shutdown() {
   ThisFiber::SleepFor(10ms);
 }
 
+optional<ErrorReply> Service::CheckChannelsOwnership(CmdArgList channels) {
+  if (!cluster::IsClusterEnabled())
+    return nullopt;
+
+  const cluster::ClusterConfig* cluster_config = cluster_family_.cluster_config();
+  if (cluster_config == nullptr) {
+    return ErrorReply{kClusterNotConfigured};
+  }
+
+  optional<cluster::SlotId> slot;
+  for (string_view channel : ArgS(channels)) {
+    cluster::SlotId channel_slot = cluster::KeySlot(channel);
+    if (slot && channel_slot != *slot)
+      return ErrorReply{"-CROSSSLOT Keys in request don't hash to the same slot"};
+    slot = channel_slot;
+  }
+
+  if (slot && !cluster_config->IsMySlot(*slot)) {
+    cluster::ClusterNodeInfo master = cluster_config->GetMasterNodeForSlot(*slot);
+    return ErrorReply{absl::StrCat("-MOVED ", *slot, " ", master.ip, ":", master.port)};
+  }
+  return nullopt;
+}
+
 optional<ErrorReply> Service::CheckKeysOwnership(const CommandId* cid, CmdArgList args,
                                                  const ConnectionContext& dfly_cntx) {
   if (dfly_cntx.is_replicating) {
@@ -921,29 +1064,46 @@ optional<ErrorReply> Service::CheckKeysOwnership(const CommandId* cid, CmdArgLis
     return ErrorReply{key_index_res.status()};
   }
 
+  // Check keys slot is in my ownership
+  const cluster::ClusterConfig* cluster_config = cluster_family_.cluster_config();
+  if (cluster_config == nullptr) {
+    return ErrorReply{kClusterNotConfigured};
+  }
+
   const auto& key_index = *key_index_res;
   optional<cluster::SlotId> keys_slot;
+  optional<cluster::SlotId> foreign_slot;
   bool cross_slot = false;
   // Iterate keys and check to which slot they belong.
   for (unsigned i = key_index.start; i < key_index.end; i += key_index.step) {
     string_view key = ArgS(args, i);
     cluster::SlotId slot = cluster::KeySlot(key);
+    if (!foreign_slot && !cluster_config->IsMySlot(slot))
+      foreign_slot = slot;
     if (keys_slot && slot != *keys_slot) {
       cross_slot = true;  // keys belong to different slots
-      break;
     } else {
       keys_slot = slot;
     }
   }
 
   if (cross_slot) {
-    return ErrorReply{"-CROSSSLOT Keys in request don't hash to the same slot"};
-  }
-
-  // Check keys slot is in my ownership
-  const cluster::ClusterConfig* cluster_config = cluster_family_.cluster_config();
-  if (cluster_config == nullptr) {
-    return ErrorReply{kClusterNotConfigured};
+    // With forwarding, keys of several local slots are served as is, and MGET, MSET and DEL
+    // outside of transactions are forwarded, see MaybeForwardCrossSlot.
+    const auto& conn_state = dfly_cntx.conn_state;
+    bool in_multi = conn_state.exec_info.IsCollecting() || conn_state.exec_info.IsRunning() ||
+                    conn_state.script_info;
+    bool allowed = absl::GetFlag(FLAGS_cluster_cross_slot_forwarding) &&
+                   (!foreign_slot || (cluster::IsCrossSlotForwardable(cid) && !in_multi));
+    if (!allowed)
+      return ErrorReply{"-CROSSSLOT Keys in request don't hash to the same slot"};
+
+    // Commands forwarded by another node are redirected rather than forwarded again.
+    if (foreign_slot) {
+      if (!dfly_cntx.cluster_forwarded)
+        return nullopt;
+      keys_slot = foreign_slot;
+    }
   }
 
   if (keys_slot.has_value() && !cluster_config->IsMySlot(*keys_slot)) {
@@ -952,6 +1112,14 @@ optional<ErrorReply> Service::CheckKeysOwnership(const CommandId* cid, CmdArgLis
     return ErrorReply{absl::StrCat("-MOVED ", *keys_slot, " ", master.ip, ":", master.port)};
   }
 
+  // Replicas serve reads of the slots they mirror, unless the connection asked for the master or
+  // the replica lags behind.
+  if (keys_slot.has_value() && !ServerState::tlocal()->is_master && cid->IsReadOnly() &&
+      !cluster_family_.CanReadFromReplica(dfly_cntx)) {
+    cluster::ClusterNodeInfo master = cluster_config->GetMasterNodeForSlot(*keys_slot);
+    return ErrorReply{absl::StrCat("-MOVED ", *keys_slot, " ", master.ip, ":", master.port)};
+  }
+
   return nullopt;
 }
 
@@ -1191,6 +1359,12 @@ void Service::DispatchCommand(CmdArgList args, facade::ConnectionContext* cntx)
     return cntx->SendSimpleString("QUEUED");
   }
 
+  if (cluster::IsClusterEnabled() && !dispatching_in_multi && !dfly_cntx->is_replicating &&
+      cluster::MaybeForwardCrossSlot(cid, args_no_cmd, cluster_family_.cluster_config(), this,
+                                     dfly_cntx)) {
+    return;
+  }
+
   // Create command transaction
   intrusive_ptr<Transaction> dist_trans;
 
@@ -1215,6 +1389,8 @@ void Service::DispatchCommand(CmdArgList args, facade::ConnectionContext* cntx)
             st != OpStatus::OK)
           return cntx->SendError(st);
       }
+      if (dfly_cntx->forwarded_entry)
+        dist_trans->SetForwardedJournalEntry(dfly_cntx->forwarded_entry);
 
       dfly_cntx->transaction = dist_trans.get();
       dfly_cntx->last_command_debug.shards_count = dfly_cntx->transaction->GetUniqueShardCnt();
@@ -1231,10 +1407,33 @@ void Service::DispatchCommand(CmdArgList args, facade::ConnectionContext* cntx)
   }
 
   if (!dispatching_in_multi) {
+    if (dist_trans && conn_rebalance_share_ > 0)
+      RebalanceConnection(*dist_trans, dfly_cntx);
     dfly_cntx->transaction = nullptr;
   }
 }
 
+void Service::RebalanceConnection(const Transaction& tx, ConnectionContext* cntx) {
+  facade::Connection* conn = cntx->conn();
+  if (conn == nullptr || tx.GetUniqueShardCnt() == 0)
+    return;
+
+  auto* ss = ServerState::tlocal();
+  ShardId sid = tx.GetUniqueShardCnt() == 1 ? tx.GetUniqueShard() : kInvalidSid;
+  optional<ShardId> dest =
+      cntx->shard_affinity.Record(sid, ss->thread_index(), conn_rebalance_share_);
+  if (!dest)
+    return;
+
+  if (conn->RequestRebalance(shard_set->pool()->at(*dest))) {
+    VLOG(1) << "Rebalancing connection " << conn->GetClientId() << " from "
+            << ss->thread_index() << " to " << *dest;
+    ss->stats.conn_rebalance_moves++;
+  } else {
+    ss->stats.conn_rebalance_rejected++;
+  }
+}
+
 class ReplyGuard {
  public:
   ReplyGuard(ConnectionContext* cntx, std::string_view cid_name) {
@@ -1327,6 +1526,11 @@ bool Service::InvokeCmd(const CommandId* cid, CmdArgList tail_args, ConnectionCo
   // Verifies that we reply to the client when needed.
   ReplyGuard reply_guard(cntx, cid->name());
 #endif
+  // In multi/exec the transaction is shared by all commands, so we measure the difference.
+  Transaction::PhaseCycles phases_before;
+  if (trans)
+    phases_before = trans->GetPhaseCycles();
+
   uint64_t invoke_time_usec = 0;
   try {
     invoke_time_usec = cid->Invoke(tail_args, cntx);
@@ -1335,6 +1539,12 @@ bool Service::InvokeCmd(const CommandId* cid, CmdArgList tail_args, ConnectionCo
     return false;
   }
 
+  uint64_t phases_usec[TxPhaseStats::kNumPhases] = {};
+  if (trans) {
+    ComputeTxPhases(phases_before, trans->GetPhaseCycles(), invoke_time_usec, phases_usec);
+    cid->RecordPhases(ServerState::SafeTLocal()->thread_index(), phases_usec);
+  }
+
   auto cid_name = cid->name();
   if ((!trans && cid_name != "MULTI") || (trans && !trans->IsMulti())) {
     // Each time we execute a command we need to increase the sequence number in
@@ -1352,6 +1562,7 @@ bool Service::InvokeCmd(const CommandId* cid, CmdArgList tail_args, ConnectionCo
       // Use SafeTLocal() to avoid accessing the wrong thread local instance
       ServerState::SafeTLocal()->ShouldLogSlowCmd(invoke_time_usec)) {
     vector<string> aux_params;
+    aux_params.reserve(2);  // aux_slices point into the strings
     CmdArgVec aux_slices;
 
     if (tail_args.empty() && cid->name() == "EXEC") {
@@ -1360,6 +1571,23 @@ bool Service::InvokeCmd(const CommandId* cid, CmdArgList tail_args, ConnectionCo
       aux_slices.emplace_back(aux_params.back());
       tail_args = absl::MakeSpan(aux_slices);
     }
+
+    if (trans && absl::GetFlag(FLAGS_slowlog_tx_phases)) {
+      string breakdown = "TXPHASES/";
+      for (unsigned i = 0; i < TxPhaseStats::kNumPhases; ++i) {
+        absl::StrAppend(&breakdown, i ? "," : "", TxPhaseStats::PhaseName(i), "=",
+                        phases_usec[i]);
+      }
+      aux_params.push_back(std::move(breakdown));
+
+      // Keep the breakdown within the arguments the slowlog stores.
+      if (aux_slices.empty()) {
+        size_t args_cnt = min(tail_args.size(), kMaximumSlowlogArgCount - 1);
+        aux_slices.assign(tail_args.begin(), tail_args.begin() + args_cnt);
+      }
+      aux_slices.emplace_back(aux_params.back());
+      tail_args = absl::MakeSpan(aux_slices);
+    }
     ServerState::SafeTLocal()->GetSlowLog().Add(cid->name(), tail_args, conn->GetName(),
                                                 conn->RemoteEndpointStr(), invoke_time_usec,
                                                 absl::GetCurrentTimeNanos() / 1000);
@@ -1461,6 +1689,8 @@ void Service::DispatchMC(const MemcacheParser::Command& cmd, std::string_view va
 
   MCReplyBuilder* mc_builder = static_cast<MCReplyBuilder*>(cntx->reply_builder());
   mc_builder->SetNoreply(cmd.no_reply);
+  mc_builder->SetMetaCommand(cmd.meta ? &cmd : nullptr);
+  absl::Cleanup meta_reset = [mc_builder] { mc_builder->SetMetaCommand(nullptr); };
 
   switch (cmd.type) {
     case MemcacheParser::REPLACE:
@@ -1506,6 +1736,9 @@ void Service::DispatchMC(const MemcacheParser::Command& cmd, std::string_view va
     case MemcacheParser::VERSION:
       mc_builder->SendSimpleString("VERSION 1.5.0 DF");
       return;
+    case MemcacheParser::META_NOOP:
+      mc_builder->SendSimpleString("MN");
+      return;
     default:
       mc_builder->SendClientError("bad command line format");
       return;
@@ -1539,6 +1772,12 @@ void Service::DispatchMC(const MemcacheParser::Command& cmd, std::string_view va
       char* key = const_cast<char*>(s.data());
       args.emplace_back(key, s.size());
     }
+    if (cmd.meta) {
+      if (cmd.meta_flags.return_cas)
+        dfly_cntx->conn_state.memcache_flag |= ConnectionState::FETCH_CAS_VER;
+      if (cmd.meta_flags.return_ttl)
+        dfly_cntx->conn_state.memcache_flag |= ConnectionState::FETCH_TTL;
+    }
   } else {  // write commands.
     if (store_opt[0]) {
       args.emplace_back(store_opt, strlen(store_opt));
@@ -1551,6 +1790,30 @@ void Service::DispatchMC(const MemcacheParser::Command& cmd, std::string_view va
   dfly_cntx->conn_state.memcache_flag = 0;
 }
 
+void Service::DispatchManyMC(absl::Span<const MemcacheParser::Command* const> cmds,
+                             facade::ConnectionContext* cntx) {
+  char cmd_name[] = "MGET";
+  vector<MutableSlice> args{MutableSlice{cmd_name, 4}};
+  vector<unsigned> ends;
+  ends.reserve(cmds.size());
+
+  for (const auto* cmd : cmds) {
+    DCHECK(cmd->type == MemcacheParser::GET && !cmd->meta);
+    args.emplace_back(const_cast<char*>(cmd->key.data()), cmd->key.size());
+    for (auto s : cmd->keys_ext)
+      args.emplace_back(const_cast<char*>(s.data()), s.size());
+    ends.push_back(args.size() - 1);
+  }
+
+  // The reply is split back into the replies of the commands, each one taking its keys.
+  MCReplyBuilder* mc_builder = static_cast<MCReplyBuilder*>(cntx->reply_builder());
+  mc_builder->SetNoreply(false);
+  mc_builder->SetGetBatch(ends);
+  absl::Cleanup batch_reset = [mc_builder] { mc_builder->SetGetBatch({}); };
+
+  DispatchCommand(CmdArgList{args}, cntx);
+}
+
 ErrorReply Service::ReportUnknownCmd(string_view cmd_name) {
   lock_guard lk(mu_);
   if (unknown_cmds_.size() < 1024)
@@ -1692,14 +1955,35 @@ optional<CapturingReplyBuilder::Payload> Service::FlushEvalAsyncCmds(ConnectionC
   DCHECK(eval_cid);
   cntx->transaction->MultiSwitchCmd(eval_cid);
 
+  absl::Cleanup clear = [&info] {
+    info->async_cmds_heap_mem = 0;
+    info->async_cmds.clear();
+    info->deferred_pending.clear();
+  };
+
+  // Deferred calls keep their replies, so capture the reply of every command.
+  if (!info->deferred_pending.empty()) {
+    vector<CapturingReplyBuilder::Payload> replies;
+    MultiCommandSquasher::Execute(absl::MakeSpan(info->async_cmds), cntx, this, true, true,
+                                  &replies);
+
+    for (auto& reply : replies) {
+      if (CapturingReplyBuilder::GetError(reply))
+        return std::move(reply);
+    }
+
+    for (auto [idx, handle] : info->deferred_pending) {
+      DCHECK_LT(idx, replies.size());
+      info->deferred_replies[handle] = std::move(replies[idx]);
+    }
+    return nullopt;
+  }
+
   CapturingReplyBuilder crb{ReplyMode::ONLY_ERR};
   WithReplies(&crb, cntx, [&] {
     MultiCommandSquasher::Execute(absl::MakeSpan(info->async_cmds), cntx, this, true, true);
   });
 
-  info->async_cmds_heap_mem = 0;
-  info->async_cmds.clear();
-
   auto reply = crb.Take();
   return CapturingReplyBuilder::GetError(reply) ? make_optional(std::move(reply)) : nullopt;
 }
@@ -1721,6 +2005,11 @@ void Service::CallFromScript(ConnectionContext* cntx, Interpreter::CallArgs& ca)
     // Full command verification happens during squashed execution
     if (auto* cid = registry_.Find(ArgS(ca.args, 0)); cid != nullptr) {
       auto replies = ca.error_abort ? ReplyMode::ONLY_ERR : ReplyMode::NONE;
+      if (ca.deferred) {
+        replies = ReplyMode::FULL;
+        info->deferred_pending.emplace_back(info->async_cmds.size(), info->deferred_replies.size());
+        info->deferred_replies.emplace_back();
+      }
       info->async_cmds.emplace_back(std::move(*ca.buffer), cid, ca.args.subspan(1), replies);
       info->async_cmds_heap_mem += info->async_cmds.back().UsedMemory();
     } else if (ca.error_abort) {  // If we don't abort on errors, we can ignore it completely
@@ -1739,12 +2028,56 @@ void Service::CallFromScript(ConnectionContext* cntx, Interpreter::CallArgs& ca)
     *ca.requested_abort |= ca.error_abort;
   }
 
-  if (ca.async)
+  if (ca.async) {
+    if (ca.deferred && !findcmd_err)
+      ca.translator->OnInt(cntx->conn_state.script_info->deferred_replies.size() - 1);
     return;
+  }
+
+  // Squashing is disabled, so deferred calls run right away and only their reply is kept.
+  if (ca.deferred) {
+    CapturingReplyBuilder crb;
+    WithReplies(&crb, cntx, [&] { DispatchCommand(ca.args, cntx); });
+
+    auto reply = crb.Take();
+    if (CapturingReplyBuilder::GetError(reply)) {
+      CapturingReplyBuilder::Apply(std::move(reply), &replier);
+      return;
+    }
+
+    auto& replies = cntx->conn_state.script_info->deferred_replies;
+    replies.push_back(std::move(reply));
+    ca.translator->OnInt(replies.size() - 1);
+    return;
+  }
 
   DispatchCommand(ca.args, cntx);
 }
 
+void Service::AwaitFromScript(ConnectionContext* cntx, int64_t handle,
+                              ObjectExplorer* translator) {
+  auto& info = cntx->conn_state.script_info;
+  InterpreterReplier replier(translator);
+
+  if (handle < 0 || size_t(handle) >= info->deferred_replies.size())
+    return replier.SendError("Invalid handle for redis.await()");
+
+  // The buffered calls are executed only once one of their replies is read.
+  if (!info->deferred_pending.empty() && info->deferred_pending.front().second <= handle) {
+    if (auto err = FlushEvalAsyncCmds(cntx, true); err) {
+      CapturingReplyBuilder::Apply(std::move(*err), &replier);
+      return;
+    }
+  }
+
+  auto& reply = info->deferred_replies[handle];
+  if (holds_alternative<monostate>(reply))
+    return replier.SendError("Handle was already resolved by redis.await()");
+
+  CapturingReplyBuilder::Apply(std::move(reply), &replier);
+  reply = monostate{};
+}
+
 void Service::Eval(CmdArgList args, ConnectionContext* cntx) {
   string_view body = ArgS(args, 0);
 
@@ -1798,7 +2131,14 @@ optional<ScriptMgr::ScriptParams> LoadScript(string_view sha, ScriptMgr* script_
       return std::nullopt;
 
     string err;
-    Interpreter::AddResult add_res = interpreter->AddFunction(sha, script_data->body, &err);
+    Interpreter::AddResult add_res = Interpreter::COMPILE_ERR;
+    if (script_data->bytecode) {
+      add_res = interpreter->AddPrecompiled(sha, *script_data->bytecode, &err);
+      LOG_IF(DFATAL, add_res == Interpreter::COMPILE_ERR)
+          << "Error loading precompiled " << sha << ", err " << err;
+    }
+    if (add_res == Interpreter::COMPILE_ERR)
+      add_res = interpreter->AddFunction(sha, script_data->body, &err);
     if (add_res != Interpreter::ADD_OK) {
       LOG(ERROR) << "Error adding " << sha << " to database, err " << err;
       return std::nullopt;
@@ -1848,7 +2188,7 @@ optional<bool> StartMultiEval(DbIndex dbid, CmdArgList keys, ScriptMgr::ScriptPa
       trans->StartMultiGlobal(dbid);
       return true;
     case Transaction::LOCK_AHEAD:
-      trans->StartMultiLockedAhead(dbid, keys);
+      trans->StartMultiLockedAhead(dbid, keys, false, absl::GetFlag(FLAGS_lua_prefetch_keys));
       return true;
     case Transaction::NON_ATOMIC:
       trans->StartMultiNonAtomic();
@@ -1957,6 +2297,10 @@ void Service::EvalInternal(CmdArgList args, const EvalArgs& eval_args, Interpret
   interpreter->SetGlobalArray("KEYS", eval_args.keys);
   interpreter->SetGlobalArray("ARGV", eval_args.args);
 
+  interpreter->SetAwaitFunc([cntx, this](int64_t handle, ObjectExplorer* translator) {
+    AwaitFromScript(cntx, handle, translator);
+  });
+
   absl::Cleanup clean = [interpreter, &sinfo]() {
     interpreter->ResetStack();
     sinfo.reset();
@@ -2196,14 +2540,33 @@ void Service::Exec(CmdArgList args, ConnectionContext* cntx) {
   rb->StartArray(exec_info.body.size());
 
   if (!exec_info.body.empty()) {
+    bool squash = absl::GetFlag(FLAGS_multi_exec_squash) && state == ExecEvalState::NONE &&
+                  !cntx->conn_state.tracking_info_.IsTrackingOn();
+
+    string shape;
     if (GetFlag(FLAGS_track_exec_frequencies)) {
-      string descr = CreateExecDescriptor(exec_info.body, cntx->transaction->GetUniqueShardCnt());
-      ServerState::tlocal()->exec_freq_count[descr]++;
+      shape = CreateExecShape(exec_info.body);
+      unsigned num_shards = cntx->transaction->GetUniqueShardCnt();
+      auto* ss = ServerState::tlocal();
+      ss->exec_freq_count[absl::StrCat("EXEC/", num_shards, "\n", shape)]++;
+
+      auto& profile = ss->exec_profiles[shape];
+      profile.execs++;
+      profile.single_shard += num_shards <= 1;
+      if (squash && SkipExecSquashing(profile)) {
+        squash = false;
+        ss->stats.multi_squash_skipped++;
+      }
     }
 
-    if (absl::GetFlag(FLAGS_multi_exec_squash) && state == ExecEvalState::NONE &&
-        !cntx->conn_state.tracking_info_.IsTrackingOn()) {
-      MultiCommandSquasher::Execute(absl::MakeSpan(exec_info.body), cntx, this);
+    if (squash) {
+      size_t squashed = MultiCommandSquasher::Execute(absl::MakeSpan(exec_info.body), cntx, this);
+      // Looked up again, the map may have changed while the commands ran.
+      if (!shape.empty()) {
+        auto& profile = ServerState::tlocal()->exec_profiles[shape];
+        profile.squashed++;
+        profile.squashed_cmds += squashed;
+      }
     } else {
       CmdArgVec arg_vec;
       for (auto& scmd : exec_info.body) {
@@ -2273,6 +2636,34 @@ void Service::PUnsubscribe(CmdArgList args, ConnectionContext* cntx) {
   }
 }
 
+void Service::SPublish(CmdArgList args, ConnectionContext* cntx) {
+  string_view channel = ArgS(args, 0);
+  if (auto err = CheckChannelsOwnership(args.subspan(0, 1)); err)
+    return cntx->SendError(*err);
+
+  auto subscribers = shard_set->Await(Shard(channel, shard_set->size()), [channel] {
+    return EngineShard::tlocal()->shard_channels()->FetchSubscribers(channel);
+  });
+
+  string_view messages[] = {ArgS(args, 1)};
+  cntx->SendLong(ChannelStore::SendToSubscribers(std::move(subscribers), channel, messages, true));
+}
+
+void Service::SSubscribe(CmdArgList args, ConnectionContext* cntx) {
+  if (auto err = CheckChannelsOwnership(args); err)
+    return cntx->SendError(*err);
+
+  cntx->ChangeSSubscription(true, true, args);
+}
+
+void Service::SUnsubscribe(CmdArgList args, ConnectionContext* cntx) {
+  if (args.size() == 0) {
+    cntx->SUnsubscribeAll(true);
+  } else {
+    cntx->ChangeSSubscription(false, true, args);
+  }
+}
+
 // Not a real implementation. Serves as a decorator to accept some function commands
 // for testing.
 void Service::Function(CmdArgList args, ConnectionContext* cntx) {
@@ -2308,6 +2699,33 @@ void Service::PubsubNumSub(CmdArgList args, ConnectionContext* cntx) {
   }
 }
 
+void Service::PubsubShardChannels(string_view pattern, ConnectionContext* cntx) {
+  vector<vector<string>> shard_res(shard_set->size());
+  shard_set->RunBriefInParallel([&](EngineShard* es) {
+    shard_res[es->shard_id()] = es->shard_channels()->ListChannels(pattern);
+  });
+
+  vector<string> res;
+  for (auto& channels : shard_res)
+    res.insert(res.end(), make_move_iterator(channels.begin()), make_move_iterator(channels.end()));
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->SendStringArr(res);
+}
+
+void Service::PubsubShardNumSub(CmdArgList args, ConnectionContext* cntx) {
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartArray(args.size() * 2);
+
+  for (string_view channel : ArgS(args)) {
+    size_t num_sub = shard_set->Await(Shard(channel, shard_set->size()), [channel] {
+      return EngineShard::tlocal()->shard_channels()->NumSubscribers(channel);
+    });
+    rb->SendBulkString(channel);
+    rb->SendLong(num_sub);
+  }
+}
+
 void Service::Monitor(CmdArgList args, ConnectionContext* cntx) {
   VLOG(1) << "starting monitor on this connection: " << cntx->conn()->GetClientId();
   // we are registering the current connection for all threads so they will be aware of
@@ -2335,6 +2753,10 @@ void Service::Pubsub(CmdArgList args, ConnectionContext* cntx) {
         "NUMSUB [<channel> <channel...>]",
         "\tReturns the number of subscribers for the specified channels, excluding",
         "\tpattern subscriptions.",
+        "SHARDCHANNELS [<pattern>]",
+        "\tReturn the currently active shard level channels matching a <pattern> (default: '*').",
+        "SHARDNUMSUB [<shardchannel> <shardchannel...>]",
+        "\tReturns the number of subscribers for the specified shard level channel(s).",
         "HELP",
         "\tPrints this help."};
 
@@ -2355,6 +2777,16 @@ void Service::Pubsub(CmdArgList args, ConnectionContext* cntx) {
   } else if (subcmd == "NUMSUB") {
     args.remove_prefix(1);
     PubsubNumSub(args, cntx);
+  } else if (subcmd == "SHARDCHANNELS") {
+    string_view pattern;
+    if (args.size() > 1) {
+      pattern = ArgS(args, 1);
+    }
+
+    PubsubShardChannels(pattern, cntx);
+  } else if (subcmd == "SHARDNUMSUB") {
+    args.remove_prefix(1);
+    PubsubShardNumSub(args, cntx);
   } else {
     cntx->SendError(UnknownSubCmd(subcmd, "PUBSUB"));
   }
@@ -2498,6 +2930,8 @@ void Service::ConfigureHttpHandlers(util::HttpListenerBase* base, bool is_privil
   server_family_.ConfigureMetrics(base);
   base->RegisterCb("/txz", TxTable);
   base->RegisterCb("/topkeys", Topkeys);
+  base->RegisterCb("/profilez", Profilez);
+  base->RegisterCb("/heapz", Heapz);
   base->RegisterCb("/clusterz", [this](const http::QueryArgs& args, HttpContext* send) {
     return ClusterHtmlPage(args, send, &cluster_family_);
   });
@@ -2519,11 +2953,15 @@ void Service::OnClose(facade::ConnectionContext* cntx) {
       server_cntx->UnsubscribeAll(false);
     }
 
-    if (conn_state.subscribe_info) {
-      DCHECK(!conn_state.subscribe_info->patterns.empty());
+    if (conn_state.subscribe_info && !conn_state.subscribe_info->patterns.empty()) {
       server_cntx->PUnsubscribeAll(false);
     }
 
+    if (conn_state.subscribe_info) {
+      DCHECK(!conn_state.subscribe_info->shard_channels.empty());
+      server_cntx->SUnsubscribeAll(false);
+    }
+
     DCHECK(!conn_state.subscribe_info);
   }
 
@@ -2533,6 +2971,8 @@ void Service::OnClose(facade::ConnectionContext* cntx) {
 
   server_family_.OnClose(server_cntx);
 
+  if (conn_state.tracking_info_.IsTrackingOn() && conn_state.tracking_info_.IsBcast())
+    server_cntx->ChangeBcastTracking(false);
   conn_state.tracking_info_.SetClientTracking(false);
 }
 
@@ -2565,6 +3005,9 @@ constexpr uint32_t kSubscribe = PUBSUB | SLOW;
 constexpr uint32_t kUnsubscribe = PUBSUB | SLOW;
 constexpr uint32_t kPSubscribe = PUBSUB | SLOW;
 constexpr uint32_t kPUnsubsribe = PUBSUB | SLOW;
+constexpr uint32_t kSPublish = PUBSUB | FAST;
+constexpr uint32_t kSSubscribe = PUBSUB | SLOW;
+constexpr uint32_t kSUnsubscribe = PUBSUB | SLOW;
 constexpr uint32_t kFunction = SLOW;
 constexpr uint32_t kMonitor = ADMIN | SLOW | DANGEROUS;
 constexpr uint32_t kPubSub = SLOW;
@@ -2594,6 +3037,11 @@ void Service::Register(CommandRegistry* registry) {
       << CI{"PSUBSCRIBE", CO::NOSCRIPT | CO::LOADING, -2, 0, 0, acl::kPSubscribe}.MFUNC(PSubscribe)
       << CI{"PUNSUBSCRIBE", CO::NOSCRIPT | CO::LOADING, -1, 0, 0, acl::kPUnsubsribe}.MFUNC(
              PUnsubscribe)
+      << CI{"SPUBLISH", CO::LOADING | CO::FAST, 3, 0, 0, acl::kSPublish}.MFUNC(SPublish)
+      << CI{"SSUBSCRIBE", CO::NOSCRIPT | CO::LOADING, -2, 0, 0, acl::kSSubscribe}.MFUNC(
+             SSubscribe)
+      << CI{"SUNSUBSCRIBE", CO::NOSCRIPT | CO::LOADING, -1, 0, 0, acl::kSUnsubscribe}.MFUNC(
+             SUnsubscribe)
       << CI{"FUNCTION", CO::NOSCRIPT, 2, 0, 0, acl::kFunction}.MFUNC(Function)
       << CI{"MONITOR", CO::ADMIN, 1, 0, 0, acl::kMonitor}.MFUNC(Monitor)
       << CI{"PUBSUB", CO::LOADING | CO::FAST, -1, 0, 0, acl::kPubSub}.MFUNC(Pubsub)
@@ -69,6 +69,10 @@ class Service : public facade::ServiceInterface {
   void DispatchMC(const MemcacheParser::Command& cmd, std::string_view value,
                   facade::ConnectionContext* cntx) final;
 
+  // Looks up the keys of all the get commands with a single MGET.
+  void DispatchManyMC(absl::Span<const MemcacheParser::Command* const> cmds,
+                      facade::ConnectionContext* cntx) final;
+
   facade::ConnectionContext* CreateContext(util::FiberSocketBase* peer,
                                            facade::Connection* owner) final;
 
@@ -143,6 +147,9 @@ class Service : public facade::ServiceInterface {
   void Unsubscribe(CmdArgList args, ConnectionContext* cntx);
   void PSubscribe(CmdArgList args, ConnectionContext* cntx);
   void PUnsubscribe(CmdArgList args, ConnectionContext* cntx);
+  void SPublish(CmdArgList args, ConnectionContext* cntx);
+  void SSubscribe(CmdArgList args, ConnectionContext* cntx);
+  void SUnsubscribe(CmdArgList args, ConnectionContext* cntx);
   void Function(CmdArgList args, ConnectionContext* cntx);
   void Monitor(CmdArgList args, ConnectionContext* cntx);
   void Pubsub(CmdArgList args, ConnectionContext* cntx);
@@ -151,12 +158,18 @@ class Service : public facade::ServiceInterface {
   void PubsubChannels(std::string_view pattern, ConnectionContext* cntx);
   void PubsubPatterns(ConnectionContext* cntx);
   void PubsubNumSub(CmdArgList channels, ConnectionContext* cntx);
+  void PubsubShardChannels(std::string_view pattern, ConnectionContext* cntx);
+  void PubsubShardNumSub(CmdArgList channels, ConnectionContext* cntx);
 
   struct EvalArgs {
     std::string_view sha;  // only one of them is defined.
     CmdArgList keys, args;
   };
 
+  // Return error if sharded pub/sub channels don't belong to a single slot owned by the server
+  // when running in cluster mode. Channels are routed like keys, but are not locked.
+  std::optional<facade::ErrorReply> CheckChannelsOwnership(CmdArgList channels);
+
   // Return error if not all keys are owned by the server when running in cluster mode
   std::optional<facade::ErrorReply> CheckKeysOwnership(const CommandId* cid, CmdArgList args,
                                                        const ConnectionContext& dfly_cntx);
@@ -172,12 +185,19 @@ class Service : public facade::ServiceInterface {
 
   void CallFromScript(ConnectionContext* cntx, Interpreter::CallArgs& args);
 
+  // Resolve a handle of redis.dcall(), flushing the buffered calls if it is still pending.
+  void AwaitFromScript(ConnectionContext* cntx, int64_t handle, ObjectExplorer* translator);
+
+  // Moves the connection to the thread of the shard it uses most, see --conn_rebalance_share.
+  void RebalanceConnection(const Transaction& tx, ConnectionContext* cntx);
+
   void RegisterCommands();
   void Register(CommandRegistry* registry);
 
   base::VarzValue::Map GetVarzStats();
 
   util::ProactorPool& pp_;
+  double conn_rebalance_share_ = 0;
 
   acl::UserRegistry user_registry_;
   acl::AclFamily acl_family_;
@@ -4,6 +4,7 @@
 
 #include "server/memory_cmd.h"
 
+#include <absl/random/random.h>
 #include <absl/strings/str_cat.h>
 
 #ifdef __linux__
@@ -85,6 +86,85 @@ size_t MemoryUsage(PrimeIterator it) {
   return it->first.MallocUsed() + it->second.MallocUsed();
 }
 
+struct PrefixStats {
+  double keys = 0;
+  double bytes = 0;
+};
+
+using PrefixUsageMap = absl::flat_hash_map<string, PrefixStats>;
+
+// Estimates the usage per key prefix of a shard from a reservoir of at most max_samples keys.
+// Tables larger than the reservoir are sampled from randomly chosen buckets instead of being
+// scanned, and the fiber yields between batches of buckets so the shard keeps serving commands.
+PrefixUsageMap SamplePrefixUsage(DbSlice* db_slice, DbIndex db_index, string_view delimiter,
+                                 size_t max_samples) {
+  constexpr unsigned kBatchSize = 256;
+
+  vector<pair<string, size_t>> reservoir;
+  reservoir.reserve(max_samples);
+  absl::BitGen bitgen;
+  size_t visited = 0;
+  string tmp;
+
+  auto sample = [&](PrimeIterator it) {
+    string_view key = it->first.GetSlice(&tmp);
+    size_t pos = key.find(delimiter);
+    string_view prefix = pos == string_view::npos ? string_view{} : key.substr(0, pos);
+
+    size_t index = visited++;
+    if (index >= max_samples) {
+      index = absl::Uniform<size_t>(bitgen, 0, visited);
+      if (index >= max_samples)
+        return;
+    }
+
+    if (index == reservoir.size())
+      reservoir.emplace_back();
+    reservoir[index] = {string{prefix}, MemoryUsage(it)};
+  };
+
+  if (!db_slice->IsDbValid(db_index))
+    return {};
+
+  PrimeTable::Cursor cursor;
+  bool full_scan = db_slice->GetTables(db_index).first->size() <= max_samples;
+
+  // Visiting twice as many keys as the reservoir holds mixes the buckets enough, the bound on
+  // the buckets stops sampling sparse tables.
+  for (size_t buckets = 0; full_scan || visited < 2 * max_samples; ++buckets) {
+    if (buckets % kBatchSize == kBatchSize - 1)
+      util::ThisFiber::Yield();
+
+    // The db may be flushed while the fiber yields.
+    if (!db_slice->IsDbValid(db_index))
+      return {};
+
+    PrimeTable* table = db_slice->GetTables(db_index).first;
+    if (full_scan) {
+      cursor = table->Traverse(cursor, sample);
+      if (!cursor)
+        break;
+    } else {
+      if (table->size() == 0 || buckets > 16 * max_samples)
+        break;
+      table->Traverse(table->GetRandomCursor(&bitgen), sample);
+    }
+  }
+
+  PrefixUsageMap usage;
+  if (reservoir.empty() || !db_slice->IsDbValid(db_index))
+    return usage;
+
+  // Every sampled key stands for the same share of the table.
+  double scale = double(db_slice->GetTables(db_index).first->size()) / reservoir.size();
+  for (const auto& [prefix, bytes] : reservoir) {
+    PrefixStats& stats = usage[prefix];
+    stats.keys += scale;
+    stats.bytes += scale * bytes;
+  }
+  return usage;
+}
+
 }  // namespace
 
 MemoryCmd::MemoryCmd(ServerFamily* owner, ConnectionContext* cntx) : cntx_(cntx), owner_(owner) {
@@ -105,6 +185,11 @@ void MemoryCmd::Run(CmdArgList args) {
         "    If BACKING is specified, show stats for the backing heap.",
         "USAGE <key>",
         "    Show memory usage of a key.",
+        "PREFIX-USAGE [DELIMITER <delim>] [SAMPLES <count>] [TOP <count>]",
+        "    Estimates the number of keys and the memory per key prefix of the current db from",
+        "    up to SAMPLES (1000 by default) randomly sampled keys per shard. The prefix is the",
+        "    part of the key before the first DELIMITER (':' by default), keys without it are",
+        "    counted for the empty prefix. Returns the TOP (20 by default) prefixes by memory.",
         "DECOMMIT",
         "    Force decommit the memory freed by the server back to OS.",
         "TRACK",
@@ -125,6 +210,9 @@ void MemoryCmd::Run(CmdArgList args) {
         "    ADDRESS <address>",
         "        Returns whether <address> is known to be allocated internally by any of the "
         "backing heaps",
+        "    PROFILE <sample-bytes>",
+        "        Samples on average one allocation per <sample-bytes> allocated bytes with its",
+        "        stack, 0 stops sampling. The heap profile is served on the /heapz page",
     };
     auto* rb = static_cast<RedisReplyBuilder*>(cntx_->reply_builder());
     return rb->SendSimpleStrArr(help_arr);
@@ -139,6 +227,11 @@ void MemoryCmd::Run(CmdArgList args) {
     return Usage(key);
   }
 
+  if (sub_cmd == "PREFIX-USAGE") {
+    args.remove_prefix(1);
+    return PrefixUsage(args);
+  }
+
   if (sub_cmd == "DECOMMIT") {
     shard_set->pool()->AwaitBrief([](unsigned, auto* pb) {
       ServerState::tlocal()->DecommitMemory(ServerState::kDataHeap | ServerState::kBackingHeap |
@@ -178,6 +271,9 @@ struct ConnectionMemoryUsage {
   size_t connection_count = 0;
   size_t connection_size = 0;
   size_t pipelined_bytes = 0;
+  size_t parser_bytes = 0;
+  size_t reply_bytes = 0;
+  size_t arg_arena_bytes = 0;
   io::IoBuf::MemoryUsage connections_memory;
 
   size_t replication_connection_count = 0;
@@ -202,6 +298,9 @@ ConnectionMemoryUsage GetConnectionMemoryUsage(ServerFamily* server) {
         mems[thread_index].connection_count++;
         mems[thread_index].connection_size += usage.mem;
         mems[thread_index].connections_memory += usage.buf_mem;
+        mems[thread_index].parser_bytes += usage.parser_bytes;
+        mems[thread_index].reply_bytes += usage.reply_bytes;
+        mems[thread_index].arg_arena_bytes += usage.arg_arena_bytes;
       } else {
         mems[thread_index].replication_connection_count++;
         mems[thread_index].replication_connection_size += usage.mem;
@@ -221,6 +320,9 @@ ConnectionMemoryUsage GetConnectionMemoryUsage(ServerFamily* server) {
     mem.pipelined_bytes += m.pipelined_bytes;
     mem.connection_size += m.connection_size;
     mem.connections_memory += m.connections_memory;
+    mem.parser_bytes += m.parser_bytes;
+    mem.reply_bytes += m.reply_bytes;
+    mem.arg_arena_bytes += m.arg_arena_bytes;
     mem.replication_connection_count += m.replication_connection_count;
     mem.replication_connection_size += m.replication_connection_size;
     mem.replication_memory += m.replication_memory;
@@ -251,6 +353,12 @@ void MemoryCmd::Stats() {
   stats.push_back({"data_bytes", used_mem_current.load(memory_order_relaxed)});
   stats.push_back({"data_peak_bytes", used_mem_peak.load(memory_order_relaxed)});
 
+  // Index of the keys with expiry, see --expire_timer_wheel.
+  size_t expire_wheel_bytes = 0;
+  for (const auto& db_stats : server_metrics.db_stats)
+    expire_wheel_bytes += db_stats.expire_wheel_mem_usage;
+  stats.push_back({"expire_wheel_bytes", expire_wheel_bytes});
+
   ConnectionMemoryUsage connection_memory = GetConnectionMemoryUsage(owner_);
 
   // Connection stats, excluding replication connections
@@ -262,6 +370,11 @@ void MemoryCmd::Stats() {
                        &stats);
   stats.push_back({"connections.pipeline_bytes", connection_memory.pipelined_bytes});
 
+  // Components of the direct bytes
+  stats.push_back({"connections.parser_bytes", connection_memory.parser_bytes});
+  stats.push_back({"connections.reply_bytes", connection_memory.reply_bytes});
+  stats.push_back({"connections.arg_arena_bytes", connection_memory.arg_arena_bytes});
+
   // Replication connection stats
   stats.push_back(
       {"replication.connections_count", connection_memory.replication_connection_count});
@@ -282,6 +395,30 @@ void MemoryCmd::Stats() {
   stats.push_back({"serialization", serialization_memory.load()});
   stats.push_back({"tls", tls_memory.load()});
 
+  // Huge page coverage of table segments, see --table_segment_arena.
+  atomic<size_t> arena_mapped = 0, arena_used = 0, arena_huge = 0;
+  atomic_bool arena_transparent = false;
+  shard_set->RunBriefInParallel([&](EngineShard* shard) {
+    if (const SegmentArena* arena = shard->segment_arena(); arena) {
+      arena_mapped.fetch_add(arena->mapped_bytes(), memory_order_relaxed);
+      arena_used.fetch_add(arena->used_bytes(), memory_order_relaxed);
+      if (arena->has_transparent_regions())
+        arena_transparent.store(true, memory_order_relaxed);
+    }
+  });
+
+  // smaps is parsed once here rather than by every shard, the shards only look up their regions.
+  vector<SegmentArena::HugePageMapping> huge_mappings;
+  if (arena_transparent.load(memory_order_relaxed))
+    huge_mappings = SegmentArena::ReadHugePageMappings();
+  shard_set->RunBriefInParallel([&](EngineShard* shard) {
+    if (const SegmentArena* arena = shard->segment_arena(); arena)
+      arena_huge.fetch_add(arena->HugePageBytes(huge_mappings), memory_order_relaxed);
+  });
+  stats.push_back({"segment_arena.mapped_bytes", arena_mapped.load()});
+  stats.push_back({"segment_arena.used_bytes", arena_used.load()});
+  stats.push_back({"segment_arena.huge_page_bytes", arena_huge.load()});
+
   auto* rb = static_cast<RedisReplyBuilder*>(cntx_->reply_builder());
   rb->StartCollection(stats.size(), RedisReplyBuilder::MAP);
   for (const auto& [k, v] : stats) {
@@ -370,6 +507,59 @@ void MemoryCmd::Usage(std::string_view key) {
   rb->SendLong(memory_usage);
 }
 
+void MemoryCmd::PrefixUsage(CmdArgList args) {
+  string_view delimiter = ":";
+  size_t samples = 1000, top = 20;
+
+  CmdArgParser parser(args);
+  while (parser.HasNext()) {
+    if (parser.Check("DELIMITER").IgnoreCase().ExpectTail(1)) {
+      delimiter = parser.Next();
+    } else if (parser.Check("SAMPLES").IgnoreCase().ExpectTail(1)) {
+      samples = parser.Next<size_t>();
+    } else if (parser.Check("TOP").IgnoreCase().ExpectTail(1)) {
+      top = parser.Next<size_t>();
+    } else {
+      return cntx_->SendError(kSyntaxErr);
+    }
+  }
+
+  if (auto err = parser.Error(); err)
+    return cntx_->SendError(err->MakeReply());
+
+  if (delimiter.empty() || samples == 0 || samples > 100'000)
+    return cntx_->SendError(kSyntaxErr);
+
+  vector<PrefixUsageMap> shard_usage(shard_set->size());
+  DbIndex db_index = cntx_->db_index();
+  shard_set->RunBlockingInParallel([&](EngineShard* shard) {
+    shard_usage[shard->shard_id()] =
+        SamplePrefixUsage(&shard->db_slice(), db_index, delimiter, samples);
+  });
+
+  PrefixUsageMap usage;
+  for (const auto& map : shard_usage) {
+    for (const auto& [prefix, stats] : map) {
+      usage[prefix].keys += stats.keys;
+      usage[prefix].bytes += stats.bytes;
+    }
+  }
+
+  vector<pair<string_view, PrefixStats>> sorted(usage.begin(), usage.end());
+  sort(sorted.begin(), sorted.end(),
+       [](const auto& l, const auto& r) { return l.second.bytes > r.second.bytes; });
+  sorted.resize(min(sorted.size(), top));
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx_->reply_builder());
+  rb->StartArray(sorted.size());
+  for (const auto& [prefix, stats] : sorted) {
+    rb->StartArray(3);
+    rb->SendBulkString(prefix);
+    rb->SendLong(llround(stats.keys));
+    rb->SendLong(llround(stats.bytes));
+  }
+}
+
 void MemoryCmd::Track(CmdArgList args) {
 #ifndef DFLY_ENABLE_MEMORY_TRACKING
   return cntx_->SendError("MEMORY TRACK must be enabled at build time.");
@@ -440,6 +630,21 @@ void MemoryCmd::Track(CmdArgList args) {
     return;
   }
 
+  if (sub_cmd == "PROFILE") {
+    size_t sample_bytes = parser.Next<size_t>();
+    if (parser.HasError()) {
+      return cntx_->SendError(parser.Error()->MakeReply());
+    }
+
+    shard_set->pool()->AwaitBrief([sample_bytes](unsigned index, auto*) {
+      if (sample_bytes > 0)
+        AllocationTracker::Get().StartProfile(sample_bytes);
+      else
+        AllocationTracker::Get().StopProfile();
+    });
+    return cntx_->SendOk();
+  }
+
   if (sub_cmd == "ADDRESS") {
     string_view ptr_str = parser.Next();
     if (parser.HasError()) {
@@ -21,6 +21,7 @@ class MemoryCmd {
   void MallocStats();
   void ArenaStats(CmdArgList args);
   void Usage(std::string_view key);
+  void PrefixUsage(CmdArgList args);
   void Track(CmdArgList args);
 
   ConnectionContext* cntx_;
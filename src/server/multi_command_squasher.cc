@@ -4,6 +4,7 @@
 
 #include "server/multi_command_squasher.h"
 
+#include <absl/cleanup/cleanup.h>
 #include <absl/container/inlined_vector.h>
 
 #include "base/logging.h"
@@ -40,13 +41,15 @@ void CheckConnStateClean(const ConnectionState& state) {
 }  // namespace
 
 MultiCommandSquasher::MultiCommandSquasher(absl::Span<StoredCmd> cmds, ConnectionContext* cntx,
-                                           Service* service, bool verify_commands, bool error_abort)
+                                           Service* service, bool verify_commands, bool error_abort,
+                                           vector<Payload>* captured)
     : cmds_{cmds},
       cntx_{cntx},
       service_{service},
       base_cid_{nullptr},
       verify_commands_{verify_commands},
-      error_abort_{error_abort} {
+      error_abort_{error_abort},
+      captured_{captured} {
   auto mode = cntx->transaction->GetMultiMode();
   base_cid_ = cntx->transaction->GetCId();
   atomic_ = mode != Transaction::NON_ATOMIC;
@@ -134,6 +137,20 @@ bool MultiCommandSquasher::ExecuteStandalone(StoredCmd* cmd) {
   cmd->Fill(&tmp_keylist_);
   auto args = absl::MakeSpan(tmp_keylist_);
 
+  // Capture the reply of the command to store it alongside the squashed ones.
+  optional<CapturingReplyBuilder> crb;
+  SinkReplyBuilder* orig_rb = nullptr;
+  if (captured_) {
+    crb.emplace(cmd->ReplyMode());
+    orig_rb = cntx_->Inject(&*crb);
+  }
+  absl::Cleanup restore = [&] {
+    if (captured_) {
+      cntx_->Inject(orig_rb);
+      captured_->push_back(crb->Take());
+    }
+  };
+
   if (verify_commands_) {
     if (auto err = service_->VerifyCommandState(cmd->Cid(), args, *cntx_); err) {
       cntx_->SendError(std::move(*err));
@@ -201,60 +218,118 @@ OpStatus MultiCommandSquasher::SquashedHopCb(Transaction* parent_tx, EngineShard
   return OpStatus::OK;
 }
 
+void MultiCommandSquasher::RunSquashedHop() {
+  Transaction* tx = cntx_->transaction;
+
+  // Atomic transactions (that have all keys locked) perform hops and run squashed commands via
+  // stubs, non-atomic ones just run the commands in parallel.
+  if (IsAtomic()) {
+    cntx_->cid = base_cid_;
+    auto cb = [this](ShardId sid) { return !sharded_[sid].cmds.empty(); };
+    tx->PrepareSquashedMultiHop(base_cid_, cb);
+    tx->ScheduleSingleHop([this](auto* tx, auto* es) { return SquashedHopCb(tx, es); });
+  } else {
+    shard_set->RunBlockingInParallel([this, tx](auto* es) { SquashedHopCb(tx, es); },
+                                     [this](auto sid) { return !sharded_[sid].cmds.empty(); });
+  }
+}
+
 bool MultiCommandSquasher::ExecuteSquashed() {
   DCHECK(!cntx_->conn_state.exec_info.IsCollecting());
 
   if (order_.empty())
     return true;
 
+  // The previous batch failed, so the current one must not run.
+  if (pending_.has_error) {
+    for (auto& sinfo : sharded_)
+      sinfo.cmds.clear();
+    order_.clear();
+    return FlushReplies();
+  }
+
   for (auto& sd : sharded_)
     sd.replies.reserve(sd.cmds.size());
 
-  Transaction* tx = cntx_->transaction;
-  ServerState::tlocal()->stats.multi_squash_executions++;
+  auto& stats = ServerState::tlocal()->stats;
+  stats.multi_squash_executions++;
   ProactorBase* proactor = ProactorBase::me();
   uint64_t start = proactor->GetMonotonicTimeNs();
 
-  // Atomic transactions (that have all keys locked) perform hops and run squashed commands via
-  // stubs, non-atomic ones just run the commands in parallel.
-  if (IsAtomic()) {
-    cntx_->cid = base_cid_;
-    auto cb = [this](ShardId sid) { return !sharded_[sid].cmds.empty(); };
-    tx->PrepareSquashedMultiHop(base_cid_, cb);
-    tx->ScheduleSingleHop([this](auto* tx, auto* es) { return SquashedHopCb(tx, es); });
+  bool aborted = false;
+  if (pending_.order.empty()) {
+    RunSquashedHop();
   } else {
-    shard_set->RunBlockingInParallel([this, tx](auto* es) { SquashedHopCb(tx, es); },
-                                     [this](auto sid) { return !sharded_[sid].cmds.empty(); });
+    // Keep the shards busy while the previous replies are serialized. The hop fills only
+    // sharded_, so it does not touch the pending replies.
+    stats.multi_squash_pipelined_hops++;
+    fb2::Fiber hop_fb("squashed_hop", [this] { RunSquashedHop(); });
+    aborted = !FlushReplies();
+    hop_fb.Join();
   }
 
   uint64_t after_hop = proactor->GetMonotonicTimeNs();
+  ServerState::SafeTLocal()->stats.multi_squash_exec_hop_usec += (after_hop - start) / 1000;
+
+  // Errors are checked right away, so that the next batch is not started after a failed one.
+  if (pending_.sharded.empty())
+    pending_.sharded.resize(sharded_.size());
+  for (size_t i = 0; i < sharded_.size(); ++i) {
+    auto& replies = sharded_[i].replies;
+    if (error_abort_) {
+      for (const auto& reply : replies)
+        pending_.has_error |= bool(CapturingReplyBuilder::GetError(reply));
+    }
+    pending_.sharded[i].swap(replies);
+    sharded_[i].cmds.clear();
+  }
+  pending_.order.swap(order_);
+  order_.clear();
+
+  return !aborted;
+}
+
+bool MultiCommandSquasher::FlushReplies() {
+  if (pending_.order.empty())
+    return true;
+
+  uint64_t start = ProactorBase::me()->GetMonotonicTimeNs();
   bool aborted = false;
 
-  RedisReplyBuilder* rb = static_cast<RedisReplyBuilder*>(cntx_->reply_builder());
-  for (auto idx : order_) {
-    auto& replies = sharded_[idx].replies;
+  for (auto idx : pending_.order) {
+    auto& replies = pending_.sharded[idx];
     CHECK(!replies.empty());
 
     aborted |= error_abort_ && CapturingReplyBuilder::GetError(replies.back());
 
-    CapturingReplyBuilder::Apply(std::move(replies.back()), rb);
+    SendReply(std::move(replies.back()));
     replies.pop_back();
 
     if (aborted)
       break;
   }
-  uint64_t after_reply = proactor->GetMonotonicTimeNs();
-  ServerState::SafeTLocal()->stats.multi_squash_exec_hop_usec += (after_hop - start) / 1000;
-  ServerState::SafeTLocal()->stats.multi_squash_exec_reply_usec += (after_reply - after_hop) / 1000;
 
-  for (auto& sinfo : sharded_)
-    sinfo.cmds.clear();
+  for (auto& replies : pending_.sharded)
+    replies.clear();
+  pending_.order.clear();
+  pending_.has_error = false;
 
-  order_.clear();
+  uint64_t after_reply = ProactorBase::me()->GetMonotonicTimeNs();
+  ServerState::SafeTLocal()->stats.multi_squash_exec_reply_usec += (after_reply - start) / 1000;
   return !aborted;
 }
 
-void MultiCommandSquasher::Run() {
+void MultiCommandSquasher::SendReply(Payload&& reply) {
+  if (captured_) {
+    captured_->push_back(std::move(reply));
+    return;
+  }
+
+  RedisReplyBuilder* rb = static_cast<RedisReplyBuilder*>(cntx_->reply_builder());
+  CapturingReplyBuilder::Apply(std::move(reply), rb);
+}
+
+size_t MultiCommandSquasher::Run() {
   DVLOG(1) << "Trying to squash " << cmds_.size() << " commands for transaction "
            << cntx_->transaction->DebugId();
 
@@ -270,12 +345,14 @@ void MultiCommandSquasher::Run() {
     }
 
     if (res == SquashResult::NOT_SQUASHED) {
-      if (!ExecuteStandalone(&cmd))
+      if (!FlushReplies() || !ExecuteStandalone(&cmd))
         break;
     }
   }
 
-  ExecuteSquashed();  // Flush leftover
+  // Flush leftover
+  if (ExecuteSquashed())
+    FlushReplies();
 
   // Set last txid.
   cntx_->last_command_debug.clock = cntx_->transaction->txid();
@@ -295,6 +372,7 @@ void MultiCommandSquasher::Run() {
 
   VLOG(1) << "Squashed " << num_squashed_ << " of " << cmds_.size()
           << " commands, max fanout: " << num_shards_ << ", atomic: " << atomic_;
+  return num_squashed_;
 }
 
 bool MultiCommandSquasher::IsAtomic() const {
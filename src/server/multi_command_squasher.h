@@ -20,11 +20,22 @@ namespace dfly {
 // transactional api for commands. Non atomic multi transactions use regular shard_set dispatches
 // instead of hops for executing batches. This allows avoiding locking many keys at once. Each shard
 // contains a non-atomic multi transaction to execute squashed commands.
+//
+// Batches are pipelined: the replies of a batch are kept aside and serialized while the next batch
+// is executing on the shards. They are always flushed before a standalone command runs, so the
+// replies reach the client in the order of the commands.
+//
+// If `captured` is set, replies are not sent but stored there in the order of the commands
+// instead. Commands that were not executed because of an abort have no entry.
 class MultiCommandSquasher {
  public:
-  static void Execute(absl::Span<StoredCmd> cmds, ConnectionContext* cntx, Service* service,
-                      bool verify_commands = false, bool error_abort = false) {
-    MultiCommandSquasher{cmds, cntx, service, verify_commands, error_abort}.Run();
+  using Payload = facade::CapturingReplyBuilder::Payload;
+
+  // Returns the number of commands that were executed in squashed hops.
+  static size_t Execute(absl::Span<StoredCmd> cmds, ConnectionContext* cntx, Service* service,
+                        bool verify_commands = false, bool error_abort = false,
+                        std::vector<Payload>* captured = nullptr) {
+    return MultiCommandSquasher{cmds, cntx, service, verify_commands, error_abort, captured}.Run();
   }
 
  private:
@@ -35,17 +46,24 @@ class MultiCommandSquasher {
 
     bool had_writes;
     std::vector<StoredCmd*> cmds;  // accumulated commands
-    std::vector<facade::CapturingReplyBuilder::Payload> replies;
+    std::vector<Payload> replies;
     boost::intrusive_ptr<Transaction> local_tx;  // stub-mode tx for use inside shard
   };
 
+  // Replies of the last executed batch that were not serialized yet.
+  struct PendingReplies {
+    std::vector<std::vector<Payload>> sharded;
+    std::vector<ShardId> order;
+    bool has_error = false;  // whether the batch should abort execution
+  };
+
   enum class SquashResult { SQUASHED, SQUASHED_FULL, NOT_SQUASHED, ERROR };
 
   static constexpr int kMaxSquashing = 32;
 
  private:
   MultiCommandSquasher(absl::Span<StoredCmd> cmds, ConnectionContext* cntx, Service* Service,
-                       bool verify_commands, bool error_abort);
+                       bool verify_commands, bool error_abort, std::vector<Payload>* captured);
 
   // Lazy initialize shard info.
   ShardExecInfo& PrepareShardInfo(ShardId sid, std::optional<cluster::SlotId> slot_id);
@@ -59,11 +77,21 @@ class MultiCommandSquasher {
   // Callback that runs on shards during squashed hop.
   facade::OpStatus SquashedHopCb(Transaction* parent_tx, EngineShard* es);
 
-  // Execute all currently squashed commands. Return false if aborting on error.
+  // Run the hop of the current batch.
+  void RunSquashedHop();
+
+  // Execute all currently squashed commands, while serializing the replies of the previous batch.
+  // Their replies become pending. Return false if aborting on error.
   bool ExecuteSquashed();
 
-  // Run all commands until completion.
-  void Run();
+  // Serialize the pending replies. Return false if aborting on error.
+  bool FlushReplies();
+
+  // Send reply to the client or capture it.
+  void SendReply(Payload&& reply);
+
+  // Run all commands until completion. Returns the number of squashed commands.
+  size_t Run();
 
   bool IsAtomic() const;
 
@@ -78,8 +106,11 @@ class MultiCommandSquasher {
   bool verify_commands_ = false;  // Whether commands need to be verified before execution
   bool error_abort_ = false;      // Abort upon receiving error
 
+  std::vector<Payload>* captured_;  // If set, replies are stored here instead of being sent
+
   std::vector<ShardExecInfo> sharded_;
   std::vector<ShardId> order_;  // reply order for squashed cmds
+  PendingReplies pending_;
 
   size_t num_squashed_ = 0;
   size_t num_shards_ = 0;
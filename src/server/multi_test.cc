@@ -884,6 +884,51 @@ TEST_F(MultiTest, TestSquashing) {
   Run({"exec"});
 }
 
+// Test that replies of pipelined squashed hops keep the order of the commands.
+TEST_F(MultiTest, SquashingPipelinedHops) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_multi_exec_squash, true);
+
+  Run({"multi"});
+  for (unsigned i = 0; i < 100; ++i)
+    Run({"incr", kKeySid0});
+  Run({"get", kKeySid0});
+  auto resp = Run({"exec"});
+
+  ASSERT_THAT(resp, ArrLen(101));
+  for (unsigned i = 0; i < 100; ++i)
+    ASSERT_THAT(resp.GetVec()[i], IntArg(i + 1));
+  EXPECT_EQ(resp.GetVec()[100], "100");
+
+  // A squashed batch holds at most 31 commands per shard.
+  EXPECT_EQ(GetMetrics().coordinator_stats.multi_squash_pipelined_hops, 3u);
+}
+
+// Test that bodies without squashable commands stop squashing after a few runs.
+TEST_F(MultiTest, SquashingSkipped) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_multi_exec_squash, true);
+
+  for (unsigned i = 0; i < 20; ++i) {
+    Run({"multi"});
+    Run({"mset", kKeySid0, "a", kKeySid1, "b"});
+    Run({"incr", kKeySid2});
+    auto resp = Run({"exec"});
+    ASSERT_THAT(resp, ArrLen(2));
+    EXPECT_THAT(resp.GetVec()[1], IntArg(i + 1));
+  }
+  EXPECT_EQ(GetMetrics().coordinator_stats.multi_squash_skipped, 0u);
+
+  for (unsigned i = 0; i < 20; ++i) {
+    Run({"multi"});
+    Run({"mset", kKeySid0, "a", kKeySid1, "b"});
+    Run({"mset", kKeySid1, "c", kKeySid2, "d"});
+    ASSERT_THAT(Run({"exec"}), ArrLen(2));
+  }
+  EXPECT_EQ(GetMetrics().coordinator_stats.multi_squash_skipped, 4u);
+  EXPECT_EQ(Run({"get", kKeySid1}), "c");
+}
+
 TEST_F(MultiTest, MultiLeavesTxQueue) {
   if (auto mode = absl::GetFlag(FLAGS_multi_exec_mode); mode == Transaction::NON_ATOMIC) {
     GTEST_SKIP() << "Skipped MultiLeavesTxQueue test because multi_exec_mode is non atomic";
@@ -995,6 +1040,34 @@ TEST_F(MultiTest, EvalExpiration) {
   EXPECT_LE(CheckedInt({"pttl", "x"}), 5000);
 }
 
+TEST_F(MultiTest, EvalPrefetchKeys) {
+  if (auto config = absl::GetFlag(FLAGS_default_lua_flags); config != "") {
+    GTEST_SKIP() << "Skipped Eval test because default_lua_flags is set";
+    return;
+  }
+
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_multi_exec_mode, Transaction::LOCK_AHEAD);
+  Run({"set", "x", "1"});
+
+  // The prefetched entries are deleted and recreated under the script.
+  const char* kScript = R"(
+    redis.call('incr', KEYS[1])
+    redis.call('del', KEYS[1])
+    redis.call('set', KEYS[1], 'a')
+    redis.call('append', KEYS[1], 'b')
+    redis.call('rpush', KEYS[2], 'c')
+    return {redis.call('get', KEYS[1]), redis.call('lpop', KEYS[2]), redis.call('get', KEYS[2])}
+  )";
+  auto resp = Run({"eval", kScript, "2", "x", "y"});
+  ASSERT_THAT(resp, ArrLen(3));
+  EXPECT_THAT(resp.GetVec(), ElementsAre("ab", "c", ArgType(RespExpr::NIL)));
+  EXPECT_GT(GetMetrics().events.prefetch_hits, 0u);
+
+  Run({"flushall"});
+  EXPECT_THAT(Run({"eval", kScript, "2", "x", "y"}).GetVec()[0], "ab");
+}
+
 TEST_F(MultiTest, MemoryInScript) {
   EXPECT_EQ(Run({"set", "x", "y"}), "OK");
 
@@ -1082,6 +1155,36 @@ TEST_F(MultiEvalTest, ScriptSquashingUknownCmd) {
   EXPECT_EQ(Run({"get", "A"}), "2");
 }
 
+TEST_F(MultiEvalTest, ScriptDeferredCalls) {
+  string_view s = R"(
+    local handles = {}
+    for i = 1, 20 do
+      handles[i] = redis.dcall('INCRBY', 'k' .. i, i)
+    end
+    local sum = 0
+    for i = 1, 20 do
+      sum = sum + redis.await(handles[i])
+    end
+    return sum
+  )";
+
+  EXPECT_THAT(Run({"eval", s, "0"}), IntArg(210));
+  EXPECT_EQ(Run({"get", "k7"}), "7");
+
+  // All calls were buffered and executed by a single flush once the first reply was read.
+  auto metrics = GetMetrics();
+  EXPECT_EQ(metrics.coordinator_stats.eval_squashed_flushes, 1u);
+
+  EXPECT_THAT(Run({"eval", "local h = redis.dcall('GET', 'k1'); redis.await(h); "
+                           "return redis.await(h)",
+                   "0"}),
+              ErrArg("already resolved"));
+
+  // Errors of deferred calls abort the script just like redis.acall
+  EXPECT_THAT(Run({"eval", "redis.dcall('LPUSH', 'k1', 'x'); return 1", "0"}),
+              ErrArg("WRONGTYPE"));
+}
+
 TEST_F(MultiEvalTest, MultiAndEval) {
   // We had a bug in borrowing interpreters which caused a crash in this scenario
   Run({"multi"});
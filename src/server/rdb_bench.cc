@@ -0,0 +1,209 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+
+#include <iostream>
+
+#include "base/flags.h"
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "io/file.h"
+#include "io/io.h"
+#include "server/engine_shard_set.h"
+#include "server/rdb_load.h"
+#include "server/rdb_save.h"
+#include "server/test_utils.h"
+
+// Measures the save and load throughput of a single shard per data type and compression mode.
+// Run for example: rdb_bench --keys=200000 --types=string,hash --value_size=256
+
+ABSL_FLAG(uint32_t, keys, 100'000, "Number of keys populated for every data type");
+ABSL_FLAG(uint32_t, value_size, 64, "Size of string values and of container elements");
+ABSL_FLAG(uint32_t, elements, 16, "Number of elements of every container");
+ABSL_FLAG(std::vector<std::string>, types, (std::vector<std::string>{"string", "hash", "set",
+                                                                      "zset", "list"}),
+          "Data types to measure, as accepted by DEBUG POPULATE TYPE");
+ABSL_FLAG(std::string, snapshot_file, "",
+          "If set, the snapshot is written into this file and read back from it. Otherwise "
+          "it is kept in memory, which leaves the I/O share to copying.");
+
+ABSL_DECLARE_FLAG(dfly::CompressionMode, compression_mode);
+
+namespace dfly {
+
+using namespace std;
+using namespace util;
+
+namespace {
+
+// Measures the time spent writing into the wrapped sink.
+class TimedSink : public io::Sink {
+ public:
+  explicit TimedSink(io::Sink* upstream) : upstream_(upstream) {
+  }
+
+  io::Result<size_t> WriteSome(const iovec* v, uint32_t len) final {
+    uint64_t start = absl::GetCurrentTimeNanos();
+    auto res = upstream_->WriteSome(v, len);
+    write_ns += absl::GetCurrentTimeNanos() - start;
+    if (res)
+      bytes += *res;
+    return res;
+  }
+
+  uint64_t write_ns = 0;
+  size_t bytes = 0;
+
+ private:
+  io::Sink* upstream_;
+};
+
+struct BenchResult {
+  size_t bytes = 0;
+  uint64_t wall_ns = 0;
+  uint64_t compression_ns = 0;
+  uint64_t io_ns = 0;
+};
+
+double MBps(size_t bytes, uint64_t ns) {
+  return ns == 0 ? 0 : double(bytes) * 1000 / ns;  // bytes per ns * 1000 = MB/s
+}
+
+double Share(uint64_t part, uint64_t total) {
+  return total == 0 ? 0 : 100.0 * part / total;
+}
+
+}  // namespace
+
+class RdbBench : public BaseFamilyTest {
+ protected:
+  RdbBench() {
+    // A single shard, so that a stage runs in a single thread and its time splits into
+    // serialization, compression and writing.
+    num_threads_ = 1;
+  }
+
+  void Populate(string_view type);
+  BenchResult Save(string* blob);
+  BenchResult Load(const string& blob);
+};
+
+void RdbBench::Populate(string_view type) {
+  Run({"flushall"});
+
+  string keys = absl::StrCat(absl::GetFlag(FLAGS_keys));
+  string size = absl::StrCat(absl::GetFlag(FLAGS_value_size));
+  string elements = absl::StrCat(absl::GetFlag(FLAGS_elements));
+  if (type == "string") {
+    Run({"debug", "populate", keys, "key", size});
+  } else {
+    Run({"debug", "populate", keys, "key", size, "type", type, "elements", elements});
+  }
+  ASSERT_EQ(absl::GetFlag(FLAGS_keys), CheckedInt({"dbsize"}));
+}
+
+BenchResult RdbBench::Save(string* blob) {
+  string path = absl::GetFlag(FLAGS_snapshot_file);
+  BenchResult res;
+
+  pp_->at(0)->Await([&] {
+    io::StringSink string_sink;
+    unique_ptr<io::WriteFile> file;
+    io::Sink* dest = &string_sink;
+    if (!path.empty()) {
+      auto file_res = io::OpenWrite(path, io::WriteFile::Options{});
+      CHECK(file_res) << file_res.error().message();
+      file.reset(*file_res);
+      dest = file.get();
+    }
+
+    TimedSink sink(dest);
+    Context cntx;
+    uint64_t start = absl::GetCurrentTimeNanos();
+    uint64_t compression_start = SerializerBase::GetThreadLocalCompressionNs();
+
+    // The format of dfs files, with the header of a full sync.
+    RdbSaver saver(&sink, SaveMode::SINGLE_SHARD_WITH_SUMMARY, false);
+    CHECK(!saver.SaveHeader(RdbSaver::GetGlobalData(service_.get())));
+    saver.StartSnapshotInShard(false, cntx.GetCancellation(), EngineShard::tlocal());
+    CHECK(!saver.SaveBody(&cntx, nullptr));
+    if (file)
+      CHECK(!file->Close());
+
+    res.wall_ns = absl::GetCurrentTimeNanos() - start;
+    res.compression_ns = SerializerBase::GetThreadLocalCompressionNs() - compression_start;
+    res.io_ns = sink.write_ns;
+    res.bytes = sink.bytes;
+    if (path.empty())
+      *blob = string_sink.str();
+  });
+
+  return res;
+}
+
+BenchResult RdbBench::Load(const string& blob) {
+  string path = absl::GetFlag(FLAGS_snapshot_file);
+  BenchResult res;
+  Run({"flushall"});
+
+  pp_->at(0)->Await([&] {
+    uint64_t start = absl::GetCurrentTimeNanos();
+    RdbLoader loader{service_.get()};
+    error_code ec;
+    if (path.empty()) {
+      io::BytesSource source{io::Buffer(blob)};
+      ec = loader.Load(&source);
+      res.bytes = blob.size();
+    } else {
+      auto file_res = io::OpenRead(path, io::ReadonlyFile::Options{});
+      CHECK(file_res) << file_res.error().message();
+      io::FileSource source(*file_res);
+      ec = loader.Load(&source);
+      res.bytes = (*file_res)->Size();
+    }
+    CHECK(!ec) << ec.message();
+
+    res.wall_ns = absl::GetCurrentTimeNanos() - start;
+  });
+
+  EXPECT_EQ(absl::GetFlag(FLAGS_keys), CheckedInt({"dbsize"}));
+  return res;
+}
+
+TEST_F(RdbBench, SaveLoad) {
+  const pair<CompressionMode, string_view> kModes[] = {
+      {CompressionMode::NONE, "none"},
+      {CompressionMode::SINGLE_ENTRY, "single_entry"},
+      {CompressionMode::MULTI_ENTRY_ZSTD, "zstd"},
+      {CompressionMode::MULTI_ENTRY_LZ4, "lz4"},
+  };
+
+  absl::FlagSaver fs;
+  cout << absl::StrFormat("%-8s %-13s %10s %10s %8s %8s %8s %10s\n", "type", "compression",
+                          "size MB", "save MB/s", "serial%", "compr%", "io%", "load MB/s");
+
+  for (const string& type : absl::GetFlag(FLAGS_types)) {
+    Populate(type);
+    for (auto [mode, mode_name] : kModes) {
+      absl::SetFlag(&FLAGS_compression_mode, mode);
+
+      string blob;
+      BenchResult save = Save(&blob);
+      BenchResult load = Load(blob);  // restores the same data for the next mode
+
+      // Time not spent in compression or writing is spent in serialization.
+      uint64_t serialization_ns =
+          save.wall_ns - min(save.wall_ns, save.compression_ns + save.io_ns);
+      cout << absl::StrFormat("%-8s %-13s %10.1f %10.1f %8.1f %8.1f %8.1f %10.1f\n", type,
+                              mode_name, save.bytes / 1e6, MBps(save.bytes, save.wall_ns),
+                              Share(serialization_ns, save.wall_ns),
+                              Share(save.compression_ns, save.wall_ns),
+                              Share(save.io_ns, save.wall_ns), MBps(load.bytes, load.wall_ns));
+    }
+  }
+}
+
+}  // namespace dfly
@@ -15,6 +15,14 @@ constexpr uint8_t RDB_TYPE_HASH_WITH_EXPIRY = 31;
 constexpr uint8_t RDB_TYPE_SET_WITH_EXPIRY = 32;
 constexpr uint8_t RDB_TYPE_SBF = 33;
 
+// Reference to a value offloaded to kept tiered storage backing files. Only the snapshot saved
+// on shutdown with --tiered_storage_persistent has them and only the initial load accepts them.
+constexpr uint8_t RDB_TYPE_TIERED = 34;
+
+// Bits of the options field of RDB_TYPE_SBF. Filters of a blocked SBF use the cache-line
+// blocked layout.
+constexpr uint64_t RDB_SBF_OPTION_BLOCKED = 1;
+
 constexpr bool rdbIsObjectTypeDF(uint8_t type) {
   return __rdbIsObjectType(type) || (type == RDB_TYPE_JSON) ||
          (type == RDB_TYPE_HASH_WITH_EXPIRY) || (type == RDB_TYPE_SET_WITH_EXPIRY) ||
@@ -40,6 +48,19 @@ constexpr uint8_t RDB_OPCODE_JOURNAL_BLOB = 210;
 // so it is always sent at the end of the RDB stream.
 constexpr uint8_t RDB_OPCODE_JOURNAL_OFFSET = 211;
 
+// Followed by a key that was deleted since the base snapshot of a delta snapshot.
+// Delta snapshots write all the deletion markers of a shard before its entries.
+constexpr uint8_t RDB_OPCODE_DELETED_KEY = 212;
+
+// Followed by a zstd dictionary that the next RDB_OPCODE_COMPRESSED_ZSTD_BLOB_START blobs
+// of the same stream are compressed with.
+constexpr uint8_t RDB_OPCODE_ZSTD_DICT = 213;
+
+// Precedes every part of a big value saved in several entries, but the last one. Each part is
+// an entry with the same key and type holding some of the elements, the loader merges them.
+// Only the first part carries the expiry and the DF mask of the key.
+constexpr uint8_t RDB_OPCODE_FRAGMENT = 214;
+
 constexpr uint8_t RDB_OPCODE_DF_MASK = 220; /* Mask for key properties */
 
 // RDB_OPCODE_DF_MASK define 4byte field with next flags
@@ -31,6 +31,8 @@ extern "C" {
 #include "base/logging.h"
 #include "core/bloom.h"
 #include "core/json/json_object.h"
+#include "core/qlist.h"
+#include "core/small_set.h"
 #include "core/sorted_map.h"
 #include "core/string_map.h"
 #include "core/string_set.h"
@@ -46,14 +48,23 @@ extern "C" {
 #include "server/serializer_commons.h"
 #include "server/server_state.h"
 #include "server/set_family.h"
+#include "server/tiered_storage.h"
 #include "server/tiering/common.h"  // for _KB literal
 #include "server/transaction.h"
 #include "strings/human_readable.h"
 
 ABSL_DECLARE_FLAG(int32_t, list_max_listpack_size);
 ABSL_DECLARE_FLAG(int32_t, list_compress_depth);
+ABSL_DECLARE_FLAG(bool, list_experimental_v2);
 ABSL_DECLARE_FLAG(uint32_t, dbnum);
 
+ABSL_FLAG(uint32_t, rdb_load_batch_size, 1024,
+          "Number of entries a loader sends to a shard at once.");
+ABSL_FLAG(uint32_t, rdb_load_inflight_batches, 64,
+          "Maximum number of batches a loader sends to shards before waiting for them to be "
+          "applied. Limits the memory held by loaded entries when the shards are slower than "
+          "the loaders, for example when many snapshot files are loaded concurrently.");
+
 namespace dfly {
 
 using namespace std;
@@ -241,10 +252,14 @@ class DecompressImpl {
 
 class ZstdDecompress : public DecompressImpl {
  public:
-  ZstdDecompress() {
+  // dict must be the dictionary the frames were compressed with, if any.
+  explicit ZstdDecompress(std::string_view dict = {}) {
     dctx_ = ZSTD_createDCtx();
+    if (!dict.empty())
+      ddict_ = ZSTD_createDDict(dict.data(), dict.size());
   }
   ~ZstdDecompress() {
+    ZSTD_freeDDict(ddict_);
     ZSTD_freeDCtx(dctx_);
   }
 
@@ -252,6 +267,7 @@ class ZstdDecompress : public DecompressImpl {
 
  private:
   ZSTD_DCtx* dctx_;
+  ZSTD_DDict* ddict_ = nullptr;
 };
 
 io::Result<io::IoBuf*> ZstdDecompress::Decompress(std::string_view str) {
@@ -274,7 +290,9 @@ io::Result<io::IoBuf*> ZstdDecompress::Decompress(std::string_view str) {
     return Unexpected(errc::out_of_memory);
   }
   size_t const d_size =
-      ZSTD_decompressDCtx(dctx_, dest.data(), dest.size(), str.data(), str.size());
+      ddict_ ? ZSTD_decompress_usingDDict(dctx_, dest.data(), dest.size(), str.data(), str.size(),
+                                          ddict_)
+             : ZSTD_decompressDCtx(dctx_, dest.data(), dest.size(), str.data(), str.size());
   if (d_size == 0 || d_size != uncomp_size) {
     LOG(ERROR) << "Invalid ZSTD compressed string";
     return Unexpected(errc::rdb_file_corrupted);
@@ -386,6 +404,7 @@ class RdbLoaderBase::OpaqueObjLoader {
   void operator()(const LzfString& lzfstr);
   void operator()(const unique_ptr<LoadTrace>& ptr);
   void operator()(const RdbSBF& src);
+  void operator()(const RdbTieredRef& ref);
 
   std::error_code ec() const {
     return ec_;
@@ -473,13 +492,21 @@ void RdbLoaderBase::OpaqueObjLoader::operator()(const unique_ptr<LoadTrace>& ptr
 void RdbLoaderBase::OpaqueObjLoader::operator()(const RdbSBF& src) {
   SBF* sbf =
       CompactObj::AllocateMR<SBF>(src.grow_factor, src.fp_prob, src.max_capacity, src.prev_size,
-                                  src.current_size, CompactObj::memory_resource());
+                                  src.current_size, CompactObj::memory_resource(), src.blocked);
   for (unsigned i = 0; i < src.filters.size(); ++i) {
     sbf->AddFilter(src.filters[i].blob, src.filters[i].hash_cnt);
   }
   pv_->SetSBF(sbf);
 }
 
+void RdbLoaderBase::OpaqueObjLoader::operator()(const RdbTieredRef& ref) {
+  // Segments are claimed from the backing files by RdbLoader once the value is created
+  if (ref.type == OBJ_STRING && ref.length < ref.size)
+    pv_->SetExternalCompressed(ref.offset, ref.length, ref.size);
+  else
+    pv_->SetExternal(ref.offset, ref.length, ref.type, ref.encoding);
+}
+
 void RdbLoaderBase::OpaqueObjLoader::CreateSet(const LoadTrace* ltrace) {
   size_t len = ltrace->blob_count();
 
@@ -497,6 +524,17 @@ void RdbLoaderBase::OpaqueObjLoader::CreateSet(const LoadTrace* ltrace) {
     is_intset = false;
   }
 
+  // Sets without member expiry that are small enough are loaded as SmallSet.
+  bool is_small = false;
+  if (!is_intset && rdb_type_ == RDB_TYPE_SET) {
+    size_t max_len = 0;
+    Iterate(*ltrace, [&](const LoadBlob& blob) {
+      max_len = max(max_len, ToSV(blob.rdb_var).size());
+      return true;
+    });
+    is_small = SetFamily::FitsSmallSet(len, max_len);
+  }
+
   sds sdsele = nullptr;
   void* inner_obj = nullptr;
 
@@ -505,6 +543,8 @@ void RdbLoaderBase::OpaqueObjLoader::CreateSet(const LoadTrace* ltrace) {
       sdsfree(sdsele);
     if (is_intset) {
       zfree(inner_obj);
+    } else if (is_small) {
+      SmallSet::Free((SmallSet*)inner_obj);
     } else {
       CompactObj::DeleteMR<StringSet>(inner_obj);
     }
@@ -525,6 +565,18 @@ void RdbLoaderBase::OpaqueObjLoader::CreateSet(const LoadTrace* ltrace) {
       }
       return true;
     });
+  } else if (is_small) {
+    SmallSet* set = SmallSet::Create(len);
+    Iterate(*ltrace, [&](const LoadBlob& blob) {
+      bool added = false;
+      set = SmallSet::Add(set, ToSV(blob.rdb_var), &added);
+      if (!added) {
+        LOG(ERROR) << "Duplicate set members detected";
+        ec_ = RdbError(errc::duplicate_key);
+      }
+      return added;
+    });
+    inner_obj = set;
   } else {
     StringSet* set = CompactObj::AllocateMR<StringSet>();
     set->set_time(MemberTimeSeconds(GetCurrentTimeMs()));
@@ -574,7 +626,10 @@ void RdbLoaderBase::OpaqueObjLoader::CreateSet(const LoadTrace* ltrace) {
 
   if (ec_)
     return;
-  pv_->InitRobj(OBJ_SET, is_intset ? kEncodingIntSet : kEncodingStrMap2, inner_obj);
+  unsigned encoding = is_intset ? kEncodingIntSet : kEncodingStrMap2;
+  if (is_small)
+    encoding = kEncodingSmallSet;
+  pv_->InitRobj(OBJ_SET, encoding, inner_obj);
   std::move(cleanup).Cancel();
 }
 
@@ -674,9 +729,21 @@ void RdbLoaderBase::OpaqueObjLoader::CreateHMap(const LoadTrace* ltrace) {
 }
 
 void RdbLoaderBase::OpaqueObjLoader::CreateList(const LoadTrace* ltrace) {
-  quicklist* ql =
-      quicklistNew(GetFlag(FLAGS_list_max_listpack_size), GetFlag(FLAGS_list_compress_depth));
-  auto cleanup = absl::Cleanup([&] { quicklistRelease(ql); });
+  quicklist* ql = nullptr;
+  QList* qlv2 = nullptr;
+  if (GetFlag(FLAGS_list_experimental_v2)) {
+    qlv2 = CompactObj::AllocateMR<QList>(GetFlag(FLAGS_list_max_listpack_size),
+                                         CompactObj::memory_resource());
+  } else {
+    ql = quicklistNew(GetFlag(FLAGS_list_max_listpack_size), GetFlag(FLAGS_list_compress_depth));
+  }
+
+  auto cleanup = absl::Cleanup([&] {
+    if (qlv2)
+      CompactObj::DeleteMR<QList>(qlv2);
+    else
+      quicklistRelease(ql);
+  });
 
   Iterate(*ltrace, [&](const LoadBlob& blob) {
     unsigned container = blob.encoding;
@@ -686,7 +753,10 @@ void RdbLoaderBase::OpaqueObjLoader::CreateList(const LoadTrace* ltrace) {
       return false;
 
     if (container == QUICKLIST_NODE_CONTAINER_PLAIN) {
-      quicklistAppendPlainNode(ql, (uint8_t*)sv.data(), sv.size());
+      if (qlv2)
+        qlv2->Push(sv, QList::TAIL);
+      else
+        quicklistAppendPlainNode(ql, (uint8_t*)sv.data(), sv.size());
       return true;
     }
 
@@ -725,20 +795,26 @@ void RdbLoaderBase::OpaqueObjLoader::CreateList(const LoadTrace* ltrace) {
       lp = lpShrinkToFit(lp);
     }
 
-    quicklistAppendListpack(ql, lp);
+    if (qlv2)
+      qlv2->AppendListpack(lp);
+    else
+      quicklistAppendListpack(ql, lp);
     return true;
   });
 
   if (ec_)
     return;
-  if (quicklistCount(ql) == 0) {
+  if ((qlv2 ? qlv2->Size() : quicklistCount(ql)) == 0) {
     ec_ = RdbError(errc::empty_key);
     return;
   }
 
   std::move(cleanup).Cancel();
 
-  pv_->InitRobj(OBJ_LIST, OBJ_ENCODING_QUICKLIST, ql);
+  if (qlv2)
+    pv_->InitRobj(OBJ_LIST, kEncodingQL2, qlv2);
+  else
+    pv_->InitRobj(OBJ_LIST, OBJ_ENCODING_QUICKLIST, ql);
 }
 
 void RdbLoaderBase::OpaqueObjLoader::CreateZSet(const LoadTrace* ltrace) {
@@ -754,31 +830,35 @@ void RdbLoaderBase::OpaqueObjLoader::CreateZSet(const LoadTrace* ltrace) {
   }
 
   size_t maxelelen = 0, totelelen = 0;
+  vector<pair<double, sds>> members;
+  members.reserve(zsetlen);
 
   Iterate(*ltrace, [&](const LoadBlob& blob) {
     sds sdsele = ToSds(blob.rdb_var);
     if (!sdsele)
       return false;
 
-    double score = blob.score;
-
     /* Don't care about integer-encoded strings. */
     if (sdslen(sdsele) > maxelelen)
       maxelelen = sdslen(sdsele);
     totelelen += sdslen(sdsele);
 
-    if (!zs->Insert(score, sdsele)) {
-      LOG(ERROR) << "Duplicate zset fields detected";
-      sdsfree(sdsele);
-      ec_ = RdbError(errc::rdb_file_corrupted);
-      return false;
-    }
-
+    members.emplace_back(blob.score, sdsele);
     return true;
   });
 
-  if (ec_)
+  if (ec_) {
+    for (auto& member : members)
+      sdsfree(member.second);
     return;
+  }
+
+  // Build the whole zset at once, BulkInsert frees the members on failure.
+  if (!zs->BulkInsert(members)) {
+    LOG(ERROR) << "Duplicate zset fields detected";
+    ec_ = RdbError(errc::rdb_file_corrupted);
+    return;
+  }
 
   void* inner = zs;
   if (zs->Size() <= server.zset_max_listpack_entries &&
@@ -909,7 +989,7 @@ void RdbLoaderBase::OpaqueObjLoader::CreateStream(const LoadTrace* ltrace) {
 
 void RdbLoaderBase::OpaqueObjLoader::HandleBlob(string_view blob) {
   if (rdb_type_ == RDB_TYPE_STRING) {
-    pv_->SetString(blob);
+    pv_->SetCompressedString(blob);
     return;
   }
 
@@ -1384,6 +1464,9 @@ error_code RdbLoaderBase::ReadObj(int rdbtype, OpaqueObj* dest) {
     case RDB_TYPE_SBF:
       iores = ReadSBF();
       break;
+    case RDB_TYPE_TIERED:
+      iores = ReadTieredRef();
+      break;
     default:
       LOG(ERROR) << "Unsupported rdb type " << rdbtype;
 
@@ -1848,8 +1931,9 @@ auto RdbLoaderBase::ReadSBF() -> io::Result<OpaqueObj> {
   RdbSBF res;
   uint64_t options;
   SET_OR_UNEXPECT(LoadLen(nullptr), options);
-  if (options != 0)
+  if ((options & ~RDB_SBF_OPTION_BLOCKED) != 0)
     return Unexpected(errc::rdb_file_corrupted);
+  res.blocked = options & RDB_SBF_OPTION_BLOCKED;
   SET_OR_UNEXPECT(FetchBinaryDouble(), res.grow_factor);
   SET_OR_UNEXPECT(FetchBinaryDouble(), res.fp_prob);
   if (res.fp_prob <= 0 || res.fp_prob > 0.5) {
@@ -1869,7 +1953,8 @@ auto RdbLoaderBase::ReadSBF() -> io::Result<OpaqueObj> {
     SET_OR_UNEXPECT(LoadLen(nullptr), hash_cnt);
     SET_OR_UNEXPECT(FetchGenericString(), filter_data);
     size_t bit_len = filter_data.size() * 8;
-    if (!is_power2(bit_len)) {  // must be power of two
+    // must be power of two, blocked filters hold at least one block
+    if (!is_power2(bit_len) || (res.blocked && bit_len < 512)) {
       return Unexpected(errc::rdb_file_corrupted);
     }
     res.filters.emplace_back(hash_cnt, std::move(filter_data));
@@ -1877,6 +1962,25 @@ auto RdbLoaderBase::ReadSBF() -> io::Result<OpaqueObj> {
   return OpaqueObj{std::move(res), RDB_TYPE_SBF};
 }
 
+auto RdbLoaderBase::ReadTieredRef() -> io::Result<OpaqueObj> {
+  RdbTieredRef res;
+  SET_OR_UNEXPECT(LoadLen(nullptr), res.file_id);
+  SET_OR_UNEXPECT(LoadLen(nullptr), res.offset);
+  SET_OR_UNEXPECT(LoadLen(nullptr), res.length);
+  SET_OR_UNEXPECT(LoadLen(nullptr), res.size);
+  SET_OR_UNEXPECT(LoadLen(nullptr), res.type);
+  SET_OR_UNEXPECT(LoadLen(nullptr), res.encoding);
+
+  // Only strings are stored compressed, in which case they are shorter than their size
+  bool known_type = res.type == OBJ_STRING || res.type == OBJ_HASH || res.type == OBJ_SET ||
+                    res.type == OBJ_ZSET;
+  if (!known_type || res.length == 0 || res.length > res.size ||
+      (res.type != OBJ_STRING && res.length != res.size)) {
+    return Unexpected(errc::rdb_file_corrupted);
+  }
+  return OpaqueObj{std::move(res), RDB_TYPE_TIERED};
+}
+
 template <typename T> io::Result<T> RdbLoaderBase::FetchInt() {
   auto ec = EnsureRead(sizeof(T));
   if (ec)
@@ -1902,10 +2006,13 @@ struct RdbLoader::ObjSettings {
 
   bool is_sticky = false;
 
+  bool is_fragment = false;  // more parts of the value follow, see RDB_OPCODE_FRAGMENT
+
   void Reset() {
     expiretime = 0;
     has_expired = false;
     is_sticky = false;
+    is_fragment = false;
   }
 
   void SetExpire(int64_t val) {
@@ -1919,6 +2026,8 @@ struct RdbLoader::ObjSettings {
 RdbLoader::RdbLoader(Service* service)
     : service_{service}, script_mgr_{service == nullptr ? nullptr : service->script_mgr()} {
   shard_buf_.reset(new ItemsBuf[shard_set->size()]);
+  batch_size_ = max(GetFlag(FLAGS_rdb_load_batch_size), 1u);
+  max_inflight_batches_ = max(GetFlag(FLAGS_rdb_load_inflight_batches), 1u);
 }
 
 RdbLoader::~RdbLoader() {
@@ -2006,6 +2115,11 @@ error_code RdbLoader::Load(io::Source* src) {
       continue; /* Read next opcode. */
     }
 
+    if (type == RDB_OPCODE_FRAGMENT) {
+      settings.is_fragment = true;
+      continue; /* Read next opcode. */
+    }
+
     if (type == RDB_OPCODE_FREQ) {
       /* FREQ: LFU frequency. */
       FetchInt<uint8_t>();  // IGNORE
@@ -2103,22 +2217,34 @@ error_code RdbLoader::Load(io::Source* src) {
       continue;
     }
 
+    if (type == RDB_OPCODE_ZSTD_DICT) {
+      RETURN_ON_ERR(HandleZstdDictionary());
+      continue;
+    }
+
     if (type == RDB_OPCODE_COMPRESSED_BLOB_END) {
       RETURN_ON_ERR(HandleCompressedBlobFinish());
       continue;
     }
 
+    if (type == RDB_OPCODE_DELETED_KEY) {
+      RETURN_ON_ERR(LoadDeletedKey());
+      continue;
+    }
+
     if (type == RDB_OPCODE_JOURNAL_BLOB) {
       FlushAllShards();  // Always flush before applying incremental on top
       RETURN_ON_ERR(HandleJournalBlob(service_));
       continue;
     }
 
-    if (!rdbIsObjectTypeDF(type)) {
+    // Tiered references are not valid object types elsewhere, e.g. for RESTORE
+    if (!rdbIsObjectTypeDF(type) && type != RDB_TYPE_TIERED) {
       return RdbError(errc::invalid_rdb_type);
     }
 
-    ++keys_loaded;
+    if (!settings.is_fragment)  // a value saved in parts is counted by its last part
+      ++keys_loaded;
     RETURN_ON_ERR(LoadKeyValPair(type, &settings));
     settings.Reset();
   }  // main load loop
@@ -2129,6 +2255,11 @@ error_code RdbLoader::Load(io::Source* src) {
     return *ec_;
   }
 
+  if (pending_fragment_) {
+    LOG(ERROR) << "Missing the last part of the value of key " << pending_fragment_->key;
+    return RdbError(errc::rdb_file_corrupted);
+  }
+
   /* Verify the checksum if RDB version is >= 5 */
   RETURN_ON_ERR(VerifyChecksum());
 
@@ -2292,6 +2423,19 @@ error_code RdbLoaderBase::HandleCompressedBlob(int op_type) {
   return kOk;
 }
 
+error_code RdbLoaderBase::HandleZstdDictionary() {
+  string dict;
+  SET_OR_RETURN(FetchGenericString(), dict);
+
+  // The dictionary is never a part of a compressed blob.
+  if (mem_buf_ != &origin_mem_buf_)
+    return RdbError(errc::rdb_file_corrupted);
+
+  // Replaces any decompressor, the following zstd blobs of the stream use the dictionary.
+  decompress_impl_.reset(new ZstdDecompress(dict));
+  return kOk;
+}
+
 error_code RdbLoaderBase::HandleCompressedBlobFinish() {
   CHECK_NE(&origin_mem_buf_, mem_buf_);
   CHECK_EQ(mem_buf_->InputLen(), size_t(0));
@@ -2391,8 +2535,34 @@ error_code RdbLoader::HandleAux() {
     }
   } else if (auxkey == "redis-bits") {
     /* Just ignored. */
+  } else if (auxkey == "shard-count") {
+    if (!absl::SimpleAtoi(auxval, &source_shard_count_)) {
+      LOG(ERROR) << "Invalid shard-count " << auxval;
+    }
+  } else if (auxkey == "shard-id") {
+    ShardId sid;
+    if (absl::SimpleAtoi(auxval, &sid)) {
+      source_shard_id_ = sid;
+    } else {
+      LOG(ERROR) << "Invalid shard-id " << auxval;
+    }
   } else if (auxkey == "search-index") {
     LoadSearchIndexDefFromAux(std::move(auxval));
+  } else if (auxkey == "snapshot-delta") {
+    int delta;
+    is_delta_ = absl::SimpleAtoi(auxval, &delta) && delta;
+  } else if (auxkey == "dfly-master-id") {
+    master_id_ = std::move(auxval);
+  } else if (auxkey == "dfly-master-lsns") {
+    for (string_view part : absl::StrSplit(auxval, ',')) {
+      LSN lsn;
+      if (!absl::SimpleAtoi(part, &lsn)) {
+        LOG(ERROR) << "Invalid dfly-master-lsns " << auxval;
+        master_lsns_.clear();
+        break;
+      }
+      master_lsns_.push_back(lsn);
+    }
   } else {
     /* We ignore fields we don't understand, as by AUX field
      * contract. */
@@ -2419,11 +2589,19 @@ void RdbLoader::FlushShardAsync(ShardId sid) {
   if (out_buf.empty())
     return;
 
+  // Backpressure: wait until the shards applied enough of the previous batches.
+  inflight_ec_.await(
+      [this] { return inflight_batches_.load(memory_order_acquire) < max_inflight_batches_; });
+  inflight_batches_.fetch_add(1, memory_order_relaxed);
+
   auto cb = [indx = this->cur_db_index_, this, ib = std::move(out_buf)] {
     this->LoadItemsBuffer(indx, ib);
+    inflight_batches_.fetch_sub(1, memory_order_release);
+    inflight_ec_.notify();
   };
 
   shard_set->Add(sid, std::move(cb));
+  out_buf.reserve(batch_size_);
 }
 
 void RdbLoader::FlushAllShards() {
@@ -2443,6 +2621,17 @@ void RdbLoader::LoadItemsBuffer(DbIndex db_ind, const ItemsBuf& ib) {
   DbContext db_cntx{db_ind, GetCurrentTimeMs()};
 
   for (const auto* item : ib) {
+    // Entries of a delta snapshot replace the keys loaded from the previous files of the chain.
+    if (item->is_deleted || is_delta_) {
+      auto res = db_slice.FindMutable(db_cntx, item->key);
+      if (IsValid(res.it)) {
+        res.post_updater.Run();
+        db_slice.Del(db_ind, res.it);
+      }
+      if (item->is_deleted)
+        continue;
+    }
+
     PrimeValue pv;
     if (ec_ = FromOpaque(item->val, &pv); ec_) {
       LOG(ERROR) << "Could not load value for key '" << item->key << "' in DB " << db_ind;
@@ -2450,10 +2639,25 @@ void RdbLoader::LoadItemsBuffer(DbIndex db_ind, const ItemsBuf& ib) {
       break;
     }
 
-    if (item->expire_ms > 0 && db_cntx.time_now_ms >= item->expire_ms)
+    // Replicas load the keys as they are, the master expires them through the journal.
+    if (item->expire_ms > 0 && db_cntx.time_now_ms >= item->expire_ms &&
+        ServerState::tlocal()->is_master)
       continue;
 
-    auto op_res = db_slice.AddOrUpdate(db_cntx, item->key, std::move(pv), item->expire_ms);
+    if (holds_alternative<RdbTieredRef>(item->val.obj)) {
+      uint64_t file_id = get<RdbTieredRef>(item->val.obj).file_id;
+      TieredStorage* ts = EngineShard::tlocal()->tiered_storage();
+      if (!ts || !ts->Restore(db_ind, file_id, &pv)) {
+        LOG(ERROR) << "Could not restore offloaded value for key '" << item->key << "' in DB "
+                   << db_ind << ", its tiered storage backing files were not kept";
+        ec_ = RdbError(errc::rdb_file_corrupted);
+        stop_early_ = true;
+        break;
+      }
+    }
+
+    auto op_res = db_slice.AddOrUpdateForLoad(db_cntx, item->key, std::move(pv), item->expire_ms,
+                                              item->is_sticky);
     if (!op_res) {
       LOG(ERROR) << "OOM failed to add key '" << item->key << "' in DB " << db_ind;
       ec_ = RdbError(errc::out_of_memory);
@@ -2461,9 +2665,7 @@ void RdbLoader::LoadItemsBuffer(DbIndex db_ind, const ItemsBuf& ib) {
       break;
     }
 
-    auto& res = *op_res;
-    res.it->first.SetSticky(item->is_sticky);
-    if (!res.is_new) {
+    if (!*op_res) {
       LOG(WARNING) << "RDB has duplicated key '" << item->key << "' in DB " << db_ind;
     }
   }
@@ -2474,10 +2676,37 @@ void RdbLoader::LoadItemsBuffer(DbIndex db_ind, const ItemsBuf& ib) {
 }
 
 void RdbLoader::ResizeDb(size_t key_num, size_t expire_num) {
-  DCHECK_LT(key_num, 1U << 31);
-  DCHECK_LT(expire_num, 1U << 31);
-  // Note: To reserve space, it's necessary to allocate space at the shard level. We might
-  // load with different number of shards which makes database resizing unfeasible.
+  // The hint describes the keys of a single shard of the source instance in case of dfs files,
+  // see "shard-count". With the same number of shards, all its keys map to the same shard here,
+  // like during a full sync between instances of the same size, so the hint is exact for that
+  // shard. Otherwise, assuming that all source shards are balanced, each of our shards receives
+  // its share of all the keys.
+  bool same_shards = source_shard_id_ && source_shard_count_ == shard_set->size() &&
+                     *source_shard_id_ < shard_set->size();
+  size_t scale = same_shards ? shard_set->size() : max<size_t>(source_shard_count_, 1);
+  size_t key_size = key_num * scale / shard_set->size();
+  size_t expire_size = expire_num * scale / shard_set->size();
+
+  // Do not let a bogus hint allocate more segments than the memory limit allows.
+  size_t max_size =
+      max_memory_limit / shard_set->size() / PrimeTable::kSegBytes * PrimeTable::kSegCapacity;
+  key_size = min(key_size, max_size);
+  expire_size = min(expire_size, key_size);
+  DbIndex db_ind = cur_db_index_;
+
+  auto reserve = [db_ind, key_size, expire_size] {
+    EngineShard::tlocal()->db_slice().Reserve(db_ind, key_size, expire_size);
+  };
+  if (same_shards) {
+    VLOG(1) << "Reserving " << key_size << " keys in db " << db_ind << " of shard "
+            << *source_shard_id_;
+    shard_set->Add(*source_shard_id_, std::move(reserve));
+    return;
+  }
+
+  VLOG(1) << "Reserving " << key_size << " keys in db " << db_ind << " per shard";
+  for (unsigned i = 0; i < shard_set->size(); ++i)
+    shard_set->Add(i, reserve);
 }
 
 error_code RdbLoader::LoadKeyValPair(int type, ObjSettings* settings) {
@@ -2487,7 +2716,7 @@ error_code RdbLoader::LoadKeyValPair(int type, ObjSettings* settings) {
   if (item == nullptr) {
     item = new Item;
   }
-  auto cleanup = absl::Cleanup([item] { delete item; });
+  auto cleanup = absl::Cleanup([&item] { delete item; });
 
   // Read key
   SET_OR_RETURN(ReadKey(), item->key);
@@ -2507,30 +2736,209 @@ error_code RdbLoader::LoadKeyValPair(int type, ObjSettings* settings) {
    * Similarly if the RDB is the preamble of an AOF file, we want to
    * load all the keys as they are, since the log of operations later
    * assume to work in an exact keyspace state. */
+  bool has_expired = ServerState::tlocal()->is_master && settings->has_expired;
+
+  if (pending_fragment_ && pending_fragment_->key == item->key) {
+    // The next part of a value saved in parts, the settings come from the first part.
+    RETURN_ON_ERR(AppendFragment(&item->val, &pending_fragment_->val));
+    if (settings->is_fragment)
+      return kOk;
+
+    delete item;
+    item = pending_fragment_.release();
+    has_expired = pending_fragment_expired_;
+  } else {
+    if (settings->is_fragment && pending_fragment_) {
+      LOG(ERROR) << "Parts of keys " << pending_fragment_->key << " and " << item->key
+                 << " are interleaved";
+      return RdbError(errc::rdb_file_corrupted);
+    }
+
+    item->is_sticky = settings->is_sticky;
+    item->is_deleted = false;
+    item->expire_ms = settings->expiretime;
 
-  if (ServerState::tlocal()->is_master && settings->has_expired) {
+    if (settings->is_fragment) {
+      pending_fragment_.reset(item);
+      pending_fragment_expired_ = has_expired;
+      item = nullptr;
+      return kOk;
+    }
+  }
+
+  if (has_expired) {
     VLOG(2) << "Expire key: " << item->key;
     return kOk;
   }
 
-  item->is_sticky = settings->is_sticky;
-
   ShardId sid = Shard(item->key, shard_set->size());
-  item->expire_ms = settings->expiretime;
+  auto& out_buf = shard_buf_[sid];
+
+  out_buf.emplace_back(item);
+  std::move(cleanup).Cancel();
+
+  if (out_buf.size() >= batch_size_) {
+    FlushShardAsync(sid);
+  }
+
+  return kOk;
+}
+
+error_code RdbLoader::AppendFragment(OpaqueObj* fragment, OpaqueObj* dest) {
+  auto* src_trace = get_if<unique_ptr<LoadTrace>>(&fragment->obj);
+  auto* dest_trace = get_if<unique_ptr<LoadTrace>>(&dest->obj);
+  if (fragment->rdb_type != dest->rdb_type || !src_trace || !dest_trace) {
+    LOG(ERROR) << "Parts of a value with types " << dest->rdb_type << " and "
+               << fragment->rdb_type;
+    return RdbError(errc::rdb_file_corrupted);
+  }
+
+  // Segments hold whole elements, so the merged trace loads like a value saved at once.
+  auto& segments = (*src_trace)->arr;
+  std::move(segments.begin(), segments.end(), back_inserter((*dest_trace)->arr));
+  return kOk;
+}
+
+error_code RdbLoader::LoadDeletedKey() {
+  Item* item = item_queue_.Pop();
+
+  if (item == nullptr) {
+    item = new Item;
+  }
+  auto cleanup = absl::Cleanup([item] { delete item; });
+
+  SET_OR_RETURN(ReadKey(), item->key);
+  item->val = OpaqueObj{};
+  item->expire_ms = 0;
+  item->is_sticky = false;
+  item->is_deleted = true;
 
+  ShardId sid = Shard(item->key, shard_set->size());
   auto& out_buf = shard_buf_[sid];
 
   out_buf.emplace_back(item);
   std::move(cleanup).Cancel();
 
-  constexpr size_t kBufSize = 128;
-  if (out_buf.size() >= kBufSize) {
+  if (out_buf.size() >= batch_size_) {
     FlushShardAsync(sid);
   }
 
   return kOk;
 }
 
+ReadAheadSource::ReadAheadSource(::io::Source* upstream, size_t block_size, unsigned max_blocks)
+    : upstream_(upstream), block_size_(block_size), max_blocks_(max_blocks) {
+  DCHECK_GT(block_size_, 0u);
+  DCHECK_GT(max_blocks_, 0u);
+}
+
+ReadAheadSource::~ReadAheadSource() {
+  {
+    std::unique_lock lk(mu_);
+    stopped_ = true;
+  }
+  cv_.notify_all();
+  if (fiber_.IsJoinable())
+    fiber_.Join();
+}
+
+void ReadAheadSource::Start() {
+  fiber_ = util::fb2::Fiber("rdb_read_ahead", [this] { ReadLoop(); });
+}
+
+void ReadAheadSource::ReadLoop() {
+  while (true) {
+    Block block;
+    {
+      std::unique_lock lk(mu_);
+      cv_.wait(lk, [this] { return stopped_ || ready_.size() < max_blocks_; });
+      if (stopped_)
+        return;
+      if (!free_.empty()) {
+        block = std::move(free_.back());
+        free_.pop_back();
+      }
+    }
+
+    if (!block.buf)
+      block.buf.reset(new uint8_t[block_size_]);
+
+    // Returns less than requested only at the end of the source.
+    ::io::Result<size_t> res = upstream_->ReadAtLeast({block.buf.get(), block_size_}, block_size_);
+
+    bool done;
+    {
+      std::unique_lock lk(mu_);
+      if (res) {
+        block.size = *res;
+        if (block.size > 0)
+          ready_.push_back(std::move(block));
+        eof_ = *res < block_size_;
+      } else {
+        ec_ = res.error();
+      }
+      done = eof_ || ec_;
+    }
+    cv_.notify_all();
+
+    if (done)
+      return;
+  }
+}
+
+::io::Result<bool> ReadAheadSource::NextBlock() {
+  std::unique_lock lk(mu_);
+  if (cur_.buf)
+    free_.push_back(std::move(cur_));
+  cur_ = Block{};
+  cur_offs_ = 0;
+
+  cv_.wait(lk, [this] { return !ready_.empty() || eof_ || ec_; });
+
+  // Serve the blocks that were read before reporting an error.
+  if (!ready_.empty()) {
+    cur_ = std::move(ready_.front());
+    ready_.pop_front();
+    lk.unlock();
+    cv_.notify_all();
+    return true;
+  }
+
+  if (ec_)
+    return nonstd::make_unexpected(ec_);
+  return false;
+}
+
+::io::Result<size_t> ReadAheadSource::ReadSome(const iovec* v, uint32_t len) {
+  size_t read_total = 0;
+  for (; len > 0; ++v, --len) {
+    uint8_t* dest = reinterpret_cast<uint8_t*>(v->iov_base);
+    size_t left = v->iov_len;
+    while (left > 0) {
+      if (cur_offs_ == cur_.size) {
+        // Do not wait for the next block if we already have something to return.
+        if (read_total > 0)
+          return read_total;
+
+        ::io::Result<bool> res = NextBlock();
+        if (!res)
+          return nonstd::make_unexpected(res.error());
+        if (!*res)
+          return 0;
+      }
+
+      size_t n = std::min(left, cur_.size - cur_offs_);
+      memcpy(dest, cur_.buf.get() + cur_offs_, n);
+      cur_offs_ += n;
+      dest += n;
+      left -= n;
+      read_total += n;
+    }
+  }
+
+  return read_total;
+}
+
 void RdbLoader::LoadScriptFromAux(string&& body) {
   ServerState* ss = ServerState::tlocal();
   auto interpreter = ss->BorrowInterpreter();
@@ -3,6 +3,7 @@
 //
 #pragma once
 
+#include <deque>
 #include <system_error>
 
 extern "C" {
@@ -15,6 +16,8 @@ extern "C" {
 #include "io/io_buf.h"
 #include "server/common.h"
 #include "server/journal/serializer.h"
+#include "util/fibers/fibers.h"
+#include "util/fibers/synchronization.h"
 
 namespace dfly {
 
@@ -44,6 +47,7 @@ class RdbLoaderBase {
     double grow_factor, fp_prob;
     size_t prev_size, current_size;
     size_t max_capacity;
+    bool blocked = false;
 
     struct Filter {
       unsigned hash_cnt;
@@ -54,8 +58,14 @@ class RdbLoaderBase {
     std::vector<Filter> filters;
   };
 
-  using RdbVariant =
-      std::variant<long long, base::PODArray<char>, LzfString, std::unique_ptr<LoadTrace>, RdbSBF>;
+  // Reference to a value kept in tiered storage backing files, see RDB_TYPE_TIERED
+  struct RdbTieredRef {
+    uint64_t file_id, offset, length, size;
+    unsigned type, encoding;
+  };
+
+  using RdbVariant = std::variant<long long, base::PODArray<char>, LzfString,
+                                  std::unique_ptr<LoadTrace>, RdbSBF, RdbTieredRef>;
 
   struct OpaqueObj {
     RdbVariant obj;
@@ -148,10 +158,12 @@ class RdbLoaderBase {
   ::io::Result<OpaqueObj> ReadRedisJson();
   ::io::Result<OpaqueObj> ReadJson();
   ::io::Result<OpaqueObj> ReadSBF();
+  ::io::Result<OpaqueObj> ReadTieredRef();
 
   std::error_code SkipModuleData();
   std::error_code HandleCompressedBlob(int op_type);
   std::error_code HandleCompressedBlobFinish();
+  std::error_code HandleZstdDictionary();
   void AllocateDecompressOnce(int op_type);
 
   std::error_code HandleJournalBlob(Service* service);
@@ -213,6 +225,16 @@ class RdbLoader : protected RdbLoaderBase {
     return journal_offset_;
   }
 
+  // The master id and the journal records of each master flow included in a snapshot that was
+  // saved on a replica, empty otherwise.
+  const std::string& master_id() const {
+    return master_id_;
+  }
+
+  const std::vector<LSN>& master_lsns() const {
+    return master_lsns_;
+  }
+
   // Set callback for receiving RDB_OPCODE_FULLSYNC_END.
   // This opcode is used by a master instance to notify it finished streaming static data
   // and is ready to switch to stable state sync.
@@ -234,6 +256,7 @@ class RdbLoader : protected RdbLoaderBase {
     uint64_t expire_ms;
     std::atomic<Item*> next;
     bool is_sticky = false;
+    bool is_deleted = false;  // deletion marker of a delta snapshot, val is empty.
 
     friend void MPSC_intrusive_store_next(Item* dest, Item* nxt) {
       dest->next.store(nxt, std::memory_order_release);
@@ -249,6 +272,9 @@ class RdbLoader : protected RdbLoaderBase {
   struct ObjSettings;
 
   std::error_code LoadKeyValPair(int type, ObjSettings* settings);
+  // Appends the elements of a part of a value saved in parts, see RDB_OPCODE_FRAGMENT.
+  static std::error_code AppendFragment(OpaqueObj* fragment, OpaqueObj* dest);
+  std::error_code LoadDeletedKey();
   void ResizeDb(size_t key_num, size_t expire_num);
   std::error_code HandleAux();
 
@@ -272,10 +298,25 @@ class RdbLoader : protected RdbLoaderBase {
   ScriptMgr* script_mgr_;
   std::unique_ptr<ItemsBuf[]> shard_buf_;
 
+  // Batches sent to shards and not applied yet, bounded by max_inflight_batches_.
+  std::atomic_uint32_t inflight_batches_{0};
+  util::fb2::EventCount inflight_ec_;
+  uint32_t batch_size_;
+  uint32_t max_inflight_batches_;
+
   size_t keys_loaded_ = 0;
   double load_time_ = 0;
 
   DbIndex cur_db_index_ = 0;
+  unsigned source_shard_count_ = 0;         // "shard-count" aux field of dfs files.
+  std::optional<ShardId> source_shard_id_;  // "shard-id" aux field of dfs files.
+  bool is_delta_ = false;                   // "snapshot-delta" aux field of dfs files.
+  std::string master_id_;                   // "dfly-master-id" aux field.
+  std::vector<LSN> master_lsns_;            // "dfly-master-lsns" aux field.
+
+  // The first parts of a value saved in parts, loaded once its last part is read.
+  std::unique_ptr<Item> pending_fragment_;
+  bool pending_fragment_expired_ = false;
 
   AggregateError ec_;
   std::atomic_bool stop_early_{false};
@@ -286,4 +327,46 @@ class RdbLoader : protected RdbLoaderBase {
   base::MPSCIntrusiveQueue<Item> item_queue_;
 };
 
+// Reads the upstream source in large blocks on a separate fiber and keeps up to max_blocks of
+// them ready, so that reading a snapshot file overlaps with parsing it.
+class ReadAheadSource : public ::io::Source {
+ public:
+  ReadAheadSource(::io::Source* upstream, size_t block_size, unsigned max_blocks);
+  ~ReadAheadSource();
+
+  // Starts reading upstream on a fiber in the calling thread. The upstream reads suspend
+  // the reading fiber, so parsing continues while the next blocks are being read.
+  void Start();
+
+  ::io::Result<size_t> ReadSome(const iovec* v, uint32_t len) final;
+
+ private:
+  struct Block {
+    std::unique_ptr<uint8_t[]> buf;
+    size_t size = 0;
+  };
+
+  void ReadLoop();
+
+  // Replaces the consumed block with the next ready one. Returns false on EOF.
+  ::io::Result<bool> NextBlock();
+
+  ::io::Source* upstream_;
+  const size_t block_size_;
+  const unsigned max_blocks_;
+
+  Block cur_;  // accessed only by the consumer
+  size_t cur_offs_ = 0;
+
+  util::fb2::Mutex mu_;
+  util::fb2::CondVarAny cv_;
+  std::deque<Block> ready_;   // guarded by mu_
+  std::vector<Block> free_;   // guarded by mu_, consumed blocks for reuse
+  std::error_code ec_;        // guarded by mu_
+  bool eof_ = false;          // guarded by mu_
+  bool stopped_ = false;      // guarded by mu_
+
+  util::fb2::Fiber fiber_;
+};
+
 }  // namespace dfly
@@ -7,6 +7,7 @@
 #include <absl/cleanup/cleanup.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_format.h>
+#include <absl/strings/str_join.h>
 #include <lz4frame.h>
 #include <zstd.h>
 
@@ -29,6 +30,9 @@ extern "C" {
 #include "base/logging.h"
 #include "core/bloom.h"
 #include "core/json/json_object.h"
+#include "core/json/path.h"
+#include "core/qlist.h"
+#include "core/small_set.h"
 #include "core/sorted_map.h"
 #include "core/string_map.h"
 #include "core/string_set.h"
@@ -39,6 +43,7 @@ extern "C" {
 #include "server/search/doc_index.h"
 #include "server/serializer_commons.h"
 #include "server/snapshot.h"
+#include "server/tiered_storage.h"
 #include "server/tiering/common.h"
 #include "util/fibers/simple_channel.h"
 
@@ -46,9 +51,17 @@ ABSL_FLAG(dfly::CompressionMode, compression_mode, dfly::CompressionMode::MULTI_
           "set 0 for no compression,"
           "set 1 for single entry lzf compression,"
           "set 2 for multi entry zstd compression on df snapshot and single entry on rdb snapshot,"
-          "set 3 for multi entry lz4 compression on df snapshot and single entry on rdb snapshot");
+          "set 3 for multi entry lz4 compression on df snapshot and single entry on rdb snapshot,"
+          "set 4 for multi entry zstd compression with a dictionary trained on a sample of every "
+          "shard on df snapshot and single entry on rdb snapshot");
 ABSL_FLAG(int, compression_level, 2, "The compression level to use on zstd/lz4 compression");
 
+ABSL_FLAG(uint64_t, serialization_max_chunk_size, 0,
+          "Sets, hashes, sorted sets and lists that use more memory than this are saved by "
+          "snapshots in parts of about this size, flushing the serialized data in between, and "
+          "slot migrations send them as a series of commands of about this size. "
+          "0 disables it. Loaders of older versions can not read such snapshots.");
+
 namespace dfly {
 
 using namespace std;
@@ -59,6 +72,8 @@ using namespace tiering::literals;
 
 namespace {
 
+thread_local uint64_t tl_compression_ns = 0;
+
 /* Encodes the "value" argument as integer when it fits in the supported ranges
  * for encoded types. If the function successfully encodes the integer, the
  * representation is stored in the buffer pointer to by "enc" and the string
@@ -131,6 +146,10 @@ bool AbslParseFlag(std::string_view in, dfly::CompressionMode* flag, std::string
     *flag = dfly::CompressionMode::MULTI_ENTRY_LZ4;
     return true;
   }
+  if (in == "4" || in == "MULTI_ENTRY_ZSTD_DICT") {
+    *flag = dfly::CompressionMode::MULTI_ENTRY_ZSTD_DICT;
+    return true;
+  }
 
   *err = absl::StrCat("Unknown value ", in, " for compression_mode flag");
   return false;
@@ -146,6 +165,8 @@ std::string AbslUnparseFlag(dfly::CompressionMode flag) {
       return "MULTI_ENTRY_ZSTD";
     case dfly::CompressionMode::MULTI_ENTRY_LZ4:
       return "MULTI_ENTRY_LZ4";
+    case dfly::CompressionMode::MULTI_ENTRY_ZSTD_DICT:
+      return "MULTI_ENTRY_ZSTD_DICT";
   }
   DCHECK(false) << "Unknown compression_mode flag value " << int(flag);
   return "NONE";
@@ -155,19 +176,23 @@ dfly::CompressionMode GetDefaultCompressionMode() {
   return absl::GetFlag(FLAGS_compression_mode);
 }
 
-uint8_t RdbObjectType(const PrimeValue& pv) {
+uint8_t RdbObjectType(const PrimeValue& pv, bool native_encoding) {
   unsigned type = pv.ObjType();
   unsigned compact_enc = pv.Encoding();
   switch (type) {
     case OBJ_STRING:
       return RDB_TYPE_STRING;
     case OBJ_LIST:
-      if (compact_enc == OBJ_ENCODING_QUICKLIST)
+      if (native_encoding && (compact_enc == kEncodingQL2 || compact_enc == OBJ_ENCODING_QUICKLIST))
+        return RDB_TYPE_LIST_QUICKLIST_2;
+      if (compact_enc == OBJ_ENCODING_QUICKLIST || compact_enc == kEncodingQL2)
         return RDB_TYPE_LIST_QUICKLIST;
       break;
     case OBJ_SET:
       if (compact_enc == kEncodingIntSet)
         return RDB_TYPE_SET_INTSET;
+      else if (compact_enc == kEncodingSmallSet)
+        return RDB_TYPE_SET;
       else if (compact_enc == kEncodingStrMap || compact_enc == kEncodingStrMap2) {
         if (((StringSet*)pv.RObjPtr())->ExpirationUsed())
           return RDB_TYPE_SET_WITH_EXPIRY;
@@ -176,14 +201,14 @@ uint8_t RdbObjectType(const PrimeValue& pv) {
       }
       break;
     case OBJ_ZSET:
-      if (compact_enc == OBJ_ENCODING_LISTPACK)
-        return RDB_TYPE_ZSET_ZIPLIST;  // we save using the old ziplist encoding.
+      if (compact_enc == OBJ_ENCODING_LISTPACK)  // the old ziplist encoding is Redis 6 compatible
+        return native_encoding ? RDB_TYPE_ZSET_LISTPACK : RDB_TYPE_ZSET_ZIPLIST;
       else if (compact_enc == OBJ_ENCODING_SKIPLIST)
         return RDB_TYPE_ZSET_2;
       break;
     case OBJ_HASH:
       if (compact_enc == kEncodingListPack)
-        return RDB_TYPE_HASH_ZIPLIST;
+        return native_encoding ? RDB_TYPE_HASH_LISTPACK : RDB_TYPE_HASH_ZIPLIST;
       else if (compact_enc == kEncodingStrMap2) {
         if (((StringMap*)pv.RObjPtr())->ExpirationUsed())
           return RDB_TYPE_HASH_WITH_EXPIRY;  // Incompatible with Redis
@@ -216,6 +241,10 @@ class CompressorImpl {
   }
   virtual io::Result<io::Bytes> Compress(io::Bytes data) = 0;
 
+  virtual void SetLevel(int level) {
+    compression_level_ = level;
+  }
+
  protected:
   int compression_level_ = 1;
   size_t compressed_size_total_ = 0;
@@ -225,10 +254,14 @@ class CompressorImpl {
 
 class ZstdCompressor : public CompressorImpl {
  public:
-  ZstdCompressor() {
+  // dict is optional, the frames compressed with a dictionary require it for decompression.
+  explicit ZstdCompressor(std::string_view dict = {}) {
     cctx_ = ZSTD_createCCtx();
+    if (!dict.empty())
+      cdict_ = ZSTD_createCDict(dict.data(), dict.size(), compression_level_);
   }
   ~ZstdCompressor() {
+    ZSTD_freeCDict(cdict_);
     ZSTD_freeCCtx(cctx_);
   }
 
@@ -236,6 +269,7 @@ class ZstdCompressor : public CompressorImpl {
 
  private:
   ZSTD_CCtx* cctx_;
+  ZSTD_CDict* cdict_ = nullptr;
   base::PODArray<uint8_t> compr_buf_;
 };
 
@@ -244,8 +278,11 @@ io::Result<io::Bytes> ZstdCompressor::Compress(io::Bytes data) {
   if (compr_buf_.capacity() < buf_size) {
     compr_buf_.reserve(buf_size);
   }
-  size_t compressed_size = ZSTD_compressCCtx(cctx_, compr_buf_.data(), compr_buf_.capacity(),
-                                             data.data(), data.size(), compression_level_);
+  size_t compressed_size =
+      cdict_ ? ZSTD_compress_usingCDict(cctx_, compr_buf_.data(), compr_buf_.capacity(),
+                                        data.data(), data.size(), cdict_)
+             : ZSTD_compressCCtx(cctx_, compr_buf_.data(), compr_buf_.capacity(), data.data(),
+                                 data.size(), compression_level_);
 
   if (ZSTD_isError(compressed_size)) {
     return make_unexpected(error_code{int(compressed_size), generic_category()});
@@ -267,6 +304,11 @@ class Lz4Compressor : public CompressorImpl {
   // compress a string of data
   io::Result<io::Bytes> Compress(io::Bytes data);
 
+  void SetLevel(int level) final {
+    compression_level_ = level;
+    lz4_pref_.compressionLevel = level;
+  }
+
  private:
   LZ4F_preferences_t lz4_pref_ = LZ4F_INIT_PREFERENCES;
 };
@@ -320,6 +362,18 @@ std::error_code RdbSerializer::SaveValue(const PrimeValue& pv) {
   return ec;
 }
 
+error_code RdbSerializer::SaveTieredObject(const PrimeValue& pv) {
+  TieredStorage* ts = EngineShard::tlocal()->tiered_storage();
+  DCHECK(ts && ts->IsFrozen());
+
+  auto [offset, length] = pv.GetExternalSlice();
+  for (uint64_t val : {ts->file_id(), uint64_t(offset), uint64_t(length), uint64_t(pv.Size()),
+                       uint64_t(pv.ObjType()), uint64_t(pv.Encoding())}) {
+    RETURN_ON_ERR(SaveLen(val));
+  }
+  return {};
+}
+
 error_code RdbSerializer::SelectDb(uint32_t dbid) {
   if (dbid == last_entry_db_index_) {
     return error_code{};
@@ -337,6 +391,13 @@ io::Result<uint8_t> RdbSerializer::SaveEntry(const PrimeKey& pk, const PrimeValu
   DVLOG(3) << "Selecting " << dbid << " previous: " << last_entry_db_index_;
   SelectDb(dbid);
 
+  // Saved in parts, the opcode precedes the expiry and the DF mask of the first one.
+  size_t fragment_len = FragmentLen(pv);
+  if (fragment_len > 0) {
+    if (auto ec = WriteOpcode(RDB_OPCODE_FRAGMENT); ec)
+      return make_unexpected(ec);
+  }
+
   /* Save the expire time */
   if (expire_ms > 0) {
     uint8_t buf[16] = {RDB_OPCODE_EXPIRETIME_MS};
@@ -355,7 +416,8 @@ io::Result<uint8_t> RdbSerializer::SaveEntry(const PrimeKey& pk, const PrimeValu
   }
 
   string_view key = pk.GetSlice(&tmp_str_);
-  uint8_t rdb_type = RdbObjectType(pv);
+  // Offloaded values reach here only if they are referenced, see SaveTieredObject
+  uint8_t rdb_type = pv.IsExternal() ? RDB_TYPE_TIERED : RdbObjectType(pv, native_encoding_);
 
   DVLOG(3) << ((void*)this) << ": Saving key/val start " << key << " in dbid=" << dbid;
 
@@ -365,7 +427,12 @@ io::Result<uint8_t> RdbSerializer::SaveEntry(const PrimeKey& pk, const PrimeValu
   if (auto ec = SaveString(key); ec)
     return make_unexpected(ec);
 
-  if (auto ec = SaveValue(pv); ec) {
+  error_code ec;
+  if (pv.IsExternal())
+    ec = SaveTieredObject(pv);
+  else
+    ec = fragment_len > 0 ? SaveFragmentedValue(key, rdb_type, pv, fragment_len) : SaveValue(pv);
+  if (ec) {
     LOG(ERROR) << "Problems saving value for key " << key << " in dbid=" << dbid;
     return make_unexpected(ec);
   }
@@ -373,6 +440,135 @@ io::Result<uint8_t> RdbSerializer::SaveEntry(const PrimeKey& pk, const PrimeValu
   return rdb_type;
 }
 
+size_t RdbSerializer::FragmentLen(const PrimeValue& pv) const {
+  size_t max_chunk = absl::GetFlag(FLAGS_serialization_max_chunk_size);
+  if (!flush_fragment_cb_ || max_chunk == 0 || pv.IsExternal())
+    return 0;
+
+  size_t bytes = pv.MallocUsed();
+  if (bytes <= max_chunk)
+    return 0;
+
+  size_t len = 0;
+  unsigned encoding = pv.Encoding();
+  switch (pv.ObjType()) {
+    case OBJ_SET:
+      if (encoding == kEncodingStrMap2)
+        len = ((StringSet*)pv.RObjPtr())->SizeSlow();
+      break;
+    case OBJ_HASH:
+      if (encoding == kEncodingStrMap2)
+        len = ((StringMap*)pv.RObjPtr())->SizeSlow();
+      break;
+    case OBJ_ZSET:
+      if (encoding == OBJ_ENCODING_SKIPLIST)
+        len = ((detail::SortedMap*)pv.GetRobjWrapper()->inner_obj())->Size();
+      break;
+    case OBJ_LIST:
+      if (encoding == kEncodingQL2)
+        len = ((const QList*)pv.RObjPtr())->node_count();
+      break;
+  }
+
+  // Elements are assumed to be of similar size.
+  size_t fragment_len = max<size_t>(1, len * max_chunk / bytes);
+  return fragment_len < len ? fragment_len : 0;
+}
+
+// Writes the value in parts of fragment_len elements, every part but the first one starts a new
+// entry with the same key and type. The table must not change while the callback preempts.
+error_code RdbSerializer::SaveFragmentedValue(string_view key, uint8_t rdb_type,
+                                              const PrimeValue& pv, size_t fragment_len) {
+  size_t len = 0;
+  std::function<error_code(size_t)> save_elements;
+
+  // Each case saves the next n elements of the value.
+  switch (pv.ObjType()) {
+    case OBJ_SET: {
+      StringSet* set = (StringSet*)pv.RObjPtr();
+      len = set->SizeSlow();
+      save_elements = [this, set, it = set->begin()](size_t n) mutable -> error_code {
+        for (; n > 0; --n, ++it) {
+          RETURN_ON_ERR(SaveString(string_view{*it, sdslen(*it)}));
+          if (set->ExpirationUsed())
+            RETURN_ON_ERR(SaveLongLongAsString(it.HasExpiry() ? int64_t(it.ExpiryTime()) : -1));
+        }
+        return {};
+      };
+      break;
+    }
+    case OBJ_HASH: {
+      StringMap* string_map = (StringMap*)pv.RObjPtr();
+      len = string_map->SizeSlow();
+      save_elements = [this, string_map,
+                       it = string_map->begin()](size_t n) mutable -> error_code {
+        for (; n > 0; --n, ++it) {
+          const auto& [k, v] = *it;
+          RETURN_ON_ERR(SaveString(string_view{k, sdslen(k)}));
+          RETURN_ON_ERR(SaveString(string_view{v, sdslen(v)}));
+          if (string_map->ExpirationUsed())
+            RETURN_ON_ERR(SaveLongLongAsString(it.HasExpiry() ? int64_t(it.ExpiryTime()) : -1));
+        }
+        return {};
+      };
+      break;
+    }
+    case OBJ_ZSET: {
+      detail::SortedMap* zs = (detail::SortedMap*)pv.GetRobjWrapper()->inner_obj();
+      len = zs->Size();
+      save_elements = [this, zs, start = size_t(0)](size_t n) mutable {
+        error_code ec;
+        // From the greatest to the smallest element, like SaveZSetObject.
+        zs->Iterate(start, n, true, [&](sds ele, double score) {
+          ec = SaveString(string_view{ele, sdslen(ele)});
+          if (!ec)
+            ec = SaveBinaryDouble(score);
+          return !ec;
+        });
+        start += n;
+        return ec;
+      };
+      break;
+    }
+    case OBJ_LIST: {
+      const QList* ql = (const QList*)pv.RObjPtr();
+      len = ql->node_count();
+      save_elements = [this, ql, i = size_t(0)](size_t n) mutable -> error_code {
+        for (; n > 0; --n, ++i)
+          RETURN_ON_ERR(SaveQListNode(ql->node_listpack(i)));
+        return {};
+      };
+      break;
+    }
+    default:
+      LOG(DFATAL) << "Unexpected fragmented type " << pv.ObjType();
+      return make_error_code(errc::function_not_supported);
+  }
+
+  // The key may point to tmp_str_ that is reused by the entries saved during the callback.
+  string key_copy{key};
+  for (size_t saved = 0; saved < len;) {
+    size_t n = min(fragment_len, len - saved);
+    if (saved > 0) {
+      flush_fragment_cb_();
+      if (saved + n < len)
+        RETURN_ON_ERR(WriteOpcode(RDB_OPCODE_FRAGMENT));
+      RETURN_ON_ERR(WriteOpcode(rdb_type));
+      RETURN_ON_ERR(SaveString(key_copy));
+    }
+    RETURN_ON_ERR(SaveLen(n));
+    RETURN_ON_ERR(save_elements(n));
+    saved += n;
+  }
+  return {};
+}
+
+error_code RdbSerializer::SaveDeletedKey(string_view key, DbIndex dbid) {
+  SelectDb(dbid);
+  RETURN_ON_ERR(WriteOpcode(RDB_OPCODE_DELETED_KEY));
+  return SaveString(key);
+}
+
 error_code RdbSerializer::SaveObject(const PrimeValue& pv) {
   unsigned obj_type = pv.ObjType();
   CHECK_NE(obj_type, OBJ_STRING);
@@ -411,6 +607,17 @@ error_code RdbSerializer::SaveObject(const PrimeValue& pv) {
 
 error_code RdbSerializer::SaveListObject(const PrimeValue& pv) {
   /* Save a list value */
+  if (pv.Encoding() == kEncodingQL2) {
+    const QList* ql = reinterpret_cast<const QList*>(pv.RObjPtr());
+    DVLOG(2) << "Saving list of length " << ql->node_count();
+
+    RETURN_ON_ERR(SaveLen(ql->node_count()));
+    for (size_t i = 0; i < ql->node_count(); ++i) {
+      RETURN_ON_ERR(SaveQListNode(ql->node_listpack(i)));
+    }
+    return error_code{};
+  }
+
   DCHECK_EQ(OBJ_ENCODING_QUICKLIST, pv.Encoding());
   const quicklist* ql = reinterpret_cast<const quicklist*>(pv.RObjPtr());
   quicklistNode* node = ql->head;
@@ -423,6 +630,8 @@ error_code RdbSerializer::SaveListObject(const PrimeValue& pv) {
              << "/" << node->sz;
 
     if (QL_NODE_IS_PLAIN(node)) {
+      if (native_encoding_)
+        RETURN_ON_ERR(SaveLen(QUICKLIST_NODE_CONTAINER_PLAIN));
       if (quicklistNodeIsCompressed(node)) {
         void* data;
         size_t compress_len = quicklistGetLzf(node, &data);
@@ -453,7 +662,7 @@ error_code RdbSerializer::SaveListObject(const PrimeValue& pv) {
         if (decompressed)
           zfree(decompressed);
       });
-      RETURN_ON_ERR(SaveListPackAsZiplist(lp));
+      RETURN_ON_ERR(SaveQListNode(lp));
     }
     node = node->next;
   }
@@ -475,6 +684,17 @@ error_code RdbSerializer::SaveSetObject(const PrimeValue& obj) {
         RETURN_ON_ERR(SaveLongLongAsString(expiry));
       }
     }
+  } else if (obj.Encoding() == kEncodingSmallSet) {
+    const SmallSet* set = (const SmallSet*)obj.RObjPtr();
+
+    RETURN_ON_ERR(SaveLen(set->Size()));
+
+    error_code ec;
+    set->Iterate([&](string_view member) {
+      ec = SaveString(member);
+      return !ec;
+    });
+    RETURN_ON_ERR(ec);
   } else {
     CHECK_EQ(obj.Encoding(), kEncodingIntSet);
     intset* is = (intset*)obj.RObjPtr();
@@ -509,7 +729,7 @@ error_code RdbSerializer::SaveHSetObject(const PrimeValue& pv) {
     CHECK_EQ(kEncodingListPack, pv.Encoding());
 
     uint8_t* lp = (uint8_t*)pv.RObjPtr();
-    RETURN_ON_ERR(SaveListPackAsZiplist(lp));
+    RETURN_ON_ERR(SaveListPack(lp));
   }
 
   return error_code{};
@@ -542,7 +762,7 @@ error_code RdbSerializer::SaveZSetObject(const PrimeValue& pv) {
   } else {
     CHECK_EQ(pv.Encoding(), unsigned(OBJ_ENCODING_LISTPACK)) << "Unknown zset encoding";
     uint8_t* lp = (uint8_t*)robj_wrapper->inner_obj();
-    RETURN_ON_ERR(SaveListPackAsZiplist(lp));
+    RETURN_ON_ERR(SaveListPack(lp));
   }
 
   return error_code{};
@@ -626,15 +846,19 @@ error_code RdbSerializer::SaveStreamObject(const PrimeValue& pv) {
 }
 
 error_code RdbSerializer::SaveJsonObject(const PrimeValue& pv) {
-  auto json_string = pv.GetJson()->to_string();
-  return SaveString(json_string);
+  if (const JsonType* json = pv.GetJson(); json)
+    return SaveString(json->to_string());
+
+  // Flat values are saved like jsoncons values, so that they can be loaded in either encoding
+  absl::Span<uint8_t> buf = pv.GetFlatJson();
+  return SaveString(json::FromFlat(flexbuffers::GetRoot(buf.data(), buf.size())).to_string());
 }
 
 std::error_code RdbSerializer::SaveSBFObject(const PrimeValue& pv) {
   SBF* sbf = pv.GetSBF();
 
   // options to allow format mutations in the future.
-  RETURN_ON_ERR(SaveLen(0));  // options - reserved
+  RETURN_ON_ERR(SaveLen(sbf->blocked() ? RDB_SBF_OPTION_BLOCKED : 0));
   RETURN_ON_ERR(SaveBinaryDouble(sbf->grow_factor()));
   RETURN_ON_ERR(SaveBinaryDouble(sbf->fp_probability()));
   RETURN_ON_ERR(SaveLen(sbf->prev_size()));
@@ -701,6 +925,19 @@ error_code RdbSerializer::SaveListPackAsZiplist(uint8_t* lp) {
   return ec;
 }
 
+error_code RdbSerializer::SaveListPack(uint8_t* lp) {
+  if (native_encoding_)
+    return SaveString(lp, lpBytes(lp));
+  return SaveListPackAsZiplist(lp);
+}
+
+error_code RdbSerializer::SaveQListNode(const uint8_t* lp) {
+  // RDB_TYPE_LIST_QUICKLIST_2 prefixes every node with its container.
+  if (native_encoding_)
+    RETURN_ON_ERR(SaveLen(QUICKLIST_NODE_CONTAINER_PACKED));
+  return SaveListPack(const_cast<uint8_t*>(lp));
+}
+
 error_code RdbSerializer::SaveStreamPEL(rax* pel, bool nacks) {
   /* Number of entries in the PEL. */
 
@@ -835,10 +1072,10 @@ namespace {
 using VersionBuffer = std::array<char, sizeof(uint16_t)>;
 using CrcBuffer = std::array<char, sizeof(uint64_t)>;
 
-VersionBuffer MakeRdbVersion() {
+VersionBuffer MakeRdbVersion(uint16_t version) {
   VersionBuffer buf;
-  buf[0] = RDB_SER_VERSION & 0xff;
-  buf[1] = (RDB_SER_VERSION >> 8) & 0xff;
+  buf[0] = version & 0xff;
+  buf[1] = (version >> 8) & 0xff;
   return buf;
 }
 
@@ -849,7 +1086,7 @@ CrcBuffer MakeCheckSum(std::string_view dump_res) {
   return buf;
 }
 
-void AppendFooter(io::StringSink* dump_res) {
+void AppendFooter(uint16_t version, io::StringSink* dump_res) {
   auto to_bytes = [](const auto& buf) {
     return io::Bytes(reinterpret_cast<const uint8_t*>(buf.data()), buf.size());
   };
@@ -860,24 +1097,27 @@ void AppendFooter(io::StringSink* dump_res) {
    * ----------------+---------------------+---------------+
    * RDB version and CRC are both in little endian.
    */
-  const auto ver = MakeRdbVersion();
+  const auto ver = MakeRdbVersion(version);
   dump_res->Write(to_bytes(ver));
   const auto crc = MakeCheckSum(dump_res->str());
   dump_res->Write(to_bytes(crc));
 }
 }  // namespace
 
-void SerializerBase::DumpObject(const CompactObj& obj, io::StringSink* out) {
+void SerializerBase::DumpObject(const CompactObj& obj, io::StringSink* out, bool native) {
   CompressionMode compression_mode = GetDefaultCompressionMode();
-  if (compression_mode != CompressionMode::NONE) {
+  if (native) {
+    compression_mode = CompressionMode::NONE;
+  } else if (compression_mode != CompressionMode::NONE) {
     compression_mode = CompressionMode::SINGLE_ENTRY;
   }
   RdbSerializer serializer(compression_mode);
+  serializer.SetNativeEncoding(native);
 
   // According to Redis code we need to
   // 1. Save the value itself - without the key
   // 2. Save footer: this include the RDB version and the CRC value for the message
-  auto type = RdbObjectType(obj);
+  auto type = RdbObjectType(obj, native);
   DVLOG(1) << "We are going to dump object type: " << type;
   std::error_code ec = serializer.WriteOpcode(type);
   CHECK(!ec);
@@ -885,7 +1125,7 @@ void SerializerBase::DumpObject(const CompactObj& obj, io::StringSink* out) {
   CHECK(!ec);  // make sure that fully was successful
   ec = serializer.FlushToSink(out);
   CHECK(!ec);         // make sure that fully was successful
-  AppendFooter(out);  // version and crc
+  AppendFooter(native ? RDB_VERSION : RDB_SER_VERSION, out);  // version and crc
   CHECK_GT(out->str().size(), 10u);
 }
 
@@ -899,7 +1139,8 @@ io::Bytes SerializerBase::PrepareFlush() {
     return mem_buf_.InputBuffer();
 
   if (compression_mode_ == CompressionMode::MULTI_ENTRY_ZSTD ||
-      compression_mode_ == CompressionMode::MULTI_ENTRY_LZ4) {
+      compression_mode_ == CompressionMode::MULTI_ENTRY_LZ4 ||
+      compression_mode_ == CompressionMode::MULTI_ENTRY_ZSTD_DICT) {
     CompressBlob();
   }
 
@@ -1070,7 +1311,8 @@ class RdbSaver::Impl {
 
   ~Impl();
 
-  void StartSnapshotting(bool stream_journal, const Cancellation* cll, EngineShard* shard);
+  void StartSnapshotting(bool stream_journal, const Cancellation* cll, EngineShard* shard,
+                         DeltaMode delta_mode);
   void StartIncrementalSnapshotting(Context* cntx, EngineShard* shard, LSN start_lsn);
 
   void StopSnapshotting(EngineShard* shard);
@@ -1112,6 +1354,7 @@ class RdbSaver::Impl {
   RdbSerializer meta_serializer_;
   SliceSnapshot::RecordChannel channel_;
   bool push_to_sink_with_order_ = false;
+  bool native_encoding_ = false;  // dfs files are read only by Dragonfly
   std::optional<AlignedBuffer> aligned_buf_;
 
   // Single entry compression is compatible with redis rdb snapshot
@@ -1136,6 +1379,7 @@ RdbSaver::Impl::Impl(bool align_writes, unsigned producers_len, CompressionMode
   }
   if (sm == SaveMode::SINGLE_SHARD || sm == SaveMode::SINGLE_SHARD_WITH_SUMMARY) {
     push_to_sink_with_order_ = true;
+    native_encoding_ = true;
   }
 
   DCHECK(producers_len > 0 || channel_.IsClosing());
@@ -1249,17 +1493,19 @@ error_code RdbSaver::Impl::ConsumeChannel(const Cancellation* cll) {
 }
 
 void RdbSaver::Impl::StartSnapshotting(bool stream_journal, const Cancellation* cll,
-                                       EngineShard* shard) {
+                                       EngineShard* shard, DeltaMode delta_mode) {
   auto& s = GetSnapshot(shard);
-  s = std::make_unique<SliceSnapshot>(&shard->db_slice(), &channel_, compression_mode_);
+  s = std::make_unique<SliceSnapshot>(&shard->db_slice(), &channel_, compression_mode_,
+                                      native_encoding_);
 
-  s->Start(stream_journal, cll);
+  s->Start(stream_journal, cll, delta_mode);
 }
 
 void RdbSaver::Impl::StartIncrementalSnapshotting(Context* cntx, EngineShard* shard,
                                                   LSN start_lsn) {
   auto& s = GetSnapshot(shard);
-  s = std::make_unique<SliceSnapshot>(&shard->db_slice(), &channel_, compression_mode_);
+  s = std::make_unique<SliceSnapshot>(&shard->db_slice(), &channel_, compression_mode_,
+                                      native_encoding_);
 
   s->StartIncremental(cntx, start_lsn);
 }
@@ -1322,11 +1568,10 @@ RdbSaver::SnapshotStats RdbSaver::Impl::GetCurrentSnapshotProgress() const {
   }
 
   shard_set->RunBriefInParallel([&](EngineShard* es) { cb(es->shard_id()); });
-  RdbSaver::SnapshotStats init{0, 0};
-  return std::accumulate(
-      results.begin(), results.end(), init, [](auto init, auto pr) -> RdbSaver::SnapshotStats {
-        return {init.current_keys + pr.current_keys, init.total_keys + pr.total_keys};
-      });
+  RdbSaver::SnapshotStats total;
+  for (const auto& pr : results)
+    total += pr;
+  return total;
 }
 
 RdbSaver::GlobalData RdbSaver::GetGlobalData(const Service* service) {
@@ -1369,7 +1614,8 @@ unique_ptr<SliceSnapshot>& RdbSaver::Impl::GetSnapshot(EngineShard* shard) {
   return shard_snapshots_[sid];
 }
 
-RdbSaver::RdbSaver(::io::Sink* sink, SaveMode save_mode, bool align_writes) {
+RdbSaver::RdbSaver(::io::Sink* sink, SaveMode save_mode, bool align_writes, DeltaMode delta_mode)
+    : delta_mode_(delta_mode) {
   CHECK_NOTNULL(sink);
   CompressionMode compression_mode = GetDefaultCompressionMode();
   int producer_count = 0;
@@ -1406,7 +1652,7 @@ RdbSaver::~RdbSaver() {
 
 void RdbSaver::StartSnapshotInShard(bool stream_journal, const Cancellation* cll,
                                     EngineShard* shard) {
-  impl_->StartSnapshotting(stream_journal, cll, shard);
+  impl_->StartSnapshotting(stream_journal, cll, shard, delta_mode_);
 }
 
 void RdbSaver::StartIncrementalSnapshotInShard(Context* cntx, EngineShard* shard, LSN start_lsn) {
@@ -1426,6 +1672,7 @@ error_code RdbSaver::SaveHeader(const GlobalData& glob_state) {
 
   RETURN_ON_ERR(impl_->serializer()->WriteRaw(Bytes{reinterpret_cast<uint8_t*>(magic), sz}));
   RETURN_ON_ERR(SaveAux(std::move(glob_state)));
+  RETURN_ON_ERR(SaveResizeDbHints());
 
   return error_code{};
 }
@@ -1471,6 +1718,10 @@ error_code RdbSaver::SaveAux(const GlobalData& glob_state) {
   RETURN_ON_ERR(SaveAuxFieldStrInt("used-mem", used_mem_current.load(memory_order_relaxed)));
   RETURN_ON_ERR(SaveAuxFieldStrInt("aof-preamble", aof_preamble));
 
+  // Written before the data, so that the loader applies the file on top of existing keys.
+  if (delta_mode_ == DeltaMode::DELTA)
+    RETURN_ON_ERR(SaveAuxFieldStrInt("snapshot-delta", 1));
+
   // Save lua scripts only in rdb or summary file
   DCHECK(save_mode_ != SaveMode::SINGLE_SHARD || glob_state.lua_scripts.empty());
   for (const string& s : glob_state.lua_scripts)
@@ -1486,10 +1737,67 @@ error_code RdbSaver::SaveAux(const GlobalData& glob_state) {
       RETURN_ON_ERR(impl_->SaveAuxFieldStrStr("search-index", s));
   }
 
+  // The replication position is global and saved with the scripts, see above.
+  if (!glob_state.master_id.empty()) {
+    DCHECK(save_mode_ != SaveMode::SINGLE_SHARD);
+    RETURN_ON_ERR(impl_->SaveAuxFieldStrStr("dfly-master-id", glob_state.master_id));
+    RETURN_ON_ERR(
+        impl_->SaveAuxFieldStrStr("dfly-master-lsns", absl::StrJoin(glob_state.master_lsns, ",")));
+  }
+
   // TODO: "repl-stream-db", "repl-id", "repl-offset"
   return error_code{};
 }
 
+error_code RdbSaver::SaveResizeDbHints() {
+  using DbSizes = vector<pair<size_t, size_t>>;  // Key and expire counts per db.
+  auto get_sizes = [](EngineShard* shard) {
+    DbSlice& db_slice = shard->db_slice();
+    DbSizes res(db_slice.db_array_size());
+    for (DbIndex i = 0; i < res.size(); ++i) {
+      if (db_slice.IsDbValid(i)) {
+        auto [prime, expire] = db_slice.GetTables(i);
+        res[i] = {prime->size(), expire->size()};
+      }
+    }
+    return res;
+  };
+
+  DbSizes sizes;
+  if (save_mode_ == SaveMode::RDB) {
+    vector<DbSizes> shard_sizes(shard_set->size());
+    shard_set->RunBriefInParallel(
+        [&](EngineShard* shard) { shard_sizes[shard->shard_id()] = get_sizes(shard); });
+    for (const DbSizes& ss : shard_sizes) {
+      sizes.resize(max(sizes.size(), ss.size()));
+      for (size_t i = 0; i < ss.size(); ++i) {
+        sizes[i].first += ss[i].first;
+        sizes[i].second += ss[i].second;
+      }
+    }
+  } else if (save_mode_ != SaveMode::SUMMARY) {
+    // Shard files hold the keys of a single shard, the loader scales the hints by shard-count.
+    EngineShard* shard = EngineShard::tlocal();
+    if (!shard)
+      return error_code{};
+    RETURN_ON_ERR(SaveAuxFieldStrInt("shard-count", shard_set->size()));
+    RETURN_ON_ERR(SaveAuxFieldStrInt("shard-id", shard->shard_id()));
+    sizes = get_sizes(shard);
+  }
+
+  auto& ser = *impl_->serializer();
+  for (DbIndex i = 0; i < sizes.size(); ++i) {
+    if (sizes[i].first == 0)
+      continue;
+    RETURN_ON_ERR(ser.SelectDb(i));
+    RETURN_ON_ERR(ser.WriteOpcode(RDB_OPCODE_RESIZEDB));
+    RETURN_ON_ERR(ser.SaveLen(sizes[i].first));
+    RETURN_ON_ERR(ser.SaveLen(sizes[i].second));
+  }
+
+  return error_code{};
+}
+
 error_code RdbSaver::SaveEpilog() {
   uint8_t buf[8];
   uint64_t chksum;
@@ -1529,12 +1837,25 @@ RdbSaver::SnapshotStats RdbSaver::GetCurrentSnapshotProgress() const {
   return impl_->GetCurrentSnapshotProgress();
 }
 
+RdbSaver::SnapshotStats& RdbSaver::SnapshotStats::operator+=(const SnapshotStats& other) {
+  auto lowest = [](unsigned a, unsigned b) { return a == 0 ? b : (b == 0 ? a : min(a, b)); };
+
+  current_keys += other.current_keys;
+  total_keys += other.total_keys;
+  throttled_ms += other.throttled_ms;
+  buckets_per_yield = lowest(buckets_per_yield, other.buckets_per_yield);
+  compression_level = lowest(compression_level, other.compression_level);
+  return *this;
+}
+
 void SerializerBase::AllocateCompressorOnce() {
   if (compressor_impl_) {
     return;
   }
   if (compression_mode_ == CompressionMode::MULTI_ENTRY_ZSTD) {
     compressor_impl_.reset(new ZstdCompressor());
+  } else if (compression_mode_ == CompressionMode::MULTI_ENTRY_ZSTD_DICT) {
+    compressor_impl_.reset(new ZstdCompressor(zstd_dict_));
   } else if (compression_mode_ == CompressionMode::MULTI_ENTRY_LZ4) {
     compressor_impl_.reset(new Lz4Compressor());
   } else {
@@ -1542,6 +1863,24 @@ void SerializerBase::AllocateCompressorOnce() {
   }
 }
 
+uint64_t SerializerBase::GetThreadLocalCompressionNs() {
+  return tl_compression_ns;
+}
+
+void SerializerBase::SetZstdDictionary(std::string dict) {
+  DCHECK(!compressor_impl_);
+  zstd_dict_ = std::move(dict);
+}
+
+void SerializerBase::SetCompressionLevel(int level) {
+  if (compression_mode_ != CompressionMode::MULTI_ENTRY_ZSTD &&
+      compression_mode_ != CompressionMode::MULTI_ENTRY_LZ4)
+    return;
+
+  AllocateCompressorOnce();
+  compressor_impl_->SetLevel(level);
+}
+
 void SerializerBase::CompressBlob() {
   if (!compression_stats_) {
     compression_stats_.emplace(CompressionStats{});
@@ -1555,7 +1894,9 @@ void SerializerBase::CompressBlob() {
 
   AllocateCompressorOnce();
   // Compress the data
+  uint64_t start = absl::GetCurrentTimeNanos();
   auto ec = compressor_impl_->Compress(blob_to_compress);
+  tl_compression_ns += absl::GetCurrentTimeNanos() - start;
   if (!ec) {
     ++compression_stats_->compression_failed;
     return;
@@ -1568,13 +1909,21 @@ void SerializerBase::CompressBlob() {
 
   // Clear membuf and write the compressed blob to it
   mem_buf_.ConsumeInput(blob_size);
+
+  // The loader needs the dictionary before the first blob compressed with it.
+  if (!zstd_dict_.empty() && !zstd_dict_sent_) {
+    WriteOpcode(RDB_OPCODE_ZSTD_DICT);
+    SaveString(zstd_dict_);
+    zstd_dict_sent_ = true;
+  }
+
   mem_buf_.Reserve(compressed_blob.length() + 1 + 9);  // reserve space for blob + opcode + len
 
   // First write opcode for compressed string
   auto dest = mem_buf_.AppendBuffer();
-  uint8_t opcode = compression_mode_ == CompressionMode::MULTI_ENTRY_ZSTD
-                       ? RDB_OPCODE_COMPRESSED_ZSTD_BLOB_START
-                       : RDB_OPCODE_COMPRESSED_LZ4_BLOB_START;
+  uint8_t opcode = compression_mode_ == CompressionMode::MULTI_ENTRY_LZ4
+                       ? RDB_OPCODE_COMPRESSED_LZ4_BLOB_START
+                       : RDB_OPCODE_COMPRESSED_ZSTD_BLOB_START;
   dest[0] = opcode;
   mem_buf_.CommitWrite(1);
 
@@ -9,6 +9,7 @@ extern "C" {
 #include "redis/lzfP.h"
 }
 
+#include <functional>
 #include <optional>
 
 #include "base/pod_array.h"
@@ -24,7 +25,9 @@ typedef struct streamCG streamCG;
 
 namespace dfly {
 
-uint8_t RdbObjectType(const PrimeValue& pv);
+// With native_encoding listpacks are saved as they are, using the listpack types of RDB 11,
+// instead of being converted to ziplists.
+uint8_t RdbObjectType(const PrimeValue& pv, bool native_encoding = false);
 
 class EngineShard;
 class Service;
@@ -65,7 +68,20 @@ enum class SaveMode {
   RDB,                        // Save .rdb file. Expected to read all shards.
 };
 
-enum class CompressionMode { NONE, SINGLE_ENTRY, MULTI_ENTRY_ZSTD, MULTI_ENTRY_LZ4 };
+// Snapshots saved to disk can serve as bases of delta snapshots, see DbSlice::StartDeltaSnapshot.
+enum class DeltaMode {
+  NONE,   // Does not take part in delta snapshots.
+  BASE,   // Full snapshot that becomes the base of the next delta.
+  DELTA,  // Saves only the keys deleted and the buckets changed since the base.
+};
+
+enum class CompressionMode {
+  NONE,
+  SINGLE_ENTRY,
+  MULTI_ENTRY_ZSTD,
+  MULTI_ENTRY_LZ4,
+  MULTI_ENTRY_ZSTD_DICT,  // zstd with a dictionary trained on the data of each shard.
+};
 CompressionMode GetDefaultCompressionMode();
 
 class RdbSaver {
@@ -74,6 +90,11 @@ class RdbSaver {
   struct GlobalData {
     const StringVec lua_scripts;     // bodies of lua scripts
     const StringVec search_indices;  // ft.create commands to re-create search indices
+
+    // Set when saving on a replica: the id of its master and the number of journal records
+    // of each master flow that the snapshot includes.
+    std::string master_id = {};
+    std::vector<LSN> master_lsns = {};
   };
 
   // single_shard - true means that we run RdbSaver on a single shard and we do not use
@@ -81,7 +102,8 @@ class RdbSaver {
   // single_shard - false, means we capture all the data using a single RdbSaver instance
   // (corresponds to legacy, redis compatible mode)
   // if align_writes is true - writes data in aligned chunks of 4KB to fit direct I/O requirements.
-  explicit RdbSaver(::io::Sink* sink, SaveMode save_mode, bool align_writes);
+  explicit RdbSaver(::io::Sink* sink, SaveMode save_mode, bool align_writes,
+                    DeltaMode delta_mode = DeltaMode::NONE);
 
   ~RdbSaver();
 
@@ -115,6 +137,14 @@ class RdbSaver {
   struct SnapshotStats {
     size_t current_keys = 0;
     size_t total_keys = 0;
+
+    // Decisions of the snapshot pacing, see SliceSnapshot::PaceIteration.
+    size_t throttled_ms = 0;          // time the iteration waited for the memory or bandwidth limit
+    unsigned buckets_per_yield = 0;   // lowest over the shards
+    unsigned compression_level = 0;   // lowest over the shards, zero without compression
+
+    // Aggregates the stats of several shards.
+    SnapshotStats& operator+=(const SnapshotStats& other);
   };
 
   SnapshotStats GetCurrentSnapshotProgress() const;
@@ -130,8 +160,12 @@ class RdbSaver {
   std::error_code SaveAux(const GlobalData&);
   std::error_code SaveAuxFieldStrInt(std::string_view key, int64_t val);
 
+  // Writes RESIZEDB hints so that the loader can pre-size its tables.
+  std::error_code SaveResizeDbHints();
+
   std::unique_ptr<Impl> impl_;
   SaveMode save_mode_;
+  DeltaMode delta_mode_;
   CompressionMode compression_mode_;
 };
 
@@ -142,8 +176,14 @@ class SerializerBase {
   explicit SerializerBase(CompressionMode compression_mode);
   virtual ~SerializerBase() = default;
 
-  // Dumps `obj` in DUMP command format into `out`. Uses default compression mode.
-  static void DumpObject(const CompactObj& obj, io::StringSink* out);
+  // Dumps `obj` in DUMP command format into `out`. Uses default compression mode, unless
+  // native is set: then listpacks, intsets and strings are copied verbatim and uncompressed, so
+  // that RESTORE adopts them without conversions. Such dumps carry RDB_VERSION in their footer,
+  // older Redis versions refuse them.
+  static void DumpObject(const CompactObj& obj, io::StringSink* out, bool native = false);
+
+  // Total time spent in multi entry compression by the serializers of the calling thread.
+  static uint64_t GetThreadLocalCompressionNs();
 
   // Internal buffer size. Might shrink after flush due to compression.
   size_t SerializedLen() const;
@@ -170,6 +210,14 @@ class SerializerBase {
     return SaveString(io::View(io::Bytes{buf, len}));
   }
 
+  // Sets the dictionary for MULTI_ENTRY_ZSTD_DICT compression. Must be called before any data
+  // is flushed. The dictionary is written into the stream before the first blob that uses it.
+  void SetZstdDictionary(std::string dict);
+
+  // Changes the level of multi entry compression on the fly. Ignored for compression with a
+  // dictionary, whose level is fixed when the dictionary is digested.
+  void SetCompressionLevel(int level);
+
  protected:
   // Prepare internal buffer for flush. Compress it.
   io::Bytes PrepareFlush();
@@ -183,6 +231,8 @@ class SerializerBase {
   CompressionMode compression_mode_;
   io::IoBuf mem_buf_;
   std::unique_ptr<CompressorImpl> compressor_impl_;
+  std::string zstd_dict_;
+  bool zstd_dict_sent_ = false;
 
   static constexpr size_t kMinStrSizeToCompress = 256;
   static constexpr double kMinCompressionReductionPrecentage = 0.95;
@@ -220,9 +270,31 @@ class RdbSerializer : public SerializerBase {
 
   std::error_code SendJournalOffset(uint64_t journal_offset);
 
+  // Writes a marker of a key deleted since the base of a delta snapshot.
+  std::error_code SaveDeletedKey(std::string_view key, DbIndex dbid);
+
+  // While the callback is set, sets, hashes, sorted sets and lists bigger than
+  // serialization_max_chunk_size are saved in parts, see RDB_OPCODE_FRAGMENT. The callback is
+  // called after every part but the last one and may flush the serializer and preempt.
+  using FlushFragmentCb = std::function<void()>;
+  void SetFlushFragmentCb(FlushFragmentCb cb) {
+    flush_fragment_cb_ = std::move(cb);
+  }
+
+  // Saves listpack encoded hashes, sorted sets and list nodes without re-encoding them, so that
+  // loading them is a copy. Used by dfs files and full syncs, which only Dragonfly loads.
+  void SetNativeEncoding(bool native_encoding) {
+    native_encoding_ = native_encoding;
+  }
+
   size_t GetTempBufferSize() const override;
 
  private:
+  // Returns the number of elements per part if pv should be saved in parts, 0 otherwise.
+  size_t FragmentLen(const PrimeValue& pv) const;
+  std::error_code SaveFragmentedValue(std::string_view key, uint8_t rdb_type,
+                                      const PrimeValue& pv, size_t fragment_len);
+
   std::error_code SaveObject(const PrimeValue& pv);
   std::error_code SaveListObject(const PrimeValue& pv);
   std::error_code SaveSetObject(const PrimeValue& pv);
@@ -232,14 +304,21 @@ class RdbSerializer : public SerializerBase {
   std::error_code SaveJsonObject(const PrimeValue& pv);
   std::error_code SaveSBFObject(const PrimeValue& pv);
 
+  // Saves reference to offloaded value (RDB_TYPE_TIERED) instead of reading it
+  std::error_code SaveTieredObject(const PrimeValue& pv);
+
   std::error_code SaveLongLongAsString(int64_t value);
   std::error_code SaveBinaryDouble(double val);
   std::error_code SaveListPackAsZiplist(uint8_t* lp);
+  std::error_code SaveListPack(uint8_t* lp);  // as it is or as a ziplist, see SetNativeEncoding
+  std::error_code SaveQListNode(const uint8_t* lp);
   std::error_code SaveStreamPEL(rax* pel, bool nacks);
   std::error_code SaveStreamConsumers(streamCG* cg);
 
   std::string tmp_str_;
   DbIndex last_entry_db_index_ = kInvalidDbId;
+  FlushFragmentCb flush_fragment_cb_;
+  bool native_encoding_ = false;
 };
 
 }  // namespace dfly
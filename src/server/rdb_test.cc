@@ -32,7 +32,15 @@ using absl::StrCat;
 
 ABSL_DECLARE_FLAG(int32, list_compress_depth);
 ABSL_DECLARE_FLAG(int32, list_max_listpack_size);
+ABSL_DECLARE_FLAG(bool, list_experimental_v2);
 ABSL_DECLARE_FLAG(dfly::CompressionMode, compression_mode);
+ABSL_DECLARE_FLAG(uint32_t, snapshot_write_inflight);
+ABSL_DECLARE_FLAG(bool, snapshot_delta_tracking);
+ABSL_DECLARE_FLAG(uint64_t, serialization_max_chunk_size);
+ABSL_DECLARE_FLAG(uint32_t, rdb_load_batch_size);
+ABSL_DECLARE_FLAG(uint32_t, rdb_load_inflight_batches);
+ABSL_DECLARE_FLAG(uint64_t, snapshot_memory_overhead_limit);
+ABSL_DECLARE_FLAG(uint32_t, snapshot_latency_budget_usec);
 
 namespace dfly {
 
@@ -126,6 +134,26 @@ TEST_F(RdbTest, LoadSmall6) {
   EXPECT_THAT(resp.GetVec(), ElementsAre(IntArg(1), IntArg(1)));
 }
 
+TEST_F(RdbTest, LoadReadAhead) {
+  io::FileSource fs = GetSource("redis6_small.rdb");
+  RdbLoader loader{service_.get()};
+
+  // Tiny blocks make the parser cross block boundaries in the middle of entries.
+  auto ec = pp_->at(0)->Await([&] {
+    ReadAheadSource src(&fs, 7, 2);
+    src.Start();
+    return loader.Load(&src);
+  });
+  ASSERT_FALSE(ec) << ec.message();
+
+  EXPECT_THAT(Run({"get", "strkey"}), "abcdefghjjjjjjjjjj");
+  EXPECT_THAT(Run({"smembers", "intset"}),
+              RespArray(UnorderedElementsAre("111", "222", "1234", "3333", "4444", "67899",
+                                             "76554")));
+  Run({"select", "1"});
+  EXPECT_EQ(10, CheckedInt({"dbsize"}));
+}
+
 TEST_F(RdbTest, Stream) {
   io::FileSource fs = GetSource("redis6_stream.rdb");
   RdbLoader loader{service_.get()};
@@ -160,7 +188,8 @@ TEST_F(RdbTest, ComressionModeSaveDragonflyAndReload) {
   EXPECT_EQ(resp.GetVec().size(), 0);
 
   for (auto mode : {CompressionMode::NONE, CompressionMode::SINGLE_ENTRY,
-                    CompressionMode::MULTI_ENTRY_ZSTD, CompressionMode::MULTI_ENTRY_LZ4}) {
+                    CompressionMode::MULTI_ENTRY_ZSTD, CompressionMode::MULTI_ENTRY_LZ4,
+                    CompressionMode::MULTI_ENTRY_ZSTD_DICT}) {
     SetFlag(&FLAGS_compression_mode, mode);
     RespExpr resp = Run({"save", "df"});
     ASSERT_EQ(resp, "OK");
@@ -250,6 +279,31 @@ TEST_F(RdbTest, Reload) {
   EXPECT_EQ(-50000, CheckedInt({"hget", "large_keyname", string(240, 'Z')}));
 }
 
+TEST_F(RdbTest, ReloadListV2) {
+  absl::FlagSaver fs;
+
+  SetFlag(&FLAGS_list_experimental_v2, true);
+  SetFlag(&FLAGS_list_max_listpack_size, 2);
+
+  Run({"rpush", "list_key", "head", string(511, 'a'), "1", "-20", "tail"});
+  Run({"rpush", "empty_elem", ""});
+
+  auto resp = Run({"debug", "reload"});
+  ASSERT_EQ(resp, "OK");
+
+  resp = Run({"lrange", "list_key", "0", "-1"});
+  EXPECT_THAT(resp.GetVec(), ElementsAre("head", string(511, 'a'), "1", "-20", "tail"));
+  EXPECT_EQ(Run({"lindex", "empty_elem", "0"}), "");
+
+  // Lists saved with quicklist encoding are loaded as well.
+  SetFlag(&FLAGS_list_experimental_v2, false);
+  Run({"debug", "reload"});
+  SetFlag(&FLAGS_list_experimental_v2, true);
+  Run({"debug", "reload"});
+  EXPECT_EQ(5, CheckedInt({"llen", "list_key"}));
+  EXPECT_EQ(Run({"lindex", "list_key", "-2"}), "-20");
+}
+
 TEST_F(RdbTest, ReloadTtl) {
   Run({"set", "key", "val"});
   Run({"expire", "key", "1000"});
@@ -340,6 +394,124 @@ TEST_F(RdbTest, SaveFlush) {
   EXPECT_EQ(500000, k_v.second);
 }
 
+TEST_F(RdbTest, SaveWriteInflight) {
+  Run({"debug", "populate", "100000", "key", "100"});
+
+  for (uint32_t inflight : {0u, 1u, 16u}) {
+    SetFlag(&FLAGS_snapshot_write_inflight, inflight);
+    ASSERT_EQ(Run({"save", "df"}), "OK") << inflight;
+    ASSERT_EQ(Run({"debug", "reload"}), "OK") << inflight;
+    EXPECT_EQ(100000, CheckedInt({"dbsize"})) << inflight;
+    EXPECT_EQ(100, CheckedInt({"strlen", "key:777"}));
+  }
+}
+
+TEST_F(RdbTest, DeltaSnapshot) {
+  EXPECT_THAT(Run({"save", "delta"}), ErrArg("snapshot_delta_tracking"));
+
+  SetFlag(&FLAGS_snapshot_delta_tracking, true);
+  EXPECT_THAT(Run({"save", "delta"}), ErrArg("no base snapshot"));
+
+  Run({"debug", "populate", "10000", "key", "10"});
+  ASSERT_EQ(Run({"save", "df"}), "OK");
+
+  Run({"set", "key:1", "changed"});
+  Run({"del", "key:2"});
+  Run({"set", "added", "1"});
+  ASSERT_EQ(Run({"save", "delta"}), "OK");
+
+  Run({"del", "added"});
+  Run({"set", "key:2", "again"});
+  Run({"sadd", "set", "a", "b"});
+  ASSERT_EQ(Run({"save", "delta"}), "OK");
+  EXPECT_THAT(service_->server_family().GetLastSaveInfo().file_name,
+              testing::EndsWith("-delta-0002-summary.dfs"));
+
+  // Loads the base and applies both deltas.
+  ASSERT_EQ(Run({"debug", "reload", "nosave"}), "OK");
+  EXPECT_EQ(10001, CheckedInt({"dbsize"}));
+  EXPECT_EQ(Run({"get", "key:1"}), "changed");
+  EXPECT_EQ(Run({"get", "key:2"}), "again");
+  EXPECT_EQ(10, CheckedInt({"strlen", "key:777"}));
+  EXPECT_EQ(0, CheckedInt({"exists", "added"}));
+  EXPECT_EQ(2, CheckedInt({"scard", "set"}));
+
+  // The data was replaced, so the next snapshot can not be a delta.
+  EXPECT_THAT(Run({"save", "delta"}), ErrArg("base snapshot was invalidated"));
+  SetFlag(&FLAGS_snapshot_delta_tracking, false);
+}
+
+TEST_F(RdbTest, SaveBigValuesInParts) {
+  absl::FlagSaver fs;
+  SetFlag(&FLAGS_list_experimental_v2, true);
+  SetFlag(&FLAGS_serialization_max_chunk_size, 4096);
+
+  for (string_view type : {"set", "hash", "zset", "list"})
+    Run({"debug", "populate", "10", type, "20", "rand", "type", type, "elements", "2000"});
+  Run({"debug", "populate", "1000", "key", "10"});
+  Run({"pexpire", "set:3", "1000000"});
+
+  ASSERT_EQ(Run({"save", "df"}), "OK");
+  ASSERT_EQ(Run({"debug", "reload"}), "OK");
+
+  EXPECT_EQ(1040, CheckedInt({"dbsize"}));
+  for (unsigned i = 0; i < 10; ++i) {
+    string index = absl::StrCat(i);
+    EXPECT_EQ(2000, CheckedInt({"scard", "set:" + index}));
+    EXPECT_EQ(2000, CheckedInt({"hlen", "hash:" + index}));
+    EXPECT_EQ(2000, CheckedInt({"zcard", "zset:" + index}));
+    EXPECT_EQ(2000, CheckedInt({"llen", "list:" + index}));
+  }
+  EXPECT_GT(CheckedInt({"pttl", "set:3"}), 0);
+  EXPECT_EQ(-1, CheckedInt({"pttl", "set:4"}));
+}
+
+TEST_F(RdbTest, SaveListpacksNatively) {
+  absl::FlagSaver fs;
+  SetFlag(&FLAGS_list_experimental_v2, true);
+
+  Run({"hset", "hash", "a", "1", "b", "2"});
+  Run({"zadd", "zset", "1", "a", "2.5", "b"});
+  Run({"rpush", "list", "a", "b", "c"});
+  EXPECT_THAT(Run({"object", "encoding", "hash"}), "listpack");
+  EXPECT_THAT(Run({"object", "encoding", "zset"}), "listpack");
+
+  ASSERT_EQ(Run({"save", "df"}), "OK");
+  ASSERT_EQ(Run({"debug", "reload"}), "OK");
+
+  EXPECT_THAT(Run({"hgetall", "hash"}).GetVec(), ElementsAre("a", "1", "b", "2"));
+  EXPECT_THAT(Run({"zrange", "zset", "0", "-1", "withscores"}).GetVec(),
+              ElementsAre("a", "1", "b", "2.5"));
+  EXPECT_THAT(Run({"lrange", "list", "0", "-1"}).GetVec(), ElementsAre("a", "b", "c"));
+  EXPECT_THAT(Run({"object", "encoding", "hash"}), "listpack");
+  EXPECT_THAT(Run({"object", "encoding", "zset"}), "listpack");
+}
+
+TEST_F(RdbTest, LoadWithBackpressure) {
+  absl::FlagSaver fs;
+  SetFlag(&FLAGS_rdb_load_batch_size, 16);
+  SetFlag(&FLAGS_rdb_load_inflight_batches, 1);
+
+  Run({"debug", "populate", "20000"});
+  ASSERT_EQ(Run({"debug", "reload"}), "OK");
+
+  EXPECT_EQ(20000, CheckedInt({"dbsize"}));
+  EXPECT_EQ(Run({"get", "key:1017"}), "value:1017");
+}
+
+TEST_F(RdbTest, SaveWithPacing) {
+  absl::FlagSaver fs;
+  SetFlag(&FLAGS_compression_mode, CompressionMode::MULTI_ENTRY_LZ4);
+  SetFlag(&FLAGS_snapshot_memory_overhead_limit, 8192);
+  SetFlag(&FLAGS_snapshot_latency_budget_usec, 1);
+
+  Run({"debug", "populate", "50000", "key", "100"});
+  ASSERT_EQ(Run({"save", "df"}), "OK");
+  ASSERT_EQ(Run({"debug", "reload"}), "OK");
+
+  EXPECT_EQ(50000, CheckedInt({"dbsize"}));
+}
+
 TEST_F(RdbTest, SaveManyDbs) {
   Run({"debug", "populate", "50000"});
   pp_->at(1)->Await([&] {
@@ -542,4 +714,16 @@ TEST_F(RdbTest, SBF) {
   EXPECT_THAT(Run({"BF.EXISTS", "k", "1"}), IntArg(1));
 }
 
+TEST_F(RdbTest, SBFBlocked) {
+  EXPECT_EQ(Run({"BF.RESERVE", "k", "0.01", "10", "BLOCKED"}), "OK");
+  for (unsigned i = 0; i < 100; ++i) {  // enough to grow a second filter
+    Run({"BF.ADD", "k", absl::StrCat(i)});
+  }
+  Run({"debug", "reload"});
+  EXPECT_EQ(Run({"type", "k"}), "MBbloom--");
+  for (unsigned i = 0; i < 100; ++i) {
+    EXPECT_THAT(Run({"BF.EXISTS", "k", absl::StrCat(i)}), IntArg(1));
+  }
+}
+
 }  // namespace dfly
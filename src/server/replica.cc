@@ -17,6 +17,7 @@ extern "C" {
 #include <absl/strings/escaping.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/strip.h>
+#include <absl/time/clock.h>
 
 #include <boost/asio/ip/tcp.hpp>
 #include <memory>
@@ -24,11 +25,14 @@ extern "C" {
 
 #include "base/logging.h"
 #include "facade/redis_parser.h"
+#include "server/dflycmd.h"
 #include "server/error.h"
 #include "server/journal/executor.h"
 #include "server/journal/serializer.h"
 #include "server/main_service.h"
 #include "server/rdb_load.h"
+#include "server/server_family.h"
+#include "server/server_state.h"
 #include "strings/human_readable.h"
 
 ABSL_FLAG(int, replication_acks_interval, 3000, "Interval between acks in milliseconds.");
@@ -46,6 +50,18 @@ ABSL_FLAG(
     int, replica_priority, 100,
     "Published by info command for sentinel to pick replica based on score during a failover");
 
+ABSL_FLAG(std::string, replication_journal_compression, "none",
+          "Compression the master applies to the stable sync journal stream: none, lz4 or zstd. "
+          "Falls back to none if the master does not support it.");
+
+ABSL_FLAG(uint32_t, replica_apply_batch_size, 64,
+          "The maximal number of consecutive journal entries that a replica flow executes as a "
+          "single batch during stable sync. 1 executes every entry on its own.");
+
+ABSL_FLAG(bool, replica_forward_journal, true,
+          "When a replica has replicas of its own and the same number of shards as its master, "
+          "it journals the single shard entries it applies with their original serialization.");
+
 // TODO: Remove this flag on release >= 1.22
 ABSL_FLAG(bool, replica_reconnect_on_master_restart, false,
           "Deprecated - please use --break_replication_on_master_restart.");
@@ -63,6 +79,8 @@ namespace {
 
 constexpr unsigned kRdbEofMarkSize = 40;
 
+std::atomic<uint64_t> published_apply_lag_ms{UINT64_MAX};  // see Replica::PublishedApplyLagMs
+
 // Distribute flow indices over all available threads (shard_set pool size).
 vector<vector<unsigned>> Partition(unsigned num_flows) {
   vector<vector<unsigned>> partition(shard_set->pool()->size());
@@ -319,8 +337,13 @@ std::error_code Replica::HandleCapaDflyResp() {
       state_mask_.store(0);
       return make_error_code(errc::connection_aborted);
     }
-    last_journal_LSNs_.reset();
+    // A snapshot saved on a replica of this master continues from where it was saved.
+    if (master_repl_id != snapshot_master_id_ ||
+        (last_journal_LSNs_ && last_journal_LSNs_->size() != size_t(param_num_flows))) {
+      last_journal_LSNs_.reset();
+    }
   }
+  snapshot_master_id_.clear();
   master_context_.master_repl_id = master_repl_id;
   master_context_.dfly_session_id = ToSV(LastResponseArgs()[1].GetBuf());
   num_df_flows_ = param_num_flows;
@@ -352,6 +375,22 @@ std::error_code Replica::ConfigureDflyMaster() {
     PC_RETURN_ON_BAD_RESPONSE(CheckRespIsSimpleReply("OK"));
   }
 
+  master_context_.journal_compression = JournalCompression::NONE;
+  JournalCompression compression;
+  string compression_name = GetFlag(FLAGS_replication_journal_compression);
+  if (!ParseJournalCompression(compression_name, &compression)) {
+    LOG(WARNING) << "Unknown journal compression " << compression_name << ", using none";
+  } else if (compression != JournalCompression::NONE &&
+             master_context_.version > DflyVersion::VER0) {
+    RETURN_ON_ERR(SendCommandAndReadResponse(
+        StrCat("REPLCONF JOURNAL-COMPRESSION ", JournalCompressionName(compression))));
+    if (CheckRespIsSimpleReply("OK")) {
+      master_context_.journal_compression = compression;
+    } else {
+      LOG(WARNING) << "Master does not support journal compression, streaming uncompressed";
+    }
+  }
+
   return error_code{};
 }
 
@@ -394,6 +433,7 @@ error_code Replica::InitiatePSync() {
     service_.RequestLoadingState();
     absl::Cleanup cleanup = [this]() { service_.RemoveLoadingState(); };
 
+    service_.server_family().GetDflyCmd()->CancelAllReplications();
     if (slot_range_.has_value()) {
       JournalExecutor{&service_}.FlushSlots(slot_range_.value());
     } else {
@@ -450,6 +490,10 @@ error_code Replica::InitiateDflySync() {
   // Initialize MultiShardExecution.
   multi_shard_exe_.reset(new MultiShardExecution());
 
+  // Flow i of the master maps to shard i only if the number of shards is the same.
+  master_context_.forward_journal =
+      absl::GetFlag(FLAGS_replica_forward_journal) && num_df_flows_ == shard_set->size();
+
   // Initialize shard flows.
   shard_flows_.resize(num_df_flows_);
   for (unsigned i = 0; i < num_df_flows_; ++i) {
@@ -516,6 +560,8 @@ error_code Replica::InitiateDflySync() {
         std::accumulate(is_full_sync.get(), is_full_sync.get() + num_df_flows_, 0);
 
     if (num_full_flows == num_df_flows_) {
+      // The loaded snapshot is not journaled, so our own replicas must sync from scratch.
+      service_.server_family().GetDflyCmd()->CancelAllReplications();
       if (slot_range_.has_value()) {
         JournalExecutor{&service_}.FlushSlots(slot_range_.value());
       } else {
@@ -657,7 +703,12 @@ error_code Replica::ConsumeDflyStream() {
     shard_set->pool()->AwaitFiberOnAll(std::move(shard_cb));
   }
 
+  // Replicas added by ADDREPLICAOF mirror only a slot range of another master.
+  if (!slot_range_)
+    apply_lag_fb_ = fb2::Fiber("replica_apply_lag", &Replica::PublishApplyLagFb, this);
+
   JoinDflyFlows();
+  apply_lag_fb_.JoinIfNeeded();
 
   last_journal_LSNs_.emplace();
   for (auto& flow : shard_flows_) {
@@ -671,6 +722,23 @@ error_code Replica::ConsumeDflyStream() {
   return cntx_.GetError();
 }
 
+void Replica::PublishApplyLagFb() {
+  while (!cntx_.IsCancelled()) {
+    // The flows do not change during stable sync. Idle masters don't send timestamps, but
+    // then the replica has nothing to catch up with.
+    uint64_t lag_ms = 0;
+    for (const auto& flow : shard_flows_)
+      lag_ms = max(lag_ms, flow->GetApplyLagStats().last_ms);
+    published_apply_lag_ms.store(lag_ms, memory_order_relaxed);
+    ThisFiber::SleepFor(chrono::milliseconds(kApplyLagPublishMs));
+  }
+  published_apply_lag_ms.store(UINT64_MAX, memory_order_relaxed);
+}
+
+uint64_t Replica::PublishedApplyLagMs() {
+  return published_apply_lag_ms.load(memory_order_relaxed);
+}
+
 void Replica::JoinDflyFlows() {
   for (auto& flow : shard_flows_) {
     flow->JoinFlow();
@@ -816,7 +884,15 @@ void DflyShardReplica::StableSyncDflyReadFb(Context* cntx) {
 
   io::PrefixSource ps{prefix, Sock()};
 
-  JournalReader reader{&ps, 0};
+  // The master frames the stable sync journal if we asked it to compress it.
+  std::optional<JournalFrameSource> frames;
+  io::Source* source = &ps;
+  if (master_context_.journal_compression != JournalCompression::NONE) {
+    frames.emplace(&ps, master_context_.journal_compression);
+    source = &*frames;
+  }
+
+  JournalReader reader{source, 0};
   DCHECK_GE(journal_rec_executed_, 1u);
   TransactionReader tx_reader{journal_rec_executed_.load(std::memory_order_relaxed) - 1};
 
@@ -824,7 +900,28 @@ void DflyShardReplica::StableSyncDflyReadFb(Context* cntx) {
     acks_fb_ = fb2::Fiber("shard_acks", &DflyShardReplica::StableSyncDflyAcksFb, this, cntx);
   }
 
+  // Transactions are collected into a batch while more entries are already buffered.
+  // Records are counted as executed only once the batch ran, so that acks never cover
+  // records that were not applied yet.
+  const size_t max_batch = max(absl::GetFlag(FLAGS_replica_apply_batch_size), 1u);
+  vector<TransactionData> batch;
+  uint64_t batch_records = 0;
+  auto execute_batch = [&] {
+    lock_guard lk{apply_mu_};
+    in_global_cmd_ = false;
+    if (!batch.empty()) {
+      ExecuteTxBatch(absl::MakeSpan(batch), cntx);
+      batch.clear();
+    }
+    journal_rec_executed_.fetch_add(batch_records, std::memory_order_relaxed);
+    batch_records = 0;
+  };
+
   while (!cntx->IsCancelled()) {
+    // Entries are forwarded only while there are replicas to send them to.
+    bool forward = master_context_.forward_journal && ServerState::tlocal()->journal();
+    reader.SetCaptureRaw(forward);
+
     auto tx_data = tx_reader.NextTxData(&reader, cntx);
     if (!tx_data)
       break;
@@ -834,13 +931,42 @@ void DflyShardReplica::StableSyncDflyReadFb(Context* cntx) {
       //  Do nothing
     } else if (tx_data->opcode == journal::Op::PING) {
       force_ping_ = true;
-      journal_rec_executed_.fetch_add(1, std::memory_order_relaxed);
+      batch_records++;
+      execute_batch();
     } else if (tx_data->opcode == journal::Op::EXEC) {
-      journal_rec_executed_.fetch_add(1, std::memory_order_relaxed);
-    } else {
+      batch_records++;
+    } else if (tx_data->opcode == journal::Op::TIMESTAMP) {
+      execute_batch();
+      RecordApplyLag(tx_data->timestamp_ms);
+    } else if (tx_data->IsGlobalCmd()) {
+      // Global commands synchronize with the other flows, everything before them must run first.
+      execute_batch();
+      {
+        // Snapshots can not tell whether it is applied until it is counted.
+        lock_guard lk{apply_mu_};
+        in_global_cmd_ = true;
+      }
       ExecuteTx(std::move(*tx_data), cntx);
+      batch_records++;
+      execute_batch();
+    } else if (forward && tx_data->shard_cnt == 1 && !tx_data->raw_entry.empty() &&
+               (tx_data->opcode == journal::Op::COMMAND ||
+                tx_data->opcode == journal::Op::EXPIRED)) {
+      // Executed on its own, so that the change is journaled with the entry it came from.
+      execute_batch();
+      journal::ForwardedEntry fwd{tx_data->opcode, tx_data->raw_entry};
+      lock_guard lk{apply_mu_};
+      executor_->ExecuteForwarded(tx_data->dbid, tx_data->command, fwd);
       journal_rec_executed_.fetch_add(1, std::memory_order_relaxed);
+    } else {
+      if (!batch.empty() && batch.back().dbid != tx_data->dbid)
+        execute_batch();
+      batch.push_back(std::move(*tx_data));
+      batch_records++;
     }
+
+    if (batch.size() >= max_batch || !reader.HasBufferedData())
+      execute_batch();
     shard_replica_waker_.notifyAll();
   }
 }
@@ -969,6 +1095,49 @@ void DflyShardReplica::ExecuteTx(TransactionData&& tx_data, Context* cntx) {
   }
 }
 
+void DflyShardReplica::RecordApplyLag(uint64_t master_ms) {
+  uint64_t now_ms = absl::GetCurrentTimeNanos() / 1000000;
+  uint64_t lag_ms = now_ms > master_ms ? now_ms - master_ms : 0;
+
+  unsigned bucket = 0;
+  while (bucket + 1 < ApplyLagStats::kBuckets && lag_ms >= (1ULL << bucket))
+    ++bucket;
+
+  apply_lag_buckets_[bucket].fetch_add(1, std::memory_order_relaxed);
+  apply_lag_count_.fetch_add(1, std::memory_order_relaxed);
+  apply_lag_sum_ms_.fetch_add(lag_ms, std::memory_order_relaxed);
+  apply_lag_last_ms_.store(lag_ms, std::memory_order_relaxed);
+}
+
+ApplyLagStats DflyShardReplica::GetApplyLagStats() const {
+  ApplyLagStats res;
+  res.flow_id = flow_id_;
+  for (unsigned i = 0; i < ApplyLagStats::kBuckets; ++i)
+    res.buckets[i] = apply_lag_buckets_[i].load(std::memory_order_relaxed);
+  res.count = apply_lag_count_.load(std::memory_order_relaxed);
+  res.sum_ms = apply_lag_sum_ms_.load(std::memory_order_relaxed);
+  res.last_ms = apply_lag_last_ms_.load(std::memory_order_relaxed);
+  return res;
+}
+
+void DflyShardReplica::ExecuteTxBatch(absl::Span<TransactionData> batch, Context* cntx) {
+  if (cntx->IsCancelled()) {
+    return;
+  }
+
+  VLOG(2) << "Execute batch of " << batch.size() << " transactions without sync between shards";
+  absl::InlinedVector<journal::ParsedEntry::CmdData*, 64> cmds;
+  for (TransactionData& tx_data : batch) {
+    DCHECK(!tx_data.IsGlobalCmd());
+    DCHECK_EQ(tx_data.dbid, batch.front().dbid);
+    if (!tx_data.command.cmd_args.empty())
+      cmds.push_back(&tx_data.command);
+  }
+
+  if (!cmds.empty())
+    executor_->ExecuteBatch(batch.front().dbid, absl::MakeSpan(cmds));
+}
+
 error_code Replica::ParseReplicationHeader(base::IoBuf* io_buf, PSyncResponse* dest) {
   std::string_view str;
 
@@ -1062,6 +1231,9 @@ Replica::Info Replica::GetInfo() const {
     res.full_sync_done = (state_mask_.load() & R_SYNC_OK);
     res.master_last_io_sec = (ProactorBase::GetMonotonicTimeNs() - last_io_time) / 1000000000UL;
     res.master_id = master_context_.master_repl_id;
+    for (const auto& flow : shard_flows_) {
+      res.flow_apply_lag.push_back(flow->GetApplyLagStats());
+    }
     return res;
   };
 
@@ -1093,6 +1265,41 @@ std::vector<uint64_t> Replica::GetReplicaOffset() const {
   return flow_rec_count;
 }
 
+bool Replica::RunAtSyncPoint(absl::FunctionRef<void(string_view, const vector<LSN>&)> cb) {
+  lock_guard lk{flows_op_mu_};
+
+  // Global commands are counted once all the flows executed them, so the flows are locked
+  // again until none of them is in the middle of one.
+  constexpr unsigned kMaxAttempts = 100;
+  for (unsigned attempt = 0; attempt < kMaxAttempts; ++attempt) {
+    if ((state_mask_.load() & R_SYNC_OK) == 0 || !HasDflyMaster() || shard_flows_.empty())
+      return false;
+
+    size_t locked = 0;
+    while (locked < shard_flows_.size() && shard_flows_[locked]->TryLockApply())
+      ++locked;
+
+    bool all_locked = locked == shard_flows_.size();
+    if (all_locked)
+      cb(master_context_.master_repl_id, GetReplicaOffset());
+
+    for (size_t i = 0; i < locked; ++i)
+      shard_flows_[i]->UnlockApply();
+    if (all_locked)
+      return true;
+
+    ThisFiber::SleepFor(1ms);
+  }
+
+  LOG(WARNING) << "Could not stop applying records, the snapshot has no replication offsets";
+  return false;
+}
+
+void Replica::SetSnapshotSyncPoint(string master_id, vector<LSN> lsns) {
+  snapshot_master_id_ = std::move(master_id);
+  last_journal_LSNs_ = std::move(lsns);
+}
+
 std::string Replica::GetSyncId() const {
   return master_context_.dfly_session_id;
 }
@@ -1105,6 +1312,18 @@ uint64_t DflyShardReplica::JournalExecutedCount() const {
   return journal_rec_executed_.load(std::memory_order_relaxed);
 }
 
+bool DflyShardReplica::TryLockApply() {
+  apply_mu_.lock();
+  if (!in_global_cmd_)
+    return true;
+  apply_mu_.unlock();
+  return false;
+}
+
+void DflyShardReplica::UnlockApply() {
+  apply_mu_.unlock();
+}
+
 void DflyShardReplica::JoinFlow() {
   sync_fb_.JoinIfNeeded();
   acks_fb_.JoinIfNeeded();
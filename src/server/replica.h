@@ -4,7 +4,9 @@
 #pragma once
 
 #include <absl/container/inlined_vector.h>
+#include <absl/functional/function_ref.h>
 
+#include <array>
 #include <boost/fiber/barrier.hpp>
 #include <queue>
 #include <variant>
@@ -14,6 +16,7 @@
 #include "io/io_buf.h"
 #include "server/cluster/cluster_defs.h"
 #include "server/common.h"
+#include "server/journal/serializer.h"
 #include "server/journal/tx_executor.h"
 #include "server/journal/types.h"
 #include "server/protocol_client.h"
@@ -37,6 +40,21 @@ struct MasterContext {
   std::string master_repl_id;
   std::string dfly_session_id;  // Sync session id for dfly sync.
   DflyVersion version = DflyVersion::VER0;
+  JournalCompression journal_compression = JournalCompression::NONE;  // Of stable sync.
+  bool forward_journal = false;  // Whether applied entries are journaled as they were received.
+};
+
+// Apply lag of a stable sync flow, measured from the master timestamps in the stream.
+// It includes the difference between the clocks of both hosts.
+struct ApplyLagStats {
+  // Bucket i counts lags of less than 2^i ms, the last one counts all the larger lags.
+  static constexpr unsigned kBuckets = 16;
+
+  uint32_t flow_id = 0;
+  uint64_t buckets[kBuckets] = {};
+  uint64_t count = 0;
+  uint64_t sum_ms = 0;
+  uint64_t last_ms = 0;
 };
 
 // This class manages replication from both Dragonfly and Redis masters.
@@ -78,6 +96,16 @@ class Replica : ProtocolClient {
     return master_context_.master_repl_id;
   }
 
+  // Runs cb with the master id and the number of records of each master flow that the data
+  // includes, while the flows do not apply records, so that a snapshot started by cb is
+  // consistent with them. Returns false without running cb unless in stable sync with a
+  // Dragonfly master.
+  bool RunAtSyncPoint(absl::FunctionRef<void(std::string_view, const std::vector<LSN>&)> cb);
+
+  // The data was loaded from a snapshot saved on a replica of master_id, see RunAtSyncPoint.
+  // The first sync with that master continues from the given records instead of a full sync.
+  void SetSnapshotSyncPoint(std::string master_id, std::vector<LSN> lsns);
+
  private: /* Main standalone mode functions */
   // Coordinate state transitions. Spawned by start.
   void MainReplicationFb();
@@ -94,6 +122,7 @@ class Replica : ProtocolClient {
   std::error_code ConsumeDflyStream();   // Dragonfly stable state.
 
   void RedisStreamAcksFb();
+  void PublishApplyLagFb();
 
   // Joins all the flows when doing sharded replication. This is called in two
   // places: Once at the end of full sync to join the full sync fibers, and twice
@@ -125,10 +154,18 @@ class Replica : ProtocolClient {
     bool full_sync_done;
     time_t master_last_io_sec;  // monotonic clock.
     std::string master_id;
+    std::vector<ApplyLagStats> flow_apply_lag;
   };
 
   Info GetInfo() const;  // thread-safe, blocks fiber
 
+  // The apply lag of the replica of REPLICAOF while it stably syncs with a Dragonfly master,
+  // i.e. the maximal lag of the last master timestamp applied by its flows, or UINT64_MAX
+  // while it does not. Refreshed every kApplyLagPublishMs and readable from any thread
+  // without locking, for the read path.
+  static uint64_t PublishedApplyLagMs();
+  static constexpr uint64_t kApplyLagPublishMs = 100;
+
   bool HasDflyMaster() const {
     return !master_context_.dfly_session_id.empty();
   }
@@ -152,12 +189,14 @@ class Replica : ProtocolClient {
   // In redis replication mode.
   util::fb2::Fiber sync_fb_;
   util::fb2::Fiber acks_fb_;
+  util::fb2::Fiber apply_lag_fb_;  // see PublishedApplyLagMs
   util::fb2::EventCount replica_waker_;
 
   std::vector<std::unique_ptr<DflyShardReplica>> shard_flows_;
   // A vector of the last executer LSNs when a replication is interrupted.
   // Allows partial sync on reconnects.
   std::optional<std::vector<LSN>> last_journal_LSNs_;
+  std::string snapshot_master_id_;  // The master of last_journal_LSNs_ loaded from a snapshot.
   std::shared_ptr<MultiShardExecution> multi_shard_exe_;
 
   // Guard operations where flows might be in a mixed state (transition/setup)
@@ -205,11 +244,27 @@ class DflyShardReplica : public ProtocolClient {
 
   void ExecuteTx(TransactionData&& tx_data, Context* cntx);
 
+  // Executes consecutive single shard transactions of the same database without synchronizing
+  // with other flows.
+  void ExecuteTxBatch(absl::Span<TransactionData> batch, Context* cntx);
+
   uint32_t FlowId() const;
 
   uint64_t JournalExecutedCount() const;
 
+  // While locked the flow applies no records, so that each record is either applied and
+  // counted by JournalExecutedCount() or not applied at all. Fails, leaving the lock released,
+  // while a global command waits for the other flows.
+  bool TryLockApply();
+  void UnlockApply();
+
+  // Safe to call from any thread.
+  ApplyLagStats GetApplyLagStats() const;
+
  private:
+  // Accounts the lag of a master timestamp, once everything before it was applied.
+  void RecordApplyLag(uint64_t master_ms);
+
   Service& service_;
   MasterContext master_context_;
 
@@ -229,6 +284,12 @@ class DflyShardReplica : public ProtocolClient {
   // run out-of-order on the master instance.
   std::atomic_uint64_t journal_rec_executed_ = 0;
 
+  util::fb2::Mutex apply_mu_;
+  bool in_global_cmd_ = false;  // Executed but not counted yet, guarded by apply_mu_.
+
+  std::array<std::atomic_uint64_t, ApplyLagStats::kBuckets> apply_lag_buckets_{};
+  std::atomic_uint64_t apply_lag_count_{0}, apply_lag_sum_ms_{0}, apply_lag_last_ms_{0};
+
   util::fb2::Fiber sync_fb_;
 
   util::fb2::Fiber acks_fb_;
@@ -257,8 +257,8 @@ io::Result<string, GenericError> ScriptMgr::Insert(string_view body, Interpreter
       body = *async_body;
   }
 
-  string result;
-  Interpreter::AddResult add_result = interpreter->AddFunction(sha, body, &result);
+  string result, bytecode;
+  Interpreter::AddResult add_result = interpreter->AddFunction(sha, body, &result, &bytecode);
   if (add_result == Interpreter::COMPILE_ERR)
     return nonstd::make_unexpected(GenericError{std::move(result)});
 
@@ -271,6 +271,10 @@ io::Result<string, GenericError> ScriptMgr::Insert(string_view body, Interpreter
       it->second.orig_body = CharBufFromSV(orig_body);
   }
 
+  // The function was already present in the interpreter if it was not compiled now.
+  if (!it->second.bytecode && !bytecode.empty())
+    it->second.bytecode = make_shared<const string>(std::move(bytecode));
+
   UpdateScriptCaches(sha, it->second);
 
   return string{sha};
@@ -282,7 +286,7 @@ optional<ScriptMgr::ScriptData> ScriptMgr::Find(std::string_view sha) const {
 
   lock_guard lk{mu_};
   if (auto it = db_.find(sha); it != db_.end() && it->second.body)
-    return ScriptData{it->second, it->second.body.get(), {}};
+    return ScriptData{it->second, it->second.body.get(), {}, it->second.bytecode};
 
   return std::nullopt;
 }
@@ -330,7 +334,7 @@ vector<pair<string, ScriptMgr::ScriptData>> ScriptMgr::GetAll() const {
     string body = data.body ? string{data.body.get()} : string{};
     string orig_body = data.orig_body ? string{data.orig_body.get()} : string{};
     res.emplace_back(string{sha.data(), sha.size()},
-                     ScriptData{data, std::move(body), std::move(orig_body)});
+                     ScriptData{data, std::move(body), std::move(orig_body), data.bytecode});
   }
 
   return res;
@@ -7,6 +7,7 @@
 #include <absl/container/flat_hash_map.h>
 
 #include <array>
+#include <memory>
 #include <optional>
 
 #include "server/conn_context.h"
@@ -33,6 +34,9 @@ class ScriptMgr {
   struct ScriptData : public ScriptParams {
     std::string body;       // script source code present in lua interpreter
     std::string orig_body;  // original code, before removing header and adding async
+
+    // Precompiled body shared by all interpreters, see Interpreter::AddPrecompiled.
+    std::shared_ptr<const std::string> bytecode;
   };
 
   struct ScriptKey : public std::array<char, 40> {
@@ -75,6 +79,7 @@ class ScriptMgr {
   struct InternalScriptData : public ScriptParams {
     std::unique_ptr<char[]> body{};
     std::unique_ptr<char[]> orig_body{};
+    std::shared_ptr<const std::string> bytecode{};
   };
 
   ScriptParams default_params_;
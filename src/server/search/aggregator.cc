@@ -4,6 +4,8 @@
 
 #include "server/search/aggregator.h"
 
+#include <absl/strings/str_cat.h>
+
 #include "base/logging.h"
 
 namespace dfly::aggregate {
@@ -54,6 +56,16 @@ struct GroupStep {
 
 const Value kEmptyValue = Value{};
 
+// Hidden field that stores the count of a partial AVG reducer next to its sum
+std::string PartialCountField(std::string_view avg_field) {
+  return absl::StrCat("__count_", avg_field);
+}
+
+Reducer MakeReducer(std::string source_field, std::string result_field, std::string_view name) {
+  return Reducer{std::move(source_field), std::move(result_field), FindReducerFunc(name),
+                 std::string{name}};
+}
+
 }  // namespace
 
 const Value& ValueIterator::operator*() const {
@@ -96,6 +108,52 @@ PipelineStep MakeGroupStep(absl::Span<const std::string_view> fields,
   return GroupStep{std::vector<std::string>(fields.begin(), fields.end()), std::move(reducers)};
 }
 
+std::optional<PartialGroupSteps> MakePartialGroupSteps(absl::Span<const std::string_view> fields,
+                                                       const std::vector<Reducer>& reducers) {
+  std::vector<Reducer> shard_reducers, merge_reducers;
+  std::vector<std::string> avg_fields;
+
+  for (const auto& reducer : reducers) {
+    const std::string& field = reducer.result_field;
+    if (reducer.func_name == "COUNT" || reducer.func_name == "SUM") {
+      // Counts and sums of shards are summed up
+      shard_reducers.push_back(reducer);
+      merge_reducers.push_back(MakeReducer(field, field, "SUM"));
+    } else if (reducer.func_name == "MIN" || reducer.func_name == "MAX") {
+      shard_reducers.push_back(reducer);
+      merge_reducers.push_back(MakeReducer(field, field, reducer.func_name));
+    } else if (reducer.func_name == "AVG") {
+      // Averages are computed from the total sum and count
+      std::string count_field = PartialCountField(field);
+      shard_reducers.push_back(MakeReducer(reducer.source_field, field, "SUM"));
+      shard_reducers.push_back(MakeReducer("", count_field, "COUNT"));
+      merge_reducers.push_back(MakeReducer(field, field, "SUM"));
+      merge_reducers.push_back(MakeReducer(count_field, count_field, "SUM"));
+      avg_fields.push_back(field);
+    } else {
+      return std::nullopt;
+    }
+  }
+
+  std::vector<std::string> group_fields(fields.begin(), fields.end());
+  GroupStep merge_group{group_fields, std::move(merge_reducers)};
+
+  auto merge_step = [merge_group = std::move(merge_group),
+                     avg_fields = std::move(avg_fields)](std::vector<DocValues> values) mutable {
+    PipelineResult result = merge_group(std::move(values));
+    for (DocValues& doc : *result) {
+      for (const std::string& field : avg_fields) {
+        auto count = doc.extract(PartialCountField(field));
+        doc[field] = std::get<double>(doc[field]) / std::get<double>(count.mapped());
+      }
+    }
+    return result;
+  };
+
+  return PartialGroupSteps{GroupStep{std::move(group_fields), std::move(shard_reducers)},
+                           std::move(merge_step)};
+}
+
 PipelineStep MakeSortStep(std::string_view field, bool descending) {
   return [field = std::string(field), descending](std::vector<DocValues> values) -> PipelineResult {
     std::sort(values.begin(), values.end(), [field](const DocValues& l, const DocValues& r) {
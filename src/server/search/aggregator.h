@@ -7,6 +7,7 @@
 #include <absl/container/flat_hash_map.h>
 #include <absl/types/span.h>
 
+#include <optional>
 #include <string>
 #include <variant>
 
@@ -64,6 +65,13 @@ struct Reducer {
   using Func = std::function<Value(ValueIterator)>;
   std::string source_field, result_field;
   Func func;
+  std::string func_name = "";  // uppercase name of func, identifies decomposable reducers
+};
+
+// GROUPBY split into a step that runs on every shard and a step that merges partial groups
+struct PartialGroupSteps {
+  PipelineStep shard_step;  // groups documents of a single shard into partial groups
+  PipelineStep merge_step;  // merges partial groups of all shards into final groups
 };
 
 // Find reducer function by uppercase name (COUNT, MAX, etc...), empty functor if not found
@@ -73,6 +81,11 @@ Reducer::Func FindReducerFunc(std::string_view name);
 PipelineStep MakeGroupStep(absl::Span<const std::string_view> fields,
                            std::vector<Reducer> reducers);
 
+// Split `GROUPBY [fields...]` if all reducers are decomposable (COUNT, SUM, MIN, MAX, AVG),
+// otherwise return nullopt
+std::optional<PartialGroupSteps> MakePartialGroupSteps(absl::Span<const std::string_view> fields,
+                                                       const std::vector<Reducer>& reducers);
+
 // Make `SORYBY field [DESC]` step
 PipelineStep MakeSortStep(std::string_view field, bool descending = false);
 
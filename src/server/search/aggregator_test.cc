@@ -103,4 +103,40 @@ TEST(AggregatorTest, GroupWithReduce) {
   EXPECT_EQ(result->at(1).at("distinct-null"), Value{(double)1});
 }
 
+TEST(AggregatorTest, PartialGroup) {
+  std::vector<DocValues> values;
+  for (size_t i = 0; i < 20; i++)
+    values.push_back(DocValues{{"i", double(i)}, {"tag", i % 3 == 0 ? "a" : "b"}});
+
+  std::string_view fields[] = {"tag"};
+  std::vector<Reducer> reducers;
+  for (std::string name : {"COUNT", "SUM", "MIN", "MAX", "AVG"})
+    reducers.push_back(Reducer{"i", name, FindReducerFunc(name), name});
+
+  auto partial = MakePartialGroupSteps(fields, reducers);
+  ASSERT_TRUE(partial);
+
+  // Group two "shards" separately and merge their partial groups
+  std::vector<DocValues> shard1(values.begin(), values.begin() + 7);
+  std::vector<DocValues> shard2(values.begin() + 7, values.end());
+  auto groups = partial->shard_step(shard1).value();
+  auto groups2 = partial->shard_step(shard2).value();
+  groups.insert(groups.end(), groups2.begin(), groups2.end());
+  auto merged = partial->merge_step(groups);
+  ASSERT_TRUE(merged);
+
+  PipelineStep steps[] = {MakeGroupStep(fields, reducers)};
+  auto expected = Process(values, steps);
+  ASSERT_TRUE(expected);
+
+  auto by_tag = [](const DocValues& l, const DocValues& r) { return l.at("tag") < r.at("tag"); };
+  std::sort(merged->begin(), merged->end(), by_tag);
+  std::sort(expected->begin(), expected->end(), by_tag);
+  EXPECT_EQ(*merged, *expected);
+
+  // Distinct counts can't be merged
+  Reducer count_distinct{"i", "distinct", FindReducerFunc("COUNT_DISTINCT"), "COUNT_DISTINCT"};
+  EXPECT_FALSE(MakePartialGroupSteps(fields, {count_distinct}));
+}
+
 }  // namespace dfly::aggregate
@@ -9,6 +9,7 @@
 
 #include "server/search/doc_accessors.h"
 
+#include <absl/container/inlined_vector.h>
 #include <absl/strings/str_cat.h>
 #include <absl/strings/str_join.h>
 
@@ -114,48 +115,50 @@ SearchDocData StringMapAccessor::Serialize(const search::Schema& schema) const {
 }
 
 struct JsonAccessor::JsonPathContainer {
-  vector<JsonType> Evaluate(const JsonType& json) const {
-    vector<JsonType> res;
-
+  // Calls cb with each match of the path in the document, without copying the matches of
+  // documents held as JsonType.
+  void Evaluate(const JsonAccessor& doc, absl::FunctionRef<void(const JsonType&)> cb) const {
     visit(Overloaded{[&](const json::Path& path) {
-                       json::EvaluatePath(path, json,
-                                          [&](auto, const JsonType& v) { res.push_back(v); });
+                       if (doc.json_) {
+                         json::EvaluatePath(path, *doc.json_,
+                                            [&](auto, const JsonType& v) { cb(v); });
+                       } else {
+                         json::EvaluatePath(path, doc.flat_,
+                                            [&](auto, FlatJson v) { cb(json::FromFlat(v)); });
+                       }
                      },
                      [&](const jsoncons::jsonpath::jsonpath_expression<JsonType>& path) {
-                       auto json_arr = path.evaluate(json);
+                       auto json_arr = path.evaluate(doc.Json());
                        for (const auto& v : json_arr.array_range())
-                         res.push_back(v);
+                         cb(v);
                      }},
           val);
-
-    return res;
   }
 
   variant<json::Path, jsoncons::jsonpath::jsonpath_expression<JsonType>> val;
 };
 
+const JsonType& JsonAccessor::Json() const {
+  if (json_)
+    return *json_;
+  if (!owned_)
+    owned_ = json::FromFlat(flat_);
+  return *owned_;
+}
+
 BaseAccessor::StringList JsonAccessor::GetStrings(string_view active_field) const {
   auto* path = GetPath(active_field);
   if (!path)
     return {};
 
-  auto path_res = path->Evaluate(json_);
-  if (path_res.empty())
-    return {};
-
-  if (path_res.size() == 1) {
-    buf_ = path_res[0].as_string();
-    return {buf_};
-  }
-  buf_.clear();
-
   // First, grow buffer and compute string sizes
-  vector<size_t> sizes;
-  for (const auto& element : path_res) {
+  buf_.clear();
+  absl::InlinedVector<size_t, 2> sizes;
+  path->Evaluate(*this, [&](const JsonType& element) {
     size_t start = buf_.size();
     buf_ += element.as_string();
     sizes.push_back(buf_.size() - start);
-  }
+  });
 
   // Reposition start pointers to the most recent allocation of buf
   StringList out(sizes.size());
@@ -174,21 +177,24 @@ BaseAccessor::VectorInfo JsonAccessor::GetVector(string_view active_field) const
   if (!path)
     return {};
 
-  auto res = path->Evaluate(json_);
-  if (res.empty())
-    return {nullptr, 0};
+  VectorInfo res{nullptr, 0};
+  path->Evaluate(*this, [&](const JsonType& v) {
+    if (res.first)  // only the first match is used
+      return;
 
-  size_t size = res[0].size();
-  auto ptr = make_unique<float[]>(size);
+    size_t size = v.size();
+    auto ptr = make_unique<float[]>(size);
 
-  size_t i = 0;
-  for (const auto& v : res[0].array_range())
-    ptr[i++] = v.as<float>();
+    size_t i = 0;
+    for (const auto& elem : v.array_range())
+      ptr[i++] = elem.as<float>();
+    res = {std::move(ptr), size};
+  });
 
-  return {std::move(ptr), size};
+  return res;
 }
 
-JsonAccessor::JsonPathContainer* JsonAccessor::GetPath(std::string_view field) const {
+JsonAccessor::JsonPathContainer* JsonAccessor::GetPath(std::string_view field) {
   if (auto it = path_cache_.find(field); it != path_cache_.end()) {
     return it->second.get();
   }
@@ -223,7 +229,7 @@ JsonAccessor::JsonPathContainer* JsonAccessor::GetPath(std::string_view field) c
 }
 
 SearchDocData JsonAccessor::Serialize(const search::Schema& schema) const {
-  return {{"$", json_.to_string()}};
+  return {{"$", Json().to_string()}};
 }
 
 SearchDocData JsonAccessor::Serialize(const search::Schema& schema,
@@ -231,13 +237,21 @@ SearchDocData JsonAccessor::Serialize(const search::Schema& schema,
   SearchDocData out{};
   for (const auto& [ident, name] : fields) {
     if (auto* path = GetPath(ident); path) {
-      if (auto res = path->Evaluate(json_); !res.empty())
-        out[name] = res[0].to_string();
+      bool found = false;  // only the first match is used
+      path->Evaluate(*this, [&](const JsonType& v) {
+        if (!std::exchange(found, true))
+          out[name] = v.to_string();
+      });
     }
   }
   return out;
 }
 
+void JsonAccessor::PrecompilePaths(const search::Schema& schema) {
+  for (const auto& [ident, _] : schema.fields)
+    GetPath(ident);
+}
+
 void JsonAccessor::RemoveFieldFromCache(string_view field) {
   path_cache_.erase(field);
 }
@@ -249,8 +263,11 @@ unique_ptr<BaseAccessor> GetAccessor(const DbContext& db_cntx, const PrimeValue&
   DCHECK(pv.ObjType() == OBJ_HASH || pv.ObjType() == OBJ_JSON);
 
   if (pv.ObjType() == OBJ_JSON) {
-    DCHECK(pv.GetJson());
-    return make_unique<JsonAccessor>(pv.GetJson());
+    if (pv.GetJson())
+      return make_unique<JsonAccessor>(pv.GetJson());
+
+    absl::Span<uint8_t> buf = pv.GetFlatJson();
+    return make_unique<JsonAccessor>(flexbuffers::GetRoot(buf.data(), buf.size()));
   }
 
   if (pv.Encoding() == kEncodingListPack) {
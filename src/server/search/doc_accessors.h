@@ -7,9 +7,11 @@
 #include <absl/container/flat_hash_map.h>
 #include <absl/types/span.h>
 
+#include <optional>
 #include <string>
 #include <utility>
 
+#include "core/flatbuffers.h"
 #include "core/json/json_object.h"
 #include "core/search/search.h"
 #include "server/common.h"
@@ -65,7 +67,11 @@ struct StringMapAccessor : public BaseAccessor {
 struct JsonAccessor : public BaseAccessor {
   struct JsonPathContainer;  // contains jsoncons::jsonpath::jsonpath_expression
 
-  explicit JsonAccessor(const JsonType* json) : json_{*json} {
+  explicit JsonAccessor(const JsonType* json) : json_{json} {
+  }
+
+  // Reads the flat value in place, only the matches of the paths are decoded
+  explicit JsonAccessor(FlatJson flat) : flat_{flat} {
   }
 
   StringList GetStrings(std::string_view field) const override;
@@ -76,13 +82,21 @@ struct JsonAccessor : public BaseAccessor {
   SearchDocData Serialize(const search::Schema& schema,
                           const SearchParams::FieldReturnList& fields) const override;
 
+  // Parse paths of all schema fields ahead of indexing, so documents never wait for them
+  static void PrecompilePaths(const search::Schema& schema);
+
   static void RemoveFieldFromCache(std::string_view field);
 
  private:
   /// Parses `field` into a JSON path. Caches the results internally.
-  JsonPathContainer* GetPath(std::string_view field) const;
+  static JsonPathContainer* GetPath(std::string_view field);
+
+  // Returns the document, decoding a flat value as a whole on first use
+  const JsonType& Json() const;
 
-  const JsonType& json_;
+  const JsonType* json_ = nullptr;
+  FlatJson flat_;
+  mutable std::optional<JsonType> owned_;  // decoded flat_
   mutable std::string buf_;
 
   // Contains built json paths to avoid parsing them repeatedly
@@ -4,53 +4,77 @@
 
 #include "server/search/doc_index.h"
 
+#include <absl/base/internal/cycleclock.h>
 #include <absl/strings/str_join.h>
 
 #include <memory>
+#include <thread>
 
+#include "base/flags.h"
 #include "base/logging.h"
 #include "core/overloaded.h"
 #include "server/engine_shard_set.h"
 #include "server/search/doc_accessors.h"
 #include "server/server_state.h"
 
+ABSL_FLAG(uint32_t, search_build_threads, 0,
+          "Number of threads per shard that insert vectors into hnsw indices while they are built. "
+          "0 splits the cpu cores between the shards.");
+ABSL_FLAG(uint32_t, search_build_budget_usec, 1000,
+          "Cpu time in microseconds that a search index build spends per tick before it yields "
+          "to other work on the shard.");
+ABSL_FLAG(uint64_t, search_result_cache_bytes, 0,
+          "Maximum size in bytes of cached FT.SEARCH results per index on every shard. Results "
+          "are cached until the index changes. 0 disables the cache.");
+
 namespace dfly {
 
 using namespace std;
+using namespace util;
+using absl::base_internal::CycleClock;
 
 namespace {
 
-template <typename F>
-void TraverseAllMatching(const DocIndex& index, const OpArgs& op_args, F&& f) {
-  auto& db_slice = op_args.shard->db_slice();
-  DCHECK(db_slice.IsDbValid(op_args.db_cntx.db_index));
-  auto [prime_table, _] = db_slice.GetTables(op_args.db_cntx.db_index);
+// Documents are indexed in batches during builds, so that hnsw indices can insert them in parallel
+constexpr size_t kBuildBatch = 4096;
 
-  string scratch;
-  auto cb = [&](PrimeTable::iterator it) {
-    const PrimeValue& pv = it->second;
-    if (pv.ObjType() != index.GetObjCode())
-      return;
+size_t BuildThreads() {
+  if (uint32_t threads = absl::GetFlag(FLAGS_search_build_threads); threads > 0)
+    return threads;
 
-    string_view key = it->first.GetSlice(&scratch);
-    if (key.rfind(index.prefix, 0) != 0)
-      return;
+  // All shards build their part of an index at the same time
+  return max<size_t>(1, thread::hardware_concurrency() / shard_set->size());
+}
 
-    auto accessor = GetAccessor(op_args.db_cntx, pv);
-    f(key, accessor.get());
-  };
+// Identifies searches with equal results on the same version of an index
+string MakeCacheKey(const SearchParams& params, const search::SearchAlgorithm& algo) {
+  string key = algo.NormalizedQuery();
+  absl::StrAppend(&key, " LIMIT ", params.limit_offset, " ", params.limit_total);
+  if (params.return_fields) {
+    absl::StrAppend(&key, " RETURN ", params.return_fields->size());
+    for (const auto& [ident, name] : *params.return_fields)
+      absl::StrAppend(&key, " ", ident, " AS ", name);
+  }
+  return key;
+}
 
-  PrimeTable::Cursor cursor;
-  do {
-    cursor = prime_table->Traverse(cursor, cb);
-  } while (cursor);
+// Approximate memory used by a cached result
+size_t CachedBytes(const string& key, const SearchResult& result) {
+  size_t bytes = key.size() + sizeof(SearchResult);
+  for (const auto& doc : result.docs) {
+    bytes += sizeof(SerializedSearchDoc) + doc.key.size();
+    for (const auto& [field, value] : doc.values)
+      bytes += sizeof(field) + field.size() + sizeof(value) + value.size();
+  }
+  return bytes;
 }
 
 const absl::flat_hash_map<string_view, search::SchemaField::FieldType> kSchemaTypes = {
     {"TAG"sv, search::SchemaField::TAG},
     {"TEXT"sv, search::SchemaField::TEXT},
     {"NUMERIC"sv, search::SchemaField::NUMERIC},
-    {"VECTOR"sv, search::SchemaField::VECTOR}};
+    {"VECTOR"sv, search::SchemaField::VECTOR},
+    {"GEO"sv, search::SchemaField::GEO}};
 
 }  // namespace
 
@@ -108,8 +132,15 @@ string DocIndexInfo::BuildRestoreCommand() const {
         [](monostate) {},
         [out = &out](const search::SchemaField::VectorParams& params) {
           auto sim = params.sim == search::VectorSimilarity::L2 ? "L2" : "COSINE";
-          absl::StrAppend(out, " ", params.use_hnsw ? "HNSW" : "FLAT", " 6 ", "DIM ", params.dim,
-                          " DISTANCE_METRIC ", sim, " INITIAL_CAP ", params.capacity);
+          bool quantized = params.quantization != search::VectorQuantization::NONE;
+          absl::StrAppend(out, " ", params.use_hnsw ? "HNSW" : "FLAT", quantized ? " 8 " : " 6 ",
+                          "DIM ", params.dim, " DISTANCE_METRIC ", sim, " INITIAL_CAP ",
+                          params.capacity);
+          if (quantized) {
+            auto quantization =
+                params.quantization == search::VectorQuantization::FP16 ? "FP16" : "INT8";
+            absl::StrAppend(out, " QUANTIZATION ", quantization);
+          }
         },
         [out = &out](const search::SchemaField::TagParams& params) {
           absl::StrAppend(out, " ", "SEPARATOR", " ", string{params.separator});
@@ -123,8 +154,31 @@ string DocIndexInfo::BuildRestoreCommand() const {
   return out;
 }
 
+size_t ShardDocIndex::DocKeyIndex::KeyHash::operator()(string_view key) const {
+  return absl::Hash<string_view>{}(key);
+}
+
+size_t ShardDocIndex::DocKeyIndex::KeyHash::operator()(DocId id) const {
+  return (*this)(string_view{(*keys)[id]});
+}
+
+bool ShardDocIndex::DocKeyIndex::KeyEq::operator()(DocId l, DocId r) const {
+  return l == r;
+}
+
+bool ShardDocIndex::DocKeyIndex::KeyEq::operator()(DocId l, string_view r) const {
+  return (*keys)[l] == r;
+}
+
+bool ShardDocIndex::DocKeyIndex::KeyEq::operator()(string_view l, DocId r) const {
+  return l == (*keys)[r];
+}
+
+ShardDocIndex::DocKeyIndex::DocKeyIndex() : ids_{0, KeyHash{&keys_}, KeyEq{&keys_}} {
+}
+
 ShardDocIndex::DocId ShardDocIndex::DocKeyIndex::Add(string_view key) {
-  DCHECK_EQ(ids_.count(key), 0u);
+  DCHECK(!Contains(key));
 
   DocId id;
   if (!free_ids_.empty()) {
@@ -137,16 +191,18 @@ ShardDocIndex::DocId ShardDocIndex::DocKeyIndex::Add(string_view key) {
     keys_.emplace_back(key);
   }
 
-  ids_[key] = id;
+  // The key must be stored before the id is hashed
+  ids_.insert(id);
   return id;
 }
 
 ShardDocIndex::DocId ShardDocIndex::DocKeyIndex::Remove(string_view key) {
-  DCHECK_GT(ids_.count(key), 0u);
+  auto it = ids_.find(key);
+  DCHECK(it != ids_.end());
 
-  DocId id = ids_.find(key)->second;
-  keys_[id] = "";
-  ids_.erase(key);
+  DocId id = *it;
+  ids_.erase(it);
+  string{}.swap(keys_[id]);  // release memory of long keys
   free_ids_.push_back(id);
 
   return id;
@@ -159,10 +215,68 @@ string_view ShardDocIndex::DocKeyIndex::Get(DocId id) const {
   return keys_[id];
 }
 
+bool ShardDocIndex::DocKeyIndex::Contains(string_view key) const {
+  return ids_.contains(key);
+}
+
 size_t ShardDocIndex::DocKeyIndex::Size() const {
   return ids_.size();
 }
 
+void ShardDocIndex::DocKeyIndex::Clear() {
+  ids_.clear();
+  keys_.clear();
+  free_ids_.clear();
+  last_id_ = 0;
+}
+
+size_t ShardDocIndex::DocKeyIndex::ByteSize() const {
+  // Strings allocate only if they don't fit into their inline buffer
+  const size_t kInlineCapacity = string{}.capacity();
+
+  size_t bytes = keys_.capacity() * sizeof(string) + free_ids_.capacity() * sizeof(DocId);
+  for (const auto& key : keys_)
+    bytes += key.capacity() > kInlineCapacity ? key.capacity() + 1 : 0;
+
+  // One control byte per slot
+  bytes += ids_.capacity() * (sizeof(DocId) + 1);
+  return bytes;
+}
+
+const SearchResult* ShardDocIndex::ResultCache::Find(const string& key, uint64_t version) {
+  Validate(version);
+
+  auto it = entries_.find(key);
+  if (it == entries_.end()) {
+    misses++;
+    return nullptr;
+  }
+
+  hits++;
+  return &it->second;
+}
+
+void ShardDocIndex::ResultCache::Insert(string key, uint64_t version, const SearchResult& result,
+                                        size_t max_bytes) {
+  Validate(version);
+
+  size_t bytes = CachedBytes(key, result);
+  if (bytes_ + bytes > max_bytes)
+    return;
+
+  if (entries_.emplace(std::move(key), result).second)
+    bytes_ += bytes;
+}
+
+void ShardDocIndex::ResultCache::Validate(uint64_t version) {
+  if (version == version_)
+    return;
+
+  entries_.clear();
+  version_ = version;
+  bytes_ = 0;
+}
+
 uint8_t DocIndex::GetObjCode() const {
   return type == JSON ? OBJ_JSON : OBJ_HASH;
 }
@@ -175,25 +289,126 @@ ShardDocIndex::ShardDocIndex(shared_ptr<DocIndex> index)
     : base_{std::move(index)}, indices_{{}, nullptr}, key_index_{} {
 }
 
+ShardDocIndex::~ShardDocIndex() {
+  CancelBuild();
+}
+
 void ShardDocIndex::Rebuild(const OpArgs& op_args, PMR_NS::memory_resource* mr) {
-  key_index_ = DocKeyIndex{};
+  CancelBuild();
+  version_++;
+
+  key_index_.Clear();
   indices_ = search::FieldIndices{base_->schema, mr};
 
-  auto cb = [this](string_view key, BaseAccessor* doc) { indices_.Add(key_index_.Add(key), doc); };
-  TraverseAllMatching(*base_, op_args, cb);
+  auto& db_slice = op_args.shard->db_slice();
+  DCHECK(db_slice.IsDbValid(op_args.db_cntx.db_index));
+  auto [prime_table, _] = db_slice.GetTables(op_args.db_cntx.db_index);
+
+  build_ = BuildState{.shard = op_args.shard,
+                      .db_index = op_args.db_cntx.db_index,
+                      .table_size = prime_table->size(),
+                      .done = false};
+
+  // Small indices are complete after the first tick, before FT.CREATE replies
+  if (BuildTick())
+    return;
+
+  build_fb_ = fb2::Fiber("search_build", [this] {
+    do {
+      ThisFiber::Yield();
+    } while (!build_.cancelled && !BuildTick());
+  });
+}
+
+bool ShardDocIndex::BuildTick() {
+  DCHECK(!build_.done);
+
+  auto& db_slice = build_.shard->db_slice();
+  if (!db_slice.IsDbValid(build_.db_index)) {
+    build_.done = true;
+    return true;
+  }
+
+  auto [prime_table, _] = db_slice.GetTables(build_.db_index);
+  DbContext db_cntx{build_.db_index, GetCurrentTimeMs()};
+
+  // Accessors stay valid until the batch is flushed because the table is not modified meanwhile.
+  // The batch is always flushed before yielding.
+  vector<unique_ptr<BaseAccessor>> accessors;
+  vector<pair<search::DocId, search::DocumentAccessor*>> batch;
+  size_t num_threads = BuildThreads();
+  auto flush = [&] {
+    indices_.AddBatch(batch, num_threads);
+    accessors.clear();
+    batch.clear();
+  };
+
+  string scratch;
+  auto cb = [&](PrimeTable::iterator it) {
+    build_.visited++;
+
+    const PrimeValue& pv = it->second;
+    if (pv.ObjType() != base_->GetObjCode())
+      return;
+
+    string_view key = it->first.GetSlice(&scratch);
+    if (key.rfind(base_->prefix, 0) != 0)
+      return;
+
+    // Documents written during the build were already added by AddDoc
+    if (key_index_.Contains(key))
+      return;
+
+    auto doc = GetAccessor(db_cntx, pv);
+    batch.emplace_back(key_index_.Add(key), doc.get());
+    accessors.push_back(std::move(doc));
+    if (batch.size() == kBuildBatch)
+      flush();
+  };
+
+  uint64_t budget_cycles =
+      absl::GetFlag(FLAGS_search_build_budget_usec) * CycleClock::Frequency() / 1e6;
+  uint64_t start = CycleClock::Now();
+  do {
+    build_.cursor = prime_table->Traverse(build_.cursor, cb);
+  } while (build_.cursor && CycleClock::Now() - start < budget_cycles);
+  flush();
+
+  if (build_.cursor)
+    return false;
+
+  indices_.Optimize();
+  build_.done = true;
 
   VLOG(1) << "Indexed " << key_index_.Size() << " docs on " << base_->prefix;
+  return true;
+}
+
+void ShardDocIndex::CancelBuild() {
+  build_.cancelled = true;
+  build_fb_.JoinIfNeeded();
+  build_.cancelled = false;
+}
+
+bool ShardDocIndex::IsBuilding() const {
+  return !build_.done;
 }
 
 void ShardDocIndex::AddDoc(string_view key, const DbContext& db_cntx, const PrimeValue& pv) {
   auto accessor = GetAccessor(db_cntx, pv);
   indices_.Add(key_index_.Add(key), accessor.get());
+  version_++;
 }
 
 void ShardDocIndex::RemoveDoc(string_view key, const DbContext& db_cntx, const PrimeValue& pv) {
+  // Documents that the build hasn't reached yet are not indexed
+  if (IsBuilding() && !key_index_.Contains(key))
+    return;
+
   auto accessor = GetAccessor(db_cntx, pv);
   DocId id = key_index_.Remove(key);
   indices_.Remove(id, accessor.get());
+  version_++;
 }
 
 bool ShardDocIndex::Matches(string_view key, unsigned obj_code) const {
@@ -202,6 +417,22 @@ bool ShardDocIndex::Matches(string_view key, unsigned obj_code) const {
 
 SearchResult ShardDocIndex::Search(const OpArgs& op_args, const SearchParams& params,
                                    search::SearchAlgorithm* search_algo) const {
+  if (IsBuilding() && !params.allow_partial) {
+    return SearchResult{facade::ErrorReply{absl::StrCat(
+        "Index is being built: ", size_t(GetInfo().percent_indexed * 100), "% indexed")}};
+  }
+
+  // Results of partially built indices change without writes, profiles must be measured
+  size_t cache_bytes = absl::GetFlag(FLAGS_search_result_cache_bytes);
+  bool use_cache = cache_bytes > 0 && !IsBuilding() && !search_algo->IsProfilingEnabled();
+
+  string cache_key;
+  if (use_cache) {
+    cache_key = MakeCacheKey(params, *search_algo);
+    if (const SearchResult* cached = cache_.Find(cache_key, version_); cached)
+      return *cached;
+  }
+
   auto& db_slice = op_args.shard->db_slice();
   auto search_results = search_algo->Search(&indices_, params.limit_offset + params.limit_total);
 
@@ -229,8 +460,14 @@ SearchResult ShardDocIndex::Search(const OpArgs& op_args, const SearchParams& pa
     out.push_back(SerializedSearchDoc{string{key}, std::move(doc_data), std::move(score)});
   }
 
-  return SearchResult{search_results.total - expired_count, std::move(out),
+  SearchResult result{search_results.total - expired_count, std::move(out),
                       std::move(search_results.profile)};
+
+  // Expired documents are deleted later, bumping the version, so their results are not cached
+  if (use_cache && expired_count == 0)
+    cache_.Insert(std::move(cache_key), version_, result, cache_bytes);
+
+  return result;
 }
 
 vector<absl::flat_hash_map<string, search::SortableValue>> ShardDocIndex::SearchForAggregator(
@@ -241,10 +478,14 @@ vector<absl::flat_hash_map<string, search::SortableValue>> ShardDocIndex::Search
   if (!search_results.error.empty())
     return {};
 
-  // Convert load_fields into return_list required by accessor interface
+  // Convert load_fields into return_list required by accessor interface. The fields that have
+  // sort indices are served from them by ExtractStoredValues instead of the documents.
   SearchParams::FieldReturnList return_fields;
-  for (string_view load_field : load_fields)
-    return_fields.emplace_back(indices_.GetSchema().LookupAlias(load_field), load_field);
+  for (string_view load_field : load_fields) {
+    string_view ident = indices_.GetSchema().LookupAlias(load_field);
+    if (ident != load_field || !indices_.GetSortIndex(ident))
+      return_fields.emplace_back(ident, load_field);
+  }
 
   vector<absl::flat_hash_map<string, search::SortableValue>> out;
   for (DocId doc : search_results.ids) {
@@ -266,7 +507,10 @@ vector<absl::flat_hash_map<string, search::SortableValue>> ShardDocIndex::Search
 }
 
 DocIndexInfo ShardDocIndex::GetInfo() const {
-  return {*base_, key_index_.Size()};
+  double percent = 1.0;
+  if (IsBuilding())
+    percent = min(1.0, double(build_.visited) / max<size_t>(1, build_.table_size));
+  return {*base_, key_index_.Size(), percent, indices_.GetMemoryUsage(), key_index_.ByteSize()};
 }
 
 ShardDocIndices::ShardDocIndices() : local_mr_{ServerState::tlocal()->data_heap()} {
@@ -279,6 +523,9 @@ ShardDocIndex* ShardDocIndices::GetIndex(string_view name) {
 
 void ShardDocIndices::InitIndex(const OpArgs& op_args, std::string_view name,
                                 shared_ptr<DocIndex> index_ptr) {
+  if (index_ptr->type == DocIndex::JSON)
+    JsonAccessor::PrecompilePaths(index_ptr->schema);
+
   auto shard_index = make_unique<ShardDocIndex>(index_ptr);
   auto [it, _] = indices_.emplace(name, std::move(shard_index));
 
@@ -339,11 +586,13 @@ size_t ShardDocIndices::GetUsedMemory() const {
 }
 
 SearchStats ShardDocIndices::GetStats() const {
-  size_t total_entries = 0;
-  for (const auto& [_, index] : indices_)
-    total_entries += index->GetInfo().num_docs;
-
-  return {GetUsedMemory(), indices_.size(), total_entries};
+  SearchStats stats{GetUsedMemory(), indices_.size()};
+  for (const auto& [_, index] : indices_) {
+    stats.num_entries += index->key_index_.Size();
+    stats.cache_hits += index->cache_.hits;
+    stats.cache_misses += index->cache_.misses;
+  }
+  return stats;
 }
 
 }  // namespace dfly
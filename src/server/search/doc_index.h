@@ -5,6 +5,7 @@
 #pragma once
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/container/flat_hash_set.h>
 
 #include <memory>
 #include <optional>
@@ -17,6 +18,7 @@
 #include "core/search/search.h"
 #include "server/common.h"
 #include "server/table.h"
+#include "util/fibers/fibers.h"
 
 namespace dfly {
 
@@ -66,6 +68,12 @@ struct SearchParams {
   std::optional<search::SortOption> sort_option;
   search::QueryParams query_params;
 
+  // SCORER BM25: order results by relevance of their text terms
+  bool bm25_scoring = false;
+
+  // NOPARTIAL: fail instead of serving partial results while the index is being built
+  bool allow_partial = true;
+
   bool IdsOnly() const {
     return return_fields && return_fields->empty();
   }
@@ -91,6 +99,10 @@ struct DocIndex {
 struct DocIndexInfo {
   DocIndex base_index;
   size_t num_docs = 0;
+  double percent_indexed = 1.0;  // Progress of the initial build, 1 when complete
+
+  search::FieldIndices::MemoryUsage memory;
+  size_t key_table_bytes = 0;  // Mapping of keys to document ids
 
   // Build original ft.create command that can be used to re-create this index
   std::string BuildRestoreCommand() const;
@@ -104,24 +116,78 @@ class ShardDocIndex {
   using DocId = search::DocId;
 
   // DocKeyIndex manages mapping document keys to ids and vice versa through a simple interface.
+  // Keys are stored only once, by id. The lookup set stores ids and hashes them by their keys.
   struct DocKeyIndex {
+    DocKeyIndex();
+
+    // The lookup set refers to keys_ of this instance
+    DocKeyIndex(const DocKeyIndex&) = delete;
+    DocKeyIndex& operator=(const DocKeyIndex&) = delete;
+
     DocId Add(std::string_view key);
     DocId Remove(std::string_view key);
 
+    bool Contains(std::string_view key) const;
+
     std::string_view Get(DocId id) const;
     size_t Size() const;
 
+    // Remove all keys
+    void Clear();
+
+    size_t ByteSize() const;
+
    private:
-    absl::flat_hash_map<std::string, DocId> ids_;
+    struct KeyHash {
+      using is_transparent = void;
+      size_t operator()(std::string_view key) const;
+      size_t operator()(DocId id) const;
+
+      const std::vector<std::string>* keys;
+    };
+
+    struct KeyEq {
+      using is_transparent = void;
+      bool operator()(DocId l, DocId r) const;
+      bool operator()(DocId l, std::string_view r) const;
+      bool operator()(std::string_view l, DocId r) const;
+
+      const std::vector<std::string>* keys;
+    };
+
     std::vector<std::string> keys_;
+    absl::flat_hash_set<DocId, KeyHash, KeyEq> ids_;
     std::vector<DocId> free_ids_;
     DocId last_id_ = 0;
   };
 
+  // Caches results of repeated searches. Entries are valid only for the index version they were
+  // computed on, so the whole cache is dropped once the version changes.
+  struct ResultCache {
+    // Return cached result or nullptr if not found
+    const SearchResult* Find(const std::string& key, uint64_t version);
+
+    // Store result, unless the cache would grow beyond max_bytes
+    void Insert(std::string key, uint64_t version, const SearchResult& result, size_t max_bytes);
+
+    size_t hits = 0, misses = 0;
+
+   private:
+    // Drop all entries if they were computed on a different version
+    void Validate(uint64_t version);
+
+    absl::flat_hash_map<std::string, SearchResult> entries_;
+    uint64_t version_ = 0;
+    size_t bytes_ = 0;
+  };
+
  public:
   // Index must be rebuilt at least once after intialization
   ShardDocIndex(std::shared_ptr<DocIndex> index);
 
+  // Stops the build fiber if it's still running
+  ~ShardDocIndex();
+
   // Perform search on all indexed documents and return results.
   SearchResult Search(const OpArgs& op_args, const SearchParams& params,
                       search::SearchAlgorithm* search_algo) const;
@@ -138,14 +204,41 @@ class ShardDocIndex {
 
   DocIndexInfo GetInfo() const;
 
+  // Return true if the initial build is still traversing the keyspace
+  bool IsBuilding() const;
+
  private:
-  // Clears internal data. Traverses all matching documents and assigns ids.
+  // State of a build that traverses the keyspace in ticks with limited cpu time
+  struct BuildState {
+    EngineShard* shard = nullptr;
+    DbIndex db_index = 0;
+    PrimeTable::Cursor cursor;
+    size_t visited = 0;     // number of visited table entries
+    size_t table_size = 0;  // size of the table when the build started
+    bool done = true;
+    bool cancelled = false;
+  };
+
+  // Clears internal data. Traverses all matching documents and assigns ids. The first tick runs
+  // inline, the rest of the build continues on a background fiber.
   void Rebuild(const OpArgs& op_args, PMR_NS::memory_resource* mr);
 
+  // Index documents until the cpu budget of a tick is used up. Returns true when done.
+  bool BuildTick();
+
+  // Stop the background build and wait for its fiber to exit
+  void CancelBuild();
+
  private:
   std::shared_ptr<const DocIndex> base_;
   search::FieldIndices indices_;
   DocKeyIndex key_index_;
+
+  BuildState build_;
+  util::fb2::Fiber build_fb_;
+
+  uint64_t version_ = 0;  // incremented on every change of the indexed documents
+  mutable ResultCache cache_;
 };
 
 // Stores shard doc indices by name on a specific shard.
@@ -79,6 +79,14 @@ search::SchemaField::VectorParams ParseVectorParams(CmdArgParser* parser) {
       continue;
     }
 
+    if (parser->Check("QUANTIZATION").ExpectTail(1)) {
+      params.quantization =
+          parser->ToUpper().Switch("NONE", search::VectorQuantization::NONE, "FP16",
+                                   search::VectorQuantization::FP16, "INT8",
+                                   search::VectorQuantization::INT8);
+      continue;
+    }
+
     if (parser->Check("EF_RUNTIME").ExpectTail(1)) {
       parser->Next<size_t>();
       LOG(WARNING) << "EF_RUNTIME not supported";
@@ -262,6 +270,22 @@ optional<SearchParams> ParseSearchParamsOrReply(CmdArgParser parser, ConnectionC
       continue;
     }
 
+    // SCORER BM25
+    if (parser.Check("SCORER").ExpectTail(1)) {
+      if (string_view scorer = parser.Next(); !absl::EqualsIgnoreCase(scorer, "BM25")) {
+        cntx->SendError(absl::StrCat("Unsupported scorer: ", scorer));
+        return nullopt;
+      }
+      params.bm25_scoring = true;
+      continue;
+    }
+
+    // NOPARTIAL
+    if (parser.Check("NOPARTIAL")) {
+      params.allow_partial = false;
+      continue;
+    }
+
     // Unsupported parameters are ignored for now
     parser.Skip(1);
   }
@@ -280,6 +304,9 @@ struct AggregateParams {
 
   vector<string_view> load_fields;
   vector<aggregate::PipelineStep> steps;
+
+  // Set if the first step is a GROUPBY whose reducers can run on every shard
+  optional<aggregate::PartialGroupSteps> partial_group;
 };
 
 optional<AggregateParams> ParseAggregatorParamsOrReply(CmdArgParser parser,
@@ -321,9 +348,13 @@ optional<AggregateParams> ParseAggregatorParamsOrReply(CmdArgParser parser,
         parser.ExpectTag("AS");
         string result_field = parser.Next<string>();
 
-        reducers.push_back(aggregate::Reducer{source_field, result_field, std::move(func)});
+        reducers.push_back(
+            aggregate::Reducer{source_field, result_field, std::move(func), string{func_name}});
       }
 
+      if (params.steps.empty())
+        params.partial_group = aggregate::MakePartialGroupSteps(fields, reducers);
+
       params.steps.push_back(aggregate::MakeGroupStep(fields, std::move(reducers)));
       continue;
     }
@@ -414,24 +445,48 @@ void ReplyWithResults(const SearchParams& params, absl::Span<SearchResult> resul
 
 void ReplySorted(search::AggregationInfo agg, const SearchParams& params,
                  absl::Span<SearchResult> results, ConnectionContext* cntx) {
-  size_t total = 0;
-  vector<SerializedSearchDoc*> docs;
+  auto less = [desc = agg.descending](const SerializedSearchDoc& l, const SerializedSearchDoc& r) {
+    return desc ? r < l : l < r;
+  };
+
+  // Shards return at most offset + limit docs each, so merging them costs O(k) per shard.
+  // Cursors point to the next doc and the end of every shard's results
+  using Cursor = pair<SerializedSearchDoc*, SerializedSearchDoc*>;
+  vector<Cursor> cursors;
+  size_t total = 0, num_docs = 0;
   for (auto& shard_results : results) {
     total += shard_results.total_hits;
-    for (auto& doc : shard_results.docs) {
-      docs.push_back(&doc);
-    }
+    auto& shard_docs = shard_results.docs;
+
+    // Knn results are ordered by distance, so they're reversed for descending sorts
+    if (!is_sorted(shard_docs.begin(), shard_docs.end(), less))
+      stable_sort(shard_docs.begin(), shard_docs.end(), less);
+
+    if (!shard_docs.empty())
+      cursors.emplace_back(shard_docs.data(), shard_docs.data() + shard_docs.size());
+    num_docs += shard_docs.size();
   }
 
   size_t agg_limit = agg.limit.value_or(total);
   size_t prefix = min(params.limit_offset + params.limit_total, agg_limit);
 
-  partial_sort(docs.begin(), docs.begin() + min(docs.size(), prefix), docs.end(),
-               [desc = agg.descending](const auto* l, const auto* r) {
-                 return desc ? (*l >= *r) : (*l < *r);
-               });
+  // Streaming k-way merge, the heap keeps the cursor with the smallest doc on top
+  auto cursor_greater = [&less](const Cursor& l, const Cursor& r) {
+    return less(*r.first, *l.first);
+  };
+  make_heap(cursors.begin(), cursors.end(), cursor_greater);
 
-  docs.resize(min(docs.size(), agg_limit));
+  vector<SerializedSearchDoc*> docs;
+  docs.reserve(min(prefix, num_docs));
+  while (docs.size() < prefix && !cursors.empty()) {
+    pop_heap(cursors.begin(), cursors.end(), cursor_greater);
+    auto& [next, end] = cursors.back();
+    docs.push_back(next++);
+    if (next == end)
+      cursors.pop_back();
+    else
+      push_heap(cursors.begin(), cursors.end(), cursor_greater);
+  }
 
   size_t start_idx = min(params.limit_offset, docs.size());
   size_t result_count = min(docs.size() - start_idx, params.limit_total);
@@ -620,14 +675,24 @@ void SearchFamily::FtInfo(CmdArgList args, ConnectionContext* cntx) {
          infos.back().base_index.schema.fields.size());
 
   size_t total_num_docs = 0;
-  for (const auto& info : infos)
+  double percent_indexed = 0;
+  search::FieldIndices::MemoryUsage memory;
+  size_t key_table_bytes = 0;
+  for (const auto& info : infos) {
     total_num_docs += info.num_docs;
+    percent_indexed += info.percent_indexed;
+    memory.postings += info.memory.postings;
+    memory.vectors += info.memory.vectors;
+    memory.sort_indices += info.memory.sort_indices;
+    key_table_bytes += info.key_table_bytes;
+  }
+  percent_indexed /= infos.size();
 
   const auto& info = infos.front();
   const auto& schema = info.base_index.schema;
 
   auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
-  rb->StartCollection(4, RedisReplyBuilder::MAP);
+  rb->StartCollection(10, RedisReplyBuilder::MAP);
 
   rb->SendSimpleString("index_name");
   rb->SendSimpleString(idx_name);
@@ -662,6 +727,21 @@ void SearchFamily::FtInfo(CmdArgList args, ConnectionContext* cntx) {
 
   rb->SendSimpleString("num_docs");
   rb->SendLong(total_num_docs);
+
+  rb->SendSimpleString("percent_indexed");
+  rb->SendDouble(percent_indexed);
+
+  // Memory of all shards in megabytes
+  size_t total_bytes = memory.postings + memory.vectors + memory.sort_indices + key_table_bytes;
+  pair<string_view, size_t> memory_fields[] = {{"inverted_sz_mb", memory.postings},
+                                               {"vector_index_sz_mb", memory.vectors},
+                                               {"sortable_values_size_mb", memory.sort_indices},
+                                               {"key_table_size_mb", key_table_bytes},
+                                               {"total_index_memory_sz_mb", total_bytes}};
+  for (auto [name, bytes] : memory_fields) {
+    rb->SendSimpleString(name);
+    rb->SendDouble(double(bytes) / (1 << 20));
+  }
 }
 
 void SearchFamily::FtList(CmdArgList args, ConnectionContext* cntx) {
@@ -691,6 +771,9 @@ void SearchFamily::FtSearch(CmdArgList args, ConnectionContext* cntx) {
   if (!search_algo.Init(query_str, &params->query_params, sort_opt))
     return cntx->SendError("Query syntax error");
 
+  if (params->bm25_scoring)
+    search_algo.EnableScoring();
+
   // Because our coordinator thread may not have a shard, we can't check ahead if the index exists.
   atomic<bool> index_not_found{false};
   vector<SearchResult> docs(shard_set->size());
@@ -730,6 +813,9 @@ void SearchFamily::FtProfile(CmdArgList args, ConnectionContext* cntx) {
   if (!search_algo.Init(query_str, &params->query_params, sort_opt))
     return cntx->SendError("Query syntax error");
 
+  if (params->bm25_scoring)
+    search_algo.EnableScoring();
+
   search_algo.EnableProfiling();
 
   absl::Time start = absl::Now();
@@ -813,8 +899,13 @@ void SearchFamily::FtAggregate(CmdArgList args, ConnectionContext* cntx) {
   vector<ResultContainer> query_results(shard_set->size());
   cntx->transaction->ScheduleSingleHop([&](Transaction* t, EngineShard* es) {
     if (auto* index = es->search_indices()->GetIndex(params->index); index) {
-      query_results[es->shard_id()] =
-          index->SearchForAggregator(t->GetOpArgs(es), params->load_fields, &search_algo);
+      auto docs = index->SearchForAggregator(t->GetOpArgs(es), params->load_fields, &search_algo);
+
+      // Reduce documents to partial groups, so that only groups are sent to the coordinator
+      if (params->partial_group)
+        docs = std::move(params->partial_group->shard_step(std::move(docs)).value());
+
+      query_results[es->shard_id()] = std::move(docs);
     }
     return OpStatus::OK;
   });
@@ -825,7 +916,14 @@ void SearchFamily::FtAggregate(CmdArgList args, ConnectionContext* cntx) {
                   make_move_iterator(sub_results.end()));
   }
 
-  auto agg_results = aggregate::Process(std::move(values), params->steps);
+  // The first GROUPBY already ran on the shards, so only its partial groups are merged
+  absl::Span<const aggregate::PipelineStep> steps = params->steps;
+  if (params->partial_group) {
+    values = std::move(params->partial_group->merge_step(std::move(values)).value());
+    steps.remove_prefix(1);
+  }
+
+  auto agg_results = aggregate::Process(std::move(values), steps);
   if (!agg_results.has_value())
     return cntx->SendError(agg_results.error());
 
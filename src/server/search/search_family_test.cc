@@ -10,6 +10,10 @@
 #include "server/command_registry.h"
 #include "server/test_utils.h"
 
+ABSL_DECLARE_FLAG(uint32_t, search_build_budget_usec);
+ABSL_DECLARE_FLAG(uint64_t, search_result_cache_bytes);
+ABSL_DECLARE_FLAG(bool, experimental_flat_json);
+
 using namespace testing;
 using namespace std;
 using namespace util;
@@ -119,7 +123,53 @@ TEST_F(SearchFamilyTest, InfoIndex) {
   EXPECT_THAT(info,
               IsArray(_, _, _, IsArray("key_type", "HASH", "prefix", "doc-"), "attributes",
                       IsArray(IsArray("identifier", "name", "attribute", "name", "type", "TEXT")),
-                      "num_docs", IntArg(15)));
+                      "num_docs", IntArg(15), "percent_indexed", "1", "inverted_sz_mb", _,
+                      "vector_index_sz_mb", "0", "sortable_values_size_mb", "0",
+                      "key_table_size_mb", _, "total_index_memory_sz_mb", _));
+
+  const auto& fields = info.GetVec();
+  double inverted = stod(fields[11].GetString()), key_table = stod(fields[17].GetString());
+  EXPECT_GT(inverted, 0);
+  EXPECT_GT(key_table, 0);
+  EXPECT_NEAR(stod(fields[19].GetString()), inverted + key_table, 1e-6);
+}
+
+TEST_F(SearchFamilyTest, BackgroundBuild) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_search_build_budget_usec, 0);  // traverse a single bucket per tick
+
+  for (size_t i = 0; i < 2000; i++)
+    Run({"hset", absl::StrCat("doc-", i), "tag", "a"});
+
+  EXPECT_EQ(Run({"ft.create", "idx", "PREFIX", "1", "doc-", "SCHEMA", "tag", "TAG"}), "OK");
+
+  // Either the build is still in progress or all documents are indexed
+  auto resp = Run({"ft.search", "idx", "*", "NOPARTIAL", "LIMIT", "0", "0"});
+  if (resp.type == RespExpr::ERROR)
+    EXPECT_THAT(resp, ErrArg("Index is being built"));
+  else
+    EXPECT_THAT(resp, IntArg(2000));
+
+  // Write while the index is being built: delete, update and add documents
+  for (size_t i = 0; i < 2000; i += 2)
+    Run({"del", absl::StrCat("doc-", i)});
+  for (size_t i = 1; i < 2000; i += 10)
+    Run({"hset", absl::StrCat("doc-", i), "tag", "b"});
+  for (size_t i = 2000; i < 2500; i++)
+    Run({"hset", absl::StrCat("doc-", i), "tag", "a"});
+
+  for (size_t i = 0; i < 1000; i++) {
+    if (Run({"ft.info", "idx"}).GetVec()[9].GetString() == "1")
+      break;
+    ThisFiber::SleepFor(1ms);
+  }
+
+  auto info = Run({"ft.info", "idx"});
+  EXPECT_THAT(info.GetVec()[7], IntArg(1500));
+  EXPECT_EQ(info.GetVec()[9].GetString(), "1");
+  EXPECT_THAT(Run({"ft.search", "idx", "*", "NOPARTIAL", "LIMIT", "0", "0"}), IntArg(1500));
+  EXPECT_THAT(Run({"ft.search", "idx", "@tag:{a}", "LIMIT", "0", "0"}), IntArg(1300));
+  EXPECT_THAT(Run({"ft.search", "idx", "@tag:{b}", "LIMIT", "0", "0"}), IntArg(200));
 }
 
 TEST_F(SearchFamilyTest, Stats) {
@@ -146,6 +196,36 @@ TEST_F(SearchFamilyTest, Stats) {
   EXPECT_LE(metrics.search_stats.used_memory, 3 * expected_usage);
 }
 
+TEST_F(SearchFamilyTest, ResultCache) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_search_result_cache_bytes, 1 << 20);
+
+  EXPECT_EQ(Run({"ft.create", "i1", "SCHEMA", "title", "TEXT", "n", "NUMERIC"}), "OK");
+  Run({"hset", "d:1", "title", "first doc", "n", "1"});
+  Run({"hset", "d:2", "title", "second doc", "n", "2"});
+
+  auto search = [this](string_view query) { return Run({"ft.search", "i1", query}); };
+  auto cache_stats = [this] {
+    auto stats = GetMetrics().search_stats;
+    return pair{stats.cache_hits, stats.cache_misses};
+  };
+
+  size_t num_shards = shard_set->size();
+  EXPECT_THAT(search("@n:[1 2]  doc"), AreDocIds("d:1", "d:2"));
+  EXPECT_EQ(cache_stats(), pair(size_t(0), num_shards));
+
+  // Equivalent query is served from the cache
+  EXPECT_THAT(search("doc @n:[1 2]"), AreDocIds("d:1", "d:2"));
+  EXPECT_EQ(cache_stats(), pair(num_shards, num_shards));
+
+  // Writes invalidate cached results
+  Run({"hset", "d:2", "n", "3"});
+  Run({"hset", "d:3", "title", "third doc", "n", "1"});
+  EXPECT_THAT(search("doc @n:[1 2]"), AreDocIds("d:1", "d:3"));
+  Run({"del", "d:1"});
+  EXPECT_THAT(search("doc @n:[1 2]"), AreDocIds("d:3"));
+}
+
 // todo: ASAN fails heres on arm
 #ifndef SANITIZERS
 TEST_F(SearchFamilyTest, Simple) {
@@ -223,6 +303,29 @@ TEST_F(SearchFamilyTest, JsonAttributesPaths) {
   EXPECT_THAT(Run({"ft.search", "i1", "yes"}), AreDocIds("k2"));
 }
 
+// Flat documents are read in place.
+TEST_F(SearchFamilyTest, JsonFlat) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_experimental_flat_json, true);
+
+  Run({"json.set", "k1", ".", R"({"name": "alex", "nested": {"score": 10}, "tags": ["a", "b"]})"});
+  Run({"json.set", "k2", ".", R"({"name": "bob", "nested": {"score": 15}, "tags": ["b"]})"});
+
+  EXPECT_EQ(Run({"ft.create", "i1", "on", "json", "schema", "$.name", "as", "name", "text",
+                 "$.nested.score", "as", "score", "numeric", "$.tags[*]", "as", "tags", "tag"}),
+            "OK");
+
+  EXPECT_THAT(Run({"ft.search", "i1", "@tags:{b}"}), AreDocIds("k1", "k2"));
+  EXPECT_THAT(Run({"ft.search", "i1", "@score:[12 20]"}), AreDocIds("k2"));
+
+  auto res = Run({"ft.search", "i1", "@name:alex", "return", "1", "$.nested", "as", "n"});
+  EXPECT_THAT(res.GetVec()[2], RespArray(ElementsAre("n", R"({"score":10})")));
+
+  res = Run({"ft.search", "i1", "@name:bob"});
+  EXPECT_THAT(res.GetVec()[2], RespArray(ElementsAre(
+                                   "$", R"({"name":"bob","nested":{"score":15},"tags":["b"]})")));
+}
+
 // todo: fails on arm build
 #ifndef SANITIZERS
 TEST_F(SearchFamilyTest, JsonArrayValues) {
@@ -389,6 +492,26 @@ TEST_F(SearchFamilyTest, Numbers) {
   */
 }
 
+TEST_F(SearchFamilyTest, Geo) {
+  Run({"hset", "berlin", "loc", "13.405,52.52", "pop", "3600"});
+  Run({"hset", "potsdam", "loc", "13.064,52.391", "pop", "180"});
+  Run({"hset", "hamburg", "loc", "9.993,53.551", "pop", "1800"});
+  Run({"hset", "munich", "loc", "11.582,48.135", "pop", "1500"});
+
+  EXPECT_EQ(Run({"ft.create", "i1", "schema", "loc", "geo", "pop", "numeric"}), "OK");
+
+  EXPECT_THAT(Run({"ft.search", "i1", "@loc:[13.4 52.5 50 km]"}), AreDocIds("berlin", "potsdam"));
+  EXPECT_THAT(Run({"ft.search", "i1", "@loc:[13.4 52.5 300 km]"}),
+              AreDocIds("berlin", "potsdam", "hamburg"));
+  EXPECT_THAT(Run({"ft.search", "i1", "@loc:[13.4 52.5 300 km] @pop:[1000 2000]"}),
+              AreDocIds("hamburg"));
+  EXPECT_THAT(Run({"ft.search", "i1", "@loc:[BOX 12 51 600 600 km] -@pop:[0 1000]"}),
+              AreDocIds("berlin", "hamburg"));
+
+  EXPECT_THAT(Run({"ft.search", "i1", "@loc:[13.4 52.5 50 lightyears]"}),
+              ErrArg("Query syntax error"));
+}
+
 TEST_F(SearchFamilyTest, TestLimit) {
   for (unsigned i = 0; i < 20; i++)
     Run({"hset", to_string(i), "match", "all"});
@@ -691,4 +814,50 @@ TEST_F(SearchFamilyTest, Vector) {
   EXPECT_EQ(resp, "OK");
 }
 
+TEST_F(SearchFamilyTest, QuantizedVector) {
+  auto floatsv = [](const float* f) -> string_view {
+    return {reinterpret_cast<const char*>(f), sizeof(float)};
+  };
+
+  auto resp = Run({"ft.create", "fp16", "ON", "HASH", "SCHEMA", "vector", "VECTOR", "HNSW", "6",
+                   "DIM", "100", "distance_metric", "cosine", "QUANTIZATION", "FP16"});
+  EXPECT_EQ(resp, "OK");
+
+  resp = Run({"ft.create", "int4", "ON", "HASH", "SCHEMA", "vector", "VECTOR", "FLAT", "4", "DIM",
+              "1", "QUANTIZATION", "INT4"});
+  EXPECT_THAT(resp, ErrArg("Parse error of vector parameters"));
+
+  resp = Run({"ft.create", "int8", "ON", "HASH", "SCHEMA", "vector", "VECTOR", "FLAT", "4", "DIM",
+              "1", "QUANTIZATION", "int8"});
+  EXPECT_EQ(resp, "OK");
+
+  for (unsigned i = 0; i < 10; i++) {
+    const float value = i;
+    Run({"hset", "k"s + to_string(i), "vector", floatsv(&value)});
+  }
+
+  const float query = 5;
+  resp = Run({"ft.search", "int8", "* => [KNN 3 @vector $vec]", "NOCONTENT", "PARAMS", "2", "vec",
+              floatsv(&query)});
+  EXPECT_THAT(resp, IsUnordArray(IntArg(3), "k4", "k5", "k6"));
+}
+
+TEST_F(SearchFamilyTest, KnnSortDesc) {
+  auto floatsv = [](const float* f) -> string_view {
+    return {reinterpret_cast<const char*>(f), sizeof(float)};
+  };
+
+  Run({"ft.create", "i1", "SCHEMA", "vector", "VECTOR", "FLAT", "2", "DIM", "1"});
+  for (unsigned i = 0; i < 10; i++) {
+    const float value = i;
+    Run({"hset", "k"s + to_string(i), "vector", floatsv(&value)});
+  }
+
+  // Shards return knn results closest first, they have to be merged in reverse
+  const float query = 0;
+  auto resp = Run({"ft.search", "i1", "* => [KNN 4 @vector $vec]", "SORTBY", "__vector_score",
+                   "DESC", "NOCONTENT", "PARAMS", "2", "vec", floatsv(&query)});
+  EXPECT_THAT(resp, IsArray(IntArg(4), "k3", "k2", "k1", "k0"));
+}
+
 }  // namespace dfly
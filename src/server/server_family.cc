@@ -7,6 +7,7 @@
 #include <absl/cleanup/cleanup.h>
 #include <absl/random/random.h>  // for master_replid_ generation.
 #include <absl/strings/match.h>
+#include <absl/strings/str_format.h>
 #include <absl/strings/str_join.h>
 #include <absl/strings/str_replace.h>
 #include <absl/strings/strip.h>
@@ -46,6 +47,7 @@ extern "C" {
 #include "server/engine_shard_set.h"
 #include "server/error.h"
 #include "server/generic_family.h"
+#include "server/journal/aof.h"
 #include "server/journal/journal.h"
 #include "server/main_service.h"
 #include "server/memory_cmd.h"
@@ -89,6 +91,9 @@ ABSL_FLAG(string, dir, "", "working directory");
 ABSL_FLAG(string, dbfilename, "dump-{timestamp}",
           "the filename to save/load the DB, instead of/with {timestamp} can be used {Y}, {m}, and "
           "{d} macros");
+ABSL_FLAG(string, aof_dir, "",
+          "If set, the journal is appended to files in this directory, which are replayed on top "
+          "of the last snapshot on startup. Requires io_uring.");
 ABSL_FLAG(string, requirepass, "",
           "password for AUTH authentication. "
           "If empty can also be set with DFLY_PASSWORD environment variable.");
@@ -126,8 +131,17 @@ ABSL_FLAG(bool, s3_sign_payload, true,
 ABSL_FLAG(bool, info_replication_valkey_compatible, false,
           "when true - output valkey compatible values for info-replication");
 
+ABSL_FLAG(uint32_t, rdb_load_read_ahead_mb, 8,
+          "Number of 1MB blocks read ahead of the parser when loading snapshot files. "
+          "0 disables read ahead.");
+
+ABSL_FLAG(bool, snapshot_delta_tracking, false,
+          "if true, local dfs snapshots track the changes since they were taken and "
+          "SAVE DELTA writes only the changed keys next to the last one");
+
 ABSL_DECLARE_FLAG(int32_t, port);
 ABSL_DECLARE_FLAG(bool, cache_mode);
+ABSL_DECLARE_FLAG(std::string, cache_eviction_policy);
 ABSL_DECLARE_FLAG(uint32_t, hz);
 ABSL_DECLARE_FLAG(bool, tls);
 ABSL_DECLARE_FLAG(string, tls_ca_cert_file);
@@ -463,7 +477,7 @@ void ClientTracking(CmdArgList args, ConnectionContext* cntx) {
         "Client tracking is currently not supported for RESP2. Please use RESP3.");
 
   CmdArgParser parser{args};
-  if (!parser.HasAtLeast(1) || args.size() > 3)
+  if (!parser.HasAtLeast(1))
     return cntx->SendError(kSyntaxErr);
 
   bool is_on = false;
@@ -476,34 +490,44 @@ void ClientTracking(CmdArgList args, ConnectionContext* cntx) {
   }
 
   bool noloop = false;
+  bool bcast = false;
+  vector<string> prefixes;
 
-  if (parser.HasNext()) {
-    if (parser.Check("OPTIN").IgnoreCase()) {
+  while (parser.HasNext()) {
+    if (option == Tracking::NONE && parser.Check("OPTIN").IgnoreCase()) {
       option = Tracking::OPTIN;
-    } else if (parser.Check("OPTOUT").IgnoreCase()) {
+    } else if (option == Tracking::NONE && parser.Check("OPTOUT").IgnoreCase()) {
       option = Tracking::OPTOUT;
-    } else if (parser.Check("NOLOOP").IgnoreCase()) {
+    } else if (!noloop && parser.Check("NOLOOP").IgnoreCase()) {
       noloop = true;
+    } else if (!bcast && parser.Check("BCAST").IgnoreCase()) {
+      bcast = true;
+    } else if (parser.Check("PREFIX").IgnoreCase() && parser.HasNext()) {
+      prefixes.emplace_back(parser.Next<string_view>());
     } else {
       return cntx->SendError(kSyntaxErr);
     }
   }
 
-  if (parser.HasNext()) {
-    if (!noloop && parser.Check("NOLOOP").IgnoreCase()) {
-      noloop = true;
-    } else {
-      return cntx->SendError(kSyntaxErr);
-    }
-  }
+  if (!bcast && !prefixes.empty())
+    return cntx->SendError("PREFIX option requires BCAST mode to be enabled");
+  if (bcast && option != Tracking::NONE)
+    return cntx->SendError("OPTIN and OPTOUT are not compatible with BCAST");
+
+  auto& info = cntx->conn_state.tracking_info_;
+  if (info.IsTrackingOn() && info.IsBcast())
+    cntx->ChangeBcastTracking(false);
 
   if (is_on) {
     ++cntx->subscriptions;
   }
 
-  cntx->conn_state.tracking_info_.SetClientTracking(is_on);
-  cntx->conn_state.tracking_info_.SetOption(option);
-  cntx->conn_state.tracking_info_.SetNoLoop(noloop);
+  info.SetClientTracking(is_on);
+  info.SetOption(option);
+  info.SetNoLoop(noloop);
+  info.SetBcast(is_on && bcast, std::move(prefixes));
+  if (info.IsBcast())
+    cntx->ChangeBcastTracking(true);
   return cntx->SendOk();
 }
 
@@ -671,6 +695,28 @@ optional<ReplicaOfArgs> ReplicaOfArgs::FromCmdArgs(CmdArgList args, ConnectionCo
   return replicaof_args;
 }
 
+// Returns the LSNs that cover the journal of every shard so far, and thus all the writes of the
+// calling connection. The pings make the replicas ack right away instead of on their interval.
+vector<LSN> PingJournalsForAcks() {
+  vector<LSN> lsns(shard_set->size(), 0);
+  shard_set->RunBlockingInParallel([&lsns](EngineShard* shard) {
+    journal::Journal* journal = shard->journal();
+    if (!journal)
+      return;
+    lsns[shard->shard_id()] = journal->GetLsn();
+    if (journal->HasRegisteredCallbacks())
+      journal->RecordEntry(0, journal::Op::PING, 0, 0, nullopt, {}, true);
+  });
+  return lsns;
+}
+
+// Zero means no timeout.
+chrono::steady_clock::time_point WaitDeadline(int64_t timeout_ms) {
+  if (timeout_ms == 0)
+    return chrono::steady_clock::time_point::max();
+  return chrono::steady_clock::now() + chrono::milliseconds(timeout_ms);
+}
+
 }  // namespace
 
 std::optional<fb2::Fiber> Pause(std::vector<facade::Listener*> listeners, facade::Connection* conn,
@@ -845,6 +891,9 @@ void ServerFamily::Init(util::AcceptServer* acceptor, std::vector<facade::Listen
     snapshot_storage_ = std::make_shared<detail::FileSnapshotStorage>(nullptr);
   }
 
+  if (string aof_dir = GetFlag(FLAGS_aof_dir); !aof_dir.empty())
+    aof_ = make_unique<journal::AppendOnlyFile>(aof_dir, journal_.get());
+
   // check for '--replicaof' before loading anything
   if (ReplicaOfFlag flag = GetFlag(FLAGS_replicaof); flag.has_value()) {
     service_.proactor_pool().GetNextProactor()->Await(
@@ -867,12 +916,37 @@ void ServerFamily::Init(util::AcceptServer* acceptor, std::vector<facade::Listen
 }
 
 void ServerFamily::LoadFromSnapshot() {
+  // The append only files are replayed on top of the snapshot of their manifest.
+  if (aof_) {
+    auto manifest = journal::AppendOnlyFile::ReadManifest(GetFlag(FLAGS_aof_dir));
+    if (!manifest) {
+      LOG(ERROR) << "Could not read the append only file manifest: " << manifest.error().message();
+      exit(1);
+    }
+
+    if (*manifest) {
+      journal::AofManifest aof_manifest = std::move(**manifest);
+      auto recover = [this, aof_manifest] {
+        RecoverAndOpenAof(aof_manifest.generation, aof_manifest.snapshot);
+      };
+      if (aof_manifest.snapshot.empty())
+        service_.proactor_pool().GetNextProactor()->Await(recover);
+      else
+        load_result_ = Load(aof_manifest.snapshot, recover);
+      return;
+    }
+  }
+
   const auto load_path_result =
       snapshot_storage_->LoadPath(GetFlag(FLAGS_dir), GetFlag(FLAGS_dbfilename));
   if (load_path_result) {
     const std::string load_path = *load_path_result;
     if (!load_path.empty()) {
-      load_result_ = Load(load_path);
+      std::function<void()> open_aof;
+      if (aof_)
+        open_aof = [this, load_path] { RecoverAndOpenAof(nullopt, load_path); };
+      load_result_ = Load(load_path, std::move(open_aof));
+      return;
     }
   } else {
     if (std::error_code(load_path_result.error()) == std::errc::no_such_file_or_directory) {
@@ -881,6 +955,27 @@ void ServerFamily::LoadFromSnapshot() {
       LOG(ERROR) << "Failed to load snapshot: " << load_path_result.error().Format();
     }
   }
+
+  if (aof_) {
+    service_.proactor_pool().GetNextProactor()->Await([this] { RecoverAndOpenAof(nullopt, ""); });
+  }
+}
+
+void ServerFamily::RecoverAndOpenAof(std::optional<uint64_t> generation,
+                                     std::string_view snapshot) {
+  string dir = GetFlag(FLAGS_aof_dir);
+  if (generation) {
+    if (auto ec = journal::AppendOnlyFile::Replay(&service_, dir, generation); ec) {
+      LOG(ERROR) << "Could not replay the append only files in " << dir << ": " << ec.message();
+      exit(1);
+    }
+  }
+
+  // Opened only after the replay, so that the replayed entries are not appended again.
+  if (auto ec = aof_->Open(snapshot); ec) {
+    LOG(ERROR) << "Could not open the append only files in " << dir << ": " << ec.message();
+    exit(1);
+  }
 }
 
 void ServerFamily::JoinSnapshotSchedule() {
@@ -901,6 +996,12 @@ void ServerFamily::Shutdown() {
   bg_save_fb_.JoinIfNeeded();
 
   if (save_on_shutdown_ && !absl::GetFlag(FLAGS_dbfilename).empty()) {
+    // With persistent tiered storage the snapshot refers to offloaded values in kept files
+    shard_set->RunBriefInParallel([](EngineShard* es) {
+      if (auto* ts = es->tiered_storage(); ts)
+        ts->FreezeForShutdown();
+    });
+
     shard_set->pool()->GetNextProactor()->Await([this] {
       if (GenericError ec = DoSave(); ec) {
         LOG(WARNING) << "Failed to perform snapshot " << ec.Format();
@@ -914,6 +1015,9 @@ void ServerFamily::Shutdown() {
       stats_caching_task_ = 0;
     }
 
+    if (aof_)
+      aof_->Close();
+
     auto ec = journal_->Close();
     LOG_IF(ERROR, ec) << "Error closing journal " << ec;
 
@@ -936,19 +1040,33 @@ struct AggregateLoadResult {
 // Load starts as many fibers as there are files to load each one separately.
 // It starts one more fiber that waits for all load fibers to finish and returns the first
 // error (if any occured) with a future.
-std::optional<fb2::Future<GenericError>> ServerFamily::Load(const std::string& load_path) {
-  auto paths_result = snapshot_storage_->LoadPaths(load_path);
-  if (!paths_result) {
-    LOG(ERROR) << "Failed to load snapshot: " << paths_result.error().Format();
+std::optional<fb2::Future<GenericError>> ServerFamily::Load(const std::string& load_path,
+                                                           std::function<void()> post_load) {
+  auto fail = [](const GenericError& err) {
+    LOG(ERROR) << "Failed to load snapshot: " << err.Format();
 
     fb2::Future<GenericError> future;
-    future.Resolve(paths_result.error());
+    future.Resolve(err);
     return future;
-  }
+  };
 
-  std::vector<std::string> paths = *paths_result;
+  // A delta snapshot is loaded on top of its base and the deltas before it, one after another.
+  auto chain_result = snapshot_storage_->LoadChain(load_path);
+  if (!chain_result)
+    return fail(chain_result.error());
+
+  std::vector<std::vector<std::string>> stages;
+  for (const auto& summary_path : *chain_result) {
+    auto paths_result = snapshot_storage_->LoadPaths(summary_path);
+    if (!paths_result)
+      return fail(paths_result.error());
+    stages.push_back(std::move(*paths_result));
+  }
 
   LOG(INFO) << "Loading " << load_path;
+  if (stages.size() > 1)
+    LOG(INFO) << "Applying " << stages.size() - 1 << " delta snapshots on top of "
+              << chain_result->front();
 
   auto new_state = service_.SwitchState(GlobalState::ACTIVE, GlobalState::LOADING);
   if (new_state != GlobalState::LOADING) {
@@ -957,43 +1075,61 @@ std::optional<fb2::Future<GenericError>> ServerFamily::Load(const std::string& l
   }
 
   RdbLoader::PerformPreLoad(&service_);
+  {
+    std::lock_guard lk(replicaof_mu_);
+    snapshot_master_id_.clear();
+    snapshot_master_lsns_.clear();
+  }
 
   auto& pool = service_.proactor_pool();
+  auto aggregated_result = std::make_shared<AggregateLoadResult>();
 
-  vector<fb2::Fiber> load_fibers;
-  load_fibers.reserve(paths.size());
+  auto launch_stage = [this, &pool, aggregated_result](std::vector<std::string> paths) {
+    vector<fb2::Fiber> load_fibers;
+    load_fibers.reserve(paths.size());
 
-  auto aggregated_result = std::make_shared<AggregateLoadResult>();
+    for (auto& path : paths) {
+      // For single file, choose thread that does not handle shards if possible.
+      // This will balance out the CPU during the load.
+      ProactorBase* proactor;
+      if (paths.size() == 1 && shard_count() < pool.size()) {
+        proactor = pool.at(shard_count());
+      } else {
+        proactor = pool.GetNextProactor();
+      }
 
-  for (auto& path : paths) {
-    // For single file, choose thread that does not handle shards if possible.
-    // This will balance out the CPU during the load.
-    ProactorBase* proactor;
-    if (paths.size() == 1 && shard_count() < pool.size()) {
-      proactor = pool.at(shard_count());
-    } else {
-      proactor = pool.GetNextProactor();
+      auto load_fiber = [this, aggregated_result, path = std::move(path)]() {
+        auto load_result = LoadRdb(path);
+        if (load_result.has_value())
+          aggregated_result->keys_read.fetch_add(*load_result);
+        else
+          aggregated_result->first_error = load_result.error();
+      };
+      load_fibers.push_back(proactor->LaunchFiber(std::move(load_fiber)));
     }
+    return load_fibers;
+  };
 
-    auto load_fiber = [this, aggregated_result, path = std::move(path)]() {
-      auto load_result = LoadRdb(path);
-      if (load_result.has_value())
-        aggregated_result->keys_read.fetch_add(*load_result);
-      else
-        aggregated_result->first_error = load_result.error();
-    };
-    load_fibers.push_back(proactor->LaunchFiber(std::move(load_fiber)));
-  }
+  vector<fb2::Fiber> load_fibers = launch_stage(std::move(stages.front()));
 
   fb2::Future<GenericError> future;
 
   // Run fiber that empties the channel and sets ec_promise.
   auto load_join_fiber = [this, aggregated_result, load_fibers = std::move(load_fibers),
-                          future]() mutable {
+                          stages = std::move(stages), launch_stage, future,
+                          post_load = std::move(post_load)]() mutable {
     for (auto& fiber : load_fibers) {
       fiber.Join();
     }
 
+    // Deltas must be applied on top of the fully loaded previous stage.
+    for (size_t i = 1; i < stages.size() && !aggregated_result->first_error; ++i) {
+      // Index definitions are loaded again from the summary of the delta.
+      RdbLoader::PerformPreLoad(&service_);
+      for (auto& fiber : launch_stage(std::move(stages[i])))
+        fiber.Join();
+    }
+
     if (aggregated_result->first_error) {
       LOG(ERROR) << "Rdb load failed. " << (*aggregated_result->first_error).message();
       exit(1);
@@ -1002,6 +1138,8 @@ std::optional<fb2::Future<GenericError>> ServerFamily::Load(const std::string& l
     RdbLoader::PerformPostLoad(&service_);
 
     LOG(INFO) << "Load finished, num keys read: " << aggregated_result->keys_read;
+    if (post_load)
+      post_load();
     service_.SwitchState(GlobalState::LOADING, GlobalState::ACTIVE);
     future.Resolve(*(aggregated_result->first_error));
   };
@@ -1041,10 +1179,25 @@ io::Result<size_t> ServerFamily::LoadRdb(const std::string& rdb_file) {
   io::ReadonlyFileOrError res = snapshot_storage_->OpenReadFile(rdb_file);
   if (res) {
     io::FileSource fs(*res);
+    io::Source* src = &fs;
+
+    // Reading the file in large blocks on a separate fiber overlaps I/O with parsing.
+    std::optional<ReadAheadSource> read_ahead;
+    if (uint32_t blocks = GetFlag(FLAGS_rdb_load_read_ahead_mb); blocks > 0) {
+      read_ahead.emplace(&fs, 1U << 20, blocks);
+      read_ahead->Start();
+      src = &*read_ahead;
+    }
 
     RdbLoader loader{&service_};
-    ec = loader.Load(&fs);
+    ec = loader.Load(src);
     if (!ec) {
+      // Only the summary file of a snapshot saved on a replica has the replication offsets.
+      if (!loader.master_id().empty()) {
+        std::lock_guard lk(replicaof_mu_);
+        snapshot_master_id_ = loader.master_id();
+        snapshot_master_lsns_ = loader.master_lsns();
+      }
       VLOG(1) << "Done loading RDB from " << rdb_file << ", keys loaded: " << loader.keys_loaded();
       VLOG(1) << "Loading finished after " << strings::HumanReadableElapsedTime(loader.load_time());
       return loader.keys_loaded();
@@ -1112,6 +1265,21 @@ void AppendMetricWithoutLabels(string_view name, string_view help, const absl::A
   AppendMetricValue(name, value, {}, {}, dest);
 }
 
+// Appends histogram with power of two buckets, multiplying the bounds and the sum by scale.
+void AppendLog2Histogram(string_view name, string_view help, const tiering::Log2Histogram& hist,
+                         double scale, string* dest) {
+  AppendMetricHeader(name, help, MetricType::HISTOGRAM, dest);
+  string bucket_name = StrCat(name, "_bucket");
+  uint64_t count = 0;
+  for (unsigned i = 0; i < tiering::Log2Histogram::kBuckets; ++i) {
+    count += hist.buckets[i];
+    string le = i + 1 < tiering::Log2Histogram::kBuckets ? StrCat((2ull << i) * scale) : "+Inf";
+    AppendMetricValue(bucket_name, count, {"le"}, {le}, dest);
+  }
+  AppendMetricValue(StrCat(name, "_sum"), hist.sum * scale, {}, {}, dest);
+  AppendMetricValue(StrCat(name, "_count"), hist.count, {}, {}, dest);
+}
+
 void PrintPrometheusMetrics(const Metrics& m, DflyCmd* dfly_cmd, StringResponse* resp) {
   // Server metrics
   AppendMetricHeader("version", "", MetricType::GAUGE, &resp->body());
@@ -1146,6 +1314,39 @@ void PrintPrometheusMetrics(const Metrics& m, DflyCmd* dfly_cmd, StringResponse*
                             conn_stats.pipelined_cmd_latency * 1e-6, MetricType::COUNTER,
                             &resp->body());
 
+  AppendMetricHeader("pipeline_squash_batch_size", "Number of commands per squashed pipeline batch",
+                     MetricType::HISTOGRAM, &resp->body());
+  constexpr unsigned kSquashBuckets = facade::ConnectionStats::kSquashBatchBuckets;
+  uint64_t squash_batches = 0;
+  for (unsigned i = 0; i < kSquashBuckets; ++i) {
+    squash_batches += conn_stats.squash_batches[i];
+    string le = i + 1 < kSquashBuckets ? absl::StrCat(2u << i) : "+Inf";
+    AppendMetricValue("pipeline_squash_batch_size_bucket", squash_batches, {"le"}, {le},
+                      &resp->body());
+  }
+  AppendMetricValue("pipeline_squash_batch_size_sum", conn_stats.squashed_commands, {}, {},
+                    &resp->body());
+  AppendMetricValue("pipeline_squash_batch_size_count", squash_batches, {}, {}, &resp->body());
+
+  AppendMetricWithoutLabels("dispatch_budget_yields_total", "",
+                            conn_stats.dispatch_budget_yields, MetricType::COUNTER, &resp->body());
+  if (!conn_stats.class_queue_latency.empty()) {
+    AppendMetricHeader("dispatch_queue_commands_total",
+                       "Pipelined commands dispatched per client class", MetricType::COUNTER,
+                       &resp->body());
+    for (const auto& [cls, latency] : conn_stats.class_queue_latency) {
+      AppendMetricValue("dispatch_queue_commands_total", latency.count, {"class"}, {cls},
+                        &resp->body());
+    }
+    AppendMetricHeader("dispatch_queue_duration_seconds",
+                       "Time pipelined commands waited in the dispatch queue per client class",
+                       MetricType::COUNTER, &resp->body());
+    for (const auto& [cls, latency] : conn_stats.class_queue_latency) {
+      AppendMetricValue("dispatch_queue_duration_seconds", latency.total_usec * 1e-6, {"class"},
+                        {cls}, &resp->body());
+    }
+  }
+
   // Memory metrics
   auto sdata_res = io::ReadStatusInfo();
   AppendMetricWithoutLabels("memory_used_bytes", "", m.heap_used_bytes, MetricType::GAUGE,
@@ -1254,6 +1455,36 @@ void PrintPrometheusMetrics(const Metrics& m, DflyCmd* dfly_cmd, StringResponse*
   AppendMetricValue("listener_accept_error_total", m.refused_conn_max_clients_reached_count,
                     {"reason"}, {"limit_reached"}, &resp->body());
 
+  // Tiered storage metrics
+  if (const auto& ts = m.tiered_stats; ts.capacity_bytes > 0) {
+    AppendMetricWithoutLabels("tiered_pending_io", "Disk reads and writes in flight",
+                              ts.pending_io_cnt, MetricType::GAUGE, &resp->body());
+    AppendLog2Histogram("tiered_read_duration_seconds", "Duration of backing file reads",
+                        ts.read_usec, 1e-6, &resp->body());
+    AppendLog2Histogram("tiered_stash_duration_seconds", "Duration of backing file writes",
+                        ts.stash_usec, 1e-6, &resp->body());
+    AppendLog2Histogram("tiered_read_queue_wait_seconds",
+                        "Time reads are queued before they are submitted", ts.queue_wait_usec,
+                        1e-6, &resp->body());
+    AppendLog2Histogram("tiered_io_depth", "Disk operations in flight when another one is issued",
+                        ts.pending_io_depth, 1, &resp->body());
+
+    string page_bytes, allocated_bytes;
+    AppendMetricHeader("tiered_page_bytes", "Bytes of backing file pages in use by page class",
+                       MetricType::GAUGE, &page_bytes);
+    AppendMetricHeader("tiered_page_allocated_bytes",
+                       "Bytes allocated within backing file pages by page class",
+                       MetricType::GAUGE, &allocated_bytes);
+    AppendMetricValue("tiered_page_bytes", ts.small_page_bytes, {"class"}, {"small"}, &page_bytes);
+    AppendMetricValue("tiered_page_bytes", ts.medium_page_bytes, {"class"}, {"medium"},
+                      &page_bytes);
+    AppendMetricValue("tiered_page_allocated_bytes", ts.small_page_allocated_bytes, {"class"},
+                      {"small"}, &allocated_bytes);
+    AppendMetricValue("tiered_page_allocated_bytes", ts.medium_page_allocated_bytes, {"class"},
+                      {"medium"}, &allocated_bytes);
+    absl::StrAppend(&resp->body(), page_bytes, allocated_bytes);
+  }
+
   // DB stats
   AppendMetricWithoutLabels("expired_keys_total", "", m.events.expired_keys, MetricType::COUNTER,
                             &resp->body());
@@ -1276,6 +1507,52 @@ void PrintPrometheusMetrics(const Metrics& m, DflyCmd* dfly_cmd, StringResponse*
     absl::StrAppend(&resp->body(), command_metrics);
   }
 
+  if (!m.cmd_latency_map.empty()) {
+    string latency_metrics;
+    AppendMetricHeader("command_latency_seconds", "Latency of command invocations",
+                       MetricType::HISTOGRAM, &latency_metrics);
+    for (const auto& [name, stat] : m.cmd_latency_map) {
+      uint64_t count = 0;
+      for (unsigned i = 0; i < CmdLatencyHistogram::kNumBuckets; ++i) {
+        count += stat.buckets[i];
+        string le =
+            i + 1 < CmdLatencyHistogram::kNumBuckets ? absl::StrCat((1u << i) * 1e-6) : "+Inf";
+        AppendMetricValue("command_latency_seconds_bucket", count, {"cmd", "le"}, {name, le},
+                          &latency_metrics);
+      }
+      auto it = m.cmd_stats_map.find(name);
+      double sum = it != m.cmd_stats_map.end() ? it->second.second * 1e-6 : 0;
+      AppendMetricValue("command_latency_seconds_sum", sum, {"cmd"}, {name}, &latency_metrics);
+      AppendMetricValue("command_latency_seconds_count", count, {"cmd"}, {name},
+                        &latency_metrics);
+    }
+    absl::StrAppend(&resp->body(), latency_metrics);
+  }
+
+  if (!m.cmd_phase_stats_map.empty()) {
+    string phase_metrics;
+    AppendMetricHeader("command_phase_duration_seconds",
+                       "Latency of the transaction phases of commands", MetricType::HISTOGRAM,
+                       &phase_metrics);
+    for (const auto& [name, stat] : m.cmd_phase_stats_map) {
+      for (unsigned phase = 0; phase < TxPhaseStats::kNumPhases; ++phase) {
+        string_view phase_name = TxPhaseStats::PhaseName(phase);
+        uint64_t count = 0;
+        for (unsigned i = 0; i < TxPhaseStats::kNumBuckets; ++i) {
+          count += stat.buckets[phase][i];
+          string le = i + 1 < TxPhaseStats::kNumBuckets ? absl::StrCat((1u << i) * 1e-6) : "+Inf";
+          AppendMetricValue("command_phase_duration_seconds_bucket", count,
+                            {"cmd", "phase", "le"}, {name, phase_name, le}, &phase_metrics);
+        }
+        AppendMetricValue("command_phase_duration_seconds_sum", stat.sum_usec[phase] * 1e-6,
+                          {"cmd", "phase"}, {name, phase_name}, &phase_metrics);
+        AppendMetricValue("command_phase_duration_seconds_count", count, {"cmd", "phase"},
+                          {name, phase_name}, &phase_metrics);
+      }
+    }
+    absl::StrAppend(&resp->body(), phase_metrics);
+  }
+
   if (!m.replication_metrics.empty()) {
     string replication_lag_metrics;
     AppendMetricHeader("connected_replica_lag_records", "Lag in records of a connected replica.",
@@ -1287,6 +1564,56 @@ void PrintPrometheusMetrics(const Metrics& m, DflyCmd* dfly_cmd, StringResponse*
                         &replication_lag_metrics);
     }
     absl::StrAppend(&resp->body(), replication_lag_metrics);
+
+    // Values of a metric must follow its header, so every metric is collected separately.
+    string bytes_metrics, inflight_metrics, throttle_metrics;
+    AppendMetricHeader("connected_replica_journal_bytes_total",
+                       "Journal bytes sent to a connected replica", MetricType::COUNTER,
+                       &bytes_metrics);
+    AppendMetricHeader("connected_replica_inflight_bytes",
+                       "Journal bytes sent to a connected replica but not yet acked by the socket",
+                       MetricType::GAUGE, &inflight_metrics);
+    AppendMetricHeader("connected_replica_throttle_seconds_total",
+                       "Time the journal stream waited for a slow replica", MetricType::COUNTER,
+                       &throttle_metrics);
+    for (const auto& replica : m.replication_metrics) {
+      string port = absl::StrCat(replica.listening_port);
+      for (const auto& flow : replica.flows) {
+        string flow_id = absl::StrCat(flow.flow_id);
+        AppendMetricValue("connected_replica_journal_bytes_total", flow.written_bytes,
+                          {"replica_ip", "replica_port", "flow"}, {replica.address, port, flow_id},
+                          &bytes_metrics);
+        AppendMetricValue("connected_replica_inflight_bytes", flow.in_flight_bytes,
+                          {"replica_ip", "replica_port", "flow"}, {replica.address, port, flow_id},
+                          &inflight_metrics);
+        AppendMetricValue("connected_replica_throttle_seconds_total", flow.throttle_usec * 1e-6,
+                          {"replica_ip", "replica_port", "flow"}, {replica.address, port, flow_id},
+                          &throttle_metrics);
+      }
+    }
+    absl::StrAppend(&resp->body(), bytes_metrics, inflight_metrics, throttle_metrics);
+  }
+
+  if (!m.replica_apply_lag.empty()) {
+    string lag_metrics;
+    AppendMetricHeader("replica_apply_lag_milliseconds",
+                       "Time from a master timestamp in the stream until it was applied",
+                       MetricType::HISTOGRAM, &lag_metrics);
+    for (const auto& lag : m.replica_apply_lag) {
+      string flow_id = absl::StrCat(lag.flow_id);
+      uint64_t count = 0;
+      for (unsigned i = 0; i < ApplyLagStats::kBuckets; ++i) {
+        count += lag.buckets[i];
+        string le = i + 1 < ApplyLagStats::kBuckets ? absl::StrCat(1u << i) : "+Inf";
+        AppendMetricValue("replica_apply_lag_milliseconds_bucket", count, {"flow", "le"},
+                          {flow_id, le}, &lag_metrics);
+      }
+      AppendMetricValue("replica_apply_lag_milliseconds_sum", lag.sum_ms, {"flow"}, {flow_id},
+                        &lag_metrics);
+      AppendMetricValue("replica_apply_lag_milliseconds_count", lag.count, {"flow"}, {flow_id},
+                        &lag_metrics);
+    }
+    absl::StrAppend(&resp->body(), lag_metrics);
   }
 
   AppendMetricWithoutLabels("fiber_switch_total", "", m.fiber_switch_cnt, MetricType::COUNTER,
@@ -1302,6 +1629,71 @@ void PrintPrometheusMetrics(const Metrics& m, DflyCmd* dfly_cmd, StringResponse*
                             &resp->body());
   AppendMetricWithoutLabels("tx_queue_len", "", m.tx_queue_len, MetricType::GAUGE, &resp->body());
 
+  // Per shard load
+  {
+    string load_metrics;
+    auto append_shard_metric = [&](string_view name, string_view help, MetricType type,
+                                   auto get) {
+      AppendMetricHeader(name, help, type, &load_metrics);
+      for (size_t sid = 0; sid < m.shard_load.size(); ++sid)
+        AppendMetricValue(name, get(m.shard_load[sid]), {"shard"}, {absl::StrCat(sid)},
+                          &load_metrics);
+    };
+
+    append_shard_metric("shard_utilization", "Busy fraction of the last 6 seconds",
+                        MetricType::GAUGE, [](const auto& l) { return l.utilization; });
+    append_shard_metric("shard_busy_seconds_total", "Time spent executing transactions",
+                        MetricType::COUNTER,
+                        [](const auto& l) { return l.stats.busy_usec_total * 1e-6; });
+    append_shard_metric("shard_tx_queue_len", "Transaction queue length", MetricType::GAUGE,
+                        [](const auto& l) { return l.tx_queue_len; });
+    append_shard_metric("shard_tx_queue_len_avg",
+                        "Average transaction queue length over the last 6 seconds",
+                        MetricType::GAUGE, [](const auto& l) { return l.tx_queue_len_avg; });
+    append_shard_metric("shard_task_queue_len", "Callbacks waiting in the shard queue",
+                        MetricType::GAUGE, [](const auto& l) { return l.task_queue_len; });
+    append_shard_metric("shard_fiber_switch_delay_seconds_total",
+                        "Time fibers spent runnable but not running", MetricType::COUNTER,
+                        [](const auto& l) { return l.fiber_switch_delay_usec * 1e-6; });
+    append_shard_metric("shard_heartbeat_overruns_total",
+                        "Heartbeats that ran longer than their period", MetricType::COUNTER,
+                        [](const auto& l) { return l.stats.heartbeat_overrun_total; });
+
+    auto append_task_metric = [&](string_view name, string_view help, MetricType type,
+                                  auto get) {
+      AppendMetricHeader(name, help, type, &load_metrics);
+      for (size_t sid = 0; sid < m.shard_load.size(); ++sid) {
+        for (unsigned i = 0; i < EngineShard::BG_TASK_TOTAL; ++i) {
+          auto task = EngineShard::BackgroundTask(i);
+          AppendMetricValue(name, get(m.shard_load[sid], task), {"shard", "task"},
+                            {absl::StrCat(sid), EngineShard::BackgroundTaskName(task)},
+                            &load_metrics);
+        }
+      }
+    };
+    append_task_metric("shard_background_seconds_total", "Time spent in background tasks",
+                       MetricType::COUNTER, [](const auto& l, auto task) {
+                         return l.stats.background_usec[task] * 1e-6;
+                       });
+    append_task_metric("shard_background_usec_per_sec",
+                       "Time per second spent in background tasks over the last 6 seconds",
+                       MetricType::GAUGE, [](const auto& l, auto task) {
+                         return l.background_usec_per_sec[task];
+                       });
+    absl::StrAppend(&resp->body(), load_metrics);
+  }
+  AppendMetricWithoutLabels("tx_schedule_batches_total", "Batched transaction schedule hops",
+                            m.coordinator_stats.tx_schedule_batch_cnt, MetricType::COUNTER,
+                            &resp->body());
+  AppendMetricWithoutLabels("tx_schedule_batched_total",
+                            "Transactions scheduled through batched hops",
+                            m.coordinator_stats.tx_schedule_batched_cnt, MetricType::COUNTER,
+                            &resp->body());
+  AppendMetricWithoutLabels("tx_cross_node_hops_total",
+                            "Hops sent to shards on another NUMA node than the coordinator",
+                            m.coordinator_stats.tx_cross_node_hops, MetricType::COUNTER,
+                            &resp->body());
+
   {
     bool added = false;
     string str;
@@ -1459,13 +1851,19 @@ GenericError ServerFamily::DoSave(bool ignore_state) {
 }
 
 GenericError ServerFamily::DoSaveCheckAndStart(bool new_version, string_view basename,
-                                               Transaction* trans, bool ignore_state) {
+                                               Transaction* trans, bool ignore_state, bool delta) {
   auto state = service_.GetGlobalState();
   // In some cases we want to create a snapshot even if server is not active, f.e in takeover
   if (!ignore_state && (state != GlobalState::ACTIVE)) {
     return GenericError{make_error_code(errc::operation_in_progress),
                         StrCat(GlobalStateName(state), " - can not save database")};
   }
+  shared_ptr<Replica> repl_ptr;
+  {
+    std::lock_guard lk(replicaof_mu_);
+    repl_ptr = replica_;
+  }
+
   {
     std::lock_guard lk(save_mu_);
     if (save_controller_) {
@@ -1473,15 +1871,59 @@ GenericError ServerFamily::DoSaveCheckAndStart(bool new_version, string_view bas
                           "SAVING - can not save database"};
     }
 
-    save_controller_ = make_unique<SaveStagesController>(detail::SaveStagesInputs{
-        new_version, basename, trans, &service_, fq_threadpool_.get(), snapshot_storage_});
+    detail::SaveStagesInputs inputs{
+        new_version, basename, trans, &service_, fq_threadpool_.get(), snapshot_storage_};
+    if (GetFlag(FLAGS_snapshot_delta_tracking)) {
+      if (delta) {
+        if (delta_base_path_.empty()) {
+          return GenericError{make_error_code(errc::invalid_argument),
+                              "no base snapshot to save a delta for"};
+        }
+        inputs.delta_mode_ = DeltaMode::DELTA;
+        inputs.delta_of_ = delta_base_path_;
+        inputs.delta_seq_ = delta_count_ + 1;
+      } else if (new_version) {
+        inputs.delta_mode_ = DeltaMode::BASE;
+      }
+    } else if (delta) {
+      return GenericError{make_error_code(errc::invalid_argument),
+                          "delta snapshots require --snapshot_delta_tracking"};
+    } else if (!delta_base_path_.empty()) {
+      // The flag was turned off, stop tracking the deleted keys.
+      shard_set->RunBriefInParallel([](EngineShard* es) { es->db_slice().ResetDeltaSnapshots(); });
+      delta_base_path_.clear();
+      delta_count_ = 0;
+    }
+
+    // Every snapshot starts a new generation of append only files at its cut.
+    if (aof_ && aof_->IsOpen()) {
+      uint64_t generation = aof_save_generation_ = aof_->NextGeneration();
+      inputs.on_shard_cut_ = [aof = aof_.get(), generation](EngineShard* es) {
+        aof->RotateInShard(es->shard_id(), generation);
+      };
+    }
+
+    auto start = [&] {
+      save_controller_ = make_unique<SaveStagesController>(std::move(inputs));
+      return save_controller_->InitResourcesAndStart();
+    };
 
-    auto res = save_controller_->InitResourcesAndStart();
+    // On a replica the snapshot records how far it replicated the master, so that a replica
+    // restored from it continues with a partial sync.
+    std::optional<detail::SaveInfo> res;
+    auto start_at_sync_point = [&](string_view master_id, const vector<LSN>& lsns) {
+      inputs.master_id_ = master_id;
+      inputs.master_lsns_ = lsns;
+      res = start();
+    };
+    if (!repl_ptr || !repl_ptr->RunAtSyncPoint(start_at_sync_point))
+      res = start();
 
     if (res) {
       DCHECK_EQ(res->error, true);
       last_save_info_.SetLastSaveError(*res);
       save_controller_.reset();
+      aof_save_generation_ = 0;
       return res->error;
     }
   }
@@ -1504,6 +1946,26 @@ GenericError ServerFamily::WaitUntilSaveFinished(Transaction* trans, bool ignore
       last_save_info_.file_name = save_info.file_name;
       last_save_info_.freq_map = save_info.freq_map;
     }
+
+    // The files of older generations are needed no longer once the snapshot is saved.
+    if (aof_save_generation_ && !save_info.error && aof_->IsOpen()) {
+      if (auto ec = aof_->CommitSnapshot(save_info.file_name, aof_save_generation_); ec)
+        LOG(ERROR) << "Could not commit the snapshot to the append only files: " << ec.message();
+    }
+    aof_save_generation_ = 0;
+
+    // A failed save drops the base in all shards, see DbSlice::FinishDeltaSnapshot.
+    if (DeltaMode mode = save_controller_->delta_mode_; mode != DeltaMode::NONE) {
+      if (save_info.error) {
+        delta_base_path_.clear();
+        delta_count_ = 0;
+      } else if (mode == DeltaMode::BASE) {
+        delta_base_path_ = absl::StripSuffix(save_info.file_name, "-summary.dfs");
+        delta_count_ = 0;
+      } else {
+        ++delta_count_;
+      }
+    }
     save_controller_.reset();
   }
 
@@ -1511,8 +1973,8 @@ GenericError ServerFamily::WaitUntilSaveFinished(Transaction* trans, bool ignore
 }
 
 GenericError ServerFamily::DoSave(bool new_version, string_view basename, Transaction* trans,
-                                  bool ignore_state) {
-  if (auto ec = DoSaveCheckAndStart(new_version, basename, trans, ignore_state); ec) {
+                                  bool ignore_state, bool delta) {
+  if (auto ec = DoSaveCheckAndStart(new_version, basename, trans, ignore_state, delta); ec) {
     return ec;
   }
 
@@ -1693,6 +2155,9 @@ void ServerFamily::Client(CmdArgList args, ConnectionContext* cntx) {
   }
 
   if (sub_cmd == "SETINFO") {
+    // Dragonfly specific attribute, the class weighs the dispatch budget of the connection.
+    if (sub_args.size() == 2 && absl::EqualsIgnoreCase(ArgS(sub_args, 0), "CLASS"))
+      cntx->client_class = ArgS(sub_args, 1);
     return cntx->SendOk();
   }
 
@@ -1803,7 +2268,7 @@ void ServerFamily::BgSaveFb(boost::intrusive_ptr<Transaction> trans) {
   }
 }
 
-std::optional<ServerFamily::VersionBasename> ServerFamily::GetVersionAndBasename(
+std::optional<ServerFamily::SaveCmdOptions> ServerFamily::GetSaveCmdOptions(
     CmdArgList args, ConnectionContext* cntx) {
   if (args.size() > 2) {
     cntx->SendError(kSyntaxErr);
@@ -1811,6 +2276,7 @@ std::optional<ServerFamily::VersionBasename> ServerFamily::GetVersionAndBasename
   }
 
   bool new_version = absl::GetFlag(FLAGS_df_snapshot_format);
+  bool delta = false;
 
   if (args.size() >= 1) {
     ToUpper(&args[0]);
@@ -1819,6 +2285,9 @@ std::optional<ServerFamily::VersionBasename> ServerFamily::GetVersionAndBasename
       new_version = true;
     } else if (sub_cmd == "RDB") {
       new_version = false;
+    } else if (sub_cmd == "DELTA" && args.size() == 1) {
+      // The name of a delta is derived from its base.
+      new_version = delta = true;
     } else {
       cntx->SendError(UnknownSubCmd(sub_cmd, "SAVE"), kSyntaxErrType);
       return {};
@@ -1830,20 +2299,20 @@ std::optional<ServerFamily::VersionBasename> ServerFamily::GetVersionAndBasename
     basename = ArgS(args, 1);
   }
 
-  return ServerFamily::VersionBasename{new_version, basename};
+  return ServerFamily::SaveCmdOptions{new_version, basename, delta};
 }
 
-// BGSAVE [DF|RDB] [basename]
+// BGSAVE [DF|RDB] [basename] | BGSAVE DELTA
 // TODO add missing [SCHEDULE]
 void ServerFamily::BgSave(CmdArgList args, ConnectionContext* cntx) {
-  auto maybe_res = GetVersionAndBasename(args, cntx);
+  auto maybe_res = GetSaveCmdOptions(args, cntx);
   if (!maybe_res) {
     return;
   }
 
-  const auto [version, basename] = *maybe_res;
+  const auto [version, basename, delta] = *maybe_res;
 
-  if (auto ec = DoSaveCheckAndStart(version, basename, cntx->transaction); ec) {
+  if (auto ec = DoSaveCheckAndStart(version, basename, cntx->transaction, false, delta); ec) {
     cntx->SendError(ec.Format());
     return;
   }
@@ -1853,18 +2322,19 @@ void ServerFamily::BgSave(CmdArgList args, ConnectionContext* cntx) {
   cntx->SendOk();
 }
 
-// SAVE [DF|RDB] [basename]
+// SAVE [DF|RDB] [basename] | SAVE DELTA
 // Allows saving the snapshot of the dataset on disk, potentially overriding the format
-// and the snapshot name.
+// and the snapshot name. SAVE DELTA saves only the changes since the last dfs snapshot,
+// see --snapshot_delta_tracking.
 void ServerFamily::Save(CmdArgList args, ConnectionContext* cntx) {
-  auto maybe_res = GetVersionAndBasename(args, cntx);
+  auto maybe_res = GetSaveCmdOptions(args, cntx);
   if (!maybe_res) {
     return;
   }
 
-  const auto [version, basename] = *maybe_res;
+  const auto [version, basename, delta] = *maybe_res;
 
-  GenericError ec = DoSave(version, basename, cntx->transaction);
+  GenericError ec = DoSave(version, basename, cntx->transaction, false, delta);
   if (ec) {
     cntx->SendError(ec.Format());
   } else {
@@ -1881,6 +2351,12 @@ static void MergeDbSliceStats(const DbSlice::Stats& src, Metrics* dest) {
 
   dest->events += src.events;
   dest->small_string_bytes += src.small_string_bytes;
+  dest->key_prefix_bytes += src.key_prefix_bytes;
+  dest->compression_saved_bytes += src.compression_saved_bytes;
+  dest->shared_value_bytes += src.shared_value_bytes;
+  dest->dedup_saved_bytes += src.dedup_saved_bytes;
+  dest->lazyfree_pending_bytes += src.lazyfree_pending_bytes;
+  dest->lazyfree_pending_objects += src.lazyfree_pending_objects;
 }
 
 void ServerFamily::ResetStat() {
@@ -1899,6 +2375,7 @@ void ServerFamily::ResetStat() {
         tl_facade_stats->conn_stats.command_cnt = 0;
         tl_facade_stats->conn_stats.io_read_cnt = 0;
         tl_facade_stats->conn_stats.io_read_bytes = 0;
+        tl_facade_stats->conn_stats.class_queue_latency.clear();
 
         tl_facade_stats->reply_stats.io_write_bytes = 0;
         tl_facade_stats->reply_stats.io_write_cnt = 0;
@@ -1912,6 +2389,7 @@ void ServerFamily::ResetStat() {
 
 Metrics ServerFamily::GetMetrics() const {
   Metrics result;
+  result.shard_load.resize(shard_set->size());
   util::fb2::Mutex mu;
 
   auto cmd_stat_cb = [&dest = result.cmd_stats_map](string_view name, const CmdCallStats& stat) {
@@ -1920,6 +2398,16 @@ Metrics ServerFamily::GetMetrics() const {
     sum += stat.second;
   };
 
+  auto phase_stat_cb = [&dest = result.cmd_phase_stats_map](string_view name,
+                                                            const TxPhaseStats& stat) {
+    dest[absl::AsciiStrToLower(name)] += stat;
+  };
+
+  auto latency_stat_cb = [&dest = result.cmd_latency_map](string_view name,
+                                                          const CmdLatencyHistogram& stat) {
+    dest[absl::AsciiStrToLower(name)] += stat;
+  };
+
   auto cb = [&](unsigned index, ProactorBase* pb) {
     EngineShard* shard = EngineShard::tlocal();
     ServerState* ss = ServerState::tlocal();
@@ -1939,6 +2427,7 @@ Metrics ServerFamily::GetMetrics() const {
     result.qps += uint64_t(ss->MovingSum6());
     result.facade_stats += *tl_facade_stats;
     result.serialization_bytes += SliceSnapshot::GetThreadLocalMemoryUsage();
+    result.hot_key_cache_bytes += ss->hot_key_cache().bytes();
 
     if (shard) {
       result.heap_used_bytes += shard->UsedMemory();
@@ -1953,8 +2442,27 @@ Metrics ServerFamily::GetMetrics() const {
         result.search_stats += shard->search_indices()->GetStats();
       }
 
+      ShardLoadMetrics& load = result.shard_load[shard->shard_id()];
+      load.utilization = shard->GetMovingSum6(EngineShard::BUSY_USEC) / 6e6;
+      if (uint32_t heartbeats = shard->GetMovingSum6(EngineShard::HEARTBEATS); heartbeats) {
+        uint32_t tx_queue_len_sum = shard->GetMovingSum6(EngineShard::TX_QUEUE_LEN);
+        load.tx_queue_len_avg = double(tx_queue_len_sum) / heartbeats;
+      }
+      load.tx_queue_len = shard->txq()->size();
+      load.task_queue_len = shard->GetFiberQueue()->backlog();
+      load.fiber_switch_delay_usec = fb2::FiberSwitchDelayUsec();
+      for (unsigned i = 0; i < EngineShard::BG_TASK_TOTAL; ++i) {
+        auto task = EngineShard::BackgroundTask(i);
+        load.background_usec_per_sec[i] = shard->GetBackgroundUsec6(task) / 6;
+      }
+      load.stats = shard->load_stats();
+
       result.traverse_ttl_per_sec += shard->GetMovingSum6(EngineShard::TTL_TRAVERSE);
       result.delete_ttl_per_sec += shard->GetMovingSum6(EngineShard::TTL_DELETE);
+      result.expire_lag_ms =
+          max(result.expire_lag_ms, shard->db_slice().ExpireLagMs(GetCurrentTimeMs()));
+      for (DbIndex i = 0; i < shard->db_slice().db_array_size(); ++i)
+        result.expire_backlog += shard->db_slice().ExpireBacklog(i, GetCurrentTimeMs());
       if (result.tx_queue_len < shard->txq()->size())
         result.tx_queue_len = shard->txq()->size();
     }
@@ -1965,6 +2473,8 @@ Metrics ServerFamily::GetMetrics() const {
     result.lua_stats += InterpreterManager::tl_stats();
 
     service_.mutable_registry()->MergeCallStats(index, cmd_stat_cb);
+    service_.mutable_registry()->MergePhaseStats(index, phase_stat_cb);
+    service_.mutable_registry()->MergeLatencyStats(index, latency_stat_cb);
   };
 
   service_.proactor_pool().AwaitFiberOnAll(std::move(cb));
@@ -1974,9 +2484,14 @@ Metrics ServerFamily::GetMetrics() const {
   result.traverse_ttl_per_sec /= 6;
   result.delete_ttl_per_sec /= 6;
 
+  // Replicas can have replicas of their own.
+  result.replication_metrics = dfly_cmd_->GetReplicasRoleInfo();
   bool is_master = ServerState::tlocal() && ServerState::tlocal()->is_master;
-  if (is_master)
-    result.replication_metrics = dfly_cmd_->GetReplicasRoleInfo();
+  if (!is_master) {
+    unique_lock lk{replicaof_mu_};
+    if (replica_)
+      result.replica_apply_lag = replica_->GetInfo().flow_apply_lag;
+  }
 
   // Update peak stats. We rely on the fact that GetMetrics is called frequently enough to
   // update peak_stats_ from it.
@@ -2081,12 +2596,19 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
       }
     }
     append("table_used_memory", total.table_mem_usage);
+    append("expire_wheel_used_memory", total.expire_wheel_mem_usage);
     append("num_buckets", total.bucket_count);
     append("num_entries", total.key_count);
     append("inline_keys", total.inline_keys);
     append("listpack_blobs", total.listpack_blob_cnt);
     append("listpack_bytes", total.listpack_bytes);
     append("small_string_bytes", m.small_string_bytes);
+    append("key_prefix_bytes", m.key_prefix_bytes);
+    append("compression_saved_bytes", m.compression_saved_bytes);
+    append("shared_value_bytes", m.shared_value_bytes);
+    append("dedup_saved_bytes", m.dedup_saved_bytes);
+    append("lazyfree_pending_bytes", m.lazyfree_pending_bytes);
+    append("lazyfree_pending_objects", m.lazyfree_pending_objects);
     append("pipeline_cache_bytes", m.facade_stats.conn_stats.pipeline_cmd_cache_bytes);
     append("dispatch_queue_bytes", m.facade_stats.conn_stats.dispatch_queue_bytes);
     append("dispatch_queue_subscriber_bytes",
@@ -2095,11 +2617,13 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     append("client_read_buffer_peak_bytes", m.peak_stats.conn_read_buf_capacity);
     append("tls_bytes", m.tls_bytes);
     append("snapshot_serialization_bytes", m.serialization_bytes);
+    append("hot_key_cache_bytes", m.hot_key_cache_bytes);
 
     if (GetFlag(FLAGS_cache_mode)) {
       append("cache_mode", "cache");
       // PHP Symphony needs this field to work.
       append("maxmemory_policy", "eviction");
+      append("cache_eviction_policy", GetFlag(FLAGS_cache_eviction_policy));
     } else {
       append("cache_mode", "store");
       // Compatible with redis based frameworks.
@@ -2130,7 +2654,10 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     append("instantaneous_ops_per_sec", m.qps);
     append("total_pipelined_commands", conn_stats.pipelined_cmd_cnt);
     append("total_pipelined_squashed_commands", conn_stats.squashed_commands);
+    append("total_pipelined_squash_batches",
+           accumulate(begin(conn_stats.squash_batches), end(conn_stats.squash_batches), 0ull));
     append("pipelined_latency_usec", conn_stats.pipelined_cmd_latency);
+    append("dispatch_budget_yields", conn_stats.dispatch_budget_yields);
     append("total_net_input_bytes", conn_stats.io_read_bytes);
     append("connection_migrations", conn_stats.num_migrations);
     append("total_net_output_bytes", reply_stats.io_write_bytes);
@@ -2140,18 +2667,28 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     append("instantaneous_output_kbps", -1);
     append("rejected_connections", -1);
     append("expired_keys", m.events.expired_keys);
+    append("expired_hash_fields", m.events.expired_hash_fields);
+    append("expired_set_fields", m.events.expired_set_fields);
     append("evicted_keys", m.events.evicted_keys);
     append("hard_evictions", m.events.hard_evictions);
     append("garbage_checked", m.events.garbage_checked);
     append("garbage_collected", m.events.garbage_collected);
     append("bump_ups", m.events.bumpups);
     append("stash_unloaded", m.events.stash_unloaded);
+    append("segments_merged", m.events.segments_merged);
     append("oom_rejections", m.events.insertion_rejections);
     append("traverse_ttl_sec", m.traverse_ttl_per_sec);
     append("delete_ttl_sec", m.delete_ttl_per_sec);
+    append("expire_lag_ms", m.expire_lag_ms);
+    append("expire_backlog", m.expire_backlog);
     append("keyspace_hits", m.events.hits);
     append("keyspace_misses", m.events.misses);
     append("keyspace_mutations", m.events.mutations);
+    append("key_prefetch_hits", m.events.prefetch_hits);
+    append("hot_key_cache_hits", m.coordinator_stats.hot_key_cache_hits);
+    append("coalesced_gets", m.coordinator_stats.coalesced_gets);
+    append("conn_rebalance_moves", m.coordinator_stats.conn_rebalance_moves);
+    append("conn_rebalance_rejected", m.coordinator_stats.conn_rebalance_rejected);
     append("total_reads_processed", conn_stats.io_read_cnt);
     append("total_writes_processed", reply_stats.io_write_cnt);
     append("defrag_attempt_total", m.shard_stats.defrag_attempt_total);
@@ -2176,12 +2713,35 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     append("tiered_total_cancels", m.tiered_stats.total_cancels);
     append("tiered_total_deletes", m.tiered_stats.total_deletes);
     append("tiered_total_deletes", m.tiered_stats.total_defrags);
+    append("tiered_total_hot_skips", m.tiered_stats.total_hot_skips);
+    append("tiered_total_uncached_reads", m.tiered_stats.total_uncached_reads);
+    append("tiered_total_range_reads", m.tiered_stats.total_range_reads);
+    append("tiered_total_compactions", m.tiered_stats.total_compactions);
+    append("tiered_total_compressed_stashes", m.tiered_stats.total_compressed_stashes);
+    append("tiered_compression_saved_bytes", m.tiered_stats.compression_saved_bytes);
 
     append("tiered_allocated_bytes", m.tiered_stats.allocated_bytes);
     append("tiered_capacity_bytes", m.tiered_stats.capacity_bytes);
 
     append("tiered_pending_read_cnt", m.tiered_stats.pending_read_cnt);
     append("tiered_pending_stash_cnt", m.tiered_stats.pending_stash_cnt);
+    append("tiered_pending_io_cnt", m.tiered_stats.pending_io_cnt);
+
+    append("tiered_small_page_bytes", m.tiered_stats.small_page_bytes);
+    append("tiered_small_page_allocated_bytes", m.tiered_stats.small_page_allocated_bytes);
+    append("tiered_medium_page_bytes", m.tiered_stats.medium_page_bytes);
+    append("tiered_medium_page_allocated_bytes", m.tiered_stats.medium_page_allocated_bytes);
+
+    auto append_hist = [&](string_view name, const tiering::Log2Histogram& hist) {
+      append(StrCat(name, "_cnt"), hist.count);
+      append(StrCat(name, "_avg"), hist.count ? hist.sum / hist.count : 0);
+      append(StrCat(name, "_p50"), hist.Quantile(0.5));
+      append(StrCat(name, "_p99"), hist.Quantile(0.99));
+    };
+    append_hist("tiered_read_usec", m.tiered_stats.read_usec);
+    append_hist("tiered_stash_usec", m.tiered_stats.stash_usec);
+    append_hist("tiered_read_queue_wait_usec", m.tiered_stats.queue_wait_usec);
+    append_hist("tiered_io_depth", m.tiered_stats.pending_io_depth);
 
     append("tiered_small_bins_cnt", m.tiered_stats.small_bins_cnt);
     append("tiered_small_bins_entries_cnt", m.tiered_stats.small_bins_entries_cnt);
@@ -2194,12 +2754,14 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     double perc = 0;
     bool is_saving = false;
     uint32_t curent_durration_sec = 0;
+    RdbSaver::SnapshotStats pacing;
     {
       lock_guard lk{save_mu_};
       if (save_controller_) {
         is_saving = true;
         curent_durration_sec = save_controller_->GetCurrentSaveDuration();
         auto res = save_controller_->GetCurrentSnapshotProgress();
+        pacing = res;
         if (res.total_keys != 0) {
           current_snap_keys = res.current_keys;
           total_snap_keys = res.total_keys;
@@ -2211,6 +2773,9 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     append("current_snapshot_perc", perc);
     append("current_save_keys_processed", current_snap_keys);
     append("current_save_keys_total", total_snap_keys);
+    append("current_save_throttled_ms", pacing.throttled_ms);
+    append("current_save_buckets_per_yield", pacing.buckets_per_yield);
+    append("current_save_compression_level", pacing.compression_level);
 
     auto save_info = GetLastSaveInfo();
     // when last success save
@@ -2232,16 +2797,29 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     append("last_failed_save", save_info.last_error_time);
     append("last_error", save_info.last_error.Format());
     append("last_failed_save_duration_sec", save_info.failed_duration_sec);
+
+    if (aof_) {
+      journal::AofStats aof_stats = aof_->GetStats();
+      append("aof_enabled", aof_->IsOpen());
+      append("aof_written_bytes", aof_stats.written_bytes);
+      append("aof_fsyncs", aof_stats.syncs);
+      append("aof_write_errors", aof_stats.errors);
+    }
   }
 
   if (should_enter("TRANSACTION", true)) {
     append("tx_shard_polls", m.shard_stats.poll_execution_total);
     append("tx_shard_immediate_total", m.shard_stats.tx_immediate_total);
+    append("tx_shard_immediate_conflict_total", m.shard_stats.tx_immediate_conflict_total);
     append("tx_shard_ooo_total", m.shard_stats.tx_ooo_total);
+    append("tx_shard_ring_scheduled_total", m.shard_stats.tx_ring_scheduled_total);
     append("tx_global_total", m.coordinator_stats.tx_global_cnt);
     append("tx_normal_total", m.coordinator_stats.tx_normal_cnt);
     append("tx_inline_runs_total", m.coordinator_stats.tx_inline_runs);
     append("tx_schedule_cancel_total", m.coordinator_stats.tx_schedule_cancel_cnt);
+    append("tx_schedule_batches_total", m.coordinator_stats.tx_schedule_batch_cnt);
+    append("tx_schedule_batched_total", m.coordinator_stats.tx_schedule_batched_cnt);
+    append("tx_cross_node_hops_total", m.coordinator_stats.tx_cross_node_hops);
 
     append("tx_with_freq", absl::StrJoin(m.coordinator_stats.tx_width_freq_arr, ","));
     append("tx_queue_len", m.tx_queue_len);
@@ -2251,23 +2829,47 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
            m.coordinator_stats.eval_shardlocal_coordination_cnt);
     append("eval_squashed_flushes", m.coordinator_stats.eval_squashed_flushes);
     append("multi_squash_execution_total", m.coordinator_stats.multi_squash_executions);
+    append("multi_squash_pipelined_hops", m.coordinator_stats.multi_squash_pipelined_hops);
     append("multi_squash_execution_hop_usec", m.coordinator_stats.multi_squash_exec_hop_usec);
     append("multi_squash_execution_reply_usec", m.coordinator_stats.multi_squash_exec_reply_usec);
+    append("multi_squash_skipped_total", m.coordinator_stats.multi_squash_skipped);
   }
 
   if (should_enter("REPLICATION")) {
     ServerState& etl = *ServerState::tlocal();
 
-    if (etl.is_master) {
-      append("role", "master");
+    auto append_replicas = [&] {
       append("connected_slaves", m.facade_stats.conn_stats.num_replicas);
       const auto& replicas = m.replication_metrics;
       for (size_t i = 0; i < replicas.size(); i++) {
         auto& r = replicas[i];
         // e.g. slave0:ip=172.19.0.3,port=6379,state=full_sync
-        append(StrCat("slave", i), StrCat("ip=", r.address, ",port=", r.listening_port,
-                                          ",state=", r.state, ",lag=", r.lsn_lag));
+        string line = StrCat("ip=", r.address, ",port=", r.listening_port, ",state=", r.state,
+                             ",lag=", r.lsn_lag);
+        if (r.journal_compression != JournalCompression::NONE) {
+          double ratio = r.journal_sent_bytes ? double(r.journal_raw_bytes) / r.journal_sent_bytes
+                                              : 0;
+          absl::StrAppend(&line, ",compression=", JournalCompressionName(r.journal_compression),
+                          ",compression_ratio=", absl::StrFormat("%.2f", ratio),
+                          ",compression_cpu_usec=", r.journal_compress_usec);
+        }
+
+        ReplicaRoleInfo::FlowStats total{};
+        for (const auto& flow : r.flows) {
+          total.bytes_per_sec += flow.bytes_per_sec;
+          total.in_flight_bytes += flow.in_flight_bytes;
+          total.throttle_usec += flow.throttle_usec;
+        }
+        absl::StrAppend(&line, ",journal_bytes_per_sec=", total.bytes_per_sec,
+                        ",inflight_bytes=", total.in_flight_bytes,
+                        ",throttle_ms=", total.throttle_usec / 1000);
+        append(StrCat("slave", i), line);
       }
+    };
+
+    if (etl.is_master) {
+      append("role", "master");
+      append_replicas();
       append("master_replid", master_replid_);
     } else {
       append("role", GetFlag(FLAGS_info_replication_valkey_compatible) ? "slave" : "replica");
@@ -2287,11 +2889,20 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
         append("master_replid", rinfo.master_id);
         append("slave_priority", GetFlag(FLAGS_replica_priority));
         append("slave_read_only", 1);
+
+        for (const auto& lag : rinfo.flow_apply_lag) {
+          uint64_t avg_ms = lag.count ? lag.sum_ms / lag.count : 0;
+          append(StrCat("master_flow", lag.flow_id),
+                 StrCat("apply_lag_ms=", lag.last_ms, ",apply_lag_avg_ms=", avg_ms,
+                        ",apply_lag_samples=", lag.count));
+        }
       };
       replication_info_cb(replica_->GetInfo());
       for (const auto& replica : cluster_replicas_) {
         replication_info_cb(replica->GetInfo());
       }
+      if (!m.replication_metrics.empty())
+        append_replicas();
     }
   }
 
@@ -2319,6 +2930,38 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
                   vector<pair<string_view, uint64_t>>(unknown_cmd.cbegin(), unknown_cmd.cend()));
   }
 
+  if (should_enter("SHARDS", true)) {
+    for (size_t sid = 0; sid < m.shard_load.size(); ++sid) {
+      const auto& load = m.shard_load[sid];
+      append(StrCat("shard_", sid),
+             StrCat("utilization=", load.utilization, ",busy_usec=", load.stats.busy_usec_total,
+                    ",tx_queue_len=", load.tx_queue_len, ",tx_queue_len_avg=",
+                    load.tx_queue_len_avg, ",task_queue_len=", load.task_queue_len,
+                    ",fiber_switch_delay_usec=", load.fiber_switch_delay_usec,
+                    ",heartbeat_overruns=", load.stats.heartbeat_overrun_total));
+
+      string background;
+      for (unsigned i = 0; i < EngineShard::BG_TASK_TOTAL; ++i) {
+        absl::StrAppend(&background, i ? "," : "",
+                        EngineShard::BackgroundTaskName(EngineShard::BackgroundTask(i)), "=",
+                        load.background_usec_per_sec[i]);
+      }
+      append(StrCat("shard_", sid, "_background_usec_per_sec"), background);
+    }
+  }
+
+  if (should_enter("TXPHASESTATS", true)) {
+    for (const auto& [name, stat] : m.cmd_phase_stats_map) {
+      string val = absl::StrCat("calls=", stat.count);
+      for (unsigned phase = 0; phase < TxPhaseStats::kNumPhases; ++phase) {
+        absl::StrAppend(&val, ",", TxPhaseStats::PhaseName(phase), "_usec=", stat.sum_usec[phase],
+                        ",", TxPhaseStats::PhaseName(phase), "_usec_per_call=",
+                        static_cast<double>(stat.sum_usec[phase]) / stat.count);
+      }
+      append(StrCat("txphasestat_", name), val);
+    }
+  }
+
   if (should_enter("MODULES")) {
     append("module",
            "name=ReJSON,ver=20000,api=1,filters=0,usedby=[search],using=[],options=[handle-io-"
@@ -2332,6 +2975,8 @@ void ServerFamily::Info(CmdArgList args, ConnectionContext* cntx) {
     append("search_memory", m.search_stats.used_memory);
     append("search_num_indices", m.search_stats.num_indices);
     append("search_num_entries", m.search_stats.num_entries);
+    append("search_cache_hits", m.search_stats.cache_hits);
+    append("search_cache_misses", m.search_stats.cache_misses);
   }
 
   if (should_enter("ERRORSTATS", true)) {
@@ -2534,15 +3179,34 @@ void ServerFamily::ReplicaOfInternal(CmdArgList args, ConnectionContext* cntx,
     return;
   }
 
+  // The data is replaced by the one of the master, which is not journaled.
+  if (aof_ && aof_->IsOpen()) {
+    LOG(WARNING) << "Replicas do not keep append only files, removing the ones in "
+                 << GetFlag(FLAGS_aof_dir);
+    aof_->Close(true);
+  }
+
+  // The data loaded from a snapshot saved on a replica is kept for a partial sync, it is replaced
+  // by a full sync if the master turns out to be a different one.
+  bool resume_snapshot = !snapshot_master_id_.empty() && !snapshot_master_lsns_.empty() &&
+                         !replicaof_args->slot_range.has_value();
+
   // If we are called by "Replicate", cntx->transaction will be null but we do not need
   // to flush anything.
-  if (cntx->transaction) {
+  if (cntx->transaction && !resume_snapshot) {
     Drakarys(cntx->transaction, DbSlice::kDbAll);
   }
 
   // Create a new replica and assing it
   auto new_replica = make_shared<Replica>(replicaof_args->host, replicaof_args->port, &service_,
                                           master_replid(), replicaof_args->slot_range);
+  if (resume_snapshot) {
+    LOG(INFO) << "Continuing replication of " << snapshot_master_id_ << " from the snapshot";
+    new_replica->SetSnapshotSyncPoint(std::move(snapshot_master_id_),
+                                      std::move(snapshot_master_lsns_));
+  }
+  snapshot_master_id_.clear();
+  snapshot_master_lsns_.clear();
 
   replica_ = new_replica;
 
@@ -2698,6 +3362,12 @@ void ServerFamily::ReplConf(CmdArgList args, ConnectionContext* cntx) {
         return cntx->SendError(kInvalidIntErr);
       }
       dfly_cmd_->SetDflyClientVersion(cntx, DflyVersion(version));
+    } else if (cmd == "JOURNAL-COMPRESSION" && args.size() == 2) {
+      JournalCompression compression;
+      if (!ParseJournalCompression(arg, &compression)) {
+        return cntx->SendError(kSyntaxErr);
+      }
+      dfly_cmd_->SetJournalCompression(cntx, compression);
     } else if (cmd == "ACK" && args.size() == 2) {
       // Don't send error/Ok back through the socket, because we don't want to interleave with
       // the journal writes that we write into the same socket.
@@ -2713,7 +3383,7 @@ void ServerFamily::ReplConf(CmdArgList args, ConnectionContext* cntx) {
         return;
       }
       VLOG(2) << "Received client ACK=" << ack;
-      cntx->replication_flow->last_acked_lsn = ack;
+      dfly_cmd_->OnAck(cntx->replication_flow, ack);
       return;
     } else if (cmd == "ACL-CHECK") {
       // TODO(kostasrim): Remove this branch 20/6/2024
@@ -2774,6 +3444,61 @@ void ServerFamily::Role(CmdArgList args, ConnectionContext* cntx) {
   }
 }
 
+// WAIT <numreplicas> <timeout>
+void ServerFamily::Wait(CmdArgList args, ConnectionContext* cntx) {
+  CmdArgParser parser{args};
+  auto [numreplicas, timeout_ms] = parser.Next<uint32_t, int64_t>();
+  if (auto err = parser.Error(); err)
+    return cntx->SendError(err->MakeReply());
+  if (timeout_ms < 0)
+    return cntx->SendError("timeout is negative");
+
+  if (!ServerState::tlocal()->is_master)
+    return cntx->SendError("WAIT cannot be used with replica instances.");
+
+  vector<LSN> lsns = PingJournalsForAcks();
+  unsigned acked = dfly_cmd_->WaitForAcks(lsns, numreplicas, WaitDeadline(timeout_ms));
+  cntx->SendLong(acked);
+}
+
+// WAITAOF <numlocal> <numreplicas> <timeout>
+// The replicas keep no append only files, so their acks count as they do for WAIT.
+void ServerFamily::WaitAof(CmdArgList args, ConnectionContext* cntx) {
+  CmdArgParser parser{args};
+  auto [numlocal, numreplicas, timeout_ms] = parser.Next<uint32_t, uint32_t, int64_t>();
+  if (auto err = parser.Error(); err)
+    return cntx->SendError(err->MakeReply());
+  if (timeout_ms < 0)
+    return cntx->SendError("timeout is negative");
+
+  if (!ServerState::tlocal()->is_master)
+    return cntx->SendError("WAITAOF cannot be used with replica instances.");
+
+  bool aof_open = aof_ && aof_->IsOpen();
+  if (numlocal > 0 && !aof_open) {
+    return cntx->SendError(
+        "WAITAOF cannot be used when numlocal is set but the append only file is disabled.");
+  }
+
+  vector<LSN> lsns = PingJournalsForAcks();
+  auto deadline = WaitDeadline(timeout_ms);
+
+  // The files are synced in groups, at least once per aof_fsync_interval_ms.
+  unsigned local = aof_open && aof_->IsSynced(lsns);
+  while (local < numlocal && chrono::steady_clock::now() < deadline) {
+    ThisFiber::SleepFor(1ms);
+    local = aof_->IsSynced(lsns);
+  }
+
+  unsigned acked = dfly_cmd_->WaitForAcks(
+      lsns, numreplicas, local < numlocal ? chrono::steady_clock::now() : deadline);
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartArray(2);
+  rb->SendLong(local);
+  rb->SendLong(acked);
+}
+
 void ServerFamily::Script(CmdArgList args, ConnectionContext* cntx) {
   ToUpper(&args.front());
 
@@ -2789,6 +3514,49 @@ void ServerFamily::LastSave(CmdArgList args, ConnectionContext* cntx) {
   cntx->SendLong(save_time);
 }
 
+// Replies in the format of Redis 7: a map from the command names to their number of calls and
+// the cumulative counts of the buckets with calls, keyed by the bucket bound in usec.
+void ServerFamily::LatencyHistogram(CmdArgList args, ConnectionContext* cntx) {
+  absl::flat_hash_set<string> commands;
+  for (string_view name : ArgS(args))
+    commands.insert(absl::AsciiStrToUpper(name));
+
+  map<string, CmdLatencyHistogram> hists;
+  util::fb2::Mutex mu;
+  service_.proactor_pool().AwaitFiberOnAll([&](unsigned index, ProactorBase* pb) {
+    lock_guard lk(mu);
+    service_.mutable_registry()->MergeLatencyStats(
+        index, [&](string_view name, const CmdLatencyHistogram& stat) {
+          if (commands.empty() || commands.contains(name))
+            hists[absl::AsciiStrToLower(name)] += stat;
+        });
+  });
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartCollection(hists.size(), RedisReplyBuilder::MAP);
+  for (const auto& [name, stat] : hists) {
+    uint64_t calls = 0;
+    vector<pair<uint64_t, uint64_t>> cdf;
+    for (unsigned i = 0; i < CmdLatencyHistogram::kNumBuckets; ++i) {
+      if (stat.buckets[i] == 0)
+        continue;
+      calls += stat.buckets[i];
+      cdf.emplace_back(1ULL << i, calls);
+    }
+
+    rb->SendBulkString(name);
+    rb->StartCollection(2, RedisReplyBuilder::MAP);
+    rb->SendBulkString("calls");
+    rb->SendLong(calls);
+    rb->SendBulkString("histogram_usec");
+    rb->StartCollection(cdf.size(), RedisReplyBuilder::MAP);
+    for (const auto& [bound, count] : cdf) {
+      rb->SendLong(bound);
+      rb->SendLong(count);
+    }
+  }
+}
+
 void ServerFamily::Latency(CmdArgList args, ConnectionContext* cntx) {
   auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
   ToUpper(&args[0]);
@@ -2798,6 +3566,11 @@ void ServerFamily::Latency(CmdArgList args, ConnectionContext* cntx) {
     return rb->SendEmptyArray();
   }
 
+  if (sub_cmd == "HISTOGRAM") {
+    args.remove_prefix(1);
+    return LatencyHistogram(args, cntx);
+  }
+
   LOG_FIRST_N(ERROR, 10) << "Subcommand " << sub_cmd << " not supported";
   cntx->SendError(kSyntaxErr);
 }
@@ -2921,6 +3694,8 @@ constexpr uint32_t kReplicaOf = ADMIN | SLOW | DANGEROUS;
 constexpr uint32_t kReplTakeOver = DANGEROUS;
 constexpr uint32_t kReplConf = ADMIN | SLOW | DANGEROUS;
 constexpr uint32_t kRole = ADMIN | FAST | DANGEROUS;
+constexpr uint32_t kWait = SLOW | CONNECTION;
+constexpr uint32_t kWaitAof = SLOW | CONNECTION;
 constexpr uint32_t kSlowLog = ADMIN | SLOW | DANGEROUS;
 constexpr uint32_t kScript = SLOW | SCRIPTING;
 constexpr uint32_t kModule = ADMIN | SLOW | DANGEROUS;
@@ -2957,6 +3732,8 @@ void ServerFamily::Register(CommandRegistry* registry) {
              ReplTakeOver)
       << CI{"REPLCONF", CO::ADMIN | CO::LOADING, -1, 0, 0, acl::kReplConf}.HFUNC(ReplConf)
       << CI{"ROLE", CO::LOADING | CO::FAST | CO::NOSCRIPT, 1, 0, 0, acl::kRole}.HFUNC(Role)
+      << CI{"WAIT", CO::NOSCRIPT, 3, 0, 0, acl::kWait}.HFUNC(Wait)
+      << CI{"WAITAOF", CO::NOSCRIPT, 4, 0, 0, acl::kWaitAof}.HFUNC(WaitAof)
       << CI{"SLOWLOG", CO::ADMIN | CO::FAST, -2, 0, 0, acl::kSlowLog}.HFUNC(SlowLog)
       << CI{"SCRIPT", CO::NOSCRIPT | CO::NO_KEY_TRANSACTIONAL, -2, 0, 0, acl::kScript}.HFUNC(Script)
       << CI{"DFLY", CO::ADMIN | CO::GLOBAL_TRANS | CO::HIDDEN, -2, 0, 0, acl::kDfly}.HFUNC(Dfly)
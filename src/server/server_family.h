@@ -12,6 +12,7 @@
 #include "facade/redis_parser.h"
 #include "facade/reply_builder.h"
 #include "server/channel_store.h"
+#include "server/command_registry.h"
 #include "server/detail/save_stages_controller.h"
 #include "server/dflycmd.h"
 #include "server/engine_shard_set.h"
@@ -43,6 +44,7 @@ std::string GetPassword();
 
 namespace journal {
 class Journal;
+class AppendOnlyFile;
 }  // namespace journal
 namespace cluster {
 class ClusterFamily;
@@ -59,6 +61,22 @@ struct ReplicaRoleInfo {
   uint32_t listening_port;
   std::string_view state;
   uint64_t lsn_lag;
+
+  // Stable sync journal compression, summed over the flows.
+  JournalCompression journal_compression = JournalCompression::NONE;
+  uint64_t journal_raw_bytes = 0;
+  uint64_t journal_sent_bytes = 0;
+  uint64_t journal_compress_usec = 0;
+
+  // Stable sync stream of every flow.
+  struct FlowStats {
+    uint32_t flow_id;
+    uint64_t written_bytes;
+    uint64_t bytes_per_sec;
+    uint64_t in_flight_bytes;
+    uint64_t throttle_usec;
+  };
+  std::vector<FlowStats> flows;
 };
 
 struct ReplicationMemoryStats {
@@ -73,6 +91,19 @@ struct PeakStats {
   size_t conn_read_buf_capacity = 0;     // peak of total read buf capcacities
 };
 
+// Load of a single shard thread.
+struct ShardLoadMetrics {
+  double utilization = 0;                // fraction of the last 6 seconds spent in PollExecution
+  double tx_queue_len_avg = 0;           // tx queue length over the heartbeats of the last 6 secs
+  uint32_t tx_queue_len = 0;             // current tx queue length
+  uint32_t task_queue_len = 0;           // callbacks waiting in the shard queue
+  uint64_t fiber_switch_delay_usec = 0;  // time fibers spent runnable but not running
+
+  // average time per second spent in every background task over the last 6 seconds
+  uint32_t background_usec_per_sec[EngineShard::BG_TASK_TOTAL] = {};
+  EngineShard::LoadStats stats;
+};
+
 // Aggregated metrics over multiple sources on all shards
 struct Metrics {
   SliceEvents events;              // general keyspace stats
@@ -91,13 +122,22 @@ struct Metrics {
 
   size_t heap_used_bytes = 0;
   size_t small_string_bytes = 0;
+  size_t key_prefix_bytes = 0;
+  size_t compression_saved_bytes = 0;
+  size_t shared_value_bytes = 0;
+  size_t dedup_saved_bytes = 0;
+  size_t lazyfree_pending_bytes = 0;
+  size_t lazyfree_pending_objects = 0;
   uint32_t traverse_ttl_per_sec = 0;
   uint32_t delete_ttl_per_sec = 0;
+  uint64_t expire_lag_ms = 0;  // max over shards, see DbSlice::ExpireLagMs.
+  size_t expire_backlog = 0;   // sum over shards, see DbSlice::ExpireBacklog.
   uint64_t fiber_switch_cnt = 0;
   uint64_t fiber_switch_delay_usec = 0;
   uint64_t tls_bytes = 0;
   uint64_t refused_conn_max_clients_reached_count = 0;
   uint64_t serialization_bytes = 0;
+  uint64_t hot_key_cache_bytes = 0;
 
   // Statistics about fibers running for a long time (more than 1ms).
   uint64_t fiber_longrun_cnt = 0;
@@ -112,7 +152,11 @@ struct Metrics {
 
   // command call frequencies (count, aggregated latency in usec).
   std::map<std::string, std::pair<uint64_t, uint64_t>> cmd_stats_map;
+  std::map<std::string, TxPhaseStats> cmd_phase_stats_map;  // transactional commands only
+  std::map<std::string, CmdLatencyHistogram> cmd_latency_map;
+  std::vector<ShardLoadMetrics> shard_load;  // indexed by shard id
   std::vector<ReplicaRoleInfo> replication_metrics;
+  std::vector<ApplyLagStats> replica_apply_lag;  // of the flows from the master, on replicas
 };
 
 struct LastSaveInfo {
@@ -174,8 +218,9 @@ class ServerFamily {
 
   // if new_version is true, saves DF specific, non redis compatible snapshot.
   // if basename is not empty it will override dbfilename flag.
+  // if delta is true, saves only the changes since the last dfs snapshot next to it.
   GenericError DoSave(bool new_version, std::string_view basename, Transaction* transaction,
-                      bool ignore_state = false);
+                      bool ignore_state = false, bool delta = false);
 
   // Calls DoSave with a default generated transaction and with the format
   // specified in --df_snapshot_format
@@ -188,8 +233,10 @@ class ServerFamily {
   LastSaveInfo GetLastSaveInfo() const;
 
   // Load snapshot from file (.rdb file or summary.dfs file) and return
-  // future with error_code.
-  std::optional<util::fb2::Future<GenericError>> Load(const std::string& file_name);
+  // future with error_code. post_load runs once the data is loaded, before the server turns
+  // active.
+  std::optional<util::fb2::Future<GenericError>> Load(const std::string& file_name,
+                                                      std::function<void()> post_load = {});
 
   bool TEST_IsSaving() const;
 
@@ -236,6 +283,10 @@ class ServerFamily {
   void JoinSnapshotSchedule();
   void LoadFromSnapshot();
 
+  // Replays the append only files starting at the given generation, if set, and starts
+  // appending to new ones.
+  void RecoverAndOpenAof(std::optional<uint64_t> generation, std::string_view snapshot);
+
   uint32_t shard_count() const {
     return shard_set->size();
   }
@@ -253,11 +304,14 @@ class ServerFamily {
   void Hello(CmdArgList args, ConnectionContext* cntx);
   void LastSave(CmdArgList args, ConnectionContext* cntx);
   void Latency(CmdArgList args, ConnectionContext* cntx);
+  void LatencyHistogram(CmdArgList args, ConnectionContext* cntx);
   void ReplicaOf(CmdArgList args, ConnectionContext* cntx);
   void AddReplicaOf(CmdArgList args, ConnectionContext* cntx);
   void ReplTakeOver(CmdArgList args, ConnectionContext* cntx);
   void ReplConf(CmdArgList args, ConnectionContext* cntx);
   void Role(CmdArgList args, ConnectionContext* cntx);
+  void Wait(CmdArgList args, ConnectionContext* cntx);
+  void WaitAof(CmdArgList args, ConnectionContext* cntx);
   void Save(CmdArgList args, ConnectionContext* cntx);
   void BgSave(CmdArgList args, ConnectionContext* cntx);
   void Script(CmdArgList args, ConnectionContext* cntx);
@@ -282,15 +336,20 @@ class ServerFamily {
 
   void SendInvalidationMessages() const;
 
-  // Helper function to retrieve version(true if format is dfs rdb), and basename from args.
+  // Helper function to retrieve version(true if format is dfs rdb), basename and whether
+  // a delta snapshot is requested from args.
   // In case of an error an empty optional is returned.
-  using VersionBasename = std::pair<bool, std::string_view>;
-  std::optional<VersionBasename> GetVersionAndBasename(CmdArgList args, ConnectionContext* cntx);
+  struct SaveCmdOptions {
+    bool new_version;
+    std::string_view basename;
+    bool delta;
+  };
+  std::optional<SaveCmdOptions> GetSaveCmdOptions(CmdArgList args, ConnectionContext* cntx);
 
   void BgSaveFb(boost::intrusive_ptr<Transaction> trans);
 
   GenericError DoSaveCheckAndStart(bool new_version, string_view basename, Transaction* trans,
-                                   bool ignore_state = false);
+                                   bool ignore_state = false, bool delta = false);
 
   GenericError WaitUntilSaveFinished(Transaction* trans, bool ignore_state = false);
   void StopAllClusterReplicas();
@@ -309,9 +368,13 @@ class ServerFamily {
   std::shared_ptr<Replica> replica_ ABSL_GUARDED_BY(replicaof_mu_);
   std::vector<std::unique_ptr<Replica>> cluster_replicas_
       ABSL_GUARDED_BY(replicaof_mu_);  // used to replicating multiple nodes to single dragonfly
+  // Replication offsets of the last snapshot loaded, if it was saved on a replica.
+  std::string snapshot_master_id_ ABSL_GUARDED_BY(replicaof_mu_);
+  std::vector<LSN> snapshot_master_lsns_ ABSL_GUARDED_BY(replicaof_mu_);
 
   std::unique_ptr<ScriptMgr> script_mgr_;
   std::unique_ptr<journal::Journal> journal_;
+  std::unique_ptr<journal::AppendOnlyFile> aof_;  // Set if --aof_dir is.
   std::unique_ptr<DflyCmd> dfly_cmd_;
 
   std::string master_replid_;
@@ -321,6 +384,13 @@ class ServerFamily {
   LastSaveInfo last_save_info_ ABSL_GUARDED_BY(save_mu_);
   std::unique_ptr<detail::SaveStagesController> save_controller_ ABSL_GUARDED_BY(save_mu_);
 
+  // Path of the last dfs snapshot without "-summary.dfs" and the number of deltas saved for it.
+  std::string delta_base_path_ ABSL_GUARDED_BY(save_mu_);
+  unsigned delta_count_ ABSL_GUARDED_BY(save_mu_) = 0;
+
+  // The generation of append only files started by the running save.
+  uint64_t aof_save_generation_ ABSL_GUARDED_BY(save_mu_) = 0;
+
   // Used to override save on shutdown behavior that is usually set
   // be --dbfilename.
   bool save_on_shutdown_{true};
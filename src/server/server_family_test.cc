@@ -7,11 +7,15 @@
 #include <absl/strings/match.h>
 
 #include "absl/strings/str_cat.h"
+#include "base/flags.h"
 #include "base/gtest.h"
 #include "base/logging.h"
 #include "facade/facade_test.h"
 #include "server/test_utils.h"
 
+ABSL_DECLARE_FLAG(bool, slowlog_tx_phases);
+ABSL_DECLARE_FLAG(uint32_t, heartbeat_budget_usec);
+
 using namespace testing;
 using namespace std;
 using namespace util;
@@ -85,6 +89,28 @@ TEST_F(ServerFamilyTest, SlowLogArgsLengthTruncation) {
   EXPECT_THAT(key_value, expected_value);
 }
 
+TEST_F(ServerFamilyTest, SlowLogTxPhases) {
+  absl::SetFlag(&FLAGS_slowlog_tx_phases, true);
+  Run({"config", "set", "slowlog_log_slower_than", "0"});
+
+  Run({"set", "foo", "bar"});
+  auto resp = Run({"slowlog", "get", "1"});
+  auto args = resp.GetVec()[0].GetVec()[3].GetVec();
+  ASSERT_EQ(args.size(), 4u);
+  EXPECT_EQ(args[2], "bar");
+  EXPECT_THAT(args[3].GetString(), StartsWith("TXPHASES/schedule="));
+
+  // Non transactional commands do not have phases.
+  Run({"ping"});
+  resp = Run({"slowlog", "get", "1"});
+  EXPECT_THAT(resp.GetVec()[0].GetVec()[3].GetVec(), ElementsAre("PING"));
+  absl::SetFlag(&FLAGS_slowlog_tx_phases, false);
+
+  resp = Run({"info", "txphasestats"});
+  EXPECT_THAT(resp.GetString(), HasSubstr("txphasestat_set:calls=1,schedule_usec="));
+  EXPECT_THAT(resp.GetString(), Not(HasSubstr("txphasestat_ping")));
+}
+
 TEST_F(ServerFamilyTest, SlowLogHelp) {
   auto resp = Run({"slowlog", "help"});
 
@@ -493,6 +519,39 @@ TEST_F(ServerFamilyTest, ClientTrackingSelectDB) {
   EXPECT_EQ(GetInvalidationMessage("IO0", 0).key, "C");
 }
 
+TEST_F(ServerFamilyTest, ClientTrackingBcast) {
+  Run({"HELLO", "3"});
+  EXPECT_THAT(Run({"CLIENT", "TRACKING", "ON", "PREFIX", "a:"}),
+              ErrArg("PREFIX option requires BCAST mode to be enabled"));
+  EXPECT_THAT(Run({"CLIENT", "TRACKING", "ON", "BCAST", "OPTIN"}),
+              ErrArg("OPTIN and OPTOUT are not compatible with BCAST"));
+  EXPECT_THAT(Run({"CLIENT", "TRACKING", "ON", "BCAST", "PREFIX"}), ErrArg("syntax error"));
+
+  EXPECT_EQ(Run({"CLIENT", "TRACKING", "ON", "BCAST", "PREFIX", "a:", "PREFIX", "b:"}), "OK");
+
+  // Keys do not need to be read to be tracked.
+  pp_->at(1)->Await([&] { return Run({"SET", "ab", "1"}); });
+  pp_->at(1)->Await([&] { return Run({"MSET", "a:1", "1", "b:1", "2", "c:1", "3"}); });
+  pp_->at(1)->Await([&] { return Run({"DEL", "b:1"}); });
+
+  set<string> keys;
+  ExpectConditionWithinTimeout([&] {
+    for (size_t i = 0; i < InvalidationMessagesLen("IO0"); ++i) {
+      const auto& msg = GetInvalidationMessage("IO0", i);
+      keys.insert(msg.keys.begin(), msg.keys.end());
+    }
+    return keys.size() >= 2;
+  });
+  pp_->AwaitFiberOnAll([](ProactorBase* pb) {});
+  EXPECT_THAT(keys, ElementsAre("a:1", "b:1"));
+
+  Run({"CLIENT", "TRACKING", "OFF"});
+  size_t len = InvalidationMessagesLen("IO0");
+  pp_->at(1)->Await([&] { return Run({"SET", "a:2", "1"}); });
+  pp_->AwaitFiberOnAll([](ProactorBase* pb) {});
+  EXPECT_EQ(InvalidationMessagesLen("IO0"), len);
+}
+
 TEST_F(ServerFamilyTest, ClientTrackingNonTransactionalBug) {
   Run({"HELLO", "3"});
   Run({"CLIENT", "TRACKING", "ON"});
@@ -516,4 +575,83 @@ TEST_F(ServerFamilyTest, ClientTrackingLuaBug) {
   EXPECT_EQ(InvalidationMessagesLen("IO0"), 3);
 }
 
+TEST_F(ServerFamilyTest, SyncBandwidthLimit) {
+  EXPECT_EQ(Run({"config", "set", "sync_bandwidth_limit", "1mb"}), "OK");
+
+  // A burst of 100ms worth of bytes passes, the bytes beyond it are paced.
+  EXPECT_EQ(SyncBandwidthLimiter::Consume(50 << 10).count(), 0);
+  auto pause = SyncBandwidthLimiter::Consume(100 << 10);
+  EXPECT_GT(pause, 20ms);
+  EXPECT_LT(pause, 100ms);
+
+  EXPECT_EQ(Run({"config", "set", "sync_bandwidth_limit", "0"}), "OK");
+  EXPECT_EQ(SyncBandwidthLimiter::Consume(100 << 20).count(), 0);
+}
+
+TEST_F(ServerFamilyTest, LatencyHistogram) {
+  for (unsigned i = 0; i < 10; ++i)
+    Run({"set", "foo", "bar"});
+  Run({"get", "foo"});
+
+  auto resp = Run({"latency", "histogram", "set", "GET"});
+  ASSERT_THAT(resp, ArrLen(4));
+  auto vec = resp.GetVec();
+  EXPECT_EQ(vec[0], "get");
+  EXPECT_EQ(vec[2], "set");
+
+  ASSERT_THAT(vec[3], ArrLen(4));
+  auto set_stats = vec[3].GetVec();
+  EXPECT_THAT(set_stats[0], "calls");
+  EXPECT_THAT(set_stats[1], IntArg(10));
+  EXPECT_THAT(set_stats[2], "histogram_usec");
+
+  // Cumulative counts of the buckets with calls, the last one counts all calls.
+  auto cdf = set_stats[3].GetVec();
+  ASSERT_FALSE(cdf.empty());
+  EXPECT_THAT(cdf.back(), IntArg(10));
+
+  resp = Run({"latency", "histogram", "nosuchcmd"});
+  EXPECT_THAT(resp, ArrLen(0));
+}
+
+TEST_F(ServerFamilyTest, InfoShards) {
+  for (unsigned i = 0; i < 10; ++i)
+    Run({"set", absl::StrCat("key", i), "bar"});
+
+  auto resp = Run({"info", "shards"});
+  for (unsigned sid = 0; sid < shard_set->size(); ++sid)
+    EXPECT_THAT(resp.GetString(), HasSubstr(absl::StrCat("shard_", sid, ":utilization=")));
+  EXPECT_THAT(resp.GetString(), HasSubstr(",task_queue_len="));
+  EXPECT_THAT(resp.GetString(), HasSubstr(",heartbeat_overruns="));
+  EXPECT_THAT(resp.GetString(), HasSubstr("shard_0_background_usec_per_sec:expiry="));
+}
+
+TEST_F(ServerFamilyTest, SlicedHeartbeat) {
+  absl::FlagSaver fs;
+  absl::SetFlag(&FLAGS_heartbeat_budget_usec, 200);
+
+  for (unsigned i = 0; i < 1000; ++i)
+    Run({"set", absl::StrCat("key", i), "bar", "px", "1"});
+
+  // The heartbeat deletes the expired keys in slices, without accessing them.
+  for (unsigned i = 0; i < 100 && CheckedInt({"dbsize"}) > 0; ++i)
+    ThisFiber::SleepFor(10ms);
+  EXPECT_EQ(0, CheckedInt({"dbsize"}));
+
+  auto metrics = GetMetrics();
+  EXPECT_GT(metrics.shard_load[0].stats.background_usec[EngineShard::BG_EXPIRY], 0u);
+}
+
+TEST_F(ServerFamilyTest, Wait) {
+  Run({"set", "foo", "bar"});
+  EXPECT_THAT(Run({"wait", "0", "0"}), IntArg(0));
+
+  // There are no replicas to ack, so it times out.
+  EXPECT_THAT(Run({"wait", "1", "10"}), IntArg(0));
+  EXPECT_THAT(Run({"wait", "1", "-1"}), ErrArg("timeout is negative"));
+
+  EXPECT_THAT(Run({"waitaof", "1", "0", "10"}), ErrArg("append only file is disabled"));
+  EXPECT_THAT(Run({"waitaof", "0", "1", "10"}), RespArray(ElementsAre(IntArg(0), IntArg(0))));
+}
+
 }  // namespace dfly
@@ -15,6 +15,7 @@ extern "C" {
 #include "base/flags.h"
 #include "base/logging.h"
 #include "facade/conn_context.h"
+#include "facade/dragonfly_connection.h"
 #include "server/journal/journal.h"
 
 ABSL_FLAG(uint32_t, interpreter_per_thread, 10, "Lua interpreters per thread");
@@ -27,7 +28,7 @@ ServerState::Stats::Stats(unsigned num_shards) : tx_width_freq_arr(num_shards) {
 }
 
 ServerState::Stats& ServerState::Stats::Add(const ServerState::Stats& other) {
-  static_assert(sizeof(Stats) == 16 * 8, "Stats size mismatch");
+  static_assert(sizeof(Stats) == 25 * 8, "Stats size mismatch");
 
   this->eval_io_coordination_cnt += other.eval_io_coordination_cnt;
   this->eval_shardlocal_coordination_cnt += other.eval_shardlocal_coordination_cnt;
@@ -37,15 +38,24 @@ ServerState::Stats& ServerState::Stats::Add(const ServerState::Stats& other) {
   this->tx_normal_cnt += other.tx_normal_cnt;
   this->tx_inline_runs += other.tx_inline_runs;
   this->tx_schedule_cancel_cnt += other.tx_schedule_cancel_cnt;
+  this->tx_schedule_batch_cnt += other.tx_schedule_batch_cnt;
+  this->tx_schedule_batched_cnt += other.tx_schedule_batched_cnt;
+  this->tx_cross_node_hops += other.tx_cross_node_hops;
 
   this->multi_squash_executions += other.multi_squash_executions;
+  this->multi_squash_pipelined_hops += other.multi_squash_pipelined_hops;
   this->multi_squash_exec_hop_usec += other.multi_squash_exec_hop_usec;
   this->multi_squash_exec_reply_usec += other.multi_squash_exec_reply_usec;
+  this->multi_squash_skipped += other.multi_squash_skipped;
 
   this->blocked_on_interpreter += other.blocked_on_interpreter;
   this->rdb_save_usec += other.rdb_save_usec;
   this->rdb_save_count += other.rdb_save_count;
   this->oom_error_cmd_cnt += other.oom_error_cmd_cnt;
+  this->hot_key_cache_hits += other.hot_key_cache_hits;
+  this->coalesced_gets += other.coalesced_gets;
+  this->conn_rebalance_moves += other.conn_rebalance_moves;
+  this->conn_rebalance_rejected += other.conn_rebalance_rejected;
 
   if (this->tx_width_freq_arr.size() > 0) {
     DCHECK_EQ(this->tx_width_freq_arr.size(), other.tx_width_freq_arr.size());
@@ -84,6 +94,102 @@ void MonitorsRepo::NotifyChangeCount(bool added) {
   }
 }
 
+struct BcastTrackingRepo::Node {
+  absl::flat_hash_map<char, std::unique_ptr<Node>> children;
+  std::vector<facade::Connection*> conns;  // connections tracking the prefix of this node
+};
+
+BcastTrackingRepo::BcastTrackingRepo() : root_(new Node) {
+}
+
+BcastTrackingRepo::~BcastTrackingRepo() = default;
+
+void BcastTrackingRepo::Add(facade::Connection* conn, const std::vector<std::string>& prefixes) {
+  auto add = [&](std::string_view prefix) {
+    Node* node = root_.get();
+    for (char c : prefix) {
+      auto& child = node->children[c];
+      if (!child)
+        child.reset(new Node);
+      node = child.get();
+    }
+    node->conns.push_back(conn);
+  };
+
+  if (prefixes.empty())
+    add("");
+  for (const auto& prefix : prefixes)
+    add(prefix);
+}
+
+void BcastTrackingRepo::Remove(facade::Connection* conn, const std::vector<std::string>& prefixes) {
+  auto remove = [&](std::string_view prefix) {
+    std::vector<Node*> path{root_.get()};
+    for (char c : prefix) {
+      auto it = path.back()->children.find(c);
+      if (it == path.back()->children.end())
+        return;
+      path.push_back(it->second.get());
+    }
+
+    auto& conns = path.back()->conns;
+    if (auto it = std::find(conns.begin(), conns.end(), conn); it != conns.end())
+      conns.erase(it);
+
+    // Prune the nodes that no longer lead to any connection.
+    for (size_t i = path.size() - 1; i > 0; --i) {
+      if (!path[i]->conns.empty() || !path[i]->children.empty())
+        break;
+      path[i - 1]->children.erase(prefix[i - 1]);
+    }
+  };
+
+  if (prefixes.empty())
+    remove("");
+  for (const auto& prefix : prefixes)
+    remove(prefix);
+
+  pending_.erase(conn);
+}
+
+void BcastTrackingRepo::NotifyChangeCount(bool added) {
+  if (added) {
+    ++global_count_;
+  } else {
+    DCHECK(global_count_ > 0);
+    --global_count_;
+  }
+}
+
+void BcastTrackingRepo::Invalidate(const std::vector<std::string>& keys) {
+  bool was_empty = pending_.empty();
+  for (const auto& key : keys) {
+    const Node* node = root_.get();
+    for (size_t i = 0; node; ++i) {
+      for (auto* conn : node->conns)
+        pending_[conn].insert(key);
+      if (i == key.size())
+        break;
+      auto it = node->children.find(key[i]);
+      node = it == node->children.end() ? nullptr : it->second.get();
+    }
+  }
+
+  // Give the other shards a chance to deliver their keys within the same loop iteration.
+  if (was_empty && !pending_.empty())
+    util::fb2::Fiber(util::fb2::Launch::post, "bcast_invalidate", [this] { Flush(); }).Detach();
+}
+
+void BcastTrackingRepo::Flush() {
+  auto pending = std::move(pending_);
+  pending_.clear();
+  for (auto& [conn, keys] : pending) {
+    facade::Connection::InvalidationMessage msg;
+    msg.keys.assign(keys.begin(), keys.end());
+    conn->SendInvalidationMessageAsync(std::move(msg));
+  }
+}
+
 ServerState::ServerState() : interpreter_mgr_{absl::GetFlag(FLAGS_interpreter_per_thread)} {
   CHECK(mi_heap_get_backing() == mi_heap_get_default());
 
@@ -95,6 +201,14 @@ ServerState::ServerState() : interpreter_mgr_{absl::GetFlag(FLAGS_interpreter_pe
 ServerState::~ServerState() {
 }
 
+void ServerState::SetDataHeap(mi_heap_t* heap) {
+  replace_zmalloc_threadlocal(data_heap_, heap);
+
+  // Blocks that were allocated from the old heap are still valid, they move to the backing heap.
+  mi_heap_delete(data_heap_);
+  data_heap_ = heap;
+}
+
 void ServerState::Init(uint32_t thread_index, uint32_t num_shards, acl::UserRegistry* registry) {
   state_ = new ServerState();
   state_->gstate_ = GlobalState::ACTIVE;
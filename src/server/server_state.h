@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <absl/container/flat_hash_set.h>
+
+#include <memory>
 #include <optional>
 #include <valarray>
 #include <vector>
@@ -13,6 +16,7 @@
 #include "server/acl/acl_log.h"
 #include "server/acl/user_registry.h"
 #include "server/common.h"
+#include "server/hot_key_cache.h"
 #include "server/script_mgr.h"
 #include "server/slowlog.h"
 #include "util/sliding_counter.h"
@@ -81,6 +85,42 @@ class MonitorsRepo {
   unsigned int global_count_ = 0;  // by global its means that we count the monitor for all threads
 };
 
+// Thread local registry of the connections that use CLIENT TRACKING in BCAST mode.
+// Like MonitorsRepo, every thread holds only its own connections and a copy of the global
+// count, so that shards can skip collecting modified keys when nobody is listening.
+// The prefixes of all the connections are kept in a trie, modified keys are matched against
+// it and coalesced per connection until the end of the current event loop iteration, when
+// every connection receives a single invalidation push with all of its keys.
+class BcastTrackingRepo {
+ public:
+  BcastTrackingRepo();
+  ~BcastTrackingRepo();
+
+  // Registers a connection of this thread for the given prefixes, all keys if empty.
+  void Add(facade::Connection* conn, const std::vector<std::string>& prefixes);
+  void Remove(facade::Connection* conn, const std::vector<std::string>& prefixes);
+
+  bool Empty() const {
+    return global_count_ == 0u;
+  }
+
+  // Must be called on all threads when a connection is added or removed.
+  void NotifyChangeCount(bool added);
+
+  // Queues invalidations of the modified keys for the connections of this thread that track
+  // them and schedules a flush if needed.
+  void Invalidate(const std::vector<std::string>& keys);
+
+ private:
+  struct Node;
+
+  void Flush();
+
+  std::unique_ptr<Node> root_;
+  absl::flat_hash_map<facade::Connection*, absl::flat_hash_set<std::string>> pending_;
+  unsigned global_count_ = 0;
+};
+
 enum class ClientPause { WRITE, ALL };
 
 // Present in every server thread. This class differs from EngineShard. The latter manages
@@ -109,13 +149,22 @@ class ServerState {  // public struct - to allow initialization.
     uint64_t tx_inline_runs = 0;
     uint64_t tx_schedule_cancel_cnt = 0;
 
+    // Batched schedule hops and the transactions they carried, see tx_batch_schedule flag.
+    uint64_t tx_schedule_batch_cnt = 0;
+    uint64_t tx_schedule_batched_cnt = 0;
+
+    // Hops sent to shards on another NUMA node than the coordinator.
+    uint64_t tx_cross_node_hops = 0;
+
     uint64_t eval_io_coordination_cnt = 0;
     uint64_t eval_shardlocal_coordination_cnt = 0;
     uint64_t eval_squashed_flushes = 0;
 
     uint64_t multi_squash_executions = 0;
+    uint64_t multi_squash_pipelined_hops = 0;  // hops overlapped with reply serialization
     uint64_t multi_squash_exec_hop_usec = 0;
     uint64_t multi_squash_exec_reply_usec = 0;
+    uint64_t multi_squash_skipped = 0;  // EXECs run without squashing, see ExecProfile
 
     uint64_t blocked_on_interpreter = 0;
 
@@ -125,6 +174,14 @@ class ServerState {  // public struct - to allow initialization.
     // Number of times we rejected command dispatch due to OOM condition.
     uint64_t oom_error_cmd_cnt = 0;
 
+    uint64_t hot_key_cache_hits = 0;  // reads served by the thread's HotKeyCache
+    uint64_t coalesced_gets = 0;      // GETs answered by an identical GET in flight
+
+    // Connection moves requested by RebalanceConnection, and the ones declined because the
+    // connection couldn't move or the destination thread had too many connections.
+    uint64_t conn_rebalance_moves = 0;
+    uint64_t conn_rebalance_rejected = 0;
+
     std::valarray<uint64_t> tx_width_freq_arr;
   };
 
@@ -203,6 +260,10 @@ class ServerState {  // public struct - to allow initialization.
     return data_heap_;
   }
 
+  // Replaces the data heap, for example with one that allocates from a dedicated arena. Must be
+  // called before the shard of this thread is initialized, as the shard keeps using the heap.
+  void SetDataHeap(mi_heap_t* heap);
+
   journal::Journal* journal() {
     return journal_;
   }
@@ -215,6 +276,14 @@ class ServerState {  // public struct - to allow initialization.
     return monitors_;
   }
 
+  BcastTrackingRepo& BcastTracking() {
+    return bcast_tracking_;
+  }
+
+  HotKeyCache& hot_key_cache() {
+    return hot_key_cache_;
+  }
+
   const absl::flat_hash_map<std::string, base::Histogram>& call_latency_histos() const {
     return call_latency_histos_;
   }
@@ -280,6 +349,16 @@ class ServerState {  // public struct - to allow initialization.
   // Exec descriptor frequency count for this thread.
   absl::flat_hash_map<std::string, unsigned> exec_freq_count;
 
+  // How the EXECs of a body shape, i.e. its commands and their number of arguments, ran on this
+  // thread. Shapes whose commands are never squashed skip the squasher.
+  struct ExecProfile {
+    uint32_t execs = 0;
+    uint32_t single_shard = 0;   // execs that touched at most one shard
+    uint32_t squashed = 0;       // execs that ran through the squasher
+    uint64_t squashed_cmds = 0;  // commands the squasher executed in squashed hops
+  };
+  absl::flat_hash_map<std::string, ExecProfile> exec_profiles;
+
  private:
   int64_t live_transactions_ = 0;
   SlowLogShard slow_log_shard_;
@@ -304,6 +383,8 @@ class ServerState {  // public struct - to allow initialization.
   Counter qps_;
 
   MonitorsRepo monitors_;
+  BcastTrackingRepo bcast_tracking_;
+  HotKeyCache hot_key_cache_;
 
   absl::flat_hash_map<std::string, base::Histogram> call_latency_histos_;
   uint32_t thread_index_ = 0;
@@ -13,6 +13,8 @@ extern "C" {
 #include "base/flags.h"
 #include "base/logging.h"
 #include "base/stl_util.h"
+#include "core/small_set.h"
+#include "core/sorted_intersect.h"
 #include "core/string_set.h"
 #include "facade/cmd_arg_parser.h"
 #include "server/acl/acl_commands_def.h"
@@ -49,10 +51,75 @@ auto EntriesRange(const NewEntries& entries) {
 
 constexpr uint32_t kMaxIntSetEntries = 256;
 
+// Number of members probed at once by the intersections.
+constexpr size_t kInterBatchSize = 32;
+
 bool IsDenseEncoding(const CompactObj& co) {
   return co.Encoding() == kEncodingStrMap2;
 }
 
+StringSet* SmallToStrSet(const SmallSet* ss) {
+  StringSet* res = CompactObj::AllocateMR<StringSet>();
+  res->Reserve(ss->Size());
+  ss->Iterate([res](string_view member) {
+    CHECK(res->Add(member));
+    return true;
+  });
+  return res;
+}
+
+// Converts the intset of co, that can not hold vals, to a string set. SmallSet is chosen if the
+// members fit it even if all of vals are new. Returns false on OOM.
+bool ConvertIntSet(const NewEntries& vals, CompactObj* co) {
+  intset* is = (intset*)co->RObjPtr();
+  size_t len = intsetLen(is), num = 0, max_len = 0;
+  for (string_view val : EntriesRange(vals)) {
+    ++num;
+    max_len = max(max_len, val.size());
+  }
+
+  if (SetFamily::FitsSmallSet(len + num, max_len)) {
+    SmallSet* ss = SmallSet::Create(len + num);
+    int64_t intele;
+    char buf[32];
+    for (uint32_t ii = 0; intsetGet(is, ii, &intele); ++ii) {
+      char* next = absl::numbers_internal::FastIntToBuffer(intele, buf);
+      bool added = false;
+      ss = SmallSet::Add(ss, string_view{buf, size_t(next - buf)}, &added);
+    }
+    co->InitRobj(OBJ_SET, kEncodingSmallSet, ss);  // frees 'is' on a way.
+    return true;
+  }
+
+  StringSet* ss = SetFamily::ConvertToStrSet(is, len);
+  if (!ss)
+    return false;
+  co->InitRobj(OBJ_SET, kEncodingStrMap2, ss);
+  return true;
+}
+
+// Adds vals to the SmallSet of co. Converts it to a string set once a new member does not fit,
+// leaving the rest of vals to be added to the string set.
+unsigned AddSmallSet(const NewEntries& vals, CompactObj* co) {
+  SmallSet* ss = (SmallSet*)co->RObjPtr();
+  unsigned res = 0;
+
+  for (string_view member : EntriesRange(vals)) {
+    if (!SetFamily::FitsSmallSet(ss->Size() + 1, member.size()) && !ss->Contains(member)) {
+      co->SetRObjPtr(ss);
+      co->InitRobj(OBJ_SET, kEncodingStrMap2, SmallToStrSet(ss));
+      return res;
+    }
+
+    bool added = false;
+    ss = SmallSet::Add(ss, member, &added);
+    res += added;
+  }
+
+  co->SetRObjPtr(ss);
+  return res;
+}
+
 intset* IntsetAddSafe(string_view val, intset* is, bool* success, bool* added) {
   long long llval;
   *added = false;
@@ -137,6 +204,12 @@ pair<unsigned, bool> RemoveSet(const DbContext& db_context, facade::ArgRange val
     }
     isempty = (intsetLen(is) == 0);
     set->SetRObjPtr(is);
+  } else if (set->Encoding() == kEncodingSmallSet) {
+    SmallSet* ss = (SmallSet*)set->RObjPtr();
+    for (string_view val : vals) {
+      removed += ss->Erase(val);
+    }
+    isempty = ss->Empty();
   } else {
     return RemoveStrSet(MemberTimeSeconds(db_context.time_now_ms), vals, set);
   }
@@ -146,17 +219,20 @@ pair<unsigned, bool> RemoveSet(const DbContext& db_context, facade::ArgRange val
 void InitSet(const NewEntries& vals, CompactObj* set) {
   bool int_set = true;
   long long intv;
+  size_t num = 0, max_len = 0, bytes = 0;
 
   for (string_view v : EntriesRange(vals)) {
-    if (!string2ll(v.data(), v.size(), &intv)) {
-      int_set = false;
-      break;
-    }
+    int_set = int_set && string2ll(v.data(), v.size(), &intv);
+    ++num;
+    max_len = max(max_len, v.size());
+    bytes += v.size();
   }
 
   if (int_set) {
     intset* is = intsetNew();
     set->InitRobj(OBJ_SET, kEncodingIntSet, is);
+  } else if (SetFamily::FitsSmallSet(num, max_len)) {
+    set->InitRobj(OBJ_SET, kEncodingSmallSet, SmallSet::Create(num, bytes));
   } else {
     InitStrSet(set);
   }
@@ -192,6 +268,10 @@ uint32_t SetTypeLen(const DbContext& db_context, const SetType& set) {
     return intsetLen((const intset*)set.first);
   }
 
+  if (set.second == kEncodingSmallSet) {
+    return ((const SmallSet*)set.first)->Size();
+  }
+
   if (true) {
     StringSet* ss = (StringSet*)set.first;
     ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
@@ -207,6 +287,9 @@ bool IsInSet(const DbContext& db_context, const SetType& st, int64_t val) {
   char* next = absl::numbers_internal::FastIntToBuffer(val, buf);
   string_view str{buf, size_t(next - buf)};
 
+  if (st.second == kEncodingSmallSet)
+    return ((const SmallSet*)st.first)->Contains(str);
+
   if (true) {
     StringSet* ss = (StringSet*)st.first;
     ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
@@ -223,6 +306,9 @@ bool IsInSet(const DbContext& db_context, const SetType& st, string_view member)
     return intsetFind((intset*)st.first, llval);
   }
 
+  if (st.second == kEncodingSmallSet)
+    return ((const SmallSet*)st.first)->Contains(member);
+
   if (true) {
     StringSet* ss = (StringSet*)st.first;
     ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
@@ -241,6 +327,9 @@ int32_t GetExpiry(const DbContext& db_context, const SetType& st, string_view me
     return -1;
   }
 
+  if (st.second == kEncodingSmallSet)
+    return ((const SmallSet*)st.first)->Contains(member) ? -1 : -3;
+
   if (true) {
     StringSet* ss = (StringSet*)st.first;
     ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
@@ -255,6 +344,24 @@ int32_t GetExpiry(const DbContext& db_context, const SetType& st, string_view me
 
 void FindInSet(StringVec& memberships, const DbContext& db_context, const SetType& st,
                facade::ArgRange members) {
+  if (st.second == kEncodingStrMap2) {
+    StringSet* ss = (StringSet*)st.first;
+    ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
+
+    vector<string_view> keys;
+    keys.reserve(members.Size());
+    for (string_view member : members)
+      keys.push_back(member);
+
+    // Probe all members at once to overlap the cache misses.
+    vector<sds> found(keys.size());
+    ss->FindBatch(keys.data(), keys.size(), found.data());
+    for (sds elem : found) {
+      memberships.emplace_back(to_string(elem != nullptr));
+    }
+    return;
+  }
+
   for (string_view member : members) {
     bool status = IsInSet(db_context, st, member);
     memberships.emplace_back(to_string(status));
@@ -264,6 +371,14 @@ void FindInSet(StringVec& memberships, const DbContext& db_context, const SetTyp
 // Removes arg from result.
 void DiffStrSet(const DbContext& db_context, const SetType& st,
                 absl::flat_hash_set<string>* result) {
+  if (st.second == kEncodingSmallSet) {
+    ((const SmallSet*)st.first)->Iterate([result](string_view member) {
+      result->erase(member);
+      return true;
+    });
+    return;
+  }
+
   if (true) {
     StringSet* ss = (StringSet*)st.first;
     ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
@@ -273,29 +388,135 @@ void DiffStrSet(const DbContext& db_context, const SetType& st,
   }
 }
 
-void InterStrSet(const DbContext& db_context, const vector<SetType>& vec, StringVec* result) {
-  if (true) {
-    StringSet* ss = (StringSet*)vec.front().first;
-    ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
-    for (const sds ptr : *ss) {
-      std::string_view str{ptr, sdslen(ptr)};
-      size_t j = 1;
-      for (j = 1; j < vec.size(); ++j) {
-        if (vec[j].first != ss && !IsInSet(db_context, vec[j], str)) {
-          break;
-        }
-      }
+// Keeps the members of batch that belong to every set of vec from index first on, except for
+// skip. Every set is probed with the whole batch at once: string sets are hash probed in a
+// batch to overlap the cache misses, intsets and small sets are searched member by member.
+void FilterBatch(const DbContext& db_context, const vector<SetType>& vec, size_t first,
+                 const void* skip, vector<string_view>* batch) {
+  sds found[kInterBatchSize];
+  DCHECK_LE(batch->size(), kInterBatchSize);
+
+  for (size_t j = first; j < vec.size() && !batch->empty(); ++j) {
+    if (vec[j].first == skip)
+      continue;
 
-      if (j == vec.size()) {
-        result->push_back(std::string(str));
+    size_t keep = 0;
+    if (vec[j].second != kEncodingStrMap2) {
+      for (string_view str : *batch) {
+        if (IsInSet(db_context, vec[j], str))
+          (*batch)[keep++] = str;
       }
+    } else {
+      StringSet* other = (StringSet*)vec[j].first;
+      other->set_time(MemberTimeSeconds(db_context.time_now_ms));
+      other->FindBatch(batch->data(), batch->size(), found);
+      for (size_t i = 0; i < batch->size(); ++i) {
+        if (found[i])
+          (*batch)[keep++] = (*batch)[i];
+      }
+    }
+    batch->resize(keep);
+  }
+}
+
+// Appends the members of batch to result, up to limit members in total if limit is set.
+// Returns false once the limit is reached.
+bool AppendBatch(const vector<string_view>& batch, size_t limit, StringVec* result) {
+  for (string_view str : batch) {
+    if (limit && result->size() >= limit)
+      return false;
+    result->push_back(std::string(str));
+  }
+  return !limit || result->size() < limit;
+}
+
+// Intersects the sets of vec when the smallest one, vec.front(), is a string set.
+void InterStrSet(const DbContext& db_context, const vector<SetType>& vec, size_t limit,
+                 StringVec* result) {
+  const void* front = vec.front().first;
+  vector<string_view> batch;
+  batch.reserve(kInterBatchSize);
+
+  // Returns false once the limit is reached.
+  auto add = [&](string_view member) {
+    batch.push_back(member);
+    if (batch.size() < kInterBatchSize)
+      return true;
+
+    FilterBatch(db_context, vec, 1, front, &batch);
+    bool proceed = AppendBatch(batch, limit, result);
+    batch.clear();
+    return proceed;
+  };
+
+  if (vec.front().second == kEncodingSmallSet) {
+    if (!((const SmallSet*)front)->Iterate(add))
+      return;
+  } else {
+    StringSet* ss = (StringSet*)front;
+    ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
+    for (const sds ptr : *ss) {
+      if (!add({ptr, sdslen(ptr)}))
+        return;
     }
   }
+  FilterBatch(db_context, vec, 1, front, &batch);
+  AppendBatch(batch, limit, result);
+}
+
+// Intersects the sets of vec when the smallest one, vec.front(), is an intset. The members are
+// intersected with the other intsets as sorted integer arrays first, and only the remaining
+// ones are probed in the string sets.
+void InterIntSet(const DbContext& db_context, vector<SetType>* vec, size_t limit,
+                 StringVec* result) {
+  const intset* front = (const intset*)vec->front().first;
+
+  // Move the string sets after the intsets, both keep their order by size.
+  auto str_begin = stable_partition(vec->begin() + 1, vec->end(), [](const SetType& st) {
+    return st.second == kEncodingIntSet;
+  });
+  bool has_str_sets = str_begin != vec->end();
+
+  vector<int64_t> items;
+  IntsetDecode(front, &items);
+  size_t num = items.size();
+  for (auto it = vec->begin() + 1; it != str_begin && num > 0; ++it) {
+    if (it->first == front)
+      continue;
+    bool last = !has_str_sets && it + 1 == str_begin;
+    num = IntersectIntset(items.data(), num, (const intset*)it->first, last ? limit : 0);
+  }
+
+  if (!has_str_sets) {
+    num = limit ? min(num, limit) : num;
+    for (size_t i = 0; i < num; ++i)
+      result->push_back(absl::StrCat(items[i]));
+    return;
+  }
+
+  size_t first_str = str_begin - vec->begin();
+  vector<string> strs;
+  vector<string_view> batch;
+  strs.reserve(kInterBatchSize);
+  batch.reserve(kInterBatchSize);
+
+  for (size_t i = 0; i < num; i += kInterBatchSize) {
+    strs.clear();
+    batch.clear();
+    for (size_t j = i; j < min(num, i + kInterBatchSize); ++j)
+      strs.push_back(absl::StrCat(items[j]));
+    for (const string& str : strs)
+      batch.push_back(str);
+
+    FilterBatch(db_context, *vec, first_str, nullptr, &batch);
+    if (!AppendBatch(batch, limit, result))
+      return;
+  }
 }
 
 StringVec RandMemberStrSet(const DbContext& db_context, const CompactObj& co,
                            PicksGenerator& generator, std::size_t picks_count) {
-  CHECK(IsDenseEncoding(co));
+  CHECK_NE(co.Encoding(), kEncodingIntSet);
 
   std::unordered_map<RandomPick, std::uint32_t> times_index_is_picked;
   for (std::size_t i = 0; i < picks_count; i++) {
@@ -305,8 +526,10 @@ StringVec RandMemberStrSet(const DbContext& db_context, const CompactObj& co,
   StringVec result;
   result.reserve(picks_count);
 
-  StringSet* ss = static_cast<StringSet*>(co.RObjPtr());
-  ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
+  if (IsDenseEncoding(co)) {
+    StringSet* ss = static_cast<StringSet*>(co.RObjPtr());
+    ss->set_time(MemberTimeSeconds(db_context.time_now_ms));
+  }
 
   std::uint32_t ss_entry_index = 0;
   container_utils::IterateSet(
@@ -519,15 +742,9 @@ OpResult<uint32_t> OpAdd(const OpArgs& op_args, std::string_view key, const NewE
 
       if (!success) {
         co.SetRObjPtr(is);
-
-        StringSet* ss = SetFamily::ConvertToStrSet(is, intsetLen(is));
-        if (!ss) {
+        if (!ConvertIntSet(vals, &co)) {
           return OpStatus::OUT_OF_MEMORY;
         }
-
-        // frees 'is' on a way.
-        co.InitRobj(OBJ_SET, kEncodingStrMap2, ss);
-        inner_obj = co.RObjPtr();
         break;
       }
     }
@@ -536,8 +753,13 @@ OpResult<uint32_t> OpAdd(const OpArgs& op_args, std::string_view key, const NewE
       co.SetRObjPtr(is);
   }
 
-  if (co.Encoding() != kEncodingIntSet) {
-    res = AddStrSet(op_args.db_cntx, vals, UINT32_MAX, &co);
+  // The members added before a conversion are already there, so they are not counted again.
+  if (co.Encoding() == kEncodingSmallSet) {
+    res += AddSmallSet(vals, &co);
+  }
+
+  if (IsDenseEncoding(co)) {
+    res += AddStrSet(op_args.db_cntx, vals, UINT32_MAX, &co);
   }
 
   if (journal_update && op_args.shard->journal()) {
@@ -579,12 +801,19 @@ OpResult<uint32_t> OpAddEx(const OpArgs& op_args, string_view key, uint32_t ttl_
         return OpStatus::OUT_OF_MEMORY;
       }
       co.InitRobj(OBJ_SET, kEncodingStrMap2, ss);
+    } else if (co.Encoding() == kEncodingSmallSet) {
+      // Only string sets keep the expiry of members.
+      co.InitRobj(OBJ_SET, kEncodingStrMap2, SmallToStrSet((SmallSet*)co.RObjPtr()));
     }
 
     CHECK(IsDenseEncoding(co));
   }
 
+  StringSet* ss = (StringSet*)co.RObjPtr();
+  uint32_t next_expiry = ss->NextExpiry();
   uint32_t res = AddStrSet(op_args.db_cntx, vals, ttl_sec, &co);
+  if (ss->NextExpiry() < next_expiry)
+    db_slice.ScheduleFieldExpiry(op_args.db_cntx.db_index, key, ss->NextExpiry());
 
   return res;
 }
@@ -789,8 +1018,101 @@ OpResult<StringVec> OpDiff(const OpArgs& op_args, ShardArgs::Iterator start,
   return ToVec(std::move(uniques));
 }
 
-// Read-only OpInter op on sets.
-OpResult<StringVec> OpInter(const Transaction* t, EngineShard* es, bool remove_first) {
+// Members of a shard's partial union, split by container_utils::MergePartition. The views refer
+// to the members of the source sets, which stay locked until the transaction concludes.
+struct PartitionedViews {
+  vector<SvArray> parts;
+  container_utils::EntryViews views;
+};
+
+// Like OpUnion, but splits the members into num_parts partitions without copying them. Members
+// of several sets of the shard are repeated, the partitions are deduplicated when merged.
+OpResult<PartitionedViews> OpUnionViews(const OpArgs& op_args, ShardArgs::Iterator start,
+                                        ShardArgs::Iterator end, unsigned num_parts) {
+  DCHECK(start != end);
+  PartitionedViews res;
+  res.parts.resize(num_parts);
+
+  for (; start != end; ++start) {
+    auto find_res = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, *start, OBJ_SET);
+    if (!find_res) {
+      if (find_res.status() != OpStatus::KEY_NOTFOUND)
+        return find_res.status();
+      continue;
+    }
+
+    const PrimeValue& pv = find_res.value()->second;
+    if (IsDenseEncoding(pv)) {
+      StringSet* ss = (StringSet*)pv.RObjPtr();
+      ss->set_time(MemberTimeSeconds(op_args.db_cntx.time_now_ms));
+    }
+    container_utils::IterateSet(pv, [&res, num_parts](container_utils::ContainerEntry ce) {
+      string_view member = res.views.Get(ce);
+      res.parts[container_utils::MergePartition(member, num_parts)].push_back(member);
+      return true;
+    });
+  }
+  return res;
+}
+
+// Distinct members of the given partition of all the partial results.
+SvArray UnionPartition(const vector<OpResult<PartitionedViews>>& results, unsigned part) {
+  absl::flat_hash_set<string_view> uniques;
+  for (const auto& res : results) {
+    if (res)
+      uniques.insert(res->parts[part].begin(), res->parts[part].end());
+  }
+  return SvArray(uniques.begin(), uniques.end());
+}
+
+// Indices of the members that belong to any of the sets of the keys. The sets are probed rather
+// than iterated, so that large sets are not copied for diffing a few members against them.
+OpResult<vector<uint32_t>> OpFindMembers(const OpArgs& op_args, ShardArgs::Iterator start,
+                                         ShardArgs::Iterator end, const StringVec& members) {
+  vector<bool> found(members.size(), false);
+  for (; start != end; ++start) {
+    auto find_res = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, *start, OBJ_SET);
+    if (!find_res) {
+      if (find_res.status() == OpStatus::WRONG_TYPE)
+        return OpStatus::WRONG_TYPE;
+      continue;  // KEY_NOTFOUND
+    }
+
+    const PrimeValue& pv = find_res.value()->second;
+    SetType st{pv.RObjPtr(), pv.Encoding()};
+    if (st.second != kEncodingStrMap2) {
+      for (size_t i = 0; i < members.size(); ++i)
+        found[i] = found[i] || IsInSet(op_args.db_cntx, st, members[i]);
+      continue;
+    }
+
+    // Probe the members in batches to overlap the cache misses.
+    StringSet* ss = (StringSet*)st.first;
+    ss->set_time(MemberTimeSeconds(op_args.db_cntx.time_now_ms));
+    string_view batch[kInterBatchSize];
+    sds res[kInterBatchSize];
+    for (size_t i = 0; i < members.size(); i += kInterBatchSize) {
+      size_t len = min(kInterBatchSize, members.size() - i);
+      for (size_t j = 0; j < len; ++j)
+        batch[j] = members[i + j];
+      ss->FindBatch(batch, len, res);
+      for (size_t j = 0; j < len; ++j)
+        found[i + j] = found[i + j] || res[j];
+    }
+  }
+
+  vector<uint32_t> res;
+  for (size_t i = 0; i < found.size(); ++i) {
+    if (found[i])
+      res.push_back(i);
+  }
+  return res;
+}
+
+// Read-only OpInter op on sets. Stops after limit members unless limit is 0, thus limit must be
+// set only if all the sets are hosted by the shard.
+OpResult<StringVec> OpInter(const Transaction* t, EngineShard* es, bool remove_first,
+                            size_t limit = 0) {
   ShardArgs args = t->GetShardArgs(es->shard_id());
   auto it = args.begin();
   if (remove_first) {
@@ -811,9 +1133,9 @@ OpResult<StringVec> OpInter(const Transaction* t, EngineShard* es, bool remove_f
     }
 
     container_utils::IterateSet(find_res.value()->second,
-                                [&result](container_utils::ContainerEntry ce) {
+                                [&result, limit](container_utils::ContainerEntry ce) {
                                   result.push_back(ce.ToString());
-                                  return true;
+                                  return !limit || result.size() < limit;
                                 });
     return result;
   }
@@ -846,26 +1168,10 @@ OpResult<StringVec> OpInter(const Transaction* t, EngineShard* es, bool remove_f
 
   std::sort(sets.begin(), sets.end(), comp);
 
-  int encoding = sets.front().second;
-  if (encoding == kEncodingIntSet) {
-    int ii = 0;
-    intset* is = (intset*)sets.front().first;
-    int64_t intele;
-
-    while (intsetGet(is, ii++, &intele)) {
-      size_t j = 1;
-      for (j = 1; j < sets.size(); j++) {
-        if (sets[j].first != is && !IsInSet(t->GetDbContext(), sets[j], intele))
-          break;
-      }
-
-      /* Only take action when all sets contain the member */
-      if (j == sets.size()) {
-        result.push_back(absl::StrCat(intele));
-      }
-    }
+  if (sets.front().second == kEncodingIntSet) {
+    InterIntSet(t->GetDbContext(), &sets, limit, &result);
   } else {
-    InterStrSet(t->GetDbContext(), sets, &result);
+    InterStrSet(t->GetDbContext(), sets, limit, &result);
   }
 
   return result;
@@ -982,6 +1288,14 @@ OpResult<StringVec> OpScan(const OpArgs& op_args, string_view key, uint64_t* cur
       }
     }
     *cursor = 0;
+  } else if (it->second.Encoding() == kEncodingSmallSet) {
+    // Small sets are returned whole, like intsets.
+    ((const SmallSet*)it->second.RObjPtr())->Iterate([&](string_view member) {
+      if (scan_op.Matches(member))
+        res.emplace_back(member);
+      return true;
+    });
+    *cursor = 0;
   } else {
     *cursor = ScanStrSet(op_args.db_cntx, it->second, *cursor, scan_op, &res);
   }
@@ -1183,58 +1497,93 @@ void SDiff(CmdArgList args, ConnectionContext* cntx) {
   rb->SendStringArr(arr, RedisReplyBuilder::SET);
 }
 
+// Diffs the members of the source shard against the sets of the other shards in parallel.
 void SDiffStore(CmdArgList args, ConnectionContext* cntx) {
-  ResultStringVec result_set(shard_set->size(), OpStatus::SKIPPED);
   string_view dest_key = ArgS(args, 0);
-  ShardId dest_shard = Shard(dest_key, result_set.size());
+  ShardId dest_shard = Shard(dest_key, shard_set->size());
   string_view src_key = ArgS(args, 1);
-  ShardId src_shard = Shard(src_key, result_set.size());
+  ShardId src_shard = Shard(src_key, shard_set->size());
 
   VLOG(1) << "SDiffStore " << src_key << " " << src_shard;
 
-  // read-only op
-  auto diff_cb = [&](Transaction* t, EngineShard* shard) {
+  // Source keys of the shard, without the destination key
+  auto source_keys = [&](Transaction* t, EngineShard* shard) {
     ShardArgs largs = t->GetShardArgs(shard->shard_id());
-    OpArgs op_args = t->GetOpArgs(shard);
     DCHECK(!largs.Empty());
     ShardArgs::Iterator start = largs.begin();
-    ShardArgs::Iterator end = largs.end();
     if (shard->shard_id() == dest_shard) {
       CHECK_EQ(*start, dest_key);
       ++start;
-      if (start == end)
-        return OpStatus::OK;
     }
+    return make_pair(start, largs.end());
+  };
 
-    if (shard->shard_id() == src_shard) {
+  // The source shard diffs its own keys, while the others check the types of theirs.
+  OpResult<StringVec> diff = StringVec{};
+  vector<OpStatus> statuses(shard_set->size(), OpStatus::OK);
+  vector<bool> has_sources(shard_set->size(), false);
+  auto diff_cb = [&](Transaction* t, EngineShard* shard) {
+    auto [start, end] = source_keys(t, shard);
+    ShardId sid = shard->shard_id();
+    if (start == end)
+      return OpStatus::OK;
+
+    if (sid == src_shard) {
       CHECK_EQ(src_key, *start);
-      result_set[shard->shard_id()] = OpDiff(op_args, start, end);  // Diff
+      diff = OpDiff(t->GetOpArgs(shard), start, end);
     } else {
-      result_set[shard->shard_id()] = OpUnion(op_args, start, end);  // Union
+      has_sources[sid] = true;
+      statuses[sid] = OpFindMembers(t->GetOpArgs(shard), start, end, {}).status();
     }
-
     return OpStatus::OK;
   };
 
   cntx->transaction->Execute(std::move(diff_cb), false);
-  ResultSetView rsv = DiffResultVec(result_set, src_shard);
-  if (!rsv) {
-    cntx->transaction->Conclude();
-    cntx->SendError(rsv.status());
-    return;
+  if (diff.status() == OpStatus::KEY_NOTFOUND)
+    diff = StringVec{};
+  statuses[src_shard] = diff.status();
+  for (OpStatus status : statuses) {
+    if (status != OpStatus::OK) {
+      cntx->transaction->Conclude();
+      return cntx->SendError(status);
+    }
+  }
+
+  // The other shards find which members of the diff they have.
+  vector<bool> removed(diff->size(), false);
+  if (!diff->empty() && find(has_sources.begin(), has_sources.end(), true) != has_sources.end()) {
+    vector<vector<uint32_t>> found(shard_set->size());
+    auto filter_cb = [&](Transaction* t, EngineShard* shard) {
+      auto [start, end] = source_keys(t, shard);
+      ShardId sid = shard->shard_id();
+      if (sid != src_shard && start != end)
+        found[sid] = OpFindMembers(t->GetOpArgs(shard), start, end, *diff).value();
+      return OpStatus::OK;
+    };
+    cntx->transaction->Execute(std::move(filter_cb), false);
+
+    for (const auto& indices : found) {
+      for (uint32_t i : indices)
+        removed[i] = true;
+    }
+  }
+
+  SvArray members;
+  for (size_t i = 0; i < diff->size(); ++i) {
+    if (!removed[i])
+      members.emplace_back((*diff)[i]);
   }
 
-  size_t result_size = rsv.value().size();
   auto store_cb = [&](Transaction* t, EngineShard* shard) {
     if (shard->shard_id() == dest_shard) {
-      OpAdd(t->GetOpArgs(shard), dest_key, std::move(rsv.value()), true, true);
+      OpAdd(t->GetOpArgs(shard), dest_key, ArgSlice{members}, true, true);
     }
 
     return OpStatus::OK;
   };
 
   cntx->transaction->Execute(std::move(store_cb), true);
-  cntx->SendLong(result_size);
+  cntx->SendLong(members.size());
 }
 
 void SMembers(CmdArgList args, ConnectionContext* cntx) {
@@ -1361,9 +1710,11 @@ void SInterCard(CmdArgList args, ConnectionContext* cntx) {
   } else if (args.size() > (num_keys + 1))
     return cntx->SendError(kSyntaxErr);
 
+  // A shard can stop at the limit only if it holds all the sets.
+  unsigned shard_limit = cntx->transaction->GetUniqueShardCnt() == 1 ? limit : 0;
   ResultStringVec result_set(shard_set->size(), OpStatus::SKIPPED);
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    result_set[shard->shard_id()] = OpInter(t, shard, false);
+    result_set[shard->shard_id()] = OpInter(t, shard, false, shard_limit);
     return OpStatus::OK;
   };
 
@@ -1398,12 +1749,19 @@ void SUnion(CmdArgList args, ConnectionContext* cntx) {
   }
 }
 
+// Every shard splits the views of its members into partitions, which large unions merge in
+// parallel.
 void SUnionStore(CmdArgList args, ConnectionContext* cntx) {
-  ResultStringVec result_set(shard_set->size(), OpStatus::SKIPPED);
+  vector<OpResult<PartitionedViews>> result_set(shard_set->size(), OpStatus::SKIPPED);
   string_view dest_key = ArgS(args, 0);
   ShardId dest_shard = Shard(dest_key, result_set.size());
 
+  // The i-th shard of the transaction merges partition i.
+  unsigned num_parts = cntx->transaction->GetUniqueShardCnt();
+  vector<bool> active(shard_set->size(), false);
+
   auto union_cb = [&](Transaction* t, EngineShard* shard) {
+    active[shard->shard_id()] = true;
     ShardArgs largs = t->GetShardArgs(shard->shard_id());
     ShardArgs::Iterator start = largs.begin(), end = largs.end();
     if (shard->shard_id() == dest_shard) {
@@ -1412,30 +1770,69 @@ void SUnionStore(CmdArgList args, ConnectionContext* cntx) {
       if (start == end)
         return OpStatus::OK;
     }
-    result_set[shard->shard_id()] = OpUnion(t->GetOpArgs(shard), start, end);
+    result_set[shard->shard_id()] = OpUnionViews(t->GetOpArgs(shard), start, end, num_parts);
     return OpStatus::OK;
   };
 
   cntx->transaction->Execute(std::move(union_cb), false);
 
-  ResultSetView unionset = UnionResultVec(result_set);
-  if (!unionset) {
-    cntx->transaction->Conclude();
-    cntx->SendError(unionset.status());
-    return;
+  size_t total = 0;
+  for (const auto& res : result_set) {
+    if (!res && res.status() != OpStatus::SKIPPED) {
+      cntx->transaction->Conclude();
+      return cntx->SendError(res.status());
+    }
+    if (res) {
+      for (const SvArray& part : res->parts)
+        total += part.size();
+    }
+  }
+
+  vector<ShardId> mergers;
+  for (ShardId sid = 0; sid < active.size(); ++sid) {
+    if (active[sid])
+      mergers.push_back(sid);
+  }
+  DCHECK_EQ(mergers.size(), num_parts);
+
+  // Members of different partitions are distinct, so that the partitions are merged
+  // independently.
+  vector<SvArray> merged(num_parts);
+  if (num_parts > 1 && total >= container_utils::kMinParallelMergeSize) {
+    auto merge_cb = [&](Transaction* t, EngineShard* shard) {
+      auto part = find(mergers.begin(), mergers.end(), shard->shard_id()) - mergers.begin();
+      merged[part] = UnionPartition(result_set, part);
+      return OpStatus::OK;
+    };
+    cntx->transaction->Execute(std::move(merge_cb), false);
+  } else {
+    for (unsigned part = 0; part < num_parts; ++part)
+      merged[part] = UnionPartition(result_set, part);
+  }
+
+  SvArray members;
+  for (const SvArray& part : merged)
+    members.insert(members.end(), part.begin(), part.end());
+
+  // Overwriting the destination frees its members, so they are copied if it is a source too.
+  StringVec copies;
+  for (size_t i = 1; i < args.size() && copies.empty(); ++i) {
+    if (ArgS(args, i) == dest_key) {
+      copies.assign(members.begin(), members.end());
+      members.assign(copies.begin(), copies.end());
+    }
   }
 
-  size_t result_size = unionset.value().size();
   auto store_cb = [&](Transaction* t, EngineShard* shard) {
     if (shard->shard_id() == dest_shard) {
-      OpAdd(t->GetOpArgs(shard), dest_key, std::move(unionset.value()), true, true);
+      OpAdd(t->GetOpArgs(shard), dest_key, ArgSlice{members}, true, true);
     }
 
     return OpStatus::OK;
   };
 
   cntx->transaction->Execute(std::move(store_cb), true);
-  cntx->SendLong(result_size);
+  cntx->SendLong(members.size());
 }
 
 void SScan(CmdArgList args, ConnectionContext* cntx) {
@@ -1582,6 +1979,11 @@ uint32_t SetFamily::MaxIntsetEntries() {
   return kMaxIntSetEntries;
 }
 
+bool SetFamily::FitsSmallSet(size_t size, size_t max_len) {
+  return size <= min<size_t>(server.set_max_small_entries, SmallSet::kMaxSize) &&
+         max_len <= min(server.set_max_small_value, SmallSet::kMaxMemberLen);
+}
+
 int32_t SetFamily::FieldExpireTime(const DbContext& db_context, const PrimeValue& pv,
                                    std::string_view field) {
   DCHECK_EQ(OBJ_SET, pv.ObjType());
@@ -28,6 +28,9 @@ class SetFamily {
   // Returns nullptr on OOM.
   static StringSet* ConvertToStrSet(const intset* is, size_t expected_len);
 
+  // Whether a set of size members, the longest one max_len bytes long, is encoded as SmallSet.
+  static bool FitsSmallSet(size_t size, size_t max_len);
+
   // returns expiry time in seconds since kMemberExpiryBase date.
   // returns -3 if field was not found, -1 if no ttl is associated with the item.
   static int32_t FieldExpireTime(const DbContext& db_context, const PrimeValue& pv,
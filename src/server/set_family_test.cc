@@ -92,6 +92,34 @@ TEST_F(SetFamilyTest, SDiff) {
   EXPECT_EQ(2, CheckedInt({"SDIFFSTORE", "tar", "bar", "foo", "car"}));
 }
 
+TEST_F(SetFamilyTest, LargeStore) {
+  // Large enough for the partial results to be merged in parallel.
+  for (unsigned i = 0; i < 3; ++i) {
+    vector<string> args = {"sadd", absl::StrCat("s", i)};
+    for (unsigned j = i * 2000; j < i * 2000 + 3000; ++j)
+      args.push_back(absl::StrCat("m", j));
+    Run(absl::MakeSpan(args));
+  }
+
+  EXPECT_EQ(7000, CheckedInt({"sunionstore", "u", "s0", "s1", "s2"}));
+  EXPECT_EQ(7000, CheckedInt({"scard", "u"}));
+  EXPECT_THAT(Run({"sismember", "u", "m6999"}), IntArg(1));
+
+  EXPECT_EQ(2000, CheckedInt({"sdiffstore", "d", "s0", "s1", "s2"}));
+  EXPECT_THAT(Run({"sismember", "d", "m1999"}), IntArg(1));
+  EXPECT_THAT(Run({"sismember", "d", "m2000"}), IntArg(0));
+  EXPECT_EQ(2000, CheckedInt({"sdiffstore", "s0", "s0", "s1", "nokey"}));
+  EXPECT_EQ(2000, CheckedInt({"scard", "s0"}));
+
+  EXPECT_EQ(0, CheckedInt({"sdiffstore", "d", "s0", "u"}));
+  EXPECT_EQ(0, CheckedInt({"exists", "d"}));
+
+  Run({"set", "str", "foo"});
+  EXPECT_THAT(Run({"sunionstore", "u", "s0", "s1", "str"}), ErrArg("WRONGTYPE"));
+  EXPECT_THAT(Run({"sdiffstore", "u", "s0", "s1", "str"}), ErrArg("WRONGTYPE"));
+  EXPECT_EQ(7000, CheckedInt({"scard", "u"}));
+}
+
 TEST_F(SetFamilyTest, SInter) {
   auto resp = Run({"sadd", "a", "1", "2", "3", "4"});
   Run({"sadd", "b", "3", "5", "6", "2"});
@@ -134,6 +162,29 @@ TEST_F(SetFamilyTest, SInterCard) {
   EXPECT_THAT(resp, ErrArg("value is not an integer or out of range"));
 }
 
+TEST_F(SetFamilyTest, SInterIntSets) {
+  // a and b are intsets of different encodings, c is a string set.
+  for (unsigned i = 0; i < 200; ++i) {
+    Run({"sadd", "a", absl::StrCat(i * 3)});
+    Run({"sadd", "b", absl::StrCat(i * 2)});
+  }
+  Run({"sadd", "b", "100000"});
+  for (unsigned i = 0; i < 300; ++i) {
+    Run({"sadd", "c", absl::StrCat(i * 4)});
+  }
+  Run({"sadd", "c", "x"});
+
+  // Multiples of 6 below 400 and multiples of 12 among them.
+  EXPECT_EQ(67, CheckedInt({"sintercard", "2", "a", "b"}));
+  EXPECT_EQ(34, CheckedInt({"sintercard", "3", "a", "b", "c"}));
+  EXPECT_EQ(5, CheckedInt({"sintercard", "3", "c", "b", "a", "LIMIT", "5"}));
+  EXPECT_EQ(67, CheckedInt({"sintercard", "2", "a", "b", "LIMIT", "100"}));
+
+  auto resp = Run({"sinter", "c", "b", "a"});
+  ASSERT_THAT(resp, ArrLen(34));
+  EXPECT_THAT(resp.GetVec(), IsSupersetOf({"0", "12", "396"}));
+}
+
 TEST_F(SetFamilyTest, SMove) {
   auto resp = Run({"sadd", "a", "1", "2", "3", "4"});
   Run({"sadd", "b", "3", "5", "6", "2"});
@@ -313,6 +364,56 @@ TEST_F(SetFamilyTest, Empty) {
   ASSERT_THAT(resp, ArrLen(0));
 }
 
+TEST_F(SetFamilyTest, SmallSet) {
+  // Sets of a few short strings are packed, until they outgrow the limits.
+  vector<string> args = {"sadd", "s"};
+  for (unsigned i = 0; i < 100; ++i)
+    args.push_back(absl::StrCat("member:", i));
+  EXPECT_THAT(Run(absl::MakeSpan(args)), IntArg(100));
+  EXPECT_LT(CheckedInt({"memory", "usage", "s"}), 2000);
+  EXPECT_THAT(Run({"sismember", "s", "member:42"}), IntArg(1));
+  EXPECT_THAT(Run({"smismember", "s", "member:1", "member:", "member:99"}).GetVec(),
+              ElementsAre(IntArg(1), IntArg(0), IntArg(1)));
+  EXPECT_THAT(Run({"srem", "s", "member:42", "member:420"}), IntArg(1));
+  EXPECT_EQ(99, CheckedInt({"scard", "s"}));
+
+  // Intsets convert to small sets and count the integers added along.
+  Run({"sadd", "i", "1", "2", "3"});
+  EXPECT_THAT(Run({"sadd", "i", "a", "4"}), IntArg(2));
+  EXPECT_THAT(Run({"smembers", "i"}).GetVec(), UnorderedElementsAre("1", "2", "3", "4", "a"));
+  Run({"sadd", "s", "1", "2"});
+  EXPECT_THAT(Run({"sinter", "i", "s"}).GetVec(), UnorderedElementsAre("1", "2"));
+  EXPECT_THAT(Run({"sdiff", "i", "s"}).GetVec(), UnorderedElementsAre("3", "4", "a"));
+  EXPECT_EQ(104, CheckedInt({"sunionstore", "u", "i", "s"}));
+  EXPECT_THAT(Run({"spop", "u", "2"}), ArrLen(2));
+  EXPECT_EQ(102, CheckedInt({"scard", "u"}));
+
+  EXPECT_THAT(Run({"smove", "i", "s", "a"}), IntArg(1));
+  EXPECT_THAT(Run({"sismember", "s", "a"}), IntArg(1));
+  EXPECT_THAT(Run({"spop", "i", "10"}), ArrLen(4));
+  EXPECT_THAT(Run({"exists", "i"}), IntArg(0));
+
+  // A long member converts to a string set, keeping the members.
+  string long_member(100, 'x');
+  EXPECT_THAT(Run({"sadd", "s", long_member}), IntArg(1));
+  EXPECT_THAT(Run({"sismember", "s", long_member}), IntArg(1));
+  EXPECT_THAT(Run({"sismember", "s", "member:99"}), IntArg(1));
+  EXPECT_EQ(103, CheckedInt({"scard", "s"}));
+
+  // So does growing past the entries limit.
+  args.resize(2);
+  for (unsigned i = 0; i < 200; ++i)
+    args.push_back(absl::StrCat(i, "-member"));
+  EXPECT_THAT(Run(absl::MakeSpan(args)), IntArg(200));
+  EXPECT_THAT(Run({"srandmember", "s", "3"}), ArrLen(3));
+  EXPECT_THAT(Run({"sismember", "s", "199-member"}), IntArg(1));
+
+  // Member expiry is kept only by string sets.
+  Run({"sadd", "e", "a", "b"});
+  EXPECT_THAT(Run({"saddex", "e", "10", "c"}), IntArg(1));
+  EXPECT_THAT(Run({"smembers", "e"}).GetVec(), UnorderedElementsAre("a", "b", "c"));
+}
+
 TEST_F(SetFamilyTest, SScan) {
   // Test for int set
   for (int i = 0; i < 15; i++) {
@@ -329,10 +430,19 @@ TEST_F(SetFamilyTest, SScan) {
   vec = StrArray(resp.GetVec()[1]);
   EXPECT_THAT(vec, UnorderedElementsAre("1", "10", "11", "12", "13", "14"));
 
-  // test string set
+  // Small sets are scanned whole as well
+  for (int i = 0; i < 15; i++) {
+    Run({"sadd", "mysmallset", absl::StrCat("str-", i)});
+  }
+  resp = Run({"sscan", "mysmallset", "0", "count", "4"});
+  EXPECT_EQ(resp.GetVec()[0], "0");
+  EXPECT_EQ(StrArray(resp.GetVec()[1]).size(), 15);
+
+  // test string set, the long member does not fit a small set
   for (int i = 0; i < 15; i++) {
     Run({"sadd", "mystrset", absl::StrCat("str-", i)});
   }
+  Run({"sadd", "mystrset", string(100, 'x')});
 
   resp = Run({"sscan", "mystrset", "0", "count", "5"});
   vec = StrArray(resp.GetVec()[1]);
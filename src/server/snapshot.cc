@@ -7,7 +7,9 @@
 #include <absl/functional/bind_front.h>
 #include <absl/strings/match.h>
 #include <absl/strings/str_cat.h>
+#include <zdict.h>
 
+#include "base/flags.h"
 #include "base/logging.h"
 #include "core/heap_size.h"
 #include "server/db_slice.h"
@@ -17,6 +19,21 @@
 #include "server/rdb_save.h"
 #include "server/tiered_storage.h"
 
+ABSL_DECLARE_FLAG(uint64_t, serialization_max_chunk_size);
+ABSL_DECLARE_FLAG(int, compression_level);
+
+ABSL_FLAG(uint64_t, snapshot_memory_overhead_limit, 0,
+          "If positive, the bucket iteration of a snapshot pauses while more bytes than this "
+          "are serialized and not written yet. Buckets changed by writes are still serialized "
+          "meanwhile, so this bounds the growth caused by a slow sink, not the overhead of writes.");
+ABSL_FLAG(uint32_t, snapshot_latency_budget_usec, 0,
+          "If positive, the bucket iteration of a snapshot adapts the number of buckets it "
+          "serializes between yields so that it runs for about this long at once. When a single "
+          "bucket does not fit, the compression level is lowered as well.");
+ABSL_FLAG(uint64_t, snapshot_tiered_read_limit, 16 << 20,
+          "Bytes of offloaded values a snapshot reads ahead while it keeps iterating buckets. "
+          "The iteration waits for reads to complete once more bytes than this are pending.");
+
 namespace dfly {
 
 using namespace std;
@@ -25,15 +42,70 @@ using namespace chrono_literals;
 
 namespace {
 thread_local absl::flat_hash_set<SliceSnapshot*> tl_slice_snapshots;
+
+// Trains a zstd dictionary on the serialized form of the first entries of the shard. Entries are
+// spread randomly over the buckets, so these are a fair sample of the data. Training runs
+// synchronously in the shard thread, hence the sample is kept small.
+string TrainZstdDictionary(const DbTableArray& db_array) {
+  constexpr size_t kMaxSampleBytes = 256 << 10;
+  constexpr size_t kMaxEntryBytes = 4 << 10;
+  constexpr size_t kDictCapacity = 16 << 10;
+
+  RdbSerializer serializer(CompressionMode::NONE);
+  vector<size_t> sample_sizes;
+
+  for (DbIndex db_indx = 0; db_indx < db_array.size(); ++db_indx) {
+    DbTable* db_table = db_array[db_indx].get();
+    if (!db_table)
+      continue;
+
+    PrimeTable::Cursor cursor;
+    do {
+      cursor = db_table->prime.Traverse(cursor, [&](PrimeIterator it) {
+        const PrimeValue& pv = it->second;
+        if (pv.IsExternal() || pv.MallocUsed() > kMaxEntryBytes)
+          return;
+        size_t before = serializer.SerializedLen();
+        if (serializer.SaveEntry(it->first, pv, 0, db_indx))
+          sample_sizes.push_back(serializer.SerializedLen() - before);
+      });
+    } while (cursor && serializer.SerializedLen() < kMaxSampleBytes);
+
+    if (serializer.SerializedLen() >= kMaxSampleBytes)
+      break;
+  }
+
+  io::StringSink samples;
+  if (sample_sizes.empty() || serializer.FlushToSink(&samples))
+    return {};
+
+  string dict(kDictCapacity, '\0');
+  size_t dict_size = ZDICT_trainFromBuffer(dict.data(), dict.size(), samples.str().data(),
+                                           sample_sizes.data(), sample_sizes.size());
+  if (ZDICT_isError(dict_size)) {
+    // Too few or too small samples, compress without a dictionary.
+    VLOG(1) << "Could not train zstd dictionary: " << ZDICT_getErrorName(dict_size);
+    return {};
+  }
+  dict.resize(dict_size);
+  return dict;
+}
+
 }  // namespace
 
 size_t SliceSnapshot::DbRecord::size() const {
   return HeapSize(value);
 }
 
-SliceSnapshot::SliceSnapshot(DbSlice* slice, RecordChannel* dest, CompressionMode compression_mode)
-    : db_slice_(slice), dest_(dest), compression_mode_(compression_mode) {
+SliceSnapshot::SliceSnapshot(DbSlice* slice, RecordChannel* dest, CompressionMode compression_mode,
+                             bool native_encoding)
+    : db_slice_(slice),
+      dest_(dest),
+      compression_mode_(compression_mode),
+      native_encoding_(native_encoding) {
   db_array_ = slice->databases();
+  tiered_reads_ = make_shared<TieredReads>();
+  tiered_read_limit_ = absl::GetFlag(FLAGS_snapshot_tiered_read_limit);
   tl_slice_snapshots.insert(this);
 }
 
@@ -53,11 +125,38 @@ bool SliceSnapshot::IsSnaphotInProgress() {
   return tl_slice_snapshots.size() > 0;
 }
 
-void SliceSnapshot::Start(bool stream_journal, const Cancellation* cll) {
+void SliceSnapshot::Start(bool stream_journal, const Cancellation* cll, DeltaMode delta_mode) {
   DCHECK(!snapshot_fb_.IsJoinable());
 
   auto db_cb = absl::bind_front(&SliceSnapshot::OnDbChange, this);
   snapshot_version_ = db_slice_->RegisterOnChange(std::move(db_cb));
+  serializer_ = std::make_unique<RdbSerializer>(compression_mode_);
+  serializer_->SetNativeEncoding(native_encoding_);
+  max_chunk_size_ = absl::GetFlag(FLAGS_serialization_max_chunk_size);
+  throttle_bandwidth_ = stream_journal;
+  TieredStorage* ts = EngineShard::tlocal()->tiered_storage();
+  reference_tiered_ = !stream_journal && ts && ts->IsFrozen();
+  if (compression_mode_ == CompressionMode::MULTI_ENTRY_ZSTD ||
+      compression_mode_ == CompressionMode::MULTI_ENTRY_LZ4) {
+    max_compression_level_ = compression_level_ = absl::GetFlag(FLAGS_compression_level);
+  }
+  if (compression_mode_ == CompressionMode::MULTI_ENTRY_ZSTD_DICT)
+    serializer_->SetZstdDictionary(TrainZstdDictionary(db_array_));
+
+  if (delta_mode != DeltaMode::NONE) {
+    auto [base_version, deleted_keys] = db_slice_->StartDeltaSnapshot(snapshot_version_);
+    if (delta_mode == DeltaMode::DELTA) {
+      DCHECK_GT(base_version, 0u);
+      delta_base_version_ = base_version;
+
+      // The markers must precede any entry, as a deleted key could have been added again.
+      // OnDbChange can serialize buckets as soon as we preempt, so they are written right away.
+      for (DbIndex db_indx = 0; db_indx < deleted_keys.size(); ++db_indx) {
+        for (const string& key : deleted_keys[db_indx])
+          serializer_->SaveDeletedKey(key, db_indx);
+      }
+    }
+  }
 
   if (stream_journal) {
     auto* journal = db_slice_->shard_owner()->journal();
@@ -66,8 +165,6 @@ void SliceSnapshot::Start(bool stream_journal, const Cancellation* cll) {
     journal_cb_id_ = journal->RegisterOnChange(std::move(journal_cb));
   }
 
-  serializer_ = std::make_unique<RdbSerializer>(compression_mode_);
-
   VLOG(1) << "DbSaver::Start - saving entries with version less than " << snapshot_version_;
 
   snapshot_fb_ = fb2::Fiber("snapshot", [this, stream_journal, cll] {
@@ -86,6 +183,7 @@ void SliceSnapshot::StartIncremental(Context* cntx, LSN start_lsn) {
   DCHECK(journal);
 
   serializer_ = std::make_unique<RdbSerializer>(compression_mode_);
+  serializer_->SetNativeEncoding(native_encoding_);
 
   snapshot_fb_ =
       fb2::Fiber("incremental_snapshot", [this, journal, cntx, lsn = start_lsn]() mutable {
@@ -94,10 +192,27 @@ void SliceSnapshot::StartIncremental(Context* cntx, LSN start_lsn) {
         VLOG(1) << "Starting incremental snapshot from lsn=" << lsn;
 
         // The replica sends the LSN of the next entry is wants to receive.
-        while (!cntx->IsCancelled() && journal->IsLSNInBuffer(lsn)) {
-          serializer_->WriteJournalEntry(journal->GetEntry(lsn));
-          PushSerializedToChannel(false);
-          lsn++;
+        // Entries that were already dropped from the buffer are read from the on-disk ring.
+        while (!cntx->IsCancelled()) {
+          if (journal->IsLSNInBuffer(lsn)) {
+            serializer_->WriteJournalEntry(journal->GetEntry(lsn));
+            PushSerializedToChannel(false);
+            lsn++;
+            continue;
+          }
+
+          if (!journal->IsLSNOnDisk(lsn))
+            break;
+
+          auto next_lsn = journal->ReadFromDisk(lsn, [this](std::string_view entry) {
+            serializer_->WriteJournalEntry(entry);
+            PushSerializedToChannel(false);
+          });
+          if (!next_lsn) {
+            VLOG(1) << "Could not read lsn " << lsn << " from disk: " << next_lsn.error().message();
+            break;
+          }
+          lsn = *next_lsn;
         }
 
         VLOG(1) << "Last LSN sent in incremental snapshot was " << (lsn - 1);
@@ -135,6 +250,8 @@ void SliceSnapshot::Stop() {
   Join();
 
   if (journal_cb_id_) {
+    // The offset must follow the journal entries queued behind tiered reads
+    SerializeTieredReads(true);
     auto* journal = db_slice_->shard_owner()->journal();
     serializer_->SendJournalOffset(journal->GetLsn());
     journal->UnregisterOnChange(journal_cb_id_);
@@ -198,19 +315,36 @@ void SliceSnapshot::IterateBucketsFb(const Cancellation* cll, bool send_full_syn
     current_db_ = db_indx;
 
     VLOG(1) << "Start traversing " << pt->size() << " items for index " << db_indx;
+    last_yield_ns_ = absl::GetCurrentTimeNanos();
     do {
       if (cll->IsCancelled())
         return;
 
+      // Serialization stalls on memory, so the buckets and values of the next cursors are
+      // fetched while the current one is serialized.
+      pt->PrefetchTraversal(cursor, PrefetchEntry);
       PrimeTable::Cursor next =
           pt->Traverse(cursor, absl::bind_front(&SliceSnapshot::BucketSaveCb, this));
+      if (big_value_skipped_) {
+        // Traverse the logical bucket again and save the skipped buckets, preempting between the
+        // parts of big values. Locking waits for the running transactions, which may save the
+        // skipped buckets as a whole meanwhile.
+        big_value_skipped_ = false;
+        db_slice_->LockForSerialization();
+        table_locked_ = true;
+        pt->Traverse(cursor, absl::bind_front(&SliceSnapshot::BucketSaveCb, this));
+        table_locked_ = false;
+        db_slice_->UnlockForSerialization();
+      }
       cursor = next;
       PushSerializedToChannel(false);
 
-      if (stats_.loop_serialized >= last_yield + 100) {
+      if (stats_.loop_serialized >= last_yield + buckets_per_yield_) {
+        PaceIteration(cll);
         DVLOG(2) << "Before sleep " << ThisFiber::GetName();
         ThisFiber::Yield();
         DVLOG(2) << "After sleep";
+        last_yield_ns_ = absl::GetCurrentTimeNanos();
 
         last_yield = stats_.loop_serialized;
         // Push in case other fibers (writes commands that pushed previous values)
@@ -230,8 +364,54 @@ void SliceSnapshot::IterateBucketsFb(const Cancellation* cll, bool send_full_syn
   }
 
   // serialized + side_saved must be equal to the total saved.
-  VLOG(1) << "Exit SnapshotSerializer (loop_serialized/side_saved/cbcalls): "
-          << stats_.loop_serialized << "/" << stats_.side_saved << "/" << stats_.savecb_calls;
+  VLOG(1) << "Exit SnapshotSerializer (loop_serialized/side_saved/cbcalls/delta_skipped/"
+             "big_value_buckets): "
+          << stats_.loop_serialized << "/" << stats_.side_saved << "/" << stats_.savecb_calls
+          << "/" << stats_.delta_skipped << "/" << stats_.big_value_buckets;
+}
+
+void SliceSnapshot::PaceIteration(const Cancellation* cll) {
+  constexpr unsigned kMaxBucketsPerYield = 1000;
+
+  if (uint64_t budget_ns = absl::GetFlag(FLAGS_snapshot_latency_budget_usec) * 1000;
+      budget_ns > 0) {
+    uint64_t ran_ns = absl::GetCurrentTimeNanos() - last_yield_ns_;
+    if (ran_ns > budget_ns) {
+      // Yield more often first, compress faster only when yielding after every bucket is not
+      // enough.
+      if (buckets_per_yield_ > 1) {
+        buckets_per_yield_ /= 2;
+      } else if (compression_level_ > 1) {
+        serializer_->SetCompressionLevel(--compression_level_);
+      }
+    } else if (ran_ns < budget_ns / 2) {
+      if (compression_level_ < max_compression_level_) {
+        serializer_->SetCompressionLevel(++compression_level_);
+      } else if (buckets_per_yield_ < kMaxBucketsPerYield) {
+        buckets_per_yield_ *= 2;
+      }
+    }
+  }
+
+  // Full syncs share the bandwidth limit, pausing here keeps the channel from growing.
+  if (unthrottled_bytes_ > 0) {
+    uint64_t slept_ns = SyncBandwidthLimiter::Throttle(unthrottled_bytes_, cll);
+    stats_.throttled_ms += (slept_ns + 500'000) / 1'000'000;
+    unthrottled_bytes_ = 0;
+  }
+
+  uint64_t limit = absl::GetFlag(FLAGS_snapshot_memory_overhead_limit);
+  if (limit == 0)
+    return;
+
+  // Pushing blocks while the channel is full, and the channel drains at the speed of the sink.
+  PushSerializedToChannel(false);
+  while (!cll->IsCancelled() && dest_->GetSize() > 0 &&
+         serializer_->SerializedLen() + dest_->GetSize() > limit) {
+    ThisFiber::SleepFor(1ms);
+    ++stats_.throttled_ms;
+    PushSerializedToChannel(false);
+  }
 }
 
 bool SliceSnapshot::BucketSaveCb(PrimeIterator it) {
@@ -245,30 +425,65 @@ bool SliceSnapshot::BucketSaveCb(PrimeIterator it) {
     ++stats_.skipped;
     return false;
   }
+
+  if (!table_locked_ && HasBigValue(it)) {
+    big_value_skipped_ = true;
+    return false;
+  }
+
   db_slice_->FlushChangeToEarlierCallbacks(current_db_, DbSlice::Iterator::FromPrime(it),
                                            snapshot_version_);
 
-  stats_.loop_serialized += SerializeBucket(current_db_, it);
+  if (table_locked_)
+    ++stats_.big_value_buckets;
+  stats_.loop_serialized += SerializeBucket(current_db_, it, table_locked_);
+  return false;
+}
+
+bool SliceSnapshot::HasBigValue(PrimeTable::bucket_iterator it) const {
+  if (max_chunk_size_ == 0)
+    return false;
+
+  for (; !it.is_done(); ++it) {
+    const PrimeValue& pv = it->second;
+    unsigned obj_type = pv.ObjType();
+    bool is_container =
+        obj_type == OBJ_SET || obj_type == OBJ_HASH || obj_type == OBJ_ZSET || obj_type == OBJ_LIST;
+    if (is_container && !pv.IsExternal() && pv.MallocUsed() > max_chunk_size_)
+      return true;
+  }
   return false;
 }
 
-unsigned SliceSnapshot::SerializeBucket(DbIndex db_index, PrimeTable::bucket_iterator it) {
+unsigned SliceSnapshot::SerializeBucket(DbIndex db_index, PrimeTable::bucket_iterator it,
+                                        bool preemptible) {
   // Must be atomic because after after we call it.snapshot_version_ we're starting
   // to send incremental updates instead of serializing the whole bucket: We must not
   // send the update until the initial SerializeBucket is called.
   // Relying on the atomicity of SerializeBucket is Ok here because only one thread may handle this
-  // bucket.
-  FiberAtomicGuard fg;
+  // bucket. When the table is locked for serialization no other fiber modifies it, so we may
+  // preempt.
+  optional<FiberAtomicGuard> fg;
+  if (!preemptible)
+    fg.emplace();
   DCHECK_LT(it.GetVersion(), snapshot_version_);
 
+  uint64_t version = it.GetVersion();
+  it.SetVersion(snapshot_version_);
+
+  // The bucket is saved in the base snapshot already.
+  if (delta_base_version_ > 0 && version <= delta_base_version_) {
+    ++stats_.delta_skipped;
+    return 0;
+  }
+
   // traverse physical bucket and write it into string file.
   serialize_bucket_running_ = true;
-  it.SetVersion(snapshot_version_);
   unsigned result = 0;
 
   while (!it.is_done()) {
     ++result;
-    SerializeEntry(db_index, it->first, it->second, nullopt, serializer_.get());
+    SerializeEntry(db_index, it->first, it->second, nullopt, serializer_.get(), preemptible);
     ++it;
   }
   serialize_bucket_running_ = false;
@@ -276,38 +491,83 @@ unsigned SliceSnapshot::SerializeBucket(DbIndex db_index, PrimeTable::bucket_ite
 }
 
 // This function should not block and should not preempt because it's called
-// from SerializeBucket which should execute atomically.
+// from SerializeBucket which should execute atomically, unless preemptible is set.
 void SliceSnapshot::SerializeEntry(DbIndex db_indx, const PrimeKey& pk, const PrimeValue& pv,
-                                   optional<uint64_t> expire, RdbSerializer* serializer) {
+                                   optional<uint64_t> expire, RdbSerializer* serializer,
+                                   bool preemptible) {
   time_t expire_time = expire.value_or(0);
   if (!expire && pv.HasExpire()) {
     auto eit = db_array_[db_indx]->expire.Find(pk);
     expire_time = db_slice_->ExpireTime(eit);
   }
 
-  if (pv.IsExternal()) {
-    // We can't block, so we just schedule a tiered read and append it to the delayed entries
-    util::fb2::Future<PrimeValue> future;
+  if (pv.IsExternal() && !reference_tiered_) {
+    // We can't block, so we schedule a tiered read and queue the entry to be serialized once it
+    // completes. The value is decoded for serialization only and stays offloaded.
+    auto item = make_shared<TieredReads::Item>();
+    item->dbid = db_indx;
+    item->key = PrimeKey(pk.ToString());
+    item->expire = expire_time;
+    item->bytes = pv.Size();
+    tiered_reads_->queue.push_back(item);
+    tiered_reads_->pending_bytes += item->bytes;
+
     EngineShard::tlocal()->tiered_storage()->Read(
         db_indx, pk.ToString(), pv,
-        [future](const std::string& v) mutable { future.Resolve(PrimeValue(v)); });
-    delayed_entries_.push_back({db_indx, PrimeKey(pk.ToString()), std::move(future), expire_time});
-    ++type_freq_map_[RDB_TYPE_STRING];
+        [reads = tiered_reads_, item, type = pv.ObjType(),
+         encoding = pv.Encoding()](const std::string& v) {
+          item->value = TieredStorage::DecodeValue(type, encoding, v);
+          reads->ready_ec.notify();
+        });
   } else {
+    if (preemptible) {
+      DCHECK_EQ(serializer, serializer_.get());
+      serializer->SetFlushFragmentCb([this] { PushSerializedToChannel(true); });
+    }
     io::Result<uint8_t> res = serializer->SaveEntry(pk, pv, expire_time, db_indx);
+    if (preemptible)
+      serializer->SetFlushFragmentCb(nullptr);
     CHECK(res);
     ++type_freq_map_[*res];
   }
 }
 
-bool SliceSnapshot::PushSerializedToChannel(bool force) {
-  // Bucket serialization might have accumulated some delayed values.
-  // Because we can finally block in this function, we'll await and serialize them
-  while (!delayed_entries_.empty()) {
-    auto& entry = delayed_entries_.back();
-    serializer_->SaveEntry(entry.key, entry.value.Get(), entry.expire, entry.dbid);
-    delayed_entries_.pop_back();
+void SliceSnapshot::SerializeTieredReads(bool wait_all) {
+  auto& reads = *tiered_reads_;
+  auto front_ready = [&reads] {
+    return reads.queue.empty() || reads.queue.front()->journal_entry || reads.queue.front()->value;
+  };
+
+  while (!reads.queue.empty()) {
+    if (!front_ready()) {
+      if (!wait_all && reads.pending_bytes <= tiered_read_limit_)
+        return;
+      reads.ready_ec.await(front_ready);
+      continue;
+    }
+
+    // Keep the item alive, SaveEntry can preempt and push more items
+    shared_ptr<TieredReads::Item> item = std::move(reads.queue.front());
+    reads.queue.pop_front();
+
+    if (item->journal_entry) {
+      serializer_->WriteJournalEntry(*item->journal_entry);
+      continue;
+    }
+
+    reads.pending_bytes -= item->bytes;
+    io::Result<uint8_t> res =
+        serializer_->SaveEntry(item->key, *item->value, item->expire, item->dbid);
+    CHECK(res);
+    ++type_freq_map_[*res];
   }
+}
+
+bool SliceSnapshot::PushSerializedToChannel(bool force) {
+  // Bucket serialization might have queued tiered reads. Serialize the completed ones, unless
+  // called while an entry is serialized in parts.
+  if (!serialize_bucket_running_)
+    SerializeTieredReads(force);
 
   if (!force && serializer_->SerializedLen() < 4096)
     return false;
@@ -324,6 +584,8 @@ bool SliceSnapshot::PushSerializedToChannel(bool force) {
   DbRecord db_rec{.id = id, .value = std::move(sfile.val)};
 
   dest_->Push(std::move(db_rec));
+  if (throttle_bandwidth_)
+    unthrottled_bytes_ += serialized;
 
   VLOG(2) << "PushSerializedToChannel " << serialized << " bytes";
   return true;
@@ -360,7 +622,12 @@ void SliceSnapshot::OnJournalEntry(const journal::JournalItem& item, bool await)
   // TriggerJournalWriteToSink. This call uses the NOOP opcode with await=true. Since there is no
   // additional journal change to serialize, it simply invokes PushSerializedToChannel.
   if (item.opcode != journal::Op::NOOP) {
-    serializer_->WriteJournalEntry(item.data);
+    // Entries written while tiered reads are pending might belong to their keys, so they are
+    // queued behind them.
+    if (tiered_reads_->queue.empty())
+      serializer_->WriteJournalEntry(*item.data);
+    else
+      tiered_reads_->queue.push_back(make_shared<TieredReads::Item>())->journal_entry = item.data;
   }
 
   if (await) {
@@ -400,7 +667,11 @@ size_t SliceSnapshot::GetTempBuffersSize() const {
 }
 
 RdbSaver::SnapshotStats SliceSnapshot::GetCurrentSnapshotProgress() const {
-  return {stats_.loop_serialized + stats_.side_saved, stats_.keys_total};
+  return {.current_keys = stats_.loop_serialized + stats_.side_saved,
+          .total_keys = stats_.keys_total,
+          .throttled_ms = stats_.throttled_ms,
+          .buckets_per_yield = buckets_per_yield_,
+          .compression_level = unsigned(compression_level_)};
 }
 
 }  // namespace dfly
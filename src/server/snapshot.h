@@ -6,6 +6,8 @@
 
 #include <atomic>
 #include <bitset>
+#include <deque>
+#include <optional>
 
 #include "base/pod_array.h"
 #include "core/size_tracking_channel.h"
@@ -13,7 +15,7 @@
 #include "server/db_slice.h"
 #include "server/rdb_save.h"
 #include "server/table.h"
-#include "util/fibers/future.h"
+#include "util/fibers/synchronization.h"
 
 namespace dfly {
 
@@ -58,7 +60,9 @@ class SliceSnapshot {
 
   using RecordChannel = SizeTrackingChannel<DbRecord, base::mpmc_bounded_queue<DbRecord>>;
 
-  SliceSnapshot(DbSlice* slice, RecordChannel* dest, CompressionMode compression_mode);
+  // With native_encoding, listpacks are saved as they are, see RdbSerializer::SetNativeEncoding.
+  SliceSnapshot(DbSlice* slice, RecordChannel* dest, CompressionMode compression_mode,
+                bool native_encoding = false);
   ~SliceSnapshot();
 
   static size_t GetThreadLocalMemoryUsage();
@@ -66,7 +70,9 @@ class SliceSnapshot {
 
   // Initialize snapshot, start bucket iteration fiber, register listeners.
   // In journal streaming mode it needs to be stopped by either Stop or Cancel.
-  void Start(bool stream_journal, const Cancellation* cll);
+  // A delta snapshot writes the deletion markers first and skips the unchanged buckets.
+  void Start(bool stream_journal, const Cancellation* cll,
+             DeltaMode delta_mode = DeltaMode::NONE);
 
   // Initialize a snapshot that sends only the missing journal updates
   // since start_lsn and then registers a callback switches into the
@@ -91,16 +97,29 @@ class SliceSnapshot {
   // and submits them to SerializeBucket.
   void IterateBucketsFb(const Cancellation* cll, bool send_full_sync_cut);
 
+  // Called by IterateBucketsFb before yielding. Adapts the buckets serialized between yields and
+  // the compression level to the latency budget, pauses full syncs for the sync bandwidth limit
+  // and waits while the serialized data that was not written yet exceeds the memory overhead
+  // limit.
+  void PaceIteration(const Cancellation* cll);
+
   // Called on traversing cursor by IterateBucketsFb.
   bool BucketSaveCb(PrimeIterator it);
 
+  // Whether the bucket holds a value that is saved in parts, see serialization_max_chunk_size.
+  bool HasBigValue(PrimeTable::bucket_iterator bucket_it) const;
+
   // Serialize single bucket.
   // Returns number of serialized entries, updates bucket version to snapshot version.
-  unsigned SerializeBucket(DbIndex db_index, PrimeTable::bucket_iterator bucket_it);
+  // Preemptible only while the table is locked for serialization, it saves big values in parts
+  // then.
+  unsigned SerializeBucket(DbIndex db_index, PrimeTable::bucket_iterator bucket_it,
+                           bool preemptible = false);
 
   // Serialize entry into passed serializer.
   void SerializeEntry(DbIndex db_index, const PrimeKey& pk, const PrimeValue& pv,
-                      std::optional<uint64_t> expire, RdbSerializer* serializer);
+                      std::optional<uint64_t> expire, RdbSerializer* serializer,
+                      bool preemptible = false);
 
   // DbChange listener
   void OnDbChange(DbIndex db_index, const DbSlice::ChangeReq& req);
@@ -116,6 +135,10 @@ class SliceSnapshot {
   // Return if pushed.
   bool PushSerializedToChannel(bool force);
 
+  // Serialize the queued items whose reads completed, in order, see TieredReads. Waits for reads
+  // while more than snapshot_tiered_read_limit bytes are pending, or for all of them if wait_all.
+  void SerializeTieredReads(bool wait_all);
+
  public:
   uint64_t snapshot_version() const {
     return snapshot_version_;
@@ -133,12 +156,23 @@ class SliceSnapshot {
   RdbSaver::SnapshotStats GetCurrentSnapshotProgress() const;
 
  private:
-  // An entry whose value must be awaited
-  struct DelayedEntry {
-    DbIndex dbid;
-    CompactObj key;
-    util::fb2::Future<PrimeValue> value;
-    time_t expire;
+  // Offloaded values are read while the iteration continues. Journal entries written while reads
+  // are pending are queued behind them, so that they follow the values of their keys. Items are
+  // serialized in order once their reads complete. Shared with the read callbacks, which may
+  // complete after the snapshot is cancelled.
+  struct TieredReads {
+    struct Item {
+      DbIndex dbid = 0;
+      CompactObj key;
+      time_t expire = 0;
+      size_t bytes = 0;                 // size of the value
+      std::optional<PrimeValue> value;  // set once read
+      std::shared_ptr<const std::string> journal_entry;
+    };
+
+    std::deque<std::shared_ptr<Item>> queue;
+    size_t pending_bytes = 0;  // of the values in the queue
+    util::fb2::EventCount ready_ec;
   };
 
   DbSlice* db_slice_;
@@ -150,17 +184,38 @@ class SliceSnapshot {
   DbIndex current_db_;
 
   std::unique_ptr<RdbSerializer> serializer_;
-  std::vector<DelayedEntry> delayed_entries_;  // collected during atomic bucket traversal
+  std::shared_ptr<TieredReads> tiered_reads_;
+  size_t tiered_read_limit_ = 0;  // see snapshot_tiered_read_limit
+  bool reference_tiered_ = false;  // offloaded values are saved as references to kept files
 
   // Used for sanity checks.
   bool serialize_bucket_running_ = false;
   util::fb2::Fiber snapshot_fb_;  // IterateEntriesFb
 
   CompressionMode compression_mode_;
+  bool native_encoding_;
   RdbTypeFreqMap type_freq_map_;
 
   // version upper bound for entries that should be saved (not included).
   uint64_t snapshot_version_ = 0;
+
+  // Delta snapshots skip buckets with versions up to the base version (included).
+  uint64_t delta_base_version_ = 0;
+
+  // Buckets with big values are skipped by the first traversal of a cursor and saved by a
+  // second one, while the table is locked for serialization.
+  size_t max_chunk_size_ = 0;
+  bool big_value_skipped_ = false;
+  bool table_locked_ = false;
+
+  // Pacing state, see PaceIteration.
+  unsigned buckets_per_yield_ = 100;
+  int compression_level_ = 0;  // zero if the level can not be changed
+  int max_compression_level_ = 0;
+  uint64_t last_yield_ns_ = 0;
+  bool throttle_bandwidth_ = false;  // full syncs are limited by SyncBandwidthLimiter
+  size_t unthrottled_bytes_ = 0;     // pushed since the last pause
+
   uint32_t journal_cb_id_ = 0;
   uint64_t rec_id_ = 0;
 
@@ -170,6 +225,9 @@ class SliceSnapshot {
     size_t side_saved = 0;
     size_t savecb_calls = 0;
     size_t keys_total = 0;
+    size_t delta_skipped = 0;  // buckets unchanged since the delta base
+    size_t big_value_buckets = 0;  // buckets saved while the table was locked
+    size_t throttled_ms = 0;       // waiting for the memory or the bandwidth limit
   } stats_;
 };
 
@@ -794,6 +794,46 @@ stream* GetReadOnlyStream(const CompactObj& cobj) {
   return const_cast<stream*>((const stream*)cobj.RObjPtr());
 }
 
+// Records read by the last woken XREAD of the thread. The key's bucket version changes with every
+// update of the key, so the records are valid while it stays the same.
+struct WokenReadCache {
+  DbIndex db_index = 0;
+  string key;
+  streamID start;
+  uint64_t version = 0;
+  shared_ptr<const RecordVec> records;
+};
+
+thread_local WokenReadCache tl_woken_read;
+
+// Reads entries for a woken XREAD that is not part of a consumer group. Readers woken by the same
+// XADD usually wait at the same id, so they share the records instead of each walking the stream.
+OpResult<shared_ptr<const RecordVec>> OpReadWoken(const OpArgs& op_args, string_view key,
+                                                  const RangeOpts& opts) {
+  DCHECK(opts.group == nullptr);
+  auto res_it = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key, OBJ_STREAM);
+  if (!res_it)
+    return res_it.status();
+
+  WokenReadCache& cache = tl_woken_read;
+  uint64_t version = res_it->GetVersion();
+  if (cache.records && cache.version == version && cache.db_index == op_args.db_cntx.db_index &&
+      cache.key == key && streamCompareID(&cache.start, &opts.start.val) == 0) {
+    return cache.records;
+  }
+
+  OpResult<RecordVec> result = OpRange(op_args, key, opts);
+  if (!result)
+    return result.status();
+
+  cache.db_index = op_args.db_cntx.db_index;
+  cache.key = key;
+  cache.start = opts.start.val;
+  cache.version = version;
+  cache.records = make_shared<const RecordVec>(std::move(*result));
+  return cache.records;
+}
+
 }  // namespace
 
 // Returns a map of stream to the ID of the last entry in the stream. Any
@@ -1565,6 +1605,61 @@ OpResult<uint32_t> OpAck(const OpArgs& op_args, string_view key, string_view gna
   return acknowledged;
 }
 
+// Forward cursor over the entries of a stream. Checks an ascending sequence of ids against the
+// stream in a single pass, instead of seeking the stream from its root for every id.
+class StreamEntryCursor {
+ public:
+  StreamEntryCursor(stream* s, streamID start) {
+    streamIteratorStart(&it_, s, &start, nullptr, 0);
+  }
+
+  ~StreamEntryCursor() {
+    streamIteratorStop(&it_);
+  }
+
+  // Position the cursor at the entry with the given id. Ids must be passed in ascending order.
+  // Returns false if the stream has no such entry.
+  bool Seek(streamID id) {
+    while (valid_ && (!started_ || streamCompareID(&cur_, &id) < 0)) {
+      SkipFields();
+      valid_ = streamIteratorGetID(&it_, &cur_, &numfields_);
+      started_ = true;
+    }
+    return valid_ && streamCompareID(&cur_, &id) == 0;
+  }
+
+  // Read the entry the cursor is positioned at after a successful Seek.
+  Record ReadRecord() {
+    Record rec;
+    rec.id = cur_;
+    rec.kv_arr.reserve(numfields_);
+    for (; numfields_ > 0; numfields_--) {
+      unsigned char *key, *value;
+      int64_t key_len, value_len;
+      streamIteratorGetField(&it_, &key, &value, &key_len, &value_len);
+      rec.kv_arr.emplace_back(string(reinterpret_cast<char*>(key), key_len),
+                              string(reinterpret_cast<char*>(value), value_len));
+    }
+    return rec;
+  }
+
+ private:
+  // The iterator can advance only after all fields of the current entry were consumed.
+  void SkipFields() {
+    for (; numfields_ > 0; numfields_--) {
+      unsigned char *key, *value;
+      int64_t key_len, value_len;
+      streamIteratorGetField(&it_, &key, &value, &key_len, &value_len);
+    }
+  }
+
+  streamIterator it_;
+  streamID cur_;
+  int64_t numfields_ = 0;  // fields of the current entry not consumed yet
+  bool started_ = false;
+  bool valid_ = true;
+};
+
 OpResult<ClaimInfo> OpAutoClaim(const OpArgs& op_args, string_view key, const ClaimOpts& opts) {
   auto cgr_res = FindGroup(op_args, key, opts.group);
   if (!cgr_res)
@@ -1593,6 +1688,9 @@ OpResult<ClaimInfo> OpAutoClaim(const OpArgs& op_args, string_view key, const Cl
   ClaimInfo result;
   result.justid = (opts.flags & kClaimJustID);
 
+  // The PEL is scanned in id order, so entries are looked up with a single cursor over the stream.
+  StreamEntryCursor cursor(stream, start_id);
+
   auto now = GetCurrentTimeMs();
   int count = opts.count;
   while (attempts-- && count && raxNext(&ri)) {
@@ -1601,7 +1699,7 @@ OpResult<ClaimInfo> OpAutoClaim(const OpArgs& op_args, string_view key, const Cl
     streamID id;
     streamDecodeID(ri.key, &id);
 
-    if (!streamEntryExists(stream, &id)) {
+    if (!cursor.Seek(id)) {
       raxRemove(group->pel, ri.key, ri.key_len, nullptr);
       raxRemove(nack->consumer->pel, ri.key, ri.key_len, nullptr);
       streamFreeNACK(nack);
@@ -1616,9 +1714,9 @@ OpResult<ClaimInfo> OpAutoClaim(const OpArgs& op_args, string_view key, const Cl
         continue;
     }
 
-    op_args.shard->tmp_str1 =
-        sdscpylen(op_args.shard->tmp_str1, opts.consumer.data(), opts.consumer.size());
     if (consumer == nullptr) {
+      op_args.shard->tmp_str1 =
+          sdscpylen(op_args.shard->tmp_str1, opts.consumer.data(), opts.consumer.size());
       consumer = streamLookupConsumer(group, op_args.shard->tmp_str1, SLC_DEFAULT);
       if (consumer == nullptr) {
         consumer = streamCreateConsumer(group, op_args.shard->tmp_str1, nullptr, 0, SCC_DEFAULT);
@@ -1641,7 +1739,11 @@ OpResult<ClaimInfo> OpAutoClaim(const OpArgs& op_args, string_view key, const Cl
       nack->consumer = consumer;
     }
 
-    AppendClaimResultItem(result, stream, id);
+    if (result.justid) {
+      result.ids.push_back(id);
+    } else {
+      result.records.push_back(cursor.ReadRecord());
+    }
     count--;
   }
 
@@ -2926,7 +3028,7 @@ void XReadBlock(ReadOpts* opts, ConnectionContext* cntx) {
   // Resolve the entry in the woken key. Note this must not use OpRead since
   // only the shard that contains the woken key blocks for the awoken
   // transaction to proceed.
-  OpResult<RecordVec> result;
+  OpResult<shared_ptr<const RecordVec>> result;
   std::string key;
   auto range_cb = [&](Transaction* t, EngineShard* shard) {
     if (auto wake_key = t->GetWakeKey(shard->shard_id()); wake_key) {
@@ -2946,7 +3048,15 @@ void XReadBlock(ReadOpts* opts, ConnectionContext* cntx) {
       range_opts.consumer = sitem.consumer;
       range_opts.noack = opts->noack;
 
-      result = OpRange(t->GetOpArgs(shard), *wake_key, range_opts);
+      if (range_opts.group) {
+        OpResult<RecordVec> records = OpRange(t->GetOpArgs(shard), *wake_key, range_opts);
+        if (records)
+          result = make_shared<const RecordVec>(std::move(*records));
+        else
+          result = records.status();
+      } else {
+        result = OpReadWoken(t->GetOpArgs(shard), *wake_key, range_opts);
+      }
       key = *wake_key;
     }
     return OpStatus::OK;
@@ -2954,9 +3064,13 @@ void XReadBlock(ReadOpts* opts, ConnectionContext* cntx) {
   cntx->transaction->Execute(std::move(range_cb), true);
 
   if (result) {
+    absl::Span<const Record> records;
+    if (*result)
+      records = **result;
+
     SinkReplyBuilder::ReplyAggregator agg(cntx->reply_builder());
     rb->StartArray(1);
-    StreamReplies{cntx->reply_builder()}.SendStreamRecords(key, *result);
+    StreamReplies{cntx->reply_builder()}.SendStreamRecords(key, records);
   } else {
     return rb->SendNullArray();
   }
@@ -309,6 +309,44 @@ TEST_F(StreamFamilyTest, XReadBlock) {
   EXPECT_THAT(resp1.GetVec(), ElementsAre("foo", ArrLen(1)));
 }
 
+TEST_F(StreamFamilyTest, XReadBlockFanOut) {
+  Run({"xadd", "foo", "1-1", "k1", "v1"});
+
+  // Readers waiting at the same id are woken together and share the new entries
+  const unsigned kNumReaders = 8;
+  vector<RespExpr> resps(kNumReaders);
+  vector<fb2::Fiber> fibers;
+  for (unsigned i = 0; i < kNumReaders; i++) {
+    fibers.push_back(pp_->at(i % pp_->size())->LaunchFiber(Launch::dispatch, [&, i] {
+      resps[i] = Run(absl::StrCat("reader", i), {"xread", "block", "0", "streams", "foo", "$"});
+    }));
+  }
+  ThisFiber::SleepFor(50us);
+
+  pp_->at(0)->Await([&] { return Run("writer", {"xadd", "foo", "1-2", "k2", "v2"}); });
+  for (auto& fb : fibers)
+    fb.Join();
+
+  for (const auto& resp : resps) {
+    ASSERT_THAT(resp.GetVec(), ElementsAre("foo", ArrLen(1)));
+    auto record = resp.GetVec()[1].GetVec()[0].GetVec();
+    EXPECT_EQ(record[0], "1-2");
+    EXPECT_THAT(record[1].GetVec(), ElementsAre("k2", "v2"));
+  }
+
+  // Next readers wait at a later id and get the new entries only
+  auto fb = pp_->at(1)->LaunchFiber(Launch::dispatch, [&] {
+    resps[0] = Run("reader0", {"xread", "block", "0", "streams", "foo", "$"});
+  });
+  ThisFiber::SleepFor(50us);
+  pp_->at(0)->Await([&] { return Run("writer", {"xadd", "foo", "1-3", "k3", "v3"}); });
+  fb.Join();
+  ASSERT_THAT(resps[0].GetVec(), ElementsAre("foo", ArrLen(1)));
+  auto record = resps[0].GetVec()[1].GetVec()[0].GetVec();
+  EXPECT_EQ(record[0], "1-3");
+  EXPECT_THAT(record[1].GetVec(), ElementsAre("k3", "v3"));
+}
+
 TEST_F(StreamFamilyTest, XReadGroupBlockwithoutBlock) {
   Run({"xadd", "foo", "1-*", "k1", "v1"});
   Run({"xadd", "foo", "1-*", "k2", "v2"});
@@ -916,6 +954,39 @@ TEST_F(StreamFamilyTest, XAutoClaim) {
                                   RespArray(ElementsAre("1-2", "1-4")))));
 }
 
+TEST_F(StreamFamilyTest, XAutoClaimManyNodes) {
+  // Span several listpack nodes and delete every third entry.
+  for (unsigned i = 1; i <= 300; i++) {
+    string id = absl::StrCat(i, "-0");
+    Run({"xadd", "foo", id, "k", absl::StrCat("v", i)});
+  }
+  Run({"xgroup", "create", "foo", "group", "0"});
+  Run({"xreadgroup", "group", "group", "alice", "streams", "foo", ">"});
+  for (unsigned i = 3; i <= 300; i += 3) {
+    Run({"xdel", "foo", absl::StrCat(i, "-0")});
+  }
+
+  auto resp = Run({"xautoclaim", "foo", "group", "bob", "0", "100-0", "count", "20"});
+  ASSERT_THAT(resp, ArrLen(3));
+  const auto& vec = resp.GetVec();
+  EXPECT_EQ(vec[0], "129-0");
+
+  auto claimed = vec[1].GetVec();
+  ASSERT_EQ(claimed.size(), 20u);
+  EXPECT_THAT(claimed[0], RespArray(ElementsAre("100-0", RespArray(ElementsAre("k", "v100")))));
+  EXPECT_THAT(claimed[1], RespArray(ElementsAre("101-0", RespArray(ElementsAre("k", "v101")))));
+  EXPECT_THAT(claimed[19], RespArray(ElementsAre("128-0", RespArray(ElementsAre("k", "v128")))));
+
+  auto deleted = vec[2].GetVec();
+  ASSERT_EQ(deleted.size(), 9u);
+  EXPECT_EQ(deleted[0], "102-0");
+  EXPECT_EQ(deleted[8], "126-0");
+
+  // Deleted entries are gone from the PEL
+  resp = Run({"xpending", "foo", "group"});
+  EXPECT_THAT(resp.GetVec()[0], IntArg(291));
+}
+
 TEST_F(StreamFamilyTest, XInfoStream) {
   Run({"del", "mystream"});
   Run({"xgroup", "create", "mystream", "mygroup", "$", "MKSTREAM"});
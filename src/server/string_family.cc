@@ -4,6 +4,7 @@
 
 #include "server/string_family.h"
 
+#include <absl/container/flat_hash_map.h>
 #include <absl/container/inlined_vector.h>
 #include <absl/strings/match.h>
 
@@ -29,11 +30,33 @@
 #include "server/engine_shard_set.h"
 #include "server/error.h"
 #include "server/journal/journal.h"
+#include "server/server_state.h"
 #include "server/table.h"
 #include "server/tiered_storage.h"
 #include "server/transaction.h"
 #include "util/fibers/future.h"
 
+ABSL_FLAG(uint32_t, get_zero_copy_min_size, 0,
+          "If positive, GET sends values of at least this size directly from the table "
+          "while the key stays locked, instead of copying them first. "
+          "Adds an unlocking hop to every GET.");
+
+ABSL_FLAG(bool, coalesce_gets, false,
+          "If true, a GET that arrives while an identical GET from the same thread has not read "
+          "its key yet waits for that read and shares its result instead of taking its own hop. "
+          "Coalesced reads do not use get_zero_copy_min_size.");
+
+ABSL_FLAG(uint64_t, hot_key_cache_bytes, 0,
+          "If positive, every thread caches the values of hot keys read by GET up to this many "
+          "bytes, so that their reads are served without a hop to the shard. Keys are hot once "
+          "they were read hot_key_min_reads times, requires --enable_top_keys_tracking.");
+
+ABSL_FLAG(uint64_t, hot_key_min_reads, 1000,
+          "Estimated number of reads after which a key is cached by the hot key cache");
+
+ABSL_FLAG(uint32_t, hot_key_cache_max_value, 1024,
+          "Values larger than this are not cached by the hot key cache");
+
 namespace dfly {
 
 namespace {
@@ -45,6 +68,17 @@ using CI = CommandId;
 
 constexpr uint32_t kMaxStrLen = 1 << 28;
 
+// Strings of at least this size are stored as is by APPEND and SETRANGE, so that the following
+// calls modify them in place instead of copying them whole.
+constexpr size_t kMinInPlaceStrLen = 4096;
+
+void SetModifiedString(string_view value, PrimeValue* pv) {
+  if (value.size() >= kMinInPlaceStrLen)
+    pv->SetRawString(value);
+  else
+    pv->SetCompressedString(value);
+}
+
 void CopyValueToBuffer(const PrimeValue& pv, char* dest) {
   DCHECK_EQ(pv.ObjType(), OBJ_STRING);
   DCHECK(!pv.IsExternal());
@@ -88,25 +122,30 @@ OpResult<uint32_t> OpSetRange(const OpArgs& op_args, string_view key, size_t sta
   RETURN_ON_BAD_STATUS(op_res);
   auto& res = *op_res;
 
+  PrimeValue& pv = res.it->second;
   string s;
 
   if (res.is_new) {
     s.resize(range_len);
   } else {
-    if (res.it->second.ObjType() != OBJ_STRING)
+    if (pv.ObjType() != OBJ_STRING)
       return OpStatus::WRONG_TYPE;
 
-    s = GetString(res.it->second);
+    if (pv.SetRawRange(start, value))
+      return pv.Size();
+
+    s = GetString(pv);
     if (s.size() < range_len)
       s.resize(range_len);
   }
 
   memcpy(s.data() + start, value.data(), value.size());
-  res.it->second.SetString(s);
-  return res.it->second.Size();
+  SetModifiedString(s, &pv);
+  return pv.Size();
 }
 
-OpResult<string> OpGetRange(const OpArgs& op_args, string_view key, int32_t start, int32_t end) {
+OpResult<StringValue> OpGetRange(const OpArgs& op_args, string_view key, int32_t start,
+                                 int32_t end) {
   auto& db_slice = op_args.shard->db_slice();
   auto it_res = db_slice.FindReadOnly(op_args.db_cntx, key, OBJ_STRING);
   if (!it_res.ok())
@@ -132,22 +171,32 @@ OpResult<string> OpGetRange(const OpArgs& op_args, string_view key, int32_t star
   if (size_t(end) >= strlen)
     end = strlen - 1;
 
+  size_t len = end - start + 1;
+  if (co.IsExternal()) {
+    return StringValue{op_args.shard->tiered_storage()->ReadRange(op_args.db_cntx.db_index, key,
+                                                                  co, start, len)};
+  }
+
   string tmp;
   string_view slice = co.GetSlice(&tmp);
 
-  return string(slice.substr(start, end - start + 1));
+  return StringValue{string(slice.substr(start, len))};
 };
 
 size_t ExtendExisting(DbSlice::Iterator it, string_view key, string_view val, bool prepend) {
+  PrimeValue& pv = it->second;
+  if (!prepend && pv.SetRawRange(pv.Size(), val))
+    return pv.Size();
+
   string tmp, new_val;
-  string_view slice = it->second.GetSlice(&tmp);
+  string_view slice = pv.GetSlice(&tmp);
 
   if (prepend)
     new_val = absl::StrCat(val, slice);
   else
     new_val = absl::StrCat(slice, val);
 
-  it->second.SetString(new_val);
+  SetModifiedString(new_val, &pv);
 
   return new_val.size();
 }
@@ -248,6 +297,27 @@ OpResult<int64_t> OpIncrBy(const OpArgs& op_args, string_view key, int64_t incr,
   return new_val;
 }
 
+// Replies with the result of OpIncrBy.
+void SendIncrResult(const OpResult<int64_t>& result, SinkReplyBuilder* builder) {
+  switch (result.status()) {
+    case OpStatus::OK:
+      builder->SendLong(result.value());
+      break;
+    case OpStatus::INVALID_VALUE:
+      builder->SendError(kInvalidIntErr);
+      break;
+    case OpStatus::OUT_OF_RANGE:
+      builder->SendError(kIncrOverflow);
+      break;
+    case OpStatus::KEY_NOTFOUND:  // Relevant only for MC
+      reinterpret_cast<MCReplyBuilder*>(builder)->SendNotFound();
+      break;
+    default:
+      reinterpret_cast<RedisReplyBuilder*>(builder)->SendError(result.status());
+      break;
+  }
+}
+
 int64_t AbsExpiryToTtl(int64_t abs_expiry_time, bool as_milli) {
   using std::chrono::duration_cast;
   using std::chrono::milliseconds;
@@ -302,12 +372,24 @@ OpStatus OpMSet(const OpArgs& op_args, const ShardArgs& args) {
   return result;
 }
 
-// emission_interval_ms assumed to be positive
-// limit is assumed to be positive
-OpResult<array<int64_t, 5>> OpThrottle(const OpArgs& op_args, const string_view key,
-                                       const int64_t limit, const int64_t emission_interval_ms,
-                                       const uint64_t quantity) {
+struct ThrottleParams {
+  enum Mode { GCRA, WINDOW };
+
+  Mode mode = GCRA;
+  int64_t limit = 0;                 // positive
+  int64_t emission_interval_ms = 0;  // positive
+  uint64_t quantity = 1;
+};
+
+using ThrottleResult = OpResult<array<int64_t, 5>>;
+
+// Generic cell rate algorithm, the key holds the theoretical arrival time.
+ThrottleResult OpThrottleGcra(const OpArgs& op_args, const string_view key,
+                              const ThrottleParams& params) {
   auto& db_slice = op_args.shard->db_slice();
+  const int64_t limit = params.limit;
+  const int64_t emission_interval_ms = params.emission_interval_ms;
+  const uint64_t quantity = params.quantity;
 
   if (emission_interval_ms > INT64_MAX / limit) {
     return OpStatus::INVALID_INT;
@@ -388,7 +470,7 @@ OpResult<array<int64_t, 5>> OpThrottle(const OpArgs& op_args, const string_view
   if (!limited) {
     if (IsValid(res.it)) {
       if (IsValid(res.exp_it)) {
-        res.exp_it->second = db_slice.FromAbsoluteTime(new_tat_ms);
+        db_slice.SetExpireTime(op_args.db_cntx.db_index, res.exp_it, new_tat_ms);
       } else {
         db_slice.AddExpire(op_args.db_cntx.db_index, res.it, new_tat_ms);
       }
@@ -408,8 +490,199 @@ OpResult<array<int64_t, 5>> OpThrottle(const OpArgs& op_args, const string_view
   return array<int64_t, 5>{limited ? 1 : 0, limit, remaining, retry_after_ms, reset_after_ms};
 }
 
+// Fixed window approximation of GCRA with the same limits: at most limit units per window of
+// limit * emission_interval_ms, which starts with the first request and ends when the key
+// expires. The key holds the used units as an integer, so a check costs a single lookup and
+// no arithmetic on timestamps, but a client can get up to twice the limit around the end of
+// a window.
+ThrottleResult OpThrottleWindow(const OpArgs& op_args, const string_view key,
+                                const ThrottleParams& params) {
+  auto& db_slice = op_args.shard->db_slice();
+  const int64_t limit = params.limit;
+
+  if (params.emission_interval_ms > INT64_MAX / limit) {
+    return OpStatus::INVALID_INT;
+  }
+  const int64_t window_ms = params.emission_interval_ms * limit;
+  const int64_t now_ms = op_args.db_cntx.time_now_ms;
+  if (now_ms > INT64_MAX - window_ms) {
+    return OpStatus::INVALID_INT;
+  }
+
+  auto res = db_slice.FindMutable(op_args.db_cntx, key);
+  int64_t used = 0;
+  int64_t reset_at_ms = now_ms + window_ms;
+  if (IsValid(res.it)) {
+    if (res.it->second.ObjType() != OBJ_STRING) {
+      return OpStatus::WRONG_TYPE;
+    }
+
+    auto opt_used = res.it->second.TryGetInt();
+    if (!opt_used || *opt_used < 0) {
+      return OpStatus::INVALID_VALUE;
+    }
+    used = min(*opt_used, limit);
+    if (IsValid(res.exp_it)) {
+      reset_at_ms = db_slice.ExpireTime(res.exp_it);
+    }
+  }
+
+  const bool limited = params.quantity > static_cast<uint64_t>(limit - used);
+  int64_t retry_after_ms = -1000;
+  int64_t reset_after_ms = 0;
+  if (limited) {
+    // A request larger than the limit can never succeed.
+    if (params.quantity <= static_cast<uint64_t>(limit)) {
+      retry_after_ms = reset_at_ms - now_ms;
+    }
+    if (IsValid(res.it)) {
+      reset_after_ms = reset_at_ms - now_ms;
+    }
+  } else {
+    used += params.quantity;
+    reset_after_ms = reset_at_ms - now_ms;
+    if (IsValid(res.it)) {
+      if (!IsValid(res.exp_it)) {
+        db_slice.AddExpire(op_args.db_cntx.db_index, res.it, reset_at_ms);
+      }
+      res.it->second.SetInt(used);
+    } else {
+      CompactObj cobj;
+      cobj.SetInt(used);
+
+      auto res = db_slice.AddNew(op_args.db_cntx, key, std::move(cobj), reset_at_ms);
+      if (!res) {
+        return res.status();
+      }
+    }
+  }
+
+  return array<int64_t, 5>{limited ? 1 : 0, limit, limit - used, retry_after_ms, reset_after_ms};
+}
+
+ThrottleResult OpThrottle(const OpArgs& op_args, const string_view key,
+                          const ThrottleParams& params) {
+  return params.mode == ThrottleParams::WINDOW ? OpThrottleWindow(op_args, key, params)
+                                               : OpThrottleGcra(op_args, key, params);
+}
+
+// Throttles the keys of the shard in order. mode_and_params are the arguments of CL.MTHROTTLE
+// before the keys, which are replicated with the keys of the shard.
+vector<ThrottleResult> OpMThrottle(const OpArgs& op_args, const ShardArgs& keys,
+                                   const ThrottleParams& params, CmdArgList mode_and_params) {
+  vector<ThrottleResult> results;
+  results.reserve(keys.Size());
+  for (string_view key : keys)
+    results.push_back(OpThrottle(op_args, key, params));
+
+  if (op_args.shard->journal()) {
+    vector<string_view> journal_args;
+    journal_args.reserve(mode_and_params.size() + keys.Size());
+    for (size_t i = 0; i < mode_and_params.size(); ++i)
+      journal_args.push_back(ArgS(mode_and_params, i));
+    journal_args.insert(journal_args.end(), keys.begin(), keys.end());
+    RecordJournal(op_args, "CL.MTHROTTLE", journal_args, op_args.tx->GetUniqueShardCnt());
+  }
+  return results;
+}
+
+// Parses <max_burst> <count per period> <period> [<quantity>] of CL.THROTTLE.
+// Returns the error to reply with on failure.
+optional<string_view> ParseThrottleParams(CmdArgList args, ThrottleParams* params) {
+  // Allow max burst in number of tokens
+  uint64_t max_burst;
+  if (!absl::SimpleAtoi(ArgS(args, 0), &max_burst)) {
+    return kInvalidIntErr;
+  }
+
+  // Emit count of tokens per period
+  uint64_t count;
+  if (!absl::SimpleAtoi(ArgS(args, 1), &count)) {
+    return kInvalidIntErr;
+  }
+
+  // Period of emitting count of tokens
+  uint64_t period;
+  if (!absl::SimpleAtoi(ArgS(args, 2), &period)) {
+    return kInvalidIntErr;
+  }
+
+  // Apply quantity of tokens now
+  if (args.size() > 3 && !absl::SimpleAtoi(ArgS(args, 3), &params->quantity)) {
+    return kInvalidIntErr;
+  }
+
+  if (max_burst > INT64_MAX - 1) {
+    return kInvalidIntErr;
+  }
+  params->limit = max_burst + 1;
+
+  if (period > UINT64_MAX / 1000 || count == 0 || period * 1000 / count > INT64_MAX) {
+    return kInvalidIntErr;
+  }
+  params->emission_interval_ms = period * 1000 / count;
+
+  if (params->emission_interval_ms == 0) {
+    return "zero rates are not supported";
+  }
+  return nullopt;
+}
+
+bool ParseThrottleMode(string_view arg, ThrottleParams::Mode* mode) {
+  if (absl::EqualsIgnoreCase(arg, "GCRA")) {
+    *mode = ThrottleParams::GCRA;
+  } else if (absl::EqualsIgnoreCase(arg, "WINDOW")) {
+    *mode = ThrottleParams::WINDOW;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+// Replies with the throttling result, converting its durations to seconds.
+void SendThrottleResult(ThrottleResult result, ConnectionContext* cntx) {
+  if (result) {
+    auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+    rb->StartArray(result->size());
+    auto& array = result.value();
+
+    int64_t retry_after_s = array[3] / 1000;
+    if (array[3] > 0) {
+      retry_after_s += 1;
+    }
+    array[3] = retry_after_s;
+
+    int64_t reset_after_s = array[4] / 1000;
+    if (array[4] > 0) {
+      reset_after_s += 1;
+    }
+    array[4] = reset_after_s;
+
+    for (const auto& v : array) {
+      rb->SendLong(v);
+    }
+  } else {
+    switch (result.status()) {
+      case OpStatus::WRONG_TYPE:
+        cntx->SendError(kWrongTypeErr);
+        break;
+      case OpStatus::INVALID_INT:
+      case OpStatus::INVALID_VALUE:
+        cntx->SendError(kInvalidIntErr);
+        break;
+      case OpStatus::OUT_OF_MEMORY:
+        cntx->SendError(kOutOfMemory);
+        break;
+      default:
+        cntx->SendError(result.status());
+        break;
+    }
+  }
+}
+
 SinkReplyBuilder::MGetResponse OpMGet(util::fb2::BlockingCounter wait_bc, bool fetch_mcflag,
-                                      bool fetch_mcver, const Transaction* t, EngineShard* shard) {
+                                      bool fetch_mcver, bool fetch_mcttl, const Transaction* t,
+                                      EngineShard* shard) {
   ShardArgs keys = t->GetShardArgs(shard->shard_id());
   DCHECK(!keys.Empty());
 
@@ -418,14 +691,17 @@ SinkReplyBuilder::MGetResponse OpMGet(util::fb2::BlockingCounter wait_bc, bool f
   SinkReplyBuilder::MGetResponse response(keys.Size());
   absl::InlinedVector<DbSlice::ConstIterator, 32> iters(keys.Size());
 
-  // First, fetch all iterators and count total size ahead
+  absl::InlinedVector<string_view, 32> key_arr(keys.begin(), keys.end());
+  absl::InlinedVector<OpResult<DbSlice::ConstIterator>, 32> find_res(keys.Size());
+
+  // First, fetch all iterators in one batch and count total size ahead
+  db_slice.FindReadOnly(t->GetDbContext(), key_arr, OBJ_STRING, absl::MakeSpan(find_res));
+
   size_t total_size = 0;
-  unsigned index = 0;
-  for (string_view key : keys) {
-    auto it_res = db_slice.FindReadOnly(t->GetDbContext(), key, OBJ_STRING);
-    if (auto& dest = iters[index++]; it_res) {
-      dest = *it_res;
-      total_size += (*it_res)->second.Size();
+  for (size_t i = 0; i < find_res.size(); ++i) {
+    if (find_res[i]) {
+      iters[i] = *find_res[i];
+      total_size += iters[i]->second.Size();
     }
   }
 
@@ -465,6 +741,13 @@ SinkReplyBuilder::MGetResponse OpMGet(util::fb2::BlockingCounter wait_bc, bool f
       if (fetch_mcver) {
         resp.mc_ver = it.GetVersion();
       }
+
+      if (fetch_mcttl && it->second.HasExpire()) {
+        const ExpireTable* expire_table = db_slice.GetTables(t->GetDbIndex()).second;
+        int64_t ttl_ms = db_slice.ExpireTime(expire_table->Find(it->first)) -
+                         t->GetDbContext().time_now_ms;
+        resp.mc_ttl = max<int64_t>(ttl_ms / 1000, 0);
+      }
     }
   }
 
@@ -482,7 +765,7 @@ OpResult<variant<size_t, util::fb2::Future<size_t>>> OpExtend(const OpArgs& op_a
   RETURN_ON_BAD_STATUS(it_res);
 
   if (it_res->is_new) {
-    it_res->it->second.SetString(value);
+    it_res->it->second.SetCompressedString(value);
     return {it_res->it->second.Size()};
   }
 
@@ -529,6 +812,107 @@ struct GetReplies {
   RedisReplyBuilder* rb;
 };
 
+// A value handed out by its shard to the hot key cache of the coordinator thread.
+struct HotKeyRead {
+  bool shared = false;
+  ShardId sid = 0;
+  uint64_t epoch = 0;
+  uint64_t expire_at_ms = 0;
+  string value;
+};
+
+// A GET on this thread whose result is shared with the identical GETs that arrive before it
+// reads its key. Later arrivals start their own read, otherwise they could miss a write that
+// completed before they arrived.
+struct InflightGet {
+  explicit InflightGet(DbIndex db) : db{db} {
+  }
+
+  DbIndex db;
+  atomic_bool read_started{false};
+  util::fb2::Done done;
+  OpResult<string> result;
+};
+
+thread_local absl::flat_hash_map<string, shared_ptr<InflightGet>> tl_inflight_gets;
+
+void SendGetResult(const OpResult<string>& res, GetReplies replies) {
+  switch (res.status()) {
+    case OpStatus::OK:
+      return replies.rb->SendBulkString(res.value());
+    case OpStatus::WRONG_TYPE:
+      return replies.rb->SendError(kWrongTypeErr);
+    default:
+      replies.rb->SendNull();
+  }
+}
+
+void ShareIfHot(const DbContext& db_cntx, string_view key, const DbSlice::ConstIterator& it,
+                EngineShard* es, HotKeyRead* read) {
+  const PrimeValue& pv = it->second;
+  if (pv.IsExternal() || pv.Size() > absl::GetFlag(FLAGS_hot_key_cache_max_value))
+    return;
+
+  DbSlice& db_slice = es->db_slice();
+  DbTable* table = db_slice.GetDBTable(db_cntx.db_index);
+  if (table->top_keys.Count(key) < absl::GetFlag(FLAGS_hot_key_min_reads))
+    return;
+
+  if (pv.HasExpire()) {
+    auto exp_it = DbSlice::ExpIterator::FromPrime(table->expire.Find(it->first));
+    read->expire_at_ms = db_slice.ExpireTime(exp_it);
+  }
+
+  read->shared = true;
+  read->sid = es->shard_id();
+  read->epoch = db_slice.ShareHotKey(key);
+  read->value = GetString(pv);
+}
+
+// Large values are not copied out of the table but sent directly while the key is read
+// locked. The lock keeps writers away and neither defragmentation nor offloading touch locked
+// keys, while the pin keeps the blob alive if lazy expiry or eviction delete the key. The
+// value is unpinned and the lock released by a second hop once the reply is sent.
+void GetZeroCopy(string_view key, uint32_t min_size, ConnectionContext* cntx) {
+  string_view raw;
+  auto cb = [&](Transaction* tx, EngineShard* es) -> OpResult<StringValue> {
+    auto it_res = es->db_slice().FindReadOnly(tx->GetDbContext(), key, OBJ_STRING);
+    if (!it_res.ok())
+      return it_res.status();
+
+    const PrimeValue& pv = (*it_res)->second;
+    string_view value = pv.HasIoPending() ? string_view{} : pv.GetRawString();
+    if (value.size() >= min_size) {
+      raw = value;
+      es->db_slice().PinValue(raw);
+      return StringValue{};
+    }
+    return StringValue::Read(tx->GetDbIndex(), key, pv, es);
+  };
+
+  OpResult<StringValue> res;
+  cntx->transaction->Execute(
+      [&](Transaction* tx, EngineShard* es) {
+        res = cb(tx, es);
+        return res.status();
+      },
+      false);
+
+  GetReplies replies{cntx->reply_builder()};
+  if (raw.empty())
+    replies.Send(std::move(res));
+  else
+    replies.rb->SendBulkString(raw);
+
+  cntx->transaction->Execute(
+      [&](Transaction* tx, EngineShard* es) {
+        if (!raw.empty())
+          es->db_slice().UnpinValue(raw);
+        return OpStatus::OK;
+      },
+      true);
+}
+
 }  // namespace
 
 StringValue StringValue::Read(DbIndex dbid, string_view key, const PrimeValue& pv,
@@ -604,7 +988,7 @@ OpStatus SetCmd::SetExisting(const SetParams& params, DbSlice::Iterator it,
     if (at_ms) {  // Command has an expiry paramater.
       if (IsValid(e_it)) {
         // Updated existing expiry information.
-        e_it->second = db_slice.FromAbsoluteTime(at_ms);
+        db_slice.SetExpireTime(op_args_.db_cntx.db_index, e_it, at_ms);
       } else {
         // Add new expiry information.
         db_slice.AddExpire(op_args_.db_cntx.db_index, it, at_ms);
@@ -628,7 +1012,7 @@ OpStatus SetCmd::SetExisting(const SetParams& params, DbSlice::Iterator it,
   }
 
   // overwrite existing entry.
-  prime_value.SetString(value);
+  prime_value.SetCompressedString(value);
 
   PostEdit(params, key, value, &prime_value);
   return OpStatus::OK;
@@ -640,7 +1024,8 @@ void SetCmd::AddNew(const SetParams& params, DbSlice::Iterator it, DbSlice::ExpI
   auto& db_slice = shard->db_slice();
 
   // Adding new value.
-  PrimeValue tvalue{value};
+  PrimeValue tvalue;
+  tvalue.SetCompressedString(value);
   tvalue.SetFlag(params.memcache_flags != 0);
   it->second = std::move(tvalue);
 
@@ -858,15 +1243,74 @@ void StringFamily::SetNx(CmdArgList args, ConnectionContext* cntx) {
 }
 
 void StringFamily::Get(CmdArgList args, ConnectionContext* cntx) {
-  auto cb = [key = ArgS(args, 0)](Transaction* tx, EngineShard* es) -> OpResult<StringValue> {
+  string_view key = ArgS(args, 0);
+  DbIndex db = cntx->db_index();
+
+  // Tracking clients must register their reads with the shard.
+  bool plain_read =
+      !cntx->transaction->IsMulti() && !cntx->conn_state.tracking_info_.IsTrackingOn();
+
+  HotKeyCache& hot_cache = ServerState::tlocal()->hot_key_cache();
+  bool use_hot_cache = plain_read && hot_cache.IsEnabled();
+  if (use_hot_cache) {
+    if (const string* value = hot_cache.Get(db, key, GetCurrentTimeMs()); value) {
+      ++ServerState::tlocal()->stats.hot_key_cache_hits;
+      return GetReplies{cntx->reply_builder()}.rb->SendBulkString(*value);
+    }
+  }
+
+  shared_ptr<InflightGet> flight;
+  if (plain_read && absl::GetFlag(FLAGS_coalesce_gets)) {
+    auto [it, inserted] = tl_inflight_gets.try_emplace(key);
+    if (!inserted && it->second->db == db &&
+        !it->second->read_started.load(memory_order_acquire)) {
+      shared_ptr<InflightGet> leader = it->second;
+      leader->done.Wait();
+      ++ServerState::tlocal()->stats.coalesced_gets;
+      return SendGetResult(leader->result, cntx->reply_builder());
+    }
+    it->second = flight = make_shared<InflightGet>(db);
+  }
+
+  uint32_t zero_copy_min_size = absl::GetFlag(FLAGS_get_zero_copy_min_size);
+  if (zero_copy_min_size > 0 && !cntx->transaction->IsMulti() && !flight)
+    return GetZeroCopy(key, zero_copy_min_size, cntx);
+
+  HotKeyRead hot_read;
+  auto cb = [&](Transaction* tx, EngineShard* es) -> OpResult<StringValue> {
+    if (flight)
+      flight->read_started.store(true, memory_order_release);
+
     auto it_res = es->db_slice().FindReadOnly(tx->GetDbContext(), key, OBJ_STRING);
     if (!it_res.ok())
       return it_res.status();
 
+    if (use_hot_cache)
+      ShareIfHot(tx->GetDbContext(), key, *it_res, es, &hot_read);
     return StringValue::Read(tx->GetDbIndex(), key, (*it_res)->second, es);
   };
 
-  GetReplies{cntx->reply_builder()}.Send(cntx->transaction->ScheduleSingleHopT(cb));
+  OpResult<StringValue> res = cntx->transaction->ScheduleSingleHopT(cb);
+  if (hot_read.shared) {
+    hot_cache.Put(hot_read.sid, hot_read.epoch, db, key, std::move(hot_read.value),
+                  hot_read.expire_at_ms);
+  }
+
+  if (!flight)
+    return GetReplies{cntx->reply_builder()}.Send(std::move(res));
+
+  flight->result = res.ok() ? OpResult<string>{std::move(res.value()).Get()}
+                            : OpResult<string>{res.status()};
+  if (auto it = tl_inflight_gets.find(key); it != tl_inflight_gets.end() && it->second == flight)
+    tl_inflight_gets.erase(it);
+  flight->done.Notify();
+  SendGetResult(flight->result, cntx->reply_builder());
+}
+
+void StringFamily::Init(util::ProactorPool* pp) {
+  pp->AwaitBrief([limit = absl::GetFlag(FLAGS_hot_key_cache_bytes)](unsigned, util::ProactorBase*) {
+    ServerState::tlocal()->hot_key_cache().SetLimit(limit);
+  });
 }
 
 void StringFamily::GetDel(CmdArgList args, ConnectionContext* cntx) {
@@ -1084,27 +1528,42 @@ void StringFamily::IncrByGeneric(string_view key, int64_t val, ConnectionContext
   };
 
   OpResult<int64_t> result = cntx->transaction->ScheduleSingleHopT(std::move(cb));
-  auto* builder = cntx->reply_builder();
 
   DVLOG(2) << "IncrByGeneric " << key << "/" << result.value();
+  SendIncrResult(result, cntx->reply_builder());
+}
 
-  switch (result.status()) {
-    case OpStatus::OK:
-      builder->SendLong(result.value());
-      break;
-    case OpStatus::INVALID_VALUE:
-      builder->SendError(kInvalidIntErr);
-      break;
-    case OpStatus::OUT_OF_RANGE:
-      builder->SendError(kIncrOverflow);
-      break;
-    case OpStatus::KEY_NOTFOUND:  // Relevant only for MC
-      reinterpret_cast<MCReplyBuilder*>(builder)->SendNotFound();
-      break;
-    default:
-      reinterpret_cast<RedisReplyBuilder*>(builder)->SendError(result.status());
-      break;
+/* MINCRBY <key> <increment> [<key> <increment> ...]
+ * Increments all the counters in a single hop. Response is an array with the new value of
+ * every counter or its error, in order. A failure of one counter does not affect the others.
+ */
+void StringFamily::MIncrBy(CmdArgList args, ConnectionContext* cntx) {
+  // Increments are parsed once here, so that the shards only look up the keys.
+  vector<OpResult<int64_t>> results(args.size() / 2);
+  vector<int64_t> increments(results.size());
+  for (size_t i = 0; i < increments.size(); ++i) {
+    if (!absl::SimpleAtoi(ArgS(args, i * 2 + 1), &increments[i])) {
+      return cntx->SendError(kInvalidIntErr);
+    }
   }
+
+  auto cb = [&](Transaction* t, EngineShard* shard) {
+    OpArgs op_args = t->GetOpArgs(shard);
+    ShardArgs shard_args = t->GetShardArgs(shard->shard_id());
+    for (auto it = shard_args.begin(); it != shard_args.end(); ++it) {
+      size_t indx = it.index() / 2;
+      results[indx] = OpIncrBy(op_args, *it, increments[indx], false);
+      ++it;  // skip the increment
+    }
+    return OpStatus::OK;
+  };
+
+  cntx->transaction->ScheduleSingleHop(std::move(cb));
+
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartArray(results.size());
+  for (const auto& result : results)
+    SendIncrResult(result, rb);
 }
 
 /// (P)SETEX key seconds value
@@ -1148,11 +1607,14 @@ void StringFamily::MGet(CmdArgList args, ConnectionContext* cntx) {
   bool fetch_mcflag = cntx->protocol() == Protocol::MEMCACHE;
   bool fetch_mcver =
       fetch_mcflag && (dfly_cntx->conn_state.memcache_flag & ConnectionState::FETCH_CAS_VER);
+  bool fetch_mcttl =
+      fetch_mcflag && (dfly_cntx->conn_state.memcache_flag & ConnectionState::FETCH_TTL);
 
   // Count of pending tiered reads
   util::fb2::BlockingCounter tiering_bc{0};
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    mget_resp[shard->shard_id()] = OpMGet(tiering_bc, fetch_mcflag, fetch_mcver, t, shard);
+    mget_resp[shard->shard_id()] =
+        OpMGet(tiering_bc, fetch_mcflag, fetch_mcver, fetch_mcttl, t, shard);
     return OpStatus::OK;
   };
 
@@ -1294,13 +1756,13 @@ void StringFamily::GetRange(CmdArgList args, ConnectionContext* cntx) {
   };
 
   Transaction* trans = cntx->transaction;
-  OpResult<string> result = trans->ScheduleSingleHopT(std::move(cb));
+  OpResult<StringValue> result = trans->ScheduleSingleHopT(std::move(cb));
 
   if (result.status() == OpStatus::WRONG_TYPE) {
     cntx->SendError(result.status());
   } else {
     auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
-    rb->SendBulkString(result.value());
+    rb->SendBulkString(result && !result->IsEmpty() ? std::move(*result).Get() : string{});
   }
 }
 
@@ -1337,7 +1799,7 @@ void StringFamily::SetRange(CmdArgList args, ConnectionContext* cntx) {
   }
 }
 
-/* CL.THROTTLE <key> <max_burst> <count per period> <period> [<quantity>] */
+/* CL.THROTTLE <key> <max_burst> <count per period> <period> [<quantity> [GCRA | WINDOW]] */
 /* Response is array of 5 integers. The meaning of each array item is:
  *  1. Whether the action was limited:
  *   - 0 indicates the action is allowed.
@@ -1349,102 +1811,73 @@ void StringFamily::SetRange(CmdArgList args, ConnectionContext* cntx) {
  * action was allowed. Equivalent to Retry-After.
  *  5. The number of seconds until the limit will reset to its maximum capacity.
  * Equivalent to X-RateLimit-Reset.
+ * WINDOW selects the fixed window approximation, see OpThrottleWindow.
  */
 void StringFamily::ClThrottle(CmdArgList args, ConnectionContext* cntx) {
   const string_view key = ArgS(args, 0);
 
-  // Allow max burst in number of tokens
-  uint64_t max_burst;
-  const string_view max_burst_str = ArgS(args, 1);
-  if (!absl::SimpleAtoi(max_burst_str, &max_burst)) {
-    return cntx->SendError(kInvalidIntErr);
+  ThrottleParams params;
+  if (auto err = ParseThrottleParams(args.subspan(1, min<size_t>(args.size() - 1, 4)), &params);
+      err) {
+    return cntx->SendError(*err);
   }
 
-  // Emit count of tokens per period
-  uint64_t count;
-  const string_view count_str = ArgS(args, 2);
-  if (!absl::SimpleAtoi(count_str, &count)) {
-    return cntx->SendError(kInvalidIntErr);
+  if (args.size() > 6) {
+    return cntx->SendError(kSyntaxErr);
   }
-
-  // Period of emitting count of tokens
-  uint64_t period;
-  const string_view period_str = ArgS(args, 3);
-  if (!absl::SimpleAtoi(period_str, &period)) {
-    return cntx->SendError(kInvalidIntErr);
+  if (args.size() > 5 && !ParseThrottleMode(ArgS(args, 5), &params.mode)) {
+    return cntx->SendError(kSyntaxErr);
   }
 
-  // Apply quantity of tokens now
-  uint64_t quantity = 1;
-  if (args.size() > 4) {
-    const string_view quantity_str = ArgS(args, 4);
-
-    if (!absl::SimpleAtoi(quantity_str, &quantity)) {
-      return cntx->SendError(kInvalidIntErr);
-    }
-  }
+  auto cb = [&](Transaction* t, EngineShard* shard) -> ThrottleResult {
+    return OpThrottle(t->GetOpArgs(shard), key, params);
+  };
 
-  if (max_burst > INT64_MAX - 1) {
-    return cntx->SendError(kInvalidIntErr);
-  }
-  const int64_t limit = max_burst + 1;
+  Transaction* trans = cntx->transaction;
+  SendThrottleResult(trans->ScheduleSingleHopT(std::move(cb)), cntx);
+}
 
-  if (period > UINT64_MAX / 1000 || count == 0 || period * 1000 / count > INT64_MAX) {
-    return cntx->SendError(kInvalidIntErr);
+/* CL.MTHROTTLE <GCRA | WINDOW> <max_burst> <count per period> <period> <quantity> <key> [<key> ...]
+ * Throttles all the keys with the same limits in a single hop. Response is an array with the
+ * response of CL.THROTTLE for each key, in order. Keys are not rolled back if some of them are
+ * limited, i.e. every key is checked and charged independently.
+ */
+void StringFamily::ClMThrottle(CmdArgList args, ConnectionContext* cntx) {
+  ThrottleParams params;
+  if (!ParseThrottleMode(ArgS(args, 0), &params.mode)) {
+    return cntx->SendError(kSyntaxErr);
   }
-  const int64_t emission_interval_ms = period * 1000 / count;
-
-  if (emission_interval_ms == 0) {
-    return cntx->SendError("zero rates are not supported");
+  if (auto err = ParseThrottleParams(args.subspan(1, 4), &params); err) {
+    return cntx->SendError(*err);
   }
 
-  auto cb = [&](Transaction* t, EngineShard* shard) -> OpResult<array<int64_t, 5>> {
-    return OpThrottle(t->GetOpArgs(shard), key, limit, emission_interval_ms, quantity);
+  Transaction* transaction = cntx->transaction;
+  vector<vector<ThrottleResult>> results(shard_set->size());
+  auto cb = [&](Transaction* t, EngineShard* shard) {
+    ShardId sid = shard->shard_id();
+    results[sid] = OpMThrottle(t->GetOpArgs(shard), t->GetShardArgs(sid), params,
+                               args.subspan(0, 5));
+    return OpStatus::OK;
   };
+  transaction->ScheduleSingleHop(std::move(cb));
 
-  Transaction* trans = cntx->transaction;
-  OpResult<array<int64_t, 5>> result = trans->ScheduleSingleHopT(std::move(cb));
-
-  if (result) {
-    auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
-    rb->StartArray(result->size());
-    auto& array = result.value();
-
-    int64_t retry_after_s = array[3] / 1000;
-    if (array[3] > 0) {
-      retry_after_s += 1;
-    }
-    array[3] = retry_after_s;
-
-    int64_t reset_after_s = array[4] / 1000;
-    if (array[4] > 0) {
-      reset_after_s += 1;
-    }
-    array[4] = reset_after_s;
+  // Reorder the results according to the order of the keys.
+  vector<ThrottleResult> ordered(args.size() - 5, OpStatus::SKIPPED);
+  for (ShardId sid = 0; sid < results.size(); ++sid) {
+    if (!transaction->IsActive(sid))
+      continue;
 
-    for (const auto& v : array) {
-      rb->SendLong(v);
-    }
-  } else {
-    switch (result.status()) {
-      case OpStatus::WRONG_TYPE:
-        cntx->SendError(kWrongTypeErr);
-        break;
-      case OpStatus::INVALID_INT:
-      case OpStatus::INVALID_VALUE:
-        cntx->SendError(kInvalidIntErr);
-        break;
-      case OpStatus::OUT_OF_MEMORY:
-        cntx->SendError(kOutOfMemory);
-        break;
-      default:
-        cntx->SendError(result.status());
-        break;
+    ShardArgs shard_args = transaction->GetShardArgs(sid);
+    unsigned src_indx = 0;
+    for (auto it = shard_args.begin(); it != shard_args.end(); ++it, ++src_indx) {
+      ordered[it.index() - 5] = std::move(results[sid][src_indx]);
     }
   }
-}
 
-void StringFamily::Init(util::ProactorPool* pp) {
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartArray(ordered.size());
+  for (auto& result : ordered)
+    SendThrottleResult(std::move(result), cntx);
 }
 
 void StringFamily::Shutdown() {
@@ -1464,6 +1897,7 @@ constexpr uint32_t kDecr = WRITE | STRING | FAST;
 constexpr uint32_t kIncrBy = WRITE | STRING | FAST;
 constexpr uint32_t kIncrByFloat = WRITE | STRING | FAST;
 constexpr uint32_t kDecrBy = WRITE | STRING | FAST;
+constexpr uint32_t kMIncrBy = WRITE | STRING | FAST;
 constexpr uint32_t kGet = READ | STRING | FAST;
 constexpr uint32_t kGetDel = WRITE | STRING | FAST;
 constexpr uint32_t kGetEx = WRITE | STRING | FAST;
@@ -1478,6 +1912,7 @@ constexpr uint32_t kSetRange = WRITE | STRING | SLOW;
 // ClThrottle is a module in redis. Therefore we introduce a new extension
 // to the category. We should consider other defaults as well
 constexpr uint32_t kClThrottle = THROTTLE;
+constexpr uint32_t kClMThrottle = THROTTLE;
 }  // namespace acl
 
 void StringFamily::Register(CommandRegistry* registry) {
@@ -1499,6 +1934,8 @@ void StringFamily::Register(CommandRegistry* registry) {
       << CI{"INCRBY", CO::WRITE | CO::FAST, 3, 1, 1, acl::kIncrBy}.HFUNC(IncrBy)
       << CI{"INCRBYFLOAT", CO::WRITE | CO::FAST, 3, 1, 1, acl::kIncrByFloat}.HFUNC(IncrByFloat)
       << CI{"DECRBY", CO::WRITE | CO::FAST, 3, 1, 1, acl::kDecrBy}.HFUNC(DecrBy)
+      << CI{"MINCRBY", CO::WRITE | CO::FAST | CO::INTERLEAVED_KEYS, -3, 1, -1, acl::kMIncrBy}.HFUNC(
+             MIncrBy)
       << CI{"GET", CO::READONLY | CO::FAST, 2, 1, 1, acl::kGet}.HFUNC(Get)
       << CI{"GETDEL", CO::WRITE | CO::FAST, 2, 1, 1, acl::kGetDel}.HFUNC(GetDel)
       << CI{"GETEX", CO::WRITE | CO::DENYOOM | CO::FAST | CO::NO_AUTOJOURNAL, -1, 1, 1, acl::kGetEx}
@@ -1513,7 +1950,10 @@ void StringFamily::Register(CommandRegistry* registry) {
              GetRange)  // Alias for GetRange
       << CI{"SETRANGE", CO::WRITE | CO::FAST | CO::DENYOOM, 4, 1, 1, acl::kSetRange}.HFUNC(SetRange)
       << CI{"CL.THROTTLE", CO::WRITE | CO::DENYOOM | CO::FAST, -5, 1, 1, acl::kClThrottle}.HFUNC(
-             ClThrottle);
+             ClThrottle)
+      << CI{"CL.MTHROTTLE", CO::WRITE | CO::DENYOOM | CO::FAST | CO::NO_AUTOJOURNAL, -7, 6, -1,
+            acl::kClMThrottle}
+             .HFUNC(ClMThrottle);
 }
 
 }  // namespace dfly
@@ -111,6 +111,7 @@ class StringFamily {
   static void MGet(CmdArgList args, ConnectionContext* cntx);
   static void MSet(CmdArgList args, ConnectionContext* cntx);
   static void MSetNx(CmdArgList args, ConnectionContext* cntx);
+  static void MIncrBy(CmdArgList args, ConnectionContext* cntx);
 
   static void Set(CmdArgList args, ConnectionContext* cntx);
   static void SetEx(CmdArgList args, ConnectionContext* cntx);
@@ -121,6 +122,7 @@ class StringFamily {
   static void PSetEx(CmdArgList args, ConnectionContext* cntx);
 
   static void ClThrottle(CmdArgList args, ConnectionContext* cntx);
+  static void ClMThrottle(CmdArgList args, ConnectionContext* cntx);
 
   // These functions are used internally, they do not implement any specific command
   static void IncrByGeneric(std::string_view key, int64_t val, ConnectionContext* cntx);
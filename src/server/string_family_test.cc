@@ -18,6 +18,13 @@ using namespace testing;
 using namespace std;
 using namespace util;
 using absl::StrCat;
+using fb2::Fiber;
+
+ABSL_DECLARE_FLAG(uint32_t, get_zero_copy_min_size);
+ABSL_DECLARE_FLAG(bool, coalesce_gets);
+ABSL_DECLARE_FLAG(uint64_t, hot_key_cache_bytes);
+ABSL_DECLARE_FLAG(uint64_t, hot_key_min_reads);
+ABSL_DECLARE_FLAG(bool, enable_top_keys_tracking);
 
 namespace dfly {
 
@@ -55,6 +62,116 @@ TEST_F(StringFamilyTest, SetGet) {
   EXPECT_EQ(3, metrics.events.mutations);
 }
 
+TEST_F(StringFamilyTest, GetZeroCopy) {
+  absl::SetFlag(&FLAGS_get_zero_copy_min_size, 1024);
+
+  string large(4096, '\xfe');
+  Run({"set", "large", large});
+  Run({"set", "small", "val"});
+  Run({"lpush", "list", "a"});
+
+  EXPECT_EQ(Run({"get", "large"}), large);
+  EXPECT_EQ(Run({"get", "small"}), "val");
+  EXPECT_THAT(Run({"get", "missing"}), ArgType(RespExpr::NIL));
+  EXPECT_THAT(Run({"get", "list"}), ErrArg("WRONGTYPE"));
+  EXPECT_FALSE(IsLocked(0, "large"));
+
+  Run({"multi"});
+  Run({"get", "large"});
+  EXPECT_EQ(Run({"exec"}), large);
+
+  absl::SetFlag(&FLAGS_get_zero_copy_min_size, 0);
+}
+
+TEST_F(StringFamilyTest, GetZeroCopyExpiredWhileSending) {
+  // Pin the value like a large GET does while its reply is sent, then let another reader
+  // lazily expire the key before the pin is dropped.
+  string large(4096, 'x');
+  Run({"set", "large", large, "px", "10"});
+
+  string_view raw;
+  ShardId sid = Shard("large", shard_set->size());
+  shard_set->Await(sid, [&] {
+    auto& db_slice = EngineShard::tlocal()->db_slice();
+    auto it_res = db_slice.FindReadOnly(DbContext{0, GetCurrentTimeMs()}, "large", OBJ_STRING);
+    ASSERT_TRUE(it_res.ok());
+    raw = (*it_res)->second.GetRawString();
+    db_slice.PinValue(raw);
+  });
+  ASSERT_EQ(raw.size(), large.size());
+
+  AdvanceTime(20);
+  EXPECT_THAT(Run({"get", "large"}), ArgType(RespExpr::NIL));
+  Run({"set", "other", string(4096, 'y')});
+
+  shard_set->Await(sid, [&] {
+    EXPECT_EQ(raw, large);
+    EngineShard::tlocal()->db_slice().UnpinValue(raw);
+  });
+}
+
+TEST_F(StringFamilyTest, HotKeyCache) {
+  absl::SetFlag(&FLAGS_enable_top_keys_tracking, true);
+  absl::SetFlag(&FLAGS_hot_key_cache_bytes, 1 << 20);
+  absl::SetFlag(&FLAGS_hot_key_min_reads, 2);
+  ResetService();
+
+  Run({"set", "key", "val1"});
+  for (unsigned i = 0; i < 5; ++i)
+    EXPECT_EQ(Run({"get", "key"}), "val1");
+  EXPECT_GT(GetMetrics().coordinator_stats.hot_key_cache_hits, 0u);
+  EXPECT_GT(GetMetrics().hot_key_cache_bytes, 0u);
+
+  // Reads that follow a write see it, although its broadcast is asynchronous.
+  Run({"set", "key", "val2"});
+  EXPECT_EQ(Run({"get", "key"}), "val2");
+  for (unsigned i = 0; i < 5; ++i)
+    EXPECT_EQ(Run({"get", "key"}), "val2");
+
+  Run({"del", "key"});
+  EXPECT_THAT(Run({"get", "key"}), ArgType(RespExpr::NIL));
+
+  Run({"multi"});
+  Run({"get", "key"});
+  EXPECT_THAT(Run({"exec"}), ArgType(RespExpr::NIL));
+
+  absl::SetFlag(&FLAGS_hot_key_min_reads, 1000);
+  absl::SetFlag(&FLAGS_hot_key_cache_bytes, 0);
+  absl::SetFlag(&FLAGS_enable_top_keys_tracking, false);
+}
+
+TEST_F(StringFamilyTest, CoalescedGet) {
+  absl::SetFlag(&FLAGS_coalesce_gets, true);
+  Run({"set", "key", "val"});
+
+  // Keeps the key locked, so that the GETs queue up before the first one reads it.
+  auto locker = pp_->at(1)->LaunchFiber([&] {
+    Run("locker", {"eval", "for i = 1, 10000000 do end return 1", "1", "key"});
+  });
+  ThisFiber::SleepFor(5ms);
+
+  const unsigned kFibers = 8;
+  vector<Fiber> fbs(kFibers);
+  for (unsigned i = 0; i < kFibers; ++i) {
+    fbs[i] = pp_->at(0)->LaunchFiber([this, i] {
+      EXPECT_EQ(Run(StrCat("r", i), {"get", "key"}), "val");
+    });
+  }
+  for (auto& fb : fbs)
+    fb.Join();
+  locker.Join();
+
+  EXPECT_GT(GetMetrics().coordinator_stats.coalesced_gets, 0u);
+
+  // A read that starts after the write must see it.
+  Run({"set", "key", "val2"});
+  EXPECT_EQ(Run({"get", "key"}), "val2");
+  Run({"lpush", "list", "a"});
+  EXPECT_THAT(Run({"get", "list"}), ErrArg("WRONGTYPE"));
+
+  absl::SetFlag(&FLAGS_coalesce_gets, false);
+}
+
 TEST_F(StringFamilyTest, Incr) {
   ASSERT_EQ(Run({"set", "key", "0"}), "OK");
   ASSERT_THAT(Run({"incr", "key"}), IntArg(1));
@@ -76,6 +193,28 @@ TEST_F(StringFamilyTest, Incr) {
   EXPECT_EQ(0, metrics.events.hits);
 }
 
+TEST_F(StringFamilyTest, MIncrBy) {
+  Run({"set", "a", "10"});
+  Run({"set", "s", "str"});
+  Run({"lpush", "l", "x"});
+  Run({"set", "max", "9223372036854775807"});
+
+  auto resp = Run({"mincrby", "a", "5", "b", "-2", "s", "1", "a", "1", "l", "1", "max", "1"});
+  ASSERT_THAT(resp, ArrLen(6));
+  const auto& vec = resp.GetVec();
+  EXPECT_THAT(vec[0], IntArg(15));
+  EXPECT_THAT(vec[1], IntArg(-2));
+  EXPECT_THAT(vec[2], ErrArg(kInvalidIntErr));
+  EXPECT_THAT(vec[3], IntArg(16));
+  EXPECT_THAT(vec[4], ErrArg("WRONGTYPE"));
+  EXPECT_THAT(vec[5], ErrArg("overflow"));
+  EXPECT_EQ(Run({"get", "a"}), "16");
+
+  EXPECT_THAT(Run({"mincrby", "a", "x"}), ErrArg(kInvalidIntErr));
+  EXPECT_THAT(Run({"mincrby", "a", "1", "b"}), ErrArg("wrong number of arguments"));
+  EXPECT_EQ(Run({"get", "a"}), "16");
+}
+
 TEST_F(StringFamilyTest, Append) {
   Run({"setex", "key", "100", "val"});
   EXPECT_THAT(Run({"ttl", "key"}), IntArg(100));
@@ -217,6 +356,19 @@ TEST_F(StringFamilyTest, MSetLong) {
   }
   auto resp = Run(absl::MakeSpan(command));
   EXPECT_EQ(resp, "OK");
+
+  // Interleave missing keys with existing ones, the replies must keep the order of the keys.
+  command = {"mget"};
+  for (unsigned i = 0; i < 12000; i += 2) {
+    command.push_back(StrCat("key", i));
+    command.push_back(StrCat("missing", i));
+  }
+  resp = Run(absl::MakeSpan(command));
+  ASSERT_THAT(resp, ArrLen(12000));
+  for (unsigned i = 0; i < 12000; i += 2) {
+    EXPECT_EQ(resp.GetVec()[i], StrCat("val", i));
+    EXPECT_THAT(resp.GetVec()[i + 1], ArgType(RespExpr::NIL));
+  }
 }
 
 TEST_F(StringFamilyTest, MGetSet) {
@@ -493,6 +645,27 @@ TEST_F(StringFamilyTest, Range) {
   EXPECT_EQ(Run({"getrange", "num", "-5000", "10000"}), "1234");
 }
 
+TEST_F(StringFamilyTest, LargeRangeAndAppend) {
+  // Large strings are modified in place by the following calls.
+  string val(10000, 'a');
+  Run({"SET", "key", val});
+  for (unsigned i = 0; i < 100; ++i) {
+    ASSERT_THAT(Run({"APPEND", "key", "xyz"}), IntArg(val.size() + 3));
+    val.append("xyz");
+  }
+  EXPECT_THAT(Run({"SETRANGE", "key", "5", "bcd"}), IntArg(val.size()));
+  val.replace(5, 3, "bcd");
+  EXPECT_EQ(Run({"GET", "key"}), val);
+
+  EXPECT_THAT(Run({"SETRANGE", "key", to_string(val.size() + 1), "e"}), IntArg(val.size() + 2));
+  val.append(string_view{"\0e", 2});
+  EXPECT_EQ(Run({"GETRANGE", "key", "-4", "-1"}), val.substr(val.size() - 4));
+  EXPECT_EQ(Run({"GET", "key"}), val);
+
+  Run({"PREPEND", "key", "p"});
+  EXPECT_EQ(Run({"GET", "key"}), "p" + val);
+}
+
 TEST_F(StringFamilyTest, IncrByFloat) {
   Run({"SET", "nonum", "  11"});
   auto resp = Run({"INCRBYFLOAT", "nonum", "1.0"});
@@ -769,6 +942,63 @@ TEST_F(StringFamilyTest, ClThrottle) {
   EXPECT_THAT(resp, ErrArg(kInvalidIntErr));
 }
 
+TEST_F(StringFamilyTest, ClThrottleWindow) {
+  // 5 units per window of 50 seconds.
+  auto resp = Run({"cl.throttle", "foo", "4", "1", "10", "3", "window"});
+  ASSERT_THAT(resp.GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(2), IntArg(-1), IntArg(51)));
+
+  AdvanceTime(10000);
+  resp = Run({"cl.throttle", "foo", "4", "1", "10", "3", "window"});
+  ASSERT_THAT(resp.GetVec(),
+              ElementsAre(IntArg(1), IntArg(5), IntArg(2), IntArg(41), IntArg(41)));
+
+  resp = Run({"cl.throttle", "foo", "4", "1", "10", "2", "window"});
+  ASSERT_THAT(resp.GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(0), IntArg(-1), IntArg(41)));
+
+  // The next window starts from scratch.
+  AdvanceTime(40001);
+  resp = Run({"cl.throttle", "foo", "4", "1", "10", "1", "window"});
+  ASSERT_THAT(resp.GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(4), IntArg(-1), IntArg(51)));
+
+  // You can never make a request larger than the maximum.
+  resp = Run({"cl.throttle", "bar", "4", "1", "10", "6", "window"});
+  ASSERT_THAT(resp.GetVec(),
+              ElementsAre(IntArg(1), IntArg(5), IntArg(5), IntArg(-1), IntArg(0)));
+  EXPECT_EQ(0, CheckedInt({"exists", "bar"}));
+
+  EXPECT_THAT(Run({"cl.throttle", "foo", "4", "1", "10", "1", "foo"}), ErrArg("syntax error"));
+}
+
+TEST_F(StringFamilyTest, ClMThrottle) {
+  auto resp = Run({"cl.mthrottle", "gcra", "4", "1", "10", "1", "a", "b", "a"});
+  ASSERT_THAT(resp, ArrLen(3));
+  EXPECT_THAT(resp.GetVec()[0].GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(4), IntArg(-1), IntArg(11)));
+  EXPECT_THAT(resp.GetVec()[1].GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(4), IntArg(-1), IntArg(11)));
+  EXPECT_THAT(resp.GetVec()[2].GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(3), IntArg(-1), IntArg(21)));
+
+  // Same state as the single key command.
+  resp = Run({"cl.throttle", "b", "4", "1", "10"});
+  EXPECT_THAT(resp.GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(3), IntArg(-1), IntArg(21)));
+
+  // Errors are reported per key.
+  Run({"lpush", "l", "x"});
+  resp = Run({"cl.mthrottle", "window", "4", "1", "10", "2", "l", "c"});
+  ASSERT_THAT(resp, ArrLen(2));
+  EXPECT_THAT(resp.GetVec()[0], ErrArg("WRONGTYPE"));
+  EXPECT_THAT(resp.GetVec()[1].GetVec(),
+              ElementsAre(IntArg(0), IntArg(5), IntArg(3), IntArg(-1), IntArg(51)));
+
+  EXPECT_THAT(Run({"cl.mthrottle", "fast", "4", "1", "10", "1", "a"}), ErrArg("syntax error"));
+  EXPECT_THAT(Run({"cl.mthrottle", "gcra", "4", "0", "10", "1", "a"}), ErrArg(kInvalidIntErr));
+}
+
 TEST_F(StringFamilyTest, SetMGetWithNilResp3) {
   Run({"hello", "3"});
 
@@ -854,6 +1084,23 @@ TEST_F(StringFamilyTest, SetWithHashtagsWithHashtagLock) {
   EXPECT_EQ(1, GetDebugInfo().shards_count);
 }
 
+TEST_F(StringFamilyTest, MSetSingleHashtagLock) {
+  SetTestFlag("cluster_mode", "emulated");
+  SetTestFlag("lock_on_hashtags", "true");
+  ResetService();
+
+  // All keys share a tag, so the transaction runs on a single shard with a single lock.
+  auto fb = ExpectUsedKeys({"user"});
+  EXPECT_EQ(Run({"mset", "{user}1", "a", "{user}2", "b", "{user}3", "c"}), "OK");
+  fb.Join();
+  EXPECT_EQ(1, GetDebugInfo().shards_count);
+
+  fb = ExpectUsedKeys({"user"});
+  EXPECT_THAT(Run({"mget", "{user}1", "{user}2", "{user}3"}),
+              RespArray(ElementsAre("a", "b", "c")));
+  fb.Join();
+}
+
 TEST_F(StringFamilyTest, MultiSetWithHashtagsDontLockHashtags) {
   SetTestFlag("cluster_mode", "");
   SetTestFlag("lock_on_hashtags", "false");
@@ -6,12 +6,17 @@
 
 #include "base/flags.h"
 #include "base/logging.h"
+#include "core/string_set.h"
 #include "server/cluster/cluster_defs.h"
 #include "server/server_state.h"
 
 ABSL_FLAG(bool, enable_top_keys_tracking, false,
           "Enables / disables tracking of hot keys debugging feature");
 
+ABSL_FLAG(uint32_t, table_split_step, 0,
+          "If positive, splits the segments of the main table incrementally, moving at most this "
+          "many buckets per insertion. 0 splits a whole segment at once.");
+
 using namespace std;
 namespace dfly {
 #define ADD(x) (x) += o.x
@@ -59,36 +64,126 @@ SlotStats& SlotStats::operator+=(const SlotStats& o) {
 }
 
 std::optional<const IntentLock> LockTable::Find(LockTag tag) const {
-  LockFp fp = tag.Fingerprint();
-  if (auto it = locks_.find(fp); it != locks_.end())
-    return it->second;
-  return std::nullopt;
+  return Find(tag.Fingerprint());
 }
 
-std::optional<const IntentLock> LockTable::Find(uint64_t fp) const {
-  if (auto it = locks_.find(fp); it != locks_.end())
+std::optional<const IntentLock> LockTable::Find(LockFp fp) const {
+  const Stripe& stripe = stripes_[fp % kNumStripes];
+  if (stripe.fp == fp && !stripe.lock.IsFree())
+    return stripe.lock;
+
+  if (overflow_.empty())
+    return std::nullopt;
+
+  if (auto it = overflow_.find(fp); it != overflow_.end())
     return it->second;
   return std::nullopt;
 }
 
-void LockTable::Release(uint64_t fp, IntentLock::Mode mode) {
-  auto it = locks_.find(fp);
-  DCHECK(it != locks_.end()) << fp;
+void LockTable::Release(LockFp fp, IntentLock::Mode mode) {
+  Stripe& stripe = stripes_[fp % kNumStripes];
+  if (stripe.fp == fp && !stripe.lock.IsFree()) {
+    stripe.lock.Release(mode);
+    if (stripe.lock.IsFree())
+      stripes_used_--;
+    return;
+  }
+
+  auto it = overflow_.find(fp);
+  DCHECK(it != overflow_.end()) << fp;
 
   it->second.Release(mode);
   if (it->second.IsFree())
-    locks_.erase(it);
+    overflow_.erase(it);
+}
+
+SlotKeyIndex::SlotKeyIndex(PMR_NS::memory_resource* mr)
+    : mr_(mr), slots_(cluster::kMaxSlotNum + 1) {
+}
+
+SlotKeyIndex::~SlotKeyIndex() {
+}
+
+void SlotKeyIndex::Add(cluster::SlotId sid, string_view key) {
+  auto& keys = slots_[sid];
+  if (!keys)
+    keys = make_unique<StringSet>(mr_);
+  keys->Add(key);
+}
+
+void SlotKeyIndex::Remove(cluster::SlotId sid, string_view key) {
+  auto& keys = slots_[sid];
+  if (keys && keys->Erase(key) && keys->Empty())
+    keys.reset();
+}
+
+vector<string> SlotKeyIndex::GetKeys(cluster::SlotId sid, size_t limit) const {
+  vector<string> res;
+  if (!slots_[sid])
+    return res;
+
+  res.reserve(min(limit, slots_[sid]->UpperBoundSize()));
+  for (sds key : *slots_[sid]) {
+    if (res.size() >= limit)
+      break;
+    res.emplace_back(key, sdslen(key));
+  }
+  return res;
+}
+
+void SlotKeyIndex::Clear() {
+  for (auto& keys : slots_)
+    keys.reset();
+}
+
+void ExpireWheel::Schedule(string_view key, uint64_t at) {
+  auto [it, inserted] = keys_.try_emplace(key);
+  if (inserted && it->first.capacity() > string{}.capacity())
+    key_heap_bytes_ += it->first.capacity() + 1;
+
+  // Otherwise the live entry fires earlier and reschedules the key to its current deadline.
+  if (at < it->second.tick)
+    Add(&*it, at);
+}
+
+void ExpireWheel::Add(KeyMap::value_type* key, uint64_t at) {
+  KeyState& state = key->second;
+  state.tick = at;
+  ++state.gen;
+  ++state.refs;
+  wheel_.Add(at, Entry{key, state.gen});
+}
+
+void ExpireWheel::Erase(KeyMap::value_type* key) {
+  if (key->first.capacity() > string{}.capacity())
+    key_heap_bytes_ -= key->first.capacity() + 1;
+  keys_.erase(key->first);
+}
+
+void ExpireWheel::Clear() {
+  wheel_.Clear();
+  keys_.clear();
+  key_heap_bytes_ = 0;
+}
+
+size_t ExpireWheel::MemUsage() const {
+  // The hash table holds a pointer and a control byte per slot, the nodes are allocated apart.
+  return keys_.capacity() * (sizeof(void*) + 1) + keys_.size() * sizeof(KeyMap::value_type) +
+         key_heap_bytes_ + wheel_.MemUsage();
 }
 
-DbTable::DbTable(PMR_NS::memory_resource* mr, DbIndex db_index)
-    : prime(kInitSegmentLog, detail::PrimeTablePolicy{}, mr),
+DbTable::DbTable(PMR_NS::memory_resource* mr, DbIndex db_index,
+                 PMR_NS::memory_resource* segment_mr)
+    : prime(kInitSegmentLog, detail::PrimeTablePolicy{}, segment_mr ? segment_mr : mr),
       expire(0, detail::ExpireTablePolicy{}, mr),
       mcflag(0, detail::ExpireTablePolicy{}, mr),
       top_keys({.enabled = absl::GetFlag(FLAGS_enable_top_keys_tracking)}),
       index(db_index) {
   if (cluster::IsClusterEnabled()) {
     slots_stats.resize(cluster::kMaxSlotNum + 1);
+    slots_load.resize(cluster::kMaxSlotNum + 1);
   }
+  prime.set_split_step(absl::GetFlag(FLAGS_table_split_step));
   thread_index = ServerState::tlocal()->thread_index();
 }
 
@@ -101,6 +196,14 @@ void DbTable::Clear() {
   prime.Clear();
   expire.Clear();
   mcflag.Clear();
+  if (expire_wheel)
+    expire_wheel->Clear();
+  if (expire_buckets)
+    expire_buckets->Clear();
+  if (field_expire_wheel)
+    field_expire_wheel->Clear();
+  if (slot_keys)
+    slot_keys->Clear();
   stats = DbTableStats{};
 }
 
@@ -5,12 +5,16 @@
 #pragma once
 
 #include <absl/container/flat_hash_map.h>
+#include <absl/container/node_hash_map.h>
 
 #include <boost/smart_ptr/intrusive_ptr.hpp>
 #include <boost/smart_ptr/intrusive_ref_counter.hpp>
 
+#include "core/expire_buckets.h"
 #include "core/expire_period.h"
 #include "core/intent_lock.h"
+#include "core/timer_wheel.h"
+#include "server/cluster/cluster_defs.h"
 #include "server/conn_context.h"
 #include "server/detail/table.h"
 #include "server/top_keys.h"
@@ -20,6 +24,8 @@ extern "C" {
 }
 namespace dfly {
 
+class StringSet;
+
 using PrimeKey = detail::PrimeKey;
 using PrimeValue = detail::PrimeValue;
 
@@ -49,6 +55,12 @@ inline bool IsValid(ExpireConstIterator it) {
   return !it.is_done();
 }
 
+// Callback of PrimeTable::PrefetchTraversal for the traversals that read the keys and values.
+inline void PrefetchEntry(const PrimeKey& key, const PrimeValue& value) {
+  key.Prefetch();
+  value.Prefetch();
+}
+
 struct SlotStats {
   uint64_t key_count = 0;
   uint64_t total_reads = 0;
@@ -57,6 +69,14 @@ struct SlotStats {
   SlotStats& operator+=(const SlotStats& o);
 };
 
+// Load of a slot, decayed over time by DbSlice::UpdateSlotLoad.
+struct SlotLoad {
+  uint64_t written_bytes = 0;  // Of the values allocated and freed in the slot.
+  uint64_t last_ops = 0, last_written_bytes = 0;  // At the last update.
+  double ops_per_sec = 0;
+  double bytes_per_sec = 0;
+};
+
 struct DbTableStats {
   // Number of inline keys.
   uint64_t inline_keys = 0;
@@ -79,38 +99,162 @@ struct DbTableStats {
 };
 
 // Table for recording locks. Keys used with the lock table should be normalized with LockTag.
+// Locks are kept in a fixed array of stripes indexed by fingerprint, so that locking and
+// unlocking does not hash or allocate. Only locks whose stripe is already held by another
+// fingerprint are stored in the overflow map. A fingerprint is never present in both.
 class LockTable {
  public:
+  static constexpr size_t kNumStripes = 512;
+
   size_t Size() const {
-    return locks_.size();
+    return stripes_used_ + overflow_.size();
   }
+
   std::optional<const IntentLock> Find(LockTag tag) const;
   std::optional<const IntentLock> Find(LockFp fp) const;
 
   bool Acquire(LockFp fp, IntentLock::Mode mode) {
-    return locks_[fp].Acquire(mode);
+    Stripe& stripe = stripes_[fp % kNumStripes];
+    if (stripe.fp == fp && !stripe.lock.IsFree())
+      return stripe.lock.Acquire(mode);
+
+    if (stripe.lock.IsFree() && (overflow_.empty() || !overflow_.contains(fp))) {
+      stripe.fp = fp;
+      stripes_used_++;
+      return stripe.lock.Acquire(mode);
+    }
+
+    return overflow_[fp].Acquire(mode);
   }
 
   void Release(LockFp fp, IntentLock::Mode mode);
 
-  auto begin() const {
-    return locks_.cbegin();
+  // Calls cb(LockFp, const IntentLock&) for every held lock.
+  template <typename Cb> void ForEach(Cb&& cb) const {
+    for (const Stripe& stripe : stripes_) {
+      if (!stripe.lock.IsFree())
+        cb(stripe.fp, stripe.lock);
+    }
+    for (const auto& [fp, lock] : overflow_)
+      cb(fp, lock);
   }
 
-  auto end() const {
-    return locks_.cend();
+  // Number of locks that collided with another fingerprint and are kept in the overflow map.
+  size_t OverflowSize() const {
+    return overflow_.size();
   }
 
  private:
+  struct Stripe {
+    LockFp fp = 0;
+    IntentLock lock;
+  };
+
   // We use fingerprinting before accessing locks - no need to mix more.
   struct Hasher {
     size_t operator()(LockFp val) const {
       return val;
     }
   };
-  absl::flat_hash_map<LockFp, IntentLock, Hasher> locks_;
+
+  std::array<Stripe, kNumStripes> stripes_;
+  size_t stripes_used_ = 0;
+  absl::flat_hash_map<LockFp, IntentLock, Hasher> overflow_;
+};
+
+// Index of the keys by their cluster slots, so that slot operations visit only the keys of
+// their slots instead of traversing the whole table. Costs a copy of each key.
+class SlotKeyIndex {
+ public:
+  explicit SlotKeyIndex(PMR_NS::memory_resource* mr);
+  ~SlotKeyIndex();
+
+  void Add(cluster::SlotId sid, std::string_view key);
+  void Remove(cluster::SlotId sid, std::string_view key);
+
+  // Copies at most limit keys of the slot, in no particular order.
+  std::vector<std::string> GetKeys(cluster::SlotId sid, size_t limit = SIZE_MAX) const;
+
+  void Clear();
+
+ private:
+  PMR_NS::memory_resource* mr_;
+  std::vector<std::unique_ptr<StringSet>> slots_;  // Allocated while the slot has keys.
 };
 
+// Index of the keys with expiry by their deadlines, see DbSlice::DeleteExpiredFromWheel. Holds
+// a single copy of each key. Postponing the deadline of an indexed key does not touch the wheel:
+// its entry fires at the earlier deadline and the key is rescheduled then. Only bringing the
+// deadline forward adds an entry, which turns the previous one into a stale pointer that is
+// skipped when it fires.
+class ExpireWheel {
+ public:
+  explicit ExpireWheel(uint64_t now_ms) : wheel_(now_ms) {
+  }
+
+  // Makes sure that key fires no later than at.
+  void Schedule(std::string_view key, uint64_t at);
+
+  // Calls cb(std::string_view key) for the indexed keys that are due at now_ms, at most limit
+  // of them. cb returns the deadline to reschedule the key at, which must be after now_ms, or 0
+  // to drop the key from the index. Returns the number of fired wheel entries.
+  template <typename Cb> size_t Advance(uint64_t now_ms, size_t limit, Cb&& cb);
+
+  void Clear();
+
+  // Number of indexed keys.
+  size_t size() const {
+    return keys_.size();
+  }
+
+  // Number of wheel entries, including the stale ones.
+  size_t entries() const {
+    return wheel_.size();
+  }
+
+  uint64_t lag(uint64_t now_ms) const {
+    return wheel_.lag(now_ms);
+  }
+
+  size_t MemUsage() const;
+
+ private:
+  struct KeyState {
+    uint64_t tick = UINT64_MAX;  // Deadline of the live entry, UINT64_MAX if there is none.
+    uint32_t gen = 0;            // Of the live entry, older entries are stale.
+    uint32_t refs = 0;           // Number of entries in the wheel, live or stale.
+  };
+
+  // Node based, so that the wheel entries can point to the keys.
+  using KeyMap = absl::node_hash_map<std::string, KeyState>;
+
+  struct Entry {
+    KeyMap::value_type* key;
+    uint32_t gen;
+  };
+
+  void Add(KeyMap::value_type* key, uint64_t at);
+  void Erase(KeyMap::value_type* key);
+
+  KeyMap keys_;
+  TimerWheel<Entry> wheel_;
+  size_t key_heap_bytes_ = 0;  // Allocated by the keys that do not fit the inline string buffer.
+};
+
+template <typename Cb> size_t ExpireWheel::Advance(uint64_t now_ms, size_t limit, Cb&& cb) {
+  return wheel_.Advance(now_ms, limit, [&](uint64_t, Entry e) {
+    KeyState& state = e.key->second;
+    --state.refs;
+    if (e.gen == state.gen) {
+      state.tick = UINT64_MAX;
+      if (uint64_t at = cb(std::string_view{e.key->first}); at > 0)
+        Add(e.key, at);
+    }
+    if (state.refs == 0)
+      Erase(e.key);
+  });
+}
+
 // A single Db table that represents a table that can be chosen with "SELECT" command.
 struct DbTable : boost::intrusive_ref_counter<DbTable, boost::thread_unsafe_counter> {
   PrimeTable prime;
@@ -128,13 +272,45 @@ struct DbTable : boost::intrusive_ref_counter<DbTable, boost::thread_unsafe_coun
 
   mutable DbTableStats stats;
   std::vector<SlotStats> slots_stats;
+  std::vector<SlotLoad> slots_load;
+  uint64_t slots_load_time_ms = 0;  // Of the last update of slots_load.
   ExpireTable::Cursor expire_cursor;
 
+  // Optional index of the keys with expiry by their deadlines, see
+  // DbSlice::DeleteExpiredFromWheel. Keys are not removed when they are deleted or their expiry
+  // changes, instead they are validated against the expire table when they fire.
+  std::unique_ptr<ExpireWheel> expire_wheel;
+
+  // Optional index of the expire table buckets by the coarse deadlines of their keys, see
+  // DbSlice::DeleteExpiredFromBuckets.
+  std::unique_ptr<ExpireBuckets> expire_buckets;
+
+  // Entry of field_expire_wheel: a hash or a set with expiring fields and the cursor of its
+  // ongoing DenseSet::DeleteExpiredStep pass.
+  struct FieldExpiryTask {
+    std::string key;
+    uint32_t cursor = 0;
+  };
+
+  // Optional index of the hashes and sets by the expiry of their fields, scheduled whenever a
+  // container's DenseSet::NextExpiry decreases, see DbSlice::DeleteExpiredFields.
+  std::unique_ptr<TimerWheel<FieldExpiryTask>> field_expire_wheel;
+
+  // Optional index of the keys by their slots in cluster mode, see DbSlice::FlushSlotsFb and
+  // RestoreStreamer::Start. Maintained together with slots_stats.
+  std::unique_ptr<SlotKeyIndex> slot_keys;
+
+  // Segment ids to continue merging from, see DbSlice::MergeSegmentsStep.
+  uint32_t prime_merge_cursor = 0;
+  uint32_t expire_merge_cursor = 0;
+
   TopKeys top_keys;
   DbIndex index;
   uint32_t thread_index;
 
-  explicit DbTable(PMR_NS::memory_resource* mr, DbIndex index);
+  // segment_mr, if set, is used for the segments of the prime table.
+  explicit DbTable(PMR_NS::memory_resource* mr, DbIndex index,
+                   PMR_NS::memory_resource* segment_mr = nullptr);
   ~DbTable();
 
   void Clear();
@@ -243,9 +243,8 @@ void BaseFamilyTest::ResetService() {
           }
 
           LOG(ERROR) << "TxLocks for shard " << es->shard_id();
-          for (const auto& k_v : es->db_slice().GetDBTable(0)->trans_locks) {
-            LOG(ERROR) << "Key " << k_v.first << " " << k_v.second;
-          }
+          es->db_slice().GetDBTable(0)->trans_locks.ForEach(
+              [](LockFp fp, const IntentLock& lock) { LOG(ERROR) << "Key " << fp << " " << lock; });
         }
       });
     }
@@ -470,6 +469,17 @@ auto BaseFamilyTest::GetMC(MP::CmdType cmd_type, std::initializer_list<std::stri
   return conn->SplitLines();
 }
 
+auto BaseFamilyTest::RunMC(const MP::Command& cmd, std::string_view value) -> MCResponse {
+  if (!ProactorBase::IsProactorThread()) {
+    return pp_->at(0)->Await([&] { return this->RunMC(cmd, value); });
+  }
+
+  TestConnWrapper* conn = AddFindConn(Protocol::MEMCACHE, GetId());
+  service_->DispatchMC(cmd, value, conn->cmd_cntx());
+
+  return conn->SplitLines();
+}
+
 int64_t BaseFamilyTest::CheckedInt(ArgSlice list) {
   RespExpr resp = Run(list);
   if (resp.type == RespExpr::INT64) {
@@ -11,13 +11,24 @@
 #include <optional>
 #include <variant>
 
+extern "C" {
+#include "redis/intset.h"
+#include "redis/listpack.h"
+#include "redis/redis_aux.h"
+#include "redis/zmalloc.h"
+}
+
 #include "absl/cleanup/cleanup.h"
+#include "absl/strings/str_split.h"
 #include "absl/flags/internal/flag.h"
 #include "base/flags.h"
 #include "base/logging.h"
+#include "core/small_set.h"
+#include "core/value_compressor.h"
 #include "server/common.h"
 #include "server/db_slice.h"
 #include "server/engine_shard_set.h"
+#include "server/server_state.h"
 #include "server/snapshot.h"
 #include "server/table.h"
 #include "server/tiering/common.h"
@@ -31,6 +42,29 @@ ABSL_FLAG(bool, tiered_storage_cache_fetched, true,
 ABSL_FLAG(size_t, tiered_storage_write_depth, 50,
           "Maximum number of concurrent stash requests issued by background offload");
 
+ABSL_FLAG(uint32_t, tiered_storage_promote_min_reads, 1,
+          "Number of reads of an offloaded value after which it is loaded back to memory, if "
+          "tiered_storage_cache_fetched is set. Modified values are always loaded");
+
+ABSL_FLAG(float, tiered_storage_compaction_ratio, 0,
+          "Values on pages of the backing file that are used less than this ratio are moved out, "
+          "so that the pages can be released. 0 disables compaction");
+
+ABSL_FLAG(size_t, tiered_storage_compaction_budget, 1UL << 20,
+          "Maximum number of bytes read by a single compaction step");
+
+ABSL_FLAG(bool, tiered_storage_containers, false,
+          "Also offload hashes, sets and sorted sets in their compact encodings. They are read "
+          "back to memory on access, blocking the shard thread for the read");
+
+ABSL_FLAG(bool, tiered_storage_compression, false,
+          "Compress offloaded strings with zstd if it saves space. Reads decompress them");
+
+ABSL_FLAG(bool, tiered_storage_persistent, false,
+          "Keep the backing files on shutdown. The snapshot saved on shutdown then refers to the "
+          "offloaded values instead of copying them, and the next start restores them as "
+          "offloaded. Requires the same backing files and number of threads");
+
 namespace dfly {
 
 using namespace std;
@@ -46,6 +80,38 @@ bool OccupiesWholePages(size_t size) {
   return size >= TieredStorage::kMinOccupancySize;
 }
 
+// Containers are offloaded only in their compact encodings, which are single heap blobs that can
+// be stored and restored as is. Returns an empty view for other values.
+string_view ContainerBlob(const PrimeValue& pv) {
+  unsigned type = pv.ObjType(), encoding = pv.Encoding();
+  if ((type == OBJ_HASH && encoding == kEncodingListPack) ||
+      (type == OBJ_ZSET && encoding == OBJ_ENCODING_LISTPACK)) {
+    uint8_t* lp = static_cast<uint8_t*>(pv.RObjPtr());
+    return {reinterpret_cast<char*>(lp), lpBytes(lp)};
+  }
+  if (type == OBJ_SET && encoding == kEncodingIntSet) {
+    intset* is = static_cast<intset*>(pv.RObjPtr());
+    return {reinterpret_cast<char*>(is), intsetBlobLen(is)};
+  }
+  if (type == OBJ_SET && encoding == kEncodingSmallSet) {
+    SmallSet* ss = static_cast<SmallSet*>(pv.RObjPtr());
+    return {reinterpret_cast<char*>(ss), ss->BlobLen()};
+  }
+  return {};
+}
+
+// Restores value of the given type and encoding from its stashed bytes
+void SetValue(string_view value, unsigned type, unsigned encoding, PrimeValue* pv) {
+  if (type == OBJ_STRING) {
+    pv->SetString(value);
+    return;
+  }
+
+  void* blob = zmalloc(value.size());
+  memcpy(blob, value.data(), value.size());
+  pv->InitRobj(type, encoding, blob);
+}
+
 // Stashed bins no longer have bin ids, so this sentinel is used to differentiate from regular reads
 constexpr auto kFragmentedBin = tiering::SmallBins::kInvalidBin - 1;
 
@@ -58,6 +124,7 @@ class TieredStorage::ShardOpManager : public tiering::OpManager {
   ShardOpManager(TieredStorage* ts, DbSlice* db_slice, size_t max_size)
       : tiering::OpManager{max_size}, ts_{ts}, db_slice_{db_slice} {
     cache_fetched_ = absl::GetFlag(FLAGS_tiered_storage_cache_fetched);
+    promote_min_reads_ = absl::GetFlag(FLAGS_tiered_storage_promote_min_reads);
   }
 
   // Called before overriding value with segment
@@ -81,7 +148,15 @@ class TieredStorage::ShardOpManager : public tiering::OpManager {
       RecordAdded(db_slice_->MutableStats(key.first), *pv, segment);
 
       pv->SetIoPending(false);
-      pv->SetExternal(segment.offset, segment.length);
+      // Strings are stashed as is or compressed, in which case the blob is shorter
+      size_t raw_size = pv->Size();
+      if (pv->ObjType() == OBJ_STRING && segment.length < raw_size) {
+        pv->SetExternalCompressed(segment.offset, segment.length, raw_size);
+        stats_.total_compressed_stashes++;
+        stats_.compression_saved_bytes += raw_size - segment.length;
+      } else {
+        pv->SetExternal(segment.offset, segment.length, pv->ObjType(), pv->Encoding());
+      }
 
       stats_.total_stashes++;
     }
@@ -109,9 +184,17 @@ class TieredStorage::ShardOpManager : public tiering::OpManager {
 
   // Set value to be an in-memory type again, either empty or with a value. Update memory stats
   void SetInMemory(PrimeValue* pv, DbIndex dbid, string_view value, tiering::DiskSegment segment) {
+    unsigned type = pv->ObjType(), encoding = pv->Encoding();
+    bool has_expire = pv->HasExpire(), sticky = pv->IsSticky();
+    if (pv->IsExternalCompressed())
+      stats_.compression_saved_bytes -= pv->Size() - segment.length;
+
     pv->Reset();
-    if (!value.empty())
-      pv->SetString(value);
+    if (!value.empty()) {
+      SetValue(value, type, encoding, pv);
+      pv->SetExpire(has_expire);
+      pv->SetSticky(sticky);
+    }
 
     RecordDeleted(db_slice_->MutableStats(dbid), *pv, segment);
 
@@ -145,7 +228,13 @@ class TieredStorage::ShardOpManager : public tiering::OpManager {
 
       // Cut out relevant part of value and restore it to memory
       string_view sub_value = value.substr(sub_segment.offset - segment.offset, sub_segment.length);
-      SetInMemory(&it->second, dbid, sub_value, sub_segment);
+      if (it->second.IsExternalCompressed()) {
+        string raw(it->second.Size(), '\0');
+        ValueCompressor::Decompress(sub_value, raw.data());
+        SetInMemory(&it->second, dbid, raw, sub_segment);
+      } else {
+        SetInMemory(&it->second, dbid, sub_value, sub_segment);
+      }
     }
   }
 
@@ -165,17 +254,27 @@ class TieredStorage::ShardOpManager : public tiering::OpManager {
       return true;  // delete
     }
 
-    if (!modified && !cache_fetched_)
+    if (!modified && (!cache_fetched_ || ts_->frozen_))
       return false;
 
     if (SliceSnapshot::IsSnaphotInProgress())
       return false;
 
-    SetInMemory(get<OpManager::KeyRef>(id), value, segment);
+    auto key = get<OpManager::KeyRef>(id);
+    if (!modified && !ShouldPromote(key)) {
+      stats_.total_uncached_reads++;
+      return false;
+    }
+
+    SetInMemory(key, value, segment);
     return true;
   }
 
   bool ReportDelete(tiering::DiskSegment segment) override {
+    // The snapshot saved on shutdown refers to the segment
+    if (ts_->frozen_)
+      return false;
+
     if (OccupiesWholePages(segment.length))
       return true;
 
@@ -203,11 +302,21 @@ class TieredStorage::ShardOpManager : public tiering::OpManager {
     return IsValid(it) ? &it->second : nullptr;
   }
 
+  // Whether a value that was read without modifications was read often enough to be loaded back
+  bool ShouldPromote(OpManager::KeyRef key) {
+    auto pv = Find(key);
+    return !pv || !pv->IsExternal() || pv->IncrementExternalReads() >= promote_min_reads_;
+  }
+
   bool cache_fetched_ = false;
+  unsigned promote_min_reads_ = 1;
 
   struct {
     size_t total_stashes = 0, total_fetches = 0, total_cancels = 0, total_deletes = 0;
     size_t total_defrags = 0;  // included in total_fetches
+    size_t total_hot_skips = 0, total_uncached_reads = 0, total_range_reads = 0;
+    size_t total_compactions = 0;
+    size_t total_compressed_stashes = 0, compression_saved_bytes = 0;
   } stats_;
 
   TieredStorage* ts_;
@@ -217,17 +326,24 @@ class TieredStorage::ShardOpManager : public tiering::OpManager {
 TieredStorage::TieredStorage(DbSlice* db_slice, size_t max_size)
     : op_manager_{make_unique<ShardOpManager>(this, db_slice, max_size)},
       bins_{make_unique<tiering::SmallBins>()} {
+  stash_containers_ = absl::GetFlag(FLAGS_tiered_storage_containers);
+  persistent_ = absl::GetFlag(FLAGS_tiered_storage_persistent);
+  if (absl::GetFlag(FLAGS_tiered_storage_compression))
+    compressor_ = make_unique<ValueCompressor>(kMinValueSize);
 }
 
 TieredStorage::~TieredStorage() {
 }
 
 error_code TieredStorage::Open(string_view path) {
-  return op_manager_->Open(absl::StrCat(path, ProactorBase::me()->GetPoolIndex()));
+  vector<string> files;
+  for (string_view prefix : absl::StrSplit(path, ',', absl::SkipWhitespace()))
+    files.push_back(absl::StrCat(prefix, ProactorBase::me()->GetPoolIndex()));
+  return op_manager_->Open(files, persistent_);
 }
 
 void TieredStorage::Close() {
-  op_manager_->Close();
+  op_manager_->Close(frozen_);
 }
 
 util::fb2::Future<string> TieredStorage::Read(DbIndex dbid, string_view key,
@@ -238,7 +354,8 @@ util::fb2::Future<string> TieredStorage::Read(DbIndex dbid, string_view key,
     future.Resolve(*value);
     return false;
   };
-  op_manager_->Enqueue(KeyRef(dbid, key), value.GetExternalSlice(), std::move(cb));
+  op_manager_->Enqueue(KeyRef(dbid, key), value.GetExternalSlice(), std::move(cb),
+                       value.IsExternalCompressed());
   return future;
 }
 
@@ -249,7 +366,67 @@ void TieredStorage::Read(DbIndex dbid, std::string_view key, const PrimeValue& v
     readf(*value);
     return false;
   };
-  op_manager_->Enqueue(KeyRef(dbid, key), value.GetExternalSlice(), std::move(cb));
+  op_manager_->Enqueue(KeyRef(dbid, key), value.GetExternalSlice(), std::move(cb),
+                       value.IsExternalCompressed());
+}
+
+util::fb2::Future<string> TieredStorage::ReadRange(DbIndex dbid, string_view key,
+                                                   const PrimeValue& value, size_t offset,
+                                                   size_t length) {
+  DCHECK(value.IsExternal());
+  tiering::DiskSegment segment = value.GetExternalSlice();
+  util::fb2::Future<string> future;
+
+  // Small values share pages with others and compressed ones must be decompressed whole
+  if (value.IsExternalCompressed() || segment.length < kMinOccupancySize) {
+    auto cb = [future, offset, length](string* value) mutable {
+      future.Resolve(value->substr(offset, length));
+      return false;
+    };
+    op_manager_->Enqueue(KeyRef(dbid, key), segment, std::move(cb), value.IsExternalCompressed());
+    return future;
+  }
+
+  auto cb = [future](string_view value, error_code ec) mutable {
+    LOG_IF(ERROR, ec) << "Failed to read range of offloaded value " << ec.message();
+    future.Resolve(string{ec ? string_view{} : value});
+  };
+  op_manager_->stats_.total_range_reads++;
+  op_manager_->ReadRange(segment, offset, length, std::move(cb));
+  return future;
+}
+
+void TieredStorage::Load(DbIndex dbid, PrimeValue* value) {
+  DCHECK(value->IsExternal());
+  tiering::DiskSegment segment = value->GetExternalSlice();
+
+  string blob;
+  if (auto ec = op_manager_->ReadSync(segment, &blob); ec) {
+    LOG(ERROR) << "Failed to load offloaded value " << ec.message();
+    return;
+  }
+
+  op_manager_->Delete(segment);
+  op_manager_->SetInMemory(value, dbid, blob, segment);
+}
+
+bool TieredStorage::ShouldLoad(PrimeValue* value) {
+  DCHECK(value->IsExternal());
+  if (!op_manager_->cache_fetched_ || frozen_)
+    return false;
+  return value->IncrementExternalReads() >= op_manager_->promote_min_reads_;
+}
+
+error_code TieredStorage::ReadContainer(const PrimeValue& value, string* blob) {
+  DCHECK(value.IsExternal() && value.ObjType() != OBJ_STRING);
+  op_manager_->stats_.total_uncached_reads++;
+  return op_manager_->ReadSync(value.GetExternalSlice(), blob);
+}
+
+PrimeValue TieredStorage::DecodeValue(unsigned type, unsigned encoding, string_view value) {
+  PrimeValue pv;
+  SetValue(value, type, encoding, &pv);
+  return pv;
 }
 
 template <typename T>
@@ -262,7 +439,8 @@ util::fb2::Future<T> TieredStorage::Modify(DbIndex dbid, std::string_view key,
     future.Resolve(modf(value));
     return true;
   };
-  op_manager_->Enqueue(KeyRef(dbid, key), value.GetExternalSlice(), std::move(cb));
+  op_manager_->Enqueue(KeyRef(dbid, key), value.GetExternalSlice(), std::move(cb),
+                       value.IsExternalCompressed());
   return future;
 }
 
@@ -274,12 +452,19 @@ void TieredStorage::Stash(DbIndex dbid, string_view key, PrimeValue* value) {
   DCHECK(!value->IsExternal() && !value->HasIoPending());
 
   string buf;
-  string_view value_sv = value->GetSlice(&buf);
+  string_view value_sv =
+      value->ObjType() == OBJ_STRING ? value->GetSlice(&buf) : ContainerBlob(*value);
   value->SetIoPending(true);
 
+  // The compressed blob is copied by the stash below, before the compressor is used again
+  if (compressor_ && value->ObjType() == OBJ_STRING && value_sv.size() < (1u << 24)) {
+    if (auto blob = compressor_->Compress(value_sv); blob)
+      value_sv = *blob;
+  }
+
   tiering::OpManager::EntryId id;
   error_code ec;
-  if (OccupiesWholePages(value->Size())) {  // large enough for own page
+  if (OccupiesWholePages(value_sv.size())) {  // large enough for own page
     id = KeyRef(dbid, key);
     ec = op_manager_->Stash(id, value_sv);
   } else if (auto bin = bins_->Stash(dbid, key, value_sv); bin) {
@@ -302,16 +487,65 @@ void TieredStorage::Delete(DbIndex dbid, PrimeValue* value) {
 
 void TieredStorage::CancelStash(DbIndex dbid, std::string_view key, PrimeValue* value) {
   DCHECK(value->HasIoPending());
-  if (OccupiesWholePages(value->Size())) {
-    op_manager_->Delete(KeyRef(dbid, key));
-  } else if (auto bin = bins_->Delete(dbid, key); bin) {
-    op_manager_->Delete(*bin);
+  // Whether the value was stashed to its own pages depends on its compressed size, so the key is
+  // looked up among the pending whole page stashes first
+  if (!op_manager_->Delete(KeyRef(dbid, key))) {
+    if (auto bin = bins_->Delete(dbid, key); bin)
+      op_manager_->Delete(*bin);
   }
   value->SetIoPending(false);
 }
 
+void TieredStorage::FreezeForShutdown() {
+  frozen_ = persistent_;
+}
+
+uint64_t TieredStorage::file_id() const {
+  return op_manager_->file_id();
+}
+
+bool TieredStorage::Restore(DbIndex dbid, uint64_t file_id, PrimeValue* pv) {
+  DCHECK(pv->IsExternal());
+  if (file_id == 0 || file_id != op_manager_->restored_file_id())
+    return false;
+
+  tiering::DiskSegment segment = pv->GetExternalSlice();
+  if (OccupiesWholePages(segment.length)) {
+    if (!op_manager_->Claim(segment))
+      return false;
+  } else if (bins_->Restore(segment)) {
+    tiering::DiskSegment page{segment.ContainingPages().offset, tiering::kPageSize};
+    if (!op_manager_->Claim(page)) {
+      bins_->Delete(segment);
+      return false;
+    }
+  }
+
+  // The value is accounted as if it was stashed in this run
+  op_manager_->RecordAdded(op_manager_->db_slice_->MutableStats(dbid), *pv, segment);
+  op_manager_->stats_.total_stashes++;
+  if (pv->IsExternalCompressed()) {
+    op_manager_->stats_.total_compressed_stashes++;
+    op_manager_->stats_.compression_saved_bytes += pv->Size() - segment.length;
+  }
+  return true;
+}
+
+bool TieredStorage::StashBlocked() const {
+  // Segments that are restored while loading must not be overlapped by new allocations
+  return frozen_ || (op_manager_->restored_file_id() != 0 &&
+                     ServerState::tlocal()->gstate() == GlobalState::LOADING);
+}
+
 bool TieredStorage::ShouldStash(const PrimeValue& pv) const {
-  return !pv.IsExternal() && pv.ObjType() == OBJ_STRING && pv.Size() >= kMinValueSize;
+  if (pv.IsExternal() || StashBlocked())
+    return false;
+  // Offloading a value that other values share would free no memory.
+  if (pv.SharedRefCount() > 1)
+    return false;
+  if (pv.ObjType() == OBJ_STRING)
+    return pv.Size() >= kMinValueSize;
+  return stash_containers_ && ContainerBlob(pv).size() >= kMinValueSize;
 }
 
 TieredStats TieredStorage::GetStats() const {
@@ -323,14 +557,32 @@ TieredStats TieredStorage::GetStats() const {
     stats.total_stashes = shard_stats.total_stashes;
     stats.total_cancels = shard_stats.total_cancels;
     stats.total_defrags = shard_stats.total_defrags;
+    stats.total_hot_skips = shard_stats.total_hot_skips;
+    stats.total_uncached_reads = shard_stats.total_uncached_reads;
+    stats.total_range_reads = shard_stats.total_range_reads;
+    stats.total_compactions = shard_stats.total_compactions;
+    stats.total_compressed_stashes = shard_stats.total_compressed_stashes;
+    stats.compression_saved_bytes = shard_stats.compression_saved_bytes;
   }
 
   {  // OpManager stats
     tiering::OpManager::Stats op_stats = op_manager_->GetStats();
     stats.pending_read_cnt = op_stats.pending_read_cnt;
     stats.pending_stash_cnt = op_stats.pending_stash_cnt;
-    stats.allocated_bytes = op_stats.disk_stats.allocated_bytes;
-    stats.capacity_bytes = op_stats.disk_stats.capacity_bytes;
+    stats.queue_wait_usec = op_stats.queue_wait_usec;
+
+    const auto& disk_stats = op_stats.disk_stats;
+    stats.allocated_bytes = disk_stats.allocated_bytes;
+    stats.capacity_bytes = disk_stats.capacity_bytes;
+    stats.pending_io_cnt = disk_stats.pending_ops;
+    stats.small_page_bytes = disk_stats.class_page_bytes[tiering::detail::SMALL_P];
+    stats.small_page_allocated_bytes = disk_stats.class_allocated_bytes[tiering::detail::SMALL_P];
+    stats.medium_page_bytes = disk_stats.class_page_bytes[tiering::detail::MEDIUM_P];
+    stats.medium_page_allocated_bytes = disk_stats.class_allocated_bytes[tiering::detail::MEDIUM_P];
+
+    stats.read_usec = disk_stats.read_usec;
+    stats.stash_usec = disk_stats.stash_usec;
+    stats.pending_io_depth = disk_stats.pending_ops_hist;
   }
 
   {  // SmallBins stats
@@ -344,7 +596,7 @@ TieredStats TieredStorage::GetStats() const {
 }
 
 void TieredStorage::RunOffloading(DbIndex dbid) {
-  if (SliceSnapshot::IsSnaphotInProgress())
+  if (SliceSnapshot::IsSnaphotInProgress() || StashBlocked())
     return;
 
   PrimeTable& table = op_manager_->db_slice_->GetDBTable(dbid)->prime;
@@ -359,7 +611,19 @@ void TieredStorage::RunOffloading(DbIndex dbid) {
       return;
 
     if (ShouldStash(it->second)) {
-      Stash(dbid, it->first.GetSlice(&tmp), &it->second);
+      // Give keys that were accessed since the last pass a second chance to stay in memory
+      if (it->first.WasTouched()) {
+        it->first.SetTouched(false);
+        op_manager_->stats_.total_hot_skips++;
+        return;
+      }
+
+      // Stashing frees the value, which may still be referenced by a reply of a locked key.
+      string_view key = it->first.GetSlice(&tmp);
+      if (!op_manager_->db_slice_->CheckLock(IntentLock::EXCLUSIVE, dbid, key))
+        return;
+
+      Stash(dbid, key, &it->second);
       stash_limit--;
     }
   };
@@ -374,4 +638,37 @@ void TieredStorage::RunOffloading(DbIndex dbid) {
   } while (offloading_cursor_ != start_cursor && stash_limit > 0 && iterations++ < 100);
 }
 
+void TieredStorage::RunCompaction(DbIndex dbid) {
+  float ratio = absl::GetFlag(FLAGS_tiered_storage_compaction_ratio);
+  DbTable* table = op_manager_->db_slice_->GetDBTable(dbid);
+  if (ratio <= 0 || table->stats.tiered_entries == 0 || SliceSnapshot::IsSnaphotInProgress() ||
+      frozen_)
+    return;
+
+  int64_t budget = absl::GetFlag(FLAGS_tiered_storage_compaction_budget);
+  std::string tmp;
+  auto cb = [this, dbid, ratio, &tmp, &budget](PrimeIterator it) {
+    if (budget <= 0 || !it->second.IsExternal())
+      return;
+
+    tiering::DiskSegment segment = it->second.GetExternalSlice();
+    if (op_manager_->PageUsage(segment.offset) >= ratio)
+      return;
+
+    // Reporting the read as a modification loads the value back to memory and frees its segment.
+    // Offloading stashes it again later, filling pages that are in use.
+    string_view key = it->first.GetSlice(&tmp);
+    op_manager_->Enqueue(KeyRef(dbid, key), segment, [](std::string*) { return true; },
+                         it->second.IsExternalCompressed());
+    op_manager_->stats_.total_compactions++;
+    budget -= segment.ContainingPages().length;
+  };
+
+  PrimeTable::Cursor start_cursor{};
+  size_t iterations = 0;
+  do {
+    compaction_cursor_ = table->prime.TraverseBySegmentOrder(compaction_cursor_, cb);
+  } while (compaction_cursor_ != start_cursor && budget > 0 && iterations++ < 100);
+}
+
 }  // namespace dfly
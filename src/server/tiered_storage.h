@@ -19,6 +19,7 @@
 namespace dfly {
 
 class DbSlice;
+class ValueCompressor;
 
 namespace tiering {
 class SmallBins;
@@ -40,6 +41,8 @@ class TieredStorage {
   TieredStorage(TieredStorage&& other) = delete;
   TieredStorage(const TieredStorage& other) = delete;
 
+  // Open backing files for the given path prefix or comma separated list of prefixes, one per
+  // device
   std::error_code Open(std::string_view path);
   void Close();
 
@@ -50,6 +53,26 @@ class TieredStorage {
   void Read(DbIndex dbid, std::string_view key, const PrimeValue& value,
             std::function<void(const std::string&)> readf);
 
+  // Read length bytes at offset of offloaded string, which must be within its size. Uncompressed
+  // values taking up whole pages are read only from the pages covering the range and stay
+  // offloaded, while others are read whole
+  util::fb2::Future<std::string> ReadRange(DbIndex dbid, std::string_view key,
+                                           const PrimeValue& value, size_t offset, size_t length);
+
+  // Read offloaded container back to memory and free its segment. Blocks the thread on the read,
+  // as container commands can't wait for it inside their callbacks
+  void Load(DbIndex dbid, PrimeValue* value);
+
+  // Whether a lookup that only reads an offloaded container should Load it rather than look it up
+  // in a copy from ReadContainer. Counts the read, see tiered_storage_promote_min_reads
+  bool ShouldLoad(PrimeValue* value);
+
+  // Read blob of offloaded container without loading it to memory. Blocks the thread like Load
+  std::error_code ReadContainer(const PrimeValue& value, std::string* blob);
+
+  // Build in-memory value of the type and encoding of an offloaded one from the bytes read for it
+  static PrimeValue DecodeValue(unsigned type, unsigned encoding, std::string_view value);
+
   // Apply modification to offloaded value, return generic result from callback
   template <typename T>
   util::fb2::Future<T> Modify(DbIndex dbid, std::string_view key, const PrimeValue& value,
@@ -67,16 +90,44 @@ class TieredStorage {
   // Returns if a value should be stashed
   bool ShouldStash(const PrimeValue& pv) const;
 
+  // With persistent backing files, stop changing them so that the snapshot saved on shutdown can
+  // refer to offloaded values. Nothing is stashed or freed afterwards and the files are kept on
+  // Close
+  void FreezeForShutdown();
+
+  bool IsFrozen() const {
+    return frozen_;
+  }
+
+  // Id of the backing files that is stored in references to offloaded values
+  uint64_t file_id() const;
+
+  // Take over offloaded value whose reference was loaded from a snapshot. Returns false if the
+  // backing files were not kept with the given id or the segment can't be claimed
+  bool Restore(DbIndex dbid, uint64_t file_id, PrimeValue* pv);
+
   TieredStats GetStats() const;
 
   // Run offloading loop until i/o device is loaded or all entries were traversed
   void RunOffloading(DbIndex dbid);
 
+  // Move offloaded values out of sparsely used pages of the backing file, within the compaction
+  // i/o budget, so that the pages can be released
+  void RunCompaction(DbIndex dbid);
+
  private:
+  // Whether the backing files must not get new allocations
+  bool StashBlocked() const;
+
   PrimeTable::Cursor offloading_cursor_{};  // where RunOffloading left off
+  PrimeTable::Cursor compaction_cursor_{};  // where RunCompaction left off
+  bool stash_containers_ = false;
+  bool persistent_ = false;  // keep backing files for the next start
+  bool frozen_ = false;      // set by FreezeForShutdown
 
   std::unique_ptr<ShardOpManager> op_manager_;
   std::unique_ptr<tiering::SmallBins> bins_;
+  std::unique_ptr<ValueCompressor> compressor_;  // set if stashed strings are compressed
 };
 
 }  // namespace dfly
@@ -115,12 +166,32 @@ class TieredStorage {
     return {};
   }
 
+  util::fb2::Future<std::string> ReadRange(DbIndex dbid, std::string_view key,
+                                           const PrimeValue& value, size_t offset, size_t length) {
+    return {};
+  }
+
   template <typename T>
   util::fb2::Future<T> Modify(DbIndex dbid, std::string_view key, const PrimeValue& value,
                               std::function<T(std::string*)> modf) {
     return {};
   }
 
+  void Load(DbIndex dbid, PrimeValue* value) {
+  }
+
+  bool ShouldLoad(PrimeValue* value) {
+    return true;
+  }
+
+  std::error_code ReadContainer(const PrimeValue& value, std::string* blob) {
+    return {};
+  }
+
+  static PrimeValue DecodeValue(unsigned type, unsigned encoding, std::string_view value) {
+    return {};
+  }
+
   void Stash(DbIndex dbid, std::string_view key, PrimeValue* value) {
   }
 
@@ -134,12 +205,30 @@ class TieredStorage {
     return false;
   }
 
+  void FreezeForShutdown() {
+  }
+
+  bool IsFrozen() const {
+    return false;
+  }
+
+  uint64_t file_id() const {
+    return 0;
+  }
+
+  bool Restore(DbIndex dbid, uint64_t file_id, PrimeValue* pv) {
+    return false;
+  }
+
   TieredStats GetStats() const {
     return {};
   }
 
   void RunOffloading(DbIndex dbid) {
   }
+
+  void RunCompaction(DbIndex dbid) {
+  }
 };
 
 }  // namespace dfly
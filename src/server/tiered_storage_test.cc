@@ -4,6 +4,7 @@
 
 #include "server/tiered_storage.h"
 
+#include <absl/random/random.h>
 #include <absl/strings/str_cat.h>
 #include <gmock/gmock.h>
 #include <gtest/gtest.h>
@@ -26,6 +27,12 @@ ABSL_DECLARE_FLAG(string, tiered_prefix);
 ABSL_DECLARE_FLAG(bool, tiered_storage_cache_fetched);
 ABSL_DECLARE_FLAG(bool, backing_file_direct);
 ABSL_DECLARE_FLAG(float, tiered_offload_threshold);
+ABSL_DECLARE_FLAG(bool, tiered_storage_containers);
+ABSL_DECLARE_FLAG(uint32_t, tiered_storage_promote_min_reads);
+ABSL_DECLARE_FLAG(bool, tiered_storage_compression);
+ABSL_DECLARE_FLAG(uint64_t, snapshot_tiered_read_limit);
+ABSL_DECLARE_FLAG(bool, tiered_storage_persistent);
+ABSL_DECLARE_FLAG(string, dbfilename);
 
 namespace dfly {
 
@@ -119,6 +126,26 @@ TEST_F(TieredStorageTest, SimpleAppend) {
   }
 }
 
+TEST_F(TieredStorageTest, GetRange) {
+  string val;
+  for (char c = 'A'; c <= 'D'; c++)
+    val.append(tiering::kPageSize, c);
+  Run({"SET", "large", val});
+  ExpectConditionWithinTimeout([this] { return GetMetrics().db_stats[0].tiered_entries == 1; });
+
+  // Only the pages covering the range are read, and the value stays offloaded
+  size_t start = tiering::kPageSize + 10;
+  size_t end = 2 * tiering::kPageSize + 10;
+  auto resp = Run({"GETRANGE", "large", absl::StrCat(start), absl::StrCat(end)});
+  EXPECT_EQ(resp, val.substr(start, end - start + 1));
+  EXPECT_EQ(Run({"GETRANGE", "large", "-3", "-1"}), "DDD");
+
+  auto metrics = GetMetrics();
+  EXPECT_EQ(metrics.tiered_stats.total_range_reads, 2);
+  EXPECT_EQ(metrics.db_stats[0].tiered_entries, 1);
+  EXPECT_EQ(metrics.tiered_stats.total_fetches, 0);
+}
+
 TEST_F(TieredStorageTest, MultiDb) {
   for (size_t i = 0; i < 10; i++) {
     Run({"SELECT", absl::StrCat(i)});
@@ -194,6 +221,68 @@ TEST_F(TieredStorageTest, BackgroundOffloading) {
   EXPECT_EQ(metrics.tiered_stats.total_stashes, 2 * kNum);
   EXPECT_EQ(metrics.tiered_stats.total_fetches, kNum);
   EXPECT_EQ(metrics.tiered_stats.allocated_bytes, kNum * 4096);
+
+  // The fetched keys were read since the previous pass, so they were skipped once
+  EXPECT_GE(metrics.tiered_stats.total_hot_skips, kNum);
+}
+
+TEST_F(TieredStorageTest, PromoteRepeatedReads) {
+  absl::FlagSaver saver;
+  absl::SetFlag(&FLAGS_tiered_storage_promote_min_reads, 2);
+  ResetService();
+
+  Run({"SET", "k", string(3000, 'A')});
+  ExpectConditionWithinTimeout([this] { return GetMetrics().db_stats[0].tiered_entries == 1; });
+
+  // The first read is served from disk only
+  EXPECT_EQ(Run({"GET", "k"}), string(3000, 'A'));
+  auto metrics = GetMetrics();
+  EXPECT_EQ(metrics.db_stats[0].tiered_entries, 1);
+  EXPECT_EQ(metrics.tiered_stats.total_uncached_reads, 1);
+
+  EXPECT_EQ(Run({"GET", "k"}), string(3000, 'A'));
+  metrics = GetMetrics();
+  EXPECT_EQ(metrics.db_stats[0].tiered_entries, 0);
+  EXPECT_EQ(metrics.tiered_stats.total_fetches, 1);
+}
+
+TEST_F(TieredStorageTest, Compression) {
+  absl::FlagSaver saver;
+  absl::SetFlag(&FLAGS_tiered_storage_compression, true);
+  absl::SetFlag(&FLAGS_tiered_storage_promote_min_reads, 3);
+  ResetService();
+
+  // Digits compress to about half, random bytes don't compress
+  string digits, random(3000, '\0');
+  for (unsigned i = 0; digits.size() < 20000; i++)
+    absl::StrAppend(&digits, (i * 7919u) % 1000003);
+  absl::BitGen gen;
+  for (char& c : random)
+    c = absl::Uniform<uint8_t>(gen);
+
+  Run({"SET", "digits", digits});
+  Run({"SET", "random", random});
+  ExpectConditionWithinTimeout([this] { return GetMetrics().db_stats[0].tiered_entries == 2; });
+
+  auto metrics = GetMetrics();
+  EXPECT_EQ(metrics.tiered_stats.total_compressed_stashes, 1);
+  EXPECT_GT(metrics.tiered_stats.compression_saved_bytes, digits.size() / 3);
+  EXPECT_EQ(metrics.db_stats[0].tiered_used_bytes,
+            digits.size() + random.size() - metrics.tiered_stats.compression_saved_bytes);
+
+  // Reads from disk see the decompressed value
+  EXPECT_EQ(Run({"GET", "digits"}), digits);
+  EXPECT_THAT(Run({"STRLEN", "digits"}), IntArg(digits.size()));
+  EXPECT_THAT(Run({"MGET", "digits", "random"}), RespArray(ElementsAre(digits, random)));
+
+  // Modifications load the decompressed value to memory
+  EXPECT_THAT(Run({"APPEND", "digits", "B"}), IntArg(digits.size() + 1));
+  EXPECT_EQ(Run({"GET", "digits"}), digits + 'B');
+
+  Run({"DEL", "digits", "random"});
+  metrics = GetMetrics();
+  EXPECT_EQ(metrics.db_stats[0].tiered_entries, 0);
+  EXPECT_EQ(metrics.tiered_stats.compression_saved_bytes, 0);
 }
 
 TEST_F(TieredStorageTest, FlushAll) {
@@ -225,4 +314,130 @@ TEST_F(TieredStorageTest, FlushAll) {
   EXPECT_GT(metrics.tiered_stats.total_fetches, 2u);
 }
 
+TEST_F(TieredStorageTest, SnapshotOffloaded) {
+  absl::FlagSaver saver;
+  absl::SetFlag(&FLAGS_tiered_offload_threshold, 0.0f);  // offload all values
+  absl::SetFlag(&FLAGS_snapshot_tiered_read_limit, 16'000);
+
+  const int kNum = 500;
+  for (size_t i = 0; i < kNum; i++) {
+    Run({"SET", absl::StrCat("k", i), string(3000, 'a' + i % 26)});
+  }
+  ExpectConditionWithinTimeout([&] { return GetMetrics().db_stats[0].tiered_entries == kNum; });
+
+  // The values are serialized from their reads without being loaded back to memory
+  EXPECT_EQ(Run({"DEBUG", "RELOAD"}), "OK");
+  EXPECT_EQ(CheckedInt({"DBSIZE"}), kNum);
+  for (size_t i = 0; i < kNum; i++) {
+    ASSERT_EQ(Run({"GET", absl::StrCat("k", i)}), string(3000, 'a' + i % 26)) << i;
+  }
+}
+
+TEST_F(TieredStorageTest, PersistentRestart) {
+  absl::FlagSaver saver;
+  absl::SetFlag(&FLAGS_tiered_offload_threshold, 0.0f);  // offload all values
+  absl::SetFlag(&FLAGS_tiered_storage_persistent, true);
+  ResetService();
+
+  // Values taking up whole pages and values stashed in small bins
+  const int kNum = 200;
+  auto value = [](size_t i) { return string(i % 2 ? 3000 : 500, 'a' + i % 26); };
+  for (size_t i = 0; i < kNum; i++) {
+    Run({"SET", absl::StrCat("k", i), value(i)});
+  }
+  ExpectConditionWithinTimeout([&] {
+    auto metrics = GetMetrics();
+    return metrics.db_stats[0].tiered_entries >= kNum / 2 &&
+           metrics.tiered_stats.pending_stash_cnt == 0;
+  });
+  size_t offloaded = GetMetrics().db_stats[0].tiered_entries;
+
+  // Like on shutdown, the snapshot refers to the offloaded values that are kept in the files
+  shard_set->RunBriefInParallel([](EngineShard* es) { es->tiered_storage()->FreezeForShutdown(); });
+  absl::SetFlag(&FLAGS_dbfilename, "tiered_persistent_test");
+  EXPECT_EQ(Run({"SAVE"}), "OK");
+
+  absl::SetFlag(&FLAGS_dbfilename, "");  // keep the snapshot
+  ShutdownService();
+  absl::SetFlag(&FLAGS_dbfilename, "tiered_persistent_test");
+  ResetService();
+
+  ExpectConditionWithinTimeout([&] { return service_->GetGlobalState() == GlobalState::ACTIVE; });
+  EXPECT_EQ(CheckedInt({"DBSIZE"}), kNum);
+  EXPECT_EQ(GetMetrics().db_stats[0].tiered_entries, offloaded);
+  for (size_t i = 0; i < kNum; i++) {
+    ASSERT_EQ(Run({"GET", absl::StrCat("k", i)}), value(i)) << i;
+  }
+
+  // New values don't overlap the restored ones
+  Run({"SET", "new", string(3000, 'z')});
+  ExpectConditionWithinTimeout([&] { return GetMetrics().tiered_stats.pending_stash_cnt == 0; });
+  EXPECT_EQ(Run({"GET", "new"}), string(3000, 'z'));
+  EXPECT_EQ(Run({"GET", "k1"}), value(1));
+
+  CleanupSnapshots();
+}
+
+TEST_F(TieredStorageTest, Containers) {
+  absl::FlagSaver saver;
+  absl::SetFlag(&FLAGS_tiered_offload_threshold, 0.0f);  // offload all values
+  absl::SetFlag(&FLAGS_tiered_storage_containers, true);
+  ResetService();
+
+  max_memory_limit = 100 * 4096;
+  pp_->at(0)->AwaitBrief([] { EngineShard::tlocal()->TEST_EnableHeartbeat(); });
+
+  // Values are kept small for the compact encodings
+  Run({"HSET", "hash", "field1", string(50, 'a'), "field2", string(50, 'b')});
+  Run({"SADD", "set", "1", "2", "3", "100000", "200000", "300000", "400000", "500000", "600000",
+       "700000", "800000", "900000", "1000000", "1100000", "1200000", "1300000"});
+  Run({"ZADD", "zset", "1", string(40, 'x'), "2", string(40, 'y')});
+  Run({"EXPIRE", "hash", "1000"});
+
+  ExpectConditionWithinTimeout([&] { return GetMetrics().db_stats[0].tiered_entries == 3; });
+
+  EXPECT_EQ(Run({"HGET", "hash", "field2"}), string(50, 'b'));
+  EXPECT_THAT(Run({"SCARD", "set"}), IntArg(16));
+  EXPECT_THAT(Run({"ZRANGE", "zset", "0", "-1"}),
+              RespArray(ElementsAre(string(40, 'x'), string(40, 'y'))));
+  EXPECT_GT(CheckedInt({"TTL", "hash"}), 0);
+
+  // The loaded values are modified in memory and offloaded again
+  Run({"HSET", "hash", "field3", string(50, 'c')});
+  ExpectConditionWithinTimeout([&] { return GetMetrics().db_stats[0].tiered_entries == 3; });
+  EXPECT_THAT(Run({"HLEN", "hash"}), IntArg(3));
+
+  Run({"DEL", "hash", "set", "zset"});
+  EXPECT_EQ(GetMetrics().db_stats[0].tiered_entries, 0u);
+  EXPECT_EQ(GetMetrics().db_stats[0].listpack_blob_cnt, 0u);
+}
+
+TEST_F(TieredStorageTest, HashFieldReads) {
+  absl::FlagSaver saver;
+  absl::SetFlag(&FLAGS_tiered_offload_threshold, 0.0f);  // offload all values
+  absl::SetFlag(&FLAGS_tiered_storage_containers, true);
+  absl::SetFlag(&FLAGS_tiered_storage_promote_min_reads, 3);
+  ResetService();
+
+  max_memory_limit = 100 * 4096;
+  pp_->at(0)->AwaitBrief([] { EngineShard::tlocal()->TEST_EnableHeartbeat(); });
+
+  Run({"HSET", "hash", "field1", string(50, 'a'), "field2", string(50, 'b')});
+  ExpectConditionWithinTimeout([&] { return GetMetrics().db_stats[0].tiered_entries == 1; });
+
+  // Field lookups read the hash from disk without loading it
+  EXPECT_EQ(Run({"HGET", "hash", "field2"}), string(50, 'b'));
+  EXPECT_THAT(Run({"HMGET", "hash", "field1", "missing"}),
+              RespArray(ElementsAre(string(50, 'a'), ArgType(RespExpr::NIL))));
+  auto metrics = GetMetrics();
+  EXPECT_EQ(metrics.db_stats[0].tiered_entries, 1);
+  EXPECT_EQ(metrics.tiered_stats.total_uncached_reads, 2);
+  EXPECT_EQ(metrics.tiered_stats.total_fetches, 0);
+
+  // Until it's read often enough
+  EXPECT_THAT(Run({"HEXISTS", "hash", "field1"}), IntArg(1));
+  EXPECT_EQ(GetMetrics().tiered_stats.total_fetches, 1);
+  EXPECT_THAT(Run({"HSTRLEN", "hash", "field2"}), IntArg(50));
+}
+
 }  // namespace dfly
@@ -4,6 +4,7 @@
 
 #pragma once
 
+#include <cstdint>
 #include <memory>
 #include <optional>
 
@@ -44,4 +45,39 @@ struct DiskSegment {
   size_t offset = 0, length = 0;
 };
 
+// Histogram with power of two buckets. Bucket i counts values below 2^(i + 1), the last bucket
+// counts all larger values.
+struct Log2Histogram {
+  static constexpr unsigned kBuckets = 16;
+
+  void Add(uint64_t value) {
+    unsigned bucket = value == 0 ? 0 : 63 - __builtin_clzll(value);
+    buckets[bucket < kBuckets ? bucket : kBuckets - 1]++;
+    count++;
+    sum += value;
+  }
+
+  // Upper bound of the bucket that holds the given quantile, 0 if empty
+  uint64_t Quantile(double q) const {
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < kBuckets; i++) {
+      seen += buckets[i];
+      if (count > 0 && seen >= q * count)
+        return uint64_t(2) << i;
+    }
+    return 0;
+  }
+
+  Log2Histogram& operator+=(const Log2Histogram& o) {
+    for (unsigned i = 0; i < kBuckets; i++)
+      buckets[i] += o.buckets[i];
+    count += o.count;
+    sum += o.sum;
+    return *this;
+  }
+
+  uint64_t buckets[kBuckets] = {};
+  uint64_t count = 0, sum = 0;
+};
+
 };  // namespace dfly::tiering
@@ -4,8 +4,16 @@
 
 #include "server/tiering/disk_storage.h"
 
+#include <fcntl.h>
+#include <unistd.h>
+
 #include <system_error>
 
+#include "absl/random/random.h"
+#include "absl/strings/numbers.h"
+#include "absl/strings/str_cat.h"
+#include "absl/strings/str_split.h"
+#include "absl/time/clock.h"
 #include "base/flags.h"
 #include "base/logging.h"
 #include "io/io_buf.h"
@@ -20,12 +28,27 @@ ABSL_FLAG(bool, backing_file_direct, false, "If true uses O_DIRECT to open backi
 ABSL_FLAG(uint64_t, registered_buffer_size, 512_KB,
           "Size of registered buffer for IoUring fixed read/writes");
 
+ABSL_FLAG(bool, backing_file_iopoll, false,
+          "If true, reads and writes of backing files go through a separate io_uring with polled "
+          "completions. Requires backing_file_direct");
+
+ABSL_FLAG(bool, backing_file_sqpoll, false,
+          "If true, the polled io_uring of backing files uses a kernel submission thread that is "
+          "shared by all threads. Requires backing_file_iopoll");
+
+ABSL_FLAG(bool, backing_file_punch_holes, true,
+          "If true, the disk space of pages that become empty is released from backing files");
+
 namespace dfly::tiering {
 
 using namespace ::util::fb2;
 
 namespace {
 
+uint64_t NowUsec() {
+  return absl::GetCurrentTimeNanos() / 1000;
+}
+
 UringBuf AllocateTmpBuf(size_t size) {
   size = (size + kPageSize - 1) / kPageSize * kPageSize;
   VLOG(1) << "Fallback to temporary allocation: " << size;
@@ -60,6 +83,11 @@ void ReturnBuf(UringBuf buf) {
 }
 
 constexpr off_t kInitialSize = 1UL << 28;  // 256MB
+constexpr off_t kStripeSize = 1UL << 28;   // 256MB, the segment size of the allocator
+
+// Layout written next to the first backing file: magic, file id, number of stripes and the size
+// of every backing file
+constexpr std::string_view kLayoutMagic = "dfly-tiered-layout-1";
 
 template <typename... Ts> std::error_code DoFiberCall(void (SubmitEntry::*c)(Ts...), Ts... args) {
   auto* proactor = static_cast<UringProactor*>(ProactorBase::me());
@@ -74,48 +102,120 @@ template <typename... Ts> std::error_code DoFiberCall(void (SubmitEntry::*c)(Ts.
 DiskStorage::DiskStorage(size_t max_size) : max_size_(max_size) {
 }
 
-std::error_code DiskStorage::Open(std::string_view path) {
+std::error_code DiskStorage::Open(const std::vector<std::string>& paths, bool restore) {
   DCHECK_EQ(ProactorBase::me()->GetKind(), ProactorBase::IOURING);
-  CHECK(!backing_file_);
+  CHECK(devices_.empty() && !paths.empty());
+
+  devices_.resize(paths.size());
+  layout_path_ = absl::StrCat(paths[0], ".layout");
+  restored_file_id_ = 0;
+  bool restored = restore && ReadKeptLayout();
 
-  int kFlags = O_CREAT | O_RDWR | O_TRUNC | O_CLOEXEC;
+  int kFlags = O_CREAT | O_RDWR | O_CLOEXEC;
+  if (!restored)
+    kFlags |= O_TRUNC;
   if (absl::GetFlag(FLAGS_backing_file_direct))
     kFlags |= O_DIRECT;
 
-  auto res = OpenLinux(path, kFlags, 0666);
-  if (!res)
-    return res.error();
-  backing_file_ = std::move(res.value());
+  for (size_t i = 0; i < paths.size(); i++) {
+    auto res = OpenLinux(paths[i], kFlags, 0666);
+    if (!res)
+      return res.error();
+    devices_[i].backing_file = std::move(res.value());
 
-  int fd = backing_file_->fd();
-  RETURN_ON_ERR(DoFiberCall(&SubmitEntry::PrepFallocate, fd, 0, 0L, kInitialSize));
-  RETURN_ON_ERR(DoFiberCall(&SubmitEntry::PrepFadvise, fd, 0L, 0L, POSIX_FADV_RANDOM));
+    int fd = devices_[i].backing_file->fd();
+    RETURN_ON_ERR(DoFiberCall(&SubmitEntry::PrepFadvise, fd, 0L, 0L, POSIX_FADV_RANDOM));
+  }
 
-  size_ = kInitialSize;
-  alloc_.AddStorage(0, size_);
+  absl::BitGen gen;
+  file_id_ = absl::Uniform<uint64_t>(gen, 1, UINT64_MAX);
+
+  if (restored) {
+    // The storage covers the files as they were kept, their segments are claimed by their owners
+    if (devices_.size() == 1) {
+      alloc_.AddStorage(0, devices_[0].size);
+      stripe_span_ = kStripeSize;
+    } else {
+      stripe_span_ = 2 * kStripeSize;
+      for (size_t i = 0; i < num_stripes_; i++)
+        alloc_.AddStorage(i * stripe_span_, kStripeSize);
+    }
+  } else if (devices_.size() == 1) {
+    int fd = devices_[0].backing_file->fd();
+    RETURN_ON_ERR(DoFiberCall(&SubmitEntry::PrepFallocate, fd, 0, 0L, kInitialSize));
+    devices_[0].size = kInitialSize;
+    alloc_.AddStorage(0, kInitialSize);
+    stripe_span_ = kStripeSize;
+  } else {
+    // Start with a stripe on every device that fits
+    stripe_span_ = 2 * kStripeSize;
+    do {
+      RETURN_ON_ERR(AddStripe());
+    } while (num_stripes_ < devices_.size() && off_t(alloc_.capacity()) + kStripeSize < max_size_);
+  }
 
   auto* up = static_cast<UringProactor*>(ProactorBase::me());
   if (int io_res = up->RegisterBuffers(absl::GetFlag(FLAGS_registered_buffer_size)); io_res < 0)
     return std::error_code{-io_res, std::system_category()};
 
+  // Polling for completions works only for files that bypass the page cache
+  if (absl::GetFlag(FLAGS_backing_file_iopoll)) {
+    if (!(kFlags & O_DIRECT)) {
+      LOG(WARNING) << "backing_file_iopoll requires backing_file_direct, ignoring";
+    } else {
+      for (auto& dev : devices_) {
+        dev.polled_ring = std::make_unique<PolledRing>();
+        int fd = dev.backing_file->fd();
+        if (auto ec = dev.polled_ring->Init(fd, absl::GetFlag(FLAGS_backing_file_sqpoll)); ec) {
+          LOG(WARNING) << "Failed to set up polled io_uring, using the proactor ring: "
+                       << ec.message();
+          dev.polled_ring.reset();
+        }
+      }
+    }
+  }
+
   return {};
 }
 
-void DiskStorage::Close() {
+void DiskStorage::Close(bool keep) {
   using namespace std::chrono_literals;
   while (pending_ops_ > 0 || grow_pending_)
     util::ThisFiber::SleepFor(10ms);
 
-  backing_file_->Close();
-  backing_file_.reset();
+  for (auto& dev : devices_) {
+    if (dev.polled_ring) {
+      dev.polled_ring->Close();
+      dev.polled_ring.reset();
+    }
+
+    if (dev.backing_file) {
+      if (keep && fdatasync(dev.backing_file->fd()) < 0)
+        LOG(ERROR) << "Failed to sync backing file: " << strerror(errno);
+      dev.backing_file->Close();
+    }
+  }
+
+  if (keep && !devices_.empty()) {
+    if (auto ec = WriteKeptLayout(); ec)
+      LOG(ERROR) << "Failed to keep backing files: " << ec.message();
+  }
+
+  devices_.clear();
+  num_stripes_ = 0;
 }
 
 void DiskStorage::Read(DiskSegment segment, ReadCb cb) {
   DCHECK_GT(segment.length, 0u);
   DCHECK_EQ(segment.offset % kPageSize, 0u);
 
-  UringBuf buf = PrepareBuf(segment.length);
-  auto io_cb = [this, cb = std::move(cb), buf, segment](int io_res) {
+  auto [dev, file_offset] = Locate(segment.offset);
+
+  // Registered buffers belong to the proactor ring, the polled one uses temporary ones
+  PolledRing* ring = dev->polled_ring.get();
+  UringBuf buf = ring ? AllocateTmpBuf(segment.length) : PrepareBuf(segment.length);
+  auto io_cb = [this, cb = std::move(cb), buf, segment, start = NowUsec()](int io_res) {
+    read_usec_.Add(NowUsec() - start);
     if (io_res < 0)
       cb("", std::error_code{-io_res, std::system_category()});
     else
@@ -124,23 +224,70 @@ void DiskStorage::Read(DiskSegment segment, ReadCb cb) {
     pending_ops_--;
   };
 
-  pending_ops_++;
+  pending_ops_hist_.Add(pending_ops_++);
+  if (ring && ring->Read(buf.bytes, file_offset, io_cb))
+    return;
+
   if (buf.buf_idx)
-    backing_file_->ReadFixedAsync(buf.bytes, segment.offset, *buf.buf_idx, std::move(io_cb));
+    dev->backing_file->ReadFixedAsync(buf.bytes, file_offset, *buf.buf_idx, std::move(io_cb));
+  else
+    dev->backing_file->ReadAsync(buf.bytes, file_offset, std::move(io_cb));
+}
+
+std::error_code DiskStorage::ReadSync(DiskSegment segment, std::string* value) {
+  DCHECK_GT(segment.length, 0u);
+
+  // O_DIRECT requires aligned offsets, lengths and buffers
+  size_t start = segment.offset / kPageSize * kPageSize;
+  size_t end = (segment.offset + segment.length + kPageSize - 1) / kPageSize * kPageSize;
+  UringBuf buf = AllocateTmpBuf(end - start);
+
+  auto [dev, file_offset] = Locate(start);
+  ssize_t io_res = pread(dev->backing_file->fd(), buf.bytes.data(), end - start, file_offset);
+  std::error_code ec;
+  if (io_res < 0)
+    ec = std::error_code{errno, std::system_category()};
+  else if (size_t(io_res) < segment.offset + segment.length - start)
+    ec = std::make_error_code(std::errc::io_error);
   else
-    backing_file_->ReadAsync(buf.bytes, segment.offset, std::move(io_cb));
+    value->assign(reinterpret_cast<char*>(buf.bytes.data()) + (segment.offset - start),
+                  segment.length);
+
+  DestroyTmpBuf(buf);
+  return ec;
 }
 
 void DiskStorage::MarkAsFree(DiskSegment segment) {
   DCHECK_GT(segment.length, 0u);
   DCHECK_EQ(segment.offset % kPageSize, 0u);
 
-  alloc_.Free(segment.offset, segment.length);
+  DiskSegment page = alloc_.Free(segment.offset, segment.length);
+  if (page.length == 0 || !absl::GetFlag(FLAGS_backing_file_punch_holes))
+    return;
+
+  // The page can be reused right away, so the hole is punched synchronously before any new write
+  // to it is issued
+  auto [dev, file_offset] = Locate(page.offset);
+  if (fallocate(dev->backing_file->fd(), FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, file_offset,
+                page.length) < 0) {
+    LOG_FIRST_N(WARNING, 1) << "Failed to punch hole in backing file: " << strerror(errno);
+  }
+}
+
+double DiskStorage::PageUsage(size_t offset) const {
+  return alloc_.PageUsage(offset);
+}
+
+bool DiskStorage::Claim(DiskSegment segment) {
+  return restored_file_id_ != 0 && alloc_.Claim(segment.offset, segment.length);
 }
 
 std::error_code DiskStorage::Stash(io::Bytes bytes, StashCb cb) {
   DCHECK_GT(bytes.length(), 0u);
 
+  // New allocations could overlap segments that are not claimed yet
+  restored_file_id_ = 0;
+
   int64_t offset = alloc_.Malloc(bytes.size());
 
   // If we've run out of space, block and grow as much as needed
@@ -152,10 +299,13 @@ std::error_code DiskStorage::Stash(io::Bytes bytes, StashCb cb) {
       return std::make_error_code(std::errc::file_too_large);
   }
 
-  UringBuf buf = PrepareBuf(bytes.size());
+  auto [dev, file_offset] = Locate(offset);
+  PolledRing* ring = dev->polled_ring.get();
+  UringBuf buf = ring ? AllocateTmpBuf(bytes.size()) : PrepareBuf(bytes.size());
   memcpy(buf.bytes.data(), bytes.data(), bytes.length());
 
-  auto io_cb = [this, cb, offset, buf, len = bytes.size()](int io_res) {
+  auto io_cb = [this, cb, offset, buf, len = bytes.size(), start = NowUsec()](int io_res) {
+    stash_usec_.Add(NowUsec() - start);
     if (io_res < 0) {
       MarkAsFree({size_t(offset), len});
       cb({}, std::error_code{-io_res, std::system_category()});
@@ -166,33 +316,128 @@ std::error_code DiskStorage::Stash(io::Bytes bytes, StashCb cb) {
     pending_ops_--;
   };
 
-  pending_ops_++;
+  pending_ops_hist_.Add(pending_ops_++);
+  if (ring && ring->Write(buf.bytes, file_offset, io_cb))
+    return {};
+
   if (buf.buf_idx)
-    backing_file_->WriteFixedAsync(buf.bytes, offset, *buf.buf_idx, std::move(io_cb));
+    dev->backing_file->WriteFixedAsync(buf.bytes, file_offset, *buf.buf_idx, std::move(io_cb));
   else
-    backing_file_->WriteAsync(buf.bytes, offset, std::move(io_cb));
+    dev->backing_file->WriteAsync(buf.bytes, file_offset, std::move(io_cb));
   return {};
 }
 
 DiskStorage::Stats DiskStorage::GetStats() const {
-  return {alloc_.allocated_bytes(), alloc_.capacity()};
+  Stats stats{.allocated_bytes = alloc_.allocated_bytes(),
+              .capacity_bytes = alloc_.capacity(),
+              .pending_ops = pending_ops_,
+              .read_usec = read_usec_,
+              .stash_usec = stash_usec_,
+              .pending_ops_hist = pending_ops_hist_};
+  for (auto pc : {detail::SMALL_P, detail::MEDIUM_P}) {
+    stats.class_page_bytes[pc] = alloc_.page_bytes(pc);
+    stats.class_allocated_bytes[pc] = alloc_.allocated_bytes(pc);
+  }
+  return stats;
 }
 
-std::error_code DiskStorage::Grow(off_t grow_size) {
-  off_t start = size_;
+std::pair<DiskStorage::Device*, off_t> DiskStorage::Locate(size_t offset) {
+  if (devices_.size() == 1)
+    return {&devices_[0], offset};
+
+  size_t stripe = offset / stripe_span_, stripe_offset = offset % stripe_span_;
+  DCHECK_LT(stripe_offset, size_t(kStripeSize));
+  return {&devices_[stripe % devices_.size()],
+          off_t(stripe / devices_.size() * kStripeSize + stripe_offset)};
+}
 
+std::error_code DiskStorage::Grow(off_t grow_size) {
   if (off_t(alloc_.capacity()) + grow_size >= max_size_)
     return std::make_error_code(std::errc::no_space_on_device);
 
+  // Stripes are not contiguous, so larger allocations can't be served
+  if (devices_.size() > 1 && grow_size > kStripeSize)
+    return std::make_error_code(std::errc::file_too_large);
+
   if (std::exchange(grow_pending_, true))
     return std::make_error_code(std::errc::operation_in_progress);
 
-  auto err = DoFiberCall(&SubmitEntry::PrepFallocate, backing_file_->fd(), 0, size_, grow_size);
+  std::error_code err;
+  if (devices_.size() > 1) {
+    err = AddStripe();
+  } else {
+    Device& dev = devices_[0];
+    err = DoFiberCall(&SubmitEntry::PrepFallocate, dev.backing_file->fd(), 0, dev.size, grow_size);
+    if (!err) {
+      alloc_.AddStorage(dev.size, grow_size);
+      dev.size += grow_size;
+    }
+  }
   grow_pending_ = false;
-  RETURN_ON_ERR(err);
+  return err;
+}
+
+bool DiskStorage::ReadKeptLayout() {
+  int fd = open(layout_path_.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+    return false;
+
+  char buf[512];
+  ssize_t len = read(fd, buf, sizeof(buf));
+  close(fd);
+
+  // The layout is valid only until the files are used again
+  unlink(layout_path_.c_str());
+
+  std::vector<std::string_view> parts;
+  if (len > 0)
+    parts = absl::StrSplit(std::string_view{buf, size_t(len)}, ' ', absl::SkipWhitespace());
+
+  uint64_t file_id = 0;
+  size_t num_stripes = 0;
+  std::vector<off_t> sizes(devices_.size());
+  bool valid = parts.size() == devices_.size() + 3 && parts[0] == kLayoutMagic &&
+               absl::SimpleAtoi(parts[1], &file_id) && absl::SimpleAtoi(parts[2], &num_stripes);
+  for (size_t i = 0; valid && i < sizes.size(); i++)
+    valid = absl::SimpleAtoi(parts[i + 3], &sizes[i]);
+
+  if (!valid || file_id == 0) {
+    LOG(WARNING) << "Discarding kept backing files, their layout does not match: " << layout_path_;
+    return false;
+  }
+
+  restored_file_id_ = file_id;
+  num_stripes_ = num_stripes;
+  for (size_t i = 0; i < sizes.size(); i++)
+    devices_[i].size = sizes[i];
+  return true;
+}
+
+std::error_code DiskStorage::WriteKeptLayout() {
+  std::string layout = absl::StrCat(kLayoutMagic, " ", file_id_, " ", num_stripes_);
+  for (const auto& dev : devices_)
+    absl::StrAppend(&layout, " ", dev.size);
+
+  int fd = open(layout_path_.c_str(), O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0666);
+  if (fd < 0)
+    return std::error_code{errno, std::system_category()};
+
+  std::error_code ec;
+  if (write(fd, layout.data(), layout.size()) != ssize_t(layout.size()) || fsync(fd) < 0)
+    ec = std::error_code{errno ? errno : EIO, std::system_category()};
+  close(fd);
+  return ec;
+}
+
+std::error_code DiskStorage::AddStripe() {
+  Device& dev = devices_[num_stripes_ % devices_.size()];
+  RETURN_ON_ERR(
+      DoFiberCall(&SubmitEntry::PrepFallocate, dev.backing_file->fd(), 0, dev.size, kStripeSize));
 
-  size_ += grow_size;
-  alloc_.AddStorage(start, grow_size);
+  // The stripe continues the backing file of the device, see Locate
+  alloc_.AddStorage(num_stripes_ * stripe_span_, kStripeSize);
+  dev.size += kStripeSize;
+  num_stripes_++;
   return {};
 }
 
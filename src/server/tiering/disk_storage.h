@@ -4,21 +4,35 @@
 
 #pragma once
 
+#include <string>
 #include <system_error>
+#include <vector>
 
 #include "io/io.h"
 #include "server/tiering/common.h"
 #include "server/tiering/external_alloc.h"
+#include "server/tiering/polled_ring.h"
 #include "util/fibers/uring_file.h"
 
 namespace dfly::tiering {
 
-// Disk storage controlled by asynchronous operations.
+// Disk storage controlled by asynchronous operations. It can span the backing files of several
+// devices, in which case the storage grows by stripes that are assigned to the files in turns.
 class DiskStorage {
  public:
   struct Stats {
     size_t allocated_bytes = 0;
     size_t capacity_bytes = 0;
+
+    // Bytes of pages in use and of allocated blocks, by detail::PageClass. Large allocations are
+    // not tracked
+    size_t class_page_bytes[2] = {0, 0};
+    size_t class_allocated_bytes[2] = {0, 0};
+
+    size_t pending_ops = 0;          // reads and writes in flight
+    Log2Histogram read_usec;         // from issuing read to its completion
+    Log2Histogram stash_usec;        // from issuing write to its completion
+    Log2Histogram pending_ops_hist;  // reads and writes in flight when another one is issued
   };
 
   using ReadCb = std::function<void(std::string_view, std::error_code)>;
@@ -26,15 +40,45 @@ class DiskStorage {
 
   explicit DiskStorage(size_t max_size);
 
-  std::error_code Open(std::string_view path);
-  void Close();
+  std::error_code Open(std::string_view path) {
+    return Open(std::vector<std::string>{std::string{path}});
+  }
+
+  // Open a backing file at each path, ideally on separate devices. If restore is set and the
+  // files were kept by the last Close, they are opened with their contents, see Claim.
+  std::error_code Open(const std::vector<std::string>& paths, bool restore = false);
+
+  // If keep is set, the files are kept along with their layout for the next Open to restore
+  void Close(bool keep = false);
+
+  // Random id of the files while they are open, identifies segments that are kept by Close
+  uint64_t file_id() const {
+    return file_id_;
+  }
+
+  // Id the restored files had while they were open before, 0 if they were not restored
+  uint64_t restored_file_id() const {
+    return restored_file_id_;
+  }
+
+  // Mark segment of the restored files as allocated again. Claims are accepted until the first
+  // stash. Returns false if the segment can't be claimed, see ExternalAllocator::Claim
+  bool Claim(DiskSegment segment);
 
   // Request read for segment, cb will be called on completion with read value
   void Read(DiskSegment segment, ReadCb cb);
 
-  // Mark segment as free, performed immediately
+  // Read segment into value, blocking the thread until it completes. For callers that can't
+  // preempt.
+  std::error_code ReadSync(DiskSegment segment, std::string* value);
+
+  // Mark segment as free, performed immediately. Pages that become empty are punched out of the
+  // backing file.
   void MarkAsFree(DiskSegment segment);
 
+  // Fraction of the page hosting the offset that is in use, see ExternalAllocator::PageUsage
+  double PageUsage(size_t offset) const;
+
   // Request bytes to be stored, cb will be called with assigned segment on completion. Can block to
   // grow backing file. Returns error code if operation failed  immediately (most likely it failed
   // to grow the backing file) or passes an empty segment if the final write operation failed.
@@ -44,13 +88,37 @@ class DiskStorage {
   Stats GetStats() const;
 
  private:
+  struct Device {
+    std::unique_ptr<util::fb2::LinuxFile> backing_file;
+    std::unique_ptr<PolledRing> polled_ring;  // used for reads and writes if set
+    off_t size = 0;
+  };
+
+  // Returns the device of the offset and the offset within its backing file
+  std::pair<Device*, off_t> Locate(size_t offset);
+
   std::error_code Grow(off_t grow_size);
 
+  // Read and remove the layout kept by Close. Returns false if there is none matching the devices
+  bool ReadKeptLayout();
+  std::error_code WriteKeptLayout();
+
+  // Add a stripe of kStripeSize bytes to the next device in turn
+  std::error_code AddStripe();
+
  private:
-  off_t size_, max_size_;
+  off_t max_size_;
   size_t pending_ops_ = 0;  // number of ongoing ops for safe shutdown
+  Log2Histogram read_usec_, stash_usec_, pending_ops_hist_;
   bool grow_pending_ = false;
-  std::unique_ptr<util::fb2::LinuxFile> backing_file_;
+  uint64_t file_id_ = 0, restored_file_id_ = 0;
+  std::string layout_path_;  // of the layout written by Close
+
+  // With several devices, stripes are spaced apart in the allocator offsets, so that no allocation
+  // spans two of them.
+  size_t stripe_span_ = 0;
+  size_t num_stripes_ = 0;
+  std::vector<Device> devices_;
 
   ExternalAllocator alloc_;
 };
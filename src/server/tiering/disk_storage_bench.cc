@@ -0,0 +1,140 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include <absl/random/random.h>
+#include <absl/strings/str_format.h>
+#include <absl/time/clock.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+
+#include "base/flags.h"
+#include "base/init.h"
+#include "base/logging.h"
+#include "server/tiering/common.h"
+#include "server/tiering/disk_storage.h"
+#include "util/fibers/pool.h"
+#include "util/fibers/synchronization.h"
+
+// Measures the latency of DiskStorage reads for every completion mode of the backing file.
+// Run for example: disk_storage_bench --path=/mnt/nvme/bench --reads=200000 --depth=4
+
+ABSL_FLAG(std::string, path, "disk_storage_bench_backing", "Backing file to create");
+ABSL_FLAG(std::vector<std::string>, modes,
+          (std::vector<std::string>{"buffered", "direct", "iopoll", "sqpoll"}),
+          "Modes to measure: buffered, direct, iopoll or sqpoll");
+ABSL_FLAG(uint32_t, values, 10'000, "Number of values stashed before reading");
+ABSL_FLAG(uint32_t, value_size, 4096, "Size of stashed values");
+ABSL_FLAG(uint32_t, reads, 100'000, "Number of reads measured per mode");
+ABSL_FLAG(uint32_t, depth, 1, "Number of reads in flight");
+
+ABSL_DECLARE_FLAG(bool, backing_file_direct);
+ABSL_DECLARE_FLAG(bool, backing_file_iopoll);
+ABSL_DECLARE_FLAG(bool, backing_file_sqpoll);
+
+namespace dfly::tiering {
+
+using namespace std;
+using namespace util;
+
+namespace {
+
+struct Result {
+  vector<uint64_t> latencies_ns;
+  uint64_t wall_ns = 0;
+};
+
+void SetMode(string_view mode) {
+  absl::SetFlag(&FLAGS_backing_file_direct, mode != "buffered");
+  absl::SetFlag(&FLAGS_backing_file_iopoll, mode == "iopoll" || mode == "sqpoll");
+  absl::SetFlag(&FLAGS_backing_file_sqpoll, mode == "sqpoll");
+}
+
+Result Run() {
+  DiskStorage storage(64_MB + uint64_t(absl::GetFlag(FLAGS_values)) * 2 *
+                                   absl::GetFlag(FLAGS_value_size));
+  string path = absl::GetFlag(FLAGS_path);
+  CHECK(!storage.Open(path));
+
+  vector<DiskSegment> segments;
+  string value(absl::GetFlag(FLAGS_value_size), 'x');
+  for (uint32_t i = 0; i < absl::GetFlag(FLAGS_values); i++) {
+    CHECK(!storage.Stash(io::Buffer(value),
+                         [&](DiskSegment segment, error_code ec) {
+                           CHECK(!ec);
+                           segments.push_back(segment);
+                         }));
+  }
+  while (segments.size() < absl::GetFlag(FLAGS_values))
+    ThisFiber::SleepFor(1ms);
+
+  Result res;
+  uint32_t num_reads = absl::GetFlag(FLAGS_reads);
+  res.latencies_ns.reserve(num_reads);
+
+  absl::BitGen gen;
+  uint32_t issued = 0, inflight = 0;
+  fb2::EventCount ec;
+  uint64_t start = absl::GetCurrentTimeNanos();
+
+  while (issued < num_reads) {
+    ec.await([&] { return inflight < absl::GetFlag(FLAGS_depth); });
+    DiskSegment segment = segments[absl::Uniform(gen, 0u, uint32_t(segments.size()))];
+    uint64_t read_start = absl::GetCurrentTimeNanos();
+    inflight++;
+    issued++;
+    storage.Read(segment, [&, read_start](string_view, error_code read_ec) {
+      CHECK(!read_ec);
+      res.latencies_ns.push_back(absl::GetCurrentTimeNanos() - read_start);
+      inflight--;
+      ec.notify();
+    });
+  }
+  ec.await([&] { return inflight == 0; });
+  res.wall_ns = absl::GetCurrentTimeNanos() - start;
+
+  storage.Close();
+  unlink(path.c_str());
+  return res;
+}
+
+double Percentile(const vector<uint64_t>& sorted, double p) {
+  size_t index = min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[index] / 1000.0;
+}
+
+}  // namespace
+
+}  // namespace dfly::tiering
+
+int main(int argc, char* argv[]) {
+  MainInitGuard guard(&argc, &argv);
+  using namespace dfly::tiering;
+
+  std::unique_ptr<util::ProactorPool> pp(util::fb2::Pool::IOUring(256, 1));
+  pp->Run();
+
+  std::cout << absl::StrFormat("%-10s %10s %10s %10s %10s %10s %12s\n", "mode", "avg_us",
+                               "p50_us", "p90_us", "p99_us", "p999_us", "reads/s");
+  for (const std::string& mode : absl::GetFlag(FLAGS_modes)) {
+    SetMode(mode);
+    Result res = pp->at(0)->Await([] { return Run(); });
+
+    auto& lat = res.latencies_ns;
+    std::sort(lat.begin(), lat.end());
+    double avg = 0;
+    for (uint64_t ns : lat)
+      avg += ns;
+    avg /= lat.size() * 1000.0;
+
+    std::cout << absl::StrFormat("%-10s %10.1f %10.1f %10.1f %10.1f %10.1f %12.0f\n", mode, avg,
+                                 Percentile(lat, 0.5), Percentile(lat, 0.9),
+                                 Percentile(lat, 0.99), Percentile(lat, 0.999),
+                                 lat.size() * 1e9 / res.wall_ns);
+  }
+
+  pp->Stop();
+  return 0;
+}
@@ -88,12 +88,21 @@ TEST_F(DiskStorageTest, Basic) {
     EXPECT_EQ(segments_.size(), 100);
 
     EXPECT_EQ(GetStats().allocated_bytes, 100 * kPageSize);
+    EXPECT_EQ(GetStats().class_allocated_bytes[detail::SMALL_P], 100 * kPageSize);
+    EXPECT_EQ(GetStats().class_page_bytes[detail::SMALL_P], 1_MB);
 
     // Read all 100 values
     for (size_t i = 0; i < 100; i++)
       Read(i);
     Wait();
 
+    auto stats = GetStats();
+    EXPECT_EQ(stats.pending_ops, 0u);
+    EXPECT_EQ(stats.stash_usec.count, 100u);
+    EXPECT_EQ(stats.read_usec.count, 100u);
+    EXPECT_EQ(stats.pending_ops_hist.count, 200u);
+    EXPECT_GT(stats.pending_ops_hist.Quantile(1), 2u);  // the writes were issued together
+
     // Expect them to be equal to written
     for (size_t i = 0; i < 100; i++)
       EXPECT_EQ(last_reads_[i], absl::StrCat("value", i));
@@ -125,4 +134,70 @@ TEST_F(DiskStorageTest, ReUse) {
   });
 }
 
+TEST_F(DiskStorageTest, MultipleDevices) {
+  pp_->at(0)->Await([this] {
+    storage_ = make_unique<DiskStorage>(1024_MB);
+    vector<string> paths = {"disk_storage_test_backing0", "disk_storage_test_backing1"};
+    ASSERT_FALSE(storage_->Open(paths));
+    EXPECT_EQ(GetStats().capacity_bytes, 512_MB);  // a stripe on every device
+
+    // Small and medium blocks are allocated from different stripes, so different devices
+    Stash(0, string(100, 'a'));
+    Stash(1, string(256_KB, 'b'));
+    Wait();
+    EXPECT_LT(segments_[0].offset, 256_MB);
+    EXPECT_GE(segments_[1].offset, 512_MB);
+
+    Read(0);
+    Read(1);
+    Wait();
+    EXPECT_EQ(last_reads_[0], string(100, 'a'));
+    EXPECT_EQ(last_reads_[1], string(256_KB, 'b'));
+
+    storage_->Close();
+    storage_.reset();
+    unlink("disk_storage_test_backing0");
+    unlink("disk_storage_test_backing1");
+  });
+}
+
+TEST_F(DiskStorageTest, KeepFiles) {
+  pp_->at(0)->Await([this] {
+    vector<string> paths = {"disk_storage_test_backing"};
+    storage_ = make_unique<DiskStorage>(256_MB);
+    ASSERT_FALSE(storage_->Open(paths, true));
+    EXPECT_EQ(storage_->restored_file_id(), 0u);  // nothing was kept
+
+    for (size_t i = 0; i < 10; i++)
+      Stash(i, absl::StrCat("value", i));
+    Wait();
+    uint64_t file_id = storage_->file_id();
+    storage_->Close(true);
+
+    storage_ = make_unique<DiskStorage>(256_MB);
+    ASSERT_FALSE(storage_->Open(paths, true));
+    EXPECT_EQ(storage_->restored_file_id(), file_id);
+    EXPECT_NE(storage_->file_id(), file_id);
+
+    for (size_t i = 0; i < 10; i++)
+      EXPECT_TRUE(storage_->Claim(segments_[i]));
+    EXPECT_FALSE(storage_->Claim(segments_[0]));
+    EXPECT_EQ(GetStats().allocated_bytes, 10 * kPageSize);
+
+    for (size_t i = 0; i < 10; i++)
+      Read(i);
+    Wait();
+    for (size_t i = 0; i < 10; i++)
+      EXPECT_EQ(last_reads_[i], absl::StrCat("value", i));
+
+    // New values don't overwrite the claimed ones, which can't be claimed after stashing
+    Stash(10, "value10");
+    Wait();
+    EXPECT_GE(segments_[10].offset, 10 * kPageSize);
+    EXPECT_EQ(storage_->restored_file_id(), 0u);
+
+    Close();
+  });
+}
+
 }  // namespace dfly::tiering
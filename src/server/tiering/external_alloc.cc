@@ -345,6 +345,7 @@ int64_t ExternalAllocator::Malloc(size_t sz) {
       return -int64_t(kSegmentSize);
     free_pages_[bin_idx] = page;
     page->Init(pc, bin_idx);
+    page_bytes_[pc] += 1UL << ToSegDescr(page)->page_shift();
   }
 
   DCHECK(page->available);
@@ -353,13 +354,14 @@ int64_t ExternalAllocator::Malloc(size_t sz) {
 
   page->free_blocks.flip(pos);
   --page->available;
-  allocated_bytes_ += ToBlockSize(page->block_size_bin);
 
   SegmentDescr* seg = ToSegDescr(page);
+  allocated_bytes_ += ToBlockSize(page->block_size_bin);
+  class_allocated_bytes_[seg->page_class()] += ToBlockSize(page->block_size_bin);
   return seg->BlockOffset(page, pos);
 }
 
-void ExternalAllocator::Free(size_t offset, size_t sz) {
+DiskSegment ExternalAllocator::Free(size_t offset, size_t sz) {
   size_t idx = offset / 256_MB;
   size_t delta = offset % 256_MB;
   CHECK_LT(idx, segments_.size());
@@ -384,10 +386,86 @@ void ExternalAllocator::Free(size_t offset, size_t sz) {
   ++page->available;
 
   DCHECK_EQ(page->available, page->free_blocks.count());
+  allocated_bytes_ -= block_size;
+  class_allocated_bytes_[seg->page_class()] -= block_size;
   if (page->available == blocks_num) {
     FreePage(page, seg, block_size);
+    return {offset - block_offs, page_size};
   }
-  allocated_bytes_ -= block_size;
+  return {};
+}
+
+bool ExternalAllocator::Claim(size_t offset, size_t sz) {
+  PageClass pc = detail::ClassFromSize(sz);
+  if (pc == PageClass::LARGE_P)
+    return extent_tree_.Remove(offset, alignup(sz, 4_KB));
+
+  size_t idx = offset / kSegmentSize;
+  SegmentDescr* seg = idx < segments_.size() ? segments_[idx] : nullptr;
+  if (seg == nullptr) {
+    if (!extent_tree_.Remove(idx * kSegmentSize, kSegmentSize))
+      return false;
+
+    seg = GetNewSegment(pc, idx * kSegmentSize);
+    if (sq_[pc] == nullptr)
+      sq_[pc] = seg;
+    else
+      sq_[pc]->LinkBefore(seg);
+  } else if (seg->page_class() != pc) {
+    return false;
+  }
+
+  BinIdx bin_idx = ToBinIdx(sz);
+  size_t block_size = ToBlockSize(bin_idx);
+  size_t page_size = 1UL << seg->page_shift();
+  size_t block_offs = offset % kSegmentSize % page_size;
+  if (block_offs % block_size != 0 || block_offs + block_size > page_size)
+    return false;
+
+  Page* page = seg->GetPage((offset % kSegmentSize) >> seg->page_shift());
+  if (!page->segment_inuse) {
+    page->segment_inuse = 1;
+    ++seg->page_info_.used;
+    page->Init(pc, bin_idx);
+    page_bytes_[pc] += page_size;
+
+    // Full segments are not kept in the queue, see FindPage
+    if (!seg->HasFreePages()) {
+      SegmentDescr* next = seg->Detach();
+      if (sq_[pc] == seg)
+        sq_[pc] = next;
+    }
+  } else if (page->block_size_bin != bin_idx) {
+    return false;
+  }
+
+  unsigned pos = block_offs / block_size;
+  if (!page->free_blocks[pos])
+    return false;
+
+  page->free_blocks.flip(pos);
+  --page->available;
+  allocated_bytes_ += block_size;
+  class_allocated_bytes_[pc] += block_size;
+  return true;
+}
+
+double ExternalAllocator::PageUsage(size_t offset) const {
+  size_t idx = offset / 256_MB;
+  if (idx >= segments_.size() || !segments_[idx])
+    return 1;
+
+  SegmentDescr* seg = segments_[idx];
+  unsigned page_id = (offset % 256_MB) >> seg->page_shift();
+  if (page_id >= seg->capacity())
+    return 1;
+
+  const Page* page = seg->GetPage(page_id);
+  if (!page->segment_inuse || free_pages_[page->block_size_bin] == page)
+    return 1;
+
+  unsigned blocks_num = (1 << seg->page_shift()) / ToBlockSize(page->block_size_bin);
+  return 1.0 - double(page->available) / blocks_num;
 }
 
 void ExternalAllocator::AddStorage(size_t start, size_t size) {
@@ -436,19 +514,7 @@ auto ExternalAllocator::FindPage(PageClass pc) -> Page* {
   if (op_range) {
     DCHECK_EQ(0u, op_range->first % kSegmentAlignment);
 
-    unsigned num_pages = NumPagesInSegment(pc);
-    size_t seg_idx = op_range->first / kSegmentAlignment;
-
-    if (segments_.size() > seg_idx) {
-      DCHECK(segments_[seg_idx] == nullptr);
-    } else {
-      segments_.resize(seg_idx + 1);
-    }
-
-    void* ptr =
-        mi_malloc_aligned(sizeof(SegmentDescr) + num_pages * sizeof(Page), kSegDescrAlignment);
-    SegmentDescr* seg = new (ptr) SegmentDescr(pc, op_range->first, num_pages);
-    segments_[seg_idx] = seg;
+    SegmentDescr* seg = GetNewSegment(pc, op_range->first);
 
     DCHECK(sq_[pc] == NULL);
     DCHECK(seg->next == seg->prev && seg == seg->next);
@@ -460,6 +526,23 @@ auto ExternalAllocator::FindPage(PageClass pc) -> Page* {
   return nullptr;
 }
 
+auto ExternalAllocator::GetNewSegment(PageClass pc, size_t offset) -> SegmentDescr* {
+  unsigned num_pages = NumPagesInSegment(pc);
+  size_t seg_idx = offset / kSegmentAlignment;
+
+  if (segments_.size() > seg_idx) {
+    DCHECK(segments_[seg_idx] == nullptr);
+  } else {
+    segments_.resize(seg_idx + 1);
+  }
+
+  void* ptr =
+      mi_malloc_aligned(sizeof(SegmentDescr) + num_pages * sizeof(Page), kSegDescrAlignment);
+  SegmentDescr* seg = new (ptr) SegmentDescr(pc, offset, num_pages);
+  segments_[seg_idx] = seg;
+  return seg;
+}
+
 int64_t ExternalAllocator::LargeMalloc(size_t size) {
   size_t align_sz = alignup(size, 4_KB);
   auto op_range = extent_tree_.GetRange(align_sz, 4_KB);
@@ -484,6 +567,7 @@ void ExternalAllocator::FreePage(Page* page, SegmentDescr* owner, size_t block_s
 
   page->segment_inuse = 0;
   page->available = 0;
+  page_bytes_[owner->page_class()] -= 1UL << owner->page_shift();
 
   if (!owner->HasFreePages()) {
     // Segment was fully booked but now it has a free page.
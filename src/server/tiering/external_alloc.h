@@ -61,7 +61,18 @@ class ExternalAllocator {
   // size sz.
   int64_t Malloc(size_t sz);
 
-  void Free(size_t offset, size_t sz);
+  // Returns the range of the page that hosted the block if it became fully free, or an empty
+  // segment otherwise.
+  DiskSegment Free(size_t offset, size_t sz);
+
+  // Marks the block of size sz at offset as allocated, as if it was returned by Malloc(sz), so
+  // that allocations of a previous run can be restored. Returns false if the block is outside of
+  // the storage, is not aligned like Malloc would return it or overlaps other allocations.
+  bool Claim(size_t offset, size_t sz);
+
+  // Returns the fraction of used blocks in the page that hosts offset. Returns 1 for large
+  // allocations and for pages that are currently filled by new allocations.
+  double PageUsage(size_t offset) const;
 
   /// Adds backing storage to the allocator. The range should not overlap with already
   /// added storage ranges.
@@ -80,6 +91,16 @@ class ExternalAllocator {
     return allocated_bytes_;
   }
 
+  // Bytes of the pages of the class that are in use and bytes of their allocated blocks. Their
+  // difference is the fragmentation of the class. Large allocations are not tracked.
+  size_t page_bytes(detail::PageClass pc) const {
+    return pc == detail::LARGE_P ? 0 : page_bytes_[pc];
+  }
+
+  size_t allocated_bytes(detail::PageClass pc) const {
+    return pc == detail::LARGE_P ? 0 : class_allocated_bytes_[pc];
+  }
+
  private:
   class SegmentDescr;
   using Page = detail::Page;
@@ -89,7 +110,8 @@ class ExternalAllocator {
   Page* FindPage(detail::PageClass sc);
 
   int64_t LargeMalloc(size_t size);
-  SegmentDescr* GetNewSegment(detail::PageClass sc);
+  // Creates the descriptor of the segment at offset, whose range was taken from the extent tree
+  SegmentDescr* GetNewSegment(detail::PageClass sc, size_t offset);
   void FreePage(Page* page, SegmentDescr* owner, size_t block_size);
 
   static SegmentDescr* ToSegDescr(Page*);
@@ -104,6 +126,8 @@ class ExternalAllocator {
 
   size_t capacity_ = 0;  // in bytes.
   size_t allocated_bytes_ = 0;
+  size_t page_bytes_[2] = {0, 0};             // map: PageClass -> bytes of pages in use
+  size_t class_allocated_bytes_[2] = {0, 0};  // map: PageClass -> allocated bytes
 };
 
 }  // namespace dfly::tiering
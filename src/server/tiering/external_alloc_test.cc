@@ -117,4 +117,82 @@ TEST_F(ExternalAllocatorTest, Classes) {
   EXPECT_EQ(1_MB + 4_KB, ExternalAllocator::GoodSize(1_MB + 1));
 }
 
+TEST_F(ExternalAllocatorTest, PageUsage) {
+  ext_alloc_.AddStorage(0, kSegSize);
+
+  // Fill the first 1MB page with 4KB blocks, the next allocation starts a new page
+  constexpr unsigned kBlocks = 1_MB / kMinBlockSize;
+  vector<int64_t> offsets;
+  for (unsigned i = 0; i < kBlocks; ++i)
+    offsets.push_back(ext_alloc_.Malloc(kMinBlockSize));
+  int64_t next = ext_alloc_.Malloc(kMinBlockSize);
+  EXPECT_EQ(next, 1_MB);
+  EXPECT_EQ(ext_alloc_.PageUsage(next), 1);  // the page being filled is never sparse
+
+  for (unsigned i = 0; i < kBlocks / 4 * 3; ++i)
+    EXPECT_EQ(ext_alloc_.Free(offsets[i], kMinBlockSize).length, 0u);
+  EXPECT_DOUBLE_EQ(ext_alloc_.PageUsage(offsets.back()), 0.25);
+
+  DiskSegment page;
+  for (unsigned i = kBlocks / 4 * 3; i < kBlocks; ++i)
+    page = ext_alloc_.Free(offsets[i], kMinBlockSize);
+  EXPECT_EQ(page.offset, 0u);
+  EXPECT_EQ(page.length, 1_MB);
+}
+
+TEST_F(ExternalAllocatorTest, ClassStats) {
+  ext_alloc_.AddStorage(0, kSegSize * 2);
+
+  int64_t small = ext_alloc_.Malloc(kMinBlockSize);
+  int64_t medium = ext_alloc_.Malloc(256_KB);
+  ASSERT_GE(small, 0);
+  ASSERT_GE(medium, 0);
+
+  EXPECT_EQ(ext_alloc_.page_bytes(detail::SMALL_P), 1_MB);
+  EXPECT_EQ(ext_alloc_.allocated_bytes(detail::SMALL_P), kMinBlockSize);
+  EXPECT_EQ(ext_alloc_.page_bytes(detail::MEDIUM_P), 16_MB);
+  EXPECT_EQ(ext_alloc_.allocated_bytes(detail::MEDIUM_P), 256_KB);
+
+  ext_alloc_.Free(small, kMinBlockSize);
+  ext_alloc_.Free(medium, 256_KB);
+  for (auto pc : {detail::SMALL_P, detail::MEDIUM_P}) {
+    EXPECT_EQ(ext_alloc_.page_bytes(pc), 0u);
+    EXPECT_EQ(ext_alloc_.allocated_bytes(pc), 0u);
+  }
+}
+
+TEST_F(ExternalAllocatorTest, Claim) {
+  ext_alloc_.AddStorage(0, kSegSize * 2);
+
+  // Allocations of a previous run
+  std::map<int64_t, size_t> ranges;
+  for (size_t sz : {kMinBlockSize, kMinBlockSize * 3, size_t(8000), size_t(256_KB)}) {
+    for (unsigned i = 0; i < 10; ++i)
+      ranges.emplace(ext_alloc_.Malloc(sz), sz);
+  }
+
+  ExternalAllocator restored;
+  restored.AddStorage(0, kSegSize * 2);
+  for (const auto& [offset, sz] : ranges)
+    ASSERT_TRUE(restored.Claim(offset, sz)) << offset;
+  EXPECT_EQ(restored.allocated_bytes(), ext_alloc_.allocated_bytes());
+
+  EXPECT_FALSE(restored.Claim(ranges.begin()->first, ranges.begin()->second));  // taken
+  EXPECT_FALSE(restored.Claim(kMinBlockSize / 2, kMinBlockSize));              // not aligned
+  EXPECT_FALSE(restored.Claim(kSegSize * 3, kMinBlockSize));                   // no storage
+
+  // New allocations don't overlap the claimed ones
+  for (unsigned i = 0; i < 100; ++i) {
+    size_t sz = i % 2 ? kMinBlockSize : 256_KB;
+    int64_t offset = restored.Malloc(sz);
+    ASSERT_GE(offset, 0);
+    auto it = ranges.upper_bound(offset);
+    ASSERT_TRUE(it == ranges.end() || offset + int64_t(sz) <= it->first);
+    ASSERT_TRUE(it == ranges.begin() || prev(it)->first + int64_t(prev(it)->second) <= offset);
+  }
+
+  for (const auto& [offset, sz] : ranges)
+    restored.Free(offset, sz);
+}
+
 }  // namespace dfly::tiering
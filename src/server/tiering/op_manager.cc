@@ -4,10 +4,13 @@
 
 #include "server/tiering/op_manager.h"
 
+#include <algorithm>
 #include <variant>
 
+#include "absl/time/clock.h"
 #include "base/logging.h"
 #include "core/overloaded.h"
+#include "core/value_compressor.h"
 #include "io/io.h"
 #include "server/tiering/common.h"
 #include "server/tiering/disk_storage.h"
@@ -28,6 +31,9 @@ OpManager::EntryId Borrowed(const OpManager::OwnedEntryId& id) {
   return std::visit([](const auto& v) -> OpManager::EntryId { return v; }, id);
 }
 
+// Reads of adjacent pages are merged up to this size
+constexpr size_t kMaxCoalescedReadSize = 64_KB;
+
 }  // namespace
 
 OpManager::OpManager(size_t max_size) : storage_{max_size} {
@@ -40,21 +46,56 @@ std::error_code OpManager::Open(std::string_view file) {
   return storage_.Open(file);
 }
 
-void OpManager::Close() {
-  storage_.Close();
+std::error_code OpManager::Open(const std::vector<std::string>& files, bool restore) {
+  return storage_.Open(files, restore);
+}
+
+void OpManager::Close(bool keep) {
+  // Wait for queued reads to be submitted, so that the storage can wait for them to complete
+  while (flush_scheduled_)
+    util::ThisFiber::SleepFor(std::chrono::milliseconds(1));
+  storage_.Close(keep);
 }
 
-void OpManager::Enqueue(EntryId id, DiskSegment segment, ReadCallback cb) {
+void OpManager::Enqueue(EntryId id, DiskSegment segment, ReadCallback cb, bool compressed) {
   // Fill pages for prepared read as it has no penalty and potentially covers more small segments
-  PrepareRead(segment.ContainingPages())
-      .ForSegment(segment, id)
-      .callbacks.emplace_back(std::move(cb));
+  EntryOps& ops = PrepareRead(segment.ContainingPages()).ForSegment(segment, id);
+  ops.callbacks.emplace_back(std::move(cb));
+  ops.compressed |= compressed;
+}
+
+void OpManager::ReadRange(DiskSegment segment, size_t offset, size_t length,
+                          DiskStorage::ReadCb cb) {
+  DCHECK_EQ(segment.offset % kPageSize, 0u);
+  DCHECK_LE(offset + length, segment.length);
+
+  size_t start = segment.offset + offset;
+  size_t pages_start = start / kPageSize * kPageSize;
+  size_t pages_end = (start + length + kPageSize - 1) / kPageSize * kPageSize;
+
+  range_reads_[segment.offset].pending++;
+  auto io_cb = [this, base = segment.offset, skip = start - pages_start, length,
+                cb = std::move(cb)](std::string_view value, std::error_code ec) {
+    cb(ec ? value : value.substr(skip, length), ec);
+
+    auto it = range_reads_.find(base);
+    if (--it->second.pending == 0) {
+      std::optional<DiskSegment> pages = it->second.free_pages;
+      range_reads_.erase(it);
+      if (pages)
+        storage_.MarkAsFree(*pages);
+    }
+  };
+  storage_.Read({pages_start, pages_end - pages_start}, std::move(io_cb));
 }
 
-void OpManager::Delete(EntryId id) {
+std::error_code OpManager::ReadSync(DiskSegment segment, std::string* value) {
+  return storage_.ReadSync(segment, value);
+}
+
+bool OpManager::Delete(EntryId id) {
   // If the item isn't offloaded, it has io pending, so cancel it
-  DCHECK(pending_stash_ver_.count(ToOwned(id)));
-  pending_stash_ver_.erase(ToOwned(id));
+  return pending_stash_ver_.erase(ToOwned(id)) > 0;
 }
 
 void OpManager::Delete(DiskSegment segment) {
@@ -67,7 +108,7 @@ void OpManager::Delete(DiskSegment segment) {
   if (pending_op) {
     pending_op->deleting = true;
   } else if (ReportDelete(segment) && base_it == pending_reads_.end()) {
-    storage_.MarkAsFree(segment.ContainingPages());
+    MarkAsFree(segment.ContainingPages());
   }
 }
 
@@ -88,14 +129,52 @@ OpManager::ReadOp& OpManager::PrepareRead(DiskSegment aligned_segment) {
 
   auto [it, inserted] = pending_reads_.try_emplace(aligned_segment.offset, aligned_segment);
   if (inserted) {
-    auto io_cb = [this, aligned_segment](std::string_view value, std::error_code ec) {
-      ProcessRead(aligned_segment.offset, value);
-    };
-    storage_.Read(aligned_segment, io_cb);
+    // Submit reads once the current fiber yields, so that reads requested by the same batch of
+    // commands can be merged
+    it->second.queued_at_usec = absl::GetCurrentTimeNanos() / 1000;
+    queued_reads_.push_back(aligned_segment.offset);
+    if (!std::exchange(flush_scheduled_, true))
+      util::fb2::Fiber("tiered_read_flush", [this] { FlushReads(); }).Detach();
   }
   return it->second;
 }
 
+void OpManager::FlushReads() {
+  flush_scheduled_ = false;
+
+  std::vector<size_t> offsets = std::move(queued_reads_);
+  queued_reads_.clear();
+  std::sort(offsets.begin(), offsets.end());
+
+  uint64_t now_usec = absl::GetCurrentTimeNanos() / 1000;
+  for (size_t offset : offsets)
+    queue_wait_usec_.Add(now_usec - pending_reads_.at(offset).queued_at_usec);
+
+  for (size_t i = 0; i < offsets.size();) {
+    DiskSegment segment = pending_reads_.at(offsets[i]).segment;
+    size_t j = i + 1;
+    for (; j < offsets.size(); j++) {
+      DiskSegment next = pending_reads_.at(offsets[j]).segment;
+      if (next.offset != segment.offset + segment.length ||
+          segment.length + next.length > kMaxCoalescedReadSize)
+        break;
+      segment.length += next.length;
+    }
+
+    coalesced_read_cnt_ += j - i - 1;
+    std::vector<size_t> read_offsets(offsets.begin() + i, offsets.begin() + j);
+    auto io_cb = [this, segment, read_offsets = std::move(read_offsets)](std::string_view value,
+                                                                         std::error_code ec) {
+      for (size_t offset : read_offsets) {
+        size_t length = pending_reads_.at(offset).segment.length;
+        ProcessRead(offset, ec ? value : value.substr(offset - segment.offset, length));
+      }
+    };
+    storage_.Read(segment, std::move(io_cb));
+    i = j;
+  }
+}
+
 void OpManager::ProcessStashed(EntryId id, unsigned version, DiskSegment segment,
                                std::error_code ec) {
   if (auto it = pending_stash_ver_.find(ToOwned(id));
@@ -129,7 +208,14 @@ void OpManager::ProcessRead(size_t offset, std::string_view value) {
   // Report functions in the loop may append items to info->key_ops during the traversal
   for (size_t i = 0; i < info->key_ops.size(); i++) {
     auto& ko = info->key_ops[i];
-    key_value = value.substr(ko.segment.offset - info->segment.offset, ko.segment.length);
+    std::string_view stored =
+        value.substr(ko.segment.offset - info->segment.offset, ko.segment.length);
+    if (ko.compressed && stored.size() > ValueCompressor::kHeaderSize) {
+      key_value.resize(ValueCompressor::DecompressedSize(stored));
+      ValueCompressor::Decompress(stored, key_value.data());
+    } else {
+      key_value = stored;
+    }
 
     bool modified = false;
     for (auto& cb : ko.callbacks)
@@ -146,12 +232,19 @@ void OpManager::ProcessRead(size_t offset, std::string_view value) {
   }
 
   if (deleting_full) {
-    storage_.MarkAsFree(info->segment);
+    MarkAsFree(info->segment);
   }
 
   pending_reads_.erase(offset);
 }
 
+void OpManager::MarkAsFree(DiskSegment pages) {
+  if (auto it = range_reads_.find(pages.offset); it != range_reads_.end())
+    it->second.free_pages = pages;
+  else
+    storage_.MarkAsFree(pages);
+}
+
 OpManager::EntryOps& OpManager::ReadOp::ForSegment(DiskSegment key_segment, EntryId id) {
   DCHECK_GE(key_segment.offset, segment.offset);
   DCHECK_LE(key_segment.length, segment.length);
@@ -174,7 +267,9 @@ OpManager::EntryOps* OpManager::ReadOp::Find(DiskSegment key_segment) {
 OpManager::Stats OpManager::GetStats() const {
   return {.disk_stats = storage_.GetStats(),
           .pending_read_cnt = pending_reads_.size(),
-          .pending_stash_cnt = pending_stash_ver_.size()};
+          .pending_stash_cnt = pending_stash_ver_.size(),
+          .coalesced_read_cnt = coalesced_read_cnt_,
+          .queue_wait_usec = queue_wait_usec_};
 }
 
 }  // namespace dfly::tiering
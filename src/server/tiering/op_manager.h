@@ -7,7 +7,9 @@
 #include <absl/container/flat_hash_map.h>
 #include <absl/container/inlined_vector.h>
 
+#include <optional>
 #include <variant>
+#include <vector>
 
 #include "server/tiering/common.h"
 #include "server/tiering/disk_storage.h"
@@ -26,6 +28,8 @@ class OpManager {
 
     size_t pending_read_cnt = 0;
     size_t pending_stash_cnt = 0;
+    size_t coalesced_read_cnt = 0;  // page reads merged into reads of preceding pages
+    Log2Histogram queue_wait_usec;  // from queueing page reads until they are submitted
   };
 
   using KeyRef = std::pair<DbIndex, std::string_view>;
@@ -44,19 +48,50 @@ class OpManager {
   // Open file with underlying disk storage, must be called before use
   std::error_code Open(std::string_view file);
 
-  void Close();
+  // Same for storage that spans multiple files. See DiskStorage for restoring kept files
+  std::error_code Open(const std::vector<std::string>& files, bool restore = false);
+
+  void Close(bool keep = false);
 
   // Enqueue callback to be executed once value is read. Trigger read if none is pending yet for
   // this segment. Multiple entries can be obtained from a single segment, but every distinct id
-  // will have it's own independent callback loop that can safely modify the underlying value
-  void Enqueue(EntryId id, DiskSegment segment, ReadCallback cb);
+  // will have it's own independent callback loop that can safely modify the underlying value.
+  // If compressed is set, the segment holds a ValueCompressor blob and the callbacks and
+  // ReportFetched receive the decompressed value
+  void Enqueue(EntryId id, DiskSegment segment, ReadCallback cb, bool compressed = false);
+
+  // Read only the bytes [offset, offset + length) of an offloaded value that takes up whole pages
+  // and isn't compressed, fetching just the pages covering them. The entry is not reported as
+  // fetched. If the segment is deleted meanwhile, freeing it is deferred until the read finishes
+  void ReadRange(DiskSegment segment, size_t offset, size_t length, DiskStorage::ReadCb cb);
+
+  // Read value of offloaded segment, blocking the thread. Pending reads of it are not affected
+  std::error_code ReadSync(DiskSegment segment, std::string* value);
 
-  // Delete entry with pending io
-  void Delete(EntryId id);
+  // Delete entry with pending io. Returns false if it has no pending stash
+  bool Delete(EntryId id);
 
   // Delete offloaded entry
   void Delete(DiskSegment segment);
 
+  // Fraction of the page hosting the offset that is in use, see ExternalAllocator::PageUsage
+  double PageUsage(size_t offset) const {
+    return storage_.PageUsage(offset);
+  }
+
+  // Kept files of the storage, see DiskStorage
+  uint64_t file_id() const {
+    return storage_.file_id();
+  }
+
+  uint64_t restored_file_id() const {
+    return storage_.restored_file_id();
+  }
+
+  bool Claim(DiskSegment segment) {
+    return storage_.Claim(segment);
+  }
+
   // Stash value to be offloaded
   std::error_code Stash(EntryId id, std::string_view value);
 
@@ -85,6 +120,7 @@ class OpManager {
     DiskSegment segment;
     absl::InlinedVector<ReadCallback, 1> callbacks;
     bool deleting = false;
+    bool compressed = false;
   };
 
   // Describes an ongoing read operation for a fixed segment
@@ -100,23 +136,42 @@ class OpManager {
 
     DiskSegment segment;                       // spanning segment of whole read
     absl::InlinedVector<EntryOps, 1> key_ops;  // enqueued operations for different keys
+    uint64_t queued_at_usec = 0;
   };
 
   // Prepare read operation for aligned segment or return pending if it exists.
   // Refernce is valid until any other read operations occur.
   ReadOp& PrepareRead(DiskSegment aligned_segment);
 
+  // Submit queued reads, merging the ones of adjacent segments
+  void FlushReads();
+
   // Called once read finished
   void ProcessRead(size_t offset, std::string_view value);
 
   // Called once Stash finished
   void ProcessStashed(EntryId id, unsigned version, DiskSegment segment, std::error_code ec);
 
+  // Mark pages as free, unless range reads of them are pending
+  void MarkAsFree(DiskSegment pages);
+
  protected:
   DiskStorage storage_;
 
   absl::flat_hash_map<size_t /* offset */, ReadOp> pending_reads_;
 
+  // Pending range reads by offset of the read segment, with the pages to free once they finish
+  struct RangeReads {
+    unsigned pending = 0;
+    std::optional<DiskSegment> free_pages;
+  };
+  absl::flat_hash_map<size_t /* offset */, RangeReads> range_reads_;
+
+  std::vector<size_t> queued_reads_;  // offsets of pending reads that are not submitted yet
+  bool flush_scheduled_ = false;
+  size_t coalesced_read_cnt_ = 0;
+  Log2Histogram queue_wait_usec_;
+
   size_t pending_stash_counter_ = 0;
   // todo: allow heterogeneous lookups with non owned id
   absl::flat_hash_map<OwnedEntryId, unsigned /* version */> pending_stash_ver_;
@@ -140,6 +140,28 @@ TEST_F(OpManagerTest, ReadSamePageDifferentOffsets) {
   });
 }
 
+TEST_F(OpManagerTest, CoalesceAdjacentReads) {
+  pp_->at(0)->Await([this] {
+    Open();
+
+    for (unsigned i = 0; i < 10; i++)
+      EXPECT_FALSE(Stash(i, absl::StrCat("VALUE", i)));
+    while (stashed_.size() < 10)
+      util::ThisFiber::SleepFor(1ms);
+
+    // Reads issued without yielding are submitted together
+    std::vector<util::fb2::Future<std::string>> futures;
+    for (unsigned i = 0; i < 10; i++)
+      futures.emplace_back(Read(i, stashed_[i]));
+
+    for (unsigned i = 0; i < 10; i++)
+      EXPECT_EQ(futures[i].Get(), absl::StrCat("VALUE", i));
+    EXPECT_GT(GetStats().coalesced_read_cnt, 0u);
+
+    Close();
+  });
+}
+
 TEST_F(OpManagerTest, Modify) {
   pp_->at(0)->Await([this] {
     Open();
@@ -0,0 +1,153 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include "server/tiering/polled_ring.h"
+
+#include <absl/synchronization/mutex.h>
+
+#include <cstring>
+
+#include "base/logging.h"
+
+namespace dfly::tiering {
+
+using namespace std;
+
+namespace {
+
+constexpr unsigned kRingDepth = 256;
+constexpr unsigned kSqThreadIdleMs = 10;
+
+// The first ring created with SQPOLL owns the kernel submission thread, the other ones attach to
+// it. The thread is dropped by the kernel once all rings using it are closed.
+absl::Mutex sq_owner_mu;
+int sq_owner_fd ABSL_GUARDED_BY(sq_owner_mu) = -1;
+unsigned sq_users ABSL_GUARDED_BY(sq_owner_mu) = 0;
+
+}  // namespace
+
+PolledRing::~PolledRing() {
+  Close();
+}
+
+error_code PolledRing::Init(int fd, bool sqpoll) {
+  DCHECK(!initialized_);
+
+  io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  params.flags = IORING_SETUP_IOPOLL;
+
+  absl::MutexLock lk(&sq_owner_mu);
+  if (sqpoll) {
+    params.flags |= IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = kSqThreadIdleMs;
+    if (sq_owner_fd >= 0) {
+      params.flags |= IORING_SETUP_ATTACH_WQ;
+      params.wq_fd = sq_owner_fd;
+    }
+  }
+
+  if (int res = io_uring_queue_init_params(kRingDepth, &ring_, &params); res < 0)
+    return error_code{-res, system_category()};
+
+  if (int res = io_uring_register_files(&ring_, &fd, 1); res < 0) {
+    io_uring_queue_exit(&ring_);
+    return error_code{-res, system_category()};
+  }
+
+  if (sqpoll) {
+    if (sq_owner_fd < 0)
+      sq_owner_fd = ring_.ring_fd;
+    sq_users++;
+  }
+
+  initialized_ = true;
+  sqpoll_ = sqpoll;
+  closing_ = false;
+  poller_ = util::fb2::Fiber("tiered_polled_ring", [this] { PollLoop(); });
+  return {};
+}
+
+void PolledRing::Close() {
+  if (!initialized_)
+    return;
+
+  closing_ = true;
+  ec_.notify();
+  poller_.JoinIfNeeded();
+
+  io_uring_queue_exit(&ring_);
+  initialized_ = false;
+
+  if (sqpoll_) {
+    absl::MutexLock lk(&sq_owner_mu);
+    if (--sq_users == 0)
+      sq_owner_fd = -1;
+  }
+}
+
+io_uring_sqe* PolledRing::GetSqe() {
+  return initialized_ && !closing_ ? io_uring_get_sqe(&ring_) : nullptr;
+}
+
+void PolledRing::Enqueue(io_uring_sqe* sqe, Callback cb) {
+  sqe->flags |= IOSQE_FIXED_FILE;  // index of the registered file
+  io_uring_sqe_set_data(sqe, new Callback(std::move(cb)));
+  inflight_++;
+  unsubmitted_++;
+  ec_.notify();
+}
+
+bool PolledRing::Read(io::MutableBytes buf, off_t offset, Callback cb) {
+  io_uring_sqe* sqe = GetSqe();
+  if (sqe == nullptr)
+    return false;
+
+  io_uring_prep_read(sqe, 0, buf.data(), buf.size(), offset);
+  Enqueue(sqe, std::move(cb));
+  return true;
+}
+
+bool PolledRing::Write(io::Bytes buf, off_t offset, Callback cb) {
+  io_uring_sqe* sqe = GetSqe();
+  if (sqe == nullptr)
+    return false;
+
+  io_uring_prep_write(sqe, 0, buf.data(), buf.size(), offset);
+  Enqueue(sqe, std::move(cb));
+  return true;
+}
+
+void PolledRing::PollLoop() {
+  while (true) {
+    ec_.await([this] { return inflight_ > 0 || closing_; });
+    if (inflight_ == 0)
+      return;  // closing
+
+    // Operations prepared since the last iteration are submitted together. With SQPOLL this only
+    // wakes up the kernel thread if it went idle.
+    if (unsubmitted_ > 0) {
+      if (int res = io_uring_submit(&ring_); res < 0)
+        LOG_EVERY_T(ERROR, 1) << "Failed to submit to polled ring: " << strerror(-res);
+      else
+        unsubmitted_ = 0;
+    }
+
+    // For IOPOLL rings peeking enters the kernel to poll the device for completions
+    io_uring_cqe* cqe = nullptr;
+    while (io_uring_peek_cqe(&ring_, &cqe) == 0 && cqe != nullptr) {
+      auto* cb = static_cast<Callback*>(io_uring_cqe_get_data(cqe));
+      int res = cqe->res;
+      io_uring_cqe_seen(&ring_, cqe);
+
+      inflight_--;
+      (*cb)(res);
+      delete cb;
+    }
+
+    util::ThisFiber::Yield();
+  }
+}
+
+}  // namespace dfly::tiering
@@ -0,0 +1,63 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#pragma once
+
+#include <liburing.h>
+
+#include <functional>
+#include <system_error>
+
+#include "io/io.h"
+#include "util/fibers/fibers.h"
+#include "util/fibers/synchronization.h"
+
+namespace dfly::tiering {
+
+// io_uring instance dedicated to a single O_DIRECT file, separate from the proactor ring. It is
+// set up with IORING_SETUP_IOPOLL, so completions are busy polled by a fiber while operations are
+// in flight instead of being signalled by interrupts. With sqpoll, submissions are picked up by a
+// kernel thread that is shared by the polled rings of all threads, so that they need no syscalls.
+// Must be used from a single thread.
+class PolledRing {
+ public:
+  // Receives the result of the operation, negative errno on failure
+  using Callback = std::function<void(int)>;
+
+  PolledRing() = default;
+  ~PolledRing();
+
+  PolledRing(const PolledRing&) = delete;
+  PolledRing& operator=(const PolledRing&) = delete;
+
+  std::error_code Init(int fd, bool sqpoll);
+
+  // Waits for operations in flight and releases the ring
+  void Close();
+
+  // Issue read or write of the whole buffer. Return false if the ring can't accept more operations
+  // right now, in which case the callback is not called.
+  bool Read(io::MutableBytes buf, off_t offset, Callback cb);
+  bool Write(io::Bytes buf, off_t offset, Callback cb);
+
+ private:
+  // Returns nullptr if the submission queue is full
+  io_uring_sqe* GetSqe();
+
+  // Track prepared operation until its completion is polled
+  void Enqueue(io_uring_sqe* sqe, Callback cb);
+
+  // Submits prepared operations and polls for completions while there are operations in flight
+  void PollLoop();
+
+  io_uring ring_;
+  bool initialized_ = false, sqpoll_ = false, closing_ = false;
+  size_t inflight_ = 0;
+  size_t unsubmitted_ = 0;
+
+  util::fb2::EventCount ec_;
+  util::fb2::Fiber poller_;
+};
+
+}  // namespace dfly::tiering
@@ -138,6 +138,14 @@ SmallBins::BinInfo SmallBins::Delete(DiskSegment segment) {
   return {segment};
 }
 
+bool SmallBins::Restore(DiskSegment segment) {
+  auto [it, inserted] = stashed_bins_.try_emplace(segment.ContainingPages().offset);
+  it->second.entries++;
+  it->second.bytes += segment.length;
+  stats_.stashed_entries_cnt++;
+  return inserted;
+}
+
 SmallBins::Stats SmallBins::GetStats() const {
   return Stats{.stashed_bins_cnt = stashed_bins_.size(),
                .stashed_entries_cnt = stats_.stashed_entries_cnt,
@@ -59,6 +59,10 @@ class SmallBins {
   // the need for external actions like deleting empty segments or triggering defragmentation
   BinInfo Delete(DiskSegment segment);
 
+  // Account segment of a stashed bin that is restored from kept backing files. Returns true if
+  // it is the first one of its bin, whose page then needs to be claimed
+  bool Restore(DiskSegment segment);
+
   // Delete stashed bin. Returns list of recovered item key hashes and db indices.
   // Mainly used for defragmentation
   KeyHashDbList DeleteBin(DiskSegment segment, std::string_view value);
@@ -62,6 +62,25 @@ void TopKeys::Touch(std::string_view key) {
   }
 }
 
+uint64_t TopKeys::Count(std::string_view key) const {
+  if (!IsEnabled()) {
+    return 0;
+  }
+
+  const uint64_t fingerprint = XXH3_64bits(key.data(), key.size());
+  const int shift = absl::bit_width(options_.buckets);
+
+  uint64_t count = 0;
+  for (uint64_t array = 0; array < options_.arrays; ++array) {
+    const int bucket = (fingerprint >> (shift * array)) % options_.buckets;
+    const Cell& cell = GetCell(array, bucket);
+    if (cell.fingerprint == fingerprint) {
+      count = std::max(count, cell.count);
+    }
+  }
+  return count;
+}
+
 absl::flat_hash_map<std::string, uint64_t> TopKeys::GetTopKeys() const {
   if (!IsEnabled()) {
     return {};
@@ -48,6 +48,10 @@ class TopKeys {
   explicit TopKeys(Options options);
 
   void Touch(std::string_view key);
+
+  // Returns the estimated number of times key was touched, 0 if it is not tracked.
+  uint64_t Count(std::string_view key) const;
+
   absl::flat_hash_map<std::string, uint64_t> GetTopKeys() const;
 
   bool IsEnabled() const;
@@ -31,6 +31,14 @@ TEST(TopKeysTest, MultiTouch) {
   EXPECT_THAT(top_keys.GetTopKeys(), UnorderedElementsAre(Pair("key1", 3)));
 }
 
+TEST(TopKeysTest, Count) {
+  TopKeys top_keys({.min_key_count_to_record = 100});
+  for (unsigned i = 0; i < 3; ++i)
+    top_keys.Touch("key1");
+  EXPECT_EQ(top_keys.Count("key1"), 3u);
+  EXPECT_EQ(top_keys.Count("key2"), 0u);
+}
+
 TEST(TopKeysTest, MinKeyCountToRecord) {
   TopKeys top_keys({.min_key_count_to_record = 3});
   top_keys.Touch("key1");
@@ -4,12 +4,15 @@
 
 #include "server/transaction.h"
 
+#include <absl/base/internal/cycleclock.h>
 #include <absl/strings/match.h>
 
 #include "base/logging.h"
+#include "facade/numa.h"
 #include "facade/op_status.h"
 #include "redis/redis_aux.h"
 #include "server/blocking_controller.h"
+#include "server/cmd_profiler.h"
 #include "server/command_registry.h"
 #include "server/common.h"
 #include "server/db_slice.h"
@@ -20,11 +23,20 @@
 ABSL_FLAG(uint32_t, tx_queue_warning_len, 96,
           "Length threshold for warning about long transaction queue");
 
+ABSL_FLAG(bool, tx_batch_schedule, false,
+          "If true, schedule hops of single shard transactions issued by the same thread during "
+          "one event loop iteration are sent to their shard together");
+
+ABSL_FLAG(bool, tx_schedule_ring, false,
+          "If true, schedule hops of single shard transactions are published to a lock-free ring "
+          "of their shard instead of allocating a shard queue task for each of them");
+
 namespace dfly {
 
 using namespace std;
 using namespace util;
 using absl::StrCat;
+using absl::base_internal::CycleClock;
 
 thread_local Transaction::TLTmpSpace Transaction::tmp_space;
 
@@ -35,6 +47,15 @@ atomic_uint64_t op_seq{1};
 
 constexpr size_t kTransSize [[maybe_unused]] = sizeof(Transaction);
 
+struct PendingSchedule {
+  Transaction* tx;
+  bool can_run_immediately;
+};
+
+// Schedule hops queued by this thread, by shard id.
+thread_local vector<vector<PendingSchedule>> tl_pending_schedules;
+thread_local bool tl_schedule_flush_posted = false;
+
 void AnalyzeTxQueue(const EngineShard* shard, const TxQueue* txq) {
   unsigned q_limit = absl::GetFlag(FLAGS_tx_queue_warning_len);
   if (txq->size() > q_limit) {
@@ -199,15 +220,36 @@ void Transaction::BuildShardIndex(const KeyIndex& key_index, std::vector<PerShar
     unique_slot_checker_.Add(key);
     uint32_t sid = Shard(key, shard_data_.size());
     add(sid, *key_index.bonus, *key_index.bonus + 1);
+    shard_index[sid].fps.push_back(LockTag(key).Fingerprint());
   }
 
+  // Route all the keys before distributing them. The hashes of different keys don't depend on
+  // each other, so the loop overlaps them, and the per-shard counts let the index arrays be sized
+  // once instead of growing key by key.
+  size_t num_keys = (key_index.end - key_index.start + key_index.step - 1) / key_index.step;
+  auto& routes = tmp_space.GetKeyRoutes(num_keys);
+  absl::InlinedVector<uint32_t, 32> counts(shard_index.size(), 0);
   for (unsigned i = key_index.start; i < key_index.end; i += key_index.step) {
     string_view key = ArgS(full_args_, i);
     unique_slot_checker_.Add(key);
-    uint32_t sid = Shard(key, shard_data_.size());
+    KeyRoute route{Shard(key, shard_data_.size()), LockTag(key).Fingerprint()};
+    routes.push_back(route);
+    ++counts[route.sid];
+  }
+
+  for (size_t sid = 0; sid < shard_index.size(); ++sid) {
+    if (counts[sid] == 0)
+      continue;
     shard_index[sid].key_step = key_index.step;
+    shard_index[sid].slices.reserve(shard_index[sid].slices.size() + counts[sid]);
+    shard_index[sid].fps.reserve(shard_index[sid].fps.size() + counts[sid]);
+  }
 
-    add(sid, i, i + key_index.step);
+  unsigned i = key_index.start;
+  for (const KeyRoute& route : routes) {
+    add(route.sid, i, i + key_index.step);
+    shard_index[route.sid].fps.push_back(route.fp);
+    i += key_index.step;
   }
 }
 
@@ -238,15 +280,10 @@ void Transaction::InitShardData(absl::Span<const PerShardCache> shard_index, siz
     unique_shard_cnt_++;
     unique_shard_id_ = i;
 
-    for (size_t j = 0; j < src.slices.size(); ++j) {
-      IndexSlice slice = src.slices[j];
-      args_slices_.push_back(slice);
-      for (uint32_t k = slice.first; k < slice.second; k += src.key_step) {
-        string_view key = ArgS(full_args_, k);
-        kv_fp_.push_back(LockTag(key).Fingerprint());
-        sd.fp_count++;
-      }
-    }
+    // The fingerprints were computed when the keys were routed.
+    args_slices_.insert(args_slices_.end(), src.slices.begin(), src.slices.end());
+    kv_fp_.insert(kv_fp_.end(), src.fps.begin(), src.fps.end());
+    sd.fp_count = src.fps.size();
   }
 }
 
@@ -263,19 +300,36 @@ void Transaction::PrepareMultiFps(CmdArgList keys) {
   }
 }
 
-void Transaction::StoreKeysInArgs(const KeyIndex& key_index) {
+void Transaction::StoreKeysInArgs(const KeyIndex& key_index, bool single_tag) {
   DCHECK(!key_index.bonus);
   DCHECK(kv_fp_.empty());
   DCHECK(args_slices_.empty());
 
   // even for a single key we may have multiple arguments per key (MSET).
   args_slices_.emplace_back(key_index.start, key_index.end);
+  if (single_tag) {
+    kv_fp_.push_back(LockTag(ArgS(full_args_, key_index.start)).Fingerprint());
+    return;
+  }
+
   for (unsigned j = key_index.start; j < key_index.end; j += key_index.step) {
     string_view key = ArgS(full_args_, j);
     kv_fp_.push_back(LockTag(key).Fingerprint());
   }
 }
 
+bool Transaction::KeysShareLockTag(const KeyIndex& key_index) const {
+  if (!LockTagOptions::instance().enabled || key_index.bonus)
+    return false;
+
+  LockTag tag{ArgS(full_args_, key_index.start)};
+  for (unsigned j = key_index.start + key_index.step; j < key_index.end; j += key_index.step) {
+    if (!(LockTag{ArgS(full_args_, j)} == tag))
+      return false;
+  }
+  return true;
+}
+
 void Transaction::InitByKeys(const KeyIndex& key_index) {
   if (key_index.start == full_args_.size()) {  // eval with 0 keys.
     CHECK(absl::StartsWith(cid_->name(), "EVAL")) << cid_->name();
@@ -287,18 +341,25 @@ void Transaction::InitByKeys(const KeyIndex& key_index) {
   // Stub transactions always operate only on single shard.
   bool is_stub = multi_ && multi_->role == SQUASHED_STUB;
 
-  if ((key_index.HasSingleKey() && !IsAtomicMulti()) || is_stub) {
+  // Multiple keys confined to a single lock tag live on the same shard and are covered by the
+  // same lock, so they take the single key path below with a single fingerprint.
+  bool single_tag = !is_stub && !IsAtomicMulti() && !key_index.HasSingleKey() &&
+                    KeysShareLockTag(key_index);
+
+  if ((key_index.HasSingleKey() && !IsAtomicMulti()) || is_stub || single_tag) {
     DCHECK(!IsActiveMulti() || multi_->mode == NON_ATOMIC);
 
     // We don't have to split the arguments by shards, so we can copy them directly.
-    StoreKeysInArgs(key_index);
+    StoreKeysInArgs(key_index, single_tag);
 
     unique_shard_cnt_ = 1;
     string_view akey = ArgS(full_args_, key_index.start);
     if (is_stub)  // stub transactions don't migrate
       DCHECK_EQ(unique_shard_id_, Shard(akey, shard_set->size()));
     else {
-      unique_slot_checker_.Add(akey);
+      // Cluster slots may be computed by different rules than lock tags, so check all keys.
+      for (unsigned j = key_index.start; j < key_index.end; j += key_index.step)
+        unique_slot_checker_.Add(ArgS(full_args_, j));
       unique_shard_id_ = Shard(akey, shard_set->size());
     }
 
@@ -419,7 +480,8 @@ void Transaction::StartMultiGlobal(DbIndex dbid) {
   ScheduleInternal();
 }
 
-void Transaction::StartMultiLockedAhead(DbIndex dbid, CmdArgList keys, bool skip_scheduling) {
+void Transaction::StartMultiLockedAhead(DbIndex dbid, CmdArgList keys, bool skip_scheduling,
+                                        bool prefetch_keys) {
   DVLOG(1) << "StartMultiLockedAhead on " << keys.size() << " keys";
 
   DCHECK(multi_);
@@ -427,6 +489,8 @@ void Transaction::StartMultiLockedAhead(DbIndex dbid, CmdArgList keys, bool skip
 
   multi_->mode = LOCK_AHEAD;
   multi_->lock_mode = LockMode();
+  if (prefetch_keys)
+    multi_->key_prefetch.resize(shard_set->size());
 
   PrepareMultiFps(keys);
 
@@ -626,7 +690,12 @@ bool Transaction::RunInShard(EngineShard* shard, bool txq_ooo) {
 void Transaction::RunCallback(EngineShard* shard) {
   DCHECK_EQ(shard, EngineShard::tlocal());
 
+  uint64_t start = CycleClock::Now();
+  bool immediate = shard_data_[SidToId(shard->shard_id())].local_mask & RAN_IMMEDIATELY;
+
   RunnableResult result;
+  const CommandId* prev_cid = CmdProfiler::current();
+  CmdProfiler::SetCurrent(cid_);
   shard->db_slice().LockChangeCb();
   try {
     result = (*cb_ptr_)(this, shard);
@@ -652,6 +721,10 @@ void Transaction::RunCallback(EngineShard* shard) {
   }
 
   shard->db_slice().OnCbFinish();
+  CmdProfiler::SetCurrent(prev_cid);
+
+  (immediate ? immediate_exec_cycles_ : exec_cycles_)
+      .fetch_add(CycleClock::Now() - start, memory_order_relaxed);
 
   // Handle result flags to alter behaviour.
   if (result.flags & RunnableResult::AVOID_CONCLUDING) {
@@ -717,6 +790,14 @@ void Transaction::ScheduleInternal() {
       // single shard schedule operation can't fail
       CHECK(ScheduleInShard(EngineShard::tlocal(), can_run_immediately));
       run_barrier_.Dec();
+    } else if (unique_shard_cnt_ == 1 && absl::GetFlag(FLAGS_tx_batch_schedule)) {
+      // txid is assigned in the shard, so single shard scheduling can't fail either.
+      QueueScheduleHop(can_run_immediately);
+      run_barrier_.Wait();
+    } else if (unique_shard_cnt_ == 1 && absl::GetFlag(FLAGS_tx_schedule_ring) &&
+               shard_set->PushSchedule(unique_shard_id_, {this, can_run_immediately})) {
+      // Same as above, if the ring is full we fall back to a regular shard queue task.
+      run_barrier_.Wait();
     } else {
       IterateActiveShards([cb](const auto& sd, ShardId i) { shard_set->Add(i, cb); });
       run_barrier_.Wait();
@@ -830,12 +911,17 @@ void Transaction::Execute(RunnableType cb, bool conclude) {
                                   : (coordinator_state_ & ~COORD_CONCLUDING);
   }
 
+  uint64_t start = CycleClock::Now();
   if ((coordinator_state_ & COORD_SCHED) == 0) {
     ScheduleInternal();
+    uint64_t now = CycleClock::Now();
+    schedule_cycles_ += now - start;
+    start = now;
   }
 
   DispatchHop();
   run_barrier_.Wait();
+  hop_cycles_ += CycleClock::Now() - start;
   cb_ptr_ = nullptr;
 
   if (coordinator_state_ & COORD_CONCLUDING)
@@ -890,9 +976,13 @@ void Transaction::DispatchHop() {
     DVLOG(3) << "ptr_release " << DebugId();
     intrusive_ptr_release(this);  // against use_count_.fetch_add above.
   };
-  IterateShards([&poll_cb, &poll_flags](PerShardData& sd, auto i) {
-    if (poll_flags.test(i))
+  auto* ss = ServerState::tlocal();
+  int node = facade::numa::NodeOfThread(ss->thread_index());
+  IterateShards([&poll_cb, &poll_flags, ss, node](PerShardData& sd, auto i) {
+    if (poll_flags.test(i)) {
+      ss->stats.tx_cross_node_hops += facade::numa::NodeOfThread(i) != node;
       shard_set->Add(i, poll_cb);
+    }
   });
 }
 
@@ -1030,6 +1120,15 @@ bool Transaction::IsActive(ShardId sid) const {
   return shard_data_[SidToId(sid)].local_mask & ACTIVE;
 }
 
+Transaction::PhaseCycles Transaction::GetPhaseCycles() const {
+  PhaseCycles res;
+  res.schedule = schedule_cycles_;
+  res.hops = hop_cycles_;
+  res.exec = exec_cycles_.load(memory_order_relaxed);
+  res.immediate_exec = immediate_exec_cycles_.load(memory_order_relaxed);
+  return res;
+}
+
 IntentLock::Mode Transaction::LockMode() const {
   return cid_->IsReadOnly() ? IntentLock::SHARED : IntentLock::EXCLUSIVE;
 }
@@ -1037,7 +1136,10 @@ IntentLock::Mode Transaction::LockMode() const {
 OpArgs Transaction::GetOpArgs(EngineShard* shard) const {
   DCHECK(IsActive(shard->shard_id()));
   DCHECK((multi_ && multi_->role == SQUASHED_STUB) || (run_barrier_.DEBUG_Count() > 0));
-  return OpArgs{shard, this, GetDbContext()};
+  OpArgs res{shard, this, GetDbContext()};
+  if (multi_ && !multi_->key_prefetch.empty())
+    res.db_cntx.prefetch = multi_->key_prefetch[shard->shard_id()].get();
+  return res;
 }
 
 // This function should not block since it's run via RunBriefInParallel.
@@ -1063,16 +1165,24 @@ bool Transaction::ScheduleInShard(EngineShard* shard, bool can_run_immediately)
     lock_args = GetLockArgs(shard->shard_id());
     bool shard_unlocked = shard->shard_lock()->Check(mode);
 
-    // Check if we can run immediately
-    if (shard_unlocked && can_run_immediately && CheckLocks(shard->db_slice(), mode, lock_args)) {
-      sd.local_mask |= RAN_IMMEDIATELY;
-      shard->stats().tx_immediate_total++;
-
-      RunCallback(shard);
-      // Check state again, it could've been updated if the callback returned AVOID_CONCLUDING flag.
-      // Only possible for single shard.
-      if (coordinator_state_ & COORD_CONCLUDING)
-        return true;
+    // Check if we can run immediately. This is the optimistic path of single hop transactions:
+    // the callback runs right here without taking intent locks or entering the tx queue,
+    // which is safe because no scheduled transaction holds a conflicting lock on our keys.
+    // Reads conflict only with exclusive locks, so plain reads almost always take this path.
+    // Otherwise we fall back to regular scheduling below.
+    if (can_run_immediately) {
+      if (shard_unlocked && CheckLocks(shard->db_slice(), mode, lock_args)) {
+        sd.local_mask |= RAN_IMMEDIATELY;
+        shard->stats().tx_immediate_total++;
+
+        RunCallback(shard);
+        // Check state again, it could've been updated if the callback returned AVOID_CONCLUDING
+        // flag. Only possible for single shard.
+        if (coordinator_state_ & COORD_CONCLUDING)
+          return true;
+      } else {
+        shard->stats().tx_immediate_conflict_total++;
+      }
     }
 
     bool keys_unlocked = shard->db_slice().Acquire(mode, lock_args);
@@ -1117,9 +1227,60 @@ bool Transaction::ScheduleInShard(EngineShard* shard, bool can_run_immediately)
   AnalyzeTxQueue(shard, txq);
   DVLOG(1) << "Insert into tx-queue, sid(" << sid << ") " << DebugId() << ", qlen " << txq->size();
 
+  // The keys are locked now, so a prefetched iterator can only be invalidated by the
+  // transactions queued before us or by background tasks, which the lookups detect.
+  if (multi_ && !multi_->key_prefetch.empty()) {
+    multi_->key_prefetch[shard->shard_id()] =
+        shard->db_slice().PrefetchKeys(db_index_, GetShardArgs(shard->shard_id()));
+  }
+
   return true;
 }
 
+void Transaction::QueueScheduleHop(bool can_run_immediately) {
+  if (tl_pending_schedules.empty())
+    tl_pending_schedules.resize(shard_set->size());
+
+  tl_pending_schedules[unique_shard_id_].push_back({this, can_run_immediately});
+
+  // The flush fiber runs only after the fibers that are already ready, so all transactions
+  // issued by them until then are batched together.
+  if (!exchange(tl_schedule_flush_posted, true))
+    fb2::Fiber(fb2::Launch::post, "tx_schedule_flush", &Transaction::FlushScheduleHops).Detach();
+}
+
+void Transaction::FlushScheduleHops() {
+  tl_schedule_flush_posted = false;
+
+  auto* ss = ServerState::tlocal();
+  auto& stats = ss->stats;
+  int node = facade::numa::NodeOfThread(ss->thread_index());
+  for (ShardId sid = 0; sid < tl_pending_schedules.size(); ++sid) {
+    auto& pending = tl_pending_schedules[sid];
+    if (pending.empty())
+      continue;
+
+    stats.tx_schedule_batch_cnt++;
+    stats.tx_schedule_batched_cnt += pending.size();
+    stats.tx_cross_node_hops += facade::numa::NodeOfThread(sid) != node;
+
+    // Transactions are kept alive by their coordinators until FinishHop is called.
+    shard_set->Add(sid, [batch = std::move(pending)] {
+      for (const PendingSchedule& ps : batch) {
+        CHECK(ps.tx->ScheduleInShard(EngineShard::tlocal(), ps.can_run_immediately));
+        ps.tx->FinishHop();
+      }
+    });
+    pending.clear();
+  }
+}
+
+void Transaction::ScheduleFromRing(EngineShard* shard, bool can_run_immediately) {
+  DCHECK_EQ(unique_shard_cnt_, 1u);
+  CHECK(ScheduleInShard(shard, can_run_immediately));
+  FinishHop();
+}
+
 bool Transaction::CancelShardCb(EngineShard* shard) {
   ShardId idx = SidToId(shard->shard_id());
   auto& sd = shard_data_[idx];
@@ -1287,6 +1448,10 @@ void Transaction::UnlockMultiShardCb(absl::Span<const LockFp> fps, EngineShard*
   auto& sd = shard_data_[SidToId(sid)];
   sd.local_mask |= UNLOCK_MULTI;
 
+  // Releases the table reference on its own thread.
+  if (!multi_->key_prefetch.empty())
+    multi_->key_prefetch[sid].reset();
+
   // It does not have to be that all shards in multi transaction execute this tx.
   // Hence it could stay in the tx queue. We perform the necessary cleanup and remove it from
   // there. The transaction is not guaranteed to be at front.
@@ -1392,6 +1557,14 @@ void Transaction::LogAutoJournalOnShard(EngineShard* shard, RunnableResult resul
     return;
   }
 
+  // The keys of a single shard entry of the master map to a single shard here as well when the
+  // number of shards is the same, otherwise the command is split and serialized again.
+  if (forwarded_entry_ && unique_shard_cnt_ == 1 && !multi_) {
+    journal->RecordForwardedEntry(*forwarded_entry_, db_index_,
+                                  unique_slot_checker_.GetUniqueSlotId(), cid_->name(), true);
+    return;
+  }
+
   journal::Entry::Payload entry_payload;
   string_view cmd{cid_->name()};
   if (unique_shard_cnt_ == 1 || args_slices_.empty()) {
@@ -1584,4 +1757,10 @@ std::vector<Transaction::PerShardCache>& Transaction::TLTmpSpace::GetShardIndex(
   return shard_cache;
 }
 
+std::vector<Transaction::KeyRoute>& Transaction::TLTmpSpace::GetKeyRoutes(size_t num_keys) {
+  key_routes.clear();
+  key_routes.reserve(num_keys);
+  return key_routes;
+}
+
 }  // namespace dfly
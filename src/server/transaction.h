@@ -169,6 +169,14 @@ class Transaction {
     RAN_IMMEDIATELY = 1 << 7,  // Whether the shard executed immediately (during schedule)
   };
 
+  // Cycles spent in the phases of the transaction, accumulated over all its hops.
+  struct PhaseCycles {
+    uint64_t schedule = 0;        // coordinator waiting for the schedule hop
+    uint64_t hops = 0;            // coordinator waiting for the execution hops
+    uint64_t exec = 0;            // callbacks run by the execution hops
+    uint64_t immediate_exec = 0;  // callbacks run immediately during scheduling
+  };
+
   explicit Transaction(const CommandId* cid);
 
   // Initialize transaction for squashing placed on a specific shard with a given parent tx
@@ -201,6 +209,9 @@ class Transaction {
   // Returns true if the transaction continues running in the thread
   bool RunInShard(EngineShard* shard, bool txq_ooo);
 
+  // Called by engine shard to run the schedule hop published to its schedule ring.
+  void ScheduleFromRing(EngineShard* shard, bool can_run_immediately);
+
   // Registers transaction into watched queue and blocks until a) either notification is received.
   // or b) tp is reached. If tp is time_point::max() then waits indefinitely.
   // Expects that the transaction had been scheduled before, and uses Execute(.., true) to register.
@@ -223,8 +234,11 @@ class Transaction {
   // Start multi in GLOBAL mode.
   void StartMultiGlobal(DbIndex dbid);
 
-  // Start multi in LOCK_AHEAD mode with given keys.
-  void StartMultiLockedAhead(DbIndex dbid, CmdArgList keys, bool skip_scheduling = false);
+  // Start multi in LOCK_AHEAD mode with given keys. If prefetch_keys is set, the keys are looked
+  // up once per shard when scheduled and the commands reuse their iterators, see KeyPrefetch.
+  // The keys must stay valid until UnlockMulti then.
+  void StartMultiLockedAhead(DbIndex dbid, CmdArgList keys, bool skip_scheduling = false,
+                             bool prefetch_keys = false);
 
   // Start multi in NON_ATOMIC mode.
   void StartMultiNonAtomic();
@@ -270,6 +284,9 @@ class Transaction {
     return txid_;
   }
 
+  // Safe to call only from the coordinator, between hops.
+  PhaseCycles GetPhaseCycles() const;
+
   IntentLock::Mode LockMode() const;  // Based on command mask
 
   std::string_view Name() const;  // Based on command name
@@ -337,6 +354,12 @@ class Transaction {
   // Re-enable auto journal for commands marked as NO_AUTOJOURNAL. Call during setup.
   void ReviveAutoJournal();
 
+  // Auto journal the given serialization of the command instead of serializing it. Used by
+  // replicas to forward the entries of their master. Call during setup.
+  void SetForwardedJournalEntry(const journal::ForwardedEntry* fwd) {
+    forwarded_entry_ = fwd;
+  }
+
   // Clear all state to make transaction re-usable
   void Refurbish();
 
@@ -449,6 +472,9 @@ class Transaction {
     // executing multi-command. For every write to a shard journal, the corresponding index in the
     // vector is marked as true.
     absl::InlinedVector<bool, 4> shard_journal_write;
+
+    // Per shard, set by ScheduleInShard and reset by UnlockMultiShardCb if keys are prefetched.
+    std::vector<std::unique_ptr<KeyPrefetch>> key_prefetch;
   };
 
   enum CoordinatorState : uint8_t {
@@ -460,10 +486,12 @@ class Transaction {
   // Auxiliary structure used during initialization
   struct PerShardCache {
     std::vector<IndexSlice> slices;
+    std::vector<LockFp> fps;  // fingerprints of the keys in slices, in order
     unsigned key_step = 1;
 
     void Clear() {
       slices.clear();
+      fps.clear();
     }
   };
 
@@ -505,7 +533,11 @@ class Transaction {
   void InitShardData(absl::Span<const PerShardCache> shard_index, size_t num_args);
 
   // Store all key index keys in args_. Used only for single shard initialization.
-  void StoreKeysInArgs(const KeyIndex& key_index);
+  // If single_tag is set, all keys share the same lock tag and only one fingerprint is stored.
+  void StoreKeysInArgs(const KeyIndex& key_index, bool single_tag = false);
+
+  // Returns true if lock tags are enabled and all keys of key_index share the same lock tag.
+  bool KeysShareLockTag(const KeyIndex& key_index) const;
 
   // Multi transactions unlock asynchronously, so they need to keep fingerprints of keys.
   void PrepareMultiFps(CmdArgList keys);
@@ -516,6 +548,13 @@ class Transaction {
   // false if inconsistent order was detected and the schedule needs to be cancelled.
   bool ScheduleInShard(EngineShard* shard, bool can_run_immediately);
 
+  // Queue the schedule hop of a single shard transaction. Hops queued by the same thread during
+  // one iteration of its event loop are sent to their shard with a single task.
+  void QueueScheduleHop(bool can_run_immediately);
+
+  // Send the queued schedule hops of this thread to their shards.
+  static void FlushScheduleHops();
+
   // Set ARMED flags, start run barrier and submit poll tasks. Doesn't wait for the run barrier
   void DispatchHop();
 
@@ -617,6 +656,9 @@ class Transaction {
   // Set if a NO_AUTOJOURNAL command asked to enable auto journal again
   bool re_enabled_auto_journal_ = false;
 
+  // Set if the command is applied from the journal of a master and can be forwarded as is.
+  const journal::ForwardedEntry* forwarded_entry_ = nullptr;
+
   RunnableType* cb_ptr_ = nullptr;    // Run on shard threads
   const CommandId* cid_ = nullptr;    // Underlying command
   std::unique_ptr<MultiData> multi_;  // Initialized when the transaction is multi/exec.
@@ -642,6 +684,12 @@ class Transaction {
   OpStatus local_result_ = OpStatus::OK;
   absl::base_internal::SpinLock local_result_mu_;
 
+  // Phase timings, see PhaseCycles. Callback cycles are added concurrently by the shards.
+  uint64_t schedule_cycles_ = 0;
+  uint64_t hop_cycles_ = 0;
+  std::atomic_uint64_t exec_cycles_{0};
+  std::atomic_uint64_t immediate_exec_cycles_{0};
+
   // Stats purely for debugging purposes
   struct Stats {
     size_t schedule_attempts = 0;
@@ -651,11 +699,18 @@ class Transaction {
   std::function<void(Transaction* trans)> tracking_cb_;
 
  private:
+  struct KeyRoute {
+    ShardId sid;
+    LockFp fp;
+  };
+
   struct TLTmpSpace {
     std::vector<PerShardCache>& GetShardIndex(unsigned size);
+    std::vector<KeyRoute>& GetKeyRoutes(size_t num_keys);
 
    private:
     std::vector<PerShardCache> shard_cache;
+    std::vector<KeyRoute> key_routes;
   };
 
   static thread_local TLTmpSpace tmp_space;
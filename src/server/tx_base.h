@@ -14,6 +14,7 @@ namespace dfly {
 
 class EngineShard;
 class Transaction;
+struct KeyPrefetch;
 
 using DbIndex = uint16_t;
 using ShardId = uint16_t;
@@ -59,6 +60,7 @@ struct KeyIndex {
 struct DbContext {
   DbIndex db_index = 0;
   uint64_t time_now_ms = 0;
+  KeyPrefetch* prefetch = nullptr;  // iterators of the keys of an armed script, if any
 };
 
 struct OpArgs {
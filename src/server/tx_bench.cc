@@ -0,0 +1,241 @@
+// Copyright 2024, DragonflyDB authors.  All rights reserved.
+// See LICENSE for licensing terms.
+//
+
+#include <absl/strings/str_cat.h>
+#include <absl/strings/str_format.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+
+#include "base/flags.h"
+#include "base/gtest.h"
+#include "base/logging.h"
+#include "server/engine_shard_set.h"
+#include "server/main_service.h"
+#include "server/test_utils.h"
+#include "server/transaction.h"
+
+// Measures the throughput and latency of the transaction scheduling path for the common shapes
+// of commands. The clients dispatch commands straight into an in-process service, without
+// networking or reply parsing, so the numbers are dominated by scheduling and hops.
+// Run for example: tx_bench --threads=8 --clients=64 --requests=20000
+
+ABSL_FLAG(uint32_t, threads, 4, "Number of threads, every thread runs a shard and clients");
+ABSL_FLAG(uint32_t, clients, 32, "Number of concurrent clients, spread over the threads");
+ABSL_FLAG(uint32_t, requests, 10'000, "Number of requests every client sends per scenario");
+ABSL_FLAG(std::vector<std::string>, mset_shards, (std::vector<std::string>{"2", "4"}),
+          "Numbers of shards spanned by the keys of the MSET scenarios");
+ABSL_FLAG(bool, shared_keys, false,
+          "If true, all the clients use the same keys, which adds lock contention");
+
+ABSL_DECLARE_FLAG(uint32_t, multi_exec_mode);
+
+namespace dfly {
+
+using namespace std;
+using namespace util;
+
+namespace {
+
+// Commands sent one after another as a single request, which is measured as a whole.
+using Request = vector<vector<string>>;
+
+struct ClientLoad {
+  Request setup;  // sent once before the measured requests
+  Request request;
+};
+
+struct Result {
+  vector<uint64_t> latencies_ns;
+  uint64_t wall_ns = 0;
+};
+
+// Dispatches commands straight into the service and drops the replies.
+class BenchClient {
+ public:
+  explicit BenchClient(Service* service) : service_(service), conn_(Protocol::REDIS, &sink_) {
+  }
+
+  // Commands may modify their arguments in place, so they must be owned by the client.
+  void Send(vector<string>& args) {
+    args_.clear();
+    for (string& arg : args)
+      args_.emplace_back(arg.data(), arg.size());
+    service_->DispatchCommand(CmdArgList{args_}, conn_.cntx());
+    sink_.Clear();
+  }
+
+  void Send(Request& request) {
+    for (auto& args : request)
+      Send(args);
+  }
+
+ private:
+  Service* service_;
+  io::StringSink sink_;
+  TestConnection conn_;
+  CmdArgVec args_;
+};
+
+double Percentile(const vector<uint64_t>& sorted, double p) {
+  size_t index = min(sorted.size() - 1, size_t(p * sorted.size()));
+  return sorted[index] / 1000.0;
+}
+
+void PrintResult(string_view name, Result res) {
+  auto& lat = res.latencies_ns;
+  if (lat.empty())
+    return;
+
+  sort(lat.begin(), lat.end());
+  double avg = 0;
+  for (uint64_t ns : lat)
+    avg += ns;
+  avg /= lat.size() * 1000.0;
+
+  cout << absl::StrFormat("%-20s %12.0f %10.1f %10.1f %10.1f %10.1f\n", name,
+                          lat.size() * 1e9 / res.wall_ns, avg, Percentile(lat, 0.5),
+                          Percentile(lat, 0.99), Percentile(lat, 0.999));
+}
+
+}  // namespace
+
+class TxBench : public BaseFamilyTest {
+ protected:
+  TxBench() {
+    num_threads_ = absl::GetFlag(FLAGS_threads);
+  }
+
+  // Runs num_clients clients over all the threads, make_load is called on the thread of the
+  // client.
+  Result RunScenario(unsigned num_clients, function<ClientLoad(unsigned client)> make_load);
+
+  // Returns count keys of the client, each on a different shard.
+  static vector<string> KeysOnShards(unsigned client, unsigned count);
+};
+
+Result TxBench::RunScenario(unsigned num_clients, function<ClientLoad(unsigned client)> make_load) {
+  const uint32_t requests = absl::GetFlag(FLAGS_requests);
+  vector<vector<uint64_t>> latencies(num_clients);
+  vector<Fiber> fibers(num_clients);
+
+  Run({"flushall"});
+  uint64_t start = absl::GetCurrentTimeNanos();
+  for (unsigned i = 0; i < num_clients; ++i) {
+    fibers[i] = pp_->at(i % pp_->size())->LaunchFiber([&, i] {
+      ClientLoad load = make_load(i);
+      BenchClient client{service_.get()};
+      client.Send(load.setup);
+
+      auto& lat = latencies[i];
+      lat.reserve(requests);
+      for (uint32_t r = 0; r < requests; ++r) {
+        uint64_t sent = absl::GetCurrentTimeNanos();
+        client.Send(load.request);
+        lat.push_back(absl::GetCurrentTimeNanos() - sent);
+      }
+    });
+  }
+
+  for (auto& fb : fibers)
+    fb.Join();
+
+  Result res;
+  res.wall_ns = absl::GetCurrentTimeNanos() - start;
+  for (const auto& lat : latencies)
+    res.latencies_ns.insert(res.latencies_ns.end(), lat.begin(), lat.end());
+  return res;
+}
+
+vector<string> TxBench::KeysOnShards(unsigned client, unsigned count) {
+  CHECK_LE(count, shard_set->size());
+  string prefix = absl::GetFlag(FLAGS_shared_keys) ? "key:" : absl::StrCat("key:", client, ":");
+
+  vector<string> keys;
+  vector<bool> taken(shard_set->size(), false);
+  for (unsigned j = 0; keys.size() < count; ++j) {
+    string key = absl::StrCat(prefix, j);
+    ShardId sid = Shard(key, shard_set->size());
+    if (!taken[sid]) {
+      taken[sid] = true;
+      keys.push_back(std::move(key));
+    }
+  }
+  return keys;
+}
+
+TEST_F(TxBench, Scheduling) {
+  absl::FlagSaver fs;
+  const unsigned num_clients = absl::GetFlag(FLAGS_clients);
+
+  cout << absl::StrFormat("%-20s %12s %10s %10s %10s %10s\n", "scenario", "requests/s", "avg_us",
+                          "p50_us", "p99_us", "p999_us");
+
+  // Single hop on a single shard.
+  PrintResult("get", RunScenario(num_clients, [](unsigned client) {
+                vector<string> keys = KeysOnShards(client, 1);
+                return ClientLoad{{{"set", keys[0], "v"}}, {{"get", keys[0]}}};
+              }));
+
+  PrintResult("set", RunScenario(num_clients, [](unsigned client) {
+                vector<string> keys = KeysOnShards(client, 1);
+                return ClientLoad{{}, {{"set", keys[0], "v"}}};
+              }));
+
+  // Two hops on two shards, the value is moved back and forth.
+  if (shard_set->size() >= 2) {
+    PrintResult("rename x2", RunScenario(num_clients, [](unsigned client) {
+                  vector<string> keys = KeysOnShards(client, 2);
+                  return ClientLoad{{{"set", keys[0], "v"}},
+                                    {{"rename", keys[0], keys[1]}, {"rename", keys[1], keys[0]}}};
+                }));
+  }
+
+  for (const string& shards_str : absl::GetFlag(FLAGS_mset_shards)) {
+    unsigned shards = 0;
+    CHECK(absl::SimpleAtoi(shards_str, &shards)) << shards_str;
+    if (shards == 0 || shards > shard_set->size())
+      continue;
+
+    PrintResult(absl::StrCat("mset ", shards, " shards"),
+                RunScenario(num_clients, [shards](unsigned client) {
+                  vector<string> mset = {"mset"};
+                  for (string& key : KeysOnShards(client, shards)) {
+                    mset.push_back(std::move(key));
+                    mset.push_back("v");
+                  }
+                  return ClientLoad{{}, {mset}};
+                }));
+  }
+
+  const pair<Transaction::MultiMode, string_view> kModes[] = {
+      {Transaction::GLOBAL, "global"},
+      {Transaction::LOCK_AHEAD, "lock_ahead"},
+      {Transaction::NON_ATOMIC, "non_atomic"},
+  };
+  for (auto [mode, mode_name] : kModes) {
+    absl::SetFlag(&FLAGS_multi_exec_mode, mode);
+    PrintResult(absl::StrCat("multi ", mode_name), RunScenario(num_clients, [](unsigned client) {
+                  vector<string> keys = KeysOnShards(client, min(2u, shard_set->size()));
+                  return ClientLoad{{},
+                                    {{"multi"},
+                                     {"set", keys.front(), "v"},
+                                     {"set", keys.back(), "v"},
+                                     {"exec"}}};
+                }));
+  }
+
+  // Pairs of clients play ping-pong over two lists, so that every pop blocks until the other
+  // client pushes. A request is a full round trip.
+  PrintResult("blpop ping-pong", RunScenario(num_clients & ~1u, [](unsigned client) {
+                string ping = absl::StrCat("ping:", client / 2);
+                string pong = absl::StrCat("pong:", client / 2);
+                if (client % 2 == 0)
+                  return ClientLoad{{}, {{"blpop", ping, "0"}, {"lpush", pong, "v"}}};
+                return ClientLoad{{}, {{"lpush", ping, "v"}, {"blpop", pong, "0"}}};
+              }));
+}
+
+}  // namespace dfly
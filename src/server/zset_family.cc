@@ -10,6 +10,7 @@ extern "C" {
 #include "redis/geo.h"
 #include "redis/geohash.h"
 #include "redis/geohash_helper.h"
+#include "redis/intset.h"
 #include "redis/listpack.h"
 #include "redis/redis_aux.h"
 #include "redis/util.h"
@@ -19,7 +20,11 @@ extern "C" {
 
 #include "base/logging.h"
 #include "base/stl_util.h"
+#include "core/listpack_scan.h"
+#include "core/small_set.h"
+#include "core/sorted_intersect.h"
 #include "core/sorted_map.h"
+#include "core/string_set.h"
 #include "facade/cmd_arg_parser.h"
 #include "facade/error.h"
 #include "server/blocking_controller.h"
@@ -137,7 +142,7 @@ int ZsetDel(detail::RobjWrapper* robj_wrapper, sds ele) {
   if (robj_wrapper->encoding() == OBJ_ENCODING_LISTPACK) {
     unsigned char* eptr;
     uint8_t* lp = (uint8_t*)robj_wrapper->inner_obj();
-    if ((eptr = zzlFind(lp, ele, NULL)) != NULL) {
+    if ((eptr = detail::ZzlFind(lp, {ele, sdslen(ele)}, nullptr)) != NULL) {
       lp = lpDeleteRangeWithEntry(lp, &eptr, 2);
       robj_wrapper->set_inner_obj(lp);
       return 1;
@@ -154,7 +159,8 @@ int ZsetDel(detail::RobjWrapper* robj_wrapper, sds ele) {
 std::optional<double> GetZsetScore(const detail::RobjWrapper* robj_wrapper, sds member) {
   if (robj_wrapper->encoding() == OBJ_ENCODING_LISTPACK) {
     double score;
-    if (zzlFind((uint8_t*)robj_wrapper->inner_obj(), member, &score) == NULL)
+    uint8_t* lp = (uint8_t*)robj_wrapper->inner_obj();
+    if (detail::ZzlFind(lp, {member, sdslen(member)}, &score) == NULL)
       return std::nullopt;
     return score;
   }
@@ -715,6 +721,9 @@ void SendAtLeastOneKeyError(ConnectionContext* cntx) {
 enum class AggType : uint8_t { SUM, MIN, MAX, NOOP };
 using ScoredMap = absl::flat_hash_map<std::string, double>;
 
+// Number of members looked up at once by the intersections.
+constexpr size_t kInterBatchSize = 32;
+
 ScoredMap FromObject(const CompactObj& co, double weight) {
   ZSetFamily::RangeParams params;
   params.with_scores = true;
@@ -749,9 +758,9 @@ double Aggregate(double v1, double v2, AggType atype) {
 }
 
 // the result is in the destination.
-void UnionScoredMap(ScoredMap* dest, ScoredMap* src, AggType agg_type) {
-  ScoredMap* target = dest;
-  ScoredMap* iter = src;
+template <typename Map> void UnionScoredMap(Map* dest, Map* src, AggType agg_type) {
+  Map* target = dest;
+  Map* iter = src;
 
   if (iter->size() > target->size())
     swap(target, iter);
@@ -820,8 +829,9 @@ double GetKeyWeight(Transaction* t, ShardId shard_id, const vector<double>& weig
   return weights[windex];
 }
 
-OpResult<ScoredMap> OpUnion(EngineShard* shard, Transaction* t, string_view dest, AggType agg_type,
-                            const vector<double>& weights, bool store) {
+// Source zsets of the shard with their weights.
+OpResult<KeyIterWeightVec> FindUnionKeys(EngineShard* shard, Transaction* t, string_view dest,
+                                         const vector<double>& weights, bool store) {
   ShardArgs keys = t->GetShardArgs(shard->shard_id());
   DCHECK(!keys.Empty());
 
@@ -841,7 +851,7 @@ OpResult<ScoredMap> OpUnion(EngineShard* shard, Transaction* t, string_view dest
     // In case ONLY the destination key is hosted in this shard no work on this shard should be
     // done in this step
     if (start == end) {
-      return OpStatus::OK;
+      return KeyIterWeightVec{};
     }
   }
 
@@ -861,7 +871,54 @@ OpResult<ScoredMap> OpUnion(EngineShard* shard, Transaction* t, string_view dest
     ++index;
   }
 
-  return UnionShardKeysWithScore(key_weight_vec, agg_type);
+  return key_weight_vec;
+}
+
+OpResult<ScoredMap> OpUnion(EngineShard* shard, Transaction* t, string_view dest, AggType agg_type,
+                            const vector<double>& weights, bool store) {
+  auto keys = FindUnionKeys(shard, t, dest, weights, store);
+  if (!keys)
+    return keys.status();
+  return UnionShardKeysWithScore(*keys, agg_type);
+}
+
+// Members of a shard's partial ZUNIONSTORE result, split by container_utils::MergePartition. The
+// views refer to the members of the source zsets, which stay locked until the transaction
+// concludes.
+using ScoredViewMap = absl::flat_hash_map<string_view, double>;
+
+struct PartitionedScores {
+  vector<ScoredViewMap> parts;
+  container_utils::EntryViews views;
+};
+
+// Like OpUnion, but splits the members into num_parts partitions without copying them.
+OpResult<PartitionedScores> OpUnionViews(EngineShard* shard, Transaction* t, string_view dest,
+                                         AggType agg_type, const vector<double>& weights,
+                                         unsigned num_parts) {
+  auto keys = FindUnionKeys(shard, t, dest, weights, true);
+  if (!keys)
+    return keys.status();
+
+  PartitionedScores res;
+  res.parts.resize(num_parts);
+  for (const auto& [it, weight] : *keys) {
+    if (it.is_done())
+      continue;
+
+    container_utils::IterateSortedSet(
+        it->second.GetRobjWrapper(),
+        [&, weight = weight](container_utils::ContainerEntry ce, double score) {
+          string_view member = res.views.Get(ce);
+          ScoredViewMap& part = res.parts[container_utils::MergePartition(member, num_parts)];
+          auto [sit, inserted] = part.emplace(member, score * weight);
+          if (!inserted)
+            sit->second = Aggregate(sit->second, score * weight, agg_type);
+          return true;
+        },
+        0, -1, false, true);
+  }
+  return res;
 }
 
 ScoredMap ZSetFromSet(const PrimeValue& pv, double weight) {
@@ -873,8 +930,146 @@ ScoredMap ZSetFromSet(const PrimeValue& pv, double weight) {
   return result;
 }
 
+// An input of ZINTER* with its weight. Sets are treated as sorted sets whose scores are all 1.
+struct InterSource {
+  const PrimeValue* pv;
+  double weight;
+};
+
+bool IsIntSet(const InterSource& src) {
+  return src.pv->ObjType() == OBJ_SET && src.pv->Encoding() == kEncodingIntSet;
+}
+
+// Sets scores[i] to the weighted score of batch[i] in src or to nullopt if it is not there.
+// Hash based encodings are probed with the whole batch at once to overlap the cache misses.
+void ProbeScores(const DbContext& db_cntx, const InterSource& src, const vector<string_view>& batch,
+                 optional<double>* scores) {
+  const PrimeValue& pv = *src.pv;
+  if (pv.ObjType() == OBJ_ZSET) {
+    const detail::RobjWrapper* robj_wrapper = pv.GetRobjWrapper();
+    if (robj_wrapper->encoding() == OBJ_ENCODING_SKIPLIST) {
+      auto* zs = (const detail::SortedMap*)robj_wrapper->inner_obj();
+      zs->GetScoreBatch(batch.data(), batch.size(), scores);
+    } else {
+      uint8_t* lp = (uint8_t*)robj_wrapper->inner_obj();
+      for (size_t i = 0; i < batch.size(); ++i) {
+        double score;
+        scores[i] = detail::ZzlFind(lp, batch[i], &score) ? optional{score} : nullopt;
+      }
+    }
+  } else if (pv.Encoding() == kEncodingIntSet) {
+    intset* is = (intset*)pv.RObjPtr();
+    for (size_t i = 0; i < batch.size(); ++i) {
+      long long llval;
+      bool found = string2ll(batch[i].data(), batch[i].size(), &llval) && intsetFind(is, llval);
+      scores[i] = found ? optional{1.0} : nullopt;
+    }
+  } else if (pv.Encoding() == kEncodingSmallSet) {
+    const SmallSet* ss = (const SmallSet*)pv.RObjPtr();
+    for (size_t i = 0; i < batch.size(); ++i)
+      scores[i] = ss->Contains(batch[i]) ? optional{1.0} : nullopt;
+  } else {
+    StringSet* ss = (StringSet*)pv.RObjPtr();
+    ss->set_time(MemberTimeSeconds(db_cntx.time_now_ms));
+    sds found[kInterBatchSize];
+    ss->FindBatch(batch.data(), batch.size(), found);
+    for (size_t i = 0; i < batch.size(); ++i)
+      scores[i] = found[i] ? optional{1.0} : nullopt;
+  }
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    if (scores[i])
+      *scores[i] *= src.weight;
+  }
+}
+
+// Intersects the inputs, smallest first. Intsets alone are intersected as sorted integer arrays,
+// otherwise the members of the smallest input are looked up in the others batch by batch.
+ScoredMap InterSources(const DbContext& db_cntx, vector<InterSource> sources, AggType agg_type,
+                       size_t limit) {
+  ScoredMap result;
+
+  if (all_of(sources.begin(), sources.end(), IsIntSet)) {
+    double score = sources.front().weight;
+    for (size_t i = 1; i < sources.size(); ++i)
+      score = Aggregate(score, sources[i].weight, agg_type);
+
+    sort(sources.begin(), sources.end(), [](const InterSource& a, const InterSource& b) {
+      return a.pv->Size() < b.pv->Size();
+    });
+
+    vector<int64_t> items;
+    IntsetDecode((const intset*)sources.front().pv->RObjPtr(), &items);
+    size_t num = items.size();
+    for (size_t i = 1; i < sources.size() && num > 0; ++i) {
+      bool last = i + 1 == sources.size();
+      num = IntersectIntset(items.data(), num, (const intset*)sources[i].pv->RObjPtr(),
+                            last ? limit : 0);
+    }
+
+    num = limit ? min(num, limit) : num;
+    result.reserve(num);
+    for (size_t i = 0; i < num; ++i)
+      result.emplace(absl::StrCat(items[i]), score);
+    return result;
+  }
+
+  auto smallest = min_element(sources.begin(), sources.end(), [](const auto& a, const auto& b) {
+    return a.pv->Size() < b.pv->Size();
+  });
+  iter_swap(sources.begin(), smallest);
+
+  const InterSource& front = sources.front();
+  ScoredMap candidates = front.pv->ObjType() == OBJ_ZSET ? FromObject(*front.pv, front.weight)
+                                                         : ZSetFromSet(*front.pv, front.weight);
+
+  vector<string_view> batch;
+  vector<double> batch_scores;
+  optional<double> found[kInterBatchSize];
+  batch.reserve(kInterBatchSize);
+  batch_scores.reserve(kInterBatchSize);
+
+  // Keeps the members of the batch that are in all the other inputs. Returns false once the
+  // limit is reached.
+  auto flush = [&] {
+    for (size_t j = 1; j < sources.size() && !batch.empty(); ++j) {
+      ProbeScores(db_cntx, sources[j], batch, found);
+      size_t keep = 0;
+      for (size_t i = 0; i < batch.size(); ++i) {
+        if (found[i]) {
+          batch_scores[keep] = Aggregate(batch_scores[i], *found[i], agg_type);
+          batch[keep++] = batch[i];
+        }
+      }
+      batch.resize(keep);
+      batch_scores.resize(keep);
+    }
+
+    for (size_t i = 0; i < batch.size(); ++i) {
+      if (limit && result.size() >= limit)
+        return false;
+      result.emplace(string(batch[i]), batch_scores[i]);
+    }
+    batch.clear();
+    batch_scores.clear();
+    return !limit || result.size() < limit;
+  };
+
+  for (const auto& [member, score] : candidates) {
+    batch.push_back(member);
+    batch_scores.push_back(score);
+    if (batch.size() == kInterBatchSize && !flush())
+      return result;
+  }
+  flush();
+
+  return result;
+}
+
+// Stops after limit members unless limit is 0, thus limit must be set only if all the keys are
+// hosted by the shard.
 OpResult<ScoredMap> OpInter(EngineShard* shard, Transaction* t, string_view dest, AggType agg_type,
-                            const vector<double>& weights, bool store) {
+                            const vector<double>& weights, bool store, size_t limit = 0) {
   ShardArgs keys = t->GetShardArgs(shard->shard_id());
   DCHECK(!keys.Empty());
 
@@ -919,28 +1114,15 @@ OpResult<ScoredMap> OpInter(EngineShard* shard, Transaction* t, string_view dest
     ++index;
   }
 
-  ScoredMap result;
-  for (auto it = it_arr.begin(); it != it_arr.end(); ++it) {
-    if (it->first.it.is_done()) {
+  vector<InterSource> sources;
+  sources.reserve(it_arr.size());
+  for (const auto& [it_res, weight] : it_arr) {
+    if (it_res.it.is_done())
       return ScoredMap{};
-    }
-
-    ScoredMap sm;
-    if (it->first.it->second.ObjType() == OBJ_ZSET)
-      sm = FromObject(it->first.it->second, it->second);
-    else
-      sm = ZSetFromSet(it->first.it->second, it->second);
-
-    if (result.empty())
-      result.swap(sm);
-    else
-      InterScoredMap(&result, &sm, agg_type);
-
-    if (result.empty())
-      return result;
+    sources.push_back({&it_res.it->second, weight});
   }
 
-  return result;
+  return InterSources(t->GetDbContext(), std::move(sources), agg_type, limit);
 }
 
 using ScoredMemberView = std::pair<double, std::string_view>;
@@ -994,6 +1176,21 @@ OpResult<AddResult> OpAdd(const OpArgs& op_args, const ZParams& zparams, string_
   detail::RobjWrapper* robj_wrapper = res_it->it->second.GetRobjWrapper();
   bool is_list_pack = robj_wrapper->encoding() == OBJ_ENCODING_LISTPACK;
 
+  // A store command replaces the key with a freshly created map, which can be built at once.
+  if (zparams.override && zparams.flags == 0 && !is_list_pack) {
+    detail::SortedMap* sm = (detail::SortedMap*)robj_wrapper->inner_obj();
+    vector<pair<double, sds>> bulk(members.size());
+    for (size_t j = 0; j < members.size(); j++) {
+      bulk[j] = {members[j].first, sdsnewlen(members[j].second.data(), members[j].second.size())};
+    }
+
+    if (sm->BulkInsert(bulk)) {
+      aresult.num_updated = members.size();
+      return aresult;
+    }
+    // Fall back to adding the members one by one, which handles duplicates and NaN scores.
+  }
+
   // opportunistically reserve space if multiple entries are about to be added.
   if ((zparams.flags & ZADD_IN_XX) == 0 && members.size() > 2) {
     if (is_list_pack) {
@@ -1194,6 +1391,90 @@ OpResult<SetOpArgs> ParseSetOpArgs(CmdArgList args, bool store) {
   return op_args;
 }
 
+// Every shard splits the views of its members into partitions, the i-th shard of the transaction
+// merging partition i when the results are large.
+void ZUnionStoreInternal(CmdArgList args, const SetOpArgs& op_args, ConnectionContext* cntx) {
+  string_view dest_key = ArgS(args, 0);
+  unsigned num_parts = cntx->transaction->GetUniqueShardCnt();
+  vector<OpResult<PartitionedScores>> results(shard_set->size());
+  vector<bool> active(shard_set->size(), false);
+
+  auto cb = [&](Transaction* t, EngineShard* shard) {
+    ShardId sid = shard->shard_id();
+    active[sid] = true;
+    results[sid] = OpUnionViews(shard, t, dest_key, op_args.agg_type, op_args.weights, num_parts);
+    return OpStatus::OK;
+  };
+  cntx->transaction->Execute(std::move(cb), false);
+
+  size_t total = 0;
+  for (auto& op_res : results) {
+    if (!op_res) {
+      cntx->transaction->Conclude();
+      return cntx->SendError(op_res.status());
+    }
+    for (const ScoredViewMap& part : op_res->parts)
+      total += part.size();
+  }
+
+  // Members of different partitions are distinct, so that the partitions are merged
+  // independently.
+  vector<ScoredViewMap> merged(num_parts);
+  auto merge_part = [&](unsigned part) {
+    for (auto& op_res : results) {
+      if (!op_res->parts.empty())
+        UnionScoredMap(&merged[part], &op_res->parts[part], op_args.agg_type);
+    }
+  };
+
+  if (num_parts > 1 && total >= container_utils::kMinParallelMergeSize) {
+    vector<ShardId> mergers;
+    for (ShardId sid = 0; sid < active.size(); ++sid) {
+      if (active[sid])
+        mergers.push_back(sid);
+    }
+    DCHECK_EQ(mergers.size(), num_parts);
+
+    auto merge_cb = [&](Transaction* t, EngineShard* shard) {
+      merge_part(find(mergers.begin(), mergers.end(), shard->shard_id()) - mergers.begin());
+      return OpStatus::OK;
+    };
+    cntx->transaction->Execute(std::move(merge_cb), false);
+  } else {
+    for (unsigned part = 0; part < num_parts; ++part)
+      merge_part(part);
+  }
+
+  vector<ScoredMemberView> smvec;
+  for (const ScoredViewMap& result : merged) {
+    for (const auto& elem : result) {
+      smvec.emplace_back(elem.second, elem.first);
+    }
+  }
+
+  // Overwriting the destination frees its members, so they are copied if it is a source too.
+  StringVec copies;
+  for (size_t i = 2; i < op_args.num_keys + 2 && copies.empty(); ++i) {
+    if (ArgS(args, i) == dest_key) {
+      copies.reserve(smvec.size());
+      for (auto& elem : smvec)
+        elem.second = copies.emplace_back(elem.second);
+    }
+  }
+
+  ShardId dest_shard = Shard(dest_key, shard_set->size());
+  auto store_cb = [&](Transaction* t, EngineShard* shard) {
+    if (shard->shard_id() == dest_shard) {
+      ZParams zparams;
+      zparams.override = true;
+      OpAdd(t->GetOpArgs(shard), zparams, dest_key, ScoredMemberSpan{smvec}).value();
+    }
+    return OpStatus::OK;
+  };
+  cntx->transaction->Execute(std::move(store_cb), true);
+  cntx->SendLong(smvec.size());
+}
+
 void ZUnionFamilyInternal(CmdArgList args, bool store, ConnectionContext* cntx) {
   OpResult<SetOpArgs> op_args_res = ParseSetOpArgs(args, store);
   if (!op_args_res) {
@@ -1204,18 +1485,19 @@ void ZUnionFamilyInternal(CmdArgList args, bool store, ConnectionContext* cntx)
     return SendAtLeastOneKeyError(cntx);
   }
 
-  vector<OpResult<ScoredMap>> maps(shard_set->size());
-
   string_view dest_key = ArgS(args, 0);
+  if (store)
+    return ZUnionStoreInternal(args, op_args, cntx);
 
+  vector<OpResult<ScoredMap>> maps(shard_set->size());
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    maps[shard->shard_id()] = OpUnion(shard, t, dest_key, op_args.agg_type, op_args.weights, store);
+    maps[shard->shard_id()] =
+        OpUnion(shard, t, dest_key, op_args.agg_type, op_args.weights, false);
     return OpStatus::OK;
   };
 
-  // For commands not storing computed result, this should be
-  // the last transaction hop (e.g. ZUNION)
-  cntx->transaction->Execute(std::move(cb), !store);
+  // This is the last transaction hop of ZUNION.
+  cntx->transaction->Execute(std::move(cb), true);
 
   ScoredMap result;
   for (auto& op_res : maps) {
@@ -1229,28 +1511,13 @@ void ZUnionFamilyInternal(CmdArgList args, bool store, ConnectionContext* cntx)
     smvec.emplace_back(elem.second, elem.first);
   }
 
-  if (store) {
-    ShardId dest_shard = Shard(dest_key, maps.size());
-    AddResult add_result;
-    auto store_cb = [&](Transaction* t, EngineShard* shard) {
-      if (shard->shard_id() == dest_shard) {
-        ZParams zparams;
-        zparams.override = true;
-        add_result = OpAdd(t->GetOpArgs(shard), zparams, dest_key, ScoredMemberSpan{smvec}).value();
-      }
-      return OpStatus::OK;
-    };
-    cntx->transaction->Execute(std::move(store_cb), true);
-    cntx->SendLong(smvec.size());
-  } else {
-    std::sort(std::begin(smvec), std::end(smvec));
-    auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
-    rb->StartArray(smvec.size() * (op_args.with_scores ? 2 : 1));
-    for (const auto& elem : smvec) {
-      rb->SendBulkString(elem.second);
-      if (op_args.with_scores) {
-        rb->SendDouble(elem.first);
-      }
+  std::sort(std::begin(smvec), std::end(smvec));
+  auto* rb = static_cast<RedisReplyBuilder*>(cntx->reply_builder());
+  rb->StartArray(smvec.size() * (op_args.with_scores ? 2 : 1));
+  for (const auto& elem : smvec) {
+    rb->SendBulkString(elem.second);
+    if (op_args.with_scores) {
+      rb->SendDouble(elem.first);
     }
   }
 }
@@ -1426,24 +1693,6 @@ auto OpRange(const ZSetFamily::ZRangeSpec& range_spec, const OpArgs& op_args, st
   return iv.PopResult();
 }
 
-auto OpRanges(const std::vector<ZSetFamily::ZRangeSpec>& range_specs, const OpArgs& op_args,
-              string_view key) -> OpResult<vector<ScoredArray>> {
-  auto res_it = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key, OBJ_ZSET);
-  if (!res_it)
-    return res_it.status();
-
-  // Action::RANGE is read-only, but requires mutable pointer, thus const_cast
-  PrimeValue& pv = const_cast<PrimeValue&>(res_it.value()->second);
-  vector<ScoredArray> result_arrays;
-  for (auto& range_spec : range_specs) {
-    IntervalVisitor iv{Action::RANGE, range_spec.params, &pv};
-    std::visit(iv, range_spec.interval);
-    result_arrays.push_back(iv.PopResult());
-  }
-
-  return result_arrays;
-}
-
 OpResult<unsigned> OpRemRange(const OpArgs& op_args, string_view key,
                               const ZSetFamily::ZRangeSpec& range_spec) {
   auto& db_slice = op_args.shard->db_slice();
@@ -1658,6 +1907,18 @@ OpResult<MScoreResponse> OpMScore(const OpArgs& op_args, string_view key,
   MScoreResponse scores(members.Size());
 
   const detail::RobjWrapper* robj_wrapper = res_it.value()->second.GetRobjWrapper();
+  if (robj_wrapper->encoding() == OBJ_ENCODING_SKIPLIST) {
+    vector<string_view> keys;
+    keys.reserve(members.Size());
+    for (string_view member : members.Range())
+      keys.push_back(member);
+
+    // Probe all members at once to overlap the cache misses.
+    detail::SortedMap* zs = (detail::SortedMap*)robj_wrapper->inner_obj();
+    zs->GetScoreBatch(keys.data(), keys.size(), scores.data());
+    return scores;
+  }
+
   sds& tmp_str = op_args.shard->tmp_str1;
 
   size_t i = 0;
@@ -2159,10 +2420,12 @@ void ZSetFamily::ZInterCard(CmdArgList args, ConnectionContext* cntx) {
     return cntx->SendError(kSyntaxErr);
   }
 
+  // A shard can stop at the limit only if it holds all the keys.
+  size_t shard_limit = cntx->transaction->GetUniqueShardCnt() == 1 ? limit : 0;
   vector<OpResult<ScoredMap>> maps(shard_set->size(), OpStatus::SKIPPED);
 
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    maps[shard->shard_id()] = OpInter(shard, t, "", AggType::NOOP, {}, false);
+    maps[shard->shard_id()] = OpInter(shard, t, "", AggType::NOOP, {}, false, shard_limit);
     return OpStatus::OK;
   };
 
@@ -2782,7 +3045,166 @@ void ZSetFamily::GeoDist(CmdArgList args, ConnectionContext* cntx) {
 }
 
 namespace {
-std::vector<ZSetFamily::ZRangeSpec> GetGeoRangeSpec(const GeoHashRadius& n) {
+constexpr double kEarthRadiusM = 6372797.560856;  // as in geohash_helper.c
+
+// Cells holding more members than this are split into their four children.
+constexpr size_t kGeoCellSplitThreshold = 256;
+
+// Maximal number of times a cell of the search area is split.
+constexpr unsigned kGeoCellMaxSplits = 4;
+
+// Number of candidates decoded and filtered together.
+constexpr size_t kGeoBatchSize = 64;
+
+inline double DegToRad(double deg) {
+  return deg * M_PI / 180.0;
+}
+
+inline double RadToDeg(double rad) {
+  return rad * 180.0 / M_PI;
+}
+
+// Absolute difference of two longitudes, taking the wrap around the antimeridian into account.
+inline double LonDelta(double lon1, double lon2) {
+  double delta = fabs(lon1 - lon2);
+  return delta > 180 ? 360 - delta : delta;
+}
+
+// Bounding box in degrees of all the points matching a search shape. It is slightly larger than
+// the exact one, so that it never drops a member geoWithinShape would accept.
+class GeoBounds {
+ public:
+  explicit GeoBounds(const GeoShape& shape);
+
+  bool Contains(double lon, double lat) const {
+    return fabs(lat - lat_) <= lat_delta_ && LonDelta(lon, lon_) <= lon_delta_;
+  }
+
+  // min_dist is the MinDistance of area.
+  bool Intersects(const GeoHashArea& area, double min_dist) const {
+    return area.latitude.max >= lat_ - lat_delta_ && area.latitude.min <= lat_ + lat_delta_ &&
+           LonGap(area) <= lon_delta_ && min_dist <= max_dist_;
+  }
+
+  // Lower bound of the distance in meters from the center to the points of area.
+  double MinDistance(const GeoHashArea& area) const;
+
+ private:
+  double LonGap(const GeoHashArea& area) const {
+    if (area.longitude.min <= lon_ && lon_ <= area.longitude.max)
+      return 0;
+    return min(LonDelta(area.longitude.min, lon_), LonDelta(area.longitude.max, lon_));
+  }
+
+  double lon_, lat_;
+  double lat_delta_;
+  double lon_delta_;  // 180 if longitudes are not bounded
+  double max_dist_;   // distance of the farthest point for circles
+};
+
+GeoBounds::GeoBounds(const GeoShape& shape) : lon_(shape.xy[0]), lat_(shape.xy[1]) {
+  constexpr double kMargin = 1 + 1e-6;
+  lon_delta_ = 180;
+  max_dist_ = HUGE_VAL;
+
+  if (shape.type == CIRCULAR_TYPE) {
+    // The points within angular distance r from the center span asin(sin(r) / cos(lat))
+    // longitudes, unless the circle contains a pole.
+    max_dist_ = shape.t.radius * shape.conversion;
+    double r = max_dist_ / kEarthRadiusM;
+    lat_delta_ = RadToDeg(r) * kMargin;
+    if (r < M_PI / 2 && fabs(lat_) + lat_delta_ < 90) {
+      double sin_lon = sin(r) / cos(DegToRad(lat_));
+      if (sin_lon < 1)
+        lon_delta_ = RadToDeg(asin(sin_lon)) * kMargin;
+    }
+  } else {
+    // geohashGetDistanceIfInRectangle compares the latitude distance with half of the height and
+    // the distance along the latitude of the point with half of the width. The latter allows the
+    // widest longitude range at the latitude farthest from the equator.
+    double half_w = shape.t.r.width * shape.conversion / 2 / kEarthRadiusM;
+    lat_delta_ = RadToDeg(shape.t.r.height * shape.conversion / 2 / kEarthRadiusM) * kMargin;
+    double far_lat = fabs(lat_) + lat_delta_;
+    if (half_w < M_PI && far_lat < 90) {
+      double sin_half_lon = sin(half_w / 2) / cos(DegToRad(far_lat));
+      if (sin_half_lon < 1)
+        lon_delta_ = min(180.0, RadToDeg(2 * asin(sin_half_lon)) * kMargin);
+    }
+  }
+}
+
+double GeoBounds::MinDistance(const GeoHashArea& area) const {
+  const GeoHashRange& lat = area.latitude;
+  const GeoHashRange& lon = area.longitude;
+  bool lon_inside = lon.min <= lon_ && lon_ <= lon.max;
+  if (lon_inside && lat.min <= lat_ && lat_ <= lat.max)
+    return 0;
+
+  // The nearest point is on an edge. Along a parallel it is at the longitude nearest to the
+  // center. Along a meridian the cosine of the distance is a sinusoid of the latitude, whose
+  // peak is clamped to the edge.
+  double min_dist = HUGE_VAL;
+  double near_lon = lon_;
+  if (!lon_inside)
+    near_lon = LonDelta(lon.min, lon_) < LonDelta(lon.max, lon_) ? lon.min : lon.max;
+  for (double edge_lat : {lat.min, lat.max}) {
+    min_dist = min(min_dist, geohashGetDistance(lon_, lat_, near_lon, edge_lat));
+  }
+
+  double lat_rad = DegToRad(lat_);
+  for (double edge_lon : {lon.min, lon.max}) {
+    double peak = RadToDeg(atan2(sin(lat_rad), cos(lat_rad) * cos(DegToRad(edge_lon - lon_))));
+    double edge_lat = clamp(peak, lat.min, lat.max);
+    min_dist = min(min_dist, geohashGetDistance(lon_, lat_, edge_lon, edge_lat));
+  }
+
+  // Leave room for rounding errors, the result only needs to be a lower bound.
+  return min_dist * (1 - 1e-6);
+}
+
+// Score range of a geohash cell to scan and the lower bound of the distance to its members.
+struct GeoCell {
+  zrangespec range;
+  double min_dist;
+};
+
+// Adds the cell unless it is outside of bounds. Cells holding too many members are split into
+// their four children instead, which are added in score order, so that members are visited in
+// the same order as when scanning the whole cell.
+void AddGeoCell(const GeoBounds& bounds, const detail::SortedMap* zs, GeoHashBits cell,
+                unsigned splits, vector<GeoCell>* cells) {
+  GeoHashArea area;
+  geohashDecodeWGS84(cell, &area);
+  double min_dist = bounds.MinDistance(area);
+  if (!bounds.Intersects(area, min_dist))
+    return;
+
+  GeoHashFix52Bits min, max;
+  scoresOfGeoHashBox(cell, &min, &max);
+
+  GeoCell gc;
+  gc.range.min = min;
+  gc.range.max = max;
+  gc.range.minex = 0;
+  gc.range.maxex = 1;
+
+  if (zs && splits > 0 && cell.step < GEO_STEP_MAX &&
+      zs->Count(gc.range) > kGeoCellSplitThreshold) {
+    for (uint64_t quadrant = 0; quadrant < 4; ++quadrant) {
+      GeoHashBits child = {.bits = (cell.bits << 2) | quadrant, .step = uint8_t(cell.step + 1)};
+      AddGeoCell(bounds, zs, child, splits - 1, cells);
+    }
+    return;
+  }
+
+  gc.min_dist = min_dist;
+  cells->push_back(gc);
+}
+
+// The cells to scan for the search area. Dense cells of sorted maps are split, listpacks are
+// small enough to scan the area as is.
+vector<GeoCell> GetGeoCells(const GeoHashRadius& n, const GeoBounds& bounds,
+                            const detail::SortedMap* zs) {
   array<GeoHashBits, 9> neighbors;
   unsigned int last_processed = 0;
 
@@ -2796,8 +3218,8 @@ std::vector<ZSetFamily::ZRangeSpec> GetGeoRangeSpec(const GeoHashRadius& n) {
   neighbors[7] = n.neighbors.south_east;
   neighbors[8] = n.neighbors.south_west;
 
-  // Get range_specs for neighbors (*and* our own hashbox)
-  std::vector<ZSetFamily::ZRangeSpec> range_specs;
+  // Get cells for neighbors (*and* our own hashbox)
+  vector<GeoCell> cells;
   for (unsigned int i = 0; i < neighbors.size(); i++) {
     if (HASHISZERO(neighbors[i])) {
       continue;
@@ -2812,21 +3234,195 @@ std::vector<ZSetFamily::ZRangeSpec> GetGeoRangeSpec(const GeoHashRadius& n) {
       continue;
     }
 
-    GeoHashFix52Bits min, max;
-    scoresOfGeoHashBox(neighbors[i], &min, &max);
+    AddGeoCell(bounds, zs, neighbors[i], kGeoCellMaxSplits, &cells);
+    last_processed = i;
+  }
+  return cells;
+}
 
-    ZSetFamily::ScoreInterval si;
-    si.first = ZSetFamily::Bound{static_cast<double>(min), false};
-    si.second = ZSetFamily::Bound{static_cast<double>(max), true};
+// Collects the members matching the search shape. Candidates are buffered and filtered in
+// batches: first by the bounding box, which is cheap and vectorizes, and only the remaining ones
+// by the exact distance. When COUNT is given without ANY it keeps only the best count members
+// in a heap, otherwise it stops once count members are found with ANY.
+class GeoCollector {
+ public:
+  GeoCollector(const GeoShape& shape, const GeoSearchOpts& opts, const detail::RobjWrapper* robj)
+      : shape_(shape), bounds_(shape), robj_(robj) {
+    if (opts.count > 0) {
+      if (opts.any) {
+        limit_ = opts.count;
+      } else {
+        top_k_ = opts.count;
+        desc_ = opts.sorting == Sorting::kDesc;
+      }
+    }
+  }
 
-    ZSetFamily::RangeParams range_params;
-    range_params.interval_type = ZSetFamily::RangeParams::IntervalType::SCORE;
-    range_params.with_scores = true;
-    range_specs.emplace_back(si, range_params);
+  GeoArray Search(const GeoHashRadius& radius);
 
-    last_processed = i;
+ private:
+  // ref is the listpack entry or the sds member.
+  bool Add(double score, const void* ref) {
+    scores_[batch_len_] = score;
+    refs_[batch_len_] = ref;
+    return ++batch_len_ < kGeoBatchSize || Flush();
   }
-  return range_specs;
+
+  // Returns false if no more members are needed.
+  bool Flush();
+
+  // Whether a member at distance dist has a chance to be in the result.
+  bool Accepts(double dist) const {
+    if (top_k_ == 0 || points_.size() < top_k_)
+      return true;
+    return desc_ ? dist > points_.front().dist : dist < points_.front().dist;
+  }
+
+  bool Better(const GeoPoint& a, const GeoPoint& b) const {
+    return desc_ ? a.dist > b.dist : a.dist < b.dist;
+  }
+
+  bool ScanCell(const zrangespec& range);
+
+  string Member(const void* ref) const;
+
+  const GeoShape& shape_;
+  GeoBounds bounds_;
+  const detail::RobjWrapper* robj_;
+  size_t limit_ = 0;
+  size_t top_k_ = 0;
+  bool desc_ = false;
+
+  GeoArray points_;  // heap ordered by Better if top_k_ is set
+
+  size_t batch_len_ = 0;
+  double scores_[kGeoBatchSize];
+  const void* refs_[kGeoBatchSize];
+};
+
+GeoArray GeoCollector::Search(const GeoHashRadius& radius) {
+  bool is_listpack = robj_->encoding() == OBJ_ENCODING_LISTPACK;
+  auto* zs = is_listpack ? nullptr : static_cast<const detail::SortedMap*>(robj_->inner_obj());
+  vector<GeoCell> cells = GetGeoCells(radius, bounds_, zs);
+
+  // The nearest members are likely in the nearest cells. Once the heap is full, the cells that
+  // are farther than its worst member can't contribute anymore.
+  bool nearest_first = top_k_ > 0 && !desc_;
+  if (nearest_first) {
+    stable_sort(cells.begin(), cells.end(),
+                [](const GeoCell& a, const GeoCell& b) { return a.min_dist < b.min_dist; });
+  }
+
+  for (const GeoCell& cell : cells) {
+    if (nearest_first) {
+      Flush();
+      if (points_.size() == top_k_ && cell.min_dist > points_.front().dist)
+        break;
+    }
+    if (!ScanCell(cell.range))
+      return std::move(points_);
+  }
+  Flush();
+
+  return std::move(points_);
+}
+
+bool GeoCollector::ScanCell(const zrangespec& range) {
+  if (robj_->encoding() == OBJ_ENCODING_LISTPACK) {
+    uint8_t* zl = (uint8_t*)robj_->inner_obj();
+    uint8_t* eptr = zzlFirstInRange(zl, &range);
+    uint8_t* sptr = eptr ? lpNext(zl, eptr) : nullptr;
+    while (eptr) {
+      double score = zzlGetScore(sptr);
+      if (!zslValueLteMax(score, &range))
+        break;
+      if (!Add(score, eptr))
+        return false;
+      zzlNext(zl, &eptr, &sptr);
+    }
+    return true;
+  }
+
+  auto* zs = static_cast<const detail::SortedMap*>(robj_->inner_obj());
+  return zs->IterateByScore(range, [this](sds ele, double score) { return Add(score, ele); });
+}
+
+bool GeoCollector::Flush() {
+  size_t len = batch_len_;
+  batch_len_ = 0;
+
+  double xy[kGeoBatchSize][2];
+  bool decoded[kGeoBatchSize];
+  for (size_t i = 0; i < len; ++i) {
+    GeoHashBits hash = {.bits = (uint64_t)scores_[i], .step = GEO_STEP_MAX};
+    decoded[i] = geohashDecodeToLongLatWGS84(hash, xy[i]);
+  }
+
+  bool inside[kGeoBatchSize];
+  for (size_t i = 0; i < len; ++i) {
+    inside[i] = decoded[i] && bounds_.Contains(xy[i][0], xy[i][1]);
+  }
+
+  for (size_t i = 0; i < len; ++i) {
+    if (!inside[i])
+      continue;
+
+    // Same checks as geoWithinShape, on the already decoded point.
+    double dist;
+    if (shape_.type == CIRCULAR_TYPE) {
+      if (!geohashGetDistanceIfInRadiusWGS84(shape_.xy[0], shape_.xy[1], xy[i][0], xy[i][1],
+                                             shape_.t.radius * shape_.conversion, &dist))
+        continue;
+    } else if (!geohashGetDistanceIfInRectangle(shape_.t.r.width * shape_.conversion,
+                                                shape_.t.r.height * shape_.conversion,
+                                                shape_.xy[0], shape_.xy[1], xy[i][0], xy[i][1],
+                                                &dist)) {
+      continue;
+    }
+
+    if (!Accepts(dist))
+      continue;
+
+    GeoPoint point(xy[i][0], xy[i][1], dist, scores_[i], Member(refs_[i]));
+    if (top_k_ == 0) {
+      points_.push_back(std::move(point));
+      if (limit_ > 0 && points_.size() >= limit_)
+        return false;
+      continue;
+    }
+
+    auto cmp = [this](const GeoPoint& a, const GeoPoint& b) { return Better(a, b); };
+    if (points_.size() == top_k_) {
+      pop_heap(points_.begin(), points_.end(), cmp);
+      points_.back() = std::move(point);
+    } else {
+      points_.push_back(std::move(point));
+    }
+    push_heap(points_.begin(), points_.end(), cmp);
+  }
+  return true;
+}
+
+string GeoCollector::Member(const void* ref) const {
+  if (robj_->encoding() == OBJ_ENCODING_LISTPACK) {
+    unsigned int vlen = 0;
+    long long vlong = 0;
+    uint8_t* vstr = lpGetValue((uint8_t*)ref, &vlen, &vlong);
+    return vstr ? string{reinterpret_cast<const char*>(vstr), vlen} : absl::StrCat(vlong);
+  }
+  sds ele = (sds)ref;
+  return string{ele, sdslen(ele)};
+}
+
+OpResult<GeoArray> OpGeoSearch(const GeoShape& shape, const GeoHashRadius& radius,
+                               const GeoSearchOpts& opts, const OpArgs& op_args, string_view key) {
+  auto res_it = op_args.shard->db_slice().FindReadOnly(op_args.db_cntx, key, OBJ_ZSET);
+  if (!res_it)
+    return res_it.status();
+
+  const PrimeValue& pv = res_it.value()->second;
+  GeoCollector collector(shape, opts, pv.GetRobjWrapper());
+  return collector.Search(radius);
 }
 
 void SortIfNeeded(GeoArray* ga, Sorting sorting, uint64_t count) {
@@ -2842,7 +3438,7 @@ void SortIfNeeded(GeoArray* ga, Sorting sorting, uint64_t count) {
     }
   };
 
-  if (count > 0) {
+  if (count > 0 && count < ga->size()) {
     std::partial_sort(ga->begin(), ga->begin() + count, ga->end(), comparator);
     ga->resize(count);
   } else {
@@ -2908,39 +3504,26 @@ void GeoSearchStoreGeneric(ConnectionContext* cntx, const GeoShape& shape_ref, s
   DCHECK(shape->xy[0] >= -180.0 && shape->xy[0] <= 180.0);
   DCHECK(shape->xy[1] >= -90.0 && shape->xy[1] <= 90.0);
 
-  // query
+  // As in Redis, COUNT without ANY returns the nearest members.
+  GeoSearchOpts opts = geo_ops;
+  if (opts.count > 0 && !opts.any && opts.sorting == Sorting::kUnsorted)
+    opts.sorting = Sorting::kAsc;
+
+  // query, the matching members are filtered on the shard
   GeoHashRadius georadius = geohashCalculateAreasByShapeWGS84(shape);
   GeoArray ga;
-  auto range_specs = GetGeoRangeSpec(georadius);
-  // get all the matching members and add them to the potential result list
-  vector<OpResult<vector<ScoredArray>>> result_arrays;
   auto cb = [&](Transaction* t, EngineShard* shard) {
-    auto res_it = OpRanges(range_specs, t->GetOpArgs(shard), key);
-    if (res_it) {
-      result_arrays.emplace_back(res_it);
+    if (shard->shard_id() == from_shard) {
+      auto res = OpGeoSearch(*shape, georadius, opts, t->GetOpArgs(shard), key);
+      if (res)
+        ga = std::move(*res);
     }
     return OpStatus::OK;
   };
   cntx->transaction->Execute(std::move(cb), geo_ops.store == GeoStoreType::kNoStore);
 
-  // filter potential result list
-  double xy[2];
-  double distance;
-  unsigned long limit = geo_ops.any ? geo_ops.count : 0;
-  for (auto& result_array : result_arrays) {
-    for (auto& arr : *result_array) {
-      for (auto& p : arr) {
-        if (geoWithinShape(shape, p.second, xy, &distance) == 0) {
-          ga.emplace_back(xy[0], xy[1], distance, p.second, p.first);
-          if (limit > 0 && ga.size() >= limit)
-            break;
-        }
-      }
-    }
-  }
-
   // sort and trim by count
-  SortIfNeeded(&ga, geo_ops.sorting, geo_ops.count);
+  SortIfNeeded(&ga, opts.sorting, opts.count);
 
   if (geo_ops.store == GeoStoreType::kNoStore) {
     // case 1: read mode
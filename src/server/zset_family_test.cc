@@ -628,6 +628,31 @@ TEST_F(ZSetFamilyTest, ZUnionStoreOpts) {
   EXPECT_THAT(resp.GetVec(), ElementsAre("c", "0", "a", "2", "b", "4"));
 }
 
+TEST_F(ZSetFamilyTest, ZUnionStoreLarge) {
+  // Large enough for the partial results to be merged in parallel.
+  for (unsigned i = 0; i < 3; ++i) {
+    vector<string> args = {"zadd", absl::StrCat("z", i)};
+    for (unsigned j = i * 2000; j < i * 2000 + 3000; ++j) {
+      args.push_back(absl::StrCat(i + 1));
+      args.push_back(absl::StrCat("m", j));
+    }
+    Run(absl::MakeSpan(args));
+  }
+
+  EXPECT_EQ(7000, CheckedInt({"zunionstore", "u", "3", "z0", "z1", "z2"}));
+  EXPECT_EQ(7000, CheckedInt({"zcard", "u"}));
+  EXPECT_EQ("1", Run({"zscore", "u", "m0"}));
+  EXPECT_EQ("3", Run({"zscore", "u", "m2500"}));
+  EXPECT_EQ("5", Run({"zscore", "u", "m4500"}));
+
+  EXPECT_EQ(7000, CheckedInt({"zunionstore", "u", "3", "z0", "z1", "z2", "aggregate", "max"}));
+  EXPECT_EQ("3", Run({"zscore", "u", "m4500"}));
+
+  Run({"set", "str", "foo"});
+  EXPECT_THAT(Run({"zunionstore", "u", "2", "z0", "str"}), ErrArg("WRONGTYPE"));
+  EXPECT_EQ(7000, CheckedInt({"zcard", "u"}));
+}
+
 TEST_F(ZSetFamilyTest, ZInterStore) {
   EXPECT_EQ(2, CheckedInt({"zadd", "z1", "1", "a", "2", "b"}));
   EXPECT_EQ(2, CheckedInt({"zadd", "z2", "3", "c", "2", "b"}));
@@ -685,6 +710,36 @@ TEST_F(ZSetFamilyTest, ZInterCard) {
   EXPECT_EQ(2, CheckedInt({"zintercard", "2", "z1", "s2"}));
 }
 
+TEST_F(ZSetFamilyTest, ZInterMixedEncodings) {
+  // Intsets only.
+  Run({"sadd", "s1", "1", "2", "3"});
+  Run({"sadd", "s2", "2", "3", "4"});
+  auto resp = Run({"zinter", "2", "s1", "s2", "weights", "2", "3", "withscores"});
+  EXPECT_THAT(resp.GetVec(), ElementsAre("2", "5", "3", "5"));
+  resp = Run({"zinter", "2", "s1", "s2", "weights", "2", "3", "aggregate", "max", "withscores"});
+  EXPECT_THAT(resp.GetVec(), ElementsAre("2", "3", "3", "3"));
+  EXPECT_EQ(1, CheckedInt({"zintercard", "2", "s1", "s2", "LIMIT", "1"}));
+
+  // A skiplist, a listpack and a string set.
+  for (unsigned i = 0; i < 300; ++i) {
+    Run({"zadd", "large", absl::StrCat(i), absl::StrCat("m", i)});
+  }
+  for (unsigned i = 0; i < 50; ++i) {
+    Run({"zadd", "small", "1", absl::StrCat("m", i * 10)});
+    Run({"sadd", "strs", absl::StrCat("m", i * 20)});
+  }
+  EXPECT_EQ(30, CheckedInt({"zintercard", "2", "large", "small"}));
+  EXPECT_EQ(15, CheckedInt({"zintercard", "3", "large", "small", "strs"}));
+  EXPECT_EQ(7, CheckedInt({"zintercard", "3", "large", "small", "strs", "LIMIT", "7"}));
+
+  resp = Run({"zinter", "3", "large", "small", "strs", "withscores"});
+  ASSERT_THAT(resp, ArrLen(30));
+  EXPECT_THAT(resp.GetVec()[0], "m0");
+  EXPECT_THAT(resp.GetVec()[1], "2");
+  EXPECT_THAT(resp.GetVec()[28], "m280");
+  EXPECT_THAT(resp.GetVec()[29], "282");
+}
+
 TEST_F(ZSetFamilyTest, ZAddBug148) {
   auto resp = Run({"zadd", "key", "1", "9fe9f1eb"});
   EXPECT_THAT(resp, IntArg(1));
@@ -1108,4 +1163,64 @@ TEST_F(ZSetFamilyTest, GeoRadiusByMember) {
                            "WITHHASH and WITHCOORDS options"));
 }
 
+TEST_F(ZSetFamilyTest, GeoSearchDense) {
+  // Enough points around Berlin for the search to split the geohash cells
+  vector<string> args = {"geoadd", "points"};
+  for (unsigned i = 0; i < 40; ++i) {
+    for (unsigned j = 0; j < 40; ++j) {
+      args.push_back(absl::StrCat(13.38 + i * 0.001));
+      args.push_back(absl::StrCat(52.50 + j * 0.0007));
+      args.push_back(absl::StrCat("p", i, "_", j));
+    }
+  }
+  EXPECT_THAT(Run(absl::MakeSpan(args)), IntArg(1600));
+
+  auto dists = [&](std::initializer_list<const std::string_view> cmd) {
+    auto resp = Run(cmd);
+    vector<double> res;
+    for (const auto& item : resp.GetVec()) {
+      double dist = 0;
+      EXPECT_TRUE(absl::SimpleAtod(item.GetVec()[1].GetString(), &dist));
+      res.push_back(dist);
+    }
+    return res;
+  };
+
+  vector<double> all = dists({"GEOSEARCH", "points", "FROMLONLAT", "13.40", "52.51", "BYRADIUS",
+                              "500", "M", "ASC", "WITHDIST"});
+  ASSERT_GT(all.size(), 100u);
+  ASSERT_LT(all.size(), 1600u);
+  EXPECT_TRUE(is_sorted(all.begin(), all.end()));
+  EXPECT_LE(all.back(), 500);
+
+  vector<double> unsorted = dists(
+      {"GEOSEARCH", "points", "FROMLONLAT", "13.40", "52.51", "BYRADIUS", "500", "M", "WITHDIST"});
+  sort(unsorted.begin(), unsorted.end());
+  EXPECT_EQ(unsorted, all);
+
+  // COUNT without ANY returns the nearest members, also when not sorted explicitly
+  vector<double> nearest(all.begin(), all.begin() + 10);
+  EXPECT_EQ(dists({"GEOSEARCH", "points", "FROMLONLAT", "13.40", "52.51", "BYRADIUS", "500", "M",
+                   "COUNT", "10", "WITHDIST"}),
+            nearest);
+  EXPECT_EQ(dists({"GEOSEARCH", "points", "FROMLONLAT", "13.40", "52.51", "BYRADIUS", "500", "M",
+                   "ASC", "COUNT", "10", "WITHDIST"}),
+            nearest);
+
+  vector<double> farthest(all.rbegin(), all.rbegin() + 10);
+  EXPECT_EQ(dists({"GEOSEARCH", "points", "FROMLONLAT", "13.40", "52.51", "BYRADIUS", "500", "M",
+                   "DESC", "COUNT", "10", "WITHDIST"}),
+            farthest);
+
+  EXPECT_EQ(dists({"GEOSEARCH", "points", "FROMLONLAT", "13.40", "52.51", "BYRADIUS", "500", "M",
+                   "COUNT", "10", "ANY", "WITHDIST"})
+                .size(),
+            10u);
+
+  vector<double> box = dists({"GEOSEARCH", "points", "FROMLONLAT", "13.40", "52.51", "BYBOX",
+                              "600", "400", "M", "ASC", "WITHDIST"});
+  ASSERT_GT(box.size(), 100u);
+  ASSERT_LT(box.size(), 1600u);
+}
+
 }  // namespace dfly
@@ -632,6 +632,83 @@ async def test_cluster_replica_sets_non_owned_keys(df_local_factory: DflyInstanc
         await close_clients(c_master, c_master_admin, c_replica, c_replica_admin)
 
 
+@dfly_args({"proactor_threads": 4, "cluster_mode": "yes"})
+async def test_cluster_replica_reads(df_local_factory: DflyInstanceFactory):
+    master = df_local_factory.create(port=BASE_PORT, admin_port=BASE_PORT + 1000)
+    replica = df_local_factory.create(port=BASE_PORT + 1, admin_port=BASE_PORT + 1001)
+    df_local_factory.start_all([master, replica])
+
+    c_master = master.client()
+    c_master_admin = master.admin_client()
+    c_replica = replica.client(single_connection_client=True)
+    c_replica_admin = replica.admin_client()
+
+    master_id = await get_node_id(c_master_admin)
+    replica_id = await get_node_id(c_replica_admin)
+    config = [
+        {
+            "slot_ranges": [{"start": 0, "end": 16383}],
+            "master": {"id": master_id, "ip": "localhost", "port": master.port},
+            "replicas": [{"id": replica_id, "ip": "localhost", "port": replica.port}],
+        }
+    ]
+    await push_config(json.dumps(config), [c_master_admin, c_replica_admin])
+
+    await c_master.set("key", "value")
+    await c_replica.execute_command("REPLICAOF", "localhost", master.port)
+    await check_all_replicas_finished([c_replica], c_master)
+
+    # Replicas serve reads unless the connection asks for the master.
+    assert await c_replica.get("key") == "value"
+    assert await c_replica.execute_command("READWRITE") == "OK"
+    with pytest.raises(redis.exceptions.ResponseError, match=rf"MOVED \d+ localhost:{master.port}"):
+        await c_replica.get("key")
+    assert await c_replica.execute_command("READONLY") == "OK"
+    assert await c_replica.get("key") == "value"
+
+    # Within the lag bound reads are served, without a link to the master they are redirected.
+    await c_replica_admin.config_set("cluster_replica_read_max_lag_ms", "10000")
+    assert await c_replica.get("key") == "value"
+
+    await close_clients(c_master, c_master_admin)
+    master.stop()
+    await asyncio.sleep(0.5)
+    with pytest.raises(redis.exceptions.ResponseError, match=r"MOVED"):
+        await c_replica.get("key")
+
+    await close_clients(c_replica, c_replica_admin)
+
+
+@dfly_args({"proactor_threads": 4, "cluster_mode": "yes", "cluster_cross_slot_forwarding": "true"})
+async def test_cluster_cross_slot_forwarding(df_local_factory: DflyInstanceFactory):
+    instances = [
+        df_local_factory.create(port=BASE_PORT + i, admin_port=BASE_PORT + i + 1000)
+        for i in range(2)
+    ]
+    df_local_factory.start_all(instances)
+
+    nodes = [(await create_node_info(instance)) for instance in instances]
+    nodes[0].slots = [(0, 8000)]
+    nodes[1].slots = [(8001, 16383)]
+    await push_config(json.dumps(generate_config(nodes)), [node.admin_client for node in nodes])
+
+    keys = [f"key{i}" for i in range(100)]
+    client = nodes[0].client
+    assert await client.mset({k: f"value{k}" for k in keys})
+    assert await client.mget(keys) == [f"value{k}" for k in keys]
+    assert await nodes[1].client.mget(keys + ["missing"]) == [f"value{k}" for k in keys] + [None]
+
+    # Every node stores the keys of its own slots.
+    assert await nodes[0].client.dbsize() + await nodes[1].client.dbsize() == 100
+    assert 0 < await nodes[0].client.dbsize() < 100
+
+    assert await client.delete(*keys, "missing") == 100
+    assert await nodes[0].client.dbsize() == 0
+    assert await nodes[1].client.dbsize() == 0
+
+    await close_clients(*[node.client for node in nodes], *[node.admin_client for node in nodes])
+
+
 @dfly_args({"proactor_threads": 4, "cluster_mode": "yes"})
 async def test_cluster_flush_slots_after_config_change(df_local_factory: DflyInstanceFactory):
     # Start and configure cluster with 1 master and 1 replica, both own all slots
@@ -1201,6 +1278,55 @@ async def test_migration_with_key_ttl(df_local_factory):
     await close_clients(*[node.client for node in nodes], *[node.admin_client for node in nodes])
 
 
+@dfly_args({"proactor_threads": 2, "cluster_mode": "yes", "serialization_max_chunk_size": 1000})
+async def test_migration_of_big_containers(df_local_factory):
+    instances = [
+        df_local_factory.create(port=BASE_PORT + i, admin_port=BASE_PORT + i + 1000)
+        for i in range(2)
+    ]
+
+    df_local_factory.start_all(instances)
+
+    nodes = [(await create_node_info(instance)) for instance in instances]
+    nodes[0].slots = [(0, 16383)]
+    nodes[1].slots = []
+
+    await push_config(json.dumps(generate_config(nodes)), [node.admin_client for node in nodes])
+
+    # Every container is much bigger than a chunk, so it is sent in several commands.
+    client = nodes[0].client
+    await client.hset("hash", mapping={f"f{i}": f"v{i}" for i in range(1000)})
+    await client.sadd("set", *[f"m{i}" for i in range(1000)])
+    await client.zadd("zset", {f"m{i}": i + 0.5 for i in range(1000)})
+    await client.rpush("list", *[f"e{i}" for i in range(1000)])
+    await client.expire("list", 100)
+    assert await client.execute_command("stick hash") == 1
+
+    nodes[0].migrations.append(
+        MigrationInfo("127.0.0.1", instances[1].admin_port, [(0, 16383)], nodes[1].id)
+    )
+    await push_config(json.dumps(generate_config(nodes)), [node.admin_client for node in nodes])
+
+    await wait_for_status(nodes[0].admin_client, nodes[1].id, "FINISHED")
+
+    nodes[0].migrations = []
+    nodes[0].slots = []
+    nodes[1].slots = [(0, 16383)]
+    await push_config(json.dumps(generate_config(nodes)), [node.admin_client for node in nodes])
+
+    target = nodes[1].client
+    assert await target.hgetall("hash") == {f"f{i}": f"v{i}" for i in range(1000)}
+    assert await target.smembers("set") == {f"m{i}" for i in range(1000)}
+    assert await target.zrange("zset", 0, -1, withscores=True) == [
+        (f"m{i}", i + 0.5) for i in range(1000)
+    ]
+    assert await target.lrange("list", 0, -1) == [f"e{i}" for i in range(1000)]
+    assert await target.ttl("list") > 0
+    assert await target.execute_command("stick hash") == 0
+
+    await close_clients(*[node.client for node in nodes], *[node.admin_client for node in nodes])
+
+
 @dfly_args({"proactor_threads": 4, "cluster_mode": "yes"})
 async def test_network_disconnect_during_migration(df_local_factory, df_seeder_factory):
     instances = [
@@ -436,6 +436,30 @@ async def test_keyspace_events(async_client: aioredis.Redis):
     assert set(ev["data"] for ev in events) == set(keys)
 
 
+@dfly_args({"notify_keyspace_events": "Ex", "keyspace_events_compact": True})
+async def test_keyspace_events_compact(async_client: aioredis.Redis):
+    pclient = async_client.pubsub()
+    await pclient.subscribe("__keyevent@0__:expired")
+
+    keys = [f"k{i}" for i in range(100)]
+    for key in keys:
+        await async_client.set(key, "X", px=200)
+
+    # Each message holds the keys of a heartbeat as a RESP array.
+    expired = []
+    async for message in pclient.listen():
+        if message["type"] == "subscribe":
+            continue
+
+        lines = message["data"].split("\r\n")
+        assert lines[0] == f"*{(len(lines) - 1) // 2}"
+        expired += lines[2::2]
+        if len(expired) >= len(keys):
+            break
+
+    assert sorted(expired) == sorted(keys)
+
+
 async def test_big_command(df_server, size=8 * 1024):
     reader, writer = await asyncio.open_connection("127.0.0.1", df_server.port)
 
@@ -646,6 +670,9 @@ async def test_squashed_pipeline(async_client: aioredis.Redis):
         assert isinstance(res[10], aioredis.ResponseError)
         res = res[11:]
 
+    info = await async_client.info("stats")
+    assert info["total_pipelined_squash_batches"] > 0
+
 
 @dfly_args({"proactor_threads": "4", "pipeline_squash": 10})
 async def test_squashed_pipeline_seeder(df_server, df_seeder_factory):
@@ -677,6 +704,29 @@ async def test_squashed_pipeline_multi(async_client: aioredis.Redis):
     await p.execute()
 
 
+@dfly_args(
+    {
+        "proactor_threads": "1",
+        "pipeline_squash": 0,
+        "dispatch_budget_usec": 1,
+        "dispatch_class_weights": "batch:4",
+    }
+)
+async def test_dispatch_budget(df_server, async_client: aioredis.Redis):
+    await async_client.execute_command("CLIENT SETINFO CLASS batch")
+    p = async_client.pipeline(transaction=False)
+    for i in range(500):
+        p.set(f"k{i}", "x" * 100)
+    await p.execute()
+
+    info = await async_client.info("stats")
+    assert info["dispatch_budget_yields"] > 0
+
+    metrics = await df_server.metrics()
+    samples = metrics["dragonfly_dispatch_queue_commands"].samples
+    assert any(s.labels["class"] == "batch" and s.value > 0 for s in samples)
+
+
 async def test_unix_domain_socket(df_local_factory, tmp_dir):
     server = df_local_factory.create(proactor_threads=1, port=BASE_PORT, unixsocket="./df.sock")
     server.start()
@@ -836,3 +886,28 @@ async def test_tls_when_read_write_is_interleaved(
     client = aioredis.Redis(port=server.port, **with_ca_tls_client_args)
     await client.execute_command("GET foo")
     await client.close()
+
+
+@dfly_args({"proactor_threads": 2, "get_zero_copy_min_size": 1024})
+async def test_zero_copy_get_expires_while_sending(
+    async_client: aioredis.Redis, df_server: DflyInstance
+):
+    # The raw connection is not drained, so its large reply is still being sent when the key
+    # expires and another reader deletes it lazily.
+    value = b"x" * (32 << 20)
+    await async_client.set("large", value, px=200)
+
+    reader, writer = await asyncio.open_connection("localhost", df_server.port, limit=1 << 16)
+    writer.write(b"GET large\r\n")
+    await writer.drain()
+
+    await asyncio.sleep(0.5)
+    assert await async_client.exists("large") == 0
+    await async_client.set("other", b"y" * (32 << 20))
+
+    assert await reader.readline() == f"${len(value)}\r\n".encode()
+    body = await reader.readexactly(len(value) + 2)
+    assert body[:-2] == value
+
+    writer.close()
+    await writer.wait_closed()
@@ -116,6 +116,32 @@ async def test_http_api(df_server: DflyInstance):
     assert await client.ttl("foo") > 0
 
 
+@dfly_args({"proactor_threads": "2", "expose_http_api": "true"})
+async def test_http_api_batch(df_server: DflyInstance):
+    async with get_http_session() as session:
+        commands = [["set", f"key{i}", f"val{i}"] for i in range(100)]
+        commands += [["mget", "key0", "key99"], ["foo"], ["lrange", "key0", "0", "-1"]]
+        async with session.post(f"http://localhost:{df_server.port}/api", json=commands) as resp:
+            assert resp.status == 200
+            replies = await resp.json()
+
+        assert len(replies) == len(commands)
+        assert all(reply == {"result": "OK"} for reply in replies[:100])
+        assert replies[100] == {"result": ["val0", "val99"]}
+        assert replies[101] == {"error": "unknown command `FOO`"}
+        assert "error" in replies[102]
+
+        # The connection is reused for the next request.
+        body = '["get", "key1"]'
+        async with session.post(f"http://localhost:{df_server.port}/api", data=body) as resp:
+            assert resp.status == 200
+            assert await resp.json() == {"result": "val1"}
+
+        body = '[["ping"], "ping"]'
+        async with session.post(f"http://localhost:{df_server.port}/api", data=body) as resp:
+            assert resp.status == 400
+
+
 @dfly_args({"proactor_threads": "1", "expose_http_api": "true", "requirepass": "XXX"})
 async def test_password_on_http_api(df_server: DflyInstance):
     async with get_http_session("default", "badpass") as session:
@@ -1927,6 +1927,42 @@ async def test_replicaof_reject_on_load(df_local_factory, df_seeder_factory):
     replica.stop()
 
 
+async def test_replica_snapshot_partial_sync(df_local_factory, df_seeder_factory):
+    tmp_file_name = "".join(random.choices(string.ascii_letters, k=10))
+    master = df_local_factory.create(proactor_threads=2, shard_repl_backlog_len=1 << 14)
+    replica = df_local_factory.create(proactor_threads=2, dbfilename=f"dump_{tmp_file_name}")
+    df_local_factory.start_all([master, replica])
+
+    seeder = df_seeder_factory.create(port=master.port, keys=1000)
+    await seeder.run(target_deviation=0.1)
+
+    c_master = master.client()
+    c_replica = replica.client()
+    await c_replica.execute_command(f"REPLICAOF localhost {master.port}")
+    await wait_for_replicas_state(c_replica)
+    await check_all_replicas_finished([c_replica], c_master)
+    await c_replica.execute_command("SAVE DF")
+    await c_replica.close()
+    replica.stop()
+
+    # The restored replica fetches only the changes done since its snapshot.
+    await seeder.run(target_ops=1000)
+    replica.start()
+    c_replica = replica.client()
+    await wait_available_async(c_replica)
+    await c_replica.execute_command(f"REPLICAOF localhost {master.port}")
+    await wait_for_replicas_state(c_replica)
+    await check_all_replicas_finished([c_replica], c_master)
+
+    capture = await seeder.capture()
+    assert await seeder.compare(capture, replica.port)
+
+    await disconnect_clients(c_master, c_replica)
+    master.stop()
+    replica.stop()
+    assert replica.is_in_logs("Started partial sync")
+
+
 @pytest.mark.asyncio
 async def test_heartbeat_eviction_propagation(df_local_factory):
     master = df_local_factory.create(
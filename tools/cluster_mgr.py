@@ -422,6 +422,55 @@ def migrate(args):
     move(args)
 
 
+def suggest_rebalance(args):
+    """Proposes slot migrations that even out the operations per second of the masters, based on
+    the decayed slot load every master reports with CLUSTER SLOT-STATS."""
+    config = build_config_from_existing(args)
+
+    masters = []
+    for shard in config:
+        node = Node(shard["master"]["ip"], shard["master"]["port"])
+        stats = send_command(
+            node, ["cluster", "slot-stats", "orderby", "ops-per-sec", "limit", "16384"]
+        )
+        slots = {int(slot): float(dict(zip(m[::2], m[1::2]))["ops-per-sec"]) for slot, m in stats}
+        masters.append({"node": node, "slots": slots, "load": sum(slots.values())})
+
+    total = sum(m["load"] for m in masters)
+    if len(masters) < 2 or total == 0:
+        print("No load to rebalance")
+        return
+
+    moves = []
+    for _ in range(args.max_moves):
+        hot = max(masters, key=lambda m: m["load"])
+        cold = min(masters, key=lambda m: m["load"])
+        gap = hot["load"] - cold["load"]
+        # Moving a slot helps only if it is cooler than the gap, the hottest such slot helps most.
+        candidates = [(load, slot) for slot, load in hot["slots"].items() if 0 < load < gap]
+        if not candidates or gap / total < args.rebalance_threshold:
+            break
+        load, slot = max(candidates)
+        del hot["slots"][slot]
+        cold["slots"][slot] = load
+        hot["load"] -= load
+        cold["load"] += load
+        moves.append((slot, load, hot["node"], cold["node"]))
+
+    if not moves:
+        print("The load is balanced")
+        return
+
+    for slot, load, src, dst in moves:
+        print(
+            f"- Slot {slot} ({load:.0f} ops/s) from {src.host}:{src.port} to {dst.host}:{dst.port}:"
+            f" ./cluster_mgr.py --action=migrate --slot_start={slot} --slot_end={slot}"
+            f" --target_host={dst.host} --target_port={dst.port}"
+        )
+    for m in masters:
+        print(f"Load of {m['node'].host}:{m['node'].port} after the moves: {m['load']:.0f} ops/s")
+
+
 def print_config(args):
     config = build_config_from_existing(args)
     print(json.dumps(config, indent=2))
@@ -498,6 +547,11 @@ Migrate slots 10-20 to target:
   ./cluster_mgr.py --action=migrate --slot_start=10 --slot_end=20 --target_host=X --target_port=X
 Unlike --action=move above, this will migrate the data to the new owner.
 
+Suggest slot migrations that even out the load of the masters:
+  ./cluster_mgr.py --action=suggest_rebalance
+This only prints the suggested `--action=migrate` commands, based on the load of the last seconds.
+Tune with `--max_moves` and `--rebalance_threshold`.
+
 Connect to cluster and shutdown all nodes:
   ./cluster_mgr.py --action=shutdown
 WARNING: Be careful! This will close all Dragonfly servers connected to the cluster.
@@ -534,6 +588,15 @@ WARNING: Be careful! This will close all Dragonfly servers connected to the clus
     parser.add_argument(
         "--attach_as_replica", type=bool, default=False, help="Is the attached node a replica?"
     )
+    parser.add_argument(
+        "--max_moves", type=int, default=10, help="Max slot moves to suggest for rebalancing"
+    )
+    parser.add_argument(
+        "--rebalance_threshold",
+        type=float,
+        default=0.1,
+        help="Stop suggesting moves once the load gap of masters is below this share of the total",
+    )
     args = parser.parse_args()
 
     actions = dict(
@@ -549,6 +612,7 @@ WARNING: Be careful! This will close all Dragonfly servers connected to the clus
                 move,
                 print_config,
                 migrate,
+                suggest_rebalance,
             ]
         ]
     )